@@ -364,9 +364,8 @@ EXPORT_SYMBOL(__ioremap);
 void __iounmap(void __iomem *addr)
 {
 #ifndef CONFIG_SMP
-	struct vm_struct **p, *tmp;
+	struct vm_struct *tmp;
 #endif
-	unsigned int section_mapping = 0;
 
 	addr = (void __iomem *)(PAGE_MASK & (unsigned long)addr);
 
@@ -374,27 +373,15 @@ void __iounmap(void __iomem *addr)
 	/*
 	 * If this is a section based mapping we need to handle it
 	 * specially as the VM subysystem does not know how to handle
-	 * such a beast. We need the lock here b/c we need to clear
-	 * all the mappings before the area can be reclaimed
-	 * by someone else.
+	 * such a beast.  Clear the section mappings here; vunmap() then
+	 * finds no ptes below them and just releases the area.
 	 */
-	write_lock(&vmlist_lock);
-	for (p = &vmlist ; (tmp = *p) ; p = &tmp->next) {
-		if((tmp->flags & VM_IOREMAP) && (tmp->addr == addr)) {
-			if (tmp->flags & VM_ARM_SECTION_MAPPING) {
-				*p = tmp->next;
-				unmap_area_sections((unsigned long)tmp->addr,
-						    tmp->size);
-				kfree(tmp);
-				section_mapping = 1;
-			}
-			break;
-		}
-	}
-	write_unlock(&vmlist_lock);
+	tmp = find_vm_area((void *)addr);
+	if (tmp && (tmp->flags & VM_IOREMAP) &&
+	    (tmp->flags & VM_ARM_SECTION_MAPPING))
+		unmap_area_sections((unsigned long)tmp->addr, tmp->size);
 #endif
 
-	if (!section_mapping)
-		vunmap(addr);
+	vunmap(addr);
 }
 EXPORT_SYMBOL(__iounmap);
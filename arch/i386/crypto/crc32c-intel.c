@@ -0,0 +1,156 @@
+/*
+ * Cryptographic API.
+ *
+ * CRC32C chksum using the crc32 instruction of SSE4.2, which folds in a
+ * byte, or 4 bytes (8 on x86_64), per instruction.  Registered as
+ * "crc32c" at a higher priority than the table-driven crypto/crc32c.c,
+ * so iSCSI and the other crypto API users get it where the cpu has it;
+ * the module refuses to load where it does not.
+ *
+ * Shared by i386 and x86_64.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ */
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/string.h>
+#include <linux/kernel.h>
+#include <linux/crypto.h>
+#include <linux/types.h>
+#include <asm/cpufeature.h>
+
+#define CHKSUM_BLOCK_SIZE	32
+#define CHKSUM_DIGEST_SIZE	4
+
+/*
+ * The crc32 instruction is given as bytes for older assemblers:
+ * crc32b %cl,%esi and crc32l %ecx,%esi (crc32q %rcx,%rsi with REX.W).
+ */
+#ifdef CONFIG_X86_64
+#define REX_PRE		"0x48, "
+#define SCALE_F		8
+#else
+#define REX_PRE
+#define SCALE_F		4
+#endif
+
+struct chksum_ctx {
+	u32 crc;
+};
+
+static u32 crc32c_intel_byte(u32 crc, unsigned char const *data,
+			     size_t length)
+{
+	while (length--) {
+		__asm__ __volatile__(
+			".byte 0xf2, 0x0f, 0x38, 0xf0, 0xf1"
+			: "=S" (crc)
+			: "0" (crc), "c" (*data));
+		data++;
+	}
+	return crc;
+}
+
+static u32 crc32c_intel(u32 crc, unsigned char const *data, size_t length)
+{
+	unsigned long const *p;
+	size_t n;
+
+	/* the instruction takes misaligned words, but more slowly */
+	n = -(unsigned long)data & (SCALE_F - 1);
+	if (n > length)
+		n = length;
+	crc = crc32c_intel_byte(crc, data, n);
+	data += n;
+	length -= n;
+
+	p = (unsigned long const *)data;
+	for (n = length / SCALE_F; n; n--, p++)
+		__asm__ __volatile__(
+			".byte 0xf2, " REX_PRE "0x0f, 0x38, 0xf1, 0xf1"
+			: "=S" (crc)
+			: "0" (crc), "c" (*p));
+
+	return crc32c_intel_byte(crc, (unsigned char const *)p,
+				 length & (SCALE_F - 1));
+}
+
+static void chksum_init(struct crypto_tfm *tfm)
+{
+	struct chksum_ctx *mctx = crypto_tfm_ctx(tfm);
+
+	mctx->crc = ~(u32)0;
+}
+
+/* As in crypto/crc32c.c: the key is the seed. */
+static int chksum_setkey(struct crypto_tfm *tfm, const u8 *key,
+			 unsigned int keylen, u32 *flags)
+{
+	struct chksum_ctx *mctx = crypto_tfm_ctx(tfm);
+
+	if (keylen != sizeof(mctx->crc)) {
+		if (flags)
+			*flags = CRYPTO_TFM_RES_BAD_KEY_LEN;
+		return -EINVAL;
+	}
+	mctx->crc = *(u32 *)key;
+	return 0;
+}
+
+static void chksum_update(struct crypto_tfm *tfm, const u8 *data,
+			  unsigned int length)
+{
+	struct chksum_ctx *mctx = crypto_tfm_ctx(tfm);
+
+	mctx->crc = crc32c_intel(mctx->crc, data, length);
+}
+
+static void chksum_final(struct crypto_tfm *tfm, u8 *out)
+{
+	struct chksum_ctx *mctx = crypto_tfm_ctx(tfm);
+
+	*(u32 *)out = ~mctx->crc;
+}
+
+static struct crypto_alg alg = {
+	.cra_name		=	"crc32c",
+	.cra_driver_name	=	"crc32c-intel",
+	.cra_priority		=	200,
+	.cra_flags		=	CRYPTO_ALG_TYPE_DIGEST,
+	.cra_blocksize		=	CHKSUM_BLOCK_SIZE,
+	.cra_ctxsize		=	sizeof(struct chksum_ctx),
+	.cra_module		=	THIS_MODULE,
+	.cra_list		=	LIST_HEAD_INIT(alg.cra_list),
+	.cra_u			=	{
+		.digest = {
+			.dia_digestsize	=	CHKSUM_DIGEST_SIZE,
+			.dia_setkey	=	chksum_setkey,
+			.dia_init	=	chksum_init,
+			.dia_update	=	chksum_update,
+			.dia_final	=	chksum_final
+		}
+	}
+};
+
+static int __init crc32c_intel_mod_init(void)
+{
+	if (!cpu_has_xmm4_2)
+		return -ENODEV;
+	return crypto_register_alg(&alg);
+}
+
+static void __exit crc32c_intel_mod_fini(void)
+{
+	crypto_unregister_alg(&alg);
+}
+
+module_init(crc32c_intel_mod_init);
+module_exit(crc32c_intel_mod_fini);
+
+MODULE_DESCRIPTION("CRC32c (Castagnoli) using the SSE4.2 crc32 instruction");
+MODULE_LICENSE("GPL");
+MODULE_ALIAS("crc32c");
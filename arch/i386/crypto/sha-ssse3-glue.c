@@ -0,0 +1,368 @@
+/*
+ * Cryptographic API.
+ *
+ * SHA1 and SHA256 with the message schedule computed four words at a
+ * time with SSSE3 (sha-ssse3-asm.S) and the rounds in C.  Registered as
+ * "sha1" and "sha256" above the generic implementations, for cpus with
+ * SSSE3; shared by i386 and x86_64.
+ *
+ * The xmm registers are only borrowed where kernel_fpu_begin() is safe:
+ * in process context, or in an interrupt that came in neither over a
+ * task's live fpu state nor over another kernel_fpu_begin() section.
+ * Elsewhere the schedule is computed in C and the result is the same.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ */
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/string.h>
+#include <linux/crypto.h>
+#include <linux/types.h>
+#include <linux/bitops.h>
+#include <linux/hardirq.h>
+#include <asm/byteorder.h>
+#include <asm/cpufeature.h>
+#include <asm/i387.h>
+#include <asm/system.h>
+
+#define SHA1_DIGEST_SIZE	20
+#define SHA256_DIGEST_SIZE	32
+#define SHA_HMAC_BLOCK_SIZE	64
+
+asmlinkage void sha1_schedule_ssse3(u32 *wk, const u8 *data);
+asmlinkage void sha256_schedule_ssse3(u32 *wk, const u8 *data);
+
+struct sha_ssse3_ctx {
+	u64 count;
+	u32 state[8];
+	u8 buffer[SHA_HMAC_BLOCK_SIZE];
+};
+
+/* Runs the rounds for one block; wk is scratch for the schedule */
+typedef void (sha_block_fn)(u32 *state, const u8 *data, u32 *wk, int simd);
+
+static int sha_ssse3_usable(void)
+{
+	if (!in_interrupt())
+		return 1;
+	/* both cases leave CR0.TS clear */
+	return !(current_thread_info()->status & TS_USEDFPU) &&
+	       (read_cr0() & 8);
+}
+
+static const u32 sha1_k[4] = {
+	0x5a827999, 0x6ed9eba1, 0x8f1bbcdc, 0xca62c1d6
+};
+
+static void sha1_schedule(u32 *wk, const u8 *data)
+{
+	int i;
+
+	for (i = 0; i < 16; i++)
+		wk[i] = be32_to_cpu(((const __be32 *)data)[i]);
+	for (; i < 80; i++)
+		wk[i] = rol32(wk[i-3] ^ wk[i-8] ^ wk[i-14] ^ wk[i-16], 1);
+	for (i = 0; i < 80; i++)
+		wk[i] += sha1_k[i / 20];
+}
+
+#define SHA1_ROUND(f) do {						\
+	t = rol32(a, 5) + (f) + e + wk[i];				\
+	e = d; d = c; c = rol32(b, 30); b = a; a = t;			\
+} while (0)
+
+static void sha1_block(u32 *state, const u8 *data, u32 *wk, int simd)
+{
+	u32 a, b, c, d, e, t;
+	int i;
+
+	if (simd)
+		sha1_schedule_ssse3(wk, data);
+	else
+		sha1_schedule(wk, data);
+
+	a = state[0];
+	b = state[1];
+	c = state[2];
+	d = state[3];
+	e = state[4];
+
+	for (i = 0; i < 20; i++)
+		SHA1_ROUND(d ^ (b & (c ^ d)));
+	for (; i < 40; i++)
+		SHA1_ROUND(b ^ c ^ d);
+	for (; i < 60; i++)
+		SHA1_ROUND((b & c) | (d & (b | c)));
+	for (; i < 80; i++)
+		SHA1_ROUND(b ^ c ^ d);
+
+	state[0] += a;
+	state[1] += b;
+	state[2] += c;
+	state[3] += d;
+	state[4] += e;
+}
+
+static const u32 sha256_k[64] = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
+	0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+	0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
+	0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
+	0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+	0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
+	0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5,
+	0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+	0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+#define e0(x)	(ror32(x, 2) ^ ror32(x, 13) ^ ror32(x, 22))
+#define e1(x)	(ror32(x, 6) ^ ror32(x, 11) ^ ror32(x, 25))
+#define s0(x)	(ror32(x, 7) ^ ror32(x, 18) ^ ((x) >> 3))
+#define s1(x)	(ror32(x, 17) ^ ror32(x, 19) ^ ((x) >> 10))
+
+static void sha256_schedule(u32 *wk, const u8 *data)
+{
+	int i;
+
+	for (i = 0; i < 16; i++)
+		wk[i] = be32_to_cpu(((const __be32 *)data)[i]);
+	for (; i < 64; i++)
+		wk[i] = s1(wk[i-2]) + wk[i-7] + s0(wk[i-15]) + wk[i-16];
+	for (i = 0; i < 64; i++)
+		wk[i] += sha256_k[i];
+}
+
+static void sha256_block(u32 *state, const u8 *data, u32 *wk, int simd)
+{
+	u32 a, b, c, d, e, f, g, h, t1, t2;
+	int i;
+
+	if (simd)
+		sha256_schedule_ssse3(wk, data);
+	else
+		sha256_schedule(wk, data);
+
+	a = state[0];
+	b = state[1];
+	c = state[2];
+	d = state[3];
+	e = state[4];
+	f = state[5];
+	g = state[6];
+	h = state[7];
+
+	for (i = 0; i < 64; i++) {
+		t1 = h + e1(e) + (g ^ (e & (f ^ g))) + wk[i];
+		t2 = e0(a) + ((a & b) | (c & (a | b)));
+		h = g;
+		g = f;
+		f = e;
+		e = d + t1;
+		d = c;
+		c = b;
+		b = a;
+		a = t1 + t2;
+	}
+
+	state[0] += a;
+	state[1] += b;
+	state[2] += c;
+	state[3] += d;
+	state[4] += e;
+	state[5] += f;
+	state[6] += g;
+	state[7] += h;
+}
+
+/*
+ * SHA1 and SHA256 buffer and pad alike; only the block function and
+ * the length of the state differ.
+ */
+static void sha_ssse3_update(struct sha_ssse3_ctx *sctx, const u8 *data,
+			     unsigned int len, sha_block_fn *block)
+{
+	unsigned int partial = sctx->count & 0x3f;
+	u32 wk[80];
+	int simd;
+
+	sctx->count += len;
+	if (partial + len < SHA_HMAC_BLOCK_SIZE) {
+		memcpy(sctx->buffer + partial, data, len);
+		return;
+	}
+
+	simd = sha_ssse3_usable();
+	if (simd)
+		kernel_fpu_begin();
+
+	if (partial) {
+		unsigned int fill = SHA_HMAC_BLOCK_SIZE - partial;
+
+		memcpy(sctx->buffer + partial, data, fill);
+		block(sctx->state, sctx->buffer, wk, simd);
+		data += fill;
+		len -= fill;
+	}
+	for (; len >= SHA_HMAC_BLOCK_SIZE; len -= SHA_HMAC_BLOCK_SIZE) {
+		block(sctx->state, data, wk, simd);
+		data += SHA_HMAC_BLOCK_SIZE;
+	}
+
+	if (simd)
+		kernel_fpu_end();
+	memset(wk, 0, sizeof(wk));
+
+	memcpy(sctx->buffer, data, len);
+}
+
+static void sha_ssse3_final(struct sha_ssse3_ctx *sctx, u8 *out,
+			    unsigned int words, sha_block_fn *block)
+{
+	static const u8 padding[SHA_HMAC_BLOCK_SIZE] = { 0x80, };
+	__be32 *dst = (__be32 *)out;
+	unsigned int i, index, padlen;
+	__be64 bits;
+
+	bits = cpu_to_be64(sctx->count << 3);
+
+	/* Pad out to 56 mod 64 */
+	index = sctx->count & 0x3f;
+	padlen = (index < 56) ? (56 - index) : ((64+56) - index);
+	sha_ssse3_update(sctx, padding, padlen, block);
+
+	/* Append length */
+	sha_ssse3_update(sctx, (const u8 *)&bits, sizeof(bits), block);
+
+	for (i = 0; i < words; i++)
+		dst[i] = cpu_to_be32(sctx->state[i]);
+
+	/* Wipe context */
+	memset(sctx, 0, sizeof(*sctx));
+}
+
+static void sha1_ssse3_init(struct crypto_tfm *tfm)
+{
+	struct sha_ssse3_ctx *sctx = crypto_tfm_ctx(tfm);
+	static const struct sha_ssse3_ctx initstate = {
+		.state = { 0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476,
+			   0xc3d2e1f0 },
+	};
+
+	*sctx = initstate;
+}
+
+static void sha1_ssse3_update(struct crypto_tfm *tfm, const u8 *data,
+			      unsigned int len)
+{
+	sha_ssse3_update(crypto_tfm_ctx(tfm), data, len, sha1_block);
+}
+
+static void sha1_ssse3_final(struct crypto_tfm *tfm, u8 *out)
+{
+	sha_ssse3_final(crypto_tfm_ctx(tfm), out, SHA1_DIGEST_SIZE / 4,
+			sha1_block);
+}
+
+static void sha256_ssse3_init(struct crypto_tfm *tfm)
+{
+	struct sha_ssse3_ctx *sctx = crypto_tfm_ctx(tfm);
+	static const struct sha_ssse3_ctx initstate = {
+		.state = { 0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+			   0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19 },
+	};
+
+	*sctx = initstate;
+}
+
+static void sha256_ssse3_update(struct crypto_tfm *tfm, const u8 *data,
+				unsigned int len)
+{
+	sha_ssse3_update(crypto_tfm_ctx(tfm), data, len, sha256_block);
+}
+
+static void sha256_ssse3_final(struct crypto_tfm *tfm, u8 *out)
+{
+	sha_ssse3_final(crypto_tfm_ctx(tfm), out, SHA256_DIGEST_SIZE / 4,
+			sha256_block);
+}
+
+static struct crypto_alg sha1_alg = {
+	.cra_name		=	"sha1",
+	.cra_driver_name	=	"sha1-ssse3",
+	.cra_priority		=	200,
+	.cra_flags		=	CRYPTO_ALG_TYPE_DIGEST,
+	.cra_blocksize		=	SHA_HMAC_BLOCK_SIZE,
+	.cra_ctxsize		=	sizeof(struct sha_ssse3_ctx),
+	.cra_module		=	THIS_MODULE,
+	.cra_alignmask		=	3,
+	.cra_list		=	LIST_HEAD_INIT(sha1_alg.cra_list),
+	.cra_u			=	{
+		.digest = {
+			.dia_digestsize	=	SHA1_DIGEST_SIZE,
+			.dia_init	=	sha1_ssse3_init,
+			.dia_update	=	sha1_ssse3_update,
+			.dia_final	=	sha1_ssse3_final
+		}
+	}
+};
+
+static struct crypto_alg sha256_alg = {
+	.cra_name		=	"sha256",
+	.cra_driver_name	=	"sha256-ssse3",
+	.cra_priority		=	200,
+	.cra_flags		=	CRYPTO_ALG_TYPE_DIGEST,
+	.cra_blocksize		=	SHA_HMAC_BLOCK_SIZE,
+	.cra_ctxsize		=	sizeof(struct sha_ssse3_ctx),
+	.cra_module		=	THIS_MODULE,
+	.cra_alignmask		=	3,
+	.cra_list		=	LIST_HEAD_INIT(sha256_alg.cra_list),
+	.cra_u			=	{
+		.digest = {
+			.dia_digestsize	=	SHA256_DIGEST_SIZE,
+			.dia_init	=	sha256_ssse3_init,
+			.dia_update	=	sha256_ssse3_update,
+			.dia_final	=	sha256_ssse3_final
+		}
+	}
+};
+
+static int __init sha_ssse3_mod_init(void)
+{
+	int ret;
+
+	if (!cpu_has_fxsr || !cpu_has_ssse3)
+		return -ENODEV;
+
+	ret = crypto_register_alg(&sha1_alg);
+	if (ret)
+		return ret;
+	ret = crypto_register_alg(&sha256_alg);
+	if (ret)
+		crypto_unregister_alg(&sha1_alg);
+	return ret;
+}
+
+static void __exit sha_ssse3_mod_fini(void)
+{
+	crypto_unregister_alg(&sha256_alg);
+	crypto_unregister_alg(&sha1_alg);
+}
+
+module_init(sha_ssse3_mod_init);
+module_exit(sha_ssse3_mod_fini);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("SHA1 and SHA256 Secure Hash Algorithms, SSSE3 schedule");
+MODULE_ALIAS("sha1");
+MODULE_ALIAS("sha256");
@@ -31,6 +31,9 @@
 #include <linux/kprobes.h>
 #include <linux/ptrace.h>
 #include <linux/preempt.h>
+#include <linux/kallsyms.h>
+#include <linux/module.h>
+#include <linux/stop_machine.h>
 #include <asm/cacheflush.h>
 #include <asm/kdebug.h>
 #include <asm/desc.h>
@@ -740,7 +743,487 @@ int __kprobes longjmp_break_handler(struct kprobe *p, struct pt_regs *regs)
 	return 0;
 }
 
+#ifdef CONFIG_OPTPROBES
+/*
+ * Jump optimization: where the instructions under a probe can be shown
+ * safe to run elsewhere, the int3 is replaced by a jump to a detour
+ * buffer, which saves the registers, calls the pre_handler, restores
+ * them, runs a copy of the displaced instructions and jumps back after
+ * them.  No trap, and no single-step.
+ */
+
+/* What follows an opcode, for finding where instructions start */
+#define INAT_MODRM	0x01	/* a ModR/M byte */
+#define INAT_IMM8	0x02	/* an 8 bit immediate */
+#define INAT_IMM16	0x04	/* a 16 bit immediate */
+#define INAT_IMMZ	0x08	/* a 16 or 32 bit one, by operand size */
+#define INAT_MOFFS	0x10	/* a 32 bit address */
+#define INAT_REL	0x20	/* the immediate is a branch displacement */
+#define INAT_GRP3	0x40	/* an immediate with /0 and /1 only */
+#define INAT_BAD	0x80	/* not decoded */
+
+#define M	INAT_MODRM
+#define I8	INAT_IMM8
+#define IZ	INAT_IMMZ
+#define R8	(INAT_IMM8 | INAT_REL)
+#define RZ	(INAT_IMMZ | INAT_REL)
+#define MO	INAT_MOFFS
+#define X	INAT_BAD
+
+/* Prefixes and 0x0f are taken care of before these are looked at */
+static const u8 onebyte_attr[256] = {
+	/*    0     1     2     3     4     5     6     7    */
+	/*    8     9     a     b     c     d     e     f    */
+	M,    M,    M,    M,    I8,   IZ,   0,    0,	/* 00 */
+	M,    M,    M,    M,    I8,   IZ,   0,    0,
+	M,    M,    M,    M,    I8,   IZ,   0,    0,	/* 10 */
+	M,    M,    M,    M,    I8,   IZ,   0,    0,
+	M,    M,    M,    M,    I8,   IZ,   0,    0,	/* 20 */
+	M,    M,    M,    M,    I8,   IZ,   0,    0,
+	M,    M,    M,    M,    I8,   IZ,   0,    0,	/* 30 */
+	M,    M,    M,    M,    I8,   IZ,   0,    0,
+	0,    0,    0,    0,    0,    0,    0,    0,	/* 40 */
+	0,    0,    0,    0,    0,    0,    0,    0,
+	0,    0,    0,    0,    0,    0,    0,    0,	/* 50 */
+	0,    0,    0,    0,    0,    0,    0,    0,
+	0,    0,    M,    M,    0,    0,    0,    0,	/* 60 */
+	IZ,   M|IZ, I8,   M|I8, 0,    0,    0,    0,
+	R8,   R8,   R8,   R8,   R8,   R8,   R8,   R8,	/* 70 */
+	R8,   R8,   R8,   R8,   R8,   R8,   R8,   R8,
+	M|I8, M|IZ, M|I8, M|I8, M,    M,    M,    M,	/* 80 */
+	M,    M,    M,    M,    M,    M,    M,    M,
+	0,    0,    0,    0,    0,    0,    0,    0,	/* 90 */
+	0,    0,    X,    0,    0,    0,    0,    0,
+	MO,   MO,   MO,   MO,   0,    0,    0,    0,	/* a0 */
+	I8,   IZ,   0,    0,    0,    0,    0,    0,
+	I8,   I8,   I8,   I8,   I8,   I8,   I8,   I8,	/* b0 */
+	IZ,   IZ,   IZ,   IZ,   IZ,   IZ,   IZ,   IZ,
+	M|I8, M|I8, INAT_IMM16, 0, M,   M,    M|I8, M|IZ,	/* c0 */
+	INAT_IMM16|I8, 0, INAT_IMM16, 0, 0, I8, 0, 0,
+	M,    M,    M,    M,    I8,   I8,   X,    0,	/* d0 */
+	M,    M,    M,    M,    M,    M,    M,    M,
+	R8,   R8,   R8,   R8,   I8,   I8,   I8,   I8,	/* e0 */
+	RZ,   RZ,   X,    R8,   0,    0,    0,    0,
+	0,    X,    0,    0,    0,    0,    M|INAT_GRP3, M|INAT_GRP3, /* f0 */
+	0,    0,    0,    0,    0,    0,    M,    M,
+};
+
+static const u8 twobyte_attr[256] = {
+	M,    M,    M,    M,    X,    X,    0,    X,	/* 00 */
+	0,    0,    X,    0,    X,    M,    X,    X,
+	M,    M,    M,    M,    M,    M,    M,    M,	/* 10 */
+	M,    M,    M,    M,    M,    M,    M,    M,
+	M,    M,    M,    M,    X,    X,    X,    X,	/* 20 */
+	M,    M,    M,    M,    M,    M,    M,    M,
+	0,    0,    0,    0,    X,    X,    X,    X,	/* 30 */
+	X,    X,    X,    X,    X,    X,    X,    X,
+	M,    M,    M,    M,    M,    M,    M,    M,	/* 40 */
+	M,    M,    M,    M,    M,    M,    M,    M,
+	M,    M,    M,    M,    M,    M,    M,    M,	/* 50 */
+	M,    M,    M,    M,    M,    M,    M,    M,
+	M,    M,    M,    M,    M,    M,    M,    M,	/* 60 */
+	M,    M,    M,    M,    M,    M,    M,    M,
+	M|I8, M|I8, M|I8, M|I8, M,    M,    M,    0,	/* 70 */
+	X,    X,    X,    X,    M,    M,    M,    M,
+	RZ,   RZ,   RZ,   RZ,   RZ,   RZ,   RZ,   RZ,	/* 80 */
+	RZ,   RZ,   RZ,   RZ,   RZ,   RZ,   RZ,   RZ,
+	M,    M,    M,    M,    M,    M,    M,    M,	/* 90 */
+	M,    M,    M,    M,    M,    M,    M,    M,
+	0,    0,    0,    M,    M|I8, M,    X,    X,	/* a0 */
+	0,    0,    X,    M,    M|I8, M,    M,    M,
+	M,    M,    M,    M,    M,    M,    M,    M,	/* b0 */
+	M,    X,    M|I8, M,    M,    M,    M,    M,
+	M,    M,    M|I8, M,    M|I8, M|I8, M|I8, M,	/* c0 */
+	0,    0,    0,    0,    0,    0,    0,    0,
+	M,    M,    M,    M,    M,    M,    M,    M,	/* d0 */
+	M,    M,    M,    M,    M,    M,    M,    M,
+	M,    M,    M,    M,    M,    M,    M,    M,	/* e0 */
+	M,    M,    M,    M,    M,    M,    M,    M,
+	M,    M,    M,    M,    M,    M,    M,    M,	/* f0 */
+	M,    M,    M,    M,    M,    M,    M,    X,
+};
+
+#undef M
+#undef I8
+#undef IZ
+#undef R8
+#undef RZ
+#undef MO
+#undef X
+
+/* BUG()'s line and file follow its ud2 */
+#ifdef CONFIG_DEBUG_BUGVERBOSE
+#define BUG_DATA_SIZE	6
+#else
+#define BUG_DATA_SIZE	0
+#endif
+
+struct optprobe_insn {
+	int length;
+	int attr;
+	int opcode;		/* 0x0fXX for the two byte ones */
+	int modrm;		/* or -1 */
+	long disp;		/* of a relative branch */
+};
+
+/*
+ * Decode the instruction at insn, of which avail bytes may be read.
+ * 16 bit addressing and 16 bit branches are not handled.
+ */
+static int __kprobes decode_insn(kprobe_opcode_t *insn, int avail,
+				 struct optprobe_insn *d)
+{
+	kprobe_opcode_t *p = insn;
+	int opsize = 4, imm = 0, attr, mod, rm;
+
+	for (;; p++) {
+		if (p - insn >= avail)
+			return -EINVAL;
+		switch (*p) {
+		case 0x66:
+			opsize = 2;
+			continue;
+		case 0x26: case 0x2e: case 0x36: case 0x3e:
+		case 0x64: case 0x65: case 0xf0: case 0xf2: case 0xf3:
+			continue;
+		case 0x67:
+			return -EINVAL;
+		}
+		break;
+	}
+
+	d->opcode = *p++;
+	if (d->opcode == 0x0f) {
+		if (p - insn >= avail)
+			return -EINVAL;
+		d->opcode = 0x0f00 | *p++;
+		attr = twobyte_attr[d->opcode & 0xff];
+		if (d->opcode == 0x0f0b)
+			p += BUG_DATA_SIZE;
+	} else
+		attr = onebyte_attr[d->opcode];
+	if (attr & INAT_BAD)
+		return -EINVAL;
+
+	d->modrm = -1;
+	if (attr & INAT_MODRM) {
+		/* the ModR/M byte and perhaps a SIB */
+		if (p + 2 - insn > avail)
+			return -EINVAL;
+		d->modrm = *p++;
+		mod = d->modrm >> 6;
+		rm = d->modrm & 7;
+		if (mod != 3 && rm == 4) {
+			if (mod == 0 && (*p & 7) == 5)
+				p += 4;
+			p++;
+		} else if (mod == 0 && rm == 5)
+			p += 4;
+		if (mod == 1)
+			p += 1;
+		else if (mod == 2)
+			p += 4;
+		if ((attr & INAT_GRP3) && ((d->modrm >> 3) & 7) < 2)
+			attr |= (d->opcode & 1) ? INAT_IMMZ : INAT_IMM8;
+	}
+
+	if (attr & INAT_IMM8)
+		imm += 1;
+	if (attr & INAT_IMM16)
+		imm += 2;
+	if (attr & INAT_IMMZ)
+		imm += opsize;
+	if (attr & INAT_MOFFS)
+		imm += 4;
+	p += imm;
+
+	d->length = p - insn;
+	if (d->length > avail || d->length > MAX_INSN_SIZE)
+		return -EINVAL;
+	d->attr = attr;
+	if (attr & INAT_REL) {
+		if (opsize != 4)
+			return -EINVAL;
+		d->disp = (imm == 1) ? *(s8 *)(p - 1) : *(s32 *)(p - 4);
+	}
+	return 0;
+}
+
+static inline int insn_is_call(struct optprobe_insn *d)
+{
+	int reg = (d->modrm >> 3) & 7;
+
+	return d->opcode == 0xe8 || (d->opcode == 0xff && (reg == 2 || reg == 3));
+}
+
+static inline int insn_is_indirect_jump(struct optprobe_insn *d)
+{
+	int reg = (d->modrm >> 3) & 7;
+
+	return d->opcode == 0xff && (reg == 4 || reg == 5);
+}
+
+/*
+ * Copy len bytes of text at addr as they are without probes: the int3s
+ * and jumps of the probes there replaced by what they overwrote.
+ */
+static void __kprobes recover_insns(kprobe_opcode_t *buf,
+				    kprobe_opcode_t *addr, int len)
+{
+	struct kprobe *q;
+	int i, j;
+
+	memcpy(buf, addr, len);
+	for (i = 1 - RELATIVEJUMP_SIZE; i < len; i++) {
+		q = get_kprobe(addr + i);
+		if (!q)
+			continue;
+		if (i >= 0)
+			buf[i] = q->opcode;
+		if (!q->ainsn.optinsn)
+			continue;
+		for (j = 1; j < RELATIVEJUMP_SIZE; j++)
+			if (i + j >= 0 && i + j < len)
+				buf[i + j] = q->ainsn.copied_insn[j - 1];
+	}
+}
+
+#define OPTPROBE_DECODE_SIZE	(2 * MAX_INSN_SIZE)
+
+/* Decode the instruction at addr, not reading past end */
+static int __kprobes decode_text(kprobe_opcode_t *buf, unsigned long addr,
+				 unsigned long end, struct optprobe_insn *d)
+{
+	int avail = min(end - addr, (unsigned long)OPTPROBE_DECODE_SIZE);
+
+	recover_insns(buf, (kprobe_opcode_t *)addr, avail);
+	return decode_insn(buf, avail, d);
+}
+
+/*
+ * Returns how many bytes of instructions a jump at p would displace, or
+ * 0 if they can't be shown safe to move.  Each must decode, run the same
+ * out of line (can_boost(), and not a call, which would return to the
+ * detour buffer), have no exception fixup and carry no other probe; and
+ * decoding the function from its start, no branch in it may land among
+ * them.  Functions with an indirect jump (a switch table) are given up.
+ */
+static int __kprobes can_optimize(struct kprobe *p)
+{
+	char namebuf[KSYM_NAME_LEN + 1], *modname;
+	kprobe_opcode_t buf[OPTPROBE_DECODE_SIZE];
+	unsigned long paddr = (unsigned long)p->addr;
+	unsigned long size, offset, addr, end, target;
+	struct optprobe_insn d;
+	int len;
+
+	if (!kallsyms_lookup(paddr, &size, &offset, &modname, namebuf))
+		return 0;
+	addr = paddr - offset;
+	end = addr + size;
+
+	for (len = 0; len < RELATIVEJUMP_SIZE; len += d.length) {
+		if (len && get_kprobe(p->addr + len))
+			return 0;
+		if (decode_text(buf, paddr + len, end, &d) ||
+		    (d.attr & INAT_REL) || insn_is_call(&d) ||
+		    !can_boost(buf) || search_exception_tables(paddr + len))
+			return 0;
+	}
+
+	for (; addr < end; addr += d.length) {
+		if (decode_text(buf, addr, end, &d) ||
+		    insn_is_indirect_jump(&d))
+			return 0;
+		/* out of step with the instructions at p */
+		if (addr < paddr + len && addr + d.length > paddr &&
+		    (addr < paddr || addr + d.length > paddr + len))
+			return 0;
+		if (d.attr & INAT_REL) {
+			target = addr + d.length + d.disp;
+			if (paddr < target && target < paddr + len)
+				return 0;
+		}
+	}
+	return len;
+}
+
+/*
+ * The detour buffer starts with a copy of this, which builds a pt_regs
+ * as the int3 would have and calls optimized_callback() with it and the
+ * probe address, patched in at optprobe_template_val.
+ */
+void __kprobes optprobe_template_holder(void)
+{
+	asm volatile (".global optprobe_template_entry\n"
+			"optprobe_template_entry: \n"
+			"	pushf\n"
+			/* skip cs, eip, orig_eax, es, ds */
+			"	subl $20, %esp\n"
+			"	pushl %eax\n"
+			"	pushl %ebp\n"
+			"	pushl %edi\n"
+			"	pushl %esi\n"
+			"	pushl %edx\n"
+			"	pushl %ecx\n"
+			"	pushl %ebx\n"
+			"	movl %esp, %eax\n"
+			".global optprobe_template_val\n"
+			"optprobe_template_val: \n"
+			"	movl $0, %edx\n"
+			/* absolute, as the template is copied elsewhere */
+			"	movl $optimized_callback, %ecx\n"
+			"	call *%ecx\n"
+			"	popl %ebx\n"
+			"	popl %ecx\n"
+			"	popl %edx\n"
+			"	popl %esi\n"
+			"	popl %edi\n"
+			"	popl %ebp\n"
+			"	popl %eax\n"
+			"	addl $20, %esp\n"
+			"	popf\n"
+			".global optprobe_template_end\n"
+			"optprobe_template_end: \n");
+}
+
+extern kprobe_opcode_t optprobe_template_entry[];
+extern kprobe_opcode_t optprobe_template_val[];
+extern kprobe_opcode_t optprobe_template_end[];
+
+#define TMPL_SIZE	(optprobe_template_end - optprobe_template_entry)
+#define TMPL_VAL_IDX	(optprobe_template_val - optprobe_template_entry + 1)
+
+/*
+ * Called from a detour buffer in place of the int3 at addr.  Only probes
+ * without post_handler and break_handler are optimized, so there is
+ * nothing to single-step; a pre_handler's change of regs->eip is not
+ * honoured.
+ */
+fastcall void __kprobes optimized_callback(struct pt_regs *regs,
+					   unsigned long addr)
+{
+	struct kprobe *p;
+	struct kprobe_ctlblk *kcb;
+	unsigned long flags;
+
+	local_irq_save(flags);
+	preempt_disable();
+	p = get_kprobe((void *)addr);
+	if (kprobe_running()) {
+		kprobes_inc_nmissed_count(p);
+	} else {
+		kcb = get_kprobe_ctlblk();
+		/* as the handlers would find them after the int3 */
+		regs->xcs = __KERNEL_CS;
+		regs->eip = addr + sizeof(kprobe_opcode_t);
+		regs->orig_eax = ~0UL;
+		__get_cpu_var(current_kprobe) = p;
+		kcb->kprobe_status = KPROBE_HIT_ACTIVE;
+		if (p->pre_handler)
+			p->pre_handler(p, regs);
+		reset_current_kprobe();
+	}
+	preempt_enable_no_resched();
+	local_irq_restore(flags);
+}
+
+struct optprobe_patch {
+	kprobe_opcode_t *addr;
+	kprobe_opcode_t insn[RELATIVEJUMP_SIZE];
+};
+
+/*
+ * Run with the other cpus stopped.  Without CONFIG_PREEMPT they can only
+ * have stopped in schedule(), so none is in the middle of the displaced
+ * instructions, nor in a detour buffer: the jump goes in, or comes out,
+ * at once as far as any of them can tell.
+ */
+static int __kprobes __optprobe_patch(void *data)
+{
+	struct optprobe_patch *pp = data;
+
+	memcpy(pp->addr, pp->insn, RELATIVEJUMP_SIZE);
+	flush_icache_range((unsigned long)pp->addr,
+			   (unsigned long)pp->addr + RELATIVEJUMP_SIZE);
+	return 0;
+}
+
+static void __kprobes optprobe_patch(struct optprobe_patch *pp)
+{
+	/* It can only fail to create its threads */
+	while (stop_machine_run(__optprobe_patch, pp, NR_CPUS))
+		schedule_timeout_uninterruptible(HZ / 10);
+}
+
+/*
+ * Called under kprobe_mutex with p armed, and the only probe within the
+ * instructions it displaces.  If it can't be optimized, p stays on int3.
+ */
+int __kprobes arch_optimize_kprobe(struct kprobe *p)
+{
+	struct optprobe_patch pp;
+	kprobe_opcode_t *buf;
+	int len;
+
+	if (p->ainsn.optinsn)
+		return 0;
+	len = can_optimize(p);
+	if (!len)
+		return -EINVAL;
+	buf = get_optinsn_slot();
+	if (!buf)
+		return -ENOMEM;
+
+	memcpy(buf, optprobe_template_entry, TMPL_SIZE);
+	*(unsigned long *)(buf + TMPL_VAL_IDX) = (unsigned long)p->addr;
+	memcpy(buf + TMPL_SIZE, p->addr, len);
+	buf[TMPL_SIZE] = p->opcode;
+	set_jmp_op(buf + TMPL_SIZE + len, p->addr + len);
+	flush_icache_range((unsigned long)buf,
+			   (unsigned long)buf + TMPL_SIZE + len +
+			   RELATIVEJUMP_SIZE);
+
+	p->ainsn.optsize = len;
+	memcpy(p->ainsn.copied_insn, p->addr + 1, RELATIVEJUMP_SIZE - 1);
+
+	pp.addr = p->addr;
+	pp.insn[0] = RELATIVEJUMP_INSTRUCTION;
+	*(long *)(pp.insn + 1) =
+		(long)buf - ((long)p->addr + RELATIVEJUMP_SIZE);
+	p->ainsn.optinsn = buf;
+	optprobe_patch(&pp);
+	return 0;
+}
+
+/* Put p back on int3, called under kprobe_mutex */
+void __kprobes arch_unoptimize_kprobe(struct kprobe *p)
+{
+	struct optprobe_patch pp;
+
+	if (!p->ainsn.optinsn)
+		return;
+	pp.addr = p->addr;
+	pp.insn[0] = BREAKPOINT_INSTRUCTION;
+	memcpy(pp.insn + 1, p->ainsn.copied_insn, RELATIVEJUMP_SIZE - 1);
+	optprobe_patch(&pp);
+
+	free_optinsn_slot(p->ainsn.optinsn);
+	p->ainsn.optinsn = NULL;
+}
+
+int __kprobes arch_within_optimized_kprobe(struct kprobe *p,
+					   unsigned long addr)
+{
+	return p->ainsn.optinsn && (unsigned long)p->addr <= addr &&
+		addr < (unsigned long)p->addr + p->ainsn.optsize;
+}
+#endif /* CONFIG_OPTPROBES */
+
 int __init arch_init_kprobes(void)
 {
+#ifdef CONFIG_OPTPROBES
+	BUG_ON(TMPL_SIZE > MAX_OPTPROBE_TEMPLATE_SIZE);
+#endif
 	return 0;
 }
@@ -252,10 +252,21 @@ void send_IPI_mask_sequence(cpumask_t mask, int vector)
  *	Optimizations Manfred Spraul <manfred@colorfullife.com>
  */
 
-static cpumask_t flush_cpumask;
-static struct mm_struct * flush_mm;
-static unsigned long flush_va;
-static DEFINE_SPINLOCK(tlbstate_lock);
+/*
+ * Every cpu posts its flush requests in its own flush_request, and marks
+ * itself in the flush_senders of each cpu that has to act on it.  A cpu
+ * sends one request at a time, with preemption disabled, so the request
+ * needs no lock and shootdowns from different cpus run in parallel; the
+ * IPI handler serves all the senders marked in its flush_senders at once.
+ */
+struct flush_request {
+	cpumask_t pending;		/* cpus that haven't flushed yet */
+	struct mm_struct *mm;
+	unsigned long va;
+} ____cacheline_aligned;
+
+static DEFINE_PER_CPU(struct flush_request, flush_request);
+static DEFINE_PER_CPU(cpumask_t, flush_senders);
 #define FLUSH_ALL	0xffffffff
 
 /*
@@ -322,40 +333,51 @@ static inline void leave_mm (unsigned long cpu)
 fastcall void smp_invalidate_interrupt(struct pt_regs *regs)
 {
 	unsigned long cpu;
+	cpumask_t *senders;
+	struct flush_request *f;
+	int sender, flushed = 0;
 
 	cpu = get_cpu();
+	senders = &per_cpu(flush_senders, cpu);
 
-	if (!cpu_isset(cpu, flush_cpumask))
-		goto out;
-		/* 
-		 * This was a BUG() but until someone can quote me the
-		 * line from the intel manual that guarantees an IPI to
-		 * multiple CPUs is retried _only_ on the erroring CPUs
-		 * its staying as a return
-		 *
-		 * BUG();
-		 */
-		 
-	if (flush_mm == per_cpu(cpu_tlbstate, cpu).active_mm) {
-		if (per_cpu(cpu_tlbstate, cpu).state == TLBSTATE_OK) {
-			if (flush_va == FLUSH_ALL)
-				local_flush_tlb();
-			else
-				__flush_tlb_one(flush_va);
-		} else
-			leave_mm(cpu);
+	/*
+	 * An empty mask is not a BUG(): nobody can quote the line from
+	 * the intel manual that guarantees an IPI to multiple CPUs is
+	 * retried _only_ on the erroring CPUs, and a sender that marked
+	 * us after an earlier IPI had us running has already been served.
+	 */
+	for_each_cpu_mask(sender, *senders) {
+		if (!test_and_clear_bit(sender, cpus_addr(*senders)))
+			continue;
+		f = &per_cpu(flush_request, sender);
+
+		if (!flushed &&
+		    f->mm == per_cpu(cpu_tlbstate, cpu).active_mm) {
+			if (per_cpu(cpu_tlbstate, cpu).state == TLBSTATE_OK) {
+				if (f->va == FLUSH_ALL) {
+					local_flush_tlb();
+					flushed = 1;
+				} else
+					__flush_tlb_one(f->va);
+			} else {
+				leave_mm(cpu);
+				flushed = 1;
+			}
+		}
+		smp_mb__before_clear_bit();
+		cpu_clear(cpu, f->pending);
+		smp_mb__after_clear_bit();
 	}
 	ack_APIC_irq();
-	smp_mb__before_clear_bit();
-	cpu_clear(cpu, flush_cpumask);
-	smp_mb__after_clear_bit();
-out:
 	put_cpu_no_resched();
 }
 
 static void flush_tlb_others(cpumask_t cpumask, struct mm_struct *mm,
 						unsigned long va)
 {
+	struct flush_request *f;
+	int self, cpu;
+
 	/*
 	 * A couple of (to be removed) sanity checks:
 	 *
@@ -371,40 +393,27 @@ static void flush_tlb_others(cpumask_t cpumask, struct mm_struct *mm,
 	if (cpus_empty(cpumask))
 		return;
 
-	/*
-	 * i'm not happy about this global shared spinlock in the
-	 * MM hot path, but we'll see how contended it is.
-	 * Temporarily this turns IRQs off, so that lockups are
-	 * detected by the NMI watchdog.
-	 */
-	spin_lock(&tlbstate_lock);
-	
-	flush_mm = mm;
-	flush_va = va;
-#if NR_CPUS <= BITS_PER_LONG
-	atomic_set_mask(cpumask, &flush_cpumask);
-#else
-	{
-		int k;
-		unsigned long *flush_mask = (unsigned long *)&flush_cpumask;
-		unsigned long *cpu_mask = (unsigned long *)&cpumask;
-		for (k = 0; k < BITS_TO_LONGS(NR_CPUS); ++k)
-			atomic_set_mask(cpu_mask[k], &flush_mask[k]);
-	}
-#endif
+	self = smp_processor_id();
+	f = &per_cpu(flush_request, self);
+	f->mm = mm;
+	f->va = va;
+	f->pending = cpumask;
+	smp_wmb();
+	for_each_cpu_mask(cpu, cpumask)
+		cpu_set(self, per_cpu(flush_senders, cpu));
+
 	/*
 	 * We have to send the IPI only to
 	 * CPUs affected.
 	 */
 	send_IPI_mask(cpumask, INVALIDATE_TLB_VECTOR);
 
-	while (!cpus_empty(flush_cpumask))
+	while (!cpus_empty(f->pending))
 		/* nothing. lockup detection does not belong here */
 		mb();
 
-	flush_mm = NULL;
-	flush_va = 0;
-	spin_unlock(&tlbstate_lock);
+	f->mm = NULL;
+	f->va = 0;
 }
 	
 void flush_tlb_current_task(void)
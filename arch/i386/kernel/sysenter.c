@@ -17,11 +17,14 @@
 #include <linux/elf.h>
 #include <linux/mm.h>
 #include <linux/module.h>
+#include <linux/clocksource.h>
 
 #include <asm/cpufeature.h>
 #include <asm/msr.h>
 #include <asm/pgtable.h>
 #include <asm/unistd.h>
+#include <asm/tsc.h>
+#include <asm/vgtod.h>
 
 /*
  * Should the kernel map a VDSO page into processes and pass its
@@ -96,6 +99,30 @@ int __init sysenter_setup(void)
 	return 0;
 }
 
+/*
+ * Keep the vDSO's copy of the timekeeping state up to date for its
+ * clock_gettime().  Before sysenter_setup() there is no page to keep it
+ * in, and copying the image there clears it until the next tick.
+ */
+void update_vsyscall(struct timespec *wall_time, struct clocksource *clock)
+{
+	struct vsyscall_gtod_data *vgtod;
+
+	if (!syscall_page)
+		return;
+	vgtod = syscall_page + VGTOD_OFFSET;
+
+	write_seqcount_begin(&vgtod->seq);
+	vgtod->mode = is_vsyscall_clocksource(clock) ? VGTOD_TSC : VGTOD_NONE;
+	vgtod->cycle_last = clock->cycle_last;
+	vgtod->mask = clock->mask;
+	vgtod->mult = clock->mult;
+	vgtod->shift = clock->shift;
+	vgtod->wall_time = *wall_time;
+	vgtod->wall_to_monotonic = wall_to_monotonic;
+	write_seqcount_end(&vgtod->seq);
+}
+
 static struct page *syscall_nopage(struct vm_area_struct *vma,
 				unsigned long adr, int *type)
 {
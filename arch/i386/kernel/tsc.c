@@ -344,6 +344,15 @@ static struct clocksource clocksource_tsc = {
 	.is_continuous		= 1,
 };
 
+/*
+ * Can the vDSO read the clocksource itself?  Only a TSC that is good
+ * enough for the kernel to keep time with.
+ */
+int is_vsyscall_clocksource(struct clocksource *cs)
+{
+	return cs == &clocksource_tsc && !check_tsc_unstable();
+}
+
 static int tsc_update_callback(void)
 {
 	int change = 0;
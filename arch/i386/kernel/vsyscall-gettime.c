@@ -0,0 +1,110 @@
+/*
+ * clock_gettime() in the vDSO.  CLOCK_REALTIME and CLOCK_MONOTONIC add
+ * the TSC cycles since the last tick to the timekeeping state the kernel
+ * keeps in this page, the coarse clocks just return the latter.  Other
+ * clocks, or a clocksource user mode cannot read, take the system call.
+ *
+ * This is linked into the vDSO images and runs in user mode: it is built
+ * position independent and must not call into the kernel proper.
+ */
+
+#include <linux/linkage.h>
+#include <linux/time.h>
+#include <asm/vgtod.h>
+#include <asm/msr.h>
+#include <asm/unistd.h>
+
+struct vsyscall_gtod_data __vsyscall_gtod_data
+	__attribute__ ((section(".vsyscall_gtod"), visibility("hidden")));
+
+#define gtod (&__vsyscall_gtod_data)
+
+/* smp_rmb() is an alternative, and nothing patches those in the vDSO */
+#define vgtod_rmb()	asm volatile("lock; addl $0,0(%%esp)" : : : "memory")
+
+static inline unsigned vgtod_read_begin(void)
+{
+	unsigned seq;
+
+	while ((seq = *(volatile unsigned *)&gtod->seq.sequence) & 1)
+		asm volatile("rep; nop");
+	vgtod_rmb();
+	return seq;
+}
+
+static inline int vgtod_read_retry(unsigned seq)
+{
+	vgtod_rmb();
+	return *(volatile unsigned *)&gtod->seq.sequence != seq;
+}
+
+static inline unsigned long vgetns(void)
+{
+	cycle_t now;
+
+	rdtscll(now);
+	if (now < gtod->cycle_last)
+		now = gtod->cycle_last;
+	return ((now - gtod->cycle_last) & gtod->mask) * gtod->mult >>
+		gtod->shift;
+}
+
+static inline int do_clock_gettime(clockid_t clock, struct timespec *ts)
+{
+	int coarse = clock == CLOCK_REALTIME_COARSE ||
+		     clock == CLOCK_MONOTONIC_COARSE;
+	unsigned seq;
+	unsigned long nsec;
+	time_t sec;
+
+	do {
+		seq = vgtod_read_begin();
+		if (!coarse && gtod->mode != VGTOD_TSC)
+			return 0;
+
+		sec = gtod->wall_time.tv_sec;
+		nsec = gtod->wall_time.tv_nsec;
+		if (clock == CLOCK_MONOTONIC ||
+		    clock == CLOCK_MONOTONIC_COARSE) {
+			sec += gtod->wall_to_monotonic.tv_sec;
+			nsec += gtod->wall_to_monotonic.tv_nsec;
+		}
+		if (!coarse)
+			nsec += vgetns();
+	} while (vgtod_read_retry(seq));
+
+	/* no 64 bit division here, and nsec is at most a few seconds */
+	while (nsec >= NSEC_PER_SEC) {
+		nsec -= NSEC_PER_SEC;
+		sec++;
+	}
+	ts->tv_sec = sec;
+	ts->tv_nsec = nsec;
+	return 1;
+}
+
+/* %ebx is the PIC register, so the clock id goes through %edi */
+static inline long clock_gettime_syscall(clockid_t clock, struct timespec *ts)
+{
+	long ret;
+
+	asm volatile("xchgl %%ebx, %%edi; int $0x80; xchgl %%ebx, %%edi"
+		     : "=a" (ret)
+		     : "0" (__NR_clock_gettime), "D" (clock), "c" (ts)
+		     : "memory");
+	return ret;
+}
+
+/* Returns 0, or the negative error of the system call */
+asmlinkage long __vdso_clock_gettime(clockid_t clock, struct timespec *ts)
+{
+	switch (clock) {
+	case CLOCK_REALTIME:
+	case CLOCK_MONOTONIC:
+	case CLOCK_REALTIME_COARSE:
+	case CLOCK_MONOTONIC_COARSE:
+		if (do_clock_gettime(clock, ts))
+			return 0;
+	}
+	return clock_gettime_syscall(clock, ts);
+}
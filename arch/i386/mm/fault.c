@@ -22,6 +22,7 @@
 #include <linux/highmem.h>
 #include <linux/module.h>
 #include <linux/kprobes.h>
+#include <linux/perf_counter.h>
 
 #include <asm/system.h>
 #include <asm/uaccess.h>
@@ -386,6 +387,8 @@ fastcall void __kprobes do_page_fault(struct pt_regs *regs,
 	if (in_atomic() || !mm)
 		goto bad_area_nosemaphore;
 
+	perf_swcounter_event(PERF_COUNT_PAGE_FAULTS, 1, regs);
+
 	/* When running in the kernel we expect faults to occur only to
 	 * addresses in user space.  All other faults represent errors in the
 	 * kernel and should generate an OOPS.  Unfortunatly, in the case of an
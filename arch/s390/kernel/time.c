@@ -257,9 +257,10 @@ static inline void stop_hz_timer(void)
 
 	/*
 	 * Leave the clock comparator set up for the next timer
-	 * tick if either rcu or a softirq is pending.
+	 * tick if rcu, a softirq or a printk wakeup is pending.
 	 */
-	if (rcu_needs_cpu(cpu) || local_softirq_pending()) {
+	if (rcu_needs_cpu(cpu) || local_softirq_pending() ||
+	    printk_needs_cpu(cpu)) {
 		cpu_clear(cpu, nohz_cpu_mask);
 		return;
 	}
@@ -80,7 +80,8 @@ static int do_aio(aio_context_t ctx, enum aio_type type, int fd, char *buf,
 				.aio_offset	= offset,
 				.aio_reserved1	= 0,
 				.aio_reserved2	= 0,
-				.aio_reserved3	= 0 });
+				.aio_flags	= 0,
+				.aio_resfd	= 0 });
 
 	switch(type){
 	case AIO_READ:
@@ -56,6 +56,7 @@
 #include <asm/byteorder.h>
 #include <linux/bitops.h>
 #include <linux/crypto.h>
+#include <linux/string.h>
 #include <linux/errno.h>
 #include <linux/init.h>
 #include <linux/module.h>
@@ -296,6 +297,106 @@ static void aes_decrypt(struct crypto_tfm *tfm, u8 *dst, const u8 *src)
 	aes_dec_blk(tfm, dst, src);
 }
 
+/*
+ * Multi-block entry points, for whole scatterlist segments at a time:
+ * the asm is called directly for each block, without the per-block
+ * indirect calls and copies of the generic chaining code.
+ */
+static inline void aes_xor_block(u8 *dst, const u8 *a, const u8 *b)
+{
+	unsigned long *d = (unsigned long *)dst;
+	const unsigned long *x = (const unsigned long *)a;
+	const unsigned long *y = (const unsigned long *)b;
+	int i;
+
+	for (i = 0; i < AES_BLOCK_SIZE / sizeof(long); i++)
+		d[i] = x[i] ^ y[i];
+}
+
+static inline void aes_ctr_inc(u8 *ctr)
+{
+	int i;
+
+	for (i = AES_BLOCK_SIZE - 1; i >= 0; i--)
+		if (++ctr[i])
+			break;
+}
+
+static unsigned int aes_encrypt_ecb(const struct cipher_desc *desc, u8 *dst,
+				    const u8 *src, unsigned int nbytes)
+{
+	unsigned int done;
+
+	for (done = 0; done + AES_BLOCK_SIZE <= nbytes; done += AES_BLOCK_SIZE)
+		aes_enc_blk(desc->tfm, dst + done, src + done);
+	return done;
+}
+
+static unsigned int aes_decrypt_ecb(const struct cipher_desc *desc, u8 *dst,
+				    const u8 *src, unsigned int nbytes)
+{
+	unsigned int done;
+
+	for (done = 0; done + AES_BLOCK_SIZE <= nbytes; done += AES_BLOCK_SIZE)
+		aes_dec_blk(desc->tfm, dst + done, src + done);
+	return done;
+}
+
+static unsigned int aes_encrypt_cbc(const struct cipher_desc *desc, u8 *dst,
+				    const u8 *src, unsigned int nbytes)
+{
+	u8 *iv = desc->info;
+	const u8 *prev = iv;
+	unsigned int done;
+
+	for (done = 0; done + AES_BLOCK_SIZE <= nbytes; done += AES_BLOCK_SIZE) {
+		aes_xor_block(dst + done, src + done, prev);
+		aes_enc_blk(desc->tfm, dst + done, dst + done);
+		prev = dst + done;
+	}
+	memcpy(iv, prev, AES_BLOCK_SIZE);
+	return done;
+}
+
+/*
+ * From the last block back, so that in place each ciphertext block is
+ * still there when the block after it is decrypted, and nothing but
+ * the next IV has to be copied aside.
+ */
+static unsigned int aes_decrypt_cbc(const struct cipher_desc *desc, u8 *dst,
+				    const u8 *src, unsigned int nbytes)
+{
+	u8 *iv = desc->info;
+	unsigned int done = nbytes & ~(AES_BLOCK_SIZE - 1);
+	unsigned int i = done - AES_BLOCK_SIZE;
+	u8 next_iv[AES_BLOCK_SIZE];
+
+	memcpy(next_iv, src + i, AES_BLOCK_SIZE);
+	for (; i; i -= AES_BLOCK_SIZE) {
+		aes_dec_blk(desc->tfm, dst + i, src + i);
+		aes_xor_block(dst + i, dst + i, src + i - AES_BLOCK_SIZE);
+	}
+	aes_dec_blk(desc->tfm, dst, src);
+	aes_xor_block(dst, dst, iv);
+	memcpy(iv, next_iv, AES_BLOCK_SIZE);
+	return done;
+}
+
+static unsigned int aes_crypt_ctr(const struct cipher_desc *desc, u8 *dst,
+				  const u8 *src, unsigned int nbytes)
+{
+	u8 *ctr = desc->info;
+	u8 ks[AES_BLOCK_SIZE] __attribute__ ((__aligned__(sizeof(long))));
+	unsigned int done;
+
+	for (done = 0; done + AES_BLOCK_SIZE <= nbytes; done += AES_BLOCK_SIZE) {
+		aes_enc_blk(desc->tfm, ks, ctr);
+		aes_ctr_inc(ctr);
+		aes_xor_block(dst + done, src + done, ks);
+	}
+	return done;
+}
+
 static struct crypto_alg aes_alg = {
 	.cra_name		=	"aes",
 	.cra_driver_name	=	"aes-x86_64",
@@ -311,7 +412,12 @@ static struct crypto_alg aes_alg = {
 			.cia_max_keysize	=	AES_MAX_KEY_SIZE,
 			.cia_setkey	   	= 	aes_set_key,
 			.cia_encrypt	 	=	aes_encrypt,
-			.cia_decrypt	  	=	aes_decrypt
+			.cia_decrypt	  	=	aes_decrypt,
+			.cia_encrypt_ecb	=	aes_encrypt_ecb,
+			.cia_decrypt_ecb	=	aes_decrypt_ecb,
+			.cia_encrypt_cbc	=	aes_encrypt_cbc,
+			.cia_decrypt_cbc	=	aes_decrypt_cbc,
+			.cia_crypt_ctr		=	aes_crypt_ctr
 		}
 	}
 };
@@ -25,6 +25,9 @@
 #include <linux/kernel_stat.h>
 #include <linux/sysdev.h>
 #include <linux/module.h>
+#include <linux/rcupdate.h>
+#include <linux/hrtimer.h>
+#include <linux/clockchips.h>
 
 #include <asm/atomic.h>
 #include <asm/smp.h>
@@ -816,6 +819,181 @@ static int __init calibrate_APIC_clock(void)
 
 static unsigned int calibration_result;
 
+/*
+ * The local APIC timer as a clock event device: it starts out running
+ * the periodic tick, and the hrtimer code may switch it to one-shot
+ * mode for high resolution timers.
+ */
+static DEFINE_PER_CPU(struct clock_event_device, lapic_events);
+
+static void lapic_timer_tick(struct clock_event_device *evt,
+			     struct pt_regs *regs)
+{
+	smp_local_timer_interrupt(regs);
+}
+
+static int lapic_next_event(unsigned long delta,
+			    struct clock_event_device *evt)
+{
+	apic_write(APIC_TMICT, delta);
+	return 0;
+}
+
+static void lapic_timer_setup(enum clock_event_mode mode,
+			      struct clock_event_device *evt)
+{
+	unsigned long flags;
+
+	local_irq_save(flags);
+	switch (mode) {
+	case CLOCK_EVT_MODE_PERIODIC:
+		__setup_APIC_LVTT(calibration_result);
+		break;
+	case CLOCK_EVT_MODE_ONESHOT:
+		/* the divider is left as __setup_APIC_LVTT set it */
+		apic_write(APIC_LVTT, LOCAL_TIMER_VECTOR);
+		apic_write(APIC_TMICT, 0);
+		break;
+	case CLOCK_EVT_MODE_UNUSED:
+	case CLOCK_EVT_MODE_SHUTDOWN:
+		disable_APIC_timer();
+		break;
+	}
+	local_irq_restore(flags);
+}
+
+/*
+ * Set up the clock event device of this cpu, once its timer runs the
+ * periodic tick. A cpu which comes back online gets its tick handler
+ * back, the device stays registered.
+ */
+static void __cpuinit setup_APIC_events(void)
+{
+	struct clock_event_device *evt = &__get_cpu_var(lapic_events);
+	int cpu = smp_processor_id();
+	int registered = evt->name != NULL;
+
+	evt->name = "lapic";
+	evt->features = CLOCK_EVT_FEAT_PERIODIC | CLOCK_EVT_FEAT_ONESHOT;
+	/* a stopped timer (C3 broadcast) can not do one-shot events */
+	if (cpu_isset(cpu, timer_interrupt_broadcast_ipi_mask))
+		evt->features &= ~CLOCK_EVT_FEAT_ONESHOT;
+	evt->rating = 100;
+	evt->cpumask = cpumask_of_cpu(cpu);
+	evt->shift = 32;
+	evt->mult = div_sc(calibration_result / APIC_DIVISOR * HZ,
+			   NSEC_PER_SEC, evt->shift);
+	evt->max_delta_ns = clockevent_delta2ns(0x7FFFFFFF, evt);
+	evt->min_delta_ns = clockevent_delta2ns(0xF, evt);
+	evt->set_next_event = lapic_next_event;
+	evt->set_mode = lapic_timer_setup;
+	evt->event_handler = lapic_timer_tick;
+	evt->mode = CLOCK_EVT_MODE_PERIODIC;
+
+	if (!registered)
+		clockevents_register_device(evt);
+}
+
+#ifdef CONFIG_NO_IDLE_HZ
+int sysctl_hz_timer = 0;
+
+/* jiffies when the local timer of an idle cpu was stopped */
+static DEFINE_PER_CPU(unsigned long, hz_timer_stopped);
+
+/*
+ * Program the local timer of an idle cpu to fire once, when the next
+ * timer (or hrtimer) is due, instead of every tick.
+ * Called from the idle notifier only.
+ */
+static void stop_hz_timer(void)
+{
+	int cpu = smp_processor_id();
+	unsigned long flags, next, ticks, max_ticks;
+
+	if (sysctl_hz_timer || !using_apic_timer ||
+	    (apic_runs_main_timer > 1 && cpu == boot_cpu_id) ||
+	    cpu_isset(cpu, timer_interrupt_broadcast_ipi_mask))
+		return;
+
+	local_irq_save(flags);
+	cpu_set(cpu, nohz_cpu_mask);
+	smp_mb();
+	/*
+	 * Keep ticking if rcu, a softirq or printk need this cpu, or if
+	 * other cpus have tasks to give away: the idle tick pulls them.
+	 */
+	if (rcu_needs_cpu(cpu) || local_softirq_pending() ||
+	    printk_needs_cpu(cpu) || sched_tick_needed(cpu))
+		goto out_tick;
+
+	next = next_timer_interrupt();
+	ticks = next - jiffies;
+	if ((long)ticks <= 1)
+		goto out_tick;
+
+	/* the timer count is 32 bits */
+	max_ticks = 0xffffffffUL / (calibration_result / APIC_DIVISOR);
+	if (ticks > max_ticks)
+		ticks = max_ticks;
+
+	__get_cpu_var(hz_timer_stopped) = jiffies;
+	/* in high resolution mode the tick is an hrtimer */
+	if (!hrtimer_stop_sched_tick(ticks)) {
+		apic_write(APIC_LVTT, LOCAL_TIMER_VECTOR);
+		apic_write(APIC_TMICT,
+			   ticks * (calibration_result / APIC_DIVISOR));
+	}
+	local_irq_restore(flags);
+	return;
+
+out_tick:
+	cpu_clear(cpu, nohz_cpu_mask);
+	local_irq_restore(flags);
+}
+
+/*
+ * The idle cpu woke up: restart the periodic tick, and account the
+ * ticks it slept through as idle time.
+ */
+static void start_hz_timer(void)
+{
+	int cpu = smp_processor_id();
+	unsigned long flags, ticks;
+
+	if (!cpu_isset(cpu, nohz_cpu_mask))
+		return;
+
+	local_irq_save(flags);
+	cpu_clear(cpu, nohz_cpu_mask);
+	if (!hrtimer_restart_sched_tick())
+		__setup_APIC_LVTT(calibration_result);
+
+	ticks = jiffies - __get_cpu_var(hz_timer_stopped);
+	if (ticks > 1)
+		account_system_time(current, 0, jiffies_to_cputime(ticks - 1));
+	touch_softlockup_watchdog();
+	local_irq_restore(flags);
+}
+
+static int nohz_idle_notify(struct notifier_block *self,
+			    unsigned long action, void *unused)
+{
+	switch (action) {
+	case IDLE_START:
+		stop_hz_timer();
+		break;
+	case IDLE_END:
+		start_hz_timer();
+		break;
+	}
+	return NOTIFY_OK;
+}
+
+static struct notifier_block nohz_idle_nb = {
+	.notifier_call = nohz_idle_notify,
+};
+#endif /* CONFIG_NO_IDLE_HZ */
+
 void __init setup_boot_APIC_clock (void)
 {
 	if (disable_apic_timer) { 
@@ -833,14 +1011,19 @@ void __init setup_boot_APIC_clock (void)
 	 * Now set up the timer for real.
 	 */
 	setup_APIC_timer(calibration_result);
+	setup_APIC_events();
 
 	local_irq_enable();
+#ifdef CONFIG_NO_IDLE_HZ
+	idle_notifier_register(&nohz_idle_nb);
+#endif
 }
 
 void __cpuinit setup_secondary_APIC_clock(void)
 {
 	local_irq_disable(); /* FIXME: Do we need this? --RR */
 	setup_APIC_timer(calibration_result);
+	setup_APIC_events();
 	local_irq_enable();
 }
 
@@ -885,6 +1068,9 @@ void switch_APIC_timer_to_ipi(void *cpumask)
 
 	if (cpu_isset(cpu, mask) &&
 	    !cpu_isset(cpu, timer_interrupt_broadcast_ipi_mask)) {
+		/* the ticks come from the broadcast IPI from now on */
+		__get_cpu_var(lapic_events).features &= ~CLOCK_EVT_FEAT_ONESHOT;
+		hrtimer_switch_to_lowres();
 		disable_APIC_timer();
 		cpu_set(cpu, timer_interrupt_broadcast_ipi_mask);
 	}
@@ -910,6 +1096,7 @@ void switch_ipi_to_APIC_timer(void *cpumask)
 	    cpu_isset(cpu, timer_interrupt_broadcast_ipi_mask)) {
 		cpu_clear(cpu, timer_interrupt_broadcast_ipi_mask);
 		enable_APIC_timer();
+		__get_cpu_var(lapic_events).features |= CLOCK_EVT_FEAT_ONESHOT;
 	}
 }
 EXPORT_SYMBOL(switch_ipi_to_APIC_timer);
@@ -969,6 +1156,8 @@ void smp_local_timer_interrupt(struct pt_regs *regs)
  */
 void smp_apic_timer_interrupt(struct pt_regs *regs)
 {
+	struct clock_event_device *evt = &__get_cpu_var(lapic_events);
+
 	/*
 	 * the NMI deadlock-detector uses this.
 	 */
@@ -986,7 +1175,10 @@ void smp_apic_timer_interrupt(struct pt_regs *regs)
 	 */
 	exit_idle();
 	irq_enter();
-	smp_local_timer_interrupt(regs);
+	if (evt->event_handler)
+		evt->event_handler(evt, regs);
+	else
+		smp_local_timer_interrupt(regs);
 	irq_exit();
 }
 
@@ -541,6 +541,11 @@ void __kprobes nmi_watchdog_tick(struct pt_regs * regs, unsigned reason)
 	   not too */
 	if (atomic_read(&mce_entry) > 0)
 		touched = 1;
+#endif
+#ifdef CONFIG_NO_IDLE_HZ
+	/* the local timer of an idle cpu may be stopped */
+	if (cpu_isset(smp_processor_id(), nohz_cpu_mask))
+		touched = 1;
 #endif
 	if (!touched && __get_cpu_var(last_irq_sum) == sum) {
 		/*
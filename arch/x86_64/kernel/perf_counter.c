@@ -0,0 +1,434 @@
+/*
+ * arch/x86_64/kernel/perf_counter.c
+ *
+ * Hardware performance counters on the PMCs of Intel processors with
+ * architectural perfmon and of AMD K7 and later.
+ *
+ * A counter takes a free PMC when it is switched onto a cpu and gives
+ * it back when switched off.  The PMC is started at minus the events
+ * left to the next sample and interrupts through the local APIC's
+ * performance counter LVT, delivered as an NMI, when it wraps: the
+ * handler writes the sample and starts the PMC on the next period.
+ * Counting-only counters are interrupted every half the PMC's range
+ * so that no wrap goes unseen.
+ *
+ * While there are hardware counters the LAPIC NMI is reserved for
+ * them, which stops the NMI watchdog and keeps oprofile out.
+ */
+
+#include <linux/perf_counter.h>
+#include <linux/init.h>
+#include <linux/sched.h>
+#include <linux/mutex.h>
+#include <linux/percpu.h>
+#include <linux/err.h>
+#include <asm/apic.h>
+#include <asm/msr.h>
+#include <asm/nmi.h>
+#include <asm/uaccess.h>
+#include <asm/intel_arch_perfmon.h>
+
+struct x86_pmu {
+	const char	*name;
+	unsigned int	eventsel;	/* the first event select MSR */
+	unsigned int	perfctr;	/* the first counter MSR */
+	int		num_counters;
+	int		counter_bits;
+	u64		counter_mask;
+	s64		max_period;	/* that a counter can be started at */
+	u64		event_map[PERF_HW_EVENTS_MAX];
+};
+
+static struct x86_pmu x86_pmu __read_mostly;
+
+struct cpu_hw_counters {
+	struct perf_counter	*counters[X86_PMC_MAX];
+	unsigned long		used_mask[BITS_TO_LONGS(X86_PMC_MAX)];
+};
+
+static DEFINE_PER_CPU(struct cpu_hw_counters, cpu_hw_counters);
+
+static DEFINE_MUTEX(pmu_reserve_mutex);
+static int pmu_users;
+
+/*
+ * Bring the counter up to date with its PMC.  An NMI may do the same
+ * in the middle of it, hence the cmpxchg() on prev_count.
+ */
+static void x86_perf_counter_update(struct perf_counter *counter)
+{
+	struct hw_perf_counter *hwc = &counter->hw;
+	int shift = 64 - x86_pmu.counter_bits;
+	u64 prev, new;
+	s64 delta;
+
+	do {
+		prev = hwc->prev_count;
+		rdmsrl(x86_pmu.perfctr + hwc->idx, new);
+	} while (cmpxchg(&hwc->prev_count, prev, new) != prev);
+
+	/* the PMC is counter_bits wide: sign-extend the difference */
+	delta = (new << shift) - (prev << shift);
+	delta >>= shift;
+
+	atomic64_add(delta, &hwc->delta);
+	atomic64_sub(delta, &hwc->period_left);
+}
+
+/* Move the events seen into the count: under the context lock */
+static void x86_perf_counter_fold(struct perf_counter *counter)
+{
+	counter->count += xchg(&counter->hw.delta.counter, 0);
+}
+
+/* Start the PMC at minus the events left to the end of the period */
+static void x86_perf_counter_set_period(struct perf_counter *counter)
+{
+	struct hw_perf_counter *hwc = &counter->hw;
+	s64 period = counter->attr.sample_period;
+	s64 left = atomic64_read(&hwc->period_left);
+
+	if (!period || period > x86_pmu.max_period)
+		period = x86_pmu.max_period;
+	if (left <= 0) {
+		left += period;
+		if (left <= 0)
+			left = period;
+		atomic64_set(&hwc->period_left, left);
+	}
+	if (left > x86_pmu.max_period)
+		left = x86_pmu.max_period;
+
+	hwc->prev_count = (u64)-left;
+	wrmsrl(x86_pmu.perfctr + hwc->idx, (u64)-left & x86_pmu.counter_mask);
+}
+
+static int x86_pmu_enable(struct perf_counter *counter)
+{
+	struct cpu_hw_counters *cpuc = &__get_cpu_var(cpu_hw_counters);
+	struct hw_perf_counter *hwc = &counter->hw;
+	int idx;
+
+	idx = find_first_zero_bit(cpuc->used_mask, x86_pmu.num_counters);
+	if (idx >= x86_pmu.num_counters)
+		return -EBUSY;
+	__set_bit(idx, cpuc->used_mask);
+	hwc->idx = idx;
+	cpuc->counters[idx] = counter;
+
+	apic_write(APIC_LVTPC, APIC_DM_NMI);
+	x86_perf_counter_set_period(counter);
+	wrmsrl(x86_pmu.eventsel + idx,
+	       hwc->config | ARCH_PERFMON_EVENTSEL0_ENABLE);
+	return 0;
+}
+
+static void x86_pmu_disable(struct perf_counter *counter)
+{
+	struct cpu_hw_counters *cpuc = &__get_cpu_var(cpu_hw_counters);
+	struct hw_perf_counter *hwc = &counter->hw;
+	int idx = hwc->idx;
+
+	wrmsrl(x86_pmu.eventsel + idx, hwc->config);
+	/* the NMI of a last wrap still finds the counter */
+	x86_perf_counter_update(counter);
+	cpuc->counters[idx] = NULL;
+	__clear_bit(idx, cpuc->used_mask);
+	x86_perf_counter_fold(counter);
+}
+
+static void x86_pmu_read(struct perf_counter *counter)
+{
+	x86_perf_counter_update(counter);
+	x86_perf_counter_fold(counter);
+}
+
+static const struct perf_counter_ops x86_pmu_ops = {
+	.enable		= x86_pmu_enable,
+	.disable	= x86_pmu_disable,
+	.read		= x86_pmu_read,
+};
+
+/*
+ * A PMC has wrapped when its top bit is clear, having been started
+ * negative.  Returns whether one of ours has, else the NMI is for
+ * someone else.
+ */
+static int x86_pmu_nmi(struct pt_regs *regs, int cpu)
+{
+	struct cpu_hw_counters *cpuc = &per_cpu(cpu_hw_counters, cpu);
+	struct perf_counter *counter;
+	int idx, handled = 0;
+	u64 val;
+
+	for (idx = 0; idx < x86_pmu.num_counters; idx++) {
+		counter = cpuc->counters[idx];
+		if (!counter)
+			continue;
+		rdmsrl(x86_pmu.perfctr + idx, val);
+		if (val & (1ULL << (x86_pmu.counter_bits - 1)))
+			continue;
+
+		handled = 1;
+		x86_perf_counter_update(counter);
+		if (counter->attr.sample_period &&
+		    atomic64_read(&counter->hw.period_left) <= 0)
+			perf_counter_overflow(counter, regs, 1);
+		x86_perf_counter_set_period(counter);
+	}
+
+	/* some processors mask the LVT entry on delivery */
+	if (handled)
+		apic_write(APIC_LVTPC, APIC_DM_NMI);
+	return handled;
+}
+
+static int reserve_pmu(void)
+{
+	int err = 0;
+
+	mutex_lock(&pmu_reserve_mutex);
+	if (!pmu_users) {
+		err = reserve_lapic_nmi();
+		if (!err)
+			set_nmi_callback(x86_pmu_nmi);
+	}
+	if (!err)
+		pmu_users++;
+	mutex_unlock(&pmu_reserve_mutex);
+	return err;
+}
+
+static void x86_pmu_destroy(struct perf_counter *counter)
+{
+	mutex_lock(&pmu_reserve_mutex);
+	if (!--pmu_users) {
+		unset_nmi_callback();
+		synchronize_sched();
+		release_lapic_nmi();
+	}
+	mutex_unlock(&pmu_reserve_mutex);
+}
+
+const struct perf_counter_ops *hw_perf_counter_init(struct perf_counter *counter)
+{
+	struct perf_counter_attr *attr = &counter->attr;
+	struct hw_perf_counter *hwc = &counter->hw;
+	u64 config;
+	int err;
+
+	if (!x86_pmu.num_counters)
+		return ERR_PTR(-EOPNOTSUPP);
+
+	if (attr->type == PERF_TYPE_RAW)
+		config = attr->config & X86_RAW_EVENT_MASK;
+	else {
+		if (attr->config >= PERF_HW_EVENTS_MAX)
+			return ERR_PTR(-EINVAL);
+		config = x86_pmu.event_map[attr->config];
+		if (!config)
+			return ERR_PTR(-EOPNOTSUPP);
+	}
+
+	config |= ARCH_PERFMON_EVENTSEL_INT;
+	if (!(attr->flags & PERF_ATTR_EXCLUDE_USER))
+		config |= ARCH_PERFMON_EVENTSEL_USR;
+	if (!(attr->flags & PERF_ATTR_EXCLUDE_KERNEL))
+		config |= ARCH_PERFMON_EVENTSEL_OS;
+	hwc->config = config;
+	hwc->idx = -1;
+	atomic64_set(&hwc->period_left, attr->sample_period ?
+		     attr->sample_period : x86_pmu.max_period);
+
+	err = reserve_pmu();
+	if (err)
+		return ERR_PTR(err);
+	counter->destroy = x86_pmu_destroy;
+	return &x86_pmu_ops;
+}
+
+/*
+ * Callchains: the frame pointers of the kernel stack, when there are
+ * any, then those of the user stack.
+ */
+
+struct stack_frame {
+	const void __user	*next_fp;
+	unsigned long		return_address;
+};
+
+static inline void callchain_store(struct perf_callchain_entry *entry, u64 ip)
+{
+	if (entry->nr < PERF_MAX_STACK_DEPTH)
+		entry->ip[entry->nr++] = ip;
+}
+
+static void perf_callchain_kernel(struct pt_regs *regs,
+				  struct perf_callchain_entry *entry)
+{
+#ifdef CONFIG_FRAME_POINTER
+	unsigned long stack = regs->rsp & ~(THREAD_SIZE - 1);
+	unsigned long fp = regs->rbp;
+#endif
+
+	callchain_store(entry, PERF_CONTEXT_KERNEL);
+	callchain_store(entry, regs->rip);
+
+#ifdef CONFIG_FRAME_POINTER
+	/* frames go up the stack the interrupted code was on, and end there */
+	while (fp > regs->rsp && fp < stack + THREAD_SIZE - sizeof(long) * 2 &&
+	       entry->nr < PERF_MAX_STACK_DEPTH) {
+		struct stack_frame *frame = (struct stack_frame *)fp;
+
+		callchain_store(entry, frame->return_address);
+		if ((unsigned long)frame->next_fp <= fp)
+			break;
+		fp = (unsigned long)frame->next_fp;
+	}
+#endif
+}
+
+/* The page fault handler fails the copy instead of sleeping */
+static int copy_stack_frame(const void __user *fp, struct stack_frame *frame)
+{
+	int ret = 1;
+
+	if (!access_ok(VERIFY_READ, fp, sizeof(*frame)))
+		return 0;
+	inc_preempt_count();
+	if (__copy_from_user_inatomic(frame, fp, sizeof(*frame)))
+		ret = 0;
+	dec_preempt_count();
+	return ret;
+}
+
+static void perf_callchain_user(struct pt_regs *regs,
+				struct perf_callchain_entry *entry)
+{
+	const void __user *fp = (const void __user *)regs->rbp;
+	struct stack_frame frame;
+
+	callchain_store(entry, PERF_CONTEXT_USER);
+	callchain_store(entry, regs->rip);
+
+	/* 32-bit frames are not walked */
+	if (test_thread_flag(TIF_IA32))
+		return;
+
+	while (entry->nr < PERF_MAX_STACK_DEPTH) {
+		if ((unsigned long)fp < regs->rsp)
+			break;
+		if (!copy_stack_frame(fp, &frame))
+			break;
+		callchain_store(entry, frame.return_address);
+		fp = frame.next_fp;
+	}
+}
+
+void perf_callchain(struct pt_regs *regs, struct perf_callchain_entry *entry)
+{
+	if (!regs)
+		return;
+	if (!user_mode(regs)) {
+		perf_callchain_kernel(regs, entry);
+		if (!current->mm)
+			return;
+		regs = task_pt_regs(current);
+	}
+	perf_callchain_user(regs, entry);
+}
+
+/*
+ * Intel architectural perfmon: CPUID leaf 0xA gives the number and
+ * width of the PMCs, and which of the architectural events there are.
+ */
+static int __init intel_pmu_init(void)
+{
+	/* the CPUID.0xA ebx bit that says each of ours is missing */
+	static const int unavailable_bit[PERF_HW_EVENTS_MAX] = {
+		[PERF_COUNT_CPU_CYCLES]			= 0,
+		[PERF_COUNT_INSTRUCTIONS]		= 1,
+		[PERF_COUNT_CACHE_REFERENCES]		= 3,
+		[PERF_COUNT_CACHE_MISSES]		= 4,
+		[PERF_COUNT_BRANCH_INSTRUCTIONS]	= 5,
+		[PERF_COUNT_BRANCH_MISSES]		= 6,
+	};
+	static const u64 intel_event_map[PERF_HW_EVENTS_MAX] = {
+		[PERF_COUNT_CPU_CYCLES]			= 0x003c,
+		[PERF_COUNT_INSTRUCTIONS]		= 0x00c0,
+		[PERF_COUNT_CACHE_REFERENCES]		= 0x4f2e,
+		[PERF_COUNT_CACHE_MISSES]		= 0x412e,
+		[PERF_COUNT_BRANCH_INSTRUCTIONS]	= 0x00c4,
+		[PERF_COUNT_BRANCH_MISSES]		= 0x00c5,
+	};
+	unsigned int eax, ebx, ecx, edx;
+	int i;
+
+	if (boot_cpu_data.cpuid_level < 0xa)
+		return -ENODEV;
+	cpuid(0xa, &eax, &ebx, &ecx, &edx);
+	if ((eax & 0xff) < 1)
+		return -ENODEV;
+
+	x86_pmu.name = "Intel architectural";
+	x86_pmu.eventsel = MSR_ARCH_PERFMON_EVENTSEL0;
+	x86_pmu.perfctr = MSR_ARCH_PERFMON_PERFCTR0;
+	x86_pmu.num_counters = min_t(int, (eax >> 8) & 0xff, X86_PMC_MAX);
+	x86_pmu.counter_bits = (eax >> 16) & 0xff;
+	/* writes to the PMCs only take 32 bits, sign-extended */
+	x86_pmu.max_period = (1ULL << 31) - 1;
+	for (i = 0; i < PERF_HW_EVENTS_MAX; i++)
+		if (!(ebx & (1 << unavailable_bit[i])))
+			x86_pmu.event_map[i] = intel_event_map[i];
+	return 0;
+}
+
+static int __init amd_pmu_init(void)
+{
+	static const u64 amd_event_map[PERF_HW_EVENTS_MAX] = {
+		[PERF_COUNT_CPU_CYCLES]			= 0x0076,
+		[PERF_COUNT_INSTRUCTIONS]		= 0x00c0,
+		[PERF_COUNT_CACHE_REFERENCES]		= 0x0080,
+		[PERF_COUNT_CACHE_MISSES]		= 0x0081,
+		[PERF_COUNT_BRANCH_INSTRUCTIONS]	= 0x00c4,
+		[PERF_COUNT_BRANCH_MISSES]		= 0x00c5,
+	};
+
+	if (boot_cpu_data.x86 < 6)
+		return -ENODEV;
+
+	x86_pmu.name = "AMD";
+	x86_pmu.eventsel = MSR_K7_EVNTSEL0;
+	x86_pmu.perfctr = MSR_K7_PERFCTR0;
+	x86_pmu.num_counters = 4;
+	x86_pmu.counter_bits = 48;
+	x86_pmu.max_period = (1ULL << 47) - 1;
+	memcpy(x86_pmu.event_map, amd_event_map, sizeof(amd_event_map));
+	return 0;
+}
+
+static int __init init_hw_perf_counters(void)
+{
+	int err = -ENODEV;
+
+	if (!cpu_has_apic)
+		return 0;
+	if (boot_cpu_data.x86_vendor == X86_VENDOR_INTEL &&
+	    cpu_has(&boot_cpu_data, X86_FEATURE_ARCH_PERFMON))
+		err = intel_pmu_init();
+	else if (boot_cpu_data.x86_vendor == X86_VENDOR_AMD)
+		err = amd_pmu_init();
+	if (err) {
+		x86_pmu.num_counters = 0;
+		return 0;
+	}
+
+	x86_pmu.counter_mask = (1ULL << x86_pmu.counter_bits) - 1;
+	if (x86_pmu.max_period > (1LL << (x86_pmu.counter_bits - 1)) - 1)
+		x86_pmu.max_period = (1LL << (x86_pmu.counter_bits - 1)) - 1;
+	printk(KERN_INFO "Performance counters: %s PMU, %d counters, "
+	       "%d bits wide\n", x86_pmu.name, x86_pmu.num_counters,
+	       x86_pmu.counter_bits);
+	return 0;
+}
+arch_initcall(init_hw_perf_counters);
@@ -40,15 +40,16 @@
  *
  * 	More scalable flush, from Andi Kleen
  *
- * 	To avoid global state use 8 different call vectors.
- * 	Each CPU uses a specific vector to trigger flushes on other
- * 	CPUs. Depending on the received vector the target CPUs look into
- *	the right per cpu variable for the flush data.
+ *	To avoid global state every CPU posts its flushes in its own per
+ *	cpu variable, and marks itself in the flush_senders mask of each
+ *	target CPU. A CPU sends one flush at a time with preemption
+ *	disabled, so the flush data needs no lock and flushes from all
+ *	CPUs proceed in parallel; a target serves every sender marked in
+ *	its mask in one interrupt.
  *
- * 	With more than 8 CPUs they are hashed to the 8 available
- * 	vectors. The limited global vector space forces us to this right now.
- *	In future when interrupts are split into per CPU domains this could be
- *	fixed, at the cost of triggering multiple IPIs in some cases.
+ *	The IPI still goes out on one of 8 call vectors, hashed by sender,
+ *	so that IPIs from different CPUs don't merge in the APIC, but the
+ *	vector no longer tells where the flush data is.
  */
 
 union smp_flush_state {
@@ -57,7 +58,6 @@ union smp_flush_state {
 		struct mm_struct *flush_mm;
 		unsigned long flush_va;
 #define FLUSH_ALL	-1ULL
-		spinlock_t tlbstate_lock;
 	};
 	char pad[SMP_CACHE_BYTES];
 } ____cacheline_aligned;
@@ -66,6 +66,7 @@ union smp_flush_state {
    to a full cache line because other CPUs can access it and we don't
    want false sharing in the per cpu data segment. */
 static DEFINE_PER_CPU(union smp_flush_state, flush_state);
+static DEFINE_PER_CPU(cpumask_t, flush_senders);
 
 /*
  * We cannot call mmdrop() because we are in interrupt context, 
@@ -131,84 +132,71 @@ asmlinkage void smp_invalidate_interrupt(struct pt_regs *regs)
 {
 	int cpu;
 	int sender;
+	int flushed = 0;
+	cpumask_t *senders;
 	union smp_flush_state *f;
 
 	cpu = smp_processor_id();
+	senders = &per_cpu(flush_senders, cpu);
+
 	/*
-	 * orig_rax contains the negated interrupt vector.
-	 * Use that to determine where the sender put the data.
+	 * An empty mask is not a BUG(): nobody can quote the line from
+	 * the intel manual that guarantees an IPI to multiple CPUs is
+	 * retried _only_ on the erroring CPUs, and a sender that marked
+	 * us after an earlier IPI had us running has already been served.
 	 */
-	sender = ~regs->orig_rax - INVALIDATE_TLB_VECTOR_START;
-	f = &per_cpu(flush_state, sender);
-
-	if (!cpu_isset(cpu, f->flush_cpumask))
-		goto out;
-		/* 
-		 * This was a BUG() but until someone can quote me the
-		 * line from the intel manual that guarantees an IPI to
-		 * multiple CPUs is retried _only_ on the erroring CPUs
-		 * its staying as a return
-		 *
-		 * BUG();
-		 */
-		 
-	if (f->flush_mm == read_pda(active_mm)) {
-		if (read_pda(mmu_state) == TLBSTATE_OK) {
-			if (f->flush_va == FLUSH_ALL)
-				local_flush_tlb();
-			else
-				__flush_tlb_one(f->flush_va);
-		} else
-			leave_mm(cpu);
-	}
-out:
 	ack_APIC_irq();
-	cpu_clear(cpu, f->flush_cpumask);
+	for_each_cpu_mask(sender, *senders) {
+		if (!test_and_clear_bit(sender, cpus_addr(*senders)))
+			continue;
+		f = &per_cpu(flush_state, sender);
+
+		if (!flushed && f->flush_mm == read_pda(active_mm)) {
+			if (read_pda(mmu_state) == TLBSTATE_OK) {
+				if (f->flush_va == FLUSH_ALL) {
+					local_flush_tlb();
+					flushed = 1;
+				} else
+					__flush_tlb_one(f->flush_va);
+			} else {
+				leave_mm(cpu);
+				flushed = 1;
+			}
+		}
+		cpu_clear(cpu, f->flush_cpumask);
+	}
 }
 
 static void flush_tlb_others(cpumask_t cpumask, struct mm_struct *mm,
 						unsigned long va)
 {
-	int sender;
+	int self, cpu;
 	union smp_flush_state *f;
 
 	/* Caller has disabled preemption */
-	sender = smp_processor_id() % NUM_INVALIDATE_TLB_VECTORS;
-	f = &per_cpu(flush_state, sender);
-
-	/* Could avoid this lock when
-	   num_online_cpus() <= NUM_INVALIDATE_TLB_VECTORS, but it is
-	   probably not worth checking this for a cache-hot lock. */
-	spin_lock(&f->tlbstate_lock);
+	self = smp_processor_id();
+	f = &per_cpu(flush_state, self);
 
 	f->flush_mm = mm;
 	f->flush_va = va;
-	cpus_or(f->flush_cpumask, cpumask, f->flush_cpumask);
+	f->flush_cpumask = cpumask;
+	smp_wmb();
+	for_each_cpu_mask(cpu, cpumask)
+		cpu_set(self, per_cpu(flush_senders, cpu));
 
 	/*
 	 * We have to send the IPI only to
 	 * CPUs affected.
 	 */
-	send_IPI_mask(cpumask, INVALIDATE_TLB_VECTOR_START + sender);
+	send_IPI_mask(cpumask, INVALIDATE_TLB_VECTOR_START +
+			       self % NUM_INVALIDATE_TLB_VECTORS);
 
 	while (!cpus_empty(f->flush_cpumask))
 		cpu_relax();
 
 	f->flush_mm = NULL;
 	f->flush_va = 0;
-	spin_unlock(&f->tlbstate_lock);
 }
-
-int __cpuinit init_smp_flush(void)
-{
-	int i;
-	for_each_cpu_mask(i, cpu_possible_map) {
-		spin_lock_init(&per_cpu(flush_state, i).tlbstate_lock);
-	}
-	return 0;
-}
-
-core_initcall(init_smp_flush);
 	
 void flush_tlb_current_task(void)
 {
@@ -173,6 +173,7 @@ int do_settimeofday(struct timespec *tv)
 
 	set_normalized_timespec(&xtime, sec, nsec);
 	set_normalized_timespec(&wall_to_monotonic, wtm_sec, wtm_nsec);
+	vxtime.wall_to_monotonic = wall_to_monotonic;
 
 	ntp_clear();
 
@@ -431,6 +432,7 @@ void main_timer_handler(struct pt_regs *regs)
  */
 
 	do_timer(regs);
+	vxtime.wall_to_monotonic = wall_to_monotonic;
 #ifndef CONFIG_SMP
 	update_process_times(user_mode(regs));
 #endif
@@ -906,6 +908,7 @@ void __init time_init(void)
 
 	set_normalized_timespec(&wall_to_monotonic,
 	                        -xtime.tv_sec, -xtime.tv_nsec);
+	vxtime.wall_to_monotonic = wall_to_monotonic;
 
 	if (!hpet_init())
                 vxtime_hz = (FSEC_PER_SEC + hpet_period / 2) / hpet_period;
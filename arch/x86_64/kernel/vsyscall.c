@@ -81,6 +81,48 @@ static __always_inline void do_vgettimeofday(struct timeval * tv)
 	tv->tv_usec = usec % 1000000;
 }
 
+/*
+ * The same reads for clock_gettime(), kept in nanoseconds.  The coarse
+ * clocks stop at the last tick and leave the TSC and HPET alone.
+ */
+static __always_inline void do_vclock_gettime(clockid_t clock,
+					      struct timespec *ts)
+{
+	long sequence, t;
+	unsigned long sec, nsec;
+
+	do {
+		sequence = read_seqbegin(&__xtime_lock);
+
+		sec = __xtime.tv_sec;
+		nsec = __xtime.tv_nsec;
+		if (clock == CLOCK_MONOTONIC ||
+		    clock == CLOCK_MONOTONIC_COARSE) {
+			sec += __vxtime.wall_to_monotonic.tv_sec;
+			nsec += __vxtime.wall_to_monotonic.tv_nsec;
+		}
+		if (clock == CLOCK_REALTIME_COARSE ||
+		    clock == CLOCK_MONOTONIC_COARSE)
+			continue;
+
+		nsec += (__jiffies - __wall_jiffies) * (NSEC_PER_SEC / HZ);
+		if (__vxtime.mode != VXTIME_HPET) {
+			t = get_cycles_sync();
+			if (t < __vxtime.last_tsc)
+				t = __vxtime.last_tsc;
+			nsec += (((t - __vxtime.last_tsc) *
+				  __vxtime.tsc_quot) >> 32) * NSEC_PER_USEC;
+		} else {
+			nsec += (((readl((void *)fix_to_virt(VSYSCALL_HPET) + 0xf0) -
+				   __vxtime.last) * __vxtime.quot) >> 32) *
+				NSEC_PER_USEC;
+		}
+	} while (read_seqretry(&__xtime_lock, sequence));
+
+	ts->tv_sec = sec + nsec / NSEC_PER_SEC;
+	ts->tv_nsec = nsec % NSEC_PER_SEC;
+}
+
 /* RED-PEN may want to readd seq locking, but then the variable should be write-once. */
 static __always_inline void do_get_tz(struct timezone * tz)
 {
@@ -116,6 +158,16 @@ int __vsyscall(0) vgettimeofday(struct timeval * tv, struct timezone * tz)
 	return 0;
 }
 
+static __always_inline long clock_gettime_syscall(clockid_t clock,
+						  struct timespec *ts)
+{
+	long ret;
+	asm volatile("syscall"
+		: "=a" (ret)
+		: "0" (__NR_clock_gettime),"D" (clock),"S" (ts) : __syscall_clobber);
+	return ret;
+}
+
 /* This will break when the xtime seconds get inaccurate, but that is
  * unlikely */
 time_t __vsyscall(1) vtime(time_t *t)
@@ -127,9 +179,23 @@ time_t __vsyscall(1) vtime(time_t *t)
 	return __xtime.tv_sec;
 }
 
-long __vsyscall(2) venosys_0(void)
+/*
+ * Other clocks are left to the system call, which is not NOPed out by
+ * the vsyscall64 sysctl like the two above.
+ */
+long __vsyscall(2) vclock_gettime(clockid_t clock, struct timespec *ts)
 {
-	return -ENOSYS;
+	if (!__sysctl_vsyscall)
+		return clock_gettime_syscall(clock, ts);
+	switch (clock) {
+	case CLOCK_REALTIME:
+	case CLOCK_MONOTONIC:
+	case CLOCK_REALTIME_COARSE:
+	case CLOCK_MONOTONIC_COARSE:
+		do_vclock_gettime(clock, ts);
+		return 0;
+	}
+	return clock_gettime_syscall(clock, ts);
 }
 
 long __vsyscall(3) venosys_1(void)
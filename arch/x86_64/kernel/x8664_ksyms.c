@@ -53,6 +53,8 @@ extern void * __memcpy(void *,const void *,__kernel_size_t);
 EXPORT_SYMBOL(memset);
 EXPORT_SYMBOL(memcpy);
 EXPORT_SYMBOL(__memcpy);
+EXPORT_SYMBOL(__memcpy_nt);
+EXPORT_SYMBOL(__memcpy_cached);
 
 EXPORT_SYMBOL(empty_zero_page);
 EXPORT_SYMBOL(init_level4_pgt);
@@ -0,0 +1,137 @@
+/*
+ * Measure where non-temporal stores start to pay off for memcpy.
+ *
+ * For each size the module copies a buffer with __memcpy_cached and with
+ * __memcpy_nt, and charges each with the time to read back a working set
+ * of half the cache afterwards: a cached copy is quicker on its own, but
+ * evicts what the caller was using.  The smallest size from which the
+ * non-temporal copy wins at every larger size is reported, and made the
+ * copy_nt_threshold if the module is loaded with apply=1.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ */
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/kernel.h>
+#include <linux/init.h>
+#include <linux/sched.h>
+#include <linux/string.h>
+#include <linux/vmalloc.h>
+#include <linux/timex.h>
+#include <asm/processor.h>
+
+#define BENCH_MIN_SIZE	(16UL << 10)
+#define BENCH_MAX_SIZE	(32UL << 20)
+#define BENCH_NSIZES	12	/* 16K << 11 == BENCH_MAX_SIZE */
+
+static int apply;
+module_param(apply, bool, 0);
+MODULE_PARM_DESC(apply, "Set copy_nt_threshold to the measured crossover");
+
+static int rounds = 8;
+module_param(rounds, int, 0);
+MODULE_PARM_DESC(rounds, "Copies timed per size and method");
+
+typedef void *(*copy_fn_t)(void *, const void *, size_t);
+
+static unsigned long touch(const char *ws, unsigned long len)
+{
+	const volatile unsigned long *p = (const volatile unsigned long *)ws;
+	unsigned long i, sum = 0;
+
+	for (i = 0; i < len / sizeof(long); i += 64 / sizeof(long))
+		sum += p[i];
+	return sum;
+}
+
+static cycles_t bench_one(copy_fn_t fn, char *dst, const char *src,
+			  unsigned long size, const char *ws,
+			  unsigned long ws_len)
+{
+	cycles_t t0, total = 0;
+	int i;
+
+	for (i = 0; i < rounds; i++) {
+		preempt_disable();
+		touch(ws, ws_len);
+		t0 = get_cycles();
+		fn(dst, src, size);
+		touch(ws, ws_len);
+		total += get_cycles() - t0;
+		preempt_enable();
+		cond_resched();
+	}
+	return total / rounds;
+}
+
+static int __init copy_bench_init(void)
+{
+	cycles_t cached[BENCH_NSIZES], nt[BENCH_NSIZES];
+	unsigned long size, ws_len, crossover = ~0UL;
+	char *src, *dst, *ws;
+	int i, ret = -ENOMEM;
+
+	if (rounds < 1)
+		return -EINVAL;
+
+	ws_len = 256UL << 10;
+	if (boot_cpu_data.x86_cache_size > 0)
+		ws_len = boot_cpu_data.x86_cache_size * 1024UL / 2;
+
+	src = vmalloc(BENCH_MAX_SIZE);
+	dst = vmalloc(BENCH_MAX_SIZE);
+	ws = vmalloc(ws_len);
+	if (!src || !dst || !ws)
+		goto out;
+	memset(src, 0x5a, BENCH_MAX_SIZE);
+	memset(dst, 0, BENCH_MAX_SIZE);
+	memset(ws, 0, ws_len);
+
+	for (i = 0, size = BENCH_MIN_SIZE; i < BENCH_NSIZES; i++, size <<= 1) {
+		cached[i] = bench_one(__memcpy_cached, dst, src, size,
+				      ws, ws_len);
+		nt[i] = bench_one(__memcpy_nt, dst, src, size, ws, ws_len);
+		printk(KERN_INFO "copy_bench: %8lu bytes: cached %llu, "
+		       "non-temporal %llu cycles\n", size,
+		       (unsigned long long)cached[i],
+		       (unsigned long long)nt[i]);
+	}
+
+	/* the smallest size from which non-temporal wins throughout */
+	for (i = BENCH_NSIZES - 1; i >= 0 && nt[i] <= cached[i]; i--)
+		crossover = BENCH_MIN_SIZE << i;
+
+	if (crossover == ~0UL)
+		printk(KERN_INFO "copy_bench: non-temporal copies do not pay "
+		       "off up to %lu bytes\n", BENCH_MAX_SIZE);
+	else
+		printk(KERN_INFO "copy_bench: non-temporal copies pay off "
+		       "from %lu bytes\n", crossover);
+	printk(KERN_INFO "copy_bench: copy_nt_threshold is %lu\n",
+	       copy_nt_threshold);
+
+	if (apply) {
+		copy_nt_threshold = max(crossover, COPY_NT_MIN);
+		printk(KERN_INFO "copy_bench: copy_nt_threshold set to %lu\n",
+		       copy_nt_threshold);
+	}
+	ret = 0;
+out:
+	vfree(ws);
+	vfree(dst);
+	vfree(src);
+	return ret;
+}
+
+static void __exit copy_bench_exit(void)
+{
+}
+
+module_init(copy_bench_init);
+module_exit(copy_bench_exit);
+
+MODULE_DESCRIPTION("Non-temporal memcpy threshold benchmark");
+MODULE_LICENSE("GPL");
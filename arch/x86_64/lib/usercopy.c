@@ -6,7 +6,11 @@
  * Copyright 2002 Andi Kleen <ak@suse.de>
  */
 #include <linux/module.h>
+#include <linux/init.h>
+#include <linux/cache.h>
+#include <linux/string.h>
 #include <asm/uaccess.h>
+#include <asm/processor.h>
 
 /*
  * Copy a null terminated string from userspace.
@@ -164,3 +168,41 @@ unsigned long copy_in_user(void __user *to, const void __user *from, unsigned le
 }
 EXPORT_SYMBOL(copy_in_user);
 
+/*
+ * memcpy and copy_user_generic use non-temporal stores for copies of at
+ * least this many bytes.  Half the last level cache is the default: both
+ * source and destination go through it, and a copy that size leaves no
+ * room for whatever the caller was working on.  ~0UL (never) until the
+ * cache size is known, or if copy_nt_threshold=0 is given.
+ */
+unsigned long copy_nt_threshold __read_mostly = ~0UL;
+EXPORT_SYMBOL(copy_nt_threshold);
+
+static unsigned long copy_nt_param;
+static int copy_nt_param_set;
+
+static int __init copy_nt_setup(char *str)
+{
+	copy_nt_param = memparse(str, &str);
+	copy_nt_param_set = 1;
+	return 1;
+}
+__setup("copy_nt_threshold=", copy_nt_setup);
+
+static int __init copy_nt_init(void)
+{
+	unsigned long n;
+
+	if (copy_nt_param_set) {
+		if (!copy_nt_param)
+			return 0;
+		n = copy_nt_param;
+	} else {
+		if (boot_cpu_data.x86_cache_size <= 0)
+			return 0;
+		n = boot_cpu_data.x86_cache_size * 1024UL / 2;
+	}
+	copy_nt_threshold = max(n, COPY_NT_MIN);
+	return 0;
+}
+core_initcall(copy_nt_init);
@@ -23,6 +23,7 @@
 #include <linux/compiler.h>
 #include <linux/module.h>
 #include <linux/kprobes.h>
+#include <linux/perf_counter.h>
 
 #include <asm/system.h>
 #include <asm/uaccess.h>
@@ -413,6 +414,18 @@ asmlinkage void __kprobes do_page_fault(struct pt_regs *regs,
 	if (unlikely(in_atomic() || !mm))
 		goto bad_area_nosemaphore;
 
+	perf_swcounter_event(PERF_COUNT_PAGE_FAULTS, 1, regs);
+
+	/*
+	 * Try a not-present fault on plain anonymous memory without
+	 * mmap_sem first, so as not to queue behind a writer.
+	 */
+	if (!(error_code & PF_PROT) &&
+	    handle_speculative_fault(mm, address, error_code & PF_WRITE)) {
+		tsk->min_flt++;
+		return;
+	}
+
  again:
 	/* When running in the kernel we expect faults to occur only to
 	 * addresses in user space.  All other faults represent errors in the
@@ -0,0 +1,558 @@
+/*
+ * bpf_jit_comp.c : BPF JIT compiler for x86_64
+ *
+ * Translates classic BPF socket filters into native code when they are
+ * attached, so that sk_filter() and the packet socket do not have to go
+ * through the sk_run_filter() interpreter for every packet.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; version 2
+ * of the License.
+ */
+#include <linux/module.h>
+#include <linux/moduleloader.h>
+#include <linux/skbuff.h>
+#include <linux/slab.h>
+#include <linux/workqueue.h>
+#include <linux/filter.h>
+#include <linux/string.h>
+
+int bpf_jit_enable __read_mostly;
+
+/*
+ * assembly code in arch/x86_64/net/bpf_jit.S
+ */
+extern u8 sk_load_word[], sk_load_half[], sk_load_byte[], sk_load_byte_msh[];
+
+static inline u8 *emit_code(u8 *ptr, u32 bytes, unsigned int len)
+{
+	if (len == 1)
+		*ptr = bytes;
+	else if (len == 2)
+		*(u16 *)ptr = bytes;
+	else {
+		*(u32 *)ptr = bytes;
+		barrier();
+	}
+	return ptr + len;
+}
+
+#define EMIT(bytes, len)	do { prog = emit_code(prog, bytes, len); } while (0)
+
+#define EMIT1(b1)		EMIT(b1, 1)
+#define EMIT2(b1, b2)		EMIT((b1) + ((b2) << 8), 2)
+#define EMIT3(b1, b2, b3)	EMIT((b1) + ((b2) << 8) + ((b3) << 16), 3)
+#define EMIT4(b1, b2, b3, b4)   EMIT((b1) + ((b2) << 8) + ((b3) << 16) + ((b4) << 24), 4)
+#define EMIT1_off32(b1, off)	do { EMIT1(b1); EMIT(off, 4); } while (0)
+
+#define CLEAR_A() EMIT2(0x31, 0xc0) /* xor %eax,%eax */
+#define CLEAR_X() EMIT2(0x31, 0xdb) /* xor %ebx,%ebx */
+
+/* offset of the next byte to be emitted, from the start of the image */
+#define CUR_ADDR	(proglen + (prog - temp))
+
+static inline int is_imm8(int value)
+{
+	return value <= 127 && value >= -128;
+}
+
+static inline int is_near(int offset)
+{
+	return offset <= 127 && offset >= -128;
+}
+
+/* jmp to an image offset */
+#define EMIT_JMP(target)						\
+do {									\
+	int __off = (target) - (CUR_ADDR + 2);				\
+	if (is_near(__off))						\
+		EMIT2(0xeb, __off & 0xff);	/* jmp .+off8 */	\
+	else {								\
+		__off = (target) - (CUR_ADDR + 5);			\
+		EMIT1_off32(0xe9, __off);	/* jmp .+off32 */	\
+	}								\
+} while (0)
+
+/* list of x86 cond jumps opcodes (. + s8)
+ * Add 0x10 (and an extra 0x0f) to generate far jumps (. + s32)
+ */
+#define X86_JB  0x72
+#define X86_JAE 0x73
+#define X86_JE  0x74
+#define X86_JNE 0x75
+#define X86_JBE 0x76
+#define X86_JA  0x77
+
+#define EMIT_COND_JMP(op, target)					\
+do {									\
+	int __off = (target) - (CUR_ADDR + 2);				\
+	if (is_near(__off))						\
+		EMIT2(op, __off & 0xff);	/* jxx .+off8 */	\
+	else {								\
+		__off = (target) - (CUR_ADDR + 6);			\
+		EMIT2(0x0f, (op) + 0x10);				\
+		EMIT(__off, 4);			/* jxx .+off32 */	\
+	}								\
+} while (0)
+
+/* call one of the load helpers, rel32 from the end of the call */
+#define EMIT_CALL(func)							\
+do {									\
+	u32 __rel = (u8 *)(func) - (image + CUR_ADDR + 5);		\
+	EMIT1_off32(0xe8, __rel);					\
+} while (0)
+
+#define COND_SEL(CODE, TOP, FOP)	\
+	case CODE:			\
+		t_op = TOP;		\
+		f_op = FOP;		\
+		goto cond_branch
+
+#define SEEN_DATAREF 1 /* might call external helpers */
+#define SEEN_XREG    2 /* ebx is used */
+#define SEEN_MEM     4 /* use mem[] for temporary storage */
+
+/*
+ * Stack frame of a compiled filter, relative to %rbp:
+ *   -8		saved %rbx
+ *   -12	scratch word for sk_filter_load_slow()
+ *   -80..-20	mem[BPF_MEMWORDS]
+ */
+#define BPF_FRAME_SIZE	80
+#define MEM_OFF(k)	(-BPF_FRAME_SIZE + 4 * (k))
+
+/* mov -8(%rbp),%rbx; leaveq; ret */
+#define EMIT_EPILOGUE()						\
+do {								\
+	EMIT4(0x48, 0x8b, 0x5d, 0xf8);				\
+	EMIT2(0xc9, 0xc3);					\
+} while (0)
+
+/* op off(%rdi),reg ; rex is 0 when no REX prefix is needed and
+ * modrm is the disp8 form of the addressing byte
+ */
+#define EMIT_SKB_FIELD(rex, op, modrm, field)				\
+do {									\
+	if (rex)							\
+		EMIT1(rex);						\
+	if (is_imm8(offsetof(struct sk_buff, field)))			\
+		EMIT3(op, modrm, offsetof(struct sk_buff, field));	\
+	else {								\
+		EMIT2(op, (modrm) + 0x40);				\
+		EMIT(offsetof(struct sk_buff, field), 4);		\
+	}								\
+} while (0)
+
+void bpf_jit_compile(struct sk_filter *fp)
+{
+	u8 temp[64];
+	u8 *prog;
+	unsigned int proglen, ilen;
+	int i, pass, changed;
+	u8 t_op, f_op, seen = 0;
+	u8 *image = NULL;
+	unsigned int cleanup_addr;	/* epilogue code offset */
+	unsigned int ret0_addr;		/* "return 0" code offset */
+	unsigned int *addrs;
+	struct sock_filter *filter = fp->insns;
+	int flen = fp->len;
+
+	if (!bpf_jit_enable)
+		return;
+
+	addrs = kmalloc(flen * sizeof(*addrs), GFP_KERNEL);
+	if (addrs == NULL)
+		return;
+
+	/* Before first pass, make a rough estimation of addrs[]
+	 * each bpf instruction is translated to less than 64 bytes
+	 */
+	for (proglen = 0, i = 0; i < flen; i++) {
+		proglen += 64;
+		addrs[i] = proglen;
+	}
+	cleanup_addr = proglen;
+	ret0_addr = cleanup_addr + 6;
+
+	for (pass = 0; pass < 10; pass++) {
+		changed = 0;
+		proglen = 0;
+		prog = temp;
+
+		/* no prologue/epilogue for trivial filters (RET something) */
+		if (seen) {
+			EMIT4(0x55, 0x48, 0x89, 0xe5);	 /* push %rbp; mov %rsp,%rbp */
+			EMIT4(0x48, 0x83, 0xec, BPF_FRAME_SIZE); /* subq $80,%rsp */
+			/* must save %rbx in case bpf_error is hit */
+			EMIT4(0x48, 0x89, 0x5d, 0xf8);	 /* mov %rbx,-8(%rbp) */
+			if (seen & SEEN_XREG)
+				CLEAR_X(); /* X starts out as 0 */
+
+			/*
+			 * If this filter needs to access skb data,
+			 * loads r9 and r8 with :
+			 *  r9 = skb->len - skb->data_len
+			 *  r8 = skb->data
+			 */
+			if (seen & SEEN_DATAREF) {
+				/* mov off(%rdi),%r9d */
+				EMIT_SKB_FIELD(0x44, 0x8b, 0x4f, len);
+				/* sub off(%rdi),%r9d */
+				EMIT_SKB_FIELD(0x44, 0x2b, 0x4f, data_len);
+				/* mov off(%rdi),%r8 */
+				EMIT_SKB_FIELD(0x4c, 0x8b, 0x47, data);
+			}
+		}
+
+		switch (filter[0].code) {
+		case BPF_RET|BPF_K:
+		case BPF_LD|BPF_W|BPF_LEN:
+		case BPF_LD|BPF_IMM:
+		case BPF_LD|BPF_W|BPF_ABS:
+		case BPF_LD|BPF_H|BPF_ABS:
+		case BPF_LD|BPF_B|BPF_ABS:
+			/* first instruction sets A register (or is RET 'constant') */
+			break;
+		default:
+			/* A starts out as 0 */
+			CLEAR_A();
+		}
+
+		ilen = prog - temp;
+		if (image)
+			memcpy(image, temp, ilen);
+		proglen = ilen;
+
+		for (i = 0; i < flen; i++) {
+			unsigned int K = filter[i].k;
+			unsigned int t_addr, f_addr;
+
+			prog = temp;
+
+			switch (filter[i].code) {
+			case BPF_ALU|BPF_ADD|BPF_X: /* A += X; */
+				seen |= SEEN_XREG;
+				EMIT2(0x01, 0xd8);		/* add %ebx,%eax */
+				break;
+			case BPF_ALU|BPF_ADD|BPF_K: /* A += K; */
+				if (!K)
+					break;
+				if (is_imm8(K))
+					EMIT3(0x83, 0xc0, K & 0xff); /* add imm8,%eax */
+				else
+					EMIT1_off32(0x05, K);	/* add imm32,%eax */
+				break;
+			case BPF_ALU|BPF_SUB|BPF_X: /* A -= X; */
+				seen |= SEEN_XREG;
+				EMIT2(0x29, 0xd8);		/* sub %ebx,%eax */
+				break;
+			case BPF_ALU|BPF_SUB|BPF_K: /* A -= K */
+				if (!K)
+					break;
+				if (is_imm8(K))
+					EMIT3(0x83, 0xe8, K & 0xff); /* sub imm8,%eax */
+				else
+					EMIT1_off32(0x2d, K);	/* sub imm32,%eax */
+				break;
+			case BPF_ALU|BPF_MUL|BPF_X: /* A *= X; */
+				seen |= SEEN_XREG;
+				EMIT3(0x0f, 0xaf, 0xc3);	/* imul %ebx,%eax */
+				break;
+			case BPF_ALU|BPF_MUL|BPF_K: /* A *= K */
+				if (is_imm8(K))
+					EMIT3(0x6b, 0xc0, K & 0xff); /* imul imm8,%eax,%eax */
+				else {
+					EMIT2(0x69, 0xc0);	/* imul imm32,%eax */
+					EMIT(K, 4);
+				}
+				break;
+			case BPF_ALU|BPF_DIV|BPF_X: /* A /= X; */
+				seen |= SEEN_XREG;
+				EMIT2(0x85, 0xdb);		/* test %ebx,%ebx */
+				EMIT_COND_JMP(X86_JE, ret0_addr);
+				EMIT4(0x31, 0xd2, 0xf7, 0xf3);	/* xor %edx,%edx; div %ebx */
+				break;
+			case BPF_ALU|BPF_DIV|BPF_K: /* A /= K; K != 0 */
+				EMIT1_off32(0xb9, K);		/* mov $imm32,%ecx */
+				EMIT4(0x31, 0xd2, 0xf7, 0xf1);	/* xor %edx,%edx; div %ecx */
+				break;
+			case BPF_ALU|BPF_AND|BPF_X:
+				seen |= SEEN_XREG;
+				EMIT2(0x21, 0xd8);		/* and %ebx,%eax */
+				break;
+			case BPF_ALU|BPF_AND|BPF_K:
+				if (is_imm8(K))
+					EMIT3(0x83, 0xe0, K & 0xff); /* and imm8,%eax */
+				else
+					EMIT1_off32(0x25, K);	/* and imm32,%eax */
+				break;
+			case BPF_ALU|BPF_OR|BPF_X:
+				seen |= SEEN_XREG;
+				EMIT2(0x09, 0xd8);		/* or %ebx,%eax */
+				break;
+			case BPF_ALU|BPF_OR|BPF_K:
+				if (is_imm8(K))
+					EMIT3(0x83, 0xc8, K & 0xff); /* or imm8,%eax */
+				else
+					EMIT1_off32(0x0d, K);	/* or imm32,%eax */
+				break;
+			case BPF_ALU|BPF_LSH|BPF_X: /* A <<= X; */
+				seen |= SEEN_XREG;
+				EMIT4(0x89, 0xd9, 0xd3, 0xe0);	/* mov %ebx,%ecx; shl %cl,%eax */
+				break;
+			case BPF_ALU|BPF_LSH|BPF_K:
+				if (K == 0)
+					break;
+				else if (K == 1)
+					EMIT2(0xd1, 0xe0);	/* shl %eax */
+				else
+					EMIT3(0xc1, 0xe0, K & 0xff); /* shl imm8,%eax */
+				break;
+			case BPF_ALU|BPF_RSH|BPF_X: /* A >>= X; */
+				seen |= SEEN_XREG;
+				EMIT4(0x89, 0xd9, 0xd3, 0xe8);	/* mov %ebx,%ecx; shr %cl,%eax */
+				break;
+			case BPF_ALU|BPF_RSH|BPF_K: /* A >>= K; */
+				if (K == 0)
+					break;
+				else if (K == 1)
+					EMIT2(0xd1, 0xe8);	/* shr %eax */
+				else
+					EMIT3(0xc1, 0xe8, K & 0xff); /* shr imm8,%eax */
+				break;
+			case BPF_ALU|BPF_NEG:
+				EMIT2(0xf7, 0xd8);		/* neg %eax */
+				break;
+			case BPF_RET|BPF_K:
+				if (!K)
+					CLEAR_A();
+				else
+					EMIT1_off32(0xb8, K);	/* mov $imm32,%eax */
+				/* fallinto */
+			case BPF_RET|BPF_A:
+				if (!seen)
+					EMIT1(0xc3);		/* ret */
+				else if (i != flen - 1)
+					EMIT_JMP(cleanup_addr);
+				/* else fall into the epilogue */
+				break;
+			case BPF_MISC|BPF_TAX: /* X = A */
+				seen |= SEEN_XREG;
+				EMIT2(0x89, 0xc3);		/* mov %eax,%ebx */
+				break;
+			case BPF_MISC|BPF_TXA: /* A = X */
+				seen |= SEEN_XREG;
+				EMIT2(0x89, 0xd8);		/* mov %ebx,%eax */
+				break;
+			case BPF_LD|BPF_IMM: /* A = K */
+				if (!K)
+					CLEAR_A();
+				else
+					EMIT1_off32(0xb8, K);	/* mov $imm32,%eax */
+				break;
+			case BPF_LDX|BPF_IMM: /* X = K */
+				seen |= SEEN_XREG;
+				if (!K)
+					CLEAR_X();
+				else
+					EMIT1_off32(0xbb, K);	/* mov $imm32,%ebx */
+				break;
+			case BPF_LD|BPF_MEM: /* A = mem[K] : mov off8(%rbp),%eax */
+				seen |= SEEN_MEM;
+				EMIT3(0x8b, 0x45, MEM_OFF(K) & 0xff);
+				break;
+			case BPF_LDX|BPF_MEM: /* X = mem[K] : mov off8(%rbp),%ebx */
+				seen |= SEEN_XREG | SEEN_MEM;
+				EMIT3(0x8b, 0x5d, MEM_OFF(K) & 0xff);
+				break;
+			case BPF_ST: /* mem[K] = A : mov %eax,off8(%rbp) */
+				seen |= SEEN_MEM;
+				EMIT3(0x89, 0x45, MEM_OFF(K) & 0xff);
+				break;
+			case BPF_STX: /* mem[K] = X : mov %ebx,off8(%rbp) */
+				seen |= SEEN_XREG | SEEN_MEM;
+				EMIT3(0x89, 0x5d, MEM_OFF(K) & 0xff);
+				break;
+			case BPF_LD|BPF_W|BPF_LEN: /* A = skb->len; */
+				/* mov off(%rdi),%eax */
+				EMIT_SKB_FIELD(0, 0x8b, 0x47, len);
+				break;
+			case BPF_LDX|BPF_W|BPF_LEN: /* X = skb->len; */
+				seen |= SEEN_XREG;
+				/* mov off(%rdi),%ebx */
+				EMIT_SKB_FIELD(0, 0x8b, 0x5f, len);
+				break;
+			case BPF_LD|BPF_W|BPF_ABS:
+				seen |= SEEN_DATAREF;
+				EMIT1_off32(0xbe, K);		/* mov imm32,%esi */
+				EMIT_CALL(sk_load_word);
+				break;
+			case BPF_LD|BPF_H|BPF_ABS:
+				seen |= SEEN_DATAREF;
+				EMIT1_off32(0xbe, K);		/* mov imm32,%esi */
+				EMIT_CALL(sk_load_half);
+				break;
+			case BPF_LD|BPF_B|BPF_ABS:
+				seen |= SEEN_DATAREF;
+				EMIT1_off32(0xbe, K);		/* mov imm32,%esi */
+				EMIT_CALL(sk_load_byte);
+				break;
+			case BPF_LDX|BPF_B|BPF_MSH:
+				/* the interpreter does not look at ancillary
+				 * data here, leave such filters to it */
+				if ((int)K < 0 && (int)K >= SKF_AD_OFF)
+					goto out;
+				seen |= SEEN_DATAREF | SEEN_XREG;
+				EMIT1_off32(0xbe, K);		/* mov imm32,%esi */
+				EMIT_CALL(sk_load_byte_msh);
+				break;
+			case BPF_LD|BPF_W|BPF_IND:
+			case BPF_LD|BPF_H|BPF_IND:
+			case BPF_LD|BPF_B|BPF_IND:
+				seen |= SEEN_DATAREF | SEEN_XREG;
+				EMIT2(0x89, 0xde);		/* mov %ebx,%esi */
+				if (K) {
+					if (is_imm8(K))
+						EMIT3(0x83, 0xc6, K & 0xff); /* add imm8,%esi */
+					else {
+						EMIT2(0x81, 0xc6);	/* add imm32,%esi */
+						EMIT(K, 4);
+					}
+				}
+				if (BPF_SIZE(filter[i].code) == BPF_W)
+					EMIT_CALL(sk_load_word);
+				else if (BPF_SIZE(filter[i].code) == BPF_H)
+					EMIT_CALL(sk_load_half);
+				else
+					EMIT_CALL(sk_load_byte);
+				break;
+			case BPF_JMP|BPF_JA:
+				if (K)
+					EMIT_JMP(addrs[i + K]);
+				break;
+			COND_SEL(BPF_JMP|BPF_JGT|BPF_K, X86_JA, X86_JBE);
+			COND_SEL(BPF_JMP|BPF_JGE|BPF_K, X86_JAE, X86_JB);
+			COND_SEL(BPF_JMP|BPF_JEQ|BPF_K, X86_JE, X86_JNE);
+			COND_SEL(BPF_JMP|BPF_JSET|BPF_K, X86_JNE, X86_JE);
+			COND_SEL(BPF_JMP|BPF_JGT|BPF_X, X86_JA, X86_JBE);
+			COND_SEL(BPF_JMP|BPF_JGE|BPF_X, X86_JAE, X86_JB);
+			COND_SEL(BPF_JMP|BPF_JEQ|BPF_X, X86_JE, X86_JNE);
+			COND_SEL(BPF_JMP|BPF_JSET|BPF_X, X86_JNE, X86_JE);
+
+cond_branch:			/* jumps to the start of insn i + 1 + jt/jf */
+				if (!filter[i].jt && !filter[i].jf)
+					break;
+				t_addr = addrs[i + filter[i].jt];
+				f_addr = addrs[i + filter[i].jf];
+
+				switch (filter[i].code) {
+				case BPF_JMP|BPF_JGT|BPF_X:
+				case BPF_JMP|BPF_JGE|BPF_X:
+				case BPF_JMP|BPF_JEQ|BPF_X:
+					seen |= SEEN_XREG;
+					EMIT2(0x39, 0xd8);	/* cmp %ebx,%eax */
+					break;
+				case BPF_JMP|BPF_JSET|BPF_X:
+					seen |= SEEN_XREG;
+					EMIT2(0x85, 0xd8);	/* test %ebx,%eax */
+					break;
+				case BPF_JMP|BPF_JEQ|BPF_K:
+				case BPF_JMP|BPF_JGT|BPF_K:
+				case BPF_JMP|BPF_JGE|BPF_K:
+					if (K == 0) {
+						EMIT2(0x85, 0xc0); /* test %eax,%eax */
+						break;
+					}
+					if (is_imm8(K))
+						EMIT3(0x83, 0xf8, K & 0xff); /* cmp imm8,%eax */
+					else
+						EMIT1_off32(0x3d, K);	/* cmp imm32,%eax */
+					break;
+				case BPF_JMP|BPF_JSET|BPF_K:
+					if (K <= 0xFF)
+						EMIT2(0xa8, K);	/* test imm8,%al */
+					else
+						EMIT1_off32(0xa9, K); /* test imm32,%eax */
+					break;
+				}
+				if (filter[i].jt != 0) {
+					EMIT_COND_JMP(t_op, t_addr);
+					if (filter[i].jf)
+						EMIT_JMP(f_addr);
+					break;
+				}
+				EMIT_COND_JMP(f_op, f_addr);
+				break;
+			default:
+				/* hmm, too complex filter, give up with jit compiler */
+				goto out;
+			}
+			ilen = prog - temp;
+			if (image)
+				memcpy(image + proglen, temp, ilen);
+			proglen += ilen;
+			if (addrs[i] != proglen) {
+				addrs[i] = proglen;
+				changed = 1;
+			}
+		}
+
+		/* epilogue, and the "return 0" used by DIV X and friends */
+		if (seen) {
+			if (cleanup_addr != proglen)
+				changed = 1;
+			cleanup_addr = proglen;
+			ret0_addr = cleanup_addr + 6;
+			prog = temp;
+			EMIT_EPILOGUE();
+			CLEAR_A();
+			EMIT_EPILOGUE();
+			ilen = prog - temp;
+			if (image)
+				memcpy(image + proglen, temp, ilen);
+			proglen += ilen;
+		}
+
+		if (image) {
+			if (changed) {
+				printk(KERN_ERR "bpf_jit_compile: image layout "
+				       "changed in final pass\n");
+				module_free(NULL, image);
+				image = NULL;
+			}
+			break;
+		}
+		if (!changed) {
+			image = module_alloc(max_t(unsigned int, proglen,
+						   sizeof(struct work_struct)));
+			if (!image)
+				goto out;
+		}
+	}
+
+	if (image)
+		fp->bpf_func = (void *)image;
+out:
+	kfree(addrs);
+	return;
+}
+
+static void jit_free_defer(void *arg)
+{
+	module_free(NULL, arg);
+}
+
+/* run from softirq, we must use a work_struct to call
+ * module_free() from process context
+ */
+void bpf_jit_free(struct sk_filter *fp)
+{
+	if (fp->bpf_func != sk_run_filter) {
+		struct work_struct *work = (struct work_struct *)fp->bpf_func;
+
+		INIT_WORK(work, jit_free_defer, work);
+		schedule_work(work);
+	}
+}
+EXPORT_SYMBOL(bpf_jit_free);
@@ -0,0 +1,350 @@
+/*
+ * Block I/O groups
+ *
+ * Every cpuset has an io_group, the root cpuset the root_io_group, and the
+ * groups form the same tree as the cpusets.  Two things are done with them:
+ *
+ * - CFQ shares the time of a disk between the groups which have requests
+ *   queued on it, in proportion to their weights, the tasks and the child
+ *   groups of a group competing for the share of the group.
+ *
+ * - The bios submitted by the tasks of a group can be limited in bytes and
+ *   in I/Os per second.  Bios over the limit of their group, or of one of
+ *   its ancestors, are held back and resubmitted by kthrotld once the
+ *   limits allow.  A limit lets bursts of a tenth of a second through.
+ *
+ * The limits apply to the bios seen by submit_bio(): those of the page
+ * cache writeback are submitted by the flusher threads, in the root cpuset.
+ */
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/bio.h>
+#include <linux/blkdev.h>
+#include <linux/blk-iogroup.h>
+#include <linux/slab.h>
+#include <linux/init.h>
+#include <asm/div64.h>
+
+static void io_group_throttle_timer(unsigned long data);
+static void io_group_dispatch(void *data);
+
+struct io_group root_io_group = {
+	.ref		= ATOMIC_INIT(1),
+	.weight		= IOG_WEIGHT_DEFAULT,
+	.throttle_timer	= TIMER_INITIALIZER(io_group_throttle_timer, 0,
+				(unsigned long)&root_io_group),
+	.throttle_work	= __WORK_INITIALIZER(root_io_group.throttle_work,
+				io_group_dispatch, &root_io_group),
+	.lock		= SPIN_LOCK_UNLOCKED,
+};
+EXPORT_SYMBOL(root_io_group);
+
+static DEFINE_SPINLOCK(iog_throttle_lock);
+static struct workqueue_struct *kthrotld_wq;
+
+/* A tenth of a second's worth can be used in one go */
+#define IOG_BURST_DIV	10
+
+/**
+ * io_group_create - make the io group of a new cpuset
+ * @parent: the group of the parent cpuset
+ */
+struct io_group *io_group_create(struct io_group *parent)
+{
+	struct io_group *iog;
+
+	iog = kzalloc(sizeof(*iog), GFP_KERNEL);
+	if (!iog)
+		return ERR_PTR(-ENOMEM);
+
+	atomic_set(&iog->ref, 1);
+	io_group_get(parent);
+	iog->parent = parent;
+	iog->weight = IOG_WEIGHT_DEFAULT;
+	setup_timer(&iog->throttle_timer, io_group_throttle_timer,
+		    (unsigned long)iog);
+	INIT_WORK(&iog->throttle_work, io_group_dispatch, iog);
+	spin_lock_init(&iog->lock);
+	return iog;
+}
+
+/**
+ * io_group_put - drop a reference to an io group
+ * @iog: the group
+ *
+ * The cpuset holds one, and so do the CFQ queues of its tasks and the
+ * bios it holds back.  May be called from any context.
+ */
+void io_group_put(struct io_group *iog)
+{
+	struct io_group *parent;
+
+	while (atomic_dec_and_test(&iog->ref)) {
+		BUG_ON(iog == &root_io_group || iog->throttled);
+		parent = iog->parent;
+		kfree(iog);
+		iog = parent;
+	}
+}
+EXPORT_SYMBOL(io_group_put);
+
+int io_group_set_weight(struct io_group *iog, unsigned int weight)
+{
+	if (!iog->parent)
+		return -EINVAL;
+	if (weight < IOG_WEIGHT_MIN || weight > IOG_WEIGHT_MAX)
+		return -EINVAL;
+	iog->weight = weight;
+	return 0;
+}
+
+static s64 iog_burst(struct iog_bucket *b)
+{
+	u64 burst = b->limit;
+
+	do_div(burst, IOG_BURST_DIV);
+	return burst ? burst : 1;
+}
+
+/**
+ * io_group_set_limit - limit the bytes or the I/Os per second of a group
+ * @iog: the group
+ * @iops: set the limit of I/Os rather than of bytes
+ * @limit: the new limit per second, 0 for none
+ */
+int io_group_set_limit(struct io_group *iog, int iops, u64 limit)
+{
+	struct iog_bucket *b = iops ? &iog->iops : &iog->bps;
+
+	if (!iog->parent)
+		return -EINVAL;
+
+	spin_lock_irq(&iog_throttle_lock);
+	b->limit = limit;
+	b->tokens = limit ? iog_burst(b) : 0;
+	b->last = jiffies;
+	spin_unlock_irq(&iog_throttle_lock);
+	return 0;
+}
+
+/*
+ * Add what came in since the last refill.  The time of the last refill is
+ * only moved on once a whole token was added, so that low limits get their
+ * fractions of a token too.
+ */
+static void iog_refill(struct iog_bucket *b, unsigned long now)
+{
+	unsigned long elapsed = now - b->last;
+	s64 burst;
+	u64 new;
+
+	if (elapsed > HZ)
+		elapsed = HZ;
+	new = b->limit * elapsed;
+	do_div(new, HZ);
+	if (!new)
+		return;
+
+	b->last = now;
+	burst = iog_burst(b);
+	b->tokens += new;
+	if (b->tokens > burst)
+		b->tokens = burst;
+}
+
+/*
+ * Jiffies until the bucket has a token again.  A bio may use more than
+ * the tokens left, leaving the bucket in debt.  The held back bios are
+ * looked at every second at least, for a new limit to be seen.
+ */
+static unsigned long iog_wait(struct iog_bucket *b)
+{
+	u64 wait;
+
+	if (b->tokens > 0)
+		return 0;
+	wait = (u64)(1 - b->tokens) * HZ;
+	do_div(wait, b->limit);
+	return min_t(u64, wait + 1, HZ);
+}
+
+static inline int iog_limited(struct io_group *iog)
+{
+	for (; iog; iog = iog->parent)
+		if (iog->bps.limit || iog->iops.limit)
+			return 1;
+	return 0;
+}
+
+/*
+ * How long must a bio of @iog wait before it can go?  Called with
+ * iog_throttle_lock held.
+ */
+static unsigned long iog_may_dispatch(struct io_group *iog, unsigned long now)
+{
+	unsigned long wait = 0;
+
+	for (; iog; iog = iog->parent) {
+		if (iog->bps.limit) {
+			iog_refill(&iog->bps, now);
+			wait = max(wait, iog_wait(&iog->bps));
+		}
+		if (iog->iops.limit) {
+			iog_refill(&iog->iops, now);
+			wait = max(wait, iog_wait(&iog->iops));
+		}
+	}
+	return wait;
+}
+
+static void iog_charge(struct io_group *iog, struct bio *bio)
+{
+	for (; iog; iog = iog->parent) {
+		if (iog->bps.limit)
+			iog->bps.tokens -= bio->bi_size;
+		if (iog->iops.limit)
+			iog->iops.tokens--;
+	}
+}
+
+/**
+ * io_group_throttle - account a bio to its group, and hold it back if need be
+ * @iog: the group of the submitting task
+ * @bio: the bio
+ *
+ * Returns 1 if the bio was queued, to be submitted later on: the caller
+ * must not submit it then.
+ */
+int io_group_throttle(struct io_group *iog, struct bio *bio)
+{
+	const int rw = bio_data_dir(bio);
+	unsigned long flags, wait;
+
+	spin_lock_irqsave(&iog->lock, flags);
+	iog->ios[rw]++;
+	iog->bytes[rw] += bio->bi_size;
+	spin_unlock_irqrestore(&iog->lock, flags);
+
+	if (likely(!iog_limited(iog)))
+		return 0;
+
+	spin_lock_irqsave(&iog_throttle_lock, flags);
+	if (!iog->throttled) {
+		wait = iog_may_dispatch(iog, jiffies);
+		if (!wait) {
+			iog_charge(iog, bio);
+			spin_unlock_irqrestore(&iog_throttle_lock, flags);
+			return 0;
+		}
+		/* the queued bios hold a reference to the group */
+		io_group_get(iog);
+		iog->throttled = bio;
+		mod_timer(&iog->throttle_timer, jiffies + wait);
+	} else
+		iog->throttled_tail->bi_next = bio;
+	iog->throttled_tail = bio;
+	bio->bi_next = NULL;
+	iog->nr_throttled++;
+	spin_unlock_irqrestore(&iog_throttle_lock, flags);
+	return 1;
+}
+
+static void io_group_throttle_timer(unsigned long data)
+{
+	struct io_group *iog = (struct io_group *)data;
+
+	queue_work(kthrotld_wq, &iog->throttle_work);
+}
+
+/*
+ * Submit the held back bios of a group which its limits allow by now
+ */
+static void io_group_dispatch(void *data)
+{
+	struct io_group *iog = data;
+	struct bio *bio, *list = NULL, **tail = &list;
+	unsigned long wait;
+	int drained = 0;
+
+	spin_lock_irq(&iog_throttle_lock);
+	while ((bio = iog->throttled) != NULL) {
+		wait = iog_may_dispatch(iog, jiffies);
+		if (wait) {
+			mod_timer(&iog->throttle_timer, jiffies + wait);
+			break;
+		}
+		iog_charge(iog, bio);
+		iog->throttled = bio->bi_next;
+		if (!iog->throttled) {
+			iog->throttled_tail = NULL;
+			drained = 1;
+		}
+		bio->bi_next = NULL;
+		*tail = bio;
+		tail = &bio->bi_next;
+	}
+	spin_unlock_irq(&iog_throttle_lock);
+
+	while ((bio = list) != NULL) {
+		list = bio->bi_next;
+		bio->bi_next = NULL;
+		generic_make_request(bio);
+	}
+
+	if (drained)
+		io_group_put(iog);
+}
+
+/**
+ * io_group_completed - account a completed request to its group
+ * @iog: the group
+ * @rw: the direction of the request
+ * @start_time: jiffies when the request was queued
+ */
+void io_group_completed(struct io_group *iog, int rw, unsigned long start_time)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&iog->lock, flags);
+	iog->completed[rw]++;
+	iog->service_time += jiffies_to_msecs(jiffies - start_time);
+	spin_unlock_irqrestore(&iog->lock, flags);
+}
+EXPORT_SYMBOL(io_group_completed);
+
+/*
+ * The contents of the io_stat file of a cpuset, but for the last newline
+ */
+int io_group_stat(struct io_group *iog, char *page)
+{
+	unsigned long nr_throttled;
+	char *s = page;
+
+	spin_lock_irq(&iog_throttle_lock);
+	nr_throttled = iog->nr_throttled;
+	spin_unlock_irq(&iog_throttle_lock);
+
+	spin_lock_irq(&iog->lock);
+	s += sprintf(s, "read_ios %lu\nwrite_ios %lu\n",
+		     iog->ios[READ], iog->ios[WRITE]);
+	s += sprintf(s, "read_bytes %llu\nwrite_bytes %llu\n",
+		     (unsigned long long)iog->bytes[READ],
+		     (unsigned long long)iog->bytes[WRITE]);
+	s += sprintf(s, "throttled %lu\n", nr_throttled);
+	s += sprintf(s, "completed_reads %lu\ncompleted_writes %lu\n",
+		     iog->completed[READ], iog->completed[WRITE]);
+	s += sprintf(s, "service_ms %llu",
+		     (unsigned long long)iog->service_time);
+	spin_unlock_irq(&iog->lock);
+
+	return s - page;
+}
+
+static int __init io_group_init(void)
+{
+	kthrotld_wq = create_singlethread_workqueue("kthrotld");
+	if (!kthrotld_wq)
+		panic("Failed to create kthrotld\n");
+	return 0;
+}
+subsys_initcall(io_group_init);
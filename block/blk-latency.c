@@ -0,0 +1,127 @@
+/*
+ * Block I/O latency histograms
+ *
+ * blktrace sees every request, but what it streams to user space costs too
+ * much to leave it on all the time.  These histograms are meant to be: a
+ * request is timed when it is queued, when the driver takes it, and when
+ * it completes, and the two latencies are counted in per-cpu histograms of
+ * its queue, by direction and size.  They are shown, summed up over the
+ * cpus, by the latency_queue and latency_device files of the queue in
+ * sysfs, and are reset by writing to them.
+ *
+ * The counts are updated without locking, from whatever context the
+ * requests complete in, as the disk statistics are: one may get lost now
+ * and then.
+ */
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/blkdev.h>
+#include <linux/blk-latency.h>
+#include <linux/percpu.h>
+#include <asm/div64.h>
+
+int blk_lat_init(request_queue_t *q)
+{
+	q->lat_hist = alloc_percpu(struct blk_lat_hist);
+	return q->lat_hist ? 0 : -ENOMEM;
+}
+
+void blk_lat_exit(request_queue_t *q)
+{
+	if (q->lat_hist)
+		free_percpu(q->lat_hist);
+}
+
+static inline int blk_lat_size(struct request *rq)
+{
+	unsigned long sectors = rq->hard_nr_sectors;
+
+	if (sectors <= 8)
+		return 0;
+	if (sectors <= 32)
+		return 1;
+	if (sectors <= 128)
+		return 2;
+	return 3;
+}
+
+static inline int blk_lat_slot(u64 ns)
+{
+	do_div(ns, NSEC_PER_USEC);
+	if (ns >> (BLK_LAT_SLOTS - 2))
+		return BLK_LAT_SLOTS - 1;
+	return fls((unsigned int)ns);
+}
+
+/*
+ * Count the latency of @rq in @phase, from @start until now.  Issuing a
+ * request starts its device phase: the size it is counted with is taken
+ * then, as nothing of it may be left on completion.
+ */
+void __blk_lat_account(struct request *rq, int phase, u64 start)
+{
+	struct blk_lat_hist *hist;
+	u64 now = blk_lat_now();
+	int slot = now > start ? blk_lat_slot(now - start) : 0;
+
+	if (phase == BLK_LAT_QUEUE) {
+		rq->io_start_time_ns = now;
+		rq->lat_size = blk_lat_size(rq);
+	}
+
+	hist = per_cpu_ptr(rq->q->lat_hist, get_cpu());
+	hist->slot[phase][rq_data_dir(rq)][rq->lat_size][slot]++;
+	put_cpu();
+}
+
+static const char *blk_lat_size_names[BLK_LAT_SIZES] = {
+	"4k", "16k", "64k", "max",
+};
+
+/*
+ * One line per direction and size, with the counts of the slots.  The
+ * first line has the lower bounds of the slots, in usecs.
+ */
+ssize_t blk_lat_show(request_queue_t *q, int phase, char *page)
+{
+	unsigned long sum[BLK_LAT_SLOTS];
+	char *s = page;
+	int rw, size, slot, cpu;
+
+	s += sprintf(s, "usecs");
+	for (slot = 0; slot < BLK_LAT_SLOTS; slot++)
+		s += sprintf(s, " %lu", slot ? 1UL << (slot - 1) : 0);
+	s += sprintf(s, "\n");
+
+	for (rw = READ; rw <= WRITE; rw++) {
+		for (size = 0; size < BLK_LAT_SIZES; size++) {
+			memset(sum, 0, sizeof(sum));
+			for_each_possible_cpu(cpu) {
+				struct blk_lat_hist *hist;
+
+				hist = per_cpu_ptr(q->lat_hist, cpu);
+				for (slot = 0; slot < BLK_LAT_SLOTS; slot++)
+					sum[slot] += hist->slot[phase][rw][size][slot];
+			}
+
+			s += sprintf(s, "%s %s", rw == READ ? "read" : "write",
+				     blk_lat_size_names[size]);
+			for (slot = 0; slot < BLK_LAT_SLOTS; slot++)
+				s += sprintf(s, " %lu", sum[slot]);
+			s += sprintf(s, "\n");
+		}
+	}
+
+	return s - page;
+}
+
+void blk_lat_reset(request_queue_t *q, int phase)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		struct blk_lat_hist *hist = per_cpu_ptr(q->lat_hist, cpu);
+
+		memset(hist->slot[phase], 0, sizeof(hist->slot[phase]));
+	}
+}
@@ -0,0 +1,461 @@
+/*
+ * Multi-queue block layer
+ *
+ * A queue set up by blk_mq_init_queue() has no queue lock, no elevator and
+ * no request_fn.  Every cpu puts the requests it makes on a software queue
+ * of its own, where later bios are merged into them, and the software
+ * queues are mapped onto the hardware queues of the device.  Running a
+ * hardware queue hands the requests of its software queues to the
+ * driver's ->queue_rq(), one at a time.
+ *
+ * The requests are preallocated, one for each tag of a hardware queue, so
+ * that getting a request is getting a tag.  A request the driver ends is
+ * completed on the cpu which made it, by blk_complete_request().
+ */
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/bio.h>
+#include <linux/blkdev.h>
+#include <linux/blk-mq.h>
+#include <linux/slab.h>
+#include <linux/blktrace_api.h>
+#include <linux/blk-latency.h>
+#include <linux/trace_events.h>
+
+#include "blk.h"
+
+struct blk_mq_ctx {
+	spinlock_t		lock;
+	struct list_head	rq_list;	/* requests not dispatched yet */
+	unsigned int		cpu;
+	unsigned int		index_hw;	/* hardware queue of the cpu */
+} ____cacheline_aligned_in_smp;
+
+/* Only the last few requests of a software queue are tried for merging */
+#define BLK_MQ_MERGE_DEPTH	8
+
+static struct request *__blk_mq_alloc_request(struct blk_mq_hw_ctx *hctx)
+{
+	unsigned int tag;
+
+	do {
+		tag = find_next_zero_bit(hctx->tag_map, hctx->queue_depth,
+					 hctx->next_tag);
+		if (tag >= hctx->queue_depth) {
+			tag = find_first_zero_bit(hctx->tag_map,
+						  hctx->queue_depth);
+			if (tag >= hctx->queue_depth)
+				return NULL;
+		}
+	} while (test_and_set_bit(tag, hctx->tag_map));
+
+	hctx->next_tag = tag + 1;
+	return hctx->rqs[tag];
+}
+
+static struct request *blk_mq_alloc_request_wait(struct blk_mq_hw_ctx *hctx)
+{
+	DEFINE_WAIT(wait);
+	struct request *rq;
+
+	for (;;) {
+		prepare_to_wait(&hctx->tag_wait, &wait, TASK_UNINTERRUPTIBLE);
+		rq = __blk_mq_alloc_request(hctx);
+		if (rq)
+			break;
+		io_schedule();
+	}
+	finish_wait(&hctx->tag_wait, &wait);
+
+	return rq;
+}
+
+static void blk_mq_free_request(struct request *rq)
+{
+	struct blk_mq_hw_ctx *hctx = rq->q->queue_hw_ctx[rq->mq_ctx->index_hw];
+
+	rq->rq_status = RQ_INACTIVE;
+	smp_mb__before_clear_bit();
+	clear_bit(rq->tag, hctx->tag_map);
+	smp_mb__after_clear_bit();
+
+	if (waitqueue_active(&hctx->tag_wait))
+		wake_up(&hctx->tag_wait);
+	/* the driver may have room for what it was busy for */
+	if (!list_empty(&hctx->dispatch))
+		blk_mq_run_hw_queue(hctx, 1);
+}
+
+static void blk_mq_rq_init(request_queue_t *q, struct blk_mq_ctx *ctx,
+			   struct request *rq, struct bio *bio)
+{
+	int tag = rq->tag;
+
+	memset(rq, 0, sizeof(*rq));
+	INIT_LIST_HEAD(&rq->queuelist);
+	INIT_LIST_HEAD(&rq->donelist);
+	rq->flags = bio_data_dir(bio);
+	rq->rq_status = RQ_ACTIVE;
+	rq->tag = tag;
+	rq->ref_count = 1;
+	rq->q = q;
+	rq->mq_ctx = ctx;
+
+	init_request_from_bio(rq, bio);
+	rq->cpu = ctx->cpu;
+}
+
+/*
+ * Called with the software queue locked
+ */
+static int blk_mq_attempt_merge(request_queue_t *q, struct blk_mq_ctx *ctx,
+				struct bio *bio)
+{
+	int checked = BLK_MQ_MERGE_DEPTH;
+	struct request *rq;
+	int ret;
+
+	list_for_each_entry_reverse(rq, &ctx->rq_list, queuelist) {
+		if (!checked--)
+			break;
+		ret = blk_attempt_bio_merge(q, rq, bio);
+		if (ret)
+			return ret > 0;
+	}
+
+	return 0;
+}
+
+static void __blk_mq_run_hw_queue(struct blk_mq_hw_ctx *hctx)
+{
+	request_queue_t *q = hctx->queue;
+	struct request *rq;
+	LIST_HEAD(list);
+	unsigned int i;
+	int ret;
+
+	spin_lock_bh(&hctx->lock);
+	if (unlikely(test_bit(BLK_MQ_S_STOPPED, &hctx->state)))
+		goto out;
+
+	/* what the driver was busy for goes first */
+	list_splice_init(&hctx->dispatch, &list);
+	for (i = 0; i < hctx->nr_ctx; i++) {
+		struct blk_mq_ctx *ctx = hctx->ctxs[i];
+
+		if (list_empty(&ctx->rq_list))
+			continue;
+		spin_lock(&ctx->lock);
+		list_splice_init(&ctx->rq_list, list.prev);
+		spin_unlock(&ctx->lock);
+	}
+
+	while (!list_empty(&list)) {
+		rq = list_entry_rq(list.next);
+		list_del_init(&rq->queuelist);
+		blk_add_trace_rq(q, rq, BLK_TA_ISSUE);
+		trace_block_rq_issue(q, rq);
+		blk_lat_issue(rq);
+
+		ret = q->mq_ops->queue_rq(hctx, rq);
+		if (likely(ret == BLK_MQ_RQ_QUEUE_OK))
+			continue;
+		if (ret == BLK_MQ_RQ_QUEUE_BUSY) {
+			list_add(&rq->queuelist, &list);
+			break;
+		}
+		blk_mq_end_io(rq, -EIO);
+	}
+
+	/* run again when a request of the hardware queue completes */
+	if (!list_empty(&list))
+		list_splice(&list, &hctx->dispatch);
+out:
+	spin_unlock_bh(&hctx->lock);
+}
+
+static void blk_mq_run_work_fn(void *data)
+{
+	__blk_mq_run_hw_queue(data);
+}
+
+/**
+ * blk_mq_run_hw_queue - hand the pending requests to the driver
+ * @hctx: the hardware queue
+ * @async: from kblockd rather than from the caller
+ *
+ * A driver which returned BLK_MQ_RQ_QUEUE_BUSY for another reason than
+ * requests in flight on @hctx calls this once it can take more.
+ */
+void blk_mq_run_hw_queue(struct blk_mq_hw_ctx *hctx, int async)
+{
+	if (async)
+		kblockd_schedule_work(&hctx->run_work);
+	else
+		__blk_mq_run_hw_queue(hctx);
+}
+EXPORT_SYMBOL(blk_mq_run_hw_queue);
+
+void blk_mq_stop_hw_queue(struct blk_mq_hw_ctx *hctx)
+{
+	set_bit(BLK_MQ_S_STOPPED, &hctx->state);
+}
+EXPORT_SYMBOL(blk_mq_stop_hw_queue);
+
+void blk_mq_start_hw_queue(struct blk_mq_hw_ctx *hctx)
+{
+	clear_bit(BLK_MQ_S_STOPPED, &hctx->state);
+	blk_mq_run_hw_queue(hctx, 1);
+}
+EXPORT_SYMBOL(blk_mq_start_hw_queue);
+
+static int blk_mq_make_request(request_queue_t *q, struct bio *bio)
+{
+	struct blk_mq_hw_ctx *hctx;
+	struct blk_mq_ctx *ctx;
+	struct request *rq;
+
+	blk_queue_bounce(q, &bio);
+
+	if (unlikely(bio_barrier(bio))) {
+		bio_endio(bio, bio->bi_size, -EOPNOTSUPP);
+		return 0;
+	}
+
+	ctx = per_cpu_ptr(q->queue_ctx, get_cpu());
+	hctx = q->queue_hw_ctx[ctx->index_hw];
+
+	spin_lock_bh(&ctx->lock);
+	if (blk_mq_attempt_merge(q, ctx, bio)) {
+		spin_unlock_bh(&ctx->lock);
+		put_cpu();
+		return 0;
+	}
+	spin_unlock_bh(&ctx->lock);
+
+	rq = __blk_mq_alloc_request(hctx);
+	put_cpu();
+	if (unlikely(!rq)) {
+		blk_mq_run_hw_queue(hctx, 0);
+		rq = blk_mq_alloc_request_wait(hctx);
+	}
+
+	/*
+	 * The request stays with the software queue of the tag, even if we
+	 * slept and moved to a cpu of another hardware queue.
+	 */
+	blk_mq_rq_init(q, ctx, rq, bio);
+
+	spin_lock_bh(&ctx->lock);
+	list_add_tail(&rq->queuelist, &ctx->rq_list);
+	spin_unlock_bh(&ctx->lock);
+
+	blk_mq_run_hw_queue(hctx, 0);
+	return 0;
+}
+
+/*
+ * Complete a request on the cpu which made it, from BLOCK_SOFTIRQ
+ */
+static void blk_mq_softirq_done(struct request *rq)
+{
+	struct gendisk *disk = rq->rq_disk;
+	int error = rq->errors;
+
+	end_that_request_first(rq, error ? error : 1, rq->hard_nr_sectors);
+
+	if (disk && blk_fs_request(rq)) {
+		const int rw = rq_data_dir(rq);
+
+		__disk_stat_inc(disk, ios[rw]);
+		__disk_stat_add(disk, ticks[rw], jiffies - rq->start_time);
+		blk_lat_done(rq);
+	}
+
+	blk_mq_free_request(rq);
+}
+
+/**
+ * blk_mq_end_io - end a request of a multi-queue device
+ * @rq: the request, as handed to ->queue_rq()
+ * @error: 0, or the error of the request
+ *
+ * May be called from any context.  The bios of the request are ended, and
+ * its tag freed, on the cpu which made it.
+ */
+void blk_mq_end_io(struct request *rq, int error)
+{
+	rq->errors = error;
+	blk_complete_request(rq);
+}
+EXPORT_SYMBOL(blk_mq_end_io);
+
+static void blk_mq_free_hctx(struct blk_mq_hw_ctx *hctx)
+{
+	unsigned int i;
+
+	if (hctx->rqs) {
+		for (i = 0; i < hctx->queue_depth; i++)
+			kfree(hctx->rqs[i]);
+		kfree(hctx->rqs);
+	}
+	kfree(hctx->tag_map);
+	kfree(hctx->ctxs);
+	kfree(hctx);
+}
+
+static struct blk_mq_hw_ctx *blk_mq_alloc_hctx(request_queue_t *q,
+					       struct blk_mq_reg *reg,
+					       unsigned int i)
+{
+	struct blk_mq_hw_ctx *hctx;
+	unsigned int depth = reg->queue_depth;
+	unsigned int j;
+
+	hctx = kmalloc_node(sizeof(*hctx), GFP_KERNEL, reg->numa_node);
+	if (!hctx)
+		return NULL;
+	memset(hctx, 0, sizeof(*hctx));
+
+	spin_lock_init(&hctx->lock);
+	INIT_LIST_HEAD(&hctx->dispatch);
+	INIT_WORK(&hctx->run_work, blk_mq_run_work_fn, hctx);
+	hctx->queue = q;
+	hctx->queue_num = i;
+	hctx->numa_node = reg->numa_node;
+	hctx->queue_depth = depth;
+	init_waitqueue_head(&hctx->tag_wait);
+
+	hctx->ctxs = kzalloc(NR_CPUS * sizeof(struct blk_mq_ctx *), GFP_KERNEL);
+	hctx->tag_map = kzalloc(BITS_TO_LONGS(depth) * sizeof(long),
+				GFP_KERNEL);
+	hctx->rqs = kzalloc(depth * sizeof(struct request *), GFP_KERNEL);
+	if (!hctx->ctxs || !hctx->tag_map || !hctx->rqs)
+		goto fail;
+
+	for (j = 0; j < depth; j++) {
+		struct request *rq;
+
+		rq = kmalloc_node(sizeof(*rq) + reg->cmd_size, GFP_KERNEL,
+				  reg->numa_node);
+		if (!rq)
+			goto fail;
+		memset(rq, 0, sizeof(*rq) + reg->cmd_size);
+		rq->tag = j;
+		hctx->rqs[j] = rq;
+	}
+
+	return hctx;
+
+fail:
+	blk_mq_free_hctx(hctx);
+	return NULL;
+}
+
+/**
+ * blk_mq_init_queue - set up a multi-queue request queue
+ * @reg: the hardware queues of the device and the driver's operations
+ * @driver_data: passed to ->init_hctx()
+ *
+ * The cpus are spread over the hardware queues in contiguous groups,
+ * blk_mq_map_queue() tells which one a cpu submits to.  Requests are only
+ * made from bios: there is no elevator, no barrier support and no
+ * blk_get_request() on such a queue.  Returns NULL on failure.
+ */
+request_queue_t *blk_mq_init_queue(struct blk_mq_reg *reg, void *driver_data)
+{
+	struct blk_mq_hw_ctx *hctx;
+	request_queue_t *q;
+	unsigned int i;
+	int cpu;
+
+	if (!reg->nr_hw_queues || !reg->queue_depth || !reg->ops->queue_rq)
+		return NULL;
+
+	q = blk_alloc_queue_node(GFP_KERNEL, reg->numa_node);
+	if (!q)
+		return NULL;
+
+	/* from here on, blk_put_queue() frees what was set up */
+	q->mq_ops = reg->ops;
+	q->node = reg->numa_node;
+
+	q->queue_ctx = alloc_percpu(struct blk_mq_ctx);
+	q->mq_map = kzalloc(NR_CPUS * sizeof(unsigned int), GFP_KERNEL);
+	q->queue_hw_ctx = kzalloc(reg->nr_hw_queues * sizeof(hctx),
+				  GFP_KERNEL);
+	if (!q->queue_ctx || !q->mq_map || !q->queue_hw_ctx)
+		goto fail;
+
+	i = 0;
+	for_each_possible_cpu(cpu)
+		q->mq_map[cpu] = i++ * reg->nr_hw_queues / num_possible_cpus();
+
+	for (i = 0; i < reg->nr_hw_queues; i++) {
+		hctx = blk_mq_alloc_hctx(q, reg, i);
+		if (!hctx)
+			goto fail;
+		if (reg->ops->init_hctx &&
+		    reg->ops->init_hctx(hctx, driver_data, i)) {
+			blk_mq_free_hctx(hctx);
+			goto fail;
+		}
+		q->queue_hw_ctx[i] = hctx;
+		q->nr_hw_queues = i + 1;
+	}
+
+	for_each_possible_cpu(cpu) {
+		struct blk_mq_ctx *ctx = per_cpu_ptr(q->queue_ctx, cpu);
+
+		spin_lock_init(&ctx->lock);
+		INIT_LIST_HEAD(&ctx->rq_list);
+		ctx->cpu = cpu;
+		ctx->index_hw = q->mq_map[cpu];
+
+		hctx = q->queue_hw_ctx[ctx->index_hw];
+		hctx->ctxs[hctx->nr_ctx++] = ctx;
+	}
+
+	blk_queue_make_request(q, blk_mq_make_request);
+	blk_queue_softirq_done(q, blk_mq_softirq_done);
+	q->back_merge_fn	= ll_back_merge_fn;
+	q->front_merge_fn	= ll_front_merge_fn;
+	q->merge_requests_fn	= ll_merge_requests_fn;
+	q->queue_flags		|= (1 << QUEUE_FLAG_CLUSTER) |
+				   (1 << QUEUE_FLAG_SAME_COMP) |
+				   (1 << QUEUE_FLAG_SAME_FORCE);
+
+	blk_queue_segment_boundary(q, 0xffffffff);
+	blk_queue_max_segment_size(q, MAX_SEGMENT_SIZE);
+
+	return q;
+
+fail:
+	blk_put_queue(q);
+	return NULL;
+}
+EXPORT_SYMBOL(blk_mq_init_queue);
+
+/*
+ * Called when the last reference to the queue is gone
+ */
+void blk_mq_free_queue(request_queue_t *q)
+{
+	struct blk_mq_hw_ctx *hctx;
+	unsigned int i;
+
+	kblockd_flush();
+
+	if (q->queue_hw_ctx) {
+		for (i = 0; i < q->nr_hw_queues; i++) {
+			hctx = q->queue_hw_ctx[i];
+			if (q->mq_ops->exit_hctx)
+				q->mq_ops->exit_hctx(hctx, i);
+			blk_mq_free_hctx(hctx);
+		}
+		kfree(q->queue_hw_ctx);
+	}
+	kfree(q->mq_map);
+	if (q->queue_ctx)
+		free_percpu(q->queue_ctx);
+}
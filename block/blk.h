@@ -0,0 +1,22 @@
+#ifndef BLK_INTERNAL_H
+#define BLK_INTERNAL_H
+
+/*
+ * Shared between the files of the block layer, not for drivers
+ */
+
+/* ll_rw_blk.c */
+extern int ll_back_merge_fn(request_queue_t *, struct request *,
+			    struct bio *);
+extern int ll_front_merge_fn(request_queue_t *, struct request *,
+			     struct bio *);
+extern int ll_merge_requests_fn(request_queue_t *, struct request *,
+				struct request *);
+extern void init_request_from_bio(struct request *, struct bio *);
+extern int blk_attempt_bio_merge(request_queue_t *, struct request *,
+				 struct bio *);
+
+/* blk-mq.c */
+extern void blk_mq_free_queue(request_queue_t *);
+
+#endif
@@ -12,6 +12,7 @@
 #include <linux/hash.h>
 #include <linux/rbtree.h>
 #include <linux/ioprio.h>
+#include <linux/blk-iogroup.h>
 
 /*
  * tunables
@@ -30,6 +31,9 @@ static int cfq_slice_idle = HZ / 125;
 #define CFQ_IDLE_GRACE		(HZ / 10)
 #define CFQ_SLICE_SCALE		(5)
 
+/* cfq_quantum is multiplied by this for a device which doesn't seek */
+#define CFQ_NONROT_QUANTUM	(4)
+
 #define CFQ_KEY_ASYNC		(0)
 
 static DEFINE_SPINLOCK(cfq_exit_lock);
@@ -87,6 +91,29 @@ static struct completion *ioc_gone;
 
 #define sample_valid(samples)	((samples) > 80)
 
+#ifdef CONFIG_BLK_IO_GROUP
+/*
+ * An io group on one device.  Every group is charged for the time its
+ * queues, and those of the groups below it, held the device, scaled by
+ * its weight: the next queue to get a slice is one of the group with the
+ * least charge, down from the root.  The queues of a group compete with
+ * its child groups as one more group of the default weight, charged in
+ * ->self_vtime.
+ */
+struct cfq_group {
+	struct list_head node;		/* on cfqd->group_list */
+	struct io_group *iog;
+	struct cfq_group *parent;
+	int ref;			/* queues and child groups */
+	unsigned int busy;		/* busy queues, of the group and below */
+	unsigned int own_busy;		/* busy queues of the group */
+	unsigned long vtime;
+	unsigned long self_vtime;
+};
+
+#define CFQ_VTIME_SHIFT		8
+#endif
+
 /*
  * Per block device queue structure
  */
@@ -156,6 +183,11 @@ struct cfq_data {
 	unsigned int cfq_slice_idle;
 
 	struct list_head cic_list;
+
+#ifdef CONFIG_BLK_IO_GROUP
+	struct cfq_group root_group;
+	struct list_head group_list;	/* all but the root group */
+#endif
 };
 
 /*
@@ -197,6 +229,10 @@ struct cfq_queue {
 
 	/* various state flags, see below */
 	unsigned int flags;
+
+#ifdef CONFIG_BLK_IO_GROUP
+	struct cfq_group *cfqg;
+#endif
 };
 
 struct cfq_rq {
@@ -457,6 +493,253 @@ static void cfq_update_next_crq(struct cfq_rq *crq)
 		cfqq->next_crq = cfq_find_next_crq(cfqq->cfqd, cfqq, crq);
 }
 
+#ifdef CONFIG_BLK_IO_GROUP
+static struct cfq_group *
+cfq_find_group(struct cfq_data *cfqd, struct io_group *iog)
+{
+	struct cfq_group *cfqg;
+
+	if (iog == cfqd->root_group.iog)
+		return &cfqd->root_group;
+	list_for_each_entry(cfqg, &cfqd->group_list, node)
+		if (cfqg->iog == iog)
+			return cfqg;
+	return NULL;
+}
+
+static void cfq_put_group(struct cfq_group *cfqg)
+{
+	struct cfq_group *parent;
+
+	while (!--cfqg->ref && cfqg->parent) {
+		BUG_ON(cfqg->busy);
+		parent = cfqg->parent;
+		list_del(&cfqg->node);
+		io_group_put(cfqg->iog);
+		kfree(cfqg);
+		cfqg = parent;
+	}
+}
+
+/*
+ * The group of @iog on the device, made along with its parents if need
+ * be.  Returns with a reference held, NULL if out of memory.  Called with
+ * the queue lock held.
+ */
+static struct cfq_group *
+cfq_get_group(struct cfq_data *cfqd, struct io_group *iog)
+{
+	struct cfq_group *cfqg, *parent;
+
+	cfqg = cfq_find_group(cfqd, iog);
+	if (cfqg) {
+		cfqg->ref++;
+		return cfqg;
+	}
+
+	parent = cfq_get_group(cfqd, iog->parent);
+	if (!parent)
+		return NULL;
+
+	cfqg = kzalloc(sizeof(*cfqg), GFP_ATOMIC);
+	if (!cfqg) {
+		cfq_put_group(parent);
+		return NULL;
+	}
+	io_group_get(iog);
+	cfqg->iog = iog;
+	cfqg->parent = parent;
+	cfqg->ref = 1;
+	list_add(&cfqg->node, &cfqd->group_list);
+	return cfqg;
+}
+
+/*
+ * The least vtime of the busy entities in @parent, but @skip: @parent
+ * stands for its own queues there.  Returns 0 if there are none.
+ */
+static int cfq_group_min_vtime(struct cfq_data *cfqd, struct cfq_group *parent,
+			       struct cfq_group *skip, unsigned long *min)
+{
+	struct cfq_group *cfqg;
+	int found = 0;
+
+	if (parent->own_busy && parent != skip) {
+		*min = parent->self_vtime;
+		found = 1;
+	}
+	list_for_each_entry(cfqg, &cfqd->group_list, node) {
+		if (cfqg->parent != parent || !cfqg->busy || cfqg == skip)
+			continue;
+		if (!found || time_before(cfqg->vtime, *min))
+			*min = cfqg->vtime;
+		found = 1;
+	}
+	return found;
+}
+
+/*
+ * A group which starts to have work does not get to make up for the time
+ * it had none, it starts out with the least charge of its busy siblings.
+ */
+static void cfq_group_add_busy(struct cfq_data *cfqd, struct cfq_queue *cfqq)
+{
+	struct cfq_group *cfqg = cfqq->cfqg;
+	unsigned long min;
+
+	if (!cfqg->own_busy++ &&
+	    cfq_group_min_vtime(cfqd, cfqg, cfqg, &min) &&
+	    time_before(cfqg->self_vtime, min))
+		cfqg->self_vtime = min;
+
+	for (; cfqg; cfqg = cfqg->parent) {
+		if (!cfqg->busy++ && cfqg->parent &&
+		    cfq_group_min_vtime(cfqd, cfqg->parent, cfqg, &min) &&
+		    time_before(cfqg->vtime, min))
+			cfqg->vtime = min;
+	}
+}
+
+static void cfq_group_del_busy(struct cfq_queue *cfqq)
+{
+	struct cfq_group *cfqg = cfqq->cfqg;
+
+	cfqg->own_busy--;
+	for (; cfqg; cfqg = cfqg->parent)
+		cfqg->busy--;
+}
+
+/*
+ * Charge the group of a queue, and its parents, for the time of a slice
+ */
+static void cfq_group_charge(struct cfq_queue *cfqq, unsigned long used)
+{
+	struct cfq_group *cfqg = cfqq->cfqg;
+
+	used = max(used, 1UL) << CFQ_VTIME_SHIFT;
+	cfqg->self_vtime += used;
+	for (; cfqg; cfqg = cfqg->parent)
+		cfqg->vtime += used * IOG_WEIGHT_DEFAULT / cfqg->iog->weight;
+}
+
+/*
+ * The group to serve next: from the root down, the busy entity of the
+ * least vtime, until it is a group's own queues.
+ */
+static struct cfq_group *cfq_select_group(struct cfq_data *cfqd)
+{
+	struct cfq_group *cfqg = &cfqd->root_group, *best, *__cfqg;
+	unsigned long min;
+
+	if (!cfqg->busy)
+		return NULL;
+
+	for (;;) {
+		best = NULL;
+		if (cfqg->own_busy) {
+			best = cfqg;
+			min = cfqg->self_vtime;
+		}
+		list_for_each_entry(__cfqg, &cfqd->group_list, node) {
+			if (__cfqg->parent != cfqg || !__cfqg->busy)
+				continue;
+			if (!best || time_before(__cfqg->vtime, min)) {
+				best = __cfqg;
+				min = __cfqg->vtime;
+			}
+		}
+		if (!best || best == cfqg)
+			return cfqg;
+		cfqg = best;
+	}
+}
+
+/*
+ * The first queue of the selected group, in the order the queues of all
+ * groups would be served in.  Real time queues go first whatever their
+ * group, idle class queues are left to the usual rules.
+ */
+static struct cfq_queue *cfq_group_next_queue(struct cfq_data *cfqd)
+{
+	struct cfq_group *cfqg;
+	struct cfq_queue *cfqq;
+	int i;
+
+	if (list_empty(&cfqd->group_list))
+		return NULL;
+
+	list_for_each_entry(cfqq, &cfqd->cur_rr, cfq_list)
+		if (cfq_class_rt(cfqq))
+			return cfqq;
+
+	cfqg = cfq_select_group(cfqd);
+	if (!cfqg)
+		return NULL;
+
+	list_for_each_entry(cfqq, &cfqd->cur_rr, cfq_list)
+		if (cfqq->cfqg == cfqg)
+			return cfqq;
+	for (i = 0; i < CFQ_PRIO_LISTS; i++)
+		list_for_each_entry(cfqq, &cfqd->rr_list[i], cfq_list)
+			if (cfqq->cfqg == cfqg)
+				return cfqq;
+	list_for_each_entry(cfqq, &cfqd->busy_rr, cfq_list)
+		if (cfqq->cfqg == cfqg)
+			return cfqq;
+
+	return NULL;
+}
+
+/*
+ * The group of a new queue: that of the task for a sync queue, the async
+ * queues are shared by all and stay in the root group.
+ */
+static void cfq_init_queue_group(struct cfq_data *cfqd, struct cfq_queue *cfqq)
+{
+	struct io_group *iog;
+
+	cfqq->cfqg = NULL;
+	if (cfqq->key != CFQ_KEY_ASYNC) {
+		iog = cpuset_get_io_group();
+		cfqq->cfqg = cfq_get_group(cfqd, iog);
+		io_group_put(iog);
+	}
+	if (!cfqq->cfqg) {
+		cfqq->cfqg = &cfqd->root_group;
+		cfqd->root_group.ref++;
+	}
+}
+
+static void cfq_completed_group(struct cfq_queue *cfqq, struct request *rq)
+{
+	if (blk_fs_request(rq))
+		io_group_completed(cfqq->cfqg->iog, rq_data_dir(rq),
+				   rq->start_time);
+}
+
+static void cfq_init_groups(struct cfq_data *cfqd)
+{
+	cfqd->root_group.iog = &root_io_group;
+	cfqd->root_group.ref = 1;
+	INIT_LIST_HEAD(&cfqd->group_list);
+}
+#else
+static inline struct cfq_queue *cfq_group_next_queue(struct cfq_data *cfqd)
+{
+	return NULL;
+}
+static inline void
+cfq_group_add_busy(struct cfq_data *cfqd, struct cfq_queue *cfqq) {}
+static inline void cfq_group_del_busy(struct cfq_queue *cfqq) {}
+static inline void
+cfq_group_charge(struct cfq_queue *cfqq, unsigned long used) {}
+static inline void
+cfq_init_queue_group(struct cfq_data *cfqd, struct cfq_queue *cfqq) {}
+static inline void
+cfq_completed_group(struct cfq_queue *cfqq, struct request *rq) {}
+static inline void cfq_init_groups(struct cfq_data *cfqd) {}
+#endif
+
 static void cfq_resort_rr_list(struct cfq_queue *cfqq, int preempted)
 {
 	struct cfq_data *cfqd = cfqq->cfqd;
@@ -522,6 +805,7 @@ cfq_add_cfqq_rr(struct cfq_data *cfqd, struct cfq_queue *cfqq)
 	BUG_ON(cfq_cfqq_on_rr(cfqq));
 	cfq_mark_cfqq_on_rr(cfqq);
 	cfqd->busy_queues++;
+	cfq_group_add_busy(cfqd, cfqq);
 
 	cfq_resort_rr_list(cfqq, 0);
 }
@@ -535,6 +819,7 @@ cfq_del_cfqq_rr(struct cfq_data *cfqd, struct cfq_queue *cfqq)
 
 	BUG_ON(!cfqd->busy_queues);
 	cfqd->busy_queues--;
+	cfq_group_del_busy(cfqq);
 }
 
 /*
@@ -768,6 +1053,9 @@ __cfq_slice_expired(struct cfq_data *cfqd, struct cfq_queue *cfqq,
 	if (cfq_cfqq_wait_request(cfqq))
 		del_timer(&cfqd->idle_slice_timer);
 
+	if (cfqq == cfqd->active_queue)
+		cfq_group_charge(cfqq, now - cfqq->slice_start);
+
 	if (!preempted && !cfq_cfqq_dispatched(cfqq)) {
 		cfqq->service_last = now;
 		cfq_schedule_dispatch(cfqd);
@@ -866,13 +1154,17 @@ static int cfq_get_next_prio_level(struct cfq_data *cfqd)
 
 static struct cfq_queue *cfq_set_active_queue(struct cfq_data *cfqd)
 {
-	struct cfq_queue *cfqq = NULL;
+	/*
+	 * with io groups on the device, the group to serve comes first
+	 */
+	struct cfq_queue *cfqq = cfq_group_next_queue(cfqd);
 
 	/*
 	 * if current list is non-empty, grab first entry. if it is empty,
 	 * get next prio level and grab first entry then if any are spliced
 	 */
-	if (!list_empty(&cfqd->cur_rr) || cfq_get_next_prio_level(cfqd) != -1)
+	if (!cfqq && (!list_empty(&cfqd->cur_rr) ||
+		      cfq_get_next_prio_level(cfqd) != -1))
 		cfqq = list_entry_cfqq(cfqd->cur_rr.next);
 
 	/*
@@ -902,6 +1194,17 @@ static struct cfq_queue *cfq_set_active_queue(struct cfq_data *cfqd)
 
 #define CIC_SEEKY(cic) ((cic)->seek_mean > (128 * 1024))
 
+/*
+ * A device which doesn't seek, and has room for many requests at once,
+ * loses more throughput to idling for the next request of a queue than it
+ * could ever gain from it.  The time slices stay, and with them fairness
+ * between the queues and classes, but an empty queue gives up its slice.
+ */
+static inline int cfq_nonrot_deep(struct cfq_data *cfqd)
+{
+	return cfqd->hw_tag && blk_queue_nonrot(cfqd->queue);
+}
+
 static int cfq_arm_slice_timer(struct cfq_data *cfqd, struct cfq_queue *cfqq)
 
 {
@@ -918,6 +1221,8 @@ static int cfq_arm_slice_timer(struct cfq_data *cfqd, struct cfq_queue *cfqq)
 		return 0;
 	if (!cfq_cfqq_idle_window(cfqq))
 		return 0;
+	if (cfq_nonrot_deep(cfqd))
+		return 0;
 	/*
 	 * task has exited, don't wait
 	 */
@@ -1038,6 +1343,8 @@ static struct cfq_queue *cfq_select_queue(struct cfq_data *cfqd)
 	 */
 	if (!RB_EMPTY_ROOT(&cfqq->sort_list))
 		goto keep_queue;
+	else if (cfq_nonrot_deep(cfqd))
+		goto expire;
 	else if (cfq_cfqq_dispatched(cfqq)) {
 		cfqq = NULL;
 		goto keep_queue;
@@ -1177,6 +1484,8 @@ cfq_dispatch_requests(request_queue_t *q, int force)
 		max_dispatch = cfqd->cfq_quantum;
 		if (cfq_class_idle(cfqq))
 			max_dispatch = 1;
+		else if (cfq_nonrot_deep(cfqd))
+			max_dispatch *= CFQ_NONROT_QUANTUM;
 
 		dispatched += __cfq_dispatch_requests(cfqd, cfqq, max_dispatch);
 
@@ -1220,6 +1529,9 @@ static void cfq_put_queue(struct cfq_queue *cfqq)
 	 */
 	list_del(&cfqq->cfq_list);
 	hlist_del(&cfqq->cfq_hash);
+#ifdef CONFIG_BLK_IO_GROUP
+	cfq_put_group(cfqq->cfqg);
+#endif
 	kmem_cache_free(cfq_pool, cfqq);
 }
 
@@ -1488,6 +1800,7 @@ retry:
 		cfq_mark_cfqq_idle_window(cfqq);
 		cfq_mark_cfqq_prio_changed(cfqq);
 		cfq_init_prio_data(cfqq);
+		cfq_init_queue_group(cfqd, cfqq);
 	}
 
 	if (new_cfqq)
@@ -1849,6 +2162,8 @@ static void cfq_completed_request(request_queue_t *q, struct request *rq)
 	if (!cfq_class_idle(cfqq))
 		cfqd->last_end_request = now;
 
+	cfq_completed_group(cfqq, rq);
+
 	if (!cfq_cfqq_dispatched(cfqq)) {
 		if (cfq_cfqq_on_rr(cfqq)) {
 			cfqq->service_last = now;
@@ -2245,6 +2560,7 @@ static void *cfq_init_queue(request_queue_t *q, elevator_t *e)
 	INIT_LIST_HEAD(&cfqd->idle_rr);
 	INIT_LIST_HEAD(&cfqd->empty_list);
 	INIT_LIST_HEAD(&cfqd->cic_list);
+	cfq_init_groups(cfqd);
 
 	cfqd->crq_hash = kmalloc(sizeof(struct hlist_head) * CFQ_MHASH_ENTRIES, GFP_KERNEL);
 	if (!cfqd->crq_hash)
@@ -14,6 +14,7 @@
 #include <linux/compiler.h>
 #include <linux/hash.h>
 #include <linux/rbtree.h>
+#include <linux/ktime.h>
 
 /*
  * See Documentation/block/deadline-iosched.txt
@@ -23,6 +24,13 @@ static const int write_expire = 5 * HZ; /* ditto for writes, these limits are SO
 static const int writes_starved = 2;    /* max times reads can starve a write */
 static const int fifo_batch = 16;       /* # of sequential requests treated as one
 				     by the above parameters. For throughput. */
+static const int target_read_lat = 0;	/* usecs a read should take, 0 for none */
+
+/*
+ * Service time estimates are kept per data direction, and per size of the
+ * requests in powers of two: up to 4KB, 8KB, ... 512KB and more.
+ */
+#define DL_SIZE_BUCKETS		8
 
 static const int deadline_hash_shift = 5;
 #define DL_HASH_BLOCK(sec)	((sec) >> 3)
@@ -58,6 +66,16 @@ struct deadline_data {
 	int fifo_batch;
 	int writes_starved;
 	int front_merges;
+	int target_read_lat;
+
+	/*
+	 * with a read latency target, a write batch ends early once reads
+	 * are waiting and the estimated service time of the writes
+	 * dispatched since the last read is over write_budget
+	 */
+	s64 svc_ns[2][DL_SIZE_BUCKETS];	/* service time averages */
+	s64 batch_ns;			/* of the writes since the last read */
+	s64 write_budget;		/* adapted to the read latencies */
 
 	mempool_t *drq_pool;
 };
@@ -84,6 +102,11 @@ struct deadline_rq {
 	 */
 	struct list_head fifo;
 	unsigned long expires;
+
+	/* for the latency target */
+	s64 queued_ns;
+	s64 dispatched_ns;
+	int size_bucket;
 };
 
 static void deadline_move_request(struct deadline_data *dd, struct deadline_rq *drq);
@@ -262,6 +285,51 @@ deadline_find_first_drq(struct deadline_data *dd, int data_dir)
 /*
  * add drq to rbtree and fifo
  */
+static inline s64 deadline_now_ns(void)
+{
+	struct timespec ts;
+
+	ktime_get_ts(&ts);
+	return timespec_to_ns(&ts);
+}
+
+static inline int deadline_size_bucket(struct request *rq)
+{
+	/* 8 sectors and below go to the first one */
+	int bucket = fls(rq->nr_sectors >> 3);
+
+	return min(bucket, DL_SIZE_BUCKETS - 1);
+}
+
+/*
+ * The service time a request is expected to take, as seen for requests of
+ * its direction and size.  Until there are samples, the budget of a batch
+ * is assumed to allow fifo_batch requests.
+ */
+static s64 deadline_svc_estimate(struct deadline_data *dd, struct request *rq)
+{
+	s64 svc = dd->svc_ns[rq_data_dir(rq)][deadline_size_bucket(rq)];
+
+	if (!svc)
+		svc = (s64)dd->target_read_lat * NSEC_PER_USEC /
+			max(dd->fifo_batch, 1);
+	return svc;
+}
+
+/*
+ * Must a write batch end before @drq, to let the waiting reads go?
+ */
+static inline int
+deadline_batch_over(struct deadline_data *dd, struct deadline_rq *drq,
+		    int reads)
+{
+	if (!dd->target_read_lat || !reads)
+		return 0;
+	if (rq_data_dir(drq->request) != WRITE)
+		return 0;
+	return dd->batch_ns >= dd->write_budget;
+}
+
 static void
 deadline_add_request(struct request_queue *q, struct request *rq)
 {
@@ -276,6 +344,8 @@ deadline_add_request(struct request_queue *q, struct request *rq)
 	 */
 	drq->expires = jiffies + dd->fifo_expire[data_dir];
 	list_add_tail(&drq->fifo, &dd->fifo_list[data_dir]);
+	if (dd->target_read_lat)
+		drq->queued_ns = deadline_now_ns();
 
 	if (rq_mergeable(rq))
 		deadline_add_drq_hash(dd, drq);
@@ -481,7 +551,8 @@ static int deadline_dispatch_requests(request_queue_t *q, int force)
 			/* end the batch on a non sequential request */
 			dd->batching += dd->fifo_batch;
 		
-		if (dd->batching < dd->fifo_batch)
+		if (dd->batching < dd->fifo_batch &&
+		    !deadline_batch_over(dd, drq, reads))
 			/* we are still entitled to batch */
 			goto dispatch_request;
 	}
@@ -549,11 +620,60 @@ dispatch_request:
 	 * drq is the selected appropriate request.
 	 */
 	dd->batching++;
+	if (dd->target_read_lat) {
+		if (rq_data_dir(drq->request) == READ)
+			dd->batch_ns = 0;
+		else
+			dd->batch_ns += deadline_svc_estimate(dd, drq->request);
+	}
 	deadline_move_request(dd, drq);
 
 	return 1;
 }
 
+static void deadline_activate_request(request_queue_t *q, struct request *rq)
+{
+	struct deadline_data *dd = q->elevator->elevator_data;
+	struct deadline_rq *drq = RQ_DATA(rq);
+
+	if (dd->target_read_lat) {
+		drq->dispatched_ns = deadline_now_ns();
+		drq->size_bucket = deadline_size_bucket(rq);
+	}
+}
+
+/*
+ * Update the service time average of the size of the request, and adapt
+ * the write budget to the latency of reads: halve it for a read later
+ * than the target, grow it by an eighth of the target for one in time.
+ */
+static void deadline_completed_request(request_queue_t *q, struct request *rq)
+{
+	struct deadline_data *dd = q->elevator->elevator_data;
+	struct deadline_rq *drq = RQ_DATA(rq);
+	const int data_dir = rq_data_dir(rq);
+	s64 target, now, *svc;
+
+	if (!dd->target_read_lat || !drq->dispatched_ns)
+		return;
+
+	now = deadline_now_ns();
+	svc = &dd->svc_ns[data_dir][drq->size_bucket];
+	if (*svc)
+		*svc += (now - drq->dispatched_ns - *svc) / 8;
+	else
+		*svc = now - drq->dispatched_ns;
+
+	if (data_dir != READ || !drq->queued_ns)
+		return;
+
+	target = (s64)dd->target_read_lat * NSEC_PER_USEC;
+	if (now - drq->queued_ns > target)
+		dd->write_budget = max(dd->write_budget / 2, target / 16);
+	else
+		dd->write_budget = min(dd->write_budget + target / 8, target);
+}
+
 static int deadline_queue_empty(request_queue_t *q)
 {
 	struct deadline_data *dd = q->elevator->elevator_data;
@@ -642,6 +762,8 @@ static void *deadline_init_queue(request_queue_t *q, elevator_t *e)
 	dd->writes_starved = writes_starved;
 	dd->front_merges = 1;
 	dd->fifo_batch = fifo_batch;
+	dd->target_read_lat = target_read_lat;
+	dd->write_budget = (s64)target_read_lat * NSEC_PER_USEC;
 	return dd;
 }
 
@@ -711,6 +833,7 @@ SHOW_FUNCTION(deadline_write_expire_show, dd->fifo_expire[WRITE], 1);
 SHOW_FUNCTION(deadline_writes_starved_show, dd->writes_starved, 0);
 SHOW_FUNCTION(deadline_front_merges_show, dd->front_merges, 0);
 SHOW_FUNCTION(deadline_fifo_batch_show, dd->fifo_batch, 0);
+SHOW_FUNCTION(deadline_target_read_lat_show, dd->target_read_lat, 0);
 #undef SHOW_FUNCTION
 
 #define STORE_FUNCTION(__FUNC, __PTR, MIN, MAX, __CONV)			\
@@ -736,6 +859,23 @@ STORE_FUNCTION(deadline_front_merges_store, &dd->front_merges, 0, 1, 0);
 STORE_FUNCTION(deadline_fifo_batch_store, &dd->fifo_batch, 0, INT_MAX, 0);
 #undef STORE_FUNCTION
 
+static ssize_t
+deadline_target_read_lat_store(elevator_t *e, const char *page, size_t count)
+{
+	struct deadline_data *dd = e->elevator_data;
+	int __data;
+	int ret = deadline_var_store(&__data, (page), count);
+
+	if (__data < 0)
+		__data = 0;
+	/* start over, with the whole target for the writes */
+	memset(dd->svc_ns, 0, sizeof(dd->svc_ns));
+	dd->batch_ns = 0;
+	dd->write_budget = (s64)__data * NSEC_PER_USEC;
+	dd->target_read_lat = __data;
+	return ret;
+}
+
 #define DD_ATTR(name) \
 	__ATTR(name, S_IRUGO|S_IWUSR, deadline_##name##_show, \
 				      deadline_##name##_store)
@@ -746,6 +886,7 @@ static struct elv_fs_entry deadline_attrs[] = {
 	DD_ATTR(writes_starved),
 	DD_ATTR(front_merges),
 	DD_ATTR(fifo_batch),
+	DD_ATTR(target_read_lat),
 	__ATTR_NULL
 };
 
@@ -759,6 +900,8 @@ static struct elevator_type iosched_deadline = {
 		.elevator_queue_empty_fn =	deadline_queue_empty,
 		.elevator_former_req_fn =	deadline_former_request,
 		.elevator_latter_req_fn =	deadline_latter_request,
+		.elevator_activate_req_fn =	deadline_activate_request,
+		.elevator_completed_req_fn =	deadline_completed_request,
 		.elevator_set_req_fn =		deadline_set_request,
 		.elevator_put_req_fn = 		deadline_put_request,
 		.elevator_init_fn =		deadline_init_queue,
@@ -33,6 +33,8 @@
 #include <linux/compiler.h>
 #include <linux/delay.h>
 #include <linux/blktrace_api.h>
+#include <linux/blk-latency.h>
+#include <linux/trace_events.h>
 
 #include <asm/uaccess.h>
 
@@ -512,6 +514,8 @@ struct request *elv_next_request(request_queue_t *q)
 			 */
 			rq->flags |= REQ_STARTED;
 			blk_add_trace_rq(q, rq, BLK_TA_ISSUE);
+			trace_block_rq_issue(q, rq);
+			blk_lat_issue(rq);
 		}
 
 		if (!q->boundary_rq || q->boundary_rq == rq) {
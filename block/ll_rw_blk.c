@@ -19,6 +19,7 @@
 #include <linux/mm.h>
 #include <linux/kernel_stat.h>
 #include <linux/string.h>
+#include <linux/scatterlist.h>
 #include <linux/init.h>
 #include <linux/bootmem.h>	/* for max_pfn/max_low_pfn */
 #include <linux/completion.h>
@@ -27,7 +28,15 @@
 #include <linux/writeback.h>
 #include <linux/interrupt.h>
 #include <linux/cpu.h>
+#include <linux/topology.h>
 #include <linux/blktrace_api.h>
+#include <linux/blk-iogroup.h>
+#include <linux/blk-latency.h>
+#include <linux/trace_events.h>
+#include <linux/task_io_accounting_ops.h>
+#include <linux/pci.h>		/* for PCI_DMA_BUS_IS_PHYS */
+
+#include "blk.h"
 
 /*
  * for max sense size
@@ -37,9 +46,11 @@
 static void blk_unplug_work(void *data);
 static void blk_unplug_timeout(unsigned long data);
 static void drive_stat_acct(struct request *rq, int nr_sectors, int new_io);
-static void init_request_from_bio(struct request *req, struct bio *bio);
 static int __make_request(request_queue_t *q, struct bio *bio);
 
+DEFINE_TRACE(block_rq_issue);
+DEFINE_TRACE(block_rq_complete);
+
 /*
  * For the allocated request tables
  */
@@ -70,7 +81,21 @@ unsigned long blk_max_low_pfn, blk_max_pfn;
 EXPORT_SYMBOL(blk_max_low_pfn);
 EXPORT_SYMBOL(blk_max_pfn);
 
-static DEFINE_PER_CPU(struct list_head, blk_cpu_done);
+/*
+ * The requests to complete on each cpu from BLOCK_SOFTIRQ.  For a queue
+ * which completes on the submitting cpu, another cpu may queue a request
+ * to it as well, and kick it with an IPI from its own softirq, once
+ * interrupts are on.
+ */
+struct blk_cpu_done {
+	spinlock_t		lock;
+	struct list_head	list;
+#ifdef CONFIG_BLK_COMPLETE_REMOTE
+	cpumask_t		ipi_mask;	/* cpus to kick, irqs off */
+#endif
+};
+
+static DEFINE_PER_CPU(struct blk_cpu_done, blk_cpu_done);
 
 /* Amount of time in which a process may batch requests */
 #define BLK_BATCH_TIME	(HZ/50UL)
@@ -249,7 +274,8 @@ void blk_queue_make_request(request_queue_t * q, make_request_fn * mfn)
 	blk_queue_max_hw_segments(q, MAX_HW_SEGMENTS);
 	q->make_request_fn = mfn;
 	q->backing_dev_info.ra_pages = (VM_MAX_READAHEAD * 1024) / PAGE_CACHE_SIZE;
-	q->backing_dev_info.state = 0;
+	/* the queue stays registered, see blk_alloc_queue_node() */
+	q->backing_dev_info.state &= 1 << BDI_registered;
 	q->backing_dev_info.capabilities = BDI_CAP_MAP_COPY;
 	blk_queue_max_sectors(q, SAFE_MAX_SECTORS);
 	blk_queue_hardsect_size(q, 512);
@@ -298,6 +324,8 @@ static inline void rq_init(request_queue_t *q, struct request *rq)
 	rq->end_io = NULL;
 	rq->end_io_data = NULL;
 	rq->completion_data = NULL;
+	rq->cpu = -1;
+	blk_lat_clear(rq);
 }
 
 /**
@@ -654,6 +682,32 @@ void blk_queue_bounce_limit(request_queue_t *q, u64 dma_addr)
 
 EXPORT_SYMBOL(blk_queue_bounce_limit);
 
+/**
+ * blk_queue_bounce_dev - set the bounce limit from the device doing the DMA
+ * @q:  the request queue for the device
+ * @dev:  the device the pages are mapped for, or %NULL
+ *
+ * Description:
+ *    Where the DMA API translates bus addresses, through an IOMMU or
+ *    swiotlb, any page can be handed to dma_map_sg() after blk_rq_map_sg()
+ *    and nothing needs to be bounced by the block layer.  Otherwise the
+ *    DMA mask of @dev is the limit, and devices without one get their
+ *    highmem pages bounced.
+ **/
+void blk_queue_bounce_dev(request_queue_t *q, struct device *dev)
+{
+	u64 limit = BLK_BOUNCE_HIGH;
+
+	if (!PCI_DMA_BUS_IS_PHYS)
+		limit = BLK_BOUNCE_ANY;
+	else if (dev && dev->dma_mask && *dev->dma_mask)
+		limit = *dev->dma_mask;
+
+	blk_queue_bounce_limit(q, limit);
+}
+
+EXPORT_SYMBOL(blk_queue_bounce_dev);
+
 /**
  * blk_queue_max_sectors - set max sectors for a request for this queue
  * @q:  the request queue for the device
@@ -1312,21 +1366,27 @@ static int blk_hw_contig_segment(request_queue_t *q, struct bio *bio,
 
 /*
  * map a request to scatterlist, return number of sg entries setup. Caller
- * must make sure sg can hold rq->nr_phys_segments entries
+ * must make sure sg can hold rq->nr_phys_segments entries.  On a queue
+ * marked QUEUE_FLAG_SG_CHAIN, sglist may be a chain of tables; the
+ * entries of other queues' tables need not be initialised.
  */
-int blk_rq_map_sg(request_queue_t *q, struct request *rq, struct scatterlist *sg)
+int blk_rq_map_sg(request_queue_t *q, struct request *rq,
+		  struct scatterlist *sglist)
 {
 	struct bio_vec *bvec, *bvprv;
+	struct scatterlist *sg;
 	struct bio *bio;
-	int nsegs, i, cluster;
+	int nsegs, i, cluster, chain;
 
 	nsegs = 0;
 	cluster = q->queue_flags & (1 << QUEUE_FLAG_CLUSTER);
+	chain = blk_queue_sg_chain(q);
 
 	/*
 	 * for each bio in rq
 	 */
 	bvprv = NULL;
+	sg = NULL;
 	rq_for_each_bio(bio, rq) {
 		/*
 		 * for each segment in bio
@@ -1335,7 +1395,7 @@ int blk_rq_map_sg(request_queue_t *q, struct request *rq, struct scatterlist *sg
 			int nbytes = bvec->bv_len;
 
 			if (bvprv && cluster) {
-				if (sg[nsegs - 1].length + nbytes > q->max_segment_size)
+				if (sg->length + nbytes > q->max_segment_size)
 					goto new_segment;
 
 				if (!BIOVEC_PHYS_MERGEABLE(bvprv, bvec))
@@ -1343,13 +1403,20 @@ int blk_rq_map_sg(request_queue_t *q, struct request *rq, struct scatterlist *sg
 				if (!BIOVEC_SEG_BOUNDARY(q, bvprv, bvec))
 					goto new_segment;
 
-				sg[nsegs - 1].length += nbytes;
+				sg->length += nbytes;
 			} else {
 new_segment:
-				memset(&sg[nsegs],0,sizeof(struct scatterlist));
-				sg[nsegs].page = bvec->bv_page;
-				sg[nsegs].length = nbytes;
-				sg[nsegs].offset = bvec->bv_offset;
+				if (!sg)
+					sg = sglist;
+				else if (chain)
+					sg = sg_next(sg);
+				else
+					sg++;
+
+				memset(sg, 0, sizeof(struct scatterlist));
+				sg->page = bvec->bv_page;
+				sg->length = nbytes;
+				sg->offset = bvec->bv_offset;
 
 				nsegs++;
 			}
@@ -1412,7 +1479,7 @@ static inline int ll_new_hw_segment(request_queue_t *q,
 	return 1;
 }
 
-static int ll_back_merge_fn(request_queue_t *q, struct request *req, 
+int ll_back_merge_fn(request_queue_t *q, struct request *req, 
 			    struct bio *bio)
 {
 	unsigned short max_sectors;
@@ -1450,7 +1517,7 @@ static int ll_back_merge_fn(request_queue_t *q, struct request *req,
 	return ll_new_hw_segment(q, req, bio);
 }
 
-static int ll_front_merge_fn(request_queue_t *q, struct request *req, 
+int ll_front_merge_fn(request_queue_t *q, struct request *req, 
 			     struct bio *bio)
 {
 	unsigned short max_sectors;
@@ -1489,7 +1556,7 @@ static int ll_front_merge_fn(request_queue_t *q, struct request *req,
 	return ll_new_hw_segment(q, req, bio);
 }
 
-static int ll_merge_requests_fn(request_queue_t *q, struct request *req,
+int ll_merge_requests_fn(request_queue_t *q, struct request *req,
 				struct request *next)
 {
 	int total_phys_segments;
@@ -1773,6 +1840,7 @@ static void blk_release_queue(struct kobject *kobj)
 	struct request_list *rl = &q->rq;
 
 	blk_sync_queue(q);
+	bdi_unregister(&q->backing_dev_info);
 
 	if (rl->rq_pool)
 		mempool_destroy(rl->rq_pool);
@@ -1783,6 +1851,10 @@ static void blk_release_queue(struct kobject *kobj)
 	if (q->blk_trace)
 		blk_trace_shutdown(q);
 
+	if (q->mq_ops)
+		blk_mq_free_queue(q);
+
+	blk_lat_exit(q);
 	kmem_cache_free(requestq_cachep, q);
 }
 
@@ -1842,6 +1914,10 @@ request_queue_t *blk_alloc_queue_node(gfp_t gfp_mask, int node_id)
 		return NULL;
 
 	memset(q, 0, sizeof(*q));
+	if (blk_lat_init(q)) {
+		kmem_cache_free(requestq_cachep, q);
+		return NULL;
+	}
 	init_timer(&q->unplug_timer);
 
 	snprintf(q->kobj.name, KOBJ_NAME_LEN, "%s", "queue");
@@ -1850,6 +1926,7 @@ request_queue_t *blk_alloc_queue_node(gfp_t gfp_mask, int node_id)
 
 	q->backing_dev_info.unplug_io_fn = blk_backing_dev_unplug;
 	q->backing_dev_info.unplug_io_data = q;
+	bdi_register(&q->backing_dev_info);
 
 	mutex_init(&q->sysfs_lock);
 
@@ -2771,6 +2848,7 @@ static int attempt_merge(request_queue_t *q, struct request *req,
 	 */
 	if (time_after(req->start_time, next->start_time))
 		req->start_time = next->start_time;
+	blk_lat_merge(req, next);
 
 	req->biotail->bi_next = next->bio;
 	req->biotail = next->biotail;
@@ -2810,7 +2888,153 @@ static inline int attempt_front_merge(request_queue_t *q, struct request *rq)
 	return 0;
 }
 
-static void init_request_from_bio(struct request *req, struct bio *bio)
+/*
+ * Per-task plugging.  Between blk_start_plug() and blk_finish_plug(), the
+ * requests a task makes of a queue which takes it (QUEUE_FLAG_TASKPLUG)
+ * are kept on the task's plug: bios are merged into them there without
+ * the queue lock, and they go to the elevator all at once, at the end of
+ * the batch or when the task sleeps.  Such a queue is never plugged
+ * itself, what is queued outside of a batch is dispatched at once.
+ */
+
+/* Flush a plug which holds this many requests, not to delay them all */
+#define BLK_PLUG_MAX_REQUESTS	16
+
+/*
+ * Let the driver at the requests of a queue which doesn't wait for a plug
+ * timer.  Called with the queue lock held.
+ */
+static void blk_dispatch_queue(request_queue_t *q)
+{
+	blk_remove_plug(q);
+	if (!blk_queue_stopped(q) && !elv_queue_empty(q))
+		q->request_fn(q);
+}
+
+/**
+ * blk_start_plug - start batching the requests of the current task
+ * @plug: the plug, on the caller's stack
+ *
+ * Plugs don't nest: the requests made under an inner plug go on the outer
+ * one, which is flushed when the outermost batch ends.
+ */
+void blk_start_plug(struct blk_plug *plug)
+{
+	INIT_LIST_HEAD(&plug->list);
+	plug->count = 0;
+	if (!current->plug)
+		current->plug = plug;
+}
+EXPORT_SYMBOL(blk_start_plug);
+
+/**
+ * blk_flush_plug_list - queue the requests batched on a plug
+ * @plug: the plug of the current task
+ *
+ * The requests of each queue are added to its elevator, and the driver
+ * started, in one hold of the queue lock.
+ */
+void blk_flush_plug_list(struct blk_plug *plug)
+{
+	LIST_HEAD(list);
+	struct request *rq, *n;
+	request_queue_t *q;
+
+	list_splice_init(&plug->list, &list);
+	plug->count = 0;
+
+	while (!list_empty(&list)) {
+		q = list_entry_rq(list.next)->q;
+
+		spin_lock_irq(q->queue_lock);
+		list_for_each_entry_safe(rq, n, &list, queuelist) {
+			if (rq->q != q)
+				continue;
+			list_del_init(&rq->queuelist);
+			add_request(q, rq);
+		}
+		blk_dispatch_queue(q);
+		spin_unlock_irq(q->queue_lock);
+	}
+}
+EXPORT_SYMBOL(blk_flush_plug_list);
+
+/**
+ * blk_finish_plug - end a batch started by blk_start_plug()
+ * @plug: the plug given to blk_start_plug()
+ */
+void blk_finish_plug(struct blk_plug *plug)
+{
+	if (!list_empty(&plug->list))
+		blk_flush_plug_list(plug);
+	if (current->plug == plug)
+		current->plug = NULL;
+}
+EXPORT_SYMBOL(blk_finish_plug);
+
+/*
+ * Merge @bio at either end of @req, a request which isn't on a queue yet.
+ * Returns 1 if it was merged, 0 if it isn't contiguous with @req, and -1
+ * if it is but the merge was refused.
+ */
+int blk_attempt_bio_merge(request_queue_t *q, struct request *req,
+			  struct bio *bio)
+{
+	int nr_sectors = bio_sectors(bio);
+
+	if (!elv_rq_merge_ok(req, bio))
+		return 0;
+
+	if (req->sector + req->nr_sectors == bio->bi_sector) {
+		if (!q->back_merge_fn(q, req, bio))
+			return -1;
+
+		blk_add_trace_bio(q, bio, BLK_TA_BACKMERGE);
+
+		req->biotail->bi_next = bio;
+		req->biotail = bio;
+	} else if (req->sector - nr_sectors == bio->bi_sector) {
+		if (!q->front_merge_fn(q, req, bio))
+			return -1;
+
+		blk_add_trace_bio(q, bio, BLK_TA_FRONTMERGE);
+
+		bio->bi_next = req->bio;
+		req->bio = bio;
+		req->buffer = bio_data(bio);
+		req->current_nr_sectors = bio_cur_sectors(bio);
+		req->hard_cur_sectors = req->current_nr_sectors;
+		req->sector = req->hard_sector = bio->bi_sector;
+	} else
+		return 0;
+
+	req->nr_sectors = req->hard_nr_sectors += nr_sectors;
+	req->ioprio = ioprio_best(req->ioprio, bio_prio(bio));
+	return 1;
+}
+
+/*
+ * Merge @bio into one of the requests on the plug.  No lock is needed,
+ * the requests are the task's alone until the plug is flushed.
+ */
+static int attempt_plug_merge(struct blk_plug *plug, request_queue_t *q,
+			      struct bio *bio)
+{
+	struct request *req;
+	int ret;
+
+	list_for_each_entry_reverse(req, &plug->list, queuelist) {
+		if (req->q != q)
+			continue;
+		ret = blk_attempt_bio_merge(q, req, bio);
+		if (ret)
+			return ret > 0;
+	}
+
+	return 0;
+}
+
+void init_request_from_bio(struct request *req, struct bio *bio)
 {
 	req->flags |= REQ_CMD;
 
@@ -2841,10 +3065,13 @@ static void init_request_from_bio(struct request *req, struct bio *bio)
 	req->ioprio = bio_prio(bio);
 	req->rq_disk = bio->bi_bdev->bd_disk;
 	req->start_time = jiffies;
+	blk_lat_queued(req);
+	req->cpu = raw_smp_processor_id();
 }
 
 static int __make_request(request_queue_t *q, struct bio *bio)
 {
+	struct blk_plug *plug = NULL;
 	struct request *req;
 	int el_ret, rw, nr_sectors, cur_nr_sectors, barrier, err, sync;
 	unsigned short prio;
@@ -2873,6 +3100,12 @@ static int __make_request(request_queue_t *q, struct bio *bio)
 		goto end_io;
 	}
 
+	if (current->plug && blk_queue_taskplug(q) && !barrier) {
+		plug = current->plug;
+		if (attempt_plug_merge(plug, q, bio))
+			return 0;
+	}
+
 	spin_lock_irq(q->queue_lock);
 
 	if (unlikely(barrier) || elv_queue_empty(q))
@@ -2944,12 +3177,22 @@ get_rq:
 	 */
 	init_request_from_bio(req, bio);
 
+	if (plug) {
+		if (plug->count >= BLK_PLUG_MAX_REQUESTS)
+			blk_flush_plug_list(plug);
+		list_add_tail(&req->queuelist, &plug->list);
+		plug->count++;
+		return 0;
+	}
+
 	spin_lock_irq(q->queue_lock);
-	if (elv_queue_empty(q))
+	if (elv_queue_empty(q) && !blk_queue_taskplug(q))
 		blk_plug_device(q);
 	add_request(q, req);
 out:
-	if (sync)
+	if (blk_queue_taskplug(q))
+		blk_dispatch_queue(q);
+	else if (sync)
 		__generic_unplug_device(q);
 
 	spin_unlock_irq(q->queue_lock);
@@ -3098,6 +3341,26 @@ end_io:
 
 EXPORT_SYMBOL(generic_make_request);
 
+#ifdef CONFIG_BLK_IO_GROUP
+/*
+ * Account a bio to the io group of the submitter, returns 1 if the group
+ * is over its limits and holds the bio back.
+ */
+static int blk_throttle_bio(struct bio *bio)
+{
+	struct io_group *iog = cpuset_get_io_group();
+	int held = io_group_throttle(iog, bio);
+
+	io_group_put(iog);
+	return held;
+}
+#else
+static inline int blk_throttle_bio(struct bio *bio)
+{
+	return 0;
+}
+#endif
+
 /**
  * submit_bio: submit a bio to the block device layer for I/O
  * @rw: whether to %READ or %WRITE, or maybe to %READA (read ahead)
@@ -3115,10 +3378,13 @@ void submit_bio(int rw, struct bio *bio)
 	BIO_BUG_ON(!bio->bi_size);
 	BIO_BUG_ON(!bio->bi_io_vec);
 	bio->bi_rw |= rw;
-	if (rw & WRITE)
+	if (rw & WRITE) {
 		count_vm_events(PGPGOUT, count);
-	else
+	} else {
+		/* writes are accounted to tasks when they dirty pages */
+		task_io_account_read(bio->bi_size);
 		count_vm_events(PGPGIN, count);
+	}
 
 	if (unlikely(block_dump)) {
 		char b[BDEVNAME_SIZE];
@@ -3129,6 +3395,9 @@ void submit_bio(int rw, struct bio *bio)
 			bdevname(bio->bi_bdev,b));
 	}
 
+	if (blk_throttle_bio(bio))
+		return;
+
 	generic_make_request(bio);
 }
 
@@ -3212,6 +3481,7 @@ static int __end_that_request_first(struct request *req, int uptodate,
 	struct bio *bio;
 
 	blk_add_trace_rq(req->q, req, BLK_TA_COMPLETE);
+	trace_block_rq_complete(req->q, req);
 
 	/*
 	 * extend uptodate bool to allow < 0 value to be direct io error
@@ -3358,19 +3628,66 @@ int end_that_request_chunk(struct request *req, int uptodate, int nr_bytes)
 
 EXPORT_SYMBOL(end_that_request_chunk);
 
+#ifdef CONFIG_BLK_COMPLETE_REMOTE
+/* Runs on a cpu requests were queued to, from the IPI */
+static void blk_done_ipi(void *info)
+{
+	raise_softirq_irqoff(BLOCK_SOFTIRQ);
+}
+
+/*
+ * The cpu a request of @q is to be completed on, when @cpu ended it
+ */
+static inline int blk_complete_cpu(request_queue_t *q, struct request *req,
+				   int cpu)
+{
+	if (!test_bit(QUEUE_FLAG_SAME_COMP, &q->queue_flags) ||
+	    req->cpu < 0 || req->cpu == cpu || !cpu_online(req->cpu))
+		return cpu;
+	/* the submitter's cache is as good but for the forced case */
+	if (!test_bit(QUEUE_FLAG_SAME_FORCE, &q->queue_flags) &&
+	    cpu_isset(cpu, topology_core_siblings(req->cpu)))
+		return cpu;
+	return req->cpu;
+}
+#else
+static inline int blk_complete_cpu(request_queue_t *q, struct request *req,
+				   int cpu)
+{
+	return cpu;
+}
+#endif
+
 /*
  * splice the completion data to a local structure and hand off to
  * process_completion_queue() to complete the requests
  */
 static void blk_done_softirq(struct softirq_action *h)
 {
-	struct list_head *cpu_list, local_list;
+	struct blk_cpu_done *done;
+	struct list_head local_list;
+#ifdef CONFIG_BLK_COMPLETE_REMOTE
+	cpumask_t mask;
+	int cpu;
+#endif
 
 	local_irq_disable();
-	cpu_list = &__get_cpu_var(blk_cpu_done);
-	list_replace_init(cpu_list, &local_list);
+	done = &__get_cpu_var(blk_cpu_done);
+#ifdef CONFIG_BLK_COMPLETE_REMOTE
+	mask = done->ipi_mask;
+	cpus_clear(done->ipi_mask);
+#endif
+	spin_lock(&done->lock);
+	list_replace_init(&done->list, &local_list);
+	spin_unlock(&done->lock);
 	local_irq_enable();
 
+#ifdef CONFIG_BLK_COMPLETE_REMOTE
+	for_each_cpu_mask(cpu, mask)
+		if (cpu_online(cpu))
+			smp_call_function_single(cpu, blk_done_ipi, NULL, 0, 0);
+#endif
+
 	while (!list_empty(&local_list)) {
 		struct request *rq = list_entry(local_list.next, struct request, donelist);
 
@@ -3389,11 +3706,25 @@ static int blk_cpu_notify(struct notifier_block *self, unsigned long action,
 	 * and trigger a run of the softirq
 	 */
 	if (action == CPU_DEAD) {
-		int cpu = (unsigned long) hcpu;
+		struct blk_cpu_done *dead, *done;
+		LIST_HEAD(list);
+
+		dead = &per_cpu(blk_cpu_done, (unsigned long) hcpu);
 
 		local_irq_disable();
-		list_splice_init(&per_cpu(blk_cpu_done, cpu),
-				 &__get_cpu_var(blk_cpu_done));
+		spin_lock(&dead->lock);
+		list_splice_init(&dead->list, &list);
+		spin_unlock(&dead->lock);
+
+		done = &__get_cpu_var(blk_cpu_done);
+		spin_lock(&done->lock);
+		list_splice_init(&list, done->list.prev);
+		spin_unlock(&done->lock);
+#ifdef CONFIG_BLK_COMPLETE_REMOTE
+		cpus_or(done->ipi_mask, done->ipi_mask, dead->ipi_mask);
+		cpus_clear(dead->ipi_mask);
+		cpu_clear(smp_processor_id(), done->ipi_mask);
+#endif
 		raise_softirq_irqoff(BLOCK_SOFTIRQ);
 		local_irq_enable();
 	}
@@ -3418,20 +3749,45 @@ static struct notifier_block __devinitdata blk_cpu_notifier = {
  *     through requeueing. Theh actual completion happens out-of-order,
  *     through a softirq handler. The user must have registered a completion
  *     callback through blk_queue_softirq_done().
+ *
+ *     The softirq runs on the cpu which took the interrupt, or with
+ *     QUEUE_FLAG_SAME_COMP (rq_affinity in sysfs) on the cpu which
+ *     submitted the request, unless the two share a package.
  **/
 
 void blk_complete_request(struct request *req)
 {
-	struct list_head *cpu_list;
+	struct blk_cpu_done *done;
 	unsigned long flags;
+	int cpu, ccpu;
+#ifdef CONFIG_BLK_COMPLETE_REMOTE
+	int kick;
+#endif
 
 	BUG_ON(!req->q->softirq_done_fn);
 		
 	local_irq_save(flags);
 
-	cpu_list = &__get_cpu_var(blk_cpu_done);
-	list_add_tail(&req->donelist, cpu_list);
-	raise_softirq_irqoff(BLOCK_SOFTIRQ);
+	cpu = smp_processor_id();
+	ccpu = blk_complete_cpu(req->q, req, cpu);
+
+	done = &per_cpu(blk_cpu_done, ccpu);
+	spin_lock(&done->lock);
+#ifdef CONFIG_BLK_COMPLETE_REMOTE
+	kick = list_empty(&done->list);
+#endif
+	list_add_tail(&req->donelist, &done->list);
+	spin_unlock(&done->lock);
+
+	if (ccpu == cpu)
+		raise_softirq_irqoff(BLOCK_SOFTIRQ);
+#ifdef CONFIG_BLK_COMPLETE_REMOTE
+	else if (kick) {
+		/* else the cpu was kicked already */
+		cpu_set(ccpu, __get_cpu_var(blk_cpu_done).ipi_mask);
+		raise_softirq_irqoff(BLOCK_SOFTIRQ);
+	}
+#endif
 
 	local_irq_restore(flags);
 }
@@ -3469,6 +3825,7 @@ void end_that_request_last(struct request *req, int uptodate)
 		__disk_stat_add(disk, ticks[rw], duration);
 		disk_round_stats(disk);
 		disk->in_flight--;
+		blk_lat_done(req);
 	}
 	if (req->end_io)
 		req->end_io(req, error);
@@ -3536,8 +3893,10 @@ int __init blk_dev_init(void)
 	iocontext_cachep = kmem_cache_create("blkdev_ioc",
 			sizeof(struct io_context), 0, SLAB_PANIC, NULL, NULL);
 
-	for_each_possible_cpu(i)
-		INIT_LIST_HEAD(&per_cpu(blk_cpu_done, i));
+	for_each_possible_cpu(i) {
+		spin_lock_init(&per_cpu(blk_cpu_done, i).lock);
+		INIT_LIST_HEAD(&per_cpu(blk_cpu_done, i).list);
+	}
 
 	open_softirq(BLOCK_SOFTIRQ, blk_done_softirq, NULL);
 	register_hotcpu_notifier(&blk_cpu_notifier);
@@ -3813,6 +4172,120 @@ static ssize_t queue_max_hw_sectors_show(struct request_queue *q, char *page)
 }
 
 
+static ssize_t queue_taskplug_show(struct request_queue *q, char *page)
+{
+	return queue_var_show(blk_queue_taskplug(q), page);
+}
+
+static ssize_t
+queue_taskplug_store(struct request_queue *q, const char *page, size_t count)
+{
+	unsigned long taskplug;
+	ssize_t ret = queue_var_store(&taskplug, page, count);
+
+	spin_lock_irq(q->queue_lock);
+	if (taskplug) {
+		set_bit(QUEUE_FLAG_TASKPLUG, &q->queue_flags);
+		/* nothing is to wait for the timer any more */
+		blk_dispatch_queue(q);
+	} else
+		clear_bit(QUEUE_FLAG_TASKPLUG, &q->queue_flags);
+	spin_unlock_irq(q->queue_lock);
+
+	return ret;
+}
+
+static ssize_t queue_bounced_kb_show(struct request_queue *q, char *page)
+{
+	unsigned long sectors = atomic_long_read(&q->bounced_sectors);
+
+	return sprintf(page, "%lu\n", sectors >> 1);
+}
+
+static ssize_t queue_rotational_show(struct request_queue *q, char *page)
+{
+	return queue_var_show(!blk_queue_nonrot(q), page);
+}
+
+static ssize_t
+queue_rotational_store(struct request_queue *q, const char *page, size_t count)
+{
+	unsigned long rot;
+	ssize_t ret = queue_var_store(&rot, page, count);
+
+	spin_lock_irq(q->queue_lock);
+	if (rot)
+		clear_bit(QUEUE_FLAG_NONROT, &q->queue_flags);
+	else
+		set_bit(QUEUE_FLAG_NONROT, &q->queue_flags);
+	spin_unlock_irq(q->queue_lock);
+
+	return ret;
+}
+
+static ssize_t queue_rq_affinity_show(struct request_queue *q, char *page)
+{
+	int set = test_bit(QUEUE_FLAG_SAME_COMP, &q->queue_flags);
+	int force = test_bit(QUEUE_FLAG_SAME_FORCE, &q->queue_flags);
+
+	return queue_var_show(set << force, page);
+}
+
+/*
+ * 0 completes the requests on the cpu which took the interrupt, 1 on a cpu
+ * of the submitter's package, 2 on the very cpu which submitted them.
+ */
+static ssize_t
+queue_rq_affinity_store(struct request_queue *q, const char *page, size_t count)
+{
+	unsigned long val;
+	ssize_t ret = queue_var_store(&val, page, count);
+
+	if (val > 2)
+		return -EINVAL;
+
+	spin_lock_irq(q->queue_lock);
+	if (val) {
+		set_bit(QUEUE_FLAG_SAME_COMP, &q->queue_flags);
+		if (val == 2)
+			set_bit(QUEUE_FLAG_SAME_FORCE, &q->queue_flags);
+		else
+			clear_bit(QUEUE_FLAG_SAME_FORCE, &q->queue_flags);
+	} else {
+		clear_bit(QUEUE_FLAG_SAME_COMP, &q->queue_flags);
+		clear_bit(QUEUE_FLAG_SAME_FORCE, &q->queue_flags);
+	}
+	spin_unlock_irq(q->queue_lock);
+
+	return ret;
+}
+
+#ifdef CONFIG_BLK_LAT_HIST
+static ssize_t queue_lat_queue_show(struct request_queue *q, char *page)
+{
+	return blk_lat_show(q, BLK_LAT_QUEUE, page);
+}
+
+static ssize_t queue_lat_device_show(struct request_queue *q, char *page)
+{
+	return blk_lat_show(q, BLK_LAT_DEVICE, page);
+}
+
+static ssize_t
+queue_lat_queue_store(struct request_queue *q, const char *page, size_t count)
+{
+	blk_lat_reset(q, BLK_LAT_QUEUE);
+	return count;
+}
+
+static ssize_t
+queue_lat_device_store(struct request_queue *q, const char *page, size_t count)
+{
+	blk_lat_reset(q, BLK_LAT_DEVICE);
+	return count;
+}
+#endif
+
 static struct queue_sysfs_entry queue_requests_entry = {
 	.attr = {.name = "nr_requests", .mode = S_IRUGO | S_IWUSR },
 	.show = queue_requests_show,
@@ -3836,6 +4309,43 @@ static struct queue_sysfs_entry queue_max_hw_sectors_entry = {
 	.show = queue_max_hw_sectors_show,
 };
 
+static struct queue_sysfs_entry queue_bounced_kb_entry = {
+	.attr = {.name = "bounced_kb", .mode = S_IRUGO },
+	.show = queue_bounced_kb_show,
+};
+
+static struct queue_sysfs_entry queue_taskplug_entry = {
+	.attr = {.name = "task_plug", .mode = S_IRUGO | S_IWUSR },
+	.show = queue_taskplug_show,
+	.store = queue_taskplug_store,
+};
+
+static struct queue_sysfs_entry queue_rotational_entry = {
+	.attr = {.name = "rotational", .mode = S_IRUGO | S_IWUSR },
+	.show = queue_rotational_show,
+	.store = queue_rotational_store,
+};
+
+static struct queue_sysfs_entry queue_rq_affinity_entry = {
+	.attr = {.name = "rq_affinity", .mode = S_IRUGO | S_IWUSR },
+	.show = queue_rq_affinity_show,
+	.store = queue_rq_affinity_store,
+};
+
+#ifdef CONFIG_BLK_LAT_HIST
+static struct queue_sysfs_entry queue_lat_queue_entry = {
+	.attr = {.name = "latency_queue", .mode = S_IRUGO | S_IWUSR },
+	.show = queue_lat_queue_show,
+	.store = queue_lat_queue_store,
+};
+
+static struct queue_sysfs_entry queue_lat_device_entry = {
+	.attr = {.name = "latency_device", .mode = S_IRUGO | S_IWUSR },
+	.show = queue_lat_device_show,
+	.store = queue_lat_device_store,
+};
+#endif
+
 static struct queue_sysfs_entry queue_iosched_entry = {
 	.attr = {.name = "scheduler", .mode = S_IRUGO | S_IWUSR },
 	.show = elv_iosched_show,
@@ -3847,6 +4357,14 @@ static struct attribute *default_attrs[] = {
 	&queue_ra_entry.attr,
 	&queue_max_hw_sectors_entry.attr,
 	&queue_max_sectors_entry.attr,
+	&queue_bounced_kb_entry.attr,
+	&queue_taskplug_entry.attr,
+	&queue_rq_affinity_entry.attr,
+	&queue_rotational_entry.attr,
+#ifdef CONFIG_BLK_LAT_HIST
+	&queue_lat_queue_entry.attr,
+	&queue_lat_device_entry.attr,
+#endif
 	&queue_iosched_entry.attr,
 	NULL,
 };
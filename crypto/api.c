@@ -39,7 +39,7 @@ static inline void crypto_alg_put(struct crypto_alg *alg)
 	module_put(alg->cra_module);
 }
 
-static struct crypto_alg *crypto_alg_lookup(const char *name)
+static struct crypto_alg *crypto_alg_lookup(const char *name, u32 flags)
 {
 	struct crypto_alg *q, *alg = NULL;
 	int best = -1;
@@ -52,6 +52,10 @@ static struct crypto_alg *crypto_alg_lookup(const char *name)
 	list_for_each_entry(q, &crypto_alg_list, cra_list) {
 		int exact, fuzzy;
 
+		if ((q->cra_flags & CRYPTO_ALG_ASYNC) &&
+		    !(flags & CRYPTO_TFM_REQ_ASYNC))
+			continue;
+
 		exact = !strcmp(q->cra_driver_name, name);
 		fuzzy = !strcmp(q->cra_name, name);
 		if (!exact && !(fuzzy && q->cra_priority > best))
@@ -75,9 +79,10 @@ static struct crypto_alg *crypto_alg_lookup(const char *name)
 
 /* A far more intelligent version of this is planned.  For now, just
  * try an exact match on the name of the algorithm. */
-static inline struct crypto_alg *crypto_alg_mod_lookup(const char *name)
+static inline struct crypto_alg *crypto_alg_mod_lookup(const char *name,
+							u32 flags)
 {
-	return try_then_request_module(crypto_alg_lookup(name), name);
+	return try_then_request_module(crypto_alg_lookup(name, flags), name);
 }
 
 static int crypto_init_flags(struct crypto_tfm *tfm, u32 flags)
@@ -174,7 +179,7 @@ struct crypto_tfm *crypto_alloc_tfm(const char *name, u32 flags)
 	struct crypto_alg *alg;
 	unsigned int tfm_size;
 
-	alg = crypto_alg_mod_lookup(name);
+	alg = crypto_alg_mod_lookup(name, flags);
 	if (alg == NULL)
 		goto out;
 
@@ -187,6 +192,13 @@ struct crypto_tfm *crypto_alloc_tfm(const char *name, u32 flags)
 	
 	if (crypto_init_flags(tfm, flags))
 		goto out_free_tfm;
+
+	if (alg->cra_flags & CRYPTO_ALG_ASYNC) {
+		tfm->crt_fallback = crypto_alloc_tfm(alg->cra_name,
+						     flags & ~CRYPTO_TFM_REQ_ASYNC);
+		if (tfm->crt_fallback == NULL)
+			goto out_free_tfm;
+	}
 		
 	if (crypto_init_ops(tfm))
 		goto out_free_tfm;
@@ -199,6 +211,7 @@ struct crypto_tfm *crypto_alloc_tfm(const char *name, u32 flags)
 cra_init_failed:
 	crypto_exit_ops(tfm);
 out_free_tfm:
+	crypto_free_tfm(tfm->crt_fallback);
 	kfree(tfm);
 	tfm = NULL;
 out_put:
@@ -221,6 +234,7 @@ void crypto_free_tfm(struct crypto_tfm *tfm)
 	if (alg->cra_exit)
 		alg->cra_exit(tfm);
 	crypto_exit_ops(tfm);
+	crypto_free_tfm(tfm->crt_fallback);
 	crypto_alg_put(alg);
 	memset(tfm, 0, size);
 	kfree(tfm);
@@ -243,6 +257,22 @@ static inline int crypto_set_driver_name(struct crypto_alg *alg)
 	return 0;
 }
 
+static int crypto_check_async(struct crypto_alg *alg)
+{
+	if (!(alg->cra_flags & CRYPTO_ALG_ASYNC))
+		return 0;
+
+	switch (alg->cra_flags & CRYPTO_ALG_TYPE_MASK) {
+	case CRYPTO_ALG_TYPE_CIPHER:
+		return alg->cra_cipher.cia_crypt_async ? 0 : -EINVAL;
+
+	case CRYPTO_ALG_TYPE_DIGEST:
+		return alg->cra_digest.dia_digest_async ? 0 : -EINVAL;
+	}
+
+	return -EINVAL;
+}
+
 int crypto_register_alg(struct crypto_alg *alg)
 {
 	int ret;
@@ -259,6 +289,9 @@ int crypto_register_alg(struct crypto_alg *alg)
 
 	if (alg->cra_priority < 0)
 		return -EINVAL;
+
+	if (crypto_check_async(alg))
+		return -EINVAL;
 	
 	ret = crypto_set_driver_name(alg);
 	if (unlikely(ret))
@@ -302,7 +335,7 @@ out:
 int crypto_alg_available(const char *name, u32 flags)
 {
 	int ret = 0;
-	struct crypto_alg *alg = crypto_alg_mod_lookup(name);
+	struct crypto_alg *alg = crypto_alg_mod_lookup(name, flags);
 	
 	if (alg) {
 		crypto_alg_put(alg);
@@ -312,6 +345,37 @@ int crypto_alg_available(const char *name, u32 flags)
 	return ret;
 }
 
+void crypto_init_queue(struct crypto_queue *queue, unsigned int max_qlen)
+{
+	INIT_LIST_HEAD(&queue->list);
+	queue->qlen = 0;
+	queue->max_qlen = max_qlen;
+}
+
+int crypto_enqueue_request(struct crypto_queue *queue,
+			   struct crypto_async_request *req)
+{
+	if (unlikely(queue->qlen >= queue->max_qlen))
+		return -EBUSY;
+
+	queue->qlen++;
+	list_add_tail(&req->list, &queue->list);
+	return -EINPROGRESS;
+}
+
+struct crypto_async_request *crypto_dequeue_request(struct crypto_queue *queue)
+{
+	struct crypto_async_request *req;
+
+	if (unlikely(!queue->qlen))
+		return NULL;
+
+	queue->qlen--;
+	req = list_entry(queue->list.next, struct crypto_async_request, list);
+	list_del(&req->list);
+	return req;
+}
+
 static int __init init_crypto(void)
 {
 	printk(KERN_INFO "Initializing Cryptographic API\n");
@@ -326,3 +390,6 @@ EXPORT_SYMBOL_GPL(crypto_unregister_alg);
 EXPORT_SYMBOL_GPL(crypto_alloc_tfm);
 EXPORT_SYMBOL_GPL(crypto_free_tfm);
 EXPORT_SYMBOL_GPL(crypto_alg_available);
+EXPORT_SYMBOL_GPL(crypto_init_queue);
+EXPORT_SYMBOL_GPL(crypto_enqueue_request);
+EXPORT_SYMBOL_GPL(crypto_dequeue_request);
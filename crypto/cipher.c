@@ -240,6 +240,46 @@ static unsigned int cbc_process_decrypt(const struct cipher_desc *desc,
 	return done;
 }
 
+/* The counter is the IV, a big endian number the size of a block */
+static inline void ctr_inc(u8 *ctr, unsigned int size)
+{
+	while (size--)
+		if (++ctr[size])
+			break;
+}
+
+static unsigned int ctr_process(const struct cipher_desc *desc,
+				u8 *dst, const u8 *src,
+				unsigned int nbytes)
+{
+	struct crypto_tfm *tfm = desc->tfm;
+	void (*xor)(u8 *, const u8 *) = tfm->crt_u.cipher.cit_xor_block;
+	int bsize = crypto_tfm_alg_blocksize(tfm);
+	unsigned long alignmask = crypto_tfm_alg_alignmask(desc->tfm);
+
+	u8 stack[bsize + alignmask];
+	u8 *ks = (u8 *)ALIGN((unsigned long)stack, alignmask + 1);
+
+	void (*fn)(struct crypto_tfm *, u8 *, const u8 *) = desc->crfn;
+	u8 *ctr = desc->info;
+	unsigned int done = 0;
+
+	nbytes -= bsize;
+
+	do {
+		fn(tfm, ks, ctr);
+		ctr_inc(ctr, bsize);
+		if (dst != src)
+			memcpy(dst, src, bsize);
+		xor(dst, ks);
+
+		src += bsize;
+		dst += bsize;
+	} while ((done += bsize) <= nbytes);
+
+	return done;
+}
+
 static unsigned int ecb_process(const struct cipher_desc *desc, u8 *dst,
 				const u8 *src, unsigned int nbytes)
 {
@@ -365,6 +405,39 @@ static int cbc_decrypt_iv(struct crypto_tfm *tfm,
 	return crypt_iv_unaligned(&desc, dst, src, nbytes);
 }
 
+/* Counter mode is the same both ways, always with the forward cipher */
+static int ctr_crypt(struct crypto_tfm *tfm,
+		     struct scatterlist *dst,
+		     struct scatterlist *src,
+		     unsigned int nbytes)
+{
+	struct cipher_desc desc;
+	struct cipher_alg *cipher = &tfm->__crt_alg->cra_cipher;
+
+	desc.tfm = tfm;
+	desc.crfn = cipher->cia_encrypt;
+	desc.prfn = cipher->cia_crypt_ctr ?: ctr_process;
+	desc.info = tfm->crt_cipher.cit_iv;
+
+	return crypt(&desc, dst, src, nbytes);
+}
+
+static int ctr_crypt_iv(struct crypto_tfm *tfm,
+			struct scatterlist *dst,
+			struct scatterlist *src,
+			unsigned int nbytes, u8 *iv)
+{
+	struct cipher_desc desc;
+	struct cipher_alg *cipher = &tfm->__crt_alg->cra_cipher;
+
+	desc.tfm = tfm;
+	desc.crfn = cipher->cia_encrypt;
+	desc.prfn = cipher->cia_crypt_ctr ?: ctr_process;
+	desc.info = iv;
+
+	return crypt_iv_unaligned(&desc, dst, src, nbytes);
+}
+
 static int nocrypt(struct crypto_tfm *tfm,
                    struct scatterlist *dst,
                    struct scatterlist *src,
@@ -381,6 +454,113 @@ static int nocrypt_iv(struct crypto_tfm *tfm,
 	return -ENOSYS;
 }
 
+/*
+ * An async tfm keeps its key in the engine and in the fallback, which
+ * does the synchronous calls.
+ */
+static int async_setkey(struct crypto_tfm *tfm, const u8 *key,
+			unsigned int keylen)
+{
+	struct crypto_tfm *fallback = tfm->crt_fallback;
+	int ret;
+
+	fallback->crt_flags &= ~CRYPTO_TFM_REQ_MASK;
+	fallback->crt_flags |= tfm->crt_flags & CRYPTO_TFM_REQ_MASK;
+	ret = crypto_cipher_setkey(fallback, key, keylen);
+	tfm->crt_flags |= fallback->crt_flags & CRYPTO_TFM_RES_MASK;
+	if (ret)
+		return ret;
+	return setkey(tfm, key, keylen);
+}
+
+static int async_encrypt(struct crypto_tfm *tfm,
+			 struct scatterlist *dst,
+			 struct scatterlist *src,
+			 unsigned int nbytes)
+{
+	return crypto_cipher_encrypt(tfm->crt_fallback, dst, src, nbytes);
+}
+
+static int async_encrypt_iv(struct crypto_tfm *tfm,
+			    struct scatterlist *dst,
+			    struct scatterlist *src,
+			    unsigned int nbytes, u8 *iv)
+{
+	return crypto_cipher_encrypt_iv(tfm->crt_fallback, dst, src, nbytes, iv);
+}
+
+static int async_decrypt(struct crypto_tfm *tfm,
+			 struct scatterlist *dst,
+			 struct scatterlist *src,
+			 unsigned int nbytes)
+{
+	return crypto_cipher_decrypt(tfm->crt_fallback, dst, src, nbytes);
+}
+
+static int async_decrypt_iv(struct crypto_tfm *tfm,
+			    struct scatterlist *dst,
+			    struct scatterlist *src,
+			    unsigned int nbytes, u8 *iv)
+{
+	return crypto_cipher_decrypt_iv(tfm->crt_fallback, dst, src, nbytes, iv);
+}
+
+static void init_async_ops(struct crypto_tfm *tfm)
+{
+	struct cipher_tfm *ops = &tfm->crt_cipher;
+	struct cipher_tfm *fops = &tfm->crt_fallback->crt_cipher;
+
+	ops->cit_setkey = async_setkey;
+	ops->cit_encrypt = async_encrypt;
+	ops->cit_decrypt = async_decrypt;
+	ops->cit_encrypt_iv = async_encrypt_iv;
+	ops->cit_decrypt_iv = async_decrypt_iv;
+	ops->cit_xor_block = fops->cit_xor_block;
+	ops->cit_iv = fops->cit_iv;
+	ops->cit_ivsize = fops->cit_ivsize;
+}
+
+static int crypt_async(struct cipher_request *req, int dir)
+{
+	struct crypto_tfm *tfm = req->base.tfm;
+	int ret;
+
+	BUG_ON(crypto_tfm_alg_type(tfm) != CRYPTO_ALG_TYPE_CIPHER);
+	req->dir = dir;
+
+	if (crypto_tfm_alg_async(tfm)) {
+		ret = tfm->__crt_alg->cra_cipher.cia_crypt_async(req);
+		if (ret != -EBUSY)
+			return ret;
+		tfm = tfm->crt_fallback;
+	}
+
+	if (tfm->crt_cipher.cit_mode == CRYPTO_TFM_MODE_ECB)
+		return dir == CRYPTO_DIR_ENCRYPT ?
+		       crypto_cipher_encrypt(tfm, req->dst, req->src,
+					     req->nbytes) :
+		       crypto_cipher_decrypt(tfm, req->dst, req->src,
+					     req->nbytes);
+
+	return dir == CRYPTO_DIR_ENCRYPT ?
+	       crypto_cipher_encrypt_iv(tfm, req->dst, req->src,
+					req->nbytes, req->iv) :
+	       crypto_cipher_decrypt_iv(tfm, req->dst, req->src,
+					req->nbytes, req->iv);
+}
+
+int crypto_cipher_encrypt_async(struct cipher_request *req)
+{
+	return crypt_async(req, CRYPTO_DIR_ENCRYPT);
+}
+EXPORT_SYMBOL_GPL(crypto_cipher_encrypt_async);
+
+int crypto_cipher_decrypt_async(struct cipher_request *req)
+{
+	return crypt_async(req, CRYPTO_DIR_DECRYPT);
+}
+EXPORT_SYMBOL_GPL(crypto_cipher_decrypt_async);
+
 int crypto_init_cipher_flags(struct crypto_tfm *tfm, u32 flags)
 {
 	u32 mode = flags & CRYPTO_TFM_MODE_MASK;
@@ -393,6 +573,11 @@ int crypto_init_cipher_ops(struct crypto_tfm *tfm)
 	int ret = 0;
 	struct cipher_tfm *ops = &tfm->crt_cipher;
 
+	if (crypto_tfm_alg_async(tfm)) {
+		init_async_ops(tfm);
+		goto out;
+	}
+
 	ops->cit_setkey = setkey;
 
 	switch (tfm->crt_cipher.cit_mode) {
@@ -416,17 +601,18 @@ int crypto_init_cipher_ops(struct crypto_tfm *tfm)
 		break;
 	
 	case CRYPTO_TFM_MODE_CTR:
-		ops->cit_encrypt = nocrypt;
-		ops->cit_decrypt = nocrypt;
-		ops->cit_encrypt_iv = nocrypt_iv;
-		ops->cit_decrypt_iv = nocrypt_iv;
+		ops->cit_encrypt = ctr_crypt;
+		ops->cit_decrypt = ctr_crypt;
+		ops->cit_encrypt_iv = ctr_crypt_iv;
+		ops->cit_decrypt_iv = ctr_crypt_iv;
 		break;
 
 	default:
 		BUG();
 	}
 	
-	if (ops->cit_mode == CRYPTO_TFM_MODE_CBC) {
+	if (ops->cit_mode == CRYPTO_TFM_MODE_CBC ||
+	    ops->cit_mode == CRYPTO_TFM_MODE_CTR) {
 		unsigned long align;
 		unsigned long addr;
 	    	
@@ -92,6 +92,58 @@ static void digest(struct crypto_tfm *tfm,
 	final(tfm, out);
 }
 
+/* An async tfm does the synchronous calls with its fallback */
+static void async_init(struct crypto_tfm *tfm)
+{
+	crypto_digest_init(tfm->crt_fallback);
+}
+
+static void async_update(struct crypto_tfm *tfm,
+			 struct scatterlist *sg, unsigned int nsg)
+{
+	crypto_digest_update(tfm->crt_fallback, sg, nsg);
+}
+
+static void async_final(struct crypto_tfm *tfm, u8 *out)
+{
+	crypto_digest_final(tfm->crt_fallback, out);
+}
+
+static void async_digest(struct crypto_tfm *tfm,
+			 struct scatterlist *sg, unsigned int nsg, u8 *out)
+{
+	crypto_digest_digest(tfm->crt_fallback, sg, nsg, out);
+}
+
+static int async_setkey(struct crypto_tfm *tfm, const u8 *key,
+			unsigned int keylen)
+{
+	int ret;
+
+	ret = crypto_digest_setkey(tfm->crt_fallback, key, keylen);
+	if (ret || tfm->__crt_alg->cra_digest.dia_setkey == NULL)
+		return ret;
+	return setkey(tfm, key, keylen);
+}
+
+int crypto_digest_async(struct digest_request *req)
+{
+	struct crypto_tfm *tfm = req->base.tfm;
+
+	BUG_ON(crypto_tfm_alg_type(tfm) != CRYPTO_ALG_TYPE_DIGEST);
+
+	if (crypto_tfm_alg_async(tfm)) {
+		int ret = tfm->__crt_alg->cra_digest.dia_digest_async(req);
+		if (ret != -EBUSY)
+			return ret;
+		tfm = tfm->crt_fallback;
+	}
+
+	crypto_digest_digest(tfm, req->sg, req->nsg, req->out);
+	return 0;
+}
+EXPORT_SYMBOL_GPL(crypto_digest_async);
+
 int crypto_init_digest_flags(struct crypto_tfm *tfm, u32 flags)
 {
 	return flags ? -EINVAL : 0;
@@ -100,6 +152,15 @@ int crypto_init_digest_flags(struct crypto_tfm *tfm, u32 flags)
 int crypto_init_digest_ops(struct crypto_tfm *tfm)
 {
 	struct digest_tfm *ops = &tfm->crt_digest;
+
+	if (crypto_tfm_alg_async(tfm)) {
+		ops->dit_init	= async_init;
+		ops->dit_update	= async_update;
+		ops->dit_final	= async_final;
+		ops->dit_digest	= async_digest;
+		ops->dit_setkey	= async_setkey;
+		return crypto_alloc_hmac_block(tfm);
+	}
 	
 	ops->dit_init	= init;
 	ops->dit_update	= update;
@@ -56,6 +56,31 @@
 #define DECRYPT 0
 #define MODE_ECB 1
 #define MODE_CBC 0
+#define MODE_CTR 2
+
+static const char *cipher_mode_name(int mode)
+{
+	switch (mode) {
+	case MODE_ECB:
+		return "ECB";
+	case MODE_CTR:
+		return "CTR";
+	default:
+		return "CBC";
+	}
+}
+
+static u32 cipher_mode_flags(int mode)
+{
+	switch (mode) {
+	case MODE_ECB:
+		return 0;
+	case MODE_CTR:
+		return CRYPTO_TFM_MODE_CTR;
+	default:
+		return CRYPTO_TFM_MODE_CBC;
+	}
+}
 
 static unsigned int IDX[8] = { IDX1, IDX2, IDX3, IDX4, IDX5, IDX6, IDX7, IDX8 };
 
@@ -269,10 +294,7 @@ static void test_cipher(char *algo, int mode, int enc,
 	        e = "encryption";
 	else
 		e = "decryption";
-	if (mode == MODE_ECB)
-		m = "ECB";
-	else
-		m = "CBC";
+	m = cipher_mode_name(mode);
 
 	printk("\ntesting %s %s %s\n", algo, m, e);
 
@@ -288,10 +310,7 @@ static void test_cipher(char *algo, int mode, int enc,
 	memcpy(tvmem, template, tsize);
 	cipher_tv = (void *)tvmem;
 
-	if (mode)
-		tfm = crypto_alloc_tfm(algo, 0);
-	else
-		tfm = crypto_alloc_tfm(algo, CRYPTO_TFM_MODE_CBC);
+	tfm = crypto_alloc_tfm(algo, cipher_mode_flags(mode));
 
 	if (tfm == NULL) {
 		printk("failed to load transform for %s %s\n", algo, m);
@@ -321,7 +340,7 @@ static void test_cipher(char *algo, int mode, int enc,
 			sg_set_buf(&sg[0], cipher_tv[i].input,
 				   cipher_tv[i].ilen);
 
-			if (!mode) {
+			if (mode != MODE_ECB) {
 				crypto_cipher_set_iv(tfm, cipher_tv[i].iv,
 					crypto_tfm_alg_ivsize(tfm));
 			}
@@ -379,7 +398,7 @@ static void test_cipher(char *algo, int mode, int enc,
 					   cipher_tv[i].tap[k]);
 			}
 
-			if (!mode) {
+			if (mode != MODE_ECB) {
 				crypto_cipher_set_iv(tfm, cipher_tv[i].iv,
 						crypto_tfm_alg_ivsize(tfm));
 			}
@@ -484,8 +503,10 @@ out:
 	local_bh_enable();
 
 	if (ret == 0)
-		printk("1 operation in %lu cycles (%d bytes)\n",
-		       (cycles + 4) / 8, blen);
+		printk("1 operation in %lu cycles (%d bytes), "
+		       "%lu.%02lu cycles/byte\n",
+		       (cycles + 4) / 8, blen, cycles / (8 * blen),
+		       (cycles * 100 / (8 * blen)) % 100);
 
 	return ret;
 }
@@ -503,17 +524,11 @@ static void test_cipher_speed(char *algo, int mode, int enc, unsigned int sec,
 	        e = "encryption";
 	else
 		e = "decryption";
-	if (mode == MODE_ECB)
-		m = "ECB";
-	else
-		m = "CBC";
+	m = cipher_mode_name(mode);
 
 	printk("\ntesting speed of %s %s %s\n", algo, m, e);
 
-	if (mode)
-		tfm = crypto_alloc_tfm(algo, 0);
-	else
-		tfm = crypto_alloc_tfm(algo, CRYPTO_TFM_MODE_CBC);
+	tfm = crypto_alloc_tfm(algo, cipher_mode_flags(mode));
 
 	if (tfm == NULL) {
 		printk("failed to load transform for %s %s\n", algo, m);
@@ -548,7 +563,7 @@ static void test_cipher_speed(char *algo, int mode, int enc, unsigned int sec,
 			goto out;
 		}
 
-		if (!mode) {
+		if (mode != MODE_ECB) {
 			iv_len = crypto_tfm_alg_ivsize(tfm);
 			memset(&iv, 0xff, iv_len);
 			crypto_cipher_set_iv(tfm, iv, iv_len);
@@ -570,6 +585,20 @@ out:
 	crypto_free_tfm(tfm);
 }
 
+static void test_aes_speed(char *algo)
+{
+	test_cipher_speed(algo, MODE_ECB, ENCRYPT, sec, NULL, 0,
+			  aes_speed_template);
+	test_cipher_speed(algo, MODE_ECB, DECRYPT, sec, NULL, 0,
+			  aes_speed_template);
+	test_cipher_speed(algo, MODE_CBC, ENCRYPT, sec, NULL, 0,
+			  aes_speed_template);
+	test_cipher_speed(algo, MODE_CBC, DECRYPT, sec, NULL, 0,
+			  aes_speed_template);
+	test_cipher_speed(algo, MODE_CTR, ENCRYPT, sec, NULL, 0,
+			  aes_speed_template);
+}
+
 static void test_digest_jiffies(struct crypto_tfm *tfm, char *p, int blen,
 				int plen, char *out, int sec)
 {
@@ -923,6 +952,8 @@ static void do_test(void)
 		test_cipher ("aes", MODE_ECB, DECRYPT, aes_dec_tv_template, AES_DEC_TEST_VECTORS);
 		test_cipher ("aes", MODE_CBC, ENCRYPT, aes_cbc_enc_tv_template, AES_CBC_ENC_TEST_VECTORS);
 		test_cipher ("aes", MODE_CBC, DECRYPT, aes_cbc_dec_tv_template, AES_CBC_DEC_TEST_VECTORS);
+		test_cipher ("aes", MODE_CTR, ENCRYPT, aes_ctr_enc_tv_template, AES_CTR_ENC_TEST_VECTORS);
+		test_cipher ("aes", MODE_CTR, DECRYPT, aes_ctr_dec_tv_template, AES_CTR_DEC_TEST_VECTORS);
 
 		//CAST5
 		test_cipher ("cast5", MODE_ECB, ENCRYPT, cast5_enc_tv_template, CAST5_ENC_TEST_VECTORS);
@@ -1030,6 +1061,8 @@ static void do_test(void)
 		test_cipher ("aes", MODE_ECB, DECRYPT, aes_dec_tv_template, AES_DEC_TEST_VECTORS);
 		test_cipher ("aes", MODE_CBC, ENCRYPT, aes_cbc_enc_tv_template, AES_CBC_ENC_TEST_VECTORS);
 		test_cipher ("aes", MODE_CBC, DECRYPT, aes_cbc_dec_tv_template, AES_CBC_DEC_TEST_VECTORS);
+		test_cipher ("aes", MODE_CTR, ENCRYPT, aes_ctr_enc_tv_template, AES_CTR_ENC_TEST_VECTORS);
+		test_cipher ("aes", MODE_CTR, DECRYPT, aes_ctr_dec_tv_template, AES_CTR_DEC_TEST_VECTORS);
 		break;
 
 	case 11:
@@ -1140,14 +1173,7 @@ static void do_test(void)
 #endif
 
 	case 200:
-		test_cipher_speed("aes", MODE_ECB, ENCRYPT, sec, NULL, 0,
-				  aes_speed_template);
-		test_cipher_speed("aes", MODE_ECB, DECRYPT, sec, NULL, 0,
-				  aes_speed_template);
-		test_cipher_speed("aes", MODE_CBC, ENCRYPT, sec, NULL, 0,
-				  aes_speed_template);
-		test_cipher_speed("aes", MODE_CBC, DECRYPT, sec, NULL, 0,
-				  aes_speed_template);
+		test_aes_speed("aes");
 		break;
 
 	case 201:
@@ -1202,6 +1228,13 @@ static void do_test(void)
 				  des_speed_template);
 		break;
 
+	case 205:
+		/* each implementation that may be built, by driver name */
+		test_aes_speed("aes-generic");
+		test_aes_speed("aes-i586");
+		test_aes_speed("aes-x86_64");
+		break;
+
 	case 300:
 		/* fall through */
 
@@ -1253,9 +1286,25 @@ static void do_test(void)
 		test_digest_speed("tgr192", sec, generic_digest_speed_template);
 		if (mode > 300 && mode < 400) break;
 
+	case 313:
+		test_digest_speed("crc32c", sec, generic_digest_speed_template);
+		if (mode > 300 && mode < 400) break;
+
 	case 399:
 		break;
 
+	case 314:
+		/* each implementation that may be built, by driver name */
+		test_digest_speed("sha1-generic", sec,
+				  generic_digest_speed_template);
+		test_digest_speed("sha1-ssse3", sec,
+				  generic_digest_speed_template);
+		test_digest_speed("sha256-generic", sec,
+				  generic_digest_speed_template);
+		test_digest_speed("sha256-ssse3", sec,
+				  generic_digest_speed_template);
+		break;
+
 	case 1000:
 		test_available();
 		break;
@@ -1370,7 +1370,7 @@ static void cciss_update_drive_info(int ctlr, int drv_index)
 
 		/* Set up queue information */
 		disk->queue->backing_dev_info.ra_pages = READ_AHEAD;
-		blk_queue_bounce_limit(disk->queue, hba[ctlr]->pdev->dma_mask);
+		blk_queue_bounce_dev(disk->queue, &hba[ctlr]->pdev->dev);
 
 		/* This is a hardware imposed limit. */
 		blk_queue_max_hw_segments(disk->queue, MAXSGENTRIES);
@@ -3240,7 +3240,7 @@ static int __devinit cciss_init_one(struct pci_dev *pdev,
 		drv->queue = q;
 
 		q->backing_dev_info.ra_pages = READ_AHEAD;
-		blk_queue_bounce_limit(q, hba[i]->pdev->dma_mask);
+		blk_queue_bounce_dev(q, &hba[i]->pdev->dev);
 
 		/* This is a hardware imposed limit. */
 		blk_queue_max_hw_segments(q, MAXSGENTRIES);
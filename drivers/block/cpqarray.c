@@ -450,7 +450,7 @@ static int __init cpqarray_register_ctlr( int i, struct pci_dev *pdev)
 	ida_procinit(i);
 
 	if (pdev)
-		blk_queue_bounce_limit(q, hba[i]->pci_dev->dma_mask);
+		blk_queue_bounce_dev(q, &hba[i]->pci_dev->dev);
 
 	/* This is a hardware imposed limit. */
 	blk_queue_max_hw_segments(q, SG_MAX);
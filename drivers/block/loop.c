@@ -44,6 +44,9 @@
  * backing filesystem.
  * Anton Altaparmakov, 16 Feb 2005
  *
+ * Direct I/O mode (LOOP_SET_DIRECT_IO), remapping the bios onto the device
+ * of the backing filesystem, without the page cache or the loop thread.
+ *
  * Still To Fix:
  * - Advisory locking is ignored here.
  * - Should use an own CAP_* category instead of CAP_SYS_ADMIN
@@ -72,6 +75,7 @@
 #include <linux/completion.h>
 #include <linux/highmem.h>
 #include <linux/gfp.h>
+#include <linux/vmalloc.h>
 
 #include <asm/uaccess.h>
 
@@ -507,6 +511,192 @@ static struct bio *loop_get_bio(struct loop_device *lo)
 	return bio;
 }
 
+/*
+ * Direct I/O.  The blocks of the backing file are mapped once, the way
+ * swapon does it, and the bios of the loop device are then remapped onto
+ * the device of the backing filesystem and submitted right away: many of
+ * them can be in flight, and the data isn't cached a second time in the
+ * page cache of the backing file.  All the blocks of the file must be
+ * allocated, as nothing is allocated on the way, and the file can't be
+ * truncated meanwhile: it is marked S_SWAPFILE.
+ */
+struct loop_dio {
+	struct loop_device	*lo;
+	struct bio		*bio;
+	atomic_t		remaining;	/* clones, and the submitter */
+	int			error;
+};
+
+/*
+ * Map the blocks of the backing file behind the loop device.  Returns the
+ * number of extents, counted only when @ext is NULL, or an error if the
+ * file has holes.
+ */
+static int loop_scan_extents(struct loop_device *lo, struct inode *inode,
+			     struct loop_extent *ext, int max)
+{
+	unsigned blkbits = inode->i_blkbits;
+	loff_t end = lo->lo_offset + ((loff_t)get_capacity(disks[lo->lo_number]) << 9);
+	sector_t block = lo->lo_offset >> blkbits;
+	sector_t last = (end + (1 << blkbits) - 1) >> blkbits;
+	sector_t next_disk = 0;
+	int nr = 0;
+
+	for (; block < last; block++) {
+		sector_t disk_block = bmap(inode, block);
+
+		if (!disk_block) {
+			printk(KERN_ERR "loop%d: backing file has holes, "
+			       "can't do direct I/O\n", lo->lo_number);
+			return -EINVAL;
+		}
+		if (nr && disk_block == next_disk) {
+			if (ext)
+				ext[nr - 1].nr_blocks++;
+		} else {
+			if (ext) {
+				if (nr == max)
+					return -EAGAIN;
+				ext[nr].file_block = block;
+				ext[nr].nr_blocks = 1;
+				ext[nr].disk_block = disk_block;
+			}
+			nr++;
+		}
+		next_disk = disk_block + 1;
+		cond_resched();
+	}
+	return nr;
+}
+
+static struct loop_extent *loop_find_extent(struct loop_device *lo,
+					    sector_t block)
+{
+	int lo_idx = 0, hi_idx = lo->lo_nr_extents;
+
+	while (lo_idx < hi_idx) {
+		int mid = (lo_idx + hi_idx) / 2;
+		struct loop_extent *ext = &lo->lo_extents[mid];
+
+		if (block < ext->file_block)
+			hi_idx = mid;
+		else if (block >= ext->file_block + ext->nr_blocks)
+			lo_idx = mid + 1;
+		else
+			return ext;
+	}
+	return NULL;
+}
+
+static void loop_dio_put(struct loop_dio *dio)
+{
+	struct loop_device *lo = dio->lo;
+
+	if (!atomic_dec_and_test(&dio->remaining))
+		return;
+
+	bio_endio(dio->bio, dio->bio->bi_size, dio->error);
+	kfree(dio);
+	if (atomic_dec_and_test(&lo->lo_direct_pending))
+		wake_up(&lo->lo_direct_wait);
+}
+
+static int loop_dio_end_io(struct bio *clone, unsigned int bytes_done,
+			   int error)
+{
+	struct loop_dio *dio = clone->bi_private;
+
+	if (clone->bi_size)
+		return 1;
+
+	if (error)
+		dio->error = error;
+	bio_put(clone);
+	loop_dio_put(dio);
+	return 0;
+}
+
+static void loop_dio_submit(struct loop_dio *dio, struct bio *clone)
+{
+	atomic_inc(&dio->remaining);
+	generic_make_request(clone);
+}
+
+/*
+ * Remap @bio onto the backing device, in as many clones as there are
+ * discontiguities in the backing file or limits of the backing queue.
+ */
+static void loop_direct_bio(struct loop_device *lo, struct bio *bio)
+{
+	unsigned blkbits = lo->lo_backing_file->f_mapping->host->i_blkbits;
+	loff_t pos = ((loff_t)bio->bi_sector << 9) + lo->lo_offset;
+	struct bio *clone = NULL;
+	struct bio_vec *bvec;
+	sector_t next_sector = 0;
+	struct loop_dio *dio;
+	int i;
+
+	dio = kmalloc(sizeof(*dio), GFP_NOIO);
+	if (!dio) {
+		bio_io_error(bio, bio->bi_size);
+		if (atomic_dec_and_test(&lo->lo_direct_pending))
+			wake_up(&lo->lo_direct_wait);
+		return;
+	}
+	dio->lo = lo;
+	dio->bio = bio;
+	dio->error = 0;
+	atomic_set(&dio->remaining, 1);
+
+	bio_for_each_segment(bvec, bio, i) {
+		unsigned int off = bvec->bv_offset, len = bvec->bv_len;
+
+		while (len) {
+			struct loop_extent *ext;
+			loff_t ext_pos;
+			sector_t sector;
+			unsigned int n;
+
+			ext = loop_find_extent(lo, pos >> blkbits);
+			if (!ext) {
+				dio->error = -EIO;
+				goto out;
+			}
+			ext_pos = (loff_t)ext->file_block << blkbits;
+			n = min_t(loff_t, len,
+				  ext_pos + ((loff_t)ext->nr_blocks << blkbits) - pos);
+			sector = (ext->disk_block << (blkbits - 9)) +
+				 ((pos - ext_pos) >> 9);
+
+			if (!clone || sector != next_sector ||
+			    bio_add_page(clone, bvec->bv_page, n, off) < n) {
+				if (clone)
+					loop_dio_submit(dio, clone);
+				clone = bio_alloc(GFP_NOIO, bio->bi_vcnt - i);
+				clone->bi_sector = sector;
+				clone->bi_bdev = lo->lo_direct_bdev;
+				clone->bi_rw = bio->bi_rw;
+				clone->bi_end_io = loop_dio_end_io;
+				clone->bi_private = dio;
+				if (bio_add_page(clone, bvec->bv_page, n, off) < n) {
+					bio_put(clone);
+					clone = NULL;
+					dio->error = -EIO;
+					goto out;
+				}
+			}
+			next_sector = sector + (n >> 9);
+			pos += n;
+			off += n;
+			len -= n;
+		}
+	}
+out:
+	if (clone)
+		loop_dio_submit(dio, clone);
+	loop_dio_put(dio);
+}
+
 static int loop_make_request(request_queue_t *q, struct bio *old_bio)
 {
 	struct loop_device *lo = q->queuedata;
@@ -522,6 +712,12 @@ static int loop_make_request(request_queue_t *q, struct bio *old_bio)
 		goto out;
 	if (unlikely(rw == WRITE && (lo->lo_flags & LO_FLAGS_READ_ONLY)))
 		goto out;
+	if (lo->lo_flags & LO_FLAGS_DIRECT_IO) {
+		atomic_inc(&lo->lo_direct_pending);
+		spin_unlock_irq(&lo->lo_lock);
+		loop_direct_bio(lo, old_bio);
+		return 0;
+	}
 	lo->lo_pending++;
 	loop_add_bio(lo, old_bio);
 	spin_unlock_irq(&lo->lo_lock);
@@ -688,10 +884,12 @@ static int loop_change_fd(struct loop_device *lo, struct file *lo_file,
 	if (lo->lo_state != Lo_bound)
 		goto out;
 
-	/* the loop device has to be read-only */
+	/* the loop device has to be read-only, and not remapped */
 	error = -EINVAL;
 	if (!(lo->lo_flags & LO_FLAGS_READ_ONLY))
 		goto out;
+	if (lo->lo_flags & LO_FLAGS_DIRECT_IO)
+		goto out;
 
 	error = -EBADF;
 	file = fget(arg);
@@ -888,6 +1086,106 @@ loop_init_xfer(struct loop_device *lo, struct loop_func_table *xfer,
 	return err;
 }
 
+/*
+ * Called with no direct bios in flight
+ */
+static void loop_clear_direct(struct loop_device *lo)
+{
+	struct inode *inode = lo->lo_backing_file->f_mapping->host;
+
+	vfree(lo->lo_extents);
+	lo->lo_extents = NULL;
+	lo->lo_nr_extents = 0;
+	lo->lo_direct_bdev = NULL;
+	blk_queue_hardsect_size(lo->lo_queue, 512);
+
+	mutex_lock(&inode->i_mutex);
+	inode->i_flags &= ~S_SWAPFILE;
+	mutex_unlock(&inode->i_mutex);
+}
+
+/*
+ * Switch direct I/O on or off.  The device mustn't be in use: the
+ * requests already queued to the loop thread, and the page cache of the
+ * backing file, are flushed before the bios go to the backing device.
+ */
+static int loop_set_direct_io(struct loop_device *lo,
+			      struct block_device *bdev, unsigned long arg)
+{
+	struct file *file = lo->lo_backing_file;
+	struct inode *inode;
+	struct loop_extent *ext;
+	unsigned short hardsect;
+	int nr, error;
+
+	if (lo->lo_state != Lo_bound)
+		return -ENXIO;
+	if (!arg == !(lo->lo_flags & LO_FLAGS_DIRECT_IO))
+		return 0;
+	if (lo->lo_refcnt > 1)	/* we needed one fd for the ioctl */
+		return -EBUSY;
+
+	if (!arg) {
+		spin_lock_irq(&lo->lo_lock);
+		lo->lo_flags &= ~LO_FLAGS_DIRECT_IO;
+		spin_unlock_irq(&lo->lo_lock);
+		wait_event(lo->lo_direct_wait,
+			   !atomic_read(&lo->lo_direct_pending));
+		loop_clear_direct(lo);
+		return 0;
+	}
+
+	inode = file->f_mapping->host;
+	if (!S_ISREG(inode->i_mode) || !inode->i_mapping->a_ops->bmap ||
+	    !inode->i_sb->s_bdev || lo->lo_encryption)
+		return -EINVAL;
+	hardsect = bdev_hardsect_size(inode->i_sb->s_bdev);
+	if (lo->lo_offset & (hardsect - 1))
+		return -EINVAL;
+
+	mutex_lock(&inode->i_mutex);
+	if (IS_SWAPFILE(inode)) {
+		mutex_unlock(&inode->i_mutex);
+		return -EBUSY;
+	}
+	inode->i_flags |= S_SWAPFILE;
+	mutex_unlock(&inode->i_mutex);
+
+	nr = loop_scan_extents(lo, inode, NULL, 0);
+	error = nr ? nr : -EINVAL;
+	if (nr <= 0)
+		goto out_clear;
+	error = -ENOMEM;
+	ext = vmalloc(nr * sizeof(*ext));
+	if (!ext)
+		goto out_clear;
+	error = loop_scan_extents(lo, inode, ext, nr);
+	if (error < 0) {
+		vfree(ext);
+		goto out_clear;
+	}
+
+	sync_blockdev(bdev);
+	filemap_write_and_wait(inode->i_mapping);
+	invalidate_inode_pages2(inode->i_mapping);
+
+	lo->lo_direct_bdev = inode->i_sb->s_bdev;
+	lo->lo_extents = ext;
+	lo->lo_nr_extents = nr;
+	blk_queue_hardsect_size(lo->lo_queue, hardsect);
+
+	spin_lock_irq(&lo->lo_lock);
+	lo->lo_flags |= LO_FLAGS_DIRECT_IO;
+	spin_unlock_irq(&lo->lo_lock);
+	return 0;
+
+out_clear:
+	mutex_lock(&inode->i_mutex);
+	inode->i_flags &= ~S_SWAPFILE;
+	mutex_unlock(&inode->i_mutex);
+	return error;
+}
+
 static int loop_clr_fd(struct loop_device *lo, struct block_device *bdev)
 {
 	struct file *filp = lo->lo_backing_file;
@@ -911,6 +1209,12 @@ static int loop_clr_fd(struct loop_device *lo, struct block_device *bdev)
 
 	wait_for_completion(&lo->lo_done);
 
+	if (lo->lo_flags & LO_FLAGS_DIRECT_IO) {
+		wait_event(lo->lo_direct_wait,
+			   !atomic_read(&lo->lo_direct_pending));
+		loop_clear_direct(lo);
+	}
+
 	lo->lo_backing_file = NULL;
 
 	loop_release_xfer(lo);
@@ -949,6 +1253,11 @@ loop_set_status(struct loop_device *lo, const struct loop_info64 *info)
 		return -ENXIO;
 	if ((unsigned int) info->lo_encrypt_key_size > LO_KEY_SIZE)
 		return -EINVAL;
+	/* the mapping of the backing file is set */
+	if ((lo->lo_flags & LO_FLAGS_DIRECT_IO) &&
+	    (info->lo_encrypt_type || lo->lo_offset != info->lo_offset ||
+	     lo->lo_sizelimit != info->lo_sizelimit))
+		return -EBUSY;
 
 	err = loop_release_xfer(lo);
 	if (err)
@@ -1155,6 +1464,9 @@ static int lo_ioctl(struct inode * inode, struct file * file,
 	case LOOP_CLR_FD:
 		err = loop_clr_fd(lo, inode->i_bdev);
 		break;
+	case LOOP_SET_DIRECT_IO:
+		err = loop_set_direct_io(lo, inode->i_bdev, arg);
+		break;
 	case LOOP_SET_STATUS:
 		err = loop_set_status_old(lo, (struct loop_info __user *) arg);
 		break;
@@ -1286,6 +1598,7 @@ static int __init loop_init(void)
 		mutex_init(&lo->lo_ctl_mutex);
 		init_completion(&lo->lo_done);
 		init_completion(&lo->lo_bh_done);
+		init_waitqueue_head(&lo->lo_direct_wait);
 		lo->lo_number = i;
 		spin_lock_init(&lo->lo_lock);
 		disk->major = LOOP_MAJOR;
@@ -27,6 +27,7 @@
 #include <linux/compiler.h>
 #include <linux/err.h>
 #include <linux/kernel.h>
+#include <linux/kthread.h>
 #include <net/sock.h>
 
 #include <asm/uaccess.h>
@@ -80,6 +81,7 @@ static const char *ioctl_cmd_to_ascii(int cmd)
 	case NBD_PRINT_DEBUG: return "print-debug";
 	case NBD_SET_SIZE_BLOCKS: return "set-size-blocks";
 	case NBD_DISCONNECT: return "disconnect";
+	case NBD_ADD_SOCK: return "add-sock";
 	case BLKROSET: return "set-read-only";
 	case BLKFLSBUF: return "flush-buffer-cache";
 	}
@@ -188,12 +190,13 @@ static inline int sock_send_bvec(struct socket *sock, struct bio_vec *bvec,
 	return result;
 }
 
-static int nbd_send_req(struct nbd_device *lo, struct request *req)
+static int nbd_send_req(struct nbd_conn *conn, struct request *req)
 {
 	int result, i, flags;
 	struct nbd_request request;
 	unsigned long size = req->nr_sectors << 9;
-	struct socket *sock = lo->sock;
+	struct nbd_device *lo = conn->lo;
+	struct socket *sock = conn->sock;
 
 	request.magic = htonl(NBD_REQUEST_MAGIC);
 	request.type = htonl(nbd_cmd(req));
@@ -245,6 +248,20 @@ error_out:
 	return 1;
 }
 
+/*
+ * Is @req still being sent on one of the connections?  Its reply can be
+ * in before the sender is done with it.
+ */
+static int nbd_req_active(struct nbd_device *lo, struct request *req)
+{
+	int i;
+
+	for (i = 0; i < lo->nr_conns; i++)
+		if (lo->conns[i]->active_req == req)
+			return 1;
+	return 0;
+}
+
 static struct request *nbd_find_request(struct nbd_device *lo, char *handle)
 {
 	struct request *req;
@@ -254,20 +271,20 @@ static struct request *nbd_find_request(struct nbd_device *lo, char *handle)
 
 	memcpy(&xreq, handle, sizeof(xreq));
 
-	err = wait_event_interruptible(lo->active_wq, lo->active_req != xreq);
+	err = wait_event_interruptible(lo->active_wq, !nbd_req_active(lo, xreq));
 	if (unlikely(err))
 		goto out;
 
-	spin_lock(&lo->queue_lock);
+	spin_lock_irq(&lo->queue_lock);
 	list_for_each(tmp, &lo->queue_head) {
 		req = list_entry(tmp, struct request, queuelist);
 		if (req != xreq)
 			continue;
 		list_del_init(&req->queuelist);
-		spin_unlock(&lo->queue_lock);
+		spin_unlock_irq(&lo->queue_lock);
 		return req;
 	}
-	spin_unlock(&lo->queue_lock);
+	spin_unlock_irq(&lo->queue_lock);
 
 	err = -ENOENT;
 
@@ -286,12 +303,13 @@ static inline int sock_recv_bvec(struct socket *sock, struct bio_vec *bvec)
 }
 
 /* NULL returned = something went wrong, inform userspace */
-static struct request *nbd_read_stat(struct nbd_device *lo)
+static struct request *nbd_read_stat(struct nbd_conn *conn)
 {
 	int result;
 	struct nbd_reply reply;
 	struct request *req;
-	struct socket *sock = lo->sock;
+	struct nbd_device *lo = conn->lo;
+	struct socket *sock = conn->sock;
 
 	reply.magic = 0;
 	result = sock_xmit(sock, 0, &reply, sizeof(reply), MSG_WAITALL);
@@ -351,19 +369,95 @@ static struct request *nbd_read_stat(struct nbd_device *lo)
 	}
 	return req;
 harderror:
-	lo->harderror = result;
+	if (!lo->harderror)
+		lo->harderror = result;
 	return NULL;
 }
 
-static void nbd_do_it(struct nbd_device *lo)
+/*
+ * Shut down the sockets, for the senders and the receivers to fail.  The
+ * sockets stay until nbd_clear_conns().
+ */
+static void nbd_shutdown_socks(struct nbd_device *lo)
+{
+	int i;
+
+	/* FIXME: This code is duplicated from sys_shutdown, but
+	 * there should be a more generic interface rather than
+	 * calling socket ops directly here */
+	for (i = 0; i < lo->nr_conns; i++) {
+		struct socket *sock = lo->conns[i]->sock;
+
+		sock->ops->shutdown(sock, SEND_SHUTDOWN|RCV_SHUTDOWN);
+	}
+}
+
+static int nbd_sender(void *data)
 {
+	struct nbd_conn *conn = data;
+	struct nbd_device *lo = conn->lo;
+	struct request *req;
+
+	while (!kthread_should_stop()) {
+		wait_event_interruptible(conn->send_wq, kthread_should_stop() ||
+					 !list_empty(&conn->send_queue));
+
+		spin_lock_irq(&lo->queue_lock);
+		if (list_empty(&conn->send_queue)) {
+			spin_unlock_irq(&lo->queue_lock);
+			continue;
+		}
+		req = list_entry(conn->send_queue.next, struct request,
+				 queuelist);
+		list_del_init(&req->queuelist);
+		conn->active_req = req;
+		spin_unlock_irq(&lo->queue_lock);
+
+		mutex_lock(&conn->tx_lock);
+		if (nbd_send_req(conn, req) != 0) {
+			printk(KERN_ERR "%s: Request send failed\n",
+					lo->disk->disk_name);
+			req->errors++;
+			nbd_end_request(req);
+		} else {
+			spin_lock_irq(&lo->queue_lock);
+			list_add(&req->queuelist, &lo->queue_head);
+			spin_unlock_irq(&lo->queue_lock);
+		}
+		conn->active_req = NULL;
+		mutex_unlock(&conn->tx_lock);
+		wake_up_all(&lo->active_wq);
+	}
+	return 0;
+}
+
+/*
+ * Complete the requests replied to on a connection.  When it fails, it
+ * takes the others down with it: which requests were sent on it is not
+ * known, so the device has to start over.
+ */
+static int nbd_receiver(void *data)
+{
+	struct nbd_conn *conn = data;
+	struct nbd_device *lo = conn->lo;
 	struct request *req;
 
 	BUG_ON(lo->magic != LO_MAGIC);
 
-	while ((req = nbd_read_stat(lo)) != NULL)
+	while ((req = nbd_read_stat(conn)) != NULL)
 		nbd_end_request(req);
-	return;
+
+	nbd_shutdown_socks(lo);
+	if (atomic_dec_and_test(&lo->nr_receivers))
+		wake_up(&lo->receivers_wq);
+
+	set_current_state(TASK_INTERRUPTIBLE);
+	while (!kthread_should_stop()) {
+		schedule();
+		set_current_state(TASK_INTERRUPTIBLE);
+	}
+	__set_current_state(TASK_RUNNING);
+	return 0;
 }
 
 static void nbd_clear_que(struct nbd_device *lo)
@@ -373,15 +467,14 @@ static void nbd_clear_que(struct nbd_device *lo)
 	BUG_ON(lo->magic != LO_MAGIC);
 
 	/*
-	 * Because we have set lo->sock to NULL under the tx_lock, all
-	 * modifications to the list must have completed by now.  For
-	 * the same reason, the active_req must be NULL.
+	 * Because we have set lo->nr_conns to 0 and stopped the senders
+	 * and receivers, all modifications to the list must have completed
+	 * by now.
 	 *
 	 * As a consequence, we don't need to take the spin lock while
 	 * purging the list here.
 	 */
-	BUG_ON(lo->sock);
-	BUG_ON(lo->active_req);
+	BUG_ON(lo->nr_conns);
 
 	while (!list_empty(&lo->queue_head)) {
 		req = list_entry(lo->queue_head.next, struct request,
@@ -392,6 +485,139 @@ static void nbd_clear_que(struct nbd_device *lo)
 	}
 }
 
+/*
+ * Drop the connections, failing the requests still queued to them or
+ * waiting for their reply.  The receivers must be gone.
+ */
+static void nbd_clear_conns(struct nbd_device *lo)
+{
+	struct nbd_conn *conn;
+	struct request *req;
+	int i, nr_conns;
+
+	spin_lock_irq(&lo->queue_lock);
+	nr_conns = lo->nr_conns;
+	lo->nr_conns = 0;
+	spin_unlock_irq(&lo->queue_lock);
+
+	for (i = 0; i < nr_conns; i++) {
+		conn = lo->conns[i];
+		lo->conns[i] = NULL;
+
+		if (conn->sender)
+			kthread_stop(conn->sender);
+		while (!list_empty(&conn->send_queue)) {
+			req = list_entry(conn->send_queue.next, struct request,
+					 queuelist);
+			list_del_init(&req->queuelist);
+			req->errors++;
+			nbd_end_request(req);
+		}
+		fput(conn->file);
+		kfree(conn);
+	}
+	nbd_clear_que(lo);
+}
+
+static int nbd_add_sock(struct nbd_device *lo, unsigned int fd)
+{
+	struct nbd_conn *conn;
+	struct file *file;
+	struct inode *inode;
+
+	if (lo->nr_conns == NBD_MAX_CONNS)
+		return -EBUSY;
+
+	file = fget(fd);
+	if (!file)
+		return -EINVAL;
+	inode = file->f_dentry->d_inode;
+	if (!S_ISSOCK(inode->i_mode)) {
+		fput(file);
+		return -EINVAL;
+	}
+
+	conn = kzalloc(sizeof(*conn), GFP_KERNEL);
+	if (!conn) {
+		fput(file);
+		return -ENOMEM;
+	}
+	conn->lo = lo;
+	conn->file = file;
+	conn->sock = SOCKET_I(inode);
+	mutex_init(&conn->tx_lock);
+	INIT_LIST_HEAD(&conn->send_queue);
+	init_waitqueue_head(&conn->send_wq);
+
+	spin_lock_irq(&lo->queue_lock);
+	lo->conns[lo->nr_conns++] = conn;
+	spin_unlock_irq(&lo->queue_lock);
+	return 0;
+}
+
+/*
+ * Start a sender and a receiver for each connection, and wait for them to
+ * fail, or for a signal.
+ */
+static int nbd_do_it(struct nbd_device *lo)
+{
+	struct nbd_conn *conn;
+	int i, error = 0;
+
+	BUG_ON(lo->magic != LO_MAGIC);
+
+	lo->running = 1;
+	lo->harderror = 0;
+	atomic_set(&lo->nr_receivers, 0);
+
+	for (i = 0; i < lo->nr_conns; i++) {
+		conn = lo->conns[i];
+		conn->sender = kthread_run(nbd_sender, conn, "%s-send/%d",
+					   lo->disk->disk_name, i);
+		if (IS_ERR(conn->sender)) {
+			error = PTR_ERR(conn->sender);
+			conn->sender = NULL;
+			goto out;
+		}
+	}
+
+	for (i = 0; i < lo->nr_conns; i++) {
+		conn = lo->conns[i];
+		atomic_inc(&lo->nr_receivers);
+		conn->receiver = kthread_run(nbd_receiver, conn, "%s-recv/%d",
+					     lo->disk->disk_name, i);
+		if (IS_ERR(conn->receiver)) {
+			error = PTR_ERR(conn->receiver);
+			conn->receiver = NULL;
+			atomic_dec(&lo->nr_receivers);
+			nbd_shutdown_socks(lo);
+			break;
+		}
+	}
+
+	if (wait_event_interruptible(lo->receivers_wq,
+				     !atomic_read(&lo->nr_receivers))) {
+		if (!lo->harderror)
+			lo->harderror = -EINTR;
+		nbd_shutdown_socks(lo);
+		wait_event(lo->receivers_wq, !atomic_read(&lo->nr_receivers));
+	}
+
+	for (i = 0; i < lo->nr_conns; i++) {
+		conn = lo->conns[i];
+		if (conn->receiver)
+			kthread_stop(conn->receiver);
+		conn->receiver = NULL;
+	}
+out:
+	printk(KERN_WARNING "%s: shutting down sockets\n", lo->disk->disk_name);
+	nbd_shutdown_socks(lo);
+	nbd_clear_conns(lo);
+	printk(KERN_WARNING "%s: queue cleared\n", lo->disk->disk_name);
+	lo->running = 0;
+	return error ? error : lo->harderror;
+}
+
 /*
  * We always wait for result of write, for now. It would be nice to make it optional
  * in future
@@ -405,6 +631,7 @@ static void do_nbd_request(request_queue_t * q)
 	
 	while ((req = elv_next_request(q)) != NULL) {
 		struct nbd_device *lo;
+		struct nbd_conn *conn;
 
 		blkdev_dequeue_request(req);
 		dprintk(DBG_BLKDEV, "%s: request %p: dequeued (flags=%lx)\n",
@@ -428,37 +655,19 @@ static void do_nbd_request(request_queue_t * q)
 		}
 
 		req->errors = 0;
-		spin_unlock_irq(q->queue_lock);
 
-		mutex_lock(&lo->tx_lock);
-		if (unlikely(!lo->sock)) {
-			mutex_unlock(&lo->tx_lock);
+		/* the senders take it from here, in turn */
+		spin_lock(&lo->queue_lock);
+		if (unlikely(!lo->nr_conns)) {
+			spin_unlock(&lo->queue_lock);
 			printk(KERN_ERR "%s: Attempted send on closed socket\n",
 			       lo->disk->disk_name);
-			req->errors++;
-			nbd_end_request(req);
-			spin_lock_irq(q->queue_lock);
-			continue;
-		}
-
-		lo->active_req = req;
-
-		if (nbd_send_req(lo, req) != 0) {
-			printk(KERN_ERR "%s: Request send failed\n",
-					lo->disk->disk_name);
-			req->errors++;
-			nbd_end_request(req);
-		} else {
-			spin_lock(&lo->queue_lock);
-			list_add(&req->queuelist, &lo->queue_head);
-			spin_unlock(&lo->queue_lock);
+			goto error_out;
 		}
-
-		lo->active_req = NULL;
-		mutex_unlock(&lo->tx_lock);
-		wake_up_all(&lo->active_wq);
-
-		spin_lock_irq(q->queue_lock);
+		conn = lo->conns[lo->next_conn++ % lo->nr_conns];
+		list_add_tail(&req->queuelist, &conn->send_queue);
+		spin_unlock(&lo->queue_lock);
+		wake_up(&conn->send_wq);
 		continue;
 
 error_out:
@@ -474,7 +683,7 @@ static int nbd_ioctl(struct inode *inode, struct file *file,
 		     unsigned int cmd, unsigned long arg)
 {
 	struct nbd_device *lo = inode->i_bdev->bd_disk->private_data;
-	int error;
+	int i;
 	struct request sreq ;
 
 	if (!capable(CAP_SYS_ADMIN))
@@ -498,39 +707,35 @@ static int nbd_ioctl(struct inode *inode, struct file *file,
 		 */
 		sreq.sector = 0;
 		sreq.nr_sectors = 0;
-                if (!lo->sock)
+		if (!lo->nr_conns)
 			return -EINVAL;
-                nbd_send_req(lo, &sreq);
-                return 0;
+		for (i = 0; i < lo->nr_conns; i++) {
+			struct nbd_conn *conn = lo->conns[i];
+
+			mutex_lock(&conn->tx_lock);
+			nbd_send_req(conn, &sreq);
+			mutex_unlock(&conn->tx_lock);
+		}
+		return 0;
  
 	case NBD_CLEAR_SOCK:
-		error = 0;
-		mutex_lock(&lo->tx_lock);
-		lo->sock = NULL;
-		mutex_unlock(&lo->tx_lock);
-		file = lo->file;
-		lo->file = NULL;
-		nbd_clear_que(lo);
+		/* NBD_DO_IT tidies up once its receivers are gone */
+		if (lo->running) {
+			nbd_shutdown_socks(lo);
+			return 0;
+		}
+		nbd_clear_conns(lo);
 		BUG_ON(!list_empty(&lo->queue_head));
-		if (file)
-			fput(file);
-		return error;
+		return 0;
 	case NBD_SET_SOCK:
-		if (lo->file)
+		if (lo->nr_conns)
 			return -EBUSY;
-		error = -EINVAL;
-		file = fget(arg);
-		if (file) {
-			inode = file->f_dentry->d_inode;
-			if (S_ISSOCK(inode->i_mode)) {
-				lo->file = file;
-				lo->sock = SOCKET_I(inode);
-				error = 0;
-			} else {
-				fput(file);
-			}
-		}
-		return error;
+		return nbd_add_sock(lo, arg);
+	case NBD_ADD_SOCK:
+		/* more connections to the same server, before NBD_DO_IT */
+		if (lo->running)
+			return -EBUSY;
+		return nbd_add_sock(lo, arg);
 	case NBD_SET_BLKSIZE:
 		lo->blksize = arg;
 		lo->bytesize &= ~(lo->blksize-1);
@@ -551,38 +756,17 @@ static int nbd_ioctl(struct inode *inode, struct file *file,
 		set_capacity(lo->disk, lo->bytesize >> 9);
 		return 0;
 	case NBD_DO_IT:
-		if (!lo->file)
+		if (!lo->nr_conns)
 			return -EINVAL;
-		nbd_do_it(lo);
-		/* on return tidy up in case we have a signal */
-		/* Forcibly shutdown the socket causing all listeners
-		 * to error
-		 *
-		 * FIXME: This code is duplicated from sys_shutdown, but
-		 * there should be a more generic interface rather than
-		 * calling socket ops directly here */
-		mutex_lock(&lo->tx_lock);
-		if (lo->sock) {
-			printk(KERN_WARNING "%s: shutting down socket\n",
-				lo->disk->disk_name);
-			lo->sock->ops->shutdown(lo->sock,
-				SEND_SHUTDOWN|RCV_SHUTDOWN);
-			lo->sock = NULL;
-		}
-		mutex_unlock(&lo->tx_lock);
-		file = lo->file;
-		lo->file = NULL;
-		nbd_clear_que(lo);
-		printk(KERN_WARNING "%s: queue cleared\n", lo->disk->disk_name);
-		if (file)
-			fput(file);
-		return lo->harderror;
+		if (lo->running)
+			return -EBUSY;
+		return nbd_do_it(lo);
 	case NBD_CLEAR_QUE:
 		/*
 		 * This is for compatibility only.  The queue is always cleared
 		 * by NBD_DO_IT or NBD_CLEAR_SOCK.
 		 */
-		BUG_ON(!lo->sock && !list_empty(&lo->queue_head));
+		BUG_ON(!lo->nr_conns && !list_empty(&lo->queue_head));
 		return 0;
 	case NBD_PRINT_DEBUG:
 		printk(KERN_INFO "%s: next = %p, prev = %p, head = %p\n",
@@ -645,13 +829,13 @@ static int __init nbd_init(void)
 
 	for (i = 0; i < nbds_max; i++) {
 		struct gendisk *disk = nbd_dev[i].disk;
-		nbd_dev[i].file = NULL;
+		nbd_dev[i].nr_conns = 0;
 		nbd_dev[i].magic = LO_MAGIC;
 		nbd_dev[i].flags = 0;
 		spin_lock_init(&nbd_dev[i].queue_lock);
 		INIT_LIST_HEAD(&nbd_dev[i].queue_head);
-		mutex_init(&nbd_dev[i].tx_lock);
 		init_waitqueue_head(&nbd_dev[i].active_wq);
+		init_waitqueue_head(&nbd_dev[i].receivers_wq);
 		nbd_dev[i].blksize = 1024;
 		nbd_dev[i].bytesize = 0x7ffffc00ULL << 10; /* 2TB */
 		disk->major = NBD_MAJOR;
@@ -411,6 +411,7 @@ static void __exit rd_cleanup(void)
 		blk_cleanup_queue(rd_queue[i]);
 	}
 	unregister_blkdev(RAMDISK_MAJOR, "ramdisk");
+	bdi_unregister(&rd_file_backing_dev_info);
 }
 
 /*
@@ -460,6 +461,8 @@ static int __init rd_init(void)
 		add_disk(rd_disks[i]);
 	}
 
+	bdi_register(&rd_file_backing_dev_info);
+
 	/* rd_size is given in kB */
 	printk("RAMDISK driver initialized: "
 		"%d RAM disks of %dK size %d blocksize\n",
@@ -0,0 +1,636 @@
+/*
+ * zram.c - compressed RAM block device
+ *
+ * Every page written to a zram device is compressed with zlib and kept
+ * in memory; reading it back decompresses it.  Used as a swap device,
+ * swap-out becomes compression and swap-in tens of microseconds of
+ * decompression rather than a disk seek, at the cost of some fraction
+ * of the memory that was to be freed.
+ *
+ * Pages of zeroes take no memory at all, and a page that does not
+ * compress to within ZRAM_MAX_COMPR is kept as it is.  When a swap slot
+ * on the device is freed, swapfile.c tells us so through
+ * ->swap_slot_free_notify and its memory is released at once.
+ *
+ * Statistics are in /sys/block/zram<id>/, see Documentation/zram.txt.
+ */
+
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/init.h>
+#include <linux/kernel.h>
+#include <linux/string.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/highmem.h>
+#include <linux/bio.h>
+#include <linux/blkdev.h>
+#include <linux/genhd.h>
+#include <linux/mutex.h>
+#include <linux/spinlock.h>
+#include <linux/swap.h>
+#include <linux/zlib.h>
+
+#include <asm/atomic.h>
+
+#define ZRAM_WBITS		12	/* a page needs no more window */
+#define ZRAM_MEM_LEVEL		8
+
+/* Keep pages that compress worse than this as they are */
+#define ZRAM_MAX_COMPR		(PAGE_SIZE / 4 * 3)
+
+/* zram_slot->flags */
+#define ZRAM_ZERO		0x01	/* page of zeroes, nothing stored */
+#define ZRAM_UNCOMPRESSED	0x02	/* ->data is a struct page */
+
+struct zram_slot {
+	void *data;		/* compressed data, or a page */
+	unsigned short size;	/* compressed size in bytes */
+	unsigned char flags;
+};
+
+struct zram_stats {
+	atomic_long_t num_reads;
+	atomic_long_t num_writes;
+	atomic_long_t failed_reads;
+	atomic_long_t failed_writes;
+	atomic_long_t notify_free;	/* swap slots freed */
+	atomic_long_t zero_pages;
+	atomic_long_t pages_stored;	/* compressed or not */
+	atomic_long_t pages_uncompressed;
+	atomic_long_t compr_size;	/* bytes of compressed data */
+};
+
+struct zram {
+	spinlock_t lock;		/* protects the table */
+	struct zram_slot *table;
+	unsigned long nr_pages;
+	struct request_queue *queue;
+	struct gendisk *disk;
+	struct zram_stats stats;
+};
+
+/*
+ * A zlib stream costs a few hundred kilobytes of workspace, so there is
+ * one per online cpu at load time, shared by all devices.
+ */
+struct zram_stream {
+	struct mutex lock;
+	z_stream def;
+	z_stream inf;
+	void *buffer;		/* ZRAM_MAX_COMPR of compressed data */
+};
+
+static int zram_major;
+static struct zram *zram_devices;
+static struct zram_stream *zram_streams;
+static int zram_nr_streams;
+
+static unsigned int num_devices = 1;
+module_param(num_devices, uint, 0);
+MODULE_PARM_DESC(num_devices, "Number of zram devices");
+
+static unsigned long disksize_kb;
+module_param(disksize_kb, ulong, 0);
+MODULE_PARM_DESC(disksize_kb, "Size of each zram device in kbytes (default 25% of RAM)");
+
+static struct zram_stream *zram_get_stream(void)
+{
+	struct zram_stream *zs;
+
+	zs = &zram_streams[raw_smp_processor_id() % zram_nr_streams];
+	mutex_lock(&zs->lock);
+	return zs;
+}
+
+static void zram_put_stream(struct zram_stream *zs)
+{
+	mutex_unlock(&zs->lock);
+}
+
+/* Returns the compressed size in zs->buffer, or -E2BIG */
+static int zram_compress(struct zram_stream *zs, void *src)
+{
+	z_stream *s = &zs->def;
+
+	if (zlib_deflateReset(s) != Z_OK)
+		return -EINVAL;
+
+	s->next_in = src;
+	s->avail_in = PAGE_SIZE;
+	s->next_out = zs->buffer;
+	s->avail_out = ZRAM_MAX_COMPR;
+
+	/* Z_OK or Z_BUF_ERROR: ran out of room, not worth compressing */
+	if (zlib_deflate(s, Z_FINISH) != Z_STREAM_END)
+		return -E2BIG;
+
+	return s->total_out;
+}
+
+static int zram_decompress(struct zram_stream *zs, void *src, int size,
+			   void *dst)
+{
+	z_stream *s = &zs->inf;
+
+	if (zlib_inflateReset(s) != Z_OK)
+		return -EINVAL;
+
+	s->next_in = src;
+	s->avail_in = size;
+	s->next_out = dst;
+	s->avail_out = PAGE_SIZE;
+
+	if (zlib_inflate(s, Z_FINISH) != Z_STREAM_END ||
+	    s->total_out != PAGE_SIZE)
+		return -EIO;
+
+	return 0;
+}
+
+static int page_zero_filled(void *ptr)
+{
+	unsigned long *page = ptr;
+	unsigned int pos;
+
+	for (pos = 0; pos < PAGE_SIZE / sizeof(*page); pos++) {
+		if (page[pos])
+			return 0;
+	}
+
+	return 1;
+}
+
+/*
+ * Detach whatever is stored in a slot, updating the statistics.  The
+ * caller frees it with zram_free_data() once the lock is dropped.
+ * Caller holds zram->lock.
+ */
+static void zram_clear_slot(struct zram *zram, struct zram_slot *slot,
+			    struct zram_slot *old)
+{
+	*old = *slot;
+	if (slot->flags & ZRAM_ZERO)
+		atomic_long_dec(&zram->stats.zero_pages);
+	else if (slot->data) {
+		atomic_long_dec(&zram->stats.pages_stored);
+		if (slot->flags & ZRAM_UNCOMPRESSED)
+			atomic_long_dec(&zram->stats.pages_uncompressed);
+		else
+			atomic_long_sub(slot->size, &zram->stats.compr_size);
+	}
+	slot->data = NULL;
+	slot->size = 0;
+	slot->flags = 0;
+}
+
+static void zram_free_data(struct zram_slot *old)
+{
+	if (!old->data)
+		return;
+	if (old->flags & ZRAM_UNCOMPRESSED)
+		__free_page(old->data);
+	else
+		kfree(old->data);
+}
+
+static int zram_read(struct zram *zram, struct page *page, unsigned long index)
+{
+	struct zram_stream *zs;
+	struct zram_slot *slot = &zram->table[index];
+	void *dst;
+	int size, ret = 0;
+
+	zs = zram_get_stream();
+	spin_lock(&zram->lock);
+	if (!slot->data) {
+		/* never written, or a page of zeroes */
+		spin_unlock(&zram->lock);
+		zram_put_stream(zs);
+		dst = kmap_atomic(page, KM_USER0);
+		memset(dst, 0, PAGE_SIZE);
+		kunmap_atomic(dst, KM_USER0);
+		flush_dcache_page(page);
+		return 0;
+	}
+	if (slot->flags & ZRAM_UNCOMPRESSED) {
+		copy_highpage(page, slot->data);
+		spin_unlock(&zram->lock);
+		zram_put_stream(zs);
+		return 0;
+	}
+
+	/* copy it out so that a racing free can't pull it from under us */
+	size = slot->size;
+	memcpy(zs->buffer, slot->data, size);
+	spin_unlock(&zram->lock);
+
+	dst = kmap_atomic(page, KM_USER0);
+	ret = zram_decompress(zs, zs->buffer, size, dst);
+	kunmap_atomic(dst, KM_USER0);
+	zram_put_stream(zs);
+	flush_dcache_page(page);
+
+	if (unlikely(ret)) {
+		printk(KERN_ERR "%s: decompression failed at page %lu\n",
+		       zram->disk->disk_name, index);
+		atomic_long_inc(&zram->stats.failed_reads);
+	}
+	return ret;
+}
+
+static int zram_write(struct zram *zram, struct page *page, unsigned long index)
+{
+	struct zram_stream *zs;
+	struct zram_slot *slot = &zram->table[index];
+	struct zram_slot new = { NULL, 0, 0 }, old;
+	void *src;
+	int clen;
+
+	src = kmap_atomic(page, KM_USER0);
+	if (page_zero_filled(src)) {
+		kunmap_atomic(src, KM_USER0);
+		new.flags = ZRAM_ZERO;
+		goto store;
+	}
+
+	zs = zram_get_stream();
+	clen = zram_compress(zs, src);
+	kunmap_atomic(src, KM_USER0);
+
+	if (clen < 0) {
+		struct page *store;
+
+		zram_put_stream(zs);
+		store = alloc_page(GFP_NOIO | __GFP_HIGHMEM | __GFP_NOWARN);
+		if (!store)
+			goto fail;
+		copy_highpage(store, page);
+		new.data = store;
+		new.size = PAGE_SIZE;
+		new.flags = ZRAM_UNCOMPRESSED;
+		goto store;
+	}
+
+	new.data = kmalloc(clen, GFP_NOIO | __GFP_NOWARN);
+	if (!new.data) {
+		zram_put_stream(zs);
+		goto fail;
+	}
+	memcpy(new.data, zs->buffer, clen);
+	new.size = clen;
+	zram_put_stream(zs);
+
+store:
+	spin_lock(&zram->lock);
+	zram_clear_slot(zram, slot, &old);
+	*slot = new;
+	if (new.flags & ZRAM_ZERO)
+		atomic_long_inc(&zram->stats.zero_pages);
+	else {
+		atomic_long_inc(&zram->stats.pages_stored);
+		if (new.flags & ZRAM_UNCOMPRESSED)
+			atomic_long_inc(&zram->stats.pages_uncompressed);
+		else
+			atomic_long_add(new.size, &zram->stats.compr_size);
+	}
+	spin_unlock(&zram->lock);
+	zram_free_data(&old);
+	return 0;
+
+fail:
+	atomic_long_inc(&zram->stats.failed_writes);
+	return -ENOMEM;
+}
+
+static int zram_make_request(request_queue_t *q, struct bio *bio)
+{
+	struct zram *zram = q->queuedata;
+	unsigned long index;
+	struct bio_vec *bvec;
+	int rw = bio_data_dir(bio);
+	int ret = 0, i;
+
+	if (unlikely((bio->bi_sector & ((PAGE_SIZE >> 9) - 1)) ||
+		     (bio->bi_size & (PAGE_SIZE - 1))))
+		goto fail;
+
+	index = bio->bi_sector >> (PAGE_SHIFT - 9);
+	if (index + (bio->bi_size >> PAGE_SHIFT) > zram->nr_pages)
+		goto fail;
+
+	if (rw == READ)
+		atomic_long_inc(&zram->stats.num_reads);
+	else
+		atomic_long_inc(&zram->stats.num_writes);
+
+	bio_for_each_segment(bvec, bio, i) {
+		/* the hardsect size is PAGE_SIZE, so each is a whole page */
+		if (unlikely(bvec->bv_len != PAGE_SIZE || bvec->bv_offset))
+			goto fail;
+		if (rw == READ)
+			ret = zram_read(zram, bvec->bv_page, index);
+		else
+			ret = zram_write(zram, bvec->bv_page, index);
+		if (ret)
+			goto fail;
+		index++;
+	}
+
+	bio_endio(bio, bio->bi_size, 0);
+	return 0;
+fail:
+	bio_io_error(bio, bio->bi_size);
+	return 0;
+}
+
+/* Called under swap_lock when the swap slot at @index is freed */
+static void zram_slot_free_notify(struct block_device *bdev,
+				  unsigned long index)
+{
+	struct zram *zram = bdev->bd_disk->private_data;
+	struct zram_slot old;
+
+	if (index >= zram->nr_pages)
+		return;
+
+	spin_lock(&zram->lock);
+	zram_clear_slot(zram, &zram->table[index], &old);
+	spin_unlock(&zram->lock);
+	zram_free_data(&old);
+	atomic_long_inc(&zram->stats.notify_free);
+}
+
+static struct block_device_operations zram_fops = {
+	.owner			= THIS_MODULE,
+	.swap_slot_free_notify	= zram_slot_free_notify,
+};
+
+/*
+ * Statistics, in /sys/block/zram<id>/
+ */
+#define ZRAM_STAT_ATTR(_name, _expr)					\
+static ssize_t zram_show_##_name(struct gendisk *disk, char *buf)	\
+{									\
+	struct zram *zram = disk->private_data;				\
+	return sprintf(buf, "%lu\n", (unsigned long)(_expr));		\
+}									\
+static struct disk_attribute zram_attr_##_name = {			\
+	.attr = { .name = #_name, .mode = S_IRUGO, .owner = THIS_MODULE }, \
+	.show = zram_show_##_name,					\
+}
+
+#define zram_stat(name)	atomic_long_read(&zram->stats.name)
+
+ZRAM_STAT_ATTR(disksize, zram->nr_pages << PAGE_SHIFT);
+ZRAM_STAT_ATTR(num_reads, zram_stat(num_reads));
+ZRAM_STAT_ATTR(num_writes, zram_stat(num_writes));
+ZRAM_STAT_ATTR(failed_reads, zram_stat(failed_reads));
+ZRAM_STAT_ATTR(failed_writes, zram_stat(failed_writes));
+ZRAM_STAT_ATTR(notify_free, zram_stat(notify_free));
+ZRAM_STAT_ATTR(zero_pages, zram_stat(zero_pages));
+ZRAM_STAT_ATTR(pages_stored, zram_stat(pages_stored));
+ZRAM_STAT_ATTR(pages_uncompressed, zram_stat(pages_uncompressed));
+ZRAM_STAT_ATTR(orig_data_size,
+	(zram_stat(pages_stored) + zram_stat(zero_pages)) << PAGE_SHIFT);
+ZRAM_STAT_ATTR(compr_data_size, zram_stat(compr_size));
+ZRAM_STAT_ATTR(mem_used_total,
+	zram_stat(compr_size) + (zram_stat(pages_uncompressed) << PAGE_SHIFT));
+
+/* Memory used as a percentage of the data it holds */
+static ssize_t zram_show_compr_ratio(struct gendisk *disk, char *buf)
+{
+	struct zram *zram = disk->private_data;
+	unsigned long orig, used;
+
+	orig = (zram_stat(pages_stored) + zram_stat(zero_pages)) << PAGE_SHIFT;
+	used = zram_stat(compr_size) +
+		(zram_stat(pages_uncompressed) << PAGE_SHIFT);
+	if (!orig)
+		return sprintf(buf, "0\n");
+	return sprintf(buf, "%lu\n", used / (orig / 100 ? orig / 100 : 1));
+}
+
+static struct disk_attribute zram_attr_compr_ratio = {
+	.attr = { .name = "compr_ratio", .mode = S_IRUGO, .owner = THIS_MODULE },
+	.show = zram_show_compr_ratio,
+};
+
+static struct attribute *zram_attrs[] = {
+	&zram_attr_disksize.attr,
+	&zram_attr_num_reads.attr,
+	&zram_attr_num_writes.attr,
+	&zram_attr_failed_reads.attr,
+	&zram_attr_failed_writes.attr,
+	&zram_attr_notify_free.attr,
+	&zram_attr_zero_pages.attr,
+	&zram_attr_pages_stored.attr,
+	&zram_attr_pages_uncompressed.attr,
+	&zram_attr_orig_data_size.attr,
+	&zram_attr_compr_data_size.attr,
+	&zram_attr_mem_used_total.attr,
+	&zram_attr_compr_ratio.attr,
+	NULL,
+};
+
+static struct attribute_group zram_attr_group = {
+	.attrs = zram_attrs,
+};
+
+static void zram_free_streams(void)
+{
+	int i;
+
+	for (i = 0; i < zram_nr_streams; i++) {
+		struct zram_stream *zs = &zram_streams[i];
+
+		if (zs->def.workspace) {
+			zlib_deflateEnd(&zs->def);
+			vfree(zs->def.workspace);
+		}
+		if (zs->inf.workspace) {
+			zlib_inflateEnd(&zs->inf);
+			vfree(zs->inf.workspace);
+		}
+		kfree(zs->buffer);
+	}
+	kfree(zram_streams);
+}
+
+static int __init zram_alloc_streams(void)
+{
+	int i;
+
+	zram_nr_streams = num_online_cpus();
+	zram_streams = kzalloc(zram_nr_streams * sizeof(struct zram_stream),
+			       GFP_KERNEL);
+	if (!zram_streams)
+		return -ENOMEM;
+
+	for (i = 0; i < zram_nr_streams; i++) {
+		struct zram_stream *zs = &zram_streams[i];
+
+		mutex_init(&zs->lock);
+		zs->buffer = kmalloc(ZRAM_MAX_COMPR, GFP_KERNEL);
+		zs->def.workspace = vmalloc(zlib_deflate_workspacesize());
+		zs->inf.workspace = vmalloc(zlib_inflate_workspacesize());
+		if (!zs->buffer || !zs->def.workspace || !zs->inf.workspace)
+			goto fail;
+
+		/* raw deflate: there's no need for the zlib header */
+		if (zlib_deflateInit2(&zs->def, Z_BEST_SPEED, Z_DEFLATED,
+				      -ZRAM_WBITS, ZRAM_MEM_LEVEL,
+				      Z_DEFAULT_STRATEGY) != Z_OK)
+			goto fail;
+		if (zlib_inflateInit2(&zs->inf, -ZRAM_WBITS) != Z_OK) {
+			zlib_deflateEnd(&zs->def);
+			goto fail;
+		}
+	}
+	return 0;
+
+fail:
+	/* leave nothing half set up for zram_free_streams() to end */
+	vfree(zram_streams[i].def.workspace);
+	zram_streams[i].def.workspace = NULL;
+	vfree(zram_streams[i].inf.workspace);
+	zram_streams[i].inf.workspace = NULL;
+	zram_nr_streams = i + 1;
+	zram_free_streams();
+	return -ENOMEM;
+}
+
+static void zram_free_table(struct zram *zram)
+{
+	unsigned long index;
+
+	for (index = 0; index < zram->nr_pages; index++) {
+		struct zram_slot old;
+
+		zram_clear_slot(zram, &zram->table[index], &old);
+		zram_free_data(&old);
+	}
+	vfree(zram->table);
+}
+
+static int __init zram_create_device(struct zram *zram, int device_id)
+{
+	struct gendisk *disk;
+
+	spin_lock_init(&zram->lock);
+	zram->nr_pages = disksize_kb >> (PAGE_SHIFT - 10);
+	zram->table = vmalloc(zram->nr_pages * sizeof(struct zram_slot));
+	if (!zram->table)
+		goto out;
+	memset(zram->table, 0, zram->nr_pages * sizeof(struct zram_slot));
+
+	zram->queue = blk_alloc_queue(GFP_KERNEL);
+	if (!zram->queue)
+		goto out_table;
+	blk_queue_make_request(zram->queue, zram_make_request);
+	blk_queue_hardsect_size(zram->queue, PAGE_SIZE);
+	zram->queue->queuedata = zram;
+
+	disk = alloc_disk(1);
+	if (!disk)
+		goto out_queue;
+	disk->major = zram_major;
+	disk->first_minor = device_id;
+	disk->fops = &zram_fops;
+	disk->queue = zram->queue;
+	disk->private_data = zram;
+	disk->flags |= GENHD_FL_SUPPRESS_PARTITION_INFO;
+	sprintf(disk->disk_name, "zram%d", device_id);
+	set_capacity(disk, zram->nr_pages << (PAGE_SHIFT - 9));
+	zram->disk = disk;
+	add_disk(disk);
+
+	if (sysfs_create_group(&disk->kobj, &zram_attr_group))
+		printk(KERN_WARNING "%s: could not create statistics\n",
+		       disk->disk_name);
+	return 0;
+
+out_queue:
+	blk_cleanup_queue(zram->queue);
+out_table:
+	vfree(zram->table);
+out:
+	return -ENOMEM;
+}
+
+static void zram_destroy_device(struct zram *zram)
+{
+	sysfs_remove_group(&zram->disk->kobj, &zram_attr_group);
+	del_gendisk(zram->disk);
+	put_disk(zram->disk);
+	blk_cleanup_queue(zram->queue);
+	zram_free_table(zram);
+}
+
+static int __init zram_init(void)
+{
+	int i, err;
+
+	if (!num_devices || num_devices > 256) {
+		printk(KERN_ERR "zram: invalid num_devices %u\n", num_devices);
+		return -EINVAL;
+	}
+	if (!disksize_kb)
+		disksize_kb = (totalram_pages << (PAGE_SHIFT - 10)) / 4;
+	disksize_kb &= ~((PAGE_SIZE >> 10) - 1);
+	if (!disksize_kb)
+		return -EINVAL;
+
+	err = zram_alloc_streams();
+	if (err)
+		return err;
+
+	zram_major = register_blkdev(0, "zram");
+	if (zram_major <= 0) {
+		err = -EBUSY;
+		goto out_streams;
+	}
+
+	zram_devices = kzalloc(num_devices * sizeof(struct zram), GFP_KERNEL);
+	if (!zram_devices) {
+		err = -ENOMEM;
+		goto out_unregister;
+	}
+
+	for (i = 0; i < num_devices; i++) {
+		err = zram_create_device(&zram_devices[i], i);
+		if (err)
+			goto out_devices;
+	}
+
+	printk(KERN_INFO "zram: %u devices of %luK, %d compression streams\n",
+	       num_devices, disksize_kb, zram_nr_streams);
+	return 0;
+
+out_devices:
+	while (i--)
+		zram_destroy_device(&zram_devices[i]);
+	kfree(zram_devices);
+out_unregister:
+	unregister_blkdev(zram_major, "zram");
+out_streams:
+	zram_free_streams();
+	return err;
+}
+
+static void __exit zram_exit(void)
+{
+	int i;
+
+	for (i = 0; i < num_devices; i++)
+		zram_destroy_device(&zram_devices[i]);
+	kfree(zram_devices);
+	unregister_blkdev(zram_major, "zram");
+	zram_free_streams();
+}
+
+module_init(zram_init);
+module_exit(zram_exit);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("Compressed RAM block device");
@@ -124,6 +124,43 @@ static void put_tty_queue(unsigned char c, struct tty_struct *tty)
 	spin_unlock_irqrestore(&tty->read_lock, flags);
 }
 
+/**
+ *	put_tty_queue_run	-	add a run of characters to the read queue
+ *	@tty: terminal device
+ *	@cp: characters
+ *	@count: number of characters
+ *
+ *	Copy characters that need no further processing into the read
+ *	queue with at most two memcpy()s and one acquisition of the
+ *	read_lock, rather than taking the lock per character. As with
+ *	put_tty_queue_nolock() whatever does not fit is dropped.
+ */
+
+static void put_tty_queue_run(struct tty_struct *tty, const unsigned char *cp,
+			      int count)
+{
+	unsigned long flags;
+	int i;
+
+	spin_lock_irqsave(&tty->read_lock, flags);
+	i = min(N_TTY_BUF_SIZE - tty->read_cnt,
+		N_TTY_BUF_SIZE - tty->read_head);
+	i = min(count, i);
+	memcpy(tty->read_buf + tty->read_head, cp, i);
+	tty->read_head = (tty->read_head + i) & (N_TTY_BUF_SIZE-1);
+	tty->read_cnt += i;
+	cp += i;
+	count -= i;
+
+	i = min(N_TTY_BUF_SIZE - tty->read_cnt,
+		N_TTY_BUF_SIZE - tty->read_head);
+	i = min(count, i);
+	memcpy(tty->read_buf + tty->read_head, cp, i);
+	tty->read_head = (tty->read_head + i) & (N_TTY_BUF_SIZE-1);
+	tty->read_cnt += i;
+	spin_unlock_irqrestore(&tty->read_lock, flags);
+}
+
 /**
  *	check_unthrottle	-	allow new receive data
  *	@tty; tty device
@@ -884,6 +921,45 @@ static void n_tty_write_wakeup(struct tty_struct *tty)
 	return;
 }
 
+/**
+ *	n_tty_plain_run		-	count characters needing no processing
+ *	@tty: terminal device
+ *	@cp: characters
+ *	@fp: flag buffer or NULL
+ *	@count: characters
+ *
+ *	Returns how many of the leading characters n_tty_receive_char()
+ *	would simply queue as they are: all normal ones in raw mode,
+ *	otherwise, with echo and the input transformations off, those
+ *	outside process_char_map. Special characters may change the mode,
+ *	so the caller hands each of them to n_tty_receive_char() and asks
+ *	again.
+ */
+
+static int n_tty_plain_run(struct tty_struct *tty, const unsigned char *cp,
+			   const char *fp, int count)
+{
+	int n;
+
+	if (!tty->raw) {
+		if (L_ECHO(tty) || I_ISTRIP(tty) || I_PARMRK(tty) ||
+		    (I_IUCLC(tty) && L_IEXTEN(tty)))
+			return 0;
+		if (tty->closing || tty->lnext || tty->erasing)
+			return 0;
+		if (tty->stopped && !tty->flow_stopped &&
+		    I_IXON(tty) && I_IXANY(tty))
+			return 0;
+	}
+	for (n = 0; n < count; n++) {
+		if (fp && fp[n] != TTY_NORMAL)
+			break;
+		if (!tty->raw && test_bit(cp[n], tty->process_char_map))
+			break;
+	}
+	return n;
+}
+
 /**
  *	n_tty_receive_buf	-	data receive
  *	@tty: terminal device
@@ -902,33 +978,26 @@ static void n_tty_receive_buf(struct tty_struct *tty, const unsigned char *cp,
 {
 	const unsigned char *p;
 	char *f, flags = TTY_NORMAL;
-	int	i;
+	int	i, n;
 	char	buf[64];
-	unsigned long cpuflags;
 
 	if (!tty->read_buf)
 		return;
 
-	if (tty->real_raw) {
-		spin_lock_irqsave(&tty->read_lock, cpuflags);
-		i = min(N_TTY_BUF_SIZE - tty->read_cnt,
-			N_TTY_BUF_SIZE - tty->read_head);
-		i = min(count, i);
-		memcpy(tty->read_buf + tty->read_head, cp, i);
-		tty->read_head = (tty->read_head + i) & (N_TTY_BUF_SIZE-1);
-		tty->read_cnt += i;
-		cp += i;
-		count -= i;
-
-		i = min(N_TTY_BUF_SIZE - tty->read_cnt,
-			N_TTY_BUF_SIZE - tty->read_head);
-		i = min(count, i);
-		memcpy(tty->read_buf + tty->read_head, cp, i);
-		tty->read_head = (tty->read_head + i) & (N_TTY_BUF_SIZE-1);
-		tty->read_cnt += i;
-		spin_unlock_irqrestore(&tty->read_lock, cpuflags);
-	} else {
+	if (tty->real_raw)
+		put_tty_queue_run(tty, cp, count);
+	else {
 		for (i=count, p = cp, f = fp; i; i--, p++) {
+			n = n_tty_plain_run(tty, p, f, i);
+			if (n) {
+				put_tty_queue_run(tty, p, n);
+				if (f)
+					f += n;
+				p += n;
+				i -= n;
+				if (!i)
+					break;
+			}
 			if (f)
 				flags = *f++;
 			switch (flags) {
@@ -53,6 +53,8 @@ static void pty_close(struct tty_struct * tty, struct file * filp)
 	if (!tty->link)
 		return;
 	tty->link->packet = 0;
+	/* let the other end read what we wrote before it sees EOF */
+	tty_flush_to_ldisc(tty->link);
 	set_bit(TTY_OTHER_CLOSED, &tty->link->flags);
 	wake_up_interruptible(&tty->link->read_wait);
 	wake_up_interruptible(&tty->link->write_wait);
@@ -88,32 +90,44 @@ static void pty_unthrottle(struct tty_struct * tty)
 }
 
 /*
- * WSH 05/24/97: modified to 
- *   (1) use space in tty->flip instead of a shared temp buffer
- *	 The flip buffers aren't being used for a pty, so there's lots
- *	 of space available.  The buffer is protected by a per-pty
- *	 semaphore that should almost never come under contention.
- *   (2) avoid redundant copying for cases where count >> receive_room
- * N.B. Calls from user space may now return an error code instead of
- * a count.
- *
- * FIXME: Our pty_write method is called with our ldisc lock held but
- * not our partners. We can't just take the other one blindly without
- * risking deadlocks.
+ * Writes are staged in the flip buffers of the other end, which are
+ * handed to its line discipline by flush_to_ldisc() off the work queue.
+ * Writers no longer run the other end's receive_buf under the BKL, and a
+ * burst of small writes reaches the line discipline in one go.  What the
+ * other end has not yet taken is bounded by PTY_BUF_SIZE; pty_unthrottle()
+ * wakes the writer once its reader has made room.
+ */
+
+static int pty_space(struct tty_struct *to)
+{
+	int n = PTY_BUF_SIZE - to->buf.memory_used;
+
+	return n < 0 ? 0 : n;
+}
+
+/*
+ * Our own writers are serialized by the atomic_write_lock, but echo from
+ * our line discipline writes here as well; flip_write_lock keeps the two
+ * from filling the other end's buffers at once.
  */
 static int pty_write(struct tty_struct * tty, const unsigned char *buf, int count)
 {
 	struct tty_struct *to = tty->link;
+	unsigned long flags;
 	int	c;
 
 	if (!to || tty->stopped)
 		return 0;
 
-	c = to->receive_room;
+	spin_lock_irqsave(&to->flip_write_lock, flags);
+	c = pty_space(to);
 	if (c > count)
 		c = count;
-	to->ldisc.receive_buf(to, buf, NULL, c);
-	
+	if (c) {
+		c = tty_insert_flip_string(to, buf, c);
+		tty_flip_buffer_push(to);
+	}
+	spin_unlock_irqrestore(&to->flip_write_lock, flags);
 	return c;
 }
 
@@ -124,7 +138,7 @@ static int pty_write_room(struct tty_struct *tty)
 	if (!to || tty->stopped)
 		return 0;
 
-	return to->receive_room;
+	return pty_space(to);
 }
 
 /*
@@ -119,6 +119,12 @@
  * this will result in random numbers that are merely cryptographically
  * strong.  For many applications, however, this is acceptable.
  *
+ * get_random_bytes() and /dev/urandom do not hash the nonblocking pool
+ * for each request.  Each cpu runs its own ChaCha20 stream, keyed from
+ * that pool and rekeyed from it every five minutes or whenever entropy
+ * is credited from userspace, so readers on different cpus share no
+ * state between reseeds.
+ *
  * Exported interfaces ---- input
  * ==============================
  *
@@ -855,6 +861,120 @@ static ssize_t extract_entropy_user(struct entropy_store *r, void __user *buf,
 	return ret;
 }
 
+/*********************************************************************
+ *
+ * Per-cpu output stage
+ *
+ *********************************************************************/
+
+/*
+ * Each cpu has a ChaCha20 stream that serves get_random_bytes() and
+ * /dev/urandom without touching the shared pools.  A stream is keyed
+ * from the nonblocking pool on first use, then again every
+ * CRNG_RESEED_INTERVAL, or once crng_seq shows entropy was credited
+ * since.  At the end of each request the key is overwritten with output
+ * nobody has seen, so the state left behind does not reveal what was
+ * returned.  The state is also used from interrupts, hence blocks are
+ * produced with them disabled.
+ */
+#define CRNG_RESEED_INTERVAL (300 * HZ)
+
+struct crng_state {
+	__u32 state[CHACHA20_BLOCK_WORDS];
+	unsigned long init_time;
+	int seq;
+};
+
+static DEFINE_PER_CPU(struct crng_state, crng_state);
+
+/* Starts off ahead of every cpu's seq, so that each seeds itself */
+static atomic_t crng_seq = ATOMIC_INIT(1);
+
+static void crng_reseed(struct crng_state *crng)
+{
+	__u32 buf[CHACHA20_BLOCK_WORDS - 4];
+	int i;
+
+	crng->seq = atomic_read(&crng_seq);
+	extract_entropy(&nonblocking_pool, buf, sizeof(buf), 0, 0);
+
+	/* "expand 32-byte k" */
+	crng->state[0] = 0x61707865;
+	crng->state[1] = 0x3320646e;
+	crng->state[2] = 0x79622d32;
+	crng->state[3] = 0x6b206574;
+	for (i = 0; i < CHACHA20_BLOCK_WORDS - 4; i++)
+		crng->state[i + 4] ^= buf[i];
+	crng->init_time = jiffies;
+	memset(buf, 0, sizeof(buf));
+}
+
+/* Fill @out with the next block of this cpu's stream */
+static void crng_next_block(__u32 *out)
+{
+	struct crng_state *crng;
+	unsigned long flags;
+
+	local_irq_save(flags);
+	crng = &__get_cpu_var(crng_state);
+	if (crng->seq != atomic_read(&crng_seq) ||
+	    time_after(jiffies, crng->init_time + CRNG_RESEED_INTERVAL))
+		crng_reseed(crng);
+	chacha20_block(crng->state, out);
+	local_irq_restore(flags);
+}
+
+/* Replace this cpu's key with stream nobody has seen */
+static void crng_backtrack_protect(void)
+{
+	__u32 tmp[CHACHA20_BLOCK_WORDS];
+	struct crng_state *crng;
+	unsigned long flags;
+	int i;
+
+	local_irq_save(flags);
+	crng = &__get_cpu_var(crng_state);
+	chacha20_block(crng->state, tmp);
+	for (i = 0; i < 8; i++)
+		crng->state[i + 4] ^= tmp[i];
+	local_irq_restore(flags);
+	memset(tmp, 0, sizeof(tmp));
+}
+
+static ssize_t crng_get_bytes_user(void __user *buf, size_t nbytes)
+{
+	ssize_t ret = 0, i;
+	__u32 tmp[CHACHA20_BLOCK_WORDS];
+
+	while (nbytes) {
+		if (need_resched()) {
+			if (signal_pending(current)) {
+				if (ret == 0)
+					ret = -ERESTARTSYS;
+				break;
+			}
+			schedule();
+		}
+
+		crng_next_block(tmp);
+		i = min_t(size_t, nbytes, CHACHA20_BLOCK_SIZE);
+		if (copy_to_user(buf, tmp, i)) {
+			ret = -EFAULT;
+			break;
+		}
+
+		nbytes -= i;
+		buf += i;
+		ret += i;
+	}
+	crng_backtrack_protect();
+
+	/* Wipe data just returned from memory */
+	memset(tmp, 0, sizeof(tmp));
+
+	return ret;
+}
+
 /*
  * This function is the exported kernel interface.  It returns some
  * number of good random numbers, suitable for seeding TCP sequence
@@ -862,7 +982,18 @@ static ssize_t extract_entropy_user(struct entropy_store *r, void __user *buf,
  */
 void get_random_bytes(void *buf, int nbytes)
 {
-	extract_entropy(&nonblocking_pool, buf, nbytes, 0, 0);
+	__u32 tmp[CHACHA20_BLOCK_WORDS];
+	int i;
+
+	while (nbytes > 0) {
+		crng_next_block(tmp);
+		i = min_t(int, nbytes, CHACHA20_BLOCK_SIZE);
+		memcpy(buf, tmp, i);
+		nbytes -= i;
+		buf += i;
+	}
+	crng_backtrack_protect();
+	memset(tmp, 0, sizeof(tmp));
 }
 
 EXPORT_SYMBOL(get_random_bytes);
@@ -999,7 +1130,7 @@ static ssize_t
 urandom_read(struct file * file, char __user * buf,
 		      size_t nbytes, loff_t *ppos)
 {
-	return extract_entropy_user(&nonblocking_pool, buf, nbytes);
+	return crng_get_bytes_user(buf, nbytes);
 }
 
 static unsigned int
@@ -1070,6 +1201,7 @@ random_ioctl(struct inode * inode, struct file * file,
 		if (get_user(ent_count, p))
 			return -EFAULT;
 		credit_entropy_store(&input_pool, ent_count);
+		atomic_inc(&crng_seq);
 		/*
 		 * Wake up waiting processes if we have enough
 		 * entropy.
@@ -1091,6 +1223,7 @@ random_ioctl(struct inode * inode, struct file * file,
 		if (retval < 0)
 			return retval;
 		credit_entropy_store(&input_pool, ent_count);
+		atomic_inc(&crng_seq);
 		/*
 		 * Wake up waiting processes if we have enough
 		 * entropy.
@@ -1106,6 +1239,7 @@ random_ioctl(struct inode * inode, struct file * file,
 		init_std_data(&input_pool);
 		init_std_data(&blocking_pool);
 		init_std_data(&nonblocking_pool);
+		atomic_inc(&crng_seq);
 		return 0;
 	default:
 		return -EINVAL;
@@ -1595,6 +1595,18 @@ void start_tty(struct tty_struct *tty)
 
 EXPORT_SYMBOL(start_tty);
 
+/*
+ *	The pty driver and the N_TTY line discipline do their own locking
+ *	on the read and write paths, so busy ptys need not serialize on the
+ *	BKL there. Other drivers and disciplines may still rely on it.
+ */
+
+static inline int tty_rw_needs_bkl(struct tty_struct *tty)
+{
+	return tty->driver->type != TTY_DRIVER_TYPE_PTY ||
+	       tty->ldisc.num != N_TTY;
+}
+
 /**
  *	tty_read	-	read method for tty device files
  *	@file: pointer to tty file
@@ -1608,14 +1620,15 @@ EXPORT_SYMBOL(start_tty);
  *	Locking:
  *		Locks the line discipline internally while needed
  *		For historical reasons the line discipline read method is
- *	invoked under the BKL. This will go away in time so do not rely on it
- *	in new code. Multiple read calls may be outstanding in parallel.
+ *	invoked under the BKL, except for N_TTY on a pty. This will go away
+ *	in time so do not rely on it in new code. Multiple read calls may be
+ *	outstanding in parallel.
  */
 
 static ssize_t tty_read(struct file * file, char __user * buf, size_t count, 
 			loff_t *ppos)
 {
-	int i;
+	int i, bkl;
 	struct tty_struct * tty;
 	struct inode *inode;
 	struct tty_ldisc *ld;
@@ -1630,13 +1643,16 @@ static ssize_t tty_read(struct file * file, char __user * buf, size_t count,
 	/* We want to wait for the line discipline to sort out in this
 	   situation */
 	ld = tty_ldisc_ref_wait(tty);
-	lock_kernel();
+	bkl = tty_rw_needs_bkl(tty);
+	if (bkl)
+		lock_kernel();
 	if (ld->read)
 		i = (ld->read)(tty,file,buf,count);
 	else
 		i = -EIO;
 	tty_ldisc_deref(ld);
-	unlock_kernel();
+	if (bkl)
+		unlock_kernel();
 	if (i > 0)
 		inode->i_atime = current_fs_time(inode->i_sb);
 	return i;
@@ -1655,6 +1671,7 @@ static inline ssize_t do_tty_write(
 {
 	ssize_t ret = 0, written = 0;
 	unsigned int chunk;
+	int bkl = tty_rw_needs_bkl(tty);
 	
 	/* FIXME: O_NDELAY ... */
 	if (mutex_lock_interruptible(&tty->atomic_write_lock)) {
@@ -1708,9 +1725,11 @@ static inline ssize_t do_tty_write(
 		ret = -EFAULT;
 		if (copy_from_user(tty->write_buf, buf, size))
 			break;
-		lock_kernel();
+		if (bkl)
+			lock_kernel();
 		ret = write(tty, file, tty->write_buf, size);
-		unlock_kernel();
+		if (bkl)
+			unlock_kernel();
 		if (ret <= 0)
 			break;
 		written += ret;
@@ -1748,7 +1767,8 @@ static inline ssize_t do_tty_write(
  *	and are then processed in chunks to the device. The line discipline
  *	write method will not be involked in parallel for each device
  *		The line discipline write method is called under the big
- *	kernel lock for historical reasons. New code should not rely on this.
+ *	kernel lock for historical reasons, except for N_TTY on a pty. New
+ *	code should not rely on this.
  */
 
 static ssize_t tty_write(struct file * file, const char __user * buf, size_t count,
@@ -3558,6 +3578,25 @@ void tty_flip_buffer_push(struct tty_struct *tty)
 
 EXPORT_SYMBOL(tty_flip_buffer_push);
 
+/**
+ *	tty_flush_to_ldisc	-	push the flip buffers now
+ *	@tty: tty to push
+ *
+ *	Hand the committed contents of the flip buffers to the line
+ *	discipline from the caller's context rather than waiting for the
+ *	work queue. The pty driver uses this on close so that the other end
+ *	reads all of the data before it sees the hangup.
+ *
+ *	Locking: as flush_to_ldisc. Must not be called from IRQ context.
+ */
+
+void tty_flush_to_ldisc(struct tty_struct *tty)
+{
+	flush_to_ldisc((void *) tty);
+}
+
+EXPORT_SYMBOL_GPL(tty_flush_to_ldisc);
+
 
 /**
  *	initialize_tty_struct
@@ -3587,6 +3626,7 @@ static void initialize_tty_struct(struct tty_struct *tty)
 	mutex_init(&tty->atomic_read_lock);
 	mutex_init(&tty->atomic_write_lock);
 	spin_lock_init(&tty->read_lock);
+	spin_lock_init(&tty->flip_write_lock);
 	INIT_LIST_HEAD(&tty->tty_files);
 	INIT_WORK(&tty->SAK_work, NULL, NULL);
 }
@@ -23,7 +23,8 @@
  * This code implements the DMA subsystem. It provides a HW-neutral interface
  * for other kernel code to use asynchronous memory copy capabilities,
  * if present, and allows different HW DMA drivers to register as providing
- * this capability.
+ * this capability.  Engines may offer xor and the RAID-6 syndrome too, and
+ * a client may ask for channels which have them.
  *
  * Due to the fact we are accelerating what is already a relatively fast
  * operation, the code goes to great lengths to avoid additional overhead,
@@ -97,6 +98,20 @@ static ssize_t show_bytes_transferred(struct class_device *cd, char *buf)
 	return sprintf(buf, "%lu\n", count);
 }
 
+static ssize_t show_average_copy_size(struct class_device *cd, char *buf)
+{
+	struct dma_chan *chan = container_of(cd, struct dma_chan, class_dev);
+	unsigned long count = 0, bytes = 0;
+	int i;
+
+	for_each_possible_cpu(i) {
+		count += per_cpu_ptr(chan->local, i)->memcpy_count;
+		bytes += per_cpu_ptr(chan->local, i)->bytes_transferred;
+	}
+
+	return sprintf(buf, "%lu\n", count ? bytes / count : 0);
+}
+
 static ssize_t show_in_use(struct class_device *cd, char *buf)
 {
 	struct dma_chan *chan = container_of(cd, struct dma_chan, class_dev);
@@ -107,6 +122,7 @@ static ssize_t show_in_use(struct class_device *cd, char *buf)
 static struct class_device_attribute dma_class_attrs[] = {
 	__ATTR(memcpy_count, S_IRUGO, show_memcpy_count, NULL),
 	__ATTR(bytes_transferred, S_IRUGO, show_bytes_transferred, NULL),
+	__ATTR(average_copy_size, S_IRUGO, show_average_copy_size, NULL),
 	__ATTR(in_use, S_IRUGO, show_in_use, NULL),
 	__ATTR_NULL
 };
@@ -140,8 +156,11 @@ static struct dma_chan *dma_client_chan_alloc(struct dma_client *client)
 	unsigned long flags;
 	int desc;	/* allocated descriptor count */
 
-	/* Find a channel, any DMA engine will do */
+	/* Find a channel of a DMA engine with the operations wanted */
 	list_for_each_entry(device, &dma_device_list, global_node) {
+		if ((device->capabilities & client->cap_mask) !=
+		    client->cap_mask)
+			continue;
 		list_for_each_entry(chan, &device->channels, device_node) {
 			if (chan->client)
 				continue;
@@ -322,6 +341,13 @@ int dma_async_device_register(struct dma_device *device)
 	kref_init(&device->refcount);
 	device->dev_id = id++;
 
+	set_bit(DMA_MEMCPY, &device->capabilities);
+	BUG_ON(dma_has_cap(device, DMA_XOR) &&
+	       (!device->device_xor_pg || device->max_xor < 2));
+	BUG_ON(dma_has_cap(device, DMA_PQ) &&
+	       (!device->device_pq_pg || device->max_xor < 2));
+	BUG_ON(dma_has_cap(device, DMA_PQ_VAL) && !device->device_pq_val_pg);
+
 	/* represent channels in sysfs. Probably want devs too */
 	list_for_each_entry(chan, &device->channels, device_node) {
 		chan->local = alloc_percpu(typeof(*chan->local));
@@ -117,6 +117,8 @@ int ipoib_vlan_add(struct net_device *pdev, unsigned short pkey)
 
 	if (ipoib_add_pkey_attr(priv->dev))
 		goto sysfs_failed;
+	if (ipoib_cm_add_mode_attr(priv->dev))
+		goto sysfs_failed;
 
 	if (class_device_create_file(&priv->dev->class_dev,
 				     &class_device_attr_parent))
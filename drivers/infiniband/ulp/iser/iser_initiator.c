@@ -658,7 +658,7 @@ void iser_snd_completion(struct iser_desc *tx_desc)
 	if (conn->suspend_tx) {
 		iser_dbg("%ld resuming tx\n",jiffies);
 		clear_bit(ISCSI_SUSPEND_BIT, &conn->suspend_tx);
-		scsi_queue_work(conn->session->host, &conn->xmitwork);
+		iscsi_conn_queue_work(conn);
 	}
 	write_unlock(conn->recv_lock);
 
@@ -0,0 +1,330 @@
+/*
+ * async_tx.c : asynchronous parity operations for RAID-4/5/6
+ *
+ * The xor, syndrome and copy operations of the RAID code go through here.
+ * A DMA engine channel which offers xor is taken for them when the system
+ * has one; each chain of operations is submitted to that channel in order,
+ * which the engine completes them in, so that a later operation sees the
+ * results of the earlier ones without waiting for them.  Whatever the
+ * channel cannot do, or runs out of descriptors for, the cpu does once the
+ * chain so far has completed.
+ *
+ * Copies are only offloaded to a chain which already is on the channel:
+ * on their own they are too small to be worth a trip to the engine.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ */
+
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/mm.h>
+#include <linux/highmem.h>
+#include <linux/string.h>
+#include <linux/spinlock.h>
+#include <linux/rcupdate.h>
+#include <linux/raid/xor.h>
+#include "raid6.h"
+#include "async_tx.h"
+
+#ifdef CONFIG_DMA_ENGINE
+
+static struct dma_client *async_tx_client;
+static struct dma_chan *async_tx_chan;
+static DEFINE_SPINLOCK(async_tx_lock);
+
+static void async_tx_event(struct dma_client *client, struct dma_chan *chan,
+			   enum dma_event event)
+{
+	spin_lock(&async_tx_lock);
+	switch (event) {
+	case DMA_RESOURCE_ADDED:
+		if (!async_tx_chan)
+			rcu_assign_pointer(async_tx_chan, chan);
+		break;
+	case DMA_RESOURCE_REMOVED:
+		if (async_tx_chan == chan)
+			rcu_assign_pointer(async_tx_chan, NULL);
+		break;
+	default:
+		break;
+	}
+	spin_unlock(&async_tx_lock);
+}
+
+/*
+ * The channel to submit an operation of @type to, with a reference held,
+ * or NULL if the cpu is to do it: the chain has completed by then.
+ */
+static struct dma_chan *async_tx_chan_for(struct async_tx *tx,
+					  enum dma_transaction_type type)
+{
+	struct dma_chan *chan = tx->chan;
+
+	if (chan) {
+		if (dma_has_cap(chan->device, type))
+			return chan;
+		async_tx_wait(tx);
+		return NULL;
+	}
+	if (type == DMA_MEMCPY)
+		return NULL;
+
+	rcu_read_lock();
+	chan = rcu_dereference(async_tx_chan);
+	if (chan && dma_has_cap(chan->device, type))
+		dma_chan_get(chan);
+	else
+		chan = NULL;
+	rcu_read_unlock();
+	return chan;
+}
+
+/* Give up on @chan for an operation the cpu is to do after all */
+static void async_tx_drop(struct async_tx *tx, struct dma_chan *chan)
+{
+	if (chan == tx->chan)
+		async_tx_wait(tx);
+	else
+		dma_chan_put(chan);
+}
+
+/* Add a submitted operation to the chain, or fail it over to the cpu */
+static int async_tx_submitted(struct async_tx *tx, struct dma_chan *chan,
+			      dma_cookie_t cookie)
+{
+	if (dma_submit_error(cookie)) {
+		async_tx_drop(tx, chan);
+		return 0;
+	}
+	tx->chan = chan;
+	tx->cookie = cookie;
+	return 1;
+}
+
+static int async_pq_offload(struct async_tx *tx, struct dma_chan *chan,
+			    struct page **blocks, int disks, size_t len)
+{
+	dma_cookie_t cookie;
+
+	if (disks - 2 > chan->device->max_xor) {
+		async_tx_drop(tx, chan);
+		return 0;
+	}
+	cookie = chan->device->device_pq_pg(chan, blocks, disks, len);
+	return async_tx_submitted(tx, chan, cookie);
+}
+
+#endif /* CONFIG_DMA_ENGINE */
+
+static void async_xor_cpu(struct page *dest, struct page **src, int src_cnt,
+			  size_t len, int flags)
+{
+	void *ptr[MAX_XOR_BLOCKS];
+	int count = 1;
+
+	ptr[0] = page_address(dest);
+	if (flags & ASYNC_TX_XOR_ZERO_DST)
+		memset(ptr[0], 0, len);
+	while (src_cnt--) {
+		ptr[count++] = page_address(*src++);
+		if (count == MAX_XOR_BLOCKS) {
+			xor_block(count, len, ptr);
+			count = 1;
+		}
+	}
+	if (count != 1)
+		xor_block(count, len, ptr);
+}
+
+static void async_pq_cpu(struct page **blocks, int disks, size_t len)
+{
+	/**** FIX THIS: This could be very bad if disks is close to 256 ****/
+	void *ptrs[disks];
+	int i;
+
+	for (i = 0; i < disks; i++)
+		ptrs[i] = page_address(blocks[i]);
+	raid6_call.gen_syndrome(disks, len, ptrs);
+}
+
+/**
+ * async_memcpy - copy between pages, in high memory or not
+ * @tx: the chain
+ * @dest: the destination page
+ * @dest_off: offset in @dest
+ * @src: the source page
+ * @src_off: offset in @src
+ * @len: bytes to copy
+ */
+void async_memcpy(struct async_tx *tx, struct page *dest, unsigned int dest_off,
+		  struct page *src, unsigned int src_off, size_t len)
+{
+	char *d, *s;
+#ifdef CONFIG_DMA_ENGINE
+	struct dma_chan *chan = async_tx_chan_for(tx, DMA_MEMCPY);
+
+	if (chan && async_tx_submitted(tx, chan,
+			dma_async_memcpy_pg_to_pg(chan, dest, dest_off,
+						  src, src_off, len)))
+		return;
+#endif
+	d = kmap_atomic(dest, KM_USER0);
+	s = kmap_atomic(src, KM_USER1);
+	memcpy(d + dest_off, s + src_off, len);
+	kunmap_atomic(s, KM_USER1);
+	kunmap_atomic(d, KM_USER0);
+}
+
+/**
+ * async_xor - xor pages into a page
+ * @tx: the chain
+ * @dest: the page to xor into
+ * @src: the pages to xor
+ * @src_cnt: how many there are
+ * @len: bytes from the start of each
+ * @flags: ASYNC_TX_XOR_ZERO_DST to zero @dest first
+ */
+void async_xor(struct async_tx *tx, struct page *dest, struct page **src,
+	       int src_cnt, size_t len, int flags)
+{
+#ifdef CONFIG_DMA_ENGINE
+	struct dma_chan *chan = async_tx_chan_for(tx, DMA_XOR);
+	dma_cookie_t cookie;
+	int n;
+
+	while (chan && src_cnt) {
+		n = min_t(int, src_cnt, chan->device->max_xor);
+		cookie = chan->device->device_xor_pg(chan, dest, src, n, len,
+					flags & ASYNC_TX_XOR_ZERO_DST);
+		if (!async_tx_submitted(tx, chan, cookie))
+			break;
+		/* the later sources go on top of what is in dest by now */
+		src += n;
+		src_cnt -= n;
+		flags &= ~ASYNC_TX_XOR_ZERO_DST;
+	}
+	if (chan && !src_cnt)
+		return;
+#endif
+	async_xor_cpu(dest, src, src_cnt, len, flags);
+}
+
+/**
+ * async_gen_syndrome - compute RAID-6 P and Q
+ * @tx: the chain
+ * @blocks: the data pages, followed by P and Q
+ * @disks: the number of pages in @blocks
+ * @len: bytes from the start of each
+ */
+void async_gen_syndrome(struct async_tx *tx, struct page **blocks, int disks,
+			size_t len)
+{
+#ifdef CONFIG_DMA_ENGINE
+	struct dma_chan *chan = async_tx_chan_for(tx, DMA_PQ);
+
+	if (chan && async_pq_offload(tx, chan, blocks, disks, len))
+		return;
+#endif
+	async_pq_cpu(blocks, disks, len);
+}
+
+static int async_page_is_zero(struct page *page, size_t len)
+{
+	char *a = page_address(page);
+
+	return *(u32 *)a == 0 && memcmp(a, a + 4, len - 4) == 0;
+}
+
+/**
+ * async_syndrome_val - check RAID-6 P and Q, and put them right
+ * @tx: the chain
+ * @blocks: the data pages, followed by P and Q
+ * @disks: the number of pages in @blocks
+ * @len: bytes from the start of each
+ * @spare: a page for the cpu to check on, its contents are lost
+ * @result: set to the ASYNC_TX_*_BAD bits once the chain has completed
+ *
+ * Whatever P and Q were, the chain leaves the right syndrome in them.
+ */
+void async_syndrome_val(struct async_tx *tx, struct page **blocks, int disks,
+			size_t len, struct page *spare, u32 *result)
+{
+#ifdef CONFIG_DMA_ENGINE
+	struct dma_chan *chan = async_tx_chan_for(tx, DMA_PQ_VAL);
+	dma_cookie_t cookie;
+
+	if (chan && (!dma_has_cap(chan->device, DMA_PQ) ||
+		     disks - 2 > chan->device->max_xor)) {
+		async_tx_drop(tx, chan);
+		chan = NULL;
+	}
+	if (chan) {
+		cookie = chan->device->device_pq_val_pg(chan, blocks, disks,
+							len, result);
+		if (async_tx_submitted(tx, chan, cookie)) {
+			/* the check is queued before the new syndrome */
+			if (!async_pq_offload(tx, chan, blocks, disks, len))
+				async_pq_cpu(blocks, disks, len);
+			return;
+		}
+	}
+#endif
+
+	*result = 0;
+	/* the xor of the data and P is zero when P is right */
+	async_xor_cpu(spare, blocks, disks - 1, len, ASYNC_TX_XOR_ZERO_DST);
+	if (!async_page_is_zero(spare, len))
+		*result |= ASYNC_TX_P_BAD;
+
+	memcpy(page_address(spare), page_address(blocks[disks - 1]), len);
+	async_pq_cpu(blocks, disks, len);
+	if (memcmp(page_address(spare), page_address(blocks[disks - 1]), len))
+		*result |= ASYNC_TX_Q_BAD;
+}
+
+/**
+ * async_tx_wait - wait for a chain to complete
+ * @tx: the chain
+ *
+ * Polls the channel: the chains are short, and their submitters hold
+ * spinlocks.  The chain may be added to again afterwards.
+ */
+void async_tx_wait(struct async_tx *tx)
+{
+#ifdef CONFIG_DMA_ENGINE
+	struct dma_chan *chan = tx->chan;
+
+	if (!chan)
+		return;
+	dma_async_memcpy_issue_pending(chan);
+	while (dma_async_memcpy_complete(chan, tx->cookie, NULL, NULL) ==
+	       DMA_IN_PROGRESS)
+		cpu_relax();
+	dma_chan_put(chan);
+	tx->chan = NULL;
+#endif
+}
+
+int async_tx_register(void)
+{
+#ifdef CONFIG_DMA_ENGINE
+	async_tx_client = dma_async_client_register(async_tx_event);
+	if (!async_tx_client)
+		return -ENOMEM;
+	/* copies alone are not worth it, see above */
+	async_tx_client->cap_mask = 1 << DMA_XOR;
+	dma_async_client_chan_request(async_tx_client, 1);
+#endif
+	return 0;
+}
+
+void async_tx_unregister(void)
+{
+#ifdef CONFIG_DMA_ENGINE
+	rcu_assign_pointer(async_tx_chan, NULL);
+	dma_async_client_unregister(async_tx_client);
+#endif
+}
@@ -0,0 +1,56 @@
+#ifndef _ASYNC_TX_H
+#define _ASYNC_TX_H
+
+/*
+ * Asynchronous parity operations for the RAID-4/5/6 code.
+ *
+ * The operations of one struct async_tx form a chain: each one sees the
+ * results of the ones submitted before it.  They are offloaded to a DMA
+ * engine channel which has xor when there is one (see async_tx.c), and are
+ * done by the cpu otherwise, before the call returns.  The pages handed in
+ * must be DMA-mappable and, for the cpu, in low memory, but for those of
+ * async_memcpy().  async_tx_wait() must be called before the results are
+ * looked at, and before the chain goes out of scope.
+ */
+
+#include <linux/dmaengine.h>
+
+struct page;
+
+struct async_tx {
+#ifdef CONFIG_DMA_ENGINE
+	struct dma_chan	*chan;		/* NULL until something was offloaded */
+	dma_cookie_t	cookie;		/* of the last operation offloaded */
+#endif
+};
+
+/* async_xor() flags */
+#define ASYNC_TX_XOR_ZERO_DST	1	/* dest is not one of the sources */
+
+/* async_syndrome_val() result bits */
+#define ASYNC_TX_P_BAD		1
+#define ASYNC_TX_Q_BAD		2
+
+static inline void async_tx_init(struct async_tx *tx)
+{
+#ifdef CONFIG_DMA_ENGINE
+	tx->chan = NULL;
+#endif
+}
+
+extern void async_memcpy(struct async_tx *tx, struct page *dest,
+			 unsigned int dest_off, struct page *src,
+			 unsigned int src_off, size_t len);
+extern void async_xor(struct async_tx *tx, struct page *dest,
+		      struct page **src, int src_cnt, size_t len, int flags);
+extern void async_gen_syndrome(struct async_tx *tx, struct page **blocks,
+			       int disks, size_t len);
+extern void async_syndrome_val(struct async_tx *tx, struct page **blocks,
+			       int disks, size_t len, struct page *spare,
+			       u32 *result);
+extern void async_tx_wait(struct async_tx *tx);
+
+extern int async_tx_register(void);
+extern void async_tx_unregister(void);
+
+#endif
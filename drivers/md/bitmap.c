@@ -274,6 +274,25 @@ static int write_sb_page(mddev_t *mddev, long offset, struct page *page, int wai
 	return 0;
 }
 
+/*
+ * write out @nr pages which follow each other in the bitmap, with one
+ * request per device
+ */
+static void write_sb_pages(mddev_t *mddev, long offset, struct page **pages,
+			   int nr)
+{
+	mdk_rdev_t *rdev;
+	struct list_head *tmp;
+
+	ITERATE_RDEV(mddev, rdev, tmp)
+		if (test_bit(In_sync, &rdev->flags)
+		    && !test_bit(Faulty, &rdev->flags))
+			md_super_write_pages(mddev, rdev,
+					     (rdev->sb_offset<<1) + offset
+					     + pages[0]->index * (PAGE_SIZE/512),
+					     pages, nr);
+}
+
 /*
  * write out a page to a file
  */
@@ -755,22 +774,43 @@ static void bitmap_file_set_bit(struct bitmap *bitmap, sector_t block)
 
 }
 
+/*
+ * write out the @nr pages of the bitmap from filemap[@start] on, without
+ * waiting for them
+ */
+static void write_pages(struct bitmap *bitmap, unsigned long start, int nr)
+{
+	int i;
+
+	atomic_long_add(nr, &bitmap->stat_pages);
+	if (bitmap->file == NULL) {
+		write_sb_pages(bitmap->mddev, bitmap->offset,
+			       bitmap->filemap + start, nr);
+		return;
+	}
+	for (i = 0; i < nr; i++)
+		write_page(bitmap, bitmap->filemap[start + i], 0);
+}
+
 /* this gets called when the md device is ready to unplug its underlying
  * (slave) device queues -- before we let any writes go down, we need to
- * sync the dirty pages of the bitmap file to disk */
+ * sync the dirty pages of the bitmap file to disk.  The writes which come
+ * in meanwhile are held back by the personality until the next unplug, so
+ * that whatever they dirtied goes out together then.
+ */
 int bitmap_unplug(struct bitmap *bitmap)
 {
-	unsigned long i, flags;
+	unsigned long i, flags, start = 0;
 	int dirty, need_write;
 	struct page *page;
 	int wait = 0;
-	int err;
+	int nr = 0;
 
 	if (!bitmap)
 		return 0;
 
 	/* look at each page to see if there are any set bits that need to be
-	 * flushed out to disk */
+	 * flushed out to disk.  Runs of such pages are written together */
 	for (i = 0; i < bitmap->file_pages; i++) {
 		spin_lock_irqsave(&bitmap->lock, flags);
 		if (!bitmap->filemap) {
@@ -786,14 +826,25 @@ int bitmap_unplug(struct bitmap *bitmap)
 			wait = 1;
 		spin_unlock_irqrestore(&bitmap->lock, flags);
 
-		if (dirty | need_write)
-			err = write_page(bitmap, page, 0);
+		if (dirty | need_write) {
+			if (!nr++)
+				start = i;
+		} else if (nr) {
+			write_pages(bitmap, start, nr);
+			nr = 0;
+		}
 	}
+	if (nr)
+		write_pages(bitmap, start, nr);
+
 	if (wait) { /* if any writes were performed, we need to wait on them */
-		if (bitmap->file)
+		atomic_long_inc(&bitmap->stat_flushes);
+		if (bitmap->file) {
+			/* all of them go to the queue at once */
+			blk_run_address_space(bitmap->file->f_mapping);
 			wait_event(bitmap->write_wait,
 				   atomic_read(&bitmap->pending_writes)==0);
-		else
+		} else
 			md_super_wait(bitmap->mddev);
 	}
 	if (bitmap->flags & BITMAP_WRITE_ERROR)
@@ -1137,6 +1188,7 @@ int bitmap_startwrite(struct bitmap *bitmap, sector_t offset, unsigned long sect
 {
 	if (!bitmap) return 0;
 
+	atomic_long_inc(&bitmap->stat_writes);
 	if (behind) {
 		atomic_inc(&bitmap->behind_writes);
 		PRINTK(KERN_DEBUG "inc write-behind count %d/%d\n",
@@ -1156,6 +1208,7 @@ int bitmap_startwrite(struct bitmap *bitmap, sector_t offset, unsigned long sect
 
 		switch(*bmc) {
 		case 0:
+			atomic_long_inc(&bitmap->stat_bits_set);
 			bitmap_file_set_bit(bitmap, offset);
 			bitmap_count_page(bitmap,offset, 1);
 			blk_plug_device(bitmap->mddev->queue);
@@ -1389,6 +1442,25 @@ void bitmap_destroy(mddev_t *mddev)
  * initialize the bitmap structure
  * if this returns an error, bitmap_destroy must be called to do clean up
  */
+/*
+ * The contents of md/bitmap_stat: the flushes per data write are what the
+ * bitmap costs the writes
+ */
+int bitmap_stat(struct bitmap *bitmap, char *page)
+{
+	char *s = page;
+
+	s += sprintf(s, "writes %lu\n",
+		     atomic_long_read(&bitmap->stat_writes));
+	s += sprintf(s, "bits_set %lu\n",
+		     atomic_long_read(&bitmap->stat_bits_set));
+	s += sprintf(s, "flushes %lu\n",
+		     atomic_long_read(&bitmap->stat_flushes));
+	s += sprintf(s, "flush_pages %lu\n",
+		     atomic_long_read(&bitmap->stat_pages));
+	return s - page;
+}
+
 int bitmap_create(mddev_t *mddev)
 {
 	struct bitmap *bitmap;
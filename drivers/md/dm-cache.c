@@ -0,0 +1,1288 @@
+/*
+ * dm-cache.c
+ *
+ * Keeps the hot blocks of a slow origin device on a fast cache device.
+ *
+ * This file is released under the GPL.
+ */
+
+#include <linux/blkdev.h>
+#include <linux/bitmap.h>
+#include <linux/crc32.h>
+#include <linux/device-mapper.h>
+#include <linux/fs.h>
+#include <linux/hash.h>
+#include <linux/init.h>
+#include <linux/list.h>
+#include <linux/mempool.h>
+#include <linux/module.h>
+#include <linux/mutex.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/workqueue.h>
+
+#include "dm.h"
+#include "dm-io.h"
+#include "kcopyd.h"
+
+#define DM_MSG_PREFIX "cache"
+
+/*
+ * Metadata layout: a superblock in the first sector, then one 64 bit
+ * entry per cache block from sector CACHE_SUPER_SECTORS on.  An entry
+ * is zero for an unused block, else the origin block shifted left by
+ * two, with the valid and dirty bits below.
+ *
+ * A cache block is only overwritten after its entry has been
+ * committed as unused, and only takes writes after its new entry
+ * has been committed, so a crash can't make a block look cached with
+ * someone else's data.  Dirty bits are only trusted after a clean
+ * shutdown; otherwise every cached block is taken to be dirty.
+ */
+#define CACHE_METADATA_MAGIC	0x68636163	/* "cach" */
+#define CACHE_METADATA_VERSION	1
+#define CACHE_SUPER_SECTORS	8
+
+#define CACHE_SB_CLEAN		1
+
+#define ENTRY_VALID		1
+#define ENTRY_DIRTY		2
+#define ENTRIES_PER_SECTOR	64UL
+
+/*
+ * Block size limits, in sectors
+ */
+#define CACHE_MIN_BLOCK_SIZE	(PAGE_SIZE >> 9)
+#define CACHE_MAX_BLOCK_SIZE	4096
+
+/*
+ * Misses to a block, within an aging period, that get it promoted
+ */
+#define CACHE_DEFAULT_THRESHOLD	4
+
+/*
+ * The heat of origin blocks is counted in a hash table of this many
+ * counters per cache block, halved every CACHE_PERIOD.
+ */
+#define CACHE_HOT_RATIO		4
+#define CACHE_PERIOD		HZ
+
+#define CACHE_PROMOTE_QUEUE	256	/* blocks waiting for promotion */
+#define CACHE_BATCH		16	/* blocks copied at a time */
+#define CACHE_VICTIM_SCAN	64	/* lru entries looked at for a victim */
+
+#define CACHE_COPY_PAGES	256
+#define MIN_IOS			256
+
+/* Cache block flags */
+#define CB_VALID		1
+#define CB_DIRTY		2
+#define CB_MIGRATING		4	/* being promoted */
+#define CB_COPIED		8	/* promoted, entry not committed yet */
+#define CB_CLEANING		16	/* being written back */
+
+struct cache_disk_super {
+	__le32 magic;
+	__le32 csum;		/* of the rest of the superblock */
+	__le32 version;
+	__le32 flags;
+	__le64 block_size;	/* in sectors */
+	__le64 nr_cblocks;
+};
+
+struct cache_block {
+	struct hlist_node hash;		/* while valid or migrating */
+	struct list_head lru;		/* or on the free list */
+	unsigned long oblock;
+	unsigned int flags;
+	unsigned int inflight;		/* bios to the cache device */
+};
+
+/*
+ * Heat of the origin blocks hashing here, and the writes to them in
+ * flight on the origin; a block isn't promoted under a write.
+ */
+struct hot_entry {
+	unsigned short count;
+	unsigned int writes;
+};
+
+struct cache_io {
+	struct list_head list;		/* while deferred */
+	struct cache_c *cache;
+	struct bio *bio;
+	struct cache_block *cb;
+	struct hot_entry *hot;
+};
+
+struct cache_stats {
+	unsigned long read_hits;
+	unsigned long read_misses;
+	unsigned long write_hits;
+	unsigned long write_misses;
+	unsigned long promotions;
+	unsigned long demotions;
+	unsigned long writebacks;
+};
+
+struct cache_c {
+	struct dm_target *ti;
+	struct dm_dev *metadata_dev;
+	struct dm_dev *cache_dev;
+	struct dm_dev *origin_dev;
+
+	sector_t block_size;
+	unsigned int block_shift;
+	unsigned long nr_cblocks;
+	unsigned long nr_oblocks;	/* whole ones */
+	int writeback;
+	unsigned int threshold;
+
+	/*
+	 * Protects everything below; taken from end_io.
+	 */
+	spinlock_t lock;
+	struct cache_block *cblocks;
+	struct hlist_head *buckets;
+	unsigned int hash_bits;
+	struct list_head lru;		/* least recently used first */
+	struct list_head free;
+	unsigned long nr_cached;
+	unsigned long nr_dirty;
+
+	struct hot_entry *hot;
+	unsigned int hot_bits;
+
+	unsigned long promote_queue[CACHE_PROMOTE_QUEUE];
+	unsigned int promote_head;
+	unsigned int nr_promote;
+
+	struct list_head deferred;	/* writes to migrating blocks */
+	unsigned long *md_dirty;	/* entry sectors to write */
+	int fail;
+	int quiescing;
+	struct cache_stats stats;
+
+	/*
+	 * Metadata, under md_lock
+	 */
+	struct mutex md_lock;
+	sector_t md_sectors;
+	sector_t entry_sectors;
+	unsigned long *md_writing;	/* entry sectors being written */
+	__le64 *entries;
+	struct cache_disk_super *sb;
+
+	mempool_t *io_pool;
+	struct kcopyd_client *copier;
+	struct workqueue_struct *wq;
+	struct work_struct worker;
+	struct work_struct tick;
+};
+
+static kmem_cache_t *_io_cache;
+
+static inline unsigned long bio_to_oblock(struct cache_c *cache,
+					  struct bio *bio)
+{
+	return (bio->bi_sector - cache->ti->begin) >> cache->block_shift;
+}
+
+static inline sector_t block_offset(struct cache_c *cache, struct bio *bio)
+{
+	return (bio->bi_sector - cache->ti->begin) & (cache->block_size - 1);
+}
+
+/*-----------------------------------------------------------------
+ * Lookup and heat
+ *---------------------------------------------------------------*/
+static struct cache_block *__lookup(struct cache_c *cache,
+				    unsigned long oblock)
+{
+	struct hlist_head *bucket;
+	struct hlist_node *n;
+	struct cache_block *cb;
+
+	bucket = cache->buckets + hash_long(oblock, cache->hash_bits);
+	hlist_for_each_entry (cb, n, bucket, hash)
+		if (cb->oblock == oblock)
+			return cb;
+
+	return NULL;
+}
+
+static void __hash(struct cache_c *cache, struct cache_block *cb)
+{
+	hlist_add_head(&cb->hash, cache->buckets +
+		       hash_long(cb->oblock, cache->hash_bits));
+}
+
+static inline struct hot_entry *hot_entry(struct cache_c *cache,
+					  unsigned long oblock)
+{
+	return cache->hot + hash_long(oblock, cache->hot_bits);
+}
+
+static inline unsigned long cblock_index(struct cache_c *cache,
+					 struct cache_block *cb)
+{
+	return cb - cache->cblocks;
+}
+
+/*
+ * The entry of the block has to be written at the next commit.
+ */
+static inline void __entry_changed(struct cache_c *cache,
+				   struct cache_block *cb)
+{
+	__set_bit(cblock_index(cache, cb) / ENTRIES_PER_SECTOR,
+		  cache->md_dirty);
+}
+
+static void __queue_promotion(struct cache_c *cache, unsigned long oblock)
+{
+	if (cache->nr_promote == CACHE_PROMOTE_QUEUE || cache->fail ||
+	    oblock >= cache->nr_oblocks)
+		return;
+
+	cache->promote_queue[(cache->promote_head + cache->nr_promote) %
+			     CACHE_PROMOTE_QUEUE] = oblock;
+	cache->nr_promote++;
+}
+
+/*
+ * Least recently used block that can be reused without any io:
+ * unused, or clean and idle.
+ */
+static struct cache_block *__find_victim(struct cache_c *cache)
+{
+	struct cache_block *cb;
+	int scanned = 0;
+
+	if (!list_empty(&cache->free))
+		return list_entry(cache->free.next, struct cache_block, lru);
+
+	list_for_each_entry (cb, &cache->lru, lru) {
+		if (++scanned > CACHE_VICTIM_SCAN)
+			break;
+		if (!(cb->flags & (CB_DIRTY | CB_CLEANING)) && !cb->inflight)
+			return cb;
+	}
+
+	return NULL;
+}
+
+/*-----------------------------------------------------------------
+ * Metadata
+ *---------------------------------------------------------------*/
+static int metadata_io(struct cache_c *cache, int rw, sector_t sector,
+		       sector_t count, void *data)
+{
+	struct io_region region;
+	unsigned long bits;
+
+	region.bdev = cache->metadata_dev->bdev;
+	region.sector = sector;
+	region.count = count;
+
+	return dm_io_sync_vm(1, &region, rw, data, &bits);
+}
+
+static u32 super_csum(struct cache_disk_super *sb)
+{
+	return crc32(~0, (u8 *) sb + 8, sizeof(*sb) - 8);
+}
+
+static int write_super(struct cache_c *cache, int clean)
+{
+	struct cache_disk_super *sb = cache->sb;
+	int r;
+
+	memset(sb, 0, 512);
+	sb->magic = cpu_to_le32(CACHE_METADATA_MAGIC);
+	sb->version = cpu_to_le32(CACHE_METADATA_VERSION);
+	sb->flags = cpu_to_le32(clean ? CACHE_SB_CLEAN : 0);
+	sb->block_size = cpu_to_le64(cache->block_size);
+	sb->nr_cblocks = cpu_to_le64(cache->nr_cblocks);
+	sb->csum = cpu_to_le32(super_csum(sb));
+
+	r = metadata_io(cache, WRITE, 0, 1, sb);
+	if (!r) {
+		r = blkdev_issue_flush(cache->metadata_dev->bdev, NULL);
+		if (r == -EOPNOTSUPP)
+			r = 0;
+	}
+
+	return r;
+}
+
+static __le64 __disk_entry(struct cache_block *cb)
+{
+	u64 e;
+
+	if (!(cb->flags & CB_VALID) &&
+	    (cb->flags & (CB_MIGRATING | CB_COPIED)) !=
+	    (CB_MIGRATING | CB_COPIED))
+		return 0;
+
+	e = ((u64) cb->oblock << 2) | ENTRY_VALID;
+	if (cb->flags & CB_DIRTY)
+		e |= ENTRY_DIRTY;
+
+	return cpu_to_le64(e);
+}
+
+/*
+ * Writes out the entry sectors that changed.  Called with md_lock
+ * held.
+ */
+static int __commit(struct cache_c *cache, int all)
+{
+	unsigned long s, end, i, first, last;
+	int r = 0;
+
+	if (cache->fail)
+		return -EIO;
+
+	/*
+	 * Entries that change after this go out with the next commit.
+	 */
+	spin_lock_irq(&cache->lock);
+	if (all)
+		bitmap_fill(cache->md_dirty, cache->entry_sectors);
+	for (s = 0; s < cache->entry_sectors; s++) {
+		if (!test_bit(s, cache->md_dirty))
+			continue;
+		__clear_bit(s, cache->md_dirty);
+		__set_bit(s, cache->md_writing);
+
+		first = s * ENTRIES_PER_SECTOR;
+		last = min(first + ENTRIES_PER_SECTOR, cache->nr_cblocks);
+		for (i = first; i < last; i++)
+			cache->entries[i] = __disk_entry(cache->cblocks + i);
+	}
+	spin_unlock_irq(&cache->lock);
+
+	for (s = 0; s < cache->entry_sectors; s = end) {
+		s = find_next_bit(cache->md_writing, cache->entry_sectors, s);
+		if (s >= cache->entry_sectors)
+			break;
+		for (end = s; end < cache->entry_sectors &&
+			      test_bit(end, cache->md_writing); end++)
+			__clear_bit(end, cache->md_writing);
+
+		r = metadata_io(cache, WRITE, CACHE_SUPER_SECTORS + s,
+				end - s, (void *) cache->entries + (s << 9));
+		if (r)
+			goto bad;
+	}
+
+	r = blkdev_issue_flush(cache->metadata_dev->bdev, NULL);
+	if (r && r != -EOPNOTSUPP)
+		goto bad;
+
+	return 0;
+
+      bad:
+	spin_lock_irq(&cache->lock);
+	bitmap_zero(cache->md_writing, cache->entry_sectors);
+	cache->fail = 1;
+	spin_unlock_irq(&cache->lock);
+
+	DMERR("metadata commit failed (%d), cache is now read-only "
+	      "and write-through", r);
+	return r;
+}
+
+static int cache_commit(struct cache_c *cache, int all)
+{
+	int r;
+
+	mutex_lock(&cache->md_lock);
+	r = __commit(cache, all);
+	mutex_unlock(&cache->md_lock);
+
+	return r;
+}
+
+/*
+ * Reads the entries in, or formats the metadata if it is all zeroes.
+ */
+static int cache_load(struct cache_c *cache, char **error)
+{
+	struct cache_disk_super *sb = cache->sb;
+	struct cache_block *cb;
+	unsigned long i;
+	int clean, r;
+	u64 e;
+
+	r = metadata_io(cache, READ, 0, 1, sb);
+	if (r) {
+		*error = "Couldn't read metadata superblock";
+		return r;
+	}
+
+	if (!sb->magic) {
+		for (i = 0; i < cache->nr_cblocks; i++)
+			list_add_tail(&cache->cblocks[i].lru, &cache->free);
+		r = __commit(cache, 1);
+		goto out;
+	}
+
+	if (le32_to_cpu(sb->magic) != CACHE_METADATA_MAGIC ||
+	    le32_to_cpu(sb->csum) != super_csum(sb)) {
+		*error = "Metadata superblock is corrupt";
+		return -EINVAL;
+	}
+
+	if (le32_to_cpu(sb->version) != CACHE_METADATA_VERSION) {
+		*error = "Unsupported metadata version";
+		return -EINVAL;
+	}
+
+	if (le64_to_cpu(sb->block_size) != cache->block_size ||
+	    le64_to_cpu(sb->nr_cblocks) != cache->nr_cblocks) {
+		*error = "Cache device or block size differs from the metadata";
+		return -EINVAL;
+	}
+
+	clean = le32_to_cpu(sb->flags) & CACHE_SB_CLEAN;
+
+	r = metadata_io(cache, READ, CACHE_SUPER_SECTORS,
+			cache->entry_sectors, cache->entries);
+	if (r) {
+		*error = "Couldn't read metadata entries";
+		return r;
+	}
+
+	for (i = 0; i < cache->nr_cblocks; i++) {
+		cb = cache->cblocks + i;
+		e = le64_to_cpu(cache->entries[i]);
+
+		if (!(e & ENTRY_VALID)) {
+			list_add_tail(&cb->lru, &cache->free);
+			continue;
+		}
+
+		cb->oblock = e >> 2;
+		if (cb->oblock >= cache->nr_oblocks) {
+			*error = "Metadata maps blocks beyond the origin";
+			return -EINVAL;
+		}
+
+		cb->flags = CB_VALID;
+		if ((e & ENTRY_DIRTY) || !clean) {
+			cb->flags |= CB_DIRTY;
+			cache->nr_dirty++;
+		}
+		__hash(cache, cb);
+		list_add_tail(&cb->lru, &cache->lru);
+		cache->nr_cached++;
+	}
+
+	if (!clean)
+		DMWARN("cache was not shut down cleanly, %lu blocks to "
+		       "write back", cache->nr_dirty);
+
+      out:
+	if (!r)
+		r = write_super(cache, 0);
+	if (r)
+		*error = "Couldn't write metadata";
+
+	return r;
+}
+
+/*-----------------------------------------------------------------
+ * Copying between the devices
+ *---------------------------------------------------------------*/
+struct copy_batch {
+	atomic_t count;
+	struct completion done;
+};
+
+struct copy_job {
+	struct copy_batch *batch;
+	struct cache_block *cb;
+	unsigned long old_oblock;	/* of a demoted block */
+	int demoted;
+	int err;
+};
+
+static void copy_complete(int read_err, unsigned int write_err,
+			  void *context)
+{
+	struct copy_job *job = context;
+
+	job->err = (read_err || write_err) ? -EIO : 0;
+	if (atomic_dec_and_test(&job->batch->count))
+		complete(&job->batch->done);
+}
+
+/*
+ * Copies each block in jobs from the origin (promote) or back to it,
+ * all at once, and waits for them.
+ */
+static void copy_blocks(struct cache_c *cache, struct copy_job *jobs,
+			unsigned int nr, int promote)
+{
+	struct copy_batch batch;
+	struct io_region o, c;
+	unsigned int i;
+	int r;
+
+	atomic_set(&batch.count, nr + 1);
+	init_completion(&batch.done);
+
+	for (i = 0; i < nr; i++) {
+		jobs[i].batch = &batch;
+
+		o.bdev = cache->origin_dev->bdev;
+		o.sector = (sector_t) jobs[i].cb->oblock << cache->block_shift;
+		o.count = cache->block_size;
+
+		c.bdev = cache->cache_dev->bdev;
+		c.sector = (sector_t) cblock_index(cache, jobs[i].cb) <<
+			   cache->block_shift;
+		c.count = cache->block_size;
+
+		if (promote)
+			r = kcopyd_copy(cache->copier, &o, 1, &c, 0,
+					copy_complete, jobs + i);
+		else
+			r = kcopyd_copy(cache->copier, &c, 1, &o, 0,
+					copy_complete, jobs + i);
+		if (r) {
+			jobs[i].err = r;
+			atomic_dec(&batch.count);
+		}
+	}
+
+	if (!atomic_dec_and_test(&batch.count))
+		wait_for_completion(&batch.done);
+}
+
+/*-----------------------------------------------------------------
+ * Data path
+ *---------------------------------------------------------------*/
+static void remap_to_cache(struct cache_c *cache, struct bio *bio,
+			   struct cache_block *cb)
+{
+	bio->bi_bdev = cache->cache_dev->bdev;
+	bio->bi_sector = ((sector_t) cblock_index(cache, cb) <<
+			  cache->block_shift) + block_offset(cache, bio);
+}
+
+static void remap_to_origin(struct cache_c *cache, struct bio *bio)
+{
+	bio->bi_bdev = cache->origin_dev->bdev;
+	bio->bi_sector -= cache->ti->begin;
+}
+
+static void writethrough_complete(unsigned long error, void *context)
+{
+	struct bio *bio = context;
+
+	bio_endio(bio, bio->bi_size, error ? -EIO : 0);
+}
+
+/*
+ * A write hit in write-through mode goes to both devices at once.
+ */
+static void issue_writethrough(struct cache_c *cache, struct bio *bio,
+			       struct cache_block *cb)
+{
+	struct io_region where[2];
+	int r;
+
+	where[0].bdev = cache->origin_dev->bdev;
+	where[0].sector = bio->bi_sector - cache->ti->begin;
+	where[0].count = bio_sectors(bio);
+
+	where[1].bdev = cache->cache_dev->bdev;
+	where[1].sector = ((sector_t) cblock_index(cache, cb) <<
+			   cache->block_shift) + block_offset(cache, bio);
+	where[1].count = bio_sectors(bio);
+
+	r = dm_io_async_bvec(2, where, WRITE, bio->bi_io_vec + bio->bi_idx,
+			     writethrough_complete, bio);
+	if (r)
+		bio_endio(bio, bio->bi_size, r);
+}
+
+/*
+ * Returns 1 when the bio has been remapped, 0 when it has been
+ * issued or deferred.
+ */
+static int map_io(struct cache_c *cache, struct cache_io *io)
+{
+	struct bio *bio = io->bio;
+	unsigned long oblock = bio_to_oblock(cache, bio);
+	int write = bio_data_dir(bio) == WRITE;
+	struct cache_block *cb;
+	struct hot_entry *hot;
+	unsigned long flags;
+	int kick = 0;
+
+	spin_lock_irqsave(&cache->lock, flags);
+	cb = __lookup(cache, oblock);
+
+	if (cb && (cb->flags & CB_MIGRATING)) {
+		if (write) {
+			list_add_tail(&io->list, &cache->deferred);
+			spin_unlock_irqrestore(&cache->lock, flags);
+			return 0;
+		}
+		cb = NULL;
+		goto miss;
+	}
+
+	if (cb) {
+		cb->inflight++;
+		io->cb = cb;
+		list_move_tail(&cb->lru, &cache->lru);
+
+		if (!write) {
+			cache->stats.read_hits++;
+			spin_unlock_irqrestore(&cache->lock, flags);
+			remap_to_cache(cache, bio, cb);
+			return 1;
+		}
+
+		cache->stats.write_hits++;
+		if (!cache->writeback || cache->fail) {
+			spin_unlock_irqrestore(&cache->lock, flags);
+			issue_writethrough(cache, bio, cb);
+			return 0;
+		}
+
+		if (!(cb->flags & CB_DIRTY)) {
+			cb->flags |= CB_DIRTY;
+			cache->nr_dirty++;
+		}
+		spin_unlock_irqrestore(&cache->lock, flags);
+		remap_to_cache(cache, bio, cb);
+		return 1;
+	}
+
+      miss:
+	hot = hot_entry(cache, oblock);
+	if (write) {
+		cache->stats.write_misses++;
+		hot->writes++;
+		io->hot = hot;
+	} else
+		cache->stats.read_misses++;
+
+	if (!cb && ++hot->count >= cache->threshold) {
+		hot->count = 0;
+		__queue_promotion(cache, oblock);
+		kick = 1;
+	}
+	spin_unlock_irqrestore(&cache->lock, flags);
+
+	if (kick)
+		queue_work(cache->wq, &cache->worker);
+
+	remap_to_origin(cache, bio);
+	return 1;
+}
+
+/*
+ * Promotes up to CACHE_BATCH queued blocks.  Returns -EBUSY if it
+ * ran out of blocks that can be reused without writing them back.
+ */
+static int promote_blocks(struct cache_c *cache)
+{
+	struct copy_job jobs[CACHE_BATCH];
+	struct cache_block *cb;
+	unsigned long oblock;
+	unsigned int nr = 0, i;
+	int demoted = 0, r = 0;
+
+	spin_lock_irq(&cache->lock);
+	while (cache->nr_promote && nr < CACHE_BATCH && !cache->fail) {
+		oblock = cache->promote_queue[cache->promote_head];
+
+		if (!__lookup(cache, oblock) &&
+		    !hot_entry(cache, oblock)->writes) {
+			cb = __find_victim(cache);
+			if (!cb) {
+				r = -EBUSY;
+				break;
+			}
+
+			jobs[nr].demoted = 0;
+			if (cb->flags & CB_VALID) {
+				hlist_del(&cb->hash);
+				cache->nr_cached--;
+				__entry_changed(cache, cb);
+				jobs[nr].old_oblock = cb->oblock;
+				jobs[nr].demoted = 1;
+				demoted = 1;
+			}
+
+			cb->oblock = oblock;
+			cb->flags = CB_MIGRATING;
+			__hash(cache, cb);
+			list_del(&cb->lru);
+			jobs[nr++].cb = cb;
+		}
+
+		cache->promote_head = (cache->promote_head + 1) %
+				      CACHE_PROMOTE_QUEUE;
+		cache->nr_promote--;
+	}
+	spin_unlock_irq(&cache->lock);
+
+	if (!nr)
+		return r;
+
+	/*
+	 * The demoted blocks must be on disk as unused before they are
+	 * overwritten; if that fails they stay what they were.
+	 */
+	if (demoted && cache_commit(cache, 0)) {
+		spin_lock_irq(&cache->lock);
+		for (i = 0; i < nr; i++) {
+			cb = jobs[i].cb;
+			hlist_del(&cb->hash);
+			if (jobs[i].demoted) {
+				cb->oblock = jobs[i].old_oblock;
+				cb->flags = CB_VALID;
+				__hash(cache, cb);
+				list_add(&cb->lru, &cache->lru);
+				cache->nr_cached++;
+			} else {
+				cb->flags = 0;
+				list_add(&cb->lru, &cache->free);
+			}
+		}
+		spin_unlock_irq(&cache->lock);
+		return r;
+	}
+
+	copy_blocks(cache, jobs, nr, 1);
+
+	spin_lock_irq(&cache->lock);
+	for (i = 0; i < nr; i++)
+		if (!jobs[i].err) {
+			jobs[i].cb->flags |= CB_COPIED;
+			__entry_changed(cache, jobs[i].cb);
+		}
+	spin_unlock_irq(&cache->lock);
+
+	/*
+	 * And the promoted ones must be on disk before they take
+	 * writes.  If that fails the cache turns write-through, so
+	 * they may be used anyway.
+	 */
+	cache_commit(cache, 0);
+
+	spin_lock_irq(&cache->lock);
+	for (i = 0; i < nr; i++) {
+		cb = jobs[i].cb;
+		if (jobs[i].demoted)
+			cache->stats.demotions++;
+
+		if (jobs[i].err) {
+			hlist_del(&cb->hash);
+			cb->flags = 0;
+			list_add(&cb->lru, &cache->free);
+			continue;
+		}
+
+		cb->flags = CB_VALID;
+		list_add_tail(&cb->lru, &cache->lru);
+		cache->nr_cached++;
+		cache->stats.promotions++;
+	}
+	spin_unlock_irq(&cache->lock);
+
+	return r;
+}
+
+/*
+ * Writes back up to CACHE_BATCH of the least recently used dirty
+ * blocks.  A block written to meanwhile just stays dirty.
+ */
+static void writeback_blocks(struct cache_c *cache)
+{
+	struct copy_job jobs[CACHE_BATCH];
+	struct cache_block *cb;
+	unsigned int nr = 0, i;
+
+	spin_lock_irq(&cache->lock);
+	list_for_each_entry (cb, &cache->lru, lru) {
+		if (nr == CACHE_BATCH)
+			break;
+		if ((cb->flags & (CB_DIRTY | CB_CLEANING)) != CB_DIRTY)
+			continue;
+
+		cb->flags &= ~CB_DIRTY;
+		cb->flags |= CB_CLEANING;
+		cache->nr_dirty--;
+		jobs[nr++].cb = cb;
+	}
+	spin_unlock_irq(&cache->lock);
+
+	if (!nr)
+		return;
+
+	copy_blocks(cache, jobs, nr, 0);
+
+	spin_lock_irq(&cache->lock);
+	for (i = 0; i < nr; i++) {
+		cb = jobs[i].cb;
+		cb->flags &= ~CB_CLEANING;
+		if (!jobs[i].err)
+			cache->stats.writebacks++;
+		else if (!(cb->flags & CB_DIRTY)) {
+			cb->flags |= CB_DIRTY;
+			cache->nr_dirty++;
+		}
+	}
+	spin_unlock_irq(&cache->lock);
+}
+
+static void process_deferred(struct cache_c *cache)
+{
+	struct cache_io *io, *tmp;
+	LIST_HEAD(ios);
+
+	spin_lock_irq(&cache->lock);
+	list_splice_init(&cache->deferred, &ios);
+	spin_unlock_irq(&cache->lock);
+
+	list_for_each_entry_safe (io, tmp, &ios, list)
+		if (map_io(cache, io))
+			generic_make_request(io->bio);
+}
+
+static void do_worker(void *data)
+{
+	struct cache_c *cache = data;
+
+	while (cache->nr_promote && !cache->fail) {
+		if (promote_blocks(cache) == -EBUSY) {
+			writeback_blocks(cache);
+			break;
+		}
+		process_deferred(cache);
+	}
+
+	process_deferred(cache);
+}
+
+/*
+ * Once a period: age the heat counters and write back a batch.
+ */
+static void do_tick(void *data)
+{
+	struct cache_c *cache = data;
+	unsigned int i, j, size = 1 << cache->hot_bits;
+
+	/* a bit at a time, the lock is taken from end_io */
+	for (i = 0; i < size; i += 4096) {
+		spin_lock_irq(&cache->lock);
+		for (j = i; j < min(i + 4096, size); j++)
+			cache->hot[j].count >>= 1;
+		spin_unlock_irq(&cache->lock);
+	}
+
+	writeback_blocks(cache);
+
+	if (!cache->quiescing)
+		queue_delayed_work(cache->wq, &cache->tick, CACHE_PERIOD);
+}
+
+/*-----------------------------------------------------------------
+ * Target
+ *---------------------------------------------------------------*/
+static inline sector_t get_dev_size(struct block_device *bdev)
+{
+	return bdev->bd_inode->i_size >> SECTOR_SHIFT;
+}
+
+static int alloc_cache(struct cache_c *cache)
+{
+	unsigned long i, buckets;
+
+	buckets = roundup_pow_of_two(max(cache->nr_cblocks / 2, 64UL));
+	cache->hash_bits = ffs(buckets) - 1;
+	cache->hot_bits = ffs(roundup_pow_of_two(cache->nr_cblocks *
+						 CACHE_HOT_RATIO)) - 1;
+
+	cache->cblocks = dm_vcalloc(cache->nr_cblocks,
+				    sizeof(struct cache_block));
+	cache->buckets = dm_vcalloc(buckets, sizeof(struct hlist_head));
+	cache->hot = dm_vcalloc(1 << cache->hot_bits,
+				sizeof(struct hot_entry));
+	cache->md_dirty = dm_vcalloc(BITS_TO_LONGS(cache->entry_sectors),
+				     sizeof(unsigned long));
+	cache->md_writing = dm_vcalloc(BITS_TO_LONGS(cache->entry_sectors),
+				       sizeof(unsigned long));
+	cache->entries = dm_vcalloc(cache->entry_sectors, 512);
+	cache->sb = vmalloc(PAGE_SIZE);
+	if (!cache->cblocks || !cache->buckets || !cache->hot ||
+	    !cache->md_dirty || !cache->md_writing || !cache->entries ||
+	    !cache->sb)
+		return -ENOMEM;
+
+	memset(cache->cblocks, 0, cache->nr_cblocks *
+	       sizeof(struct cache_block));
+	memset(cache->hot, 0, (1 << cache->hot_bits) *
+	       sizeof(struct hot_entry));
+	memset(cache->md_dirty, 0, BITS_TO_LONGS(cache->entry_sectors) *
+	       sizeof(unsigned long));
+	memset(cache->md_writing, 0, BITS_TO_LONGS(cache->entry_sectors) *
+	       sizeof(unsigned long));
+	memset(cache->entries, 0, cache->entry_sectors << 9);
+
+	for (i = 0; i < buckets; i++)
+		INIT_HLIST_HEAD(cache->buckets + i);
+
+	return 0;
+}
+
+static void free_cache(struct cache_c *cache)
+{
+	vfree(cache->cblocks);
+	vfree(cache->buckets);
+	vfree(cache->hot);
+	vfree(cache->md_dirty);
+	vfree(cache->md_writing);
+	vfree(cache->entries);
+	vfree(cache->sb);
+}
+
+/*
+ * Construct a cache mapping:
+ * <metadata dev> <cache dev> <origin dev> <block size>
+ * <writeback|writethrough> [<promote threshold>]
+ */
+static int cache_ctr(struct dm_target *ti, unsigned int argc, char **argv)
+{
+	struct cache_c *cache;
+	unsigned long block_size;
+	char *end;
+	int r;
+
+	if (argc != 5 && argc != 6) {
+		ti->error = "Requires 5 or 6 arguments";
+		return -EINVAL;
+	}
+
+	cache = kzalloc(sizeof(*cache), GFP_KERNEL);
+	if (!cache) {
+		ti->error = "Cannot allocate cache context";
+		return -ENOMEM;
+	}
+
+	cache->ti = ti;
+	spin_lock_init(&cache->lock);
+	INIT_LIST_HEAD(&cache->lru);
+	INIT_LIST_HEAD(&cache->free);
+	INIT_LIST_HEAD(&cache->deferred);
+	mutex_init(&cache->md_lock);
+	INIT_WORK(&cache->worker, do_worker, cache);
+	INIT_WORK(&cache->tick, do_tick, cache);
+
+	r = -EINVAL;
+	block_size = simple_strtoul(argv[3], &end, 10);
+	if (*end || block_size < CACHE_MIN_BLOCK_SIZE ||
+	    block_size > CACHE_MAX_BLOCK_SIZE ||
+	    (block_size & (block_size - 1))) {
+		ti->error = "Invalid block size";
+		goto bad1;
+	}
+	cache->block_size = block_size;
+	cache->block_shift = ffs(block_size) - 1;
+
+	if (!strcmp(argv[4], "writeback"))
+		cache->writeback = 1;
+	else if (strcmp(argv[4], "writethrough")) {
+		ti->error = "Mode must be writeback or writethrough";
+		goto bad1;
+	}
+
+	cache->threshold = CACHE_DEFAULT_THRESHOLD;
+	if (argc == 6) {
+		cache->threshold = simple_strtoul(argv[5], &end, 10);
+		if (*end || !cache->threshold || cache->threshold > 0xffff) {
+			ti->error = "Invalid promote threshold";
+			goto bad1;
+		}
+	}
+
+	r = dm_get_device(ti, argv[0], 0, 0,
+			  FMODE_READ | FMODE_WRITE, &cache->metadata_dev);
+	if (r) {
+		ti->error = "Cannot get metadata device";
+		goto bad1;
+	}
+
+	r = dm_get_device(ti, argv[1], 0, 0,
+			  FMODE_READ | FMODE_WRITE, &cache->cache_dev);
+	if (r) {
+		ti->error = "Cannot get cache device";
+		goto bad2;
+	}
+
+	r = dm_get_device(ti, argv[2], 0, ti->len,
+			  FMODE_READ | FMODE_WRITE, &cache->origin_dev);
+	if (r) {
+		ti->error = "Cannot get origin device";
+		goto bad3;
+	}
+
+	r = -EINVAL;
+	cache->nr_cblocks = get_dev_size(cache->cache_dev->bdev) >>
+			    cache->block_shift;
+	cache->nr_oblocks = ti->len >> cache->block_shift;
+	cache->md_sectors = get_dev_size(cache->metadata_dev->bdev);
+	cache->entry_sectors = (cache->nr_cblocks + ENTRIES_PER_SECTOR - 1) /
+			       ENTRIES_PER_SECTOR;
+	if (!cache->nr_cblocks) {
+		ti->error = "Cache device is smaller than a block";
+		goto bad4;
+	}
+	if (cache->md_sectors < CACHE_SUPER_SECTORS + cache->entry_sectors) {
+		ti->error = "Metadata device is too small";
+		goto bad4;
+	}
+
+	r = alloc_cache(cache);
+	if (r) {
+		ti->error = "Cannot allocate cache blocks";
+		goto bad5;
+	}
+
+	cache->io_pool = mempool_create_slab_pool(MIN_IOS, _io_cache);
+	if (!cache->io_pool) {
+		ti->error = "Cannot allocate io mempool";
+		r = -ENOMEM;
+		goto bad5;
+	}
+
+	r = dm_io_get(block_size >> (PAGE_SHIFT - 9));
+	if (r) {
+		ti->error = "Couldn't reserve dm-io pages";
+		goto bad6;
+	}
+
+	r = cache_load(cache, &ti->error);
+	if (r)
+		goto bad7;
+
+	r = kcopyd_client_create(CACHE_COPY_PAGES, &cache->copier);
+	if (r) {
+		ti->error = "Could not create kcopyd client";
+		goto bad7;
+	}
+
+	cache->wq = create_singlethread_workqueue("kcached");
+	if (!cache->wq) {
+		ti->error = "Could not create cache workqueue";
+		r = -ENOMEM;
+		goto bad8;
+	}
+
+	ti->split_io = block_size;
+	ti->private = cache;
+	return 0;
+
+      bad8:
+	kcopyd_client_destroy(cache->copier);
+      bad7:
+	dm_io_put(block_size >> (PAGE_SHIFT - 9));
+      bad6:
+	mempool_destroy(cache->io_pool);
+      bad5:
+	free_cache(cache);
+      bad4:
+	dm_put_device(ti, cache->origin_dev);
+      bad3:
+	dm_put_device(ti, cache->cache_dev);
+      bad2:
+	dm_put_device(ti, cache->metadata_dev);
+      bad1:
+	kfree(cache);
+	return r;
+}
+
+static void cache_dtr(struct dm_target *ti)
+{
+	struct cache_c *cache = ti->private;
+
+	destroy_workqueue(cache->wq);
+	kcopyd_client_destroy(cache->copier);
+	dm_io_put(cache->block_size >> (PAGE_SHIFT - 9));
+	mempool_destroy(cache->io_pool);
+	free_cache(cache);
+
+	dm_put_device(ti, cache->origin_dev);
+	dm_put_device(ti, cache->cache_dev);
+	dm_put_device(ti, cache->metadata_dev);
+	kfree(cache);
+}
+
+static int cache_map(struct dm_target *ti, struct bio *bio,
+		     union map_info *map_context)
+{
+	struct cache_c *cache = ti->private;
+	struct cache_io *io;
+
+	io = mempool_alloc(cache->io_pool, GFP_NOIO);
+	io->cache = cache;
+	io->bio = bio;
+	io->cb = NULL;
+	io->hot = NULL;
+	map_context->ptr = io;
+
+	return map_io(cache, io);
+}
+
+static int cache_end_io(struct dm_target *ti, struct bio *bio,
+			int error, union map_info *map_context)
+{
+	struct cache_c *cache = ti->private;
+	struct cache_io *io = map_context->ptr;
+	unsigned long flags;
+
+	spin_lock_irqsave(&cache->lock, flags);
+	if (io->cb)
+		io->cb->inflight--;
+	if (io->hot)
+		io->hot->writes--;
+	spin_unlock_irqrestore(&cache->lock, flags);
+
+	mempool_free(io, cache->io_pool);
+	return error;
+}
+
+/*
+ * The dirty bits are written out, and trusted at the next load, only
+ * when the device is suspended.
+ */
+static void cache_postsuspend(struct dm_target *ti)
+{
+	struct cache_c *cache = ti->private;
+
+	cache->quiescing = 1;
+	cancel_delayed_work(&cache->tick);
+	flush_workqueue(cache->wq);
+
+	mutex_lock(&cache->md_lock);
+	if (!__commit(cache, 1) && write_super(cache, 1))
+		DMERR("couldn't mark the metadata clean");
+	mutex_unlock(&cache->md_lock);
+}
+
+static void cache_resume(struct dm_target *ti)
+{
+	struct cache_c *cache = ti->private;
+	int r;
+
+	mutex_lock(&cache->md_lock);
+	r = write_super(cache, 0);
+	mutex_unlock(&cache->md_lock);
+
+	if (r) {
+		DMERR("couldn't mark the metadata in use, "
+		      "no more blocks will be promoted");
+		spin_lock_irq(&cache->lock);
+		cache->fail = 1;
+		spin_unlock_irq(&cache->lock);
+	}
+
+	cache->quiescing = 0;
+	queue_delayed_work(cache->wq, &cache->tick, CACHE_PERIOD);
+}
+
+static int cache_status(struct dm_target *ti, status_type_t type,
+			char *result, unsigned int maxlen)
+{
+	struct cache_c *cache = ti->private;
+	struct cache_stats stats;
+	unsigned long nr_cached, nr_dirty;
+	unsigned int sz = 0;
+
+	switch (type) {
+	case STATUSTYPE_INFO:
+		spin_lock_irq(&cache->lock);
+		stats = cache->stats;
+		nr_cached = cache->nr_cached;
+		nr_dirty = cache->nr_dirty;
+		spin_unlock_irq(&cache->lock);
+
+		DMEMIT("%lu/%lu %lu %lu %lu %lu %lu %lu %lu %lu%s",
+		       nr_cached, cache->nr_cblocks,
+		       stats.read_hits, stats.read_misses,
+		       stats.write_hits, stats.write_misses,
+		       stats.promotions, stats.demotions,
+		       stats.writebacks, nr_dirty,
+		       cache->fail ? " fail" : "");
+		break;
+
+	case STATUSTYPE_TABLE:
+		DMEMIT("%s %s %s %llu %s %u", cache->metadata_dev->name,
+		       cache->cache_dev->name, cache->origin_dev->name,
+		       (unsigned long long) cache->block_size,
+		       cache->writeback ? "writeback" : "writethrough",
+		       cache->threshold);
+		break;
+	}
+
+	return 0;
+}
+
+static struct target_type cache_target = {
+	.name        = "cache",
+	.module      = THIS_MODULE,
+	.version     = {1, 0, 0},
+	.ctr         = cache_ctr,
+	.dtr         = cache_dtr,
+	.map         = cache_map,
+	.end_io      = cache_end_io,
+	.postsuspend = cache_postsuspend,
+	.resume      = cache_resume,
+	.status      = cache_status,
+};
+
+static int __init dm_cache_init(void)
+{
+	int r;
+
+	_io_cache = kmem_cache_create("dm-cache-io", sizeof(struct cache_io),
+				      __alignof__(struct cache_io),
+				      0, NULL, NULL);
+	if (!_io_cache) {
+		DMERR("Couldn't create io cache.");
+		return -ENOMEM;
+	}
+
+	r = dm_register_target(&cache_target);
+	if (r < 0) {
+		DMERR("register failed %d", r);
+		kmem_cache_destroy(_io_cache);
+	}
+
+	return r;
+}
+
+static void __exit dm_cache_exit(void)
+{
+	int r = dm_unregister_target(&cache_target);
+
+	if (r < 0)
+		DMERR("unregister failed %d", r);
+
+	kmem_cache_destroy(_io_cache);
+}
+
+module_init(dm_cache_init);
+module_exit(dm_cache_exit);
+
+MODULE_DESCRIPTION(DM_NAME " cache target");
+MODULE_LICENSE("GPL");
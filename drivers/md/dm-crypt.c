@@ -14,6 +14,8 @@
 #include <linux/slab.h>
 #include <linux/crypto.h>
 #include <linux/workqueue.h>
+#include <linux/kthread.h>
+#include <linux/wait.h>
 #include <asm/atomic.h>
 #include <linux/scatterlist.h>
 #include <asm/page.h>
@@ -48,6 +50,44 @@ struct convert_context {
 	int write;
 };
 
+/*
+ * An encrypted clone waiting for its fragments to be converted.
+ * Writes are submitted in the order they were queued.
+ */
+struct crypt_chunk {
+	struct list_head list;
+	struct crypt_io *io;
+	struct bio *clone;
+	struct work_struct work;	/* async: submitted from kcryptd */
+	atomic_t pending;
+	int error;
+	int done;
+};
+
+/*
+ * One sector handed to an asynchronous cipher, chunk is NULL for reads.
+ * The cipher's request context and then the IV follow req.
+ */
+struct crypt_req {
+	struct crypt_io *io;
+	struct crypt_chunk *chunk;
+	struct scatterlist sg_in;
+	struct scatterlist sg_out;
+	struct cipher_request req;
+};
+
+/*
+ * A range of sectors converted by one of the crypt workers, chunk is
+ * NULL for reads which are decrypted in place
+ */
+struct crypt_frag {
+	struct list_head list;
+	struct crypt_io *io;
+	struct crypt_chunk *chunk;
+	struct convert_context ctx;
+	unsigned int nr_sectors;
+};
+
 struct crypt_config;
 
 struct crypt_iv_operations {
@@ -73,6 +113,27 @@ struct crypt_config {
 	mempool_t *io_pool;
 	mempool_t *page_pool;
 
+	/*
+	 * optional pool of worker threads converting
+	 * fragments of bios in parallel
+	 */
+	unsigned int nr_workers;
+	struct task_struct **workers;
+	mempool_t *frag_pool;
+	mempool_t *chunk_pool;
+	spinlock_t frag_lock;
+	struct list_head frag_list;
+	wait_queue_head_t frag_wait;
+	struct list_head write_list;
+	int write_busy;
+
+	/*
+	 * requests for an asynchronous cipher,
+	 * NULL if the cipher is synchronous
+	 */
+	mempool_t *req_pool;
+	unsigned int req_iv_offset;
+
 	/*
 	 * crypto related data
 	 */
@@ -90,8 +151,16 @@ struct crypt_config {
 #define MIN_IOS        256
 #define MIN_POOL_PAGES 32
 #define MIN_BIO_PAGES  8
+#define MAX_WORKERS    64
+
+/*
+ * bios are only split between workers in pieces of at least this size
+ */
+#define MIN_FRAG_SECTORS 32
 
 static kmem_cache_t *_crypt_io_pool;
+static kmem_cache_t *_crypt_frag_pool;
+static kmem_cache_t *_crypt_chunk_pool;
 
 /*
  * Different IV generation algorithms:
@@ -256,15 +325,34 @@ crypt_convert_init(struct crypt_config *cc, struct convert_context *ctx,
 	ctx->write = write;
 }
 
+static void crypt_convert_advance(struct convert_context *ctx)
+{
+	ctx->offset_in += 1 << SECTOR_SHIFT;
+	if (ctx->offset_in >= bio_iovec_idx(ctx->bio_in, ctx->idx_in)->bv_len) {
+		ctx->offset_in = 0;
+		ctx->idx_in++;
+	}
+
+	ctx->offset_out += 1 << SECTOR_SHIFT;
+	if (ctx->offset_out >= bio_iovec_idx(ctx->bio_out, ctx->idx_out)->bv_len) {
+		ctx->offset_out = 0;
+		ctx->idx_out++;
+	}
+
+	ctx->sector++;
+}
+
 /*
- * Encrypt / decrypt data from one bio to another one (can be the same one)
+ * Encrypt / decrypt up to nr_sectors of data from one bio to another one
+ * (can be the same one)
  */
 static int crypt_convert(struct crypt_config *cc,
-                         struct convert_context *ctx)
+                         struct convert_context *ctx, unsigned int nr_sectors)
 {
 	int r = 0;
 
-	while(ctx->idx_in < ctx->bio_in->bi_vcnt &&
+	while(nr_sectors-- &&
+	      ctx->idx_in < ctx->bio_in->bi_vcnt &&
 	      ctx->idx_out < ctx->bio_out->bi_vcnt) {
 		struct bio_vec *bv_in = bio_iovec_idx(ctx->bio_in, ctx->idx_in);
 		struct bio_vec *bv_out = bio_iovec_idx(ctx->bio_out, ctx->idx_out);
@@ -279,29 +367,29 @@ static int crypt_convert(struct crypt_config *cc,
 			.length = 1 << SECTOR_SHIFT
 		};
 
-		ctx->offset_in += sg_in.length;
-		if (ctx->offset_in >= bv_in->bv_len) {
-			ctx->offset_in = 0;
-			ctx->idx_in++;
-		}
-
-		ctx->offset_out += sg_out.length;
-		if (ctx->offset_out >= bv_out->bv_len) {
-			ctx->offset_out = 0;
-			ctx->idx_out++;
-		}
-
 		r = crypt_convert_scatterlist(cc, &sg_out, &sg_in, sg_in.length,
 		                              ctx->write, ctx->sector);
 		if (r < 0)
 			break;
 
-		ctx->sector++;
+		crypt_convert_advance(ctx);
 	}
 
 	return r;
 }
 
+/*
+ * Move the context past nr_sectors without converting them
+ */
+static void crypt_convert_skip(struct convert_context *ctx,
+                               unsigned int nr_sectors)
+{
+	while(nr_sectors-- &&
+	      ctx->idx_in < ctx->bio_in->bi_vcnt &&
+	      ctx->idx_out < ctx->bio_out->bi_vcnt)
+		crypt_convert_advance(ctx);
+}
+
 /*
  * Generate a new unfragmented bio with the given size
  * This should never violate the device limitations
@@ -433,6 +521,361 @@ static void dec_pending(struct crypt_io *io, int error)
 	mempool_free(io, cc->io_pool);
 }
 
+/*
+ * Crypt workers:
+ *
+ * With the "workers" table option, bios are split into fragments of
+ * consecutive sectors which are converted by a pool of threads, so a
+ * single large bio keeps several CPUs busy.  The cipher is only used
+ * with an explicit IV, so a single tfm can be shared by all of them.
+ *
+ * Encrypted clones are put on write_list when they are queued and
+ * are submitted strictly in that order, whichever worker finishes
+ * first, so the underlying device sees the writes in the same order
+ * as it would without the workers.
+ */
+static void crypt_queue_frags(struct crypt_config *cc, struct crypt_io *io,
+                              struct crypt_chunk *chunk,
+                              struct convert_context *ctx,
+                              unsigned int nr_sectors)
+{
+	struct crypt_frag *frag, *next;
+	unsigned int n, i, per_frag;
+	gfp_t gfp_mask = GFP_NOIO;
+	LIST_HEAD(frags);
+
+	n = min(cc->nr_workers, max(nr_sectors / MIN_FRAG_SECTORS, 1U));
+
+	/*
+	 * Only the first fragment is guaranteed, if more cannot be
+	 * allocated without waiting the bio is split in fewer pieces.
+	 */
+	for (i = 0; i < n; i++) {
+		frag = mempool_alloc(cc->frag_pool, gfp_mask);
+		if (!frag)
+			break;
+		list_add_tail(&frag->list, &frags);
+		gfp_mask = GFP_NOWAIT;
+	}
+	n = i;
+	per_frag = (nr_sectors + n - 1) / n;
+
+	if (chunk)
+		atomic_set(&chunk->pending, n);
+	else
+		atomic_add(n, &io->pending);
+
+	spin_lock(&cc->frag_lock);
+	if (chunk)
+		list_add_tail(&chunk->list, &cc->write_list);
+	list_for_each_entry_safe(frag, next, &frags, list) {
+		frag->io = io;
+		frag->chunk = chunk;
+		frag->ctx = *ctx;
+		frag->nr_sectors = min(per_frag, nr_sectors);
+		crypt_convert_skip(ctx, frag->nr_sectors);
+		nr_sectors -= frag->nr_sectors;
+		list_move_tail(&frag->list, &cc->frag_list);
+	}
+	spin_unlock(&cc->frag_lock);
+
+	wake_up_nr(&cc->frag_wait, n);
+}
+
+static void crypt_submit_chunk(struct crypt_config *cc,
+                               struct crypt_chunk *chunk)
+{
+	struct crypt_io *io = chunk->io;
+	struct bio *clone = chunk->clone;
+	unsigned int size = clone->bi_size;
+	int error = chunk->error;
+
+	mempool_free(chunk, cc->chunk_pool);
+
+	if (error < 0) {
+		/* free the pages as crypt_endio would after completion */
+		clone->bi_size = 0;
+		crypt_free_buffer_pages(cc, clone, size);
+		bio_put(clone);
+		dec_pending(io, error);
+		return;
+	}
+
+	generic_make_request(clone);
+}
+
+/*
+ * Submit all the chunks at the head of write_list which are completely
+ * encrypted, only one worker at a time does this to keep them in order.
+ */
+static void crypt_chunk_done(struct crypt_config *cc,
+                             struct crypt_chunk *chunk)
+{
+	spin_lock(&cc->frag_lock);
+	chunk->done = 1;
+	if (cc->write_busy) {
+		spin_unlock(&cc->frag_lock);
+		return;
+	}
+
+	cc->write_busy = 1;
+	while (!list_empty(&cc->write_list)) {
+		chunk = list_entry(cc->write_list.next,
+		                   struct crypt_chunk, list);
+		if (!chunk->done)
+			break;
+		list_del(&chunk->list);
+		spin_unlock(&cc->frag_lock);
+
+		crypt_submit_chunk(cc, chunk);
+
+		spin_lock(&cc->frag_lock);
+	}
+	cc->write_busy = 0;
+	spin_unlock(&cc->frag_lock);
+}
+
+static void crypt_do_frag(struct crypt_config *cc, struct crypt_frag *frag)
+{
+	struct crypt_io *io = frag->io;
+	struct crypt_chunk *chunk = frag->chunk;
+	int r;
+
+	r = crypt_convert(cc, &frag->ctx, frag->nr_sectors);
+	mempool_free(frag, cc->frag_pool);
+
+	if (!chunk) {
+		dec_pending(io, r);
+		return;
+	}
+
+	if (r < 0)
+		chunk->error = r;
+	if (atomic_dec_and_test(&chunk->pending))
+		crypt_chunk_done(cc, chunk);
+}
+
+static int crypt_worker_thread(void *data)
+{
+	struct crypt_config *cc = (struct crypt_config *) data;
+	struct crypt_frag *frag;
+	DEFINE_WAIT(wait);
+
+	while (!kthread_should_stop()) {
+		prepare_to_wait_exclusive(&cc->frag_wait, &wait,
+		                          TASK_INTERRUPTIBLE);
+		if (list_empty(&cc->frag_list) && !kthread_should_stop())
+			schedule();
+		finish_wait(&cc->frag_wait, &wait);
+		try_to_freeze();
+
+		spin_lock(&cc->frag_lock);
+		while (!list_empty(&cc->frag_list)) {
+			frag = list_entry(cc->frag_list.next,
+			                  struct crypt_frag, list);
+			list_del(&frag->list);
+			spin_unlock(&cc->frag_lock);
+
+			crypt_do_frag(cc, frag);
+			cond_resched();
+
+			spin_lock(&cc->frag_lock);
+		}
+		spin_unlock(&cc->frag_lock);
+	}
+
+	return 0;
+}
+
+static void crypt_stop_workers(struct crypt_config *cc)
+{
+	unsigned int i;
+
+	if (!cc->workers)
+		return;
+
+	for (i = 0; i < cc->nr_workers; i++)
+		if (cc->workers[i])
+			kthread_stop(cc->workers[i]);
+	kfree(cc->workers);
+	cc->workers = NULL;
+
+	if (cc->chunk_pool)
+		mempool_destroy(cc->chunk_pool);
+	if (cc->frag_pool)
+		mempool_destroy(cc->frag_pool);
+}
+
+static int crypt_start_workers(struct crypt_config *cc, struct dm_target *ti)
+{
+	unsigned int i;
+
+	INIT_LIST_HEAD(&cc->frag_list);
+	init_waitqueue_head(&cc->frag_wait);
+
+	cc->workers = kzalloc(cc->nr_workers * sizeof(*cc->workers),
+	                      GFP_KERNEL);
+	if (!cc->workers) {
+		ti->error = "Cannot allocate crypt workers";
+		return -ENOMEM;
+	}
+
+	cc->frag_pool = mempool_create_slab_pool(MIN_IOS, _crypt_frag_pool);
+	cc->chunk_pool = mempool_create_slab_pool(MIN_IOS, _crypt_chunk_pool);
+	if (!cc->frag_pool || !cc->chunk_pool) {
+		ti->error = "Cannot allocate crypt worker mempools";
+		goto bad;
+	}
+
+	for (i = 0; i < cc->nr_workers; i++) {
+		cc->workers[i] = kthread_run(crypt_worker_thread, cc,
+		                             "kcryptd_%u", i);
+		if (IS_ERR(cc->workers[i])) {
+			cc->workers[i] = NULL;
+			ti->error = "Cannot start crypt worker thread";
+			goto bad;
+		}
+	}
+
+	return 0;
+
+bad:
+	crypt_stop_workers(cc);
+	return -ENOMEM;
+}
+
+/*
+ * Asynchronous ciphers:
+ *
+ * When the cipher is driven by a hardware engine, every sector is
+ * submitted as a request of its own and converted while the next ones
+ * are set up.  Reads complete the io from the last completion, writes
+ * go through write_list as with the workers, but are submitted from
+ * kcryptd since the completions may come in softirq context.
+ */
+static void kcryptd_queue_chunk(struct crypt_chunk *chunk);
+
+static void crypt_req_done(struct crypt_config *cc, struct crypt_req *creq,
+                           int error)
+{
+	struct crypt_io *io = creq->io;
+	struct crypt_chunk *chunk = creq->chunk;
+
+	mempool_free(creq, cc->req_pool);
+
+	if (!chunk) {
+		dec_pending(io, error);
+		return;
+	}
+
+	if (error < 0)
+		chunk->error = error;
+	if (atomic_dec_and_test(&chunk->pending))
+		kcryptd_queue_chunk(chunk);
+}
+
+static void crypt_async_done(struct crypto_async_request *req, int error)
+{
+	struct crypt_req *creq = req->data;
+	struct crypt_config *cc = (struct crypt_config *) creq->io->target->private;
+
+	crypt_req_done(cc, creq, error);
+}
+
+/*
+ * Hand up to nr_sectors to an asynchronous cipher, one request per
+ * sector.  Each holds a reference on the io, or for writes on the
+ * chunk, until it completes, which may be before it is submitted.
+ */
+static void crypt_convert_async(struct crypt_config *cc,
+                                struct convert_context *ctx,
+                                struct crypt_io *io, struct crypt_chunk *chunk,
+                                unsigned int nr_sectors)
+{
+	while(nr_sectors-- &&
+	      ctx->idx_in < ctx->bio_in->bi_vcnt &&
+	      ctx->idx_out < ctx->bio_out->bi_vcnt) {
+		struct bio_vec *bv_in = bio_iovec_idx(ctx->bio_in, ctx->idx_in);
+		struct bio_vec *bv_out = bio_iovec_idx(ctx->bio_out, ctx->idx_out);
+		struct crypt_req *creq;
+		u8 *iv = NULL;
+		int r = 0;
+
+		creq = mempool_alloc(cc->req_pool, GFP_NOIO);
+		creq->io = io;
+		creq->chunk = chunk;
+		creq->sg_in.page = bv_in->bv_page;
+		creq->sg_in.offset = bv_in->bv_offset + ctx->offset_in;
+		creq->sg_in.length = 1 << SECTOR_SHIFT;
+		creq->sg_out.page = bv_out->bv_page;
+		creq->sg_out.offset = bv_out->bv_offset + ctx->offset_out;
+		creq->sg_out.length = 1 << SECTOR_SHIFT;
+
+		if (cc->iv_size) {
+			iv = (u8 *)creq + cc->req_iv_offset;
+			if (cc->iv_gen_ops)
+				r = cc->iv_gen_ops->generator(cc, iv, ctx->sector);
+			else
+				memset(iv, 0, cc->iv_size);
+		}
+
+		crypto_request_init(&creq->req.base, cc->tfm,
+		                    crypt_async_done, creq);
+		creq->req.dst = &creq->sg_out;
+		creq->req.src = &creq->sg_in;
+		creq->req.nbytes = 1 << SECTOR_SHIFT;
+		creq->req.iv = iv;
+
+		if (chunk)
+			atomic_inc(&chunk->pending);
+		else
+			atomic_inc(&io->pending);
+
+		if (r >= 0) {
+			if (ctx->write)
+				r = crypto_cipher_encrypt_async(&creq->req);
+			else
+				r = crypto_cipher_decrypt_async(&creq->req);
+		}
+		if (r != -EINPROGRESS)
+			crypt_req_done(cc, creq, r);
+
+		crypt_convert_advance(ctx);
+	}
+}
+
+static int crypt_start_async(struct crypt_config *cc, struct dm_target *ti)
+{
+	cc->req_iv_offset = ALIGN(offsetof(struct crypt_req, req) +
+	                          crypto_cipher_reqsize(cc->tfm),
+	                          __alignof__(u64));
+	cc->req_pool = mempool_create_kmalloc_pool(MIN_IOS,
+	                                           cc->req_iv_offset +
+	                                           cc->iv_size);
+	cc->chunk_pool = mempool_create_slab_pool(MIN_IOS, _crypt_chunk_pool);
+	if (!cc->req_pool || !cc->chunk_pool) {
+		ti->error = "Cannot allocate crypt request mempools";
+		if (cc->chunk_pool)
+			mempool_destroy(cc->chunk_pool);
+		if (cc->req_pool)
+			mempool_destroy(cc->req_pool);
+		cc->req_pool = NULL;
+		return -ENOMEM;
+	}
+
+	return 0;
+}
+
+static void crypt_stop_async(struct crypt_config *cc)
+{
+	if (!cc->req_pool)
+		return;
+
+	mempool_destroy(cc->chunk_pool);
+	mempool_destroy(cc->req_pool);
+	cc->req_pool = NULL;
+}
+
 /*
  * kcryptd:
  *
@@ -451,7 +894,20 @@ static void kcryptd_do_work(void *data)
 
 	crypt_convert_init(cc, &ctx, io->bio, io->bio,
 	                   io->bio->bi_sector - io->target->begin, 0);
-	r = crypt_convert(cc, &ctx);
+
+	if (cc->nr_workers) {
+		crypt_queue_frags(cc, io, NULL, &ctx, bio_sectors(io->bio));
+		dec_pending(io, 0);
+		return;
+	}
+
+	if (cc->req_pool) {
+		crypt_convert_async(cc, &ctx, io, NULL, bio_sectors(io->bio));
+		dec_pending(io, 0);
+		return;
+	}
+
+	r = crypt_convert(cc, &ctx, bio_sectors(io->bio));
 
 	dec_pending(io, r);
 }
@@ -462,6 +918,20 @@ static void kcryptd_queue_io(struct crypt_io *io)
 	queue_work(_kcryptd_workqueue, &io->work);
 }
 
+static void kcryptd_do_chunk(void *data)
+{
+	struct crypt_chunk *chunk = (struct crypt_chunk *) data;
+	struct crypt_config *cc = (struct crypt_config *) chunk->io->target->private;
+
+	crypt_chunk_done(cc, chunk);
+}
+
+static void kcryptd_queue_chunk(struct crypt_chunk *chunk)
+{
+	INIT_WORK(&chunk->work, kcryptd_do_chunk, chunk);
+	queue_work(_kcryptd_workqueue, &chunk->work);
+}
+
 /*
  * Decode key from its hex representation
  */
@@ -503,9 +973,38 @@ static void crypt_encode_key(char *hex, u8 *key, unsigned int size)
 	}
 }
 
+/*
+ * Parse the optional parameters:
+ * <#opt_params> [workers <n>]
+ */
+static int crypt_parse_opts(struct dm_target *ti, unsigned int argc,
+                            char **argv, unsigned int *nr_workers)
+{
+	unsigned int nr_opts, i;
+
+	if (sscanf(argv[0], "%u", &nr_opts) != 1 || nr_opts != argc - 1) {
+		ti->error = "Invalid number of optional parameters";
+		return -EINVAL;
+	}
+
+	for (i = 1; i < argc; i += 2) {
+		if (strcmp(argv[i], "workers") != 0 || i + 1 >= argc) {
+			ti->error = "Invalid optional parameter";
+			return -EINVAL;
+		}
+		if (sscanf(argv[i + 1], "%u", nr_workers) != 1 ||
+		    *nr_workers > MAX_WORKERS) {
+			ti->error = "Invalid number of workers";
+			return -EINVAL;
+		}
+	}
+
+	return 0;
+}
+
 /*
  * Construct an encryption mapping:
- * <cipher> <key> <iv_offset> <dev_path> <start>
+ * <cipher> <key> <iv_offset> <dev_path> <start> [<#opt_params> <opt_params>]
  */
 static int crypt_ctr(struct dm_target *ti, unsigned int argc, char **argv)
 {
@@ -518,13 +1017,17 @@ static int crypt_ctr(struct dm_target *ti, unsigned int argc, char **argv)
 	char *ivopts;
 	unsigned int crypto_flags;
 	unsigned int key_size;
+	unsigned int nr_workers = 0;
 	unsigned long long tmpll;
 
-	if (argc != 5) {
+	if (argc < 5) {
 		ti->error = "Not enough arguments";
 		return -EINVAL;
 	}
 
+	if (argc > 5 && crypt_parse_opts(ti, argc - 5, argv + 5, &nr_workers))
+		return -EINVAL;
+
 	tmp = argv[0];
 	cipher = strsep(&tmp, "-");
 	chainmode = strsep(&tmp, "-");
@@ -544,6 +1047,12 @@ static int crypt_ctr(struct dm_target *ti, unsigned int argc, char **argv)
 	}
 
 	cc->key_size = key_size;
+	cc->nr_workers = nr_workers;
+	cc->workers = NULL;
+	cc->req_pool = NULL;
+	spin_lock_init(&cc->frag_lock);
+	INIT_LIST_HEAD(&cc->write_list);
+	cc->write_busy = 0;
 	if ((!key_size && strcmp(argv[1], "-") != 0) ||
 	    (key_size && crypt_decode_key(cc->key, argv[1], key_size) < 0)) {
 		ti->error = "Error decoding key";
@@ -571,7 +1080,8 @@ static int crypt_ctr(struct dm_target *ti, unsigned int argc, char **argv)
 		goto bad1;
 	}
 
-	tfm = crypto_alloc_tfm(cipher, crypto_flags | CRYPTO_TFM_REQ_MAY_SLEEP);
+	tfm = crypto_alloc_tfm(cipher, crypto_flags | CRYPTO_TFM_REQ_MAY_SLEEP |
+	                               CRYPTO_TFM_REQ_ASYNC);
 	if (!tfm) {
 		ti->error = "Error allocating crypto tfm";
 		goto bad1;
@@ -664,9 +1174,24 @@ static int crypt_ctr(struct dm_target *ti, unsigned int argc, char **argv)
 	} else
 		cc->iv_mode = NULL;
 
+	if (crypto_tfm_alg_async(tfm)) {
+		/* the engine does the work in parallel already */
+		if (cc->nr_workers)
+			DMWARN("Workers not used with an asynchronous cipher");
+		cc->nr_workers = 0;
+		if (crypt_start_async(cc, ti) < 0)
+			goto bad6;
+	}
+
+	if (cc->nr_workers && crypt_start_workers(cc, ti) < 0)
+		goto bad6;
+
 	ti->private = cc;
 	return 0;
 
+bad6:
+	kfree(cc->iv_mode);
+	dm_put_device(ti, cc->dev);
 bad5:
 	mempool_destroy(cc->page_pool);
 bad4:
@@ -687,6 +1212,8 @@ static void crypt_dtr(struct dm_target *ti)
 {
 	struct crypt_config *cc = (struct crypt_config *) ti->private;
 
+	crypt_stop_workers(cc);
+	crypt_stop_async(cc);
 	mempool_destroy(cc->page_pool);
 	mempool_destroy(cc->io_pool);
 
@@ -742,9 +1269,13 @@ crypt_clone(struct crypt_config *cc, struct crypt_io *io, struct bio *bio,
 	if (bio_data_dir(bio) == WRITE) {
 		clone = crypt_alloc_buffer(cc, bio->bi_size,
                                  io->first_clone, bvec_idx);
-		if (clone) {
+		/*
+		 * with workers or an asynchronous cipher
+		 * the clone is encrypted by crypt_map
+		 */
+		if (clone && !cc->nr_workers && !cc->req_pool) {
 			ctx->bio_out = clone;
-			if (crypt_convert(cc, ctx) < 0) {
+			if (crypt_convert(cc, ctx, bio_sectors(clone)) < 0) {
 				crypt_free_buffer_pages(cc, clone,
 				                        clone->bi_size);
 				bio_put(clone);
@@ -822,7 +1353,34 @@ static int crypt_map(struct dm_target *ti, struct bio *bio,
 		remaining -= clone->bi_size;
 		sector += bio_sectors(clone);
 
-		generic_make_request(clone);
+		if ((cc->nr_workers || cc->req_pool) &&
+		    bio_data_dir(bio) == WRITE) {
+			struct crypt_chunk *chunk;
+
+			chunk = mempool_alloc(cc->chunk_pool, GFP_NOIO);
+			chunk->io = io;
+			chunk->clone = clone;
+			chunk->error = 0;
+			chunk->done = 0;
+
+			ctx.bio_out = clone;
+			if (cc->nr_workers)
+				crypt_queue_frags(cc, io, chunk, &ctx,
+				                  bio_sectors(clone));
+			else {
+				/* hold it until all its sectors are submitted */
+				atomic_set(&chunk->pending, 1);
+				spin_lock(&cc->frag_lock);
+				list_add_tail(&chunk->list, &cc->write_list);
+				spin_unlock(&cc->frag_lock);
+
+				crypt_convert_async(cc, &ctx, io, chunk,
+				                    bio_sectors(clone));
+				if (atomic_dec_and_test(&chunk->pending))
+					crypt_chunk_done(cc, chunk);
+			}
+		} else
+			generic_make_request(clone);
 
 		/* out of memory -> run queues */
 		if (remaining)
@@ -890,6 +1448,9 @@ static int crypt_status(struct dm_target *ti, status_type_t type,
 
 		DMEMIT(" %llu %s %llu", (unsigned long long)cc->iv_offset,
 				cc->dev->name, (unsigned long long)cc->start);
+
+		if (cc->nr_workers)
+			DMEMIT(" 2 workers %u", cc->nr_workers);
 		break;
 	}
 	return 0;
@@ -897,7 +1458,7 @@ static int crypt_status(struct dm_target *ti, status_type_t type,
 
 static struct target_type crypt_target = {
 	.name   = "crypt",
-	.version= {1, 1, 0},
+	.version= {1, 2, 0},
 	.module = THIS_MODULE,
 	.ctr    = crypt_ctr,
 	.dtr    = crypt_dtr,
@@ -915,6 +1476,17 @@ static int __init dm_crypt_init(void)
 	if (!_crypt_io_pool)
 		return -ENOMEM;
 
+	_crypt_frag_pool = kmem_cache_create("dm-crypt_frag",
+	                                     sizeof(struct crypt_frag),
+	                                     0, 0, NULL, NULL);
+	_crypt_chunk_pool = kmem_cache_create("dm-crypt_chunk",
+	                                      sizeof(struct crypt_chunk),
+	                                      0, 0, NULL, NULL);
+	if (!_crypt_frag_pool || !_crypt_chunk_pool) {
+		r = -ENOMEM;
+		goto bad1;
+	}
+
 	_kcryptd_workqueue = create_workqueue("kcryptd");
 	if (!_kcryptd_workqueue) {
 		r = -ENOMEM;
@@ -933,6 +1505,10 @@ static int __init dm_crypt_init(void)
 bad2:
 	destroy_workqueue(_kcryptd_workqueue);
 bad1:
+	if (_crypt_chunk_pool)
+		kmem_cache_destroy(_crypt_chunk_pool);
+	if (_crypt_frag_pool)
+		kmem_cache_destroy(_crypt_frag_pool);
 	kmem_cache_destroy(_crypt_io_pool);
 	return r;
 }
@@ -945,6 +1521,8 @@ static void __exit dm_crypt_exit(void)
 		DMERR("unregister failed %d", r);
 
 	destroy_workqueue(_kcryptd_workqueue);
+	kmem_cache_destroy(_crypt_chunk_pool);
+	kmem_cache_destroy(_crypt_frag_pool);
 	kmem_cache_destroy(_crypt_io_pool);
 }
 
@@ -70,7 +70,7 @@ struct multipath {
 	struct pgpath *current_pgpath;
 	struct priority_group *current_pg;
 	struct priority_group *next_pg;	/* Switch to this PG if set */
-	unsigned repeat_count;		/* I/Os left before calling PS again */
+	atomic_t repeat_count;		/* I/Os left before calling PS again */
 
 	unsigned queue_io;		/* Must we queue all I/O? */
 	unsigned queue_if_no_path;	/* Queue I/O if last path fails? */
@@ -94,6 +94,7 @@ struct multipath {
  */
 struct mpath_io {
 	struct pgpath *pgpath;
+	size_t nr_bytes;
 	struct dm_bio_details details;
 };
 
@@ -233,15 +234,22 @@ static void __switch_pg(struct multipath *m, struct pgpath *pgpath)
 static int __choose_path_in_pg(struct multipath *m, struct priority_group *pg)
 {
 	struct path *path;
+	struct pgpath *pgpath;
+	unsigned repeat_count;
 
-	path = pg->ps.type->select_path(&pg->ps, &m->repeat_count);
+	path = pg->ps.type->select_path(&pg->ps, &repeat_count);
 	if (!path)
 		return -ENXIO;
 
-	m->current_pgpath = path_to_pgpath(path);
+	pgpath = path_to_pgpath(path);
 
 	if (m->current_pg != pg)
-		__switch_pg(m, m->current_pgpath);
+		__switch_pg(m, pgpath);
+
+	/* map_io() may look at queue_io once it sees the new path */
+	atomic_set(&m->repeat_count, repeat_count);
+	smp_wmb();
+	m->current_pgpath = pgpath;
 
 	return 0;
 }
@@ -285,18 +293,42 @@ failed:
 	m->current_pg = NULL;
 }
 
+/*
+ * Uses up one of the current path's repeat count, unless it is the
+ * last one.  A count of 0 never runs out.
+ */
+static inline int repeat_count_left(struct multipath *m)
+{
+	return atomic_read(&m->repeat_count) <= 0 ||
+	       atomic_add_unless(&m->repeat_count, -1, 1);
+}
+
 static int map_io(struct multipath *m, struct bio *bio, struct mpath_io *mpio,
 		  unsigned was_queued)
 {
 	int r = 1;
 	unsigned long flags;
 	struct pgpath *pgpath;
+	struct path_selector *ps;
+
+	/*
+	 * While the current path lasts, bios take it without the lock.
+	 * A path failed meanwhile only gets the bios already past
+	 * this check, which fail over as usual.
+	 */
+	pgpath = m->current_pgpath;
+	smp_rmb();
+	if (!was_queued && pgpath && !m->queue_io && repeat_count_left(m))
+		goto mapped;
+
+	mpio->pgpath = NULL;
 
 	spin_lock_irqsave(&m->lock, flags);
 
 	/* Do we need to select a new pgpath? */
 	if (!m->current_pgpath ||
-	    (!m->queue_io && (m->repeat_count && --m->repeat_count == 0)))
+	    (!m->queue_io && atomic_read(&m->repeat_count) > 0 &&
+	     atomic_dec_and_test(&m->repeat_count)))
 		__choose_pgpath(m);
 
 	pgpath = m->current_pgpath;
@@ -312,16 +344,23 @@ static int map_io(struct multipath *m, struct bio *bio, struct mpath_io *mpio,
 		if ((m->pg_init_required && !m->pg_init_in_progress) ||
 		    !m->queue_io)
 			queue_work(kmultipathd, &m->process_queued_ios);
-		pgpath = NULL;
 		r = 0;
 	} else if (!pgpath)
 		r = -EIO;		/* Failed */
-	else
-		bio->bi_bdev = pgpath->path.dev->bdev;
 
+	spin_unlock_irqrestore(&m->lock, flags);
+
+	if (r != 1)
+		return r;
+
+      mapped:
+	bio->bi_bdev = pgpath->path.dev->bdev;
 	mpio->pgpath = pgpath;
+	mpio->nr_bytes = bio->bi_size;
 
-	spin_unlock_irqrestore(&m->lock, flags);
+	ps = &pgpath->pg->ps;
+	if (ps->type->start_io)
+		ps->type->start_io(ps, &pgpath->path, mpio->nr_bytes);
 
 	return r;
 }
@@ -1063,7 +1102,7 @@ static int multipath_end_io(struct dm_target *ti, struct bio *bio,
 	if (pgpath) {
 		ps = &pgpath->pg->ps;
 		if (ps->type->end_io)
-			ps->type->end_io(ps, &pgpath->path);
+			ps->type->end_io(ps, &pgpath->path, mpio->nr_bytes);
 	}
 	if (r <= 0)
 		mempool_free(mpio, m->mpio_pool);
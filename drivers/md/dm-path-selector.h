@@ -75,7 +75,14 @@ struct path_selector_type {
 	int (*status) (struct path_selector *ps, struct path *path,
 		       status_type_t type, char *result, unsigned int maxlen);
 
-	int (*end_io) (struct path_selector *ps, struct path *path);
+	/*
+	 * Called as each io is sent down a path and as it completes,
+	 * without the multipath lock held.
+	 */
+	int (*start_io) (struct path_selector *ps, struct path *path,
+			 size_t nr_bytes);
+	int (*end_io) (struct path_selector *ps, struct path *path,
+		       size_t nr_bytes);
 };
 
 /* Register a path selector */
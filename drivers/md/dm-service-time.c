@@ -0,0 +1,341 @@
+/*
+ * This file is released under the GPL.
+ *
+ * Service-time path selector: sends each io down the valid path that
+ * should complete it first, judging by the bytes already in flight
+ * on each path and the throughput each path has been seen to give.
+ */
+
+#include "dm.h"
+#include "dm-path-selector.h"
+
+#include <linux/slab.h>
+#include <linux/spinlock.h>
+#include <linux/ktime.h>
+#include <asm/div64.h>
+
+#define DM_MSG_PREFIX "multipath service-time"
+
+/*-----------------------------------------------------------------
+ * Path-handling code, paths are held in lists
+ *---------------------------------------------------------------*/
+struct path_info {
+	struct list_head list;
+	struct path *path;
+	unsigned repeat_count;
+
+	spinlock_t lock;
+	unsigned in_flight;		/* ios */
+	u64 in_flight_size;		/* bytes */
+
+	/*
+	 * Throughput is measured over the time the path had ios in
+	 * flight, so an idle path does not look slow.
+	 */
+	u64 busy_since;			/* ns, while in_flight */
+	u64 busy_ns;			/* busy time of this sample */
+	u64 done_bytes;			/* bytes completed in this sample */
+	unsigned throughput;		/* KB/s, 0 until first sample */
+};
+
+static void free_paths(struct list_head *paths)
+{
+	struct path_info *pi, *next;
+
+	list_for_each_entry_safe(pi, next, paths, list) {
+		list_del(&pi->list);
+		kfree(pi);
+	}
+}
+
+/*-----------------------------------------------------------------
+ * Service-time selector
+ *---------------------------------------------------------------*/
+
+#define ST_MIN_IO		1
+#define ST_SAMPLE_NS		(100 * NSEC_PER_MSEC)
+
+struct selector {
+	struct list_head valid_paths;
+	struct list_head failed_paths;
+};
+
+static struct selector *alloc_selector(void)
+{
+	struct selector *s = kmalloc(sizeof(*s), GFP_KERNEL);
+
+	if (s) {
+		INIT_LIST_HEAD(&s->valid_paths);
+		INIT_LIST_HEAD(&s->failed_paths);
+	}
+
+	return s;
+}
+
+static int st_create(struct path_selector *ps, unsigned argc, char **argv)
+{
+	struct selector *s;
+
+	s = alloc_selector();
+	if (!s)
+		return -ENOMEM;
+
+	ps->context = s;
+	return 0;
+}
+
+static void st_destroy(struct path_selector *ps)
+{
+	struct selector *s = (struct selector *) ps->context;
+
+	free_paths(&s->valid_paths);
+	free_paths(&s->failed_paths);
+	kfree(s);
+	ps->context = NULL;
+}
+
+static int st_status(struct path_selector *ps, struct path *path,
+		     status_type_t type, char *result, unsigned int maxlen)
+{
+	struct path_info *pi;
+	unsigned long flags;
+	u64 size;
+	unsigned throughput;
+	int sz = 0;
+
+	if (!path)
+		DMEMIT("0 ");
+	else {
+		pi = path->pscontext;
+		switch(type) {
+		case STATUSTYPE_INFO:
+			spin_lock_irqsave(&pi->lock, flags);
+			size = pi->in_flight_size;
+			throughput = pi->throughput;
+			spin_unlock_irqrestore(&pi->lock, flags);
+			DMEMIT("%llu %u ", (unsigned long long) size,
+			       throughput);
+			break;
+		case STATUSTYPE_TABLE:
+			DMEMIT("%u ", pi->repeat_count);
+			break;
+		}
+	}
+
+	return sz;
+}
+
+/*
+ * Called during initialisation to register each path with an
+ * optional repeat_count.
+ */
+static int st_add_path(struct path_selector *ps, struct path *path,
+		       int argc, char **argv, char **error)
+{
+	struct selector *s = (struct selector *) ps->context;
+	struct path_info *pi;
+	unsigned repeat_count = ST_MIN_IO;
+
+	if (argc > 1) {
+		*error = "service-time ps: incorrect number of arguments";
+		return -EINVAL;
+	}
+
+	/* First path argument is number of I/Os before switching path */
+	if ((argc == 1) && (sscanf(argv[0], "%u", &repeat_count) != 1)) {
+		*error = "service-time ps: invalid repeat count";
+		return -EINVAL;
+	}
+
+	pi = kzalloc(sizeof(*pi), GFP_KERNEL);
+	if (!pi) {
+		*error = "service-time ps: Error allocating path context";
+		return -ENOMEM;
+	}
+
+	pi->path = path;
+	pi->repeat_count = repeat_count;
+	spin_lock_init(&pi->lock);
+
+	path->pscontext = pi;
+
+	list_add_tail(&pi->list, &s->valid_paths);
+
+	return 0;
+}
+
+static void st_fail_path(struct path_selector *ps, struct path *p)
+{
+	struct selector *s = (struct selector *) ps->context;
+	struct path_info *pi = p->pscontext;
+
+	list_move(&pi->list, &s->failed_paths);
+}
+
+static int st_reinstate_path(struct path_selector *ps, struct path *p)
+{
+	struct selector *s = (struct selector *) ps->context;
+	struct path_info *pi = p->pscontext;
+
+	list_move_tail(&pi->list, &s->valid_paths);
+
+	return 0;
+}
+
+/*
+ * The estimated service time of an io on a path is
+ * (in_flight_size + 1) / throughput.  Paths not measured yet are
+ * credited with the best throughput seen on any path, so that they
+ * get tried.  Among equals the path used longest ago wins.
+ */
+static struct path *st_select_path(struct path_selector *ps,
+				   unsigned *repeat_count)
+{
+	struct selector *s = (struct selector *) ps->context;
+	struct path_info *pi, *best = NULL;
+	u64 size, best_size = 0;
+	unsigned tp, best_tp = 0, max_tp = 1;
+	unsigned long flags;
+
+	list_for_each_entry(pi, &s->valid_paths, list)
+		if (pi->throughput > max_tp)
+			max_tp = pi->throughput;
+
+	list_for_each_entry(pi, &s->valid_paths, list) {
+		spin_lock_irqsave(&pi->lock, flags);
+		size = pi->in_flight_size + 1;
+		tp = pi->throughput ? : max_tp;
+		spin_unlock_irqrestore(&pi->lock, flags);
+
+		if (!best || size * best_tp < best_size * tp) {
+			best = pi;
+			best_size = size;
+			best_tp = tp;
+		}
+	}
+
+	if (!best)
+		return NULL;
+
+	list_move_tail(&best->list, &s->valid_paths);
+	*repeat_count = best->repeat_count;
+
+	return best->path;
+}
+
+static u64 st_now(void)
+{
+	struct timespec ts;
+
+	ktime_get_ts(&ts);
+	return timespec_to_ns(&ts);
+}
+
+static int st_start_io(struct path_selector *ps, struct path *path,
+		       size_t nr_bytes)
+{
+	struct path_info *pi = path->pscontext;
+	unsigned long flags;
+
+	spin_lock_irqsave(&pi->lock, flags);
+	if (!pi->in_flight++)
+		pi->busy_since = st_now();
+	pi->in_flight_size += nr_bytes;
+	spin_unlock_irqrestore(&pi->lock, flags);
+
+	return 0;
+}
+
+/*
+ * Folds a sample into the throughput, a moving average weighing the
+ * last sample by a quarter.
+ */
+static void st_update_throughput(struct path_info *pi)
+{
+	u64 bytes = pi->done_bytes, ns = pi->busy_ns;
+	unsigned sample;
+
+	while (ns > 0xffffffffULL) {
+		ns >>= 1;
+		bytes >>= 1;
+	}
+
+	bytes *= NSEC_PER_SEC >> 10;
+	do_div(bytes, (u32) ns);
+	sample = bytes > UINT_MAX ? UINT_MAX : (unsigned) bytes;
+	if (!sample)
+		sample = 1;
+
+	if (pi->throughput)
+		pi->throughput = pi->throughput - (pi->throughput >> 2) +
+				 (sample >> 2);
+	else
+		pi->throughput = sample;
+
+	pi->busy_ns = 0;
+	pi->done_bytes = 0;
+}
+
+static int st_end_io(struct path_selector *ps, struct path *path,
+		     size_t nr_bytes)
+{
+	struct path_info *pi = path->pscontext;
+	unsigned long flags;
+	u64 now = st_now();
+
+	spin_lock_irqsave(&pi->lock, flags);
+	if (now > pi->busy_since)
+		pi->busy_ns += now - pi->busy_since;
+	pi->busy_since = now;
+	pi->in_flight--;
+	pi->in_flight_size -= nr_bytes;
+	pi->done_bytes += nr_bytes;
+
+	if (pi->busy_ns >= ST_SAMPLE_NS)
+		st_update_throughput(pi);
+	spin_unlock_irqrestore(&pi->lock, flags);
+
+	return 0;
+}
+
+static struct path_selector_type st_ps = {
+	.name = "service-time",
+	.module = THIS_MODULE,
+	.table_args = 1,
+	.info_args = 2,
+	.create = st_create,
+	.destroy = st_destroy,
+	.status = st_status,
+	.add_path = st_add_path,
+	.fail_path = st_fail_path,
+	.reinstate_path = st_reinstate_path,
+	.select_path = st_select_path,
+	.start_io = st_start_io,
+	.end_io = st_end_io,
+};
+
+static int __init dm_st_init(void)
+{
+	int r = dm_register_path_selector(&st_ps);
+
+	if (r < 0)
+		DMERR("register failed %d", r);
+
+	DMINFO("version 1.0.0 loaded");
+
+	return r;
+}
+
+static void __exit dm_st_exit(void)
+{
+	int r = dm_unregister_path_selector(&st_ps);
+
+	if (r < 0)
+		DMERR("service-time: unregister failed %d", r);
+}
+
+module_init(dm_st_init);
+module_exit(dm_st_exit);
+
+MODULE_DESCRIPTION(DM_NAME " service-time multipath path selector");
+MODULE_LICENSE("GPL");
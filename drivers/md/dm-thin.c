@@ -0,0 +1,1815 @@
+/*
+ * dm-thin.c
+ *
+ * Thin provisioning: thin devices and snapshots sharing the blocks of
+ * one data device.
+ *
+ * This file is released under the GPL.
+ */
+
+#include <linux/blkdev.h>
+#include <linux/bitmap.h>
+#include <linux/crc32.h>
+#include <linux/device-mapper.h>
+#include <linux/fs.h>
+#include <linux/init.h>
+#include <linux/list.h>
+#include <linux/mm.h>
+#include <linux/module.h>
+#include <linux/mutex.h>
+#include <linux/rbtree.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/workqueue.h>
+
+#include "dm.h"
+#include "dm-bio-list.h"
+#include "dm-io.h"
+#include "kcopyd.h"
+
+#define DM_MSG_PREFIX "thin"
+
+#define MESG_STR(x) x, sizeof(x)
+
+/*
+ * Metadata layout: a superblock in the first sector, then two areas
+ * that take turns holding the mapping image.  A commit writes the new
+ * image into the area the superblock does not point at, and only then
+ * the superblock, so a crash leaves the last commit intact.
+ */
+#define THIN_METADATA_MAGIC	0x6e696874	/* "thin" */
+#define THIN_METADATA_VERSION	1
+#define THIN_SUPER_SECTORS	8
+
+/*
+ * Data block size limits, in sectors
+ */
+#define THIN_MIN_BLOCK_SIZE	(PAGE_SIZE >> 9)
+#define THIN_MAX_BLOCK_SIZE	4096
+
+/*
+ * Provisioned blocks reach the metadata at least this often
+ */
+#define THIN_COMMIT_PERIOD	HZ
+
+/*
+ * Each pool reserves this many pages for breaking sharing
+ */
+#define THIN_COPY_PAGES		256
+
+struct thin_disk_super {
+	__le32 magic;
+	__le32 csum;		/* of the rest of the superblock */
+	__le32 version;
+	__le32 image_csum;
+	__le64 trans_id;
+	__le64 block_size;	/* in sectors */
+	__le64 nr_blocks;
+	__le64 image_sector;
+	__le64 image_len;	/* in bytes */
+	__le64 nr_devs;
+};
+
+/*
+ * The image is, for each thin device, a thin_disk_dev followed by
+ * its extents in ascending virtual block order.
+ */
+struct thin_disk_dev {
+	__le64 dev_id;
+	__le64 nr_extents;
+};
+
+struct thin_disk_extent {
+	__le64 vblock;
+	__le64 dblock;
+	__le64 len;
+};
+
+/*
+ * A run of virtual blocks mapped onto consecutive data blocks
+ */
+struct thin_extent {
+	struct rb_node node;
+	unsigned long vbegin;
+	unsigned long dbegin;
+	unsigned long len;
+};
+
+/*
+ * A thin device or snapshot in the pool
+ */
+struct thin_dev {
+	struct list_head list;
+	u64 dev_id;
+
+	struct rb_root extents;		/* by vbegin */
+	unsigned long nr_extents;
+	unsigned long mapped;		/* blocks */
+
+	int opened;			/* thin targets constructed */
+	int active;			/* thin targets resumed */
+};
+
+struct pool {
+	struct list_head list;		/* in _pools */
+	struct mapped_device *pool_md;
+	struct dm_target *ti;		/* the resumed pool target */
+	int ref;
+
+	struct block_device *metadata_bdev;
+	struct block_device *data_bdev;
+	sector_t block_size;
+	unsigned int block_shift;
+	unsigned long low_water;
+	int low_water_triggered;
+
+	/*
+	 * Serialises commits and the metadata messages
+	 */
+	struct mutex md_lock;
+
+	/*
+	 * Protects the device list, the extent trees and the block
+	 * maps.  The map function only reads them.
+	 */
+	rwlock_t lock;
+	struct list_head devs;
+	unsigned long nr_blocks;
+	u32 *refcount;
+	unsigned long *free_map;
+	unsigned long *pending_free;	/* freed since the image was taken */
+	unsigned long *committing_free;	/* freed before it */
+	unsigned long nr_free;
+	unsigned long alloc_hint;
+	int dirty;
+	int fail;
+
+	sector_t md_sectors;
+	sector_t area_sectors;
+	u64 trans_id;
+	sector_t image_sector;
+	size_t image_len;
+	void *image;
+	size_t image_size;
+	struct thin_disk_super *sb;
+
+	void *zero_buf;
+	struct kcopyd_client *copier;
+	struct workqueue_struct *wq;
+	struct work_struct commit_work;
+};
+
+/*
+ * Target contexts
+ */
+struct pool_c {
+	struct pool *pool;
+	struct dm_dev *metadata_dev;
+	struct dm_dev *data_dev;
+	unsigned long low_water;
+};
+
+struct thin_c {
+	struct dm_target *ti;
+	struct pool *pool;
+	struct thin_dev *td;
+	struct dm_dev *pool_dev;
+	int active;
+
+	spinlock_t lock;
+	struct bio_list deferred;
+	struct work_struct worker;
+};
+
+static LIST_HEAD(_pools);
+static DEFINE_MUTEX(_pools_lock);
+
+static kmem_cache_t *_extent_cache;
+
+static inline sector_t bytes_to_sectors(size_t len)
+{
+	return (len + 511) >> 9;
+}
+
+/*-----------------------------------------------------------------
+ * Extent trees
+ *---------------------------------------------------------------*/
+static struct thin_extent *__find_extent(struct thin_dev *td,
+					 unsigned long vblock)
+{
+	struct rb_node *n = td->extents.rb_node;
+	struct thin_extent *e;
+
+	while (n) {
+		e = rb_entry(n, struct thin_extent, node);
+		if (vblock < e->vbegin)
+			n = n->rb_left;
+		else if (vblock >= e->vbegin + e->len)
+			n = n->rb_right;
+		else
+			return e;
+	}
+
+	return NULL;
+}
+
+static void __insert_extent(struct thin_dev *td, struct thin_extent *new)
+{
+	struct rb_node **p = &td->extents.rb_node, *parent = NULL;
+	struct thin_extent *e;
+
+	while (*p) {
+		parent = *p;
+		e = rb_entry(parent, struct thin_extent, node);
+		if (new->vbegin < e->vbegin)
+			p = &(*p)->rb_left;
+		else
+			p = &(*p)->rb_right;
+	}
+
+	rb_link_node(&new->node, parent, p);
+	rb_insert_color(&new->node, &td->extents);
+	td->nr_extents++;
+}
+
+static void __erase_extent(struct thin_dev *td, struct thin_extent *e)
+{
+	rb_erase(&e->node, &td->extents);
+	td->nr_extents--;
+	kmem_cache_free(_extent_cache, e);
+}
+
+static void __merge_extent(struct thin_dev *td, struct thin_extent *e)
+{
+	struct thin_extent *prev, *next;
+	struct rb_node *n;
+
+	n = rb_prev(&e->node);
+	if (n) {
+		prev = rb_entry(n, struct thin_extent, node);
+		if (prev->vbegin + prev->len == e->vbegin &&
+		    prev->dbegin + prev->len == e->dbegin) {
+			prev->len += e->len;
+			__erase_extent(td, e);
+			e = prev;
+		}
+	}
+
+	n = rb_next(&e->node);
+	if (n) {
+		next = rb_entry(n, struct thin_extent, node);
+		if (e->vbegin + e->len == next->vbegin &&
+		    e->dbegin + e->len == next->dbegin) {
+			e->len += next->len;
+			__erase_extent(td, next);
+		}
+	}
+}
+
+/*
+ * Each of these may consume the extent in *spare.
+ */
+static void __unmap_block(struct thin_dev *td, struct thin_extent *e,
+			  unsigned long vblock, struct thin_extent **spare)
+{
+	unsigned long off = vblock - e->vbegin;
+	struct thin_extent *tail;
+
+	td->mapped--;
+
+	if (e->len == 1)
+		__erase_extent(td, e);
+
+	else if (!off) {
+		e->vbegin++;
+		e->dbegin++;
+		e->len--;
+
+	} else if (off == e->len - 1)
+		e->len--;
+
+	else {
+		tail = *spare;
+		*spare = NULL;
+		tail->vbegin = vblock + 1;
+		tail->dbegin = e->dbegin + off + 1;
+		tail->len = e->len - off - 1;
+		e->len = off;
+		__insert_extent(td, tail);
+	}
+}
+
+static void __map_block(struct thin_dev *td, unsigned long vblock,
+			unsigned long dblock, struct thin_extent **spare)
+{
+	struct thin_extent *e = *spare;
+
+	*spare = NULL;
+	e->vbegin = vblock;
+	e->dbegin = dblock;
+	e->len = 1;
+	__insert_extent(td, e);
+	__merge_extent(td, e);
+	td->mapped++;
+}
+
+static void free_extents(struct thin_dev *td)
+{
+	struct rb_node *n;
+
+	while ((n = rb_first(&td->extents)))
+		__erase_extent(td, rb_entry(n, struct thin_extent, node));
+}
+
+static struct thin_dev *alloc_dev(u64 dev_id)
+{
+	struct thin_dev *td = kzalloc(sizeof(*td), GFP_NOIO);
+
+	if (td) {
+		td->dev_id = dev_id;
+		td->extents = RB_ROOT;
+	}
+
+	return td;
+}
+
+static void free_dev(struct thin_dev *td)
+{
+	free_extents(td);
+	kfree(td);
+}
+
+static struct thin_dev *__find_dev(struct pool *pool, u64 dev_id)
+{
+	struct thin_dev *td;
+
+	list_for_each_entry (td, &pool->devs, list)
+		if (td->dev_id == dev_id)
+			return td;
+
+	return NULL;
+}
+
+/*-----------------------------------------------------------------
+ * Data blocks
+ *
+ * A block whose last reference goes is only put back on the free
+ * map once a commit has written an image that no longer refers to
+ * it; until then the last committed image may still need it.
+ *---------------------------------------------------------------*/
+static int __alloc_block(struct pool *pool, unsigned long *result)
+{
+	unsigned long b;
+
+	b = find_next_bit(pool->free_map, pool->nr_blocks, pool->alloc_hint);
+	if (b >= pool->nr_blocks) {
+		b = find_first_bit(pool->free_map, pool->nr_blocks);
+		if (b >= pool->nr_blocks)
+			return -ENOSPC;
+	}
+
+	__clear_bit(b, pool->free_map);
+	pool->refcount[b] = 1;
+	pool->nr_free--;
+	pool->alloc_hint = b + 1;
+	*result = b;
+
+	return 0;
+}
+
+/*
+ * Gives back a block no image has seen yet.
+ */
+static void __unalloc_block(struct pool *pool, unsigned long b)
+{
+	pool->refcount[b] = 0;
+	__set_bit(b, pool->free_map);
+	pool->nr_free++;
+}
+
+static void __dec_block(struct pool *pool, unsigned long b)
+{
+	if (!--pool->refcount[b])
+		__set_bit(b, pool->pending_free);
+}
+
+static void __dec_extents(struct pool *pool, struct thin_dev *td)
+{
+	struct thin_extent *e;
+	struct rb_node *n;
+	unsigned long i;
+
+	for (n = rb_first(&td->extents); n; n = rb_next(n)) {
+		e = rb_entry(n, struct thin_extent, node);
+		for (i = 0; i < e->len; i++)
+			__dec_block(pool, e->dbegin + i);
+	}
+}
+
+static void free_block_maps(u32 *refcount, unsigned long **maps)
+{
+	int i;
+
+	vfree(refcount);
+	for (i = 0; i < 3; i++)
+		vfree(maps[i]);
+}
+
+/*
+ * Allocates zeroed refcounts and free, pending and committing maps.
+ */
+static int alloc_block_maps(unsigned long nr_blocks, u32 **refcount,
+			    unsigned long **maps)
+{
+	size_t len = BITS_TO_LONGS(nr_blocks) * sizeof(unsigned long);
+	int i;
+
+	*refcount = vmalloc(nr_blocks * sizeof(u32));
+	for (i = 0; i < 3; i++)
+		maps[i] = vmalloc(len);
+
+	if (!*refcount || !maps[0] || !maps[1] || !maps[2]) {
+		free_block_maps(*refcount, maps);
+		return -ENOMEM;
+	}
+
+	memset(*refcount, 0, nr_blocks * sizeof(u32));
+	for (i = 0; i < 3; i++)
+		memset(maps[i], 0, len);
+
+	return 0;
+}
+
+/*
+ * The data device has grown
+ */
+static int pool_resize(struct pool *pool, unsigned long nr_blocks)
+{
+	unsigned long *maps[3], *old_map;
+	u32 *refcount, *old_refcount;
+	size_t len;
+	unsigned long b;
+	int r;
+
+	r = alloc_block_maps(nr_blocks, &refcount, maps);
+	if (r)
+		return r;
+
+	write_lock_irq(&pool->lock);
+	len = BITS_TO_LONGS(pool->nr_blocks) * sizeof(unsigned long);
+	memcpy(refcount, pool->refcount, pool->nr_blocks * sizeof(u32));
+	memcpy(maps[0], pool->free_map, len);
+	memcpy(maps[1], pool->pending_free, len);
+	memcpy(maps[2], pool->committing_free, len);
+	for (b = pool->nr_blocks; b < nr_blocks; b++)
+		__set_bit(b, maps[0]);
+	pool->nr_free += nr_blocks - pool->nr_blocks;
+	pool->nr_blocks = nr_blocks;
+
+	old_refcount = pool->refcount;
+	pool->refcount = refcount;
+	refcount = old_refcount;
+	old_map = pool->free_map;
+	pool->free_map = maps[0];
+	maps[0] = old_map;
+	old_map = pool->pending_free;
+	pool->pending_free = maps[1];
+	maps[1] = old_map;
+	old_map = pool->committing_free;
+	pool->committing_free = maps[2];
+	maps[2] = old_map;
+
+	if (pool->nr_free >= pool->low_water)
+		pool->low_water_triggered = 0;
+	pool->dirty = 1;
+	write_unlock_irq(&pool->lock);
+
+	free_block_maps(refcount, maps);
+	return 0;
+}
+
+/*-----------------------------------------------------------------
+ * Metadata
+ *---------------------------------------------------------------*/
+static int grow_image(struct pool *pool, size_t len)
+{
+	size_t size = PAGE_ALIGN(len + len / 2);
+
+	vfree(pool->image);
+	pool->image_size = 0;
+	pool->image = __vmalloc(size, GFP_NOIO | __GFP_HIGHMEM, PAGE_KERNEL);
+	if (!pool->image)
+		return -ENOMEM;
+
+	pool->image_size = size;
+	return 0;
+}
+
+static int metadata_io(struct pool *pool, int rw, sector_t sector,
+		       sector_t count, void *data)
+{
+	struct io_region region;
+	unsigned long bits;
+
+	region.bdev = pool->metadata_bdev;
+	region.sector = sector;
+	region.count = count;
+
+	return dm_io_sync_vm(1, &region, rw, data, &bits);
+}
+
+static size_t __image_len(struct pool *pool, unsigned long *nr_devs)
+{
+	struct thin_dev *td;
+	size_t len = 0;
+
+	*nr_devs = 0;
+	list_for_each_entry (td, &pool->devs, list) {
+		len += sizeof(struct thin_disk_dev) +
+		       td->nr_extents * sizeof(struct thin_disk_extent);
+		(*nr_devs)++;
+	}
+
+	return len;
+}
+
+static void __fill_image(struct pool *pool)
+{
+	struct thin_disk_extent *de;
+	struct thin_disk_dev *dd;
+	struct thin_extent *e;
+	struct thin_dev *td;
+	struct rb_node *n;
+	void *p = pool->image;
+
+	list_for_each_entry (td, &pool->devs, list) {
+		dd = p;
+		dd->dev_id = cpu_to_le64(td->dev_id);
+		dd->nr_extents = cpu_to_le64(td->nr_extents);
+
+		de = (struct thin_disk_extent *) (dd + 1);
+		for (n = rb_first(&td->extents); n; n = rb_next(n), de++) {
+			e = rb_entry(n, struct thin_extent, node);
+			de->vblock = cpu_to_le64(e->vbegin);
+			de->dblock = cpu_to_le64(e->dbegin);
+			de->len = cpu_to_le64(e->len);
+		}
+		p = de;
+	}
+}
+
+static u32 super_csum(struct thin_disk_super *sb)
+{
+	return crc32(~0, (u8 *) sb + 8, sizeof(*sb) - 8);
+}
+
+/*
+ * Writes out the mappings if they changed.  Called with md_lock held.
+ */
+static int __commit(struct pool *pool)
+{
+	struct thin_disk_super *sb = pool->sb;
+	unsigned long nr_devs, b, *old_map;
+	sector_t where, count;
+	size_t len;
+	int r;
+
+	if (pool->fail)
+		return -EIO;
+
+	read_lock(&pool->lock);
+	r = pool->dirty;
+	read_unlock(&pool->lock);
+	if (!r)
+		return 0;
+
+	/* the blocks the new image points at must be on disk first */
+	r = blkdev_issue_flush(pool->data_bdev, NULL);
+	if (r && r != -EOPNOTSUPP)
+		goto bad;
+
+	write_lock_irq(&pool->lock);
+	while ((len = __image_len(pool, &nr_devs)) +
+	       511 > pool->image_size) {
+		write_unlock_irq(&pool->lock);
+		r = grow_image(pool, len + 511);
+		if (r)
+			goto bad;
+		write_lock_irq(&pool->lock);
+	}
+	__fill_image(pool);
+	old_map = pool->committing_free;
+	pool->committing_free = pool->pending_free;
+	pool->pending_free = old_map;
+	pool->dirty = 0;
+	write_unlock_irq(&pool->lock);
+
+	count = bytes_to_sectors(len);
+	if (count > pool->area_sectors) {
+		DMERR("metadata device too small for %lu bytes of mappings",
+		      (unsigned long) len);
+		r = -ENOSPC;
+		goto bad;
+	}
+	memset(pool->image + len, 0, (count << 9) - len);
+
+	where = THIN_SUPER_SECTORS;
+	if (pool->image_sector == where)
+		where += pool->area_sectors;
+
+	if (count) {
+		r = metadata_io(pool, WRITE, where, count, pool->image);
+		if (r)
+			goto bad;
+	}
+
+	r = blkdev_issue_flush(pool->metadata_bdev, NULL);
+	if (r && r != -EOPNOTSUPP)
+		goto bad;
+
+	memset(sb, 0, 512);
+	sb->magic = cpu_to_le32(THIN_METADATA_MAGIC);
+	sb->version = cpu_to_le32(THIN_METADATA_VERSION);
+	sb->image_csum = cpu_to_le32(crc32(~0, pool->image, len));
+	sb->trans_id = cpu_to_le64(pool->trans_id + 1);
+	sb->block_size = cpu_to_le64(pool->block_size);
+	sb->nr_blocks = cpu_to_le64(pool->nr_blocks);
+	sb->image_sector = cpu_to_le64(where);
+	sb->image_len = cpu_to_le64(len);
+	sb->nr_devs = cpu_to_le64(nr_devs);
+	sb->csum = cpu_to_le32(super_csum(sb));
+
+	r = metadata_io(pool, WRITE, 0, 1, sb);
+	if (r)
+		goto bad;
+
+	r = blkdev_issue_flush(pool->metadata_bdev, NULL);
+	if (r && r != -EOPNOTSUPP)
+		goto bad;
+
+	pool->trans_id++;
+	pool->image_sector = where;
+	pool->image_len = len;
+
+	write_lock_irq(&pool->lock);
+	for (b = find_first_bit(pool->committing_free, pool->nr_blocks);
+	     b < pool->nr_blocks;
+	     b = find_next_bit(pool->committing_free, pool->nr_blocks, b + 1)) {
+		__clear_bit(b, pool->committing_free);
+		__set_bit(b, pool->free_map);
+		pool->nr_free++;
+	}
+	if (pool->nr_free >= pool->low_water)
+		pool->low_water_triggered = 0;
+	write_unlock_irq(&pool->lock);
+
+	return 0;
+
+      bad:
+	write_lock_irq(&pool->lock);
+	bitmap_or(pool->pending_free, pool->pending_free,
+		  pool->committing_free, pool->nr_blocks);
+	bitmap_zero(pool->committing_free, pool->nr_blocks);
+	pool->dirty = 1;
+	pool->fail = 1;
+	write_unlock_irq(&pool->lock);
+
+	DMERR("metadata commit failed (%d), no more blocks will be "
+	      "provisioned", r);
+	return r;
+}
+
+static int pool_commit(struct pool *pool)
+{
+	int r;
+
+	mutex_lock(&pool->md_lock);
+	r = __commit(pool);
+	mutex_unlock(&pool->md_lock);
+
+	return r;
+}
+
+static void do_commit(void *data)
+{
+	pool_commit(data);
+}
+
+static void schedule_commit(struct pool *pool)
+{
+	queue_delayed_work(pool->wq, &pool->commit_work, THIN_COMMIT_PERIOD);
+}
+
+/*
+ * Builds the extent trees and refcounts from the committed image.
+ */
+static int load_image(struct pool *pool, unsigned long nr_devs,
+		      unsigned long nr_blocks)
+{
+	struct thin_disk_extent *de;
+	struct thin_disk_dev *dd;
+	struct thin_extent *e;
+	struct thin_dev *td;
+	unsigned long nr_extents, i, b;
+	void *p = pool->image, *end = pool->image + pool->image_len;
+
+	while (nr_devs--) {
+		dd = p;
+		if ((void *) (dd + 1) > end)
+			return -EINVAL;
+
+		td = alloc_dev(le64_to_cpu(dd->dev_id));
+		if (!td)
+			return -ENOMEM;
+		list_add_tail(&td->list, &pool->devs);
+
+		nr_extents = le64_to_cpu(dd->nr_extents);
+		de = (struct thin_disk_extent *) (dd + 1);
+		if ((void *) (de + nr_extents) > end)
+			return -EINVAL;
+
+		for (i = 0; i < nr_extents; i++, de++) {
+			e = kmem_cache_alloc(_extent_cache, GFP_NOIO);
+			if (!e)
+				return -ENOMEM;
+
+			e->vbegin = le64_to_cpu(de->vblock);
+			e->dbegin = le64_to_cpu(de->dblock);
+			e->len = le64_to_cpu(de->len);
+			__insert_extent(td, e);
+
+			if (!e->len || e->dbegin >= nr_blocks ||
+			    e->len > nr_blocks - e->dbegin)
+				return -EINVAL;
+
+			for (b = e->dbegin; b < e->dbegin + e->len; b++)
+				pool->refcount[b]++;
+			td->mapped += e->len;
+		}
+		p = de;
+	}
+
+	return 0;
+}
+
+/*
+ * Reads the metadata in, or formats it if it is all zeroes.
+ */
+static int pool_load(struct pool *pool, char **error)
+{
+	struct thin_disk_super *sb = pool->sb;
+	unsigned long nr_blocks, b;
+	sector_t block_size;
+	int r;
+
+	r = metadata_io(pool, READ, 0, 1, sb);
+	if (r) {
+		*error = "Couldn't read metadata superblock";
+		return r;
+	}
+
+	if (!sb->magic) {
+		if (memcmp(sb, pool->zero_buf, 512)) {
+			*error = "Metadata device holds something else";
+			return -EINVAL;
+		}
+
+		pool->image_sector = THIN_SUPER_SECTORS + pool->area_sectors;
+		nr_blocks = 0;
+		goto out;
+	}
+
+	if (le32_to_cpu(sb->magic) != THIN_METADATA_MAGIC ||
+	    le32_to_cpu(sb->csum) != super_csum(sb)) {
+		*error = "Metadata superblock is corrupt";
+		return -EINVAL;
+	}
+
+	if (le32_to_cpu(sb->version) != THIN_METADATA_VERSION) {
+		*error = "Unsupported metadata version";
+		return -EINVAL;
+	}
+
+	block_size = le64_to_cpu(sb->block_size);
+	if (block_size != pool->block_size) {
+		*error = "Block size differs from the one in the metadata";
+		return -EINVAL;
+	}
+
+	nr_blocks = le64_to_cpu(sb->nr_blocks);
+	if (nr_blocks > pool->nr_blocks) {
+		*error = "Data device is smaller than the metadata says";
+		return -EINVAL;
+	}
+
+	pool->trans_id = le64_to_cpu(sb->trans_id);
+	pool->image_sector = le64_to_cpu(sb->image_sector);
+	pool->image_len = le64_to_cpu(sb->image_len);
+
+	if ((pool->image_sector != THIN_SUPER_SECTORS &&
+	     pool->image_sector != THIN_SUPER_SECTORS + pool->area_sectors) ||
+	    bytes_to_sectors(pool->image_len) > pool->area_sectors) {
+		*error = "Metadata superblock doesn't match the device";
+		return -EINVAL;
+	}
+
+	r = grow_image(pool, pool->image_len + 511);
+	if (r) {
+		*error = "Couldn't allocate metadata image";
+		return r;
+	}
+
+	if (pool->image_len) {
+		r = metadata_io(pool, READ, pool->image_sector,
+				bytes_to_sectors(pool->image_len), pool->image);
+		if (r) {
+			*error = "Couldn't read metadata image";
+			return r;
+		}
+	}
+
+	if (le32_to_cpu(sb->image_csum) !=
+	    crc32(~0, pool->image, pool->image_len)) {
+		*error = "Metadata image is corrupt";
+		return -EINVAL;
+	}
+
+	r = load_image(pool, le64_to_cpu(sb->nr_devs), nr_blocks);
+	if (r) {
+		*error = "Couldn't load metadata image";
+		return r;
+	}
+
+      out:
+	for (b = 0; b < pool->nr_blocks; b++)
+		if (!pool->refcount[b]) {
+			__set_bit(b, pool->free_map);
+			pool->nr_free++;
+		}
+
+	/* formatted or grown: write it out */
+	if (nr_blocks != pool->nr_blocks)
+		pool->dirty = 1;
+
+	return 0;
+}
+
+/*-----------------------------------------------------------------
+ * Pools
+ *---------------------------------------------------------------*/
+static struct pool *__pool_find(struct mapped_device *md)
+{
+	struct pool *pool;
+
+	list_for_each_entry (pool, &_pools, list)
+		if (pool->pool_md == md)
+			return pool;
+
+	return NULL;
+}
+
+static void pool_destroy(struct pool *pool)
+{
+	struct thin_dev *td, *tmp;
+	unsigned long *maps[3];
+
+	if (pool->wq) {
+		cancel_delayed_work(&pool->commit_work);
+		flush_workqueue(pool->wq);
+		pool_commit(pool);
+		destroy_workqueue(pool->wq);
+	}
+
+	if (pool->copier)
+		kcopyd_client_destroy(pool->copier);
+	dm_io_put(pool->block_size >> (PAGE_SHIFT - 9));
+
+	list_for_each_entry_safe (td, tmp, &pool->devs, list)
+		free_dev(td);
+
+	maps[0] = pool->free_map;
+	maps[1] = pool->pending_free;
+	maps[2] = pool->committing_free;
+	free_block_maps(pool->refcount, maps);
+
+	vfree(pool->image);
+	vfree(pool->sb);
+	vfree(pool->zero_buf);
+	kfree(pool);
+}
+
+static struct pool *pool_create(struct mapped_device *md,
+				struct block_device *metadata_bdev,
+				struct block_device *data_bdev,
+				sector_t block_size, unsigned long nr_blocks,
+				char **error)
+{
+	unsigned long *maps[3];
+	struct pool *pool;
+	int r;
+
+	pool = kzalloc(sizeof(*pool), GFP_KERNEL);
+	if (!pool) {
+		*error = "Cannot allocate pool context";
+		return ERR_PTR(-ENOMEM);
+	}
+
+	pool->pool_md = md;
+	pool->ref = 1;
+	pool->metadata_bdev = metadata_bdev;
+	pool->data_bdev = data_bdev;
+	pool->block_size = block_size;
+	pool->block_shift = ffs(block_size) - 1;
+	pool->nr_blocks = nr_blocks;
+	mutex_init(&pool->md_lock);
+	rwlock_init(&pool->lock);
+	INIT_LIST_HEAD(&pool->devs);
+	INIT_WORK(&pool->commit_work, do_commit, pool);
+
+	pool->md_sectors = i_size_read(metadata_bdev->bd_inode) >> 9;
+	pool->area_sectors = (pool->md_sectors - THIN_SUPER_SECTORS) / 2;
+	if (pool->md_sectors < THIN_SUPER_SECTORS * 3) {
+		*error = "Metadata device is too small";
+		r = -EINVAL;
+		goto bad;
+	}
+
+	r = dm_io_get(block_size >> (PAGE_SHIFT - 9));
+	if (r) {
+		*error = "Couldn't reserve dm-io pages";
+		goto bad;
+	}
+
+	r = alloc_block_maps(nr_blocks, &pool->refcount, maps);
+	if (r) {
+		*error = "Cannot allocate block maps";
+		goto bad_io;
+	}
+	pool->free_map = maps[0];
+	pool->pending_free = maps[1];
+	pool->committing_free = maps[2];
+
+	r = -ENOMEM;
+	pool->sb = vmalloc(PAGE_SIZE);
+	pool->zero_buf = vmalloc(block_size << 9);
+	if (!pool->sb || !pool->zero_buf) {
+		*error = "Cannot allocate metadata buffers";
+		goto bad_io;
+	}
+	memset(pool->zero_buf, 0, block_size << 9);
+
+	r = pool_load(pool, error);
+	if (r)
+		goto bad_io;
+
+	r = kcopyd_client_create(THIN_COPY_PAGES, &pool->copier);
+	if (r) {
+		*error = "Could not create kcopyd client";
+		goto bad_io;
+	}
+
+	pool->wq = create_singlethread_workqueue("kthinpoold");
+	if (!pool->wq) {
+		*error = "Could not create pool workqueue";
+		r = -ENOMEM;
+		goto bad_io;
+	}
+
+	r = pool_commit(pool);
+	if (r) {
+		*error = "Couldn't write metadata";
+		goto bad_io;
+	}
+
+	return pool;
+
+      bad_io:
+	pool_destroy(pool);
+	return ERR_PTR(r);
+
+      bad:
+	kfree(pool);
+	return ERR_PTR(r);
+}
+
+static void pool_put(struct pool *pool)
+{
+	int last;
+
+	mutex_lock(&_pools_lock);
+	last = !--pool->ref;
+	if (last)
+		list_del(&pool->list);
+	mutex_unlock(&_pools_lock);
+
+	if (last)
+		pool_destroy(pool);
+}
+
+static void pool_event(struct pool *pool)
+{
+	DMWARN("pool has fallen below its low water mark");
+
+	mutex_lock(&_pools_lock);
+	if (pool->ti)
+		dm_table_event(pool->ti->table);
+	mutex_unlock(&_pools_lock);
+}
+
+/*-----------------------------------------------------------------
+ * Pool target
+ *---------------------------------------------------------------*/
+
+/*
+ * Construct a pool: <metadata dev> <data dev> <block size> <low water mark>
+ */
+static int pool_ctr(struct dm_target *ti, unsigned int argc, char **argv)
+{
+	struct mapped_device *md;
+	struct pool *pool;
+	struct pool_c *pc;
+	unsigned long block_size, nr_blocks;
+	char *end;
+	int r;
+
+	if (argc != 4) {
+		ti->error = "Requires exactly 4 arguments";
+		return -EINVAL;
+	}
+
+	pc = kzalloc(sizeof(*pc), GFP_KERNEL);
+	if (!pc) {
+		ti->error = "Cannot allocate pool target context";
+		return -ENOMEM;
+	}
+
+	block_size = simple_strtoul(argv[2], &end, 10);
+	if (*end || block_size < THIN_MIN_BLOCK_SIZE ||
+	    block_size > THIN_MAX_BLOCK_SIZE ||
+	    (block_size & (block_size - 1))) {
+		ti->error = "Invalid block size";
+		r = -EINVAL;
+		goto bad1;
+	}
+
+	pc->low_water = simple_strtoul(argv[3], &end, 10);
+	if (*end) {
+		ti->error = "Invalid low water mark";
+		r = -EINVAL;
+		goto bad1;
+	}
+
+	nr_blocks = ti->len >> (ffs(block_size) - 1);
+	if (!nr_blocks) {
+		ti->error = "Pool is smaller than a block";
+		r = -EINVAL;
+		goto bad1;
+	}
+
+	r = dm_get_device(ti, argv[0], 0, 0,
+			  FMODE_READ | FMODE_WRITE, &pc->metadata_dev);
+	if (r) {
+		ti->error = "Cannot get metadata device";
+		goto bad1;
+	}
+
+	r = dm_get_device(ti, argv[1], 0, ti->len,
+			  FMODE_READ | FMODE_WRITE, &pc->data_dev);
+	if (r) {
+		ti->error = "Cannot get data device";
+		goto bad2;
+	}
+
+	/*
+	 * A table reload finds the pool of the table it replaces.
+	 */
+	md = dm_table_get_md(ti->table);
+	mutex_lock(&_pools_lock);
+	pool = __pool_find(md);
+	if (pool) {
+		if (pool->metadata_bdev != pc->metadata_dev->bdev ||
+		    pool->data_bdev != pc->data_dev->bdev ||
+		    pool->block_size != block_size) {
+			ti->error = "Pool's devices or block size can't change";
+			r = -EINVAL;
+		} else if (nr_blocks < pool->nr_blocks) {
+			ti->error = "Pool can't shrink";
+			r = -EINVAL;
+		} else if (nr_blocks > pool->nr_blocks &&
+			   (r = pool_resize(pool, nr_blocks)))
+			ti->error = "Cannot grow pool";
+		else
+			pool->ref++;
+
+	} else {
+		pool = pool_create(md, pc->metadata_dev->bdev,
+				   pc->data_dev->bdev, block_size, nr_blocks,
+				   &ti->error);
+		if (IS_ERR(pool))
+			r = PTR_ERR(pool);
+		else
+			list_add(&pool->list, &_pools);
+	}
+	mutex_unlock(&_pools_lock);
+	dm_put(md);
+
+	if (r)
+		goto bad3;
+
+	pc->pool = pool;
+	ti->private = pc;
+	return 0;
+
+      bad3:
+	dm_put_device(ti, pc->data_dev);
+      bad2:
+	dm_put_device(ti, pc->metadata_dev);
+      bad1:
+	kfree(pc);
+	return r;
+}
+
+static void pool_dtr(struct dm_target *ti)
+{
+	struct pool_c *pc = ti->private;
+	struct pool *pool = pc->pool;
+
+	mutex_lock(&_pools_lock);
+	if (pool->ti == ti)
+		pool->ti = NULL;
+	mutex_unlock(&_pools_lock);
+
+	pool_put(pool);
+	dm_put_device(ti, pc->data_dev);
+	dm_put_device(ti, pc->metadata_dev);
+	kfree(pc);
+}
+
+/*
+ * The pool device itself is the data device.
+ */
+static int pool_map(struct dm_target *ti, struct bio *bio,
+		    union map_info *map_context)
+{
+	struct pool_c *pc = ti->private;
+
+	bio->bi_bdev = pc->data_dev->bdev;
+	bio->bi_sector -= ti->begin;
+
+	return 1;
+}
+
+static void pool_postsuspend(struct dm_target *ti)
+{
+	struct pool_c *pc = ti->private;
+	struct pool *pool = pc->pool;
+
+	cancel_delayed_work(&pool->commit_work);
+	flush_workqueue(pool->wq);
+	pool_commit(pool);
+}
+
+static void pool_resume(struct dm_target *ti)
+{
+	struct pool_c *pc = ti->private;
+	struct pool *pool = pc->pool;
+
+	mutex_lock(&_pools_lock);
+	pool->ti = ti;
+	mutex_unlock(&_pools_lock);
+
+	write_lock_irq(&pool->lock);
+	pool->low_water = pc->low_water;
+	if (pool->nr_free >= pool->low_water)
+		pool->low_water_triggered = 0;
+	write_unlock_irq(&pool->lock);
+}
+
+static int parse_dev_id(char *arg, u64 *dev_id)
+{
+	char *end;
+
+	*dev_id = simple_strtoull(arg, &end, 10);
+	return (*end || end == arg) ? -EINVAL : 0;
+}
+
+static int create_thin(struct pool *pool, u64 dev_id)
+{
+	struct thin_dev *td;
+
+	if (__find_dev(pool, dev_id))
+		return -EEXIST;
+
+	td = alloc_dev(dev_id);
+	if (!td)
+		return -ENOMEM;
+
+	write_lock_irq(&pool->lock);
+	list_add_tail(&td->list, &pool->devs);
+	pool->dirty = 1;
+	write_unlock_irq(&pool->lock);
+
+	return 0;
+}
+
+/*
+ * A snapshot starts out sharing every block of its origin.  No data
+ * is copied here; the first write to a shared block, from either
+ * side, copies that block once.
+ */
+static int create_snap(struct pool *pool, u64 dev_id, u64 origin_id)
+{
+	struct thin_dev *origin, *td;
+	struct thin_extent *e, *copy;
+	struct rb_node *n;
+	unsigned long i;
+
+	if (__find_dev(pool, dev_id))
+		return -EEXIST;
+
+	origin = __find_dev(pool, origin_id);
+	if (!origin)
+		return -ENODEV;
+
+	/*
+	 * Nothing changes a device's tree while none of its targets
+	 * is resumed, so it can be walked without the lock.
+	 */
+	if (origin->active) {
+		DMWARN("suspend device %llu before snapshotting it",
+		       (unsigned long long) origin_id);
+		return -EBUSY;
+	}
+
+	td = alloc_dev(dev_id);
+	if (!td)
+		return -ENOMEM;
+
+	for (n = rb_first(&origin->extents); n; n = rb_next(n)) {
+		e = rb_entry(n, struct thin_extent, node);
+		copy = kmem_cache_alloc(_extent_cache, GFP_NOIO);
+		if (!copy) {
+			free_dev(td);
+			return -ENOMEM;
+		}
+		*copy = *e;
+		__insert_extent(td, copy);
+	}
+	td->mapped = origin->mapped;
+
+	write_lock_irq(&pool->lock);
+	for (n = rb_first(&td->extents); n; n = rb_next(n)) {
+		e = rb_entry(n, struct thin_extent, node);
+		for (i = 0; i < e->len; i++)
+			pool->refcount[e->dbegin + i]++;
+	}
+	list_add_tail(&td->list, &pool->devs);
+	pool->dirty = 1;
+	write_unlock_irq(&pool->lock);
+
+	return 0;
+}
+
+static int delete_dev(struct pool *pool, u64 dev_id)
+{
+	struct thin_dev *td;
+
+	td = __find_dev(pool, dev_id);
+	if (!td)
+		return -ENODEV;
+
+	if (td->opened)
+		return -EBUSY;
+
+	write_lock_irq(&pool->lock);
+	list_del(&td->list);
+	__dec_extents(pool, td);
+	pool->dirty = 1;
+	write_unlock_irq(&pool->lock);
+
+	free_dev(td);
+	return 0;
+}
+
+/*
+ * Pool messages:
+ *   create_thin <dev id>
+ *   create_snap <dev id> <origin id>
+ *   delete <dev id>
+ * Each is committed before the message returns.
+ */
+static int pool_message(struct dm_target *ti, unsigned argc, char **argv)
+{
+	struct pool_c *pc = ti->private;
+	struct pool *pool = pc->pool;
+	u64 dev_id, origin_id;
+	int r = -EINVAL;
+
+	if (argc < 2 || parse_dev_id(argv[1], &dev_id))
+		goto out;
+
+	mutex_lock(&pool->md_lock);
+	if (argc == 2 && !strnicmp(argv[0], MESG_STR("create_thin")))
+		r = create_thin(pool, dev_id);
+
+	else if (argc == 3 && !strnicmp(argv[0], MESG_STR("create_snap")) &&
+		 !parse_dev_id(argv[2], &origin_id))
+		r = create_snap(pool, dev_id, origin_id);
+
+	else if (argc == 2 && !strnicmp(argv[0], MESG_STR("delete")))
+		r = delete_dev(pool, dev_id);
+
+	if (!r)
+		r = __commit(pool);
+	mutex_unlock(&pool->md_lock);
+
+      out:
+	if (r == -EINVAL)
+		DMWARN("Unrecognised pool message received.");
+
+	return r;
+}
+
+static int pool_status(struct dm_target *ti, status_type_t type,
+		       char *result, unsigned int maxlen)
+{
+	struct pool_c *pc = ti->private;
+	struct pool *pool = pc->pool;
+	unsigned long nr_blocks, nr_free;
+	unsigned int sz = 0;
+
+	switch (type) {
+	case STATUSTYPE_INFO:
+		read_lock(&pool->lock);
+		nr_blocks = pool->nr_blocks;
+		nr_free = pool->nr_free;
+		read_unlock(&pool->lock);
+
+		DMEMIT("%llu %llu/%llu %lu/%lu%s",
+		       (unsigned long long) pool->trans_id,
+		       (unsigned long long) (THIN_SUPER_SECTORS +
+				bytes_to_sectors(pool->image_len)),
+		       (unsigned long long) pool->md_sectors,
+		       nr_blocks - nr_free, nr_blocks,
+		       pool->fail ? " fail" : "");
+		break;
+
+	case STATUSTYPE_TABLE:
+		DMEMIT("%s %s %llu %lu", pc->metadata_dev->name,
+		       pc->data_dev->name,
+		       (unsigned long long) pool->block_size, pc->low_water);
+		break;
+	}
+
+	return 0;
+}
+
+static struct target_type pool_target = {
+	.name        = "thin-pool",
+	.module      = THIS_MODULE,
+	.version     = {1, 0, 0},
+	.ctr         = pool_ctr,
+	.dtr         = pool_dtr,
+	.map         = pool_map,
+	.postsuspend = pool_postsuspend,
+	.resume      = pool_resume,
+	.message     = pool_message,
+	.status      = pool_status,
+};
+
+/*-----------------------------------------------------------------
+ * Thin target
+ *---------------------------------------------------------------*/
+static inline unsigned long get_bio_block(struct thin_c *tc, struct bio *bio)
+{
+	return (bio->bi_sector - tc->ti->begin) >> tc->pool->block_shift;
+}
+
+static void remap(struct thin_c *tc, struct bio *bio, unsigned long dblock)
+{
+	struct pool *pool = tc->pool;
+
+	bio->bi_bdev = pool->data_bdev;
+	bio->bi_sector = ((sector_t) dblock << pool->block_shift) +
+			 ((bio->bi_sector - tc->ti->begin) &
+			  (pool->block_size - 1));
+}
+
+static int bio_covers_block(struct pool *pool, struct bio *bio)
+{
+	return !(bio->bi_sector & (pool->block_size - 1)) &&
+	       bio->bi_size == (pool->block_size << 9);
+}
+
+static int zero_block(struct pool *pool, unsigned long b)
+{
+	struct io_region region;
+	unsigned long bits;
+
+	region.bdev = pool->data_bdev;
+	region.sector = (sector_t) b << pool->block_shift;
+	region.count = pool->block_size;
+
+	return dm_io_sync_vm(1, &region, WRITE, pool->zero_buf, &bits);
+}
+
+struct thin_copy {
+	struct completion done;
+	int err;
+};
+
+static void copy_complete(int read_err, unsigned int write_err,
+			  void *context)
+{
+	struct thin_copy *c = context;
+
+	c->err = (read_err || write_err) ? -EIO : 0;
+	complete(&c->done);
+}
+
+static int copy_block(struct pool *pool, unsigned long from,
+		      unsigned long to)
+{
+	struct io_region src, dest;
+	struct thin_copy c;
+	int r;
+
+	src.bdev = pool->data_bdev;
+	src.sector = (sector_t) from << pool->block_shift;
+	src.count = pool->block_size;
+
+	dest.bdev = pool->data_bdev;
+	dest.sector = (sector_t) to << pool->block_shift;
+	dest.count = pool->block_size;
+
+	init_completion(&c.done);
+	r = kcopyd_copy(pool->copier, &src, 1, &dest, 0, copy_complete, &c);
+	if (r)
+		return r;
+
+	wait_for_completion(&c.done);
+	return c.err;
+}
+
+/*
+ * A write to a block that is unmapped, or shared with another
+ * device: give the device a block of its own, filled with zeroes or
+ * with a copy of the shared one unless the bio overwrites all of it.
+ */
+static void process_bio(struct thin_c *tc, struct bio *bio)
+{
+	struct pool *pool = tc->pool;
+	struct thin_dev *td = tc->td;
+	unsigned long vblock = get_bio_block(tc, bio);
+	struct thin_extent *spare[2], *e;
+	unsigned long old = 0, new;
+	int shared = 0, event = 0, r;
+
+	spare[0] = kmem_cache_alloc(_extent_cache, GFP_NOIO);
+	spare[1] = kmem_cache_alloc(_extent_cache, GFP_NOIO);
+	if (!spare[0] || !spare[1]) {
+		r = -ENOMEM;
+		goto out;
+	}
+
+	write_lock_irq(&pool->lock);
+	e = __find_extent(td, vblock);
+	if (e) {
+		old = e->dbegin + vblock - e->vbegin;
+		if (pool->refcount[old] == 1) {
+			/* mapped or unshared while the bio was queued */
+			write_unlock_irq(&pool->lock);
+			remap(tc, bio, old);
+			generic_make_request(bio);
+			r = 0;
+			bio = NULL;
+			goto out;
+		}
+		shared = 1;
+	}
+
+	r = pool->fail ? -EIO : __alloc_block(pool, &new);
+	if (!r && pool->nr_free < pool->low_water &&
+	    !pool->low_water_triggered) {
+		pool->low_water_triggered = 1;
+		event = 1;
+	}
+	write_unlock_irq(&pool->lock);
+
+	if (event)
+		pool_event(pool);
+
+	if (r) {
+		if (r == -ENOSPC && printk_ratelimit())
+			DMWARN("pool is out of data blocks");
+		goto out;
+	}
+
+	if (!bio_covers_block(pool, bio)) {
+		r = shared ? copy_block(pool, old, new) : zero_block(pool, new);
+		if (r) {
+			write_lock_irq(&pool->lock);
+			__unalloc_block(pool, new);
+			write_unlock_irq(&pool->lock);
+			goto out;
+		}
+	}
+
+	write_lock_irq(&pool->lock);
+	if (shared) {
+		e = __find_extent(td, vblock);
+		__unmap_block(td, e, vblock, &spare[0]);
+		__dec_block(pool, old);
+	}
+	__map_block(td, vblock, new, spare[0] ? &spare[0] : &spare[1]);
+	pool->dirty = 1;
+	write_unlock_irq(&pool->lock);
+
+	schedule_commit(pool);
+
+	remap(tc, bio, new);
+	generic_make_request(bio);
+	bio = NULL;
+
+      out:
+	if (bio)
+		bio_endio(bio, bio->bi_size, r);
+
+	if (spare[0])
+		kmem_cache_free(_extent_cache, spare[0]);
+	if (spare[1])
+		kmem_cache_free(_extent_cache, spare[1]);
+}
+
+static void do_worker(void *data)
+{
+	struct thin_c *tc = data;
+	struct bio_list bios;
+	struct bio *bio;
+
+	spin_lock_irq(&tc->lock);
+	bios = tc->deferred;
+	bio_list_init(&tc->deferred);
+	spin_unlock_irq(&tc->lock);
+
+	while ((bio = bio_list_pop(&bios)))
+		process_bio(tc, bio);
+}
+
+/*
+ * Construct a thin device: <pool dev> <dev id>
+ */
+static int thin_ctr(struct dm_target *ti, unsigned int argc, char **argv)
+{
+	struct mapped_device *md;
+	struct pool *pool = NULL;
+	struct thin_c *tc;
+	u64 dev_id;
+	int r;
+
+	if (argc != 2) {
+		ti->error = "Requires exactly 2 arguments";
+		return -EINVAL;
+	}
+
+	if (parse_dev_id(argv[1], &dev_id)) {
+		ti->error = "Invalid device id";
+		return -EINVAL;
+	}
+
+	tc = kzalloc(sizeof(*tc), GFP_KERNEL);
+	if (!tc) {
+		ti->error = "Cannot allocate thin target context";
+		return -ENOMEM;
+	}
+
+	r = dm_get_device(ti, argv[0], 0, 0,
+			  FMODE_READ | FMODE_WRITE, &tc->pool_dev);
+	if (r) {
+		ti->error = "Cannot get pool device";
+		goto bad1;
+	}
+
+	md = dm_get_md(tc->pool_dev->bdev->bd_dev);
+	if (md) {
+		mutex_lock(&_pools_lock);
+		pool = __pool_find(md);
+		if (pool)
+			pool->ref++;
+		mutex_unlock(&_pools_lock);
+		dm_put(md);
+	}
+
+	if (!pool) {
+		ti->error = "Device is not a thin pool";
+		r = -EINVAL;
+		goto bad2;
+	}
+
+	mutex_lock(&pool->md_lock);
+	tc->td = __find_dev(pool, dev_id);
+	if (tc->td)
+		tc->td->opened++;
+	mutex_unlock(&pool->md_lock);
+
+	if (!tc->td) {
+		ti->error = "No such thin device in the pool";
+		r = -ENODEV;
+		goto bad3;
+	}
+
+	tc->ti = ti;
+	tc->pool = pool;
+	spin_lock_init(&tc->lock);
+	bio_list_init(&tc->deferred);
+	INIT_WORK(&tc->worker, do_worker, tc);
+
+	ti->split_io = pool->block_size;
+	ti->private = tc;
+	return 0;
+
+      bad3:
+	pool_put(pool);
+      bad2:
+	dm_put_device(ti, tc->pool_dev);
+      bad1:
+	kfree(tc);
+	return r;
+}
+
+static void thin_dtr(struct dm_target *ti)
+{
+	struct thin_c *tc = ti->private;
+	struct pool *pool = tc->pool;
+
+	flush_workqueue(pool->wq);
+
+	mutex_lock(&pool->md_lock);
+	tc->td->opened--;
+	if (tc->active)
+		tc->td->active--;
+	mutex_unlock(&pool->md_lock);
+
+	pool_put(pool);
+	dm_put_device(ti, tc->pool_dev);
+	kfree(tc);
+}
+
+/*
+ * Reads of mapped blocks and writes to blocks the device owns alone
+ * go straight to the data device.  Reads of unmapped blocks return
+ * zeroes; the rest is queued for the pool's workqueue.
+ */
+static int thin_map(struct dm_target *ti, struct bio *bio,
+		    union map_info *map_context)
+{
+	struct thin_c *tc = ti->private;
+	struct pool *pool = tc->pool;
+	unsigned long vblock = get_bio_block(tc, bio);
+	unsigned long dblock;
+	struct thin_extent *e;
+	unsigned long flags;
+
+	read_lock(&pool->lock);
+	e = __find_extent(tc->td, vblock);
+	if (e) {
+		dblock = e->dbegin + vblock - e->vbegin;
+		if (bio_data_dir(bio) == READ || pool->refcount[dblock] == 1) {
+			read_unlock(&pool->lock);
+			remap(tc, bio, dblock);
+			return 1;
+		}
+	}
+	read_unlock(&pool->lock);
+
+	if (!e && bio_data_dir(bio) == READ) {
+		zero_fill_bio(bio);
+		bio_endio(bio, bio->bi_size, 0);
+		return 0;
+	}
+
+	spin_lock_irqsave(&tc->lock, flags);
+	bio_list_add(&tc->deferred, bio);
+	spin_unlock_irqrestore(&tc->lock, flags);
+
+	queue_work(pool->wq, &tc->worker);
+	return 0;
+}
+
+static void thin_postsuspend(struct dm_target *ti)
+{
+	struct thin_c *tc = ti->private;
+
+	mutex_lock(&tc->pool->md_lock);
+	if (tc->active) {
+		tc->td->active--;
+		tc->active = 0;
+	}
+	mutex_unlock(&tc->pool->md_lock);
+}
+
+static void thin_resume(struct dm_target *ti)
+{
+	struct thin_c *tc = ti->private;
+
+	mutex_lock(&tc->pool->md_lock);
+	if (!tc->active) {
+		tc->td->active++;
+		tc->active = 1;
+	}
+	mutex_unlock(&tc->pool->md_lock);
+}
+
+static int thin_status(struct dm_target *ti, status_type_t type,
+		       char *result, unsigned int maxlen)
+{
+	struct thin_c *tc = ti->private;
+	struct pool *pool = tc->pool;
+	unsigned long mapped;
+	unsigned int sz = 0;
+
+	switch (type) {
+	case STATUSTYPE_INFO:
+		read_lock(&pool->lock);
+		mapped = tc->td->mapped;
+		read_unlock(&pool->lock);
+
+		DMEMIT("%llu",
+		       (unsigned long long) mapped << pool->block_shift);
+		break;
+
+	case STATUSTYPE_TABLE:
+		DMEMIT("%s %llu", tc->pool_dev->name,
+		       (unsigned long long) tc->td->dev_id);
+		break;
+	}
+
+	return 0;
+}
+
+static struct target_type thin_target = {
+	.name        = "thin",
+	.module      = THIS_MODULE,
+	.version     = {1, 0, 0},
+	.ctr         = thin_ctr,
+	.dtr         = thin_dtr,
+	.map         = thin_map,
+	.postsuspend = thin_postsuspend,
+	.resume      = thin_resume,
+	.status      = thin_status,
+};
+
+static int __init dm_thin_init(void)
+{
+	int r;
+
+	_extent_cache = kmem_cache_create("dm-thin-extent",
+					  sizeof(struct thin_extent),
+					  __alignof__(struct thin_extent),
+					  0, NULL, NULL);
+	if (!_extent_cache) {
+		DMERR("Couldn't create extent cache.");
+		return -ENOMEM;
+	}
+
+	r = dm_register_target(&pool_target);
+	if (r < 0) {
+		DMERR("pool target register failed %d", r);
+		goto bad1;
+	}
+
+	r = dm_register_target(&thin_target);
+	if (r < 0) {
+		DMERR("thin target register failed %d", r);
+		goto bad2;
+	}
+
+	return 0;
+
+      bad2:
+	dm_unregister_target(&pool_target);
+      bad1:
+	kmem_cache_destroy(_extent_cache);
+	return r;
+}
+
+static void __exit dm_thin_exit(void)
+{
+	int r;
+
+	r = dm_unregister_target(&thin_target);
+	if (r < 0)
+		DMERR("thin target unregister failed %d", r);
+
+	r = dm_unregister_target(&pool_target);
+	if (r < 0)
+		DMERR("pool target unregister failed %d", r);
+
+	kmem_cache_destroy(_extent_cache);
+}
+
+module_init(dm_thin_init);
+module_exit(dm_thin_exit);
+
+MODULE_DESCRIPTION(DM_NAME " thin provisioning target");
+MODULE_LICENSE("GPL");
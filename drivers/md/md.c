@@ -425,11 +425,9 @@ static int super_written_barrier(struct bio *bio, unsigned int bytes_done, int e
 	return super_written(bio, bytes_done, error);
 }
 
-void md_super_write(mddev_t *mddev, mdk_rdev_t *rdev,
-		   sector_t sector, int size, struct page *page)
+static void md_super_submit(mddev_t *mddev, mdk_rdev_t *rdev, struct bio *bio)
 {
-	/* write first size bytes of page to sector of rdev
-	 * Increment mddev->pending_writes before returning
+	/* Increment mddev->pending_writes before returning
 	 * and decrement it on completion, waking up sb_wait
 	 * if zero is reached.
 	 * If an error occurred, call md_error
@@ -437,12 +435,8 @@ void md_super_write(mddev_t *mddev, mdk_rdev_t *rdev,
 	 * As we might need to resubmit the request if BIO_RW_BARRIER
 	 * causes ENOTSUPP, we allocate a spare bio...
 	 */
-	struct bio *bio = bio_alloc(GFP_NOIO, 1);
 	int rw = (1<<BIO_RW) | (1<<BIO_RW_SYNC);
 
-	bio->bi_bdev = rdev->bdev;
-	bio->bi_sector = sector;
-	bio_add_page(bio, page, size, 0);
 	bio->bi_private = rdev;
 	bio->bi_end_io = super_written;
 	bio->bi_rw = rw;
@@ -459,6 +453,45 @@ void md_super_write(mddev_t *mddev, mdk_rdev_t *rdev,
 		submit_bio(rw, bio);
 }
 
+void md_super_write(mddev_t *mddev, mdk_rdev_t *rdev,
+		   sector_t sector, int size, struct page *page)
+{
+	/* write first size bytes of page to sector of rdev */
+	struct bio *bio = bio_alloc(GFP_NOIO, 1);
+
+	bio->bi_bdev = rdev->bdev;
+	bio->bi_sector = sector;
+	bio_add_page(bio, page, size, 0);
+	md_super_submit(mddev, rdev, bio);
+}
+
+/*
+ * Like md_super_write(), for @nr whole pages which are to go one after
+ * the other from @sector on.  They go down in as few bios as the device
+ * takes, so that there are fewer barriers too.
+ */
+void md_super_write_pages(mddev_t *mddev, mdk_rdev_t *rdev,
+			  sector_t sector, struct page **pages, int nr)
+{
+	struct bio *bio;
+	int i;
+
+	while (nr) {
+		bio = bio_alloc(GFP_NOIO, min(nr, BIO_MAX_PAGES));
+		bio->bi_bdev = rdev->bdev;
+		bio->bi_sector = sector;
+		bio_add_page(bio, pages[0], PAGE_SIZE, 0);
+		for (i = 1; i < nr && i < BIO_MAX_PAGES; i++)
+			if (bio_add_page(bio, pages[i], PAGE_SIZE, 0) < PAGE_SIZE)
+				break;
+		md_super_submit(mddev, rdev, bio);
+
+		sector += i * (PAGE_SIZE >> 9);
+		pages += i;
+		nr -= i;
+	}
+}
+
 void md_super_wait(mddev_t *mddev)
 {
 	/* wait for all superblock writes that were scheduled to complete.
@@ -2759,6 +2792,16 @@ sync_completed_show(mddev_t *mddev, char *page)
 
 static struct md_sysfs_entry md_sync_completed = __ATTR_RO(sync_completed);
 
+static ssize_t
+bitmap_stat_show(mddev_t *mddev, char *page)
+{
+	if (!mddev->bitmap)
+		return sprintf(page, "none\n");
+	return bitmap_stat(mddev->bitmap, page);
+}
+
+static struct md_sysfs_entry md_bitmap_stat = __ATTR_RO(bitmap_stat);
+
 static ssize_t
 suspend_lo_show(mddev_t *mddev, char *page)
 {
@@ -2837,6 +2880,7 @@ static struct attribute *md_redundancy_attrs[] = {
 	&md_sync_max.attr,
 	&md_sync_speed.attr,
 	&md_sync_completed.attr,
+	&md_bitmap_stat.attr,
 	&md_suspend_lo.attr,
 	&md_suspend_hi.attr,
 	NULL,
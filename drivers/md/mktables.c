@@ -119,6 +119,30 @@ int main(int argc, char *argv[])
     }
     printf("\n");
   }
+  printf("};\n");
+
+  /* Compute the split nibble tables of the vector recovery code: the
+     products of each multiplier and all low nibbles, then all high
+     nibbles, for a byte shuffle to look up in */
+  printf("\nconst u8 __attribute__((aligned(256)))\n"
+	 "raid6_vgfmul[256][32] =\n"
+	 "{\n");
+  for ( i = 0 ; i < 256 ; i++ ) {
+    printf("\t{\n");
+    for ( j = 0 ; j < 16 ; j += 8 ) {
+      printf("\t\t");
+      for ( k = 0 ; k < 8 ; k++ )
+	printf("0x%02x, ", gfmul(i,j+k));
+      printf("\n");
+    }
+    for ( j = 0 ; j < 16 ; j += 8 ) {
+      printf("\t\t");
+      for ( k = 0 ; k < 8 ; k++ )
+	printf("0x%02x, ", gfmul(i,(j+k) << 4));
+      printf("\n");
+    }
+    printf("\t},\n");
+  }
   printf("};\n\n");
 
   return 0;
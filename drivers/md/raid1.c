@@ -34,6 +34,8 @@
 #include "dm-bio-list.h"
 #include <linux/raid/raid1.h>
 #include <linux/raid/bitmap.h>
+#include <linux/ktime.h>
+#include <asm/div64.h>
 
 #define DEBUG 0
 #if DEBUG
@@ -255,6 +257,34 @@ static inline void update_head_pos(int disk, r1bio_t *r1_bio)
 		r1_bio->sector + (r1_bio->sectors);
 }
 
+static inline u64 raid1_now(void)
+{
+	struct timespec ts;
+
+	ktime_get_ts(&ts);
+	return timespec_to_ns(&ts);
+}
+
+/*
+ * Fold the time a read took into the average of its mirror.  A device
+ * which queues serves the reads in flight on it together, so the time is
+ * shared out between them.  A read which took longer than a second counts
+ * as one second.
+ */
+static void update_read_svc(int disk, r1bio_t *r1_bio)
+{
+	conf_t *conf = mddev_to_conf(r1_bio->mddev);
+	mirror_info_t *mirror = conf->mirrors + disk;
+	u64 t;
+
+	if (!r1_bio->read_start)
+		return;
+	t = raid1_now() - r1_bio->read_start;
+	do_div(t, NSEC_PER_USEC * r1_bio->read_depth);
+	t = min_t(u64, t, USEC_PER_SEC);
+	mirror->read_svc += (unsigned long)t - (mirror->read_svc >> 3);
+}
+
 static int raid1_end_read_request(struct bio *bio, unsigned int bytes_done, int error)
 {
 	int uptodate = test_bit(BIO_UPTODATE, &bio->bi_flags);
@@ -281,8 +311,10 @@ static int raid1_end_read_request(struct bio *bio, unsigned int bytes_done, int
 		 * user-side. So if something waits for IO, then it will
 		 * wait for the 'master' bio.
 		 */
-		if (uptodate)
+		if (uptodate) {
 			set_bit(R1BIO_Uptodate, &r1_bio->state);
+			update_read_svc(mirror, r1_bio);
+		}
 
 		raid_end_bio_io(r1_bio);
 	} else {
@@ -401,6 +433,50 @@ static int raid1_end_write_request(struct bio *bio, unsigned int bytes_done, int
 }
 
 
+/*
+ * RAID1_BALANCE_LOAD: a read which carries on from the last one sent to a
+ * mirror, or from where its head is, stays there, so that each sequential
+ * stream keeps to one mirror.  Any other read goes where it is expected to
+ * be served first: the reads in flight on a mirror and this one, times the
+ * average service time of the mirror.  A mirror without an average yet is
+ * tried first.  Write-mostly mirrors are only read from when there is
+ * nothing else, as always.
+ */
+static int read_balance_load(conf_t *conf, r1bio_t *r1_bio, int disk)
+{
+	const sector_t this_sector = r1_bio->sector;
+	int start = disk, best = disk;
+	u64 cost, best_cost = ~0ULL;
+	mirror_info_t *mirror;
+	mdk_rdev_t *rdev;
+
+	do {
+		mirror = conf->mirrors + disk;
+		rdev = rcu_dereference(mirror->rdev);
+
+		if (rdev && r1_bio->bios[disk] != IO_BLOCKED &&
+		    test_bit(In_sync, &rdev->flags) &&
+		    !test_bit(WriteMostly, &rdev->flags)) {
+			if (this_sector == mirror->next_seq_sect ||
+			    this_sector == mirror->head_position)
+				return disk;
+
+			cost = (u64)(atomic_read(&rdev->nr_pending) + 1) *
+				mirror->read_svc;
+			if (cost < best_cost) {
+				best_cost = cost;
+				best = disk;
+			}
+		}
+
+		if (disk <= 0)
+			disk = conf->raid_disks;
+		disk--;
+	} while (disk != start);
+
+	return best;
+}
+
 /*
  * This routine returns the disk from which the requested read should
  * be done. There is a per-array 'next expected sequential IO' sector
@@ -413,6 +489,9 @@ static int raid1_end_write_request(struct bio *bio, unsigned int bytes_done, int
  * If there are 2 mirrors in the same 2 devices, performance degrades
  * because position is mirror, not device based.
  *
+ * conf->read_policy RAID1_BALANCE_LOAD replaces the head distance by the
+ * load of the mirrors, see read_balance_load().
+ *
  * The rdev for the device selected will have nr_pending incremented.
  */
 static int read_balance(conf_t *conf, r1bio_t *r1_bio)
@@ -481,6 +560,11 @@ static int read_balance(conf_t *conf, r1bio_t *r1_bio)
 	disk = new_disk;
 	/* now disk == new_disk == starting point for search */
 
+	if (conf->read_policy == RAID1_BALANCE_LOAD) {
+		new_disk = read_balance_load(conf, r1_bio, disk);
+		goto rb_out;
+	}
+
 	/*
 	 * Don't change to another disk for sequential reads:
 	 */
@@ -533,6 +617,13 @@ static int read_balance(conf_t *conf, r1bio_t *r1_bio)
 		}
 		conf->next_seq_sect = this_sector + sectors;
 		conf->last_used = new_disk;
+		conf->mirrors[new_disk].next_seq_sect = this_sector + sectors;
+
+		r1_bio->read_start = 0;
+		if (conf->read_policy == RAID1_BALANCE_LOAD) {
+			r1_bio->read_start = raid1_now();
+			r1_bio->read_depth = atomic_read(&rdev->nr_pending);
+		}
 	}
 	rcu_read_unlock();
 
@@ -1056,6 +1147,8 @@ static int raid1_add_disk(mddev_t *mddev, mdk_rdev_t *rdev)
 				blk_queue_max_sectors(mddev->queue, PAGE_SIZE>>9);
 
 			p->head_position = 0;
+			p->next_seq_sect = 0;
+			p->read_svc = 0;
 			rdev->raid_disk = mirror;
 			found = 1;
 			/* As all devices are equivalent, we don't need a full recovery
@@ -1816,6 +1909,64 @@ static sector_t sync_request(mddev_t *mddev, sector_t sector_nr, int *skipped, i
 	return nr_sectors;
 }
 
+static char *raid1_read_policy[] = {
+	[RAID1_BALANCE_DISTANCE]	= "distance",
+	[RAID1_BALANCE_LOAD]		= "load",
+};
+
+static ssize_t
+raid1_show_read_balance(mddev_t *mddev, char *page)
+{
+	conf_t *conf = mddev_to_conf(mddev);
+	char *s = page;
+	int i;
+
+	if (!conf)
+		return 0;
+	for (i = 0; i < ARRAY_SIZE(raid1_read_policy); i++)
+		s += sprintf(s, i == conf->read_policy ? "[%s] " : "%s ",
+			     raid1_read_policy[i]);
+	s[-1] = '\n';
+	return s - page;
+}
+
+static ssize_t
+raid1_store_read_balance(mddev_t *mddev, const char *page, size_t len)
+{
+	conf_t *conf = mddev_to_conf(mddev);
+	size_t n = len;
+	int i;
+
+	if (len >= PAGE_SIZE)
+		return -EINVAL;
+	if (!conf)
+		return -ENODEV;
+
+	if (n && page[n-1] == '\n')
+		n--;
+	for (i = 0; i < ARRAY_SIZE(raid1_read_policy); i++)
+		if (n == strlen(raid1_read_policy[i]) &&
+		    strncmp(page, raid1_read_policy[i], n) == 0) {
+			conf->read_policy = i;
+			return len;
+		}
+	return -EINVAL;
+}
+
+static struct md_sysfs_entry
+raid1_read_balance = __ATTR(read_balance, S_IRUGO | S_IWUSR,
+			    raid1_show_read_balance,
+			    raid1_store_read_balance);
+
+static struct attribute *raid1_attrs[] =  {
+	&raid1_read_balance.attr,
+	NULL,
+};
+static struct attribute_group raid1_attrs_group = {
+	.name = NULL,
+	.attrs = raid1_attrs,
+};
+
 static int run(mddev_t *mddev)
 {
 	conf_t *conf;
@@ -1946,6 +2097,8 @@ static int run(mddev_t *mddev)
 	 */
 	mddev->array_size = mddev->size;
 
+	sysfs_create_group(&mddev->kobj, &raid1_attrs_group);
+
 	mddev->queue->unplug_fn = raid1_unplug;
 	mddev->queue->issue_flush_fn = raid1_issue_flush;
 
@@ -1984,6 +2137,7 @@ static int stop(mddev_t *mddev)
 		/* need to kick something here to make sure I/O goes? */
 	}
 
+	sysfs_remove_group(&mddev->kobj, &raid1_attrs_group);
 	md_unregister_thread(mddev->thread);
 	mddev->thread = NULL;
 	blk_sync_queue(mddev->queue); /* the unplug fn references 'conf'*/
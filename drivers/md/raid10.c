@@ -21,6 +21,8 @@
 #include "dm-bio-list.h"
 #include <linux/raid/raid10.h>
 #include <linux/raid/bitmap.h>
+#include <linux/ktime.h>
+#include <asm/div64.h>
 
 /*
  * RAID10 provides a combination of RAID0 and RAID1 functionality.
@@ -243,6 +245,34 @@ static inline void update_head_pos(int slot, r10bio_t *r10_bio)
 		r10_bio->devs[slot].addr + (r10_bio->sectors);
 }
 
+static inline u64 raid10_now(void)
+{
+	struct timespec ts;
+
+	ktime_get_ts(&ts);
+	return timespec_to_ns(&ts);
+}
+
+/*
+ * Fold the time a read took into the average of its mirror.  A device
+ * which queues serves the reads in flight on it together, so the time is
+ * shared out between them.  A read which took longer than a second counts
+ * as one second.
+ */
+static void update_read_svc(int slot, r10bio_t *r10_bio)
+{
+	conf_t *conf = mddev_to_conf(r10_bio->mddev);
+	mirror_info_t *mirror = conf->mirrors + r10_bio->devs[slot].devnum;
+	u64 t;
+
+	if (!r10_bio->read_start)
+		return;
+	t = raid10_now() - r10_bio->read_start;
+	do_div(t, NSEC_PER_USEC * r10_bio->read_depth);
+	t = min_t(u64, t, USEC_PER_SEC);
+	mirror->read_svc += (unsigned long)t - (mirror->read_svc >> 3);
+}
+
 static int raid10_end_read_request(struct bio *bio, unsigned int bytes_done, int error)
 {
 	int uptodate = test_bit(BIO_UPTODATE, &bio->bi_flags);
@@ -271,6 +301,7 @@ static int raid10_end_read_request(struct bio *bio, unsigned int bytes_done, int
 		 * wait for the 'master' bio.
 		 */
 		set_bit(R10BIO_Uptodate, &r10_bio->state);
+		update_read_svc(slot, r10_bio);
 		raid_end_bio_io(r10_bio);
 	} else {
 		/*
@@ -470,6 +501,46 @@ static int raid10_mergeable_bvec(request_queue_t *q, struct bio *bio,
 		return max;
 }
 
+/*
+ * RAID10_BALANCE_LOAD: a read which carries on from the last one sent to a
+ * mirror, or from where its head is, stays there, so that each sequential
+ * stream keeps to one mirror.  Any other read goes to the copy which is
+ * expected to be served first: the reads in flight on its mirror and this
+ * one, times the average service time of the mirror.  A mirror without an
+ * average yet is tried first.
+ */
+static int read_balance_load(conf_t *conf, r10bio_t *r10_bio, int slot)
+{
+	int best = slot;
+	u64 cost, best_cost = ~0ULL;
+	mirror_info_t *mirror;
+	mdk_rdev_t *rdev;
+	sector_t addr;
+
+	for (; slot < conf->copies; slot++) {
+		mirror = conf->mirrors + r10_bio->devs[slot].devnum;
+		addr = r10_bio->devs[slot].addr;
+
+		if ((rdev=rcu_dereference(mirror->rdev)) == NULL ||
+		    r10_bio->devs[slot].bio == IO_BLOCKED ||
+		    !test_bit(In_sync, &rdev->flags))
+			continue;
+
+		if (addr == mirror->next_seq_sect ||
+		    addr == mirror->head_position)
+			return slot;
+
+		cost = (u64)(atomic_read(&rdev->nr_pending) + 1) *
+			mirror->read_svc;
+		if (cost < best_cost) {
+			best_cost = cost;
+			best = slot;
+		}
+	}
+
+	return best;
+}
+
 /*
  * This routine returns the disk from which the requested read should
  * be done. There is a per-array 'next expected sequential IO' sector
@@ -482,6 +553,9 @@ static int raid10_mergeable_bvec(request_queue_t *q, struct bio *bio,
  * If there are 2 mirrors in the same 2 devices, performance degrades
  * because position is mirror, not device based.
  *
+ * conf->read_policy RAID10_BALANCE_LOAD replaces the head distance by the
+ * load of the mirrors, see read_balance_load().
+ *
  * The rdev for the device selected will have nr_pending incremented.
  */
 
@@ -540,6 +614,11 @@ static int read_balance(conf_t *conf, r10bio_t *r10_bio)
 		disk = r10_bio->devs[slot].devnum;
 	}
 
+	if (conf->read_policy == RAID10_BALANCE_LOAD) {
+		slot = read_balance_load(conf, r10_bio, slot);
+		disk = r10_bio->devs[slot].devnum;
+		goto rb_out;
+	}
 
 	current_distance = abs(r10_bio->devs[slot].addr -
 			       conf->mirrors[disk].head_position);
@@ -577,9 +656,17 @@ rb_out:
 	r10_bio->read_slot = slot;
 /*	conf->next_seq_sect = this_sector + sectors;*/
 
-	if (disk >= 0 && (rdev=rcu_dereference(conf->mirrors[disk].rdev))!= NULL)
+	if (disk >= 0 && (rdev=rcu_dereference(conf->mirrors[disk].rdev))!= NULL) {
 		atomic_inc(&conf->mirrors[disk].rdev->nr_pending);
-	else
+		conf->mirrors[disk].next_seq_sect =
+			r10_bio->devs[slot].addr + sectors;
+
+		r10_bio->read_start = 0;
+		if (conf->read_policy == RAID10_BALANCE_LOAD) {
+			r10_bio->read_start = raid10_now();
+			r10_bio->read_depth = atomic_read(&rdev->nr_pending);
+		}
+	} else
 		disk = -1;
 	rcu_read_unlock();
 
@@ -1080,6 +1167,8 @@ static int raid10_add_disk(mddev_t *mddev, mdk_rdev_t *rdev)
 				mddev->queue->max_sectors = (PAGE_SIZE>>9);
 
 			p->head_position = 0;
+			p->next_seq_sect = 0;
+			p->read_svc = 0;
 			rdev->raid_disk = mirror;
 			found = 1;
 			if (rdev->saved_raid_disk != mirror)
@@ -1929,6 +2018,64 @@ static sector_t sync_request(mddev_t *mddev, sector_t sector_nr, int *skipped, i
 	}
 }
 
+static char *raid10_read_policy[] = {
+	[RAID10_BALANCE_DISTANCE]	= "distance",
+	[RAID10_BALANCE_LOAD]		= "load",
+};
+
+static ssize_t
+raid10_show_read_balance(mddev_t *mddev, char *page)
+{
+	conf_t *conf = mddev_to_conf(mddev);
+	char *s = page;
+	int i;
+
+	if (!conf)
+		return 0;
+	for (i = 0; i < ARRAY_SIZE(raid10_read_policy); i++)
+		s += sprintf(s, i == conf->read_policy ? "[%s] " : "%s ",
+			     raid10_read_policy[i]);
+	s[-1] = '\n';
+	return s - page;
+}
+
+static ssize_t
+raid10_store_read_balance(mddev_t *mddev, const char *page, size_t len)
+{
+	conf_t *conf = mddev_to_conf(mddev);
+	size_t n = len;
+	int i;
+
+	if (len >= PAGE_SIZE)
+		return -EINVAL;
+	if (!conf)
+		return -ENODEV;
+
+	if (n && page[n-1] == '\n')
+		n--;
+	for (i = 0; i < ARRAY_SIZE(raid10_read_policy); i++)
+		if (n == strlen(raid10_read_policy[i]) &&
+		    strncmp(page, raid10_read_policy[i], n) == 0) {
+			conf->read_policy = i;
+			return len;
+		}
+	return -EINVAL;
+}
+
+static struct md_sysfs_entry
+raid10_read_balance = __ATTR(read_balance, S_IRUGO | S_IWUSR,
+			     raid10_show_read_balance,
+			     raid10_store_read_balance);
+
+static struct attribute *raid10_attrs[] =  {
+	&raid10_read_balance.attr,
+	NULL,
+};
+static struct attribute_group raid10_attrs_group = {
+	.name = NULL,
+	.attrs = raid10_attrs,
+};
+
 static int run(mddev_t *mddev)
 {
 	conf_t *conf;
@@ -2091,6 +2238,8 @@ static int run(mddev_t *mddev)
 
 	if (conf->near_copies < mddev->raid_disks)
 		blk_queue_merge_bvec(mddev->queue, raid10_mergeable_bvec);
+
+	sysfs_create_group(&mddev->kobj, &raid10_attrs_group);
 	return 0;
 
 out_free_conf:
@@ -2108,6 +2257,7 @@ static int stop(mddev_t *mddev)
 {
 	conf_t *conf = mddev_to_conf(mddev);
 
+	sysfs_remove_group(&mddev->kobj, &raid10_attrs_group);
 	md_unregister_thread(mddev->thread);
 	mddev->thread = NULL;
 	blk_sync_queue(mddev->queue); /* the unplug fn references 'conf'*/
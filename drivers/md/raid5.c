@@ -50,6 +50,7 @@
 #include <linux/kthread.h>
 #include <asm/atomic.h>
 #include "raid6.h"
+#include "async_tx.h"
 
 #include <linux/raid/bitmap.h>
 
@@ -122,6 +123,8 @@ static void __release_stripe(raid5_conf_t *conf, struct stripe_head *sh)
 			} else {
 				clear_bit(STRIPE_BIT_DELAY, &sh->state);
 				list_add_tail(&sh->lru, &conf->handle_list);
+				if (conf->worker_cnt)
+					wake_up(&conf->wait_for_work);
 			}
 			md_wakeup_thread(conf->mddev->thread);
 		} else {
@@ -909,11 +912,10 @@ static sector_t compute_blocknr(struct stripe_head *sh, int i)
  * Multiple bion are linked together on bi_next.  There may be extras
  * at the end of this list.  We ignore them.
  */
-static void copy_data(int frombio, struct bio *bio,
+static void copy_data(struct async_tx *tx, int frombio, struct bio *bio,
 		     struct page *page,
 		     sector_t sector)
 {
-	char *pa = page_address(page);
 	struct bio_vec *bvl;
 	int i;
 	int page_offset;
@@ -938,12 +940,14 @@ static void copy_data(int frombio, struct bio *bio,
 		else clen = len;
 
 		if (clen > 0) {
-			char *ba = __bio_kmap_atomic(bio, i, KM_USER0);
 			if (frombio)
-				memcpy(pa+page_offset, ba+b_offset, clen);
+				async_memcpy(tx, page, page_offset,
+					     bvl->bv_page,
+					     bvl->bv_offset + b_offset, clen);
 			else
-				memcpy(ba+b_offset, pa+page_offset, clen);
-			__bio_kunmap_atomic(ba, KM_USER0);
+				async_memcpy(tx, bvl->bv_page,
+					     bvl->bv_offset + b_offset,
+					     page, page_offset, clen);
 		}
 		if (clen < len) /* hit end of page */
 			break;
@@ -951,40 +955,36 @@ static void copy_data(int frombio, struct bio *bio,
 	}
 }
 
-#define check_xor() 	do { 						\
-			   if (count == MAX_XOR_BLOCKS) {		\
-				xor_block(count, STRIPE_SIZE, ptr);	\
-				count = 1;				\
-			   }						\
-			} while(0)
-
+/*
+ * The parity work below is done by chains of async_tx operations, offloaded
+ * to a DMA engine if there is one which can.  Each function waits for its
+ * chain before it updates the state of the stripe.
+ */
 
 static void compute_block(struct stripe_head *sh, int dd_idx)
 {
 	int i, count, disks = sh->disks;
-	void *ptr[MAX_XOR_BLOCKS], *p;
+	struct page *srcs[disks];
+	struct async_tx tx;
 
 	PRINTK("compute_block, stripe %llu, idx %d\n", 
 		(unsigned long long)sh->sector, dd_idx);
 
-	ptr[0] = page_address(sh->dev[dd_idx].page);
-	memset(ptr[0], 0, STRIPE_SIZE);
-	count = 1;
+	count = 0;
 	for (i = disks ; i--; ) {
 		if (i == dd_idx)
 			continue;
-		p = page_address(sh->dev[i].page);
 		if (test_bit(R5_UPTODATE, &sh->dev[i].flags))
-			ptr[count++] = p;
+			srcs[count++] = sh->dev[i].page;
 		else
 			printk(KERN_ERR "compute_block() %d, stripe %llu, %d"
 				" not present\n", dd_idx,
 				(unsigned long long)sh->sector, i);
-
-		check_xor();
 	}
-	if (count != 1)
-		xor_block(count, STRIPE_SIZE, ptr);
+	async_tx_init(&tx);
+	async_xor(&tx, sh->dev[dd_idx].page, srcs, count, STRIPE_SIZE,
+		  ASYNC_TX_XOR_ZERO_DST);
+	async_tx_wait(&tx);
 	set_bit(R5_UPTODATE, &sh->dev[dd_idx].flags);
 }
 
@@ -992,14 +992,15 @@ static void compute_parity5(struct stripe_head *sh, int method)
 {
 	raid5_conf_t *conf = sh->raid_conf;
 	int i, pd_idx = sh->pd_idx, disks = sh->disks, count;
-	void *ptr[MAX_XOR_BLOCKS];
+	struct page *srcs[disks], *parity = sh->dev[pd_idx].page;
 	struct bio *chosen;
+	struct async_tx tx;
 
 	PRINTK("compute_parity5, stripe %llu, method %d\n",
 		(unsigned long long)sh->sector, method);
 
-	count = 1;
-	ptr[0] = page_address(sh->dev[pd_idx].page);
+	async_tx_init(&tx);
+	count = 0;
 	switch(method) {
 	case READ_MODIFY_WRITE:
 		BUG_ON(!test_bit(R5_UPTODATE, &sh->dev[pd_idx].flags));
@@ -1008,7 +1009,7 @@ static void compute_parity5(struct stripe_head *sh, int method)
 				continue;
 			if (sh->dev[i].towrite &&
 			    test_bit(R5_UPTODATE, &sh->dev[i].flags)) {
-				ptr[count++] = page_address(sh->dev[i].page);
+				srcs[count++] = sh->dev[i].page;
 				chosen = sh->dev[i].towrite;
 				sh->dev[i].towrite = NULL;
 
@@ -1017,12 +1018,10 @@ static void compute_parity5(struct stripe_head *sh, int method)
 
 				BUG_ON(sh->dev[i].written);
 				sh->dev[i].written = chosen;
-				check_xor();
 			}
 		}
 		break;
 	case RECONSTRUCT_WRITE:
-		memset(ptr[0], 0, STRIPE_SIZE);
 		for (i= disks; i-- ;)
 			if (i!=pd_idx && sh->dev[i].towrite) {
 				chosen = sh->dev[i].towrite;
@@ -1038,9 +1037,10 @@ static void compute_parity5(struct stripe_head *sh, int method)
 	case CHECK_PARITY:
 		break;
 	}
-	if (count>1) {
-		xor_block(count, STRIPE_SIZE, ptr);
-		count = 1;
+	/* the old data comes out of the parity before it is overwritten */
+	if (count) {
+		async_xor(&tx, parity, srcs, count, STRIPE_SIZE, 0);
+		count = 0;
 	}
 	
 	for (i = disks; i--;)
@@ -1048,7 +1048,7 @@ static void compute_parity5(struct stripe_head *sh, int method)
 			sector_t sector = sh->dev[i].sector;
 			struct bio *wbi = sh->dev[i].written;
 			while (wbi && wbi->bi_sector < sector + STRIPE_SECTORS) {
-				copy_data(1, wbi, sh->dev[i].page, sector);
+				copy_data(&tx, 1, wbi, sh->dev[i].page, sector);
 				wbi = r5_next_bio(wbi, sector);
 			}
 
@@ -1060,20 +1060,17 @@ static void compute_parity5(struct stripe_head *sh, int method)
 	case RECONSTRUCT_WRITE:
 	case CHECK_PARITY:
 		for (i=disks; i--;)
-			if (i != pd_idx) {
-				ptr[count++] = page_address(sh->dev[i].page);
-				check_xor();
-			}
+			if (i != pd_idx)
+				srcs[count++] = sh->dev[i].page;
 		break;
 	case READ_MODIFY_WRITE:
 		for (i = disks; i--;)
-			if (sh->dev[i].written) {
-				ptr[count++] = page_address(sh->dev[i].page);
-				check_xor();
-			}
+			if (sh->dev[i].written)
+				srcs[count++] = sh->dev[i].page;
 	}
-	if (count != 1)
-		xor_block(count, STRIPE_SIZE, ptr);
+	async_xor(&tx, parity, srcs, count, STRIPE_SIZE,
+		  method == RECONSTRUCT_WRITE ? ASYNC_TX_XOR_ZERO_DST : 0);
+	async_tx_wait(&tx);
 	
 	if (method != CHECK_PARITY) {
 		set_bit(R5_UPTODATE, &sh->dev[pd_idx].flags);
@@ -1082,16 +1079,36 @@ static void compute_parity5(struct stripe_head *sh, int method)
 		clear_bit(R5_UPTODATE, &sh->dev[pd_idx].flags);
 }
 
+/* The pages of a stripe in syndrome order: the data, then P, then Q */
+static void raid6_stripe_blocks(struct stripe_head *sh, struct page **blocks)
+{
+	int disks = sh->raid_conf->raid_disks;
+	int qd_idx = raid6_next_disk(sh->pd_idx, disks);
+	int d0_idx = raid6_next_disk(qd_idx, disks);
+	int i, count;
+
+	/* Note that unlike RAID-5, the ordering of the disks matters greatly. */
+	/* FIX: Is this ordering of drives even remotely optimal? */
+	count = 0;
+	i = d0_idx;
+	do {
+		blocks[count++] = sh->dev[i].page;
+		if (count <= disks-2 && !test_bit(R5_UPTODATE, &sh->dev[i].flags))
+			printk("block %d/%d not uptodate on parity calc\n", i,count);
+		i = raid6_next_disk(i, disks);
+	} while ( i != d0_idx );
+}
+
 static void compute_parity6(struct stripe_head *sh, int method)
 {
 	raid6_conf_t *conf = sh->raid_conf;
-	int i, pd_idx = sh->pd_idx, qd_idx, d0_idx, disks = conf->raid_disks, count;
+	int i, pd_idx = sh->pd_idx, qd_idx, disks = conf->raid_disks;
 	struct bio *chosen;
 	/**** FIX THIS: This could be very bad if disks is close to 256 ****/
-	void *ptrs[disks];
+	struct page *blocks[disks];
+	struct async_tx tx;
 
 	qd_idx = raid6_next_disk(pd_idx, disks);
-	d0_idx = raid6_next_disk(qd_idx, disks);
 
 	PRINTK("compute_parity, stripe %llu, method %d\n",
 		(unsigned long long)sh->sector, method);
@@ -1116,12 +1133,13 @@ static void compute_parity6(struct stripe_head *sh, int method)
 		BUG();		/* Not implemented yet */
 	}
 
+	async_tx_init(&tx);
 	for (i = disks; i--;)
 		if (sh->dev[i].written) {
 			sector_t sector = sh->dev[i].sector;
 			struct bio *wbi = sh->dev[i].written;
 			while (wbi && wbi->bi_sector < sector + STRIPE_SECTORS) {
-				copy_data(1, wbi, sh->dev[i].page, sector);
+				copy_data(&tx, 1, wbi, sh->dev[i].page, sector);
 				wbi = r5_next_bio(wbi, sector);
 			}
 
@@ -1129,24 +1147,9 @@ static void compute_parity6(struct stripe_head *sh, int method)
 			set_bit(R5_UPTODATE, &sh->dev[i].flags);
 		}
 
-//	switch(method) {
-//	case RECONSTRUCT_WRITE:
-//	case CHECK_PARITY:
-//	case UPDATE_PARITY:
-		/* Note that unlike RAID-5, the ordering of the disks matters greatly. */
-		/* FIX: Is this ordering of drives even remotely optimal? */
-		count = 0;
-		i = d0_idx;
-		do {
-			ptrs[count++] = page_address(sh->dev[i].page);
-			if (count <= disks-2 && !test_bit(R5_UPTODATE, &sh->dev[i].flags))
-				printk("block %d/%d not uptodate on parity calc\n", i,count);
-			i = raid6_next_disk(i, disks);
-		} while ( i != d0_idx );
-//		break;
-//	}
-
-	raid6_call.gen_syndrome(disks, STRIPE_SIZE, ptrs);
+	raid6_stripe_blocks(sh, blocks);
+	async_gen_syndrome(&tx, blocks, disks, STRIPE_SIZE);
+	async_tx_wait(&tx);
 
 	switch(method) {
 	case RECONSTRUCT_WRITE:
@@ -1168,7 +1171,6 @@ static void compute_block_1(struct stripe_head *sh, int dd_idx, int nozero)
 {
 	raid6_conf_t *conf = sh->raid_conf;
 	int i, count, disks = conf->raid_disks;
-	void *ptr[MAX_XOR_BLOCKS], *p;
 	int pd_idx = sh->pd_idx;
 	int qd_idx = raid6_next_disk(pd_idx, disks);
 
@@ -1179,24 +1181,24 @@ static void compute_block_1(struct stripe_head *sh, int dd_idx, int nozero)
 		/* We're actually computing the Q drive */
 		compute_parity6(sh, UPDATE_PARITY);
 	} else {
-		ptr[0] = page_address(sh->dev[dd_idx].page);
-		if (!nozero) memset(ptr[0], 0, STRIPE_SIZE);
-		count = 1;
+		struct page *srcs[disks];
+		struct async_tx tx;
+
+		count = 0;
 		for (i = disks ; i--; ) {
 			if (i == dd_idx || i == qd_idx)
 				continue;
-			p = page_address(sh->dev[i].page);
 			if (test_bit(R5_UPTODATE, &sh->dev[i].flags))
-				ptr[count++] = p;
+				srcs[count++] = sh->dev[i].page;
 			else
 				printk("compute_block() %d, stripe %llu, %d"
 				       " not present\n", dd_idx,
 				       (unsigned long long)sh->sector, i);
-
-			check_xor();
 		}
-		if (count != 1)
-			xor_block(count, STRIPE_SIZE, ptr);
+		async_tx_init(&tx);
+		async_xor(&tx, sh->dev[dd_idx].page, srcs, count, STRIPE_SIZE,
+			  nozero ? 0 : ASYNC_TX_XOR_ZERO_DST);
+		async_tx_wait(&tx);
 		if (!nozero) set_bit(R5_UPTODATE, &sh->dev[dd_idx].flags);
 		else clear_bit(R5_UPTODATE, &sh->dev[dd_idx].flags);
 	}
@@ -1393,6 +1395,7 @@ static void handle_stripe5(struct stripe_head *sh)
 	int non_overwrite = 0;
 	int failed_num=0;
 	struct r5dev *dev;
+	struct async_tx tx;
 
 	PRINTK("handling stripe %llu, cnt=%d, pd_idx=%d\n",
 		(unsigned long long)sh->sector, atomic_read(&sh->count),
@@ -1401,6 +1404,7 @@ static void handle_stripe5(struct stripe_head *sh)
 	spin_lock(&sh->lock);
 	clear_bit(STRIPE_HANDLE, &sh->state);
 	clear_bit(STRIPE_DELAYED, &sh->state);
+	async_tx_init(&tx);
 
 	syncing = test_bit(STRIPE_SYNCING, &sh->state);
 	expanding = test_bit(STRIPE_EXPAND_SOURCE, &sh->state);
@@ -1426,7 +1430,7 @@ static void handle_stripe5(struct stripe_head *sh)
 				wake_up(&conf->wait_for_overlap);
 			spin_unlock_irq(&conf->device_lock);
 			while (rbi && rbi->bi_sector < dev->sector + STRIPE_SECTORS) {
-				copy_data(0, rbi, dev->page, dev->sector);
+				copy_data(&tx, 0, rbi, dev->page, dev->sector);
 				rbi2 = r5_next_bio(rbi, dev->sector);
 				spin_lock_irq(&conf->device_lock);
 				if (--rbi->bi_phys_segments == 0) {
@@ -1464,6 +1468,8 @@ static void handle_stripe5(struct stripe_head *sh)
 			set_bit(R5_Insync, &dev->flags);
 	}
 	rcu_read_unlock();
+	/* the reads are copied out before the pages change again */
+	async_tx_wait(&tx);
 	PRINTK("locked=%d uptodate=%d to_read=%d"
 		" to_write=%d failed=%d failed_num=%d\n",
 		locked, uptodate, to_read, to_write, failed, failed_num);
@@ -1946,6 +1952,7 @@ static void handle_stripe6(struct stripe_head *sh, struct page *tmp_page)
 	int pd_idx = sh->pd_idx;
 	int qd_idx = raid6_next_disk(pd_idx, disks);
 	int p_failed, q_failed;
+	struct async_tx tx;
 
 	PRINTK("handling stripe %llu, state=%#lx cnt=%d, pd_idx=%d, qd_idx=%d\n",
 	       (unsigned long long)sh->sector, sh->state, atomic_read(&sh->count),
@@ -1954,6 +1961,7 @@ static void handle_stripe6(struct stripe_head *sh, struct page *tmp_page)
 	spin_lock(&sh->lock);
 	clear_bit(STRIPE_HANDLE, &sh->state);
 	clear_bit(STRIPE_DELAYED, &sh->state);
+	async_tx_init(&tx);
 
 	syncing = test_bit(STRIPE_SYNCING, &sh->state);
 	/* Now to look around and see what can be done */
@@ -1977,7 +1985,7 @@ static void handle_stripe6(struct stripe_head *sh, struct page *tmp_page)
 				wake_up(&conf->wait_for_overlap);
 			spin_unlock_irq(&conf->device_lock);
 			while (rbi && rbi->bi_sector < dev->sector + STRIPE_SECTORS) {
-				copy_data(0, rbi, dev->page, dev->sector);
+				copy_data(&tx, 0, rbi, dev->page, dev->sector);
 				rbi2 = r5_next_bio(rbi, dev->sector);
 				spin_lock_irq(&conf->device_lock);
 				if (--rbi->bi_phys_segments == 0) {
@@ -2016,6 +2024,8 @@ static void handle_stripe6(struct stripe_head *sh, struct page *tmp_page)
 			set_bit(R5_Insync, &dev->flags);
 	}
 	rcu_read_unlock();
+	/* the reads are copied out before the pages change again */
+	async_tx_wait(&tx);
 	PRINTK("locked=%d uptodate=%d to_read=%d"
 	       " to_write=%d failed=%d failed_num=%d,%d\n",
 	       locked, uptodate, to_read, to_write, failed,
@@ -2320,7 +2330,18 @@ static void handle_stripe6(struct stripe_head *sh, struct page *tmp_page)
 		 * by stripe_handle with a tmp_page - just wait until then.
 		 */
 		if (tmp_page) {
-			if (failed == q_failed) {
+			if (failed == 0) {
+				/* P and Q can both be checked, in one go */
+				struct page *blocks[disks];
+				u32 bad;
+
+				raid6_stripe_blocks(sh, blocks);
+				async_syndrome_val(&tx, blocks, disks,
+						   STRIPE_SIZE, tmp_page, &bad);
+				async_tx_wait(&tx);
+				update_p = !!(bad & ASYNC_TX_P_BAD);
+				update_q = !!(bad & ASYNC_TX_Q_BAD);
+			} else if (failed == q_failed) {
 				/* The only possible failed device holds 'Q', so it makes
 				 * sense to check P (If anything else were failed, we would
 				 * have used P to recreate it).
@@ -2330,8 +2351,7 @@ static void handle_stripe6(struct stripe_head *sh, struct page *tmp_page)
 					compute_block_1(sh,pd_idx,0);
 					update_p = 1;
 				}
-			}
-			if (!q_failed && failed < 2) {
+			} else if (!q_failed && failed < 2) {
 				/* q is not failed, and we didn't use it to generate
 				 * anything, so it makes sense to check it
 				 */
@@ -2999,6 +3019,122 @@ static void raid5d (mddev_t *mddev)
 	PRINTK("--- raid5d inactive\n");
 }
 
+/*
+ * Stripe handling threads.
+ *
+ * raid5d is the only thread which deals with the bitmap, delayed
+ * stripes and recovery, but handle_stripe() can be run for different
+ * stripes at the same time (make_request() already does so), so when
+ * group_thread_cnt is set the stripes on handle_list are also pulled
+ * by a number of worker threads, each with its own spare page.
+ * A stripe is only ever handled by whoever took it off the list.
+ */
+static int raid5_worker_thread(void *arg)
+{
+	struct raid5_worker *worker = arg;
+	raid5_conf_t *conf = worker->conf;
+	struct stripe_head *sh;
+	DEFINE_WAIT(wait);
+	int handled;
+
+	while (!kthread_should_stop()) {
+		prepare_to_wait_exclusive(&conf->wait_for_work, &wait,
+					  TASK_INTERRUPTIBLE);
+		if (list_empty(&conf->handle_list) && !kthread_should_stop())
+			schedule();
+		finish_wait(&conf->wait_for_work, &wait);
+		try_to_freeze();
+
+		handled = 0;
+		spin_lock_irq(&conf->device_lock);
+		while (!list_empty(&conf->handle_list)) {
+			sh = list_entry(conf->handle_list.next,
+					struct stripe_head, lru);
+			list_del_init(&sh->lru);
+			atomic_inc(&sh->count);
+			BUG_ON(atomic_read(&sh->count) != 1);
+			spin_unlock_irq(&conf->device_lock);
+
+			handled++;
+			handle_stripe(sh, worker->spare_page);
+			release_stripe(sh);
+
+			spin_lock_irq(&conf->device_lock);
+		}
+		spin_unlock_irq(&conf->device_lock);
+
+		if (handled)
+			unplug_slaves(conf->mddev);
+	}
+	return 0;
+}
+
+static void raid5_stop_workers(raid5_conf_t *conf)
+{
+	struct raid5_worker *workers = conf->workers;
+	int i, cnt = conf->worker_cnt;
+
+	if (!workers)
+		return;
+
+	spin_lock_irq(&conf->device_lock);
+	conf->worker_cnt = 0;
+	spin_unlock_irq(&conf->device_lock);
+
+	for (i = 0; i < cnt; i++) {
+		kthread_stop(workers[i].tsk);
+		safe_put_page(workers[i].spare_page);
+	}
+	conf->workers = NULL;
+	kfree(workers);
+	/* anything the workers left behind is picked up by raid5d */
+	md_wakeup_thread(conf->mddev->thread);
+}
+
+static int raid5_start_workers(raid5_conf_t *conf, int cnt)
+{
+	mddev_t *mddev = conf->mddev;
+	struct raid5_worker *workers;
+	int i;
+
+	workers = kzalloc(cnt * sizeof(*workers), GFP_KERNEL);
+	if (!workers)
+		return -ENOMEM;
+
+	for (i = 0; i < cnt; i++) {
+		struct raid5_worker *worker = workers + i;
+
+		worker->conf = conf;
+		if (conf->level == 6) {
+			worker->spare_page = alloc_page(GFP_KERNEL);
+			if (!worker->spare_page)
+				goto abort;
+		}
+		worker->tsk = kthread_run(raid5_worker_thread, worker,
+					  "%s_raid5_%d", mdname(mddev), i);
+		if (IS_ERR(worker->tsk)) {
+			worker->tsk = NULL;
+			goto abort;
+		}
+	}
+
+	spin_lock_irq(&conf->device_lock);
+	conf->workers = workers;
+	conf->worker_cnt = cnt;
+	spin_unlock_irq(&conf->device_lock);
+	wake_up(&conf->wait_for_work);
+	return 0;
+
+abort:
+	for (i = 0; i < cnt; i++) {
+		if (workers[i].tsk)
+			kthread_stop(workers[i].tsk);
+		safe_put_page(workers[i].spare_page);
+	}
+	kfree(workers);
+	return -ENOMEM;
+}
+
 static ssize_t
 raid5_show_stripe_cache_size(mddev_t *mddev, char *page)
 {
@@ -3057,9 +3193,53 @@ stripe_cache_active_show(mddev_t *mddev, char *page)
 static struct md_sysfs_entry
 raid5_stripecache_active = __ATTR_RO(stripe_cache_active);
 
+static ssize_t
+raid5_show_group_thread_cnt(mddev_t *mddev, char *page)
+{
+	raid5_conf_t *conf = mddev_to_conf(mddev);
+	if (conf)
+		return sprintf(page, "%d\n", conf->worker_cnt);
+	else
+		return 0;
+}
+
+static ssize_t
+raid5_store_group_thread_cnt(mddev_t *mddev, const char *page, size_t len)
+{
+	raid5_conf_t *conf = mddev_to_conf(mddev);
+	char *end;
+	int new, err;
+	if (len >= PAGE_SIZE)
+		return -EINVAL;
+	if (!conf)
+		return -ENODEV;
+
+	new = simple_strtoul(page, &end, 10);
+	if (!*page || (*end && *end != '\n') )
+		return -EINVAL;
+	if (new < 0 || new > num_possible_cpus())
+		return -EINVAL;
+	if (new == conf->worker_cnt)
+		return len;
+
+	raid5_stop_workers(conf);
+	if (new) {
+		err = raid5_start_workers(conf, new);
+		if (err)
+			return err;
+	}
+	return len;
+}
+
+static struct md_sysfs_entry
+raid5_group_thread_cnt = __ATTR(group_thread_cnt, S_IRUGO | S_IWUSR,
+				raid5_show_group_thread_cnt,
+				raid5_store_group_thread_cnt);
+
 static struct attribute *raid5_attrs[] =  {
 	&raid5_stripecache_size.attr,
 	&raid5_stripecache_active.attr,
+	&raid5_group_thread_cnt.attr,
 	NULL,
 };
 static struct attribute_group raid5_attrs_group = {
@@ -3153,6 +3333,7 @@ static int run(mddev_t *mddev)
 	spin_lock_init(&conf->device_lock);
 	init_waitqueue_head(&conf->wait_for_stripe);
 	init_waitqueue_head(&conf->wait_for_overlap);
+	init_waitqueue_head(&conf->wait_for_work);
 	INIT_LIST_HEAD(&conf->handle_list);
 	INIT_LIST_HEAD(&conf->delayed_list);
 	INIT_LIST_HEAD(&conf->bitmap_list);
@@ -3322,6 +3503,7 @@ static int stop(mddev_t *mddev)
 {
 	raid5_conf_t *conf = (raid5_conf_t *) mddev->private;
 
+	raid5_stop_workers(conf);
 	md_unregister_thread(mddev->thread);
 	mddev->thread = NULL;
 	shrink_stripes(conf);
@@ -3753,6 +3935,9 @@ static int __init raid5_init(void)
 	e = raid6_select_algo();
 	if ( e )
 		return e;
+	e = async_tx_register();
+	if (e)
+		return e;
 	register_md_personality(&raid6_personality);
 	register_md_personality(&raid5_personality);
 	register_md_personality(&raid4_personality);
@@ -3764,6 +3949,7 @@ static void raid5_exit(void)
 	unregister_md_personality(&raid6_personality);
 	unregister_md_personality(&raid5_personality);
 	unregister_md_personality(&raid4_personality);
+	async_tx_unregister();
 }
 
 module_init(raid5_init);
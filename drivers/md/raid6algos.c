@@ -24,6 +24,9 @@
 
 struct raid6_calls raid6_call;
 
+void (*raid6_2data_recov)(int, size_t, int, int, void **);
+void (*raid6_datap_recov)(int, size_t, int, void **);
+
 /* Various routine sets */
 extern const struct raid6_calls raid6_intx1;
 extern const struct raid6_calls raid6_intx2;
@@ -42,6 +45,8 @@ extern const struct raid6_calls raid6_altivec1;
 extern const struct raid6_calls raid6_altivec2;
 extern const struct raid6_calls raid6_altivec4;
 extern const struct raid6_calls raid6_altivec8;
+extern const struct raid6_recov_calls raid6_recov_intx1;
+extern const struct raid6_recov_calls raid6_recov_ssse3;
 
 const struct raid6_calls * const raid6_algos[] = {
 	&raid6_intx1,
@@ -74,6 +79,14 @@ const struct raid6_calls * const raid6_algos[] = {
 	NULL
 };
 
+const struct raid6_recov_calls * const raid6_recov_algos[] = {
+	&raid6_recov_intx1,
+#if defined(__i386__) || defined(__x86_64__)
+	&raid6_recov_ssse3,
+#endif
+	NULL
+};
+
 #ifdef __KERNEL__
 #define RAID6_TIME_JIFFIES_LG2	4
 #else
@@ -81,6 +94,62 @@ const struct raid6_calls * const raid6_algos[] = {
 #define RAID6_TIME_JIFFIES_LG2	9
 #endif
 
+/* Time the recovery routines on the syndrome just computed, with the
+   first two data pages failed, and pick the fastest */
+static int __init raid6_select_recov(int disks, void **dptrs)
+{
+	const struct raid6_recov_calls * const * algo;
+	const struct raid6_recov_calls * best;
+	char *failed;
+	unsigned long perf, bestperf;
+	unsigned long j0, j1;
+
+	/* The failed pages are written to, the data ones are tables */
+	failed = (void *) __get_free_pages(GFP_KERNEL, 1);
+	if ( !failed ) {
+		printk("raid6: Yikes!  No memory available.\n");
+		return -ENOMEM;
+	}
+	dptrs[0] = failed;
+	dptrs[1] = failed + PAGE_SIZE;
+
+	bestperf = 0;  best = NULL;
+
+	for ( algo = raid6_recov_algos ; *algo ; algo++ ) {
+		if ( !(*algo)->valid || (*algo)->valid() ) {
+			perf = 0;
+
+			preempt_disable();
+			j0 = jiffies;
+			while ( (j1 = jiffies) == j0 )
+				cpu_relax();
+			while ( (jiffies-j1) < (1 << RAID6_TIME_JIFFIES_LG2) ) {
+				(*algo)->data2(disks, PAGE_SIZE, 0, 1, dptrs);
+				perf++;
+			}
+			preempt_enable();
+
+			if ( perf > bestperf ) {
+				best = *algo;
+				bestperf = perf;
+			}
+			printk("raid6: %-8s %5ld MB/s recovery\n", (*algo)->name,
+			       (perf*HZ) >> (20-16+RAID6_TIME_JIFFIES_LG2));
+		}
+	}
+
+	/* The scalar code is always valid */
+	printk("raid6: using recovery algorithm %s (%ld MB/s)\n",
+	       best->name,
+	       (bestperf*HZ) >> (20-16+RAID6_TIME_JIFFIES_LG2));
+	raid6_2data_recov = best->data2;
+	raid6_datap_recov = best->datap;
+
+	free_pages((unsigned long)failed, 1);
+
+	return 0;
+}
+
 /* Try to pick the best algorithm */
 /* This code uses the gfmul table as convenient data set to abuse */
 
@@ -147,7 +216,10 @@ int __init raid6_select_algo(void)
 	} else
 		printk("raid6: Yikes!  No algorithm found!\n");
 
+	/* The recovery routines use gen_syndrome, so come second */
+	i = best ? raid6_select_recov(disks, dptrs) : -EINVAL;
+
 	free_pages((unsigned long)syndromes, 1);
 
-	return best ? 0 : -EINVAL;
+	return i;
 }
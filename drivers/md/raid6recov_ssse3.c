@@ -0,0 +1,327 @@
+/* -*- linux-c -*- ------------------------------------------------------- *
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, Inc., 53 Temple Place Ste 330,
+ *   Bostom MA 02111-1307, USA; either version 2 of the License, or
+ *   (at your option) any later version; incorporated herein by reference.
+ *
+ * ----------------------------------------------------------------------- */
+
+/*
+ * raid6recov_ssse3.c
+ *
+ * SSSE3 implementation of RAID-6 dual failure recovery.  A multiplication
+ * by a constant in GF(2^8) is the xor of the products of the low and the
+ * high nibble of each byte, which pshufb looks up in the 16-entry tables
+ * of raid6_vgfmul, 16 bytes at a time.  On x86-64, which has 16 XMM
+ * registers, the loops do 32 bytes at a time.
+ */
+
+#if defined(__i386__) || defined(__x86_64__)
+
+#include "raid6.h"
+#include "raid6x86.h"
+
+static const u8 raid6_x0f[16] __attribute__((aligned(16))) = {
+	0x0f, 0x0f, 0x0f, 0x0f, 0x0f, 0x0f, 0x0f, 0x0f,
+	0x0f, 0x0f, 0x0f, 0x0f, 0x0f, 0x0f, 0x0f, 0x0f,
+};
+
+static int raid6_have_ssse3(void)
+{
+#ifdef __KERNEL__
+	/* Not really boot_cpu but "all_cpus" */
+	return boot_cpu_has(X86_FEATURE_XMM2) &&
+		boot_cpu_has(X86_FEATURE_SSSE3);
+#else
+	/* User space test code */
+	u32 eax = 1;
+	u32 ebx, ecx, edx;
+
+	asm volatile("cpuid" :
+		     "+a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx));
+	return (edx & (1 << 26)) && (ecx & (1 << 9));
+#endif
+}
+
+#ifdef __x86_64__
+typedef raid6_sse16_save_t raid6_ssse3_save_t;
+# define raid6_before_ssse3(s)	raid6_before_sse16(s)
+# define raid6_after_ssse3(s)	raid6_after_sse16(s)
+#else
+typedef raid6_sse_save_t raid6_ssse3_save_t;
+# define raid6_before_ssse3(s)	raid6_before_sse2(s)
+# define raid6_after_ssse3(s)	raid6_after_sse2(s)
+#endif
+
+/* Recover two failed data blocks. */
+static void raid6_2data_recov_ssse3(int disks, size_t bytes, int faila,
+				    int failb, void **ptrs)
+{
+	u8 *p, *q, *dp, *dq;
+	const u8 *pbmul;	/* P multiplier table for B data */
+	const u8 *qmul;		/* Q multiplier table (for both) */
+	raid6_ssse3_save_t sa;
+
+	p = (u8 *)ptrs[disks-2];
+	q = (u8 *)ptrs[disks-1];
+
+	/* Compute syndrome with zero for the missing data pages
+	   Use the dead data pages as temporary storage for
+	   delta p and delta q */
+	dp = (u8 *)ptrs[faila];
+	ptrs[faila] = (void *)raid6_empty_zero_page;
+	ptrs[disks-2] = dp;
+	dq = (u8 *)ptrs[failb];
+	ptrs[failb] = (void *)raid6_empty_zero_page;
+	ptrs[disks-1] = dq;
+
+	raid6_call.gen_syndrome(disks, bytes, ptrs);
+
+	/* Restore pointer table */
+	ptrs[faila]   = dp;
+	ptrs[failb]   = dq;
+	ptrs[disks-2] = p;
+	ptrs[disks-1] = q;
+
+	/* Now, pick the proper data tables */
+	pbmul = raid6_vgfmul[raid6_gfexi[failb-faila]];
+	qmul  = raid6_vgfmul[raid6_gfinv[raid6_gfexp[faila]^raid6_gfexp[failb]]];
+
+	raid6_before_ssse3(&sa);
+
+	asm volatile("movdqa %0,%%xmm7" : : "m" (raid6_x0f[0]));
+
+#ifdef __x86_64__
+	asm volatile("movdqa %0,%%xmm6" : : "m" (qmul[0]));
+	asm volatile("movdqa %0,%%xmm14" : : "m" (pbmul[0]));
+	asm volatile("movdqa %0,%%xmm15" : : "m" (pbmul[16]));
+
+	while ( bytes ) {
+		asm volatile("movdqa %0,%%xmm1" : : "m" (q[0]));
+		asm volatile("movdqa %0,%%xmm9" : : "m" (q[16]));
+		asm volatile("movdqa %0,%%xmm0" : : "m" (p[0]));
+		asm volatile("movdqa %0,%%xmm8" : : "m" (p[16]));
+		asm volatile("pxor %0,%%xmm1" : : "m" (dq[0]));
+		asm volatile("pxor %0,%%xmm9" : : "m" (dq[16]));
+		asm volatile("pxor %0,%%xmm0" : : "m" (dp[0]));
+		asm volatile("pxor %0,%%xmm8" : : "m" (dp[16]));
+
+		/* xmm0/8 = px, xmm1/9 = q ^ dq */
+		asm volatile("movdqa %xmm6,%xmm4");
+		asm volatile("movdqa %0,%%xmm5" : : "m" (qmul[16]));
+		asm volatile("movdqa %xmm6,%xmm12");
+		asm volatile("movdqa %xmm5,%xmm13");
+		asm volatile("movdqa %xmm1,%xmm3");
+		asm volatile("movdqa %xmm9,%xmm11");
+		asm volatile("movdqa %xmm0,%xmm2");
+		asm volatile("movdqa %xmm8,%xmm10");
+		asm volatile("psraw $4,%xmm1");
+		asm volatile("psraw $4,%xmm9");
+		asm volatile("pand %xmm7,%xmm3");
+		asm volatile("pand %xmm7,%xmm11");
+		asm volatile("pand %xmm7,%xmm1");
+		asm volatile("pand %xmm7,%xmm9");
+		asm volatile("pshufb %xmm3,%xmm4");
+		asm volatile("pshufb %xmm11,%xmm12");
+		asm volatile("pshufb %xmm1,%xmm5");
+		asm volatile("pshufb %xmm9,%xmm13");
+		asm volatile("pxor %xmm4,%xmm5");
+		asm volatile("pxor %xmm12,%xmm13");
+
+		/* xmm5/13 = qx = qmul[q ^ dq] */
+		asm volatile("movdqa %xmm14,%xmm4");
+		asm volatile("movdqa %xmm15,%xmm1");
+		asm volatile("movdqa %xmm14,%xmm12");
+		asm volatile("movdqa %xmm15,%xmm9");
+		asm volatile("movdqa %xmm2,%xmm3");
+		asm volatile("movdqa %xmm10,%xmm11");
+		asm volatile("psraw $4,%xmm2");
+		asm volatile("psraw $4,%xmm10");
+		asm volatile("pand %xmm7,%xmm3");
+		asm volatile("pand %xmm7,%xmm11");
+		asm volatile("pand %xmm7,%xmm2");
+		asm volatile("pand %xmm7,%xmm10");
+		asm volatile("pshufb %xmm3,%xmm4");
+		asm volatile("pshufb %xmm11,%xmm12");
+		asm volatile("pshufb %xmm2,%xmm1");
+		asm volatile("pshufb %xmm10,%xmm9");
+		asm volatile("pxor %xmm4,%xmm1");
+		asm volatile("pxor %xmm12,%xmm9");
+
+		/* xmm1/9 = pbmul[px] ^ qx = reconstructed B */
+		asm volatile("pxor %xmm5,%xmm1");
+		asm volatile("pxor %xmm13,%xmm9");
+		asm volatile("movdqa %%xmm1,%0" : "=m" (dq[0]));
+		asm volatile("movdqa %%xmm9,%0" : "=m" (dq[16]));
+
+		/* xmm0/8 = B ^ px = reconstructed A */
+		asm volatile("pxor %xmm1,%xmm0");
+		asm volatile("pxor %xmm9,%xmm8");
+		asm volatile("movdqa %%xmm0,%0" : "=m" (dp[0]));
+		asm volatile("movdqa %%xmm8,%0" : "=m" (dp[16]));
+
+		bytes -= 32;
+		p += 32; q += 32;
+		dp += 32; dq += 32;
+	}
+#else
+	while ( bytes ) {
+		asm volatile("movdqa %0,%%xmm1" : : "m" (*q));
+		asm volatile("movdqa %0,%%xmm0" : : "m" (*p));
+		asm volatile("pxor %0,%%xmm1" : : "m" (*dq));
+		asm volatile("pxor %0,%%xmm0" : : "m" (*dp));
+
+		/* xmm0 = px, xmm1 = q ^ dq */
+		asm volatile("movdqa %0,%%xmm4" : : "m" (qmul[0]));
+		asm volatile("movdqa %0,%%xmm5" : : "m" (qmul[16]));
+		asm volatile("movdqa %xmm1,%xmm3");
+		asm volatile("psraw $4,%xmm1");
+		asm volatile("pand %xmm7,%xmm3");
+		asm volatile("pand %xmm7,%xmm1");
+		asm volatile("pshufb %xmm3,%xmm4");
+		asm volatile("pshufb %xmm1,%xmm5");
+		asm volatile("pxor %xmm4,%xmm5");
+		asm volatile("movdqa %xmm0,%xmm2");
+
+		/* xmm5 = qx = qmul[q ^ dq] */
+		asm volatile("movdqa %0,%%xmm4" : : "m" (pbmul[0]));
+		asm volatile("movdqa %0,%%xmm1" : : "m" (pbmul[16]));
+		asm volatile("movdqa %xmm2,%xmm3");
+		asm volatile("psraw $4,%xmm2");
+		asm volatile("pand %xmm7,%xmm3");
+		asm volatile("pand %xmm7,%xmm2");
+		asm volatile("pshufb %xmm3,%xmm4");
+		asm volatile("pshufb %xmm2,%xmm1");
+		asm volatile("pxor %xmm4,%xmm1");
+
+		/* xmm1 = pbmul[px] ^ qx = reconstructed B */
+		asm volatile("pxor %xmm5,%xmm1");
+		asm volatile("movdqa %%xmm1,%0" : "=m" (*dq));
+
+		/* xmm0 = B ^ px = reconstructed A */
+		asm volatile("pxor %xmm1,%xmm0");
+		asm volatile("movdqa %%xmm0,%0" : "=m" (*dp));
+
+		bytes -= 16;
+		p += 16; q += 16;
+		dp += 16; dq += 16;
+	}
+#endif
+
+	raid6_after_ssse3(&sa);
+}
+
+/* Recover failure of one data block plus the P block */
+static void raid6_datap_recov_ssse3(int disks, size_t bytes, int faila,
+				    void **ptrs)
+{
+	u8 *p, *q, *dq;
+	const u8 *qmul;		/* Q multiplier table */
+	raid6_ssse3_save_t sa;
+
+	p = (u8 *)ptrs[disks-2];
+	q = (u8 *)ptrs[disks-1];
+
+	/* Compute syndrome with zero for the missing data page
+	   Use the dead data page as temporary storage for delta q */
+	dq = (u8 *)ptrs[faila];
+	ptrs[faila] = (void *)raid6_empty_zero_page;
+	ptrs[disks-1] = dq;
+
+	raid6_call.gen_syndrome(disks, bytes, ptrs);
+
+	/* Restore pointer table */
+	ptrs[faila]   = dq;
+	ptrs[disks-1] = q;
+
+	/* Now, pick the proper data tables */
+	qmul  = raid6_vgfmul[raid6_gfinv[raid6_gfexp[faila]]];
+
+	raid6_before_ssse3(&sa);
+
+	asm volatile("movdqa %0,%%xmm7" : : "m" (raid6_x0f[0]));
+
+	while ( bytes ) {
+#ifdef __x86_64__
+		asm volatile("movdqa %0,%%xmm3" : : "m" (dq[0]));
+		asm volatile("movdqa %0,%%xmm4" : : "m" (dq[16]));
+		asm volatile("pxor %0,%%xmm3" : : "m" (q[0]));
+		asm volatile("movdqa %0,%%xmm0" : : "m" (qmul[0]));
+		asm volatile("pxor %0,%%xmm4" : : "m" (q[16]));
+		asm volatile("movdqa %0,%%xmm1" : : "m" (qmul[16]));
+
+		/* xmm3/4 = q ^ dq */
+		asm volatile("movdqa %xmm3,%xmm6");
+		asm volatile("movdqa %xmm4,%xmm8");
+		asm volatile("psraw $4,%xmm3");
+		asm volatile("pand %xmm7,%xmm6");
+		asm volatile("pand %xmm7,%xmm3");
+		asm volatile("pshufb %xmm6,%xmm0");
+		asm volatile("pshufb %xmm3,%xmm1");
+		asm volatile("movdqa %0,%%xmm10" : : "m" (qmul[0]));
+		asm volatile("pxor %xmm0,%xmm1");
+		asm volatile("movdqa %0,%%xmm11" : : "m" (qmul[16]));
+		asm volatile("psraw $4,%xmm4");
+		asm volatile("pand %xmm7,%xmm8");
+		asm volatile("pand %xmm7,%xmm4");
+		asm volatile("pshufb %xmm8,%xmm10");
+		asm volatile("pshufb %xmm4,%xmm11");
+		asm volatile("movdqa %0,%%xmm2" : : "m" (p[0]));
+		asm volatile("pxor %xmm10,%xmm11");
+		asm volatile("movdqa %0,%%xmm12" : : "m" (p[16]));
+
+		/* xmm1/11 = qmul[q ^ dq] = reconstructed data */
+		asm volatile("pxor %xmm1,%xmm2");
+		asm volatile("pxor %xmm11,%xmm12");
+
+		asm volatile("movdqa %%xmm1,%0" : "=m" (dq[0]));
+		asm volatile("movdqa %%xmm11,%0" : "=m" (dq[16]));
+		asm volatile("movdqa %%xmm2,%0" : "=m" (p[0]));
+		asm volatile("movdqa %%xmm12,%0" : "=m" (p[16]));
+
+		bytes -= 32;
+		p += 32; q += 32; dq += 32;
+#else
+		asm volatile("movdqa %0,%%xmm3" : : "m" (dq[0]));
+		asm volatile("movdqa %0,%%xmm0" : : "m" (qmul[0]));
+		asm volatile("pxor %0,%%xmm3" : : "m" (q[0]));
+		asm volatile("movdqa %0,%%xmm1" : : "m" (qmul[16]));
+
+		/* xmm3 = q ^ dq */
+		asm volatile("movdqa %xmm3,%xmm6");
+		asm volatile("movdqa %0,%%xmm2" : : "m" (p[0]));
+		asm volatile("psraw $4,%xmm3");
+		asm volatile("pand %xmm7,%xmm6");
+		asm volatile("pand %xmm7,%xmm3");
+		asm volatile("pshufb %xmm6,%xmm0");
+		asm volatile("pshufb %xmm3,%xmm1");
+		asm volatile("pxor %xmm0,%xmm1");
+
+		/* xmm1 = qmul[q ^ dq] = reconstructed data */
+		asm volatile("pxor %xmm1,%xmm2");
+
+		asm volatile("movdqa %%xmm1,%0" : "=m" (dq[0]));
+		asm volatile("movdqa %%xmm2,%0" : "=m" (p[0]));
+
+		bytes -= 16;
+		p += 16; q += 16; dq += 16;
+#endif
+	}
+
+	raid6_after_ssse3(&sa);
+}
+
+const struct raid6_recov_calls raid6_recov_ssse3 = {
+	raid6_2data_recov_ssse3,
+	raid6_datap_recov_ssse3,
+	raid6_have_ssse3,
+#ifdef __x86_64__
+	"ssse3x2",
+#else
+	"ssse3x1",
+#endif
+};
+
+#endif
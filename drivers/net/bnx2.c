@@ -4396,6 +4396,16 @@ bnx2_vlan_rx_kill_vid(struct net_device *dev, uint16_t vid)
 }
 #endif
 
+/* Tell the chip about the buffer descriptors queued so far */
+static inline void
+bnx2_tx_kick(struct bnx2 *bp)
+{
+	REG_WR16(bp, MB_TX_CID_ADDR + BNX2_L2CTX_TX_HOST_BIDX, bp->tx_prod);
+	REG_WR(bp, MB_TX_CID_ADDR + BNX2_L2CTX_TX_HOST_BSEQ, bp->tx_prod_bseq);
+
+	mmiowb();
+}
+
 /* Called with netif_tx_lock.
  * bnx2_tx_int() runs without netif_tx_lock unless it needs to call
  * netif_wake_queue().
@@ -4409,6 +4419,7 @@ bnx2_start_xmit(struct sk_buff *skb, struct net_device *dev)
 	struct sw_bd *tx_buf;
 	u32 len, vlan_tag_flags, last_frag, mss;
 	u16 prod, ring_prod;
+	int xmit_more = skb->xmit_more;
 	int i;
 
 	if (unlikely(bnx2_tx_avail(bp) < (skb_shinfo(skb)->nr_frags + 1))) {
@@ -4416,6 +4427,7 @@ bnx2_start_xmit(struct sk_buff *skb, struct net_device *dev)
 		printk(KERN_ERR PFX "%s: BUG! Tx ring full when queue awake!\n",
 			dev->name);
 
+		bnx2_tx_kick(bp);
 		return NETDEV_TX_BUSY;
 	}
 	len = skb_headlen(skb);
@@ -4438,6 +4450,8 @@ bnx2_start_xmit(struct sk_buff *skb, struct net_device *dev)
 
 		if (skb_header_cloned(skb) &&
 		    pskb_expand_head(skb, 0, 0, GFP_ATOMIC)) {
+			if (!skb->xmit_more)
+				bnx2_tx_kick(bp);
 			dev_kfree_skb(skb);
 			return NETDEV_TX_OK;
 		}
@@ -4507,12 +4521,6 @@ bnx2_start_xmit(struct sk_buff *skb, struct net_device *dev)
 
 	prod = NEXT_TX_BD(prod);
 	bp->tx_prod_bseq += skb->len;
-
-	REG_WR16(bp, MB_TX_CID_ADDR + BNX2_L2CTX_TX_HOST_BIDX, prod);
-	REG_WR(bp, MB_TX_CID_ADDR + BNX2_L2CTX_TX_HOST_BSEQ, bp->tx_prod_bseq);
-
-	mmiowb();
-
 	bp->tx_prod = prod;
 	dev->trans_start = jiffies;
 
@@ -4522,6 +4530,10 @@ bnx2_start_xmit(struct sk_buff *skb, struct net_device *dev)
 			netif_wake_queue(dev);
 	}
 
+	/* Ring the doorbell once for a batch of packets */
+	if (!xmit_more || netif_queue_stopped(dev))
+		bnx2_tx_kick(bp);
+
 	return NETDEV_TX_OK;
 }
 
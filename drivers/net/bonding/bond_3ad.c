@@ -2354,34 +2354,47 @@ int bond_3ad_get_active_agg_info(struct bonding *bond, struct ad_info *ad_info)
 	return -1;
 }
 
+/*
+ * Walks bond->slave_arr under rcu_read_lock() rather than the slave list
+ * under bond->lock, see bond_xmit_xor().
+ */
 int bond_3ad_xmit_xor(struct sk_buff *skb, struct net_device *dev)
 {
-	struct slave *slave, *start_at;
+	struct slave *slave;
 	struct bonding *bond = dev->priv;
+	struct bond_slave_arr *arr;
+	struct aggregator *agg, *active_agg = NULL;
 	int slave_agg_no;
 	int slaves_in_agg;
 	int agg_id;
-	int i;
-	struct ad_info ad_info;
+	int count, i, j;
 	int res = 1;
 
-	/* make sure that the slaves list will
-	 * not change during tx
-	 */
-	read_lock(&bond->lock);
+	rcu_read_lock();
 
 	if (!BOND_IS_OK(bond)) {
 		goto out;
 	}
 
-	if (bond_3ad_get_active_agg_info(bond, &ad_info)) {
+	arr = rcu_dereference(bond->slave_arr);
+	count = bond_slave_arr_count(arr);
+
+	for (i = 0; i < count; i++) {
+		agg = SLAVE_AD_INFO(arr->arr[i]).port.aggregator;
+		if (agg && agg->is_active) {
+			active_agg = agg;
+			break;
+		}
+	}
+
+	if (!active_agg) {
 		printk(KERN_DEBUG DRV_NAME ": %s: Error: "
-		       "bond_3ad_get_active_agg_info failed\n", dev->name);
+		       "no active aggregator\n", dev->name);
 		goto out;
 	}
 
-	slaves_in_agg = ad_info.ports;
-	agg_id = ad_info.aggregator_id;
+	slaves_in_agg = active_agg->num_of_ports;
+	agg_id = active_agg->aggregator_identifier;
 
 	if (slaves_in_agg == 0) {
 		/*the aggregator is empty*/
@@ -2393,8 +2406,8 @@ int bond_3ad_xmit_xor(struct sk_buff *skb, struct net_device *dev)
 
 	slave_agg_no = bond->xmit_hash_policy(skb, dev, slaves_in_agg);
 
-	bond_for_each_slave(bond, slave, i) {
-		struct aggregator *agg = SLAVE_AD_INFO(slave).port.aggregator;
+	for (i = 0; i < count; i++) {
+		agg = SLAVE_AD_INFO(arr->arr[i]).port.aggregator;
 
 		if (agg && (agg->aggregator_identifier == agg_id)) {
 			slave_agg_no--;
@@ -2410,17 +2423,12 @@ int bond_3ad_xmit_xor(struct sk_buff *skb, struct net_device *dev)
 		goto out;
 	}
 
-	start_at = slave;
-
-	bond_for_each_slave_from(bond, slave, i, start_at) {
-		int slave_agg_id = 0;
-		struct aggregator *agg = SLAVE_AD_INFO(slave).port.aggregator;
+	for (j = 0; j < count; j++) {
+		slave = arr->arr[(i + j) % count];
+		agg = SLAVE_AD_INFO(slave).port.aggregator;
 
-		if (agg) {
-			slave_agg_id = agg->aggregator_identifier;
-		}
-
-		if (SLAVE_IS_OK(slave) && agg && (slave_agg_id == agg_id)) {
+		if (SLAVE_IS_OK(slave) && agg &&
+		    (agg->aggregator_identifier == agg_id)) {
 			res = bond_dev_queue_xmit(bond, skb, slave->dev);
 			break;
 		}
@@ -2431,7 +2439,7 @@ out:
 		/* no suitable interface, frame not sent */
 		dev_kfree_skb(skb);
 	}
-	read_unlock(&bond->lock);
+	rcu_read_unlock();
 	return 0;
 }
 
@@ -44,6 +44,8 @@
 #include <linux/in.h>
 #include <net/ip.h>
 #include <linux/ip.h>
+#include <linux/ipv6.h>
+#include <linux/jhash.h>
 #include <linux/tcp.h>
 #include <linux/udp.h>
 #include <linux/slab.h>
@@ -94,6 +96,7 @@ static char *mode	= NULL;
 static char *primary	= NULL;
 static char *lacp_rate	= NULL;
 static char *xmit_hash_policy = NULL;
+static int tx_queues	= BOND_DEFAULT_TX_QUEUES;
 static int arp_interval = BOND_LINK_ARP_INTERV;
 static char *arp_ip_target[BOND_MAX_ARP_TARGETS] = { NULL, };
 struct bond_params bonding_defaults;
@@ -123,6 +126,9 @@ MODULE_PARM_DESC(lacp_rate, "LACPDU tx rate to request from 802.3ad partner "
 module_param(xmit_hash_policy, charp, 0);
 MODULE_PARM_DESC(xmit_hash_policy, "XOR hashing method: 0 for layer 2 (default)"
 				   ", 1 for layer 3+4");
+module_param(tx_queues, int, 0);
+MODULE_PARM_DESC(tx_queues, "Number of transmit queues, passed down to "
+			    "multiqueue slaves (default 16)");
 module_param(arp_interval, int, 0);
 MODULE_PARM_DESC(arp_interval, "arp interval in milliseconds");
 module_param_array(arp_ip_target, charp, NULL, 0);
@@ -384,6 +390,8 @@ int bond_dev_queue_xmit(struct bonding *bond, struct sk_buff *skb, struct net_de
 	}
 
 	skb->priority = 1;
+	/* the queue the bond picked for the flow is kept by the slave */
+	skb->queue_mapping_set = 1;
 	dev_queue_xmit(skb);
 
 	return 0;
@@ -1080,7 +1088,7 @@ void bond_change_active_slave(struct bonding *bond, struct slave *new_active)
 		if (new_active)
 			bond_set_slave_active_flags(new_active);
 	} else {
-		bond->curr_active_slave = new_active;
+		rcu_assign_pointer(bond->curr_active_slave, new_active);
 	}
 
 	if (bond->params.mode == BOND_MODE_ACTIVEBACKUP) {
@@ -1132,13 +1140,55 @@ void bond_select_active_slave(struct bonding *bond)
 
 /*--------------------------- slave list handling ---------------------------*/
 
+static void bond_slave_arr_free(struct rcu_head *head)
+{
+	kfree(container_of(head, struct bond_slave_arr, rcu));
+}
+
+/*
+ * Makes room in bond->slave_arr for one more slave, so that
+ * bond_attach_slave() cannot fail.  A bigger array replaces the old one,
+ * which is freed once the readers are done with it.
+ *
+ * RTNL held by caller, bond->lock not held.
+ */
+static int bond_slave_arr_reserve(struct bonding *bond)
+{
+	struct bond_slave_arr *old = bond->slave_arr;
+	struct bond_slave_arr *new;
+	int size;
+
+	if (old && old->count < old->size)
+		return 0;
+
+	size = old ? 2 * old->size : 8;
+	new = kmalloc(sizeof(*new) + size * sizeof(struct slave *), GFP_KERNEL);
+	if (!new)
+		return -ENOMEM;
+	new->size = size;
+
+	write_lock_bh(&bond->lock);
+	new->count = old ? old->count : 0;
+	if (old)
+		memcpy(new->arr, old->arr, new->count * sizeof(struct slave *));
+	rcu_assign_pointer(bond->slave_arr, new);
+	write_unlock_bh(&bond->lock);
+
+	if (old)
+		call_rcu(&old->rcu, bond_slave_arr_free);
+	return 0;
+}
+
 /*
  * This function attaches the slave to the end of list.
  *
- * bond->lock held for writing by caller.
+ * bond->lock held for writing by caller, room made for the slave by
+ * bond_slave_arr_reserve().
  */
 static void bond_attach_slave(struct bonding *bond, struct slave *new_slave)
 {
+	struct bond_slave_arr *arr = bond->slave_arr;
+
 	if (bond->first_slave == NULL) { /* attaching the first slave */
 		new_slave->next = new_slave;
 		new_slave->prev = new_slave;
@@ -1150,6 +1200,10 @@ static void bond_attach_slave(struct bonding *bond, struct slave *new_slave)
 		new_slave->prev->next = new_slave;
 	}
 
+	arr->arr[arr->count] = new_slave;
+	smp_wmb();	/* the entry before the count, for the readers */
+	arr->count++;
+
 	bond->slave_cnt++;
 }
 
@@ -1165,6 +1219,21 @@ static void bond_attach_slave(struct bonding *bond, struct slave *new_slave)
  */
 static void bond_detach_slave(struct bonding *bond, struct slave *slave)
 {
+	struct bond_slave_arr *arr = bond->slave_arr;
+	int i;
+
+	/* the entries are moved down one by one, so that readers never
+	 * see anything but a slave in the array
+	 */
+	for (i = 0; i < arr->count; i++) {
+		if (arr->arr[i] != slave)
+			continue;
+		for (; i < arr->count - 1; i++)
+			arr->arr[i] = arr->arr[i + 1];
+		arr->count--;
+		break;
+	}
+
 	if (slave->next) {
 		slave->next->prev = slave->prev;
 	}
@@ -1319,6 +1388,10 @@ int bond_enslave(struct net_device *bond_dev, struct net_device *slave_dev)
 		goto err_undo_flags;
 	}
 
+	res = bond_slave_arr_reserve(bond);
+	if (res)
+		goto err_undo_flags;
+
 	new_slave = kmalloc(sizeof(struct slave), GFP_KERNEL);
 	if (!new_slave) {
 		res = -ENOMEM;
@@ -1769,6 +1842,9 @@ int bond_release(struct net_device *bond_dev, struct net_device *slave_dev)
 
 	netdev_set_master(slave_dev, NULL);
 
+	/* let the transmit paths that may still see the slave finish */
+	synchronize_net();
+
 	/* close slave before restoring its mac address */
 	dev_close(slave_dev);
 
@@ -1858,6 +1934,8 @@ static int bond_release_all(struct net_device *bond_dev)
 
 		netdev_set_master(slave_dev, NULL);
 
+		synchronize_net();
+
 		/* close slave before restoring its mac address */
 		dev_close(slave_dev);
 
@@ -3308,41 +3386,58 @@ static void bond_unregister_lacpdu(struct bonding *bond)
 /*---------------------------- Hashing Policies -----------------------------*/
 
 /*
- * Hash for the the output device based upon layer 3 and layer 4 data. If
- * the packet is a frag or not TCP or UDP, just use layer 3 data.  If it is
- * altogether not IP, mimic bond_xmit_hash_policy_l2()
+ * Hash for the output device based upon layer 2 data
  */
-static int bond_xmit_hash_policy_l34(struct sk_buff *skb,
-				    struct net_device *bond_dev, int count)
+static int bond_xmit_hash_policy_l2(struct sk_buff *skb,
+				   struct net_device *bond_dev, int count)
 {
 	struct ethhdr *data = (struct ethhdr *)skb->data;
-	struct iphdr *iph = skb->nh.iph;
-	u16 *layer4hdr = (u16 *)((u32 *)iph + iph->ihl);
-	int layer4_xor = 0;
-
-	if (skb->protocol == __constant_htons(ETH_P_IP)) {
-		if (!(iph->frag_off & __constant_htons(IP_MF|IP_OFFSET)) &&
-		    (iph->protocol == IPPROTO_TCP ||
-		     iph->protocol == IPPROTO_UDP)) {
-			layer4_xor = htons((*layer4hdr ^ *(layer4hdr + 1)));
-		}
-		return (layer4_xor ^
-			((ntohl(iph->saddr ^ iph->daddr)) & 0xffff)) % count;
-
-	}
 
 	return (data->h_dest[5] ^ bond_dev->dev_addr[5]) % count;
 }
 
 /*
- * Hash for the output device based upon layer 2 data
+ * Hash for the output device based upon layer 3 and layer 4 data: a
+ * jhash of the IPv4 or IPv6 addresses and, for TCP or UDP packets that
+ * are not fragments, the ports, scaled to the slave count.  The addresses
+ * are folded by XOR so that both directions of a flow hash alike.  If the
+ * packet is altogether not IP, mimic bond_xmit_hash_policy_l2()
  */
-static int bond_xmit_hash_policy_l2(struct sk_buff *skb,
-				   struct net_device *bond_dev, int count)
+static int bond_xmit_hash_policy_l34(struct sk_buff *skb,
+				    struct net_device *bond_dev, int count)
 {
-	struct ethhdr *data = (struct ethhdr *)skb->data;
+	unsigned char *l4hdr;
+	u32 addr, ports = 0;
+	u8 proto;
 
-	return (data->h_dest[5] ^ bond_dev->dev_addr[5]) % count;
+	if (skb->protocol == __constant_htons(ETH_P_IP) &&
+	    skb->nh.raw + sizeof(struct iphdr) <= skb->tail) {
+		struct iphdr *iph = skb->nh.iph;
+
+		addr = iph->saddr ^ iph->daddr;
+		proto = iph->protocol;
+		l4hdr = (unsigned char *)iph + iph->ihl * 4;
+		if (iph->frag_off & __constant_htons(IP_MF|IP_OFFSET))
+			l4hdr = NULL;
+	} else if (skb->protocol == __constant_htons(ETH_P_IPV6) &&
+		   skb->nh.raw + sizeof(struct ipv6hdr) <= skb->tail) {
+		struct ipv6hdr *ip6h = skb->nh.ipv6h;
+		u32 *s = ip6h->saddr.s6_addr32;
+		u32 *d = ip6h->daddr.s6_addr32;
+
+		addr = s[0] ^ s[1] ^ s[2] ^ s[3] ^ d[0] ^ d[1] ^ d[2] ^ d[3];
+		/* extension headers, fragments among them, are not walked */
+		proto = ip6h->nexthdr;
+		l4hdr = (unsigned char *)(ip6h + 1);
+	} else {
+		return bond_xmit_hash_policy_l2(skb, bond_dev, count);
+	}
+
+	if (l4hdr && (proto == IPPROTO_TCP || proto == IPPROTO_UDP) &&
+	    l4hdr + 4 <= skb->tail)
+		ports = *(u32 *)l4hdr;
+
+	return ((u64)jhash_2words(addr, ports, proto) * count) >> 32;
 }
 
 /*-------------------------- Device entry points ----------------------------*/
@@ -3832,54 +3927,54 @@ unwind:
 	return res;
 }
 
+/*
+ * The transmit paths below, bar those of the ALB modes, walk
+ * bond->slave_arr under rcu_read_lock() and take none of the bond's locks.
+ */
 static int bond_xmit_roundrobin(struct sk_buff *skb, struct net_device *bond_dev)
 {
 	struct bonding *bond = bond_dev->priv;
-	struct slave *slave, *start_at;
-	int i;
+	struct bond_slave_arr *arr;
+	struct slave *slave;
+	int count, start, i;
 	int res = 1;
 
-	read_lock(&bond->lock);
+	rcu_read_lock();
 
 	if (!BOND_IS_OK(bond)) {
 		goto out;
 	}
 
-	read_lock(&bond->curr_slave_lock);
-	slave = start_at = bond->curr_active_slave;
-	read_unlock(&bond->curr_slave_lock);
-
-	if (!slave) {
+	arr = rcu_dereference(bond->slave_arr);
+	count = bond_slave_arr_count(arr);
+	if (!count) {
 		goto out;
 	}
 
-	bond_for_each_slave_from(bond, slave, i, start_at) {
+	start = bond->rr_tx_counter++ % count;
+	for (i = 0; i < count; i++) {
+		slave = arr->arr[(start + i) % count];
 		if (IS_UP(slave->dev) &&
 		    (slave->link == BOND_LINK_UP) &&
 		    (slave->state == BOND_STATE_ACTIVE)) {
 			res = bond_dev_queue_xmit(bond, skb, slave->dev);
-
-			write_lock(&bond->curr_slave_lock);
-			bond->curr_active_slave = slave->next;
-			write_unlock(&bond->curr_slave_lock);
-
 			break;
 		}
 	}
 
-
 out:
 	if (res) {
 		/* no suitable interface, frame not sent */
 		dev_kfree_skb(skb);
 	}
-	read_unlock(&bond->lock);
+	rcu_read_unlock();
 	return 0;
 }
 
 static void bond_activebackup_xmit_copy(struct sk_buff *skb,
                                         struct bonding *bond,
-                                        struct slave *slave)
+                                        struct slave *slave,
+                                        struct slave *active_slave)
 {
 	struct sk_buff *skb2 = skb_copy(skb, GFP_ATOMIC);
 	struct ethhdr *eth_data;
@@ -3902,7 +3997,7 @@ static void bond_activebackup_xmit_copy(struct sk_buff *skb,
 	 */
 	hwaddr = slave->perm_hwaddr;
 	if (!memcmp(eth_data->h_source, hwaddr, ETH_ALEN))
-		hwaddr = bond->curr_active_slave->perm_hwaddr;
+		hwaddr = active_slave->perm_hwaddr;
 
 	/* Set source MAC address appropriately */
 	memcpy(eth_data->h_source, hwaddr, ETH_ALEN);
@@ -3921,42 +4016,46 @@ static void bond_activebackup_xmit_copy(struct sk_buff *skb,
 static int bond_xmit_activebackup(struct sk_buff *skb, struct net_device *bond_dev)
 {
 	struct bonding *bond = bond_dev->priv;
+	struct slave *active_slave;
 	int res = 1;
 
-	read_lock(&bond->lock);
-	read_lock(&bond->curr_slave_lock);
+	rcu_read_lock();
 
 	if (!BOND_IS_OK(bond)) {
 		goto out;
 	}
 
-	if (!bond->curr_active_slave)
+	active_slave = rcu_dereference(bond->curr_active_slave);
+	if (!active_slave)
 		goto out;
 
 	/* Xmit IGMP frames on all slaves to ensure rapid fail-over
 	   for multicast traffic on snooping switches */
 	if (skb->protocol == __constant_htons(ETH_P_IP) &&
 	    skb->nh.iph->protocol == IPPROTO_IGMP) {
-		struct slave *slave, *active_slave;
+		struct bond_slave_arr *arr = rcu_dereference(bond->slave_arr);
+		struct slave *slave;
+		int count = bond_slave_arr_count(arr);
 		int i;
 
-		active_slave = bond->curr_active_slave;
-		bond_for_each_slave_from_to(bond, slave, i, active_slave->next,
-		                            active_slave->prev)
-			if (IS_UP(slave->dev) &&
+		for (i = 0; i < count; i++) {
+			slave = arr->arr[i];
+			if (slave != active_slave &&
+			    IS_UP(slave->dev) &&
 			    (slave->link == BOND_LINK_UP))
-				bond_activebackup_xmit_copy(skb, bond, slave);
+				bond_activebackup_xmit_copy(skb, bond, slave,
+							    active_slave);
+		}
 	}
 
-	res = bond_dev_queue_xmit(bond, skb, bond->curr_active_slave->dev);
+	res = bond_dev_queue_xmit(bond, skb, active_slave->dev);
 
 out:
 	if (res) {
 		/* no suitable interface, frame not sent */
 		dev_kfree_skb(skb);
 	}
-	read_unlock(&bond->curr_slave_lock);
-	read_unlock(&bond->lock);
+	rcu_read_unlock();
 	return 0;
 }
 
@@ -3968,29 +4067,27 @@ out:
 static int bond_xmit_xor(struct sk_buff *skb, struct net_device *bond_dev)
 {
 	struct bonding *bond = bond_dev->priv;
-	struct slave *slave, *start_at;
-	int slave_no;
-	int i;
+	struct bond_slave_arr *arr;
+	struct slave *slave;
+	int count, slave_no, i;
 	int res = 1;
 
-	read_lock(&bond->lock);
+	rcu_read_lock();
 
 	if (!BOND_IS_OK(bond)) {
 		goto out;
 	}
 
-	slave_no = bond->xmit_hash_policy(skb, bond_dev, bond->slave_cnt);
-
-	bond_for_each_slave(bond, slave, i) {
-		slave_no--;
-		if (slave_no < 0) {
-			break;
-		}
+	arr = rcu_dereference(bond->slave_arr);
+	count = bond_slave_arr_count(arr);
+	if (!count) {
+		goto out;
 	}
 
-	start_at = slave;
+	slave_no = bond->xmit_hash_policy(skb, bond_dev, count);
 
-	bond_for_each_slave_from(bond, slave, i, start_at) {
+	for (i = 0; i < count; i++) {
+		slave = arr->arr[(slave_no + i) % count];
 		if (IS_UP(slave->dev) &&
 		    (slave->link == BOND_LINK_UP) &&
 		    (slave->state == BOND_STATE_ACTIVE)) {
@@ -4004,7 +4101,7 @@ out:
 		/* no suitable interface, frame not sent */
 		dev_kfree_skb(skb);
 	}
-	read_unlock(&bond->lock);
+	rcu_read_unlock();
 	return 0;
 }
 
@@ -4014,26 +4111,23 @@ out:
 static int bond_xmit_broadcast(struct sk_buff *skb, struct net_device *bond_dev)
 {
 	struct bonding *bond = bond_dev->priv;
-	struct slave *slave, *start_at;
+	struct bond_slave_arr *arr;
+	struct slave *slave;
 	struct net_device *tx_dev = NULL;
-	int i;
+	int count, i;
 	int res = 1;
 
-	read_lock(&bond->lock);
+	rcu_read_lock();
 
 	if (!BOND_IS_OK(bond)) {
 		goto out;
 	}
 
-	read_lock(&bond->curr_slave_lock);
-	start_at = bond->curr_active_slave;
-	read_unlock(&bond->curr_slave_lock);
-
-	if (!start_at) {
-		goto out;
-	}
+	arr = rcu_dereference(bond->slave_arr);
+	count = bond_slave_arr_count(arr);
 
-	bond_for_each_slave_from(bond, slave, i, start_at) {
+	for (i = 0; i < count; i++) {
+		slave = arr->arr[i];
 		if (IS_UP(slave->dev) &&
 		    (slave->link == BOND_LINK_UP) &&
 		    (slave->state == BOND_STATE_ACTIVE)) {
@@ -4067,7 +4161,7 @@ out:
 		dev_kfree_skb(skb);
 	}
 	/* frame sent to all suitable interfaces */
-	read_unlock(&bond->lock);
+	rcu_read_unlock();
 	return 0;
 }
 
@@ -4156,6 +4250,7 @@ static int bond_init(struct net_device *bond_dev, struct bond_params *params)
 
 	/* Initialize pointers */
 	bond->first_slave = NULL;
+	bond->slave_arr = NULL;
 	bond->curr_active_slave = NULL;
 	bond->current_arp_slave = NULL;
 	bond->primary_slave = NULL;
@@ -4222,6 +4317,10 @@ void bond_deinit(struct net_device *bond_dev)
 
 	list_del(&bond->bond_list);
 
+	/* the slaves are gone and the device unregistered */
+	kfree(bond->slave_arr);
+	bond->slave_arr = NULL;
+
 #ifdef CONFIG_PROC_FS
 	bond_remove_proc_entry(bond);
 #endif
@@ -4326,6 +4425,14 @@ static int bond_check_params(struct bond_params *params)
 		max_bonds = BOND_DEFAULT_MAX_BONDS;
 	}
 
+	if (tx_queues < 1 || tx_queues > BOND_MAX_TX_QUEUES) {
+		printk(KERN_WARNING DRV_NAME
+		       ": Warning: tx_queues (%d) not in range %d-%d, so it "
+		       "was reset to BOND_DEFAULT_TX_QUEUES (%d)\n",
+		       tx_queues, 1, BOND_MAX_TX_QUEUES, BOND_DEFAULT_TX_QUEUES);
+		tx_queues = BOND_DEFAULT_TX_QUEUES;
+	}
+
 	if (miimon < 0) {
 		printk(KERN_WARNING DRV_NAME
 		       ": Warning: miimon module parameter (%d), "
@@ -4542,7 +4649,8 @@ int bond_create(char *name, struct bond_params *params, struct bonding **newbond
 	int res;
 
 	rtnl_lock();
-	bond_dev = alloc_netdev(sizeof(struct bonding), name, ether_setup);
+	bond_dev = alloc_netdev_mq(sizeof(struct bonding), name, ether_setup,
+				   tx_queues);
 	if (!bond_dev) {
 		printk(KERN_ERR DRV_NAME
 		       ": %s: eek! can't alloc netdev!\n",
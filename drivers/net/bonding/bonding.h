@@ -19,6 +19,7 @@
 #include <linux/proc_fs.h>
 #include <linux/if_bonding.h>
 #include <linux/kobject.h>
+#include <linux/rcupdate.h>
 #include "bond_3ad.h"
 #include "bond_alb.h"
 
@@ -29,6 +30,9 @@
 
 #define BOND_MAX_ARP_TARGETS	16
 
+#define BOND_DEFAULT_TX_QUEUES	16
+#define BOND_MAX_TX_QUEUES	256
+
 #ifdef BONDING_DEBUG
 #define dprintk(fmt, args...) \
 	printk(KERN_DEBUG     \
@@ -171,6 +175,22 @@ struct slave {
  * 3) When we lock with bond->curr_slave_lock, we must lock with bond->lock
  *    beforehand.
  */
+/*
+ * The slaves again, in list order, for the transmit paths to walk under
+ * rcu_read_lock() instead of taking bond->lock.  It is only changed under
+ * bond->lock for writing, in place: a slave is appended once its entry is
+ * set, a released one is taken out by moving the later ones down.  So a
+ * reader may see a slave twice or miss one while that happens, but never
+ * a freed one, slaves being freed after synchronize_net().  The array is
+ * only replaced when it has to grow, see bond_slave_arr_reserve().
+ */
+struct bond_slave_arr {
+	struct rcu_head rcu;
+	int    size;
+	int    count;
+	struct slave *arr[0];
+};
+
 struct bonding {
 	struct   net_device *dev; /* first - useful for panic debug */
 	struct   slave *first_slave;
@@ -178,6 +198,8 @@ struct bonding {
 	struct   slave *current_arp_slave;
 	struct   slave *primary_slave;
 	s32      slave_cnt; /* never change this value outside the attach/detach wrappers */
+	struct   bond_slave_arr *slave_arr;
+	u32      rr_tx_counter;
 	rwlock_t lock;
 	rwlock_t curr_slave_lock;
 	struct   timer_list mii_timer;
@@ -200,6 +222,19 @@ struct bonding {
 	struct   vlan_group *vlgrp;
 };
 
+/**
+ * Returns the number of entries of @arr a reader may look at.
+ *
+ * Caller must be in an rcu_read_lock() section
+ */
+static inline int bond_slave_arr_count(struct bond_slave_arr *arr)
+{
+	int count = arr ? arr->count : 0;
+
+	smp_rmb();	/* pairs with bond_attach_slave() */
+	return count;
+}
+
 /**
  * Returns NULL if the net_device does not belong to any of the bond's slaves
  *
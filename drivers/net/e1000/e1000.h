@@ -255,6 +255,9 @@ struct e1000_adapter {
 	spinlock_t stats_lock;
 #ifdef CONFIG_E1000_NAPI
 	spinlock_t tx_queue_lock;
+	/* rx_ring[0] between e1000_clean and e1000_busy_poll */
+	spinlock_t rx_poll_lock;
+	int rx_poll_off;
 #endif
 	atomic_t irq_sem;
 	struct work_struct reset_task;
@@ -305,6 +308,10 @@ struct e1000_adapter {
 	uint64_t hw_csum_good;
 	uint64_t rx_hdr_split;
 	uint32_t alloc_rx_buff_failed;
+	/* tx-completed skbs refill the legacy rx ring, see e1000_up() */
+	struct skb_recycle_pool *rx_recycle;
+	struct skb_recycle_stats rx_recycle_stats;	/* of past pools */
+	struct skb_recycle_stats rx_recycle_ethtool;
 	uint32_t rx_int_delay;
 	uint32_t rx_abs_int_delay;
 	boolean_t rx_csum;
@@ -362,6 +369,7 @@ void e1000_free_all_tx_resources(struct e1000_adapter *adapter);
 int e1000_setup_all_rx_resources(struct e1000_adapter *adapter);
 void e1000_free_all_rx_resources(struct e1000_adapter *adapter);
 void e1000_update_stats(struct e1000_adapter *adapter);
+void e1000_update_recycle_stats(struct e1000_adapter *adapter);
 int e1000_set_spd_dplx(struct e1000_adapter *adapter, uint16_t spddplx);
 
 /*  e1000_ethtool.c  */
@@ -81,6 +81,9 @@ static const struct e1000_stats e1000_gstrings_stats[] = {
 	{ "rx_csum_offload_errors", E1000_STAT(hw_csum_err) },
 	{ "rx_header_split", E1000_STAT(rx_hdr_split) },
 	{ "alloc_rx_buff_failed", E1000_STAT(alloc_rx_buff_failed) },
+	{ "rx_skb_recycled", E1000_STAT(rx_recycle_ethtool.recycled) },
+	{ "rx_skb_reused", E1000_STAT(rx_recycle_ethtool.reused) },
+	{ "rx_skb_recycle_full", E1000_STAT(rx_recycle_ethtool.full) },
 };
 
 #define E1000_QUEUE_STATS_LEN 0
@@ -1857,6 +1860,7 @@ e1000_get_ethtool_stats(struct net_device *netdev,
 	int i;
 
 	e1000_update_stats(adapter);
+	e1000_update_recycle_stats(adapter);
 	for (i = 0; i < E1000_GLOBAL_STATS_LEN; i++) {
 		char *p = (char *)adapter+e1000_gstrings_stats[i].stat_offset;
 		data[i] = (e1000_gstrings_stats[i].sizeof_stat ==
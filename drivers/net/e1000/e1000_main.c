@@ -150,6 +150,7 @@ static boolean_t e1000_clean_tx_irq(struct e1000_adapter *adapter,
                                     struct e1000_tx_ring *tx_ring);
 #ifdef CONFIG_E1000_NAPI
 static int e1000_clean(struct net_device *poll_dev, int *budget);
+static int e1000_busy_poll(struct net_device *netdev, int budget);
 static boolean_t e1000_clean_rx_irq(struct e1000_adapter *adapter,
                                     struct e1000_rx_ring *rx_ring,
                                     int *work_done, int work_to_do);
@@ -454,6 +455,13 @@ e1000_up(struct e1000_adapter *adapter)
 	e1000_configure_tx(adapter);
 	e1000_setup_rctl(adapter);
 	e1000_configure_rx(adapter);
+	/* Transmitted skbs big enough for the legacy rx ring go back to it
+	 * rather than to the slab; without a pool it allocates as usual. */
+	if (!adapter->rx_ps_pages &&
+	    adapter->rx_buffer_len <= E1000_RXBUFFER_2048)
+		adapter->rx_recycle = skb_recycle_pool_create(
+				adapter->rx_buffer_len + NET_IP_ALIGN,
+				adapter->rx_ring[0].count);
 	/* call E1000_DESC_UNUSED which always leaves
 	 * at least 1 descriptor unused to make sure
 	 * next_to_use != next_to_clean */
@@ -468,6 +476,7 @@ e1000_up(struct e1000_adapter *adapter)
 	mod_timer(&adapter->watchdog_timer, jiffies);
 
 #ifdef CONFIG_E1000_NAPI
+	adapter->rx_poll_off = 0;
 	netif_poll_enable(netdev);
 #endif
 	e1000_irq_enable(adapter);
@@ -535,6 +544,10 @@ e1000_down(struct e1000_adapter *adapter)
 
 #ifdef CONFIG_E1000_NAPI
 	netif_poll_disable(netdev);
+	/* the rx ring is about to be freed, wait out any busy poll */
+	spin_lock_bh(&adapter->rx_poll_lock);
+	adapter->rx_poll_off = 1;
+	spin_unlock_bh(&adapter->rx_poll_lock);
 #endif
 	netdev->tx_queue_len = adapter->tx_queue_len;
 	adapter->link_speed = 0;
@@ -545,6 +558,18 @@ e1000_down(struct e1000_adapter *adapter)
 	e1000_reset(adapter);
 	e1000_clean_all_tx_rings(adapter);
 	e1000_clean_all_rx_rings(adapter);
+
+	if (adapter->rx_recycle) {
+		struct skb_recycle_pool *pool = adapter->rx_recycle;
+		struct skb_recycle_stats st;
+
+		adapter->rx_recycle = NULL;
+		skb_recycle_pool_stats(pool, &st);
+		adapter->rx_recycle_stats.recycled += st.recycled;
+		adapter->rx_recycle_stats.reused += st.reused;
+		adapter->rx_recycle_stats.full += st.full;
+		skb_recycle_pool_destroy(pool);
+	}
 }
 
 void
@@ -753,6 +778,7 @@ e1000_probe(struct pci_dev *pdev,
 	netdev->watchdog_timeo = 5 * HZ;
 #ifdef CONFIG_E1000_NAPI
 	netdev->poll = &e1000_clean;
+	netdev->busy_poll = &e1000_busy_poll;
 	netdev->weight = 64;
 #endif
 	netdev->vlan_rx_register = e1000_vlan_rx_register;
@@ -1123,6 +1149,8 @@ e1000_sw_init(struct e1000_adapter *adapter)
 		set_bit(__LINK_STATE_START, &adapter->polling_netdev[i].state);
 	}
 	spin_lock_init(&adapter->tx_queue_lock);
+	spin_lock_init(&adapter->rx_poll_lock);
+	adapter->rx_poll_off = 1;
 #endif
 
 	atomic_set(&adapter->irq_sem, 1);
@@ -1918,7 +1946,9 @@ e1000_unmap_and_free_tx_resource(struct e1000_adapter *adapter,
 				buffer_info->length,
 				PCI_DMA_TODEVICE);
 	}
-	if (buffer_info->skb)
+	if (buffer_info->skb &&
+	    (!adapter->rx_recycle ||
+	     !skb_recycle(adapter->rx_recycle, buffer_info->skb)))
 		dev_kfree_skb_any(buffer_info->skb);
 	memset(buffer_info, 0, sizeof(struct e1000_buffer));
 }
@@ -2785,7 +2815,13 @@ e1000_tx_queue(struct e1000_adapter *adapter, struct e1000_tx_ring *tx_ring,
 	wmb();
 
 	tx_ring->next_to_use = i;
-	writel(i, adapter->hw.hw_addr + tx_ring->tdt);
+}
+
+/* Let the hardware fetch the descriptors queued so far */
+static inline void
+e1000_tx_kick(struct e1000_adapter *adapter, struct e1000_tx_ring *tx_ring)
+{
+	writel(tx_ring->next_to_use, adapter->hw.hw_addr + tx_ring->tdt);
 }
 
 /**
@@ -2877,6 +2913,7 @@ e1000_xmit_frame(struct sk_buff *skb, struct net_device *netdev)
 	int count = 0;
 	int tso;
 	unsigned int f;
+	int xmit_more = skb->xmit_more;
 	len -= skb->data_len;
 
 	tx_ring = adapter->tx_ring;
@@ -2976,6 +3013,8 @@ e1000_xmit_frame(struct sk_buff *skb, struct net_device *netdev)
 	 * head, otherwise try next time */
 	if (unlikely(E1000_DESC_UNUSED(tx_ring) < count + 2)) {
 		netif_stop_queue(netdev);
+		/* the previous packet may have been held back */
+		e1000_tx_kick(adapter, tx_ring);
 		spin_unlock_irqrestore(&tx_ring->tx_lock, flags);
 		return NETDEV_TX_BUSY;
 	}
@@ -2984,6 +3023,7 @@ e1000_xmit_frame(struct sk_buff *skb, struct net_device *netdev)
 		if (unlikely(e1000_82547_fifo_workaround(adapter, skb))) {
 			netif_stop_queue(netdev);
 			mod_timer(&adapter->tx_fifo_stall_timer, jiffies);
+			e1000_tx_kick(adapter, tx_ring);
 			spin_unlock_irqrestore(&tx_ring->tx_lock, flags);
 			return NETDEV_TX_BUSY;
 		}
@@ -2999,6 +3039,7 @@ e1000_xmit_frame(struct sk_buff *skb, struct net_device *netdev)
 	tso = e1000_tso(adapter, tx_ring, skb);
 	if (tso < 0) {
 		dev_kfree_skb_any(skb);
+		e1000_tx_kick(adapter, tx_ring);
 		spin_unlock_irqrestore(&tx_ring->tx_lock, flags);
 		return NETDEV_TX_OK;
 	}
@@ -3025,6 +3066,10 @@ e1000_xmit_frame(struct sk_buff *skb, struct net_device *netdev)
 	if (unlikely(E1000_DESC_UNUSED(tx_ring) < MAX_SKB_FRAGS + 2))
 		netif_stop_queue(netdev);
 
+	/* Ring the doorbell once for a batch of packets */
+	if (!xmit_more || netif_queue_stopped(netdev))
+		e1000_tx_kick(adapter, tx_ring);
+
 	spin_unlock_irqrestore(&tx_ring->tx_lock, flags);
 	return NETDEV_TX_OK;
 }
@@ -3128,9 +3173,9 @@ e1000_change_mtu(struct net_device *netdev, int new_mtu)
 	}
 
 	/* NOTE: netdev_alloc_skb reserves 16 bytes, and typically NET_IP_ALIGN
-	 * means we reserve 2 more, this pushes us to allocate from the next
-	 * larger slab size
-	 * i.e. RXBUFFER_2048 --> size-4096 slab */
+	 * means we reserve 2 more.  The buffers are carved from a per-cpu
+	 * page (see netdev_alloc_frag), so that costs only the bytes, where
+	 * a kmalloc would have moved RXBUFFER_2048 to the size-4096 slab. */
 
 	if (max_frame <= E1000_RXBUFFER_256)
 		adapter->rx_buffer_len = E1000_RXBUFFER_256;
@@ -3163,6 +3208,26 @@ e1000_change_mtu(struct net_device *netdev, int new_mtu)
 	return 0;
 }
 
+/**
+ * e1000_update_recycle_stats - Update the skb recycling counters for ethtool
+ * @adapter: board private structure
+ **/
+
+void
+e1000_update_recycle_stats(struct e1000_adapter *adapter)
+{
+	struct skb_recycle_stats *st = &adapter->rx_recycle_ethtool;
+	struct skb_recycle_pool *pool = adapter->rx_recycle;
+
+	if (pool)
+		skb_recycle_pool_stats(pool, st);
+	else
+		memset(st, 0, sizeof(*st));
+	st->recycled += adapter->rx_recycle_stats.recycled;
+	st->reused += adapter->rx_recycle_stats.reused;
+	st->full += adapter->rx_recycle_stats.full;
+}
+
 /**
  * e1000_update_stats - Update the board statistics counters
  * @adapter: board private structure
@@ -3430,7 +3495,7 @@ e1000_clean(struct net_device *poll_dev, int *budget)
 {
 	struct e1000_adapter *adapter;
 	int work_to_do = min(*budget, poll_dev->quota);
-	int tx_cleaned = 0, work_done = 0;
+	int tx_cleaned = 0, rx_busy = 0, work_done = 0;
 
 	/* Must NOT use netdev_priv macro here. */
 	adapter = poll_dev->priv;
@@ -3449,14 +3514,20 @@ e1000_clean(struct net_device *poll_dev, int *budget)
 		spin_unlock(&adapter->tx_queue_lock);
 	}
 
-	adapter->clean_rx(adapter, &adapter->rx_ring[0],
-	                  &work_done, work_to_do);
+	/* A busy poller may be cleaning rx_ring[0]; stay scheduled then,
+	 * for whatever it leaves behind. */
+	if (spin_trylock(&adapter->rx_poll_lock)) {
+		adapter->clean_rx(adapter, &adapter->rx_ring[0],
+		                  &work_done, work_to_do);
+		spin_unlock(&adapter->rx_poll_lock);
+	} else
+		rx_busy = 1;
 
 	*budget -= work_done;
 	poll_dev->quota -= work_done;
 
 	/* If no Tx and not enough Rx work done, exit the polling mode */
-	if ((!tx_cleaned && (work_done == 0)) ||
+	if ((!tx_cleaned && (work_done == 0) && !rx_busy) ||
 	   !netif_running(poll_dev)) {
 quit_polling:
 		netif_rx_complete(poll_dev);
@@ -3467,6 +3538,31 @@ quit_polling:
 	return 1;
 }
 
+/**
+ * e1000_busy_poll - clean Rx for a busy polling socket
+ * @netdev: network interface device structure
+ * @budget: most packets to pass up
+ *
+ * Called with BHs disabled; interrupts are left as they are, NAPI
+ * takes over again from the next one.
+ **/
+
+static int
+e1000_busy_poll(struct net_device *netdev, int budget)
+{
+	struct e1000_adapter *adapter = netdev_priv(netdev);
+	int work_done = 0;
+
+	if (!spin_trylock(&adapter->rx_poll_lock))
+		return 0;
+	if (!adapter->rx_poll_off && netif_carrier_ok(netdev))
+		adapter->clean_rx(adapter, &adapter->rx_ring[0],
+		                  &work_done, budget);
+	spin_unlock(&adapter->rx_poll_lock);
+
+	return work_done;
+}
+
 #endif
 /**
  * e1000_clean_tx_irq - Reclaim resources after transmit completes
@@ -3978,13 +4074,16 @@ e1000_alloc_rx_buffers(struct e1000_adapter *adapter,
 	buffer_info = &rx_ring->buffer_info[i];
 
 	while (cleaned_count--) {
-		if (!(skb = buffer_info->skb))
-			skb = netdev_alloc_skb(netdev, bufsz);
-		else {
+		if ((skb = buffer_info->skb)) {
 			skb_trim(skb, 0);
 			goto map_skb;
 		}
 
+		if (adapter->rx_recycle)
+			skb = skb_recycle_alloc(adapter->rx_recycle, netdev);
+		else
+			skb = netdev_alloc_skb(netdev, bufsz);
+
 		if (unlikely(!skb)) {
 			/* Better luck next round */
 			adapter->alloc_rx_buff_failed++;
@@ -142,13 +142,37 @@ struct myri10ge_rx_done {
 	int idx;
 };
 
+#define MYRI10GE_MAX_SLICES 32
+#define MYRI10GE_RSS_TABLE_SIZE 128
+
+/*
+ * A slice is a pair of receive rings with their own interrupt queue,
+ * MSI-X vector and NAPI poll.  The firmware spreads received packets
+ * over the slices by a hash of their headers; transmits and firmware
+ * events all go through slice 0, which is polled through the
+ * net_device itself.  The other slices are polled through a private
+ * net_device that never gets registered.
+ */
+struct myri10ge_slice_state {
+	struct myri10ge_rx_buf rx_small;
+	struct myri10ge_rx_buf rx_big;
+	struct myri10ge_rx_done rx_done;
+	struct myri10ge_priv *mgp;
+	struct net_device *dev;	/* polls this slice */
+	struct net_device poll_dev;
+	u32 __iomem *irq_claim;
+	unsigned long rx_packets;
+	unsigned long rx_bytes;
+	unsigned long rx_dropped;
+	char irq_desc[IFNAMSIZ + 16];
+};
+
 struct myri10ge_priv {
 	int running;		/* running?             */
 	int csum_flag;		/* rx_csums?            */
 	struct myri10ge_tx_buf tx;	/* transmit ring        */
-	struct myri10ge_rx_buf rx_small;
-	struct myri10ge_rx_buf rx_big;
-	struct myri10ge_rx_done rx_done;
+	struct myri10ge_slice_state *ss;
+	int num_slices;
 	int small_bytes;
 	struct net_device *dev;
 	struct net_device_stats stats;
@@ -156,7 +180,6 @@ struct myri10ge_priv {
 	int sram_size;
 	unsigned long board_span;
 	unsigned long iomem_base;
-	u32 __iomem *irq_claim;
 	u32 __iomem *irq_deassert;
 	char *mac_addr_string;
 	struct mcp_cmd_response *cmd;
@@ -165,6 +188,11 @@ struct myri10ge_priv {
 	dma_addr_t fw_stats_bus;
 	struct pci_dev *pdev;
 	int msi_enabled;
+	int msix_enabled;
+	struct msix_entry *msix_vectors;
+	int rss_table_size;
+	u8 rss_table[MYRI10GE_RSS_TABLE_SIZE];	/* indirection: slice per entry */
+	u8 __iomem *rss_table_lanai;
 	unsigned int link_state;
 	unsigned int rdma_tags_available;
 	int intr_coal_delay;
@@ -196,6 +224,8 @@ struct myri10ge_priv {
 
 static char *myri10ge_fw_unaligned = "myri10ge_ethp_z8e.dat";
 static char *myri10ge_fw_aligned = "myri10ge_eth_z8e.dat";
+static char *myri10ge_fw_rss_unaligned = "myri10ge_rss_ethp_z8e.dat";
+static char *myri10ge_fw_rss_aligned = "myri10ge_rss_eth_z8e.dat";
 
 static char *myri10ge_fw_name = NULL;
 module_param(myri10ge_fw_name, charp, S_IRUGO | S_IWUSR);
@@ -257,6 +287,15 @@ module_param(myri10ge_max_irq_loops, int, S_IRUGO);
 MODULE_PARM_DESC(myri10ge_max_irq_loops,
 		 "Set stuck legacy IRQ detection threshold\n");
 
+static int myri10ge_max_slices = 1;
+module_param(myri10ge_max_slices, int, S_IRUGO);
+MODULE_PARM_DESC(myri10ge_max_slices,
+		 "Max number of receive slices, -1 for one per CPU\n");
+
+static int myri10ge_rss_hash = MXGEFW_RSS_HASH_TYPE_SRC_DST_PORT;
+module_param(myri10ge_rss_hash, int, S_IRUGO);
+MODULE_PARM_DESC(myri10ge_rss_hash, "Type of RSS hashing to do\n");
+
 #define MYRI10GE_FW_OFFSET 1024*1024
 #define MYRI10GE_HIGHPART_TO_U32(X) \
 (sizeof (X) == 8) ? ((u32)((u64)(X) >> 32)) : (0)
@@ -669,7 +708,8 @@ myri10ge_change_promisc(struct myri10ge_priv *mgp, int promisc, int atomic)
 static int myri10ge_reset(struct myri10ge_priv *mgp)
 {
 	struct myri10ge_cmd cmd;
-	int status;
+	struct myri10ge_slice_state *ss;
+	int i, status;
 	size_t bytes;
 	u32 len;
 
@@ -684,18 +724,44 @@ static int myri10ge_reset(struct myri10ge_priv *mgp)
 
 	/* Now exchange information about interrupts  */
 
-	bytes = myri10ge_max_intr_slots * sizeof(*mgp->rx_done.entry);
-	memset(mgp->rx_done.entry, 0, bytes);
+	bytes = myri10ge_max_intr_slots * sizeof(*mgp->ss[0].rx_done.entry);
+	for (i = 0; i < mgp->num_slices; i++)
+		memset(mgp->ss[i].rx_done.entry, 0, bytes);
 	cmd.data0 = (u32) bytes;
 	status = myri10ge_send_cmd(mgp, MXGEFW_CMD_SET_INTRQ_SIZE, &cmd, 0);
-	cmd.data0 = MYRI10GE_LOWPART_TO_U32(mgp->rx_done.bus);
-	cmd.data1 = MYRI10GE_HIGHPART_TO_U32(mgp->rx_done.bus);
-	status |= myri10ge_send_cmd(mgp, MXGEFW_CMD_SET_INTRQ_DMA, &cmd, 0);
+
+	/* The RSS commands, including the interrupt queues of all
+	 * but slice 0, only work once GET_MAX_RSS_QUEUES has been
+	 * issued after SET_INTRQ_SIZE */
+	if (mgp->num_slices > 1) {
+		status |= myri10ge_send_cmd(mgp, MXGEFW_CMD_GET_MAX_RSS_QUEUES,
+					    &cmd, 0);
+		cmd.data0 = mgp->num_slices;
+		cmd.data1 = MXGEFW_SLICE_INTR_MODE_ONE_PER_SLICE;
+		status |= myri10ge_send_cmd(mgp, MXGEFW_CMD_ENABLE_RSS_QUEUES,
+					    &cmd, 0);
+		if (status != 0) {
+			dev_err(&mgp->pdev->dev, "failed to set %d slices\n",
+				mgp->num_slices);
+			return status;
+		}
+	}
+
+	for (i = 0; i < mgp->num_slices; i++) {
+		ss = &mgp->ss[i];
+		cmd.data0 = MYRI10GE_LOWPART_TO_U32(ss->rx_done.bus);
+		cmd.data1 = MYRI10GE_HIGHPART_TO_U32(ss->rx_done.bus);
+		cmd.data2 = i;
+		status |= myri10ge_send_cmd(mgp, MXGEFW_CMD_SET_INTRQ_DMA,
+					    &cmd, 0);
+	}
 
 	status |=
 	    myri10ge_send_cmd(mgp, MXGEFW_CMD_GET_IRQ_ACK_OFFSET, &cmd, 0);
-	mgp->irq_claim = (__iomem u32 *) (mgp->sram + cmd.data0);
-	if (!mgp->msi_enabled) {
+	for (i = 0; i < mgp->num_slices; i++)
+		mgp->ss[i].irq_claim =
+		    (__iomem u32 *) (mgp->sram + cmd.data0 + 8 * i);
+	if (!mgp->msi_enabled && !mgp->msix_enabled) {
 		status |= myri10ge_send_cmd
 		    (mgp, MXGEFW_CMD_GET_IRQ_DEASSERT_OFFSET, &cmd, 0);
 		mgp->irq_deassert = (__iomem u32 *) (mgp->sram + cmd.data0);
@@ -721,8 +787,9 @@ static int myri10ge_reset(struct myri10ge_priv *mgp)
 
 	len = mgp->tx.boundary;
 
-	cmd.data0 = MYRI10GE_LOWPART_TO_U32(mgp->rx_done.bus);
-	cmd.data1 = MYRI10GE_HIGHPART_TO_U32(mgp->rx_done.bus);
+	ss = &mgp->ss[0];
+	cmd.data0 = MYRI10GE_LOWPART_TO_U32(ss->rx_done.bus);
+	cmd.data1 = MYRI10GE_HIGHPART_TO_U32(ss->rx_done.bus);
 	cmd.data2 = len * 0x10000;
 	status = myri10ge_send_cmd(mgp, MXGEFW_DMA_TEST, &cmd, 0);
 	if (status == 0)
@@ -731,8 +798,8 @@ static int myri10ge_reset(struct myri10ge_priv *mgp)
 	else
 		dev_warn(&mgp->pdev->dev, "DMA read benchmark failed: %d\n",
 			 status);
-	cmd.data0 = MYRI10GE_LOWPART_TO_U32(mgp->rx_done.bus);
-	cmd.data1 = MYRI10GE_HIGHPART_TO_U32(mgp->rx_done.bus);
+	cmd.data0 = MYRI10GE_LOWPART_TO_U32(ss->rx_done.bus);
+	cmd.data1 = MYRI10GE_HIGHPART_TO_U32(ss->rx_done.bus);
 	cmd.data2 = len * 0x1;
 	status = myri10ge_send_cmd(mgp, MXGEFW_DMA_TEST, &cmd, 0);
 	if (status == 0)
@@ -742,8 +809,8 @@ static int myri10ge_reset(struct myri10ge_priv *mgp)
 		dev_warn(&mgp->pdev->dev, "DMA write benchmark failed: %d\n",
 			 status);
 
-	cmd.data0 = MYRI10GE_LOWPART_TO_U32(mgp->rx_done.bus);
-	cmd.data1 = MYRI10GE_HIGHPART_TO_U32(mgp->rx_done.bus);
+	cmd.data0 = MYRI10GE_LOWPART_TO_U32(ss->rx_done.bus);
+	cmd.data1 = MYRI10GE_HIGHPART_TO_U32(ss->rx_done.bus);
 	cmd.data2 = len * 0x10001;
 	status = myri10ge_send_cmd(mgp, MXGEFW_DMA_TEST, &cmd, 0);
 	if (status == 0)
@@ -753,17 +820,19 @@ static int myri10ge_reset(struct myri10ge_priv *mgp)
 		dev_warn(&mgp->pdev->dev,
 			 "DMA read/write benchmark failed: %d\n", status);
 
-	memset(mgp->rx_done.entry, 0, bytes);
-
 	/* reset mcp/driver shared state back to 0 */
 	mgp->tx.req = 0;
 	mgp->tx.done = 0;
 	mgp->tx.pkt_start = 0;
 	mgp->tx.pkt_done = 0;
-	mgp->rx_big.cnt = 0;
-	mgp->rx_small.cnt = 0;
-	mgp->rx_done.idx = 0;
-	mgp->rx_done.cnt = 0;
+	for (i = 0; i < mgp->num_slices; i++) {
+		ss = &mgp->ss[i];
+		memset(ss->rx_done.entry, 0, bytes);
+		ss->rx_big.cnt = 0;
+		ss->rx_small.cnt = 0;
+		ss->rx_done.idx = 0;
+		ss->rx_done.cnt = 0;
+	}
 	status = myri10ge_update_mac_address(mgp, mgp->dev->dev_addr);
 	myri10ge_change_promisc(mgp, 0, 0);
 	myri10ge_change_pause(mgp, mgp->pause);
@@ -935,9 +1004,10 @@ static inline void myri10ge_vlan_ip_csum(struct sk_buff *skb, u16 hw_csum)
 }
 
 static inline unsigned long
-myri10ge_rx_done(struct myri10ge_priv *mgp, struct myri10ge_rx_buf *rx,
+myri10ge_rx_done(struct myri10ge_slice_state *ss, struct myri10ge_rx_buf *rx,
 		 int bytes, int len, int csum)
 {
+	struct myri10ge_priv *mgp = ss->mgp;
 	dma_addr_t bus;
 	struct sk_buff *skb;
 	int idx, unmap_len;
@@ -953,7 +1023,7 @@ myri10ge_rx_done(struct myri10ge_priv *mgp, struct myri10ge_rx_buf *rx,
 	/* try to replace the received skb */
 	if (myri10ge_getbuf(rx, mgp->pdev, bytes, idx)) {
 		/* drop the frame -- the old skbuf is re-cycled */
-		mgp->stats.rx_dropped += 1;
+		ss->rx_dropped += 1;
 		return 0;
 	}
 
@@ -1034,9 +1104,11 @@ static inline void myri10ge_tx_done(struct myri10ge_priv *mgp, int mcp_index)
 	}
 }
 
-static inline void myri10ge_clean_rx_done(struct myri10ge_priv *mgp, int *limit)
+static inline void
+myri10ge_clean_rx_done(struct myri10ge_slice_state *ss, int *limit)
 {
-	struct myri10ge_rx_done *rx_done = &mgp->rx_done;
+	struct myri10ge_priv *mgp = ss->mgp;
+	struct myri10ge_rx_done *rx_done = &ss->rx_done;
 	unsigned long rx_bytes = 0;
 	unsigned long rx_packets = 0;
 	unsigned long rx_ok;
@@ -1051,11 +1123,11 @@ static inline void myri10ge_clean_rx_done(struct myri10ge_priv *mgp, int *limit)
 		rx_done->entry[idx].length = 0;
 		checksum = ntohs(rx_done->entry[idx].checksum);
 		if (length <= mgp->small_bytes)
-			rx_ok = myri10ge_rx_done(mgp, &mgp->rx_small,
+			rx_ok = myri10ge_rx_done(ss, &ss->rx_small,
 						 mgp->small_bytes,
 						 length, checksum);
 		else
-			rx_ok = myri10ge_rx_done(mgp, &mgp->rx_big,
+			rx_ok = myri10ge_rx_done(ss, &ss->rx_big,
 						 mgp->dev->mtu + ETH_HLEN,
 						 length, checksum);
 		rx_packets += rx_ok;
@@ -1069,8 +1141,8 @@ static inline void myri10ge_clean_rx_done(struct myri10ge_priv *mgp, int *limit)
 	}
 	rx_done->idx = idx;
 	rx_done->cnt = cnt;
-	mgp->stats.rx_packets += rx_packets;
-	mgp->stats.rx_bytes += rx_bytes;
+	ss->rx_packets += rx_packets;
+	ss->rx_bytes += rx_bytes;
 }
 
 static inline void myri10ge_check_statblock(struct myri10ge_priv *mgp)
@@ -1104,28 +1176,53 @@ static inline void myri10ge_check_statblock(struct myri10ge_priv *mgp)
 	}
 }
 
-static int myri10ge_poll(struct net_device *netdev, int *budget)
+static int
+__myri10ge_poll(struct myri10ge_slice_state *ss, struct net_device *netdev,
+		int *budget)
 {
-	struct myri10ge_priv *mgp = netdev_priv(netdev);
-	struct myri10ge_rx_done *rx_done = &mgp->rx_done;
+	struct myri10ge_rx_done *rx_done = &ss->rx_done;
 	int limit, orig_limit, work_done;
 
 	/* process as many rx events as NAPI will allow */
 	limit = min(*budget, netdev->quota);
 	orig_limit = limit;
-	myri10ge_clean_rx_done(mgp, &limit);
+	myri10ge_clean_rx_done(ss, &limit);
 	work_done = orig_limit - limit;
 	*budget -= work_done;
 	netdev->quota -= work_done;
 
-	if (rx_done->entry[rx_done->idx].length == 0 || !netif_running(netdev)) {
+	if (rx_done->entry[rx_done->idx].length == 0 ||
+	    !netif_running(ss->mgp->dev)) {
 		netif_rx_complete(netdev);
-		__raw_writel(htonl(3), mgp->irq_claim);
+		__raw_writel(htonl(3), ss->irq_claim);
 		return 0;
 	}
 	return 1;
 }
 
+static int myri10ge_poll(struct net_device *netdev, int *budget)
+{
+	struct myri10ge_priv *mgp = netdev_priv(netdev);
+
+	return __myri10ge_poll(&mgp->ss[0], netdev, budget);
+}
+
+static int myri10ge_poll_slice(struct net_device *poll_dev, int *budget)
+{
+	return __myri10ge_poll(poll_dev->priv, poll_dev, budget);
+}
+
+/* MSI-X vectors are not shared, so an interrupt of a slice other than
+ * 0 always means it has receives */
+static irqreturn_t myri10ge_slice_intr(int irq, void *arg,
+				       struct pt_regs *regs)
+{
+	struct myri10ge_slice_state *ss = arg;
+
+	netif_rx_schedule(ss->dev);
+	return (IRQ_HANDLED);
+}
+
 static irqreturn_t myri10ge_intr(int irq, void *arg, struct pt_regs *regs)
 {
 	struct myri10ge_priv *mgp = arg;
@@ -1143,7 +1240,7 @@ static irqreturn_t myri10ge_intr(int irq, void *arg, struct pt_regs *regs)
 	if (stats->valid & 1)
 		netif_rx_schedule(mgp->dev);
 
-	if (!mgp->msi_enabled) {
+	if (!mgp->msi_enabled && !mgp->msix_enabled) {
 		__raw_writel(0, mgp->irq_deassert);
 		if (!myri10ge_deassert_wait)
 			stats->valid = 0;
@@ -1173,10 +1270,28 @@ static irqreturn_t myri10ge_intr(int irq, void *arg, struct pt_regs *regs)
 
 	myri10ge_check_statblock(mgp);
 
-	__raw_writel(htonl(3), mgp->irq_claim + 1);
+	__raw_writel(htonl(3), mgp->ss[0].irq_claim + 1);
 	return (IRQ_HANDLED);
 }
 
+/* the slices count their receives apart, as they run concurrently */
+static void myri10ge_update_rx_stats(struct myri10ge_priv *mgp)
+{
+	struct myri10ge_slice_state *ss;
+	unsigned long packets = 0, bytes = 0, dropped = 0;
+	int i;
+
+	for (i = 0; i < mgp->num_slices; i++) {
+		ss = &mgp->ss[i];
+		packets += ss->rx_packets;
+		bytes += ss->rx_bytes;
+		dropped += ss->rx_dropped;
+	}
+	mgp->stats.rx_packets = packets;
+	mgp->stats.rx_bytes = bytes;
+	mgp->stats.rx_dropped = dropped;
+}
+
 static int
 myri10ge_get_settings(struct net_device *netdev, struct ethtool_cmd *cmd)
 {
@@ -1247,10 +1362,10 @@ myri10ge_get_ringparam(struct net_device *netdev,
 {
 	struct myri10ge_priv *mgp = netdev_priv(netdev);
 
-	ring->rx_mini_max_pending = mgp->rx_small.mask + 1;
-	ring->rx_max_pending = mgp->rx_big.mask + 1;
+	ring->rx_mini_max_pending = mgp->ss[0].rx_small.mask + 1;
+	ring->rx_max_pending = mgp->ss[0].rx_big.mask + 1;
 	ring->rx_jumbo_max_pending = 0;
-	ring->tx_max_pending = mgp->rx_small.mask + 1;
+	ring->tx_max_pending = mgp->ss[0].rx_small.mask + 1;
 	ring->rx_mini_pending = ring->rx_mini_max_pending;
 	ring->rx_pending = ring->rx_max_pending;
 	ring->rx_jumbo_pending = ring->rx_jumbo_max_pending;
@@ -1318,8 +1433,10 @@ myri10ge_get_ethtool_stats(struct net_device *netdev,
 			   struct ethtool_stats *stats, u64 * data)
 {
 	struct myri10ge_priv *mgp = netdev_priv(netdev);
-	int i;
+	unsigned int rx_small_cnt = 0, rx_big_cnt = 0;
+	int i, slice;
 
+	myri10ge_update_rx_stats(mgp);
 	for (i = 0; i < MYRI10GE_NET_STATS_LEN; i++)
 		data[i] = ((unsigned long *)&mgp->stats)[i];
 
@@ -1335,8 +1452,12 @@ myri10ge_get_ethtool_stats(struct net_device *netdev,
 	data[i++] = (unsigned int)mgp->tx.pkt_done;
 	data[i++] = (unsigned int)mgp->tx.req;
 	data[i++] = (unsigned int)mgp->tx.done;
-	data[i++] = (unsigned int)mgp->rx_small.cnt;
-	data[i++] = (unsigned int)mgp->rx_big.cnt;
+	for (slice = 0; slice < mgp->num_slices; slice++) {
+		rx_small_cnt += mgp->ss[slice].rx_small.cnt;
+		rx_big_cnt += mgp->ss[slice].rx_big.cnt;
+	}
+	data[i++] = rx_small_cnt;
+	data[i++] = rx_big_cnt;
 	data[i++] = (unsigned int)mgp->wake_queue;
 	data[i++] = (unsigned int)mgp->stop_queue;
 	data[i++] = (unsigned int)mgp->watchdog_resets;
@@ -1351,6 +1472,59 @@ myri10ge_get_ethtool_stats(struct net_device *netdev,
 	data[i++] = (unsigned int)ntohl(mgp->fw_stats->dropped_no_big_buffer);
 }
 
+static u32 myri10ge_get_rx_rings(struct net_device *netdev)
+{
+	struct myri10ge_priv *mgp = netdev_priv(netdev);
+
+	return mgp->num_slices;
+}
+
+static u32 myri10ge_get_rxfh_indir_size(struct net_device *netdev)
+{
+	struct myri10ge_priv *mgp = netdev_priv(netdev);
+
+	return mgp->num_slices > 1 ? mgp->rss_table_size : 0;
+}
+
+static int myri10ge_get_rxfh(struct net_device *netdev, u32 * indir, u8 * key)
+{
+	struct myri10ge_priv *mgp = netdev_priv(netdev);
+	int i;
+
+	if (indir)
+		for (i = 0; i < mgp->rss_table_size; i++)
+			indir[i] = mgp->rss_table[i];
+	return 0;
+}
+
+static void myri10ge_write_rss_table(struct myri10ge_priv *mgp)
+{
+	int i;
+
+	for (i = 0; i < mgp->rss_table_size; i++)
+		__raw_writeb(mgp->rss_table[i], &mgp->rss_table_lanai[i]);
+	mb();
+}
+
+/* the firmware hash takes no key, only the table can be changed */
+static int
+myri10ge_set_rxfh(struct net_device *netdev, const u32 * indir, const u8 * key)
+{
+	struct myri10ge_priv *mgp = netdev_priv(netdev);
+	int i;
+
+	if (mgp->num_slices == 1 || key)
+		return -EOPNOTSUPP;
+
+	for (i = 0; i < mgp->rss_table_size; i++)
+		mgp->rss_table[i] = indir[i];
+	/* the firmware reads the table for every packet, so it can
+	 * be changed under traffic */
+	if (mgp->running == MYRI10GE_ETH_RUNNING)
+		myri10ge_write_rss_table(mgp);
+	return 0;
+}
+
 static struct ethtool_ops myri10ge_ethtool_ops = {
 	.get_settings = myri10ge_get_settings,
 	.get_drvinfo = myri10ge_get_drvinfo,
@@ -1371,75 +1545,68 @@ static struct ethtool_ops myri10ge_ethtool_ops = {
 #endif
 	.get_strings = myri10ge_get_strings,
 	.get_stats_count = myri10ge_get_stats_count,
-	.get_ethtool_stats = myri10ge_get_ethtool_stats
+	.get_ethtool_stats = myri10ge_get_ethtool_stats,
+	.get_rx_rings = myri10ge_get_rx_rings,
+	.get_rxfh_indir_size = myri10ge_get_rxfh_indir_size,
+	.get_rxfh = myri10ge_get_rxfh,
+	.set_rxfh = myri10ge_set_rxfh
 };
 
-static int myri10ge_allocate_rings(struct net_device *dev)
+static void myri10ge_unmap_rx_ring(struct myri10ge_priv *mgp,
+				   struct myri10ge_rx_buf *rx)
 {
-	struct myri10ge_priv *mgp;
-	struct myri10ge_cmd cmd;
-	int tx_ring_size, rx_ring_size;
-	int tx_ring_entries, rx_ring_entries;
-	int i, status;
-	size_t bytes;
-
-	mgp = netdev_priv(dev);
+	int i;
 
-	/* get ring sizes */
+	for (i = 0; i <= rx->mask; i++) {
+		if (rx->info[i].skb != NULL)
+			dev_kfree_skb_any(rx->info[i].skb);
+		if (pci_unmap_len(&rx->info[i], len))
+			pci_unmap_single(mgp->pdev,
+					 pci_unmap_addr(&rx->info[i], bus),
+					 pci_unmap_len(&rx->info[i], len),
+					 PCI_DMA_FROMDEVICE);
+	}
+}
 
-	status = myri10ge_send_cmd(mgp, MXGEFW_CMD_GET_SEND_RING_SIZE, &cmd, 0);
-	tx_ring_size = cmd.data0;
-	status |= myri10ge_send_cmd(mgp, MXGEFW_CMD_GET_RX_RING_SIZE, &cmd, 0);
-	rx_ring_size = cmd.data0;
+static int myri10ge_allocate_slice_rings(struct myri10ge_slice_state *ss,
+					 int rx_ring_entries)
+{
+	struct myri10ge_priv *mgp = ss->mgp;
+	struct net_device *dev = mgp->dev;
+	int i, status;
+	size_t bytes;
 
-	tx_ring_entries = tx_ring_size / sizeof(struct mcp_kreq_ether_send);
-	rx_ring_entries = rx_ring_size / sizeof(struct mcp_dma_addr);
-	mgp->tx.mask = tx_ring_entries - 1;
-	mgp->rx_small.mask = mgp->rx_big.mask = rx_ring_entries - 1;
+	ss->rx_small.mask = ss->rx_big.mask = rx_ring_entries - 1;
+	status = -ENOMEM;
 
 	/* allocate the host shadow rings */
 
-	bytes = 8 + (MYRI10GE_MAX_SEND_DESC_TSO + 4)
-	    * sizeof(*mgp->tx.req_list);
-	mgp->tx.req_bytes = kzalloc(bytes, GFP_KERNEL);
-	if (mgp->tx.req_bytes == NULL)
+	bytes = rx_ring_entries * sizeof(*ss->rx_small.shadow);
+	ss->rx_small.shadow = kzalloc(bytes, GFP_KERNEL);
+	if (ss->rx_small.shadow == NULL)
 		goto abort_with_nothing;
 
-	/* ensure req_list entries are aligned to 8 bytes */
-	mgp->tx.req_list = (struct mcp_kreq_ether_send *)
-	    ALIGN((unsigned long)mgp->tx.req_bytes, 8);
-
-	bytes = rx_ring_entries * sizeof(*mgp->rx_small.shadow);
-	mgp->rx_small.shadow = kzalloc(bytes, GFP_KERNEL);
-	if (mgp->rx_small.shadow == NULL)
-		goto abort_with_tx_req_bytes;
-
-	bytes = rx_ring_entries * sizeof(*mgp->rx_big.shadow);
-	mgp->rx_big.shadow = kzalloc(bytes, GFP_KERNEL);
-	if (mgp->rx_big.shadow == NULL)
+	bytes = rx_ring_entries * sizeof(*ss->rx_big.shadow);
+	ss->rx_big.shadow = kzalloc(bytes, GFP_KERNEL);
+	if (ss->rx_big.shadow == NULL)
 		goto abort_with_rx_small_shadow;
 
 	/* allocate the host info rings */
 
-	bytes = tx_ring_entries * sizeof(*mgp->tx.info);
-	mgp->tx.info = kzalloc(bytes, GFP_KERNEL);
-	if (mgp->tx.info == NULL)
+	bytes = rx_ring_entries * sizeof(*ss->rx_small.info);
+	ss->rx_small.info = kzalloc(bytes, GFP_KERNEL);
+	if (ss->rx_small.info == NULL)
 		goto abort_with_rx_big_shadow;
 
-	bytes = rx_ring_entries * sizeof(*mgp->rx_small.info);
-	mgp->rx_small.info = kzalloc(bytes, GFP_KERNEL);
-	if (mgp->rx_small.info == NULL)
-		goto abort_with_tx_info;
-
-	bytes = rx_ring_entries * sizeof(*mgp->rx_big.info);
-	mgp->rx_big.info = kzalloc(bytes, GFP_KERNEL);
-	if (mgp->rx_big.info == NULL)
+	bytes = rx_ring_entries * sizeof(*ss->rx_big.info);
+	ss->rx_big.info = kzalloc(bytes, GFP_KERNEL);
+	if (ss->rx_big.info == NULL)
 		goto abort_with_rx_small_info;
 
 	/* Fill the receive rings */
 
-	for (i = 0; i <= mgp->rx_small.mask; i++) {
-		status = myri10ge_getbuf(&mgp->rx_small, mgp->pdev,
+	for (i = 0; i <= ss->rx_small.mask; i++) {
+		status = myri10ge_getbuf(&ss->rx_small, mgp->pdev,
 					 mgp->small_bytes, i);
 		if (status) {
 			printk(KERN_ERR
@@ -1449,9 +1616,9 @@ static int myri10ge_allocate_rings(struct net_device *dev)
 		}
 	}
 
-	for (i = 0; i <= mgp->rx_big.mask; i++) {
+	for (i = 0; i <= ss->rx_big.mask; i++) {
 		status =
-		    myri10ge_getbuf(&mgp->rx_big, mgp->pdev,
+		    myri10ge_getbuf(&ss->rx_big, mgp->pdev,
 				    dev->mtu + ETH_HLEN, i);
 		if (status) {
 			printk(KERN_ERR
@@ -1464,43 +1631,94 @@ static int myri10ge_allocate_rings(struct net_device *dev)
 	return 0;
 
 abort_with_rx_big_ring:
-	for (i = 0; i <= mgp->rx_big.mask; i++) {
-		if (mgp->rx_big.info[i].skb != NULL)
-			dev_kfree_skb_any(mgp->rx_big.info[i].skb);
-		if (pci_unmap_len(&mgp->rx_big.info[i], len))
-			pci_unmap_single(mgp->pdev,
-					 pci_unmap_addr(&mgp->rx_big.info[i],
-							bus),
-					 pci_unmap_len(&mgp->rx_big.info[i],
-						       len),
-					 PCI_DMA_FROMDEVICE);
-	}
+	myri10ge_unmap_rx_ring(mgp, &ss->rx_big);
 
 abort_with_rx_small_ring:
-	for (i = 0; i <= mgp->rx_small.mask; i++) {
-		if (mgp->rx_small.info[i].skb != NULL)
-			dev_kfree_skb_any(mgp->rx_small.info[i].skb);
-		if (pci_unmap_len(&mgp->rx_small.info[i], len))
-			pci_unmap_single(mgp->pdev,
-					 pci_unmap_addr(&mgp->rx_small.info[i],
-							bus),
-					 pci_unmap_len(&mgp->rx_small.info[i],
-						       len),
-					 PCI_DMA_FROMDEVICE);
-	}
-	kfree(mgp->rx_big.info);
+	myri10ge_unmap_rx_ring(mgp, &ss->rx_small);
+	kfree(ss->rx_big.info);
 
 abort_with_rx_small_info:
-	kfree(mgp->rx_small.info);
-
-abort_with_tx_info:
-	kfree(mgp->tx.info);
+	kfree(ss->rx_small.info);
 
 abort_with_rx_big_shadow:
-	kfree(mgp->rx_big.shadow);
+	kfree(ss->rx_big.shadow);
 
 abort_with_rx_small_shadow:
-	kfree(mgp->rx_small.shadow);
+	kfree(ss->rx_small.shadow);
+
+abort_with_nothing:
+	return status;
+}
+
+static void myri10ge_free_slice_rings(struct myri10ge_slice_state *ss)
+{
+	myri10ge_unmap_rx_ring(ss->mgp, &ss->rx_big);
+	myri10ge_unmap_rx_ring(ss->mgp, &ss->rx_small);
+
+	kfree(ss->rx_big.info);
+
+	kfree(ss->rx_small.info);
+
+	kfree(ss->rx_big.shadow);
+
+	kfree(ss->rx_small.shadow);
+}
+
+static int myri10ge_allocate_rings(struct net_device *dev)
+{
+	struct myri10ge_priv *mgp;
+	struct myri10ge_cmd cmd;
+	int tx_ring_size, rx_ring_size;
+	int tx_ring_entries, rx_ring_entries;
+	int slice, status;
+	size_t bytes;
+
+	mgp = netdev_priv(dev);
+
+	/* get ring sizes; every slice has rx rings of the same size */
+
+	status = myri10ge_send_cmd(mgp, MXGEFW_CMD_GET_SEND_RING_SIZE, &cmd, 0);
+	tx_ring_size = cmd.data0;
+	status |= myri10ge_send_cmd(mgp, MXGEFW_CMD_GET_RX_RING_SIZE, &cmd, 0);
+	rx_ring_size = cmd.data0;
+
+	tx_ring_entries = tx_ring_size / sizeof(struct mcp_kreq_ether_send);
+	rx_ring_entries = rx_ring_size / sizeof(struct mcp_dma_addr);
+	mgp->tx.mask = tx_ring_entries - 1;
+
+	/* allocate the host shadow ring */
+
+	status = -ENOMEM;
+	bytes = 8 + (MYRI10GE_MAX_SEND_DESC_TSO + 4)
+	    * sizeof(*mgp->tx.req_list);
+	mgp->tx.req_bytes = kzalloc(bytes, GFP_KERNEL);
+	if (mgp->tx.req_bytes == NULL)
+		goto abort_with_nothing;
+
+	/* ensure req_list entries are aligned to 8 bytes */
+	mgp->tx.req_list = (struct mcp_kreq_ether_send *)
+	    ALIGN((unsigned long)mgp->tx.req_bytes, 8);
+
+	/* allocate the host info ring */
+
+	bytes = tx_ring_entries * sizeof(*mgp->tx.info);
+	mgp->tx.info = kzalloc(bytes, GFP_KERNEL);
+	if (mgp->tx.info == NULL)
+		goto abort_with_tx_req_bytes;
+
+	for (slice = 0; slice < mgp->num_slices; slice++) {
+		status = myri10ge_allocate_slice_rings(&mgp->ss[slice],
+						       rx_ring_entries);
+		if (status)
+			goto abort_with_slices;
+	}
+
+	return 0;
+
+abort_with_slices:
+	while (--slice >= 0)
+		myri10ge_free_slice_rings(&mgp->ss[slice]);
+	kfree(mgp->tx.info);
 
 abort_with_tx_req_bytes:
 	kfree(mgp->tx.req_bytes);
@@ -1520,29 +1738,8 @@ static void myri10ge_free_rings(struct net_device *dev)
 
 	mgp = netdev_priv(dev);
 
-	for (i = 0; i <= mgp->rx_big.mask; i++) {
-		if (mgp->rx_big.info[i].skb != NULL)
-			dev_kfree_skb_any(mgp->rx_big.info[i].skb);
-		if (pci_unmap_len(&mgp->rx_big.info[i], len))
-			pci_unmap_single(mgp->pdev,
-					 pci_unmap_addr(&mgp->rx_big.info[i],
-							bus),
-					 pci_unmap_len(&mgp->rx_big.info[i],
-						       len),
-					 PCI_DMA_FROMDEVICE);
-	}
-
-	for (i = 0; i <= mgp->rx_small.mask; i++) {
-		if (mgp->rx_small.info[i].skb != NULL)
-			dev_kfree_skb_any(mgp->rx_small.info[i].skb);
-		if (pci_unmap_len(&mgp->rx_small.info[i], len))
-			pci_unmap_single(mgp->pdev,
-					 pci_unmap_addr(&mgp->rx_small.info[i],
-							bus),
-					 pci_unmap_len(&mgp->rx_small.info[i],
-						       len),
-					 PCI_DMA_FROMDEVICE);
-	}
+	for (i = 0; i < mgp->num_slices; i++)
+		myri10ge_free_slice_rings(&mgp->ss[i]);
 
 	tx = &mgp->tx;
 	while (tx->done != tx->req) {
@@ -1570,26 +1767,56 @@ static void myri10ge_free_rings(struct net_device *dev)
 					       PCI_DMA_TODEVICE);
 		}
 	}
-	kfree(mgp->rx_big.info);
-
-	kfree(mgp->rx_small.info);
-
 	kfree(mgp->tx.info);
 
-	kfree(mgp->rx_big.shadow);
-
-	kfree(mgp->rx_small.shadow);
-
 	kfree(mgp->tx.req_bytes);
 	mgp->tx.req_bytes = NULL;
 	mgp->tx.req_list = NULL;
 }
 
+/* spread the hash buckets round-robin over the slices */
+static void myri10ge_init_rss_table(struct myri10ge_priv *mgp, int size)
+{
+	int i;
+
+	mgp->rss_table_size = size;
+	for (i = 0; i < size; i++)
+		mgp->rss_table[i] = i % mgp->num_slices;
+}
+
+static int myri10ge_setup_rss(struct myri10ge_priv *mgp)
+{
+	struct myri10ge_cmd cmd;
+	int status;
+
+	cmd.data0 = mgp->rss_table_size;
+	status = myri10ge_send_cmd(mgp, MXGEFW_CMD_SET_RSS_TABLE_SIZE, &cmd, 0);
+	if (status != 0 && mgp->rss_table_size != mgp->num_slices) {
+		/* older firmware takes only one entry per slice */
+		myri10ge_init_rss_table(mgp, mgp->num_slices);
+		cmd.data0 = mgp->rss_table_size;
+		status = myri10ge_send_cmd(mgp, MXGEFW_CMD_SET_RSS_TABLE_SIZE,
+					   &cmd, 0);
+	}
+	status |=
+	    myri10ge_send_cmd(mgp, MXGEFW_CMD_GET_RSS_TABLE_OFFSET, &cmd, 0);
+	if (status != 0)
+		return status;
+
+	mgp->rss_table_lanai = (u8 __iomem *) mgp->sram + cmd.data0;
+	myri10ge_write_rss_table(mgp);
+
+	cmd.data0 = 1;
+	cmd.data1 = myri10ge_rss_hash;
+	return myri10ge_send_cmd(mgp, MXGEFW_CMD_SET_RSS_ENABLE, &cmd, 0);
+}
+
 static int myri10ge_open(struct net_device *dev)
 {
 	struct myri10ge_priv *mgp;
+	struct myri10ge_slice_state *ss;
 	struct myri10ge_cmd cmd;
-	int status, big_pow2;
+	int i, status, big_pow2;
 
 	mgp = netdev_priv(dev);
 
@@ -1630,14 +1857,21 @@ static int myri10ge_open(struct net_device *dev)
 	mgp->tx.lanai =
 	    (struct mcp_kreq_ether_send __iomem *)(mgp->sram + cmd.data0);
 
-	status |=
-	    myri10ge_send_cmd(mgp, MXGEFW_CMD_GET_SMALL_RX_OFFSET, &cmd, 0);
-	mgp->rx_small.lanai =
-	    (struct mcp_kreq_ether_recv __iomem *)(mgp->sram + cmd.data0);
+	for (i = 0; i < mgp->num_slices; i++) {
+		ss = &mgp->ss[i];
+
+		cmd.data0 = i;
+		status |= myri10ge_send_cmd(mgp, MXGEFW_CMD_GET_SMALL_RX_OFFSET,
+					    &cmd, 0);
+		ss->rx_small.lanai = (struct mcp_kreq_ether_recv __iomem *)
+		    (mgp->sram + cmd.data0);
 
-	status |= myri10ge_send_cmd(mgp, MXGEFW_CMD_GET_BIG_RX_OFFSET, &cmd, 0);
-	mgp->rx_big.lanai =
-	    (struct mcp_kreq_ether_recv __iomem *)(mgp->sram + cmd.data0);
+		cmd.data0 = i;
+		status |= myri10ge_send_cmd(mgp, MXGEFW_CMD_GET_BIG_RX_OFFSET,
+					    &cmd, 0);
+		ss->rx_big.lanai = (struct mcp_kreq_ether_recv __iomem *)
+		    (mgp->sram + cmd.data0);
+	}
 
 	if (status != 0) {
 		printk(KERN_ERR
@@ -1647,15 +1881,22 @@ static int myri10ge_open(struct net_device *dev)
 		return -ENXIO;
 	}
 
-	if (mgp->mtrr >= 0) {
+	for (i = 0; i < mgp->num_slices; i++) {
+		ss = &mgp->ss[i];
+		if (mgp->mtrr >= 0) {
+			ss->rx_small.wc_fifo =
+			    (u8 __iomem *) mgp->sram + 0x300000 + 64 * i;
+			ss->rx_big.wc_fifo =
+			    (u8 __iomem *) mgp->sram + 0x340000 + 64 * i;
+		} else {
+			ss->rx_small.wc_fifo = NULL;
+			ss->rx_big.wc_fifo = NULL;
+		}
+	}
+	if (mgp->mtrr >= 0)
 		mgp->tx.wc_fifo = (u8 __iomem *) mgp->sram + 0x200000;
-		mgp->rx_small.wc_fifo = (u8 __iomem *) mgp->sram + 0x300000;
-		mgp->rx_big.wc_fifo = (u8 __iomem *) mgp->sram + 0x340000;
-	} else {
+	else
 		mgp->tx.wc_fifo = NULL;
-		mgp->rx_small.wc_fifo = NULL;
-		mgp->rx_big.wc_fifo = NULL;
-	}
 
 	status = myri10ge_allocate_rings(dev);
 	if (status != 0)
@@ -1693,10 +1934,21 @@ static int myri10ge_open(struct net_device *dev)
 		goto abort_with_rings;
 	}
 
+	if (mgp->num_slices > 1) {
+		status = myri10ge_setup_rss(mgp);
+		if (status) {
+			printk(KERN_ERR "myri10ge: %s: Couldn't enable RSS\n",
+			       dev->name);
+			goto abort_with_rings;
+		}
+	}
+
 	mgp->link_state = -1;
 	mgp->rdma_tags_available = 15;
 
-	netif_poll_enable(mgp->dev);	/* must happen prior to any irq */
+	/* must happen prior to any irq */
+	for (i = 0; i < mgp->num_slices; i++)
+		netif_poll_enable(mgp->ss[i].dev);
 
 	status = myri10ge_send_cmd(mgp, MXGEFW_CMD_ETHERNET_UP, &cmd, 0);
 	if (status) {
@@ -1725,7 +1977,7 @@ static int myri10ge_close(struct net_device *dev)
 {
 	struct myri10ge_priv *mgp;
 	struct myri10ge_cmd cmd;
-	int status, old_down_cnt;
+	int i, status, old_down_cnt;
 
 	mgp = netdev_priv(dev);
 
@@ -1737,7 +1989,8 @@ static int myri10ge_close(struct net_device *dev)
 
 	del_timer_sync(&mgp->watchdog_timer);
 	mgp->running = MYRI10GE_ETH_STOPPING;
-	netif_poll_disable(mgp->dev);
+	for (i = 0; i < mgp->num_slices; i++)
+		netif_poll_disable(mgp->ss[i].dev);
 	netif_carrier_off(dev);
 	netif_stop_queue(dev);
 	old_down_cnt = mgp->down_cnt;
@@ -2135,6 +2388,8 @@ drop:
 static struct net_device_stats *myri10ge_get_stats(struct net_device *dev)
 {
 	struct myri10ge_priv *mgp = netdev_priv(dev);
+
+	myri10ge_update_rx_stats(mgp);
 	return &mgp->stats;
 }
 
@@ -2361,6 +2616,218 @@ static void myri10ge_restore_state(struct myri10ge_priv *mgp)
 	pci_restore_state(pdev);
 }
 
+/*
+ * Receive side scaling needs the rss firmware, and one MSI-X vector
+ * per slice.  Ask the firmware how many slices it can do, and settle
+ * for the largest power of 2 no larger than that, the CPU count and
+ * the vectors we are granted.  Anything short of 2 slices falls back
+ * to the original firmware and a single interrupt.
+ */
+static void myri10ge_probe_slices(struct myri10ge_priv *mgp)
+{
+	struct pci_dev *pdev = mgp->pdev;
+	struct myri10ge_cmd cmd;
+	char *old_fw;
+	int i, status, ncpus, max_slices;
+
+	mgp->num_slices = 1;
+	ncpus = num_online_cpus();
+
+	if (myri10ge_max_slices == 1 || ncpus < 2 ||
+	    pci_find_capability(pdev, PCI_CAP_ID_MSIX) == 0)
+		return;
+
+	old_fw = mgp->fw_name;
+	if (old_fw == myri10ge_fw_aligned)
+		mgp->fw_name = myri10ge_fw_rss_aligned;
+	else if (old_fw == myri10ge_fw_unaligned)
+		mgp->fw_name = myri10ge_fw_rss_unaligned;
+	else if (old_fw != myri10ge_fw_name)
+		return;		/* adopted firmware */
+
+	status = myri10ge_load_firmware(mgp);
+	if (status != 0) {
+		dev_info(&pdev->dev, "rss firmware not found\n");
+		goto abort_with_fw;
+	}
+
+	/* hit the board with a reset to ensure it is alive */
+	memset(&cmd, 0, sizeof(cmd));
+	status = myri10ge_send_cmd(mgp, MXGEFW_CMD_RESET, &cmd, 0);
+	if (status != 0) {
+		dev_err(&pdev->dev, "failed reset\n");
+		goto abort_with_fw;
+	}
+
+	/* the firmware wants the interrupt queue size first */
+	cmd.data0 = myri10ge_max_intr_slots * sizeof(struct mcp_slot);
+	status = myri10ge_send_cmd(mgp, MXGEFW_CMD_SET_INTRQ_SIZE, &cmd, 0);
+	if (status != 0) {
+		dev_err(&pdev->dev, "failed MXGEFW_CMD_SET_INTRQ_SIZE\n");
+		goto abort_with_fw;
+	}
+
+	status = myri10ge_send_cmd(mgp, MXGEFW_CMD_GET_MAX_RSS_QUEUES, &cmd, 0);
+	if (status != 0)
+		goto abort_with_fw;
+	mgp->num_slices = cmd.data0;
+
+	max_slices = myri10ge_max_slices;
+	if (max_slices < 0 || max_slices > ncpus)
+		max_slices = ncpus;
+	if (max_slices > MYRI10GE_MAX_SLICES)
+		max_slices = MYRI10GE_MAX_SLICES;
+	if (mgp->num_slices > max_slices)
+		mgp->num_slices = max_slices;
+	while (mgp->num_slices & (mgp->num_slices - 1))
+		mgp->num_slices--;
+	if (mgp->num_slices < 2)
+		goto abort_with_fw;
+
+	mgp->msix_vectors = kcalloc(mgp->num_slices,
+				    sizeof(*mgp->msix_vectors), GFP_KERNEL);
+	if (mgp->msix_vectors == NULL)
+		goto abort_with_fw;
+	for (i = 0; i < mgp->num_slices; i++)
+		mgp->msix_vectors[i].entry = i;
+
+	while (mgp->num_slices > 1) {
+		status = pci_enable_msix(pdev, mgp->msix_vectors,
+					 mgp->num_slices);
+		if (status == 0) {
+			mgp->msix_enabled = 1;
+			return;
+		}
+		if (status < 0)
+			break;
+		/* only status vectors are available */
+		while (mgp->num_slices > status)
+			mgp->num_slices >>= 1;
+	}
+	kfree(mgp->msix_vectors);
+	mgp->msix_vectors = NULL;
+
+abort_with_fw:
+	mgp->num_slices = 1;
+	mgp->fw_name = old_fw;
+	(void)myri10ge_load_firmware(mgp);
+}
+
+static void myri10ge_free_slices(struct myri10ge_priv *mgp)
+{
+	struct myri10ge_slice_state *ss;
+	size_t bytes;
+	int i;
+
+	if (mgp->ss == NULL)
+		return;
+
+	for (i = 0; i < mgp->num_slices; i++) {
+		ss = &mgp->ss[i];
+		if (ss->rx_done.entry == NULL)
+			continue;
+		bytes = myri10ge_max_intr_slots * sizeof(*ss->rx_done.entry);
+		dma_free_coherent(&mgp->pdev->dev, bytes,
+				  ss->rx_done.entry, ss->rx_done.bus);
+		if (i > 0)
+			dev_put(ss->dev);
+	}
+	kfree(mgp->ss);
+	mgp->ss = NULL;
+}
+
+static int myri10ge_alloc_slices(struct myri10ge_priv *mgp)
+{
+	struct myri10ge_slice_state *ss;
+	size_t bytes;
+	int i;
+
+	mgp->ss = kcalloc(mgp->num_slices, sizeof(*mgp->ss), GFP_KERNEL);
+	if (mgp->ss == NULL)
+		return -ENOMEM;
+
+	for (i = 0; i < mgp->num_slices; i++) {
+		ss = &mgp->ss[i];
+
+		/* allocate rx done ring */
+		bytes = myri10ge_max_intr_slots * sizeof(*ss->rx_done.entry);
+		ss->rx_done.entry = dma_alloc_coherent(&mgp->pdev->dev, bytes,
+						       &ss->rx_done.bus,
+						       GFP_KERNEL);
+		if (ss->rx_done.entry == NULL)
+			goto abort;
+		memset(ss->rx_done.entry, 0, bytes);
+		ss->mgp = mgp;
+		if (i == 0) {
+			ss->dev = mgp->dev;
+			continue;
+		}
+
+		/* the poll device is never registered, it only
+		 * carries the NAPI state of this slice */
+		ss->dev = &ss->poll_dev;
+		ss->poll_dev.priv = ss;
+		ss->poll_dev.poll = myri10ge_poll_slice;
+		ss->poll_dev.weight = myri10ge_napi_weight;
+		dev_hold(&ss->poll_dev);
+		set_bit(__LINK_STATE_START, &ss->poll_dev.state);
+	}
+	myri10ge_init_rss_table(mgp, MYRI10GE_RSS_TABLE_SIZE);
+	return 0;
+
+abort:
+	myri10ge_free_slices(mgp);
+	return -ENOMEM;
+}
+
+static int myri10ge_request_irq(struct myri10ge_priv *mgp)
+{
+	struct pci_dev *pdev = mgp->pdev;
+	struct myri10ge_slice_state *ss;
+	int i, status;
+
+	if (!mgp->msix_enabled)
+		return request_irq(pdev->irq, myri10ge_intr, IRQF_SHARED,
+				   mgp->dev->name, mgp);
+
+	for (i = 0; i < mgp->num_slices; i++) {
+		ss = &mgp->ss[i];
+		snprintf(ss->irq_desc, sizeof(ss->irq_desc), "%s:%d",
+			 mgp->dev->name, i);
+		if (i == 0)
+			status = request_irq(mgp->msix_vectors[i].vector,
+					     myri10ge_intr, 0, ss->irq_desc,
+					     mgp);
+		else
+			status = request_irq(mgp->msix_vectors[i].vector,
+					     myri10ge_slice_intr, 0,
+					     ss->irq_desc, ss);
+		if (status != 0)
+			goto abort_with_irqs;
+	}
+	return 0;
+
+abort_with_irqs:
+	while (--i > 0)
+		free_irq(mgp->msix_vectors[i].vector, &mgp->ss[i]);
+	if (i == 0)
+		free_irq(mgp->msix_vectors[0].vector, mgp);
+	return status;
+}
+
+static void myri10ge_free_irq(struct myri10ge_priv *mgp)
+{
+	int i;
+
+	if (!mgp->msix_enabled) {
+		free_irq(mgp->pdev->irq, mgp);
+		return;
+	}
+	free_irq(mgp->msix_vectors[0].vector, mgp);
+	for (i = 1; i < mgp->num_slices; i++)
+		free_irq(mgp->msix_vectors[i].vector, &mgp->ss[i]);
+}
+
 #ifdef CONFIG_PM
 
 static int myri10ge_suspend(struct pci_dev *pdev, pm_message_t state)
@@ -2381,7 +2848,7 @@ static int myri10ge_suspend(struct pci_dev *pdev, pm_message_t state)
 		rtnl_unlock();
 	}
 	myri10ge_dummy_rdma(mgp, 0);
-	free_irq(pdev->irq, mgp);
+	myri10ge_free_irq(mgp);
 	myri10ge_save_state(mgp);
 	pci_disable_device(pdev);
 	pci_set_power_state(pdev, pci_choose_state(pdev, state));
@@ -2417,8 +2884,7 @@ static int myri10ge_resume(struct pci_dev *pdev)
 
 	pci_set_master(pdev);
 
-	status = request_irq(pdev->irq, myri10ge_intr, IRQF_SHARED,
-			     netdev->name, mgp);
+	status = myri10ge_request_irq(mgp);
 	if (status != 0) {
 		dev_err(&pdev->dev, "failed to allocate IRQ\n");
 		goto abort_with_enabled;
@@ -2561,7 +3027,6 @@ static int myri10ge_probe(struct pci_dev *pdev, const struct pci_device_id *ent)
 	struct net_device *netdev;
 	struct myri10ge_priv *mgp;
 	struct device *dev = &pdev->dev;
-	size_t bytes;
 	int i;
 	int status = -ENXIO;
 	int cap;
@@ -2671,27 +3136,26 @@ static int myri10ge_probe(struct pci_dev *pdev, const struct pci_device_id *ent)
 	for (i = 0; i < ETH_ALEN; i++)
 		netdev->dev_addr[i] = mgp->mac_addr[i];
 
-	/* allocate rx done ring */
-	bytes = myri10ge_max_intr_slots * sizeof(*mgp->rx_done.entry);
-	mgp->rx_done.entry = dma_alloc_coherent(&pdev->dev, bytes,
-						&mgp->rx_done.bus, GFP_KERNEL);
-	if (mgp->rx_done.entry == NULL)
-		goto abort_with_ioremap;
-	memset(mgp->rx_done.entry, 0, bytes);
-
 	status = myri10ge_load_firmware(mgp);
 	if (status != 0) {
 		dev_err(&pdev->dev, "failed to load firmware\n");
-		goto abort_with_rx_done;
+		goto abort_with_ioremap;
+	}
+
+	myri10ge_probe_slices(mgp);
+	status = myri10ge_alloc_slices(mgp);
+	if (status != 0) {
+		dev_err(&pdev->dev, "failed to alloc slice state\n");
+		goto abort_with_firmware;
 	}
 
 	status = myri10ge_reset(mgp);
 	if (status != 0) {
 		dev_err(&pdev->dev, "failed reset\n");
-		goto abort_with_firmware;
+		goto abort_with_slices;
 	}
 
-	if (myri10ge_msi) {
+	if (myri10ge_msi && !mgp->msix_enabled) {
 		status = pci_enable_msi(pdev);
 		if (status != 0)
 			dev_err(&pdev->dev,
@@ -2701,11 +3165,10 @@ static int myri10ge_probe(struct pci_dev *pdev, const struct pci_device_id *ent)
 			mgp->msi_enabled = 1;
 	}
 
-	status = request_irq(pdev->irq, myri10ge_intr, IRQF_SHARED,
-			     netdev->name, mgp);
+	status = myri10ge_request_irq(mgp);
 	if (status != 0) {
 		dev_err(&pdev->dev, "failed to allocate IRQ\n");
-		goto abort_with_firmware;
+		goto abort_with_msi;
 	}
 
 	pci_set_drvdata(pdev, mgp);
@@ -2719,7 +3182,8 @@ static int myri10ge_probe(struct pci_dev *pdev, const struct pci_device_id *ent)
 	netdev->hard_start_xmit = myri10ge_xmit;
 	netdev->get_stats = myri10ge_get_stats;
 	netdev->base_addr = mgp->iomem_base;
-	netdev->irq = pdev->irq;
+	netdev->irq = mgp->msix_enabled ? mgp->msix_vectors[0].vector :
+	    pdev->irq;
 	netdev->change_mtu = myri10ge_change_mtu;
 	netdev->set_multicast_list = myri10ge_set_multicast_list;
 	netdev->set_mac_address = myri10ge_set_mac_address;
@@ -2744,25 +3208,29 @@ static int myri10ge_probe(struct pci_dev *pdev, const struct pci_device_id *ent)
 		dev_err(&pdev->dev, "register_netdev failed: %d\n", status);
 		goto abort_with_irq;
 	}
-	dev_info(dev, "%s IRQ %d, tx bndry %d, fw %s, WC %s\n",
-		 (mgp->msi_enabled ? "MSI" : "xPIC"),
-		 pdev->irq, mgp->tx.boundary, mgp->fw_name,
+	dev_info(dev, "%s IRQ %d, %d slices, tx bndry %d, fw %s, WC %s\n",
+		 (mgp->msix_enabled ? "MSI-X" :
+		  mgp->msi_enabled ? "MSI" : "xPIC"),
+		 netdev->irq, mgp->num_slices, mgp->tx.boundary, mgp->fw_name,
 		 (mgp->mtrr >= 0 ? "Enabled" : "Disabled"));
 
 	return 0;
 
 abort_with_irq:
-	free_irq(pdev->irq, mgp);
+	myri10ge_free_irq(mgp);
+
+abort_with_msi:
 	if (mgp->msi_enabled)
 		pci_disable_msi(pdev);
 
+abort_with_slices:
+	myri10ge_free_slices(mgp);
+
 abort_with_firmware:
 	myri10ge_dummy_rdma(mgp, 0);
-
-abort_with_rx_done:
-	bytes = myri10ge_max_intr_slots * sizeof(*mgp->rx_done.entry);
-	dma_free_coherent(&pdev->dev, bytes,
-			  mgp->rx_done.entry, mgp->rx_done.bus);
+	if (mgp->msix_enabled)
+		pci_disable_msix(pdev);
+	kfree(mgp->msix_vectors);
 
 abort_with_ioremap:
 	iounmap(mgp->sram);
@@ -2796,7 +3264,6 @@ static void myri10ge_remove(struct pci_dev *pdev)
 {
 	struct myri10ge_priv *mgp;
 	struct net_device *netdev;
-	size_t bytes;
 
 	mgp = pci_get_drvdata(pdev);
 	if (mgp == NULL)
@@ -2805,15 +3272,16 @@ static void myri10ge_remove(struct pci_dev *pdev)
 	flush_scheduled_work();
 	netdev = mgp->dev;
 	unregister_netdev(netdev);
-	free_irq(pdev->irq, mgp);
+	myri10ge_free_irq(mgp);
 	if (mgp->msi_enabled)
 		pci_disable_msi(pdev);
 
 	myri10ge_dummy_rdma(mgp, 0);
 
-	bytes = myri10ge_max_intr_slots * sizeof(*mgp->rx_done.entry);
-	dma_free_coherent(&pdev->dev, bytes,
-			  mgp->rx_done.entry, mgp->rx_done.bus);
+	myri10ge_free_slices(mgp);
+	if (mgp->msix_enabled)
+		pci_disable_msix(pdev);
+	kfree(mgp->msix_vectors);
 
 	iounmap(mgp->sram);
 
@@ -168,9 +168,50 @@ enum myri10ge_mcp_cmd_type {
 	 * data2       = RDMA length (MSH), WDMA length (LSH)
 	 * command return data = repetitions (MSH), 0.5-ms ticks (LSH)
 	 */
-	MXGEFW_DMA_TEST
+	MXGEFW_DMA_TEST,
+
+	MXGEFW_ENABLE_ALLMULTI,
+	MXGEFW_DISABLE_ALLMULTI,
+	MXGEFW_JOIN_MULTICAST_GROUP,
+	MXGEFW_LEAVE_MULTICAST_GROUP,
+	MXGEFW_LEAVE_ALL_MULTICAST_GROUPS,
+	MXGEFW_CMD_SET_STATS_DMA_V2,
+	MXGEFW_CMD_UNALIGNED_TEST,
+	MXGEFW_CMD_UNALIGNED_STATUS,
+	MXGEFW_CMD_ALWAYS_USE_N_BIG_BUFFERS,
+
+	/* Receive side scaling, only known to the rss firmware images.
+	 * A slice is a receive ring pair with its own interrupt queue;
+	 * the per-ring commands above (GET_SMALL_RX_OFFSET,
+	 * GET_BIG_RX_OFFSET) take the slice in data0, and
+	 * SET_INTRQ_DMA takes it in data2.
+	 *
+	 * GET_MAX_RSS_QUEUES must follow SET_INTRQ_SIZE after every
+	 * reset, and precede all the other RSS commands. */
+
+	MXGEFW_CMD_GET_MAX_RSS_QUEUES,
+	/* data0 = number of slices, data1 = MXGEFW_SLICE_INTR_MODE_* */
+	MXGEFW_CMD_ENABLE_RSS_QUEUES,
+	MXGEFW_CMD_GET_RSS_SHARED_INTERRUPT_MASK_OFFSET,
+	MXGEFW_CMD_SET_RSS_SHARED_INTERRUPT_DMA,
+	/* the indirection table is one byte (a slice) per entry */
+	MXGEFW_CMD_GET_RSS_TABLE_OFFSET,
+	MXGEFW_CMD_SET_RSS_TABLE_SIZE,
+	MXGEFW_CMD_GET_RSS_KEY_OFFSET,
+	MXGEFW_CMD_RSS_KEY_UPDATED,
+	/* data0 = 1 to enable, data1 = MXGEFW_RSS_HASH_TYPE_* */
+	MXGEFW_CMD_SET_RSS_ENABLE
 };
 
+#define MXGEFW_SLICE_INTR_MODE_SHARED		0x0
+#define MXGEFW_SLICE_INTR_MODE_ONE_PER_SLICE	0x1
+
+#define MXGEFW_RSS_HASH_TYPE_IPV4		0x1
+#define MXGEFW_RSS_HASH_TYPE_TCP_IPV4		0x2
+#define MXGEFW_RSS_HASH_TYPE_SRC_PORT		0x4
+#define MXGEFW_RSS_HASH_TYPE_SRC_DST_PORT	0x5
+#define MXGEFW_RSS_HASH_TYPE_MAX		0x5
+
 enum myri10ge_mcp_cmd_status {
 	MXGEFW_CMD_OK = 0,
 	MXGEFW_CMD_UNKNOWN,
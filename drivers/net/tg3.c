@@ -38,6 +38,7 @@
 #include <linux/workqueue.h>
 #include <linux/prefetch.h>
 #include <linux/dma-mapping.h>
+#include <linux/net_dim.h>
 
 #include <net/checksum.h>
 
@@ -602,11 +603,20 @@ static void tg3_restart_ints(struct tg3 *tp)
 		     (HOSTCC_MODE_ENABLE | HOSTCC_MODE_NOW));
 }
 
+/* Keep tg3_busy_poll() away from rx rings about to be freed. */
+static void tg3_busy_poll_off(struct tg3 *tp)
+{
+	spin_lock_bh(&tp->rx_poll_lock);
+	tp->rx_poll_off = 1;
+	spin_unlock_bh(&tp->rx_poll_lock);
+}
+
 static inline void tg3_netif_stop(struct tg3 *tp)
 {
 	tp->dev->trans_start = jiffies;	/* prevent tx timeout */
 	netif_poll_disable(tp->dev);
 	netif_tx_disable(tp->dev);
+	tg3_busy_poll_off(tp);
 }
 
 static inline void tg3_netif_start(struct tg3 *tp)
@@ -616,6 +626,7 @@ static inline void tg3_netif_start(struct tg3 *tp)
 	 * so long as all callers are assured to have free tx slots
 	 * (such as after tg3_init_hw)
 	 */
+	tp->rx_poll_off = 0;
 	netif_poll_enable(tp->dev);
 	tp->hw_status->status |= SD_STATUS_UPDATED;
 	tg3_enable_ints(tp);
@@ -3314,6 +3325,7 @@ static int tg3_rx(struct tg3 *tp, int budget)
 			netif_receive_skb(skb);
 
 		tp->dev->last_rx = jiffies;
+		tp->rx_dim_bytes += len;
 		received++;
 		budget--;
 
@@ -3399,10 +3411,18 @@ static int tg3_poll(struct net_device *netdev, int *budget)
 		if (orig_budget > netdev->quota)
 			orig_budget = netdev->quota;
 
-		work_done = tg3_rx(tp, orig_budget);
+		/* If a busy poller has the ring, tg3_has_work() keeps
+		 * us scheduled for what it leaves.
+		 */
+		work_done = 0;
+		if (spin_trylock(&tp->rx_poll_lock)) {
+			work_done = tg3_rx(tp, orig_budget);
+			spin_unlock(&tp->rx_poll_lock);
+		}
 
 		*budget -= work_done;
 		netdev->quota -= work_done;
+		tp->rx_dim_pkts += work_done;
 	}
 
 	if (tp->tg3_flags & TG3_FLAG_TAGGED_STATUS) {
@@ -3415,12 +3435,31 @@ static int tg3_poll(struct net_device *netdev, int *budget)
 	done = !tg3_has_work(tp);
 	if (done) {
 		netif_rx_complete(netdev);
+		if (tp->coal.use_adaptive_rx_coalesce)
+			net_dim(&tp->rx_dim, ++tp->rx_dim_events,
+				tp->rx_dim_pkts, tp->rx_dim_bytes);
 		tg3_restart_ints(tp);
 	}
 
 	return (done ? 0 : 1);
 }
 
+/* Rx for a busy polling socket, with BHs disabled; see net/busy_poll.h */
+static int tg3_busy_poll(struct net_device *dev, int budget)
+{
+	struct tg3 *tp = netdev_priv(dev);
+	int work_done = 0;
+
+	if (!spin_trylock(&tp->rx_poll_lock))
+		return 0;
+	if (!tp->rx_poll_off &&
+	    tp->hw_status->idx[0].rx_producer != tp->rx_rcb_ptr)
+		work_done = tg3_rx(tp, budget);
+	spin_unlock(&tp->rx_poll_lock);
+
+	return work_done;
+}
+
 static void tg3_irq_quiesce(struct tg3 *tp)
 {
 	BUG_ON(tp->irq_sync);
@@ -3791,6 +3830,14 @@ static void tg3_set_txd(struct tg3 *tp, int entry,
 	txd->vlan_tag = vlan_tag << TXD_VLAN_TAG_SHIFT;
 }
 
+/* Tell the chip about the descriptors queued so far */
+static inline void tg3_tx_kick(struct tg3 *tp)
+{
+	tw32_tx_mbox((MAILBOX_SNDHOST_PROD_IDX_0 + TG3_64BIT_REG_LOW),
+		     tp->tx_prod);
+	mmiowb();
+}
+
 /* hard_start_xmit for devices that don't have any bugs and
  * support TG3_FLG2_HW_TSO_2 only.
  */
@@ -3799,6 +3846,7 @@ static int tg3_start_xmit(struct sk_buff *skb, struct net_device *dev)
 	struct tg3 *tp = netdev_priv(dev);
 	dma_addr_t mapping;
 	u32 len, entry, base_flags, mss;
+	int xmit_more = skb->xmit_more;
 
 	len = skb_headlen(skb);
 
@@ -3815,6 +3863,7 @@ static int tg3_start_xmit(struct sk_buff *skb, struct net_device *dev)
 			printk(KERN_ERR PFX "%s: BUG! Tx Ring full when "
 			       "queue awake!\n", dev->name);
 		}
+		tg3_tx_kick(tp);
 		return NETDEV_TX_BUSY;
 	}
 
@@ -3899,9 +3948,9 @@ static int tg3_start_xmit(struct sk_buff *skb, struct net_device *dev)
 		}
 	}
 
-	/* Packets are ready, update Tx producer idx local and on card. */
-	tw32_tx_mbox((MAILBOX_SNDHOST_PROD_IDX_0 + TG3_64BIT_REG_LOW), entry);
-
+	/* Packets are ready, update Tx producer idx local, and on card
+	 * once for a batch of packets.
+	 */
 	tp->tx_prod = entry;
 	if (unlikely(tg3_tx_avail(tp) <= (MAX_SKB_FRAGS + 1))) {
 		netif_stop_queue(dev);
@@ -3910,6 +3959,8 @@ static int tg3_start_xmit(struct sk_buff *skb, struct net_device *dev)
 	}
 
 out_unlock:
+	if (!xmit_more || netif_queue_stopped(dev))
+		tg3_tx_kick(tp);
     	mmiowb();
 
 	dev->trans_start = jiffies;
@@ -3930,6 +3981,7 @@ static int tg3_tso_bug(struct tg3 *tp, struct sk_buff *skb)
 	/* Estimate the number of fragments in the worst case */
 	if (unlikely(tg3_tx_avail(tp) <= (skb_shinfo(skb)->gso_segs * 3))) {
 		netif_stop_queue(tp->dev);
+		tg3_tx_kick(tp);
 		return NETDEV_TX_BUSY;
 	}
 
@@ -3941,10 +3993,13 @@ static int tg3_tso_bug(struct tg3 *tp, struct sk_buff *skb)
 		nskb = segs;
 		segs = segs->next;
 		nskb->next = NULL;
+		nskb->xmit_more = segs || skb->xmit_more;
 		tg3_start_xmit_dma_bug(nskb, tp->dev);
 	} while (segs);
 
 tg3_tso_bug_end:
+	if (!skb->xmit_more)
+		tg3_tx_kick(tp);
 	dev_kfree_skb(skb);
 
 	return NETDEV_TX_OK;
@@ -3959,6 +4014,7 @@ static int tg3_start_xmit_dma_bug(struct sk_buff *skb, struct net_device *dev)
 	struct tg3 *tp = netdev_priv(dev);
 	dma_addr_t mapping;
 	u32 len, entry, base_flags, mss;
+	int xmit_more = skb->xmit_more;
 	int would_hit_hwbug;
 
 	len = skb_headlen(skb);
@@ -3976,6 +4032,7 @@ static int tg3_start_xmit_dma_bug(struct sk_buff *skb, struct net_device *dev)
 			printk(KERN_ERR PFX "%s: BUG! Tx Ring full when "
 			       "queue awake!\n", dev->name);
 		}
+		tg3_tx_kick(tp);
 		return NETDEV_TX_BUSY;
 	}
 
@@ -4114,9 +4171,9 @@ static int tg3_start_xmit_dma_bug(struct sk_buff *skb, struct net_device *dev)
 		entry = start;
 	}
 
-	/* Packets are ready, update Tx producer idx local and on card. */
-	tw32_tx_mbox((MAILBOX_SNDHOST_PROD_IDX_0 + TG3_64BIT_REG_LOW), entry);
-
+	/* Packets are ready, update Tx producer idx local, and on card
+	 * once for a batch of packets.
+	 */
 	tp->tx_prod = entry;
 	if (unlikely(tg3_tx_avail(tp) <= (MAX_SKB_FRAGS + 1))) {
 		netif_stop_queue(dev);
@@ -4125,6 +4182,8 @@ static int tg3_start_xmit_dma_bug(struct sk_buff *skb, struct net_device *dev)
 	}
 
 out_unlock:
+	if (!xmit_more || netif_queue_stopped(dev))
+		tg3_tx_kick(tp);
     	mmiowb();
 
 	dev->trans_start = jiffies;
@@ -5922,9 +5981,21 @@ static void tg3_set_bdinfo(struct tg3 *tp, u32 bdinfo_addr,
 static void __tg3_set_rx_mode(struct net_device *);
 static void __tg3_set_coalesce(struct tg3 *tp, struct ethtool_coalesce *ec)
 {
-	tw32(HOSTCC_RXCOL_TICKS, ec->rx_coalesce_usecs);
+	u32 rx_usecs = ec->rx_coalesce_usecs;
+	u32 rx_frames = ec->rx_max_coalesced_frames;
+
+	/* net_dim picks the rx parameters while adaptive */
+	if (ec->use_adaptive_rx_coalesce) {
+		struct net_dim_cq_moder moder;
+
+		moder = net_dim_get_moderation(&tp->rx_dim);
+		rx_usecs = min_t(u32, moder.usec, MAX_RXCOL_TICKS);
+		rx_frames = min_t(u32, moder.pkts, MAX_RXMAX_FRAMES);
+	}
+
+	tw32(HOSTCC_RXCOL_TICKS, rx_usecs);
 	tw32(HOSTCC_TXCOL_TICKS, ec->tx_coalesce_usecs);
-	tw32(HOSTCC_RXMAX_FRAMES, ec->rx_max_coalesced_frames);
+	tw32(HOSTCC_RXMAX_FRAMES, rx_frames);
 	tw32(HOSTCC_TXMAX_FRAMES, ec->tx_max_coalesced_frames);
 	if (!(tp->tg3_flags2 & TG3_FLG2_5705_PLUS)) {
 		tw32(HOSTCC_RXCOAL_TICK_INT, ec->rx_coalesce_usecs_irq);
@@ -7006,6 +7077,7 @@ static int tg3_open(struct net_device *dev)
 
 	tg3_full_unlock(tp);
 
+	tp->rx_poll_off = 0;
 	netif_start_queue(dev);
 
 	return 0;
@@ -7254,6 +7326,7 @@ static int tg3_close(struct net_device *dev)
 		msleep(1);
 
 	netif_stop_queue(dev);
+	tg3_busy_poll_off(tp);
 
 	del_timer_sync(&tp->timer);
 
@@ -8953,6 +9026,7 @@ static int tg3_set_coalesce(struct net_device *dev, struct ethtool_coalesce *ec)
 	tp->coal.rx_max_coalesced_frames_irq = ec->rx_max_coalesced_frames_irq;
 	tp->coal.tx_max_coalesced_frames_irq = ec->tx_max_coalesced_frames_irq;
 	tp->coal.stats_block_coalesce_usecs = ec->stats_block_coalesce_usecs;
+	tp->coal.use_adaptive_rx_coalesce = !!ec->use_adaptive_rx_coalesce;
 
 	if (netif_running(dev)) {
 		tg3_full_lock(tp, 0);
@@ -8962,6 +9036,42 @@ static int tg3_set_coalesce(struct net_device *dev, struct ethtool_coalesce *ec)
 	return 0;
 }
 
+static u32 tg3_get_coalesce_profile(struct net_device *dev)
+{
+	struct tg3 *tp = netdev_priv(dev);
+
+	return tp->rx_dim.profile;
+}
+
+static int tg3_set_coalesce_profile(struct net_device *dev, u32 profile)
+{
+	struct tg3 *tp = netdev_priv(dev);
+	int err;
+
+	/* Not serialized against tg3_poll(); at worst the sample in
+	 * progress is judged against the wrong level once.
+	 */
+	tg3_full_lock(tp, 0);
+	err = net_dim_set_profile(&tp->rx_dim, profile);
+	if (!err && netif_running(dev))
+		__tg3_set_coalesce(tp, &tp->coal);
+	tg3_full_unlock(tp);
+	return err;
+}
+
+/* Called from the net_dim work item with a new rx moderation level. */
+static void tg3_dim_apply(struct net_dim *dim, struct net_dim_cq_moder moder)
+{
+	struct tg3 *tp = container_of(dim, struct tg3, rx_dim);
+
+	tg3_full_lock(tp, 0);
+	if (netif_running(tp->dev) && tp->coal.use_adaptive_rx_coalesce) {
+		tw32(HOSTCC_RXCOL_TICKS, min_t(u32, moder.usec, MAX_RXCOL_TICKS));
+		tw32(HOSTCC_RXMAX_FRAMES, min_t(u32, moder.pkts, MAX_RXMAX_FRAMES));
+	}
+	tg3_full_unlock(tp);
+}
+
 static struct ethtool_ops tg3_ethtool_ops = {
 	.get_settings		= tg3_get_settings,
 	.set_settings		= tg3_set_settings,
@@ -8999,6 +9109,8 @@ static struct ethtool_ops tg3_ethtool_ops = {
 	.get_ethtool_stats	= tg3_get_ethtool_stats,
 	.get_coalesce		= tg3_get_coalesce,
 	.set_coalesce		= tg3_set_coalesce,
+	.get_coalesce_profile	= tg3_get_coalesce_profile,
+	.set_coalesce_profile	= tg3_set_coalesce_profile,
 	.get_perm_addr		= ethtool_op_get_perm_addr,
 };
 
@@ -11481,7 +11593,10 @@ static int __devinit tg3_init_one(struct pci_dev *pdev,
 #endif
 	spin_lock_init(&tp->lock);
 	spin_lock_init(&tp->indirect_lock);
+	spin_lock_init(&tp->rx_poll_lock);
+	tp->rx_poll_off = 1;
 	INIT_WORK(&tp->reset_task, tg3_reset_task, tp);
+	net_dim_init(&tp->rx_dim, ETHTOOL_COAL_PROFILE_BALANCED, tg3_dim_apply);
 
 	tp->regs = ioremap_nocache(tg3reg_base, tg3reg_len);
 	if (tp->regs == 0UL) {
@@ -11505,6 +11620,7 @@ static int __devinit tg3_init_one(struct pci_dev *pdev,
 	dev->do_ioctl = tg3_ioctl;
 	dev->tx_timeout = tg3_tx_timeout;
 	dev->poll = tg3_poll;
+	dev->busy_poll = tg3_busy_poll;
 	dev->ethtool_ops = &tg3_ethtool_ops;
 	dev->weight = 64;
 	dev->watchdog_timeo = TG3_TX_TIMEOUT;
@@ -2096,6 +2096,13 @@ struct tg3 {
 	spinlock_t			lock;
 	spinlock_t			indirect_lock;
 
+	/* rx_poll_lock: Held by tg3_poll and tg3_busy_poll around
+	 *               tg3_rx.  rx_poll_off is set under it while
+	 *               the rx rings are torn down.
+	 */
+	spinlock_t			rx_poll_lock;
+	int				rx_poll_off;
+
 	u32				(*read32) (struct tg3 *, u32);
 	void				(*write32) (struct tg3 *, u32, u32);
 	u32				(*read32_mbox) (struct tg3 *, u32);
@@ -2336,6 +2343,12 @@ struct tg3 {
 #define SST_25VF0X0_PAGE_SIZE		4098
 
 	struct ethtool_coalesce		coal;
+
+	/* adaptive rx moderation, see include/linux/net_dim.h */
+	struct net_dim			rx_dim;
+	u32				rx_dim_pkts;
+	u32				rx_dim_bytes;
+	u16				rx_dim_events;
 };
 
 #endif /* !(_T3_H) */
@@ -57,7 +57,13 @@
 #include <linux/if_arp.h>
 #include <linux/if_ether.h>
 #include <linux/if_tun.h>
+#include <linux/virtio_net.h>
 #include <linux/crc32.h>
+#include <linux/jhash.h>
+#include <linux/ipv6.h>
+#include <linux/in.h>
+
+#include <net/ip.h>
 
 #include <asm/system.h>
 #include <asm/uaccess.h>
@@ -85,19 +91,57 @@ static int tun_net_close(struct net_device *dev)
 	return 0;
 }
 
+/* Keeps the packets of a flow on one queue, in order. */
+static u32 tun_flow_hash(struct sk_buff *skb)
+{
+	u32 ports = 0;
+
+	if (skb->protocol == htons(ETH_P_IP)) {
+		struct iphdr *iph = skb->nh.iph;
+
+		if (skb->nh.raw < skb->data ||
+		    skb->nh.raw + sizeof(*iph) > skb->tail)
+			return 0;
+		if (!(iph->frag_off & htons(IP_MF|IP_OFFSET)) &&
+		    (iph->protocol == IPPROTO_TCP ||
+		     iph->protocol == IPPROTO_UDP) &&
+		    skb->nh.raw + iph->ihl * 4 + 4 <= skb->tail)
+			ports = *(u32 *)(skb->nh.raw + iph->ihl * 4);
+		return jhash_3words(iph->saddr, iph->daddr,
+				    ports ^ iph->protocol, 0);
+	}
+	if (skb->protocol == htons(ETH_P_IPV6)) {
+		struct ipv6hdr *ip6h = skb->nh.ipv6h;
+
+		if (skb->nh.raw < skb->data ||
+		    skb->nh.raw + sizeof(*ip6h) > skb->tail)
+			return 0;
+		return jhash_3words(ip6h->saddr.s6_addr32[3],
+				    ip6h->daddr.s6_addr32[3],
+				    ip6h->nexthdr, 0);
+	}
+	return 0;
+}
+
 /* Net device start xmit */
 static int tun_net_xmit(struct sk_buff *skb, struct net_device *dev)
 {
 	struct tun_struct *tun = netdev_priv(dev);
+	struct tun_file *tfile;
 
 	DBG(KERN_INFO "%s: tun_net_xmit %d\n", tun->dev->name, skb->len);
 
 	/* Drop packet if interface is not attached */
-	if (!tun->attached)
+	if (!tun->numqueues)
 		goto drop;
 
+	if (tun->numqueues == 1)
+		tfile = tun->tfiles[0];
+	else
+		tfile = tun->tfiles[tun_flow_hash(skb) % tun->numqueues];
+
 	/* Packet dropping */
-	if (skb_queue_len(&tun->readq) >= dev->tx_queue_len) {
+	if (skb_queue_len(&tfile->readq) >= dev->tx_queue_len) {
 		if (!(tun->flags & TUN_ONE_QUEUE)) {
 			/* Normal queueing mode. */
 			/* Packet scheduler handles dropping of further packets. */
@@ -114,13 +158,13 @@ static int tun_net_xmit(struct sk_buff *skb, struct net_device *dev)
 	}
 
 	/* Queue packet */
-	skb_queue_tail(&tun->readq, skb);
+	skb_queue_tail(&tfile->readq, skb);
 	dev->trans_start = jiffies;
 
 	/* Notify and wake up reader process */
-	if (tun->flags & TUN_FASYNC)
-		kill_fasync(&tun->fasync, SIGIO, POLL_IN);
-	wake_up_interruptible(&tun->read_wait);
+	if (tfile->flags & TUN_FASYNC)
+		kill_fasync(&tfile->fasync, SIGIO, POLL_IN);
+	wake_up_interruptible(&tfile->read_wait);
 	return 0;
 
 drop:
@@ -167,10 +211,26 @@ tun_net_mclist(struct net_device *dev)
 	}
 }
 
+/* Add up the counters of the queues attached */
 static struct net_device_stats *tun_net_stats(struct net_device *dev)
 {
 	struct tun_struct *tun = netdev_priv(dev);
-	return &tun->stats;
+	struct net_device_stats *total = &tun->total;
+	unsigned int i;
+
+	netif_tx_lock_bh(dev);
+	*total = tun->stats;
+	for (i = 0; i < tun->numqueues; i++) {
+		struct tun_file *tfile = tun->tfiles[i];
+
+		total->rx_packets += tfile->rx_packets;
+		total->rx_bytes += tfile->rx_bytes;
+		total->rx_dropped += tfile->rx_dropped;
+		total->tx_packets += tfile->tx_packets;
+		total->tx_bytes += tfile->tx_bytes;
+	}
+	netif_tx_unlock_bh(dev);
+	return total;
 }
 
 /* Initialize net device. */
@@ -207,7 +267,8 @@ static void tun_net_init(struct net_device *dev)
 /* Poll */
 static unsigned int tun_chr_poll(struct file *file, poll_table * wait)
 {  
-	struct tun_struct *tun = file->private_data;
+	struct tun_file *tfile = file->private_data;
+	struct tun_struct *tun = tfile->tun;
 	unsigned int mask = POLLOUT | POLLWRNORM;
 
 	if (!tun)
@@ -215,18 +276,126 @@ static unsigned int tun_chr_poll(struct file *file, poll_table * wait)
 
 	DBG(KERN_INFO "%s: tun_chr_poll\n", tun->dev->name);
 
-	poll_wait(file, &tun->read_wait, wait);
+	poll_wait(file, &tfile->read_wait, wait);
  
-	if (!skb_queue_empty(&tun->readq))
+	if (!skb_queue_empty(&tfile->readq))
 		mask |= POLLIN | POLLRDNORM;
 
 	return mask;
 }
 
+/*
+ * Frames up to this long are copied into the skb's head, longer ones only
+ * up to it and the rest into pages, so that 64k GSO frames need no high
+ * order allocation.
+ */
+#define TUN_GOOD_LINEAR(align)	SKB_MAX_HEAD(align)
+
+static struct sk_buff *tun_alloc_skb(size_t align, size_t len)
+{
+	struct sk_buff *skb;
+	size_t linear = len;
+	int i;
+
+	if (len > TUN_GOOD_LINEAR(align) &&
+	    len - TUN_GOOD_LINEAR(align) <= MAX_SKB_FRAGS * PAGE_SIZE)
+		linear = TUN_GOOD_LINEAR(align);
+
+	skb = alloc_skb(linear + align, GFP_KERNEL);
+	if (!skb)
+		return NULL;
+	if (align)
+		skb_reserve(skb, align);
+	skb_put(skb, linear);
+	len -= linear;
+
+	for (i = 0; len; i++) {
+		size_t size = min_t(size_t, len, PAGE_SIZE);
+		struct page *page = alloc_page(GFP_KERNEL);
+
+		if (!page) {
+			kfree_skb(skb);
+			return NULL;
+		}
+		skb_fill_page_desc(skb, i, page, 0, size);
+		skb->len += size;
+		skb->data_len += size;
+		skb->truesize += PAGE_SIZE;
+		len -= size;
+	}
+	return skb;
+}
+
+static int tun_copy_from_user(struct sk_buff *skb, struct iovec *iv)
+{
+	int i;
+
+	if (memcpy_fromiovec(skb->data, iv, skb_headlen(skb)))
+		return -EFAULT;
+	for (i = 0; i < skb_shinfo(skb)->nr_frags; i++) {
+		skb_frag_t *frag = &skb_shinfo(skb)->frags[i];
+
+		if (memcpy_fromiovec(page_address(frag->page) +
+				     frag->page_offset, iv, frag->size))
+			return -EFAULT;
+	}
+	return 0;
+}
+
+/*
+ * The guest leaves its checksums to us: fold the sum from csum_start in,
+ * the field holds the pseudo header's already.  Computed here, not
+ * deferred, as the frame may be delivered locally as well as forwarded.
+ */
+static int tun_csum_complete(struct sk_buff *skb, int start, int offset)
+{
+	u16 check;
+
+	check = csum_fold(skb_checksum(skb, start, skb->len - start, 0));
+	if (skb_store_bits(skb, start + offset, &check, sizeof(check)))
+		return -EINVAL;
+	skb->ip_summed = CHECKSUM_UNNECESSARY;
+	return 0;
+}
+
+static int tun_set_gso(struct sk_buff *skb, const struct virtio_net_hdr *gso)
+{
+	struct skb_shared_info *sinfo = skb_shinfo(skb);
+
+	switch (gso->gso_type & ~VIRTIO_NET_HDR_GSO_ECN) {
+	case VIRTIO_NET_HDR_GSO_TCPV4:
+		sinfo->gso_type = SKB_GSO_TCPV4;
+		break;
+	case VIRTIO_NET_HDR_GSO_TCPV6:
+		sinfo->gso_type = SKB_GSO_TCPV6;
+		break;
+	case VIRTIO_NET_HDR_GSO_UDP:
+		sinfo->gso_type = SKB_GSO_UDP;
+		break;
+	default:
+		return -EINVAL;
+	}
+
+	if (gso->gso_type & VIRTIO_NET_HDR_GSO_ECN)
+		sinfo->gso_type |= SKB_GSO_TCP_ECN;
+
+	if (!gso->gso_size)
+		return -EINVAL;
+	sinfo->gso_size = gso->gso_size;
+
+	/* Header must be checked, and gso_segs computed. */
+	sinfo->gso_type |= SKB_GSO_DODGY;
+	sinfo->gso_segs = 0;
+	return 0;
+}
+
 /* Get packet from user space buffer */
-static __inline__ ssize_t tun_get_user(struct tun_struct *tun, struct iovec *iv, size_t count)
+static __inline__ ssize_t tun_get_user(struct tun_struct *tun,
+				       struct tun_file *tfile,
+				       struct iovec *iv, size_t count)
 {
 	struct tun_pi pi = { 0, __constant_htons(ETH_P_IP) };
+	struct virtio_net_hdr gso = { 0 };
 	struct sk_buff *skb;
 	size_t len = count, align = 0;
 
@@ -238,22 +407,44 @@ static __inline__ ssize_t tun_get_user(struct tun_struct *tun, struct iovec *iv,
 			return -EFAULT;
 	}
 
+	if (tun->flags & TUN_VNET_HDR) {
+		if ((len -= sizeof(gso)) > count)
+			return -EINVAL;
+
+		if (memcpy_fromiovec((void *)&gso, iv, sizeof(gso)))
+			return -EFAULT;
+
+		if (gso.hdr_len > len)
+			return -EINVAL;
+		if ((gso.flags & VIRTIO_NET_HDR_F_NEEDS_CSUM) &&
+		    gso.csum_start + gso.csum_offset + 2 > len)
+			return -EINVAL;
+	}
+
 	if ((tun->flags & TUN_TYPE_MASK) == TUN_TAP_DEV)
 		align = NET_IP_ALIGN;
  
-	if (!(skb = alloc_skb(len + align, GFP_KERNEL))) {
-		tun->stats.rx_dropped++;
+	if (!(skb = tun_alloc_skb(align, len))) {
+		tfile->rx_dropped++;
 		return -ENOMEM;
 	}
 
-	if (align)
-		skb_reserve(skb, align);
-	if (memcpy_fromiovec(skb_put(skb, len), iv, len)) {
-		tun->stats.rx_dropped++;
+	if (tun_copy_from_user(skb, iv)) {
+		tfile->rx_dropped++;
 		kfree_skb(skb);
 		return -EFAULT;
 	}
 
+	if (gso.flags & VIRTIO_NET_HDR_F_NEEDS_CSUM) {
+		if (tun_csum_complete(skb, gso.csum_start, gso.csum_offset))
+			goto drop;
+	} else if (tun->flags & TUN_NOCHECKSUM)
+		skb->ip_summed = CHECKSUM_UNNECESSARY;
+
+	if (gso.gso_type != VIRTIO_NET_HDR_GSO_NONE &&
+	    tun_set_gso(skb, &gso))
+		goto drop;
+
 	skb->dev = tun->dev;
 	switch (tun->flags & TUN_TYPE_MASK) {
 	case TUN_TUN_DEV:
@@ -265,16 +456,18 @@ static __inline__ ssize_t tun_get_user(struct tun_struct *tun, struct iovec *iv,
 		break;
 	};
 
-	if (tun->flags & TUN_NOCHECKSUM)
-		skb->ip_summed = CHECKSUM_UNNECESSARY;
- 
 	netif_rx_ni(skb);
 	tun->dev->last_rx = jiffies;
    
-	tun->stats.rx_packets++;
-	tun->stats.rx_bytes += len;
+	tfile->rx_packets++;
+	tfile->rx_bytes += len;
 
 	return count;
+
+drop:
+	tfile->rx_dropped++;
+	kfree_skb(skb);
+	return -EINVAL;
 } 
 
 static inline size_t iov_total(const struct iovec *iv, unsigned long count)
@@ -292,14 +485,16 @@ static inline size_t iov_total(const struct iovec *iv, unsigned long count)
 static ssize_t tun_chr_writev(struct file * file, const struct iovec *iv, 
 			      unsigned long count, loff_t *pos)
 {
-	struct tun_struct *tun = file->private_data;
+	struct tun_file *tfile = file->private_data;
+	struct tun_struct *tun = tfile->tun;
 
 	if (!tun)
 		return -EBADFD;
 
 	DBG(KERN_INFO "%s: tun_chr_write %ld\n", tun->dev->name, count);
 
-	return tun_get_user(tun, (struct iovec *) iv, iov_total(iv, count));
+	return tun_get_user(tun, tfile, (struct iovec *) iv,
+			    iov_total(iv, count));
 }
 
 /* Write */
@@ -312,6 +507,7 @@ static ssize_t tun_chr_write(struct file * file, const char __user * buf,
 
 /* Put packet to the user space buffer */
 static __inline__ ssize_t tun_put_user(struct tun_struct *tun,
+				       struct tun_file *tfile,
 				       struct sk_buff *skb,
 				       struct iovec *iv, int len)
 {
@@ -332,13 +528,49 @@ static __inline__ ssize_t tun_put_user(struct tun_struct *tun,
 		total += sizeof(pi);
 	}       
 
+	if (tun->flags & TUN_VNET_HDR) {
+		struct virtio_net_hdr gso = { 0 }; /* no info leak */
+
+		if ((len -= sizeof(gso)) < 0)
+			return -EINVAL;
+
+		if (skb_is_gso(skb)) {
+			struct skb_shared_info *sinfo = skb_shinfo(skb);
+
+			/* This is a hint as to how much should be linear. */
+			gso.hdr_len = skb_headlen(skb);
+			gso.gso_size = sinfo->gso_size;
+			if (sinfo->gso_type & SKB_GSO_TCPV4)
+				gso.gso_type = VIRTIO_NET_HDR_GSO_TCPV4;
+			else if (sinfo->gso_type & SKB_GSO_TCPV6)
+				gso.gso_type = VIRTIO_NET_HDR_GSO_TCPV6;
+			else if (sinfo->gso_type & SKB_GSO_UDP)
+				gso.gso_type = VIRTIO_NET_HDR_GSO_UDP;
+			else
+				return -EINVAL;
+			if (sinfo->gso_type & SKB_GSO_TCP_ECN)
+				gso.gso_type |= VIRTIO_NET_HDR_GSO_ECN;
+		}
+
+		/* On the way out CHECKSUM_HW means the sum is left to us */
+		if (skb->ip_summed == CHECKSUM_HW) {
+			gso.flags = VIRTIO_NET_HDR_F_NEEDS_CSUM;
+			gso.csum_start = skb->h.raw - skb->data;
+			gso.csum_offset = skb->csum;
+		}
+
+		if (memcpy_toiovec(iv, (void *) &gso, sizeof(gso)))
+			return -EFAULT;
+		total += sizeof(gso);
+	}
+
 	len = min_t(int, skb->len, len);
 
 	skb_copy_datagram_iovec(skb, 0, iv, len);
 	total += len;
 
-	tun->stats.tx_packets++;
-	tun->stats.tx_bytes += len;
+	tfile->tx_packets++;
+	tfile->tx_bytes += len;
 
 	return total;
 }
@@ -347,7 +579,8 @@ static __inline__ ssize_t tun_put_user(struct tun_struct *tun,
 static ssize_t tun_chr_readv(struct file *file, const struct iovec *iv,
 			    unsigned long count, loff_t *pos)
 {
-	struct tun_struct *tun = file->private_data;
+	struct tun_file *tfile = file->private_data;
+	struct tun_struct *tun = tfile->tun;
 	DECLARE_WAITQUEUE(wait, current);
 	struct sk_buff *skb;
 	ssize_t len, ret = 0;
@@ -361,7 +594,7 @@ static ssize_t tun_chr_readv(struct file *file, const struct iovec *iv,
 	if (len < 0)
 		return -EINVAL;
 
-	add_wait_queue(&tun->read_wait, &wait);
+	add_wait_queue(&tfile->read_wait, &wait);
 	while (len) {
 		const u8 ones[ ETH_ALEN] = { 0xff, 0xff, 0xff, 0xff, 0xff, 0xff };
 		u8 addr[ ETH_ALEN];
@@ -370,7 +603,7 @@ static ssize_t tun_chr_readv(struct file *file, const struct iovec *iv,
 		current->state = TASK_INTERRUPTIBLE;
 
 		/* Read frames from the queue */
-		if (!(skb=skb_dequeue(&tun->readq))) {
+		if (!(skb=skb_dequeue(&tfile->readq))) {
 			if (file->f_flags & O_NONBLOCK) {
 				ret = -EAGAIN;
 				break;
@@ -408,7 +641,8 @@ static ssize_t tun_chr_readv(struct file *file, const struct iovec *iv,
 			DBG(KERN_DEBUG "%s: tun_chr_readv: accepted: %x:%x:%x:%x:%x:%x\n",
 					tun->dev->name, addr[0], addr[1], addr[2],
 					addr[3], addr[4], addr[5]);
-			ret = tun_put_user(tun, skb, (struct iovec *) iv, len);
+			ret = tun_put_user(tun, tfile, skb, (struct iovec *) iv,
+					   len);
 			kfree_skb(skb);
 			break;
 		} else {
@@ -421,7 +655,7 @@ static ssize_t tun_chr_readv(struct file *file, const struct iovec *iv,
 	}
 
 	current->state = TASK_RUNNING;
-	remove_wait_queue(&tun->read_wait, &wait);
+	remove_wait_queue(&tfile->read_wait, &wait);
 
 	return ret;
 }
@@ -438,9 +672,6 @@ static void tun_setup(struct net_device *dev)
 {
 	struct tun_struct *tun = netdev_priv(dev);
 
-	skb_queue_head_init(&tun->readq);
-	init_waitqueue_head(&tun->read_wait);
-
 	tun->owner = -1;
 
 	SET_MODULE_OWNER(dev);
@@ -465,6 +696,91 @@ static struct tun_struct *tun_get_by_name(const char *name)
 	return NULL;
 }
 
+/* Offloads the reader takes, with TUN_F_*; needs the vnet header. */
+static int tun_set_offload(struct tun_struct *tun, unsigned long arg)
+{
+	struct net_device *dev = tun->dev;
+	unsigned int old_features, features;
+
+	ASSERT_RTNL();
+	if (arg && !(tun->flags & TUN_VNET_HDR))
+		return -EINVAL;
+
+	old_features = dev->features;
+	features = old_features & ~(NETIF_F_HW_CSUM | NETIF_F_SG |
+				    NETIF_F_TSO | NETIF_F_TSO6 |
+				    NETIF_F_TSO_ECN | NETIF_F_UFO);
+
+	/* Segmentation offloads are no use without the checksum one */
+	if (arg & TUN_F_CSUM) {
+		features |= NETIF_F_HW_CSUM | NETIF_F_SG;
+		arg &= ~TUN_F_CSUM;
+
+		if (arg & (TUN_F_TSO4|TUN_F_TSO6)) {
+			if (arg & TUN_F_TSO_ECN) {
+				features |= NETIF_F_TSO_ECN;
+				arg &= ~TUN_F_TSO_ECN;
+			}
+			if (arg & TUN_F_TSO4)
+				features |= NETIF_F_TSO;
+			if (arg & TUN_F_TSO6)
+				features |= NETIF_F_TSO6;
+			arg &= ~(TUN_F_TSO4|TUN_F_TSO6);
+		}
+
+		if (arg & TUN_F_UFO) {
+			features |= NETIF_F_UFO;
+			arg &= ~TUN_F_UFO;
+		}
+	}
+
+	/* Lets user space probe for features added later by trying them */
+	if (arg)
+		return -EINVAL;
+
+	dev->features = features;
+	if (old_features != features)
+		netdev_features_change(dev);
+	return 0;
+}
+
+static void tun_attach(struct tun_struct *tun, struct tun_file *tfile)
+{
+	netif_tx_lock_bh(tun->dev);
+	tfile->tun = tun;
+	tfile->queue_index = tun->numqueues;
+	tun->tfiles[tun->numqueues++] = tfile;
+	netif_tx_unlock_bh(tun->dev);
+}
+
+static void tun_detach(struct tun_file *tfile)
+{
+	struct tun_struct *tun = tfile->tun;
+	unsigned int index = tfile->queue_index;
+
+	/* the last queue takes the slot, the flows get spread anew */
+	netif_tx_lock_bh(tun->dev);
+	tun->numqueues--;
+	tun->tfiles[index] = tun->tfiles[tun->numqueues];
+	tun->tfiles[index]->queue_index = index;
+	tun->tfiles[tun->numqueues] = NULL;
+
+	tun->stats.rx_packets += tfile->rx_packets;
+	tun->stats.rx_bytes += tfile->rx_bytes;
+	tun->stats.rx_dropped += tfile->rx_dropped;
+	tun->stats.tx_packets += tfile->tx_packets;
+	tun->stats.tx_bytes += tfile->tx_bytes;
+	tfile->tun = NULL;
+	netif_tx_unlock_bh(tun->dev);
+
+	/* Drop read queue */
+	skb_queue_purge(&tfile->readq);
+
+	/* The device may have stopped for this queue being full */
+	if (netif_running(tun->dev))
+		netif_wake_queue(tun->dev);
+}
+
 static int tun_set_iff(struct file *file, struct ifreq *ifr)
 {
 	struct tun_struct *tun;
@@ -473,7 +789,12 @@ static int tun_set_iff(struct file *file, struct ifreq *ifr)
 
 	tun = tun_get_by_name(ifr->ifr_name);
 	if (tun) {
-		if (tun->attached)
+		/* Further queues only for multi queue devices */
+		if (tun->numqueues &&
+		    (!(tun->flags & TUN_MULTI_QUEUE) ||
+		     !(ifr->ifr_flags & IFF_MULTI_QUEUE)))
+			return -EBUSY;
+		if (tun->numqueues == TUN_MAX_QUEUES)
 			return -EBUSY;
 
 		/* Check permissions */
@@ -503,6 +824,9 @@ static int tun_set_iff(struct file *file, struct ifreq *ifr)
 			name = "tap%d";
 		} else 
 			goto failed;
+
+		if (ifr->ifr_flags & IFF_MULTI_QUEUE)
+			flags |= TUN_MULTI_QUEUE;
    
 		if (*ifr->ifr_name)
 			name = ifr->ifr_name;
@@ -539,14 +863,27 @@ static int tun_set_iff(struct file *file, struct ifreq *ifr)
 
 	DBG(KERN_INFO "%s: tun_set_iff\n", tun->dev->name);
 
+	if (tun->numqueues) {
+		/* All queues read and write frames the same way */
+		if (!(ifr->ifr_flags & IFF_NO_PI) != !(tun->flags & TUN_NO_PI) ||
+		    !(ifr->ifr_flags & IFF_VNET_HDR) !=
+		    !(tun->flags & TUN_VNET_HDR))
+			return -EINVAL;
+	} else if (ifr->ifr_flags & IFF_VNET_HDR)
+		tun->flags |= TUN_VNET_HDR;
+	else if (tun->flags & TUN_VNET_HDR) {
+		/* Without the header there is nowhere to put the offloads */
+		tun->flags &= ~TUN_VNET_HDR;
+		tun_set_offload(tun, 0);
+	}
+
 	if (ifr->ifr_flags & IFF_NO_PI)
 		tun->flags |= TUN_NO_PI;
 
 	if (ifr->ifr_flags & IFF_ONE_QUEUE)
 		tun->flags |= TUN_ONE_QUEUE;
 
-	file->private_data = tun;
-	tun->attached = 1;
+	tun_attach(tun, file->private_data);
 
 	strcpy(ifr->ifr_name, tun->dev->name);
 	return 0;
@@ -560,7 +897,8 @@ static int tun_set_iff(struct file *file, struct ifreq *ifr)
 static int tun_chr_ioctl(struct inode *inode, struct file *file, 
 			 unsigned int cmd, unsigned long arg)
 {
-	struct tun_struct *tun = file->private_data;
+	struct tun_file *tfile = file->private_data;
+	struct tun_struct *tun = tfile->tun;
 	void __user* argp = (void __user*)arg;
 	struct ifreq ifr;
 
@@ -585,6 +923,14 @@ static int tun_chr_ioctl(struct inode *inode, struct file *file,
 		return 0;
 	}
 
+	if (cmd == TUNGETFEATURES) {
+		/* The TUNSETIFF flags understood: unknown ones were never
+		 * refused there, so user space asks here first. */
+		return put_user(IFF_TUN | IFF_TAP | IFF_NO_PI | IFF_ONE_QUEUE |
+				IFF_VNET_HDR | IFF_MULTI_QUEUE,
+				(unsigned int __user*)argp);
+	}
+
 	if (!tun)
 		return -EBADFD;
 
@@ -632,6 +978,15 @@ static int tun_chr_ioctl(struct inode *inode, struct file *file,
 		}
 		break;
 
+	case TUNSETOFFLOAD: {
+		int ret;
+
+		rtnl_lock();
+		ret = tun_set_offload(tun, arg);
+		rtnl_unlock();
+		return ret;
+	}
+
 #ifdef TUN_DEBUG
 	case TUNSETDEBUG:
 		tun->debug = arg;
@@ -702,7 +1057,8 @@ static int tun_chr_ioctl(struct inode *inode, struct file *file,
 
 static int tun_chr_fasync(int fd, struct file *file, int on)
 {
-	struct tun_struct *tun = file->private_data;
+	struct tun_file *tfile = file->private_data;
+	struct tun_struct *tun = tfile->tun;
 	int ret;
 
 	if (!tun)
@@ -710,54 +1066,61 @@ static int tun_chr_fasync(int fd, struct file *file, int on)
 
 	DBG(KERN_INFO "%s: tun_chr_fasync %d\n", tun->dev->name, on);
 
-	if ((ret = fasync_helper(fd, file, on, &tun->fasync)) < 0)
+	if ((ret = fasync_helper(fd, file, on, &tfile->fasync)) < 0)
 		return ret; 
  
 	if (on) {
 		ret = f_setown(file, current->pid, 0);
 		if (ret)
 			return ret;
-		tun->flags |= TUN_FASYNC;
+		tfile->flags |= TUN_FASYNC;
 	} else 
-		tun->flags &= ~TUN_FASYNC;
+		tfile->flags &= ~TUN_FASYNC;
 
 	return 0;
 }
 
 static int tun_chr_open(struct inode *inode, struct file * file)
 {
+	struct tun_file *tfile;
+
 	DBG1(KERN_INFO "tunX: tun_chr_open\n");
-	file->private_data = NULL;
+
+	tfile = kzalloc(sizeof(*tfile), GFP_KERNEL);
+	if (!tfile)
+		return -ENOMEM;
+	init_waitqueue_head(&tfile->read_wait);
+	skb_queue_head_init(&tfile->readq);
+
+	file->private_data = tfile;
 	return 0;
 }
 
 static int tun_chr_close(struct inode *inode, struct file *file)
 {
-	struct tun_struct *tun = file->private_data;
+	struct tun_file *tfile = file->private_data;
+	struct tun_struct *tun = tfile->tun;
 
-	if (!tun)
-		return 0;
-
-	DBG(KERN_INFO "%s: tun_chr_close\n", tun->dev->name);
+	if (tun) {
+		DBG(KERN_INFO "%s: tun_chr_close\n", tun->dev->name);
 
-	tun_chr_fasync(-1, file, 0);
+		tun_chr_fasync(-1, file, 0);
 
-	rtnl_lock();
+		rtnl_lock();
 
-	/* Detach from net device */
-	file->private_data = NULL;
-	tun->attached = 0;
+		/* Detach from net device */
+		tun_detach(tfile);
 
-	/* Drop read queue */
-	skb_queue_purge(&tun->readq);
+		if (!tun->numqueues && !(tun->flags & TUN_PERSIST)) {
+			list_del(&tun->list);
+			unregister_netdevice(tun->dev);
+		}
 
-	if (!(tun->flags & TUN_PERSIST)) {
-		list_del(&tun->list);
-		unregister_netdevice(tun->dev);
+		rtnl_unlock();
 	}
 
-	rtnl_unlock();
-
+	file->private_data = NULL;
+	kfree(tfile);
 	return 0;
 }
 
@@ -837,7 +1200,7 @@ static void tun_set_msglevel(struct net_device *dev, u32 value)
 static u32 tun_get_link(struct net_device *dev)
 {
 	struct tun_struct *tun = netdev_priv(dev);
-	return tun->attached;
+	return tun->numqueues != 0;
 }
 
 static u32 tun_get_rx_csum(struct net_device *dev)
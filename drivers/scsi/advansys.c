@@ -8177,7 +8177,7 @@ asc_prt_driver_conf(struct Scsi_Host *shp, char *cp, int cplen)
 
     len = asc_prt_line(cp, leftlen,
 " host_busy %u, last_reset %u, max_id %u, max_lun %u, max_channel %u\n",
-        shp->host_busy, shp->last_reset, shp->max_id, shp->max_lun,
+        atomic_read(&shp->host_busy), shp->last_reset, shp->max_id, shp->max_lun,
         shp->max_channel);
     ASC_PRT_NEXT();
 
@@ -9143,7 +9143,7 @@ asc_prt_scsi_host(struct Scsi_Host *s)
     printk("Scsi_Host at addr 0x%lx\n", (ulong) s);
     printk(
 " host_busy %u, host_no %d, last_reset %d,\n",
-        s->host_busy, s->host_no,
+        atomic_read(&s->host_busy), s->host_no,
         (unsigned) s->last_reset);
 
     printk(
@@ -407,7 +407,7 @@ iscsi_r2t_rsp(struct iscsi_conn *conn, struct iscsi_cmd_task *ctask)
 	__kfifo_put(tcp_ctask->r2tqueue, (void*)&r2t, sizeof(void*));
 	list_move_tail(&ctask->running, &conn->xmitqueue);
 
-	scsi_queue_work(session->host, &conn->xmitwork);
+	iscsi_conn_queue_work(conn);
 	conn->r2t_pdus_cnt++;
 	spin_unlock(&session->lock);
 
@@ -1029,7 +1029,7 @@ iscsi_write_space(struct sock *sk)
 
 	tcp_conn->old_write_space(sk);
 	debug_tcp("iscsi_write_space: cid %d\n", conn->id);
-	scsi_queue_work(conn->session->host, &conn->xmitwork);
+	iscsi_conn_queue_work(conn);
 }
 
 static void
@@ -2331,7 +2331,7 @@ static struct iscsi_transport iscsi_tcp_transport = {
 	.owner			= THIS_MODULE,
 	.name			= "tcp",
 	.caps			= CAP_RECOVERY_L0 | CAP_MULTI_R2T | CAP_HDRDGST
-				  | CAP_DATADGST,
+				  | CAP_DATADGST | CAP_MULTI_CONN,
 	.param_mask		= ISCSI_MAX_RECV_DLENGTH |
 				  ISCSI_MAX_XMIT_DLENGTH |
 				  ISCSI_HDRDGST_EN |
@@ -2353,7 +2353,7 @@ static struct iscsi_transport iscsi_tcp_transport = {
 				  ISCSI_TPGT,
 	.host_template		= &iscsi_sht,
 	.conndata_size		= sizeof(struct iscsi_conn),
-	.max_conn		= 1,
+	.max_conn		= ISCSI_TCP_MAX_CONN,
 	.max_cmd_len		= ISCSI_TCP_MAX_CMD_LEN,
 	/* session management */
 	.create_session		= iscsi_tcp_session_create,
@@ -49,6 +49,7 @@
 #include <linux/workqueue.h>
 #include <linux/jiffies.h>
 #include <linux/scatterlist.h>
+#include <linux/async.h>
 #include <scsi/scsi.h>
 #include "scsi_priv.h"
 #include <scsi/scsi_cmnd.h>
@@ -4295,21 +4296,44 @@ fsm_start:
 static struct ata_queued_cmd *ata_qc_new(struct ata_port *ap)
 {
 	struct ata_queued_cmd *qc = NULL;
-	unsigned int i;
+	/* the last tag is reserved for internal command. */
+	unsigned int max = ATA_MAX_QUEUE - 1;
+	unsigned int start, tag;
+	int wrapped = 0;
 
 	/* no command while frozen */
 	if (unlikely(ap->pflags & ATA_PFLAG_FROZEN))
 		return NULL;
 
-	/* the last tag is reserved for internal command. */
-	for (i = 0; i < ATA_MAX_QUEUE - 1; i++)
-		if (!test_and_set_bit(i, &ap->qc_allocated)) {
-			qc = __ata_qc_from_tag(ap, i);
+	/*
+	 * Go round the tags from the one after the last handed out,
+	 * looking for free ones with plain reads and only trying to
+	 * take those, instead of a locked test_and_set_bit() on every
+	 * busy tag from 0 up.
+	 */
+	start = ap->last_tag + 1;
+	if (start >= max)
+		start = 0;
+
+	for (tag = start;; tag++) {
+		tag = find_next_zero_bit(&ap->qc_allocated, max, tag);
+		if (tag >= max) {
+			if (wrapped || !start)
+				break;
+			wrapped = 1;
+			tag = find_next_zero_bit(&ap->qc_allocated, max, 0);
+			if (tag >= max)
+				break;
+		}
+		if (wrapped && tag >= start)
+			break;
+		if (!test_and_set_bit(tag, &ap->qc_allocated)) {
+			qc = __ata_qc_from_tag(ap, tag);
+			qc->tag = tag;
+			ap->last_tag = tag;
 			break;
 		}
-
-	if (qc)
-		qc->tag = i;
+	}
 
 	return qc;
 }
@@ -4364,6 +4388,20 @@ void ata_qc_free(struct ata_queued_cmd *qc)
 	}
 }
 
+static void ata_qc_account_latency(struct ata_port *ap,
+				   struct ata_queued_cmd *qc)
+{
+	u64 t = ktime_to_ns(ktime_sub(ktime_get(), qc->issue_time));
+	unsigned int bucket = 0;
+
+	t >>= ATA_LAT_HIST_SHIFT;
+	while (t && bucket < ATA_LAT_HIST_BUCKETS - 1) {
+		t >>= 1;
+		bucket++;
+	}
+	ap->stats.lat_hist[bucket]++;
+}
+
 void __ata_qc_complete(struct ata_queued_cmd *qc)
 {
 	struct ata_port *ap = qc->ap;
@@ -4380,6 +4418,8 @@ void __ata_qc_complete(struct ata_queued_cmd *qc)
 	else
 		ap->active_tag = ATA_TAG_POISON;
 
+	ata_qc_account_latency(ap, qc);
+
 	/* atapi: mark qc as inactive to prevent the interrupt handler
 	 * from completing the command twice later, before the error handler
 	 * is called. (when rc != 0 and atapi request sense is needed)
@@ -4554,6 +4594,9 @@ void ata_qc_issue(struct ata_queued_cmd *qc)
 		ap->active_tag = qc->tag;
 	}
 
+	ap->stats.qdepth_hist[fls(hweight32(ap->qc_active))]++;
+	qc->issue_time = ktime_get();
+
 	qc->flags |= ATA_QCFLAG_ACTIVE;
 	ap->qc_active |= 1 << qc->tag;
 
@@ -5355,6 +5398,32 @@ err_out:
 	return NULL;
 }
 
+/*
+ *	Second half of the probing started by ata_device_add(), run
+ *	asynchronously: wait for the boot probing EH of each port, then
+ *	scan the ports for SCSI devices.  The scan waits for host sets
+ *	added earlier, so disks keep the names they would get if the
+ *	controllers were probed one after the other.
+ */
+static void ata_host_set_async_probe(void *data, async_cookie_t cookie)
+{
+	struct ata_host_set *host_set = data;
+	unsigned int i;
+
+	for (i = 0; i < host_set->n_ports; i++) {
+		struct ata_port *ap = host_set->ports[i];
+
+		if (ap->ops->error_handler)
+			ata_port_wait_eh(ap);
+	}
+
+	async_synchronize_cookie(cookie);
+
+	DPRINTK("host probe begin\n");
+	for (i = 0; i < host_set->n_ports; i++)
+		ata_scsi_scan_host(host_set->ports[i]);
+}
+
 /**
  *	ata_device_add - Register hardware device with ATA and SCSI layers
  *	@ent: Probe information describing hardware device to be registered
@@ -5365,7 +5434,10 @@ err_out:
  *	everything with requisite kernel subsystems.
  *
  *	This function requests irqs, probes the ATA bus, and probes
- *	the SCSI bus.
+ *	the SCSI bus.  The EH probing of all ports is started at once,
+ *	and waiting for it and the SCSI scan are left to run
+ *	asynchronously, so that slow ports and controllers do not hold
+ *	up the probing of the next ones.
  *
  *	LOCKING:
  *	PCI/etc. bus probe sem.
@@ -5438,7 +5510,7 @@ int ata_device_add(const struct ata_probe_ent *ent)
 		goto err_out;
 	}
 
-	/* perform each probe synchronously */
+	/* kick off EH probing of every port, old EH ports probe here */
 	DPRINTK("probe begin\n");
 	for (i = 0; i < count; i++) {
 		struct ata_port *ap;
@@ -5462,7 +5534,8 @@ int ata_device_add(const struct ata_probe_ent *ent)
 			 * scsi_scan_host and ata_host_remove, below,
 			 * at the very least
 			 */
-		}
+		} else
+			ata_scsi_add_host_attrs(ap);
 
 		if (ap->ops->error_handler) {
 			struct ata_eh_info *ehi = &ap->eh_info;
@@ -5481,9 +5554,6 @@ int ata_device_add(const struct ata_probe_ent *ent)
 			ata_port_schedule_eh(ap);
 
 			spin_unlock_irqrestore(ap->lock, flags);
-
-			/* wait for EH to finish */
-			ata_port_wait_eh(ap);
 		} else {
 			DPRINTK("ata%u: bus probe begin\n", ap->id);
 			rc = ata_bus_probe(ap);
@@ -5500,16 +5570,11 @@ int ata_device_add(const struct ata_probe_ent *ent)
 		}
 	}
 
-	/* probes are done, now scan each port's disk(s) */
-	DPRINTK("host probe begin\n");
-	for (i = 0; i < count; i++) {
-		struct ata_port *ap = host_set->ports[i];
-
-		ata_scsi_scan_host(ap);
-	}
-
 	dev_set_drvdata(dev, host_set);
 
+	/* wait for EH and scan each port's disk(s) in the background */
+	async_schedule(ata_host_set_async_probe, host_set);
+
 	VPRINTK("EXIT, returning %u\n", ent->n_ports);
 	return ent->n_ports; /* success */
 
@@ -5543,6 +5608,9 @@ void ata_port_detach(struct ata_port *ap)
 	unsigned long flags;
 	int i;
 
+	/* the boot probing of the port may still be going on */
+	async_synchronize_full();
+
 	if (!ap->ops->error_handler)
 		goto skip_eh;
 
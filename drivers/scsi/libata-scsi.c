@@ -790,6 +790,9 @@ static void ata_scsi_dev_config(struct scsi_device *sdev,
 
 	blk_queue_max_sectors(sdev->request_queue, max_sectors);
 
+	if (dev->class == ATA_DEV_ATA && ata_id_is_ssd(dev->id))
+		set_bit(QUEUE_FLAG_NONROT, &sdev->request_queue->queue_flags);
+
 	/*
 	 * SATA DMA transfers must be multiples of 4 byte, so
 	 * we need to pad ATAPI transfers using an extra sg.
@@ -2809,6 +2812,8 @@ static inline int __ata_scsi_queuecmd(struct scsi_cmnd *cmd,
  *
  *	LOCKING:
  *	Releases scsi-layer-held lock, and obtains host_set lock.
+ *	For a lockless host template, called without the scsi-layer
+ *	lock and with interrupts enabled.
  *
  *	RETURNS:
  *	Return value from __ata_scsi_queuecmd() if @cmd can be queued,
@@ -2820,12 +2825,19 @@ int ata_scsi_queuecmd(struct scsi_cmnd *cmd, void (*done)(struct scsi_cmnd *))
 	struct ata_device *dev;
 	struct scsi_device *scsidev = cmd->device;
 	struct Scsi_Host *shost = scsidev->host;
+	int lockless = shost->hostt->lockless;
+	unsigned long flags;
 	int rc = 0;
 
 	ap = ata_shost_to_port(shost);
 
-	spin_unlock(shost->host_lock);
-	spin_lock(ap->lock);
+	/* ap->lock is all we need, see the lockless host template bit */
+	if (lockless)
+		spin_lock_irqsave(ap->lock, flags);
+	else {
+		spin_unlock(shost->host_lock);
+		spin_lock(ap->lock);
+	}
 
 	ata_scsi_dump_cdb(ap, cmd);
 
@@ -2837,11 +2849,72 @@ int ata_scsi_queuecmd(struct scsi_cmnd *cmd, void (*done)(struct scsi_cmnd *))
 		done(cmd);
 	}
 
-	spin_unlock(ap->lock);
-	spin_lock(shost->host_lock);
+	if (lockless)
+		spin_unlock_irqrestore(ap->lock, flags);
+	else {
+		spin_unlock(ap->lock);
+		spin_lock(shost->host_lock);
+	}
 	return rc;
 }
 
+static ssize_t ata_scsi_show_hist(struct ata_port *ap,
+				  const unsigned long *src, int nr, char *buf)
+{
+	unsigned long hist[ATA_LAT_HIST_BUCKETS];
+	unsigned long flags;
+	ssize_t len = 0;
+	int i;
+
+	spin_lock_irqsave(ap->lock, flags);
+	memcpy(hist, src, nr * sizeof(hist[0]));
+	spin_unlock_irqrestore(ap->lock, flags);
+
+	for (i = 0; i < nr; i++)
+		len += sprintf(buf + len, "%lu%c", hist[i],
+			       i == nr - 1 ? '\n' : ' ');
+	return len;
+}
+
+static ssize_t ata_scsi_show_qdepth_hist(struct class_device *cdev, char *buf)
+{
+	struct ata_port *ap = ata_shost_to_port(class_to_shost(cdev));
+
+	return ata_scsi_show_hist(ap, ap->stats.qdepth_hist,
+				  ATA_QDEPTH_HIST_BUCKETS, buf);
+}
+static CLASS_DEVICE_ATTR(qdepth_hist, S_IRUGO, ata_scsi_show_qdepth_hist, NULL);
+
+static ssize_t ata_scsi_show_latency_hist(struct class_device *cdev, char *buf)
+{
+	struct ata_port *ap = ata_shost_to_port(class_to_shost(cdev));
+
+	return ata_scsi_show_hist(ap, ap->stats.lat_hist,
+				  ATA_LAT_HIST_BUCKETS, buf);
+}
+static CLASS_DEVICE_ATTR(latency_hist, S_IRUGO, ata_scsi_show_latency_hist,
+			 NULL);
+
+/**
+ *	ata_scsi_add_host_attrs - export the port's histograms
+ *	@ap: ATA port, its SCSI host added
+ *
+ *	Adds qdepth_hist and latency_hist, see struct ata_host_stats, to
+ *	the attributes of the port's scsi_host.  Failing to is not fatal.
+ *
+ *	LOCKING:
+ *	Kernel thread context (may sleep).
+ */
+void ata_scsi_add_host_attrs(struct ata_port *ap)
+{
+	struct class_device *cdev = &ap->host->shost_classdev;
+
+	if (class_device_create_file(cdev, &class_device_attr_qdepth_hist) ||
+	    class_device_create_file(cdev, &class_device_attr_latency_hist))
+		ata_port_printk(ap, KERN_WARNING,
+				"failed to create histogram attributes\n");
+}
+
 /**
  *	ata_scsi_simulate - simulate SCSI command on ATA device
  *	@dev: the target device
@@ -25,6 +25,7 @@
 #include <linux/mutex.h>
 #include <linux/kfifo.h>
 #include <linux/delay.h>
+#include <linux/workqueue.h>
 #include <net/tcp.h>
 #include <scsi/scsi_cmnd.h>
 #include <scsi/scsi_device.h>
@@ -638,6 +639,61 @@ again:
 	return rc;
 }
 
+/*
+ * Connections transmit from work items on this workqueue, each on the
+ * CPU it was given when set up, so that the connections of a session
+ * send in parallel rather than one after the other from the single
+ * thread of the host's workqueue.
+ */
+static struct workqueue_struct *iscsi_xmit_wq;
+
+void iscsi_conn_queue_work(struct iscsi_conn *conn)
+{
+	queue_work_on(conn->xmit_cpu, iscsi_xmit_wq, &conn->xmitwork);
+}
+EXPORT_SYMBOL_GPL(iscsi_conn_queue_work);
+
+/* spreads new connections over the online CPUs */
+static int iscsi_next_xmit_cpu(void)
+{
+	static atomic_t next = ATOMIC_INIT(0);
+	int n = (unsigned int)atomic_inc_return(&next) % num_online_cpus();
+	int cpu;
+
+	for_each_online_cpu(cpu)
+		if (!n--)
+			return cpu;
+	return raw_smp_processor_id();
+}
+
+/*
+ * Commands are dealt round robin to the started connections of the
+ * session; all the PDUs of a command then go over its connection.
+ *
+ * Called with session->lock held.
+ */
+static struct iscsi_conn *iscsi_pick_conn(struct iscsi_session *session)
+{
+	struct iscsi_conn *conn = session->next_conn;
+	struct list_head *start, *pos;
+
+	start = conn ? &conn->item : &session->connections;
+	for (pos = start->next; pos != start; pos = pos->next) {
+		if (pos == &session->connections)
+			continue;
+		conn = list_entry(pos, struct iscsi_conn, item);
+		if (conn->c_stage == ISCSI_CONN_STARTED && !conn->suspend_tx) {
+			session->next_conn = conn;
+			return conn;
+		}
+	}
+
+	conn = session->next_conn;
+	if (conn && conn->c_stage == ISCSI_CONN_STARTED && !conn->suspend_tx)
+		return conn;
+	return session->leadconn;
+}
+
 static void iscsi_xmitworker(void *data)
 {
 	struct iscsi_conn *conn = data;
@@ -713,7 +769,7 @@ int iscsi_queuecommand(struct scsi_cmnd *sc, void (*done)(struct scsi_cmnd *))
 		goto reject;
 	}
 
-	conn = session->leadconn;
+	conn = iscsi_pick_conn(session);
 
 	__kfifo_get(session->cmdpool.queue, (void*)&ctask, sizeof(void*));
 	sc->SCp.phase = session->age;
@@ -737,7 +793,7 @@ int iscsi_queuecommand(struct scsi_cmnd *sc, void (*done)(struct scsi_cmnd *))
 		session->cmdsn, session->max_cmdsn - session->exp_cmdsn + 1);
 	spin_unlock(&session->lock);
 
-	scsi_queue_work(host, &conn->xmitwork);
+	iscsi_conn_queue_work(conn);
 	return 0;
 
 reject:
@@ -838,7 +894,7 @@ iscsi_conn_send_generic(struct iscsi_conn *conn, struct iscsi_hdr *hdr,
 	else
 	        __kfifo_put(conn->mgmtqueue, (void*)&mtask, sizeof(void*));
 
-	scsi_queue_work(session->host, &conn->xmitwork);
+	iscsi_conn_queue_work(conn);
 	return 0;
 }
 
@@ -1406,6 +1462,7 @@ iscsi_conn_setup(struct iscsi_cls_session *cls_session, uint32_t conn_idx)
 		goto mgmtqueue_alloc_fail;
 
 	INIT_WORK(&conn->xmitwork, iscsi_xmitworker, conn);
+	conn->xmit_cpu = iscsi_next_xmit_cpu();
 
 	/* allocate login_mtask used for the login/text sequences */
 	spin_lock_bh(&session->lock);
@@ -1476,14 +1533,14 @@ void iscsi_conn_teardown(struct iscsi_cls_conn *cls_conn)
 	 */
 	for (;;) {
 		spin_lock_irqsave(session->host->host_lock, flags);
-		if (!session->host->host_busy) { /* OK for ERL == 0 */
+		if (!atomic_read(&session->host->host_busy)) { /* OK for ERL == 0 */
 			spin_unlock_irqrestore(session->host->host_lock, flags);
 			break;
 		}
 		spin_unlock_irqrestore(session->host->host_lock, flags);
 		msleep_interruptible(500);
 		printk(KERN_INFO "iscsi: scsi conn_destroy(): host_busy %d "
-		       "host_failed %d\n", session->host->host_busy,
+		       "host_failed %d\n", atomic_read(&session->host->host_busy),
 		       session->host->host_failed);
 		/*
 		 * force eh_abort() to unblock
@@ -1497,6 +1554,8 @@ void iscsi_conn_teardown(struct iscsi_cls_conn *cls_conn)
 	__kfifo_put(session->mgmtpool.queue, (void*)&conn->login_mtask,
 		    sizeof(void*));
 	list_del(&conn->item);
+	if (session->next_conn == conn)
+		session->next_conn = NULL;
 	if (list_empty(&session->connections))
 		session->leadconn = NULL;
 	if (session->leadconn && session->leadconn == conn)
@@ -1508,6 +1567,9 @@ void iscsi_conn_teardown(struct iscsi_cls_conn *cls_conn)
 		session->cmdsn = session->max_cmdsn = session->exp_cmdsn = 1;
 	spin_unlock_bh(&session->lock);
 
+	/* the xmit work of the connection may still be queued */
+	flush_workqueue(iscsi_xmit_wq);
+
 	kfifo_free(conn->immqueue);
 	kfifo_free(conn->mgmtqueue);
 
@@ -1900,6 +1962,23 @@ int iscsi_conn_get_param(struct iscsi_cls_conn *cls_conn,
 }
 EXPORT_SYMBOL_GPL(iscsi_conn_get_param);
 
+static int __init iscsi_init(void)
+{
+	iscsi_xmit_wq = alloc_workqueue("iscsi_xmit", WQ_RESCUER,
+					WQ_DFL_ACTIVE);
+	if (!iscsi_xmit_wq)
+		return -ENOMEM;
+	return 0;
+}
+
+static void __exit iscsi_exit(void)
+{
+	destroy_workqueue(iscsi_xmit_wq);
+}
+
+module_init(iscsi_init);
+module_exit(iscsi_exit);
+
 MODULE_AUTHOR("Mike Christie");
 MODULE_DESCRIPTION("iSCSI library functions");
 MODULE_LICENSE("GPL");
@@ -116,7 +116,8 @@ static struct scsi_host_template qla2x00_driver_template = {
 	.this_id		= -1,
 	.cmd_per_lun		= 3,
 	.use_clustering		= ENABLE_CLUSTERING,
-	.sg_tablesize		= SG_ALL,
+	.use_sg_chaining	= 1,
+	.sg_tablesize		= SCSI_MAX_SG_CHAIN_SEGMENTS,
 
 	/*
 	 * The RISC allows for each command to transfer (2^32-1) bytes of data,
@@ -145,7 +146,8 @@ static struct scsi_host_template qla24xx_driver_template = {
 	.this_id		= -1,
 	.cmd_per_lun		= 3,
 	.use_clustering		= ENABLE_CLUSTERING,
-	.sg_tablesize		= SG_ALL,
+	.use_sg_chaining	= 1,
+	.sg_tablesize		= SCSI_MAX_SG_CHAIN_SEGMENTS,
 
 	.max_sectors		= 0xFFFF,
 	.shost_attrs		= qla2x00_host_attrs,
@@ -418,7 +418,7 @@ void scsi_log_completion(struct scsi_cmnd *cmd, int disposition)
 			}
 			if (level > 3) {
 				printk(KERN_INFO "scsi host busy %d failed %d\n",
-				       sdev->host->host_busy,
+				       atomic_read(&sdev->host->host_busy),
 				       sdev->host->host_failed);
 			}
 		}
@@ -549,13 +549,19 @@ int scsi_dispatch_cmd(struct scsi_cmnd *cmd)
 	spin_lock_irqsave(host->host_lock, flags);
 	scsi_cmd_get_serial(host, cmd); 
 
+	/* only the serial number needs the lock then */
+	if (host->hostt->lockless)
+		spin_unlock_irqrestore(host->host_lock, flags);
+
 	if (unlikely(host->shost_state == SHOST_DEL)) {
 		cmd->result = (DID_NO_CONNECT << 16);
 		scsi_done(cmd);
 	} else {
 		rtn = host->hostt->queuecommand(cmd, scsi_done);
 	}
-	spin_unlock_irqrestore(host->host_lock, flags);
+
+	if (!host->hostt->lockless)
+		spin_unlock_irqrestore(host->host_lock, flags);
 	if (rtn) {
 		if (scsi_delete_timer(cmd)) {
 			atomic_inc(&cmd->device->iodone_cnt);
@@ -12,6 +12,7 @@
 #include <linux/completion.h>
 #include <linux/kernel.h>
 #include <linux/mempool.h>
+#include <linux/scatterlist.h>
 #include <linux/slab.h>
 #include <linux/init.h>
 #include <linux/pci.h>
@@ -448,20 +449,32 @@ static void scsi_init_cmd_errh(struct scsi_cmnd *cmd)
 		cmd->cmd_len = COMMAND_SIZE(cmd->cmnd[0]);
 }
 
-void scsi_device_unbusy(struct scsi_device *sdev)
+/*
+ * Drop a command from host_busy; the error handler waits for host_busy
+ * to fall to host_failed, so wake it if the host went into recovery.
+ */
+static void scsi_dec_host_busy(struct Scsi_Host *shost)
 {
-	struct Scsi_Host *shost = sdev->host;
 	unsigned long flags;
 
-	spin_lock_irqsave(shost->host_lock, flags);
-	shost->host_busy--;
+	atomic_dec(&shost->host_busy);
+	/*
+	 * Pairs with the host_lock taken by scsi_eh_scmd_add(): either it
+	 * sees our decrement, or we see the host in recovery and wake it.
+	 */
+	smp_mb__after_atomic_dec();
 	if (unlikely(scsi_host_in_recovery(shost) &&
-		     (shost->host_failed || shost->host_eh_scheduled)))
+		     (shost->host_failed || shost->host_eh_scheduled))) {
+		spin_lock_irqsave(shost->host_lock, flags);
 		scsi_eh_wakeup(shost);
-	spin_unlock(shost->host_lock);
-	spin_lock(sdev->request_queue->queue_lock);
-	sdev->device_busy--;
-	spin_unlock_irqrestore(sdev->request_queue->queue_lock, flags);
+		spin_unlock_irqrestore(shost->host_lock, flags);
+	}
+}
+
+void scsi_device_unbusy(struct scsi_device *sdev)
+{
+	scsi_dec_host_busy(sdev->host);
+	atomic_dec(&sdev->device_busy);
 }
 
 /*
@@ -535,7 +548,7 @@ static void scsi_run_queue(struct request_queue *q)
 	while (!list_empty(&shost->starved_list) &&
 	       !shost->host_blocked && !shost->host_self_blocked &&
 		!((shost->can_queue > 0) &&
-		  (shost->host_busy >= shost->can_queue))) {
+		  (atomic_read(&shost->host_busy) >= shost->can_queue))) {
 		/*
 		 * As long as shost is accepting commands and we have
 		 * starved queues, call blk_run_queue. scsi_request_fn
@@ -693,57 +706,123 @@ static struct scsi_cmnd *scsi_end_request(struct scsi_cmnd *cmd, int uptodate,
 	return NULL;
 }
 
-static struct scatterlist *scsi_alloc_sgtable(struct scsi_cmnd *cmd, gfp_t gfp_mask)
+static inline unsigned int scsi_sgtable_index(unsigned short nents)
 {
-	struct scsi_host_sg_pool *sgp;
-	struct scatterlist *sgl;
-
-	BUG_ON(!cmd->use_sg);
+	unsigned int index = 0;
 
-	switch (cmd->use_sg) {
+	switch (nents) {
 	case 1 ... 8:
-		cmd->sglist_len = 0;
+		index = 0;
 		break;
 	case 9 ... 16:
-		cmd->sglist_len = 1;
+		index = 1;
 		break;
 	case 17 ... 32:
-		cmd->sglist_len = 2;
+		index = 2;
 		break;
 #if (SCSI_MAX_PHYS_SEGMENTS > 32)
 	case 33 ... 64:
-		cmd->sglist_len = 3;
+		index = 3;
 		break;
 #if (SCSI_MAX_PHYS_SEGMENTS > 64)
 	case 65 ... 128:
-		cmd->sglist_len = 4;
+		index = 4;
 		break;
 #if (SCSI_MAX_PHYS_SEGMENTS  > 128)
 	case 129 ... 256:
-		cmd->sglist_len = 5;
+		index = 5;
 		break;
 #endif
 #endif
 #endif
 	default:
-		return NULL;
+		printk(KERN_ERR "scsi: bad segment count=%d\n", nents);
+		BUG();
 	}
 
-	sgp = scsi_sg_pools + cmd->sglist_len;
-	sgl = mempool_alloc(sgp->pool, gfp_mask);
-	return sgl;
+	return index;
 }
 
-static void scsi_free_sgtable(struct scatterlist *sgl, int index)
+/*
+ * Free a list of nents entries.  A list longer than the largest table
+ * is a chain of tables of SCSI_MAX_SG_SEGMENTS entries, the last of
+ * which links to the next table, and a last table as large as needed.
+ */
+static void __scsi_free_sgtable(struct scatterlist *sgl, unsigned int nents)
 {
 	struct scsi_host_sg_pool *sgp;
+	struct scatterlist *next;
+
+	while (nents > SCSI_MAX_SG_SEGMENTS) {
+		sgp = scsi_sg_pools + SG_MEMPOOL_NR - 1;
+		next = sg_chain_ptr(&sgl[SCSI_MAX_SG_SEGMENTS - 1]);
+		mempool_free(sgl, sgp->pool);
+		sgl = next;
+		nents -= SCSI_MAX_SG_SEGMENTS - 1;
+	}
 
-	BUG_ON(index >= SG_MEMPOOL_NR);
-
-	sgp = scsi_sg_pools + index;
+	sgp = scsi_sg_pools + scsi_sgtable_index(nents);
 	mempool_free(sgl, sgp->pool);
 }
 
+static struct scatterlist *scsi_alloc_sgtable(struct scsi_cmnd *cmd, gfp_t gfp_mask)
+{
+	struct scsi_host_sg_pool *sgp;
+	struct scatterlist *sgl, *prev, *ret;
+	unsigned int index, this, left;
+
+	BUG_ON(!cmd->use_sg);
+
+	left = cmd->use_sg;
+	ret = prev = NULL;
+	do {
+		this = left;
+		if (this > SCSI_MAX_SG_SEGMENTS) {
+			/* the last entry links to the next table */
+			this = SCSI_MAX_SG_SEGMENTS - 1;
+			index = SG_MEMPOOL_NR - 1;
+		} else
+			index = scsi_sgtable_index(this);
+
+		sgp = scsi_sg_pools + index;
+		sgl = mempool_alloc(sgp->pool, gfp_mask);
+		if (unlikely(!sgl))
+			goto enomem;
+
+		/*
+		 * A table last used at the head of a chain still holds the
+		 * link in its last entry, which blk_rq_map_sg() would follow.
+		 */
+		sgl[sgp->size - 1].page = NULL;
+
+		if (!ret) {
+			ret = sgl;
+			cmd->sglist_len = index;
+		} else
+			sg_chain(prev, SCSI_MAX_SG_SEGMENTS, sgl);
+
+		prev = sgl;
+		left -= this;
+	} while (left);
+
+	/*
+	 * use_sg is cut down to the entries actually mapped, keep the
+	 * number allocated for the free.
+	 */
+	cmd->__use_sg = cmd->use_sg;
+	return ret;
+
+ enomem:
+	if (ret)
+		__scsi_free_sgtable(ret, cmd->use_sg - left);
+	return NULL;
+}
+
+static void scsi_free_sgtable(struct scsi_cmnd *cmd)
+{
+	__scsi_free_sgtable(cmd->request_buffer, cmd->__use_sg);
+}
+
 /*
  * Function:    scsi_release_buffers()
  *
@@ -764,7 +843,7 @@ static void scsi_free_sgtable(struct scatterlist *sgl, int index)
 static void scsi_release_buffers(struct scsi_cmnd *cmd)
 {
 	if (cmd->use_sg)
-		scsi_free_sgtable(cmd->request_buffer, cmd->sglist_len);
+		scsi_free_sgtable(cmd);
 
 	/*
 	 * Zero these out.  They now point to freed memory, and it is
@@ -1232,7 +1311,7 @@ static int scsi_prep_fn(struct request_queue *q, struct request *req)
 	/* If we defer, the elv_next_request() returns NULL, but the
 	 * queue must be restarted, so we plug here if no returning
 	 * command will automatically do that. */
-	if (sdev->device_busy == 0)
+	if (atomic_read(&sdev->device_busy) == 0)
 		blk_plug_device(q);
 	return BLKPREP_DEFER;
  kill:
@@ -1249,9 +1328,11 @@ static int scsi_prep_fn(struct request_queue *q, struct request *req)
 static inline int scsi_dev_queue_ready(struct request_queue *q,
 				  struct scsi_device *sdev)
 {
-	if (sdev->device_busy >= sdev->queue_depth)
+	unsigned int busy = atomic_read(&sdev->device_busy);
+
+	if (busy >= sdev->queue_depth)
 		return 0;
-	if (sdev->device_busy == 0 && sdev->device_blocked) {
+	if (busy == 0 && sdev->device_blocked) {
 		/*
 		 * unblock after device_blocked iterates to zero
 		 */
@@ -1275,15 +1356,34 @@ static inline int scsi_dev_queue_ready(struct request_queue *q,
  * return 0. We must end up running the queue again whenever 0 is
  * returned, else IO can hang.
  *
- * Called with host_lock held.
+ * On success the command has been counted in host_busy.  The host_lock
+ * is only taken when the host is blocked or full, or sdev has to come
+ * off or go on the starved list.  Called with interrupts disabled.
  */
 static inline int scsi_host_queue_ready(struct request_queue *q,
 				   struct Scsi_Host *shost,
 				   struct scsi_device *sdev)
 {
+	unsigned int busy;
+
 	if (scsi_host_in_recovery(shost))
 		return 0;
-	if (shost->host_busy == 0 && shost->host_blocked) {
+
+	busy = atomic_inc_return(&shost->host_busy) - 1;
+	if (likely(!shost->host_blocked && !shost->host_self_blocked &&
+		   (shost->can_queue <= 0 || busy < shost->can_queue))) {
+		/* We're OK to process the command, so we can't be starved */
+		if (unlikely(!list_empty(&sdev->starved_entry))) {
+			spin_lock(shost->host_lock);
+			if (!list_empty(&sdev->starved_entry))
+				list_del_init(&sdev->starved_entry);
+			spin_unlock(shost->host_lock);
+		}
+		return 1;
+	}
+
+	spin_lock(shost->host_lock);
+	if (busy == 0 && shost->host_blocked) {
 		/*
 		 * unblock after host_blocked iterates to zero
 		 */
@@ -1292,22 +1392,27 @@ static inline int scsi_host_queue_ready(struct request_queue *q,
 				printk("scsi%d unblocking host at zero depth\n",
 					shost->host_no));
 		} else {
+			spin_unlock(shost->host_lock);
 			blk_plug_device(q);
-			return 0;
+			goto out_dec;
 		}
 	}
-	if ((shost->can_queue > 0 && shost->host_busy >= shost->can_queue) ||
+	if ((shost->can_queue > 0 && busy >= shost->can_queue) ||
 	    shost->host_blocked || shost->host_self_blocked) {
 		if (list_empty(&sdev->starved_entry))
 			list_add_tail(&sdev->starved_entry, &shost->starved_list);
-		return 0;
+		spin_unlock(shost->host_lock);
+		goto out_dec;
 	}
 
-	/* We're OK to process the command, so we can't be starved */
 	if (!list_empty(&sdev->starved_entry))
 		list_del_init(&sdev->starved_entry);
-
+	spin_unlock(shost->host_lock);
 	return 1;
+
+ out_dec:
+	scsi_dec_host_busy(shost);
+	return 0;
 }
 
 /*
@@ -1333,15 +1438,10 @@ static void scsi_kill_request(struct request *req, request_queue_t *q)
 
 	/*
 	 * SCSI request completion path will do scsi_device_unbusy(),
-	 * bump busy counts.  To bump the counters, we need to dance
-	 * with the locks as normal issue path does.
+	 * bump busy counts.
 	 */
-	sdev->device_busy++;
-	spin_unlock(sdev->request_queue->queue_lock);
-	spin_lock(shost->host_lock);
-	shost->host_busy++;
-	spin_unlock(shost->host_lock);
-	spin_lock(sdev->request_queue->queue_lock);
+	atomic_inc(&sdev->device_busy);
+	atomic_inc(&shost->host_busy);
 
 	__scsi_done(cmd);
 }
@@ -1439,7 +1539,7 @@ static void scsi_request_fn(struct request_queue *q)
 		 */
 		if (!(blk_queue_tagged(q) && !blk_queue_start_tag(q, req)))
 			blkdev_dequeue_request(req);
-		sdev->device_busy++;
+		atomic_inc(&sdev->device_busy);
 
 		spin_unlock(q->queue_lock);
 		cmd = req->special;
@@ -1450,23 +1550,20 @@ static void scsi_request_fn(struct request_queue *q)
 					 __FUNCTION__);
 			BUG();
 		}
-		spin_lock(shost->host_lock);
-
 		if (!scsi_host_queue_ready(q, shost, sdev))
 			goto not_ready;
 		if (sdev->single_lun) {
+			spin_lock(shost->host_lock);
 			if (scsi_target(sdev)->starget_sdev_user &&
-			    scsi_target(sdev)->starget_sdev_user != sdev)
+			    scsi_target(sdev)->starget_sdev_user != sdev) {
+				spin_unlock(shost->host_lock);
+				scsi_dec_host_busy(shost);
 				goto not_ready;
+			}
 			scsi_target(sdev)->starget_sdev_user = sdev;
+			spin_unlock(shost->host_lock);
 		}
-		shost->host_busy++;
-
-		/*
-		 * XXX(hch): This is rather suboptimal, scsi_dispatch_cmd will
-		 *		take the lock again.
-		 */
-		spin_unlock_irq(shost->host_lock);
+		local_irq_enable();
 
 		/*
 		 * Finally, initialize any error handling parameters, and set up
@@ -1483,7 +1580,7 @@ static void scsi_request_fn(struct request_queue *q)
 			/* we're refusing the command; because of
 			 * the way locks get dropped, we need to 
 			 * check here if plugging is required */
-			if(sdev->device_busy == 0)
+			if (atomic_read(&sdev->device_busy) == 0)
 				blk_plug_device(q);
 
 			break;
@@ -1493,20 +1590,17 @@ static void scsi_request_fn(struct request_queue *q)
 	goto out;
 
  not_ready:
-	spin_unlock_irq(shost->host_lock);
-
 	/*
 	 * lock q, handle tag, requeue req, and decrement device_busy. We
-	 * must return with queue_lock held.
+	 * must return with queue_lock held; interrupts are still off.
 	 *
 	 * Decrementing device_busy without checking it is OK, as all such
 	 * cases (host limits or settings) should run the queue at some
 	 * later time.
 	 */
-	spin_lock_irq(q->queue_lock);
+	spin_lock(q->queue_lock);
 	blk_requeue_request(q, req);
-	sdev->device_busy--;
-	if(sdev->device_busy == 0)
+	if (atomic_dec_and_test(&sdev->device_busy))
 		blk_plug_device(q);
  out:
 	/* must be careful here...if we trigger the ->remove() function
@@ -1550,7 +1644,11 @@ struct request_queue *scsi_alloc_queue(struct scsi_device *sdev)
 	blk_queue_prep_rq(q, scsi_prep_fn);
 
 	blk_queue_max_hw_segments(q, shost->sg_tablesize);
-	blk_queue_max_phys_segments(q, SCSI_MAX_PHYS_SEGMENTS);
+	if (shost->hostt->use_sg_chaining) {
+		blk_queue_max_phys_segments(q, SCSI_MAX_SG_CHAIN_SEGMENTS);
+		set_bit(QUEUE_FLAG_SG_CHAIN, &q->queue_flags);
+	} else
+		blk_queue_max_phys_segments(q, SCSI_MAX_PHYS_SEGMENTS);
 	blk_queue_max_sectors(q, shost->max_sectors);
 	blk_queue_bounce_limit(q, scsi_calculate_bounce_limit(shost));
 	blk_queue_segment_boundary(q, shost->dma_boundary);
@@ -2007,7 +2105,7 @@ scsi_device_quiesce(struct scsi_device *sdev)
 		return err;
 
 	scsi_run_queue(sdev->request_queue);
-	while (sdev->device_busy) {
+	while (atomic_read(&sdev->device_busy)) {
 		msleep_interruptible(200);
 		scsi_run_queue(sdev->request_queue);
 	}
@@ -39,6 +39,7 @@
 #include <linux/mm.h>
 #include <linux/bio.h>
 #include <linux/string.h>
+#include <linux/scatterlist.h>
 #include <linux/errno.h>
 #include <linux/cdrom.h>
 #include <linux/interrupt.h>
@@ -350,10 +351,10 @@ static int sr_init_command(struct scsi_cmnd * SCpnt)
 	}
 
 	{
-		struct scatterlist *sg = SCpnt->request_buffer;
+		struct scatterlist *sg;
 		int i, size = 0;
-		for (i = 0; i < SCpnt->use_sg; i++)
-			size += sg[i].length;
+		for_each_sg(SCpnt->request_buffer, sg, SCpnt->use_sg, i)
+			size += sg->length;
 
 		if (size != SCpnt->request_bufflen && SCpnt->use_sg) {
 			scmd_printk(KERN_ERR, SCpnt,
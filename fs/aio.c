@@ -29,6 +29,7 @@
 #include <linux/highmem.h>
 #include <linux/workqueue.h>
 #include <linux/security.h>
+#include <linux/eventfd.h>
 
 #include <asm/kmap_types.h>
 #include <asm/uaccess.h>
@@ -46,6 +47,14 @@ unsigned long aio_nr;		/* current system wide number of aio requests */
 unsigned long aio_max_nr = 0x10000; /* system wide maximum number of aio requests */
 /*----end sysctl variables---*/
 
+/*
+ * A task waiting in io_getevents() after it submitted this many iocbs from
+ * the submission ring polls the ring every tick for more, until it finds
+ * it empty for AIO_SQ_POLL_IDLE ticks in a row.
+ */
+#define AIO_SQ_POLL_BATCH	16
+#define AIO_SQ_POLL_IDLE	(HZ / 100 + 1)
+
 static kmem_cache_t	*kiocb_cachep;
 static kmem_cache_t	*kioctx_cachep;
 
@@ -60,6 +69,8 @@ static LIST_HEAD(fput_head);
 
 static void aio_kick_handler(void *);
 static void aio_queue_work(struct kioctx *);
+static long aio_submit_sq(struct kioctx *);
+static void aio_sq_poll(struct kioctx *, int);
 
 /* aio_setup
  *	Creates the slab caches used by the aio routines, panic on
@@ -102,10 +113,12 @@ static void aio_free_ring(struct kioctx *ctx)
 static int aio_setup_ring(struct kioctx *ctx)
 {
 	struct aio_ring *ring;
+	struct aio_sq_ring *sq;
 	struct aio_ring_info *info = &ctx->ring_info;
 	unsigned nr_events = ctx->max_reqs;
+	unsigned nr_sq;
 	unsigned long size;
-	int nr_pages;
+	int nr_pages, nr_sq_pages;
 
 	/* Compensate for the ring buffer's head/tail overlap entry */
 	nr_events += 2;	/* 1 is required, 2 for good luck */
@@ -119,6 +132,16 @@ static int aio_setup_ring(struct kioctx *ctx)
 
 	nr_events = (PAGE_SIZE * nr_pages - sizeof(struct aio_ring)) / sizeof(struct io_event);
 
+	/* The submission ring takes the pages after the events */
+	size = sizeof(struct aio_sq_ring);
+	size += sizeof(__u64) * (ctx->max_reqs + 1);
+	nr_sq_pages = (size + PAGE_SIZE-1) >> PAGE_SHIFT;
+
+	nr_sq = (PAGE_SIZE * nr_sq_pages - sizeof(struct aio_sq_ring)) / sizeof(__u64);
+
+	info->sq_page = nr_pages;
+	nr_pages += nr_sq_pages;
+
 	info->nr = 0;
 	info->ring_pages = info->internal_pages;
 	if (nr_pages > AIO_RING_PAGES) {
@@ -166,6 +189,14 @@ static int aio_setup_ring(struct kioctx *ctx)
 	ring->header_length = sizeof(struct aio_ring);
 	kunmap_atomic(ring, KM_USER0);
 
+	info->sq_nr = nr_sq;
+
+	sq = kmap_atomic(info->ring_pages[info->sq_page], KM_USER0);
+	sq->nr = nr_sq;
+	sq->head = sq->tail = 0;
+	sq->flags = AIO_SQ_NEED_WAKEUP;
+	kunmap_atomic(sq, KM_USER0);
+
 	return 0;
 }
 
@@ -192,6 +223,25 @@ static int aio_setup_ring(struct kioctx *ctx)
 	kunmap_atomic((void *)((unsigned long)__event & PAGE_MASK), km); \
 } while(0)
 
+/* aio_sq_entry: returns the iocb address stored at the given index of the
+ * submission ring.
+ */
+#define AIO_SQ_PER_PAGE		(PAGE_SIZE / sizeof(__u64))
+#define AIO_SQ_OFFSET		(sizeof(struct aio_sq_ring) / sizeof(__u64))
+
+static inline __u64 aio_sq_entry(struct aio_ring_info *info, unsigned nr)
+{
+	unsigned pos = nr + AIO_SQ_OFFSET;
+	__u64 *entries;
+	__u64 val;
+
+	entries = kmap_atomic(info->ring_pages[info->sq_page +
+					       pos / AIO_SQ_PER_PAGE], KM_USER1);
+	val = entries[pos % AIO_SQ_PER_PAGE];
+	kunmap_atomic(entries, KM_USER1);
+	return val;
+}
+
 /* ioctx_alloc
  *	Allocates and initializes an ioctx.  Returns an ERR_PTR if it failed.
  */
@@ -223,6 +273,7 @@ static struct kioctx *ioctx_alloc(unsigned nr_events)
 	spin_lock_init(&ctx->ctx_lock);
 	spin_lock_init(&ctx->ring_info.ring_lock);
 	init_waitqueue_head(&ctx->wait);
+	mutex_init(&ctx->sq_mutex);
 
 	INIT_LIST_HEAD(&ctx->active_reqs);
 	INIT_LIST_HEAD(&ctx->run_list);
@@ -413,6 +464,7 @@ static struct kiocb fastcall *__aio_get_req(struct kioctx *ctx)
 	req->ki_cancel = NULL;
 	req->ki_retry = NULL;
 	req->ki_dtor = NULL;
+	req->ki_eventfd = NULL;
 	req->private = NULL;
 	INIT_LIST_HEAD(&req->ki_run_list);
 
@@ -476,8 +528,11 @@ static void aio_fput_routine(void *data)
 		list_del(&req->ki_list);
 		spin_unlock_irq(&fput_lock);
 
-		/* Complete the fput */
-		__fput(req->ki_filp);
+		/* Complete the fputs */
+		if (req->ki_filp)
+			__fput(req->ki_filp);
+		if (req->ki_eventfd)
+			__fput(req->ki_eventfd);
 
 		/* Link the iocb into the context's free list */
 		spin_lock_irq(&ctx->ctx_lock);
@@ -511,8 +566,15 @@ static int __aio_put_req(struct kioctx *ctx, struct kiocb *req)
 
 	/* Must be done under the lock to serialise against cancellation.
 	 * Call this aio_fput as it duplicates fput via the fput_work.
+	 * Of ki_filp and ki_eventfd, only the files this put was the last
+	 * user of are left for aio_fput_routine().
 	 */
-	if (unlikely(atomic_dec_and_test(&req->ki_filp->f_count))) {
+	if (likely(!atomic_dec_and_test(&req->ki_filp->f_count)))
+		req->ki_filp = NULL;
+	if (req->ki_eventfd &&
+	    likely(!atomic_dec_and_test(&req->ki_eventfd->f_count)))
+		req->ki_eventfd = NULL;
+	if (unlikely(req->ki_filp || req->ki_eventfd)) {
 		get_ioctx(ctx);
 		spin_lock(&fput_lock);
 		list_add(&req->ki_list, &fput_head);
@@ -605,6 +667,7 @@ static void unuse_mm(struct mm_struct *mm)
 {
 	struct task_struct *tsk = current;
 
+	sync_mm_rss(tsk, mm);
 	task_lock(tsk);
 	tsk->flags &= ~PF_BORROWED_MM;
 	tsk->mm = NULL;
@@ -700,6 +763,7 @@ static ssize_t aio_run_iocb(struct kiocb *iocb)
 	 */
 
 	kiocbClearKicked(iocb);
+	kiocbClearWaiting(iocb);
 
 	/*
 	 * This is so that aio_complete knows it doesn't need to
@@ -925,6 +989,44 @@ void fastcall kick_iocb(struct kiocb *iocb)
 }
 EXPORT_SYMBOL(kick_iocb);
 
+/* __aio_put_event
+ *	Adds a completion event to the ring buffer.  Must be called
+ *	holding ctx->ctx_lock with interrupts off, to prevent other code
+ *	from messing with the tail pointer since we might be called from
+ *	irq context.
+ */
+static void __aio_put_event(struct kioctx *ctx, u64 obj, u64 data,
+			    long res, long res2)
+{
+	struct aio_ring_info	*info = &ctx->ring_info;
+	struct aio_ring	*ring;
+	struct io_event	*event;
+	unsigned long	tail;
+
+	ring = kmap_atomic(info->ring_pages[0], KM_IRQ1);
+
+	tail = info->tail;
+	event = aio_ring_event(info, tail, KM_IRQ0);
+	if (++tail >= info->nr)
+		tail = 0;
+
+	event->obj = obj;
+	event->data = data;
+	event->res = res;
+	event->res2 = res2;
+
+	dprintk("aio_put_event: %p[%lu]: %Lx %Lx %lx %lx\n",
+		ctx, tail, obj, data, res, res2);
+
+	smp_wmb();	/* make event visible before updating tail */
+
+	info->tail = tail;
+	ring->tail = tail;
+
+	put_aio_ring_event(event, KM_IRQ0);
+	kunmap_atomic(ring, KM_IRQ1);
+}
+
 /* aio_complete
  *	Called when the io request on the given iocb is complete.
  *	Returns true if this is the last user of the request.  The 
@@ -933,11 +1035,7 @@ EXPORT_SYMBOL(kick_iocb);
 int fastcall aio_complete(struct kiocb *iocb, long res, long res2)
 {
 	struct kioctx	*ctx = iocb->ki_ctx;
-	struct aio_ring_info	*info;
-	struct aio_ring	*ring;
-	struct io_event	*event;
 	unsigned long	flags;
-	unsigned long	tail;
 	int		ret;
 
 	/*
@@ -955,14 +1053,6 @@ int fastcall aio_complete(struct kiocb *iocb, long res, long res2)
 		return 1;
 	}
 
-	info = &ctx->ring_info;
-
-	/* add a completion event to the ring buffer.
-	 * must be done holding ctx->ctx_lock to prevent
-	 * other code from messing with the tail
-	 * pointer since we might be called from irq
-	 * context.
-	 */
 	spin_lock_irqsave(&ctx->ctx_lock, flags);
 
 	if (iocb->ki_run_list.prev && !list_empty(&iocb->ki_run_list))
@@ -975,34 +1065,13 @@ int fastcall aio_complete(struct kiocb *iocb, long res, long res2)
 	if (kiocbIsCancelled(iocb))
 		goto put_rq;
 
-	ring = kmap_atomic(info->ring_pages[0], KM_IRQ1);
-
-	tail = info->tail;
-	event = aio_ring_event(info, tail, KM_IRQ0);
-	if (++tail >= info->nr)
-		tail = 0;
-
-	event->obj = (u64)(unsigned long)iocb->ki_obj.user;
-	event->data = iocb->ki_user_data;
-	event->res = res;
-	event->res2 = res2;
-
-	dprintk("aio_complete: %p[%lu]: %p: %p %Lx %lx %lx\n",
-		ctx, tail, iocb, iocb->ki_obj.user, iocb->ki_user_data,
-		res, res2);
-
-	/* after flagging the request as done, we
-	 * must never even look at it again
-	 */
-	smp_wmb();	/* make event visible before updating tail */
-
-	info->tail = tail;
-	ring->tail = tail;
+	__aio_put_event(ctx, (u64)(unsigned long)iocb->ki_obj.user,
+			iocb->ki_user_data, res, res2);
 
-	put_aio_ring_event(event, KM_IRQ0);
-	kunmap_atomic(ring, KM_IRQ1);
+	pr_debug("added to ring %p\n", iocb);
 
-	pr_debug("added to ring %p at [%lu]\n", iocb, tail);
+	if (iocb->ki_eventfd)
+		eventfd_signal(iocb->ki_eventfd, 1);
 
 	pr_debug("%ld retries: %d of %d\n", iocb->ki_retried,
 		iocb->ki_nbytes - iocb->ki_left, iocb->ki_nbytes);
@@ -1114,11 +1183,15 @@ static int read_events(struct kioctx *ctx,
 	struct io_event		ent;
 	struct aio_timeout	to;
 	int			retry = 0;
+	int			poll, idle = 0;
 
 	/* needed to zero any padding within an entry (there shouldn't be 
 	 * any, but C is fun!
 	 */
 	memset(&ent, 0, sizeof(ent));
+
+	/* Submit what was posted on the submission ring first */
+	poll = aio_submit_sq(ctx) >= AIO_SQ_POLL_BATCH;
 retry:
 	ret = 0;
 	while (likely(i < nr)) {
@@ -1166,6 +1239,13 @@ retry:
 		set_timeout(start_jiffies, &to, &ts);
 	}
 
+	/*
+	 * After a large batch, more is likely to be posted while we wait:
+	 * look for it every tick, so that userspace need not call in.
+	 */
+	if (poll)
+		aio_sq_poll(ctx, 1);
+
 	while (likely(i < nr)) {
 		add_wait_queue_exclusive(&ctx->wait, &wait);
 		do {
@@ -1178,7 +1258,17 @@ retry:
 			ret = 0;
 			if (to.timed_out)	/* Only check after read evt */
 				break;
-			schedule();
+			if (poll) {
+				schedule_timeout(1);
+				__set_task_state(tsk, TASK_RUNNING);
+				if (aio_submit_sq(ctx))
+					idle = 0;
+				else if (++idle >= AIO_SQ_POLL_IDLE) {
+					aio_sq_poll(ctx, 0);
+					poll = 0;
+				}
+			} else
+				schedule();
 			if (signal_pending(tsk)) {
 				ret = -EINTR;
 				break;
@@ -1203,6 +1293,8 @@ retry:
 		i ++;
 	}
 
+	if (poll)
+		aio_sq_poll(ctx, 0);
 	if (timeout)
 		clear_timeout(&to);
 out:
@@ -1305,7 +1397,9 @@ asmlinkage long sys_io_destroy(aio_context_t ctx)
  * IO_CMD_P{READ,WRITE}.  They maintains kiocb retry state around potentially
  * multiple calls to f_op->aio_read().  They loop around partial progress
  * instead of returning -EIOCBRETRY because they don't have the means to call
- * kick_iocb().
+ * kick_iocb().  The exception is a buffered read or write that had to wait
+ * for a page (KIF_WAITING): the page cache queued ki_wait, so they return
+ * -EIOCBRETRY and go on from the wakeup.
  */
 static ssize_t aio_pread(struct kiocb *iocb)
 {
@@ -1330,10 +1424,15 @@ static ssize_t aio_pread(struct kiocb *iocb)
 		 * For pipes and sockets we return once we have some data; for
 		 * regular files we retry till we complete the entire read or
 		 * find that we can't read any more data (e.g short reads).
+		 * A read short of a page being read in is retried when the
+		 * page is unlocked, and must not go on before.
 		 */
-	} while (ret > 0 && iocb->ki_left > 0 &&
+	} while (ret > 0 && iocb->ki_left > 0 && !kiocbIsWaiting(iocb) &&
 		 !S_ISFIFO(inode->i_mode) && !S_ISSOCK(inode->i_mode));
 
+	if (kiocbIsWaiting(iocb))
+		return -EIOCBRETRY;
+
 	/* This means we must have transferred all that we could */
 	/* No need to retry anymore */
 	if ((ret == 0) || (iocb->ki_left == 0))
@@ -1355,7 +1454,11 @@ static ssize_t aio_pwrite(struct kiocb *iocb)
 			iocb->ki_buf += ret;
 			iocb->ki_left -= ret;
 		}
-	} while (ret > 0 && iocb->ki_left > 0);
+	} while (ret > 0 && iocb->ki_left > 0 && !kiocbIsWaiting(iocb));
+
+	/* Waiting for a locked page of the file, see aio_pread() */
+	if (kiocbIsWaiting(iocb))
+		return -EIOCBRETRY;
 
 	if ((ret == 0) || (iocb->ki_left == 0))
 		ret = iocb->ki_nbytes - iocb->ki_left;
@@ -1482,7 +1585,7 @@ int fastcall io_submit_one(struct kioctx *ctx, struct iocb __user *user_iocb,
 
 	/* enforce forwards compatibility on users */
 	if (unlikely(iocb->aio_reserved1 || iocb->aio_reserved2 ||
-		     iocb->aio_reserved3)) {
+		     (iocb->aio_flags & ~IOCB_FLAG_RESFD))) {
 		pr_debug("EINVAL: io_submit: reserve field set\n");
 		return -EINVAL;
 	}
@@ -1508,6 +1611,18 @@ int fastcall io_submit_one(struct kioctx *ctx, struct iocb __user *user_iocb,
 	}
 
 	req->ki_filp = file;
+	if (iocb->aio_flags & IOCB_FLAG_RESFD) {
+		/*
+		 * Held until the iocb is freed: aio_complete() may run in
+		 * interrupt context and must not be the one to fput() it.
+		 */
+		req->ki_eventfd = eventfd_fget((int) iocb->aio_resfd);
+		if (IS_ERR(req->ki_eventfd)) {
+			ret = PTR_ERR(req->ki_eventfd);
+			req->ki_eventfd = NULL;
+			goto out_put_req;
+		}
+	}
 	ret = put_user(req->ki_key, &user_iocb->aio_key);
 	if (unlikely(ret)) {
 		dprintk("EFAULT: aio_key\n");
@@ -1547,6 +1662,142 @@ out_put_req:
 	return ret;
 }
 
+/* aio_sq_pending
+ *	Tells if userspace posted iocbs on the submission ring that
+ *	the kernel did not take yet.  Racy, only a hint.
+ */
+static int aio_sq_pending(struct kioctx *ctx)
+{
+	struct aio_ring_info *info = &ctx->ring_info;
+	struct aio_sq_ring *sq;
+	unsigned tail;
+
+	sq = kmap_atomic(info->ring_pages[info->sq_page], KM_USER0);
+	tail = sq->tail;
+	kunmap_atomic(sq, KM_USER0);
+
+	return tail != info->sq_head;
+}
+
+/* aio_sq_error
+ *	Completes an iocb taken off the submission ring that could not be
+ *	submitted, with the error as result.  Returns 0 on success, or
+ *	-EAGAIN if the completion ring has no room left for the event.
+ */
+static int aio_sq_error(struct kioctx *ctx, struct iocb __user *user_iocb,
+			u64 data, long res)
+{
+	struct aio_ring_info *info = &ctx->ring_info;
+	struct aio_ring *ring;
+	int ret = -EAGAIN;
+
+	spin_lock_irq(&ctx->ctx_lock);
+	ring = kmap_atomic(info->ring_pages[0], KM_USER0);
+	if (ctx->reqs_active < aio_ring_avail(info, ring))
+		ret = 0;
+	kunmap_atomic(ring, KM_USER0);
+	if (!ret)
+		__aio_put_event(ctx, (u64)(unsigned long)user_iocb, data,
+				res, 0);
+	spin_unlock_irq(&ctx->ctx_lock);
+
+	if (!ret && waitqueue_active(&ctx->wait))
+		wake_up(&ctx->wait);
+	return ret;
+}
+
+/* aio_submit_sq
+ *	Submits the iocbs posted on the submission ring, in the context of
+ *	the calling task so that the files, credentials and limits are its
+ *	own.  Returns the number of iocbs taken off the ring.  The ring keeps
+ *	the ones left when the context runs out of requests, or out of room
+ *	in the completion ring to report the failure of one.
+ */
+static long aio_submit_sq(struct kioctx *ctx)
+{
+	struct aio_ring_info *info = &ctx->ring_info;
+	struct aio_sq_ring *sq;
+	unsigned head, tail;
+	long nr = 0;
+
+	if (!aio_sq_pending(ctx))
+		return 0;
+
+	mutex_lock(&ctx->sq_mutex);
+
+	sq = kmap_atomic(info->ring_pages[info->sq_page], KM_USER0);
+	tail = sq->tail % info->sq_nr;
+	kunmap_atomic(sq, KM_USER0);
+	smp_rmb();	/* read the entries only after the tail */
+
+	head = info->sq_head;
+	while (head != tail) {
+		struct iocb __user *user_iocb;
+		struct iocb tmp;
+		long ret;
+
+		user_iocb = (struct iocb __user *)(unsigned long)
+				aio_sq_entry(info, head);
+
+		tmp.aio_data = 0;
+		ret = -EFAULT;
+		if (likely(!copy_from_user(&tmp, user_iocb, sizeof(tmp))))
+			ret = io_submit_one(ctx, user_iocb, &tmp);
+		if (unlikely(ret)) {
+			if (ret == -EAGAIN ||
+			    aio_sq_error(ctx, user_iocb, tmp.aio_data, ret))
+				break;
+		}
+
+		if (++head >= info->sq_nr)
+			head = 0;
+		nr++;
+	}
+
+	info->sq_head = head;
+	sq = kmap_atomic(info->ring_pages[info->sq_page], KM_USER0);
+	smp_mb();	/* done with the entries before updating the head */
+	sq->head = head;
+	kunmap_atomic(sq, KM_USER0);
+
+	mutex_unlock(&ctx->sq_mutex);
+
+	return nr;
+}
+
+/* aio_sq_poll
+ *	Starts or stops polling of the submission ring by a task waiting in
+ *	io_getevents().  Userspace is told to wake the kernel up with
+ *	io_submit(ctx, 0, NULL) only while no task polls the ring.
+ */
+static void aio_sq_poll(struct kioctx *ctx, int on)
+{
+	struct aio_ring_info *info = &ctx->ring_info;
+	struct aio_sq_ring *sq;
+	int last = 0;
+
+	mutex_lock(&ctx->sq_mutex);
+	sq = kmap_atomic(info->ring_pages[info->sq_page], KM_USER0);
+	if (on) {
+		if (!ctx->sq_pollers++)
+			sq->flags &= ~AIO_SQ_NEED_WAKEUP;
+	} else if (!--ctx->sq_pollers) {
+		sq->flags |= AIO_SQ_NEED_WAKEUP;
+		last = 1;
+	}
+	kunmap_atomic(sq, KM_USER0);
+	mutex_unlock(&ctx->sq_mutex);
+
+	/*
+	 * Iocbs may have been posted before the flag was seen, take them
+	 * now since no one will ask for it.
+	 */
+	if (last) {
+		smp_mb();
+		aio_submit_sq(ctx);
+	}
+}
+
 /* sys_io_submit:
  *	Queue the nr iocbs pointed to by iocbpp for processing.  Returns
  *	the number of iocbs queued.  May return -EINVAL if the aio_context
@@ -1556,8 +1807,10 @@ out_put_req:
  *	-EFAULT if any of the data structures point to invalid data.  May
  *	fail with -EBADF if the file descriptor specified in the first
  *	iocb is invalid.  May fail with -EAGAIN if insufficient resources
- *	are available to queue any iocbs.  Will return 0 if nr is 0.  Will
- *	fail with -ENOSYS if not implemented.
+ *	are available to queue any iocbs.  When nr is 0, submits the iocbs
+ *	posted on the submission ring of the context instead, and returns
+ *	the number of them taken off the ring.  Will fail with -ENOSYS if
+ *	not implemented.
  */
 asmlinkage long sys_io_submit(aio_context_t ctx_id, long nr,
 			      struct iocb __user * __user *iocbpp)
@@ -1578,6 +1831,12 @@ asmlinkage long sys_io_submit(aio_context_t ctx_id, long nr,
 		return -EINVAL;
 	}
 
+	if (!nr) {
+		ret = aio_submit_sq(ctx);
+		put_ioctx(ctx);
+		return ret;
+	}
+
 	/*
 	 * AKPM: should this return a partial result if some of the IOs were
 	 * successfully submitted?
@@ -0,0 +1,91 @@
+/*
+ *  fs/anon_inodes.c
+ *
+ *  Files for signalfd, eventfd and the like, which stand for a kernel
+ *  object that has no name.  They all share the root of one internal
+ *  mount, so making one costs a struct file and nothing more.
+ */
+
+#include <linux/module.h>
+#include <linux/file.h>
+#include <linux/fs.h>
+#include <linux/mount.h>
+#include <linux/init.h>
+#include <linux/anon_inodes.h>
+
+#define ANON_INODE_FS_MAGIC	0x09041934
+
+static struct vfsmount *anon_inode_mnt __read_mostly;
+
+/**
+ * anon_inode_getfd - install a new file for a kernel object
+ * @fops: the file operations of the new file
+ * @priv: its private_data
+ * @flags: O_RDONLY, O_WRONLY or O_RDWR, which the file is opened for
+ *
+ * Returns the new file descriptor.  @fops->release is called on @priv
+ * when the last reference to the file goes, but if this fails, @priv is
+ * the caller's to clean up.
+ */
+int anon_inode_getfd(const struct file_operations *fops, void *priv,
+		     int flags)
+{
+	struct file *file;
+	int fd;
+
+	if (IS_ERR(anon_inode_mnt))
+		return -ENODEV;
+
+	fd = get_unused_fd();
+	if (fd < 0)
+		return fd;
+	file = get_empty_filp();
+	if (!file) {
+		put_unused_fd(fd);
+		return -ENFILE;
+	}
+
+	file->f_op = fops;
+	file->f_vfsmnt = mntget(anon_inode_mnt);
+	file->f_dentry = dget(anon_inode_mnt->mnt_root);
+	file->f_mapping = file->f_dentry->d_inode->i_mapping;
+	file->f_flags = flags & O_ACCMODE;
+	file->f_mode = (flags + 1) & O_ACCMODE;
+	file->private_data = priv;
+
+	fd_install(fd, file);
+	return fd;
+}
+EXPORT_SYMBOL_GPL(anon_inode_getfd);
+
+static int anon_inodefs_get_sb(struct file_system_type *fs_type, int flags,
+			       const char *dev_name, void *data,
+			       struct vfsmount *mnt)
+{
+	return get_sb_pseudo(fs_type, "anon_inode:", NULL,
+			     ANON_INODE_FS_MAGIC, mnt);
+}
+
+static struct file_system_type anon_inode_fs_type = {
+	.name		= "anon_inodefs",
+	.get_sb		= anon_inodefs_get_sb,
+	.kill_sb	= kill_anon_super,
+};
+
+static int __init anon_inode_init(void)
+{
+	int ret;
+
+	ret = register_filesystem(&anon_inode_fs_type);
+	if (ret) {
+		anon_inode_mnt = ERR_PTR(ret);
+		return ret;
+	}
+	anon_inode_mnt = kern_mount(&anon_inode_fs_type);
+	if (IS_ERR(anon_inode_mnt)) {
+		unregister_filesystem(&anon_inode_fs_type);
+		return PTR_ERR(anon_inode_mnt);
+	}
+	return 0;
+}
+fs_initcall(anon_inode_init);
@@ -285,20 +285,34 @@ create_elf_tables(struct linux_binprm *bprm, struct elfhdr *exec,
 
 #ifndef elf_map
 
+/*
+ * How much of the start of each segment to map at exec time, of what
+ * is in the page cache already: a program started over and over again
+ * touches those pages first, and would otherwise fault them in one by
+ * one.
+ */
+#define ELF_POPULATE_BYTES	(128 * 1024)
+
 static unsigned long elf_map(struct file *filep, unsigned long addr,
 		struct elf_phdr *eppnt, int prot, int type)
 {
-	unsigned long map_addr;
+	struct vm_area_struct *vma;
+	unsigned long map_addr, size;
 	unsigned long pageoffset = ELF_PAGEOFFSET(eppnt->p_vaddr);
 
 	down_write(&current->mm->mmap_sem);
 	/* mmap() will return -EINVAL if given a zero size, but a
 	 * segment with zero filesize is perfectly valid */
-	if (eppnt->p_filesz + pageoffset)
-		map_addr = do_mmap(filep, ELF_PAGESTART(addr),
-				   eppnt->p_filesz + pageoffset, prot, type,
-				   eppnt->p_offset - pageoffset);
-	else
+	size = eppnt->p_filesz + pageoffset;
+	if (size) {
+		map_addr = do_mmap(filep, ELF_PAGESTART(addr), size, prot,
+				   type, eppnt->p_offset - pageoffset);
+		vma = BAD_ADDR(map_addr) ? NULL :
+			find_vma(current->mm, map_addr);
+		if (vma && vma->vm_start == map_addr)
+			populate_cached_range(vma, map_addr, map_addr +
+					min(size, (unsigned long)ELF_POPULATE_BYTES));
+	} else
 		map_addr = ELF_PAGESTART(addr);
 	up_write(&current->mm->mmap_sem);
 	return(map_addr);
@@ -50,6 +50,14 @@ extern int SendReceive(const unsigned int /* xid */ , struct cifsSesInfo *,
 extern int SendReceive2(const unsigned int /* xid */ , struct cifsSesInfo *,
 			struct kvec *, int /* nvec to send */, 
 			int * /* type of buf returned */ , const int long_op);
+extern int SendReceive2Start(const unsigned int /* xid */ ,
+			struct cifsSesInfo *, struct kvec *,
+			int /* nvec to send */, const int long_op,
+			const int nowait, struct mid_q_entry **);
+extern int SendReceive2Wait(const unsigned int /* xid */ ,
+			struct cifsSesInfo *, struct mid_q_entry *,
+			struct kvec *, int * /* type of buf returned */ ,
+			const int long_op);
 extern int SendReceiveBlockingLock(const unsigned int /* xid */ , struct cifsTconInfo *,
 				struct smb_hdr * /* input */ ,
 				struct smb_hdr * /* out */ ,
@@ -244,6 +252,14 @@ extern int CIFSSMBRead(const int xid, struct cifsTconInfo *tcon,
                         const int netfid, unsigned int count,
                         const __u64 lseek, unsigned int *nbytes, char **buf,
 			int * return_buf_type);
+extern int CIFSSMBReadStart(const int xid, struct cifsTconInfo *tcon,
+			const int netfid, const unsigned int count,
+			const __u64 lseek, const int nowait,
+			struct mid_q_entry **);
+extern int CIFSSMBReadWait(const int xid, struct cifsTconInfo *tcon,
+			struct mid_q_entry *, const unsigned int count,
+			unsigned int *nbytes, char **buf,
+			int * return_buf_type);
 extern int CIFSSMBWrite(const int xid, struct cifsTconInfo *tcon,
 			const int netfid, const unsigned int count,
 			const __u64 lseek, unsigned int *nbytes,
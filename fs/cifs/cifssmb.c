@@ -1109,18 +1109,16 @@ openRetry:
 	return rc;
 }
 
+/* Sends a read, whose response is waited for by CIFSSMBReadWait */
 int
-CIFSSMBRead(const int xid, struct cifsTconInfo *tcon,
-            const int netfid, const unsigned int count,
-            const __u64 lseek, unsigned int *nbytes, char **buf,
-	    int * pbuf_type)
+CIFSSMBReadStart(const int xid, struct cifsTconInfo *tcon,
+		 const int netfid, const unsigned int count,
+		 const __u64 lseek, const int nowait,
+		 struct mid_q_entry **ppmidQ)
 {
 	int rc = -EACCES;
 	READ_REQ *pSMB = NULL;
-	READ_RSP *pSMBr = NULL;
-	char *pReadData = NULL;
 	int wct;
-	int resp_buf_type = 0;
 	struct kvec iov[1];
 
 	cFYI(1,("Reading %d bytes on fid %d",count,netfid));
@@ -1129,7 +1127,6 @@ CIFSSMBRead(const int xid, struct cifsTconInfo *tcon,
 	else
 		wct = 10; /* old style read */
 
-	*nbytes = 0;
 	rc = small_smb_init(SMB_COM_READ_ANDX, wct, tcon, (void **) &pSMB);
 	if (rc)
 		return rc;
@@ -1160,9 +1157,25 @@ CIFSSMBRead(const int xid, struct cifsTconInfo *tcon,
 
 	iov[0].iov_base = (char *)pSMB;
 	iov[0].iov_len = pSMB->hdr.smb_buf_length + 4;
-	rc = SendReceive2(xid, tcon->ses, iov, 
-			  1 /* num iovecs */,
-			  &resp_buf_type, 0); 
+	/* pSMB is freed in SendReceive2Start */
+	return SendReceive2Start(xid, tcon->ses, iov, 1 /* num iovecs */,
+				 0, nowait, ppmidQ);
+}
+
+int
+CIFSSMBReadWait(const int xid, struct cifsTconInfo *tcon,
+		struct mid_q_entry *midQ, const unsigned int count,
+		unsigned int *nbytes, char **buf, int * pbuf_type)
+{
+	int rc;
+	READ_RSP *pSMBr = NULL;
+	char *pReadData = NULL;
+	int resp_buf_type = 0;
+	struct kvec iov[1];
+
+	*nbytes = 0;
+	iov[0].iov_base = NULL;
+	rc = SendReceive2Wait(xid, tcon->ses, midQ, iov, &resp_buf_type, 0);
 	cifs_stats_inc(&tcon->num_reads);
 	pSMBr = (READ_RSP *)iov[0].iov_base;
 	if (rc) {
@@ -1191,7 +1204,6 @@ CIFSSMBRead(const int xid, struct cifsTconInfo *tcon,
 		}
 	}
 
-/*	cifs_small_buf_release(pSMB); */ /* Freed earlier now in SendReceive2 */
 	if(*buf) {
 		if(resp_buf_type == CIFS_SMALL_BUFFER)
 			cifs_small_buf_release(iov[0].iov_base);
@@ -1211,6 +1223,25 @@ CIFSSMBRead(const int xid, struct cifsTconInfo *tcon,
 	return rc;
 }
 
+int
+CIFSSMBRead(const int xid, struct cifsTconInfo *tcon,
+            const int netfid, const unsigned int count,
+            const __u64 lseek, unsigned int *nbytes, char **buf,
+	    int * pbuf_type)
+{
+	struct mid_q_entry *midQ;
+	int rc;
+
+	*nbytes = 0;
+	rc = CIFSSMBReadStart(xid, tcon, netfid, count, lseek, 0, &midQ);
+	if (rc) {
+		cifs_stats_inc(&tcon->num_reads);
+		cERROR(1, ("Send error in read = %d", rc));
+		return rc;
+	}
+	return CIFSSMBReadWait(xid, tcon, midQ, count, nbytes, buf, pbuf_type);
+}
+
 
 int
 CIFSSMBWrite(const int xid, struct cifsTconInfo *tcon,
@@ -1717,6 +1717,20 @@ static void cifs_copy_cache_pages(struct address_space *mapping,
 	return;
 }
 
+/* Reads sent along a run of pages before the first one is waited for */
+#define CIFS_READPAGES_PIPELINE 4
+
+static void cifs_readpages_cleanup(struct list_head *page_list)
+{
+	struct page *page;
+
+	while (!list_empty(page_list)) {
+		page = list_entry(page_list->prev, struct page, lru);
+		list_del(&page->lru);
+		page_cache_release(page);
+	}
+}
+
 static int cifs_readpages(struct file *file, struct address_space *mapping,
 	struct list_head *page_list, unsigned num_pages)
 {
@@ -1733,6 +1747,10 @@ static int cifs_readpages(struct file *file, struct address_space *mapping,
 	struct pagevec lru_pvec;
 	struct cifsFileInfo *open_file;
 	int buf_type = CIFS_NO_BUFFER;
+	struct mid_q_entry *mids[CIFS_READPAGES_PIPELINE];
+	unsigned int sizes[CIFS_READPAGES_PIPELINE];
+	unsigned int nreq, j;
+	int short_read;
 
 	xid = GetXid();
 	if (file->private_data == NULL) {
@@ -1770,112 +1788,96 @@ static int cifs_readpages(struct file *file, struct address_space *mapping,
 		if (contig_pages + i >  num_pages)
 			contig_pages = num_pages - i;
 
-		/* for reads over a certain size could initiate async
-		   read ahead */
+		/* Send reads for as much of the run as the pipeline holds,
+		   so that the server streams them back to back, then take
+		   the responses in order.  Only the first read may wait for
+		   a free request slot: the others would hold up the slots
+		   our own reads are waiting to give back */
+		nreq = 0;
+		while (contig_pages && nreq < CIFS_READPAGES_PIPELINE) {
+			/* Read size needs to be in multiples of one page */
+			read_size = min_t(const unsigned int,
+					  contig_pages * PAGE_CACHE_SIZE,
+					  cifs_sb->rsize & PAGE_CACHE_MASK);
 
-		read_size = contig_pages * PAGE_CACHE_SIZE;
-		/* Read size needs to be in multiples of one page */
-		read_size = min_t(const unsigned int, read_size,
-				  cifs_sb->rsize & PAGE_CACHE_MASK);
-
-		rc = -EAGAIN;
-		while (rc == -EAGAIN) {
 			if ((open_file->invalidHandle) && 
 			    (!open_file->closePend)) {
+				if (nreq)
+					break;
 				rc = cifs_reopen_file(file->f_dentry->d_inode,
 					file, TRUE);
 				if (rc != 0)
 					break;
 			}
 
-			rc = CIFSSMBRead(xid, pTcon,
-					 open_file->netfid,
-					 read_size, offset,
-					 &bytes_read, &smb_read_data,
-					 &buf_type);
-			/* BB more RC checks ? */
-			if (rc== -EAGAIN) {
-				if (smb_read_data) {
-					if(buf_type == CIFS_SMALL_BUFFER)
-						cifs_small_buf_release(smb_read_data);
-					else if(buf_type == CIFS_LARGE_BUFFER)
-						cifs_buf_release(smb_read_data);
-					smb_read_data = NULL;
-				}
-			}
+			rc = CIFSSMBReadStart(xid, pTcon, open_file->netfid,
+					      read_size, offset, nreq != 0,
+					      &mids[nreq]);
+			if (rc == -EAGAIN && !nreq)
+				continue;
+			if (rc)
+				break;
+			sizes[nreq++] = read_size;
+			offset += read_size;
+			contig_pages -= read_size >> PAGE_CACHE_SHIFT;
 		}
-		if ((rc < 0) || (smb_read_data == NULL)) {
+		if (!nreq) {
 			cFYI(1, ("Read error in readpages: %d", rc));
 			/* clean up remaing pages off list */
-			while (!list_empty(page_list) && (i < num_pages)) {
-				page = list_entry(page_list->prev, struct page,
-						  lru);
-				list_del(&page->lru);
-				page_cache_release(page);
-			}
+			cifs_readpages_cleanup(page_list);
 			break;
-		} else if (bytes_read > 0) {
-			pSMBr = (struct smb_com_read_rsp *)smb_read_data;
-			cifs_copy_cache_pages(mapping, page_list, bytes_read,
-				smb_read_data + 4 /* RFC1001 hdr */ +
-				le16_to_cpu(pSMBr->DataOffset), &lru_pvec);
-
-			i +=  bytes_read >> PAGE_CACHE_SHIFT;
-			cifs_stats_bytes_read(pTcon, bytes_read);
-			if ((int)(bytes_read & PAGE_CACHE_MASK) != bytes_read) {
-				i++; /* account for partial page */
+		}
 
-				/* server copy of file can have smaller size 
+		/* once a read comes back short, what follows it does not
+		   belong to the pages left on the list */
+		short_read = 0;
+		for (j = 0; j < nreq; j++) {
+			rc = CIFSSMBReadWait(xid, pTcon, mids[j], sizes[j],
+					     &bytes_read, &smb_read_data,
+					     &buf_type);
+			if (!short_read && !rc && smb_read_data &&
+			    bytes_read > 0) {
+				pSMBr = (struct smb_com_read_rsp *)smb_read_data;
+				cifs_copy_cache_pages(mapping, page_list,
+					bytes_read, smb_read_data +
+					4 /* RFC1001 hdr */ +
+					le16_to_cpu(pSMBr->DataOffset),
+					&lru_pvec);
+
+				i +=  bytes_read >> PAGE_CACHE_SHIFT;
+				cifs_stats_bytes_read(pTcon, bytes_read);
+				/* server copy of file can have smaller size
 				   than client */
-				/* BB do we need to verify this common case ? 
-				   this case is ok - if we are at server EOF 
-				   we will hit it on next read */
-
-			/* while (!list_empty(page_list) && (i < num_pages)) {
-					page = list_entry(page_list->prev, 
-							  struct page, list);
-					list_del(&page->list);
-					page_cache_release(page);
-				}
-				break; */
+				if ((int)(bytes_read & PAGE_CACHE_MASK) !=
+				    bytes_read)
+					i++; /* account for partial page */
+				if (bytes_read != sizes[j])
+					short_read = 1;
+			} else if (!short_read) {
+				cFYI(1, ("Read error or no bytes read (%d) "
+					 "at offset %lld in readpages: %d",
+					 bytes_read, offset, rc));
+				short_read = 1;
 			}
-		} else {
-			cFYI(1, ("No bytes read (%d) at offset %lld . "
-				 "Cleaning remaining pages from readahead list",
-				 bytes_read, offset));
+			if (smb_read_data) {
+				if(buf_type == CIFS_SMALL_BUFFER)
+					cifs_small_buf_release(smb_read_data);
+				else if(buf_type == CIFS_LARGE_BUFFER)
+					cifs_buf_release(smb_read_data);
+				smb_read_data = NULL;
+			}
+			bytes_read = 0;
+		}
+		if (short_read) {
 			/* BB turn off caching and do new lookup on 
 			   file size at server? */
-			while (!list_empty(page_list) && (i < num_pages)) {
-				page = list_entry(page_list->prev, struct page,
-						  lru);
-				list_del(&page->lru);
-
-				/* BB removeme - replace with zero of page? */
-				page_cache_release(page);
-			}
+			cifs_readpages_cleanup(page_list);
 			break;
 		}
-		if (smb_read_data) {
-			if(buf_type == CIFS_SMALL_BUFFER)
-				cifs_small_buf_release(smb_read_data);
-			else if(buf_type == CIFS_LARGE_BUFFER)
-				cifs_buf_release(smb_read_data);
-			smb_read_data = NULL;
-		}
-		bytes_read = 0;
 	}
 
 	pagevec_lru_add(&lru_pvec);
 
-/* need to free smb_read_data buf before exit */
-	if (smb_read_data) {
-		if(buf_type == CIFS_SMALL_BUFFER)
-			cifs_small_buf_release(smb_read_data);
-		else if(buf_type == CIFS_LARGE_BUFFER)
-			cifs_buf_release(smb_read_data);
-		smb_read_data = NULL;
-	} 
-
 	FreeXid(xid);
 	return rc;
 }
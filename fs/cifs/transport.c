@@ -416,18 +416,34 @@ static int wait_for_response(struct cifsSesInfo *ses,
 	}
 }
 
+/* For a sender already holding slots: take one only if it is free */
+static int try_free_request(struct cifsSesInfo *ses)
+{
+	int rc = 0;
+
+	spin_lock(&GlobalMid_Lock);
+	if (ses->server->tcpStatus == CifsExiting)
+		rc = -ENOENT;
+	else if (atomic_read(&ses->server->inFlight) >= cifs_max_pending)
+		rc = -EBUSY;
+	else
+		atomic_inc(&ses->server->inFlight);
+	spin_unlock(&GlobalMid_Lock);
+	return rc;
+}
+
+/* Sends the request, the response is waited for by SendReceive2Wait.
+   With nowait set -EBUSY is returned rather than waiting for a free
+   request slot, so that a caller with requests of its own outstanding
+   does not wait for slots which only it could free */
 int
-SendReceive2(const unsigned int xid, struct cifsSesInfo *ses, 
-	     struct kvec *iov, int n_vec, int * pRespBufType /* ret */, 
-	     const int long_op)
+SendReceive2Start(const unsigned int xid, struct cifsSesInfo *ses,
+		  struct kvec *iov, int n_vec, const int long_op,
+		  const int nowait, struct mid_q_entry **ppmidQ /* ret */)
 {
 	int rc = 0;
-	unsigned int receive_len;
-	unsigned long timeout;
 	struct mid_q_entry *midQ;
 	struct smb_hdr *in_buf = iov[0].iov_base;
-	
-	*pRespBufType = CIFS_NO_BUFFER;  /* no response buf yet */
 
 	if ((ses == NULL) || (ses->server == NULL)) {
 		cifs_small_buf_release(in_buf);
@@ -444,7 +460,10 @@ SendReceive2(const unsigned int xid, struct cifsSesInfo *ses,
 	   to the same server. We may make this configurable later or
 	   use ses->maxReq */
 
-	rc = wait_for_free_request(ses, long_op);
+	if (nowait)
+		rc = try_free_request(ses);
+	else
+		rc = wait_for_free_request(ses, long_op);
 	if (rc) {
 		cifs_small_buf_release(in_buf);
 		return rc;
@@ -482,8 +501,29 @@ SendReceive2(const unsigned int xid, struct cifsSesInfo *ses,
 	up(&ses->server->tcpSem);
 	cifs_small_buf_release(in_buf);
 
-	if(rc < 0)
-		goto out;
+	if(rc < 0) {
+		DeleteMidQEntry(midQ);
+		atomic_dec(&ses->server->inFlight); 
+		wake_up(&ses->server->request_q);
+		return rc;
+	}
+
+	*ppmidQ = midQ;
+	return 0;
+}
+
+/* Waits for the response to a request sent by SendReceive2Start, and
+   frees the mid.  The response buffer is returned in iov[0] */
+int
+SendReceive2Wait(const unsigned int xid, struct cifsSesInfo *ses,
+		 struct mid_q_entry *midQ, struct kvec *iov,
+		 int * pRespBufType /* ret */, const int long_op)
+{
+	int rc = 0;
+	unsigned int receive_len;
+	unsigned long timeout;
+
+	*pRespBufType = CIFS_NO_BUFFER;  /* no response buf yet */
 
 	if (long_op == -1)
 		goto out;
@@ -595,6 +635,22 @@ out:
 	return rc;
 }
 
+int
+SendReceive2(const unsigned int xid, struct cifsSesInfo *ses, 
+	     struct kvec *iov, int n_vec, int * pRespBufType /* ret */, 
+	     const int long_op)
+{
+	struct mid_q_entry *midQ;
+	int rc;
+
+	*pRespBufType = CIFS_NO_BUFFER;  /* no response buf yet */
+
+	rc = SendReceive2Start(xid, ses, iov, n_vec, long_op, 0, &midQ);
+	if (rc)
+		return rc;
+	return SendReceive2Wait(xid, ses, midQ, iov, pRespBufType, long_op);
+}
+
 int
 SendReceive(const unsigned int xid, struct cifsSesInfo *ses,
 	    struct smb_hdr *in_buf, struct smb_hdr *out_buf,
@@ -60,7 +60,15 @@ static kmem_cache_t *dentry_cache __read_mostly;
 static unsigned int d_hash_mask __read_mostly;
 static unsigned int d_hash_shift __read_mostly;
 static struct hlist_head *dentry_hashtable __read_mostly;//保存正在使用的dentry对象
-static LIST_HEAD(dentry_unused);//保存未使用dentry对象
+
+/*
+ * The unused dentries are kept on an LRU list per superblock, s_dentry_lru,
+ * under dcache_lru_lock, which also covers s_nr_dentry_unused and
+ * dentry_stat.nr_unused.  The d_lru of a dentry is only changed with its
+ * d_lock held, so that dput() can put a dentry on the LRU without taking
+ * dcache_lock.  Lock order: dcache_lock, d_lock, dcache_lru_lock.
+ */
+static __cacheline_aligned_in_smp DEFINE_SPINLOCK(dcache_lru_lock);
 
 /* Statistics gathering. */
 struct dentry_stat_t dentry_stat = {
@@ -87,6 +95,38 @@ static void d_free(struct dentry *dentry)
  	call_rcu(&dentry->d_u.d_rcu, d_callback);
 }
 
+/*
+ * LRU helpers, called with d_lock held
+ */
+static void dentry_lru_add(struct dentry *dentry)
+{
+	spin_lock(&dcache_lru_lock);
+	list_add(&dentry->d_lru, &dentry->d_sb->s_dentry_lru);
+	dentry->d_sb->s_nr_dentry_unused++;
+	dentry_stat.nr_unused++;
+	spin_unlock(&dcache_lru_lock);
+}
+
+static void dentry_lru_add_tail(struct dentry *dentry)
+{
+	spin_lock(&dcache_lru_lock);
+	list_add_tail(&dentry->d_lru, &dentry->d_sb->s_dentry_lru);
+	dentry->d_sb->s_nr_dentry_unused++;
+	dentry_stat.nr_unused++;
+	spin_unlock(&dcache_lru_lock);
+}
+
+static void dentry_lru_del_init(struct dentry *dentry)
+{
+	if (!list_empty(&dentry->d_lru)) {
+		spin_lock(&dcache_lru_lock);
+		list_del_init(&dentry->d_lru);
+		dentry->d_sb->s_nr_dentry_unused--;
+		dentry_stat.nr_unused--;
+		spin_unlock(&dcache_lru_lock);
+	}
+}
+
 /*
  * Release the dentry's inode, using the filesystem
  * d_iput() operation if defined.
@@ -96,7 +136,10 @@ static void dentry_iput(struct dentry * dentry)
 {
 	struct inode *inode = dentry->d_inode;
 	if (inode) {//处理当前dentry关联inode
+		/* the lockless walk must not use the inode after this */
+		write_seqcount_begin(&dentry->d_seq);
 		dentry->d_inode = NULL;
+		write_seqcount_end(&dentry->d_seq);
 		list_del_init(&dentry->d_alias);
 		spin_unlock(&dentry->d_lock);
 		spin_unlock(&dcache_lock);
@@ -138,6 +181,9 @@ static void dentry_iput(struct dentry * dentry)
  * releasing its resources. If the parent dentries were scheduled for release
  * they too may now get deleted.
  *
+ * The last reference to a hashed dentry only puts it on the LRU, which
+ * d_lock is enough for: dcache_lock is only taken to get rid of a dentry.
+ *
  * no dcache lock, please.
  */
 
@@ -149,6 +195,22 @@ void dput(struct dentry *dentry)
 repeat:
 	if (atomic_read(&dentry->d_count) == 1)
 		might_sleep();
+	if (!atomic_dec_and_lock(&dentry->d_count, &dentry->d_lock))
+		return;
+
+	if (!d_unhashed(dentry) &&
+	    !(dentry->d_op && dentry->d_op->d_delete)) {
+		if (list_empty(&dentry->d_lru)) {
+			dentry->d_flags |= DCACHE_REFERENCED;
+			dentry_lru_add(dentry);
+		}
+		spin_unlock(&dentry->d_lock);
+		return;
+	}
+
+	/* Take the reference back and drop it again under dcache_lock */
+	atomic_inc(&dentry->d_count);
+	spin_unlock(&dentry->d_lock);
 	if (!atomic_dec_and_lock(&dentry->d_count, &dcache_lock))
 		return;
 
@@ -171,8 +233,7 @@ repeat:
 		goto kill_it;
   	if (list_empty(&dentry->d_lru)) {
   		dentry->d_flags |= DCACHE_REFERENCED;
-  		list_add(&dentry->d_lru, &dentry_unused);
-  		dentry_stat.nr_unused++;
+		dentry_lru_add(dentry);
   	}
  	spin_unlock(&dentry->d_lock);
 	spin_unlock(&dcache_lock);
@@ -187,10 +248,7 @@ kill_it: {
 		/* If dentry was on d_lru list
 		 * delete it from there
 		 */
-  		if (!list_empty(&dentry->d_lru)) {
-  			list_del(&dentry->d_lru);
-  			dentry_stat.nr_unused--;
-  		}
+		dentry_lru_del_init(dentry);
   		list_del(&dentry->d_u.d_child);
 		dentry_stat.nr_dentry--;	/* For d_free, below */
 		/*drops the locks, at that point nobody can reach this dentry */
@@ -261,15 +319,15 @@ int d_invalidate(struct dentry * dentry)
 	return 0;
 }
 
-/* This should be called _only_ with dcache_lock held */
+/*
+ * This should be called _only_ with dcache_lock held.  Like __d_lookup,
+ * it leaves the dentry on the LRU for prune_dcache to take off, as d_lock
+ * isn't held to change d_lru.
+ */
 
 static inline struct dentry * __dget_locked(struct dentry *dentry)
 {
 	atomic_inc(&dentry->d_count);
-	if (!list_empty(&dentry->d_lru)) {
-		dentry_stat.nr_unused--;
-		list_del_init(&dentry->d_lru);
-	}
 	return dentry;
 }
 
@@ -379,125 +437,121 @@ static void prune_one_dentry(struct dentry * dentry)
 	spin_lock(&dcache_lock);
 }
 
-/**
- * prune_dcache - shrink the dcache
- * @count: number of entries to try and free
- * @sb: if given, ignore dentries for other superblocks
- *         which are being unmounted.
- *
- * Shrink the dcache. This is done when we need
- * more memory, or simply when we need to unmount
- * something (at which point we need to unuse
- * all dentries).
+/*
+ * Scan up to *count dentries from the tail of the LRU of @sb, freeing the
+ * unused ones.  With DCACHE_REFERENCED in @flags, the recently referenced
+ * dentries get one more go round the list instead.  *count is left with
+ * what wasn't scanned.
  *
- * This function may fail to free any resources if
- * all the dentries are in use.
+ * Called with dcache_lock held, which keeps the dentries on the LRU from
+ * being freed by anybody else.  The caller makes sure @sb isn't being
+ * unmounted under us.
  */
- 
-static void prune_dcache(int count, struct super_block *sb)
+static void __shrink_dcache_sb(struct super_block *sb, int *count, int flags)
 {
-	spin_lock(&dcache_lock);
-	for (; count ; count--) {
+	while (*count > 0) {
 		struct dentry *dentry;
-		struct list_head *tmp;
-		struct rw_semaphore *s_umount;
 
 		cond_resched_lock(&dcache_lock);
 
-		tmp = dentry_unused.prev;
-		if (sb) {
-			/* Try to find a dentry for this sb, but don't try
-			 * too hard, if they aren't near the tail they will
-			 * be moved down again soon
-			 */
-			int skip = count;
-			while (skip && tmp != &dentry_unused &&
-			    list_entry(tmp, struct dentry, d_lru)->d_sb != sb) {
-				skip--;
-				tmp = tmp->prev;
-			}
-		}
-		if (tmp == &dentry_unused)
+		spin_lock(&dcache_lru_lock);
+		if (list_empty(&sb->s_dentry_lru)) {
+			spin_unlock(&dcache_lru_lock);
 			break;
-		list_del_init(tmp);
-		prefetch(dentry_unused.prev);
- 		dentry_stat.nr_unused--;
-		dentry = list_entry(tmp, struct dentry, d_lru);
+		}
+		dentry = list_entry(sb->s_dentry_lru.prev, struct dentry, d_lru);
+		spin_unlock(&dcache_lru_lock);
 
- 		spin_lock(&dentry->d_lock);
+		/*
+		 * Only dput() can change its d_lru meanwhile, and only to add
+		 * it to the LRU: it is still on there.
+		 */
+		spin_lock(&dentry->d_lock);
+		(*count)--;
+		dentry_lru_del_init(dentry);
 		/*
 		 * We found an inuse dentry which was not removed from
-		 * dentry_unused because of laziness during lookup.  Do not free
-		 * it - just keep it off the dentry_unused list.
+		 * the LRU because of laziness during lookup.  Do not free
+		 * it - just keep it off the LRU list.
 		 */
- 		if (atomic_read(&dentry->d_count)) {
- 			spin_unlock(&dentry->d_lock);
+		if (atomic_read(&dentry->d_count)) {
+			spin_unlock(&dentry->d_lock);
 			continue;
 		}
 		/* If the dentry was recently referenced, don't free it. */
-		if (dentry->d_flags & DCACHE_REFERENCED) {
+		if ((flags & DCACHE_REFERENCED) &&
+		    (dentry->d_flags & DCACHE_REFERENCED)) {
 			dentry->d_flags &= ~DCACHE_REFERENCED;
- 			list_add(&dentry->d_lru, &dentry_unused);
- 			dentry_stat.nr_unused++;
- 			spin_unlock(&dentry->d_lock);
+			dentry_lru_add(dentry);
+			spin_unlock(&dentry->d_lock);
 			continue;
 		}
-		/*
-		 * If the dentry is not DCACHED_REFERENCED, it is time
-		 * to remove it from the dcache, provided the super block is
-		 * NULL (which means we are trying to reclaim memory)
-		 * or this dentry belongs to the same super block that
-		 * we want to shrink.
-		 */
-		/*
-		 * If this dentry is for "my" filesystem, then I can prune it
-		 * without taking the s_umount lock (I already hold it).
-		 */
-		if (sb && dentry->d_sb == sb) {
-			prune_one_dentry(dentry);
+		prune_one_dentry(dentry);
+	}
+}
+
+/**
+ * prune_dcache - shrink the dcache
+ * @count: number of entries to try and free
+ *
+ * Shrink the dcache when we need more memory, taking from the LRU of
+ * each superblock in proportion to the number of unused dentries on it.
+ *
+ * This function may fail to free any resources if
+ * all the dentries are in use.
+ */
+ 
+static void prune_dcache(int count)
+{
+	struct super_block *sb;
+	int unused = dentry_stat.nr_unused;
+	int prune_ratio;
+
+	if (unused <= 0 || count <= 0)
+		return;
+	if (count >= unused)
+		prune_ratio = 1;
+	else
+		prune_ratio = unused / count;
+
+	spin_lock(&sb_lock);
+restart:
+	list_for_each_entry(sb, &super_blocks, s_list) {
+		int w_count, scan;
+
+		if (sb->s_nr_dentry_unused <= 0)
 			continue;
-		}
+		sb->s_count++;
+		spin_unlock(&sb_lock);
+
+		w_count = scan = sb->s_nr_dentry_unused / prune_ratio + 1;
 		/*
-		 * ...otherwise we need to be sure this filesystem isn't being
-		 * unmounted, otherwise we could race with
-		 * generic_shutdown_super(), and end up holding a reference to
-		 * an inode while the filesystem is unmounted.
-		 * So we try to get s_umount, and make sure s_root isn't NULL.
-		 * (Take a local copy of s_umount to avoid a use-after-free of
-		 * `dentry').
+		 * We need to be sure this filesystem isn't being unmounted,
+		 * otherwise we could race with generic_shutdown_super(), and
+		 * end up holding a reference to an inode while the filesystem
+		 * is unmounted.  So we try to get s_umount, and make sure
+		 * s_root isn't NULL.
 		 */
-		s_umount = &dentry->d_sb->s_umount;
-		if (down_read_trylock(s_umount)) {
-			if (dentry->d_sb->s_root != NULL) {
-				prune_one_dentry(dentry);
-				up_read(s_umount);
-				continue;
+		if (down_read_trylock(&sb->s_umount)) {
+			if (sb->s_root) {
+				spin_lock(&dcache_lock);
+				__shrink_dcache_sb(sb, &w_count,
+						   DCACHE_REFERENCED);
+				spin_unlock(&dcache_lock);
 			}
-			up_read(s_umount);
+			up_read(&sb->s_umount);
 		}
-		spin_unlock(&dentry->d_lock);
-		/* Cannot remove the first dentry, and it isn't appropriate
-		 * to move it to the head of the list, so give up, and try
-		 * later
-		 */
-		break;
+		count -= scan - w_count;
+
+		spin_lock(&sb_lock);
+		if (__put_super_and_need_restart(sb) && count > 0)
+			goto restart;
+		if (count <= 0)
+			break;
 	}
-	spin_unlock(&dcache_lock);
+	spin_unlock(&sb_lock);
 }
 
-/*
- * Shrink the dcache for the specified super block.
- * This allows us to unmount a device without disturbing
- * the dcache for the other devices.
- *
- * This implementation makes just two traversals of the
- * unused list.  On the first pass we move the selected
- * dentries to the most recent end, and on the second
- * pass we free them.  The second pass must restart after
- * each dput(), but since the target dentries are all at
- * the end, it's really just a single traversal.
- */
-
 /**
  * shrink_dcache_sb - shrink dcache for a superblock
  * @sb: superblock
@@ -509,40 +563,10 @@ static void prune_dcache(int count, struct super_block *sb)
 
 void shrink_dcache_sb(struct super_block * sb)
 {
-	struct list_head *tmp, *next;
-	struct dentry *dentry;
+	int count = INT_MAX;
 
-	/*
-	 * Pass one ... move the dentries for the specified
-	 * superblock to the most recent end of the unused list.
-	 */
 	spin_lock(&dcache_lock);
-	list_for_each_safe(tmp, next, &dentry_unused) {
-		dentry = list_entry(tmp, struct dentry, d_lru);
-		if (dentry->d_sb != sb)
-			continue;
-		list_move(tmp, &dentry_unused);
-	}
-
-	/*
-	 * Pass two ... free the dentries for this superblock.
-	 */
-repeat:
-	list_for_each_safe(tmp, next, &dentry_unused) {
-		dentry = list_entry(tmp, struct dentry, d_lru);
-		if (dentry->d_sb != sb)
-			continue;
-		dentry_stat.nr_unused--;
-		list_del_init(tmp);
-		spin_lock(&dentry->d_lock);
-		if (atomic_read(&dentry->d_count)) {
-			spin_unlock(&dentry->d_lock);
-			continue;
-		}
-		prune_one_dentry(dentry);
-		cond_resched_lock(&dcache_lock);
-		goto repeat;
-	}
+	__shrink_dcache_sb(sb, &count, 0);
 	spin_unlock(&dcache_lock);
 }
 
@@ -627,19 +651,17 @@ resume:
 		struct dentry *dentry = list_entry(tmp, struct dentry, d_u.d_child);
 		next = tmp->next;
 
-		if (!list_empty(&dentry->d_lru)) {
-			dentry_stat.nr_unused--;
-			list_del_init(&dentry->d_lru);
-		}
+		spin_lock(&dentry->d_lock);
+		dentry_lru_del_init(dentry);
 		/* 
 		 * move only zero ref count dentries to the end 
 		 * of the unused list for prune_dcache
 		 */
 		if (!atomic_read(&dentry->d_count)) {
-			list_add_tail(&dentry->d_lru, &dentry_unused);
-			dentry_stat.nr_unused++;
+			dentry_lru_add_tail(dentry);
 			found++;
 		}
+		spin_unlock(&dentry->d_lock);
 
 		/*
 		 * We can return to the caller if we have found some (this
@@ -679,10 +701,14 @@ out:
  
 void shrink_dcache_parent(struct dentry * parent)
 {
+	struct super_block *sb = parent->d_sb;
 	int found;
 
-	while ((found = select_parent(parent)) != 0)
-		prune_dcache(found, parent->d_sb);
+	while ((found = select_parent(parent)) != 0) {
+		spin_lock(&dcache_lock);
+		__shrink_dcache_sb(sb, &found, 0);
+		spin_unlock(&dcache_lock);
+	}
 }
 
 /*
@@ -702,7 +728,7 @@ static int shrink_dcache_memory(int nr, gfp_t gfp_mask)
 	if (nr) {
 		if (!(gfp_mask & __GFP_FS))
 			return -1;
-		prune_dcache(nr, NULL);
+		prune_dcache(nr);
 	}
 	return (dentry_stat.nr_unused / 100) * sysctl_vfs_cache_pressure;
 }
@@ -745,6 +771,7 @@ struct dentry *d_alloc(struct dentry * parent, const struct qstr *name)
 	atomic_set(&dentry->d_count, 1);
 	dentry->d_flags = DCACHE_UNHASHED;//默认未hash 表示未插入到hash表中
 	spin_lock_init(&dentry->d_lock);
+	seqcount_init(&dentry->d_seq);
 	dentry->d_inode = NULL;
 	dentry->d_parent = NULL;
 	dentry->d_sb = NULL;
@@ -1033,9 +1060,9 @@ struct dentry *d_splice_alias(struct inode *inode, struct dentry *dentry)
  * rcu_read_lock() and rcu_read_unlock() are used to disable preemption while
  * lookup is going on.
  *
- * dentry_unused list is not updated even if lookup finds the required dentry
- * in there. It is updated in places such as prune_dcache, shrink_dcache_sb,
- * select_parent and __dget_locked. This laziness saves lookup from dcache_lock
+ * The LRU list is not updated even if lookup finds the required dentry
+ * in there. It is updated in places such as prune_dcache, shrink_dcache_sb
+ * and select_parent. This laziness saves lookup from dcache_lru_lock
  * acquisition.
  *
  * d_lookup() is protected against the concurrent renames in some unrelated
@@ -1119,6 +1146,59 @@ next:
  	return found;
 }
 
+/**
+ * __d_lookup_rcu - search for a dentry without locks or references
+ * @parent: parent dentry
+ * @name: qstr of name we wish to find
+ * @seqp: returns the d_seq of the dentry found
+ *
+ * This is __d_lookup for the lockless path walk, called under
+ * rcu_read_lock().  Nothing is taken on the dentry found: it, its name
+ * and its inode are only good for as long as read_seqcount_retry() on
+ * its d_seq with *@seqp says so.  A rename can make us miss the dentry,
+ * which the caller treats like a miss in the dcache.
+ *
+ * The name is compared a byte at a time, without d_lock, so that a
+ * concurrent d_move() can't send the comparison past the end of it; the
+ * parent must not have a ->d_compare(), which wouldn't expect that.
+ */
+struct dentry *__d_lookup_rcu(struct dentry *parent, struct qstr *name,
+			      unsigned *seqp)
+{
+	unsigned int len = name->len;
+	unsigned int hash = name->hash;
+	const unsigned char *str = name->name;
+	struct hlist_head *head = d_hash(parent, hash);
+	struct hlist_node *node;
+	struct dentry *dentry;
+
+	hlist_for_each_entry_rcu(dentry, node, head, d_hash) {
+		const unsigned char *dname;
+		unsigned seq;
+		unsigned int i;
+
+		if (dentry->d_name.hash != hash)
+			continue;
+		seq = read_seqcount_begin(&dentry->d_seq);
+		if (dentry->d_parent != parent)
+			continue;
+		if (d_unhashed(dentry))
+			continue;
+		if (dentry->d_name.len != len)
+			continue;
+		dname = dentry->d_name.name;
+		for (i = 0; i < len; i++)
+			if (dname[i] != str[i])
+				break;
+		if (i < len)
+			continue;
+
+		*seqp = seq;
+		return dentry;
+	}
+	return NULL;
+}
+
 /**
  * d_hash_and_lookup - hash the qstr then search for a dentry
  * @dir: Directory to search in
@@ -1350,6 +1430,8 @@ void d_move(struct dentry * dentry, struct dentry * target)
 		spin_lock(&dentry->d_lock);
 		spin_lock_nested(&target->d_lock, DENTRY_D_LOCK_NESTED);
 	}
+	write_seqcount_begin(&dentry->d_seq);
+	write_seqcount_begin(&target->d_seq);
 
 	/* Move the dentry to the target hash queue, if on different bucket */
 	if (dentry->d_flags & DCACHE_UNHASHED)
@@ -1385,6 +1467,8 @@ already_unhashed:
 	}
 
 	list_add(&dentry->d_u.d_child, &dentry->d_parent->d_subdirs);
+	write_seqcount_end(&target->d_seq);
+	write_seqcount_end(&dentry->d_seq);
 	spin_unlock(&target->d_lock);
 	fsnotify_d_move(dentry);
 	spin_unlock(&dentry->d_lock);
@@ -94,6 +94,12 @@
  *
  * The spinlock ordering is hence: dq_data_lock > dq_list_lock > i_lock
  *
+ * Space charged to a dquot well below its block limits does not take
+ * dq_data_lock: it goes to the per-cpu dq_space_delta counter, which is
+ * folded into dq_dqb.dqb_curspace under dq_data_lock whenever the space
+ * is looked at - before limits are checked, the dquot is written or
+ * released, or the usage is reported to or set from userspace.
+ *
  * Note that some things (eg. sb pointer, type, id) doesn't change during
  * the life of the dquot structure and so needn't to be protected by a lock
  *
@@ -289,6 +295,12 @@ static void wait_on_dquot(struct dquot *dquot)
 
 int dquot_mark_dquot_dirty(struct dquot *dquot)
 {
+	/* Pairs with the barrier of clear_dquot_dirty(): if the bit is still
+	 * set, the write to come sees what was charged before */
+	smp_mb();
+	if (test_bit(DQ_MOD_B, &dquot->dq_flags))
+		return 0;
+
 	spin_lock(&dq_list_lock);
 	if (!test_and_set_bit(DQ_MOD_B, &dquot->dq_flags))
 		list_add(&dquot->dq_dirty, &sb_dqopt(dquot->dq_sb)->
@@ -306,6 +318,15 @@ static inline int clear_dquot_dirty(struct dquot *dquot)
 	return 1;
 }
 
+/* Moves the space charged locklessly into dq_dqb, needs dq_data_lock */
+static void dquot_fold_space(struct dquot *dquot)
+{
+	percpu_counter_drain(&dquot->dq_space_delta,
+			     (s64 *)&dquot->dq_dqb.dqb_curspace);
+	if ((s64)dquot->dq_dqb.dqb_curspace < 0)
+		dquot->dq_dqb.dqb_curspace = 0;
+}
+
 void mark_info_dirty(struct super_block *sb, int type)
 {
 	set_bit(DQF_INFO_DIRTY_B, &sb_dqopt(sb)->info[type].dqi_flags);
@@ -366,6 +387,9 @@ int dquot_commit(struct dquot *dquot)
 	/* Inactive dquot can be only if there was error during read/init
 	 * => we have better not writing it */
 	if (test_bit(DQ_ACTIVE_B, &dquot->dq_flags)) {
+		spin_lock(&dq_data_lock);
+		dquot_fold_space(dquot);
+		spin_unlock(&dq_data_lock);
 		ret = dqopt->ops[dquot->dq_type]->commit_dqblk(dquot);
 		if (info_dirty(&dqopt->info[dquot->dq_type]))
 			ret2 = dqopt->ops[dquot->dq_type]->write_file_info(dquot->dq_sb, dquot->dq_type);
@@ -390,6 +414,9 @@ int dquot_release(struct dquot *dquot)
 	if (atomic_read(&dquot->dq_count) > 1)
 		goto out_dqlock;
 	mutex_lock(&dqopt->dqio_mutex);
+	spin_lock(&dq_data_lock);
+	dquot_fold_space(dquot);
+	spin_unlock(&dq_data_lock);
 	if (dqopt->ops[dquot->dq_type]->release_dqblk) {
 		ret = dqopt->ops[dquot->dq_type]->release_dqblk(dquot);
 		/* Write the info */
@@ -453,6 +480,7 @@ restart:
 		remove_dquot_hash(dquot);
 		remove_free_dquot(dquot);
 		remove_inuse(dquot);
+		percpu_counter_destroy(&dquot->dq_space_delta);
 		kmem_cache_free(dquot_cachep, dquot);
 	}
 	spin_unlock(&dq_list_lock);
@@ -517,6 +545,7 @@ static void prune_dqcache(int count)
 		remove_dquot_hash(dquot);
 		remove_free_dquot(dquot);
 		remove_inuse(dquot);
+		percpu_counter_destroy(&dquot->dq_space_delta);
 		kmem_cache_free(dquot_cachep, dquot);
 		count--;
 		head = free_dquots.prev;
@@ -611,6 +640,7 @@ static struct dquot *get_empty_dquot(struct super_block *sb, int type)
 	INIT_HLIST_NODE(&dquot->dq_hash);
 	INIT_LIST_HEAD(&dquot->dq_dirty);
 	init_waitqueue_head(&dquot->dq_wait_unused);
+	percpu_counter_init(&dquot->dq_space_delta, 0);
 	dquot->dq_sb = sb;
 	dquot->dq_type = type;
 	atomic_set(&dquot->dq_count, 1);
@@ -653,8 +683,10 @@ we_slept:
 		dqstats.cache_hits++;
 		dqstats.lookups++;
 		spin_unlock(&dq_list_lock);
-		if (empty)
+		if (empty) {
+			percpu_counter_destroy(&empty->dq_space_delta);
 			kmem_cache_free(dquot_cachep, empty);
+		}
 	}
 	/* Wait for dq_lock - after this we know that either dquot_release() is already
 	 * finished or it will be canceled due to dq_count > 1 test */
@@ -688,23 +720,28 @@ static int dqinit_needed(struct inode *inode, int type)
 /* This routine is guarded by dqonoff_mutex mutex */
 static void add_dquot_ref(struct super_block *sb, int type)
 {
-	struct list_head *p;
+	struct sb_file_list *fl;
+	struct file *filp;
+	int cpu;
 
+	for_each_possible_cpu(cpu) {
+		fl = per_cpu_ptr(sb->s_files, cpu);
 restart:
-	file_list_lock();
-	list_for_each(p, &sb->s_files) {
-		struct file *filp = list_entry(p, struct file, f_u.fu_list);
-		struct inode *inode = filp->f_dentry->d_inode;
-		if (filp->f_mode & FMODE_WRITE && dqinit_needed(inode, type)) {
-			struct dentry *dentry = dget(filp->f_dentry);
-			file_list_unlock();
-			sb->dq_op->initialize(inode, type);
-			dput(dentry);
-			/* As we may have blocked we had better restart... */
-			goto restart;
+		spin_lock(&fl->lock);
+		list_for_each_entry(filp, &fl->list, f_u.fu_list) {
+			struct inode *inode = filp->f_dentry->d_inode;
+			if (filp->f_mode & FMODE_WRITE &&
+			    dqinit_needed(inode, type)) {
+				struct dentry *dentry = dget(filp->f_dentry);
+				spin_unlock(&fl->lock);
+				sb->dq_op->initialize(inode, type);
+				dput(dentry);
+				/* As we may have blocked we had better restart... */
+				goto restart;
+			}
 		}
+		spin_unlock(&fl->lock);
 	}
-	file_list_unlock();
 }
 
 /* Return 0 if dqput() won't block (note that 1 doesn't necessarily mean blocking) */
@@ -790,6 +827,7 @@ static inline void dquot_decr_inodes(struct dquot *dquot, unsigned long number)
 
 static inline void dquot_decr_space(struct dquot *dquot, qsize_t number)
 {
+	dquot_fold_space(dquot);
 	if (dquot->dq_dqb.dqb_curspace > number)
 		dquot->dq_dqb.dqb_curspace -= number;
 	else
@@ -919,6 +957,7 @@ static int check_bdq(struct dquot *dquot, qsize_t space, int prealloc, char *war
 	if (space <= 0 || test_bit(DQ_FAKE_B, &dquot->dq_flags))
 		return QUOTA_OK;
 
+	dquot_fold_space(dquot);
 	if (dquot->dq_dqb.dqb_bhardlimit &&
 	   toqb(dquot->dq_dqb.dqb_curspace + space) > dquot->dq_dqb.dqb_bhardlimit &&
             !ignore_hardlimit(dquot)) {
@@ -1019,6 +1058,82 @@ int dquot_drop(struct inode *inode)
  * inode write go into the same transaction.
  */
 
+/*
+ * Largest charge taken without dq_data_lock.  Each cpu holds less than this
+ * in its part of dq_space_delta, and each may be about to add this much on
+ * top, so a dquot needs twice that per cpu of room below its limits.
+ */
+#define DQ_SPACE_BATCH	(256 << 10)
+
+/*
+ * Whether number bytes may be charged to (or, if !alloc, freed from) the
+ * dquot without looking at its limits under dq_data_lock.  Freeing is fine
+ * unless it may end a grace time; allocating, unless it may come near a
+ * limit.  Called with preemption disabled so that the charge follows
+ * before this cpu looks again.  On 32-bit SMP dqb_curspace can't be read
+ * without dq_data_lock, so everything goes the slow way there.
+ */
+static int dquot_space_fast(struct dquot *dquot, qsize_t number, int alloc)
+{
+#if BITS_PER_LONG == 64 || !defined(CONFIG_SMP)
+	struct mem_dqblk *dm = &dquot->dq_dqb;
+	__u32 limit;
+	s64 space;
+
+	if (number > DQ_SPACE_BATCH)
+		return 0;
+	if (!alloc)
+		return !dm->dqb_btime && !test_bit(DQ_BLKS_B, &dquot->dq_flags);
+	if (test_bit(DQ_FAKE_B, &dquot->dq_flags))
+		return 1;
+	limit = dm->dqb_bhardlimit;
+	if (dm->dqb_bsoftlimit && (!limit || dm->dqb_bsoftlimit < limit))
+		limit = dm->dqb_bsoftlimit;
+	if (!limit)
+		return 1;
+	/* See percpu_counter_drain() for the order */
+	space = percpu_counter_read(&dquot->dq_space_delta);
+	smp_rmb();
+	space += dm->dqb_curspace;
+	space += 2 * num_possible_cpus() * DQ_SPACE_BATCH + number;
+	return space <= ((s64)limit << QUOTABLOCK_BITS);
+#else
+	return 0;
+#endif
+}
+
+/*
+ * Charges or frees number bytes without dq_data_lock if all dquots of the
+ * inode are far enough from their limits.  Needs dqptr_sem.
+ */
+static int dquot_space_nolock(struct inode *inode, qsize_t number, int alloc)
+{
+	int cnt;
+
+	preempt_disable();
+	for (cnt = 0; cnt < MAXQUOTAS; cnt++) {
+		if (inode->i_dquot[cnt] == NODQUOT)
+			continue;
+		if (!dquot_space_fast(inode->i_dquot[cnt], number, alloc)) {
+			preempt_enable();
+			return 0;
+		}
+	}
+	for (cnt = 0; cnt < MAXQUOTAS; cnt++) {
+		if (inode->i_dquot[cnt] == NODQUOT)
+			continue;
+		__percpu_counter_mod(&inode->i_dquot[cnt]->dq_space_delta,
+				     alloc ? number : -(s32)number,
+				     DQ_SPACE_BATCH);
+	}
+	preempt_enable();
+	if (alloc)
+		inode_add_bytes(inode, number);
+	else
+		inode_sub_bytes(inode, number);
+	return 1;
+}
+
 /*
  * This operation can block, but only after everything is updated
  */
@@ -1042,6 +1157,10 @@ out_add:
 		up_read(&sb_dqopt(inode->i_sb)->dqptr_sem);
 		goto out_add;
 	}
+	if (dquot_space_nolock(inode, number, 1)) {
+		ret = QUOTA_OK;
+		goto mark_dirty;
+	}
 	spin_lock(&dq_data_lock);
 	for (cnt = 0; cnt < MAXQUOTAS; cnt++) {
 		if (inode->i_dquot[cnt] == NODQUOT)
@@ -1058,6 +1177,7 @@ out_add:
 	ret = QUOTA_OK;
 warn_put_all:
 	spin_unlock(&dq_data_lock);
+mark_dirty:
 	if (ret == QUOTA_OK)
 		/* Dirtify all the dquots - this can block when journalling */
 		for (cnt = 0; cnt < MAXQUOTAS; cnt++)
@@ -1133,6 +1253,8 @@ out_sub:
 		up_read(&sb_dqopt(inode->i_sb)->dqptr_sem);
 		goto out_sub;
 	}
+	if (dquot_space_nolock(inode, number, 0))
+		goto mark_dirty;
 	spin_lock(&dq_data_lock);
 	for (cnt = 0; cnt < MAXQUOTAS; cnt++) {
 		if (inode->i_dquot[cnt] == NODQUOT)
@@ -1141,6 +1263,7 @@ out_sub:
 	}
 	inode_sub_bytes(inode, number);
 	spin_unlock(&dq_data_lock);
+mark_dirty:
 	/* Dirtify all the dquots - this can block when journalling */
 	for (cnt = 0; cnt < MAXQUOTAS; cnt++)
 		if (inode->i_dquot[cnt])
@@ -1559,6 +1682,7 @@ static void do_get_dqblk(struct dquot *dquot, struct if_dqblk *di)
 	struct mem_dqblk *dm = &dquot->dq_dqb;
 
 	spin_lock(&dq_data_lock);
+	dquot_fold_space(dquot);
 	di->dqb_bhardlimit = dm->dqb_bhardlimit;
 	di->dqb_bsoftlimit = dm->dqb_bsoftlimit;
 	di->dqb_curspace = dm->dqb_curspace;
@@ -1593,6 +1717,7 @@ static void do_set_dqblk(struct dquot *dquot, struct if_dqblk *di)
 	int check_blim = 0, check_ilim = 0;
 
 	spin_lock(&dq_data_lock);
+	dquot_fold_space(dquot);
 	if (di->dqb_valid & QIF_SPACE) {
 		dm->dqb_curspace = di->dqb_curspace;
 		check_blim = 1;
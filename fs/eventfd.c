@@ -0,0 +1,234 @@
+/*
+ *  fs/eventfd.c
+ *
+ *  eventfd(): a 64 bit counter behind a file descriptor.
+ *
+ *  A write() adds to the counter and a read() returns it and resets it to
+ *  zero, blocking while it is zero.  The descriptor polls readable while
+ *  the counter is non-zero, so it takes the place of a pipe for waking
+ *  an event loop: one syscall and eight bytes per wakeup, and any number
+ *  of wakeups before the loop gets round to reading collapse into one.
+ *  The kernel signals one with eventfd_signal(), which AIO does when an
+ *  iocb that names one completes.
+ */
+
+#include <linux/file.h>
+#include <linux/poll.h>
+#include <linux/fs.h>
+#include <linux/anon_inodes.h>
+#include <linux/slab.h>
+#include <linux/sched.h>
+#include <linux/module.h>
+#include <linux/syscalls.h>
+#include <linux/eventfd.h>
+#include <asm/uaccess.h>
+
+struct eventfd_ctx {
+	wait_queue_head_t wqh;
+	/*
+	 * Never ULLONG_MAX, so that a reader seeing a non-zero count can
+	 * tell that the write it saw added at least one.  wqh.lock
+	 * protects it.
+	 */
+	__u64 count;
+};
+
+static const struct file_operations eventfd_fops;
+
+/**
+ * eventfd_signal - add to the counter of an eventfd
+ * @file: the eventfd, from eventfd_fget()
+ * @n: what to add
+ *
+ * Adds @n, or as much of it as fits without blocking, and wakes the
+ * readers.  May be called from interrupt context.  Returns what was
+ * added.
+ */
+int eventfd_signal(struct file *file, int n)
+{
+	struct eventfd_ctx *ctx = file->private_data;
+	unsigned long flags;
+
+	if (n < 0)
+		return -EINVAL;
+	spin_lock_irqsave(&ctx->wqh.lock, flags);
+	if (ULLONG_MAX - ctx->count <= n)
+		n = (int) (ULLONG_MAX - ctx->count - 1);
+	ctx->count += n;
+	if (waitqueue_active(&ctx->wqh))
+		wake_up_locked(&ctx->wqh);
+	spin_unlock_irqrestore(&ctx->wqh.lock, flags);
+
+	return n;
+}
+EXPORT_SYMBOL_GPL(eventfd_signal);
+
+/**
+ * eventfd_fget - take a reference to an eventfd
+ * @fd: its file descriptor
+ *
+ * Returns the file, or ERR_PTR(-EBADF) if @fd is not open, or
+ * ERR_PTR(-EINVAL) if it is not an eventfd.
+ */
+struct file *eventfd_fget(int fd)
+{
+	struct file *file;
+
+	file = fget(fd);
+	if (!file)
+		return ERR_PTR(-EBADF);
+	if (file->f_op != &eventfd_fops) {
+		fput(file);
+		return ERR_PTR(-EINVAL);
+	}
+	return file;
+}
+EXPORT_SYMBOL_GPL(eventfd_fget);
+
+static int eventfd_release(struct inode *inode, struct file *file)
+{
+	kfree(file->private_data);
+	return 0;
+}
+
+static unsigned int eventfd_poll(struct file *file, poll_table *wait)
+{
+	struct eventfd_ctx *ctx = file->private_data;
+	unsigned int events = 0;
+	unsigned long flags;
+
+	poll_wait(file, &ctx->wqh, wait);
+
+	spin_lock_irqsave(&ctx->wqh.lock, flags);
+	if (ctx->count > 0)
+		events |= POLLIN | POLLRDNORM;
+	if (ctx->count < ULLONG_MAX - 1)
+		events |= POLLOUT | POLLWRNORM;
+	spin_unlock_irqrestore(&ctx->wqh.lock, flags);
+
+	return events;
+}
+
+static ssize_t eventfd_read(struct file *file, char __user *buf, size_t count,
+			    loff_t *ppos)
+{
+	struct eventfd_ctx *ctx = file->private_data;
+	DECLARE_WAITQUEUE(wait, current);
+	ssize_t res;
+	__u64 ucnt = 0;
+
+	if (count < sizeof(ucnt))
+		return -EINVAL;
+
+	spin_lock_irq(&ctx->wqh.lock);
+	res = -EAGAIN;
+	if (ctx->count > 0)
+		res = sizeof(ucnt);
+	else if (!(file->f_flags & O_NONBLOCK)) {
+		__add_wait_queue(&ctx->wqh, &wait);
+		for (;;) {
+			set_current_state(TASK_INTERRUPTIBLE);
+			if (ctx->count > 0) {
+				res = sizeof(ucnt);
+				break;
+			}
+			if (signal_pending(current)) {
+				res = -ERESTARTSYS;
+				break;
+			}
+			spin_unlock_irq(&ctx->wqh.lock);
+			schedule();
+			spin_lock_irq(&ctx->wqh.lock);
+		}
+		__remove_wait_queue(&ctx->wqh, &wait);
+		__set_current_state(TASK_RUNNING);
+	}
+	if (res > 0) {
+		ucnt = ctx->count;
+		ctx->count = 0;
+		/* writers blocked on a full counter have room now */
+		if (waitqueue_active(&ctx->wqh))
+			wake_up_locked(&ctx->wqh);
+	}
+	spin_unlock_irq(&ctx->wqh.lock);
+
+	if (res > 0 && put_user(ucnt, (__u64 __user *) buf))
+		return -EFAULT;
+	return res;
+}
+
+static ssize_t eventfd_write(struct file *file, const char __user *buf,
+			     size_t count, loff_t *ppos)
+{
+	struct eventfd_ctx *ctx = file->private_data;
+	DECLARE_WAITQUEUE(wait, current);
+	ssize_t res;
+	__u64 ucnt;
+
+	if (count < sizeof(ucnt))
+		return -EINVAL;
+	if (copy_from_user(&ucnt, buf, sizeof(ucnt)))
+		return -EFAULT;
+	if (ucnt == ULLONG_MAX)
+		return -EINVAL;
+
+	spin_lock_irq(&ctx->wqh.lock);
+	res = -EAGAIN;
+	if (ULLONG_MAX - ctx->count > ucnt)
+		res = sizeof(ucnt);
+	else if (!(file->f_flags & O_NONBLOCK)) {
+		__add_wait_queue(&ctx->wqh, &wait);
+		for (;;) {
+			set_current_state(TASK_INTERRUPTIBLE);
+			if (ULLONG_MAX - ctx->count > ucnt) {
+				res = sizeof(ucnt);
+				break;
+			}
+			if (signal_pending(current)) {
+				res = -ERESTARTSYS;
+				break;
+			}
+			spin_unlock_irq(&ctx->wqh.lock);
+			schedule();
+			spin_lock_irq(&ctx->wqh.lock);
+		}
+		__remove_wait_queue(&ctx->wqh, &wait);
+		__set_current_state(TASK_RUNNING);
+	}
+	if (res > 0) {
+		ctx->count += ucnt;
+		if (waitqueue_active(&ctx->wqh))
+			wake_up_locked(&ctx->wqh);
+	}
+	spin_unlock_irq(&ctx->wqh.lock);
+
+	return res;
+}
+
+static const struct file_operations eventfd_fops = {
+	.release	= eventfd_release,
+	.poll		= eventfd_poll,
+	.read		= eventfd_read,
+	.write		= eventfd_write,
+};
+
+/**
+ * sys_eventfd - create an eventfd
+ * @count: the initial value of its counter
+ */
+asmlinkage long sys_eventfd(unsigned int count)
+{
+	struct eventfd_ctx *ctx;
+	int fd;
+
+	ctx = kmalloc(sizeof(*ctx), GFP_KERNEL);
+	if (!ctx)
+		return -ENOMEM;
+	init_waitqueue_head(&ctx->wqh);
+	ctx->count = count;
+
+	fd = anon_inode_getfd(&eventfd_fops, ctx, O_RDWR);
+	if (fd < 0)
+		kfree(ctx);
+	return fd;
+}
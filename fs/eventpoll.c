@@ -73,6 +73,11 @@
  * Events that require holding "epmutex" are very rare, while for
  * normal operations the epoll private "ep->sem" will guarantee
  * a greater scalability.
+ * The poll callback itself takes none of these. It pushes the item on
+ * the ready queue of the eventpoll with an atomic exchange, and takes
+ * the lock of "ep->wq" only to wake up tasks sleeping in epoll_wait(2).
+ * The queue is drained into the ready list under "ep->lock", by the
+ * only consumer that lock allows.
  */
 
 
@@ -97,7 +102,13 @@
 #endif /* #if DEBUG_EPI != 0 */
 
 /* Epoll private bits inside the event mask */
-#define EP_PRIVATE_BITS (EPOLLONESHOT | EPOLLET)
+#define EP_PRIVATE_BITS (EPOLLNOPOLL | EPOLLONESHOT | EPOLLET)
+
+/* Set in "struct epitem" rdqueued while the item is on the ready queue */
+#define EPI_RDQUEUED 0
+
+/* Events copied to user space at a time by ep_send_events() */
+#define EP_SEND_BATCH 16
 
 /* Maximum number of poll wake up nests we are allowing */
 #define EP_MAX_POLLWAKE_NESTS 4
@@ -111,6 +122,11 @@ struct epoll_filefd {
 	int fd;
 };
 
+/* Link of the lockless ready queue of an eventpoll */
+struct ep_rdnode {
+	struct ep_rdnode *next;
+};
+
 /*
  * Node that is linked into the "wake_task_list" member of the "struct poll_safewake".
  * It is used to keep track on all tasks that are currently inside the wake_up() code
@@ -161,6 +177,16 @@ struct eventpoll {
 
 	/* RB-Tree root used to store monitored fd structs */
 	struct rb_root rbr;
+
+	/*
+	 * Ready queue filled by ep_poll_callback() without locks. Items are
+	 * pushed at "rdtail" and taken off at "rdhead", under "lock", to be
+	 * moved to "rdllist". The queue is empty while "rdtail" points to
+	 * "rdstub".
+	 */
+	struct ep_rdnode *rdtail;
+	struct ep_rdnode *rdhead;
+	struct ep_rdnode rdstub;
 };
 
 /* Wait structure used by the poll hooks */
@@ -192,6 +218,10 @@ struct epitem {
 	/* List header used to link this structure to the eventpoll ready list */
 	struct list_head rdllink;
 
+	/* Link of the lockless ready queue, and its EPI_RDQUEUED bit */
+	struct ep_rdnode rdnode;
+	unsigned long rdqueued;
+
 	/* The file descriptor information this item refers to */
 	struct epoll_filefd ffd;
 
@@ -382,6 +412,99 @@ static inline struct epitem * ep_item_from_epqueue(poll_table *p)
 	return container_of(p, struct ep_pqueue, pt)->epi;
 }
 
+/*
+ * Append a node to the ready queue. Any number of callers may do this at
+ * once, without locks: the exchange orders them, then each one links its
+ * node behind the one it replaced as the tail.
+ */
+static inline void ep_rdqueue_push(struct eventpoll *ep, struct ep_rdnode *node)
+{
+	struct ep_rdnode *prev;
+
+	node->next = NULL;
+	prev = xchg(&ep->rdtail, node);
+	prev->next = node;
+}
+
+/*
+ * Tells us if anything was pushed on the ready queue and not drained yet.
+ * This is a lockless test, the result may be stale by the time it is used.
+ */
+static inline int ep_rdqueue_pending(struct eventpoll *ep)
+{
+	return ep->rdtail != &ep->rdstub;
+}
+
+/*
+ * Take the first item off the ready queue. It returns NULL when the queue
+ * is empty, and also when the link to the next item has not been set yet
+ * by the ep_rdqueue_push() in progress. Must be called with write IRQ lock
+ * on "ep->lock", since only one task at a time may take items off.
+ */
+static struct epitem *ep_rdqueue_pop(struct eventpoll *ep)
+{
+	struct ep_rdnode *head = ep->rdhead, *next = head->next;
+
+	smp_read_barrier_depends();
+	if (head == &ep->rdstub) {
+		if (!next)
+			return NULL;
+		ep->rdhead = head = next;
+		next = next->next;
+		smp_read_barrier_depends();
+	}
+	if (!next) {
+		/*
+		 * The last node cannot be taken off before another one is
+		 * behind it, so push back the stub after it.
+		 */
+		if (head != ep->rdtail)
+			return NULL;
+		ep_rdqueue_push(ep, &ep->rdstub);
+		next = head->next;
+		smp_read_barrier_depends();
+		if (!next)
+			return NULL;
+	}
+	ep->rdhead = next;
+
+	return container_of(head, struct epitem, rdnode);
+}
+
+/*
+ * Move the items of the ready queue to the ready list. This function must
+ * be called with write IRQ lock on "ep->lock".
+ */
+static void ep_rdqueue_drain(struct eventpoll *ep)
+{
+	struct epitem *epi;
+
+	while ((epi = ep_rdqueue_pop(ep)) != NULL) {
+		/* The next wake up can queue it again from now on */
+		smp_mb__before_clear_bit();
+		clear_bit(EPI_RDQUEUED, &epi->rdqueued);
+
+		if (!ep_is_linked(&epi->rdllink))
+			list_add_tail(&epi->rdllink, &ep->rdllist);
+	}
+}
+
+/*
+ * Wait for the item to be off the ready queue, before it is freed. The poll
+ * callbacks of the item must be unregistered already, so only the pushes of
+ * other items still in progress may delay it, and only for a few instructions.
+ * This function must be called with write IRQ lock on "ep->lock".
+ */
+static void ep_rdqueue_flush_item(struct eventpoll *ep, struct epitem *epi)
+{
+	for (;;) {
+		ep_rdqueue_drain(ep);
+		if (!test_bit(EPI_RDQUEUED, &epi->rdqueued))
+			break;
+		cpu_relax();
+	}
+}
+
 /* Tells if the epoll_ctl(2) operation needs an event copy from userspace */
 static inline int ep_op_hash_event(int op)
 {
@@ -787,6 +910,8 @@ static int ep_alloc(struct eventpoll **pep)
 	init_waitqueue_head(&ep->poll_wait);
 	INIT_LIST_HEAD(&ep->rdllist);
 	ep->rbr = RB_ROOT;
+	ep->rdtail = ep->rdhead = &ep->rdstub;
+	ep->rdstub.next = NULL;
 
 	*pep = ep;
 
@@ -962,6 +1087,7 @@ static int ep_insert(struct eventpoll *ep, struct epoll_event *event,
 	INIT_LIST_HEAD(&epi->fllink);
 	INIT_LIST_HEAD(&epi->txlink);
 	INIT_LIST_HEAD(&epi->pwqlist);
+	epi->rdqueued = 0;
 	epi->ep = ep;
 	ep_set_ffd(&epi->ffd, tfile, fd);
 	epi->event = *event;
@@ -1004,7 +1130,7 @@ static int ep_insert(struct eventpoll *ep, struct epoll_event *event,
 
 		/* Notify waiting tasks that events are available */
 		if (waitqueue_active(&ep->wq))
-			__wake_up_locked(&ep->wq, TASK_UNINTERRUPTIBLE | TASK_INTERRUPTIBLE);
+			wake_up(&ep->wq);
 		if (waitqueue_active(&ep->poll_wait))
 			pwake++;
 	}
@@ -1028,6 +1154,7 @@ eexit_2:
 	 * allocated wait queue.
 	 */
 	write_lock_irqsave(&ep->lock, flags);
+	ep_rdqueue_flush_item(ep, epi);
 	if (ep_is_linked(&epi->rdllink))
 		ep_list_del(&epi->rdllink);
 	write_unlock_irqrestore(&ep->lock, flags);
@@ -1083,8 +1210,7 @@ static int ep_modify(struct eventpoll *ep, struct epitem *epi, struct epoll_even
 
 				/* Notify waiting tasks that events are available */
 				if (waitqueue_active(&ep->wq))
-					__wake_up_locked(&ep->wq, TASK_UNINTERRUPTIBLE |
-							 TASK_INTERRUPTIBLE);
+					wake_up(&ep->wq);
 				if (waitqueue_active(&ep->poll_wait))
 					pwake++;
 			}
@@ -1159,8 +1285,10 @@ static int ep_unlink(struct eventpoll *ep, struct epitem *epi)
 
 	/*
 	 * If the item we are going to remove is inside the ready file descriptors
-	 * we want to remove it from this list to avoid stale events.
+	 * we want to remove it from this list to avoid stale events. It must be
+	 * off the ready queue first, ep_remove() took it off the wait queues.
 	 */
+	ep_rdqueue_flush_item(ep, epi);
 	if (ep_is_linked(&epi->rdllink))
 		ep_list_del(&epi->rdllink);
 
@@ -1230,16 +1358,12 @@ eexit_1:
  */
 static int ep_poll_callback(wait_queue_t *wait, unsigned mode, int sync, void *key)
 {
-	int pwake = 0;
-	unsigned long flags;
 	struct epitem *epi = ep_item_from_wait(wait);
 	struct eventpoll *ep = epi->ep;
 
 	DNPRINTK(3, (KERN_INFO "[%p] eventpoll: poll_callback(%p) epi=%p ep=%p\n",
 		     current, epi->ffd.file, epi, ep));
 
-	write_lock_irqsave(&ep->lock, flags);
-
 	/*
 	 * If the event mask does not contain any poll(2) event, we consider the
 	 * descriptor to be disabled. This condition is likely the effect of the
@@ -1247,30 +1371,26 @@ static int ep_poll_callback(wait_queue_t *wait, unsigned mode, int sync, void *k
 	 * until the next EPOLL_CTL_MOD will be issued.
 	 */
 	if (!(epi->event.events & ~EP_PRIVATE_BITS))
-		goto is_disabled;
-
-	/* If this file is already in the ready list we exit soon */
-	if (ep_is_linked(&epi->rdllink))
-		goto is_linked;
+		return 1;
 
-	list_add_tail(&epi->rdllink, &ep->rdllist);
+	/*
+	 * If this file is already on the ready queue we leave it there. Else
+	 * we push it, and the exchange in there orders the push before the
+	 * wait queue tests below, against the tests epoll_wait(2) does after
+	 * having queued itself.
+	 */
+	if (!test_and_set_bit(EPI_RDQUEUED, &epi->rdqueued))
+		ep_rdqueue_push(ep, &epi->rdnode);
+	else
+		smp_mb();
 
-is_linked:
 	/*
 	 * Wake up ( if active ) both the eventpoll wait list and the ->poll()
 	 * wait list.
 	 */
 	if (waitqueue_active(&ep->wq))
-		__wake_up_locked(&ep->wq, TASK_UNINTERRUPTIBLE |
-				 TASK_INTERRUPTIBLE);
+		wake_up(&ep->wq);
 	if (waitqueue_active(&ep->poll_wait))
-		pwake++;
-
-is_disabled:
-	write_unlock_irqrestore(&ep->lock, flags);
-
-	/* We have to call this outside the lock */
-	if (pwake)
 		ep_poll_safewake(&psw, &ep->poll_wait);
 
 	return 1;
@@ -1302,7 +1422,7 @@ static unsigned int ep_eventpoll_poll(struct file *file, poll_table *wait)
 
 	/* Check our condition */
 	read_lock_irqsave(&ep->lock, flags);
-	if (!list_empty(&ep->rdllist))
+	if (!list_empty(&ep->rdllist) || ep_rdqueue_pending(ep))
 		pollflags = POLLIN | POLLRDNORM;
 	read_unlock_irqrestore(&ep->lock, flags);
 
@@ -1324,6 +1444,9 @@ static int ep_collect_ready_items(struct eventpoll *ep, struct list_head *txlist
 
 	write_lock_irqsave(&ep->lock, flags);
 
+	/* Pick up what the poll callbacks queued meanwhile */
+	ep_rdqueue_drain(ep);
+
 	for (nepi = 0, lnk = lsthead->next; lnk != lsthead && nepi < maxevents;) {
 		epi = list_entry(lnk, struct epitem, rdllink);
 
@@ -1358,15 +1481,17 @@ static int ep_collect_ready_items(struct eventpoll *ep, struct list_head *txlist
 /*
  * This function is called without holding the "ep->lock" since the call to
  * __copy_to_user() might sleep, and also f_op->poll() might reenable the IRQ
- * because of the way poll() is traditionally implemented in Linux.
+ * because of the way poll() is traditionally implemented in Linux. The events
+ * are gathered on the stack and copied to user space EP_SEND_BATCH at a time.
  */
 static int ep_send_events(struct eventpoll *ep, struct list_head *txlist,
 			  struct epoll_event __user *events)
 {
-	int eventcnt = 0;
+	int eventcnt = 0, nbatch = 0;
 	unsigned int revents;
 	struct list_head *lnk;
 	struct epitem *epi;
+	struct epoll_event batch[EP_SEND_BATCH];
 
 	/*
 	 * We can loop without lock because this is a task private list.
@@ -1381,8 +1506,13 @@ static int ep_send_events(struct eventpoll *ep, struct list_head *txlist,
 		 * Get the ready file event set. We can safely use the file
 		 * because we are holding the "sem" in read and this will
 		 * guarantee that both the file and the item will not vanish.
+		 * An EPOLLNOPOLL item is not polled, the wake up is taken as
+		 * the report of all the events it waits for.
 		 */
-		revents = epi->ffd.file->f_op->poll(epi->ffd.file, NULL);
+		if (epi->event.events & EPOLLNOPOLL)
+			revents = epi->event.events & ~EP_PRIVATE_BITS;
+		else
+			revents = epi->ffd.file->f_op->poll(epi->ffd.file, NULL);
 
 		/*
 		 * Set the return event set for the current file descriptor.
@@ -1392,16 +1522,24 @@ static int ep_send_events(struct eventpoll *ep, struct list_head *txlist,
 		epi->revents = revents & epi->event.events;
 
 		if (epi->revents) {
-			if (__put_user(epi->revents,
-				       &events[eventcnt].events) ||
-			    __put_user(epi->event.data,
-				       &events[eventcnt].data))
-				return -EFAULT;
+			batch[nbatch].events = epi->revents;
+			batch[nbatch].data = epi->event.data;
 			if (epi->event.events & EPOLLONESHOT)
 				epi->event.events &= EP_PRIVATE_BITS;
 			eventcnt++;
+
+			if (++nbatch == EP_SEND_BATCH) {
+				if (__copy_to_user(&events[eventcnt - nbatch],
+						   batch, sizeof(batch)))
+					return -EFAULT;
+				nbatch = 0;
+			}
 		}
 	}
+	if (nbatch && __copy_to_user(&events[eventcnt - nbatch], batch,
+				     nbatch * sizeof(struct epoll_event)))
+		return -EFAULT;
+
 	return eventcnt;
 }
 
@@ -1433,7 +1571,8 @@ static void ep_reinject_items(struct eventpoll *ep, struct list_head *txlist)
 		 * item is set to have an Edge Triggered behaviour, we don't have
 		 * to push it back either.
 		 */
-		if (ep_rb_linked(&epi->rbn) && !(epi->event.events & EPOLLET) &&
+		if (ep_rb_linked(&epi->rbn) &&
+		    !(epi->event.events & (EPOLLET | EPOLLNOPOLL)) &&
 		    (epi->revents & epi->event.events) && !ep_is_linked(&epi->rdllink)) {
 			list_add_tail(&epi->rdllink, &ep->rdllist);
 			ricnt++;
@@ -1446,8 +1585,7 @@ static void ep_reinject_items(struct eventpoll *ep, struct list_head *txlist)
 		 * wait list.
 		 */
 		if (waitqueue_active(&ep->wq))
-			__wake_up_locked(&ep->wq, TASK_UNINTERRUPTIBLE |
-					 TASK_INTERRUPTIBLE);
+			wake_up(&ep->wq);
 		if (waitqueue_active(&ep->poll_wait))
 			pwake++;
 	}
@@ -1461,15 +1599,19 @@ static void ep_reinject_items(struct eventpoll *ep, struct list_head *txlist)
 
 
 /*
- * Perform the transfer of events to user space.
+ * Perform the transfer of events to user space. Items found with no events
+ * leave room for more, so the ready list is harvested again, under the same
+ * hold of "sem", until either "maxevents" are sent or no ready item is left.
+ * The items sent stay linked to "donelist" until the end, so none of them
+ * is collected twice.
  */
 static int ep_events_transfer(struct eventpoll *ep,
 			      struct epoll_event __user *events, int maxevents)
 {
-	int eventcnt = 0;
-	struct list_head txlist;
+	int eventcnt = 0, res;
+	struct list_head txlist, donelist;
 
-	INIT_LIST_HEAD(&txlist);
+	INIT_LIST_HEAD(&donelist);
 
 	/*
 	 * We need to lock this because we could be hit by
@@ -1477,15 +1619,27 @@ static int ep_events_transfer(struct eventpoll *ep,
 	 */
 	down_read(&ep->sem);
 
-	/* Collect/extract ready items */
-	if (ep_collect_ready_items(ep, &txlist, maxevents) > 0) {
-		/* Build result set in userspace */
-		eventcnt = ep_send_events(ep, &txlist, events);
+	while (eventcnt < maxevents) {
+		INIT_LIST_HEAD(&txlist);
+
+		/* Collect/extract ready items */
+		if (ep_collect_ready_items(ep, &txlist, maxevents - eventcnt) <= 0)
+			break;
 
-		/* Reinject ready items into the ready list */
-		ep_reinject_items(ep, &txlist);
+		/* Build result set in userspace */
+		res = ep_send_events(ep, &txlist, events + eventcnt);
+		list_splice(&txlist, &donelist);
+		if (res < 0) {
+			eventcnt = res;
+			break;
+		}
+		eventcnt += res;
 	}
 
+	/* Reinject ready items into the ready list */
+	if (!list_empty(&donelist))
+		ep_reinject_items(ep, &donelist);
+
 	up_read(&ep->sem);
 
 	return eventcnt;
@@ -1512,14 +1666,16 @@ retry:
 	write_lock_irqsave(&ep->lock, flags);
 
 	res = 0;
-	if (list_empty(&ep->rdllist)) {
+	if (list_empty(&ep->rdllist) && !ep_rdqueue_pending(ep)) {
 		/*
 		 * We don't have any available event to return to the caller.
 		 * We need to sleep here, and we will be wake up by
-		 * ep_poll_callback() when events will become available.
+		 * ep_poll_callback() when events will become available. The
+		 * callback does not take "ep->lock", so "ep->wq" is handled
+		 * under its own lock.
 		 */
 		init_waitqueue_entry(&wait, current);
-		__add_wait_queue(&ep->wq, &wait);
+		add_wait_queue(&ep->wq, &wait);
 
 		for (;;) {
 			/*
@@ -1528,7 +1684,8 @@ retry:
 			 * to TASK_INTERRUPTIBLE before doing the checks.
 			 */
 			set_current_state(TASK_INTERRUPTIBLE);
-			if (!list_empty(&ep->rdllist) || !jtimeout)
+			if (!list_empty(&ep->rdllist) || ep_rdqueue_pending(ep) ||
+			    !jtimeout)
 				break;
 			if (signal_pending(current)) {
 				res = -EINTR;
@@ -1539,13 +1696,13 @@ retry:
 			jtimeout = schedule_timeout(jtimeout);
 			write_lock_irqsave(&ep->lock, flags);
 		}
-		__remove_wait_queue(&ep->wq, &wait);
+		remove_wait_queue(&ep->wq, &wait);
 
 		set_current_state(TASK_RUNNING);
 	}
 
 	/* Is it worth to try to dig for events ? */
-	eavail = !list_empty(&ep->rdllist);
+	eavail = !list_empty(&ep->rdllist) || ep_rdqueue_pending(ep);
 
 	write_unlock_irqrestore(&ep->lock, flags);
 
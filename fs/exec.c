@@ -321,10 +321,10 @@ void install_arg_page(struct vm_area_struct *vma,
 		goto out;
 	}
 	inc_mm_counter(mm, anon_rss);
-	lru_cache_add_active(page);
 	set_pte_at(mm, address, pte, pte_mkdirty(pte_mkwrite(mk_pte(
 					page, vma->vm_page_prot))));
 	page_add_new_anon_rmap(page, vma, address);
+	lru_cache_add_active(page);
 	pte_unmap_unlock(pte, ptl);
 
 	/* no need for flush_tlb */
@@ -336,6 +336,13 @@ out:
 
 #define EXTRA_STACK_VM_PAGES	20	/* random */
 
+/*
+ * Stack pages below the strings to map at exec: the ELF tables and the
+ * first call frames of the new program go there straight away, and
+ * would otherwise be faulted in one at a time.
+ */
+#define EXEC_STACK_POPULATE_PAGES	4
+
 int setup_arg_pages(struct linux_binprm *bprm,
 		    unsigned long stack_top,
 		    int executable_stack)
@@ -447,6 +454,21 @@ int setup_arg_pages(struct linux_binprm *bprm,
 		}
 		stack_base += PAGE_SIZE;
 	}
+
+#ifndef CONFIG_STACK_GROWSUP
+	stack_base = bprm->p & PAGE_MASK;
+	for (i = 0; i < EXEC_STACK_POPULATE_PAGES; i++) {
+		struct page *page;
+
+		stack_base -= PAGE_SIZE;
+		if (stack_base < mpnt->vm_start)
+			break;
+		page = alloc_zeroed_user_highpage(mpnt, stack_base);
+		if (!page)
+			break;
+		install_arg_page(mpnt, page, stack_base);
+	}
+#endif
 	up_write(&mm->mmap_sem);
 	
 	return 0;
@@ -536,6 +558,7 @@ static int exec_mmap(struct mm_struct *mm)
 	mm_release(tsk, old_mm);
 
 	if (old_mm) {
+		sync_mm_rss(tsk, old_mm);
 		/*
 		 * Make sure that if there is a core dump in progress
 		 * for the old mm, we get out and die instead of going
@@ -19,6 +19,7 @@
 #include <linux/ext3_jbd.h>
 #include <linux/quotaops.h>
 #include <linux/buffer_head.h>
+#include <linux/crc16.h>
 
 /*
  * balloc.c contains the blocks allocation and deallocation routines
@@ -73,6 +74,92 @@ struct ext3_group_desc * ext3_get_group_desc(struct super_block * sb,
 	return desc + offset;
 }
 
+/**
+ * ext3_group_desc_csum - checksum of a group descriptor
+ * @sbi: the filesystem
+ * @group: the group of @gdp
+ * @gdp: the descriptor
+ *
+ * The checksum covers the filesystem's uuid, the group number and the
+ * descriptor up to bg_checksum, so that a descriptor written to the wrong
+ * place or left over from an earlier mkfs does not pass.  It is 0 when
+ * the filesystem does not have the gdt_csum feature.  Whoever changes a
+ * descriptor updates it under sb_bgl_lock().
+ */
+__le16 ext3_group_desc_csum(struct ext3_sb_info *sbi, __u32 block_group,
+			    struct ext3_group_desc *gdp)
+{
+	__le32 le_group = cpu_to_le32(block_group);
+	u16 crc;
+
+	if (!(sbi->s_es->s_feature_ro_compat &
+	      cpu_to_le32(EXT3_FEATURE_RO_COMPAT_GDT_CSUM)))
+		return 0;
+
+	crc = crc16(~0, sbi->s_es->s_uuid, sizeof(sbi->s_es->s_uuid));
+	crc = crc16(crc, (__u8 *)&le_group, sizeof(le_group));
+	crc = crc16(crc, (__u8 *)gdp, offsetof(struct ext3_group_desc,
+					       bg_checksum));
+	return cpu_to_le16(crc);
+}
+
+int ext3_group_desc_csum_verify(struct ext3_sb_info *sbi, __u32 block_group,
+				struct ext3_group_desc *gdp)
+{
+	if (!(sbi->s_es->s_feature_ro_compat &
+	      cpu_to_le32(EXT3_FEATURE_RO_COMPAT_GDT_CSUM)))
+		return 1;
+	return gdp->bg_checksum == ext3_group_desc_csum(sbi, block_group, gdp);
+}
+
+/*
+ * The block bitmap of a group which was never allocated from: the
+ * superblock and descriptor table backups, the bitmaps and the inode table
+ * are in use, the rest of the group is free and the bits past the end of a
+ * short last group are set.
+ */
+static void ext3_init_block_bitmap(struct super_block *sb,
+			struct buffer_head *bh, unsigned int block_group,
+			struct ext3_group_desc *desc)
+{
+	struct ext3_sb_info *sbi = EXT3_SB(sb);
+	ext3_fsblk_t start = ext3_group_first_block_no(sb, block_group);
+	unsigned long group_blocks = EXT3_BLOCKS_PER_GROUP(sb);
+	unsigned long first_meta_bg = le32_to_cpu(sbi->s_es->s_first_meta_bg);
+	unsigned long bit, bit_max;
+	ext3_fsblk_t blk;
+
+	if (block_group == sbi->s_groups_count - 1)
+		group_blocks = le32_to_cpu(sbi->s_es->s_blocks_count) - start;
+
+	bit_max = ext3_bg_has_super(sb, block_group);
+	if (!EXT3_HAS_INCOMPAT_FEATURE(sb, EXT3_FEATURE_INCOMPAT_META_BG) ||
+	    block_group / EXT3_DESC_PER_BLOCK(sb) < first_meta_bg) {
+		if (bit_max)
+			bit_max += ext3_bg_num_gdb(sb, block_group) +
+				le16_to_cpu(sbi->s_es->s_reserved_gdt_blocks);
+	} else
+		bit_max += ext3_bg_num_gdb(sb, block_group);
+
+	memset(bh->b_data, 0, sb->s_blocksize);
+	for (bit = 0; bit < bit_max; bit++)
+		ext3_set_bit(bit, bh->b_data);
+
+	blk = le32_to_cpu(desc->bg_block_bitmap);
+	if (in_range(blk, start, group_blocks))
+		ext3_set_bit(blk - start, bh->b_data);
+	blk = le32_to_cpu(desc->bg_inode_bitmap);
+	if (in_range(blk, start, group_blocks))
+		ext3_set_bit(blk - start, bh->b_data);
+	blk = le32_to_cpu(desc->bg_inode_table);
+	for (bit = 0; bit < sbi->s_itb_per_group; bit++)
+		if (in_range(blk + bit, start, group_blocks))
+			ext3_set_bit(blk + bit - start, bh->b_data);
+
+	for (bit = group_blocks; bit < sb->s_blocksize * 8; bit++)
+		ext3_set_bit(bit, bh->b_data);
+}
+
 /*
  * Read the bitmap for a given block_group, reading into the specified 
  * slot in the superblock's bitmap cache.
@@ -88,6 +175,21 @@ read_block_bitmap(struct super_block *sb, unsigned int block_group)
 	desc = ext3_get_group_desc (sb, block_group, NULL);
 	if (!desc)
 		goto error_out;
+	if (desc->bg_flags & cpu_to_le16(EXT3_BG_BLOCK_UNINIT) &&
+	    EXT3_HAS_RO_COMPAT_FEATURE(sb, EXT3_FEATURE_RO_COMPAT_GDT_CSUM)) {
+		/* nothing on disk to read, the bitmap follows from the layout */
+		bh = sb_getblk(sb, le32_to_cpu(desc->bg_block_bitmap));
+		if (bh && !buffer_uptodate(bh)) {
+			lock_buffer(bh);
+			if (!buffer_uptodate(bh)) {
+				ext3_init_block_bitmap(sb, bh, block_group,
+						       desc);
+				set_buffer_uptodate(bh);
+			}
+			unlock_buffer(bh);
+		}
+		return bh;
+	}
 	bh = sb_bread(sb, le32_to_cpu(desc->bg_block_bitmap));
 	if (!bh)
 		ext3_error (sb, "read_block_bitmap",
@@ -462,9 +564,11 @@ do_more:
 	jbd_unlock_bh_state(bitmap_bh);
 
 	spin_lock(sb_bgl_lock(sbi, block_group));
+	desc->bg_flags &= cpu_to_le16(~EXT3_BG_BLOCK_UNINIT);
 	desc->bg_free_blocks_count =
 		cpu_to_le16(le16_to_cpu(desc->bg_free_blocks_count) +
 			group_freed);
+	desc->bg_checksum = ext3_group_desc_csum(sbi, block_group, desc);
 	spin_unlock(sb_bgl_lock(sbi, block_group));
 	percpu_counter_mod(&sbi->s_freeblocks_counter, count);
 
@@ -1161,20 +1265,67 @@ out:
 	return ret;
 }
 
-static int ext3_has_free_blocks(struct ext3_sb_info *sbi)
+/* May the current task use the blocks reserved for root? */
+static int ext3_may_use_root_blocks(struct ext3_sb_info *sbi)
 {
-	ext3_fsblk_t free_blocks, root_blocks;
+	return capable(CAP_SYS_RESOURCE) || sbi->s_resuid == current->fsuid ||
+		(sbi->s_resgid != 0 && in_group_p (sbi->s_resgid));
+}
+
+/*
+ * The blocks claimed for delayed allocation are not free to other
+ * allocations: @claimed says the caller is allocating those very blocks.
+ */
+static int ext3_has_free_blocks(struct ext3_sb_info *sbi, int claimed)
+{
+	ext3_fsblk_t free_blocks, dirty_blocks, root_blocks;
 
 	free_blocks = percpu_counter_read_positive(&sbi->s_freeblocks_counter);
+	if (!claimed) {
+		dirty_blocks =
+		    percpu_counter_read_positive(&sbi->s_dirtyblocks_counter);
+		free_blocks -= min(free_blocks, dirty_blocks);
+	}
 	root_blocks = le32_to_cpu(sbi->s_es->s_r_blocks_count);
-	if (free_blocks < root_blocks + 1 && !capable(CAP_SYS_RESOURCE) &&
-		sbi->s_resuid != current->fsuid &&
-		(sbi->s_resgid == 0 || !in_group_p (sbi->s_resgid))) {
+	if (free_blocks < root_blocks + 1 && !ext3_may_use_root_blocks(sbi))
 		return 0;
-	}
 	return 1;
 }
 
+#ifdef CONFIG_SMP
+#define EXT3_FREEBLOCKS_SLACK	(4 * num_online_cpus() * FBC_BATCH)
+#else
+#define EXT3_FREEBLOCKS_SLACK	0
+#endif
+
+/**
+ * ext3_claim_free_blocks - set blocks aside for delayed allocation
+ * @sbi: the filesystem
+ * @nblocks: how many
+ *
+ * Returns -ENOSPC if they are not free.  The claim is dropped from
+ * s_dirtyblocks_counter once the blocks are allocated, or given up.
+ */
+int ext3_claim_free_blocks(struct ext3_sb_info *sbi, unsigned long nblocks)
+{
+	s64 free_blocks, dirty_blocks, root_blocks = 0;
+
+	free_blocks = percpu_counter_read_positive(&sbi->s_freeblocks_counter);
+	dirty_blocks = percpu_counter_read_positive(&sbi->s_dirtyblocks_counter);
+	/* the per-cpu counters drift: add them up once it gets close */
+	if (free_blocks - dirty_blocks < nblocks + EXT3_FREEBLOCKS_SLACK) {
+		free_blocks = percpu_counter_sum(&sbi->s_freeblocks_counter);
+		dirty_blocks = percpu_counter_sum(&sbi->s_dirtyblocks_counter);
+	}
+	if (!ext3_may_use_root_blocks(sbi))
+		root_blocks = le32_to_cpu(sbi->s_es->s_r_blocks_count);
+	if (free_blocks < dirty_blocks + root_blocks + nblocks)
+		return -ENOSPC;
+
+	percpu_counter_mod(&sbi->s_dirtyblocks_counter, nblocks);
+	return 0;
+}
+
 /*
  * ext3_should_retry_alloc() is called when ENOSPC is returned, and if
  * it is profitable to retry the operation, this function will wait
@@ -1183,7 +1334,7 @@ static int ext3_has_free_blocks(struct ext3_sb_info *sbi)
  */
 int ext3_should_retry_alloc(struct super_block *sb, int *retries)
 {
-	if (!ext3_has_free_blocks(EXT3_SB(sb)) || (*retries)++ > 3)
+	if (!ext3_has_free_blocks(EXT3_SB(sb), 0) || (*retries)++ > 3)
 		return 0;
 
 	jbd_debug(1, "%s: retrying operation after ENOSPC\n", sb->s_id);
@@ -1256,7 +1407,7 @@ ext3_fsblk_t ext3_new_blocks(handle_t *handle, struct inode *inode,
 	if (block_i && ((windowsz = block_i->rsv_window_node.rsv_goal_size) > 0))
 		my_rsv = &block_i->rsv_window_node;
 
-	if (!ext3_has_free_blocks(sbi)) {
+	if (!ext3_has_free_blocks(sbi, EXT3_I(inode)->i_da_allocating)) {
 		*errp = -ENOSPC;
 		goto out;
 	}
@@ -1427,8 +1578,10 @@ allocated:
 			ret_block, goal_hits, goal_attempts);
 
 	spin_lock(sb_bgl_lock(sbi, group_no));
+	gdp->bg_flags &= cpu_to_le16(~EXT3_BG_BLOCK_UNINIT);
 	gdp->bg_free_blocks_count =
 			cpu_to_le16(le16_to_cpu(gdp->bg_free_blocks_count) - num);
+	gdp->bg_checksum = ext3_group_desc_csum(sbi, group_no, gdp);
 	spin_unlock(sb_bgl_lock(sbi, group_no));
 	percpu_counter_mod(&sbi->s_freeblocks_counter, -num);
 
@@ -28,6 +28,7 @@
 #include <linux/smp_lock.h>
 #include <linux/slab.h>
 #include <linux/rbtree.h>
+#include <linux/sort.h>
 
 static unsigned char ext3_filetype_table[] = {
 	DT_UNKNOWN, DT_REG, DT_DIR, DT_CHR, DT_BLK, DT_FIFO, DT_SOCK, DT_LNK
@@ -317,12 +318,17 @@ static struct dir_private_info *create_dir_info(loff_t pos)
 	p->curr_hash = pos2maj_hash(pos);
 	p->curr_minor_hash = pos2min_hash(pos);
 	p->next_hash = 0;
+	p->ino_sort = 0;
+	p->ino_order = NULL;
+	p->ino_count = 0;
+	p->ino_next = 0;
 	return p;
 }
 
 void ext3_htree_free_dir_info(struct dir_private_info *p)
 {
 	free_rb_tree_fname(&p->root);
+	kfree(p->ino_order);
 	kfree(p);
 }
 
@@ -423,6 +429,105 @@ static int call_filldir(struct file * filp, void * dirent,
 	return 0;
 }
 
+/* The names read at a time by ext3_dx_readdir_sorted(), at least */
+#define EXT3_SORTDIR_BATCH	1024
+
+static int fname_ino_cmp(const void *a, const void *b)
+{
+	const struct fname *fa = *(const struct fname **) a;
+	const struct fname *fb = *(const struct fname **) b;
+
+	if (fa->inode < fb->inode)
+		return -1;
+	return fa->inode > fb->inode;
+}
+
+/* Put the @count names of the rbtree in info->ino_order by inode number */
+static int ext3_sort_batch(struct dir_private_info *info, unsigned count)
+{
+	struct rb_node *n;
+	struct fname *fname;
+	unsigned i = 0;
+
+	kfree(info->ino_order);
+	info->ino_order = kmalloc(count * sizeof(struct fname *), GFP_KERNEL);
+	if (!info->ino_order)
+		return -ENOMEM;
+	for (n = rb_first(&info->root); n; n = rb_next(n)) {
+		fname = rb_entry(n, struct fname, rb_hash);
+		for (; fname && i < count; fname = fname->next)
+			info->ino_order[i++] = fname;
+	}
+	sort(info->ino_order, i, sizeof(struct fname *), fname_ino_cmp, NULL);
+	info->ino_count = i;
+	info->ino_next = 0;
+	return 0;
+}
+
+/*
+ * readdir with the sortdir option.  The names are read a batch of leaf
+ * blocks at a time and handed out in inode order, so that stat()ing them
+ * as they come reads the inode tables in order, not all over the place.
+ * All of a batch carry the position of its start: continuing from there
+ * means the batch over again, which a reader that seeks, or NFS, sees as
+ * repeated names.  A batch is not read again when the directory changes.
+ */
+static int ext3_dx_readdir_sorted(struct file *filp,
+				  void *dirent, filldir_t filldir)
+{
+	struct dir_private_info *info = filp->private_data;
+	struct inode *inode = filp->f_dentry->d_inode;
+	struct fname *fname;
+	__u32 hash, minor_hash;
+	unsigned count;
+	int ret;
+
+	while (1) {
+		if (info->ino_next == info->ino_count) {
+			if (info->ino_count) {
+				if (info->next_hash == ~0) {
+					filp->f_pos = EXT3_HTREE_EOF;
+					break;
+				}
+				info->curr_hash = info->next_hash;
+				info->curr_minor_hash = 0;
+				filp->f_pos = hash2pos(info->curr_hash, 0);
+				info->ino_count = info->ino_next = 0;
+			}
+			free_rb_tree_fname(&info->root);
+			filp->f_version = inode->i_version;
+			hash = info->curr_hash;
+			minor_hash = info->curr_minor_hash;
+			count = 0;
+			do {
+				ret = ext3_htree_fill_tree(filp, hash,
+						minor_hash, &info->next_hash);
+				if (ret < 0)
+					return ret;
+				count += ret;
+				hash = info->next_hash;
+				minor_hash = 0;
+			} while (count < EXT3_SORTDIR_BATCH &&
+				 info->next_hash != ~0);
+			if (count == 0) {
+				filp->f_pos = EXT3_HTREE_EOF;
+				break;
+			}
+			ret = ext3_sort_batch(info, count);
+			if (ret)
+				return ret;
+		}
+
+		fname = info->ino_order[info->ino_next];
+		if (filldir(dirent, fname->name, fname->name_len, filp->f_pos,
+			    fname->inode, get_dtype(inode->i_sb,
+						    fname->file_type)))
+			break;
+		info->ino_next++;
+	}
+	return 0;
+}
+
 static int ext3_dx_readdir(struct file * filp,
 			 void * dirent, filldir_t filldir)
 {
@@ -435,6 +540,7 @@ static int ext3_dx_readdir(struct file * filp,
 		info = create_dir_info(filp->f_pos);
 		if (!info)
 			return -ENOMEM;
+		info->ino_sort = test_opt(inode->i_sb, SORTDIR);
 		filp->private_data = info;
 	}
 
@@ -448,6 +554,14 @@ static int ext3_dx_readdir(struct file * filp,
 		info->extra_fname = NULL;
 		info->curr_hash = pos2maj_hash(filp->f_pos);
 		info->curr_minor_hash = pos2min_hash(filp->f_pos);
+		info->ino_count = info->ino_next = 0;
+	}
+
+	if (info->ino_sort) {
+		ret = ext3_dx_readdir_sorted(filp, dirent, filldir);
+		if (ret < 0)
+			return ret;
+		goto finished;
 	}
 
 	/*
@@ -0,0 +1,803 @@
+/*
+ *  linux/fs/ext3/extents.c
+ *
+ * Extent trees for the data of regular files.
+ *
+ * An inode flagged EXT3_EXTENTS_FL maps its blocks with a tree of extents
+ * rooted in i_block (see ext3_extents.h) instead of with the direct and
+ * indirect block pointers.  The flag is set on the regular files created
+ * while the filesystem is mounted with -o extents; all the other inodes
+ * keep the block pointers, and are handled as they always were.
+ *
+ * Both lookups and changes of a tree are done under truncate_mutex: a
+ * change may move entries from one node to another, which a lockless
+ * lookup could not detect the way ext3_get_branch() does.
+ */
+
+#include <linux/fs.h>
+#include <linux/time.h>
+#include <linux/jbd.h>
+#include <linux/ext3_fs.h>
+#include <linux/ext3_jbd.h>
+#include <linux/ext3_extents.h>
+#include <linux/buffer_head.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+
+static ext3_fsblk_t ext_pblock(struct ext3_extent *ex)
+{
+	ext3_fsblk_t block = le32_to_cpu(ex->ee_start);
+
+	return block | (((ext3_fsblk_t)le16_to_cpu(ex->ee_start_hi) << 31) << 1);
+}
+
+static ext3_fsblk_t idx_pblock(struct ext3_extent_idx *ix)
+{
+	ext3_fsblk_t block = le32_to_cpu(ix->ei_leaf);
+
+	return block | (((ext3_fsblk_t)le16_to_cpu(ix->ei_leaf_hi) << 31) << 1);
+}
+
+static void ext3_ext_store_pblock(struct ext3_extent *ex, ext3_fsblk_t pb)
+{
+	ex->ee_start = cpu_to_le32(pb & 0xffffffff);
+	ex->ee_start_hi = cpu_to_le16((pb >> 31) >> 1);
+}
+
+static void ext3_idx_store_pblock(struct ext3_extent_idx *ix, ext3_fsblk_t pb)
+{
+	ix->ei_leaf = cpu_to_le32(pb & 0xffffffff);
+	ix->ei_leaf_hi = cpu_to_le16((pb >> 31) >> 1);
+	ix->ei_unused = 0;
+}
+
+/* The first logical block of entry i of a node: both kinds start with it */
+static __le32 ext3_ext_key(struct ext3_extent_header *eh, int i)
+{
+	if (eh->eh_depth)
+		return EXT_FIRST_INDEX(eh)[i].ei_block;
+	return EXT_FIRST_EXTENT(eh)[i].ee_block;
+}
+
+static int ext3_ext_space_root(void)
+{
+	return (EXT3_N_BLOCKS * sizeof(__le32) -
+		sizeof(struct ext3_extent_header)) / sizeof(struct ext3_extent);
+}
+
+static int ext3_ext_space_block(struct inode *inode)
+{
+	return (inode->i_sb->s_blocksize - sizeof(struct ext3_extent_header)) /
+		sizeof(struct ext3_extent);
+}
+
+static int ext3_ext_check_header(struct inode *inode,
+				 struct ext3_extent_header *eh, int depth)
+{
+	const char *error_msg;
+	int max = depth == ext_depth(inode) ? ext3_ext_space_root() :
+					      ext3_ext_space_block(inode);
+
+	if (le16_to_cpu(eh->eh_magic) != EXT3_EXT_MAGIC) {
+		error_msg = "invalid magic";
+		goto corrupted;
+	}
+	if (le16_to_cpu(eh->eh_depth) != depth ||
+	    depth > EXT3_EXT_MAX_DEPTH) {
+		error_msg = "unexpected depth";
+		goto corrupted;
+	}
+	if (le16_to_cpu(eh->eh_max) != max) {
+		error_msg = "invalid eh_max";
+		goto corrupted;
+	}
+	if (le16_to_cpu(eh->eh_entries) > max ||
+	    (depth && !eh->eh_entries)) {
+		error_msg = "invalid eh_entries";
+		goto corrupted;
+	}
+	return 0;
+
+corrupted:
+	ext3_error(inode->i_sb, "ext3_ext_check_header",
+		   "bad extent header in inode #%lu: %s - magic %x, "
+		   "entries %u, max %u, depth %u (expected %d)",
+		   inode->i_ino, error_msg, le16_to_cpu(eh->eh_magic),
+		   le16_to_cpu(eh->eh_entries), le16_to_cpu(eh->eh_max),
+		   le16_to_cpu(eh->eh_depth), depth);
+	return -EIO;
+}
+
+static void ext3_ext_free_path(struct ext3_ext_path *path, int depth)
+{
+	int i;
+
+	for (i = 0; i <= depth; i++)
+		brelse(path[i].p_bh);
+	kfree(path);
+}
+
+/*
+ * The last index entry not beyond @block, or the first one: the first
+ * entry of a node can carry a logical block past that of its own first
+ * entry, when an extent was inserted ahead of all those of the file.
+ */
+static void ext3_ext_binsearch_idx(struct ext3_ext_path *path, __u32 block)
+{
+	struct ext3_extent_idx *l, *r, *m;
+
+	l = EXT_FIRST_INDEX(path->p_hdr) + 1;
+	r = EXT_LAST_INDEX(path->p_hdr);
+	while (l <= r) {
+		m = l + (r - l) / 2;
+		if (block < le32_to_cpu(m->ei_block))
+			r = m - 1;
+		else
+			l = m + 1;
+	}
+	path->p_idx = l - 1;
+}
+
+/* Likewise in a leaf, where there may be no entries at all */
+static void ext3_ext_binsearch(struct ext3_ext_path *path, __u32 block)
+{
+	struct ext3_extent *l, *r, *m;
+
+	if (!path->p_hdr->eh_entries) {
+		path->p_ext = NULL;
+		return;
+	}
+	l = EXT_FIRST_EXTENT(path->p_hdr) + 1;
+	r = EXT_LAST_EXTENT(path->p_hdr);
+	while (l <= r) {
+		m = l + (r - l) / 2;
+		if (block < le32_to_cpu(m->ee_block))
+			r = m - 1;
+		else
+			l = m + 1;
+	}
+	path->p_ext = l - 1;
+}
+
+/*
+ * Look @block up: returns the path from the root down to the leaf which
+ * maps it, or would.  To be freed with ext3_ext_free_path().
+ */
+static struct ext3_ext_path *ext3_ext_find_extent(struct inode *inode,
+						  __u32 block)
+{
+	struct ext3_extent_header *eh = ext_inode_hdr(inode);
+	struct ext3_ext_path *path;
+	struct buffer_head *bh;
+	int depth = ext_depth(inode);
+	int i, err;
+
+	err = ext3_ext_check_header(inode, eh, depth);
+	if (err)
+		return ERR_PTR(err);
+
+	path = kzalloc(sizeof(*path) * (depth + 1), GFP_NOFS);
+	if (!path)
+		return ERR_PTR(-ENOMEM);
+
+	path[0].p_hdr = eh;
+	for (i = 0; i < depth; i++) {
+		ext3_ext_binsearch_idx(path + i, block);
+		path[i + 1].p_block = idx_pblock(path[i].p_idx);
+		bh = sb_bread(inode->i_sb, path[i + 1].p_block);
+		if (!bh) {
+			err = -EIO;
+			goto fail;
+		}
+		path[i + 1].p_bh = bh;
+		path[i + 1].p_hdr = ext_block_hdr(bh);
+		err = ext3_ext_check_header(inode, path[i + 1].p_hdr,
+					    depth - i - 1);
+		if (err)
+			goto fail;
+	}
+	ext3_ext_binsearch(path + depth, block);
+	return path;
+
+fail:
+	ext3_ext_free_path(path, depth);
+	return ERR_PTR(err);
+}
+
+static int ext3_ext_get_access(handle_t *handle, struct ext3_ext_path *path)
+{
+	if (!path->p_bh)
+		return 0;	/* the root goes out with the inode */
+	BUFFER_TRACE(path->p_bh, "get_write_access");
+	return ext3_journal_get_write_access(handle, path->p_bh);
+}
+
+static int ext3_ext_dirty(handle_t *handle, struct inode *inode,
+			  struct ext3_ext_path *path)
+{
+	if (!path->p_bh)
+		return ext3_mark_inode_dirty(handle, inode);
+	BUFFER_TRACE(path->p_bh, "call ext3_journal_dirty_metadata");
+	return ext3_journal_dirty_metadata(handle, path->p_bh);
+}
+
+/*
+ * Where to allocate @block: next to the blocks of the extent found for it,
+ * failing that next to the leaf, failing that in the group of the inode.
+ */
+static ext3_fsblk_t ext3_ext_find_goal(struct inode *inode,
+				       struct ext3_ext_path *path, __u32 block)
+{
+	struct ext3_inode_info *ei = EXT3_I(inode);
+	int depth = ext_depth(inode);
+	struct ext3_extent *ex = path[depth].p_ext;
+	ext3_fsblk_t bg_start;
+	unsigned long colour;
+
+	if (ex) {
+		__u32 ee_block = le32_to_cpu(ex->ee_block);
+
+		if (block > ee_block)
+			return ext_pblock(ex) + (block - ee_block);
+		return ext_pblock(ex) - (ee_block - block);
+	}
+	if (path[depth].p_bh)
+		return path[depth].p_block;
+
+	bg_start = ext3_group_first_block_no(inode->i_sb, ei->i_block_group);
+	colour = (current->pid % 16) *
+			(EXT3_BLOCKS_PER_GROUP(inode->i_sb) / 16);
+	return bg_start + colour;
+}
+
+/* The first logical block mapped to the right of the leaf entry found */
+static __u32 ext3_ext_next_allocated_block(struct ext3_ext_path *path,
+					   int depth)
+{
+	struct ext3_extent *ex = path[depth].p_ext;
+
+	if (ex && ex != EXT_LAST_EXTENT(path[depth].p_hdr))
+		return le32_to_cpu(ex[1].ee_block);
+	while (--depth >= 0)
+		if (path[depth].p_idx != EXT_LAST_INDEX(path[depth].p_hdr))
+			return le32_to_cpu(path[depth].p_idx[1].ei_block);
+	return EXT3_EXT_MAX_BLOCK;
+}
+
+/* A new, zeroed node, locked and with create access taken */
+static struct buffer_head *ext3_ext_new_node(handle_t *handle,
+					     struct inode *inode,
+					     ext3_fsblk_t goal, int *errp)
+{
+	struct buffer_head *bh;
+	ext3_fsblk_t block;
+
+	block = ext3_new_block(handle, inode, goal, errp);
+	if (!block)
+		return NULL;
+
+	bh = sb_getblk(inode->i_sb, block);
+	lock_buffer(bh);
+	BUFFER_TRACE(bh, "call get_create_access");
+	*errp = ext3_journal_get_create_access(handle, bh);
+	if (*errp) {
+		unlock_buffer(bh);
+		brelse(bh);
+		ext3_free_blocks(handle, inode, block, 1);
+		return NULL;
+	}
+	memset(bh->b_data, 0, bh->b_size);
+	return bh;
+}
+
+static int ext3_ext_finish_node(handle_t *handle, struct buffer_head *bh)
+{
+	int err;
+
+	BUFFER_TRACE(bh, "marking uptodate");
+	set_buffer_uptodate(bh);
+	unlock_buffer(bh);
+	BUFFER_TRACE(bh, "call ext3_journal_dirty_metadata");
+	err = ext3_journal_dirty_metadata(handle, bh);
+	brelse(bh);
+	return err;
+}
+
+/*
+ * The root is full all the way down: move its entries to a new node and
+ * leave it with a single index entry pointing there.
+ */
+static int ext3_ext_grow_root(handle_t *handle, struct inode *inode,
+			      ext3_fsblk_t goal)
+{
+	struct ext3_extent_header *eh = ext_inode_hdr(inode), *neh;
+	struct ext3_extent_idx *ix = EXT_FIRST_INDEX(eh);
+	struct buffer_head *bh;
+	int err;
+
+	bh = ext3_ext_new_node(handle, inode, goal, &err);
+	if (!bh)
+		return err;
+
+	neh = ext_block_hdr(bh);
+	memcpy(EXT_FIRST_INDEX(neh), ix,
+	       le16_to_cpu(eh->eh_entries) * sizeof(struct ext3_extent_idx));
+	neh->eh_magic = cpu_to_le16(EXT3_EXT_MAGIC);
+	neh->eh_entries = eh->eh_entries;
+	neh->eh_max = cpu_to_le16(ext3_ext_space_block(inode));
+	neh->eh_depth = eh->eh_depth;
+	/* ei_block overlays ee_block: the first key is in place already */
+	ext3_idx_store_pblock(ix, bh->b_blocknr);
+	err = ext3_ext_finish_node(handle, bh);
+	if (err)
+		return err;
+
+	eh->eh_entries = cpu_to_le16(1);
+	eh->eh_depth = cpu_to_le16(ext_depth(inode) + 1);
+	return ext3_mark_inode_dirty(handle, inode);
+}
+
+/*
+ * Split the full node at @level of @path, whose parent has room.  When the
+ * lookup ended on its last entry the file is most likely being appended
+ * to, and only that entry goes to the new node, which keeps the nodes of a
+ * file written in order full; otherwise the upper half goes.
+ */
+static int ext3_ext_split(handle_t *handle, struct inode *inode,
+			  struct ext3_ext_path *path, int level)
+{
+	struct ext3_ext_path *curp = path + level, *parent = path + level - 1;
+	struct ext3_extent_header *eh = curp->p_hdr, *neh;
+	struct ext3_extent_idx *ix;
+	struct buffer_head *bh;
+	int n = le16_to_cpu(eh->eh_entries);
+	int at, last, err;
+	__le32 key;
+
+	if (eh->eh_depth)
+		last = curp->p_idx == EXT_LAST_INDEX(eh);
+	else
+		last = curp->p_ext == EXT_LAST_EXTENT(eh);
+	at = last ? n - 1 : n / 2;
+	key = ext3_ext_key(eh, at);
+
+	err = ext3_ext_get_access(handle, curp);
+	if (!err)
+		err = ext3_ext_get_access(handle, parent);
+	if (err)
+		return err;
+
+	bh = ext3_ext_new_node(handle, inode, curp->p_block, &err);
+	if (!bh)
+		return err;
+
+	neh = ext_block_hdr(bh);
+	memcpy(EXT_FIRST_INDEX(neh), EXT_FIRST_INDEX(eh) + at,
+	       (n - at) * sizeof(struct ext3_extent_idx));
+	neh->eh_magic = cpu_to_le16(EXT3_EXT_MAGIC);
+	neh->eh_entries = cpu_to_le16(n - at);
+	neh->eh_max = cpu_to_le16(ext3_ext_space_block(inode));
+	neh->eh_depth = eh->eh_depth;
+	ix = parent->p_idx + 1;
+	memmove(ix + 1, ix, (EXT_LAST_INDEX(parent->p_hdr) + 1 - ix) *
+		sizeof(struct ext3_extent_idx));
+	ix->ei_block = key;
+	ext3_idx_store_pblock(ix, bh->b_blocknr);
+	err = ext3_ext_finish_node(handle, bh);
+	if (err)
+		return err;
+
+	eh->eh_entries = cpu_to_le16(at);
+	err = ext3_ext_dirty(handle, inode, curp);
+	if (err)
+		return err;
+	parent->p_hdr->eh_entries =
+		cpu_to_le16(le16_to_cpu(parent->p_hdr->eh_entries) + 1);
+	return ext3_ext_dirty(handle, inode, parent);
+}
+
+/*
+ * Make room in the full leaf of @path: split the full node nearest the
+ * root whose parent has room, or grow the tree if even the root is full.
+ * The caller looks the block up again afterwards, and comes back here
+ * until the leaf it ends up in has room.
+ */
+static int ext3_ext_make_room(handle_t *handle, struct inode *inode,
+			      struct ext3_ext_path *path, ext3_fsblk_t goal)
+{
+	struct ext3_extent_header *eh;
+	int level;
+
+	for (level = ext_depth(inode) - 1; level >= 0; level--) {
+		eh = path[level].p_hdr;
+		if (le16_to_cpu(eh->eh_entries) < le16_to_cpu(eh->eh_max))
+			return ext3_ext_split(handle, inode, path, level + 1);
+	}
+	return ext3_ext_grow_root(handle, inode, goal);
+}
+
+/* The first entry of the leaf changed: carry its block up the path */
+static int ext3_ext_correct_indexes(handle_t *handle, struct inode *inode,
+				    struct ext3_ext_path *path, __le32 key)
+{
+	int level, err;
+
+	for (level = ext_depth(inode) - 1; level >= 0; level--) {
+		err = ext3_ext_get_access(handle, path + level);
+		if (err)
+			return err;
+		path[level].p_idx->ei_block = key;
+		err = ext3_ext_dirty(handle, inode, path + level);
+		if (err)
+			return err;
+		if (path[level].p_idx != EXT_FIRST_INDEX(path[level].p_hdr))
+			break;
+	}
+	return 0;
+}
+
+static int ext3_can_extents_be_merged(struct ext3_extent *ex,
+				      struct ext3_extent *newex)
+{
+	unsigned len = le16_to_cpu(ex->ee_len);
+
+	if (le32_to_cpu(ex->ee_block) + len != le32_to_cpu(newex->ee_block))
+		return 0;
+	if (len + le16_to_cpu(newex->ee_len) > EXT3_EXT_MAX_LEN)
+		return 0;
+	return ext_pblock(ex) + len == ext_pblock(newex);
+}
+
+/*
+ * Add @newex, which maps a hole, to the tree.  *@ppath is the lookup of its
+ * first block, and is looked up again if the tree has to change shape.
+ */
+static int ext3_ext_insert_extent(handle_t *handle, struct inode *inode,
+				  struct ext3_ext_path **ppath,
+				  struct ext3_extent *newex)
+{
+	struct ext3_ext_path *path = *ppath;
+	struct ext3_extent_header *eh;
+	struct ext3_extent *ex, *nearex;
+	int depth, err;
+
+repeat:
+	depth = ext_depth(inode);
+	eh = path[depth].p_hdr;
+	ex = path[depth].p_ext;
+
+	if (ex && ext3_can_extents_be_merged(ex, newex)) {
+		err = ext3_ext_get_access(handle, path + depth);
+		if (err)
+			return err;
+		ex->ee_len = cpu_to_le16(le16_to_cpu(ex->ee_len) +
+					 le16_to_cpu(newex->ee_len));
+		return ext3_ext_dirty(handle, inode, path + depth);
+	}
+
+	if (le16_to_cpu(eh->eh_entries) == le16_to_cpu(eh->eh_max)) {
+		err = ext3_ext_make_room(handle, inode, path,
+					 ext_pblock(newex));
+		ext3_ext_free_path(path, depth);
+		*ppath = NULL;
+		if (err)
+			return err;
+		path = ext3_ext_find_extent(inode, le32_to_cpu(newex->ee_block));
+		if (IS_ERR(path))
+			return PTR_ERR(path);
+		*ppath = path;
+		goto repeat;
+	}
+
+	err = ext3_ext_get_access(handle, path + depth);
+	if (err)
+		return err;
+	if (!ex)
+		nearex = EXT_FIRST_EXTENT(eh);
+	else if (le32_to_cpu(newex->ee_block) > le32_to_cpu(ex->ee_block))
+		nearex = ex + 1;
+	else
+		nearex = ex;
+	memmove(nearex + 1, nearex,
+		(EXT_LAST_EXTENT(eh) + 1 - nearex) * sizeof(struct ext3_extent));
+	*nearex = *newex;
+	eh->eh_entries = cpu_to_le16(le16_to_cpu(eh->eh_entries) + 1);
+	err = ext3_ext_dirty(handle, inode, path + depth);
+	if (!err && nearex == EXT_FIRST_EXTENT(eh))
+		err = ext3_ext_correct_indexes(handle, inode, path,
+					       newex->ee_block);
+	return err;
+}
+
+/**
+ * ext3_ext_tree_init - start an empty extent tree in a new inode
+ * @handle: the transaction the inode is created in
+ * @inode: the inode, a regular file
+ *
+ * The first one sets the extents feature, which older kernels refuse to
+ * mount a filesystem with.
+ */
+int ext3_ext_tree_init(handle_t *handle, struct inode *inode)
+{
+	struct super_block *sb = inode->i_sb;
+	struct ext3_extent_header *eh = ext_inode_hdr(inode);
+	int err;
+
+	if (!EXT3_HAS_INCOMPAT_FEATURE(sb, EXT3_FEATURE_INCOMPAT_EXTENTS)) {
+		err = ext3_journal_get_write_access(handle, EXT3_SB(sb)->s_sbh);
+		if (err)
+			return err;
+		ext3_update_dynamic_rev(sb);
+		EXT3_SET_INCOMPAT_FEATURE(sb, EXT3_FEATURE_INCOMPAT_EXTENTS);
+		sb->s_dirt = 1;
+		err = ext3_journal_dirty_metadata(handle, EXT3_SB(sb)->s_sbh);
+		if (err)
+			return err;
+	}
+
+	eh->eh_magic = cpu_to_le16(EXT3_EXT_MAGIC);
+	eh->eh_entries = 0;
+	eh->eh_max = cpu_to_le16(ext3_ext_space_root());
+	eh->eh_depth = 0;
+	eh->eh_generation = 0;
+	EXT3_I(inode)->i_flags |= EXT3_EXTENTS_FL;
+	return 0;
+}
+
+/**
+ * ext3_ext_get_blocks - ext3_get_blocks_handle() for extent-mapped inodes
+ *
+ * Maps, and with @create allocates, up to @maxblocks blocks from @iblock
+ * on.  The whole of a hole is allocated in one go: up to @maxblocks, or to
+ * the next extent, which ext3_new_blocks() makes contiguous within the
+ * reservation window of the inode, and which goes into the tree as a
+ * single extent.
+ */
+int ext3_ext_get_blocks(handle_t *handle, struct inode *inode,
+		sector_t iblock, unsigned long maxblocks,
+		struct buffer_head *bh_result,
+		int create, int extend_disksize)
+{
+	struct ext3_inode_info *ei = EXT3_I(inode);
+	struct ext3_ext_path *path;
+	struct ext3_extent *ex, newex;
+	ext3_fsblk_t block;
+	unsigned long count;
+	__u32 ee_block, next;
+	int depth, err = 0;
+
+	J_ASSERT(handle != NULL || create == 0);
+
+	if (iblock >= EXT3_EXT_MAX_BLOCK)
+		return create ? -EFBIG : 0;
+
+	mutex_lock(&ei->truncate_mutex);
+	path = ext3_ext_find_extent(inode, iblock);
+	if (IS_ERR(path)) {
+		err = PTR_ERR(path);
+		goto out_unlock;
+	}
+	depth = ext_depth(inode);
+	ex = path[depth].p_ext;
+	next = ext3_ext_next_allocated_block(path, depth);
+
+	if (ex) {
+		ee_block = le32_to_cpu(ex->ee_block);
+		count = le16_to_cpu(ex->ee_len);
+		if (iblock >= ee_block && iblock < ee_block + count) {
+			block = ext_pblock(ex) + (iblock - ee_block);
+			count -= iblock - ee_block;
+			if (count > maxblocks)
+				count = maxblocks;
+			clear_buffer_new(bh_result);
+			goto out_mapped;
+		}
+		if (ee_block > iblock)
+			next = ee_block;
+	}
+	if (!create)
+		goto out;
+
+	count = min_t(unsigned long, maxblocks, next - iblock);
+	if (count > EXT3_EXT_MAX_LEN)
+		count = EXT3_EXT_MAX_LEN;
+
+	if (S_ISREG(inode->i_mode) && (!ei->i_block_alloc_info))
+		ext3_init_block_alloc_info(inode);
+
+	block = ext3_new_blocks(handle, inode,
+				ext3_ext_find_goal(inode, path, iblock),
+				&count, &err);
+	if (!block)
+		goto out;
+
+	newex.ee_block = cpu_to_le32(iblock);
+	newex.ee_len = cpu_to_le16(count);
+	ext3_ext_store_pblock(&newex, block);
+	err = ext3_ext_insert_extent(handle, inode, &path, &newex);
+	if (err) {
+		ext3_free_blocks(handle, inode, block, count);
+		goto out;
+	}
+
+	/*
+	 * i_disksize growing is protected by truncate_mutex, as for the
+	 * indirect-mapped inodes.
+	 */
+	if (extend_disksize && inode->i_size > ei->i_disksize)
+		ei->i_disksize = inode->i_size;
+	set_buffer_new(bh_result);
+out_mapped:
+	map_bh(bh_result, inode->i_sb, block);
+	err = count;
+out:
+	if (path)
+		ext3_ext_free_path(path, ext_depth(inode));
+out_unlock:
+	mutex_unlock(&ei->truncate_mutex);
+	return err;
+}
+
+/* What one step of a truncate may need: a leaf, a run of data, the nodes */
+static int ext3_ext_truncate_credits(struct inode *inode)
+{
+	return EXT3_DATA_TRANS_BLOCKS(inode->i_sb) + ext_depth(inode);
+}
+
+/* Unless the handle still has room for another step, restart it */
+static int ext3_ext_truncate_extend(handle_t *handle, struct inode *inode)
+{
+	int needed = ext3_ext_truncate_credits(inode);
+
+	if (handle->h_buffer_credits >= needed)
+		return 0;
+	if (!ext3_journal_extend(handle, needed))
+		return 0;
+	ext3_mark_inode_dirty(handle, inode);
+	jbd_debug(2, "restarting handle %p\n", handle);
+	return ext3_journal_restart(handle, needed);
+}
+
+/* Release data blocks, revoking them as ext3_clear_blocks() does */
+static void ext3_ext_free_data(handle_t *handle, struct inode *inode,
+			       ext3_fsblk_t block, unsigned long count)
+{
+	unsigned long i;
+
+	for (i = 0; i < count; i++)
+		ext3_forget(handle, 0, inode,
+			    sb_find_get_block(inode->i_sb, block + i),
+			    block + i);
+	ext3_free_blocks(handle, inode, block, count);
+}
+
+/*
+ * Take the emptied leaf of @path out of the tree, and its parents which
+ * that leaves empty.  An emptied root becomes a leaf again.
+ */
+static int ext3_ext_rm_leaf(handle_t *handle, struct inode *inode,
+			    struct ext3_ext_path *path)
+{
+	struct ext3_extent_header *eh;
+	struct ext3_extent_idx *ix;
+	int level, err;
+
+	for (level = ext_depth(inode); level > 0; level--) {
+		eh = path[level - 1].p_hdr;
+		ix = path[level - 1].p_idx;
+		err = ext3_ext_get_access(handle, path + level - 1);
+		if (err)
+			return err;
+		memmove(ix, ix + 1, (EXT_LAST_INDEX(eh) - ix) *
+			sizeof(struct ext3_extent_idx));
+		eh->eh_entries = cpu_to_le16(le16_to_cpu(eh->eh_entries) - 1);
+		if (level == 1 && !eh->eh_entries) {
+			eh->eh_depth = 0;
+			eh->eh_max = cpu_to_le16(ext3_ext_space_root());
+		}
+		err = ext3_ext_dirty(handle, inode, path + level - 1);
+		if (err)
+			return err;
+
+		/* the revoke must come before the bitmap is cleared */
+		ext3_forget(handle, 1, inode, path[level].p_bh,
+			    path[level].p_block);
+		path[level].p_bh = NULL;
+		ext3_free_blocks(handle, inode, path[level].p_block, 1);
+		if (eh->eh_entries)
+			break;
+	}
+	return 0;
+}
+
+/**
+ * ext3_ext_truncate - release the blocks of an extent-mapped inode
+ * @handle: the truncate transaction
+ * @inode: the inode, with truncate_mutex held
+ * @start: the first logical block to go
+ *
+ * Works from the right: each step trims or removes the last extent, or
+ * takes an emptied leaf out, and leaves a tree which a truncate restarted
+ * after a crash can carry on with.  The handle is restarted between steps
+ * as it runs out of credits.
+ */
+void ext3_ext_truncate(handle_t *handle, struct inode *inode,
+		       unsigned long start)
+{
+	struct ext3_ext_path *path;
+	struct ext3_extent_header *eh;
+	struct ext3_extent *ex;
+	ext3_fsblk_t block;
+	__u32 ee_block, ee_len, count;
+	int depth, err;
+
+	if (start >= EXT3_EXT_MAX_BLOCK)
+		return;
+
+	for (;;) {
+		if (is_handle_aborted(handle))
+			return;
+		err = ext3_ext_truncate_extend(handle, inode);
+		if (err)
+			break;
+
+		path = ext3_ext_find_extent(inode, EXT3_EXT_MAX_BLOCK);
+		if (IS_ERR(path)) {
+			err = PTR_ERR(path);
+			break;
+		}
+		depth = ext_depth(inode);
+		eh = path[depth].p_hdr;
+		ex = path[depth].p_ext;
+
+		if (!ex) {
+			if (depth)
+				err = ext3_ext_rm_leaf(handle, inode, path);
+			ext3_ext_free_path(path, depth);
+			if (err || !depth)
+				break;
+			continue;
+		}
+
+		ee_block = le32_to_cpu(ex->ee_block);
+		ee_len = le16_to_cpu(ex->ee_len);
+		if (ee_block + ee_len <= start) {
+			ext3_ext_free_path(path, depth);
+			break;
+		}
+
+		err = ext3_ext_get_access(handle, path + depth);
+		if (err) {
+			ext3_ext_free_path(path, depth);
+			break;
+		}
+		if (ee_block >= start) {
+			block = ext_pblock(ex);
+			count = ee_len;
+			eh->eh_entries =
+				cpu_to_le16(le16_to_cpu(eh->eh_entries) - 1);
+		} else {
+			block = ext_pblock(ex) + (start - ee_block);
+			count = ee_block + ee_len - start;
+			ex->ee_len = cpu_to_le16(start - ee_block);
+		}
+		err = ext3_ext_dirty(handle, inode, path + depth);
+		ext3_ext_free_path(path, depth);
+		if (err)
+			break;
+		ext3_ext_free_data(handle, inode, block, count);
+	}
+	ext3_std_error(inode->i_sb, err);
+}
+
+/**
+ * ext3_ext_index_trans_blocks - tree blocks one allocation may touch
+ * @inode: an extent-mapped inode
+ *
+ * A new extent may split every node on its path and grow the tree: the
+ * counterpart of the indirect blocks in ext3_writepage_trans_blocks().
+ */
+int ext3_ext_index_trans_blocks(struct inode *inode)
+{
+	return 2 * (ext_depth(inode) + 1) + 1;
+}
@@ -17,12 +17,15 @@
 #include <linux/jbd.h>
 #include <linux/ext3_fs.h>
 #include <linux/ext3_jbd.h>
+#include <linux/ext3_extents.h>
 #include <linux/stat.h>
 #include <linux/string.h>
 #include <linux/quotaops.h>
 #include <linux/buffer_head.h>
 #include <linux/random.h>
 #include <linux/bitops.h>
+#include <linux/kthread.h>
+#include <linux/sched.h>
 
 #include <asm/byteorder.h>
 
@@ -60,6 +63,25 @@ read_inode_bitmap(struct super_block * sb, unsigned long block_group)
 	if (!desc)
 		goto error_out;
 
+	if (desc->bg_flags & cpu_to_le16(EXT3_BG_INODE_UNINIT) &&
+	    EXT3_HAS_RO_COMPAT_FEATURE(sb, EXT3_FEATURE_RO_COMPAT_GDT_CSUM)) {
+		/* no inode of the group was ever used */
+		bh = sb_getblk(sb, le32_to_cpu(desc->bg_inode_bitmap));
+		if (bh && !buffer_uptodate(bh)) {
+			unsigned long bit;
+
+			lock_buffer(bh);
+			if (!buffer_uptodate(bh)) {
+				memset(bh->b_data, 0, sb->s_blocksize);
+				for (bit = EXT3_INODES_PER_GROUP(sb);
+				     bit < sb->s_blocksize * 8; bit++)
+					ext3_set_bit(bit, bh->b_data);
+				set_buffer_uptodate(bh);
+			}
+			unlock_buffer(bh);
+		}
+		return bh;
+	}
 	bh = sb_bread(sb, le32_to_cpu(desc->bg_inode_bitmap));
 	if (!bh)
 		ext3_error(sb, "read_inode_bitmap",
@@ -169,6 +191,8 @@ void ext3_free_inode (handle_t *handle, struct inode * inode)
 			if (is_directory)
 				gdp->bg_used_dirs_count = cpu_to_le16(
 				  le16_to_cpu(gdp->bg_used_dirs_count) - 1);
+			gdp->bg_checksum = ext3_group_desc_csum(sbi,
+							block_group, gdp);
 			spin_unlock(sb_bgl_lock(sbi, block_group));
 			percpu_counter_inc(&sbi->s_freeinodes_counter);
 			if (is_directory)
@@ -435,6 +459,8 @@ struct inode *ext3_new_inode(handle_t *handle, struct inode * dir, int mode)
 	struct ext3_sb_info *sbi;
 	int err = 0;
 	struct inode *ret;
+	unsigned long bit;
+	int itable_locked;
 	int i;
 
 	/* Cannot create files in a deleted directory */
@@ -529,14 +555,34 @@ got:
 	BUFFER_TRACE(bh2, "get_write_access");
 	err = ext3_journal_get_write_access(handle, bh2);
 	if (err) goto fail;
+
+	/*
+	 * Moving bg_itable_unused past inode table blocks that are still to
+	 * be zeroed is serialised against ext3_zero_itable(), which leaves
+	 * the blocks below it alone.
+	 */
+	bit = ino - group * EXT3_INODES_PER_GROUP(sb);
+	itable_locked = EXT3_HAS_RO_COMPAT_FEATURE(sb,
+					EXT3_FEATURE_RO_COMPAT_GDT_CSUM) &&
+		!(gdp->bg_flags & cpu_to_le16(EXT3_BG_INODE_ZEROED));
+	if (itable_locked)
+		mutex_lock(&sbi->s_itable_mutex);
 	spin_lock(sb_bgl_lock(sbi, group));
+	gdp->bg_flags &= cpu_to_le16(~EXT3_BG_INODE_UNINIT);
+	if (bit > EXT3_INODES_PER_GROUP(sb) -
+			le16_to_cpu(gdp->bg_itable_unused))
+		gdp->bg_itable_unused =
+			cpu_to_le16(EXT3_INODES_PER_GROUP(sb) - bit);
 	gdp->bg_free_inodes_count =
 		cpu_to_le16(le16_to_cpu(gdp->bg_free_inodes_count) - 1);
 	if (S_ISDIR(mode)) {
 		gdp->bg_used_dirs_count =
 			cpu_to_le16(le16_to_cpu(gdp->bg_used_dirs_count) + 1);
 	}
+	gdp->bg_checksum = ext3_group_desc_csum(sbi, group, gdp);
 	spin_unlock(sb_bgl_lock(sbi, group));
+	if (itable_locked)
+		mutex_unlock(&sbi->s_itable_mutex);
 	BUFFER_TRACE(bh2, "call ext3_journal_dirty_metadata");
 	err = ext3_journal_dirty_metadata(handle, bh2);
 	if (err) goto fail;
@@ -611,6 +657,12 @@ got:
 	if (err)
 		goto fail_free_drop;
 
+	if (S_ISREG(mode) && test_opt(sb, EXTENTS)) {
+		err = ext3_ext_tree_init(handle, inode);
+		if (err)
+			goto fail_free_drop;
+	}
+
 	err = ext3_mark_inode_dirty(handle, inode);
 	if (err) {
 		ext3_std_error(sb, err);
@@ -757,3 +809,153 @@ unsigned long ext3_count_dirs (struct super_block * sb)
 	return count;
 }
 
+
+/*
+ * Inode tables of filesystems made with the gdt_csum feature are only
+ * zeroed on disk as far as bg_itable_unused says inodes are in use.  The
+ * rest is zeroed here, in the background, one group at a time, before
+ * EXT3_BG_INODE_ZEROED is set: once it is, a later fsck can trust the whole
+ * table whatever bg_itable_unused says.
+ */
+#define EXT3_ZERO_BATCH		32	/* inode table blocks per write */
+
+/* Returns 1 if the group had to be zeroed, 0 if not, or an error */
+static int ext3_zero_itable(struct super_block *sb, unsigned long group)
+{
+	struct ext3_sb_info *sbi = EXT3_SB(sb);
+	struct buffer_head *bhs[EXT3_ZERO_BATCH];
+	struct ext3_group_desc *gdp;
+	struct buffer_head *gdp_bh;
+	unsigned long used, blk, n, i;
+	ext3_fsblk_t itable;
+	handle_t *handle;
+	int err, err2;
+
+	gdp = ext3_get_group_desc(sb, group, &gdp_bh);
+	if (!gdp)
+		return -EIO;
+	if (gdp->bg_flags & cpu_to_le16(EXT3_BG_INODE_ZEROED))
+		return 0;
+
+	handle = ext3_journal_start_sb(sb, 1);
+	if (IS_ERR(handle))
+		return PTR_ERR(handle);
+	mutex_lock(&sbi->s_itable_mutex);
+
+	used = 0;
+	if (!(gdp->bg_flags & cpu_to_le16(EXT3_BG_INODE_UNINIT)))
+		used = (EXT3_INODES_PER_GROUP(sb) -
+			le16_to_cpu(gdp->bg_itable_unused) +
+			sbi->s_inodes_per_block - 1) / sbi->s_inodes_per_block;
+	itable = le32_to_cpu(gdp->bg_inode_table);
+
+	err = 0;
+	for (blk = used; blk < sbi->s_itb_per_group && !err; blk += n) {
+		n = min_t(unsigned long, EXT3_ZERO_BATCH,
+			  sbi->s_itb_per_group - blk);
+		for (i = 0; i < n; i++) {
+			bhs[i] = sb_getblk(sb, itable + blk + i);
+			if (!bhs[i]) {
+				n = i;
+				err = -ENOMEM;
+				break;
+			}
+			lock_buffer(bhs[i]);
+			memset(bhs[i]->b_data, 0, sb->s_blocksize);
+			set_buffer_uptodate(bhs[i]);
+			unlock_buffer(bhs[i]);
+			mark_buffer_dirty(bhs[i]);
+		}
+		ll_rw_block(SWRITE, n, bhs);
+		for (i = 0; i < n; i++) {
+			wait_on_buffer(bhs[i]);
+			if (!buffer_uptodate(bhs[i]))
+				err = -EIO;
+			brelse(bhs[i]);
+		}
+	}
+	if (err)
+		goto out;
+
+	BUFFER_TRACE(gdp_bh, "get_write_access");
+	err = ext3_journal_get_write_access(handle, gdp_bh);
+	if (err)
+		goto out;
+	spin_lock(sb_bgl_lock(sbi, group));
+	gdp->bg_flags |= cpu_to_le16(EXT3_BG_INODE_ZEROED);
+	gdp->bg_checksum = ext3_group_desc_csum(sbi, group, gdp);
+	spin_unlock(sb_bgl_lock(sbi, group));
+	BUFFER_TRACE(gdp_bh, "call ext3_journal_dirty_metadata");
+	err = ext3_journal_dirty_metadata(handle, gdp_bh);
+out:
+	mutex_unlock(&sbi->s_itable_mutex);
+	err2 = ext3_journal_stop(handle);
+	if (!err)
+		err = err2;
+	return err ? err : 1;
+}
+
+static int ext3_itable_init_thread(void *data)
+{
+	struct super_block *sb = data;
+	unsigned long group, start;
+	int ret;
+
+	for (group = 0; group < EXT3_SB(sb)->s_groups_count; group++) {
+		if (kthread_should_stop())
+			return 0;
+		start = jiffies;
+		ret = ext3_zero_itable(sb, group);
+		if (ret < 0) {
+			ext3_warning(sb, __FUNCTION__,
+				     "zeroing the inode table of group %lu "
+				     "failed with %d", group, ret);
+			break;
+		}
+		/* leave the disk to everybody else nine tenths of the time */
+		if (ret)
+			schedule_timeout_interruptible((jiffies - start) * 9);
+		try_to_freeze();
+	}
+
+	while (!kthread_should_stop()) {
+		set_current_state(TASK_INTERRUPTIBLE);
+		if (!kthread_should_stop())
+			schedule();
+		__set_current_state(TASK_RUNNING);
+		try_to_freeze();
+	}
+	return 0;
+}
+
+/* Called at mount and remount time, with the filesystem read-write */
+void ext3_start_itable_init(struct super_block *sb)
+{
+	struct ext3_sb_info *sbi = EXT3_SB(sb);
+	struct task_struct *task;
+
+	if (!EXT3_HAS_RO_COMPAT_FEATURE(sb, EXT3_FEATURE_RO_COMPAT_GDT_CSUM) ||
+	    test_opt(sb, NOINIT_ITABLE) || (sb->s_flags & MS_RDONLY) ||
+	    sbi->s_itable_task)
+		return;
+
+	task = kthread_run(ext3_itable_init_thread, sb, "ext3_itable/%s",
+			   sb->s_id);
+	if (IS_ERR(task)) {
+		ext3_warning(sb, __FUNCTION__,
+			     "cannot start the inode table zeroing thread: %ld",
+			     PTR_ERR(task));
+		return;
+	}
+	sbi->s_itable_task = task;
+}
+
+void ext3_stop_itable_init(struct super_block *sb)
+{
+	struct ext3_sb_info *sbi = EXT3_SB(sb);
+
+	if (sbi->s_itable_task) {
+		kthread_stop(sbi->s_itable_task);
+		sbi->s_itable_task = NULL;
+	}
+}
@@ -26,6 +26,7 @@
 #include <linux/fs.h>
 #include <linux/time.h>
 #include <linux/ext3_jbd.h>
+#include <linux/ext3_extents.h>
 #include <linux/jbd.h>
 #include <linux/smp_lock.h>
 #include <linux/highuid.h>
@@ -802,6 +803,9 @@ int ext3_get_blocks_handle(handle_t *handle, struct inode *inode,
 	int count = 0;
 	ext3_fsblk_t first_block = 0;
 
+	if (ei->i_flags & EXT3_EXTENTS_FL)
+		return ext3_ext_get_blocks(handle, inode, iblock, maxblocks,
+					   bh_result, create, extend_disksize);
 
 	J_ASSERT(handle != NULL || create == 0);
 	depth = ext3_block_to_path(inode,iblock,offsets,&blocks_to_boundary);
@@ -941,6 +945,188 @@ out:
 	return err;
 }
 
+/*
+ * Delayed allocation.  With the delalloc mount option a buffered write into
+ * a hole only claims a block, in ext3_da_get_block_prep(): the buffer is
+ * marked delayed and mapped to EXT3_DA_INVALID_BLOCK.  The blocks are
+ * allocated when the page is written out, as many at a time as there are
+ * delayed buffers in a row (ext3_da_map_run()), and i_disksize follows them
+ * there.  The claims are counted in s_dirtyblocks_counter, which the other
+ * allocations leave alone.
+ */
+#define EXT3_DA_INVALID_BLOCK	(~((sector_t)0xffff))
+
+/* The most pages that one allocation in writeout takes */
+#define EXT3_DA_MAX_PAGES	32
+
+/*
+ * The indirect blocks, or extent tree nodes, which mapping @blocks
+ * delayed blocks may take at worst.
+ */
+static unsigned long ext3_da_meta_blocks(struct inode *inode,
+					 unsigned long blocks)
+{
+	unsigned long per = EXT3_ADDR_PER_BLOCK(inode->i_sb);
+
+	if (!blocks)
+		return 0;
+	if (EXT3_I(inode)->i_flags & EXT3_EXTENTS_FL)
+		per /= 3;
+	return (blocks + per - 1) / per + 2;
+}
+
+/* Claim a block, and what mapping it may take, for a delayed buffer */
+static int ext3_da_reserve_space(struct inode *inode)
+{
+	struct ext3_inode_info *ei = EXT3_I(inode);
+	unsigned long md_needed;
+	int ret;
+
+	spin_lock(&ei->i_block_reservation_lock);
+	md_needed = ext3_da_meta_blocks(inode, ei->i_reserved_data_blocks + 1) -
+		ei->i_reserved_meta_blocks;
+	ret = ext3_claim_free_blocks(EXT3_SB(inode->i_sb), md_needed + 1);
+	if (!ret) {
+		ei->i_reserved_data_blocks++;
+		ei->i_reserved_meta_blocks += md_needed;
+	}
+	spin_unlock(&ei->i_block_reservation_lock);
+	return ret;
+}
+
+/* Drop the claims of @used delayed buffers, allocated or thrown away */
+static void ext3_da_release_space(struct inode *inode, unsigned long used)
+{
+	struct ext3_inode_info *ei = EXT3_I(inode);
+	unsigned long md;
+
+	spin_lock(&ei->i_block_reservation_lock);
+	if (unlikely(used > ei->i_reserved_data_blocks)) {
+		ext3_warning(inode->i_sb, __FUNCTION__, "inode %lu: releases "
+			     "%lu blocks, has %lu", inode->i_ino, used,
+			     ei->i_reserved_data_blocks);
+		used = ei->i_reserved_data_blocks;
+	}
+	ei->i_reserved_data_blocks -= used;
+	md = ext3_da_meta_blocks(inode, ei->i_reserved_data_blocks);
+	used += ei->i_reserved_meta_blocks - md;
+	ei->i_reserved_meta_blocks = md;
+	spin_unlock(&ei->i_block_reservation_lock);
+
+	percpu_counter_mod(&EXT3_SB(inode->i_sb)->s_dirtyblocks_counter,
+			   -(long)used);
+}
+
+/*
+ * Allocate the delayed block @iblock of the page being written out, whose
+ * buffer @bh is, along with the delayed blocks which follow it on that page
+ * and on the pages after it.  Those pages are only taken if they can be
+ * locked at once: writeout does not wait for them.  A file written a page
+ * at a time is so allocated in large pieces.
+ */
+static int ext3_da_map_run(handle_t *handle, struct inode *inode,
+			   sector_t iblock, struct buffer_head *bh)
+{
+	struct ext3_inode_info *ei = EXT3_I(inode);
+	struct address_space *mapping = inode->i_mapping;
+	struct page *pages[EXT3_DA_MAX_PAGES];
+	struct buffer_head *b, *head;
+	struct page *page;
+	pgoff_t index = bh->b_page->index;
+	sector_t last_block;
+	unsigned long n = 0, m;
+	loff_t disksize;
+	int nr_pages = 0;
+	int i, ret, err;
+
+	J_ASSERT(handle != NULL);
+
+	/* count the delayed buffers in a row, up to i_size */
+	last_block = (i_size_read(inode) - 1) >> inode->i_blkbits;
+	head = page_buffers(bh->b_page);
+	b = bh;
+	for (;;) {
+		do {
+			if (!buffer_delay(b) || !buffer_dirty(b) ||
+			    iblock + n > last_block)
+				goto counted;
+			n++;
+			b = b->b_this_page;
+		} while (b != head);
+
+		if (nr_pages == EXT3_DA_MAX_PAGES)
+			break;
+		page = find_get_page(mapping, ++index);
+		if (!page)
+			break;
+		if (TestSetPageLocked(page)) {
+			page_cache_release(page);
+			break;
+		}
+		if (page->mapping != mapping || !page_has_buffers(page) ||
+		    PageWriteback(page)) {
+			unlock_page(page);
+			page_cache_release(page);
+			break;
+		}
+		pages[nr_pages++] = page;
+		b = head = page_buffers(page);
+	}
+counted:
+	spin_lock(&ei->i_block_reservation_lock);
+	ei->i_da_allocating++;
+	spin_unlock(&ei->i_block_reservation_lock);
+	ret = ext3_get_blocks_handle(handle, inode, iblock, n, bh, 1, 0);
+	spin_lock(&ei->i_block_reservation_lock);
+	ei->i_da_allocating--;
+	spin_unlock(&ei->i_block_reservation_lock);
+	if (ret <= 0)
+		goto out;
+	m = ret;
+	ret = 0;
+
+	/* bh itself is mapped: the rest follow on from it */
+	clear_buffer_delay(bh);
+	page = bh->b_page;
+	head = page_buffers(page);
+	b = bh->b_this_page;
+	i = 0;
+	for (n = 1; n < m; n++) {
+		if (b == head) {
+			page = pages[i++];
+			b = head = page_buffers(page);
+		}
+		b->b_blocknr = bh->b_blocknr + n;
+		clear_buffer_delay(b);
+		unmap_underlying_metadata(b->b_bdev, b->b_blocknr);
+		/* ext3_ordered_writepage() files the buffers of bh's page */
+		if (page != bh->b_page && ext3_should_order_data(inode)) {
+			err = ext3_journal_dirty_data(handle, b);
+			if (!ret)
+				ret = err;
+		}
+		b = b->b_this_page;
+	}
+
+	disksize = (loff_t)(iblock + m) << inode->i_blkbits;
+	if (disksize > i_size_read(inode))
+		disksize = i_size_read(inode);
+	mutex_lock(&ei->truncate_mutex);
+	if (disksize > ei->i_disksize)
+		ei->i_disksize = disksize;
+	mutex_unlock(&ei->truncate_mutex);
+	/* not just ext3_mark_inode_dirty(): fsync must see it to commit */
+	mark_inode_dirty(inode);
+
+	ext3_da_release_space(inode, m);
+out:
+	for (i = 0; i < nr_pages; i++) {
+		unlock_page(pages[i]);
+		page_cache_release(pages[i]);
+	}
+	return ret;
+}
+
 #define DIO_CREDITS (EXT3_RESERVE_TRANS_BLOCKS + 32)
 
 static int ext3_get_block(struct inode *inode, sector_t iblock,
@@ -950,6 +1136,9 @@ static int ext3_get_block(struct inode *inode, sector_t iblock,
 	int ret = 0;
 	unsigned max_blocks = bh_result->b_size >> inode->i_blkbits;
 
+	if (create && buffer_delay(bh_result))
+		return ext3_da_map_run(handle, inode, iblock, bh_result);
+
 	if (!create)
 		goto get_block;		/* A read */
 
@@ -1190,6 +1379,14 @@ int ext3_journal_dirty_data(handle_t *handle, struct buffer_head *bh)
 	return err;
 }
 
+/* Delayed buffers have no block to write to yet */
+static int journal_dirty_data_fn(handle_t *handle, struct buffer_head *bh)
+{
+	if (buffer_mapped(bh) && !buffer_delay(bh))
+		return ext3_journal_dirty_data(handle, bh);
+	return 0;
+}
+
 /* For commit_write() in data=journal mode */
 static int commit_write_fn(handle_t *handle, struct buffer_head *bh)
 {
@@ -1214,7 +1411,7 @@ static int ext3_ordered_commit_write(struct file *file, struct page *page,
 	int ret = 0, ret2;
 
 	ret = walk_page_buffers(handle, page_buffers(page),
-		from, to, NULL, ext3_journal_dirty_data);
+		from, to, NULL, journal_dirty_data_fn);
 
 	if (ret == 0) {
 		/*
@@ -1291,6 +1488,103 @@ static int ext3_journalled_commit_write(struct file *file,
 	return ret;
 }
 
+/* get_block for a delayed write: claim the blocks of holes only */
+static int ext3_da_get_block_prep(struct inode *inode, sector_t iblock,
+				  struct buffer_head *bh_result, int create)
+{
+	int ret;
+
+	BUG_ON(create == 0);
+	ret = ext3_get_blocks_handle(NULL, inode, iblock, 1, bh_result, 0, 0);
+	if (ret > 0)
+		return 0;
+	if (ret < 0)
+		return ret;
+
+	ret = ext3_da_reserve_space(inode);
+	if (ret)
+		return ret;
+	map_bh(bh_result, inode->i_sb, EXT3_DA_INVALID_BLOCK);
+	set_buffer_new(bh_result);
+	set_buffer_delay(bh_result);
+	return 0;
+}
+
+/*
+ * A delayed write runs without a transaction.  With quotas on, the blocks
+ * are allocated at once as usual: quota is only charged on allocation,
+ * and writeout is too late to refuse the write.
+ */
+static int ext3_da_prepare_write(struct file *file, struct page *page,
+				 unsigned from, unsigned to)
+{
+	struct inode *inode = page->mapping->host;
+	int ret, retries = 0;
+
+	if (sb_any_quota_enabled(inode->i_sb))
+		return ext3_prepare_write(file, page, from, to);
+retry:
+	ret = block_prepare_write(page, from, to, ext3_da_get_block_prep);
+	if (ret == -ENOSPC && ext3_should_retry_alloc(inode->i_sb, &retries))
+		goto retry;
+	return ret;
+}
+
+static int ext3_da_commit_write(struct file *file, struct page *page,
+				unsigned from, unsigned to)
+{
+	struct inode *inode = page->mapping->host;
+	struct ext3_inode_info *ei = EXT3_I(inode);
+	unsigned blocksize = inode->i_sb->s_blocksize;
+	struct buffer_head *bh;
+	handle_t *handle;
+	unsigned end;
+	loff_t pos;
+	int ret, ret2;
+
+	/* ext3_prepare_write() started a transaction */
+	if (ext3_journal_current_handle()) {
+		if (ext3_should_order_data(inode))
+			return ext3_ordered_commit_write(file, page, from, to);
+		return ext3_writeback_commit_write(file, page, from, to);
+	}
+
+	ret = generic_commit_write(file, page, from, to);
+	if (ret)
+		return ret;
+
+	/*
+	 * i_disksize moves on as delayed blocks are allocated.  A write
+	 * ending in a block allocated already moves it here.
+	 */
+	pos = ((loff_t)page->index << PAGE_CACHE_SHIFT) + to;
+	if (pos <= ei->i_disksize)
+		return 0;
+	bh = page_buffers(page);
+	for (end = blocksize; end < to; end += blocksize)
+		bh = bh->b_this_page;
+	if (!buffer_mapped(bh) || buffer_delay(bh))
+		return 0;
+
+	handle = ext3_journal_start(inode, 2);
+	if (IS_ERR(handle))
+		return PTR_ERR(handle);
+	if (ext3_should_order_data(inode))
+		ret = walk_page_buffers(handle, page_buffers(page),
+				from, to, NULL, journal_dirty_data_fn);
+	mutex_lock(&ei->truncate_mutex);
+	if (pos > ei->i_disksize)
+		ei->i_disksize = pos;
+	mutex_unlock(&ei->truncate_mutex);
+	ret2 = ext3_mark_inode_dirty(handle, inode);
+	if (!ret)
+		ret = ret2;
+	ret2 = ext3_journal_stop(handle);
+	if (!ret)
+		ret = ret2;
+	return ret;
+}
+
 /* 
  * bmap() is special.  It gets used by applications such as lilo and by
  * the swapper to find the on-disk block of a specific piece of data.
@@ -1340,6 +1634,10 @@ static sector_t ext3_bmap(struct address_space *mapping, sector_t block)
 			return 0;
 	}
 
+	/* delayed blocks have no place on disk until written out */
+	if (EXT3_I(inode)->i_reserved_data_blocks)
+		filemap_write_and_wait(mapping);
+
 	return generic_block_bmap(mapping,block,ext3_get_block);
 }
 
@@ -1355,13 +1653,6 @@ static int bput_one(handle_t *handle, struct buffer_head *bh)
 	return 0;
 }
 
-static int journal_dirty_data_fn(handle_t *handle, struct buffer_head *bh)
-{
-	if (buffer_mapped(bh))
-		return ext3_journal_dirty_data(handle, bh);
-	return 0;
-}
-
 /*
  * Note that we always start a transaction even if we're not journalling
  * data.  This is to preserve ordering: any hole instantiation within
@@ -1497,7 +1788,9 @@ static int ext3_writeback_writepage(struct page *page,
 		goto out_fail;
 	}
 
-	if (test_opt(inode->i_sb, NOBH) && ext3_should_writeback_data(inode))
+	/* nobh_writepage() would take delayed buffers for mapped ones */
+	if (test_opt(inode->i_sb, NOBH) && ext3_should_writeback_data(inode) &&
+	    !EXT3_I(inode)->i_reserved_data_blocks)
 		ret = nobh_writepage(page, ext3_get_block, wbc);
 	else
 		ret = block_write_full_page(page, ext3_get_block, wbc);
@@ -1597,6 +1890,29 @@ static void ext3_invalidatepage(struct page *page, unsigned long offset)
 	journal_invalidatepage(journal, page, offset);
 }
 
+/* Give up the claims of the delayed buffers thrown away */
+static void ext3_da_invalidatepage(struct page *page, unsigned long offset)
+{
+	struct buffer_head *head, *bh;
+	unsigned long curr_off = 0;
+	unsigned long released = 0;
+
+	if (page_has_buffers(page)) {
+		head = bh = page_buffers(page);
+		do {
+			if (offset <= curr_off && buffer_delay(bh)) {
+				clear_buffer_delay(bh);
+				released++;
+			}
+			curr_off += bh->b_size;
+			bh = bh->b_this_page;
+		} while (bh != head);
+		if (released)
+			ext3_da_release_space(page->mapping->host, released);
+	}
+	ext3_invalidatepage(page, offset);
+}
+
 static int ext3_releasepage(struct page *page, gfp_t wait)
 {
 	journal_t *journal = EXT3_JOURNAL(page->mapping->host);
@@ -1742,9 +2058,44 @@ static const struct address_space_operations ext3_journalled_aops = {
 	.releasepage	= ext3_releasepage,
 };
 
+static const struct address_space_operations ext3_da_ordered_aops = {
+	.readpage	= ext3_readpage,
+	.readpages	= ext3_readpages,
+	.writepage	= ext3_ordered_writepage,
+	.sync_page	= block_sync_page,
+	.prepare_write	= ext3_da_prepare_write,
+	.commit_write	= ext3_da_commit_write,
+	.bmap		= ext3_bmap,
+	.invalidatepage	= ext3_da_invalidatepage,
+	.releasepage	= ext3_releasepage,
+	.direct_IO	= ext3_direct_IO,
+	.migratepage	= buffer_migrate_page,
+};
+
+static const struct address_space_operations ext3_da_writeback_aops = {
+	.readpage	= ext3_readpage,
+	.readpages	= ext3_readpages,
+	.writepage	= ext3_writeback_writepage,
+	.sync_page	= block_sync_page,
+	.prepare_write	= ext3_da_prepare_write,
+	.commit_write	= ext3_da_commit_write,
+	.bmap		= ext3_bmap,
+	.invalidatepage	= ext3_da_invalidatepage,
+	.releasepage	= ext3_releasepage,
+	.direct_IO	= ext3_direct_IO,
+	.migratepage	= buffer_migrate_page,
+};
+
 void ext3_set_aops(struct inode *inode)
 {
-	if (ext3_should_order_data(inode))
+	int delalloc = test_opt(inode->i_sb, DELALLOC) &&
+		S_ISREG(inode->i_mode);
+
+	if (ext3_should_order_data(inode) && delalloc)
+		inode->i_mapping->a_ops = &ext3_da_ordered_aops;
+	else if (ext3_should_writeback_data(inode) && delalloc)
+		inode->i_mapping->a_ops = &ext3_da_writeback_aops;
+	else if (ext3_should_order_data(inode))
 		inode->i_mapping->a_ops = &ext3_ordered_aops;
 	else if (ext3_should_writeback_data(inode))
 		inode->i_mapping->a_ops = &ext3_writeback_aops;
@@ -1846,7 +2197,7 @@ static int ext3_block_truncate_page(handle_t *handle, struct page *page,
 	if (ext3_should_journal_data(inode)) {
 		err = ext3_journal_dirty_metadata(handle, bh);
 	} else {
-		if (ext3_should_order_data(inode))
+		if (ext3_should_order_data(inode) && !buffer_delay(bh))
 			err = ext3_journal_dirty_data(handle, bh);
 		mark_buffer_dirty(bh);
 	}
@@ -2235,7 +2586,7 @@ void ext3_truncate(struct inode *inode)
 	Indirect chain[4];
 	Indirect *partial;
 	__le32 nr = 0;
-	int n;
+	int n = 0;
 	long last_block;
 	unsigned blocksize = inode->i_sb->s_blocksize;
 	struct page *page;
@@ -2247,6 +2598,8 @@ void ext3_truncate(struct inode *inode)
 		return;
 	if (IS_APPEND(inode) || IS_IMMUTABLE(inode))
 		return;
+	if (S_ISDIR(inode->i_mode))
+		ext3_dx_cache_drop(inode);
 
 	/*
 	 * We have to lock the EOF page here, because lock_page() nests
@@ -2279,9 +2632,11 @@ void ext3_truncate(struct inode *inode)
 	if (page)
 		ext3_block_truncate_page(handle, page, mapping, inode->i_size);
 
-	n = ext3_block_to_path(inode, last_block, offsets, NULL);
-	if (n == 0)
-		goto out_stop;	/* error */
+	if (!(ei->i_flags & EXT3_EXTENTS_FL)) {
+		n = ext3_block_to_path(inode, last_block, offsets, NULL);
+		if (n == 0)
+			goto out_stop;	/* error */
+	}
 
 	/*
 	 * OK.  This truncate is going to happen.  We add the inode to the
@@ -2310,6 +2665,11 @@ void ext3_truncate(struct inode *inode)
 	 */
 	mutex_lock(&ei->truncate_mutex);
 
+	if (ei->i_flags & EXT3_EXTENTS_FL) {
+		ext3_ext_truncate(handle, inode, last_block);
+		goto out_unlock;
+	}
+
 	if (n == 1) {		/* direct blocks */
 		ext3_free_data(handle, inode, NULL, i_data+offsets[0],
 			       i_data + EXT3_NDIR_BLOCKS);
@@ -2370,6 +2730,7 @@ do_indirects:
 		;
 	}
 
+out_unlock:
 	ext3_discard_reservation(inode);
 
 	mutex_unlock(&ei->truncate_mutex);
@@ -2977,6 +3338,22 @@ err_out:
 	return error;
 }
 
+/* The delayed blocks count among those of the file, as they will */
+int ext3_getattr(struct vfsmount *mnt, struct dentry *dentry,
+		 struct kstat *stat)
+{
+	struct inode *inode = dentry->d_inode;
+	unsigned long delalloc_blocks;
+
+	generic_fillattr(inode, stat);
+	spin_lock(&EXT3_I(inode)->i_block_reservation_lock);
+	delalloc_blocks = EXT3_I(inode)->i_reserved_data_blocks;
+	spin_unlock(&EXT3_I(inode)->i_block_reservation_lock);
+	stat->blocks += (unsigned long long)delalloc_blocks <<
+			(inode->i_sb->s_blocksize_bits - 9);
+	return 0;
+}
+
 
 /*
  * How many blocks doth make a writepage()?
@@ -3000,6 +3377,9 @@ err_out:
  * page cannot straddle two indirect blocks, and we can only touch one indirect
  * and dindirect block, and the "5" above becomes "3".
  *
+ * For an extent-mapped inode the nodes of its tree take the place of the
+ * indirect blocks; see ext3_ext_index_trans_blocks().
+ *
  * This still overestimates under most circumstances.  If we were to pass the
  * start and end offsets in here as well we could do block_to_path() on each
  * block and work out the exact number of indirects which are touched.  Pah.
@@ -3011,6 +3391,9 @@ static int ext3_writepage_trans_blocks(struct inode *inode)
 	int indirects = (EXT3_NDIR_BLOCKS % bpp) ? 5 : 3;
 	int ret;
 
+	if (EXT3_I(inode)->i_flags & EXT3_EXTENTS_FL)
+		indirects = ext3_ext_index_trans_blocks(inode);
+
 	if (ext3_should_journal_data(inode))
 		ret = 3 * (bpp + indirects) + 2;
 	else
@@ -3187,6 +3570,13 @@ int ext3_change_inode_journal_flag(struct inode *inode, int val)
 	if (is_journal_aborted(journal) || IS_RDONLY(inode))
 		return -EROFS;
 
+	/* data=journal has no delayed blocks: allocate them first */
+	if (val && EXT3_I(inode)->i_reserved_data_blocks) {
+		err = filemap_write_and_wait(inode->i_mapping);
+		if (err)
+			return err;
+	}
+
 	journal_lock_updates(journal);
 	journal_flush(journal);
 
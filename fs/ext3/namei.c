@@ -143,6 +143,38 @@ struct dx_map_entry
 	u32 offs;
 };
 
+/*
+ * The buffers of the index blocks of an htree directory are kept referenced
+ * once it has been looked up in.  Without them a cold lookup in a directory
+ * of millions of entries is a synchronous read of the root, a node and the
+ * mapping of each.  The root has slot 0; the nodes share the rest by block
+ * number.  The directory's blocks only move when it is truncated, which
+ * ext3_dx_cache_drop()s it.  i_lock guards the slots.
+ */
+#define DX_CACHE_SLOTS	16
+
+struct ext3_dx_cache
+{
+	u32 block[DX_CACHE_SLOTS];
+	struct buffer_head *bh[DX_CACHE_SLOTS];
+};
+
+void ext3_dx_cache_drop(struct inode *dir)
+{
+	struct ext3_dx_cache *cache;
+	int i;
+
+	spin_lock(&dir->i_lock);
+	cache = EXT3_I(dir)->i_dx_cache;
+	EXT3_I(dir)->i_dx_cache = NULL;
+	spin_unlock(&dir->i_lock);
+	if (!cache)
+		return;
+	for (i = 0; i < DX_CACHE_SLOTS; i++)
+		brelse(cache->bh[i]);
+	kfree(cache);
+}
+
 #ifdef CONFIG_EXT3_INDEX
 static inline unsigned dx_get_block (struct dx_entry *entry);
 static void dx_set_block (struct dx_entry *entry, unsigned value);
@@ -317,6 +349,98 @@ struct stats dx_show_entries(struct dx_hash_info *hinfo, struct inode *dir,
 }
 #endif /* DX_DEBUG */
 
+/* How many leaf blocks readdir reads ahead of itself */
+#define DX_RA_LEAVES	16
+
+/* Start reading the blocks of @count entries from @entries */
+static void dx_readahead(struct inode *dir, struct dx_entry *entries,
+			 unsigned count)
+{
+	struct buffer_head *bh;
+	int err;
+
+	while (count--) {
+		bh = ext3_getblk(NULL, dir, dx_get_block(entries++), 0, &err);
+		if (!bh)
+			continue;
+		if (!buffer_uptodate(bh))
+			ll_rw_block(READA, 1, &bh);
+		brelse(bh);
+	}
+}
+
+static inline unsigned dx_cache_slot(u32 block)
+{
+	return block ? 1 + block % (DX_CACHE_SLOTS - 1) : 0;
+}
+
+/*
+ * ext3_bread() for the index blocks.  The first time round the cache is
+ * set up, and the blocks the root points to are read ahead: the nodes of
+ * a large directory, or the leaves of a smaller one.
+ */
+static struct buffer_head *dx_bread(struct inode *dir, u32 block, int *err)
+{
+	struct ext3_inode_info *ei = EXT3_I(dir);
+	struct ext3_dx_cache *cache, *new = NULL;
+	struct buffer_head *bh, *old;
+	unsigned slot = dx_cache_slot(block);
+	struct dx_entry *entries;
+	struct dx_root *root;
+
+	spin_lock(&dir->i_lock);
+	cache = ei->i_dx_cache;
+	bh = NULL;
+	if (cache && cache->bh[slot] && cache->block[slot] == block) {
+		bh = cache->bh[slot];
+		get_bh(bh);
+	}
+	spin_unlock(&dir->i_lock);
+	if (bh) {
+		if (buffer_uptodate(bh))
+			return bh;
+		brelse(bh);
+	}
+
+	bh = ext3_bread(NULL, dir, block, 0, err);
+	if (!bh)
+		return NULL;
+	if (!cache)
+		new = kzalloc(sizeof(*new), GFP_NOFS);
+
+	get_bh(bh);
+	spin_lock(&dir->i_lock);
+	if (!ei->i_dx_cache && new) {
+		ei->i_dx_cache = new;
+	} else {
+		kfree(new);
+		new = NULL;
+	}
+	cache = ei->i_dx_cache;
+	if (!cache) {
+		spin_unlock(&dir->i_lock);
+		put_bh(bh);
+		return bh;
+	}
+	old = cache->bh[slot];
+	cache->bh[slot] = bh;
+	cache->block[slot] = block;
+	spin_unlock(&dir->i_lock);
+	brelse(old);
+
+	if (new && block == 0) {
+		root = (struct dx_root *) bh->b_data;
+		entries = (struct dx_entry *) (((char *)&root->info) +
+					       root->info.info_length);
+		/* dx_probe() has yet to check it */
+		if (dx_get_limit(entries) ==
+		    dx_root_limit(dir, root->info.info_length) &&
+		    dx_get_count(entries) <= dx_get_limit(entries))
+			dx_readahead(dir, entries, dx_get_count(entries));
+	}
+	return bh;
+}
+
 /*
  * Probe for a directory leaf block to search.
  *
@@ -340,7 +464,7 @@ dx_probe(struct dentry *dentry, struct inode *dir,
 	frame->bh = NULL;
 	if (dentry)
 		dir = dentry->d_parent->d_inode;
-	if (!(bh = ext3_bread (NULL,dir, 0, 0, err)))
+	if (!(bh = dx_bread(dir, 0, err)))
 		goto fail;
 	root = (struct dx_root *) bh->b_data;
 	if (root->info.hash_version != DX_HASH_TEA &&
@@ -420,7 +544,7 @@ dx_probe(struct dentry *dentry, struct inode *dir,
 		frame->entries = entries;
 		frame->at = at;
 		if (!indirect--) return frame;
-		if (!(bh = ext3_bread (NULL,dir, dx_get_block(at), 0, err)))
+		if (!(bh = dx_bread(dir, dx_get_block(at), err)))
 			goto fail2;
 		at = entries = ((struct dx_node *) bh->b_data)->entries;
 		assert (dx_get_limit(entries) == dx_node_limit (dir));
@@ -508,8 +632,7 @@ static int ext3_htree_next_block(struct inode *dir, __u32 hash,
 	 * block so no check is necessary
 	 */
 	while (num_frames--) {
-		if (!(bh = ext3_bread(NULL, dir, dx_get_block(p->at),
-				      0, &err)))
+		if (!(bh = dx_bread(dir, dx_get_block(p->at), &err)))
 			return err; /* Failure */
 		p++;
 		brelse (p->bh);
@@ -606,6 +729,8 @@ int ext3_htree_fill_tree(struct file *dir_file, __u32 start_hash,
 	frame = dx_probe(NULL, dir_file->f_dentry->d_inode, &hinfo, frames, &err);
 	if (!frame)
 		return err;
+	dx_readahead(dir, frame->at, min_t(unsigned, DX_RA_LEAVES,
+		     frame->entries + dx_get_count(frame->entries) - frame->at));
 
 	/* Add '.' and '..' from the htree header */
 	if (!start_hash && !start_minor_hash) {
@@ -822,6 +822,10 @@ int ext3_group_add(struct super_block *sb, struct ext3_new_group_data *input)
 	gdp->bg_inode_table = cpu_to_le32(input->inode_table);
 	gdp->bg_free_blocks_count = cpu_to_le16(input->free_blocks_count);
 	gdp->bg_free_inodes_count = cpu_to_le16(EXT3_INODES_PER_GROUP(sb));
+	/* the resizer has zeroed the new inode table and bitmaps */
+	gdp->bg_flags = cpu_to_le16(EXT3_BG_INODE_ZEROED);
+	gdp->bg_itable_unused = 0;
+	gdp->bg_checksum = ext3_group_desc_csum(EXT3_SB(sb), input->group, gdp);
 
 	/*
 	 * Make the new blocks and inodes valid next.  We do this before
@@ -61,6 +61,8 @@ static int ext3_statfs (struct dentry * dentry, struct kstatfs * buf);
 static void ext3_unlockfs(struct super_block *sb);
 static void ext3_write_super (struct super_block * sb);
 static void ext3_write_super_lockfs(struct super_block *sb);
+static void ext3_set_journal_checksum(struct super_block *sb);
+static void ext3_check_delalloc(struct super_block *sb);
 
 /* 
  * Wrappers for journal_start/end.
@@ -389,6 +391,7 @@ static void ext3_put_super (struct super_block * sb)
 	struct ext3_super_block *es = sbi->s_es;
 	int i;
 
+	ext3_stop_itable_init(sb);
 	ext3_xattr_put_super(sb);
 	journal_destroy(sbi->s_journal);
 	if (!(sb->s_flags & MS_RDONLY)) {
@@ -405,6 +408,7 @@ static void ext3_put_super (struct super_block * sb)
 	percpu_counter_destroy(&sbi->s_freeblocks_counter);
 	percpu_counter_destroy(&sbi->s_freeinodes_counter);
 	percpu_counter_destroy(&sbi->s_dirs_counter);
+	percpu_counter_destroy(&sbi->s_dirtyblocks_counter);
 	brelse(sbi->s_sbh);
 #ifdef CONFIG_QUOTA
 	for (i = 0; i < MAXQUOTAS; i++)
@@ -452,6 +456,10 @@ static struct inode *ext3_alloc_inode(struct super_block *sb)
 	ei->i_default_acl = EXT3_ACL_NOT_CACHED;
 #endif
 	ei->i_block_alloc_info = NULL;
+	ei->i_dx_cache = NULL;
+	ei->i_reserved_data_blocks = 0;
+	ei->i_reserved_meta_blocks = 0;
+	ei->i_da_allocating = 0;
 	ei->vfs_inode.i_version = 1;
 	return &ei->vfs_inode;
 }
@@ -472,6 +480,7 @@ static void init_once(void * foo, kmem_cache_t * cachep, unsigned long flags)
 		init_rwsem(&ei->xattr_sem);
 #endif
 		mutex_init(&ei->truncate_mutex);
+		spin_lock_init(&ei->i_block_reservation_lock);
 		inode_init_once(&ei->vfs_inode);
 	}
 }
@@ -513,6 +522,7 @@ static void ext3_clear_inode(struct inode *inode)
 	EXT3_I(inode)->i_block_alloc_info = NULL;
 	if (unlikely(rsv))
 		kfree(rsv);
+	ext3_dx_cache_drop(inode);
 }
 
 static inline void ext3_show_quota_options(struct seq_file *seq, struct super_block *sb)
@@ -549,6 +559,23 @@ static int ext3_show_options(struct seq_file *seq, struct vfsmount *vfs)
 	else if (test_opt(sb, DATA_FLAGS) == EXT3_MOUNT_WRITEBACK_DATA)
 		seq_puts(seq, ",data=writeback");
 
+	if (test_opt(sb, JOURNAL_ASYNC_COMMIT))
+		seq_puts(seq, ",journal_async_commit");
+	else if (test_opt(sb, JOURNAL_CHECKSUM))
+		seq_puts(seq, ",journal_checksum");
+
+	if (test_opt(sb, EXTENTS))
+		seq_puts(seq, ",extents");
+
+	if (test_opt(sb, DELALLOC))
+		seq_puts(seq, ",delalloc");
+
+	if (test_opt(sb, SORTDIR))
+		seq_puts(seq, ",sortdir");
+
+	if (test_opt(sb, NOINIT_ITABLE))
+		seq_puts(seq, ",noinit_itable");
+
 	ext3_show_quota_options(seq, sb);
 
 	return 0;
@@ -673,6 +700,9 @@ enum {
 	Opt_user_xattr, Opt_nouser_xattr, Opt_acl, Opt_noacl,
 	Opt_reservation, Opt_noreservation, Opt_noload, Opt_nobh, Opt_bh,
 	Opt_commit, Opt_journal_update, Opt_journal_inum, Opt_journal_dev,
+	Opt_journal_checksum, Opt_journal_async_commit,
+	Opt_extents, Opt_noextents, Opt_delalloc, Opt_nodelalloc,
+	Opt_sortdir, Opt_nosortdir, Opt_init_itable, Opt_noinit_itable,
 	Opt_abort, Opt_data_journal, Opt_data_ordered, Opt_data_writeback,
 	Opt_usrjquota, Opt_grpjquota, Opt_offusrjquota, Opt_offgrpjquota,
 	Opt_jqfmt_vfsold, Opt_jqfmt_vfsv0, Opt_quota, Opt_noquota,
@@ -712,6 +742,16 @@ static match_table_t tokens = {
 	{Opt_journal_update, "journal=update"},
 	{Opt_journal_inum, "journal=%u"},
 	{Opt_journal_dev, "journal_dev=%u"},
+	{Opt_journal_checksum, "journal_checksum"},
+	{Opt_journal_async_commit, "journal_async_commit"},
+	{Opt_extents, "extents"},
+	{Opt_noextents, "noextents"},
+	{Opt_delalloc, "delalloc"},
+	{Opt_nodelalloc, "nodelalloc"},
+	{Opt_sortdir, "sortdir"},
+	{Opt_nosortdir, "nosortdir"},
+	{Opt_init_itable, "init_itable"},
+	{Opt_noinit_itable, "noinit_itable"},
 	{Opt_abort, "abort"},
 	{Opt_data_journal, "data=journal"},
 	{Opt_data_ordered, "data=ordered"},
@@ -1030,6 +1070,37 @@ clear_qf_name:
 		case Opt_noquota:
 			break;
 #endif
+		case Opt_journal_checksum:
+			set_opt(sbi->s_mount_opt, JOURNAL_CHECKSUM);
+			break;
+		case Opt_journal_async_commit:
+			set_opt(sbi->s_mount_opt, JOURNAL_ASYNC_COMMIT);
+			set_opt(sbi->s_mount_opt, JOURNAL_CHECKSUM);
+			break;
+		case Opt_extents:
+			set_opt(sbi->s_mount_opt, EXTENTS);
+			break;
+		case Opt_noextents:
+			clear_opt(sbi->s_mount_opt, EXTENTS);
+			break;
+		case Opt_delalloc:
+			set_opt(sbi->s_mount_opt, DELALLOC);
+			break;
+		case Opt_nodelalloc:
+			clear_opt(sbi->s_mount_opt, DELALLOC);
+			break;
+		case Opt_sortdir:
+			set_opt(sbi->s_mount_opt, SORTDIR);
+			break;
+		case Opt_nosortdir:
+			clear_opt(sbi->s_mount_opt, SORTDIR);
+			break;
+		case Opt_init_itable:
+			clear_opt(sbi->s_mount_opt, NOINIT_ITABLE);
+			break;
+		case Opt_noinit_itable:
+			set_opt(sbi->s_mount_opt, NOINIT_ITABLE);
+			break;
 		case Opt_abort:
 			set_opt(sbi->s_mount_opt, ABORT);
 			break;
@@ -1219,6 +1290,15 @@ static int ext3_check_descriptors (struct super_block * sb)
 					le32_to_cpu(gdp->bg_inode_table));
 			return 0;
 		}
+		if (!ext3_group_desc_csum_verify(sbi, i, gdp)) {
+			ext3_error (sb, "ext3_check_descriptors",
+				    "Checksum for group %d failed (%u!=%u)",
+				    i, le16_to_cpu(ext3_group_desc_csum(sbi, i,
+								gdp)),
+				    le16_to_cpu(gdp->bg_checksum));
+			if (!(sb->s_flags & MS_RDONLY))
+				return 0;
+		}
 		block += EXT3_BLOCKS_PER_GROUP(sb);
 		gdp++;
 	}
@@ -1661,6 +1741,9 @@ static int ext3_fill_super (struct super_block *sb, void *data, int silent)
 		ext3_count_free_inodes(sb));
 	percpu_counter_init(&sbi->s_dirs_counter,
 		ext3_count_dirs(sb));
+	percpu_counter_init(&sbi->s_dirtyblocks_counter, 0);
+
+	mutex_init(&sbi->s_itable_mutex);
 
 	/* per fileystem reservation list head & lock */
 	spin_lock_init(&sbi->s_rsv_window_lock);
@@ -1737,6 +1820,10 @@ static int ext3_fill_super (struct super_block *sb, void *data, int silent)
 	default:
 		break;
 	}
+	ext3_check_delalloc(sb);
+
+	if (!(sb->s_flags & MS_RDONLY))
+		ext3_set_journal_checksum(sb);
 
 	if (test_opt(sb, NOBH)) {
 		if (!(test_opt(sb, DATA_FLAGS) == EXT3_MOUNT_WRITEBACK_DATA)) {
@@ -1783,6 +1870,7 @@ static int ext3_fill_super (struct super_block *sb, void *data, int silent)
 		test_opt(sb,DATA_FLAGS) == EXT3_MOUNT_JOURNAL_DATA ? "journal":
 		test_opt(sb,DATA_FLAGS) == EXT3_MOUNT_ORDERED_DATA ? "ordered":
 		"writeback");
+	ext3_start_itable_init(sb);
 
 	lock_kernel();
 	return 0;
@@ -1799,6 +1887,7 @@ failed_mount3:
 	percpu_counter_destroy(&sbi->s_freeblocks_counter);
 	percpu_counter_destroy(&sbi->s_freeinodes_counter);
 	percpu_counter_destroy(&sbi->s_dirs_counter);
+	percpu_counter_destroy(&sbi->s_dirtyblocks_counter);
 failed_mount2:
 	for (i = 0; i < db_count; i++)
 		brelse(sbi->s_group_desc[i]);
@@ -1840,6 +1929,55 @@ static void ext3_init_journal_params(struct super_block *sb, journal_t *journal)
 	spin_unlock(&journal->j_state_lock);
 }
 
+/*
+ * Set the journal checksum features as the mount options ask.  The
+ * journal superblock is written out at once: an asynchronous commit must
+ * not reach the log before recovery knows to check it.
+ */
+static void ext3_set_journal_checksum(struct super_block *sb)
+{
+	journal_t *journal = EXT3_SB(sb)->s_journal;
+
+	if (test_opt(sb, JOURNAL_ASYNC_COMMIT)) {
+		if (journal_set_features(journal,
+				JFS_FEATURE_COMPAT_CHECKSUM, 0,
+				JFS_FEATURE_INCOMPAT_ASYNC_COMMIT))
+			goto out;
+		printk(KERN_WARNING "EXT3-fs: journal does not support "
+		       "asynchronous commits\n");
+	} else if (test_opt(sb, JOURNAL_CHECKSUM)) {
+		if (journal_set_features(journal,
+				JFS_FEATURE_COMPAT_CHECKSUM, 0, 0)) {
+			journal_clear_features(journal, 0, 0,
+					JFS_FEATURE_INCOMPAT_ASYNC_COMMIT);
+			goto out;
+		}
+		printk(KERN_WARNING "EXT3-fs: journal does not support "
+		       "checksums\n");
+	}
+
+	clear_opt(EXT3_SB(sb)->s_mount_opt, JOURNAL_CHECKSUM);
+	clear_opt(EXT3_SB(sb)->s_mount_opt, JOURNAL_ASYNC_COMMIT);
+	journal_clear_features(journal, JFS_FEATURE_COMPAT_CHECKSUM, 0,
+			       JFS_FEATURE_INCOMPAT_ASYNC_COMMIT);
+out:
+	journal_update_superblock(journal, 1);
+}
+
+/*
+ * Delayed allocation writes the data out after the transaction the
+ * write ran in: with data=journal there is nothing to defer to.
+ */
+static void ext3_check_delalloc(struct super_block *sb)
+{
+	if (test_opt(sb, DELALLOC) &&
+	    test_opt(sb, DATA_FLAGS) == EXT3_MOUNT_JOURNAL_DATA) {
+		printk(KERN_WARNING "EXT3-fs: delalloc not supported with "
+		       "data=journal, disabled\n");
+		clear_opt(EXT3_SB(sb)->s_mount_opt, DELALLOC);
+	}
+}
+
 static journal_t *ext3_get_journal(struct super_block *sb, int journal_inum)
 {
 	struct inode *journal_inode;
@@ -2292,6 +2430,8 @@ static int ext3_remount (struct super_block * sb, int * flags, char * data)
 	if (sbi->s_mount_opt & EXT3_MOUNT_ABORT)
 		ext3_abort(sb, __FUNCTION__, "Abort forced by user");
 
+	ext3_check_delalloc(sb);
+
 	sb->s_flags = (sb->s_flags & ~MS_POSIXACL) |
 		((sbi->s_mount_opt & EXT3_MOUNT_POSIX_ACL) ? MS_POSIXACL : 0);
 
@@ -2307,6 +2447,8 @@ static int ext3_remount (struct super_block * sb, int * flags, char * data)
 		}
 
 		if (*flags & MS_RDONLY) {
+			ext3_stop_itable_init(sb);
+
 			/*
 			 * First of all, the unconditional stuff we have to do
 			 * to disable replay of the journal when we next remount
@@ -2350,6 +2492,10 @@ static int ext3_remount (struct super_block * sb, int * flags, char * data)
 				sb->s_flags &= ~MS_RDONLY;
 		}
 	}
+	if (test_opt(sb, NOINIT_ITABLE))
+		ext3_stop_itable_init(sb);
+	else
+		ext3_start_itable_init(sb);
 #ifdef CONFIG_QUOTA
 	/* Release old quota file names */
 	for (i = 0; i < MAXQUOTAS; i++)
@@ -2382,6 +2528,7 @@ static int ext3_statfs (struct dentry * dentry, struct kstatfs * buf)
 	struct ext3_sb_info *sbi = EXT3_SB(sb);
 	struct ext3_super_block *es = sbi->s_es;
 	ext3_fsblk_t overhead;
+	u64 dirty_blocks;
 	int i;
 
 	if (test_opt (sb, MINIX_DF))
@@ -2423,6 +2570,9 @@ static int ext3_statfs (struct dentry * dentry, struct kstatfs * buf)
 	buf->f_bsize = sb->s_blocksize;
 	buf->f_blocks = le32_to_cpu(es->s_blocks_count) - overhead;
 	buf->f_bfree = percpu_counter_sum(&sbi->s_freeblocks_counter);
+	/* the blocks claimed by delayed allocation are as good as used */
+	dirty_blocks = percpu_counter_sum(&sbi->s_dirtyblocks_counter);
+	buf->f_bfree -= min_t(u64, buf->f_bfree, dirty_blocks);
 	buf->f_bavail = buf->f_bfree - le32_to_cpu(es->s_r_blocks_count);
 	if (buf->f_bfree < le32_to_cpu(es->s_r_blocks_count))
 		buf->f_bavail = 0;
@@ -244,10 +244,39 @@ void put_filp(struct file *file)
 	}
 }
 
+static void file_sb_list_del(struct file *file)
+{
+	struct sb_file_list *fl = file->f_sb_list;
+
+	if (fl) {
+		spin_lock(&fl->lock);
+		list_del_init(&file->f_u.fu_list);
+		file->f_sb_list = NULL;
+		spin_unlock(&fl->lock);
+	}
+}
+
+/*
+ * Puts the file on the list of its super block for this cpu; it may
+ * well be taken off on another.
+ */
+void file_sb_list_add(struct file *file, struct super_block *sb)
+{
+	struct sb_file_list *fl;
+
+	file_sb_list_del(file);
+	fl = per_cpu_ptr(sb->s_files, raw_smp_processor_id());
+	spin_lock(&fl->lock);
+	list_move(&file->f_u.fu_list, &fl->list);
+	file->f_sb_list = fl;
+	spin_unlock(&fl->lock);
+}
+
 void file_move(struct file *file, struct list_head *list)
 {
 	if (!list)
 		return;
+	file_sb_list_del(file);
 	file_list_lock();
 	list_move(&file->f_u.fu_list, list);
 	file_list_unlock();
@@ -255,7 +284,11 @@ void file_move(struct file *file, struct list_head *list)
 
 void file_kill(struct file *file)
 {
-	if (!list_empty(&file->f_u.fu_list)) {
+	if (list_empty(&file->f_u.fu_list))
+		return;
+	if (file->f_sb_list)
+		file_sb_list_del(file);
+	else {
 		file_list_lock();
 		list_del_init(&file->f_u.fu_list);
 		file_list_unlock();
@@ -264,26 +297,31 @@ void file_kill(struct file *file)
 
 int fs_may_remount_ro(struct super_block *sb)
 {
-	struct list_head *p;
+	struct sb_file_list *fl;
+	struct file *file;
+	int cpu;
 
 	/* Check that no files are currently opened for writing. */
-	file_list_lock();
-	list_for_each(p, &sb->s_files) {
-		struct file *file = list_entry(p, struct file, f_u.fu_list);
-		struct inode *inode = file->f_dentry->d_inode;
-
-		/* File with pending delete? */
-		if (inode->i_nlink == 0)
-			goto too_bad;
-
-		/* Writeable file? */
-		if (S_ISREG(inode->i_mode) && (file->f_mode & FMODE_WRITE))
-			goto too_bad;
+	for_each_possible_cpu(cpu) {
+		fl = per_cpu_ptr(sb->s_files, cpu);
+		spin_lock(&fl->lock);
+		list_for_each_entry(file, &fl->list, f_u.fu_list) {
+			struct inode *inode = file->f_dentry->d_inode;
+
+			/* File with pending delete? */
+			if (inode->i_nlink == 0)
+				goto too_bad;
+
+			/* Writeable file? */
+			if (S_ISREG(inode->i_mode) &&
+			    (file->f_mode & FMODE_WRITE))
+				goto too_bad;
+		}
+		spin_unlock(&fl->lock);
 	}
-	file_list_unlock();
 	return 1; /* Tis' cool bro. */
 too_bad:
-	file_list_unlock();
+	spin_unlock(&fl->lock);
 	return 0;
 }
 
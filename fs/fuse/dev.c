@@ -16,6 +16,8 @@
 #include <linux/pagemap.h>
 #include <linux/file.h>
 #include <linux/slab.h>
+#include <linux/pipe_fs_i.h>
+#include <linux/compat.h>
 
 MODULE_ALIAS_MISCDEV(FUSE_MINOR);
 
@@ -433,11 +435,31 @@ static void unlock_request(struct fuse_conn *fc, struct fuse_req *req)
 	}
 }
 
+/* Pages read into by fuse_dev_splice_read() are nobody else's */
+static void fuse_dev_pipe_buf_release(struct pipe_inode_info *pipe,
+				      struct pipe_buffer *buf)
+{
+	page_cache_release(buf->page);
+}
+
+static struct pipe_buf_operations fuse_dev_pipe_buf_ops = {
+	.can_merge = 0,
+	.map = generic_pipe_buf_map,
+	.unmap = generic_pipe_buf_unmap,
+	.pin = generic_pipe_buf_pin,
+	.release = fuse_dev_pipe_buf_release,
+	.steal = generic_pipe_buf_steal,
+	.get = generic_pipe_buf_get,
+};
+
 struct fuse_copy_state {
 	struct fuse_conn *fc;
 	int write;
 	struct fuse_req *req;
 	const struct iovec *iov;
+	struct pipe_buffer *pipebufs;
+	struct pipe_buffer *currbuf;
+	struct pipe_inode_info *pipe;
 	unsigned long nr_segs;
 	unsigned long seglen;
 	unsigned long addr;
@@ -462,7 +484,18 @@ static void fuse_copy_init(struct fuse_copy_state *cs, struct fuse_conn *fc,
 /* Unmap and put previous page of userspace buffer */
 static void fuse_copy_finish(struct fuse_copy_state *cs)
 {
-	if (cs->mapaddr) {
+	if (cs->currbuf) {
+		struct pipe_buffer *buf = cs->currbuf;
+
+		if (cs->write) {
+			kunmap_atomic(cs->mapaddr, KM_USER0);
+			flush_dcache_page(buf->page);
+			buf->len = PAGE_SIZE - cs->len;
+		} else
+			buf->ops->unmap(cs->pipe, buf, cs->mapaddr);
+		cs->currbuf = NULL;
+		cs->mapaddr = NULL;
+	} else if (cs->mapaddr) {
 		kunmap_atomic(cs->mapaddr, KM_USER0);
 		if (cs->write) {
 			flush_dcache_page(cs->pg);
@@ -473,6 +506,59 @@ static void fuse_copy_finish(struct fuse_copy_state *cs)
 	}
 }
 
+/*
+ * Give back what is left of the current page of the userspace buffer,
+ * so that the next request read into it starts right after this one.
+ * Not for pipes: there each request ends a page.
+ */
+static void fuse_copy_rewind(struct fuse_copy_state *cs)
+{
+	if (!cs->pipebufs) {
+		cs->addr -= cs->len;
+		cs->seglen += cs->len;
+		cs->len = 0;
+	}
+	fuse_copy_finish(cs);
+}
+
+/*
+ * Get the next buffer of a pipe: one to copy out of, or a new page to
+ * copy into, counted down in cs->nr_segs
+ */
+static int fuse_copy_fill_pipe(struct fuse_copy_state *cs)
+{
+	struct pipe_buffer *buf = cs->pipebufs;
+	int err;
+
+	if (!cs->nr_segs)
+		return -EIO;
+	if (!cs->write) {
+		err = buf->ops->pin(cs->pipe, buf);
+		if (err)
+			return err;
+		cs->mapaddr = buf->ops->map(cs->pipe, buf, 1);
+		cs->buf = cs->mapaddr + buf->offset;
+		cs->len = buf->len;
+	} else {
+		struct page *page = alloc_page(GFP_HIGHUSER);
+		if (!page)
+			return -ENOMEM;
+		buf->page = page;
+		buf->offset = 0;
+		buf->len = 0;
+		buf->ops = &fuse_dev_pipe_buf_ops;
+		buf->flags = 0;
+		cs->mapaddr = kmap_atomic(page, KM_USER0);
+		cs->buf = cs->mapaddr;
+		cs->len = PAGE_SIZE;
+	}
+	cs->currbuf = buf;
+	cs->pipebufs++;
+	cs->nr_segs--;
+
+	return lock_request(cs->fc, cs->req);
+}
+
 /*
  * Get another pagefull of userspace buffer, and map it to kernel
  * address space, and lock request
@@ -484,6 +570,8 @@ static int fuse_copy_fill(struct fuse_copy_state *cs)
 
 	unlock_request(cs->fc, cs->req);
 	fuse_copy_finish(cs);
+	if (cs->pipe)
+		return fuse_copy_fill_pipe(cs);
 	if (!cs->seglen) {
 		BUG_ON(!cs->nr_segs);
 		cs->seglen = cs->iov[0].iov_len;
@@ -639,9 +727,8 @@ static void request_wait(struct fuse_conn *fc)
  * Called with fc->lock held, releases it
  */
 static int fuse_read_interrupt(struct fuse_conn *fc, struct fuse_req *req,
-			       const struct iovec *iov, unsigned long nr_segs)
+			       struct fuse_copy_state *cs, size_t nbytes)
 {
-	struct fuse_copy_state cs;
 	struct fuse_in_header ih;
 	struct fuse_interrupt_in arg;
 	unsigned reqsize = sizeof(ih) + sizeof(arg);
@@ -657,38 +744,39 @@ static int fuse_read_interrupt(struct fuse_conn *fc, struct fuse_req *req,
 	arg.unique = req->in.h.unique;
 
 	spin_unlock(&fc->lock);
-	if (iov_length(iov, nr_segs) < reqsize)
+	if (nbytes < reqsize)
 		return -EINVAL;
 
-	fuse_copy_init(&cs, fc, 1, NULL, iov, nr_segs);
-	err = fuse_copy_one(&cs, &ih, sizeof(ih));
+	err = fuse_copy_one(cs, &ih, sizeof(ih));
 	if (!err)
-		err = fuse_copy_one(&cs, &arg, sizeof(arg));
-	fuse_copy_finish(&cs);
+		err = fuse_copy_one(cs, &arg, sizeof(arg));
+	fuse_copy_finish(cs);
 
 	return err ? err : reqsize;
 }
 
 /*
- * Read a single request into the userspace filesystem's buffer.  This
+ * Read requests into the userspace filesystem's buffer.  This
  * function waits until a request is available, then removes it from
  * the pending list and copies request data to userspace buffer.  If
  * no reply is needed (FORGET) or request has been aborted or there
  * was an error during the copying then it's finished by calling
  * request_end().  Otherwise add it to the processing list, and set
  * the 'sent' flag.
+ *
+ * If the filesystem asked for batched reads in INIT, further pending
+ * requests which fit are read in behind the first one, without
+ * waiting for them, and the total length is returned.  Interrupts
+ * always go out on their own.
  */
-static ssize_t fuse_dev_readv(struct file *file, const struct iovec *iov,
-			      unsigned long nr_segs, loff_t *off)
+static ssize_t fuse_dev_do_read(struct fuse_conn *fc, struct file *file,
+				struct fuse_copy_state *cs, size_t nbytes)
 {
 	int err;
 	struct fuse_req *req;
 	struct fuse_in *in;
-	struct fuse_copy_state cs;
 	unsigned reqsize;
-	struct fuse_conn *fc = fuse_get_conn(file);
-	if (!fc)
-		return -EPERM;
+	size_t done = 0;
 
  restart:
 	spin_lock(&fc->lock);
@@ -708,17 +796,22 @@ static ssize_t fuse_dev_readv(struct file *file, const struct iovec *iov,
 	if (!list_empty(&fc->interrupts)) {
 		req = list_entry(fc->interrupts.next, struct fuse_req,
 				 intr_entry);
-		return fuse_read_interrupt(fc, req, iov, nr_segs);
+		return fuse_read_interrupt(fc, req, cs, nbytes);
 	}
 
+ next:
 	req = list_entry(fc->pending.next, struct fuse_req, list);
+	in = &req->in;
+	reqsize = in->h.len;
+	/* What does not fit behind a read request waits for the next read */
+	if (done && nbytes - done < reqsize)
+		goto out_unlock;
+
 	req->state = FUSE_REQ_READING;
 	list_move(&req->list, &fc->io);
 
-	in = &req->in;
-	reqsize = in->h.len;
 	/* If request is too large, reply with an error and restart the read */
-	if (iov_length(iov, nr_segs) < reqsize) {
+	if (nbytes < reqsize) {
 		req->out.h.error = -EIO;
 		/* SETXATTR is special, since it may contain too large data */
 		if (in->h.opcode == FUSE_SETXATTR)
@@ -727,12 +820,13 @@ static ssize_t fuse_dev_readv(struct file *file, const struct iovec *iov,
 		goto restart;
 	}
 	spin_unlock(&fc->lock);
-	fuse_copy_init(&cs, fc, 1, req, iov, nr_segs);
-	err = fuse_copy_one(&cs, &in->h, sizeof(in->h));
+	cs->req = req;
+	err = fuse_copy_one(cs, &in->h, sizeof(in->h));
 	if (!err)
-		err = fuse_copy_args(&cs, in->numargs, in->argpages,
+		err = fuse_copy_args(cs, in->numargs, in->argpages,
 				     (struct fuse_arg *) in->args, 0);
-	fuse_copy_finish(&cs);
+	fuse_copy_rewind(cs);
+	cs->req = NULL;
 	spin_lock(&fc->lock);
 	req->locked = 0;
 	if (!err && req->aborted)
@@ -741,8 +835,9 @@ static ssize_t fuse_dev_readv(struct file *file, const struct iovec *iov,
 		if (!req->aborted)
 			req->out.h.error = -EIO;
 		request_end(fc, req);
-		return err;
+		return done ? done : err;
 	}
+	done += reqsize;
 	if (!req->isreply)
 		request_end(fc, req);
 	else {
@@ -752,13 +847,34 @@ static ssize_t fuse_dev_readv(struct file *file, const struct iovec *iov,
 			queue_interrupt(fc, req);
 		spin_unlock(&fc->lock);
 	}
-	return reqsize;
+	if (!fc->batch_read || cs->pipe)
+		return done;
+
+	spin_lock(&fc->lock);
+	if (fc->connected && !list_empty(&fc->pending) &&
+	    list_empty(&fc->interrupts))
+		goto next;
+ out_unlock:
+	spin_unlock(&fc->lock);
+	return done;
 
  err_unlock:
 	spin_unlock(&fc->lock);
 	return err;
 }
 
+static ssize_t fuse_dev_readv(struct file *file, const struct iovec *iov,
+			      unsigned long nr_segs, loff_t *off)
+{
+	struct fuse_copy_state cs;
+	struct fuse_conn *fc = fuse_get_conn(file);
+	if (!fc)
+		return -EPERM;
+
+	fuse_copy_init(&cs, fc, 1, NULL, iov, nr_segs);
+	return fuse_dev_do_read(fc, file, &cs, iov_length(iov, nr_segs));
+}
+
 static ssize_t fuse_dev_read(struct file *file, char __user *buf,
 			     size_t nbytes, loff_t *off)
 {
@@ -768,6 +884,79 @@ static ssize_t fuse_dev_read(struct file *file, char __user *buf,
 	return fuse_dev_readv(file, &iov, 1, off);
 }
 
+/*
+ * Read requests into pages of a pipe, which the filesystem can then
+ * move on to a file or socket without copying them through its own
+ * memory.  The pages are only added to the pipe once the request is
+ * in them, so the pipe must have room for all of it: a request
+ * larger than that gets -EIO, as one larger than a read() buffer
+ * does.
+ */
+static ssize_t fuse_dev_splice_read(struct file *in, loff_t *ppos,
+				    struct pipe_inode_info *pipe,
+				    size_t len, unsigned int flags)
+{
+	ssize_t ret;
+	unsigned nbufs, used;
+	unsigned page_nr = 0;
+	struct pipe_buffer *bufs;
+	struct fuse_copy_state cs;
+	struct fuse_conn *fc = fuse_get_conn(in);
+	if (!fc)
+		return -EPERM;
+
+	if (pipe->inode)
+		mutex_lock(&pipe->inode->i_mutex);
+	nbufs = pipe->buffers - pipe->nrbufs;
+	if (pipe->inode)
+		mutex_unlock(&pipe->inode->i_mutex);
+	if (!nbufs)
+		return -EIO;
+
+	bufs = kmalloc(nbufs * sizeof(struct pipe_buffer), GFP_KERNEL);
+	if (!bufs)
+		return -ENOMEM;
+
+	fuse_copy_init(&cs, fc, 1, NULL, NULL, nbufs);
+	cs.pipebufs = bufs;
+	cs.pipe = pipe;
+	ret = fuse_dev_do_read(fc, in, &cs,
+			       min_t(size_t, len, nbufs * PAGE_SIZE));
+	used = nbufs - cs.nr_segs;
+	if (ret < 0)
+		goto out;
+
+	if (pipe->inode)
+		mutex_lock(&pipe->inode->i_mutex);
+	if (!pipe->readers) {
+		send_sig(SIGPIPE, current, 0);
+		ret = -EPIPE;
+	} else if (pipe->nrbufs + used > pipe->buffers)
+		ret = -EIO;
+	else {
+		while (page_nr < used) {
+			int newbuf = (pipe->curbuf + pipe->nrbufs) &
+				(pipe->buffers - 1);
+			pipe->bufs[newbuf] = bufs[page_nr++];
+			pipe->nrbufs++;
+		}
+	}
+	if (pipe->inode) {
+		mutex_unlock(&pipe->inode->i_mutex);
+		if (page_nr) {
+			smp_mb();
+			if (waitqueue_active(&pipe->wait))
+				wake_up_interruptible(&pipe->wait);
+			kill_fasync(&pipe->fasync_readers, SIGIO, POLL_IN);
+		}
+	}
+ out:
+	while (page_nr < used)
+		page_cache_release(bufs[page_nr++].page);
+	kfree(bufs);
+	return ret;
+}
+
 /* Look up request on processing list by unique ID */
 static struct fuse_req *request_find(struct fuse_conn *fc, u64 unique)
 {
@@ -812,23 +1001,17 @@ static int copy_out_args(struct fuse_copy_state *cs, struct fuse_out *out,
  * it from the list and copy the rest of the buffer to the request.
  * The request is finished by calling request_end()
  */
-static ssize_t fuse_dev_writev(struct file *file, const struct iovec *iov,
-			       unsigned long nr_segs, loff_t *off)
+static ssize_t fuse_dev_do_write(struct fuse_conn *fc,
+				 struct fuse_copy_state *cs, unsigned nbytes)
 {
 	int err;
-	unsigned nbytes = iov_length(iov, nr_segs);
 	struct fuse_req *req;
 	struct fuse_out_header oh;
-	struct fuse_copy_state cs;
-	struct fuse_conn *fc = fuse_get_conn(file);
-	if (!fc)
-		return -EPERM;
 
-	fuse_copy_init(&cs, fc, 0, NULL, iov, nr_segs);
 	if (nbytes < sizeof(struct fuse_out_header))
 		return -EINVAL;
 
-	err = fuse_copy_one(&cs, &oh, sizeof(oh));
+	err = fuse_copy_one(cs, &oh, sizeof(oh));
 	if (err)
 		goto err_finish;
 	err = -EINVAL;
@@ -847,7 +1030,7 @@ static ssize_t fuse_dev_writev(struct file *file, const struct iovec *iov,
 
 	if (req->aborted) {
 		spin_unlock(&fc->lock);
-		fuse_copy_finish(&cs);
+		fuse_copy_finish(cs);
 		spin_lock(&fc->lock);
 		request_end(fc, req);
 		return -ENOENT;
@@ -864,7 +1047,7 @@ static ssize_t fuse_dev_writev(struct file *file, const struct iovec *iov,
 			queue_interrupt(fc, req);
 
 		spin_unlock(&fc->lock);
-		fuse_copy_finish(&cs);
+		fuse_copy_finish(cs);
 		return nbytes;
 	}
 
@@ -872,11 +1055,11 @@ static ssize_t fuse_dev_writev(struct file *file, const struct iovec *iov,
 	list_move(&req->list, &fc->io);
 	req->out.h = oh;
 	req->locked = 1;
-	cs.req = req;
+	cs->req = req;
 	spin_unlock(&fc->lock);
 
-	err = copy_out_args(&cs, &req->out, nbytes);
-	fuse_copy_finish(&cs);
+	err = copy_out_args(cs, &req->out, nbytes);
+	fuse_copy_finish(cs);
 
 	spin_lock(&fc->lock);
 	req->locked = 0;
@@ -892,10 +1075,22 @@ static ssize_t fuse_dev_writev(struct file *file, const struct iovec *iov,
  err_unlock:
 	spin_unlock(&fc->lock);
  err_finish:
-	fuse_copy_finish(&cs);
+	fuse_copy_finish(cs);
 	return err;
 }
 
+static ssize_t fuse_dev_writev(struct file *file, const struct iovec *iov,
+			       unsigned long nr_segs, loff_t *off)
+{
+	struct fuse_copy_state cs;
+	struct fuse_conn *fc = fuse_get_conn(file);
+	if (!fc)
+		return -EPERM;
+
+	fuse_copy_init(&cs, fc, 0, NULL, iov, nr_segs);
+	return fuse_dev_do_write(fc, &cs, iov_length(iov, nr_segs));
+}
+
 static ssize_t fuse_dev_write(struct file *file, const char __user *buf,
 			      size_t nbytes, loff_t *off)
 {
@@ -905,6 +1100,86 @@ static ssize_t fuse_dev_write(struct file *file, const char __user *buf,
 	return fuse_dev_writev(file, &iov, 1, off);
 }
 
+/*
+ * Take a reply of len bytes out of a pipe.  All of it must be in the
+ * pipe already.  The buffers are taken off the pipe under its lock,
+ * and copied from into the request without it.
+ */
+static ssize_t fuse_dev_splice_write(struct pipe_inode_info *pipe,
+				     struct file *out, loff_t *ppos,
+				     size_t len, unsigned int flags)
+{
+	unsigned nbuf = 0;
+	unsigned idx;
+	size_t rem = 0;
+	ssize_t ret;
+	struct pipe_buffer *bufs;
+	struct fuse_copy_state cs;
+	struct fuse_conn *fc = fuse_get_conn(out);
+	if (!fc)
+		return -EPERM;
+
+	if (pipe->inode)
+		mutex_lock(&pipe->inode->i_mutex);
+
+	ret = -ENOMEM;
+	bufs = kmalloc(pipe->buffers * sizeof(struct pipe_buffer), GFP_KERNEL);
+	if (!bufs)
+		goto out_unlock;
+
+	for (idx = 0; idx < pipe->nrbufs && rem < len; idx++)
+		rem += pipe->bufs[(pipe->curbuf + idx) &
+				  (pipe->buffers - 1)].len;
+	ret = -EINVAL;
+	if (rem < len)
+		goto out_free;
+
+	rem = len;
+	while (rem) {
+		struct pipe_buffer *ibuf = pipe->bufs + pipe->curbuf;
+		struct pipe_buffer *obuf = bufs + nbuf;
+
+		if (rem >= ibuf->len) {
+			*obuf = *ibuf;
+			ibuf->ops = NULL;
+			pipe->curbuf = (pipe->curbuf + 1) & (pipe->buffers - 1);
+			pipe->nrbufs--;
+		} else {
+			ibuf->ops->get(pipe, ibuf);
+			*obuf = *ibuf;
+			obuf->flags &= ~PIPE_BUF_FLAG_GIFT;
+			obuf->len = rem;
+			ibuf->offset += obuf->len;
+			ibuf->len -= obuf->len;
+		}
+		nbuf++;
+		rem -= obuf->len;
+	}
+	if (pipe->inode)
+		mutex_unlock(&pipe->inode->i_mutex);
+
+	smp_mb();
+	if (waitqueue_active(&pipe->wait))
+		wake_up_interruptible(&pipe->wait);
+	kill_fasync(&pipe->fasync_writers, SIGIO, POLL_OUT);
+
+	fuse_copy_init(&cs, fc, 0, NULL, NULL, nbuf);
+	cs.pipebufs = bufs;
+	cs.pipe = pipe;
+	ret = fuse_dev_do_write(fc, &cs, len);
+
+	if (pipe->inode)
+		mutex_lock(&pipe->inode->i_mutex);
+	for (idx = 0; idx < nbuf; idx++)
+		bufs[idx].ops->release(pipe, &bufs[idx]);
+ out_free:
+	kfree(bufs);
+ out_unlock:
+	if (pipe->inode)
+		mutex_unlock(&pipe->inode->i_mutex);
+	return ret;
+}
+
 static unsigned fuse_dev_poll(struct file *file, poll_table *wait)
 {
 	unsigned mask = POLLOUT | POLLWRNORM;
@@ -1015,9 +1290,11 @@ static int fuse_dev_release(struct inode *inode, struct file *file)
 	struct fuse_conn *fc = fuse_get_conn(file);
 	if (fc) {
 		spin_lock(&fc->lock);
-		fc->connected = 0;
-		end_requests(fc, &fc->pending);
-		end_requests(fc, &fc->processing);
+		if (!--fc->channels) {
+			fc->connected = 0;
+			end_requests(fc, &fc->pending);
+			end_requests(fc, &fc->processing);
+		}
 		spin_unlock(&fc->lock);
 		fasync_helper(-1, file, 0, &fc->fasync);
 		fuse_conn_put(fc);
@@ -1036,14 +1313,69 @@ static int fuse_dev_fasync(int fd, struct file *file, int on)
 	return fasync_helper(fd, file, on, &fc->fasync);
 }
 
+/*
+ * Make a freshly opened device file another channel of the connection
+ * of the device file whose descriptor is passed in.  Requests go out
+ * through, and replies can come in through, any channel; the
+ * connection goes down when the last one is closed.  A multithreaded
+ * filesystem gives each thread a channel of its own, so that the
+ * threads don't share one file.
+ */
+static long fuse_dev_ioctl(struct file *file, unsigned int cmd,
+			   unsigned long arg)
+{
+	int err;
+	u32 oldfd;
+	struct file *old;
+	struct fuse_conn *fc;
+
+	if (cmd != FUSE_DEV_IOC_CLONE)
+		return -ENOTTY;
+	if (get_user(oldfd, (u32 __user *) arg))
+		return -EFAULT;
+
+	old = fget(oldfd);
+	if (!old)
+		return -EBADF;
+
+	err = -EINVAL;
+	mutex_lock(&fuse_mutex);
+	fc = fuse_get_conn(old);
+	if (old->f_op == &fuse_dev_operations && fc && !file->private_data) {
+		spin_lock(&fc->lock);
+		fc->channels++;
+		spin_unlock(&fc->lock);
+		file->private_data = fuse_conn_get(fc);
+		err = 0;
+	}
+	mutex_unlock(&fuse_mutex);
+	fput(old);
+
+	return err;
+}
+
+#ifdef CONFIG_COMPAT
+static long fuse_dev_compat_ioctl(struct file *file, unsigned int cmd,
+				  unsigned long arg)
+{
+	return fuse_dev_ioctl(file, cmd, (unsigned long) compat_ptr(arg));
+}
+#endif
+
 const struct file_operations fuse_dev_operations = {
 	.owner		= THIS_MODULE,
 	.llseek		= no_llseek,
 	.read		= fuse_dev_read,
 	.readv		= fuse_dev_readv,
+	.splice_read	= fuse_dev_splice_read,
 	.write		= fuse_dev_write,
 	.writev		= fuse_dev_writev,
+	.splice_write	= fuse_dev_splice_write,
 	.poll		= fuse_dev_poll,
+	.unlocked_ioctl	= fuse_dev_ioctl,
+#ifdef CONFIG_COMPAT
+	.compat_ioctl	= fuse_dev_compat_ioctl,
+#endif
 	.release	= fuse_dev_release,
 	.fasync		= fuse_dev_fasync,
 };
@@ -969,6 +969,12 @@ static int fuse_setattr(struct dentry *entry, struct iattr *attr)
 			send_sig(SIGXFSZ, current, 0);
 			return -EFBIG;
 		}
+		/* Cached writes must not land beyond the new size afterwards */
+		if (fc->writeback_cache) {
+			err = filemap_write_and_wait(inode->i_mapping);
+			if (err)
+				return err;
+		}
 	}
 
 	req = fuse_get_req(fc);
@@ -11,6 +11,8 @@
 #include <linux/pagemap.h>
 #include <linux/slab.h>
 #include <linux/kernel.h>
+#include <linux/writeback.h>
+#include <linux/pagevec.h>
 
 static const struct file_operations fuse_direct_io_file_operations;
 
@@ -48,6 +50,7 @@ struct fuse_file *fuse_file_alloc(void)
 	struct fuse_file *ff;
 	ff = kmalloc(sizeof(struct fuse_file), GFP_KERNEL);
 	if (ff) {
+		INIT_LIST_HEAD(&ff->write_entry);
 		ff->reserved_req = fuse_request_alloc();
 		if (!ff->reserved_req) {
 			kfree(ff);
@@ -72,6 +75,13 @@ void fuse_finish_open(struct inode *inode, struct file *file,
 		invalidate_inode_pages(inode->i_mapping);
 	ff->fh = outarg->fh;
 	file->private_data = ff;
+	if (get_fuse_conn(inode)->writeback_cache && S_ISREG(inode->i_mode) &&
+	    (file->f_mode & FMODE_WRITE)) {
+		struct fuse_conn *fc = get_fuse_conn(inode);
+		spin_lock(&fc->lock);
+		list_add(&ff->write_entry, &get_fuse_inode(inode)->write_files);
+		spin_unlock(&fc->lock);
+	}
 }
 
 int fuse_open_common(struct inode *inode, struct file *file, int isdir)
@@ -137,6 +147,16 @@ int fuse_release_common(struct inode *inode, struct file *file, int isdir)
 		struct fuse_conn *fc = get_fuse_conn(inode);
 		struct fuse_req *req;
 
+		if (!list_empty(&ff->write_entry)) {
+			/* Nothing may be left dirty for lack of a handle */
+			filemap_write_and_wait(inode->i_mapping);
+			spin_lock(&fc->lock);
+			list_del_init(&ff->write_entry);
+			spin_unlock(&fc->lock);
+			/* Writeback in flight may be using this handle */
+			filemap_fdatawait(inode->i_mapping);
+		}
+
 		req = fuse_release_fill(ff, get_node_id(inode), file->f_flags,
 					isdir ? FUSE_RELEASEDIR : FUSE_RELEASE);
 
@@ -194,6 +214,12 @@ static int fuse_flush(struct file *file, fl_owner_t id)
 	if (is_bad_inode(inode))
 		return -EIO;
 
+	if (fc->writeback_cache) {
+		err = filemap_write_and_wait(inode->i_mapping);
+		if (err)
+			return err;
+	}
+
 	if (fc->no_flush)
 		return 0;
 
@@ -230,6 +256,13 @@ int fuse_fsync_common(struct file *file, struct dentry *de, int datasync,
 	if (is_bad_inode(inode))
 		return -EIO;
 
+	/* The caller only waits for the dirty pages after ->fsync() */
+	if (!isdir && fc->writeback_cache) {
+		err = filemap_write_and_wait(inode->i_mapping);
+		if (err)
+			return err;
+	}
+
 	if ((!isdir && fc->no_fsync) || (isdir && fc->no_fsyncdir))
 		return 0;
 
@@ -292,21 +325,20 @@ static size_t fuse_send_read(struct fuse_req *req, struct file *file,
 	return req->out.args[0].size;
 }
 
-static int fuse_readpage(struct file *file, struct page *page)
+/* Read a locked page, leaving it locked */
+static int fuse_do_readpage(struct file *file, struct page *page)
 {
 	struct inode *inode = page->mapping->host;
 	struct fuse_conn *fc = get_fuse_conn(inode);
 	struct fuse_req *req;
 	int err;
 
-	err = -EIO;
 	if (is_bad_inode(inode))
-		goto out;
+		return -EIO;
 
 	req = fuse_get_req(fc);
-	err = PTR_ERR(req);
 	if (IS_ERR(req))
-		goto out;
+		return PTR_ERR(req);
 
 	req->out.page_zeroing = 1;
 	req->num_pages = 1;
@@ -317,7 +349,12 @@ static int fuse_readpage(struct file *file, struct page *page)
 	if (!err)
 		SetPageUptodate(page);
 	fuse_invalidate_attr(inode); /* atime changed */
- out:
+	return err;
+}
+
+static int fuse_readpage(struct file *file, struct page *page)
+{
+	int err = fuse_do_readpage(file, page);
 	unlock_page(page);
 	return err;
 }
@@ -449,7 +486,23 @@ static size_t fuse_send_write(struct fuse_req *req, struct file *file,
 static int fuse_prepare_write(struct file *file, struct page *page,
 			      unsigned offset, unsigned to)
 {
-	/* No op */
+	struct inode *inode = page->mapping->host;
+	void *kaddr;
+
+	/* Written through, only the bytes written go out */
+	if (!get_fuse_conn(inode)->writeback_cache || PageUptodate(page) ||
+	    (offset == 0 && to == PAGE_CACHE_SIZE))
+		return 0;
+
+	/* Written back whole, so the rest of the page must be read first */
+	if (page_offset(page) < i_size_read(inode))
+		return fuse_do_readpage(file, page);
+
+	kaddr = kmap_atomic(page, KM_USER0);
+	memset(kaddr, 0, offset);
+	memset(kaddr + to, 0, PAGE_CACHE_SIZE - to);
+	flush_dcache_page(page);
+	kunmap_atomic(kaddr, KM_USER0);
 	return 0;
 }
 
@@ -467,6 +520,15 @@ static int fuse_commit_write(struct file *file, struct page *page,
 	if (is_bad_inode(inode))
 		return -EIO;
 
+	if (fc->writeback_cache) {
+		SetPageUptodate(page);
+		set_page_dirty(page);
+		pos += count;
+		if (pos > i_size_read(inode))
+			i_size_write(inode, pos);
+		return 0;
+	}
+
 	req = fuse_get_req(fc);
 	if (IS_ERR(req))
 		return PTR_ERR(req);
@@ -493,6 +555,227 @@ static int fuse_commit_write(struct file *file, struct page *page,
 	return err;
 }
 
+static void fuse_writepages_end(struct fuse_conn *fc, struct fuse_req *req)
+{
+	struct inode *inode = req->pages[0]->mapping->host;
+	unsigned i;
+
+	if (req->out.h.error)
+		set_bit(AS_EIO, &inode->i_mapping->flags);
+	for (i = 0; i < req->num_pages; i++) {
+		struct page *page = req->pages[i];
+		if (req->out.h.error)
+			SetPageError(page);
+		end_page_writeback(page);
+	}
+	fuse_put_request(fc, req);
+}
+
+/*
+ * Send a run of pages under writeback as one WRITE, in the background:
+ * the pages come out of writeback when the reply is in.  Any handle of
+ * the inode open for writing will do, fuse_release_common() waits for
+ * the writeback using it.
+ */
+static void fuse_send_writepages(struct fuse_req *req, struct inode *inode)
+{
+	struct fuse_conn *fc = get_fuse_conn(inode);
+	struct fuse_inode *fi = get_fuse_inode(inode);
+	struct fuse_write_in *inarg = &req->misc.write.in;
+	loff_t pos = page_offset(req->pages[0]);
+	loff_t size = i_size_read(inode);
+	size_t count = req->num_pages << PAGE_CACHE_SHIFT;
+
+	req->end = fuse_writepages_end;
+	/* Raced with truncate */
+	if (pos >= size) {
+		fuse_writepages_end(fc, req);
+		return;
+	}
+	if (pos + count > size)
+		count = size - pos;
+
+	memset(inarg, 0, sizeof(struct fuse_write_in));
+	spin_lock(&fc->lock);
+	if (!list_empty(&fi->write_files)) {
+		struct fuse_file *ff = list_entry(fi->write_files.next,
+						  struct fuse_file,
+						  write_entry);
+		inarg->fh = ff->fh;
+	} else
+		req->out.h.error = -EIO;
+	spin_unlock(&fc->lock);
+	if (req->out.h.error) {
+		fuse_writepages_end(fc, req);
+		return;
+	}
+
+	inarg->offset = pos;
+	inarg->size = count;
+	req->in.h.opcode = FUSE_WRITE;
+	req->in.h.nodeid = get_node_id(inode);
+	req->in.argpages = 1;
+	req->in.numargs = 2;
+	req->in.args[0].size = sizeof(struct fuse_write_in);
+	req->in.args[0].value = inarg;
+	req->in.args[1].size = count;
+	req->out.numargs = 1;
+	req->out.args[0].size = sizeof(struct fuse_write_out);
+	req->out.args[0].value = &req->misc.write.out;
+	request_send_background(fc, req);
+}
+
+static int fuse_writepage(struct page *page, struct writeback_control *wbc)
+{
+	struct inode *inode = page->mapping->host;
+	struct fuse_conn *fc = get_fuse_conn(inode);
+	struct fuse_req *req;
+
+	/*
+	 * Reclaim must not wait for the filesystem daemon, which may be
+	 * what it is reclaiming for.  The flusher threads write the page
+	 * through fuse_writepages() instead.
+	 */
+	if (wbc->for_reclaim || is_bad_inode(inode))
+		goto redirty;
+
+	req = fuse_get_req(fc);
+	if (IS_ERR(req))
+		goto redirty;
+
+	set_page_writeback(page);
+	unlock_page(page);
+	req->num_pages = 1;
+	req->pages[0] = page;
+	fuse_send_writepages(req, inode);
+	return 0;
+
+ redirty:
+	redirty_page_for_writepage(wbc, page);
+	unlock_page(page);
+	return 0;
+}
+
+/*
+ * Write dirty pages back in runs of contiguous pages, each run as
+ * large a WRITE as the filesystem takes.  The scan is that of
+ * mpage_writepages().
+ */
+static int fuse_writepages(struct address_space *mapping,
+			   struct writeback_control *wbc)
+{
+	struct inode *inode = mapping->host;
+	struct fuse_conn *fc = get_fuse_conn(inode);
+	struct backing_dev_info *bdi = mapping->backing_dev_info;
+	unsigned max_pages = min_t(unsigned, FUSE_MAX_PAGES_PER_REQ,
+				   max(fc->max_write >> PAGE_CACHE_SHIFT, 1U));
+	struct fuse_req *req = NULL;
+	struct pagevec pvec;
+	pgoff_t index;
+	pgoff_t end;
+	int scanned = 0;
+	int range_whole = 0;
+	int done = 0;
+	int err = 0;
+	int nr_pages;
+
+	if (is_bad_inode(inode))
+		return -EIO;
+
+	if (wbc->nonblocking && bdi_write_congested(bdi)) {
+		wbc->encountered_congestion = 1;
+		return 0;
+	}
+
+	pagevec_init(&pvec, 0);
+	if (wbc->range_cyclic) {
+		index = mapping->writeback_index;
+		end = -1;
+	} else {
+		index = wbc->range_start >> PAGE_CACHE_SHIFT;
+		end = wbc->range_end >> PAGE_CACHE_SHIFT;
+		if (wbc->range_start == 0 && wbc->range_end == LLONG_MAX)
+			range_whole = 1;
+		scanned = 1;
+	}
+ retry:
+	while (!done && index <= end &&
+	       (nr_pages = pagevec_lookup_tag(&pvec, mapping, &index,
+			PAGECACHE_TAG_DIRTY,
+			min(end - index, (pgoff_t)PAGEVEC_SIZE-1) + 1))) {
+		unsigned i;
+
+		scanned = 1;
+		for (i = 0; i < nr_pages && !done; i++) {
+			struct page *page = pvec.pages[i];
+
+			/* A request carries one run of pages */
+			if (req && (req->num_pages == max_pages ||
+				    req->pages[req->num_pages - 1]->index + 1 !=
+				    page->index)) {
+				fuse_send_writepages(req, inode);
+				req = NULL;
+			}
+			if (!req) {
+				req = fuse_get_req(fc);
+				if (IS_ERR(req)) {
+					err = PTR_ERR(req);
+					req = NULL;
+					done = 1;
+					break;
+				}
+			}
+
+			lock_page(page);
+			if (unlikely(page->mapping != mapping)) {
+				unlock_page(page);
+				continue;
+			}
+			if (!wbc->range_cyclic && page->index > end) {
+				done = 1;
+				unlock_page(page);
+				continue;
+			}
+			if (wbc->sync_mode != WB_SYNC_NONE)
+				wait_on_page_writeback(page);
+			if (PageWriteback(page) ||
+			    !clear_page_dirty_for_io(page)) {
+				unlock_page(page);
+				continue;
+			}
+
+			set_page_writeback(page);
+			unlock_page(page);
+			req->pages[req->num_pages++] = page;
+
+			if (--(wbc->nr_to_write) <= 0)
+				done = 1;
+			if (wbc->nonblocking && bdi_write_congested(bdi)) {
+				wbc->encountered_congestion = 1;
+				done = 1;
+			}
+		}
+		pagevec_release(&pvec);
+		cond_resched();
+	}
+	if (!scanned && !done) {
+		/* Wrap back to the start of the file */
+		scanned = 1;
+		index = 0;
+		goto retry;
+	}
+	if (wbc->range_cyclic || (range_whole && wbc->nr_to_write > 0))
+		mapping->writeback_index = index;
+
+	if (req) {
+		if (req->num_pages)
+			fuse_send_writepages(req, inode);
+		else
+			fuse_put_request(fc, req);
+	}
+	return err;
+}
+
 static void fuse_release_user_pages(struct fuse_req *req, int write)
 {
 	unsigned i;
@@ -626,6 +909,9 @@ static int fuse_file_mmap(struct file *file, struct vm_area_struct *vma)
 
 static int fuse_set_page_dirty(struct page *page)
 {
+	if (get_fuse_conn(page->mapping->host)->writeback_cache)
+		return __set_page_dirty_nobuffers(page);
+
 	printk("fuse_set_page_dirty: should not happen\n");
 	dump_stack();
 	return 0;
@@ -778,6 +1064,8 @@ static const struct file_operations fuse_direct_io_file_operations = {
 
 static const struct address_space_operations fuse_file_aops  = {
 	.readpage	= fuse_readpage,
+	.writepage	= fuse_writepage,
+	.writepages	= fuse_writepages,
 	.prepare_write	= fuse_prepare_write,
 	.commit_write	= fuse_commit_write,
 	.readpages	= fuse_readpages,
@@ -60,6 +60,10 @@ struct fuse_inode {
 
 	/** Time in jiffies until the file attributes are valid */
 	u64 i_time;
+
+	/** Files open for writing, whose handles writeback can use.
+	    Protected by fc->lock */
+	struct list_head write_files;
 };
 
 /** FUSE specific file data */
@@ -69,6 +73,9 @@ struct fuse_file {
 
 	/** File handle used by userspace */
 	u64 fh;
+
+	/** Entry on the inode's write_files list */
+	struct list_head write_entry;
 };
 
 /** One input argument of a request */
@@ -201,6 +208,10 @@ struct fuse_req {
 		struct fuse_init_out init_out;
 		struct fuse_read_in read_in;
 		struct fuse_lk_in lk_in;
+		struct {
+			struct fuse_write_in in;
+			struct fuse_write_out out;
+		} write;
 	} misc;
 
 	/** page vector */
@@ -269,6 +280,9 @@ struct fuse_conn {
 	/** The list of requests under I/O */
 	struct list_head io;
 
+	/** Number of device files the requests go out through */
+	unsigned channels;
+
 	/** Number of requests currently in the background */
 	unsigned num_background;
 
@@ -298,6 +312,12 @@ struct fuse_conn {
 	/** Do readpages asynchronously?  Only set in INIT */
 	unsigned async_read : 1;
 
+	/** Read several requests at a time?  Only set in INIT */
+	unsigned batch_read : 1;
+
+	/** Cache writes, and write dirty pages back?  Only set in INIT */
+	unsigned writeback_cache : 1;
+
 	/*
 	 * The following bitfields are only for optimization purposes
 	 * and hence races in setting them will not cause malfunction
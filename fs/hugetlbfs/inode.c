@@ -251,7 +251,7 @@ static void hugetlbfs_forget_inode(struct inode *inode)
 		spin_lock(&inode_lock);
 		inode->i_state &= ~I_WILL_FREE;
 		inodes_stat.nr_unused--;
-		hlist_del_init(&inode->i_hash);
+		__remove_inode_hash(inode);
 	}
 	list_del_init(&inode->i_list);
 	list_del_init(&inode->i_sb_list);
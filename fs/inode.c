@@ -74,6 +74,23 @@ LIST_HEAD(inode_in_use);
 LIST_HEAD(inode_unused);
 static struct hlist_head *inode_hashtable __read_mostly;
 
+/*
+ * Each chain of inode_hashtable has a lock, hashed into inode_hash_locks[]
+ * by the index of the chain.  A chain is changed under inode_lock and its
+ * lock, and may be walked under either: the lookups of inodes which are in
+ * use only take the lock of the chain, see find_inode_get().  i_hash_lock
+ * of a hashed inode is the index of the lock of its chain.
+ */
+#define I_HASH_LOCK_BITS	10
+#define I_HASH_LOCKS		(1 << I_HASH_LOCK_BITS)
+
+static spinlock_t inode_hash_locks[I_HASH_LOCKS] __cacheline_aligned_in_smp;
+
+static inline unsigned int inode_hash_lock_index(struct hlist_head *head)
+{
+	return (head - inode_hashtable) & (I_HASH_LOCKS - 1);
+}
+
 /*
  * A simple spinlock to protect the list manipulations.
  *
@@ -116,6 +133,7 @@ static struct inode *alloc_inode(struct super_block *sb)
 
 		inode->i_sb = sb;//保存superblock对象
 		inode->i_blkbits = sb->s_blocksize_bits;
+		inode->i_hash_lock = 0;
 		inode->i_flags = 0;
 		atomic_set(&inode->i_count, 1);
 		inode->i_op = &empty_iops;
@@ -146,7 +164,7 @@ static struct inode *alloc_inode(struct super_block *sb)
 		mapping->a_ops = &empty_aops;
  		mapping->host = inode;
 		mapping->flags = 0;
-		mapping_set_gfp_mask(mapping, GFP_HIGHUSER);
+		mapping_set_gfp_mask(mapping, GFP_HIGHUSER_MOVABLE);
 		mapping->assoc_mapping = NULL;
 		mapping->backing_dev_info = &default_backing_dev_info;
 
@@ -285,7 +303,7 @@ static void dispose_list(struct list_head *head)
 		clear_inode(inode);
 
 		spin_lock(&inode_lock);
-		hlist_del_init(&inode->i_hash);
+		__remove_inode_hash(inode);
 		list_del_init(&inode->i_sb_list);
 		spin_unlock(&inode_lock);
 
@@ -538,6 +556,72 @@ repeat:
 	return node ? inode : NULL;
 }
 
+/*
+ * An inode in use can be given another reference without inode_lock, as
+ * long as its count doesn't go up from zero: that is when __iget() moves
+ * it between the inode lists, and when it may be being freed.  So these
+ * look for the inode under the lock of its chain only, and return it with
+ * a reference taken, NULL if it isn't hashed, or ERR_PTR(-EAGAIN) if it
+ * is unused and the caller must look again under inode_lock.
+ */
+static struct inode *find_inode_get(struct super_block *sb,
+		struct hlist_head *head, int (*test)(struct inode *, void *),
+		void *data)
+{
+	spinlock_t *lock = &inode_hash_locks[inode_hash_lock_index(head)];
+	struct hlist_node *node;
+	struct inode *inode = NULL;
+
+	spin_lock(lock);
+	hlist_for_each (node, head) {
+		inode = hlist_entry(node, struct inode, i_hash);
+		if (inode->i_sb != sb)
+			continue;
+		if (!test(inode, data))
+			continue;
+		if (!atomic_inc_not_zero(&inode->i_count))
+			inode = ERR_PTR(-EAGAIN);
+		break;
+	}
+	spin_unlock(lock);
+	return node ? inode : NULL;
+}
+
+static struct inode *find_inode_fast_get(struct super_block *sb,
+		struct hlist_head *head, unsigned long ino)
+{
+	spinlock_t *lock = &inode_hash_locks[inode_hash_lock_index(head)];
+	struct hlist_node *node;
+	struct inode *inode = NULL;
+
+	spin_lock(lock);
+	hlist_for_each (node, head) {
+		inode = hlist_entry(node, struct inode, i_hash);
+		if (inode->i_ino != ino)
+			continue;
+		if (inode->i_sb != sb)
+			continue;
+		if (!atomic_inc_not_zero(&inode->i_count))
+			inode = ERR_PTR(-EAGAIN);
+		break;
+	}
+	spin_unlock(lock);
+	return node ? inode : NULL;
+}
+
+/*
+ * Hash @inode on the chain @head.  Called with inode_lock held.
+ */
+static void __inode_hash_add(struct inode *inode, struct hlist_head *head)
+{
+	unsigned int i = inode_hash_lock_index(head);
+
+	inode->i_hash_lock = i;
+	spin_lock(&inode_hash_locks[i]);
+	hlist_add_head(&inode->i_hash, head);
+	spin_unlock(&inode_hash_locks[i]);
+}
+
 /**
  *	new_inode 	- obtain an inode
  *	@sb: superblock
@@ -606,7 +690,7 @@ static struct inode * get_new_inode(struct super_block *sb, struct hlist_head *h
 			inodes_stat.nr_inodes++;
 			list_add(&inode->i_list, &inode_in_use);
 			list_add(&inode->i_sb_list, &sb->s_inodes);
-			hlist_add_head(&inode->i_hash, head);
+			__inode_hash_add(inode, head);
 			inode->i_state = I_LOCK|I_NEW;
 			spin_unlock(&inode_lock);
 
@@ -655,7 +739,7 @@ static struct inode * get_new_inode_fast(struct super_block *sb, struct hlist_he
 			inodes_stat.nr_inodes++;
 			list_add(&inode->i_list, &inode_in_use);
 			list_add(&inode->i_sb_list, &sb->s_inodes);
-			hlist_add_head(&inode->i_hash, head);
+			__inode_hash_add(inode, head);
 			inode->i_state = I_LOCK|I_NEW;
 			spin_unlock(&inode_lock);
 
@@ -763,7 +847,7 @@ EXPORT_SYMBOL(igrab);
  *
  * Otherwise NULL is returned.
  *
- * Note, @test is called with the inode_lock held, so can't sleep.
+ * Note, @test is called with a spinlock held, so can't sleep.
  */
 static struct inode *ifind(struct super_block *sb,
 		struct hlist_head *head, int (*test)(struct inode *, void *),
@@ -771,17 +855,19 @@ static struct inode *ifind(struct super_block *sb,
 {
 	struct inode *inode;
 
+	inode = find_inode_get(sb, head, test, data);
+	if (inode != ERR_PTR(-EAGAIN))
+		goto found;
+
 	spin_lock(&inode_lock);
 	inode = find_inode(sb, head, test, data);
-	if (inode) {
+	if (inode)
 		__iget(inode);
-		spin_unlock(&inode_lock);
-		if (likely(wait))
-			wait_on_inode(inode);
-		return inode;
-	}
 	spin_unlock(&inode_lock);
-	return NULL;
+found:
+	if (inode && likely(wait))
+		wait_on_inode(inode);
+	return inode;
 }
 
 /**
@@ -804,16 +890,19 @@ static struct inode *ifind_fast(struct super_block *sb,
 {
 	struct inode *inode;
 
+	inode = find_inode_fast_get(sb, head, ino);
+	if (inode != ERR_PTR(-EAGAIN))
+		goto found;
+
 	spin_lock(&inode_lock);
 	inode = find_inode_fast(sb, head, ino);
-	if (inode) {
+	if (inode)
 		__iget(inode);
-		spin_unlock(&inode_lock);
-		wait_on_inode(inode);
-		return inode;
-	}
 	spin_unlock(&inode_lock);
-	return NULL;
+found:
+	if (inode)
+		wait_on_inode(inode);
+	return inode;
 }
 
 /**
@@ -835,7 +924,7 @@ static struct inode *ifind_fast(struct super_block *sb,
  *
  * Otherwise NULL is returned.
  *
- * Note, @test is called with the inode_lock held, so can't sleep.
+ * Note, @test is called with a spinlock held, so can't sleep.
  */
 struct inode *ilookup5_nowait(struct super_block *sb, unsigned long hashval,
 		int (*test)(struct inode *, void *), void *data)
@@ -864,7 +953,7 @@ EXPORT_SYMBOL(ilookup5_nowait);
  *
  * Otherwise NULL is returned.
  *
- * Note, @test is called with the inode_lock held, so can't sleep.
+ * Note, @test is called with a spinlock held, so can't sleep.
  */
 struct inode *ilookup5(struct super_block *sb, unsigned long hashval,
 		int (*test)(struct inode *, void *), void *data)
@@ -919,7 +1008,7 @@ EXPORT_SYMBOL(ilookup);
  * inode and this is returned locked, hashed, and with the I_NEW flag set. The
  * file system gets to fill it in before unlocking it via unlock_new_inode().
  *
- * Note both @test and @set are called with the inode_lock held, so can't sleep.
+ * Note both @test and @set are called with a spinlock held, so can't sleep.
  */
 struct inode *iget5_locked(struct super_block *sb, unsigned long hashval,
 		int (*test)(struct inode *, void *),
@@ -986,7 +1075,7 @@ void __insert_inode_hash(struct inode *inode, unsigned long hashval)
 {
 	struct hlist_head *head = inode_hashtable + hash(inode->i_sb, hashval);
 	spin_lock(&inode_lock);
-	hlist_add_head(&inode->i_hash, head);
+	__inode_hash_add(inode, head);
 	spin_unlock(&inode_lock);
 }
 
@@ -1001,12 +1090,29 @@ EXPORT_SYMBOL(__insert_inode_hash);
 void remove_inode_hash(struct inode *inode)
 {
 	spin_lock(&inode_lock);
-	hlist_del_init(&inode->i_hash);
+	__remove_inode_hash(inode);
 	spin_unlock(&inode_lock);
 }
 
 EXPORT_SYMBOL(remove_inode_hash);
 
+/**
+ *	__remove_inode_hash - remove an inode from the hash
+ *	@inode: inode to unhash
+ *
+ *	As remove_inode_hash(), for the caller holding inode_lock.
+ */
+void __remove_inode_hash(struct inode *inode)
+{
+	spinlock_t *lock = &inode_hash_locks[inode->i_hash_lock];
+
+	spin_lock(lock);
+	hlist_del_init(&inode->i_hash);
+	spin_unlock(lock);
+}
+
+EXPORT_SYMBOL(__remove_inode_hash);
+
 /*
  * Tell the filesystem that this inode is no longer of any interest and should
  * be completely destroyed.
@@ -1045,7 +1151,7 @@ void generic_delete_inode(struct inode *inode)
 		clear_inode(inode);
 	}
 	spin_lock(&inode_lock);
-	hlist_del_init(&inode->i_hash);
+	__remove_inode_hash(inode);
 	spin_unlock(&inode_lock);
 	wake_up_inode(inode);
 	BUG_ON(inode->i_state != I_CLEAR);
@@ -1072,7 +1178,7 @@ static void generic_forget_inode(struct inode *inode)
 		spin_lock(&inode_lock);
 		inode->i_state &= ~I_WILL_FREE;
 		inodes_stat.nr_unused--;
-		hlist_del_init(&inode->i_hash);
+		__remove_inode_hash(inode);
 	}
 	list_del_init(&inode->i_list);
 	list_del_init(&inode->i_sb_list);
@@ -1343,6 +1449,9 @@ void __init inode_init_early(void)
 {
 	int loop;
 
+	for (loop = 0; loop < I_HASH_LOCKS; loop++)
+		spin_lock_init(&inode_hash_locks[loop]);
+
 	/* If hashes are distributed across NUMA nodes, defer
 	 * hash allocation until vmalloc space is available.
 	 */
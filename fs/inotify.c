@@ -40,7 +40,8 @@ static atomic_t inotify_cookie;
  * dentry->d_lock (used to keep d_move() away from dentry->d_parent)
  * iprune_mutex (synchronize shrink_icache_memory())
  * 	inode_lock (protects the super_block->s_inodes list)
- * 	inode->inotify_mutex (protects inode->inotify_watches and watches->i_list)
+ * 	inode->inotify_mutex (protects inode->inotify_watches, watches->i_list
+ * 			      and inode->inotify_mask)
  * 		inotify_handle->mutex (protects inotify_handle and watches->h_list)
  *
  * The inode->inotify_mutex and inotify_handle->mutex and held during execution
@@ -154,6 +155,31 @@ static inline int inotify_inode_watched(struct inode *inode)
 	return !list_empty(&inode->inotify_watches);
 }
 
+/*
+ * inotify_inode_wants - returns nonzero if a watch on this inode may want
+ * the event.  Lockless like inotify_inode_watched(), so that events nobody
+ * asked for don't take inode->inotify_mutex.
+ */
+static inline int inotify_inode_wants(struct inode *inode, u32 mask)
+{
+	return inode->inotify_mask & mask;
+}
+
+/*
+ * set_inode_watch_mask - recompute inode->inotify_mask from the watches.
+ *
+ * Callers must hold inode->inotify_mutex.
+ */
+static void set_inode_watch_mask(struct inode *inode)
+{
+	struct inotify_watch *watch;
+	u32 mask = 0;
+
+	list_for_each_entry(watch, &inode->inotify_watches, i_list)
+		mask |= watch->mask;
+	inode->inotify_mask = mask;
+}
+
 /*
  * Get child dentry flag into synch with parent inode.
  * Flag should always be clear for negative dentrys.
@@ -216,6 +242,7 @@ static void remove_watch_no_event(struct inotify_watch *watch,
 {
 	list_del(&watch->i_list);
 	list_del(&watch->h_list);
+	set_inode_watch_mask(watch->inode);
 
 	if (!inotify_inode_watched(watch->inode))
 		set_dentry_child_flags(watch->inode, 0);
@@ -287,7 +314,7 @@ void inotify_inode_queue_event(struct inode *inode, u32 mask, u32 cookie,
 {
 	struct inotify_watch *watch, *next;
 
-	if (!inotify_inode_watched(inode))
+	if (!inotify_inode_wants(inode, mask))
 		return;
 
 	mutex_lock(&inode->inotify_mutex);
@@ -327,7 +354,7 @@ void inotify_dentry_parent_queue_event(struct dentry *dentry, u32 mask,
 	parent = dentry->d_parent;
 	inode = parent->d_inode;
 
-	if (inotify_inode_watched(inode)) {
+	if (inotify_inode_wants(inode, mask)) {
 		dget(parent);
 		spin_unlock(&dentry->d_lock);
 		inotify_inode_queue_event(inode, mask, cookie, name,
@@ -603,6 +630,7 @@ s32 inotify_find_update_watch(struct inotify_handle *ih, struct inode *inode,
 		old->mask |= mask;
 	else
 		old->mask = mask;
+	set_inode_watch_mask(inode);
 	ret = old->wd;
 out:
 	mutex_unlock(&ih->mutex);
@@ -658,6 +686,7 @@ s32 inotify_add_watch(struct inotify_handle *ih, struct inotify_watch *watch,
 	/* Add the watch to the handle's and the inode's list */
 	list_add(&watch->h_list, &ih->watches);
 	list_add(&watch->i_list, &inode->inotify_watches);
+	inode->inotify_mask |= mask;
 out:
 	mutex_unlock(&ih->mutex);
 	mutex_unlock(&inode->inotify_mutex);
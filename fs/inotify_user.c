@@ -29,6 +29,7 @@
 #include <linux/poll.h>
 #include <linux/init.h>
 #include <linux/list.h>
+#include <linux/hash.h>
 #include <linux/inotify.h>
 #include <linux/syscalls.h>
 
@@ -65,6 +66,9 @@ int inotify_max_queued_events __read_mostly;
  * first event, or to inotify_destroy().
  */
 
+#define INOTIFY_EV_HASH_BITS	6
+#define INOTIFY_EV_HASH_SIZE	(1 << INOTIFY_EV_HASH_BITS)
+
 /*
  * struct inotify_device - represents an inotify instance
  *
@@ -75,6 +79,7 @@ struct inotify_device {
 	struct mutex		ev_mutex;	/* protects event queue */
 	struct mutex		up_mutex;	/* synchronizes watch updates */
 	struct list_head 	events;		/* list of queued events */
+	struct hlist_head	ev_hash[INOTIFY_EV_HASH_SIZE]; /* see below */
 	atomic_t		count;		/* reference count */
 	struct user_struct	*user;		/* user who opened this dev */
 	struct inotify_handle	*ih;		/* inotify handle */
@@ -94,6 +99,7 @@ struct inotify_device {
 struct inotify_kernel_event {
 	struct inotify_event	event;	/* the user-space event */
 	struct list_head        list;	/* entry in inotify_device's list */
+	struct hlist_node	hash;	/* entry in inotify_device's ev_hash */
 	char			*name;	/* filename, if any */
 };
 
@@ -199,6 +205,7 @@ static struct inotify_kernel_event * kernel_event(s32 wd, u32 mask, u32 cookie,
 	kevent->event.cookie = cookie;
 
 	INIT_LIST_HEAD(&kevent->list);
+	INIT_HLIST_NODE(&kevent->hash);
 
 	if (name) {
 		size_t len, rem, event_size = sizeof(struct inotify_event);
@@ -246,6 +253,45 @@ inotify_dev_get_event(struct inotify_device *dev)
 	return list_entry(dev->events.next, struct inotify_kernel_event, list);
 }
 
+/*
+ * The dev->ev_hash holds, for each (wd, name) that has events queued, the
+ * last one of them, so that a new event can be checked against it without
+ * walking the queue.
+ */
+static inline struct hlist_head *
+inotify_dev_hash(struct inotify_device *dev, s32 wd, const char *name)
+{
+	unsigned long hash = wd;
+
+	if (name)
+		hash ^= full_name_hash((const unsigned char *) name,
+				       strlen(name));
+	return &dev->ev_hash[hash_long(hash, INOTIFY_EV_HASH_BITS)];
+}
+
+/*
+ * inotify_dev_find_last - return the last queued event for (wd, name)
+ *
+ * Caller must hold dev->ev_mutex.
+ */
+static struct inotify_kernel_event *
+inotify_dev_find_last(struct hlist_head *head, s32 wd, const char *name)
+{
+	struct inotify_kernel_event *kevent;
+	struct hlist_node *pos;
+
+	hlist_for_each_entry(kevent, pos, head, hash) {
+		if (kevent->event.wd != wd)
+			continue;
+		if (!name && !kevent->name)
+			return kevent;
+		if (name && kevent->name && !strcmp(kevent->name, name))
+			return kevent;
+	}
+
+	return NULL;
+}
+
 /*
  * inotify_dev_queue_event - event handler registered with core inotify, adds
  * a new event to the given device
@@ -259,6 +305,7 @@ static void inotify_dev_queue_event(struct inotify_watch *w, u32 wd, u32 mask,
 	struct inotify_user_watch *watch;
 	struct inotify_device *dev;
 	struct inotify_kernel_event *kevent, *last;
+	struct hlist_head *head;
 
 	watch = container_of(w, struct inotify_user_watch, wdata);
 	dev = watch->dev;
@@ -271,17 +318,15 @@ static void inotify_dev_queue_event(struct inotify_watch *w, u32 wd, u32 mask,
 	if (mask & IN_IGNORED || mask & IN_ONESHOT)
 		put_inotify_watch(w); /* final put */
 
-	/* coalescing: drop this event if it is a dupe of the previous */
-	last = inotify_dev_get_event(dev);
-	if (last && last->event.mask == mask && last->event.wd == wd &&
-			last->event.cookie == cookie) {
-		const char *lastname = last->name;
-
-		if (!name && !lastname)
-			goto out;
-		if (name && lastname && !strcmp(lastname, name))
-			goto out;
-	}
+	/*
+	 * coalescing: drop this event if it is a dupe of the last one still
+	 * queued for the same watch and name, whatever was queued in between
+	 * for other names and watches.
+	 */
+	head = inotify_dev_hash(dev, wd, name);
+	last = inotify_dev_find_last(head, wd, name);
+	if (last && last->event.mask == mask && last->event.cookie == cookie)
+		goto out;
 
 	/* the queue overflowed and we already sent the Q_OVERFLOW event */
 	if (unlikely(dev->event_count > dev->max_events))
@@ -296,6 +341,12 @@ static void inotify_dev_queue_event(struct inotify_watch *w, u32 wd, u32 mask,
 	if (unlikely(!kevent))
 		goto out;
 
+	if (likely(kevent->event.mask != IN_Q_OVERFLOW)) {
+		if (last)
+			hlist_del_init(&last->hash);
+		hlist_add_head(&kevent->hash, head);
+	}
+
 	/* queue the event and wake up anyone waiting */
 	dev->event_count++;
 	dev->queue_size += sizeof(struct inotify_event) + kevent->event.len;
@@ -315,6 +366,7 @@ static void remove_kevent(struct inotify_device *dev,
 			  struct inotify_kernel_event *kevent)
 {
 	list_del(&kevent->list);
+	hlist_del_init(&kevent->hash);
 
 	dev->event_count--;
 	dev->queue_size -= sizeof(struct inotify_event) + kevent->event.len;
@@ -537,7 +589,7 @@ asmlinkage long sys_inotify_init(void)
 	struct inotify_handle *ih;
 	struct user_struct *user;
 	struct file *filp;
-	int fd, ret;
+	int fd, ret, i;
 
 	fd = get_unused_fd();
 	if (fd < 0)
@@ -578,6 +630,8 @@ asmlinkage long sys_inotify_init(void)
 	filp->private_data = dev;
 
 	INIT_LIST_HEAD(&dev->events);
+	for (i = 0; i < INOTIFY_EV_HASH_SIZE; i++)
+		INIT_HLIST_HEAD(&dev->ev_hash[i]);
 	init_waitqueue_head(&dev->wq);
 	mutex_init(&dev->ev_mutex);
 	mutex_init(&dev->up_mutex);
@@ -21,6 +21,9 @@
 #include <linux/mm.h>
 #include <linux/pagemap.h>
 #include <linux/smp_lock.h>
+#include <linux/highmem.h>
+#include <linux/crc32.h>
+#include <linux/blkdev.h>
 
 /*
  * Default IO end handler for temporary BJ_IO buffer_heads.
@@ -93,20 +96,28 @@ static int inverted_lock(journal_t *journal, struct buffer_head *bh)
 	return 1;
 }
 
-/* Done it all: now write the commit record.  We should have
+/* Done it all: now submit the commit record.  We should have
  * cleaned up our previous buffers by now, so if we are in abort
  * mode we can now just skip the rest of the journal write
  * entirely.
  *
+ * With an asynchronous commit the record goes out together with the
+ * rest of the transaction, and so goes without a barrier: only the
+ * checksum tells whether all of it made it to the log.
+ *
  * Returns 1 if the journal needs to be aborted or 0 on success
  */
-static int journal_write_commit_record(journal_t *journal,
-					transaction_t *commit_transaction)
+static int journal_submit_commit_record(journal_t *journal,
+					transaction_t *commit_transaction,
+					struct journal_head **cjh,
+					__u32 crc32_sum)
 {
 	struct journal_head *descriptor;
+	struct commit_header *tmp;
 	struct buffer_head *bh;
-	int i, ret;
-	int barrier_done = 0;
+	struct timespec now = current_kernel_time();
+
+	*cjh = NULL;
 
 	if (is_journal_aborted(journal))
 		return 0;
@@ -117,27 +128,53 @@ static int journal_write_commit_record(journal_t *journal,
 
 	bh = jh2bh(descriptor);
 
-	/* AKPM: buglet - add `i' to tmp! */
-	for (i = 0; i < bh->b_size; i += 512) {
-		journal_header_t *tmp = (journal_header_t*)bh->b_data;
-		tmp->h_magic = cpu_to_be32(JFS_MAGIC_NUMBER);
-		tmp->h_blocktype = cpu_to_be32(JFS_COMMIT_BLOCK);
-		tmp->h_sequence = cpu_to_be32(commit_transaction->t_tid);
+	tmp = (struct commit_header *)bh->b_data;
+	tmp->h_magic = cpu_to_be32(JFS_MAGIC_NUMBER);
+	tmp->h_blocktype = cpu_to_be32(JFS_COMMIT_BLOCK);
+	tmp->h_sequence = cpu_to_be32(commit_transaction->t_tid);
+	tmp->h_commit_sec = cpu_to_be64(now.tv_sec);
+	tmp->h_commit_nsec = cpu_to_be32(now.tv_nsec);
+
+	if (JFS_HAS_COMPAT_FEATURE(journal, JFS_FEATURE_COMPAT_CHECKSUM)) {
+		tmp->h_chksum_type	= JFS_CRC32_CHKSUM;
+		tmp->h_chksum_size	= JFS_CRC32_CHKSUM_SIZE;
+		tmp->h_chksum[0]	= cpu_to_be32(crc32_sum);
 	}
 
-	JBUFFER_TRACE(descriptor, "write commit block");
-	set_buffer_dirty(bh);
-	if (journal->j_flags & JFS_BARRIER) {
+	JBUFFER_TRACE(descriptor, "submit commit block");
+	lock_buffer(bh);
+	clear_buffer_dirty(bh);
+	set_buffer_uptodate(bh);
+	bh->b_end_io = journal_end_buffer_io_sync;
+
+	if (journal->j_flags & JFS_BARRIER &&
+	    !JFS_HAS_INCOMPAT_FEATURE(journal,
+				      JFS_FEATURE_INCOMPAT_ASYNC_COMMIT))
 		set_buffer_ordered(bh);
-		barrier_done = 1;
-	}
-	ret = sync_dirty_buffer(bh);
+	submit_bh(WRITE, bh);
+
+	*cjh = descriptor;
+	return 0;
+}
+
+/*
+ * Wait for the commit record written by journal_submit_commit_record().
+ *
+ * Returns 1 if the journal needs to be aborted or 0 on success
+ */
+static int journal_wait_on_commit_record(journal_t *journal,
+					 struct journal_head *descriptor)
+{
+	struct buffer_head *bh = jh2bh(descriptor);
+	int ret = 0;
+
+	wait_on_buffer(bh);
 	/* is it possible for another commit to fail at roughly
 	 * the same time as this one?  If so, we don't want to
 	 * trust the barrier flag in the super, but instead want
 	 * to remember if we sent a barrier request
 	 */
-	if (ret == -EOPNOTSUPP && barrier_done) {
+	if (buffer_eopnotsupp(bh) && buffer_ordered(bh)) {
 		char b[BDEVNAME_SIZE];
 
 		printk(KERN_WARNING
@@ -149,10 +186,15 @@ static int journal_write_commit_record(journal_t *journal,
 		spin_unlock(&journal->j_state_lock);
 
 		/* And try again, without the barrier */
+		clear_buffer_eopnotsupp(bh);
 		clear_buffer_ordered(bh);
 		set_buffer_uptodate(bh);
 		set_buffer_dirty(bh);
 		ret = sync_dirty_buffer(bh);
+	} else {
+		clear_buffer_ordered(bh);
+		if (!buffer_uptodate(bh))
+			ret = -EIO;
 	}
 	put_bh(bh);		/* One for getblk() */
 	journal_put_journal_head(descriptor);
@@ -160,6 +202,25 @@ static int journal_write_commit_record(journal_t *journal,
 	return (ret == -EIO);
 }
 
+/*
+ * The crc32 of a log block, added to @crc32_sum.  The block may be in
+ * high memory.
+ */
+static __u32 journal_checksum_data(__u32 crc32_sum, struct buffer_head *bh)
+{
+	struct page *page = bh->b_page;
+	char *addr;
+	__u32 checksum;
+
+	addr = kmap_atomic(page, KM_USER0);
+	checksum = crc32_be(crc32_sum,
+			    (void *)(addr + offset_in_page(bh->b_data)),
+			    bh->b_size);
+	kunmap_atomic(addr, KM_USER0);
+
+	return checksum;
+}
+
 /*
  * journal_commit_transaction
  *
@@ -182,6 +243,8 @@ void journal_commit_transaction(journal_t *journal)
 	int first_tag = 0;
 	int tag_flag;
 	int i;
+	struct journal_head *cjh = NULL;
+	__u32 crc32_sum = ~0;
 
 	/*
 	 * First job: lock down the current transaction and wait for
@@ -583,6 +646,15 @@ write_out_data:
 start_journal_io:
 			for (i = 0; i < bufs; i++) {
 				struct buffer_head *bh = wbuf[i];
+				/*
+				 * Compute checksum.
+				 */
+				if (JFS_HAS_COMPAT_FEATURE(journal,
+					JFS_FEATURE_COMPAT_CHECKSUM)) {
+					crc32_sum =
+					    journal_checksum_data(crc32_sum, bh);
+				}
+
 				lock_buffer(bh);
 				clear_buffer_dirty(bh);
 				set_buffer_uptodate(bh);
@@ -598,6 +670,16 @@ start_journal_io:
 		}
 	}
 
+	/* Done it all: with an asynchronous commit, the commit record can
+	 * go to the log right away, not waiting for the rest of the
+	 * transaction to get there.  The checksum in it covers them. */
+	if (JFS_HAS_INCOMPAT_FEATURE(journal,
+				     JFS_FEATURE_INCOMPAT_ASYNC_COMMIT)) {
+		if (journal_submit_commit_record(journal, commit_transaction,
+						 &cjh, crc32_sum))
+			__journal_abort_hard(journal);
+	}
+
 	/* Lo and behold: we have just managed to send a transaction to
            the log.  Before we can commit it, wait for the IO so far to
            complete.  Control buffers being written are on the
@@ -697,9 +779,22 @@ wait_for_iobuf:
 
 	jbd_debug(3, "JBD: commit phase 6\n");
 
-	if (journal_write_commit_record(journal, commit_transaction))
+	if (!JFS_HAS_INCOMPAT_FEATURE(journal,
+				      JFS_FEATURE_INCOMPAT_ASYNC_COMMIT)) {
+		if (journal_submit_commit_record(journal, commit_transaction,
+						 &cjh, crc32_sum))
+			err = -EIO;
+	}
+	if (cjh && journal_wait_on_commit_record(journal, cjh))
 		err = -EIO;
 
+	/* The commit record went without a barrier: make sure the
+	 * transaction is on the platter before it is checkpointed */
+	if (!err && (journal->j_flags & JFS_BARRIER) &&
+	    JFS_HAS_INCOMPAT_FEATURE(journal,
+				     JFS_FEATURE_INCOMPAT_ASYNC_COMMIT))
+		blkdev_issue_flush(journal->j_dev, NULL);
+
 	if (err)
 		__journal_abort_hard(journal);
 
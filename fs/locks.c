@@ -117,6 +117,7 @@
 #include <linux/capability.h>
 #include <linux/file.h>
 #include <linux/fs.h>
+#include <linux/hash.h>
 #include <linux/init.h>
 #include <linux/module.h>
 #include <linux/security.h>
@@ -140,8 +141,146 @@ int lease_break_time = 45;
 	for (lockp = &inode->i_flock; *lockp != NULL; lockp = &(*lockp)->fl_next)
 
 static LIST_HEAD(file_lock_list);
+
+/*
+ * Blocked POSIX waiters, for deadlock detection to find what the owner of
+ * a lock is waiting for.  They are hashed by owner, but for those of lock
+ * managers which compare owners their own way: those are on blocked_list.
+ */
+#define BLOCKED_HASH_BITS	7
+static struct list_head blocked_hash[1 << BLOCKED_HASH_BITS];
 static LIST_HEAD(blocked_list);
 
+static struct list_head *blocked_chain(struct file_lock *fl)
+{
+	if (fl->fl_lmops && fl->fl_lmops->fl_compare_owner)
+		return &blocked_list;
+	return &blocked_hash[hash_ptr(fl->fl_owner, BLOCKED_HASH_BITS)];
+}
+
+/*
+ * The POSIX locks of an inode are indexed by range as well, so that
+ * finding the ones overlapping a range does not mean walking all of them:
+ * those spanning less than POSIX_LOCK_SPAN bytes are in i_flock_tree,
+ * sorted by start, and the few longer ones on i_flock_long.  A short lock
+ * overlapping [start, end] starts between start - POSIX_LOCK_SPAN + 1 and
+ * end, so a query looks at that part of the tree and all of the list.
+ */
+#define POSIX_LOCK_SPAN		(1 << 20)
+
+static inline int posix_lock_is_long(struct file_lock *fl)
+{
+	return fl->fl_end - fl->fl_start >= POSIX_LOCK_SPAN;
+}
+
+static void posix_index_insert(struct inode *inode, struct file_lock *fl)
+{
+	struct rb_node **p = &inode->i_flock_tree.rb_node;
+	struct rb_node *parent = NULL;
+
+	if (posix_lock_is_long(fl)) {
+		hlist_add_head(&fl->fl_long, &inode->i_flock_long);
+		return;
+	}
+	while (*p) {
+		parent = *p;
+		if (fl->fl_start < rb_entry(parent, struct file_lock,
+					    fl_rb)->fl_start)
+			p = &parent->rb_left;
+		else
+			p = &parent->rb_right;
+	}
+	rb_link_node(&fl->fl_rb, parent, p);
+	rb_insert_color(&fl->fl_rb, &inode->i_flock_tree);
+}
+
+static void posix_index_remove(struct inode *inode, struct file_lock *fl)
+{
+	if (posix_lock_is_long(fl))
+		hlist_del(&fl->fl_long);
+	else
+		rb_erase(&fl->fl_rb, &inode->i_flock_tree);
+}
+
+/* Change the range of a POSIX lock on the inode's list */
+static void posix_lock_set_range(struct inode *inode, struct file_lock *fl,
+				 loff_t start, loff_t end)
+{
+	posix_index_remove(inode, fl);
+	fl->fl_start = start;
+	fl->fl_end = end;
+	posix_index_insert(inode, fl);
+}
+
+/* The first node of the tree for a lock starting at or after start */
+static struct rb_node *posix_index_first(struct inode *inode, loff_t start)
+{
+	struct rb_node *n = inode->i_flock_tree.rb_node;
+	struct rb_node *first = NULL;
+
+	while (n) {
+		if (rb_entry(n, struct file_lock, fl_rb)->fl_start >= start) {
+			first = n;
+			n = n->rb_left;
+		} else
+			n = n->rb_right;
+	}
+	return first;
+}
+
+/*
+ * The POSIX lock after fl (the first one if fl is NULL) overlapping
+ * [start, end].  fl must still be indexed, under the range it was
+ * found with.
+ */
+static struct file_lock *posix_index_next(struct inode *inode,
+		struct file_lock *fl, loff_t start, loff_t end)
+{
+	struct hlist_node *h;
+	struct rb_node *n;
+
+	if (!fl)
+		h = inode->i_flock_long.first;
+	else if (posix_lock_is_long(fl))
+		h = fl->fl_long.next;
+	else {
+		n = rb_next(&fl->fl_rb);
+		goto tree;
+	}
+	for (; h; h = h->next) {
+		fl = hlist_entry(h, struct file_lock, fl_long);
+		if (fl->fl_start <= end && fl->fl_end >= start)
+			return fl;
+	}
+	n = posix_index_first(inode, start - (POSIX_LOCK_SPAN - 1));
+tree:
+	for (; n; n = rb_next(n)) {
+		fl = rb_entry(n, struct file_lock, fl_rb);
+		if (fl->fl_start > end)
+			break;
+		if (fl->fl_end >= start)
+			return fl;
+	}
+	return NULL;
+}
+
+#define for_each_posix_lock(inode, fl, start, end) \
+	for (fl = posix_index_next(inode, NULL, start, end); fl; \
+	     fl = posix_index_next(inode, fl, start, end))
+
+/* POSIX locks go after the flock locks and leases on the inode's list */
+static struct file_lock **posix_lock_pos(struct inode *inode)
+{
+	struct file_lock **before;
+
+	for_each_lock(inode, before) {
+		struct file_lock *fl = *before;
+		if (IS_POSIX(fl))
+			break;
+	}
+	return before;
+}
+
 static kmem_cache_t *filelock_cache __read_mostly;
 
 /* Allocate an empty lock structure. */
@@ -182,6 +321,7 @@ void locks_init_lock(struct file_lock *fl)
 	INIT_LIST_HEAD(&fl->fl_block);
 	init_waitqueue_head(&fl->fl_wait);
 	fl->fl_next = NULL;
+	fl->fl_pprev = NULL;
 	fl->fl_fasync = NULL;
 	fl->fl_owner = NULL;
 	fl->fl_pid = 0;
@@ -530,7 +670,7 @@ static void locks_insert_block(struct file_lock *blocker,
 	list_add_tail(&waiter->fl_block, &blocker->fl_block);
 	waiter->fl_next = blocker;
 	if (IS_POSIX(blocker))
-		list_add(&waiter->fl_link, &blocked_list);
+		list_add(&waiter->fl_link, blocked_chain(waiter));
 }
 
 /* Wake up processes blocked waiting for blocker.
@@ -551,7 +691,8 @@ static void locks_wake_up_blocks(struct file_lock *blocker)
 }
 
 /* Insert file lock fl into an inode's lock list at the position indicated
- * by pos. At the same time add the lock to the global file lock list.
+ * by pos. At the same time add the lock to the global file lock list, and
+ * to the range index if it is a POSIX lock.
  */
 static void locks_insert_lock(struct file_lock **pos, struct file_lock *fl)
 {
@@ -559,8 +700,14 @@ static void locks_insert_lock(struct file_lock **pos, struct file_lock *fl)
 
 	/* insert into file's list */
 	fl->fl_next = *pos;
+	fl->fl_pprev = pos;
+	if (*pos)
+		(*pos)->fl_pprev = &fl->fl_next;
 	*pos = fl;
 
+	if (IS_POSIX(fl))
+		posix_index_insert(fl->fl_file->f_dentry->d_inode, fl);
+
 	if (fl->fl_ops && fl->fl_ops->fl_insert)
 		fl->fl_ops->fl_insert(fl);
 }
@@ -576,8 +723,13 @@ static void locks_delete_lock(struct file_lock **thisfl_p)
 	struct file_lock *fl = *thisfl_p;
 
 	*thisfl_p = fl->fl_next;
+	if (fl->fl_next)
+		fl->fl_next->fl_pprev = thisfl_p;
 	fl->fl_next = NULL;
+	fl->fl_pprev = NULL;
 	list_del_init(&fl->fl_link);
+	if (IS_POSIX(fl))
+		posix_index_remove(fl->fl_file->f_dentry->d_inode, fl);
 
 	fasync_helper(0, fl->fl_file, 0, &fl->fl_fasync);
 	if (fl->fl_fasync != NULL) {
@@ -669,15 +821,13 @@ int
 posix_test_lock(struct file *filp, struct file_lock *fl,
 		struct file_lock *conflock)
 {
+	struct inode *inode = filp->f_dentry->d_inode;
 	struct file_lock *cfl;
 
 	lock_kernel();
-	for (cfl = filp->f_dentry->d_inode->i_flock; cfl; cfl = cfl->fl_next) {
-		if (!IS_POSIX(cfl))
-			continue;
+	for_each_posix_lock(inode, cfl, fl->fl_start, fl->fl_end)
 		if (posix_locks_conflict(cfl, fl))
 			break;
-	}
 	if (cfl) {
 		__locks_copy_lock(conflock, cfl);
 		unlock_kernel();
@@ -711,6 +861,15 @@ static int posix_locks_deadlock(struct file_lock *caller_fl,
 next_task:
 	if (posix_same_owner(caller_fl, block_fl))
 		return 1;
+	list_for_each(tmp, &blocked_hash[hash_ptr(block_fl->fl_owner,
+						  BLOCKED_HASH_BITS)]) {
+		struct file_lock *fl = list_entry(tmp, struct file_lock, fl_link);
+		if (posix_same_owner(fl, block_fl)) {
+			fl = fl->fl_next;
+			block_fl = fl;
+			goto next_task;
+		}
+	}
 	list_for_each(tmp, &blocked_list) {
 		struct file_lock *fl = list_entry(tmp, struct file_lock, fl_link);
 		if (posix_same_owner(fl, block_fl)) {
@@ -808,8 +967,11 @@ static int __posix_lock_file_conf(struct inode *inode, struct file_lock *request
 	struct file_lock *new_fl2 = NULL;
 	struct file_lock *left = NULL;
 	struct file_lock *right = NULL;
-	struct file_lock **before;
-	int error, added = 0;
+	struct file_lock *merge = NULL;
+	struct file_lock *replace = NULL;
+	struct file_lock *keep = NULL, *next;
+	loff_t start, end;
+	int error;
 
 	/*
 	 * We may need two file_lock structures for this operation,
@@ -826,10 +988,8 @@ static int __posix_lock_file_conf(struct inode *inode, struct file_lock *request
 
 	lock_kernel();
 	if (request->fl_type != F_UNLCK) {
-		for_each_lock(inode, before) {
-			struct file_lock *fl = *before;
-			if (!IS_POSIX(fl))
-				continue;
+		for_each_posix_lock(inode, fl, request->fl_start,
+				    request->fl_end) {
 			if (!posix_locks_conflict(request, fl))
 				continue;
 			if (conflock)
@@ -852,126 +1012,96 @@ static int __posix_lock_file_conf(struct inode *inode, struct file_lock *request
 		goto out;
 
 	/*
-	 * Find the first old lock with the same owner as the new lock.
+	 * Look at the locks of the same owner adjacent to or overlapping the
+	 * new one: one of the same type is merged with it, others of another
+	 * type it covers make way for it (one of them may be reused for it),
+	 * and those it only partly covers are cut back.  Nothing is changed
+	 * until we know the operation can be done.
+	 *
+	 * In all comparisons of start vs end, use "start - 1" rather than
+	 * "end + 1". If end is OFFSET_MAX, end + 1 will become negative.
 	 */
-	
-	before = &inode->i_flock;
-
-	/* First skip locks owned by other processes.  */
-	while ((fl = *before) && (!IS_POSIX(fl) ||
-				  !posix_same_owner(request, fl))) {
-		before = &fl->fl_next;
-	}
-
-	/* Process locks with this owner.  */
-	while ((fl = *before) && posix_same_owner(request, fl)) {
-		/* Detect adjacent or overlapping regions (if same lock type)
-		 */
+	start = request->fl_start - 1;
+	end = request->fl_end == OFFSET_MAX ? OFFSET_MAX : request->fl_end + 1;
+	for_each_posix_lock(inode, fl, start, end) {
+		if (!posix_same_owner(request, fl))
+			continue;
 		if (request->fl_type == fl->fl_type) {
-			/* In all comparisons of start vs end, use
-			 * "start - 1" rather than "end + 1". If end
-			 * is OFFSET_MAX, end + 1 will become negative.
-			 */
-			if (fl->fl_end < request->fl_start - 1)
-				goto next_lock;
-			/* If the next lock in the list has entirely bigger
-			 * addresses than the new one, insert the lock here.
-			 */
-			if (fl->fl_start - 1 > request->fl_end)
-				break;
-
-			/* If we come here, the new and old lock are of the
-			 * same type and adjacent or overlapping. Make one
-			 * lock yielding from the lower start address of both
-			 * locks to the higher end address.
-			 */
-			if (fl->fl_start > request->fl_start)
-				fl->fl_start = request->fl_start;
-			else
-				request->fl_start = fl->fl_start;
-			if (fl->fl_end < request->fl_end)
-				fl->fl_end = request->fl_end;
-			else
-				request->fl_end = fl->fl_end;
-			if (added) {
-				locks_delete_lock(before);
-				continue;
-			}
-			request = fl;
-			added = 1;
-		}
-		else {
-			/* Processing for different lock types is a bit
-			 * more complex.
-			 */
-			if (fl->fl_end < request->fl_start)
-				goto next_lock;
-			if (fl->fl_start > request->fl_end)
-				break;
-			if (request->fl_type == F_UNLCK)
-				added = 1;
-			if (fl->fl_start < request->fl_start)
-				left = fl;
-			/* If the next lock in the list has a higher end
-			 * address than the new one, insert the new one here.
-			 */
-			if (fl->fl_end > request->fl_end) {
-				right = fl;
-				break;
-			}
-			if (fl->fl_start >= request->fl_start) {
-				/* The new lock completely replaces an old
-				 * one (This may happen several times).
-				 */
-				if (added) {
-					locks_delete_lock(before);
-					continue;
-				}
-				/* Replace the old lock with the new one.
-				 * Wake up anybody waiting for the old one,
-				 * as the change in lock type might satisfy
-				 * their needs.
-				 */
-				locks_wake_up_blocks(fl);
-				fl->fl_start = request->fl_start;
-				fl->fl_end = request->fl_end;
-				fl->fl_type = request->fl_type;
-				locks_release_private(fl);
-				locks_copy_private(fl, request);
-				request = fl;
-				added = 1;
-			}
+			if (!merge)
+				merge = fl;
+			continue;
 		}
-		/* Go on to next lock.
-		 */
-	next_lock:
-		before = &fl->fl_next;
+		if (!locks_overlap(fl, request))
+			continue;
+		if (fl->fl_start < request->fl_start)
+			left = fl;
+		if (fl->fl_end > request->fl_end)
+			right = fl;
+		else if (fl->fl_start >= request->fl_start && !replace)
+			replace = fl;
 	}
 
-	/*
-	 * The above code only modifies existing locks in case of
-	 * merging or replacing.  If new lock(s) need to be inserted
-	 * all modifications are done bellow this, so it's safe yet to
-	 * bail out.
-	 */
 	error = -ENOLCK; /* "no luck" */
 	if (right && left == right && !new_fl2)
 		goto out;
 
-	error = 0;
-	if (!added) {
-		if (request->fl_type == F_UNLCK) {
+	if (request->fl_type == F_UNLCK) {
+		error = 0;
+		if (!left && !right && !replace) {
 			if (request->fl_flags & FL_EXISTS)
 				error = -ENOENT;
 			goto out;
 		}
+		keep = NULL;
+	} else if (merge)
+		keep = merge;
+	else if (replace)
+		keep = replace;
+	else if (!new_fl)
+		goto out;
+	error = 0;
 
-		if (!new_fl) {
-			error = -ENOLCK;
-			goto out;
-		}
+	/*
+	 * Delete the locks the new one takes the place of, growing it over
+	 * those of the same type.  The locks cut back cannot be among them.
+	 */
+	for (fl = posix_index_next(inode, NULL, start, end); fl; fl = next) {
+		next = posix_index_next(inode, fl, start, end);
+		if (fl == keep || !posix_same_owner(request, fl))
+			continue;
+		if (request->fl_type == fl->fl_type) {
+			if (fl->fl_start < request->fl_start)
+				request->fl_start = fl->fl_start;
+			if (fl->fl_end > request->fl_end)
+				request->fl_end = fl->fl_end;
+		} else if (fl->fl_start < request->fl_start ||
+			   fl->fl_end > request->fl_end)
+			continue;
+		locks_delete_lock(fl->fl_pprev);
+	}
+
+	if (keep == merge && merge) {
+		if (merge->fl_start < request->fl_start)
+			request->fl_start = merge->fl_start;
+		if (merge->fl_end > request->fl_end)
+			request->fl_end = merge->fl_end;
+		posix_lock_set_range(inode, merge, request->fl_start,
+				     request->fl_end);
+	} else if (keep) {
+		/* Replace the old lock with the new one.
+		 * Wake up anybody waiting for the old one,
+		 * as the change in lock type might satisfy
+		 * their needs.
+		 */
+		locks_wake_up_blocks(keep);
+		posix_lock_set_range(inode, keep, request->fl_start,
+				     request->fl_end);
+		keep->fl_type = request->fl_type;
+		locks_release_private(keep);
+		locks_copy_private(keep, request);
+	} else if (request->fl_type != F_UNLCK) {
 		locks_copy_lock(new_fl, request);
-		locks_insert_lock(before, new_fl);
+		locks_insert_lock(posix_lock_pos(inode), new_fl);
 		new_fl = NULL;
 	}
 	if (right) {
@@ -982,13 +1112,15 @@ static int __posix_lock_file_conf(struct inode *inode, struct file_lock *request
 			left = new_fl2;
 			new_fl2 = NULL;
 			locks_copy_lock(left, right);
-			locks_insert_lock(before, left);
+			locks_insert_lock(posix_lock_pos(inode), left);
 		}
-		right->fl_start = request->fl_end + 1;
+		posix_lock_set_range(inode, right, request->fl_end + 1,
+				     right->fl_end);
 		locks_wake_up_blocks(right);
 	}
 	if (left) {
-		left->fl_end = request->fl_start - 1;
+		posix_lock_set_range(inode, left, left->fl_start,
+				     request->fl_start - 1);
 		locks_wake_up_blocks(left);
 	}
  out:
@@ -1010,7 +1142,7 @@ static int __posix_lock_file_conf(struct inode *inode, struct file_lock *request
  *
  * Add a POSIX style lock to a file.
  * We merge adjacent & overlapping locks whenever possible.
- * POSIX locks are sorted by owner task, then by starting address
+ * POSIX locks are indexed by range, see posix_index_next()
  *
  * Note that if called with an FL_EXISTS argument, the caller may determine
  * whether or not a lock was successfully freed by testing the return
@@ -1044,7 +1176,7 @@ EXPORT_SYMBOL(posix_lock_file_conf);
  *
  * Add a POSIX style lock to a file.
  * We merge adjacent & overlapping locks whenever possible.
- * POSIX locks are sorted by owner task, then by starting address
+ * POSIX locks are indexed by range, see posix_index_next()
  */
 int posix_lock_file_wait(struct file *filp, struct file_lock *fl)
 {
@@ -2227,6 +2359,10 @@ EXPORT_SYMBOL(lock_may_write);
 
 static int __init filelock_init(void)
 {
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(blocked_hash); i++)
+		INIT_LIST_HEAD(&blocked_hash[i]);
 	filelock_cache = kmem_cache_create("file_lock_cache",
 			sizeof(struct file_lock), 0, SLAB_PANIC,
 			init_once, NULL);
@@ -975,6 +975,193 @@ return_err:
 	return err;
 }
 
+/*
+ * MAY_EXEC from the mode bits alone, for the lockless walk.  Anything
+ * more (->permission(), capabilities) is left to the refcounted walk.
+ */
+static inline int exec_permission_rcu(struct inode *inode)
+{
+	umode_t	mode = inode->i_mode;
+
+	if (current->fsuid == inode->i_uid)
+		mode >>= 6;
+	else if (in_group_p(inode->i_gid))
+		mode >>= 3;
+
+	return mode & MAY_EXEC;
+}
+
+/*
+ * The lockless path walk: the path is resolved under rcu_read_lock(),
+ * without taking d_lock or a reference on the dentries on the way.  The
+ * d_seq of each dentry is checked instead, once what was needed of it has
+ * been read, and only the dentry the walk ends on gets a reference.
+ *
+ * Inodes are not RCU freed: one can go as soon as its dentry lets go of
+ * it, which bumps d_seq.  So an inode is only read before d_seq is checked
+ * again, and nothing is called on it: a directory with ->permission(), a
+ * security module looking at inodes and symlinks are left to the
+ * refcounted walk.  So are "..", ->d_hash(), ->d_compare() and
+ * ->d_revalidate(), the dentries not in the dcache, a second mount
+ * crossing, any error but a negative dentry, and any race.
+ *
+ * Returns -EAGAIN with nd untouched for the caller to do the refcounted
+ * walk.  Otherwise as __link_path_walk(): 0 with nd on the result, or the
+ * error with nd released.
+ */
+static int rcu_link_path_walk(const char *name, struct nameidata *nd)
+{
+	struct vfsmount *mnt = nd->mnt, *mounted = NULL;
+	struct dentry *dentry = nd->dentry;
+	struct inode_operations *iop;
+	struct inode *inode;
+	struct qstr this;
+	unsigned int lookup_flags = nd->flags;
+	unsigned seq;
+	int exec_ok;
+	int err = -EAGAIN;
+
+	if (!security_inode_permission_trivial())
+		return -EAGAIN;
+
+	while (*name == '/')
+		name++;
+	if (!*name)
+		return -EAGAIN;
+
+	rcu_read_lock();
+	/* nd holds the starting dentry, so its inode can't go */
+	seq = read_seqcount_begin(&dentry->d_seq);
+	inode = dentry->d_inode;
+	exec_ok = exec_permission_rcu(inode);
+	iop = inode->i_op;
+
+	for (;;) {
+		struct dentry *child;
+		unsigned long hash;
+		unsigned int c;
+
+		if (!exec_ok || (iop && iop->permission))
+			goto fallback;
+
+		this.name = name;
+		c = *(const unsigned char *)name;
+		hash = init_name_hash();
+		do {
+			name++;
+			hash = partial_name_hash(c, hash);
+			c = *(const unsigned char *)name;
+		} while (c && (c != '/'));
+		this.len = name - (const char *) this.name;
+		this.hash = end_name_hash(hash);
+
+		if (c) {
+			while (*++name == '/');
+			if (!*name)
+				lookup_flags |= LOOKUP_FOLLOW | LOOKUP_DIRECTORY;
+		}
+
+		if (this.name[0] == '.' &&
+		    (this.len == 1 || (this.len == 2 && this.name[1] == '.'))) {
+			if (this.len == 2 || !*name)
+				goto fallback;
+			continue;
+		}
+		if (!*name && (lookup_flags & LOOKUP_PARENT))
+			break;
+
+		if (dentry->d_op &&
+		    (dentry->d_op->d_hash || dentry->d_op->d_compare))
+			goto fallback;
+		child = __d_lookup_rcu(dentry, &this, &seq);
+		if (!child)
+			goto fallback;
+		if (child->d_op && child->d_op->d_revalidate)
+			goto fallback;
+
+		inode = child->d_inode;
+		if (inode) {
+			exec_ok = exec_permission_rcu(inode);
+			iop = inode->i_op;
+		}
+		if (read_seqcount_retry(&child->d_seq, seq))
+			goto fallback;
+		dentry = child;
+		if (!inode) {
+			err = -ENOENT;
+			goto out_release;
+		}
+
+		if (d_mountpoint(dentry)) {
+			/* the reference we took can't be dropped in here */
+			if (mounted)
+				goto fallback;
+			mounted = lookup_mnt(mnt, dentry);
+			if (mounted) {
+				mnt = mounted;
+				dentry = mnt->mnt_root;
+				if (d_mountpoint(dentry))
+					goto fallback;
+				/* pinned by the mount */
+				seq = read_seqcount_begin(&dentry->d_seq);
+				inode = dentry->d_inode;
+				exec_ok = exec_permission_rcu(inode);
+				iop = inode->i_op;
+			}
+		}
+
+		if (*name) {
+			if (!iop || iop->follow_link || !iop->lookup)
+				goto fallback;
+			continue;
+		}
+		if ((lookup_flags & LOOKUP_FOLLOW) && iop && iop->follow_link)
+			goto fallback;
+		if ((lookup_flags & LOOKUP_DIRECTORY) && (!iop || !iop->lookup))
+			goto fallback;
+		break;
+	}
+
+	if (dentry == nd->dentry || dentry == mnt->mnt_root) {
+		dget(dentry);
+	} else {
+		spin_lock(&dentry->d_lock);
+		if (read_seqcount_retry(&dentry->d_seq, seq) ||
+		    d_unhashed(dentry)) {
+			spin_unlock(&dentry->d_lock);
+			goto fallback;
+		}
+		atomic_inc(&dentry->d_count);
+		spin_unlock(&dentry->d_lock);
+	}
+	rcu_read_unlock();
+
+	if (lookup_flags & LOOKUP_PARENT) {
+		nd->last = this;
+		nd->last_type = LAST_NORM;
+	}
+	dput(nd->dentry);
+	nd->dentry = dentry;
+	if (mounted) {
+		mntput(nd->mnt);
+		nd->mnt = mounted;
+	}
+	return 0;
+
+out_release:
+	rcu_read_unlock();
+	if (mounted)
+		mntput(mounted);
+	path_release(nd);
+	return err;
+
+fallback:
+	rcu_read_unlock();
+	if (mounted)
+		mntput(mounted);
+	return -EAGAIN;
+}
+
 /*
  * Wrapper to retry pathname resolution whenever the underlying
  * file system returns an ESTALE.
@@ -984,9 +1171,17 @@ return_err:
  */
 int fastcall link_path_walk(const char *name, struct nameidata *nd)
 {
-	struct nameidata save = *nd;
+	struct nameidata save;
 	int result;
 
+	/* the lockless walk first, but not for the target of a symlink */
+	if (!nd->depth && !(nd->flags & LOOKUP_REVAL)) {
+		result = rcu_link_path_walk(name, nd);
+		if (result != -EAGAIN)
+			return result;
+	}
+
+	save = *nd;
 	/* make sure the stuff we saved doesn't go away */
 	dget(save.dentry);
 	mntget(save.mnt);
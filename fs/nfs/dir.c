@@ -31,10 +31,12 @@
 #include <linux/pagemap.h>
 #include <linux/smp_lock.h>
 #include <linux/namei.h>
+#include <linux/workqueue.h>
 
 #include "nfs4_fs.h"
 #include "delegation.h"
 #include "iostat.h"
+#include "internal.h"
 
 #define NFS_PARANOIA 1
 /* #define NFS_DEBUG_VERBOSE 1 */
@@ -150,7 +152,8 @@ typedef struct {
 	loff_t		current_index;
 	struct nfs_entry *entry;
 	decode_dirent_t	decode;
-	int		plus;
+	int		plus;		/* what to ask the server for */
+	int		page_plus;	/* what the current page holds */
 	int		error;
 } nfs_readdir_descriptor_t;
 
@@ -193,6 +196,11 @@ int nfs_readdir_filler(nfs_readdir_descriptor_t *desc, struct page *page)
 		}
 		goto error;
 	}
+	/* Pages of either kind may sit in the cache side by side */
+	if (desc->plus)
+		SetPageChecked(page);
+	else
+		ClearPageChecked(page);
 	SetPageUptodate(page);
 	spin_lock(&inode->i_lock);
 	NFS_I(inode)->cache_validity |= NFS_INO_INVALID_ATIME;
@@ -217,7 +225,7 @@ static inline
 int dir_decode(nfs_readdir_descriptor_t *desc)
 {
 	u32	*p = desc->ptr;
-	p = desc->decode(p, desc->entry, desc->plus);
+	p = desc->decode(p, desc->entry, desc->page_plus);
 	if (IS_ERR(p))
 		return PTR_ERR(p);
 	desc->ptr = p;
@@ -321,8 +329,8 @@ int find_dirent_page(nfs_readdir_descriptor_t *desc)
 	if (!PageUptodate(page))
 		goto read_error;
 
-	/* NOTE: Someone else may have changed the READDIRPLUS flag */
 	desc->page = page;
+	desc->page_plus = PageChecked(page);
 	desc->ptr = kmap(page);		/* matching kunmap in nfs_do_filldir */
 	if (*desc->dir_cookie != 0)
 		status = find_dirent(desc);
@@ -481,6 +489,7 @@ int uncached_readdir(nfs_readdir_descriptor_t *desc, void *dirent,
 	NFS_I(inode)->cache_validity |= NFS_INO_INVALID_ATIME;
 	spin_unlock(&inode->i_lock);
 	desc->page = page;
+	desc->page_plus = desc->plus;
 	desc->ptr = kmap(page);		/* matching kunmap in nfs_do_filldir */
 	if (desc->error >= 0) {
 		if ((status = dir_decode(desc)) == 0)
@@ -506,6 +515,182 @@ int uncached_readdir(nfs_readdir_descriptor_t *desc, void *dirent,
 	goto out;
 }
 
+/*
+ * READDIRPLUS costs the server a lookup of every entry, so it is only
+ * asked for while it pays: for the first batch of a small directory, and
+ * for the next batch of any directory whose entries were stat()ed since
+ * the last one, as nfs_getattr() advises.
+ */
+static int nfs_use_readdirplus(struct inode *dir, struct file *filp)
+{
+	int advised;
+
+	if (!nfs_server_capable(dir, NFS_CAP_READDIRPLUS))
+		return 0;
+	advised = test_and_clear_bit(NFS_INO_ADVISE_RDPLUS, &NFS_FLAGS(dir));
+	if (filp->f_pos == 0 && i_size_read(dir) <= NFS_LIMIT_READDIRPLUS)
+		return 1;
+	return advised;
+}
+
+/*
+ * Directory readahead: once getdents() has been through the cache, the
+ * pages after the last one it used are read in the background, so that
+ * the next call finds them there.  Each READDIR starts at the last
+ * cookie of the page before it, so they cannot but go one at a time;
+ * what is gained is that they go while the reader is busy with the
+ * entries it has.  One readahead runs per directory at a time.
+ */
+#define NFS_READDIR_RA_PAGES	8
+
+struct nfs_readdir_ra {
+	struct work_struct	work;
+	struct dentry		*dentry;
+	struct rpc_cred		*cred;
+	unsigned long		index;		/* the page to start after */
+	int			plus;
+	struct nfs_entry	entry;
+	struct nfs_fh		fh;
+	struct nfs_fattr	fattr;
+};
+
+static struct workqueue_struct *nfs_readdir_wq;
+
+/*
+ * Leave the cookie of the last entry of an uptodate page in @entry.
+ * Returns nonzero when there is nothing after the page.
+ */
+static int nfs_readdir_last_cookie(struct inode *dir, struct page *page,
+				   struct nfs_entry *entry)
+{
+	decode_dirent_t decode = NFS_PROTO(dir)->decode_dirent;
+	u32 *p = kmap(page);
+	int eof;
+
+	entry->eof = 0;
+	do {
+		p = decode(p, entry, PageChecked(page));
+	} while (!IS_ERR(p));
+	eof = entry->eof || PTR_ERR(p) != -EAGAIN;
+	kunmap(page);
+	return eof;
+}
+
+/*
+ * Read page @index + 1 of the directory, which @index is needed for.
+ * Called with the i_mutex held, as nfs_readdir_filler() is.  Returns
+ * nonzero when the readahead is to stop.
+ */
+static int nfs_readdir_ra_page(struct nfs_readdir_ra *ra, struct inode *dir,
+			       unsigned long index)
+{
+	struct address_space *mapping = dir->i_mapping;
+	struct page *page;
+	int error;
+
+	page = find_get_page(mapping, index);
+	if (page == NULL)
+		return 1;
+	/* the reader may have invalidated the cache since the last page */
+	if (!PageUptodate(page) || nfs_readdir_last_cookie(dir, page, &ra->entry)) {
+		page_cache_release(page);
+		return 1;
+	}
+	page_cache_release(page);
+
+	page = find_or_create_page(mapping, index + 1, GFP_KERNEL);
+	if (page == NULL)
+		return 1;
+	if (PageUptodate(page))
+		goto out;
+	error = NFS_PROTO(dir)->readdir(ra->dentry, ra->cred, ra->entry.cookie,
+					page, NFS_SERVER(dir)->dtsize, ra->plus);
+	if (error < 0) {
+		/* left for nfs_readdir_filler() to retry and report */
+		unlock_page(page);
+		page_cache_release(page);
+		return 1;
+	}
+	if (ra->plus)
+		SetPageChecked(page);
+	else
+		ClearPageChecked(page);
+	SetPageUptodate(page);
+	spin_lock(&dir->i_lock);
+	NFS_I(dir)->cache_validity |= NFS_INO_INVALID_ATIME;
+	spin_unlock(&dir->i_lock);
+ out:
+	unlock_page(page);
+	page_cache_release(page);
+	return 0;
+}
+
+static void nfs_readdir_ra_work(void *data)
+{
+	struct nfs_readdir_ra *ra = data;
+	struct inode *dir = ra->dentry->d_inode;
+	unsigned long index = ra->index;
+	int i, done;
+
+	for (i = 0; i <= NFS_READDIR_RA_PAGES; i++, index++) {
+		mutex_lock(&dir->i_mutex);
+		done = nfs_readdir_ra_page(ra, dir, index);
+		mutex_unlock(&dir->i_mutex);
+		if (done)
+			break;
+	}
+	clear_bit(NFS_INO_READDIR_RA, &NFS_FLAGS(dir));
+	if (ra->cred)
+		put_rpccred(ra->cred);
+	dput(ra->dentry);
+	kfree(ra);
+}
+
+static void nfs_readdir_readahead(nfs_readdir_descriptor_t *desc)
+{
+	struct dentry *dentry = desc->file->f_dentry;
+	struct inode *dir = dentry->d_inode;
+	struct rpc_cred *cred = nfs_file_cred(desc->file);
+	struct nfs_readdir_ra *ra;
+
+	if (test_and_set_bit(NFS_INO_READDIR_RA, &NFS_FLAGS(dir)))
+		return;
+	ra = kmalloc(sizeof(*ra), GFP_KERNEL);
+	if (ra == NULL) {
+		clear_bit(NFS_INO_READDIR_RA, &NFS_FLAGS(dir));
+		return;
+	}
+	ra->dentry = dget(dentry);
+	ra->cred = cred ? get_rpccred(cred) : NULL;
+	/* nfs_do_filldir() moved on past the page if it used it all */
+	ra->index = desc->page_index ? desc->page_index - 1 : 0;
+	ra->plus = desc->plus;
+	ra->entry.fh = &ra->fh;
+	ra->entry.fattr = &ra->fattr;
+	nfs_fattr_init(&ra->fattr);
+	INIT_WORK(&ra->work, nfs_readdir_ra_work, ra);
+	queue_work(nfs_readdir_wq, &ra->work);
+}
+
+/* Wait for the readaheads of a superblock going away to let go of it */
+void nfs_readdir_ra_flush(void)
+{
+	flush_workqueue(nfs_readdir_wq);
+}
+
+int __init nfs_init_readdir_ra(void)
+{
+	nfs_readdir_wq = create_workqueue("nfsreaddir");
+	if (nfs_readdir_wq == NULL)
+		return -ENOMEM;
+	return 0;
+}
+
+void nfs_destroy_readdir_ra(void)
+{
+	destroy_workqueue(nfs_readdir_wq);
+}
+
 /* The file offset position represents the dirent entry number.  A
    last cookie cache takes care of the common case of reading the
    whole directory.
@@ -545,7 +730,7 @@ static int nfs_readdir(struct file *filp, void *dirent, filldir_t filldir)
 	desc->file = filp;
 	desc->dir_cookie = &((struct nfs_open_context *)filp->private_data)->dir_cookie;
 	desc->decode = NFS_PROTO(inode)->decode_dirent;
-	desc->plus = NFS_USE_READDIRPLUS(inode);
+	desc->plus = nfs_use_readdirplus(inode, filp);
 
 	my_entry.cookie = my_entry.prev_cookie = 0;
 	my_entry.eof = 0;
@@ -568,7 +753,7 @@ static int nfs_readdir(struct file *filp, void *dirent, filldir_t filldir)
 			res = 0;
 			break;
 		}
-		if (res == -ETOOSMALL && desc->plus) {
+		if (res == -ETOOSMALL && desc->page_plus) {
 			clear_bit(NFS_INO_ADVISE_RDPLUS, &NFS_FLAGS(inode));
 			nfs_zap_caches(inode);
 			desc->plus = 0;
@@ -584,6 +769,8 @@ static int nfs_readdir(struct file *filp, void *dirent, filldir_t filldir)
 			break;
 		}
 	}
+	if (res >= 0 && !desc->entry->eof)
+		nfs_readdir_readahead(desc);
 	unlock_kernel();
 	if (res > 0)
 		res = 0;
@@ -1103,9 +1290,15 @@ static struct dentry *nfs_readdir_lookup(nfs_readdir_descriptor_t *desc)
 	}
 	name.hash = full_name_hash(name.name, name.len);
 	dentry = d_lookup(parent, &name);
-	if (dentry != NULL)
+	if (dentry != NULL) {
+		/* the attributes came for free, keep them */
+		if (desc->page_plus && dentry->d_inode != NULL &&
+		    (entry->fattr->valid & NFS_ATTR_FATTR) &&
+		    nfs_compare_fh(entry->fh, NFS_FH(dentry->d_inode)) == 0)
+			nfs_refresh_inode(dentry->d_inode, entry->fattr);
 		return dentry;
-	if (!desc->plus || !(entry->fattr->valid & NFS_ATTR_FATTR))
+	}
+	if (!desc->page_plus || !(entry->fattr->valid & NFS_ATTR_FATTR))
 		return NULL;
 	/* Note: caller is already holding the dir->i_mutex! */
 	dentry = d_alloc(parent, &name);
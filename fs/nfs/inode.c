@@ -196,9 +196,6 @@ nfs_init_locked(struct inode *inode, void *opaque)
 	return 0;
 }
 
-/* Don't use READDIRPLUS on directories that we believe are too large */
-#define NFS_LIMIT_READDIRPLUS (8*PAGE_SIZE)
-
 /*
  * This is our front-end to iget that looks up inodes by file handle
  * instead of inode number.
@@ -413,12 +410,33 @@ static void nfs_wake_up_inode(struct inode *inode)
 	wake_up_bit(&nfsi->flags, NFS_INO_REVALIDATING);
 }
 
+/*
+ * Entries are being stat()ed: the next getdents() of their directory
+ * had better bring their attributes along with it.
+ */
+static void nfs_advise_use_readdirplus(struct dentry *dentry)
+{
+	struct dentry *parent;
+	struct inode *dir;
+
+	if (IS_ROOT(dentry))
+		return;
+	parent = dget_parent(dentry);
+	dir = parent->d_inode;
+	if (dir->i_sb == dentry->d_sb &&
+	    nfs_server_capable(dir, NFS_CAP_READDIRPLUS))
+		set_bit(NFS_INO_ADVISE_RDPLUS, &NFS_FLAGS(dir));
+	dput(parent);
+}
+
 int nfs_getattr(struct vfsmount *mnt, struct dentry *dentry, struct kstat *stat)
 {
 	struct inode *inode = dentry->d_inode;
 	int need_atime = NFS_I(inode)->cache_validity & NFS_INO_INVALID_ATIME;
 	int err;
 
+	nfs_advise_use_readdirplus(dentry);
+
 	/* Flush out writes to the server in order to update c/mtime */
 	nfs_sync_inode_wait(inode, 0, 0, FLUSH_NOCOMMIT);
 
@@ -1164,6 +1182,10 @@ static int __init init_nfs_fs(void)
 	if (err)
 		goto out0;
 
+	err = nfs_init_readdir_ra();
+	if (err)
+		goto out_ra;
+
 #ifdef CONFIG_PROC_FS
 	rpc_proc_register(&nfs_rpcstat);
 #endif
@@ -1174,6 +1196,8 @@ out:
 #ifdef CONFIG_PROC_FS
 	rpc_proc_unregister("nfs");
 #endif
+	nfs_destroy_readdir_ra();
+out_ra:
 	nfs_destroy_directcache();
 out0:
 	nfs_destroy_writepagecache();
@@ -1189,6 +1213,7 @@ out4:
 
 static void __exit exit_nfs_fs(void)
 {
+	nfs_destroy_readdir_ra();
 	nfs_destroy_directcache();
 	nfs_destroy_writepagecache();
 	nfs_destroy_readpagecache();
@@ -45,6 +45,14 @@ extern void nfs_destroy_directcache(void);
 #define nfs_destroy_directcache() do {} while(0)
 #endif
 
+/* dir.c */
+/* Don't use READDIRPLUS on directories that we believe are too large */
+#define NFS_LIMIT_READDIRPLUS (8*PAGE_SIZE)
+
+extern int __init nfs_init_readdir_ra(void);
+extern void nfs_destroy_readdir_ra(void);
+extern void nfs_readdir_ra_flush(void);
+
 /* nfs2xdr.c */
 extern struct rpc_procinfo nfs_procedures[];
 extern u32 * nfs_decode_dirent(u32 *, struct nfs_entry *, int);
@@ -315,6 +315,9 @@ nfs_scan_lock_dirty(struct nfs_inode *nfsi, struct list_head *dst,
 				nfs_list_remove_request(req);
 				nfs_list_add_request(req, dst);
 				dec_zone_page_state(req->wb_page, NR_FILE_DIRTY);
+				dec_bdi_stat(
+				    req->wb_page->mapping->backing_dev_info,
+				    BDI_RECLAIMABLE);
 				res++;
 			}
 		}
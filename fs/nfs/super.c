@@ -402,6 +402,8 @@ static void nfs_show_mount_options(struct seq_file *m, struct nfs_server *nfss,
 			proto = buf;
 	}
 	seq_printf(m, ",proto=%s", proto);
+	if (nfss->client->cl_nxprts > 1 || showdefaults)
+		seq_printf(m, ",nconnect=%u", nfss->client->cl_nxprts);
 	seq_printf(m, ",timeo=%lu", 10U * nfss->retrans_timeo / HZ);
 	seq_printf(m, ",retrans=%u", nfss->retrans_count);
 	seq_printf(m, ",sec=%s", nfs_pseudoflavour_to_name(nfss->client->cl_auth->au_flavor));
@@ -618,6 +620,11 @@ nfs_sb_init(struct super_block *sb, rpc_authflavor_t authflavor)
 							 &sb->s_blocksize_bits);
 	server->wtmult = nfs_block_bits(fsinfo.wtmult, NULL);
 
+	/* enough WRITEs to keep every transport slot busy, and as many queued */
+	atomic_set(&server->write_rpcs, 0);
+	server->write_rpcs_max = 2 * server->client->cl_xprt->max_reqs *
+				 server->client->cl_nxprts;
+
 	server->dtsize = nfs_block_size(fsinfo.dtpref, NULL);
 	if (server->dtsize > PAGE_CACHE_SIZE)
 		server->dtsize = PAGE_CACHE_SIZE;
@@ -630,6 +637,7 @@ nfs_sb_init(struct super_block *sb, rpc_authflavor_t authflavor)
 		sb->s_flags |= MS_SYNCHRONOUS;
 	}
 	server->backing_dev_info.ra_pages = server->rpages * NFS_MAX_READAHEAD;
+	bdi_register(&server->backing_dev_info);
 
 	nfs_super_set_maxbytes(sb, fsinfo.maxfilesize);
 
@@ -713,6 +721,23 @@ nfs_create_client(struct nfs_server *server, const struct nfs_mount_data *data)
 	clnt->cl_intr     = 1;
 	clnt->cl_softrtry = 1;
 
+	/*
+	 * Further connections to the server, each with its own socket and
+	 * receive path, for the calls to be spread over.  One that cannot
+	 * be had is done without.
+	 */
+	if (proto == IPPROTO_TCP) {
+		int i, n = min_t(int, data->nconnect, RPC_MAX_XPRTS);
+
+		for (i = 1; i < n; i++) {
+			xprt = xprt_create_proto(proto, &server->addr, &timeparms);
+			if (IS_ERR(xprt))
+				break;
+			if (rpc_clnt_add_xprt(clnt, xprt) < 0)
+				break;
+		}
+	}
+
 	return clnt;
 
 out_fail:
@@ -999,6 +1024,8 @@ static int nfs_get_sb(struct file_system_type *fs_type,
 			}
 		case 5:
 			memset(data->context, 0, sizeof(data->context));
+		case 6:
+			data->nconnect = 0;
 	}
 #ifndef CONFIG_NFS_V3
 	/* If NFSv3 is not compiled in, return -EPROTONOSUPPORT */
@@ -1082,7 +1109,9 @@ static void nfs_kill_super(struct super_block *s)
 {
 	struct nfs_server *server = NFS_SB(s);
 
+	nfs_readdir_ra_flush();
 	kill_anon_super(s);
+	bdi_unregister(&server->backing_dev_info);
 
 	if (!IS_ERR(server->client))
 		rpc_shutdown_client(server->client);
@@ -1400,7 +1429,9 @@ static void nfs4_kill_super(struct super_block *sb)
 	struct nfs_server *server = NFS_SB(sb);
 
 	nfs_return_all_delegations(sb);
+	nfs_readdir_ra_flush();
 	kill_anon_super(sb);
+	bdi_unregister(&server->backing_dev_info);
 
 	nfs4_renewd_prepare_shutdown(server);
 
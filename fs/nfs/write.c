@@ -359,12 +359,11 @@ out:
 }
 
 /*
- * Note: causes nfs_update_request() to block on the assumption
- * 	 that the writeback is generated due to memory pressure.
+ * Writeback of any number of files may go on at once: it is the number
+ * of WRITEs in flight on the mount, below, that holds writers back.
  */
 int nfs_writepages(struct address_space *mapping, struct writeback_control *wbc)
 {
-	struct backing_dev_info *bdi = mapping->backing_dev_info;
 	struct inode *inode = mapping->host;
 	int err;
 
@@ -373,11 +372,6 @@ int nfs_writepages(struct address_space *mapping, struct writeback_control *wbc)
 	err = generic_writepages(mapping, wbc);
 	if (err)
 		return err;
-	while (test_and_set_bit(BDI_write_congested, &bdi->state) != 0) {
-		if (wbc->nonblocking)
-			return 0;
-		nfs_wait_on_write_congestion(mapping, 0);
-	}
 	err = nfs_flush_inode(inode, 0, 0, wb_priority(wbc));
 	if (err < 0)
 		goto out;
@@ -394,8 +388,6 @@ int nfs_writepages(struct address_space *mapping, struct writeback_control *wbc)
 		err = 0;
 	}
 out:
-	clear_bit(BDI_write_congested, &bdi->state);
-	wake_up_all(&nfs_write_congestion);
 	return err;
 }
 
@@ -490,6 +482,8 @@ nfs_mark_request_dirty(struct nfs_page *req)
 	nfsi->ndirty++;
 	spin_unlock(&nfsi->req_lock);
 	inc_zone_page_state(req->wb_page, NR_FILE_DIRTY);
+	inc_bdi_stat(req->wb_page->mapping->backing_dev_info,
+				BDI_RECLAIMABLE);
 	mark_inode_dirty(inode);
 }
 
@@ -518,6 +512,8 @@ nfs_mark_request_commit(struct nfs_page *req)
 	nfsi->ncommit++;
 	spin_unlock(&nfsi->req_lock);
 	inc_zone_page_state(req->wb_page, NR_UNSTABLE_NFS);
+	inc_bdi_stat(req->wb_page->mapping->backing_dev_info,
+				BDI_RECLAIMABLE);
 	mark_inode_dirty(inode);
 }
 #endif
@@ -591,6 +587,8 @@ static void nfs_cancel_commit_list(struct list_head *head)
 		nfs_list_remove_request(req);
 		nfs_inode_remove_request(req);
 		dec_zone_page_state(req->wb_page, NR_UNSTABLE_NFS);
+		dec_bdi_stat(req->wb_page->mapping->backing_dev_info,
+					BDI_RECLAIMABLE);
 		nfs_clear_page_writeback(req);
 	}
 }
@@ -971,11 +969,42 @@ static void nfs_write_rpcsetup(struct nfs_page *req,
 		(unsigned long long)data->args.offset);
 }
 
+/*
+ * WRITEs in flight are counted per mount.  Beyond write_rpcs_max of them
+ * the mount is marked write congested: nfs_update_request() then waits
+ * before dirtying more, and pdflush passes it over.  The mark goes once
+ * a quarter of them have completed.
+ */
+static void nfs_write_rpc_start(struct nfs_server *server)
+{
+	if (atomic_inc_return(&server->write_rpcs) >= server->write_rpcs_max)
+		set_bit(BDI_write_congested, &server->backing_dev_info.state);
+}
+
+static void nfs_write_rpc_end(struct nfs_server *server)
+{
+	unsigned int max = server->write_rpcs_max;
+
+	if (atomic_dec_return(&server->write_rpcs) <= max - max / 4 &&
+	    test_and_clear_bit(BDI_write_congested,
+			       &server->backing_dev_info.state))
+		wake_up_all(&nfs_write_congestion);
+}
+
+static void nfs_write_release(void *calldata)
+{
+	struct nfs_write_data *data = calldata;
+
+	nfs_write_rpc_end(NFS_SERVER(data->inode));
+	nfs_writedata_release(data);
+}
+
 static void nfs_execute_write(struct nfs_write_data *data)
 {
 	struct rpc_clnt *clnt = NFS_CLIENT(data->inode);
 	sigset_t oldset;
 
+	nfs_write_rpc_start(NFS_SERVER(data->inode));
 	rpc_clnt_sigmask(clnt, &oldset);
 	lock_kernel();
 	rpc_execute(&data->task);
@@ -1175,7 +1204,7 @@ static void nfs_writeback_done_partial(struct rpc_task *task, void *calldata)
 
 static const struct rpc_call_ops nfs_write_partial_ops = {
 	.rpc_call_done = nfs_writeback_done_partial,
-	.rpc_release = nfs_writedata_release,
+	.rpc_release = nfs_write_release,
 };
 
 /*
@@ -1236,7 +1265,7 @@ static void nfs_writeback_done_full(struct rpc_task *task, void *calldata)
 
 static const struct rpc_call_ops nfs_write_full_ops = {
 	.rpc_call_done = nfs_writeback_done_full,
-	.rpc_release = nfs_writedata_release,
+	.rpc_release = nfs_write_release,
 };
 
 
@@ -1387,6 +1416,8 @@ nfs_commit_list(struct inode *inode, struct list_head *head, int how)
 		nfs_list_remove_request(req);
 		nfs_mark_request_commit(req);
 		dec_zone_page_state(req->wb_page, NR_UNSTABLE_NFS);
+		dec_bdi_stat(req->wb_page->mapping->backing_dev_info,
+					BDI_RECLAIMABLE);
 		nfs_clear_page_writeback(req);
 	}
 	return -ENOMEM;
@@ -1411,6 +1442,8 @@ static void nfs_commit_done(struct rpc_task *task, void *calldata)
 		req = nfs_list_entry(data->pages.next);
 		nfs_list_remove_request(req);
 		dec_zone_page_state(req->wb_page, NR_UNSTABLE_NFS);
+		dec_bdi_stat(req->wb_page->mapping->backing_dev_info,
+					BDI_RECLAIMABLE);
 
 		dprintk("NFS: commit (%s/%Ld %d@%Ld)",
 			req->wb_context->dentry->d_inode->i_sb->s_id,
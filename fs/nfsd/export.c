@@ -57,6 +57,12 @@ static int		exp_verify_string(char *cp, int max);
 #define	EXPKEY_HASHMASK		(EXPKEY_HASHMAX -1)
 static struct cache_head *expkey_table[EXPKEY_HASHMAX];
 
+/* lockless lookups may still be matching against it: see cache.h */
+static void expkey_free_rcu(struct rcu_head *head)
+{
+	kfree(container_of(head, struct svc_expkey, h.rcu_head));
+}
+
 static void expkey_put(struct kref *ref)
 {
 	struct svc_expkey *key = container_of(ref, struct svc_expkey, h.ref);
@@ -67,7 +73,7 @@ static void expkey_put(struct kref *ref)
 		mntput(key->ek_mnt);
 	}
 	auth_domain_put(key->ek_client);
-	kfree(key);
+	call_rcu(&key->h.rcu_head, expkey_free_rcu);
 }
 
 static void expkey_request(struct cache_detail *cd,
@@ -319,13 +325,18 @@ svc_expkey_update(struct svc_expkey *new, struct svc_expkey *old)
 
 static struct cache_head *export_table[EXPORT_HASHMAX];
 
+static void svc_export_free_rcu(struct rcu_head *head)
+{
+	kfree(container_of(head, struct svc_export, h.rcu_head));
+}
+
 static void svc_export_put(struct kref *ref)
 {
 	struct svc_export *exp = container_of(ref, struct svc_export, h.ref);
 	dput(exp->ex_dentry);
 	mntput(exp->ex_mnt);
 	auth_domain_put(exp->ex_client);
-	kfree(exp);
+	call_rcu(&exp->h.rcu_head, svc_export_free_rcu);
 }
 
 static void svc_export_request(struct cache_detail *cd,
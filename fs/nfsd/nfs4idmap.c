@@ -94,11 +94,17 @@ ent_init(struct cache_head *cnew, struct cache_head *citm)
 	strlcpy(new->authname, itm->authname, sizeof(new->name));
 }
 
+static void
+ent_free_rcu(struct rcu_head *head)
+{
+	kfree(container_of(head, struct ent, h.rcu_head));
+}
+
 static void
 ent_put(struct kref *ref)
 {
 	struct ent *map = container_of(ref, struct ent, h.ref);
-	kfree(map);
+	call_rcu(&map->h.rcu_head, ent_free_rcu);
 }
 
 static struct cache_head *
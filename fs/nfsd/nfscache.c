@@ -16,6 +16,10 @@
 #include <linux/string.h>
 #include <linux/spinlock.h>
 #include <linux/list.h>
+#include <linux/hash.h>
+#include <linux/mm.h>
+#include <linux/swap.h>
+#include <net/checksum.h>
 
 #include <linux/sunrpc/svc.h>
 #include <linux/nfsd/nfsd.h>
@@ -26,13 +30,34 @@
  * 4.4BSD:	256
  * Solaris2:	1024
  * DEC Unix:	512-4096
+ *
+ * A busy server recycles a cache of fixed size faster than clients
+ * retransmit, so the number of entries grows with the memory of the
+ * machine and the number of nfsd threads, within the bounds below.
  */
-#define CACHESIZE		1024
-#define HASHSIZE		64
-#define REQHASH(xid)		((((xid) >> 24) ^ (xid)) & (HASHSIZE-1))
+#define RC_MIN_SIZE		1024
+#define RC_MAX_SIZE		(64 * 1024)
+#define RC_PER_THREAD		64	/* entries allowed per nfsd thread */
+#define RC_BUCKET_LEN		8	/* average entries per bucket aimed at */
+#define RC_EXPIRE		(120 * HZ)
+
+/* Bytes of the arguments covered by the checksum of an entry */
+#define RC_CSUMLEN		256U
 
-static struct hlist_head *	hash_list;
-static struct list_head 	lru_head;
+/*
+ * The cache is split into buckets by xid, each with its own lock and LRU
+ * list, oldest first.  An entry stays in the bucket of its xid, and is
+ * recycled within it.
+ */
+struct nfsd_drc_bucket {
+	struct list_head	lru_head;
+	spinlock_t		cache_lock;
+};
+
+static struct nfsd_drc_bucket *	drc_hashtbl;
+static unsigned int		drc_hashbits;
+static unsigned int		drc_mem_entries;
+static atomic_t			num_drc_entries;
 static int			cache_disabled = 1;
 
 static int	nfsd_cache_append(struct svc_rqst *rqstp, struct kvec *vec);
@@ -40,40 +65,85 @@ static int	nfsd_cache_append(struct svc_rqst *rqstp, struct kvec *vec);
 /* 
  * locking for the reply cache:
  * A cache entry is "single use" if c_state == RC_INPROG
- * Otherwise, it when accessing _prev or _next, the lock must be held.
+ * Otherwise, it when accessing _prev or _next, the lock of its bucket
+ * must be held.
  */
-static DEFINE_SPINLOCK(cache_lock);
 
-void
-nfsd_cache_init(void)
+static inline struct nfsd_drc_bucket *
+nfsd_cache_bucket(u32 xid)
+{
+	return &drc_hashtbl[hash_long(xid, drc_hashbits)];
+}
+
+/*
+ * The most entries the cache may hold: about 16 times the square root of
+ * the memory size in KB, or RC_PER_THREAD entries per running thread if
+ * more.
+ */
+static unsigned int
+nfsd_cache_size_limit(void)
+{
+	unsigned int limit;
+
+	limit = (16 * int_sqrt(totalram_pages)) << (PAGE_SHIFT - 10);
+	return min_t(unsigned int, max_t(unsigned int, limit, RC_MIN_SIZE),
+		     RC_MAX_SIZE);
+}
+
+static inline unsigned int
+nfsd_cache_limit(void)
+{
+	return max_t(unsigned int, drc_mem_entries,
+		     min_t(unsigned int, nfsdstats.th_cnt * RC_PER_THREAD,
+			   RC_MAX_SIZE));
+}
+
+static struct svc_cacherep *
+nfsd_cache_alloc(gfp_t gfp)
 {
 	struct svc_cacherep	*rp;
-	int			i;
-
-	INIT_LIST_HEAD(&lru_head);
-	i = CACHESIZE;
-	while(i) {
-		rp = kmalloc(sizeof(*rp), GFP_KERNEL);
-		if (!rp) break;
-		list_add(&rp->c_lru, &lru_head);
+
+	rp = kmalloc(sizeof(*rp), gfp);
+	if (rp) {
+		INIT_LIST_HEAD(&rp->c_lru);
 		rp->c_state = RC_UNUSED;
 		rp->c_type = RC_NOCACHE;
-		INIT_HLIST_NODE(&rp->c_hash);
-		i--;
+		atomic_inc(&num_drc_entries);
 	}
+	return rp;
+}
 
-	if (i)
-		printk (KERN_ERR "nfsd: cannot allocate all %d cache entries, only got %d\n",
-			CACHESIZE, CACHESIZE-i);
+static void
+nfsd_cache_free(struct svc_cacherep *rp)
+{
+	if (rp->c_type == RC_REPLBUFF)
+		kfree(rp->c_replvec.iov_base);
+	list_del(&rp->c_lru);
+	atomic_dec(&num_drc_entries);
+	kfree(rp);
+}
 
-	hash_list = kmalloc (HASHSIZE * sizeof(struct hlist_head), GFP_KERNEL);
-	if (!hash_list) {
-		nfsd_cache_shutdown();
+void
+nfsd_cache_init(void)
+{
+	unsigned int		i;
+
+	drc_mem_entries = nfsd_cache_size_limit();
+	drc_hashbits = long_log2(roundup_pow_of_two(drc_mem_entries /
+						    RC_BUCKET_LEN));
+	atomic_set(&num_drc_entries, 0);
+
+	drc_hashtbl = kmalloc((1 << drc_hashbits) * sizeof(*drc_hashtbl),
+			      GFP_KERNEL);
+	if (!drc_hashtbl) {
 		printk (KERN_ERR "nfsd: cannot allocate %Zd bytes for hash list\n",
-			HASHSIZE * sizeof(struct hlist_head));
+			(1 << drc_hashbits) * sizeof(*drc_hashtbl));
 		return;
 	}
-	memset(hash_list, 0, HASHSIZE * sizeof(struct hlist_head));
+	for (i = 0; i < (1 << drc_hashbits); i++) {
+		INIT_LIST_HEAD(&drc_hashtbl[i].lru_head);
+		spin_lock_init(&drc_hashtbl[i].cache_lock);
+	}
 
 	cache_disabled = 0;
 }
@@ -82,55 +152,98 @@ void
 nfsd_cache_shutdown(void)
 {
 	struct svc_cacherep	*rp;
-
-	while (!list_empty(&lru_head)) {
-		rp = list_entry(lru_head.next, struct svc_cacherep, c_lru);
-		if (rp->c_state == RC_DONE && rp->c_type == RC_REPLBUFF)
-			kfree(rp->c_replvec.iov_base);
-		list_del(&rp->c_lru);
-		kfree(rp);
-	}
+	unsigned int		i;
 
 	cache_disabled = 1;
 
-	kfree (hash_list);
-	hash_list = NULL;
+	if (!drc_hashtbl)
+		return;
+	for (i = 0; i < (1 << drc_hashbits); i++) {
+		struct list_head *head = &drc_hashtbl[i].lru_head;
+
+		while (!list_empty(head)) {
+			rp = list_entry(head->next, struct svc_cacherep, c_lru);
+			nfsd_cache_free(rp);
+		}
+	}
+
+	kfree (drc_hashtbl);
+	drc_hashtbl = NULL;
 }
 
 /*
  * Move cache entry to end of LRU list
  */
 static void
-lru_put_end(struct svc_cacherep *rp)
+lru_put_end(struct nfsd_drc_bucket *b, struct svc_cacherep *rp)
 {
-	list_move_tail(&rp->c_lru, &lru_head);
+	list_move_tail(&rp->c_lru, &b->lru_head);
 }
 
 /*
- * Move a cache entry from one hash list to another
+ * Checksum of the start of the arguments.  A client reusing an xid, after
+ * a reboot or once it has wrapped, sends other arguments with it, and must
+ * not be answered from the cache.
  */
-static void
-hash_refile(struct svc_cacherep *rp)
+static u32
+nfsd_cache_csum(struct svc_rqst *rqstp)
 {
-	hlist_del_init(&rp->c_hash);
-	hlist_add_head(&rp->c_hash, hash_list + REQHASH(rp->c_xid));
+	struct xdr_buf		*buf = &rqstp->rq_arg;
+	const unsigned char	*p = buf->head[0].iov_base;
+	size_t			csum_len, len;
+	unsigned int		base, idx;
+	u32			csum;
+
+	csum_len = min_t(size_t, buf->head[0].iov_len + buf->page_len,
+			 RC_CSUMLEN);
+	len = min_t(size_t, buf->head[0].iov_len, csum_len);
+	csum = csum_partial(p, len, 0);
+	csum_len -= len;
+
+	idx = buf->page_base >> PAGE_SHIFT;
+	base = buf->page_base & ~PAGE_MASK;
+	while (csum_len) {
+		p = page_address(buf->pages[idx]) + base;
+		len = min_t(size_t, PAGE_SIZE - base, csum_len);
+		csum = csum_partial(p, len, csum);
+		csum_len -= len;
+		base = 0;
+		idx++;
+	}
+	return csum;
+}
+
+/*
+ * The oldest entry of the bucket not in use by a thread, or NULL.
+ */
+static struct svc_cacherep *
+nfsd_cache_oldest(struct nfsd_drc_bucket *b)
+{
+	struct svc_cacherep	*rp;
+
+	list_for_each_entry(rp, &b->lru_head, c_lru)
+		if (rp->c_state != RC_INPROG)
+			return rp;
+	return NULL;
 }
 
 /*
  * Try to find an entry matching the current call in the cache. When none
- * is found, we grab the oldest unlocked entry off the LRU list.
+ * is found, we take a new entry while the cache is below its size, and
+ * the oldest unlocked entry of the bucket once it is not.
  * Note that no operation within the loop may sleep.
  */
 int
 nfsd_cache_lookup(struct svc_rqst *rqstp, int type)
 {
-	struct hlist_node	*hn;
-	struct hlist_head 	*rh;
-	struct svc_cacherep	*rp;
+	struct nfsd_drc_bucket	*b;
+	struct svc_cacherep	*rp, *new = NULL;
 	u32			xid = rqstp->rq_xid,
 				proto =  rqstp->rq_prot,
 				vers = rqstp->rq_vers,
-				proc = rqstp->rq_proc;
+				proc = rqstp->rq_proc,
+				csum;
+	unsigned int		len = rqstp->rq_arg.len;
 	unsigned long		age;
 	int rtn;
 
@@ -140,46 +253,47 @@ nfsd_cache_lookup(struct svc_rqst *rqstp, int type)
 		return RC_DOIT;
 	}
 
-	spin_lock(&cache_lock);
+	csum = nfsd_cache_csum(rqstp);
+	b = nfsd_cache_bucket(xid);
+
+	/* allocate before taking the lock, while there is room */
+	if (atomic_read(&num_drc_entries) < nfsd_cache_limit())
+		new = nfsd_cache_alloc(GFP_KERNEL);
+
+	spin_lock(&b->cache_lock);
 	rtn = RC_DOIT;
 
-	rh = &hash_list[REQHASH(xid)];
-	hlist_for_each_entry(rp, hn, rh, c_hash) {
+	list_for_each_entry(rp, &b->lru_head, c_lru) {
 		if (rp->c_state != RC_UNUSED &&
 		    xid == rp->c_xid && proc == rp->c_proc &&
 		    proto == rp->c_prot && vers == rp->c_vers &&
-		    time_before(jiffies, rp->c_timestamp + 120*HZ) &&
+		    time_before(jiffies, rp->c_timestamp + RC_EXPIRE) &&
 		    memcmp((char*)&rqstp->rq_addr, (char*)&rp->c_addr, sizeof(rp->c_addr))==0) {
+			if (csum != rp->c_csum || len != rp->c_len) {
+				/* same xid, other call */
+				nfsdstats.rccollisions++;
+				continue;
+			}
 			nfsdstats.rchits++;
 			goto found_entry;
 		}
 	}
 	nfsdstats.rcmisses++;
 
-	/* This loop shouldn't take more than a few iterations normally */
-	{
-	int	safe = 0;
-	list_for_each_entry(rp, &lru_head, c_lru) {
-		if (rp->c_state != RC_INPROG)
-			break;
-		if (safe++ > CACHESIZE) {
-			printk("nfsd: loop in repcache LRU list\n");
-			cache_disabled = 1;
-			goto out;
-		}
-	}
-	}
-
-	/* This should not happen */
-	if (rp == NULL) {
-		static int	complaints;
-
-		printk(KERN_WARNING "nfsd: all repcache entries locked!\n");
-		if (++complaints > 5) {
-			printk(KERN_WARNING "nfsd: disabling repcache.\n");
-			cache_disabled = 1;
-		}
-		goto out;
+	if (new) {
+		rp = new;
+		new = NULL;
+		list_add_tail(&rp->c_lru, &b->lru_head);
+	} else {
+		rp = nfsd_cache_oldest(b);
+		if (!rp) {
+			/* every entry of the bucket is in use */
+			rp = nfsd_cache_alloc(GFP_ATOMIC);
+			if (!rp)
+				goto out;
+			list_add_tail(&rp->c_lru, &b->lru_head);
+		} else
+			lru_put_end(b, rp);
 	}
 
 	rqstp->rq_cacherep = rp;
@@ -189,10 +303,10 @@ nfsd_cache_lookup(struct svc_rqst *rqstp, int type)
 	rp->c_addr = rqstp->rq_addr;
 	rp->c_prot = proto;
 	rp->c_vers = vers;
+	rp->c_csum = csum;
+	rp->c_len = len;
 	rp->c_timestamp = jiffies;
 
-	hash_refile(rp);
-
 	/* release any buffer */
 	if (rp->c_type == RC_REPLBUFF) {
 		kfree(rp->c_replvec.iov_base);
@@ -200,14 +314,18 @@ nfsd_cache_lookup(struct svc_rqst *rqstp, int type)
 	}
 	rp->c_type = RC_NOCACHE;
  out:
-	spin_unlock(&cache_lock);
+	spin_unlock(&b->cache_lock);
+	if (new) {
+		atomic_dec(&num_drc_entries);
+		kfree(new);
+	}
 	return rtn;
 
 found_entry:
 	/* We found a matching entry which is either in progress or done. */
 	age = jiffies - rp->c_timestamp;
 	rp->c_timestamp = jiffies;
-	lru_put_end(rp);
+	lru_put_end(b, rp);
 
 	rtn = RC_DROPIT;
 	/* Request being processed or excessive rexmits */
@@ -261,11 +379,13 @@ void
 nfsd_cache_update(struct svc_rqst *rqstp, int cachetype, u32 *statp)
 {
 	struct svc_cacherep *rp;
+	struct nfsd_drc_bucket *b;
 	struct kvec	*resv = &rqstp->rq_res.head[0], *cachv;
 	int		len;
 
 	if (!(rp = rqstp->rq_cacherep) || cache_disabled)
 		return;
+	b = nfsd_cache_bucket(rp->c_xid);
 
 	len = resv->iov_len - ((char*)statp - (char*)resv->iov_base);
 	len >>= 2;
@@ -286,22 +406,22 @@ nfsd_cache_update(struct svc_rqst *rqstp, int cachetype, u32 *statp)
 		cachv = &rp->c_replvec;
 		cachv->iov_base = kmalloc(len << 2, GFP_KERNEL);
 		if (!cachv->iov_base) {
-			spin_lock(&cache_lock);
+			spin_lock(&b->cache_lock);
 			rp->c_state = RC_UNUSED;
-			spin_unlock(&cache_lock);
+			spin_unlock(&b->cache_lock);
 			return;
 		}
 		cachv->iov_len = len << 2;
 		memcpy(cachv->iov_base, statp, len << 2);
 		break;
 	}
-	spin_lock(&cache_lock);
-	lru_put_end(rp);
+	spin_lock(&b->cache_lock);
+	lru_put_end(b, rp);
 	rp->c_secure = rqstp->rq_secure;
 	rp->c_type = cachetype;
 	rp->c_state = RC_DONE;
 	rp->c_timestamp = jiffies;
-	spin_unlock(&cache_lock);
+	spin_unlock(&b->cache_lock);
 	return;
 }
 
@@ -324,3 +444,18 @@ nfsd_cache_append(struct svc_rqst *rqstp, struct kvec *data)
 	vec->iov_len += data->iov_len;
 	return 1;
 }
+
+/*
+ * Reply cache statistics, see stats.c
+ */
+unsigned int
+nfsd_cache_entries(void)
+{
+	return atomic_read(&num_drc_entries);
+}
+
+unsigned int
+nfsd_cache_max_entries(void)
+{
+	return cache_disabled ? 0 : nfsd_cache_limit();
+}
@@ -18,6 +18,9 @@
  *	ra cache-size  <10%  <20%  <30% ... <100% not-found
  *			number of times that read-ahead entry was found that deep in
  *			the cache.
+ *	rcsize <entries> <max-entries> <collisions>
+ *			size of the reply cache, and calls not answered from
+ *			it because only their xid matched a cached one
  *	plus generic RPC stats (see net/sunrpc/stats.c)
  *
  * Copyright (C) 1995, 1996, 1997 Olaf Kirch <okir@monad.swb.de>
@@ -34,6 +37,7 @@
 #include <linux/sunrpc/stats.h>
 #include <linux/nfsd/nfsd.h>
 #include <linux/nfsd/stats.h>
+#include <linux/nfsd/cache.h>
 
 struct nfsd_stats	nfsdstats;
 struct svc_stat		nfsd_svcstats = {
@@ -68,6 +72,10 @@ static int nfsd_proc_show(struct seq_file *seq, void *v)
 	for (i=0; i<11; i++)
 		seq_printf(seq, " %u", nfsdstats.ra_depth[i]);
 	seq_putc(seq, '\n');
+
+	/* reply cache size and xid collisions */
+	seq_printf(seq, "rcsize %u %u %u\n", nfsd_cache_entries(),
+		   nfsd_cache_max_entries(), nfsdstats.rccollisions);
 	
 	/* show my rpc info */
 	svc_seq_show(seq, &nfsd_svcstats);
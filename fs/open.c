@@ -815,7 +815,7 @@ static struct file *__dentry_open(struct dentry *dentry, struct vfsmount *mnt,
 	f->f_vfsmnt = mnt;
 	f->f_pos = 0;//设置偏移为0
 	f->f_op = fops_get(inode->i_fop);//文件操作函数 来自inode
-	file_move(f, &inode->i_sb->s_files);//缓存到super block
+	file_sb_list_add(f, inode->i_sb);//缓存到super block
 
 	if (!open && f->f_op)
 		open = f->f_op->open;
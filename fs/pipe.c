@@ -16,6 +16,9 @@
 #include <linux/uio.h>
 #include <linux/highmem.h>
 #include <linux/pagemap.h>
+#include <linux/fcntl.h>
+#include <linux/capability.h>
+#include <linux/sysctl.h>
 
 #include <asm/uaccess.h>
 #include <asm/ioctls.h>
@@ -280,7 +283,7 @@ redo:
 			if (!buf->len) {
 				buf->ops = NULL;
 				ops->release(pipe, buf);
-				curbuf = (curbuf + 1) & (PIPE_BUFFERS-1);
+				curbuf = (curbuf + 1) & (pipe->buffers - 1);
 				pipe->curbuf = curbuf;
 				pipe->nrbufs = --bufs;
 				do_wakeup = 1;
@@ -369,7 +372,7 @@ pipe_writev(struct file *filp, const struct iovec *_iov,
 	chars = total_len & (PAGE_SIZE-1); /* size of the last buffer */
 	if (pipe->nrbufs && chars != 0) {
 		int lastbuf = (pipe->curbuf + pipe->nrbufs - 1) &
-							(PIPE_BUFFERS-1);
+							(pipe->buffers - 1);
 		struct pipe_buffer *buf = pipe->bufs + lastbuf;
 		struct pipe_buf_operations *ops = buf->ops;
 		int offset = buf->offset + buf->len;
@@ -415,8 +418,8 @@ redo1:
 			break;
 		}
 		bufs = pipe->nrbufs;
-		if (bufs < PIPE_BUFFERS) {
-			int newbuf = (pipe->curbuf + bufs) & (PIPE_BUFFERS-1);
+		if (bufs < pipe->buffers) {
+			int newbuf = (pipe->curbuf + bufs) & (pipe->buffers-1);
 			struct pipe_buffer *buf = pipe->bufs + newbuf;
 			struct page *page = pipe->tmp_page;
 			char *src;
@@ -477,7 +480,7 @@ redo2:
 			if (!total_len)
 				break;
 		}
-		if (bufs < PIPE_BUFFERS)
+		if (bufs < pipe->buffers)
 			continue;
 		if (filp->f_flags & O_NONBLOCK) {
 			if (!ret)
@@ -548,7 +551,7 @@ pipe_ioctl(struct inode *pino, struct file *filp,
 			nrbufs = pipe->nrbufs;
 			while (--nrbufs >= 0) {
 				count += pipe->bufs[buf].len;
-				buf = (buf+1) & (PIPE_BUFFERS-1);
+				buf = (buf+1) & (pipe->buffers - 1);
 			}
 			mutex_unlock(&inode->i_mutex);
 
@@ -579,7 +582,7 @@ pipe_poll(struct file *filp, poll_table *wait)
 	}
 
 	if (filp->f_mode & FMODE_WRITE) {
-		mask |= (nrbufs < PIPE_BUFFERS) ? POLLOUT | POLLWRNORM : 0;
+		mask |= (nrbufs < pipe->buffers) ? POLLOUT | POLLWRNORM : 0;
 		/*
 		 * Most Unices do not set POLLERR for FIFOs but on Linux they
 		 * behave exactly like pipes for poll().
@@ -814,25 +817,33 @@ struct pipe_inode_info * alloc_pipe_info(struct inode *inode)
 
 	pipe = kzalloc(sizeof(struct pipe_inode_info), GFP_KERNEL);
 	if (pipe) {
-		init_waitqueue_head(&pipe->wait);
-		pipe->r_counter = pipe->w_counter = 1;
-		pipe->inode = inode;
+		pipe->bufs = kcalloc(PIPE_DEF_BUFFERS,
+				     sizeof(struct pipe_buffer), GFP_KERNEL);
+		if (pipe->bufs) {
+			init_waitqueue_head(&pipe->wait);
+			pipe->r_counter = pipe->w_counter = 1;
+			pipe->inode = inode;
+			pipe->buffers = PIPE_DEF_BUFFERS;
+			return pipe;
+		}
+		kfree(pipe);
 	}
 
-	return pipe;
+	return NULL;
 }
 
 void __free_pipe_info(struct pipe_inode_info *pipe)
 {
 	int i;
 
-	for (i = 0; i < PIPE_BUFFERS; i++) {
+	for (i = 0; i < pipe->buffers; i++) {
 		struct pipe_buffer *buf = pipe->bufs + i;
 		if (buf->ops)
 			buf->ops->release(pipe, buf);
 	}
 	if (pipe->tmp_page)
 		__free_page(pipe->tmp_page);
+	kfree(pipe->bufs);
 	kfree(pipe);
 }
 
@@ -973,6 +984,131 @@ no_files:
 	return error;	
 }
 
+/*
+ * The most a user without CAP_SYS_RESOURCE may size a pipe to, in bytes,
+ * fs.pipe-max-size.  Always a power of two number of pages.
+ */
+unsigned int pipe_max_size = 1048576;
+
+/* The least, one page */
+unsigned int pipe_min_size = PAGE_SIZE;
+
+/*
+ * Round a pipe size in bytes up to a power of two number of pages, which
+ * the ring indexing needs.
+ */
+static unsigned int round_pipe_size(unsigned int size)
+{
+	unsigned long nr_pages;
+
+	nr_pages = (size + PAGE_SIZE - 1) >> PAGE_SHIFT;
+	return roundup_pow_of_two(nr_pages) << PAGE_SHIFT;
+}
+
+/*
+ * Sysctl handler of fs.pipe-max-size, for the rounding.
+ */
+int pipe_proc_fn(struct ctl_table *table, int write, struct file *file,
+		 void __user *buf, size_t *lenp, loff_t *ppos)
+{
+	int ret;
+
+	ret = proc_dointvec_minmax(table, write, file, buf, lenp, ppos);
+	if (ret || !write)
+		return ret;
+
+	pipe_max_size = round_pipe_size(pipe_max_size);
+	return ret;
+}
+
+/*
+ * Resize the ring of the pipe to @nr_pages buffers, keeping what it holds.
+ * Called under the pipe inode's i_mutex.
+ */
+static long pipe_set_size(struct pipe_inode_info *pipe, unsigned int nr_pages)
+{
+	struct pipe_buffer *bufs;
+	unsigned int head, tail;
+
+	/* What's in the pipe has to fit in the new ring */
+	if (nr_pages < pipe->nrbufs)
+		return -EBUSY;
+
+	bufs = kcalloc(nr_pages, sizeof(struct pipe_buffer), GFP_KERNEL);
+	if (unlikely(!bufs))
+		return -ENOMEM;
+
+	/*
+	 * The buffers from curbuf to the end of the old ring, and those
+	 * which wrapped around to its start, go in order at the start of
+	 * the new one.
+	 */
+	head = pipe->nrbufs;
+	tail = 0;
+	if (pipe->curbuf + pipe->nrbufs > pipe->buffers) {
+		head = pipe->buffers - pipe->curbuf;
+		tail = pipe->nrbufs - head;
+	}
+	if (head)
+		memcpy(bufs, pipe->bufs + pipe->curbuf,
+		       head * sizeof(struct pipe_buffer));
+	if (tail)
+		memcpy(bufs + head, pipe->bufs,
+		       tail * sizeof(struct pipe_buffer));
+
+	kfree(pipe->bufs);
+	pipe->bufs = bufs;
+	pipe->curbuf = 0;
+	pipe->buffers = nr_pages;
+	return nr_pages * PAGE_SIZE;
+}
+
+/**
+ * pipe_fcntl - F_SETPIPE_SZ and F_GETPIPE_SZ of a pipe or fifo
+ * @file: the file
+ * @cmd: the fcntl command
+ * @arg: for F_SETPIPE_SZ, the size asked for in bytes
+ *
+ * Returns the size of the pipe in bytes, which F_SETPIPE_SZ rounds up to a
+ * power of two number of pages.
+ */
+long pipe_fcntl(struct file *file, unsigned int cmd, unsigned long arg)
+{
+	struct inode *inode = file->f_dentry->d_inode;
+	struct pipe_inode_info *pipe;
+	unsigned int size;
+	long ret;
+
+	mutex_lock(&inode->i_mutex);
+	pipe = inode->i_pipe;
+	ret = -EBADF;
+	if (!pipe)
+		goto out;
+
+	switch (cmd) {
+	case F_SETPIPE_SZ:
+		ret = -EINVAL;
+		if (arg > INT_MAX)
+			break;
+		size = arg < pipe_min_size ? pipe_min_size : arg;
+		size = round_pipe_size(size);
+		ret = -EPERM;
+		if (size > pipe_max_size && !capable(CAP_SYS_RESOURCE))
+			break;
+		ret = pipe_set_size(pipe, size >> PAGE_SHIFT);
+		break;
+	case F_GETPIPE_SZ:
+		ret = pipe->buffers * PAGE_SIZE;
+		break;
+	default:
+		ret = -EINVAL;
+		break;
+	}
+out:
+	mutex_unlock(&inode->i_mutex);
+	return ret;
+}
+
 /*
  * pipefs should _never_ be mounted by userland - too much of security hassle,
  * no real gain from having the whole whorehouse mounted. So we don't need
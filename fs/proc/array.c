@@ -162,7 +162,7 @@ static inline char * task_state(struct task_struct *p, char *buffer)
 	int g;
 	struct fdtable *fdt = NULL;
 
-	read_lock(&tasklist_lock);
+	rcu_read_lock();
 	buffer += sprintf(buffer,
 		"State:\t%s\n"
 		"SleepAVG:\t%lu%%\n"
@@ -179,7 +179,7 @@ static inline char * task_state(struct task_struct *p, char *buffer)
 		pid_alive(p) && p->ptrace ? p->parent->pid : 0,
 		p->uid, p->euid, p->suid, p->fsuid,
 		p->gid, p->egid, p->sgid, p->fsgid);
-	read_unlock(&tasklist_lock);
+	rcu_read_unlock();
 	task_lock(p);
 	rcu_read_lock();
 	if (p->files)
@@ -248,6 +248,7 @@ static inline char * task_sig(struct task_struct *p, char *buffer)
 	int num_threads = 0;
 	unsigned long qsize = 0;
 	unsigned long qlim = 0;
+	unsigned long flags;
 
 	sigemptyset(&pending);
 	sigemptyset(&shpending);
@@ -256,9 +257,7 @@ static inline char * task_sig(struct task_struct *p, char *buffer)
 	sigemptyset(&caught);
 
 	/* Gather all the data with the appropriate locks held */
-	read_lock(&tasklist_lock);
-	if (p->sighand) {
-		spin_lock_irq(&p->sighand->siglock);
+	if (lock_task_sighand(p, &flags)) {
 		pending = p->pending.signal;
 		shpending = p->signal->shared_pending.signal;
 		blocked = p->blocked;
@@ -266,9 +265,8 @@ static inline char * task_sig(struct task_struct *p, char *buffer)
 		num_threads = atomic_read(&p->signal->count);
 		qsize = atomic_read(&p->user->sigpending);
 		qlim = p->signal->rlim[RLIMIT_SIGPENDING].rlim_cur;
-		spin_unlock_irq(&p->sighand->siglock);
+		unlock_task_sighand(p, &flags);
 	}
-	read_unlock(&tasklist_lock);
 
 	buffer += sprintf(buffer, "Threads:\t%d\n", num_threads);
 	buffer += sprintf(buffer, "SigQ:\t%lu/%lu\n", qsize, qlim);
@@ -293,6 +291,18 @@ static inline char *task_cap(struct task_struct *p, char *buffer)
 			    cap_t(p->cap_effective));
 }
 
+#ifdef CONFIG_NUMA_BALANCING
+static inline char *task_numa(struct task_struct *p, char *buffer)
+{
+	return buffer + sprintf(buffer, "NumaFaultsLocal:\t%lu\n"
+			    "NumaFaultsRemote:\t%lu\n"
+			    "NumaPreferredNode:\t%d\n",
+			    p->numa_faults_local,
+			    p->numa_faults_remote,
+			    p->numa_preferred_nid);
+}
+#endif
+
 int proc_pid_status(struct task_struct *task, char * buffer)
 {
 	char * orig = buffer;
@@ -302,12 +312,15 @@ int proc_pid_status(struct task_struct *task, char * buffer)
 	buffer = task_state(task, buffer);
  
 	if (mm) {
-		buffer = task_mem(mm, buffer);
+		buffer = task_mem(task, mm, buffer);
 		mmput(mm);
 	}
 	buffer = task_sig(task, buffer);
 	buffer = task_cap(task, buffer);
 	buffer = cpuset_task_status_allowed(task, buffer);
+#ifdef CONFIG_NUMA_BALANCING
+	buffer = task_numa(task, buffer);
+#endif
 #if defined(CONFIG_S390)
 	buffer = task_show_regs(task, buffer);
 #endif
@@ -332,6 +345,7 @@ static int do_task_stat(struct task_struct *task, char * buffer, int whole)
 	unsigned long rsslim = 0;
 	struct task_struct *t;
 	char tcomm[sizeof(task->comm)];
+	unsigned long flags;
 
 	state = *get_task_state(task);
 	vsize = eip = esp = 0;
@@ -347,9 +361,9 @@ static int do_task_stat(struct task_struct *task, char * buffer, int whole)
 	sigemptyset(&sigign);
 	sigemptyset(&sigcatch);
 	cutime = cstime = utime = stime = cputime_zero;
-	read_lock(&tasklist_lock);
-	if (task->sighand) {
-		spin_lock_irq(&task->sighand->siglock);
+	ppid = 0;
+	rcu_read_lock();
+	if (lock_task_sighand(task, &flags)) {
 		num_threads = atomic_read(&task->signal->count);
 		collect_sigign_sigcatch(task, &sigign, &sigcatch);
 
@@ -365,9 +379,6 @@ static int do_task_stat(struct task_struct *task, char * buffer, int whole)
 			} while (t != task);
 		}
 
-		spin_unlock_irq(&task->sighand->siglock);
-	}
-	if (task->signal) {
 		if (task->signal->tty) {
 			tty_pgrp = task->signal->tty->pgrp;
 			tty_nr = new_encode_dev(tty_devnum(task->signal->tty));
@@ -385,9 +396,10 @@ static int do_task_stat(struct task_struct *task, char * buffer, int whole)
 			utime = cputime_add(utime, task->signal->utime);
 			stime = cputime_add(stime, task->signal->stime);
 		}
+		ppid = rcu_dereference(task->group_leader->real_parent)->tgid;
+		unlock_task_sighand(task, &flags);
 	}
-	ppid = pid_alive(task) ? task->group_leader->real_parent->tgid : 0;
-	read_unlock(&tasklist_lock);
+	rcu_read_unlock();
 
 	if (!whole || num_threads<2)
 		wchan = get_wchan(task);
@@ -1,5 +1,6 @@
 #include <linux/mm.h>
 #include <linux/hugetlb.h>
+#include <linux/huge_mm.h>
 #include <linux/mount.h>
 #include <linux/seq_file.h>
 #include <linux/highmem.h>
@@ -11,7 +12,7 @@
 #include <asm/tlbflush.h>
 #include "internal.h"
 
-char *task_mem(struct mm_struct *mm, char *buffer)
+char *task_mem(struct task_struct *task, struct mm_struct *mm, char *buffer)
 {
 	unsigned long data, text, lib;
 	unsigned long hiwater_vm, total_vm, hiwater_rss, total_rss;
@@ -26,7 +27,7 @@ char *task_mem(struct mm_struct *mm, char *buffer)
 	hiwater_vm = total_vm = mm->total_vm;
 	if (hiwater_vm < mm->hiwater_vm)
 		hiwater_vm = mm->hiwater_vm;
-	hiwater_rss = total_rss = get_mm_rss(mm);
+	hiwater_rss = total_rss = get_mm_rss_exact(task, mm);
 	if (hiwater_rss < mm->hiwater_rss)
 		hiwater_rss = mm->hiwater_rss;
 
@@ -245,6 +246,39 @@ static void smaps_pte_range(struct vm_area_struct *vma, pmd_t *pmd,
 	cond_resched();
 }
 
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+/*
+ * A transparent huge page is only ever mapped by one pmd of one mm, so
+ * what it maps is all private.  Returns 0 if the pmd was split under us.
+ */
+static int smaps_huge_pmd(struct vm_area_struct *vma, pmd_t *pmd,
+				unsigned long addr, unsigned long end,
+				struct mem_size_stats *mss)
+{
+	struct mm_struct *mm = vma->vm_mm;
+	int ret = 0;
+
+	spin_lock(&mm->page_table_lock);
+	if (pmd_trans_huge(*pmd)) {
+		mss->resident += end - addr;
+		if (pte_dirty(huge_pmd_pte(*pmd)))
+			mss->private_dirty += end - addr;
+		else
+			mss->private_clean += end - addr;
+		ret = 1;
+	}
+	spin_unlock(&mm->page_table_lock);
+	return ret;
+}
+#else
+static inline int smaps_huge_pmd(struct vm_area_struct *vma, pmd_t *pmd,
+				unsigned long addr, unsigned long end,
+				struct mem_size_stats *mss)
+{
+	return 0;
+}
+#endif
+
 static inline void smaps_pmd_range(struct vm_area_struct *vma, pud_t *pud,
 				unsigned long addr, unsigned long end,
 				struct mem_size_stats *mss)
@@ -255,6 +289,9 @@ static inline void smaps_pmd_range(struct vm_area_struct *vma, pud_t *pud,
 	pmd = pmd_offset(pud, addr);
 	do {
 		next = pmd_addr_end(addr, end);
+		if (pmd_trans_huge(*pmd) &&
+		    smaps_huge_pmd(vma, pmd, addr, next, mss))
+			continue;
 		if (pmd_none_or_clear_bad(pmd))
 			continue;
 		smaps_pte_range(vma, pmd, addr, next, mss);
@@ -170,11 +170,7 @@ static int max_select_fd(unsigned long n, fd_set_bits *fds)
 		if (max)
 			continue;
 get_max:
-		do {
-			max++;
-			set >>= 1;
-		} while (set);
-		max += n * __NFDBITS;
+		max = fls_long(set) + n * __NFDBITS;
 	}
 
 	return max;
@@ -217,26 +213,29 @@ int do_select(int n, fd_set_bits *fds, s64 *timeout)
 		inp = fds->in; outp = fds->out; exp = fds->ex;
 		rinp = fds->res_in; routp = fds->res_out; rexp = fds->res_ex;
 
-		for (i = 0; i < n; ++rinp, ++routp, ++rexp) {
-			unsigned long in, out, ex, all_bits, bit = 1, mask, j;
+		for (i = 0; i < n; i += __NFDBITS, ++rinp, ++routp, ++rexp) {
+			unsigned long in, out, ex, all_bits, bit, mask;
 			unsigned long res_in = 0, res_out = 0, res_ex = 0;
 			const struct file_operations *f_op = NULL;
 			struct file *file = NULL;
+			int fd;
 
 			in = *inp++; out = *outp++; ex = *exp++;
 			all_bits = in | out | ex;
-			if (all_bits == 0) {
-				i += __NFDBITS;
+			if (all_bits == 0)
 				continue;
-			}
 
-			for (j = 0; j < __NFDBITS; ++j, ++i, bit <<= 1) {
+			/* Only visit the bits that are set, lowest first */
+			while (all_bits) {
 				int fput_needed;
-				if (i >= n)
+
+				fd = __ffs(all_bits);
+				bit = 1UL << fd;
+				all_bits &= ~bit;
+				fd += i;
+				if (fd >= n)
 					break;
-				if (!(bit & all_bits))
-					continue;
-				file = fget_light(i, &fput_needed);
+				file = fget_light(fd, &fput_needed);
 				if (file) {
 					f_op = file->f_op;
 					mask = DEFAULT_POLLMASK;
@@ -256,8 +255,8 @@ int do_select(int n, fd_set_bits *fds, s64 *timeout)
 						retval++;
 					}
 				}
-				cond_resched();
 			}
+			cond_resched();
 			if (res_in)
 				*rinp = res_in;
 			if (res_out)
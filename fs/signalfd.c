@@ -0,0 +1,282 @@
+/*
+ *  fs/signalfd.c
+ *
+ *  signalfd(): receive signals through a file descriptor.
+ *
+ *  A read() dequeues as many of the caller's pending signals in the
+ *  signalfd's mask as fit in the buffer, holding siglock once for all of
+ *  them, and returns a struct signalfd_siginfo for each.  A process that
+ *  fields a high rate of queued signals, from timers or from I/O, takes
+ *  them in batches instead of one handler invocation apiece.  The
+ *  signals should be blocked, or their handlers will have them first.
+ *
+ *  The descriptor polls readable while one of the signals is pending for
+ *  the caller.  Waiting is done on the signal handlers of the task that
+ *  created the signalfd, which are kept around until it is closed, so
+ *  it is meant to be used by the threads that share them.
+ */
+
+#include <linux/file.h>
+#include <linux/poll.h>
+#include <linux/fs.h>
+#include <linux/anon_inodes.h>
+#include <linux/slab.h>
+#include <linux/sched.h>
+#include <linux/signal.h>
+#include <linux/syscalls.h>
+#include <linux/compat.h>
+#include <linux/signalfd.h>
+#include <asm/uaccess.h>
+
+/* signals dequeued per read(), under one hold of siglock */
+#define SIGNALFD_BATCH	32
+
+struct signalfd_ctx {
+	sigset_t sigmask;		/* the signals not wanted */
+	struct sighand_struct *sighand;	/* pinned: whose queue poll waits on */
+};
+
+static int signalfd_release(struct inode *inode, struct file *file)
+{
+	struct signalfd_ctx *ctx = file->private_data;
+
+	__cleanup_sighand(ctx->sighand);
+	kfree(ctx);
+	return 0;
+}
+
+static unsigned int signalfd_poll(struct file *file, poll_table *wait)
+{
+	struct signalfd_ctx *ctx = file->private_data;
+	unsigned int events = 0;
+
+	poll_wait(file, &ctx->sighand->signalfd_wqh, wait);
+
+	spin_lock_irq(&current->sighand->siglock);
+	if (next_signal(&current->pending, &ctx->sigmask) ||
+	    next_signal(&current->signal->shared_pending, &ctx->sigmask))
+		events |= POLLIN;
+	spin_unlock_irq(&current->sighand->siglock);
+
+	return events;
+}
+
+/*
+ * Copy a siginfo_t to userspace as a struct signalfd_siginfo, filling
+ * in the fields that go with its si_code as copy_siginfo_to_user() does.
+ */
+static int signalfd_copyinfo(struct signalfd_siginfo __user *uinfo,
+			     siginfo_t const *kinfo)
+{
+	long err;
+
+	err = __clear_user(uinfo, sizeof(*uinfo));
+	err |= __put_user(kinfo->si_signo, &uinfo->ssi_signo);
+	err |= __put_user(kinfo->si_errno, &uinfo->ssi_errno);
+	err |= __put_user((__s32) kinfo->si_code, &uinfo->ssi_code);
+	switch (kinfo->si_code & __SI_MASK) {
+	case __SI_KILL:
+		err |= __put_user(kinfo->si_pid, &uinfo->ssi_pid);
+		err |= __put_user(kinfo->si_uid, &uinfo->ssi_uid);
+		break;
+	case __SI_TIMER:
+		err |= __put_user(kinfo->si_tid, &uinfo->ssi_tid);
+		err |= __put_user(kinfo->si_overrun, &uinfo->ssi_overrun);
+		err |= __put_user((long) kinfo->si_ptr, &uinfo->ssi_ptr);
+		err |= __put_user(kinfo->si_int, &uinfo->ssi_int);
+		break;
+	case __SI_POLL:
+		err |= __put_user(kinfo->si_band, &uinfo->ssi_band);
+		err |= __put_user(kinfo->si_fd, &uinfo->ssi_fd);
+		break;
+	case __SI_FAULT:
+		err |= __put_user((long) kinfo->si_addr, &uinfo->ssi_addr);
+#ifdef __ARCH_SI_TRAPNO
+		err |= __put_user(kinfo->si_trapno, &uinfo->ssi_trapno);
+#endif
+		break;
+	case __SI_CHLD:
+		err |= __put_user(kinfo->si_pid, &uinfo->ssi_pid);
+		err |= __put_user(kinfo->si_uid, &uinfo->ssi_uid);
+		err |= __put_user(kinfo->si_status, &uinfo->ssi_status);
+		err |= __put_user(kinfo->si_utime, &uinfo->ssi_utime);
+		err |= __put_user(kinfo->si_stime, &uinfo->ssi_stime);
+		break;
+	case __SI_RT:
+	case __SI_MESGQ:
+	default:
+		/* sigqueue() and the like: si_code < 0 lands here too */
+		err |= __put_user(kinfo->si_pid, &uinfo->ssi_pid);
+		err |= __put_user(kinfo->si_uid, &uinfo->ssi_uid);
+		err |= __put_user((long) kinfo->si_ptr, &uinfo->ssi_ptr);
+		err |= __put_user(kinfo->si_int, &uinfo->ssi_int);
+		break;
+	}
+
+	return err ? -EFAULT : 0;
+}
+
+/* Called with siglock held, which dequeue_signal() may drop and retake */
+static int signalfd_dequeue(struct signalfd_ctx *ctx, siginfo_t *info,
+			    int max)
+{
+	int nr;
+
+	for (nr = 0; nr < max; nr++)
+		if (!dequeue_signal(current, &ctx->sigmask, info + nr))
+			break;
+	return nr;
+}
+
+static ssize_t signalfd_read(struct file *file, char __user *buf,
+			     size_t count, loff_t *ppos)
+{
+	struct signalfd_ctx *ctx = file->private_data;
+	struct signalfd_siginfo __user *uinfo;
+	DECLARE_WAITQUEUE(wait, current);
+	siginfo_t *info;
+	ssize_t ret = 0;
+	int i, nr, max;
+
+	max = count / sizeof(struct signalfd_siginfo);
+	if (!max)
+		return -EINVAL;
+	if (max > SIGNALFD_BATCH)
+		max = SIGNALFD_BATCH;
+	uinfo = (struct signalfd_siginfo __user *) buf;
+	if (!access_ok(VERIFY_WRITE, uinfo, max * sizeof(*uinfo)))
+		return -EFAULT;
+
+	info = kmalloc(max * sizeof(siginfo_t), GFP_KERNEL);
+	if (!info)
+		return -ENOMEM;
+
+	spin_lock_irq(&current->sighand->siglock);
+	nr = signalfd_dequeue(ctx, info, max);
+	if (!nr && (file->f_flags & O_NONBLOCK))
+		ret = -EAGAIN;
+	else if (!nr) {
+		add_wait_queue(&current->sighand->signalfd_wqh, &wait);
+		for (;;) {
+			set_current_state(TASK_INTERRUPTIBLE);
+			nr = signalfd_dequeue(ctx, info, max);
+			if (nr)
+				break;
+			if (signal_pending(current)) {
+				ret = -ERESTARTSYS;
+				break;
+			}
+			spin_unlock_irq(&current->sighand->siglock);
+			schedule();
+			spin_lock_irq(&current->sighand->siglock);
+		}
+		__set_current_state(TASK_RUNNING);
+		remove_wait_queue(&current->sighand->signalfd_wqh, &wait);
+	}
+	spin_unlock_irq(&current->sighand->siglock);
+
+	for (i = 0; i < nr; i++)
+		if (signalfd_copyinfo(uinfo + i, info + i)) {
+			ret = -EFAULT;
+			break;
+		}
+	if (i)
+		ret = i * sizeof(*uinfo);
+
+	kfree(info);
+	return ret;
+}
+
+static const struct file_operations signalfd_fops = {
+	.release	= signalfd_release,
+	.poll		= signalfd_poll,
+	.read		= signalfd_read,
+};
+
+static int signalfd_create(sigset_t *sigmask)
+{
+	struct signalfd_ctx *ctx;
+	int fd;
+
+	ctx = kmalloc(sizeof(*ctx), GFP_KERNEL);
+	if (!ctx)
+		return -ENOMEM;
+	ctx->sigmask = *sigmask;
+	ctx->sighand = current->sighand;
+	atomic_inc(&ctx->sighand->count);
+
+	fd = anon_inode_getfd(&signalfd_fops, ctx, O_RDONLY);
+	if (fd < 0) {
+		__cleanup_sighand(ctx->sighand);
+		kfree(ctx);
+	}
+	return fd;
+}
+
+/**
+ * sys_signalfd - receive signals through a file descriptor
+ * @ufd: -1 for a new signalfd, or one whose mask is to be replaced
+ * @user_mask: the signals to receive
+ * @sizemask: sizeof(sigset_t)
+ *
+ * Returns the signalfd.  SIGKILL and SIGSTOP are never received.
+ */
+asmlinkage long sys_signalfd(int ufd, sigset_t __user *user_mask,
+			     size_t sizemask)
+{
+	struct signalfd_ctx *ctx;
+	struct file *file;
+	sigset_t sigmask;
+
+	if (sizemask != sizeof(sigset_t))
+		return -EINVAL;
+	if (copy_from_user(&sigmask, user_mask, sizeof(sigmask)))
+		return -EFAULT;
+	sigdelsetmask(&sigmask, sigmask(SIGKILL) | sigmask(SIGSTOP));
+	signotset(&sigmask);
+
+	if (ufd == -1)
+		return signalfd_create(&sigmask);
+
+	file = fget(ufd);
+	if (!file)
+		return -EBADF;
+	if (file->f_op != &signalfd_fops) {
+		fput(file);
+		return -EINVAL;
+	}
+	ctx = file->private_data;
+	spin_lock_irq(&current->sighand->siglock);
+	ctx->sigmask = sigmask;
+	spin_unlock_irq(&current->sighand->siglock);
+	wake_up(&ctx->sighand->signalfd_wqh);
+	fput(file);
+
+	return ufd;
+}
+
+#ifdef CONFIG_COMPAT
+
+extern void sigset_from_compat(sigset_t *set, compat_sigset_t *compat);
+
+asmlinkage long compat_sys_signalfd(int ufd,
+		const compat_sigset_t __user *user_mask,
+		compat_size_t sizemask)
+{
+	compat_sigset_t ss32;
+	sigset_t tmp;
+	sigset_t __user *ksigmask;
+
+	if (sizemask != sizeof(compat_sigset_t))
+		return -EINVAL;
+	if (copy_from_user(&ss32, user_mask, sizeof(ss32)))
+		return -EFAULT;
+	sigset_from_compat(&tmp, &ss32);
+	ksigmask = compat_alloc_user_space(sizeof(sigset_t));
+	if (copy_to_user(ksigmask, &tmp, sizeof(sigset_t)))
+		return -EFAULT;
+
+	return sys_signalfd(ufd, ksigmask, sizeof(sigset_t));
+}
+
+#endif /* CONFIG_COMPAT */
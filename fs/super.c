@@ -60,16 +60,31 @@ static struct super_block *alloc_super(struct file_system_type *type)
 	static struct super_operations default_op;
 
 	if (s) {
+		int cpu;
+
 		if (security_sb_alloc(s)) {
 			kfree(s);
 			s = NULL;
 			goto out;
 		}
+		s->s_files = alloc_percpu(struct sb_file_list);
+		if (!s->s_files) {
+			security_sb_free(s);
+			kfree(s);
+			s = NULL;
+			goto out;
+		}
+		for_each_possible_cpu(cpu) {
+			struct sb_file_list *fl = per_cpu_ptr(s->s_files, cpu);
+
+			spin_lock_init(&fl->lock);
+			INIT_LIST_HEAD(&fl->list);
+		}
 		INIT_LIST_HEAD(&s->s_dirty);
 		INIT_LIST_HEAD(&s->s_io);
-		INIT_LIST_HEAD(&s->s_files);
 		INIT_LIST_HEAD(&s->s_instances);
 		INIT_HLIST_HEAD(&s->s_anon);
+		INIT_LIST_HEAD(&s->s_dentry_lru);
 		INIT_LIST_HEAD(&s->s_inodes);
 		init_rwsem(&s->s_umount);
 		mutex_init(&s->s_lock);
@@ -106,6 +121,7 @@ out:
  */
 static inline void destroy_super(struct super_block *s)
 {
+	free_percpu(s->s_files);
 	security_sb_free(s);
 	kfree(s);
 }
@@ -519,12 +535,10 @@ static void mark_files_ro(struct super_block *sb)
 {
 	struct file *f;
 
-	file_list_lock();
-	list_for_each_entry(f, &sb->s_files, f_u.fu_list) {
+	do_file_list_for_each_entry(sb, f) {
 		if (S_ISREG(f->f_dentry->d_inode->i_mode) && file_count(f))
 			f->f_mode &= ~FMODE_WRITE;
-	}
-	file_list_unlock();
+	} while_file_list_for_each_entry;
 }
 
 /**
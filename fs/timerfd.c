@@ -0,0 +1,315 @@
+/*
+ *  fs/timerfd.c
+ *
+ *  timerfd_create(), timerfd_settime() and timerfd_gettime(): an hrtimer
+ *  behind a file descriptor.
+ *
+ *  The descriptor polls readable once the timer has expired, and a
+ *  read() returns, as a 64 bit count, how many times it has expired
+ *  since the last read, so an event loop can wait for its timers with
+ *  everything else in one epoll set, instead of through a POSIX timer's
+ *  signal and a pipe.
+ */
+
+#include <linux/file.h>
+#include <linux/poll.h>
+#include <linux/fs.h>
+#include <linux/anon_inodes.h>
+#include <linux/slab.h>
+#include <linux/sched.h>
+#include <linux/hrtimer.h>
+#include <linux/syscalls.h>
+#include <linux/timerfd.h>
+#include <asm/uaccess.h>
+
+struct timerfd_ctx {
+	struct hrtimer tmr;
+	ktime_t tintv;			/* the period, or zero */
+	wait_queue_head_t wqh;
+	/*
+	 * Expirations not read yet.  The timer is only re-armed for the
+	 * next period when they are read, and the overruns meanwhile are
+	 * counted then.  wqh.lock protects this and expired.
+	 */
+	__u64 ticks;
+	int expired;
+	int clockid;
+};
+
+static const struct file_operations timerfd_fops;
+
+/* The hrtimer callback, which may run in hard interrupt context */
+static int timerfd_tmrproc(struct hrtimer *htmr)
+{
+	struct timerfd_ctx *ctx = container_of(htmr, struct timerfd_ctx, tmr);
+	unsigned long flags;
+
+	spin_lock_irqsave(&ctx->wqh.lock, flags);
+	ctx->expired = 1;
+	ctx->ticks++;
+	wake_up_locked(&ctx->wqh);
+	spin_unlock_irqrestore(&ctx->wqh.lock, flags);
+
+	return HRTIMER_NORESTART;
+}
+
+/* Called with wqh.lock held and the timer stopped */
+static void timerfd_setup(struct timerfd_ctx *ctx, int flags,
+			  const struct itimerspec *ktmr)
+{
+	enum hrtimer_mode htmode;
+	ktime_t texp;
+
+	htmode = (flags & TFD_TIMER_ABSTIME) ? HRTIMER_ABS : HRTIMER_REL;
+	texp = timespec_to_ktime(ktmr->it_value);
+	ctx->expired = 0;
+	ctx->ticks = 0;
+	ctx->tintv = timespec_to_ktime(ktmr->it_interval);
+	hrtimer_init(&ctx->tmr, ctx->clockid, htmode);
+	ctx->tmr.expires = texp;
+	ctx->tmr.function = timerfd_tmrproc;
+	if (texp.tv64 != 0)
+		hrtimer_start(&ctx->tmr, texp, htmode);
+}
+
+/*
+ * A periodic timer that expired is re-armed when its expirations are
+ * read; count the periods that went by since as expirations too.
+ * Called with wqh.lock held.
+ */
+static void timerfd_rearm(struct timerfd_ctx *ctx)
+{
+	unsigned long overruns;
+
+	if (!ctx->expired || ctx->tintv.tv64 == 0)
+		return;
+	overruns = hrtimer_forward(&ctx->tmr, ctx->tmr.base->get_time(),
+				   ctx->tintv);
+	ctx->ticks += overruns - 1;
+	ctx->expired = 0;
+	hrtimer_restart(&ctx->tmr);
+}
+
+static int timerfd_release(struct inode *inode, struct file *file)
+{
+	struct timerfd_ctx *ctx = file->private_data;
+
+	hrtimer_cancel(&ctx->tmr);
+	kfree(ctx);
+	return 0;
+}
+
+static unsigned int timerfd_poll(struct file *file, poll_table *wait)
+{
+	struct timerfd_ctx *ctx = file->private_data;
+	unsigned int events = 0;
+	unsigned long flags;
+
+	poll_wait(file, &ctx->wqh, wait);
+
+	spin_lock_irqsave(&ctx->wqh.lock, flags);
+	if (ctx->ticks)
+		events |= POLLIN | POLLRDNORM;
+	spin_unlock_irqrestore(&ctx->wqh.lock, flags);
+
+	return events;
+}
+
+static ssize_t timerfd_read(struct file *file, char __user *buf, size_t count,
+			    loff_t *ppos)
+{
+	struct timerfd_ctx *ctx = file->private_data;
+	DECLARE_WAITQUEUE(wait, current);
+	ssize_t res;
+	__u64 ticks = 0;
+
+	if (count < sizeof(ticks))
+		return -EINVAL;
+
+	spin_lock_irq(&ctx->wqh.lock);
+	res = -EAGAIN;
+	if (ctx->ticks)
+		res = sizeof(ticks);
+	else if (!(file->f_flags & O_NONBLOCK)) {
+		__add_wait_queue(&ctx->wqh, &wait);
+		for (;;) {
+			set_current_state(TASK_INTERRUPTIBLE);
+			if (ctx->ticks) {
+				res = sizeof(ticks);
+				break;
+			}
+			if (signal_pending(current)) {
+				res = -ERESTARTSYS;
+				break;
+			}
+			spin_unlock_irq(&ctx->wqh.lock);
+			schedule();
+			spin_lock_irq(&ctx->wqh.lock);
+		}
+		__remove_wait_queue(&ctx->wqh, &wait);
+		__set_current_state(TASK_RUNNING);
+	}
+	if (res > 0) {
+		timerfd_rearm(ctx);
+		ticks = ctx->ticks;
+		ctx->ticks = 0;
+	}
+	spin_unlock_irq(&ctx->wqh.lock);
+
+	if (res > 0 && put_user(ticks, (__u64 __user *) buf))
+		return -EFAULT;
+	return res;
+}
+
+static const struct file_operations timerfd_fops = {
+	.release	= timerfd_release,
+	.poll		= timerfd_poll,
+	.read		= timerfd_read,
+};
+
+static struct file *timerfd_fget(int fd)
+{
+	struct file *file;
+
+	file = fget(fd);
+	if (!file)
+		return ERR_PTR(-EBADF);
+	if (file->f_op != &timerfd_fops) {
+		fput(file);
+		return ERR_PTR(-EINVAL);
+	}
+	return file;
+}
+
+/* Where a timer stands, as timerfd_gettime() reports it */
+static void timerfd_get(struct timerfd_ctx *ctx, struct itimerspec *kotmr)
+{
+	ktime_t rem = { .tv64 = 0 };
+
+	timerfd_rearm(ctx);
+	if (hrtimer_active(&ctx->tmr)) {
+		rem = hrtimer_get_remaining(&ctx->tmr);
+		if (rem.tv64 <= 0)
+			rem.tv64 = 1;
+	}
+	kotmr->it_value = ktime_to_timespec(rem);
+	kotmr->it_interval = ktime_to_timespec(ctx->tintv);
+}
+
+/**
+ * sys_timerfd_create - create a disarmed timerfd
+ * @clockid: CLOCK_REALTIME or CLOCK_MONOTONIC
+ * @flags: none are defined yet
+ */
+asmlinkage long sys_timerfd_create(int clockid, int flags)
+{
+	struct timerfd_ctx *ctx;
+	int fd;
+
+	if (flags)
+		return -EINVAL;
+	if (clockid != CLOCK_MONOTONIC && clockid != CLOCK_REALTIME)
+		return -EINVAL;
+
+	ctx = kzalloc(sizeof(*ctx), GFP_KERNEL);
+	if (!ctx)
+		return -ENOMEM;
+	init_waitqueue_head(&ctx->wqh);
+	ctx->clockid = clockid;
+	hrtimer_init(&ctx->tmr, clockid, HRTIMER_ABS);
+
+	fd = anon_inode_getfd(&timerfd_fops, ctx, O_RDONLY);
+	if (fd < 0)
+		kfree(ctx);
+	return fd;
+}
+
+/**
+ * sys_timerfd_settime - arm or disarm a timerfd
+ * @ufd: the timerfd
+ * @flags: TFD_TIMER_ABSTIME, or 0 for a time relative to now
+ * @utmr: the first expiration, and the period; a zero it_value disarms
+ * @otmr: if not NULL, where the old setting is returned
+ *
+ * Expirations not read yet are discarded.
+ */
+asmlinkage long sys_timerfd_settime(int ufd, int flags,
+				    const struct itimerspec __user *utmr,
+				    struct itimerspec __user *otmr)
+{
+	struct timerfd_ctx *ctx;
+	struct file *file;
+	struct itimerspec ktmr, kotmr;
+	ktime_t now, rem = { .tv64 = 0 };
+	int active;
+
+	if (copy_from_user(&ktmr, utmr, sizeof(ktmr)))
+		return -EFAULT;
+	if (flags & ~TFD_TIMER_ABSTIME)
+		return -EINVAL;
+	if (!timespec_valid(&ktmr.it_value) ||
+	    !timespec_valid(&ktmr.it_interval))
+		return -EINVAL;
+
+	file = timerfd_fget(ufd);
+	if (IS_ERR(file))
+		return PTR_ERR(file);
+	ctx = file->private_data;
+
+	/*
+	 * The callback takes wqh.lock, so the timer cannot be waited for
+	 * with it held: try again until the callback is not running.
+	 */
+	for (;;) {
+		spin_lock_irq(&ctx->wqh.lock);
+		active = hrtimer_try_to_cancel(&ctx->tmr);
+		if (active >= 0)
+			break;
+		spin_unlock_irq(&ctx->wqh.lock);
+		cpu_relax();
+	}
+
+	/* the old setting, as the timer stood when it was stopped */
+	if (active || (ctx->expired && ctx->tintv.tv64)) {
+		now = ctx->tmr.base->get_time();
+		if (!active)
+			hrtimer_forward(&ctx->tmr, now, ctx->tintv);
+		rem = ktime_sub(ctx->tmr.expires, now);
+		if (rem.tv64 <= 0)
+			rem.tv64 = 1;
+	}
+	kotmr.it_value = ktime_to_timespec(rem);
+	kotmr.it_interval = ktime_to_timespec(ctx->tintv);
+
+	timerfd_setup(ctx, flags, &ktmr);
+	spin_unlock_irq(&ctx->wqh.lock);
+	fput(file);
+
+	if (otmr && copy_to_user(otmr, &kotmr, sizeof(kotmr)))
+		return -EFAULT;
+	return 0;
+}
+
+/**
+ * sys_timerfd_gettime - read the setting of a timerfd
+ * @ufd: the timerfd
+ * @otmr: where the time to the next expiration, and the period, go
+ */
+asmlinkage long sys_timerfd_gettime(int ufd, struct itimerspec __user *otmr)
+{
+	struct timerfd_ctx *ctx;
+	struct file *file;
+	struct itimerspec kotmr;
+
+	file = timerfd_fget(ufd);
+	if (IS_ERR(file))
+		return PTR_ERR(file);
+	ctx = file->private_data;
+
+	spin_lock_irq(&ctx->wqh.lock);
+	timerfd_get(ctx, &kotmr);
+	spin_unlock_irq(&ctx->wqh.lock);
+	fput(file);
+
+	return copy_to_user(otmr, &kotmr, sizeof(kotmr)) ? -EFAULT : 0;
+}
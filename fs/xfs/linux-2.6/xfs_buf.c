@@ -160,62 +160,6 @@ test_page_region(
 	return (mask && (page_private(page) & mask) == mask);
 }
 
-/*
- *	Mapping of multi-page buffers into contiguous virtual space
- */
-
-typedef struct a_list {
-	void		*vm_addr;
-	struct a_list	*next;
-} a_list_t;
-
-STATIC a_list_t		*as_free_head;
-STATIC int		as_list_len;
-STATIC DEFINE_SPINLOCK(as_lock);
-
-/*
- *	Try to batch vunmaps because they are costly.
- */
-STATIC void
-free_address(
-	void		*addr)
-{
-	a_list_t	*aentry;
-
-	aentry = kmalloc(sizeof(a_list_t), GFP_NOWAIT);
-	if (likely(aentry)) {
-		spin_lock(&as_lock);
-		aentry->next = as_free_head;
-		aentry->vm_addr = addr;
-		as_free_head = aentry;
-		as_list_len++;
-		spin_unlock(&as_lock);
-	} else {
-		vunmap(addr);
-	}
-}
-
-STATIC void
-purge_addresses(void)
-{
-	a_list_t	*aentry, *old;
-
-	if (as_free_head == NULL)
-		return;
-
-	spin_lock(&as_lock);
-	aentry = as_free_head;
-	as_free_head = NULL;
-	as_list_len = 0;
-	spin_unlock(&as_lock);
-
-	while ((old = aentry) != NULL) {
-		vunmap(aentry->vm_addr);
-		aentry = aentry->next;
-		kfree(old);
-	}
-}
-
 /*
  *	Internal xfs_buf_t object manipulation
  */
@@ -237,7 +181,7 @@ _xfs_buf_initialize(
 	atomic_set(&bp->b_hold, 1);
 	init_MUTEX_LOCKED(&bp->b_iodonesema);
 	INIT_LIST_HEAD(&bp->b_list);
-	INIT_LIST_HEAD(&bp->b_hash_list);
+	RB_CLEAR_NODE(&bp->b_rbnode);
 	init_MUTEX_LOCKED(&bp->b_sema); /* held, no waiters */
 	XB_SET_OWNER(bp);
 	bp->b_target = target;
@@ -310,13 +254,14 @@ xfs_buf_free(
 {
 	XB_TRACE(bp, "free", 0);
 
-	ASSERT(list_empty(&bp->b_hash_list));
+	ASSERT(RB_EMPTY_NODE(&bp->b_rbnode));
 
 	if (bp->b_flags & _XBF_PAGE_CACHE) {
 		uint		i;
 
 		if ((bp->b_flags & XBF_MAPPED) && (bp->b_page_count > 1))
-			free_address(bp->b_addr - bp->b_offset);
+			vm_unmap_ram(bp->b_addr - bp->b_offset,
+					bp->b_page_count);
 
 		for (i = 0; i < bp->b_page_count; i++)
 			page_cache_release(bp->b_pages[i]);
@@ -440,10 +385,8 @@ _xfs_buf_map_pages(
 		bp->b_addr = page_address(bp->b_pages[0]) + bp->b_offset;
 		bp->b_flags |= XBF_MAPPED;
 	} else if (flags & XBF_MAPPED) {
-		if (as_list_len > 64)
-			purge_addresses();
-		bp->b_addr = vmap(bp->b_pages, bp->b_page_count,
-					VM_MAP, PAGE_KERNEL);
+		bp->b_addr = vm_map_ram(bp->b_pages, bp->b_page_count,
+					-1, PAGE_KERNEL);
 		if (unlikely(bp->b_addr == NULL))
 			return -ENOMEM;
 		bp->b_addr += bp->b_offset;
@@ -476,7 +419,9 @@ _xfs_buf_find(
 	xfs_off_t		range_base;
 	size_t			range_length;
 	xfs_bufhash_t		*hash;
-	xfs_buf_t		*bp, *n;
+	struct rb_node		**rbp;
+	struct rb_node		*parent;
+	xfs_buf_t		*bp;
 
 	range_base = (ioff << BBSHIFT);
 	range_length = (isize << BBSHIFT);
@@ -489,16 +434,23 @@ _xfs_buf_find(
 
 	spin_lock(&hash->bh_lock);
 
-	list_for_each_entry_safe(bp, n, &hash->bh_list, b_hash_list) {
+	rbp = &hash->bh_tree.rb_node;
+	parent = NULL;
+	while (*rbp) {
+		parent = *rbp;
+		bp = rb_entry(parent, xfs_buf_t, b_rbnode);
 		ASSERT(btp == bp->b_target);
-		if (bp->b_file_offset == range_base &&
-		    bp->b_buffer_length == range_length) {
-			/*
-			 * If we look at something, bring it to the
-			 * front of the list for next time.
-			 */
+
+		if (range_base < bp->b_file_offset)
+			rbp = &parent->rb_left;
+		else if (range_base > bp->b_file_offset)
+			rbp = &parent->rb_right;
+		else if (range_length < bp->b_buffer_length)
+			rbp = &parent->rb_left;
+		else if (range_length > bp->b_buffer_length)
+			rbp = &parent->rb_right;
+		else {
 			atomic_inc(&bp->b_hold);
-			list_move(&bp->b_hash_list, &hash->bh_list);
 			goto found;
 		}
 	}
@@ -508,7 +460,8 @@ _xfs_buf_find(
 		_xfs_buf_initialize(new_bp, btp, range_base,
 				range_length, flags);
 		new_bp->b_hash = hash;
-		list_add(&new_bp->b_hash_list, &hash->bh_list);
+		rb_link_node(&new_bp->b_rbnode, parent, rbp);
+		rb_insert_color(&new_bp->b_rbnode, &hash->bh_tree);
 	} else {
 		XFS_STATS_INC(xb_miss_locked);
 	}
@@ -839,7 +792,8 @@ xfs_buf_rele(
 			spin_unlock(&hash->bh_lock);
 		} else {
 			ASSERT(!(bp->b_flags & (XBF_DELWRI|_XBF_DELWRI_Q)));
-			list_del_init(&bp->b_hash_list);
+			rb_erase(&bp->b_rbnode, &hash->bh_tree);
+			RB_CLEAR_NODE(&bp->b_rbnode);
 			spin_unlock(&hash->bh_lock);
 			xfs_buf_free(bp);
 		}
@@ -1360,15 +1314,18 @@ void
 xfs_wait_buftarg(
 	xfs_buftarg_t	*btp)
 {
-	xfs_buf_t	*bp, *n;
+	xfs_buf_t	*bp;
 	xfs_bufhash_t	*hash;
+	struct rb_node	*node;
 	uint		i;
 
 	for (i = 0; i < (1 << btp->bt_hashshift); i++) {
 		hash = &btp->bt_hash[i];
 again:
 		spin_lock(&hash->bh_lock);
-		list_for_each_entry_safe(bp, n, &hash->bh_list, b_hash_list) {
+		for (node = rb_first(&hash->bh_tree); node;
+		     node = rb_next(node)) {
+			bp = rb_entry(node, xfs_buf_t, b_rbnode);
 			ASSERT(btp == bp->b_target);
 			if (!(bp->b_flags & XBF_FS_MANAGED)) {
 				spin_unlock(&hash->bh_lock);
@@ -1386,9 +1343,10 @@ again:
 }
 
 /*
- *	Allocate buffer hash table for a given target.
+ *	Allocate the buffer cache partitions for a given target.
  *	For devices containing metadata (i.e. not the log/realtime devices)
- *	we need to allocate a much larger hash table.
+ *	we need many more of them, each with its own lock, to spread the
+ *	lookups of concurrent metadata operations.
  */
 STATIC void
 xfs_alloc_bufhash(
@@ -1403,7 +1361,7 @@ xfs_alloc_bufhash(
 					sizeof(xfs_bufhash_t), KM_SLEEP);
 	for (i = 0; i < (1 << btp->bt_hashshift); i++) {
 		spin_lock_init(&btp->bt_hash[i].bh_lock);
-		INIT_LIST_HEAD(&btp->bt_hash[i].bh_list);
+		btp->bt_hash[i].bh_tree = RB_ROOT;
 	}
 }
 
@@ -1728,9 +1686,6 @@ xfsbufd(
 			blk_run_address_space(target->bt_mapping);
 		}
 
-		if (as_list_len > 0)
-			purge_addresses();
-
 		clear_bit(XBT_FORCE_FLUSH, &target->bt_flags);
 	} while (!kthread_should_stop());
 
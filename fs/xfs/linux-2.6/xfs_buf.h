@@ -19,6 +19,7 @@
 #define __XFS_BUF_H__
 
 #include <linux/list.h>
+#include <linux/rbtree.h>
 #include <linux/types.h>
 #include <linux/spinlock.h>
 #include <asm/system.h>
@@ -73,8 +74,13 @@ typedef enum {
 	XBT_FORCE_FLUSH = (1 << 1),
 } xfs_buftarg_flags_t;
 
+/*
+ * A partition of the buffer cache of a target.  Its buffers are kept in an
+ * rbtree sorted by offset and length, so that lookups stay cheap however
+ * much metadata is cached.
+ */
 typedef struct xfs_bufhash {
-	struct list_head	bh_list;
+	struct rb_root		bh_tree;
 	spinlock_t		bh_lock;
 } xfs_bufhash_t;
 
@@ -86,7 +92,7 @@ typedef struct xfs_buftarg {
 	unsigned int		bt_sshift;
 	size_t			bt_smask;
 
-	/* per device buffer hash table */
+	/* per device buffer cache partitions */
 	uint			bt_hashmask;
 	uint			bt_hashshift;
 	xfs_bufhash_t		*bt_hash;
@@ -124,8 +130,8 @@ typedef struct xfs_buf {
 	wait_queue_head_t	b_waiters;	/* unpin waiters */
 	struct list_head	b_list;
 	xfs_buf_flags_t		b_flags;	/* status flags */
-	struct list_head	b_hash_list;	/* hash table list */
-	xfs_bufhash_t		*b_hash;	/* hash table list start */
+	struct rb_node		b_rbnode;	/* in the partition's tree */
+	xfs_bufhash_t		*b_hash;	/* partition of the buffer */
 	xfs_buftarg_t		*b_target;	/* buffer target (device) */
 	atomic_t		b_hold;		/* reference count */
 	xfs_daddr_t		b_bn;		/* block number for I/O */
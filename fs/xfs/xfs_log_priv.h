@@ -363,7 +363,8 @@ typedef struct xlog_rec_ext_header {
  *	called after an iclog finishes writing.
  * - ic_size is the full size of the header plus data.
  * - ic_offset is the current number of bytes written to in this iclog.
- * - ic_refcnt is bumped when someone is writing to the log.
+ * - ic_refcnt is bumped when someone is writing to the log.  It is only
+ *	raised under the icloglock, and only drops to zero under it.
  * - ic_state is the state of the iclog.
  */
 typedef struct xlog_iclog_fields {
@@ -380,7 +381,7 @@ typedef struct xlog_iclog_fields {
 #endif
 	int			ic_size;
 	int			ic_offset;
-	int			ic_refcnt;
+	atomic_t		ic_refcnt;
 	int			ic_bwritecnt;
 	ushort_t		ic_state;
 	char			*ic_datap;	/* pointer to iclog data */
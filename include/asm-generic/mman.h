@@ -31,9 +31,14 @@
 #define MADV_DONTNEED	4		/* don't need these pages */
 
 /* common parameters: try to keep these consistent across architectures */
+#define MADV_FREE	8		/* free pages only under memory pressure */
 #define MADV_REMOVE	9		/* remove these pages & resources */
 #define MADV_DONTFORK	10		/* don't inherit across fork */
 #define MADV_DOFORK	11		/* do inherit across fork */
+#define MADV_MERGEABLE	12		/* KSM may merge identical pages */
+#define MADV_UNMERGEABLE 13		/* KSM may not merge identical pages */
+#define MADV_HUGEPAGE	14		/* worth backing with hugepages */
+#define MADV_NOHUGEPAGE	15		/* not worth backing with hugepages */
 
 /* compatibility flags */
 #define MAP_ANON	MAP_ANONYMOUS
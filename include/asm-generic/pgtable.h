@@ -163,6 +163,12 @@ static inline void ptep_set_wrprotect(struct mm_struct *mm, unsigned long addres
 #define move_pte(pte, prot, old_addr, new_addr)	(pte)
 #endif
 
+#ifndef __HAVE_ARCH_PTE_NUMA
+#define pte_numa(pte)		(0)
+#define pte_mknuma(pte)		(pte)
+#define pte_mknonnuma(pte)	(pte)
+#endif
+
 /*
  * When walking page tables, get the address of the next boundary,
  * or the end address of the range if that comes earlier.  Although no
@@ -2,10 +2,10 @@
 #define _ASM_I386_DMA_MAPPING_H
 
 #include <linux/mm.h>
+#include <linux/scatterlist.h>
 
 #include <asm/cache.h>
 #include <asm/io.h>
-#include <asm/scatterlist.h>
 #include <asm/bug.h>
 
 #define dma_alloc_noncoherent(d, s, h, f) dma_alloc_coherent(d, s, h, f)
@@ -40,16 +40,17 @@ static inline int
 dma_map_sg(struct device *dev, struct scatterlist *sg, int nents,
 	   enum dma_data_direction direction)
 {
+	struct scatterlist *s;
 	int i;
 
 	if (direction == DMA_NONE)
 		BUG();
 	WARN_ON(nents == 0 || sg[0].length == 0);
 
-	for (i = 0; i < nents; i++ ) {
-		BUG_ON(!sg[i].page);
+	for_each_sg(sg, s, nents, i) {
+		BUG_ON(!s->page);
 
-		sg[i].dma_address = page_to_phys(sg[i].page) + sg[i].offset;
+		s->dma_address = page_to_phys(s->page) + s->offset;
 	}
 
 	flush_write_buffers();
@@ -35,7 +35,17 @@ struct pt_regs;
 typedef u8 kprobe_opcode_t;
 #define BREAKPOINT_INSTRUCTION	0xcc
 #define RELATIVEJUMP_INSTRUCTION 0xe9
+#define RELATIVEJUMP_SIZE 5
 #define MAX_INSN_SIZE 16
+/*
+ * A jump-optimized probe displaces the whole instructions under its
+ * jump, and its detour buffer holds the register saving template, a
+ * copy of them and a jump back.
+ */
+#define MAX_OPTIMIZED_LENGTH (MAX_INSN_SIZE + RELATIVEJUMP_SIZE)
+#define MAX_OPTPROBE_TEMPLATE_SIZE 48
+#define MAX_OPTINSN_SIZE (MAX_OPTPROBE_TEMPLATE_SIZE + \
+			  MAX_OPTIMIZED_LENGTH + RELATIVEJUMP_SIZE)
 #define MAX_STACK_SIZE 64
 #define MIN_STACK_SIZE(ADDR) (((MAX_STACK_SIZE) < \
 	(((unsigned long)current_thread_info()) + THREAD_SIZE - (ADDR))) \
@@ -59,6 +69,14 @@ struct arch_specific_insn {
 	 * post_handler and break_handler is not set.
 	 */
 	int boostable;
+#ifdef CONFIG_OPTPROBES
+	/* detour buffer jumped to instead of the int3, if optimized */
+	kprobe_opcode_t *optinsn;
+	/* length of the instructions displaced by the jump */
+	int optsize;
+	/* what the jump's offset overwrote */
+	kprobe_opcode_t copied_insn[RELATIVEJUMP_SIZE - 1];
+#endif
 };
 
 struct prev_kprobe {
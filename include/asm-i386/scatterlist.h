@@ -18,4 +18,7 @@ struct scatterlist {
 
 #define ISA_DMA_THRESHOLD (0x00ffffff)
 
+/* the dma_map_sg() implementations walk lists with sg_next() */
+#define ARCH_HAS_SG_CHAIN
+
 #endif /* !(_I386_SCATTERLIST_H) */
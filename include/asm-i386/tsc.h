@@ -46,4 +46,7 @@ static inline cycles_t get_cycles(void)
 extern void tsc_init(void);
 extern void mark_tsc_unstable(void);
 
+struct clocksource;
+extern int is_vsyscall_clocksource(struct clocksource *cs);
+
 #endif
@@ -323,10 +323,20 @@
 #define __NR_tee		315
 #define __NR_vmsplice		316
 #define __NR_move_pages		317
+#define __NR_recvmmsg		318
+#define __NR_sendmmsg		319
+#define __NR_process_vm_readv	320
+#define __NR_process_vm_writev	321
+#define __NR_signalfd		322
+#define __NR_eventfd		323
+#define __NR_timerfd_create	324
+#define __NR_timerfd_settime	325
+#define __NR_timerfd_gettime	326
+#define __NR_perf_counter_open	327
 
 #ifdef __KERNEL__
 
-#define NR_syscalls 318
+#define NR_syscalls 328
 
 /*
  * user-visible error numbers are in the range -1 - -128: see
@@ -0,0 +1,33 @@
+#ifndef _ASM_I386_VGTOD_H
+#define _ASM_I386_VGTOD_H
+
+/*
+ * Timekeeping state for clock_gettime() in the vDSO.  The kernel copies
+ * it into the vDSO page on every tick, at a fixed offset so that it is
+ * in the same place in the int80 and the sysenter image; vsyscall.lds
+ * puts it at the end of the room left for the dynamic symbol table.
+ */
+#define VGTOD_OFFSET	0x380
+
+#ifndef __ASSEMBLY__
+
+#include <linux/seqlock.h>
+#include <linux/clocksource.h>
+
+#define VGTOD_NONE	0	/* clocksource not readable from user mode */
+#define VGTOD_TSC	1
+
+struct vsyscall_gtod_data {
+	seqcount_t	seq;
+	int		mode;
+	cycle_t		cycle_last;
+	cycle_t		mask;
+	u32		mult;
+	u32		shift;
+	struct timespec	wall_time;
+	struct timespec	wall_to_monotonic;
+};
+
+#endif /* __ASSEMBLY__ */
+
+#endif /* _ASM_I386_VGTOD_H */
@@ -19,6 +19,10 @@
 
 #define pcibios_scan_all_fns(a, b)	0
 
+/* The PCI address space does equal the physical memory address space:
+   the block layer uses this for bounce buffer decisions.  */
+#define PCI_DMA_BUS_IS_PHYS	(1)
+
 /* Generic declarations.  */
 
 struct scatterlist;
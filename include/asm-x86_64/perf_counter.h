@@ -0,0 +1,24 @@
+#ifndef _ASM_X86_64_PERF_COUNTER_H
+#define _ASM_X86_64_PERF_COUNTER_H
+
+#include <asm/atomic.h>
+
+#define X86_PMC_MAX		8
+
+/* The bits of a PERF_TYPE_RAW config: event, umask, edge, inv, cmask */
+#define X86_RAW_EVENT_MASK	0xFF84FFFFULL
+
+/*
+ * The PMU state of a counter.  delta and period_left are updated from
+ * the NMI handler as well, and are folded into the counter's count when
+ * it is read or taken off the cpu.
+ */
+struct hw_perf_counter {
+	int		idx;		/* the PMC it has while active */
+	u64		config;		/* event select, without the enable bit */
+	u64		prev_count;	/* the PMC at the last update */
+	atomic64_t	delta;		/* events not in the count yet */
+	atomic64_t	period_left;	/* events to the next overflow */
+};
+
+#endif /* _ASM_X86_64_PERF_COUNTER_H */
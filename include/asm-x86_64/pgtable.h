@@ -287,6 +287,22 @@ static inline pte_t pte_mkyoung(pte_t pte)	{ set_pte(&pte, __pte(pte_val(pte) |
 static inline pte_t pte_mkwrite(pte_t pte)	{ set_pte(&pte, __pte(pte_val(pte) | _PAGE_RW)); return pte; }
 static inline pte_t pte_mkhuge(pte_t pte)	{ set_pte(&pte, __pte(pte_val(pte) | _PAGE_PSE)); return pte; }
 
+#ifdef CONFIG_NUMA_BALANCING
+/*
+ * A NUMA hinting pte is a present mapping with _PAGE_PRESENT taken away,
+ * so the next access faults and tells us which node it came from.  It
+ * reuses _PAGE_PROTNONE, which keeps pte_present() true for the rest of
+ * the VM; only vmas with some access rights can hold one.
+ */
+#define _PAGE_NUMA	_PAGE_PROTNONE
+static inline int pte_numa(pte_t pte)
+{
+	return (pte_val(pte) & (_PAGE_NUMA | _PAGE_PRESENT)) == _PAGE_NUMA;
+}
+static inline pte_t pte_mknuma(pte_t pte)	{ set_pte(&pte, __pte((pte_val(pte) & ~_PAGE_PRESENT) | _PAGE_NUMA)); return pte; }
+static inline pte_t pte_mknonnuma(pte_t pte)	{ set_pte(&pte, __pte((pte_val(pte) & ~_PAGE_NUMA) | _PAGE_PRESENT | _PAGE_ACCESSED)); return pte; }
+#endif
+
 struct vm_area_struct;
 
 static inline int ptep_test_and_clear_dirty(struct vm_area_struct *vma, unsigned long addr, pte_t *ptep)
@@ -349,10 +365,29 @@ static inline int pmd_large(pmd_t pte) {
 #define pmd_none(x)	(!pmd_val(x))
 #define pmd_present(x)	(pmd_val(x) & _PAGE_PRESENT)
 #define pmd_clear(xp)	do { set_pmd(xp, __pmd(0)); } while (0)
+#ifdef CONFIG_SHARED_PAGE_TABLES
+/* a pte table shared since fork is mapped without _PAGE_RW */
+#define	pmd_bad(x)	((pmd_val(x) & (~PTE_MASK & ~(_PAGE_USER | _PAGE_RW))) != \
+			 (_KERNPG_TABLE & ~_PAGE_RW))
+#else
 #define	pmd_bad(x)	((pmd_val(x) & (~PTE_MASK & ~_PAGE_USER)) != _KERNPG_TABLE )
+#endif
+#define pmd_write(x)	(pmd_val(x) & _PAGE_RW)
+#define pmd_wrprotect(x)	__pmd(pmd_val(x) & ~_PAGE_RW)
+#define pmd_mkwrite(x)	__pmd(pmd_val(x) | _PAGE_RW)
 #define pfn_pmd(nr,prot) (__pmd(((nr) << PAGE_SHIFT) | pgprot_val(prot)))
 #define pmd_pfn(x)  ((pmd_val(x) & __PHYSICAL_MASK) >> PAGE_SHIFT)
 
+/*
+ * A transparent huge page is mapped by a pmd laid out like a pte with
+ * _PAGE_PSE set: these convert between the two.
+ */
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+#define pmd_trans_huge(x)	pmd_large(x)
+#endif
+#define huge_pmd_pte(x)		__pte(pmd_val(x) & ~_PAGE_PSE)
+#define pte_huge_pmd(x)		__pmd(pte_val(x) | _PAGE_PSE)
+
 #define pte_to_pgoff(pte) ((pte_val(pte) & PHYSICAL_PAGE_MASK) >> PAGE_SHIFT)
 #define pgoff_to_pte(off) ((pte_t) { ((off) << PAGE_SHIFT) | _PAGE_FILE })
 #define PTE_FILE_MAX_BITS __PHYSICAL_MASK_SHIFT
@@ -448,6 +483,9 @@ extern int kern_addr_valid(unsigned long addr);
 #define __HAVE_ARCH_PTEP_GET_AND_CLEAR_FULL
 #define __HAVE_ARCH_PTEP_SET_WRPROTECT
 #define __HAVE_ARCH_PTE_SAME
+#ifdef CONFIG_NUMA_BALANCING
+#define __HAVE_ARCH_PTE_NUMA
+#endif
 #include <asm-generic/pgtable.h>
 
 #endif /* _X86_64_PGTABLE_H */
@@ -39,6 +39,14 @@ extern void *__memcpy(void *to, const void *from, size_t len);
 		 __ret = __builtin_memcpy((dst),(src),__len);	\
 	   __ret; }) 
 
+/* Copies from this size up bypass the cache; see arch/x86_64/lib/usercopy.c */
+#define COPY_NT_MIN	4096UL
+extern unsigned long copy_nt_threshold;
+
+/* memcpy with the cache bypassed, or not, whatever the size */
+extern void *__memcpy_nt(void *to, const void *from, size_t len);
+extern void *__memcpy_cached(void *to, const void *from, size_t len);
+
 
 #define __HAVE_ARCH_MEMSET
 void *memset(void *s, int c, size_t n);
@@ -619,10 +619,30 @@ __SYSCALL(__NR_sync_file_range, sys_sync_file_range)
 __SYSCALL(__NR_vmsplice, sys_vmsplice)
 #define __NR_move_pages		279
 __SYSCALL(__NR_move_pages, sys_move_pages)
+#define __NR_recvmmsg		280
+__SYSCALL(__NR_recvmmsg, sys_recvmmsg)
+#define __NR_sendmmsg		281
+__SYSCALL(__NR_sendmmsg, sys_sendmmsg)
+#define __NR_process_vm_readv	282
+__SYSCALL(__NR_process_vm_readv, sys_process_vm_readv)
+#define __NR_process_vm_writev	283
+__SYSCALL(__NR_process_vm_writev, sys_process_vm_writev)
+#define __NR_signalfd		284
+__SYSCALL(__NR_signalfd, sys_signalfd)
+#define __NR_eventfd		285
+__SYSCALL(__NR_eventfd, sys_eventfd)
+#define __NR_timerfd_create	286
+__SYSCALL(__NR_timerfd_create, sys_timerfd_create)
+#define __NR_timerfd_settime	287
+__SYSCALL(__NR_timerfd_settime, sys_timerfd_settime)
+#define __NR_timerfd_gettime	288
+__SYSCALL(__NR_timerfd_gettime, sys_timerfd_gettime)
+#define __NR_perf_counter_open	289
+__SYSCALL(__NR_perf_counter_open, sys_perf_counter_open)
 
 #ifdef __KERNEL__
 
-#define __NR_syscall_max __NR_move_pages
+#define __NR_syscall_max __NR_perf_counter_open
 
 #ifndef __NO_STUBS
 
@@ -4,6 +4,7 @@
 enum vsyscall_num {
 	__NR_vgettimeofday,
 	__NR_vtime,
+	__NR_vclock_gettime,
 };
 
 #define VSYSCALL_START (-10UL << 20)
@@ -13,6 +14,7 @@ enum vsyscall_num {
 
 #ifdef __KERNEL__
 #include <linux/seqlock.h>
+#include <linux/time.h>
 
 #define __section_vxtime __attribute__ ((unused, __section__ (".vxtime"), aligned(16)))
 #define __section_wall_jiffies __attribute__ ((unused, __section__ (".wall_jiffies"), aligned(16)))
@@ -33,6 +35,7 @@ struct vxtime_data {
 	long quot;
 	long tsc_quot;
 	int mode;
+	struct timespec wall_to_monotonic;	/* copied under xtime_lock */
 };
 
 #define hpet_readl(a)           readl((const void __iomem *)fix_to_virt(FIX_HPET_BASE) + a)
@@ -3,6 +3,7 @@
 
 #include <linux/list.h>
 #include <linux/workqueue.h>
+#include <linux/mutex.h>
 #include <linux/aio_abi.h>
 
 #include <asm/atomic.h>
@@ -32,6 +33,7 @@ struct kioctx;
 /* #define KIF_LOCKED		0 */
 #define KIF_KICKED		1
 #define KIF_CANCELLED		2
+#define KIF_WAITING		3	/* ki_wait queued, a kick is due */
 
 #define kiocbTryLock(iocb)	test_and_set_bit(KIF_LOCKED, &(iocb)->ki_flags)
 #define kiocbTryKick(iocb)	test_and_set_bit(KIF_KICKED, &(iocb)->ki_flags)
@@ -39,14 +41,17 @@ struct kioctx;
 #define kiocbSetLocked(iocb)	set_bit(KIF_LOCKED, &(iocb)->ki_flags)
 #define kiocbSetKicked(iocb)	set_bit(KIF_KICKED, &(iocb)->ki_flags)
 #define kiocbSetCancelled(iocb)	set_bit(KIF_CANCELLED, &(iocb)->ki_flags)
+#define kiocbSetWaiting(iocb)	set_bit(KIF_WAITING, &(iocb)->ki_flags)
 
 #define kiocbClearLocked(iocb)	clear_bit(KIF_LOCKED, &(iocb)->ki_flags)
 #define kiocbClearKicked(iocb)	clear_bit(KIF_KICKED, &(iocb)->ki_flags)
 #define kiocbClearCancelled(iocb)	clear_bit(KIF_CANCELLED, &(iocb)->ki_flags)
+#define kiocbClearWaiting(iocb)	clear_bit(KIF_WAITING, &(iocb)->ki_flags)
 
 #define kiocbIsLocked(iocb)	test_bit(KIF_LOCKED, &(iocb)->ki_flags)
 #define kiocbIsKicked(iocb)	test_bit(KIF_KICKED, &(iocb)->ki_flags)
 #define kiocbIsCancelled(iocb)	test_bit(KIF_CANCELLED, &(iocb)->ki_flags)
+#define kiocbIsWaiting(iocb)	test_bit(KIF_WAITING, &(iocb)->ki_flags)
 
 /* is there a better place to document function pointer methods? */
 /**
@@ -81,6 +86,11 @@ struct kioctx;
  * discouraged.  In either case, kick_iocb() must be called once and only
  * once.  ki_retry must ensure forward progress, the AIO core will wait
  * indefinitely for kick_iocb() to be called.
+ *
+ * The generic helpers set KIF_WAITING once they have queued ki_wait.  From
+ * then on the kick may come at any time, so ki_retry must return
+ * -EIOCBRETRY as soon as it sees the flag, with its progress saved in the
+ * kiocb, even if the operation could go on.
  */
 struct kiocb {
 	struct list_head	ki_run_list;
@@ -115,6 +125,9 @@ struct kiocb {
 
 	struct list_head	ki_list;	/* the aio core uses this
 						 * for cancellation */
+
+	/* eventfd to signal on completion, or NULL; see IOCB_FLAG_RESFD */
+	struct file		*ki_eventfd;
 };
 
 #define is_sync_kiocb(iocb)	((iocb)->ki_key == KIOCB_SYNC_KEY)
@@ -129,13 +142,15 @@ struct kiocb {
 		(x)->ki_cancel = NULL;			\
 		(x)->ki_retry = NULL;			\
 		(x)->ki_dtor = NULL;			\
+		(x)->ki_eventfd = NULL;			\
 		(x)->ki_obj.tsk = tsk;			\
 		(x)->ki_user_data = 0;                  \
 		init_wait((&(x)->ki_wait));             \
 	} while (0)
 
 #define AIO_RING_MAGIC			0xa10a10a1
-#define AIO_RING_COMPAT_FEATURES	1
+#define AIO_RING_COMPAT_SQ		2	/* has a struct aio_sq_ring */
+#define AIO_RING_COMPAT_FEATURES	(1 | AIO_RING_COMPAT_SQ)
 #define AIO_RING_INCOMPAT_FEATURES	0
 struct aio_ring {
 	unsigned	id;	/* kernel internal index number */
@@ -152,6 +167,31 @@ struct aio_ring {
 	struct io_event		io_events[0];
 }; /* 128 bytes + ring size */
 
+/*
+ * The submission ring starts right after the last io_event of the aio_ring,
+ * at ring->id + ring->header_length + ring->nr * sizeof(struct io_event).
+ * Userspace stores the addresses of its iocbs at tail, as it would pass
+ * them to io_submit(), and moves tail on.  The kernel takes them from head
+ * on io_submit(ctx, 0, NULL) and in io_getevents(), and a task waiting in
+ * io_getevents() after large batches keeps polling the ring for more.
+ * AIO_SQ_NEED_WAKEUP is clear while it does, else userspace has to call
+ * io_submit(ctx, 0, NULL) for the iocbs it posted to be seen.
+ *
+ * An iocb that cannot be submitted completes at once with the error in res.
+ */
+#define AIO_SQ_NEED_WAKEUP	1
+
+struct aio_sq_ring {
+	unsigned	head;	/* next entry the kernel takes */
+	unsigned	tail;	/* next entry userspace fills */
+	unsigned	nr;	/* number of entries */
+	unsigned	flags;	/* AIO_SQ_* */
+
+	unsigned	pad[4];
+
+	__u64		iocbs[0];	/* struct iocb __user * */
+}; /* 32 bytes + ring size */
+
 #define aio_ring_avail(info, ring)	(((ring)->head + (info)->nr - 1 - (ring)->tail) % (info)->nr)
 
 #define AIO_RING_PAGES	8
@@ -165,6 +205,10 @@ struct aio_ring_info {
 
 	unsigned		nr, tail;
 
+	/* submission ring, from ring_pages[sq_page] on */
+	long			sq_page;
+	unsigned		sq_nr, sq_head;
+
 	struct page		*internal_pages[AIO_RING_PAGES];
 };
 
@@ -190,6 +234,10 @@ struct kioctx {
 
 	struct aio_ring_info	ring_info;
 
+	/* serialises the consumers of the submission ring */
+	struct mutex		sq_mutex;
+	int			sq_pollers;	/* under sq_mutex */
+
 	struct work_struct	wq;
 };
 
@@ -43,6 +43,12 @@ enum {
 	IOCB_CMD_NOOP = 6,
 };
 
+/*
+ * iocb aio_flags: IOCB_FLAG_RESFD says that aio_resfd is an eventfd,
+ * which is signalled when the iocb's event is posted.
+ */
+#define IOCB_FLAG_RESFD		(1 << 0)
+
 /* read() from /dev/aio returns these structures. */
 struct io_event {
 	__u64		data;		/* the data field from the iocb */
@@ -82,7 +88,8 @@ struct iocb {
 
 	/* extra parameters */
 	__u64	aio_reserved2;	/* TODO: use this for a (struct sigevent *) */
-	__u64	aio_reserved3;
+	__u32	aio_flags;	/* see IOCB_FLAG_ below */
+	__u32	aio_resfd;	/* eventfd signalled on completion */
 }; /* 64 bytes */
 
 #undef IFBIG
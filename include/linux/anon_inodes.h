@@ -0,0 +1,15 @@
+/*
+ *  include/linux/anon_inodes.h
+ *
+ *  Files that are descriptors for a kernel object and nothing else.
+ */
+
+#ifndef _LINUX_ANON_INODES_H
+#define _LINUX_ANON_INODES_H
+
+struct file_operations;
+
+int anon_inode_getfd(const struct file_operations *fops, void *priv,
+		     int flags);
+
+#endif /* _LINUX_ANON_INODES_H */
@@ -0,0 +1,18 @@
+#ifndef _LINUX_ASYNC_H
+#define _LINUX_ASYNC_H
+
+/*
+ * async.h: run functions, such as slow device probing at boot, in
+ * parallel with the code that schedules them.
+ */
+
+#include <linux/types.h>
+
+typedef u64 async_cookie_t;
+typedef void (async_func_ptr)(void *data, async_cookie_t cookie);
+
+extern async_cookie_t async_schedule(async_func_ptr *ptr, void *data);
+extern void async_synchronize_full(void);
+extern void async_synchronize_cookie(async_cookie_t cookie);
+
+#endif /* _LINUX_ASYNC_H */
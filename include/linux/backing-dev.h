@@ -8,8 +8,11 @@
 #ifndef _LINUX_BACKING_DEV_H
 #define _LINUX_BACKING_DEV_H
 
+#include <linux/list.h>
 #include <asm/atomic.h>
 
+struct task_struct;
+
 /*
  * Bits in backing_dev_info.state
  */
@@ -17,11 +20,22 @@ enum bdi_state {
 	BDI_pdflush,		/* A pdflush thread is working this device */
 	BDI_write_congested,	/* The write queue is getting full */
 	BDI_read_congested,	/* The read queue is getting full */
+	BDI_registered,		/* On bdi_list, may have a flusher thread */
 	BDI_unused,		/* Available bits start here */
 };
 
 typedef int (congested_fn)(void *, int);
 
+/*
+ * Per device page counts, the share of the global NR_FILE_DIRTY,
+ * NR_UNSTABLE_NFS and NR_WRITEBACK which belongs to this device
+ */
+enum bdi_stat_item {
+	BDI_RECLAIMABLE,	/* dirty and unstable pages */
+	BDI_WRITEBACK,		/* pages under writeback */
+	NR_BDI_STAT_ITEMS
+};
+
 struct backing_dev_info {
 	unsigned long ra_pages;	/* max readahead in PAGE_CACHE_SIZE units */
 	unsigned long state;	/* Always use atomic bitops on this */
@@ -30,8 +44,44 @@ struct backing_dev_info {
 	void *congested_data;	/* Pointer to aux data for congested func */
 	void (*unplug_io_fn)(struct backing_dev_info *, struct page *);
 	void *unplug_io_data;
+
+	/*
+	 * Everything below starts out zeroed, so that the statically
+	 * initialised backing_dev_infos need no setup.
+	 */
+	atomic_long_t bdi_stat[NR_BDI_STAT_ITEMS];
+
+	atomic_long_t writeout;	/* Completed writeouts, decaying */
+	unsigned long writeout_period; /* Period writeout was aged to */
+	int dirty_exceeded;	/* Dirty pages over this device's limit */
+
+	struct list_head bdi_list; /* Registered devices, under bdi_lock */
+	struct task_struct *task; /* Flusher thread, under bdi_lock */
+	long wb_nr_pages;	/* Writeout asked of the flusher, bdi_lock */
 };
 
+static inline void inc_bdi_stat(struct backing_dev_info *bdi,
+				enum bdi_stat_item item)
+{
+	atomic_long_inc(&bdi->bdi_stat[item]);
+}
+
+static inline void dec_bdi_stat(struct backing_dev_info *bdi,
+				enum bdi_stat_item item)
+{
+	atomic_long_dec(&bdi->bdi_stat[item]);
+}
+
+static inline unsigned long bdi_stat(struct backing_dev_info *bdi,
+				     enum bdi_stat_item item)
+{
+	long x = atomic_long_read(&bdi->bdi_stat[item]);
+
+	if (x < 0)
+		x = 0;
+	return x;
+}
+
 
 /*
  * Flags in backing_dev_info::capability
@@ -61,6 +111,11 @@ struct backing_dev_info {
 extern struct backing_dev_info default_backing_dev_info;
 void default_unplug_io_fn(struct backing_dev_info *bdi, struct page *page);
 
+void bdi_register(struct backing_dev_info *bdi);
+void bdi_unregister(struct backing_dev_info *bdi);
+void bdi_start_writeback(struct backing_dev_info *bdi, long nr_pages);
+void bdi_wakeup_all(void);
+
 int writeback_acquire(struct backing_dev_info *bdi);
 int writeback_in_progress(struct backing_dev_info *bdi);
 void writeback_release(struct backing_dev_info *bdi);
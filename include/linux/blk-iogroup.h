@@ -0,0 +1,74 @@
+#ifndef _LINUX_BLK_IOGROUP_H
+#define _LINUX_BLK_IOGROUP_H
+
+/*
+ * Block I/O groups.  Every cpuset has one: CFQ shares the disk time
+ * between the groups by weight, and the bios submitted by the tasks of a
+ * group can be limited in bytes and I/Os per second.  See
+ * block/blk-iogroup.c.
+ */
+
+#include <linux/spinlock.h>
+#include <linux/timer.h>
+#include <linux/workqueue.h>
+
+#ifdef CONFIG_BLK_IO_GROUP
+
+#define IOG_WEIGHT_MIN		100
+#define IOG_WEIGHT_MAX		1000
+#define IOG_WEIGHT_DEFAULT	500
+
+/* Tokens of one limit, refilled at limit per second */
+struct iog_bucket {
+	u64			limit;		/* per second, 0 for none */
+	s64			tokens;
+	unsigned long		last;		/* jiffies of the last refill */
+};
+
+struct io_group {
+	atomic_t		ref;
+	struct io_group		*parent;
+	unsigned int		weight;
+
+	/*
+	 * Throttling, under iog_throttle_lock.  The limits of a group apply
+	 * to the bios of its child groups as well.  The bios held back wait
+	 * in submission order, and are resubmitted by kthrotld.
+	 */
+	struct iog_bucket	bps;
+	struct iog_bucket	iops;
+	struct bio		*throttled, *throttled_tail;
+	unsigned long		nr_throttled;	/* bios which had to wait */
+	struct timer_list	throttle_timer;
+	struct work_struct	throttle_work;
+
+	/* statistics */
+	spinlock_t		lock;
+	unsigned long		ios[2];		/* submitted, read and write */
+	u64			bytes[2];
+	unsigned long		completed[2];	/* requests completed by CFQ */
+	u64			service_time;	/* msecs, queueing to completion */
+};
+
+extern struct io_group root_io_group;
+
+extern struct io_group *io_group_create(struct io_group *parent);
+extern void io_group_put(struct io_group *iog);
+extern int io_group_set_weight(struct io_group *iog, unsigned int weight);
+extern int io_group_set_limit(struct io_group *iog, int iops, u64 limit);
+extern int io_group_stat(struct io_group *iog, char *page);
+extern int io_group_throttle(struct io_group *iog, struct bio *bio);
+extern void io_group_completed(struct io_group *iog, int rw,
+			       unsigned long start_time);
+
+/* kernel/cpuset.c, a reference on the group of the current task */
+extern struct io_group *cpuset_get_io_group(void);
+
+static inline void io_group_get(struct io_group *iog)
+{
+	atomic_inc(&iog->ref);
+}
+
+#endif /* CONFIG_BLK_IO_GROUP */
+
+#endif
@@ -0,0 +1,91 @@
+#ifndef _LINUX_BLK_LATENCY_H
+#define _LINUX_BLK_LATENCY_H
+
+/*
+ * Per-queue latency histograms of the fs requests, from queueing to the
+ * driver taking them, and from there to their completion.  They are cheap
+ * enough to be always on; see block/blk-latency.c.
+ */
+
+#include <linux/blkdev.h>
+#include <linux/ktime.h>
+
+#ifdef CONFIG_BLK_LAT_HIST
+
+/*
+ * Slot 0 counts the latencies below a microsecond, slot n those of 2^(n-1)
+ * up to 2^n usecs, and the last one all from about 4 seconds up.  The
+ * requests are split up by direction and by size: up to 4KB, 16KB, 64KB,
+ * and more.
+ */
+#define BLK_LAT_SLOTS		24
+#define BLK_LAT_SIZES		4
+
+enum {
+	BLK_LAT_QUEUE,		/* queued -> issued to the driver */
+	BLK_LAT_DEVICE,		/* issued -> completed */
+	BLK_LAT_PHASES,
+};
+
+struct blk_lat_hist {
+	unsigned long	slot[BLK_LAT_PHASES][2][BLK_LAT_SIZES][BLK_LAT_SLOTS];
+};
+
+extern int blk_lat_init(request_queue_t *q);
+extern void blk_lat_exit(request_queue_t *q);
+extern void __blk_lat_account(struct request *rq, int phase, u64 start);
+extern ssize_t blk_lat_show(request_queue_t *q, int phase, char *page);
+extern void blk_lat_reset(request_queue_t *q, int phase);
+
+static inline u64 blk_lat_now(void)
+{
+	struct timespec ts;
+
+	ktime_get_ts(&ts);
+	return timespec_to_ns(&ts);
+}
+
+static inline void blk_lat_clear(struct request *rq)
+{
+	rq->start_time_ns = rq->io_start_time_ns = 0;
+}
+
+static inline void blk_lat_queued(struct request *rq)
+{
+	rq->start_time_ns = blk_lat_now();
+	rq->io_start_time_ns = 0;
+}
+
+/* @next is merged into @rq: it waits since the earlier of the two */
+static inline void blk_lat_merge(struct request *rq, struct request *next)
+{
+	if (next->start_time_ns < rq->start_time_ns)
+		rq->start_time_ns = next->start_time_ns;
+}
+
+/* a requeued request is only counted the first time it was issued */
+static inline void blk_lat_issue(struct request *rq)
+{
+	if (blk_fs_request(rq) && rq->start_time_ns && !rq->io_start_time_ns)
+		__blk_lat_account(rq, BLK_LAT_QUEUE, rq->start_time_ns);
+}
+
+static inline void blk_lat_done(struct request *rq)
+{
+	if (blk_fs_request(rq) && rq->io_start_time_ns)
+		__blk_lat_account(rq, BLK_LAT_DEVICE, rq->io_start_time_ns);
+}
+
+#else
+
+static inline int blk_lat_init(request_queue_t *q) { return 0; }
+static inline void blk_lat_exit(request_queue_t *q) { }
+static inline void blk_lat_clear(struct request *rq) { }
+static inline void blk_lat_queued(struct request *rq) { }
+static inline void blk_lat_merge(struct request *rq, struct request *next) { }
+static inline void blk_lat_issue(struct request *rq) { }
+static inline void blk_lat_done(struct request *rq) { }
+
+#endif /* CONFIG_BLK_LAT_HIST */
+
+#endif
@@ -0,0 +1,88 @@
+#ifndef BLK_MQ_H
+#define BLK_MQ_H
+
+#include <linux/blkdev.h>
+
+/*
+ * Multi-queue block devices.  Each cpu submits to a software queue of its
+ * own, and the software queues are mapped onto the hardware queues of the
+ * device, which the driver is handed the requests of one at a time.  There
+ * is no queue lock and no elevator; see block/blk-mq.c.
+ */
+
+struct blk_mq_hw_ctx {
+	spinlock_t		lock;		/* serializes ->queue_rq() */
+	struct list_head	dispatch;	/* requests the driver was busy for */
+	unsigned long		state;		/* BLK_MQ_S_* */
+	struct work_struct	run_work;
+
+	request_queue_t		*queue;
+	unsigned int		queue_num;
+	void			*driver_data;
+
+	/* the software queues mapped onto this one */
+	struct blk_mq_ctx	**ctxs;
+	unsigned int		nr_ctx;
+
+	/* tags, shared by the cpus of the hardware queue */
+	unsigned int		queue_depth;
+	unsigned long		*tag_map;
+	unsigned int		next_tag;	/* allocation hint */
+	wait_queue_head_t	tag_wait;
+	struct request		**rqs;		/* the request of each tag */
+
+	int			numa_node;
+};
+
+typedef int (queue_rq_fn)(struct blk_mq_hw_ctx *, struct request *);
+typedef int (init_hctx_fn)(struct blk_mq_hw_ctx *, void *, unsigned int);
+typedef void (exit_hctx_fn)(struct blk_mq_hw_ctx *, unsigned int);
+
+struct blk_mq_ops {
+	/* start a request, called with the hardware queue lock held */
+	queue_rq_fn		*queue_rq;
+
+	/* optional, set up and tear down driver_data of a hardware queue */
+	init_hctx_fn		*init_hctx;
+	exit_hctx_fn		*exit_hctx;
+};
+
+struct blk_mq_reg {
+	struct blk_mq_ops	*ops;
+	unsigned int		nr_hw_queues;
+	unsigned int		queue_depth;	/* tags of each hardware queue */
+	unsigned int		cmd_size;	/* driver data after each request */
+	int			numa_node;
+};
+
+/* ->queue_rq() results */
+enum {
+	BLK_MQ_RQ_QUEUE_OK	= 0,	/* queued to the hardware */
+	BLK_MQ_RQ_QUEUE_BUSY	= 1,	/* retry once a request completed */
+	BLK_MQ_RQ_QUEUE_ERROR	= 2,	/* end the request with -EIO */
+};
+
+/* hctx->state bits */
+enum {
+	BLK_MQ_S_STOPPED	= 0,
+};
+
+extern request_queue_t *blk_mq_init_queue(struct blk_mq_reg *, void *);
+extern void blk_mq_end_io(struct request *, int);
+extern void blk_mq_run_hw_queue(struct blk_mq_hw_ctx *, int);
+extern void blk_mq_stop_hw_queue(struct blk_mq_hw_ctx *);
+extern void blk_mq_start_hw_queue(struct blk_mq_hw_ctx *);
+
+/* The driver's cmd_size bytes, right after the request */
+static inline void *blk_mq_rq_to_pdu(struct request *rq)
+{
+	return rq + 1;
+}
+
+static inline struct blk_mq_hw_ctx *
+blk_mq_map_queue(request_queue_t *q, int cpu)
+{
+	return q->queue_hw_ctx[q->mq_map[cpu]];
+}
+
+#endif
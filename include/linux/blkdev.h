@@ -24,6 +24,10 @@ struct elevator_queue;
 typedef struct elevator_queue elevator_t;
 struct request_pm_state;
 struct blk_trace;
+struct blk_mq_ops;
+struct blk_mq_ctx;
+struct blk_mq_hw_ctx;
+struct blk_lat_hist;
 
 #define BLKDEV_MIN_RQ	4
 #define BLKDEV_MAX_RQ	128	/* Default maximum */
@@ -155,6 +159,11 @@ struct request {
 	int errors;
 	struct gendisk *rq_disk;
 	unsigned long start_time;
+#ifdef CONFIG_BLK_LAT_HIST
+	u64 start_time_ns;	/* queued, for the latency histograms */
+	u64 io_start_time_ns;	/* issued to the driver */
+	int lat_size;		/* size class, taken when issued */
+#endif
 
 	/* Number of scatter-gather DMA addr+len pairs after
 	 * physical address coalescing is performed.
@@ -199,6 +208,9 @@ struct request {
 	 */
 	rq_end_io_fn *end_io;
 	void *end_io_data;
+
+	struct blk_mq_ctx *mq_ctx;	/* software queue, for blk-mq */
+	int cpu;			/* submitted on, or -1 */
 };
 
 /*
@@ -369,6 +381,7 @@ struct request_queue
 	 */
 	unsigned long		bounce_pfn;
 	gfp_t			bounce_gfp;
+	atomic_long_t		bounced_sectors;	/* copied to bounce pages */
 
 	/*
 	 * various queue flags, see QUEUE_* below
@@ -419,6 +432,9 @@ struct request_queue
 	int			node;
 
 	struct blk_trace	*blk_trace;
+#ifdef CONFIG_BLK_LAT_HIST
+	struct blk_lat_hist	*lat_hist;	/* per cpu */
+#endif
 
 	/*
 	 * reserved for flush operations
@@ -430,6 +446,15 @@ struct request_queue
 	unsigned int		bi_size;
 
 	struct mutex		sysfs_lock;
+
+	/*
+	 * Multi-queue mode, for the queues of blk_mq_init_queue()
+	 */
+	struct blk_mq_ops	*mq_ops;
+	struct blk_mq_ctx	*queue_ctx;	/* per-cpu software queues */
+	unsigned int		*mq_map;	/* cpu -> hardware queue */
+	struct blk_mq_hw_ctx	**queue_hw_ctx;
+	unsigned int		nr_hw_queues;
 };
 
 #define RQ_INACTIVE		(-1)
@@ -444,6 +469,11 @@ struct request_queue
 #define QUEUE_FLAG_REENTER	6	/* Re-entrancy avoidance */
 #define QUEUE_FLAG_PLUGGED	7	/* queue is plugged */
 #define QUEUE_FLAG_ELVSWITCH	8	/* don't use elevator, just do FIFO */
+#define QUEUE_FLAG_TASKPLUG	9	/* plugged by the tasks, no plug timer */
+#define QUEUE_FLAG_SAME_COMP	10	/* complete on the submitter's package */
+#define QUEUE_FLAG_SAME_FORCE	11	/* ... on the submitting cpu itself */
+#define QUEUE_FLAG_NONROT	12	/* device doesn't seek, e.g. flash */
+#define QUEUE_FLAG_SG_CHAIN	13	/* blk_rq_map_sg() may follow sg chains */
 
 enum {
 	/*
@@ -488,6 +518,9 @@ enum {
 #define blk_queue_plugged(q)	test_bit(QUEUE_FLAG_PLUGGED, &(q)->queue_flags)
 #define blk_queue_tagged(q)	test_bit(QUEUE_FLAG_QUEUED, &(q)->queue_flags)
 #define blk_queue_stopped(q)	test_bit(QUEUE_FLAG_STOPPED, &(q)->queue_flags)
+#define blk_queue_taskplug(q)	test_bit(QUEUE_FLAG_TASKPLUG, &(q)->queue_flags)
+#define blk_queue_nonrot(q)	test_bit(QUEUE_FLAG_NONROT, &(q)->queue_flags)
+#define blk_queue_sg_chain(q)	test_bit(QUEUE_FLAG_SG_CHAIN, &(q)->queue_flags)
 #define blk_queue_flushing(q)	((q)->ordseq)
 
 #define blk_fs_request(rq)	((rq)->flags & REQ_CMD)
@@ -612,6 +645,30 @@ extern void blk_stop_queue(request_queue_t *q);
 extern void blk_sync_queue(struct request_queue *q);
 extern void __blk_stop_queue(request_queue_t *q);
 extern void blk_run_queue(request_queue_t *);
+
+/*
+ * A task batches the requests it makes of the queues with
+ * QUEUE_FLAG_TASKPLUG on a plug of its own, between blk_start_plug() and
+ * blk_finish_plug().  The plug lives on the task's stack.
+ */
+struct blk_plug {
+	struct list_head list;		/* requests not yet queued */
+	unsigned int count;
+};
+
+extern void blk_start_plug(struct blk_plug *);
+extern void blk_finish_plug(struct blk_plug *);
+extern void blk_flush_plug_list(struct blk_plug *);
+
+/* Called when @tsk is about to sleep, it may wait for its own requests */
+static inline void blk_flush_plug(struct task_struct *tsk)
+{
+	struct blk_plug *plug = tsk->plug;
+
+	if (plug && !list_empty(&plug->list))
+		blk_flush_plug_list(plug);
+}
+
 extern void blk_queue_activity_fn(request_queue_t *, activity_fn *, void *);
 extern int blk_rq_map_user(request_queue_t *, struct request *, void __user *, unsigned int);
 extern int blk_rq_unmap_user(struct bio *, unsigned int);
@@ -702,6 +759,7 @@ extern request_queue_t *blk_init_queue(request_fn_proc *, spinlock_t *);
 extern void blk_cleanup_queue(request_queue_t *);
 extern void blk_queue_make_request(request_queue_t *, make_request_fn *);
 extern void blk_queue_bounce_limit(request_queue_t *, u64);
+extern void blk_queue_bounce_dev(request_queue_t *, struct device *);
 extern void blk_queue_max_sectors(request_queue_t *, unsigned int);
 extern void blk_queue_max_phys_segments(request_queue_t *, unsigned short);
 extern void blk_queue_max_hw_segments(request_queue_t *, unsigned short);
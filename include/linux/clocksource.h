@@ -182,4 +182,13 @@ int clocksource_register(struct clocksource*);
 void clocksource_reselect(void);
 struct clocksource* clocksource_get_next(void);
 
+#ifdef CONFIG_GENERIC_TIME_VSYSCALL
+/* called with xtime_lock held for writing whenever xtime changes */
+extern void update_vsyscall(struct timespec *ts, struct clocksource *c);
+#else
+static inline void update_vsyscall(struct timespec *ts, struct clocksource *c)
+{
+}
+#endif
+
 #endif /* _LINUX_CLOCKSOURCE_H */
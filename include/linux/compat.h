@@ -182,6 +182,22 @@ asmlinkage ssize_t compat_sys_readv(unsigned long fd,
 		const struct compat_iovec __user *vec, unsigned long vlen);
 asmlinkage ssize_t compat_sys_writev(unsigned long fd,
 		const struct compat_iovec __user *vec, unsigned long vlen);
+asmlinkage ssize_t compat_sys_process_vm_readv(compat_pid_t pid,
+		const struct compat_iovec __user *lvec, compat_ulong_t liovcnt,
+		const struct compat_iovec __user *rvec, compat_ulong_t riovcnt,
+		compat_ulong_t flags);
+asmlinkage ssize_t compat_sys_process_vm_writev(compat_pid_t pid,
+		const struct compat_iovec __user *lvec, compat_ulong_t liovcnt,
+		const struct compat_iovec __user *rvec, compat_ulong_t riovcnt,
+		compat_ulong_t flags);
+asmlinkage long compat_sys_signalfd(int ufd,
+		const compat_sigset_t __user *user_mask,
+		compat_size_t sizemask);
+asmlinkage long compat_sys_timerfd_settime(int ufd, int flags,
+		const struct compat_itimerspec __user *utmr,
+		struct compat_itimerspec __user *otmr);
+asmlinkage long compat_sys_timerfd_gettime(int ufd,
+		struct compat_itimerspec __user *otmr);
 
 int compat_do_execve(char * filename, compat_uptr_t __user *argv,
 	        compat_uptr_t __user *envp, struct pt_regs * regs);
@@ -32,6 +32,12 @@
 #define CRYPTO_ALG_TYPE_DIGEST		0x00000002
 #define CRYPTO_ALG_TYPE_COMPRESS	0x00000004
 
+/*
+ * The algorithm is driven by a hardware engine through the async calls
+ * below.  Only found by crypto_alloc_tfm() with CRYPTO_TFM_REQ_ASYNC.
+ */
+#define CRYPTO_ALG_ASYNC		0x00000100
+
 /*
  * Transform masks and values (for crt_flags).
  */
@@ -46,6 +52,7 @@
 
 #define CRYPTO_TFM_REQ_WEAK_KEY		0x00000100
 #define CRYPTO_TFM_REQ_MAY_SLEEP	0x00000200
+#define CRYPTO_TFM_REQ_ASYNC		0x00000400
 #define CRYPTO_TFM_RES_WEAK_KEY		0x00100000
 #define CRYPTO_TFM_RES_BAD_KEY_LEN   	0x00200000
 #define CRYPTO_TFM_RES_BAD_KEY_SCHED 	0x00400000
@@ -72,6 +79,67 @@ struct cipher_desc {
 	void *info;
 };
 
+/*
+ * Asynchronous requests, submitted with crypto_cipher_encrypt_async(),
+ * crypto_cipher_decrypt_async() or crypto_digest_async().  These return
+ * 0 (or an error) if the request was done before they returned, and
+ * -EINPROGRESS if it was handed to a hardware engine: then complete()
+ * is called when it is done, from softirq or process context but never
+ * from within the submitting call, and the request and its buffers must
+ * be left alone until then.
+ *
+ * Requests are allocated by the caller, crypto_cipher_reqsize() or
+ * crypto_digest_reqsize() bytes of them, which leaves room at __ctx
+ * for the driver's own state.
+ */
+struct crypto_async_request;
+
+typedef void (*crypto_completion_t)(struct crypto_async_request *req, int err);
+
+struct crypto_async_request {
+	struct list_head list;		/* for the driver's crypto_queue */
+	crypto_completion_t complete;
+	void *data;
+	struct crypto_tfm *tfm;
+};
+
+struct cipher_request {
+	struct crypto_async_request base;
+	struct scatterlist *dst;
+	struct scatterlist *src;
+	unsigned int nbytes;
+	u8 *iv;				/* unless ECB, updated as by _iv */
+	int dir;			/* CRYPTO_DIR_* */
+
+	void *__ctx[] __attribute__ ((__aligned__));
+};
+
+struct digest_request {
+	struct crypto_async_request base;
+	struct scatterlist *sg;
+	unsigned int nsg;
+	u8 *out;
+
+	void *__ctx[] __attribute__ ((__aligned__));
+};
+
+/*
+ * A queue of requests for a driver, under the driver's own lock.
+ * crypto_enqueue_request() returns -EINPROGRESS, or -EBUSY if the queue
+ * is full: a driver's async method passes -EBUSY back, and the request
+ * is done in software instead.
+ */
+struct crypto_queue {
+	struct list_head list;
+	unsigned int qlen;
+	unsigned int max_qlen;
+};
+
+void crypto_init_queue(struct crypto_queue *queue, unsigned int max_qlen);
+int crypto_enqueue_request(struct crypto_queue *queue,
+			   struct crypto_async_request *req);
+struct crypto_async_request *crypto_dequeue_request(struct crypto_queue *queue);
+
 /*
  * Algorithms: modular crypto algorithm implementations, managed
  * via crypto_register_alg() and crypto_unregister_alg().
@@ -96,6 +164,12 @@ struct cipher_alg {
 	unsigned int (*cia_decrypt_cbc)(const struct cipher_desc *desc,
 					u8 *dst, const u8 *src,
 					unsigned int nbytes);
+	unsigned int (*cia_crypt_ctr)(const struct cipher_desc *desc,
+				      u8 *dst, const u8 *src,
+				      unsigned int nbytes);
+
+	/* CRYPTO_ALG_ASYNC only, instead of the above */
+	int (*cia_crypt_async)(struct cipher_request *req);
 };
 
 struct digest_alg {
@@ -106,6 +180,9 @@ struct digest_alg {
 	void (*dia_final)(struct crypto_tfm *tfm, u8 *out);
 	int (*dia_setkey)(struct crypto_tfm *tfm, const u8 *key,
 	                  unsigned int keylen, u32 *flags);
+
+	/* CRYPTO_ALG_ASYNC only, instead of init, update and final */
+	int (*dia_digest_async)(struct digest_request *req);
 };
 
 struct compress_alg {
@@ -125,6 +202,7 @@ struct crypto_alg {
 	unsigned int cra_blocksize;
 	unsigned int cra_ctxsize;
 	unsigned int cra_alignmask;
+	unsigned int cra_reqsize;	/* the driver's part of a request */
 
 	int cra_priority;
 
@@ -229,6 +307,13 @@ struct crypto_tfm {
 		struct compress_tfm compress;
 	} crt_u;
 	
+	/*
+	 * For CRYPTO_ALG_ASYNC: the software implementation that the
+	 * synchronous calls, and requests the engine has no room for,
+	 * are handed to.  It shares the key and the IV.
+	 */
+	struct crypto_tfm *crt_fallback;
+
 	struct crypto_alg *__crt_alg;
 
 	char __crt_ctx[] __attribute__ ((__aligned__));
@@ -268,6 +353,11 @@ static inline u32 crypto_tfm_alg_type(struct crypto_tfm *tfm)
 	return tfm->__crt_alg->cra_flags & CRYPTO_ALG_TYPE_MASK;
 }
 
+static inline int crypto_tfm_alg_async(struct crypto_tfm *tfm)
+{
+	return tfm->__crt_alg->cra_flags & CRYPTO_ALG_ASYNC;
+}
+
 static inline unsigned int crypto_tfm_alg_min_keysize(struct crypto_tfm *tfm)
 {
 	BUG_ON(crypto_tfm_alg_type(tfm) != CRYPTO_ALG_TYPE_CIPHER);
@@ -313,6 +403,38 @@ static inline unsigned int crypto_tfm_ctx_alignment(void)
 	return __alignof__(tfm->__crt_ctx);
 }
 
+static inline unsigned int crypto_cipher_reqsize(struct crypto_tfm *tfm)
+{
+	BUG_ON(crypto_tfm_alg_type(tfm) != CRYPTO_ALG_TYPE_CIPHER);
+	return sizeof(struct cipher_request) + tfm->__crt_alg->cra_reqsize;
+}
+
+static inline unsigned int crypto_digest_reqsize(struct crypto_tfm *tfm)
+{
+	BUG_ON(crypto_tfm_alg_type(tfm) != CRYPTO_ALG_TYPE_DIGEST);
+	return sizeof(struct digest_request) + tfm->__crt_alg->cra_reqsize;
+}
+
+static inline void crypto_request_init(struct crypto_async_request *req,
+				       struct crypto_tfm *tfm,
+				       crypto_completion_t complete,
+				       void *data)
+{
+	req->tfm = tfm;
+	req->complete = complete;
+	req->data = data;
+}
+
+static inline void *cipher_request_ctx(struct cipher_request *req)
+{
+	return req->__ctx;
+}
+
+static inline void *digest_request_ctx(struct digest_request *req)
+{
+	return req->__ctx;
+}
+
 /*
  * API wrappers.
  */
@@ -412,6 +534,10 @@ static inline void crypto_cipher_get_iv(struct crypto_tfm *tfm,
 	memcpy(dst, tfm->crt_cipher.cit_iv, len);
 }
 
+int crypto_cipher_encrypt_async(struct cipher_request *req);
+int crypto_cipher_decrypt_async(struct cipher_request *req);
+int crypto_digest_async(struct digest_request *req);
+
 static inline int crypto_comp_compress(struct crypto_tfm *tfm,
                                        const u8 *src, unsigned int slen,
                                        u8 *dst, unsigned int *dlen)
@@ -9,4 +9,9 @@ void sha_transform(__u32 *digest, const char *data, __u32 *W);
 
 __u32 half_md4_transform(__u32 buf[4], __u32 const in[8]);
 
+#define CHACHA20_BLOCK_WORDS 16
+#define CHACHA20_BLOCK_SIZE (CHACHA20_BLOCK_WORDS * 4)
+
+void chacha20_block(__u32 *state, __u32 *stream);
+
 #endif
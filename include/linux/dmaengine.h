@@ -52,6 +52,26 @@ typedef s32 dma_cookie_t;
 
 #define dma_submit_error(cookie) ((cookie) < 0 ? 1 : 0)
 
+/**
+ * enum dma_transaction_type - the operations a DMA device may offer
+ * @DMA_MEMCPY: the device_memcpy_* methods, which every device has
+ * @DMA_XOR: device_xor_pg
+ * @DMA_PQ: device_pq_pg, the RAID-6 P and Q syndrome
+ * @DMA_PQ_VAL: device_pq_val_pg, checking an existing syndrome
+ *
+ * The bits of these are set in &dma_device.capabilities.
+ */
+enum dma_transaction_type {
+	DMA_MEMCPY,
+	DMA_XOR,
+	DMA_PQ,
+	DMA_PQ_VAL,
+};
+
+/* device_pq_val_pg() result bits */
+#define DMA_PQ_P_BAD	1
+#define DMA_PQ_Q_BAD	2
+
 /**
  * enum dma_status - DMA transaction status
  * @DMA_SUCCESS: transaction completed successfully
@@ -141,6 +161,8 @@ typedef void (*dma_event_callback) (struct dma_client *client,
 /**
  * struct dma_client - info on the entity making use of DMA services
  * @event_callback: func ptr to call when something happens
+ * @cap_mask: the &enum dma_transaction_type bits its channels must have,
+ *	0 for any channel
  * @chan_count: number of chans allocated
  * @chans_desired: number of chans requested. Can be +/- chan_count
  * @lock: protects access to the channels list
@@ -149,6 +171,7 @@ typedef void (*dma_event_callback) (struct dma_client *client,
  */
 struct dma_client {
 	dma_event_callback	event_callback;
+	unsigned long		cap_mask;
 	unsigned int		chan_count;
 	unsigned int		chans_desired;
 
@@ -165,6 +188,9 @@ struct dma_client {
  * @refcount: reference count
  * @done: IO completion struct
  * @dev_id: unique device ID
+ * @capabilities: bitmap of the &enum dma_transaction_type it offers
+ * @max_xor: most sources a device_xor_pg call, or data pages a
+ *	device_pq_pg or device_pq_val_pg call, may take
  * @device_alloc_chan_resources: allocate resources and return the
  *	number of allocated descriptors
  * @device_free_chan_resources: release DMA channel's resources
@@ -173,6 +199,14 @@ struct dma_client {
  * @device_memcpy_pg_to_pg: memcpy struct page/offset to struct page/offset
  * @device_memcpy_complete: poll the status of an IOAT DMA transaction
  * @device_memcpy_issue_pending: push appended descriptors to hardware
+ * @device_xor_pg: xor @src into @dest, zeroing @dest first if @zero_dst
+ * @device_pq_pg: P and Q syndrome of the data pages, laid out as the
+ *	RAID-6 code has them: the data, then P, then Q
+ * @device_pq_val_pg: check the syndrome of the pages, storing the
+ *	DMA_PQ_*_BAD bits in @result on completion
+ *
+ * The operations of a channel, copies or not, complete in the order they
+ * were submitted in, and are polled for with device_memcpy_complete.
  */
 struct dma_device {
 
@@ -184,6 +218,8 @@ struct dma_device {
 	struct completion done;
 
 	int dev_id;
+	unsigned long capabilities;
+	unsigned int max_xor;
 
 	int (*device_alloc_chan_resources)(struct dma_chan *chan);
 	void (*device_free_chan_resources)(struct dma_chan *chan);
@@ -199,8 +235,22 @@ struct dma_device {
 			dma_cookie_t cookie, dma_cookie_t *last,
 			dma_cookie_t *used);
 	void (*device_memcpy_issue_pending)(struct dma_chan *chan);
+	dma_cookie_t (*device_xor_pg)(struct dma_chan *chan,
+			struct page *dest, struct page **src,
+			unsigned int src_cnt, size_t len, int zero_dst);
+	dma_cookie_t (*device_pq_pg)(struct dma_chan *chan,
+			struct page **blocks, unsigned int disks, size_t len);
+	dma_cookie_t (*device_pq_val_pg)(struct dma_chan *chan,
+			struct page **blocks, unsigned int disks, size_t len,
+			u32 *result);
 };
 
+static inline int dma_has_cap(struct dma_device *device,
+		enum dma_transaction_type type)
+{
+	return test_bit(type, &device->capabilities);
+}
+
 /* --- public DMA engine API --- */
 
 struct dma_client *dma_async_client_register(dma_event_callback event_callback);
@@ -256,6 +256,23 @@ struct ethtool_perm_addr {
 	__u8	data[0];
 };
 
+/* for spreading received packets over several rings by a hash of
+ * their headers (receive side scaling).  The hash of a packet picks
+ * an entry of the indirection table, which names the ring.
+ *
+ * ETHTOOL_GRXFH with both sizes 0 only reports rx_rings and the
+ * sizes; otherwise the sizes must be the device's, and rss_config is
+ * filled in.  ETHTOOL_SRXFH sets the table, the key or both: a size
+ * of 0 leaves that part alone.  rx_rings is read-only.
+ */
+struct ethtool_rxfh {
+	__u32	cmd;		/* ETHTOOL_{G,S}RXFH */
+	__u32	rx_rings;	/* number of receive rings */
+	__u32	indir_size;	/* entries in the indirection table */
+	__u32	key_size;	/* bytes in the hash key */
+	__u32	rss_config[0];	/* indir_size ring numbers, then the key */
+};
+
 #ifdef __KERNEL__
 
 struct net_device;
@@ -309,6 +326,13 @@ int ethtool_op_set_ufo(struct net_device *dev, u32 data);
  * phys_id: Identify the device
  * get_stats: Return statistics about the device
  * get_perm_addr: Gets the permanent hardware address
+ * get_coalesce_profile: Report the adaptive coalescing profile
+ * set_coalesce_profile: Set the adaptive coalescing profile
+ * get_rx_rings: Report the number of receive rings
+ * get_rxfh_indir_size: Report the size of the RSS indirection table
+ * get_rxfh_key_size: Report the size of the RSS hash key
+ * get_rxfh: Get the RSS indirection table and/or hash key
+ * set_rxfh: Set the RSS indirection table and/or hash key
  * 
  * Description:
  *
@@ -331,6 +355,11 @@ int ethtool_op_set_ufo(struct net_device *dev, u32 data);
  *	Should validate the magic field.  Don't need to check len for zero
  *	or wraparound.  Update len to the amount written.  Returns an error
  *	or zero.
+ *
+ * get_rxfh / set_rxfh:
+ *	Either of indir and key may be NULL, meaning that part is not
+ *	asked for, or not to be changed.  The entries of indir have been
+ *	checked against get_rx_rings.  Returns an error or zero.
  */
 struct ethtool_ops {
 	int	(*get_settings)(struct net_device *, struct ethtool_cmd *);
@@ -372,6 +401,13 @@ struct ethtool_ops {
 	void	(*complete)(struct net_device *);
 	u32     (*get_ufo)(struct net_device *);
 	int     (*set_ufo)(struct net_device *, u32);
+	u32	(*get_coalesce_profile)(struct net_device *);
+	int	(*set_coalesce_profile)(struct net_device *, u32);
+	u32	(*get_rx_rings)(struct net_device *);
+	u32	(*get_rxfh_indir_size)(struct net_device *);
+	u32	(*get_rxfh_key_size)(struct net_device *);
+	int	(*get_rxfh)(struct net_device *, u32 *indir, u8 *key);
+	int	(*set_rxfh)(struct net_device *, const u32 *indir, const u8 *key);
 };
 #endif /* __KERNEL__ */
 
@@ -413,6 +449,23 @@ struct ethtool_ops {
 #define ETHTOOL_SUFO		0x00000022 /* Set UFO enable (ethtool_value) */
 #define ETHTOOL_GGSO		0x00000023 /* Get GSO enable (ethtool_value) */
 #define ETHTOOL_SGSO		0x00000024 /* Set GSO enable (ethtool_value) */
+#define ETHTOOL_GGRO		0x00000025 /* Get GRO enable (ethtool_value) */
+#define ETHTOOL_SGRO		0x00000026 /* Set GRO enable (ethtool_value) */
+#define ETHTOOL_GCOALPROFILE	0x00000027 /* Get adaptive coalescing profile
+					    * (ethtool_value) */
+#define ETHTOOL_SCOALPROFILE	0x00000028 /* Set adaptive coalescing profile
+					    * (ethtool_value) */
+#define ETHTOOL_GRXFH		0x00000029 /* Get RSS rings, indirection
+					    * table and hash key */
+#define ETHTOOL_SRXFH		0x0000002a /* Set RSS indirection table
+					    * and hash key */
+
+/* Profiles for ETHTOOL_[GS]COALPROFILE, used while use_adaptive_rx_coalesce
+ * is set: which way the moderation leans as it follows the traffic.
+ */
+#define ETHTOOL_COAL_PROFILE_BALANCED	0
+#define ETHTOOL_COAL_PROFILE_LATENCY	1
+#define ETHTOOL_COAL_PROFILE_THROUGHPUT	2
 
 /* compatibility with older code */
 #define SPARC_ETH_GSET		ETHTOOL_GSET
@@ -0,0 +1,38 @@
+/*
+ *  include/linux/eventfd.h
+ *
+ *  eventfd(): a 64 bit counter behind a file descriptor, for waking up
+ *  event loops from other threads and from the kernel.
+ */
+
+#ifndef _LINUX_EVENTFD_H
+#define _LINUX_EVENTFD_H
+
+#ifdef __KERNEL__
+
+#include <linux/err.h>
+
+struct file;
+
+#ifdef CONFIG_EVENTFD
+
+struct file *eventfd_fget(int fd);
+int eventfd_signal(struct file *file, int n);
+
+#else /* CONFIG_EVENTFD */
+
+static inline struct file *eventfd_fget(int fd)
+{
+	return ERR_PTR(-ENOSYS);
+}
+
+static inline int eventfd_signal(struct file *file, int n)
+{
+	return 0;
+}
+
+#endif /* CONFIG_EVENTFD */
+
+#endif /* __KERNEL__ */
+
+#endif /* _LINUX_EVENTFD_H */
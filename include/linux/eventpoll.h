@@ -22,6 +22,13 @@
 #define EPOLL_CTL_DEL 2
 #define EPOLL_CTL_MOD 3
 
+/*
+ * Set the Edge Triggered behaviour for the target file descriptor, and
+ * report a wake up of the file as all the events asked for, without
+ * polling it again for the ones that are really there.
+ */
+#define EPOLLNOPOLL (1 << 29)
+
 /* Set the One Shot behaviour for the target file descriptor */
 #define EPOLLONESHOT (1 << 30)
 
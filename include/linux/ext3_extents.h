@@ -0,0 +1,99 @@
+/*
+ *  linux/include/linux/ext3_extents.h
+ *
+ * On-disk format of the extent trees of ext3 inodes flagged
+ * EXT3_EXTENTS_FL, and the in-memory path through one.
+ */
+
+#ifndef _LINUX_EXT3_EXTENTS
+#define _LINUX_EXT3_EXTENTS
+
+#include <linux/ext3_jbd.h>
+
+/*
+ * The tree is rooted in i_block: a header followed by four entries.  The
+ * nodes below it each take a block.  Index nodes point to the nodes of the
+ * next level down, the leaves at the bottom map runs of logical blocks to
+ * runs of physical ones.  Entries are kept sorted by logical block, and an
+ * index entry carries the first logical block of the node it points to.
+ */
+#define EXT3_EXT_MAGIC		0xf30a
+
+/* the longest run one extent can map */
+#define EXT3_EXT_MAX_LEN	32768
+
+/* deeper than this is taken for corruption */
+#define EXT3_EXT_MAX_DEPTH	5
+
+/* a logical block beyond any file */
+#define EXT3_EXT_MAX_BLOCK	0xffffffff
+
+/* leaf entry */
+struct ext3_extent {
+	__le32	ee_block;	/* first logical block mapped */
+	__le16	ee_len;		/* number of blocks mapped */
+	__le16	ee_start_hi;	/* high 16 bits of the physical block */
+	__le32	ee_start;	/* low 32 bits of the physical block */
+};
+
+/* index entry */
+struct ext3_extent_idx {
+	__le32	ei_block;	/* first logical block below this entry */
+	__le32	ei_leaf;	/* low 32 bits of the block of the node below */
+	__le16	ei_leaf_hi;	/* high 16 bits of it */
+	__u16	ei_unused;
+};
+
+/* at the start of the root and of each node */
+struct ext3_extent_header {
+	__le16	eh_magic;
+	__le16	eh_entries;	/* entries in use */
+	__le16	eh_max;		/* room for entries */
+	__le16	eh_depth;	/* 0 for a leaf */
+	__le32	eh_generation;
+};
+
+/* one level of a lookup, from the root (0) down to the leaf */
+struct ext3_ext_path {
+	ext3_fsblk_t			p_block;	/* of the node, 0 for the root */
+	struct ext3_extent_header	*p_hdr;
+	struct ext3_extent_idx		*p_idx;		/* in index nodes */
+	struct ext3_extent		*p_ext;		/* in the leaf, may be NULL */
+	struct buffer_head		*p_bh;		/* NULL for the root */
+};
+
+#define EXT_FIRST_EXTENT(h) \
+	((struct ext3_extent *)(((char *)(h)) + sizeof(struct ext3_extent_header)))
+#define EXT_FIRST_INDEX(h) \
+	((struct ext3_extent_idx *)(((char *)(h)) + sizeof(struct ext3_extent_header)))
+#define EXT_LAST_EXTENT(h) \
+	(EXT_FIRST_EXTENT(h) + le16_to_cpu((h)->eh_entries) - 1)
+#define EXT_LAST_INDEX(h) \
+	(EXT_FIRST_INDEX(h) + le16_to_cpu((h)->eh_entries) - 1)
+
+static inline struct ext3_extent_header *ext_inode_hdr(struct inode *inode)
+{
+	return (struct ext3_extent_header *)EXT3_I(inode)->i_data;
+}
+
+static inline struct ext3_extent_header *ext_block_hdr(struct buffer_head *bh)
+{
+	return (struct ext3_extent_header *)bh->b_data;
+}
+
+static inline unsigned short ext_depth(struct inode *inode)
+{
+	return le16_to_cpu(ext_inode_hdr(inode)->eh_depth);
+}
+
+/* extents.c */
+extern int ext3_ext_tree_init(handle_t *handle, struct inode *inode);
+extern int ext3_ext_get_blocks(handle_t *handle, struct inode *inode,
+			sector_t iblock, unsigned long maxblocks,
+			struct buffer_head *bh_result,
+			int create, int extend_disksize);
+extern void ext3_ext_truncate(handle_t *handle, struct inode *inode,
+			unsigned long start);
+extern int ext3_ext_index_trans_blocks(struct inode *inode);
+
+#endif	/* _LINUX_EXT3_EXTENTS */
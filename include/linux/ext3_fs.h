@@ -131,10 +131,20 @@ struct ext3_group_desc
 	__le16	bg_free_blocks_count;	/* Free blocks count */
 	__le16	bg_free_inodes_count;	/* Free inodes count */
 	__le16	bg_used_dirs_count;	/* Directories count */
-	__u16	bg_pad;
-	__le32	bg_reserved[3];
+	__le16	bg_flags;		/* EXT3_BG_* flags */
+	__le32	bg_reserved[2];
+	__le16	bg_itable_unused;	/* Inodes at the end never used */
+	__le16	bg_checksum;		/* crc16(s_uuid + group + desc) */
 };
 
+/*
+ * Group descriptor flags, with the gdt_csum feature only.  An uninitialised
+ * bitmap is not read, its contents follow from the group's layout.
+ */
+#define EXT3_BG_INODE_UNINIT	0x0001	/* Inode bitmap not in use */
+#define EXT3_BG_BLOCK_UNINIT	0x0002	/* Block bitmap not in use */
+#define EXT3_BG_INODE_ZEROED	0x0004	/* Inode table zeroed on disk */
+
 /*
  * Macro-instructions used to manage group descriptors
  */
@@ -181,9 +191,10 @@ struct ext3_group_desc
 #define EXT3_NOTAIL_FL			0x00008000 /* file tail should not be merged */
 #define EXT3_DIRSYNC_FL			0x00010000 /* dirsync behaviour (directories only) */
 #define EXT3_TOPDIR_FL			0x00020000 /* Top of directory hierarchies*/
+#define EXT3_EXTENTS_FL			0x00080000 /* Inode uses extents */
 #define EXT3_RESERVED_FL		0x80000000 /* reserved for ext3 lib */
 
-#define EXT3_FL_USER_VISIBLE		0x0003DFFF /* User visible flags */
+#define EXT3_FL_USER_VISIBLE		0x000BDFFF /* User visible flags */
 #define EXT3_FL_USER_MODIFIABLE		0x000380FF /* User modifiable flags */
 
 /*
@@ -371,6 +382,12 @@ struct ext3_inode {
 #define EXT3_MOUNT_QUOTA		0x80000 /* Some quota option set */
 #define EXT3_MOUNT_USRQUOTA		0x100000 /* "old" user quota */
 #define EXT3_MOUNT_GRPQUOTA		0x200000 /* "old" group quota */
+#define EXT3_MOUNT_JOURNAL_CHECKSUM	0x400000 /* Journal checksums */
+#define EXT3_MOUNT_JOURNAL_ASYNC_COMMIT	0x800000 /* Journal Async Commit */
+#define EXT3_MOUNT_EXTENTS		0x1000000 /* New files use extents */
+#define EXT3_MOUNT_DELALLOC		0x2000000 /* Delayed allocation */
+#define EXT3_MOUNT_SORTDIR		0x4000000 /* readdir in inode order */
+#define EXT3_MOUNT_NOINIT_ITABLE	0x8000000 /* Don't zero inode tables */
 
 /* Compatibility, for having both ext2_fs.h and ext3_fs.h included at once */
 #ifndef _LINUX_EXT2_FS_H
@@ -563,20 +580,24 @@ static inline int ext3_valid_inum(struct super_block *sb, unsigned long ino)
 #define EXT3_FEATURE_RO_COMPAT_SPARSE_SUPER	0x0001
 #define EXT3_FEATURE_RO_COMPAT_LARGE_FILE	0x0002
 #define EXT3_FEATURE_RO_COMPAT_BTREE_DIR	0x0004
+#define EXT3_FEATURE_RO_COMPAT_GDT_CSUM		0x0010 /* bg_flags, bg_checksum */
 
 #define EXT3_FEATURE_INCOMPAT_COMPRESSION	0x0001
 #define EXT3_FEATURE_INCOMPAT_FILETYPE		0x0002
 #define EXT3_FEATURE_INCOMPAT_RECOVER		0x0004 /* Needs recovery */
 #define EXT3_FEATURE_INCOMPAT_JOURNAL_DEV	0x0008 /* Journal device */
 #define EXT3_FEATURE_INCOMPAT_META_BG		0x0010
+#define EXT3_FEATURE_INCOMPAT_EXTENTS		0x0040 /* extents support */
 
 #define EXT3_FEATURE_COMPAT_SUPP	EXT2_FEATURE_COMPAT_EXT_ATTR
 #define EXT3_FEATURE_INCOMPAT_SUPP	(EXT3_FEATURE_INCOMPAT_FILETYPE| \
 					 EXT3_FEATURE_INCOMPAT_RECOVER| \
-					 EXT3_FEATURE_INCOMPAT_META_BG)
+					 EXT3_FEATURE_INCOMPAT_META_BG| \
+					 EXT3_FEATURE_INCOMPAT_EXTENTS)
 #define EXT3_FEATURE_RO_COMPAT_SUPP	(EXT3_FEATURE_RO_COMPAT_SPARSE_SUPER| \
 					 EXT3_FEATURE_RO_COMPAT_LARGE_FILE| \
-					 EXT3_FEATURE_RO_COMPAT_BTREE_DIR)
+					 EXT3_FEATURE_RO_COMPAT_BTREE_DIR| \
+					 EXT3_FEATURE_RO_COMPAT_GDT_CSUM)
 
 /*
  * Default values for user and/or group using reserved blocks
@@ -717,6 +738,11 @@ struct dir_private_info {
 	__u32		curr_hash;
 	__u32		curr_minor_hash;
 	__u32		next_hash;
+	/* with the sortdir option: the batch in inode order */
+	int		ino_sort;
+	struct fname	**ino_order;
+	unsigned	ino_count;
+	unsigned	ino_next;
 };
 
 /* calculate the first block number of the group */
@@ -745,6 +771,10 @@ ext3_group_first_block_no(struct super_block *sb, unsigned long group_no)
 # define NORET_AND     noreturn,
 
 /* balloc.c */
+extern __le16 ext3_group_desc_csum(struct ext3_sb_info *sbi, __u32 group,
+				   struct ext3_group_desc *gdp);
+extern int ext3_group_desc_csum_verify(struct ext3_sb_info *sbi, __u32 group,
+				       struct ext3_group_desc *gdp);
 extern int ext3_bg_has_super(struct super_block *sb, int group);
 extern unsigned long ext3_bg_num_gdb(struct super_block *sb, int group);
 extern ext3_fsblk_t ext3_new_block (handle_t *handle, struct inode *inode,
@@ -762,6 +792,8 @@ extern struct ext3_group_desc * ext3_get_group_desc(struct super_block * sb,
 						    unsigned int block_group,
 						    struct buffer_head ** bh);
 extern int ext3_should_retry_alloc(struct super_block *sb, int *retries);
+extern int ext3_claim_free_blocks(struct ext3_sb_info *sbi,
+				  unsigned long nblocks);
 extern void ext3_init_block_alloc_info(struct inode *);
 extern void ext3_rsv_window_add(struct super_block *sb, struct ext3_reserve_window_node *rsv);
 
@@ -789,6 +821,8 @@ extern unsigned long ext3_count_free_inodes (struct super_block *);
 extern unsigned long ext3_count_dirs (struct super_block *);
 extern void ext3_check_inodes_bitmap (struct super_block *);
 extern unsigned long ext3_count_free (struct buffer_head *, unsigned);
+extern void ext3_start_itable_init(struct super_block *);
+extern void ext3_stop_itable_init(struct super_block *);
 
 
 /* inode.c */
@@ -812,6 +846,8 @@ extern int ext3_get_inode_loc(struct inode *, struct ext3_iloc *);
 extern void ext3_truncate (struct inode *);
 extern void ext3_set_inode_flags(struct inode *);
 extern void ext3_set_aops(struct inode *inode);
+extern int ext3_getattr(struct vfsmount *mnt, struct dentry *dentry,
+			struct kstat *stat);
 
 /* ioctl.c */
 extern int ext3_ioctl (struct inode *, struct file *, unsigned int,
@@ -822,6 +858,7 @@ extern int ext3_orphan_add(handle_t *, struct inode *);
 extern int ext3_orphan_del(handle_t *, struct inode *);
 extern int ext3_htree_fill_tree(struct file *dir_file, __u32 start_hash,
 				__u32 start_minor_hash, __u32 *next_hash);
+extern void ext3_dx_cache_drop(struct inode *dir);
 
 /* resize.c */
 extern int ext3_group_add(struct super_block *sb,
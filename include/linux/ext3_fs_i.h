@@ -93,6 +93,9 @@ struct ext3_inode_info {
 	struct ext3_block_alloc_info *i_block_alloc_info;
 
 	__u32	i_dir_start_lookup;
+
+	/* index blocks of an htree directory, see namei.c */
+	struct ext3_dx_cache *i_dx_cache;
 #ifdef CONFIG_EXT3_FS_XATTR
 	/*
 	 * Extended attributes can be read independently of the main file
@@ -141,6 +144,17 @@ struct ext3_inode_info {
 	 * by other means, so we have truncate_mutex.
 	 */
 	struct mutex truncate_mutex;
+
+	/*
+	 * Blocks claimed for the delayed buffers of the inode, and for the
+	 * indirect blocks or extent tree nodes that mapping them may take.
+	 * i_da_allocating counts the writeouts allocating claimed blocks.
+	 */
+	spinlock_t i_block_reservation_lock;
+	unsigned long i_reserved_data_blocks;
+	unsigned long i_reserved_meta_blocks;
+	unsigned int i_da_allocating;
+
 	struct inode vfs_inode;
 };
 
@@ -23,6 +23,7 @@
 #include <linux/percpu_counter.h>
 #endif
 #include <linux/rbtree.h>
+#include <linux/mutex.h>
 
 /*
  * third extended-fs super-block data in memory
@@ -57,6 +58,7 @@ struct ext3_sb_info {
 	struct percpu_counter s_freeblocks_counter;
 	struct percpu_counter s_freeinodes_counter;
 	struct percpu_counter s_dirs_counter;
+	struct percpu_counter s_dirtyblocks_counter;	/* delalloc claims */
 	struct blockgroup_lock s_blockgroup_lock;
 
 	/* root of the per fs reservation window tree */
@@ -70,6 +72,10 @@ struct ext3_sb_info {
 	struct list_head s_orphan;
 	unsigned long s_commit_interval;
 	struct block_device *journal_bdev;
+
+	/* zeroing of the inode tables not yet zeroed, see ialloc.c */
+	struct task_struct *s_itable_task;
+	struct mutex s_itable_mutex;
 #ifdef CONFIG_JBD_DEBUG
 	struct timer_list turn_ro_timer;	/* For turning read-only (crash simulation) */
 	wait_queue_head_t ro_wait_queue;	/* For people waiting for the fs to go read-only */
@@ -233,6 +233,7 @@ extern int dir_notify_enable;
 #include <linux/list.h>
 #include <linux/radix-tree.h>
 #include <linux/prio_tree.h>
+#include <linux/rbtree.h>
 #include <linux/init.h>
 #include <linux/sched.h>
 #include <linux/mutex.h>
@@ -511,6 +512,7 @@ struct inode {
 	struct timespec		i_mtime;
 	struct timespec		i_ctime;
 	unsigned int		i_blkbits;
+	unsigned int		i_hash_lock;	/* lock of the i_hash chain */
 	unsigned long		i_blksize;
 	unsigned long		i_version;
 	blkcnt_t		i_blocks;
@@ -522,6 +524,8 @@ struct inode {
 	const struct file_operations	*i_fop;	/* former ->i_op->default_file_ops */
 	struct super_block	*i_sb;
 	struct file_lock	*i_flock;
+	struct rb_root		i_flock_tree;	/* POSIX locks by range, */
+	struct hlist_head	i_flock_long;	/*  see fs/locks.c */
 	struct address_space	*i_mapping;
 	struct address_space	i_data;
 #ifdef CONFIG_QUOTA
@@ -544,6 +548,7 @@ struct inode {
 #ifdef CONFIG_INOTIFY
 	struct list_head	inotify_watches; /* watches on this inode */
 	struct mutex		inotify_mutex;	/* protects the watches list */
+	__u32			inotify_mask;	/* all watches' masks or'ed */
 #endif
 
 	unsigned long		i_state;
@@ -656,6 +661,8 @@ struct fown_struct {
 struct file_ra_state {
 	unsigned long start;		/* Current window */
 	unsigned long size;
+	unsigned long async_size;	/* on-demand: pages of the window left
+					   when the marker page is reached */
 	unsigned long flags;		/* ra flags RA_FLAG_xxx*/
 	unsigned long cache_hit;	/* cache hit count*/
 	unsigned long prev_page;	/* Cache last read() position */
@@ -677,6 +684,7 @@ struct file {
 		struct list_head	fu_list;
 		struct rcu_head 	fu_rcuhead;
 	} f_u;
+	struct sb_file_list	*f_sb_list;	/* fu_list is on it, or NULL */
 	struct dentry		*f_dentry;
 	struct vfsmount         *f_vfsmnt;
 	const struct file_operations	*f_op;
@@ -705,6 +713,35 @@ extern spinlock_t files_lock;
 #define file_list_lock() spin_lock(&files_lock);
 #define file_list_unlock() spin_unlock(&files_lock);
 
+/*
+ * The files open on a super block are kept on per-cpu lists, each with
+ * its own lock, so that open and close on different cpus don't share
+ * a lock.  files_lock only covers the other file lists (tty_files).
+ */
+struct sb_file_list {
+	spinlock_t		lock;
+	struct list_head	list;
+};
+
+/*
+ * Walks the files of a super block, one cpu's list at a time under its
+ * lock.  The body must not break out of the walk.
+ */
+#define do_file_list_for_each_entry(__sb, __file)		\
+{								\
+	int __cpu;						\
+	for_each_possible_cpu(__cpu) {				\
+		struct sb_file_list *__fl;			\
+		__fl = per_cpu_ptr((__sb)->s_files, __cpu);	\
+		spin_lock(&__fl->lock);				\
+		list_for_each_entry((__file), &__fl->list, f_u.fu_list) {
+
+#define while_file_list_for_each_entry				\
+		}						\
+		spin_unlock(&__fl->lock);			\
+	}							\
+}
+
 #define get_file(x)	atomic_inc(&(x)->f_count)
 #define file_count(x)	atomic_read(&(x)->f_count)
 
@@ -757,6 +794,11 @@ struct lock_manager_operations {
 
 struct file_lock {
 	struct file_lock *fl_next;	/* singly linked list for this inode  */
+	struct file_lock **fl_pprev;	/* what points to it on that list */
+	union {				/* range index of POSIX locks */
+		struct rb_node fl_rb;
+		struct hlist_node fl_long;
+	};
 	struct list_head fl_link;	/* doubly linked list of all locks */
 	struct list_head fl_block;	/* circular list of blocked processes */
 	fl_owner_t fl_owner;
@@ -885,7 +927,9 @@ struct super_block {
 	struct list_head	s_dirty;	/* dirty inodes 保存所有的dentry */
 	struct list_head	s_io;		/* parked for writeback */
 	struct hlist_head	s_anon;		/* anonymous dentries for (nfs) exporting */
-	struct list_head	s_files;
+	struct list_head	s_dentry_lru;	/* unused dentries, dcache_lru_lock */
+	int			s_nr_dentry_unused;
+	struct sb_file_list	*s_files;	/* per-cpu */
 
 	struct block_device	*s_bdev;
 	struct list_head	s_instances;
@@ -1016,6 +1060,8 @@ struct block_device_operations {
 	int (*media_changed) (struct gendisk *);
 	int (*revalidate_disk) (struct gendisk *);
 	int (*getgeo)(struct block_device *, struct hd_geometry *);
+	/* this swap slot is free: called under swap_lock */
+	void (*swap_slot_free_notify) (struct block_device *, unsigned long);
 	struct module *owner;
 };
 
@@ -1622,12 +1668,14 @@ extern void remove_dquot_ref(struct super_block *, int, struct list_head *);
 
 extern void __insert_inode_hash(struct inode *, unsigned long hashval);
 extern void remove_inode_hash(struct inode *);
+extern void __remove_inode_hash(struct inode *);
 static inline void insert_inode_hash(struct inode *inode) {
 	__insert_inode_hash(inode, inode->i_ino);
 }
 
 extern struct file * get_empty_filp(void);
 extern void file_move(struct file *f, struct list_head *list);
+extern void file_sb_list_add(struct file *f, struct super_block *sb);
 extern void file_kill(struct file *f);
 struct bio;
 extern void submit_bio(int, struct bio *);
@@ -10,6 +10,7 @@
 
 #include <asm/types.h>
 #include <linux/major.h>
+#include <linux/ioctl.h>
 
 /** Version number of this interface */
 #define FUSE_KERNEL_VERSION 7
@@ -26,6 +27,9 @@
 /** The minor number of the fuse character device */
 #define FUSE_MINOR 229
 
+/** Make a new device file another channel of a mounted one's connection */
+#define FUSE_DEV_IOC_CLONE	_IOR(229, 0, __u32)
+
 /* Make sure all structures are padded to 64bit boundary, so 32bit
    userspace works under 64bit kernels */
 
@@ -91,6 +95,8 @@ struct fuse_file_lock {
  */
 #define FUSE_ASYNC_READ		(1 << 0)
 #define FUSE_POSIX_LOCKS	(1 << 1)
+#define FUSE_BATCH_READ		(1 << 2)
+#define FUSE_WRITEBACK_CACHE	(1 << 3)
 
 enum fuse_opcode {
 	FUSE_LOOKUP	   = 1,
@@ -95,10 +95,40 @@ struct hrtimer_base {
 	struct lock_class_key lock_key;
 };
 
+#define MAX_HRTIMER_BASES 2
+
+struct clock_event_device;
+struct pt_regs;
+
+/**
+ * struct hrtimer_hres - per cpu state of the high resolution mode
+ * @active:		the cpu expires its timers from the event interrupt
+ * @expires_next:	monotonic time of the programmed event
+ * @dev:		the one-shot clock event device of the cpu
+ * @tick_handler:	periodic handler which the device had installed
+ * @sched_tick:		timer which emulates the periodic tick
+ * @regs:		registers of the running event interrupt
+ * @nr_events:		number of event interrupts handled
+ */
+struct hrtimer_hres {
+	int				active;
+	ktime_t				expires_next;
+	struct clock_event_device	*dev;
+	void				(*tick_handler)(struct clock_event_device *,
+							struct pt_regs *);
+	struct hrtimer			sched_tick;
+	struct pt_regs			*regs;
+	unsigned long			nr_events;
+};
+
 /*
  * clock_was_set() is a NOP for non- high-resolution systems. The
  * time-sorted order guarantees that a timer does not expire early and
  * is expired in the next softirq when the clock was advanced.
+ *
+ * In high resolution mode the CLOCK_REALTIME timers are checked at the
+ * latest from the emulated tick, so a clock which was set forward is
+ * still noticed within a jiffy.
  */
 #define clock_was_set()		do { } while (0)
 
@@ -145,6 +175,28 @@ extern void hrtimer_init_sleeper(struct hrtimer_sleeper *sl,
 /* Soft interrupt function to run the hrtimer queues: */
 extern void hrtimer_run_queues(void);
 
+#ifdef CONFIG_HIGH_RES_TIMERS
+extern void hrtimer_interrupt(struct clock_event_device *dev,
+			      struct pt_regs *regs);
+extern void hrtimer_switch_to_lowres(void);
+extern int hrtimer_hres_active(void);
+# ifdef CONFIG_NO_IDLE_HZ
+extern int hrtimer_stop_sched_tick(unsigned long ticks);
+extern int hrtimer_restart_sched_tick(void);
+# endif
+#else
+static inline void hrtimer_switch_to_lowres(void) { }
+static inline int hrtimer_hres_active(void) { return 0; }
+# ifdef CONFIG_NO_IDLE_HZ
+static inline int hrtimer_stop_sched_tick(unsigned long ticks) { return 0; }
+static inline int hrtimer_restart_sched_tick(void) { return 0; }
+# endif
+#endif
+
+/* Per cpu state, for /proc/timer_list: */
+extern struct hrtimer_base *hrtimer_cpu_bases(int cpu);
+extern struct hrtimer_hres *hrtimer_cpu_hres(int cpu);
+
 /* Bootup initialization: */
 extern void __init hrtimers_init(void);
 
@@ -0,0 +1,136 @@
+#ifndef _LINUX_HUGE_MM_H
+#define _LINUX_HUGE_MM_H
+
+/*
+ * Transparent huge pages: private anonymous memory faulted in, and
+ * collapsed by khugepaged, as one huge page mapped by a single pmd.
+ * See Documentation/vm/transhuge.txt.
+ */
+
+#include <linux/mm.h>
+
+/* Returned by the huge fault handlers when the pte path must be taken */
+#define VM_FAULT_FALLBACK	(-1)
+
+struct mmu_gather;
+
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+
+#define HPAGE_PMD_SHIFT		PMD_SHIFT
+#define HPAGE_PMD_SIZE		(1UL << HPAGE_PMD_SHIFT)
+#define HPAGE_PMD_MASK		(~(HPAGE_PMD_SIZE - 1))
+#define HPAGE_PMD_ORDER		(HPAGE_PMD_SHIFT - PAGE_SHIFT)
+#define HPAGE_PMD_NR		(1 << HPAGE_PMD_ORDER)
+
+/* transparent_hugepage_flags */
+#define TRANSPARENT_HUGEPAGE_ALWAYS	0x1	/* every eligible vma */
+#define TRANSPARENT_HUGEPAGE_MADVISE	0x2	/* only MADV_HUGEPAGE vmas */
+
+extern unsigned long transparent_hugepage_flags;
+
+/*
+ * Huge pages are only used for private anonymous memory that isn't a
+ * stack or left to KSM: nothing but the fault, zap and split paths below has to know
+ * about them.
+ */
+static inline int transparent_hugepage_enabled(struct vm_area_struct *vma)
+{
+	if (vma->vm_file || vma->vm_ops)
+		return 0;
+	if (vma->vm_flags & (VM_NOHUGEPAGE | VM_SHARED | VM_HUGETLB |
+			     VM_PFNMAP | VM_IO | VM_GROWSDOWN | VM_GROWSUP |
+			     VM_MERGEABLE))
+		return 0;
+	if (transparent_hugepage_flags & TRANSPARENT_HUGEPAGE_ALWAYS)
+		return 1;
+	if (transparent_hugepage_flags & TRANSPARENT_HUGEPAGE_MADVISE)
+		return !!(vma->vm_flags & VM_HUGEPAGE);
+	return 0;
+}
+
+extern int do_huge_pmd_anonymous_page(struct mm_struct *mm,
+		struct vm_area_struct *vma, unsigned long address,
+		pmd_t *pmd, int write_access);
+extern int do_huge_pmd_fault(struct mm_struct *mm, struct vm_area_struct *vma,
+		unsigned long address, pmd_t *pmd, int write_access);
+extern struct page *follow_trans_huge_pmd(struct mm_struct *mm,
+		unsigned long address, pmd_t *pmd, unsigned int flags);
+extern int zap_huge_pmd(struct mmu_gather *tlb, struct vm_area_struct *vma,
+		pmd_t *pmd);
+extern int change_huge_pmd(struct mm_struct *mm, pmd_t *pmd, pgprot_t newprot);
+extern void __split_huge_page_pmd(struct mm_struct *mm, pmd_t *pmd);
+extern void split_huge_page_address(struct mm_struct *mm,
+		unsigned long address, struct page *page);
+extern void split_huge_page(struct page *page);
+extern int hugepage_madvise(unsigned long *vm_flags, int advice);
+
+extern void khugepaged_enter(struct mm_struct *mm);
+extern void khugepaged_fork(struct mm_struct *mm, struct mm_struct *oldmm);
+
+/*
+ * Callers hold mmap_sem, so a pmd seen huge can only stop being huge
+ * under us through split_huge_page(), which __split_huge_page_pmd()
+ * rechecks for under page_table_lock.
+ */
+#define split_huge_page_pmd(mm, pmd)				\
+	do {							\
+		if (unlikely(pmd_trans_huge(*(pmd))))		\
+			__split_huge_page_pmd(mm, pmd);		\
+	} while (0)
+
+#else /* !CONFIG_TRANSPARENT_HUGEPAGE */
+
+#define HPAGE_PMD_SIZE		({ BUG(); 0; })
+
+#define pmd_trans_huge(pmd)			0
+#define transparent_hugepage_enabled(vma)	0
+#define split_huge_page_pmd(mm, pmd)		do { } while (0)
+
+static inline int do_huge_pmd_anonymous_page(struct mm_struct *mm,
+		struct vm_area_struct *vma, unsigned long address,
+		pmd_t *pmd, int write_access)
+{
+	return VM_FAULT_FALLBACK;
+}
+
+static inline int do_huge_pmd_fault(struct mm_struct *mm,
+		struct vm_area_struct *vma, unsigned long address,
+		pmd_t *pmd, int write_access)
+{
+	return VM_FAULT_FALLBACK;
+}
+
+static inline struct page *follow_trans_huge_pmd(struct mm_struct *mm,
+		unsigned long address, pmd_t *pmd, unsigned int flags)
+{
+	return NULL;
+}
+
+static inline int zap_huge_pmd(struct mmu_gather *tlb,
+		struct vm_area_struct *vma, pmd_t *pmd)
+{
+	return 0;
+}
+
+static inline int change_huge_pmd(struct mm_struct *mm, pmd_t *pmd,
+		pgprot_t newprot)
+{
+	return 0;
+}
+
+static inline void split_huge_page(struct page *page)
+{
+}
+
+static inline void khugepaged_enter(struct mm_struct *mm)
+{
+}
+
+static inline void khugepaged_fork(struct mm_struct *mm,
+		struct mm_struct *oldmm)
+{
+}
+
+#endif /* CONFIG_TRANSPARENT_HUGEPAGE */
+
+#endif /* _LINUX_HUGE_MM_H */
@@ -31,19 +31,42 @@
 #define DBG1( a... )
 #endif
 
+/* Queues, that is file descriptors, a multi queue device takes */
+#define TUN_MAX_QUEUES	16
+
+struct tun_struct;
+
+/* One per open file descriptor, the device's queue once attached */
+struct tun_file {
+	struct tun_struct	*tun;
+	unsigned int		queue_index;
+	unsigned long		flags;		/* TUN_FASYNC */
+
+	wait_queue_head_t	read_wait;
+	struct sk_buff_head	readq;
+
+	struct fasync_struct    *fasync;
+
+	/* written by this file's reader and writer only */
+	unsigned long		rx_packets;
+	unsigned long		rx_bytes;
+	unsigned long		rx_dropped;
+	unsigned long		tx_packets;
+	unsigned long		tx_bytes;
+};
+
 struct tun_struct {
 	struct list_head        list;
 	unsigned long 		flags;
-	int			attached;
 	uid_t			owner;
 
-	wait_queue_head_t	read_wait;
-	struct sk_buff_head	readq;
+	/* changed under rtnl and the tx lock */
+	struct tun_file		*tfiles[TUN_MAX_QUEUES];
+	unsigned int		numqueues;
 
 	struct net_device	*dev;
-	struct net_device_stats	stats;
-
-	struct fasync_struct    *fasync;
+	struct net_device_stats	stats;		/* queues detached so far */
+	struct net_device_stats	total;
 
 	unsigned long if_flags;
 	u8 dev_addr[ETH_ALEN];
@@ -70,6 +93,8 @@ struct tun_struct {
 #define TUN_NO_PI	0x0040
 #define TUN_ONE_QUEUE	0x0080
 #define TUN_PERSIST 	0x0100	
+#define TUN_VNET_HDR	0x0200
+#define TUN_MULTI_QUEUE	0x0400
 
 /* Ioctl defines */
 #define TUNSETNOCSUM  _IOW('T', 200, int) 
@@ -78,12 +103,23 @@ struct tun_struct {
 #define TUNSETPERSIST _IOW('T', 203, int) 
 #define TUNSETOWNER   _IOW('T', 204, int)
 #define TUNSETLINK    _IOW('T', 205, int)
+#define TUNGETFEATURES _IOR('T', 207, unsigned int)
+#define TUNSETOFFLOAD  _IOW('T', 208, unsigned int)
 
 /* TUNSETIFF ifr flags */
 #define IFF_TUN		0x0001
 #define IFF_TAP		0x0002
 #define IFF_NO_PI	0x1000
+#define IFF_MULTI_QUEUE	0x0100
 #define IFF_ONE_QUEUE	0x2000
+#define IFF_VNET_HDR	0x4000
+
+/* Features for TUNSETOFFLOAD, the offloads the reader takes */
+#define TUN_F_CSUM	0x01	/* You can hand me unchecksummed packets. */
+#define TUN_F_TSO4	0x02	/* I can handle TSO for IPv4 packets */
+#define TUN_F_TSO6	0x04	/* I can handle TSO for IPv6 packets */
+#define TUN_F_TSO_ECN	0x08	/* I can handle TSO with ECN bits. */
+#define TUN_F_UFO	0x10	/* I can handle UFO packets */
 
 struct tun_pi {
 	unsigned short flags;
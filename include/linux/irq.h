@@ -18,9 +18,11 @@
 #include <linux/spinlock.h>
 #include <linux/cpumask.h>
 #include <linux/irqreturn.h>
+#include <linux/wait.h>
 
 #include <asm/irq.h>
 #include <asm/ptrace.h>
+#include <asm/atomic.h>
 
 /*
  * IRQ line status.
@@ -153,6 +155,8 @@ struct irq_desc {
 	unsigned int		irq_count;	/* For detecting broken IRQs */
 	unsigned int		irqs_unhandled;
 	spinlock_t		lock;
+	atomic_t		threads_active;	/* handler threads running */
+	wait_queue_head_t	wait_for_threads;
 #ifdef CONFIG_SMP
 	cpumask_t		affinity;
 	unsigned int		cpu;
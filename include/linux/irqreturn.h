@@ -14,12 +14,15 @@
  *
  * IRQ_NONE means we didn't handle it.
  * IRQ_HANDLED means that we did have a valid interrupt and handled it.
+ * IRQ_WAKE_THREAD means that the interrupt is ours and the rest of the
+ * handling is left to the handler thread, see request_threaded_irq().
  * IRQ_RETVAL(x) selects on the two depending on x being non-zero (for handled)
  */
 typedef int irqreturn_t;
 
 #define IRQ_NONE	(0)
 #define IRQ_HANDLED	(1)
+#define IRQ_WAKE_THREAD	(2)
 #define IRQ_RETVAL(x)	((x) != 0)
 
 #endif
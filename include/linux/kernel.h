@@ -143,6 +143,8 @@ asmlinkage int vprintk(const char *fmt, va_list args)
 	__attribute__ ((format (printf, 1, 0)));
 asmlinkage int printk(const char * fmt, ...)
 	__attribute__ ((format (printf, 1, 2)));
+extern void printk_tick(void);
+extern int printk_needs_cpu(int cpu);
 #else
 static inline int vprintk(const char *s, va_list args)
 	__attribute__ ((format (printf, 1, 0)));
@@ -150,6 +152,8 @@ static inline int vprintk(const char *s, va_list args) { return 0; }
 static inline int printk(const char *s, ...)
 	__attribute__ ((format (printf, 1, 2)));
 static inline int printk(const char *s, ...) { return 0; }
+static inline void printk_tick(void) { }
+static inline int printk_needs_cpu(int cpu) { return 0; }
 #endif
 
 unsigned long int_sqrt(unsigned long);
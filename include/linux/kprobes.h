@@ -160,6 +160,13 @@ extern int arch_init_kprobes(void);
 extern void show_registers(struct pt_regs *regs);
 extern kprobe_opcode_t *get_insn_slot(void);
 extern void free_insn_slot(kprobe_opcode_t *slot);
+#ifdef CONFIG_OPTPROBES
+extern int arch_optimize_kprobe(struct kprobe *p);
+extern void arch_unoptimize_kprobe(struct kprobe *p);
+extern int arch_within_optimized_kprobe(struct kprobe *p, unsigned long addr);
+extern kprobe_opcode_t *get_optinsn_slot(void);
+extern void free_optinsn_slot(kprobe_opcode_t *slot);
+#endif
 extern void kprobes_inc_nmissed_count(struct kprobe *p);
 
 /* Get the kprobe at this addr (if any) - called with preemption disabled */
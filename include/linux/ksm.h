@@ -0,0 +1,33 @@
+#ifndef __LINUX_KSM_H
+#define __LINUX_KSM_H
+/*
+ * Kernel samepage merging: memory areas registered with
+ * madvise(MADV_MERGEABLE) have their identical pages shared.
+ * See Documentation/vm/ksm.txt.
+ */
+
+#include <linux/mm.h>
+#include <linux/sched.h>
+
+#ifdef CONFIG_KSM
+extern int ksm_madvise(struct vm_area_struct *vma, unsigned long start,
+		unsigned long end, int advice, unsigned long *vm_flags);
+extern void ksm_fork(struct mm_struct *mm, struct mm_struct *oldmm);
+extern void __ksm_exit(struct mm_struct *mm);
+
+static inline void ksm_exit(struct mm_struct *mm)
+{
+	if (mm->ksm_mm_slot)
+		__ksm_exit(mm);
+}
+#else
+static inline void ksm_fork(struct mm_struct *mm, struct mm_struct *oldmm)
+{
+}
+
+static inline void ksm_exit(struct mm_struct *mm)
+{
+}
+#endif /* CONFIG_KSM */
+
+#endif /* __LINUX_KSM_H */
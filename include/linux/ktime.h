@@ -264,7 +264,8 @@ static inline u64 ktime_to_ns(const ktime_t kt)
 #define KTIME_REALTIME_RES	(ktime_t){ .tv64 = TICK_NSEC }
 #define KTIME_MONOTONIC_RES	(ktime_t){ .tv64 = TICK_NSEC }
 
-/* Get the monotonic time in timespec format: */
+/* Get the monotonic time in ktime_t and in timespec format: */
+extern ktime_t ktime_get(void);
 extern void ktime_get_ts(struct timespec *ts);
 
 /* Get the real (wall-) time in timespec format: */
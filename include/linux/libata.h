@@ -34,6 +34,7 @@
 #include <asm/io.h>
 #include <linux/ata.h>
 #include <linux/workqueue.h>
+#include <linux/ktime.h>
 #include <scsi/scsi_host.h>
 
 /*
@@ -112,6 +113,10 @@ enum {
 	/* tag ATA_MAX_QUEUE - 1 is reserved for internal commands */
 	ATA_MAX_QUEUE		= 32,
 	ATA_TAG_INTERNAL	= ATA_MAX_QUEUE - 1,
+	/* per-port histograms, see struct ata_host_stats */
+	ATA_QDEPTH_HIST_BUCKETS	= 6,
+	ATA_LAT_HIST_BUCKETS	= 16,
+	ATA_LAT_HIST_SHIFT	= 16,	/* first bucket: below 2^16 ns */
 	ATA_MAX_SECTORS		= 200,	/* FIXME */
 	ATA_MAX_SECTORS_LBA48	= 65535,
 	ATA_MAX_BUS		= 2,
@@ -417,6 +422,8 @@ struct ata_queued_cmd {
 	struct ata_taskfile	result_tf;
 	ata_qc_cb_t		complete_fn;
 
+	ktime_t			issue_time;
+
 	void			*private_data;
 };
 
@@ -424,6 +431,16 @@ struct ata_host_stats {
 	unsigned long		unhandled_irq;
 	unsigned long		idle_irq;
 	unsigned long		rw_reqbuf;
+
+	/*
+	 * Under the host_set lock.  qdepth_hist counts commands by the
+	 * number already in flight when they were issued: 0, 1, 2-3, 4-7,
+	 * 8-15 and 16-31.  lat_hist counts them by issue to completion
+	 * time, bucket n for below 2^(ATA_LAT_HIST_SHIFT + n) ns, the last
+	 * bucket taking all the slower ones.
+	 */
+	unsigned long		qdepth_hist[ATA_QDEPTH_HIST_BUCKETS];
+	unsigned long		lat_hist[ATA_LAT_HIST_BUCKETS];
 };
 
 struct ata_ering_entry {
@@ -534,6 +551,7 @@ struct ata_port {
 	struct ata_queued_cmd	qcmd[ATA_MAX_QUEUE];
 	unsigned long		qc_allocated;
 	unsigned int		qc_active;
+	unsigned int		last_tag;	/* tag allocation hint */
 
 	unsigned int		active_tag;
 	u32			sactive;
@@ -665,6 +665,23 @@ static inline void hlist_del_init(struct hlist_node *n)
 	}
 }
 
+/**
+ * hlist_del_init_rcu - deletes entry from hash list with re-initialization
+ * @n: the element to delete from the hash list.
+ *
+ * Note: hlist_unhashed() on the node returns true after this.  Unlike
+ * hlist_del_init() the forward pointer is left alone, for the readers
+ * which may still be walking the hash list through this node, so the
+ * same precautions as for hlist_del_rcu() apply.
+ */
+static inline void hlist_del_init_rcu(struct hlist_node *n)
+{
+	if (!hlist_unhashed(n)) {
+		__hlist_del(n);
+		n->pprev = NULL;
+	}
+}
+
 /*
  * hlist_replace_rcu - replace old entry by new one
  * @old : the element to be replaced
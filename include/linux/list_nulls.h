@@ -0,0 +1,113 @@
+#ifndef _LINUX_LIST_NULLS_H
+#define _LINUX_LIST_NULLS_H
+
+#ifdef __KERNEL__
+
+#include <linux/stddef.h>
+#include <linux/rcupdate.h>
+#include <asm/system.h>
+
+/*
+ * Hash lists whose end is not a NULL pointer but a "nulls" marker, which
+ * can carry a value: the number of the chain, typically.  Nodes are at
+ * least word aligned, so the lowest bit tells the two apart - set for a
+ * nulls marker, holding the value in the bits above, clear for a node.
+ *
+ * A lockless reader following ->next through a node that was meanwhile
+ * moved to another chain ends up on that chain's nulls marker; when the
+ * value is not that of the chain it started on, it must start over.
+ */
+struct hlist_nulls_head {
+	struct hlist_nulls_node *first;
+};
+
+struct hlist_nulls_node {
+	struct hlist_nulls_node *next, **pprev;
+};
+
+#define INIT_HLIST_NULLS_HEAD(ptr, nulls) \
+	((ptr)->first = (struct hlist_nulls_node *) (1UL | (((long)nulls) << 1)))
+
+#define hlist_nulls_entry(ptr, type, member) container_of(ptr,type,member)
+
+static inline int is_a_nulls(const struct hlist_nulls_node *ptr)
+{
+	return ((unsigned long)ptr & 1);
+}
+
+static inline unsigned long get_nulls_value(const struct hlist_nulls_node *ptr)
+{
+	return ((unsigned long)ptr) >> 1;
+}
+
+static inline int hlist_nulls_unhashed(const struct hlist_nulls_node *h)
+{
+	return !h->pprev;
+}
+
+static inline int hlist_nulls_empty(const struct hlist_nulls_head *h)
+{
+	return is_a_nulls(h->first);
+}
+
+static inline void __hlist_nulls_del(struct hlist_nulls_node *n)
+{
+	struct hlist_nulls_node *next = n->next;
+	struct hlist_nulls_node **pprev = n->pprev;
+	*pprev = next;
+	if (!is_a_nulls(next))
+		next->pprev = pprev;
+}
+
+/**
+ * hlist_nulls_del_init_rcu - deletes entry from hash list with re-initialization
+ * @n: the element to delete from the hash list.
+ *
+ * As hlist_del_init_rcu(): the forward pointer is left alone for the
+ * readers which may still be walking the list through this node.
+ */
+static inline void hlist_nulls_del_init_rcu(struct hlist_nulls_node *n)
+{
+	if (!hlist_nulls_unhashed(n)) {
+		__hlist_nulls_del(n);
+		n->pprev = NULL;
+	}
+}
+
+/**
+ * hlist_nulls_add_head_rcu
+ * @n: the element to add to the hash list.
+ * @h: the list to add to.
+ *
+ * As hlist_add_head_rcu(), for a nulls list.
+ */
+static inline void hlist_nulls_add_head_rcu(struct hlist_nulls_node *n,
+					    struct hlist_nulls_head *h)
+{
+	struct hlist_nulls_node *first = h->first;
+
+	n->next = first;
+	n->pprev = &h->first;
+	smp_wmb();
+	if (!is_a_nulls(first))
+		first->pprev = &n->next;
+	h->first = n;
+}
+
+/**
+ * hlist_nulls_for_each_entry_rcu - iterate over rcu list of given type
+ * @tpos:	the type * to use as a loop cursor.
+ * @pos:	the &struct hlist_nulls_node to use as a loop cursor.
+ * @head:	the head for your list.
+ * @member:	the name of the hlist_nulls_node within the struct.
+ *
+ * On exit @pos holds the nulls marker the walk ended on.
+ */
+#define hlist_nulls_for_each_entry_rcu(tpos, pos, head, member)		\
+	for (pos = rcu_dereference((head)->first);			\
+	     !is_a_nulls(pos) &&					\
+		({ tpos = hlist_nulls_entry(pos, typeof(*tpos), member); 1; }); \
+	     pos = rcu_dereference(pos->next))
+
+#endif /* __KERNEL__ */
+#endif
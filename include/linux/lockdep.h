@@ -56,6 +56,14 @@ enum lock_usage_bit
 
 #define MAX_LOCKDEP_SUBCLASSES		8UL
 
+/*
+ * Lock statistics: the call sites recorded per lock-class, and the
+ * buckets of the wait-time histogram, which are powers of two starting
+ * below 512 nsecs:
+ */
+#define LOCKSTAT_POINTS			4
+#define LOCKSTAT_HIST			12
+
 /*
  * Lock-classes are keyed via unique addresses, by embedding the
  * lockclass-key into the kernel (or module) .data section. (For
@@ -112,8 +120,36 @@ struct lock_class {
 
 	const char			*name;
 	int				name_version;
+
+#ifdef CONFIG_LOCK_STAT
+	/*
+	 * Where the lock was contended, counted in the lock_class_stats:
+	 */
+	unsigned long			contention_point[LOCKSTAT_POINTS];
+#endif
 };
 
+#ifdef CONFIG_LOCK_STAT
+struct lock_time {
+	u64				min;
+	u64				max;
+	u64				total;
+	unsigned long			nr;
+};
+
+struct lock_class_stats {
+	unsigned long			contention_point[LOCKSTAT_POINTS];
+	struct lock_time		read_waittime;
+	struct lock_time		write_waittime;
+	struct lock_time		read_holdtime;
+	struct lock_time		write_holdtime;
+	unsigned int			wait_hist[LOCKSTAT_HIST];
+};
+
+struct lock_class_stats lock_stats(struct lock_class *class);
+void clear_lock_stats(struct lock_class *class);
+#endif
+
 /*
  * Map the lock object (the lock instance) to the lock-class object.
  * This is embedded into specific lock instances:
@@ -180,6 +216,15 @@ struct held_lock {
 	int				read;
 	int				check;
 	int				hardirqs_off;
+
+#ifdef CONFIG_LOCK_STAT
+	/*
+	 * sched_clock() when the lock was found contended (0 if it was
+	 * not), and when it was taken:
+	 */
+	u64				waittime_stamp;
+	u64				holdtime_stamp;
+#endif
 };
 
 /*
@@ -270,6 +315,33 @@ static inline int lockdep_internal(void)
 struct lock_class_key { };
 #endif /* !LOCKDEP */
 
+#ifdef CONFIG_LOCK_STAT
+
+extern void lock_contended(struct lockdep_map *lock, unsigned long ip);
+extern void lock_acquired(struct lockdep_map *lock);
+
+/*
+ * Take a lock with @lock after a failed @try, and account the wait to
+ * the lock's class.  Uncontended acquires cost nothing over the trylock:
+ */
+#define LOCK_CONTENDED(_lock, try, lock)			\
+do {								\
+	if (!try(_lock)) {					\
+		lock_contended(&(_lock)->dep_map, _RET_IP_);	\
+		lock(_lock);					\
+		lock_acquired(&(_lock)->dep_map);		\
+	}							\
+} while (0)
+
+#else /* CONFIG_LOCK_STAT */
+
+#define lock_contended(lockdep_map, ip)		do { } while (0)
+#define lock_acquired(lockdep_map)		do { } while (0)
+
+#define LOCK_CONTENDED(_lock, try, lock)	lock(_lock)
+
+#endif /* CONFIG_LOCK_STAT */
+
 #if defined(CONFIG_TRACE_IRQFLAGS) && defined(CONFIG_GENERIC_HARDIRQS)
 extern void early_init_irq_lock_class(void);
 #else
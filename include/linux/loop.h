@@ -28,6 +28,13 @@ enum {
 
 struct loop_func_table;
 
+/* A run of blocks of the backing file, contiguous on lo_direct_bdev */
+struct loop_extent {
+	sector_t	file_block;
+	sector_t	nr_blocks;
+	sector_t	disk_block;
+};
+
 struct loop_device {
 	int		lo_number;
 	int		lo_refcnt;
@@ -64,6 +71,13 @@ struct loop_device {
 	struct mutex		lo_ctl_mutex;
 	int			lo_pending;
 
+	/* LO_FLAGS_DIRECT_IO: bios go straight to the backing device */
+	struct block_device	*lo_direct_bdev;
+	struct loop_extent	*lo_extents;	/* sorted by file_block */
+	int			lo_nr_extents;
+	atomic_t		lo_direct_pending;	/* bios in flight */
+	wait_queue_head_t	lo_direct_wait;
+
 	request_queue_t		*lo_queue;
 };
 
@@ -75,6 +89,7 @@ struct loop_device {
 enum {
 	LO_FLAGS_READ_ONLY	= 1,
 	LO_FLAGS_USE_AOPS	= 2,
+	LO_FLAGS_DIRECT_IO	= 4,
 };
 
 #include <asm/posix_types.h>	/* for __kernel_old_dev_t */
@@ -158,5 +173,6 @@ int loop_unregister_transfer(int number);
 #define LOOP_SET_STATUS64	0x4C04
 #define LOOP_GET_STATUS64	0x4C05
 #define LOOP_CHANGE_FD		0x4C06
+#define LOOP_SET_DIRECT_IO	0x4C07
 
 #endif
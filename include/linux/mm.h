@@ -110,8 +110,37 @@ struct vm_area_struct {
 #ifdef CONFIG_NUMA
 	struct mempolicy *vm_policy;	/* NUMA policy for the VMA */
 #endif
+#ifdef CONFIG_SPECULATIVE_PAGE_FAULT
+	seqcount_t vm_sequence;		/* Bumped around changes, under
+					   mmap_sem for write */
+#endif
 };
 
+/*
+ * Speculative page faults look at a vma without mmap_sem, so whoever
+ * changes its range, protection or page tables under mmap_sem for write
+ * brackets the change with these.
+ */
+#ifdef CONFIG_SPECULATIVE_PAGE_FAULT
+static inline void vma_write_begin(struct vm_area_struct *vma)
+{
+	write_seqcount_begin(&vma->vm_sequence);
+}
+
+static inline void vma_write_end(struct vm_area_struct *vma)
+{
+	write_seqcount_end(&vma->vm_sequence);
+}
+#else
+static inline void vma_write_begin(struct vm_area_struct *vma)
+{
+}
+
+static inline void vma_write_end(struct vm_area_struct *vma)
+{
+}
+#endif
+
 /*
  * This struct defines the per-mm list of VMAs for uClinux. If CONFIG_MMU is
  * disabled, then there's a single shared list of VMAs maintained by the
@@ -164,6 +193,9 @@ extern unsigned int kobjsize(const void *objp);
 #define VM_NONLINEAR	0x00800000	/* Is non-linear (remap_file_pages) */
 #define VM_MAPPED_COPY	0x01000000	/* T if mapped copy of data (nommu mmap) */
 #define VM_INSERTPAGE	0x02000000	/* The vma has had "vm_insert_page()" done on it */
+#define VM_HUGEPAGE	0x04000000	/* MADV_HUGEPAGE marked this vma */
+#define VM_NOHUGEPAGE	0x08000000	/* MADV_NOHUGEPAGE marked this vma */
+#define VM_MERGEABLE	0x10000000	/* KSM may merge identical pages */
 
 #ifndef VM_STACK_DEFAULT_FLAGS		/* arch can override this */
 #define VM_STACK_DEFAULT_FLAGS VM_DATA_DEFAULT_FLAGS
@@ -224,10 +256,13 @@ struct page {
 	unsigned long flags;		/* Atomic flags, some possibly
 					 * updated asynchronously */
 	atomic_t _count;		/* Usage count, see below. */
-	atomic_t _mapcount;		/* Count of ptes mapped in mms,
+	union {
+		atomic_t _mapcount;	/* Count of ptes mapped in mms,
 					 * to show when page is mapped
 					 * & limit reverse map searches.
 					 */
+		unsigned int inuse;	/* SLUB: Nr of objects */
+	};
 	union {
 	    struct {
 		unsigned long private;		/* Mapping-private opaque data:
@@ -248,8 +283,15 @@ struct page {
 #if NR_CPUS >= CONFIG_SPLIT_PTLOCK_CPUS
 	    spinlock_t ptl;
 #endif
+	    struct {			/* SLUB uses */
+		void **lockless_freelist;	/* Per cpu free list */
+		struct kmem_cache *slab;	/* Pointer to slab */
+	    };
+	};
+	union {
+		pgoff_t index;		/* Our offset within mapping. */
+		void *freelist;		/* SLUB: freelist req. slab lock */
 	};
-	pgoff_t index;			/* Our offset within mapping. */
 	struct list_head lru;		/* Pageout list, eg. active_list
 					 * protected by zone->lru_lock !
 					 */
@@ -561,11 +603,16 @@ void page_address_init(void);
  * page->mapping points to its anon_vma, not to a struct address_space;
  * with the PAGE_MAPPING_ANON bit set to distinguish it.
  *
+ * A page merged by KSM has no anon_vma: its page->mapping is just
+ * PAGE_MAPPING_ANON | PAGE_MAPPING_KSM.
+ *
  * Please note that, confusingly, "page_mapping" refers to the inode
  * address_space which maps the page from disk; whereas "page_mapped"
  * refers to user virtual address space into which the page is mapped.
  */
 #define PAGE_MAPPING_ANON	1
+#define PAGE_MAPPING_KSM	2
+#define PAGE_MAPPING_FLAGS	(PAGE_MAPPING_ANON | PAGE_MAPPING_KSM)
 
 extern struct address_space swapper_space;
 static inline struct address_space *page_mapping(struct page *page)
@@ -574,6 +621,10 @@ static inline struct address_space *page_mapping(struct page *page)
 
 	if (unlikely(PageSwapCache(page)))
 		mapping = &swapper_space;
+#ifdef CONFIG_SLUB
+	else if (unlikely(PageSlab(page)))
+		mapping = NULL;		/* page->mapping is page->slab */
+#endif
 	else if (unlikely((unsigned long)mapping & PAGE_MAPPING_ANON))
 		mapping = NULL;
 	return mapping;
@@ -584,6 +635,12 @@ static inline int PageAnon(struct page *page)
 	return ((unsigned long)page->mapping & PAGE_MAPPING_ANON) != 0;
 }
 
+static inline int PageKsm(struct page *page)
+{
+	return ((unsigned long)page->mapping & PAGE_MAPPING_FLAGS) ==
+		PAGE_MAPPING_FLAGS;
+}
+
 /*
  * Return the pagecache index of the passed page.  Regular pagecache pages
  * use ->index whereas swapcache pages use ->private
@@ -759,7 +816,52 @@ static inline int handle_mm_fault(struct mm_struct *mm,
 }
 #endif
 
+#ifdef CONFIG_SHARED_PAGE_TABLES
+extern int sysctl_fork_share_page_tables;
+
+/*
+ * A pte table shared by several mms since fork is mapped write-protected
+ * in all of them; one left write-protected after the others let go of it
+ * looks the same until it is next faulted on.
+ */
+#define pmd_ptes_shared(pmd)	\
+	(pmd_present(pmd) && !pmd_large(pmd) && !pmd_write(pmd))
+
+extern int unshare_pte_table(struct mm_struct *mm, struct vm_area_struct *vma,
+			pmd_t *pmd, unsigned long address);
+extern int unshare_page_range(struct vm_area_struct *vma,
+			unsigned long start, unsigned long end);
+#else
+#define pmd_ptes_shared(pmd)	0
+
+static inline int unshare_pte_table(struct mm_struct *mm,
+			struct vm_area_struct *vma, pmd_t *pmd,
+			unsigned long address)
+{
+	return 0;
+}
+
+static inline int unshare_page_range(struct vm_area_struct *vma,
+			unsigned long start, unsigned long end)
+{
+	return 0;
+}
+#endif
+
+#ifdef CONFIG_SPECULATIVE_PAGE_FAULT
+extern int handle_speculative_fault(struct mm_struct *mm,
+			unsigned long address, int write_access);
+#else
+static inline int handle_speculative_fault(struct mm_struct *mm,
+			unsigned long address, int write_access)
+{
+	return 0;
+}
+#endif
+
 extern int make_pages_present(unsigned long addr, unsigned long end);
+extern void populate_cached_range(struct vm_area_struct *vma,
+		unsigned long start, unsigned long end);
 extern int access_process_vm(struct task_struct *tsk, unsigned long addr, void *buf, int len, int write);
 void install_arg_page(struct vm_area_struct *, struct page *, unsigned long);
 
@@ -984,6 +1086,17 @@ unsigned long page_cache_readahead(struct address_space *mapping,
 			  unsigned long size);
 void handle_ra_miss(struct address_space *mapping, 
 		    struct file_ra_state *ra, pgoff_t offset);
+void page_cache_sync_readahead(struct address_space *mapping,
+			       struct file_ra_state *ra,
+			       struct file *filp,
+			       pgoff_t offset,
+			       unsigned long size);
+void page_cache_async_readahead(struct address_space *mapping,
+				struct file_ra_state *ra,
+				struct file *filp,
+				struct page *pg,
+				pgoff_t offset,
+				unsigned long size);
 unsigned long max_sane_readahead(unsigned long nr);
 
 /* Do stack extension */
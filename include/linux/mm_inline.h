@@ -1,41 +1,57 @@
-
-static inline void
-add_page_to_active_list(struct zone *zone, struct page *page)
+/*
+ * page_is_file_cache - should the page be on a file LRU or anon LRU?
+ * @page: the page to test
+ *
+ * Returns 1 if @page is page cache page backed by a regular filesystem,
+ * or 0 if @page is anonymous, tmpfs or otherwise ram or swap backed.
+ */
+static inline int page_is_file_cache(struct page *page)
 {
-	list_add(&page->lru, &zone->active_list);
-	zone->nr_active++;
+	return !PageSwapBacked(page);
 }
 
 static inline void
-add_page_to_inactive_list(struct zone *zone, struct page *page)
+add_page_to_lru_list(struct zone *zone, struct page *page, enum lru_list l)
 {
-	list_add(&page->lru, &zone->inactive_list);
-	zone->nr_inactive++;
+	list_add(&page->lru, &zone->lru[l].list);
+	zone->lru[l].nr_pages++;
 }
 
 static inline void
-del_page_from_active_list(struct zone *zone, struct page *page)
+del_page_from_lru_list(struct zone *zone, struct page *page, enum lru_list l)
 {
 	list_del(&page->lru);
-	zone->nr_active--;
+	zone->lru[l].nr_pages--;
 }
 
-static inline void
-del_page_from_inactive_list(struct zone *zone, struct page *page)
+/*
+ * The inactive list of the page's kind, the active one is LRU_ACTIVE above
+ */
+static inline enum lru_list page_lru_base_type(struct page *page)
 {
-	list_del(&page->lru);
-	zone->nr_inactive--;
+	if (page_is_file_cache(page))
+		return LRU_INACTIVE_FILE;
+	return LRU_INACTIVE_ANON;
+}
+
+/*
+ * The list an LRU page is on
+ */
+static inline enum lru_list page_lru(struct page *page)
+{
+	enum lru_list lru = page_lru_base_type(page);
+
+	if (PageActive(page))
+		lru += LRU_ACTIVE;
+	return lru;
 }
 
 static inline void
 del_page_from_lru(struct zone *zone, struct page *page)
 {
+	enum lru_list l = page_lru(page);
+
 	list_del(&page->lru);
-	if (PageActive(page)) {
-		__ClearPageActive(page);
-		zone->nr_active--;
-	} else {
-		zone->nr_inactive--;
-	}
+	__ClearPageActive(page);
+	zone->lru[l].nr_pages--;
 }
-
@@ -24,11 +24,66 @@
 #endif
 #define MAX_ORDER_NR_PAGES (1 << (MAX_ORDER - 1))
 
+/*
+ * The free pages of a zone are grouped by how easily they could be given
+ * back: kernel memory which stays put, slab pages that shrink under memory
+ * pressure, and user and page cache pages which can be reclaimed or moved.
+ * Each pageblock of pageblock_nr_pages pages carries one of these types,
+ * and an allocation only takes from a block of another type when its own
+ * ran out, so that unmovable pages don't pepper all of memory and large
+ * contiguous ranges stay available for high order allocations.
+ */
+#define MIGRATE_UNMOVABLE     0
+#define MIGRATE_RECLAIMABLE   1
+#define MIGRATE_MOVABLE       2
+#define MIGRATE_TYPES         3
+
+#define PB_MIGRATETYPE_BITS   2		/* bits per pageblock in the map */
+
+#define pageblock_order		(MAX_ORDER - 1)
+#define pageblock_nr_pages	(1UL << pageblock_order)
+
+#define for_each_migratetype_order(order, type) \
+	for (order = 0; order < MAX_ORDER; order++) \
+		for (type = 0; type < MIGRATE_TYPES; type++)
+
+extern int page_group_by_mobility_disabled;
+
 struct free_area {
-	struct list_head	free_list;
+	struct list_head	free_list[MIGRATE_TYPES];
 	unsigned long		nr_free;
 };
 
+/*
+ * The LRU lists of a zone. Anonymous and shmem pages (PageSwapBacked) can
+ * only be reclaimed by writing them to swap, so they are kept apart from
+ * the page cache: each kind has its own active and inactive list, and
+ * reclaim scans them as their recent use makes worth it.
+ */
+#define LRU_BASE	0
+#define LRU_ACTIVE	1
+#define LRU_FILE	2
+
+enum lru_list {
+	LRU_INACTIVE_ANON = LRU_BASE,
+	LRU_ACTIVE_ANON = LRU_BASE + LRU_ACTIVE,
+	LRU_INACTIVE_FILE = LRU_BASE + LRU_FILE,
+	LRU_ACTIVE_FILE = LRU_BASE + LRU_FILE + LRU_ACTIVE,
+	NR_LRU_LISTS
+};
+
+#define for_each_lru(l) for (l = 0; l < NR_LRU_LISTS; l++)
+
+static inline int is_file_lru(enum lru_list l)
+{
+	return (l == LRU_INACTIVE_FILE || l == LRU_ACTIVE_FILE);
+}
+
+static inline int is_active_lru(enum lru_list l)
+{
+	return (l == LRU_ACTIVE_ANON || l == LRU_ACTIVE_FILE);
+}
+
 struct pglist_data;
 
 /*
@@ -71,7 +126,7 @@ struct per_cpu_pages {
 	int count;		/* number of pages in the list */
 	int high;		/* high watermark, emptying needed */
 	int batch;		/* chunk size for buddy add/remove */
-	struct list_head list;	/* the list of pages */
+	struct list_head lists[MIGRATE_TYPES];	/* the pages, by type */
 };
 
 struct per_cpu_pageset {
@@ -169,17 +224,43 @@ struct zone {
 #endif
 	struct free_area	free_area[MAX_ORDER];
 
+	/*
+	 * The migrate type of each pageblock of the zone, for the pfns
+	 * from pageblock_start_pfn on (see set_pageblock_migratetype())
+	 */
+	unsigned long		*pageblock_flags;
+	unsigned long		pageblock_start_pfn;
+	unsigned long		nr_pageblocks;
+
+#ifdef CONFIG_COMPACTION
+	/*
+	 * On compaction failure, 1<<compact_defer_shift compactions
+	 * are skipped before trying again. The number attempted since
+	 * last failure is tracked with compact_considered.
+	 */
+	unsigned int		compact_considered;
+	unsigned int		compact_defer_shift;
+#endif
 
 	ZONE_PADDING(_pad1_)
 
 	/* Fields commonly accessed by the page reclaim scanner */
 	spinlock_t		lru_lock;	
-	struct list_head	active_list;
-	struct list_head	inactive_list;
-	unsigned long		nr_scan_active;
-	unsigned long		nr_scan_inactive;
-	unsigned long		nr_active;
-	unsigned long		nr_inactive;
+	struct {
+		struct list_head list;
+		unsigned long nr_pages;
+		unsigned long nr_scan;
+	} lru[NR_LRU_LISTS];
+
+	/*
+	 * How many anon [0] and file [1] pages reclaim took off the LRU
+	 * lately, and how many of those turned out to be in use and went
+	 * back to the active list: the cost of reclaiming from each kind.
+	 * Both are halved as they grow, to follow the workload.
+	 */
+	unsigned long		recent_rotated[2];
+	unsigned long		recent_scanned[2];
+
 	unsigned long		pages_scanned;	   /* since last reclaim */
 	int			all_unreclaimable; /* All pages pinned */
 
@@ -352,6 +433,8 @@ int zone_watermark_ok(struct zone *z, int order, unsigned long mark,
 
 extern int init_currently_empty_zone(struct zone *zone, unsigned long start_pfn,
 				     unsigned long size);
+struct page;
+extern int get_pageblock_migratetype(struct page *page);
 
 #ifdef CONFIG_HAVE_MEMORY_PRESENT
 void memory_present(int nid, unsigned long start, unsigned long end);
@@ -373,6 +456,14 @@ static inline int populated_zone(struct zone *zone)
 	return (!!zone->present_pages);
 }
 
+static inline unsigned long zone_lru_pages(struct zone *zone)
+{
+	return zone->lru[LRU_ACTIVE_ANON].nr_pages +
+		zone->lru[LRU_INACTIVE_ANON].nr_pages +
+		zone->lru[LRU_ACTIVE_FILE].nr_pages +
+		zone->lru[LRU_INACTIVE_FILE].nr_pages;
+}
+
 static inline int is_highmem_idx(int idx)
 {
 	return (idx == ZONE_HIGHMEM);
@@ -633,6 +724,18 @@ void sparse_init(void);
 #define early_pfn_valid(pfn)	(1)
 #endif
 
+/*
+ * If it is possible to have holes within a MAX_ORDER_NR_PAGES, then we
+ * need to check pfn validility within that MAX_ORDER_NR_PAGES block.
+ * pfn_valid_within() should be used in this case; we optimise this away
+ * when we have no holes within a MAX_ORDER_NR_PAGES block.
+ */
+#ifdef CONFIG_HOLES_IN_ZONE
+#define pfn_valid_within(pfn) pfn_valid(pfn)
+#else
+#define pfn_valid_within(pfn) (1)
+#endif
+
 void memory_present(int nid, unsigned long start, unsigned long end);
 unsigned long __init node_memmap_size_bytes(int, unsigned long, unsigned long);
 
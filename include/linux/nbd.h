@@ -24,6 +24,7 @@
 #define NBD_PRINT_DEBUG	_IO( 0xab, 6 )
 #define NBD_SET_SIZE_BLOCKS	_IO( 0xab, 7 )
 #define NBD_DISCONNECT  _IO( 0xab, 8 )
+#define NBD_ADD_SOCK	_IO( 0xab, 9 )
 
 enum {
 	NBD_CMD_READ = 0,
@@ -33,6 +34,7 @@ enum {
 
 #define nbd_cmd(req) ((req)->cmd[0])
 #define MAX_NBD 128
+#define NBD_MAX_CONNS 8	/* sockets of one device, see NBD_ADD_SOCK */
 
 /* userspace doesn't need the nbd_device structure */
 #ifdef __KERNEL__
@@ -45,20 +47,40 @@ enum {
 #define NBD_WRITE_NOCHK 0x0002
 
 struct request;
+struct task_struct;
+struct nbd_device;
+
+/*
+ * One socket to the server.  Requests are queued to the connections in
+ * turn, each sending its own from a thread; the replies may come back on
+ * any of them.
+ */
+struct nbd_conn {
+	struct nbd_device *lo;
+	struct socket * sock;
+	struct file * file;
+	struct mutex tx_lock;
+	struct request *active_req;	/* being sent			*/
+	struct list_head send_queue;	/* under lo->queue_lock		*/
+	wait_queue_head_t send_wq;
+	struct task_struct *sender, *receiver;
+};
 
 struct nbd_device {
 	int flags;
 	int harderror;		/* Code of hard error			*/
-	struct socket * sock;
-	struct file * file; 	/* If == NULL, device is not ready, yet	*/
+	struct nbd_conn *conns[NBD_MAX_CONNS];
+	int nr_conns;		/* If == 0, device is not ready, yet	*/
+	unsigned int next_conn;	/* to queue the next request to		*/
+	int running;		/* in NBD_DO_IT				*/
+	atomic_t nr_receivers;
+	wait_queue_head_t receivers_wq;
 	int magic;
 
 	spinlock_t queue_lock;
 	struct list_head queue_head;/* Requests are added here...	*/
-	struct request *active_req;
 	wait_queue_head_t active_wq;
 
-	struct mutex tx_lock;
 	struct gendisk *disk;
 	int blksize;
 	u64 bytesize;
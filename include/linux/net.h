@@ -43,6 +43,8 @@ struct inode;
 #define SYS_GETSOCKOPT	15		/* sys_getsockopt(2)		*/
 #define SYS_SENDMSG	16		/* sys_sendmsg(2)		*/
 #define SYS_RECVMSG	17		/* sys_recvmsg(2)		*/
+#define SYS_RECVMMSG	18		/* sys_recvmmsg(2)		*/
+#define SYS_SENDMMSG	19		/* sys_sendmmsg(2)		*/
 
 typedef enum {
 	SS_FREE = 0,			/* not allocated		*/
@@ -121,6 +123,7 @@ struct kiocb;
 struct sockaddr;
 struct msghdr;
 struct module;
+struct pipe_inode_info;
 
 struct proto_ops {
 	int		family;
@@ -164,6 +167,9 @@ struct proto_ops {
 				      struct vm_area_struct * vma);
 	ssize_t		(*sendpage)  (struct socket *sock, struct page *page,
 				      int offset, size_t size, int flags);
+	ssize_t		(*splice_read)(struct socket *sock, loff_t *ppos,
+				       struct pipe_inode_info *pipe,
+				       size_t len, unsigned int flags);
 };
 
 struct net_proto_family {
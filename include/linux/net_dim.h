@@ -0,0 +1,70 @@
+/*
+ * Dynamic interrupt moderation for NAPI drivers.
+ *
+ * The driver counts the packets and bytes it receives and calls
+ * net_dim() each time its poll routine completes.  Every NET_DIM_NEVENTS
+ * completions the rates over the last interval are compared with those
+ * over the previous one, and the moderation steps one level up or down a
+ * table of five (usecs, frames) pairs, whichever moves bytes per msec
+ * (then packets per msec, then fewer interrupts per msec) the right way.
+ * Where neither does, it parks until the traffic changes.
+ *
+ * The table is picked by a profile, set with ETHTOOL_SCOALPROFILE: the
+ * latency profile only goes up to 16us, the throughput one starts at
+ * 16us, the balanced one covers both.  A new level is handed to the
+ * driver's apply() callback from a work item, so that the driver may
+ * take the locks it programs the chip under.
+ */
+#ifndef _LINUX_NET_DIM_H
+#define _LINUX_NET_DIM_H
+
+#include <linux/types.h>
+#include <linux/ktime.h>
+#include <linux/workqueue.h>
+#include <linux/ethtool.h>
+
+#define NET_DIM_NEVENTS		64	/* poll completions per sample */
+#define NET_DIM_NUM_LEVELS	5
+
+struct net_dim_cq_moder {
+	u16	usec;
+	u16	pkts;
+};
+
+struct net_dim_sample {
+	ktime_t	time;
+	u32	pkt_ctr;
+	u32	byte_ctr;
+	u16	event_ctr;
+};
+
+struct net_dim_stats {
+	int	ppms;		/* packets per msec */
+	int	bpms;		/* bytes per msec */
+	int	epms;		/* events per msec */
+};
+
+struct net_dim {
+	u8			state;
+	u8			profile;	/* ETHTOOL_COAL_PROFILE_* */
+	u8			level;		/* in the profile's table */
+	u8			tune_state;
+	u8			steps_right;
+	u8			steps_left;
+	u8			tired;
+	struct net_dim_stats	prev_stats;
+	struct net_dim_sample	start_sample;
+	struct work_struct	work;
+	void			(*apply)(struct net_dim *dim,
+					 struct net_dim_cq_moder moder);
+};
+
+extern void net_dim_init(struct net_dim *dim, int profile,
+			 void (*apply)(struct net_dim *,
+				       struct net_dim_cq_moder));
+extern int net_dim_set_profile(struct net_dim *dim, int profile);
+extern struct net_dim_cq_moder net_dim_get_moderation(const struct net_dim *dim);
+extern void net_dim(struct net_dim *dim, u16 event_ctr, u32 packets,
+		    u32 bytes);
+
+#endif /* _LINUX_NET_DIM_H */
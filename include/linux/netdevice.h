@@ -165,6 +165,7 @@ struct netif_rx_stats
 	unsigned dropped;
 	unsigned time_squeeze;
 	unsigned cpu_collision;
+	unsigned received_rps;		/* steering IPIs taken */
 };
 
 DECLARE_PER_CPU(struct netif_rx_stats, netdev_rx_stat);
@@ -235,6 +236,49 @@ enum netdev_state_t
 	__LINK_STATE_QDISC_RUNNING,
 };
 
+/* The same for the transmit queues of a multiqueue device */
+enum netdev_queue_state_t
+{
+	__QUEUE_STATE_XOFF,
+	__QUEUE_STATE_FROZEN,		/* netif_tx_lock() is held */
+	__QUEUE_STATE_SCHED,
+	__QUEUE_STATE_QDISC_RUNNING,
+};
+
+/*
+ * A transmit queue of a multiqueue device, one per hardware TX ring.
+ * Packets are mapped to a queue by dev_queue_xmit(), and go out to the
+ * driver under the lock of their queue only, so that the rings are fed
+ * from several cpus at once.  Unless a root qdisc is set up with tc, each
+ * queue also has a qdisc of its own, with its own lock.
+ */
+struct netdev_queue
+{
+	spinlock_t		lock;		/* serializes qdisc and gso_skb */
+	struct Qdisc		*qdisc;
+	struct Qdisc		*qdisc_sleeping;
+	struct sk_buff		*gso_skb;
+	unsigned long		state;
+	struct netdev_queue	*next_sched;
+	struct net_device	*dev;
+
+	/* hard_start_xmit synchronizer of the ring */
+	spinlock_t		_xmit_lock ____cacheline_aligned_in_smp;
+	int			xmit_lock_owner;
+} ____cacheline_aligned_in_smp;
+
+/*
+ * The cpus the packets received on a device are spread over, by the hash
+ * of their flow: /sys/class/net/<dev>/rps_cpus.  Replaced under rtnl and
+ * read under RCU.
+ */
+struct rps_map
+{
+	unsigned int		len;
+	struct rcu_head		rcu;
+	u16			cpus[0];
+};
+
 
 /*
  * This structure holds at boot time configured netdevice settings. They
@@ -310,6 +354,7 @@ struct net_device
 #define NETIF_F_VLAN_CHALLENGED	1024	/* Device cannot handle VLAN packets */
 #define NETIF_F_GSO		2048	/* Enable software GSO. */
 #define NETIF_F_LLTX		4096	/* LockLess TX */
+#define NETIF_F_GRO		16384	/* Generic receive offload */
 
 	/* Segmentation offload features */
 #define NETIF_F_GSO_SHIFT	16
@@ -396,6 +441,14 @@ struct net_device
 	int			(*poll) (struct net_device *dev, int *quota);
 	int			quota;
 	int			weight;
+	/* Clean up to budget rx packets from process context, without
+	 * touching interrupts, unless poll is running; see net/busy_poll.h.
+	 * Returns the packets passed up.
+	 */
+	int			(*busy_poll)(struct net_device *dev, int budget);
+#ifdef CONFIG_RPS
+	struct rps_map		*rps_map;	/* receive packet steering */
+#endif
 	unsigned long		last_rx;	/* Time of last Rx	*/
 	/* Interface address info used in eth_type_trans() */
 	unsigned char		dev_addr[MAX_ADDR_LEN];	/* hw address, (before bcast 
@@ -432,6 +485,13 @@ struct net_device
 	void			*priv;	/* pointer to private data	*/
 	int			(*hard_start_xmit) (struct sk_buff *skb,
 						    struct net_device *dev);
+
+	/* Transmit queues of a multiqueue device, see alloc_netdev_mq() */
+	struct netdev_queue	*tx_queues;
+	unsigned int		num_tx_queues;
+	/* Maps a packet to its queue, the flow hash is used if NULL */
+	u16			(*select_queue)(struct net_device *dev,
+						struct sk_buff *skb);
 	/* These may be needed for future network-power-down code. */
 	unsigned long		trans_start;	/* Time (in jiffies) of last Tx	*/
 
@@ -553,10 +613,39 @@ struct packet_type {
 	struct sk_buff		*(*gso_segment)(struct sk_buff *skb,
 						int features);
 	int			(*gso_send_check)(struct sk_buff *skb);
+	struct sk_buff		**(*gro_receive)(struct sk_buff **head,
+					       struct sk_buff *skb);
+	int			(*gro_complete)(struct sk_buff *skb);
 	void			*af_packet_priv;
 	struct list_head	list;
 };
 
+/*
+ * State of a packet going through receive offload, in skb->cb until the
+ * packet is handed to the protocols.
+ */
+struct napi_gro_cb {
+	/* Offset of the header the next protocol looks at, from skb->data */
+	unsigned int		data_offset;
+
+	/* The held packet is of the same flow as the new one, or, on the
+	 * new packet, it was merged into a held one.
+	 */
+	int			same_flow;
+
+	/* The packet must not be held or merged into */
+	int			flush;
+
+	/* Segments in the packet, or the last one on its frag_list */
+	int			count;
+	struct sk_buff		*last;
+};
+
+#define NAPI_GRO_CB(skb)	((struct napi_gro_cb *)(skb)->cb)
+
+/* Most flows a cpu holds packets of during a poll */
+#define MAX_GRO_SKBS		8
+
 #include <linux/interrupt.h>
 #include <linux/notifier.h>
 
@@ -609,11 +698,19 @@ static inline int unregister_gifconf(unsigned int family)
 struct softnet_data
 {
 	struct net_device	*output_queue;
+	struct netdev_queue	*output_txq;	/* queues of multiqueue devices */
 	struct sk_buff_head	input_pkt_queue;
 	struct list_head	poll_list;
 	struct sk_buff		*completion_queue;
 
 	struct net_device	backlog_dev;	/* Sorry. 8) */
+
+	struct net_device	*gro_dev;	/* device being polled */
+	struct sk_buff		*gro_list;	/* packets held for merging */
+	int			gro_count;
+#ifdef CONFIG_RPS
+	cpumask_t		rps_ipi_mask;	/* cpus to kick, see netif_rx() */
+#endif
 #ifdef CONFIG_NET_DMA
 	struct dma_chan		*net_dma;
 #endif
@@ -665,6 +762,84 @@ static inline int netif_running(const struct net_device *dev)
 	return test_bit(__LINK_STATE_START, &dev->state);
 }
 
+/*
+ * Multiqueue devices.  The queue of a packet is in skb->queue_mapping, and
+ * the driver stops and wakes each of its rings with the subqueue calls
+ * below.  On a device with a single queue they act on the device queue.
+ */
+static inline int netif_is_multiqueue(const struct net_device *dev)
+{
+	return dev->num_tx_queues > 1;
+}
+
+static inline struct netdev_queue *netdev_get_tx_queue(const struct net_device *dev,
+						       u16 queue_index)
+{
+	return &dev->tx_queues[queue_index];
+}
+
+extern void __netif_schedule_queue(struct netdev_queue *txq);
+
+static inline int netif_tx_queue_stopped(const struct netdev_queue *txq)
+{
+	return (txq->state & ((1 << __QUEUE_STATE_XOFF) |
+			      (1 << __QUEUE_STATE_FROZEN))) ||
+		netif_queue_stopped(txq->dev);
+}
+
+static inline void netif_start_subqueue(struct net_device *dev, u16 queue_index)
+{
+	if (!netif_is_multiqueue(dev)) {
+		netif_start_queue(dev);
+		return;
+	}
+	clear_bit(__QUEUE_STATE_XOFF, &dev->tx_queues[queue_index].state);
+}
+
+static inline void netif_stop_subqueue(struct net_device *dev, u16 queue_index)
+{
+	if (!netif_is_multiqueue(dev)) {
+		netif_stop_queue(dev);
+		return;
+	}
+#ifdef CONFIG_NETPOLL_TRAP
+	if (netpoll_trap())
+		return;
+#endif
+	set_bit(__QUEUE_STATE_XOFF, &dev->tx_queues[queue_index].state);
+}
+
+static inline void netif_wake_subqueue(struct net_device *dev, u16 queue_index)
+{
+	struct netdev_queue *txq;
+
+	if (!netif_is_multiqueue(dev)) {
+		netif_wake_queue(dev);
+		return;
+	}
+#ifdef CONFIG_NETPOLL_TRAP
+	if (netpoll_trap())
+		return;
+#endif
+	txq = &dev->tx_queues[queue_index];
+	if (test_and_clear_bit(__QUEUE_STATE_XOFF, &txq->state))
+		__netif_schedule_queue(txq);
+}
+
+static inline int __netif_subqueue_stopped(const struct net_device *dev,
+					   u16 queue_index)
+{
+	if (!netif_is_multiqueue(dev))
+		return netif_queue_stopped(dev);
+	return test_bit(__QUEUE_STATE_XOFF, &dev->tx_queues[queue_index].state);
+}
+
+static inline int netif_subqueue_stopped(const struct net_device *dev,
+					 struct sk_buff *skb)
+{
+	return __netif_subqueue_stopped(dev, skb->queue_mapping);
+}
+
 
 /* Use this variant when it is known for sure that it
  * is executing from interrupt context.
@@ -913,38 +1088,78 @@ static inline void __netif_rx_complete(struct net_device *dev)
 	clear_bit(__LINK_STATE_RX_SCHED, &dev->state);
 }
 
+/*
+ * The transmit lock of a multiqueue device locks out all of its queues:
+ * they are frozen, so that packets are held back in the qdiscs until the
+ * lock is dropped, instead of each queue lock being held.
+ */
+extern void netif_tx_freeze_queues(struct net_device *dev);
+extern void netif_tx_thaw_queues(struct net_device *dev);
+
 static inline void netif_tx_lock(struct net_device *dev)
 {
 	spin_lock(&dev->_xmit_lock);
 	dev->xmit_lock_owner = smp_processor_id();
+	if (netif_is_multiqueue(dev))
+		netif_tx_freeze_queues(dev);
 }
 
 static inline void netif_tx_lock_bh(struct net_device *dev)
 {
 	spin_lock_bh(&dev->_xmit_lock);
 	dev->xmit_lock_owner = smp_processor_id();
+	if (netif_is_multiqueue(dev))
+		netif_tx_freeze_queues(dev);
 }
 
 static inline int netif_tx_trylock(struct net_device *dev)
 {
 	int ok = spin_trylock(&dev->_xmit_lock);
-	if (likely(ok))
+	if (likely(ok)) {
 		dev->xmit_lock_owner = smp_processor_id();
+		if (netif_is_multiqueue(dev))
+			netif_tx_freeze_queues(dev);
+	}
 	return ok;
 }
 
 static inline void netif_tx_unlock(struct net_device *dev)
 {
+	if (netif_is_multiqueue(dev))
+		netif_tx_thaw_queues(dev);
 	dev->xmit_lock_owner = -1;
 	spin_unlock(&dev->_xmit_lock);
 }
 
 static inline void netif_tx_unlock_bh(struct net_device *dev)
 {
+	if (netif_is_multiqueue(dev))
+		netif_tx_thaw_queues(dev);
 	dev->xmit_lock_owner = -1;
 	spin_unlock_bh(&dev->_xmit_lock);
 }
 
+/* The lock of a single queue, taken to hand it a packet */
+static inline void netif_tx_queue_lock(struct netdev_queue *txq)
+{
+	spin_lock(&txq->_xmit_lock);
+	txq->xmit_lock_owner = smp_processor_id();
+}
+
+static inline int netif_tx_queue_trylock(struct netdev_queue *txq)
+{
+	int ok = spin_trylock(&txq->_xmit_lock);
+	if (likely(ok))
+		txq->xmit_lock_owner = smp_processor_id();
+	return ok;
+}
+
+static inline void netif_tx_queue_unlock(struct netdev_queue *txq)
+{
+	txq->xmit_lock_owner = -1;
+	spin_unlock(&txq->_xmit_lock);
+}
+
 static inline void netif_tx_disable(struct net_device *dev)
 {
 	netif_tx_lock_bh(dev);
@@ -959,6 +1174,9 @@ extern void		ether_setup(struct net_device *dev);
 /* Support for loadable net-drivers */
 extern struct net_device *alloc_netdev(int sizeof_priv, const char *name,
 				       void (*setup)(struct net_device *));
+extern struct net_device *alloc_netdev_mq(int sizeof_priv, const char *name,
+					  void (*setup)(struct net_device *),
+					  unsigned int queue_count);
 extern int		register_netdev(struct net_device *dev);
 extern void		unregister_netdev(struct net_device *dev);
 /* Functions used for multicast support */
@@ -1005,7 +1223,8 @@ static inline int net_gso_ok(int features, int gso_type)
 
 static inline int skb_gso_ok(struct sk_buff *skb, int features)
 {
-	return net_gso_ok(features, skb_shinfo(skb)->gso_type);
+	return net_gso_ok(features, skb_shinfo(skb)->gso_type) &&
+	       (!skb_shinfo(skb)->frag_list || (features & NETIF_F_FRAGLIST));
 }
 
 static inline int netif_needs_gso(struct net_device *dev, struct sk_buff *skb)
@@ -286,6 +286,9 @@ struct xt_table_info
 
 	/* ipt_entry tables: one per CPU */
 	char *entries[NR_CPUS];
+
+	/* Rule classifier built by the protocol (ip_tables), or NULL */
+	void *classifier;
 };
 
 extern int xt_register_target(struct xt_target *target);
@@ -310,6 +313,40 @@ extern struct xt_table_info *xt_replace_table(struct xt_table *table,
 					      struct xt_table_info *newinfo,
 					      int *error);
 
+/*
+ * The packet path walks a table under the lock of its own cpu, so that
+ * it doesn't write to a cache line shared with the other cpus for every
+ * packet.  User context takes the lock of a cpu to read the counters of
+ * that cpu's copy of the rules, and to wait for the packets still on the
+ * old rules of a replaced table.  The lock is a rwlock so that a target
+ * sending a packet can go through the tables again.
+ */
+DECLARE_PER_CPU(rwlock_t, xt_info_locks);
+
+static inline void xt_info_rdlock_bh(void)
+{
+	local_bh_disable();
+	read_lock(&__get_cpu_var(xt_info_locks));
+}
+
+static inline void xt_info_rdunlock_bh(void)
+{
+	read_unlock(&__get_cpu_var(xt_info_locks));
+	local_bh_enable();
+}
+
+static inline void xt_info_wrlock_bh(unsigned int cpu)
+{
+	local_bh_disable();
+	write_lock(&per_cpu(xt_info_locks, cpu));
+}
+
+static inline void xt_info_wrunlock_bh(unsigned int cpu)
+{
+	write_unlock(&per_cpu(xt_info_locks, cpu));
+	local_bh_enable();
+}
+
 extern struct xt_match *xt_find_match(int af, const char *name, u8 revision);
 extern struct xt_target *xt_find_target(int af, const char *name, u8 revision);
 extern struct xt_target *xt_request_find_target(int af, const char *name, 
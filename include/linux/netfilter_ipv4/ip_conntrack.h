@@ -56,6 +56,8 @@ union ip_conntrack_nat_help {
 
 #include <linux/types.h>
 #include <linux/skbuff.h>
+#include <linux/spinlock.h>
+#include <linux/rcupdate.h>
 
 #ifdef CONFIG_NETFILTER_DEBUG
 #define IP_NF_ASSERT(x)							\
@@ -84,6 +86,12 @@ struct ip_conntrack
 	/* Timer function; drops refcnt when it goes off. */
 	struct timer_list timeout;
 
+	/* Protects the timeout refresh and the counters */
+	spinlock_t lock;
+
+	/* Cpu whose unconfirmed list has it until it is confirmed */
+	unsigned int cpu;
+
 #ifdef CONFIG_IP_NF_CT_ACCT
 	/* Accounting Information (same cache line as other written members) */
 	struct ip_conntrack_counter counters[IP_CT_DIR_MAX];
@@ -127,6 +135,9 @@ struct ip_conntrack
 	/* Traversed often, so hopefully in different cacheline to top */
 	/* These are my tuples; original and reply */
 	struct ip_conntrack_tuple_hash tuplehash[IP_CT_DIR_MAX];
+
+	/* Lookups are lockless, so freed after a grace period */
+	struct rcu_head rcu;
 };
 
 struct ip_conntrack_expect
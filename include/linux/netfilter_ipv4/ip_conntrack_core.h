@@ -54,7 +54,9 @@ static inline int ip_conntrack_confirm(struct sk_buff **pskb)
 
 extern void ip_ct_unlink_expect(struct ip_conntrack_expect *exp);
 
-extern struct list_head *ip_conntrack_hash;
+extern struct hlist_head *ip_conntrack_hash;
+extern struct hlist_head *ip_conntrack_rcu_hash(unsigned int *size);
+extern unsigned int ip_conntrack_count(void);
 extern struct list_head ip_conntrack_expect_list;
 extern rwlock_t ip_conntrack_lock;
 #endif /* _IP_CONNTRACK_CORE_H */
@@ -199,6 +199,7 @@ struct nfs_inode {
 #define NFS_INO_REVALIDATING	(0)		/* revalidating attrs */
 #define NFS_INO_ADVISE_RDPLUS	(1)		/* advise readdirplus */
 #define NFS_INO_STALE		(2)		/* possible stale inode */
+#define NFS_INO_READDIR_RA	(3)		/* directory readahead queued */
 
 static inline struct nfs_inode *NFS_I(struct inode *inode)
 {
@@ -23,6 +23,8 @@ struct nfs_server {
 	unsigned int		wsize;		/* write size */
 	unsigned int		wpages;		/* write size (in pages) */
 	unsigned int		wtmult;		/* server disk block size */
+	atomic_t		write_rpcs;	/* WRITEs in flight */
+	unsigned int		write_rpcs_max;	/* congested at this many */
 	unsigned int		dtsize;		/* readdir size */
 	unsigned int		bsize;		/* server block size */
 	unsigned int		acregmin;	/* attr cache timeouts */
@@ -0,0 +1,71 @@
+#ifndef __LINUX_NUMA_BALANCING_H
+#define __LINUX_NUMA_BALANCING_H
+/*
+ * Automatic NUMA balancing: knumad samples where tasks touch their
+ * anonymous memory and moves pages, or tasks, to match.
+ * See numa_balancing in Documentation/sysctl/vm.txt.
+ */
+
+#include <linux/mm.h>
+#include <linux/sched.h>
+#include <linux/slab.h>
+
+#ifdef CONFIG_NUMA_BALANCING
+struct ctl_table;
+
+extern int sysctl_numa_balancing;
+extern int sysctl_numa_balancing_scan_period_ms;
+extern int sysctl_numa_balancing_scan_size_mb;
+
+extern void __numa_balancing_enter(struct mm_struct *mm);
+extern int task_numa_fault(int page_nid, int this_nid, int private);
+extern int migrate_misplaced_page(struct page *page, int nid);
+extern int numa_balancing_sysctl_handler(struct ctl_table *, int,
+		struct file *, void __user *, size_t *, loff_t *);
+
+static inline void numa_balancing_enter(struct mm_struct *mm)
+{
+	if (sysctl_numa_balancing && list_empty(&mm->numa_link))
+		__numa_balancing_enter(mm);
+}
+
+static inline void numa_balancing_fork(struct mm_struct *mm,
+		struct mm_struct *oldmm)
+{
+	if (!list_empty(&oldmm->numa_link))
+		__numa_balancing_enter(mm);
+}
+
+static inline void task_numa_init(struct task_struct *p)
+{
+	p->numa_faults_local = 0;
+	p->numa_faults_remote = 0;
+	p->numa_faults = NULL;
+	p->numa_preferred_nid = -1;
+	p->numa_scan_seq = 0;
+}
+
+static inline void task_numa_free(struct task_struct *p)
+{
+	kfree(p->numa_faults);
+}
+#else
+static inline void numa_balancing_enter(struct mm_struct *mm)
+{
+}
+
+static inline void numa_balancing_fork(struct mm_struct *mm,
+		struct mm_struct *oldmm)
+{
+}
+
+static inline void task_numa_init(struct task_struct *p)
+{
+}
+
+static inline void task_numa_free(struct task_struct *p)
+{
+}
+#endif /* CONFIG_NUMA_BALANCING */
+
+#endif /* __LINUX_NUMA_BALANCING_H */
@@ -51,6 +51,71 @@ static inline void mapping_set_gfp_mask(struct address_space *m, gfp_t mask)
 #define page_cache_release(page)	put_page(page)
 void release_pages(struct page **pages, int nr, int cold);
 
+/*
+ * speculatively take a reference to a page.
+ * If the page is free (_count == 0), then _count is untouched, and 0
+ * is returned.  Otherwise, _count is incremented by 1 and 1 is returned.
+ *
+ * This function must be called inside the same rcu_read_lock() section as
+ * has been used to lookup the page in the pagecache radix-tree.  The count
+ * of a page found that way is unstable: it may already have been freed and
+ * reallocated for something else, so put_page must be able to do the right
+ * thing when an invalid speculative reference is dropped again, no matter
+ * what the page is now used for.
+ *
+ * The lookup side (eg. find_get_page) has the following pattern:
+ * 1. find page in radix tree
+ * 2. conditionally increment refcount
+ * 3. check the page is still in pagecache (if no, goto 1)
+ *
+ * Remove-side that cares about stability of _count (eg. reclaim) has the
+ * following (with tree_lock held for write):
+ * A. atomically check refcount is correct and set it to 0 (atomic_cmpxchg)
+ * B. remove page from pagecache
+ * C. free the page
+ *
+ * There are 2 critical interleavings that matter:
+ * - 2 runs before A: in this case, A sees elevated refcount and bails out
+ * - A runs before 2: in this case, 2 sees zero refcount and retries;
+ *   subsequently, B will complete and 1 will find no page, causing the
+ *   lookup to return NULL.
+ *
+ * It is possible that between 1 and 2, the page is removed then the exact
+ * same page is inserted into the same position in pagecache.  That's OK: the
+ * find_get_page under tree_lock could equally have run before or after
+ * such a re-insertion, depending on order that locks are granted.
+ */
+static inline int page_cache_get_speculative(struct page *page)
+{
+	if (unlikely(!get_page_unless_zero(page))) {
+		/*
+		 * Either the page has been freed, or will be freed.
+		 * In either case, retry here and the caller should
+		 * do the right thing (see comments above).
+		 */
+		return 0;
+	}
+	return 1;
+}
+
+/*
+ * Atomically drop exactly @count references if that is all there are, so
+ * that page_cache_get_speculative() fails on the page until it is unfrozen.
+ * Called with the tree_lock held for writing.
+ */
+static inline int page_freeze_refs(struct page *page, int count)
+{
+	return likely(atomic_cmpxchg(&page->_count, count, 0) == count);
+}
+
+static inline void page_unfreeze_refs(struct page *page, int count)
+{
+	BUG_ON(page_count(page) != 0);
+	BUG_ON(count == 0);
+
+	atomic_set(&page->_count, count);
+}
+
 #ifdef CONFIG_NUMA
 extern struct page *page_cache_alloc(struct address_space *x);
 extern struct page *page_cache_alloc_cold(struct address_space *x);
@@ -106,13 +171,30 @@ static inline struct page *read_mapping_page(struct address_space *mapping,
 	return read_cache_page(mapping, index, filler, data);
 }
 
-int add_to_page_cache(struct page *page, struct address_space *mapping,
+int add_to_page_cache_locked(struct page *page, struct address_space *mapping,
 				unsigned long index, gfp_t gfp_mask);
 int add_to_page_cache_lru(struct page *page, struct address_space *mapping,
 				unsigned long index, gfp_t gfp_mask);
 extern void remove_from_page_cache(struct page *page);
 extern void __remove_from_page_cache(struct page *page);
 
+/*
+ * Like add_to_page_cache_locked, but used to add newly allocated pages:
+ * the page is new, so we can just run SetPageLocked() against it.
+ * The other page state flags were set by rmqueue().
+ */
+static inline int add_to_page_cache(struct page *page,
+		struct address_space *mapping, unsigned long offset, gfp_t gfp_mask)
+{
+	int error;
+
+	SetPageLocked(page);
+	error = add_to_page_cache_locked(page, mapping, offset, gfp_mask);
+	if (unlikely(error))
+		ClearPageLocked(page);
+	return error;
+}
+
 /*
  * Return byte-offset into filesystem object for page.
  */
@@ -138,6 +220,23 @@ static inline void lock_page(struct page *page)
 	if (TestSetPageLocked(page))
 		__lock_page(page);
 }
+
+extern int FASTCALL(__lock_page_async(struct page *page, wait_queue_t *wait));
+extern int FASTCALL(wait_on_page_bit_async(struct page *page, int bit_nr,
+					   wait_queue_t *wait));
+
+/*
+ * Lock the page, or have the aio retry owning @wait kicked when the page
+ * is unlocked: returns 0 with the page locked, or -EIOCBRETRY.  With a
+ * synchronous @wait, such as current->io_wait outside of aio, this is
+ * lock_page().
+ */
+static inline int lock_page_async(struct page *page, wait_queue_t *wait)
+{
+	if (TestSetPageLocked(page))
+		return __lock_page_async(page, wait);
+	return 0;
+}
 	
 /*
  * This is exported only for wait_on_page_locked/wait_on_page_writeback.
@@ -158,6 +257,15 @@ static inline void wait_on_page_locked(struct page *page)
 		wait_on_page_bit(page, PG_locked);
 }
 
+/* The same for an aio retry, see lock_page_async() */
+static inline int wait_on_page_locked_async(struct page *page,
+					    wait_queue_t *wait)
+{
+	if (PageLocked(page))
+		return wait_on_page_bit_async(page, PG_locked, wait);
+	return 0;
+}
+
 /* 
  * Wait for a page to complete writeback
  */
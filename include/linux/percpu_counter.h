@@ -38,8 +38,14 @@ static inline void percpu_counter_destroy(struct percpu_counter *fbc)
 	free_percpu(fbc->counters);
 }
 
-void percpu_counter_mod(struct percpu_counter *fbc, s32 amount);
+void __percpu_counter_mod(struct percpu_counter *fbc, s32 amount, s32 batch);
 s64 percpu_counter_sum(struct percpu_counter *fbc);
+void percpu_counter_drain(struct percpu_counter *fbc, s64 *total);
+
+static inline void percpu_counter_mod(struct percpu_counter *fbc, s32 amount)
+{
+	__percpu_counter_mod(fbc, amount, FBC_BATCH);
+}
 
 static inline s64 percpu_counter_read(struct percpu_counter *fbc)
 {
@@ -84,6 +90,20 @@ percpu_counter_mod(struct percpu_counter *fbc, s32 amount)
 	preempt_enable();
 }
 
+static inline void
+__percpu_counter_mod(struct percpu_counter *fbc, s32 amount, s32 batch)
+{
+	percpu_counter_mod(fbc, amount);
+}
+
+static inline void percpu_counter_drain(struct percpu_counter *fbc, s64 *total)
+{
+	preempt_disable();
+	*total += fbc->count;
+	fbc->count = 0;
+	preempt_enable();
+}
+
 static inline s64 percpu_counter_read(struct percpu_counter *fbc)
 {
 	return fbc->count;
@@ -0,0 +1,251 @@
+#ifndef _LINUX_PERF_COUNTER_H
+#define _LINUX_PERF_COUNTER_H
+
+/*
+ * Performance counters: count, or sample every so many of, hardware
+ * and software events for a task or for a cpu, through a file
+ * descriptor from perf_counter_open().
+ */
+
+#include <linux/types.h>
+#include <linux/ioctl.h>
+
+/* perf_counter_attr.type */
+enum perf_counter_type {
+	PERF_TYPE_HARDWARE	= 0,	/* config is a perf_hw_id */
+	PERF_TYPE_SOFTWARE	= 1,	/* config is a perf_sw_id */
+	PERF_TYPE_RAW		= 2,	/* config is for the PMU itself */
+};
+
+enum perf_hw_id {
+	PERF_COUNT_CPU_CYCLES		= 0,
+	PERF_COUNT_INSTRUCTIONS		= 1,
+	PERF_COUNT_CACHE_REFERENCES	= 2,
+	PERF_COUNT_CACHE_MISSES		= 3,
+	PERF_COUNT_BRANCH_INSTRUCTIONS	= 4,
+	PERF_COUNT_BRANCH_MISSES	= 5,
+
+	PERF_HW_EVENTS_MAX
+};
+
+enum perf_sw_id {
+	PERF_COUNT_PAGE_FAULTS		= 0,
+	PERF_COUNT_CONTEXT_SWITCHES	= 1,
+	PERF_COUNT_CPU_MIGRATIONS	= 2,
+
+	PERF_SW_EVENTS_MAX
+};
+
+/* perf_counter_attr.flags */
+#define PERF_ATTR_DISABLED	(1 << 0)	/* start disabled */
+#define PERF_ATTR_EXCLUDE_USER	(1 << 1)	/* don't count user mode */
+#define PERF_ATTR_EXCLUDE_KERNEL (1 << 2)	/* don't count kernel mode */
+
+/* perf_counter_attr.sample_type: what each sample record holds */
+#define PERF_SAMPLE_IP		(1 << 0)	/* u64 ip */
+#define PERF_SAMPLE_TID		(1 << 1)	/* u32 pid, tid */
+#define PERF_SAMPLE_TIME	(1 << 2)	/* u64 ns */
+#define PERF_SAMPLE_CALLCHAIN	(1 << 3)	/* u64 nr, ips[nr] */
+
+struct perf_counter_attr {
+	__u32	type;
+	__u32	size;		/* sizeof(struct perf_counter_attr) */
+	__u64	config;
+	__u64	sample_period;	/* 0 to count only */
+	__u64	sample_type;
+	__u64	flags;
+	__u32	wakeup_events;	/* wake poll() every so many samples */
+	__u32	__reserved_1;
+	__u64	__reserved_2[4];
+};
+
+/*
+ * The first page of the mmap() of a sampling counter.  The samples
+ * follow in a ring of 2^n pages: data_head is where the kernel is to
+ * write next, to be read before the data (then rmb()).  If the mapping
+ * is writable, the reader stores how far it has read in data_tail, and
+ * samples that would overwrite what is unread are dropped and counted
+ * in lost; if not, the oldest are overwritten.
+ */
+struct perf_counter_mmap_page {
+	__u32	version;
+	__u32	__reserved_1;
+	__u64	data_head;
+	__u64	data_tail;
+	__u64	lost;
+};
+
+enum perf_event_type {
+	PERF_EVENT_SAMPLE	= 1,
+};
+
+/* The header of each record in the ring */
+struct perf_event_header {
+	__u32	type;
+	__u16	misc;
+	__u16	size;		/* of the whole record */
+};
+
+/* perf_event_header.misc: where the sample was taken */
+#define PERF_EVENT_MISC_KERNEL	(1 << 0)
+#define PERF_EVENT_MISC_USER	(1 << 1)
+
+/* Markers in a callchain: the ips that follow are kernel, or user */
+#define PERF_CONTEXT_KERNEL	((__u64)-128)
+#define PERF_CONTEXT_USER	((__u64)-512)
+
+#define PERF_COUNTER_IOC_ENABLE		_IO('$', 0)
+#define PERF_COUNTER_IOC_DISABLE	_IO('$', 1)
+#define PERF_COUNTER_IOC_RESET		_IO('$', 2)
+
+#ifdef __KERNEL__
+
+#include <linux/list.h>
+#include <linux/spinlock.h>
+#include <linux/mutex.h>
+#include <linux/wait.h>
+#include <asm/atomic.h>
+
+#ifdef CONFIG_HAVE_PERF_COUNTERS
+#include <asm/perf_counter.h>		/* struct hw_perf_counter */
+#else
+struct hw_perf_counter {
+};
+#endif
+
+struct task_struct;
+struct pt_regs;
+struct file;
+
+#define PERF_MAX_STACK_DEPTH		64
+
+struct perf_callchain_entry {
+	u64 nr;
+	u64 ip[PERF_MAX_STACK_DEPTH];
+};
+
+struct perf_counter;
+struct perf_counter_context;
+
+/*
+ * How a counter is put on and taken off the cpu it counts on: called
+ * there, with interrupts off.  enable() fails with -EBUSY if the PMU
+ * has no room for it; disable() leaves the count up to date.
+ */
+struct perf_counter_ops {
+	int (*enable)(struct perf_counter *counter);
+	void (*disable)(struct perf_counter *counter);
+	void (*read)(struct perf_counter *counter);
+};
+
+enum perf_counter_state {
+	PERF_COUNTER_STATE_OFF		= -1,
+	PERF_COUNTER_STATE_INACTIVE	= 0,
+	PERF_COUNTER_STATE_ACTIVE	= 1,
+};
+
+/* The ring buffer of a sampling counter, see perf_counter_mmap_page */
+struct perf_mmap_data {
+	int nr_pages;			/* data pages, a power of 2 */
+	int writable;			/* data_tail is honoured */
+	u64 head;			/* next write, kernel's copy */
+	u64 wakeup_head;		/* head at the last wakeup */
+	struct perf_counter_mmap_page *user_page;
+	void *data_pages[0];
+};
+
+struct perf_counter {
+	struct list_head		list_entry;	/* in ctx->counter_list */
+	struct perf_counter_attr	attr;
+	const struct perf_counter_ops	*ops;
+	void				(*destroy)(struct perf_counter *);
+	struct hw_perf_counter		hw;
+	struct perf_counter_context	*ctx;
+	enum perf_counter_state		state;
+	int				oncpu;
+	u64				count;
+
+	/* software counters: events to the next sample */
+	s64				period_left;
+
+	/* sampling: the buffer is only freed after synchronize_sched() */
+	struct perf_mmap_data		*data;
+	struct mutex			mmap_mutex;
+	atomic_t			mmap_count;
+	unsigned int			wakeup_count;
+	wait_queue_head_t		waitq;
+	atomic_t			poll;		/* POLLIN to report */
+
+	/* wakeups asked for from NMI context, done from the tick */
+	struct perf_counter		*pending_next;
+	int				pending;
+};
+
+/*
+ * The counters of a task, or of a cpu.  The lock is taken with
+ * interrupts off; a task's counters are only active while it runs,
+ * and are changed on the cpu it runs on.
+ */
+struct perf_counter_context {
+	spinlock_t		lock;
+	struct list_head	counter_list;
+	int			nr_counters;
+	int			is_active;
+	int			cpu;		/* where active, or -1 */
+	int			last_cpu;
+	struct task_struct	*task;		/* NULL for a cpu */
+	int			task_exited;
+};
+
+#ifdef CONFIG_PERF_COUNTERS
+
+extern atomic_t perf_swcounter_enabled[PERF_SW_EVENTS_MAX];
+
+extern void __perf_swcounter_event(u32 event, u64 nr, struct pt_regs *regs);
+
+/* Count nr software events; regs, if any, are where they happened */
+static inline void perf_swcounter_event(u32 event, u64 nr,
+					struct pt_regs *regs)
+{
+	if (atomic_read(&perf_swcounter_enabled[event]))
+		__perf_swcounter_event(event, nr, regs);
+}
+
+extern void perf_counter_task_sched_in(struct task_struct *task, int cpu);
+extern void perf_counter_task_sched_out(struct task_struct *task, int cpu);
+extern void perf_counter_init_task(struct task_struct *task);
+extern void perf_counter_exit_task(struct task_struct *task);
+extern void perf_counter_free_task(struct task_struct *task);
+extern void perf_counter_do_pending(void);
+
+/* For the PMU drivers */
+extern const struct perf_counter_ops *
+hw_perf_counter_init(struct perf_counter *counter);
+extern int perf_counter_overflow(struct perf_counter *counter,
+				 struct pt_regs *regs, int nmi);
+extern void perf_callchain(struct pt_regs *regs,
+			   struct perf_callchain_entry *entry);
+
+static inline int is_software_counter(struct perf_counter *counter)
+{
+	return counter->attr.type == PERF_TYPE_SOFTWARE;
+}
+
+#else
+
+static inline void perf_swcounter_event(u32 event, u64 nr,
+					struct pt_regs *regs)		{ }
+static inline void
+perf_counter_task_sched_in(struct task_struct *task, int cpu)		{ }
+static inline void
+perf_counter_task_sched_out(struct task_struct *task, int cpu)		{ }
+static inline void perf_counter_init_task(struct task_struct *task)	{ }
+static inline void perf_counter_exit_task(struct task_struct *task)	{ }
+static inline void perf_counter_free_task(struct task_struct *task)	{ }
+static inline void perf_counter_do_pending(void)			{ }
+
+#endif /* CONFIG_PERF_COUNTERS */
+
+#endif /* __KERNEL__ */
+
+#endif /* _LINUX_PERF_COUNTER_H */
@@ -3,7 +3,11 @@
 
 #define PIPEFS_MAGIC 0x50495045
 
-#define PIPE_BUFFERS (16)
+/*
+ * Buffers in the ring of a new pipe.  F_SETPIPE_SZ resizes it, always to a
+ * power of two.
+ */
+#define PIPE_DEF_BUFFERS	16
 
 #define PIPE_BUF_FLAG_LRU	0x01	/* page is on the LRU */
 #define PIPE_BUF_FLAG_ATOMIC	0x02	/* was atomically mapped */
@@ -40,8 +44,8 @@ struct pipe_buf_operations {
 
 struct pipe_inode_info {
 	wait_queue_head_t wait;
-	unsigned int nrbufs, curbuf;
-	struct pipe_buffer bufs[PIPE_BUFFERS];
+	unsigned int nrbufs, curbuf, buffers;
+	struct pipe_buffer *bufs;
 	struct page *tmp_page;
 	unsigned int start;
 	unsigned int readers;
@@ -65,6 +69,14 @@ struct pipe_inode_info * alloc_pipe_info(struct inode * inode);
 void free_pipe_info(struct inode * inode);
 void __free_pipe_info(struct pipe_inode_info *);
 
+/* fs.pipe-max-size and its lower bound */
+extern unsigned int pipe_max_size, pipe_min_size;
+struct ctl_table;
+int pipe_proc_fn(struct ctl_table *, int, struct file *, void __user *,
+		 size_t *, loff_t *);
+
+long pipe_fcntl(struct file *, unsigned int, unsigned long);
+
 /* Generic pipe buffer ops functions */
 void *generic_pipe_buf_map(struct pipe_inode_info *, struct pipe_buffer *, int);
 void generic_pipe_buf_unmap(struct pipe_inode_info *, struct pipe_buffer *, void *);
@@ -90,14 +102,22 @@ struct splice_desc {
 	unsigned int len, total_len;	/* current and remaining length */
 	unsigned int flags;		/* splice flags */
 	struct file *file;		/* file to read/write */
+	void *data;			/* for actors not writing to a file */
 	loff_t pos;			/* file position */
 };
 
 typedef int (splice_actor)(struct pipe_inode_info *, struct pipe_buffer *,
 			   struct splice_desc *);
+typedef int (splice_direct_actor)(struct pipe_inode_info *,
+				  struct splice_desc *);
 
 extern ssize_t splice_from_pipe(struct pipe_inode_info *, struct file *,
 				loff_t *, size_t, unsigned int,
 				splice_actor *);
+extern ssize_t __splice_from_pipe(struct pipe_inode_info *,
+				  struct splice_desc *, splice_actor *);
+extern ssize_t splice_direct_to_actor(struct file *, loff_t *, size_t,
+				      struct splice_desc *,
+				      splice_direct_actor *);
 
 #endif
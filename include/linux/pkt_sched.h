@@ -466,4 +466,96 @@ struct tc_netem_corrupt
 
 #define NETEM_DIST_SCALE	8192
 
+/* FQ */
+
+enum
+{
+	TCA_FQ_UNSPEC,
+	TCA_FQ_PLIMIT,		/* limit of total number of packets in queue */
+	TCA_FQ_FLOW_PLIMIT,	/* limit of packets per flow */
+	TCA_FQ_QUANTUM,		/* RR quantum */
+	TCA_FQ_INITIAL_QUANTUM,	/* RR quantum for new flow */
+	TCA_FQ_RATE_ENABLE,	/* enable/disable rate limiting */
+	TCA_FQ_FLOW_MAX_RATE,	/* per flow max rate (bytes/s) */
+	TCA_FQ_BUCKETS_LOG,	/* log2(number of flow trees) */
+	TCA_FQ_FLOW_REFILL_DELAY, /* flow credit refill delay in usec */
+	__TCA_FQ_MAX,
+};
+
+#define TCA_FQ_MAX (__TCA_FQ_MAX - 1)
+
+struct tc_fq_qd_stats
+{
+	__u64	gc_flows;
+	__u64	highprio_packets;
+	__u64	too_long_pkts;
+	__u64	allocation_errors;
+	__s64	time_next_delayed_flow;	/* ns from now */
+	__u32	flows;
+	__u32	inactive_flows;
+	__u32	throttled_flows;
+	__u32	pad;
+	__u64	throttled;
+	__u64	flows_plimit;
+};
+
+/* CODEL */
+
+enum
+{
+	TCA_CODEL_UNSPEC,
+	TCA_CODEL_TARGET,	/* target sojourn time in usec */
+	TCA_CODEL_LIMIT,	/* limit of total number of packets in queue */
+	TCA_CODEL_INTERVAL,	/* width of the moving window in usec */
+	TCA_CODEL_ECN,		/* mark ECN capable packets instead of dropping */
+	__TCA_CODEL_MAX
+};
+
+#define TCA_CODEL_MAX	(__TCA_CODEL_MAX - 1)
+
+struct tc_codel_xstats
+{
+	__u32	maxpacket;	/* largest packet we've seen so far */
+	__u32	count;		/* how many drops we've done since the last time
+				 * we entered dropping state */
+	__u32	lastcount;	/* count at entry to dropping state */
+	__u32	ldelay;		/* in-queue delay seen by most recently dequeued
+				 * packet, in usec */
+	__s32	drop_next;	/* time to drop next packet, usec from now */
+	__u32	drop_overlimit;	/* number of times max qdisc packet limit
+				 * was hit */
+	__u32	ecn_mark;	/* number of packets we ECN marked instead of
+				 * dropping */
+	__u32	dropping;	/* are we in dropping state ? */
+};
+
+/* FQ_CODEL */
+
+enum
+{
+	TCA_FQ_CODEL_UNSPEC,
+	TCA_FQ_CODEL_TARGET,	/* target sojourn time in usec */
+	TCA_FQ_CODEL_LIMIT,	/* limit of total number of packets in queue */
+	TCA_FQ_CODEL_INTERVAL,	/* width of the moving window in usec */
+	TCA_FQ_CODEL_ECN,	/* mark ECN capable packets instead of dropping */
+	TCA_FQ_CODEL_FLOWS,	/* number of flow queues, set at creation */
+	TCA_FQ_CODEL_QUANTUM,	/* DRR quantum in bytes */
+	__TCA_FQ_CODEL_MAX
+};
+
+#define TCA_FQ_CODEL_MAX	(__TCA_FQ_CODEL_MAX - 1)
+
+struct tc_fq_codel_xstats
+{
+	__u32	maxpacket;	/* largest packet we've seen so far */
+	__u32	drop_overlimit;	/* number of times max qdisc
+				 * packet limit was hit */
+	__u32	ecn_mark;	/* number of packets we ECN marked
+				 * instead of being dropped */
+	__u32	new_flow_count;	/* number of times packets
+				 * created a 'new flow' */
+	__u32	new_flows_len;	/* count of flows in new list */
+	__u32	old_flows_len;	/* count of flows in old list */
+};
+
 #endif
@@ -62,6 +62,7 @@ struct k_itimer {
 			unsigned long expires;
 		} mmtimer;
 	} it;
+	struct rcu_head rcu;		/* lock_timer() may still look */
 };
 
 struct k_clock {
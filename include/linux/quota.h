@@ -133,6 +133,7 @@ struct if_dqinfo {
 #ifdef __KERNEL__
 #include <linux/spinlock.h>
 #include <linux/mutex.h>
+#include <linux/percpu_counter.h>
 
 #include <linux/dqblk_xfs.h>
 #include <linux/dqblk_v1.h>
@@ -224,6 +225,7 @@ struct dquot {
 	unsigned long dq_flags;		/* See DQ_* */
 	short dq_type;			/* Type of quota */
 	struct mem_dqblk dq_dqb;	/* Diskquota usage */
+	struct percpu_counter dq_space_delta;	/* Space not yet in dq_dqb */
 };
 
 #define NODQUOT (struct dquot *)NULL
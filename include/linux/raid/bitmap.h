@@ -248,6 +248,11 @@ struct bitmap {
 	atomic_t pending_writes; /* pending writes to the bitmap file */
 	wait_queue_head_t write_wait;
 
+	/* for md/bitmap_stat */
+	atomic_long_t stat_writes; /* data writes started */
+	atomic_long_t stat_bits_set; /* ... which had to set a bit */
+	atomic_long_t stat_flushes; /* unplugs which waited for set bits */
+	atomic_long_t stat_pages; /* pages written by all unplugs */
 };
 
 /* the bitmap API */
@@ -261,6 +266,7 @@ int  bitmap_active(struct bitmap *bitmap);
 char *file_path(struct file *file, char *buf, int count);
 void bitmap_print_sb(struct bitmap *bitmap);
 int bitmap_update_sb(struct bitmap *bitmap);
+int bitmap_stat(struct bitmap *bitmap, char *page);
 
 int  bitmap_setallbits(struct bitmap *bitmap);
 void bitmap_write_all(struct bitmap *bitmap);
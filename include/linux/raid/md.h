@@ -87,6 +87,8 @@ extern void md_unplug_mddev(mddev_t *mddev);
 
 extern void md_super_write(mddev_t *mddev, mdk_rdev_t *rdev,
 			   sector_t sector, int size, struct page *page);
+extern void md_super_write_pages(mddev_t *mddev, mdk_rdev_t *rdev,
+				 sector_t sector, struct page **pages, int nr);
 extern void md_super_wait(mddev_t *mddev);
 extern int sync_page_io(struct block_device *bdev, sector_t sector, int size,
 			struct page *page, int rw);
@@ -8,6 +8,11 @@ typedef struct mirror_info mirror_info_t;
 struct mirror_info {
 	mdk_rdev_t	*rdev;
 	sector_t	head_position;
+	sector_t	next_seq_sect;	/* after the last read sent here */
+	unsigned long	read_svc;	/* 8 times the average service time
+					 * of a read, in usecs, kept for
+					 * RAID1_BALANCE_LOAD
+					 */
 };
 
 /*
@@ -33,6 +38,7 @@ struct r1_private_data_s {
 	int			working_disks;
 	int			last_used;
 	sector_t		next_seq_sect;
+	int			read_policy;	/* RAID1_BALANCE_* */
 	spinlock_t		device_lock;
 
 	struct list_head	retry_list;
@@ -98,6 +104,12 @@ struct r1bio_s {
 	 * if the IO is in READ direction, then this is where we read
 	 */
 	int			read_disk;
+	/*
+	 * when the read was sent, and how many were in flight on the
+	 * mirror with it
+	 */
+	u64			read_start;
+	int			read_depth;
 
 	struct list_head	retry_list;
 	struct bitmap_update	*bitmap_update;
@@ -116,6 +128,10 @@ struct r1bio_s {
  */
 #define IO_BLOCKED ((struct bio*)1)
 
+/* conf->read_policy: how read_balance() picks a mirror */
+#define	RAID1_BALANCE_DISTANCE	0	/* the closest head */
+#define	RAID1_BALANCE_LOAD	1	/* the least expected wait */
+
 /* bits for r1bio.state */
 #define	R1BIO_Uptodate	0
 #define	R1BIO_IsSync	1
@@ -8,6 +8,11 @@ typedef struct mirror_info mirror_info_t;
 struct mirror_info {
 	mdk_rdev_t	*rdev;
 	sector_t	head_position;
+	sector_t	next_seq_sect;	/* after the last read sent here */
+	unsigned long	read_svc;	/* 8 times the average service time
+					 * of a read, in usecs, kept for
+					 * RAID10_BALANCE_LOAD
+					 */
 };
 
 typedef struct r10bio_s r10bio_t;
@@ -17,6 +22,7 @@ struct r10_private_data_s {
 	mirror_info_t		*mirrors;
 	int			raid_disks;
 	int			working_disks;
+	int			read_policy;	/* RAID10_BALANCE_* */
 	spinlock_t		device_lock;
 
 	/* geometry */
@@ -93,6 +99,12 @@ struct r10bio_s {
 	 * if the IO is in READ direction, then this is where we read
 	 */
 	int			read_slot;
+	/*
+	 * when the read was sent, and how many were in flight on the
+	 * mirror with it
+	 */
+	u64			read_start;
+	int			read_depth;
 
 	struct list_head	retry_list;
 	/*
@@ -116,6 +128,10 @@ struct r10bio_s {
  */
 #define IO_BLOCKED ((struct bio*)1)
 
+/* conf->read_policy: how read_balance() picks a mirror */
+#define	RAID10_BALANCE_DISTANCE	0	/* the closest head */
+#define	RAID10_BALANCE_LOAD	1	/* the least expected wait */
+
 /* bits for r10bio.state */
 #define	R10BIO_Uptodate	0
 #define	R10BIO_IsSync	1
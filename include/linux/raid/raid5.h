@@ -246,6 +246,14 @@ struct raid5_private_data {
 
 	struct page 		*spare_page; /* Used when checking P/Q in raid6 */
 
+	/*
+	 * Optional stripe handling threads which run next to raid5d,
+	 * see group_thread_cnt in sysfs.
+	 */
+	struct raid5_worker	*workers;
+	int			worker_cnt;
+	wait_queue_head_t	wait_for_work;
+
 	/*
 	 * Free stripes pool
 	 */
@@ -263,6 +271,12 @@ struct raid5_private_data {
 
 typedef struct raid5_private_data raid5_conf_t;
 
+struct raid5_worker {
+	raid5_conf_t		*conf;
+	struct task_struct	*tsk;
+	struct page		*spare_page;	/* private raid6 P/Q check page */
+};
+
 #define mddev_to_conf(mddev) ((raid5_conf_t *) mddev->private)
 
 /*
@@ -0,0 +1,80 @@
+/*
+ * Resizable hash tables with RCU lookups.
+ *
+ * Objects embed a struct rcuhash_head and a fixed size key.  Lookups run
+ * under rcu_read_lock() or rcu_read_lock_bh() and take no lock, even
+ * while the table is being resized; inserts and removals take one of a
+ * set of bucket locks.  The table doubles when it holds more than 3/4
+ * of an object per bucket and halves below 3/10, from a work item.
+ *
+ * The caller frees removed objects after a grace period of the flavour
+ * its lookups use, as with any RCU list.
+ */
+#ifndef _LINUX_RCUHASH_H
+#define _LINUX_RCUHASH_H
+
+#include <linux/types.h>
+#include <linux/spinlock.h>
+#include <linux/mutex.h>
+#include <linux/workqueue.h>
+#include <asm/atomic.h>
+
+struct rcuhash_head {
+	struct rcuhash_head	*next;
+};
+
+/* Returns nonzero if obj is the one looked for */
+typedef int (*rcuhash_cmp_t)(void *obj, void *arg);
+typedef u32 (*rcuhash_hashfn_t)(const void *key, u32 len, u32 seed);
+
+struct rcuhash_params {
+	size_t			head_offset;	/* of the rcuhash_head */
+	size_t			key_offset;
+	size_t			key_len;
+	unsigned int		nelem_hint;	/* sizes the first table */
+	unsigned int		min_size;	/* buckets, 0 for the default */
+	unsigned int		max_size;	/* buckets, 0 for the default */
+	rcuhash_hashfn_t	hashfn;		/* jhash() if NULL */
+};
+
+/*
+ * While a resize runs, objects move one at a time from a bucket table
+ * to its future table, and lookups that miss in the first look in the
+ * second.
+ */
+struct rcuhash_table {
+	unsigned int		size;		/* a power of 2 */
+	struct rcuhash_table	*future;
+	struct rcuhash_head	*buckets[0];
+};
+
+struct rcuhash {
+	struct rcuhash_table	*tbl;
+	struct rcuhash_params	p;
+	u32			seed;
+	atomic_t		nelems;
+	/* an object's lock does not depend on the table size */
+	spinlock_t		*locks;
+	unsigned int		lock_mask;
+	struct mutex		mutex;		/* serialises resizes */
+	struct work_struct	work;
+	int			dying;
+};
+
+extern int rcuhash_init(struct rcuhash *ht, const struct rcuhash_params *p);
+extern void rcuhash_destroy(struct rcuhash *ht);
+
+extern void *rcuhash_lookup(struct rcuhash *ht, const void *key);
+extern void *rcuhash_lookup_compare(struct rcuhash *ht, const void *key,
+				    rcuhash_cmp_t cmp, void *arg);
+extern void rcuhash_insert(struct rcuhash *ht, void *obj);
+extern void *rcuhash_insert_unique(struct rcuhash *ht, void *obj,
+				   rcuhash_cmp_t cmp, void *arg);
+extern int rcuhash_remove(struct rcuhash *ht, void *obj);
+
+static inline unsigned int rcuhash_nelems(struct rcuhash *ht)
+{
+	return atomic_read(&ht->nelems);
+}
+
+#endif /* _LINUX_RCUHASH_H */
@@ -36,6 +36,7 @@
 #ifdef __KERNEL__
 
 #include <linux/cache.h>
+#include <linux/list.h>
 #include <linux/spinlock.h>
 #include <linux/threads.h>
 #include <linux/percpu.h>
@@ -60,15 +61,64 @@ struct rcu_head {
 
 
 
+/*
+ * The cpus report their quiescent states to a tree of rcu_nodes, each
+ * leaf covering RCU_FANOUT cpus and each inner node RCU_FANOUT nodes
+ * below it, so that a cpu only takes the lock of its leaf, and of the
+ * nodes above only when it is the last one there to report.  Up to three
+ * levels are used; the nodes are laid out root first, leaves last.
+ */
+#ifdef CONFIG_RCU_FANOUT
+#define RCU_FANOUT	CONFIG_RCU_FANOUT
+#else
+#define RCU_FANOUT	BITS_PER_LONG
+#endif
+
+#define RCU_LEAVES	((NR_CPUS + RCU_FANOUT - 1) / RCU_FANOUT)
+#if NR_CPUS <= RCU_FANOUT
+# define RCU_LEVELS	1
+# define RCU_MIDS	0
+#elif RCU_LEAVES <= RCU_FANOUT
+# define RCU_LEVELS	2
+# define RCU_MIDS	0
+#else
+# define RCU_LEVELS	3
+# define RCU_MIDS	((RCU_LEAVES + RCU_FANOUT - 1) / RCU_FANOUT)
+# if RCU_MIDS > RCU_FANOUT
+#  error "NR_CPUS too large for three levels of CONFIG_RCU_FANOUT"
+# endif
+#endif
+#define RCU_NUM_NODES	(RCU_LEVELS == 1 ? 1 : 1 + RCU_MIDS + RCU_LEAVES)
+
+struct rcu_node {
+	spinlock_t	lock;
+	long		gpnum;	 /* Batch # the masks below are for */
+	unsigned long	qsmask;	 /* Children yet to report for gpnum */
+	unsigned long	qsmasknext; /* Children to wait for next batch */
+	unsigned long	grpmask; /* This node's bit in parent's qsmask */
+	struct rcu_node	*parent;
+#ifdef CONFIG_PREEMPT_RCU
+	/*
+	 * Tasks preempted in a read-side critical section on one of this
+	 * leaf's cpus: those on blocked_tasks[gpnum & 1] hold up batch
+	 * gpnum, those on the other list only the batch after it.
+	 */
+	struct list_head blocked_tasks[2];
+#endif
+} ____cacheline_internodealigned_in_smp;
+
 /* Global control variables for rcupdate callback mechanism. */
 struct rcu_ctrlblk {
 	long	cur;		/* Current batch number.                      */
 	long	completed;	/* Number of the last completed batch         */
 	int	next_pending;	/* Is the next batch already waiting?         */
 
+	/* Taken to start a batch and to complete one, not per cpu */
 	spinlock_t	lock	____cacheline_internodealigned_in_smp;
-	cpumask_t	cpumask; /* CPUs that need to switch in order    */
-	                         /* for current batch to proceed.        */
+#ifdef CONFIG_RCU_BOOST
+	unsigned long	boost_time; /* When to boost blocked readers */
+#endif
+	struct rcu_node	node[RCU_NUM_NODES];
 } ____cacheline_internodealigned_in_smp;
 
 /* Is batch a before batch b ? */
@@ -109,6 +159,15 @@ struct rcu_data {
 #ifdef CONFIG_SMP
 	long		last_rs_qlen;	 /* qlen during the last resched */
 #endif
+	struct rcu_node	*mynode;	 /* Leaf this cpu reports to */
+	unsigned long	grpmask;	 /* This cpu's bit in mynode->qsmask */
+
+	/* 3) statistics */
+	unsigned long	n_cbs_queued;	 /* callbacks queued */
+	unsigned long	n_cbs_invoked;	 /* callbacks invoked */
+	unsigned long	n_batches;	 /* batches of callbacks started */
+	unsigned long	n_qs_reported;	 /* quiescent states reported */
+	unsigned long	n_force_qs;	 /* other cpus forced to reschedule */
 };
 
 DECLARE_PER_CPU(struct rcu_data, rcu_data);
@@ -134,6 +193,22 @@ static inline void rcu_bh_qsctr_inc(int cpu)
 extern int rcu_pending(int cpu);
 extern int rcu_needs_cpu(int cpu);
 
+struct task_struct;
+
+#ifdef CONFIG_PREEMPT_RCU
+/* Bits in task_struct.rcu_read_unlock_special */
+#define RCU_READ_UNLOCK_BLOCKED	1 /* queued on an rcu_node */
+
+extern void __rcu_read_lock(void);
+extern void __rcu_read_unlock(void);
+extern void rcu_preempt_note_context_switch(struct task_struct *t, int cpu);
+#else
+static inline void rcu_preempt_note_context_switch(struct task_struct *t,
+						   int cpu)
+{
+}
+#endif
+
 /**
  * rcu_read_lock - mark the beginning of an RCU read-side critical section.
  *
@@ -162,23 +237,41 @@ extern int rcu_needs_cpu(int cpu);
  * completes.
  *
  * It is illegal to block while in an RCU read-side critical section.
+ * With CONFIG_PREEMPT_RCU the section may be preempted, though: the
+ * task is then queued, and the grace period waits for it to leave.
  */
+#ifdef CONFIG_PREEMPT_RCU
+#define rcu_read_lock() \
+	do { \
+		__rcu_read_lock(); \
+		__acquire(RCU); \
+	} while(0)
+#else
 #define rcu_read_lock() \
 	do { \
 		preempt_disable(); \
 		__acquire(RCU); \
 	} while(0)
+#endif
 
 /**
  * rcu_read_unlock - marks the end of an RCU read-side critical section.
  *
  * See rcu_read_lock() for more information.
  */
+#ifdef CONFIG_PREEMPT_RCU
+#define rcu_read_unlock() \
+	do { \
+		__release(RCU); \
+		__rcu_read_unlock(); \
+	} while(0)
+#else
 #define rcu_read_unlock() \
 	do { \
 		__release(RCU); \
 		preempt_enable(); \
 	} while(0)
+#endif
 
 /*
  * So where is rcu_write_lock()?  It does not exist, as there is no
@@ -266,7 +359,9 @@ extern int rcu_needs_cpu(int cpu);
  * synchronize_kernel() API.  In contrast, synchronize_rcu() only
  * guarantees that rcu_read_lock() sections will have completed.
  * In "classic RCU", these two guarantees happen to be one and
- * the same, but can differ in realtime RCU implementations.
+ * the same, but can differ in realtime RCU implementations.  With
+ * CONFIG_PREEMPT_RCU a grace period still waits for every cpu to
+ * context switch, so synchronize_rcu() covers both.
  */
 #define synchronize_sched() synchronize_rcu()
 
@@ -0,0 +1,79 @@
+#ifndef _LINUX_READAHEAD_TRACE_H
+#define _LINUX_READAHEAD_TRACE_H
+
+#include <linux/types.h>
+
+/*
+ * On-demand readahead trace records, as read from the per cpu relay
+ * files in debugfs readahead/trace<cpu> (CONFIG_READAHEAD_TRACE). Every
+ * record is one decision of ondemand_readahead(): the access pattern it
+ * saw and the window it submitted.
+ */
+#define READAHEAD_TRACE_MAGIC	0x7ead0a00
+#define READAHEAD_TRACE_VERSION	0x01
+
+/*
+ * What the readahead was taken for
+ */
+enum readahead_pattern {
+	RA_PATTERN_INITIAL = 1,		/* start of file, sequential miss
+					   or oversize read */
+	RA_PATTERN_SUBSEQUENT,		/* expected offset, window pushed on */
+	RA_PATTERN_MARKER,		/* marker page hit with no state */
+	RA_PATTERN_CONTEXT,		/* stream found in the page cache */
+	RA_PATTERN_RANDOM,		/* small random read, read as is */
+};
+
+/*
+ * The trace itself, 64 bytes
+ */
+struct readahead_trace {
+	__u32 magic;			/* MAGIC | version */
+	__u32 sequence;			/* event number of this cpu */
+	__u64 time;			/* sched_clock() of the decision */
+	__u64 ino;			/* inode of the file */
+	__u64 offset;			/* page index of the access */
+	__u64 start;			/* readahead window */
+	__u32 dev;			/* device of the file */
+	__u32 req_size;			/* pages the reader asked for */
+	__u32 size;
+	__u32 async_size;		/* where the marker went in the window */
+	__s32 actual;			/* pages submitted for I/O */
+	__u8 pattern;			/* enum readahead_pattern */
+	__u8 async;			/* triggered by a marker page */
+	__u8 pad[2];
+};
+
+#ifdef __KERNEL__
+#include <linux/compiler.h>
+
+struct address_space;
+struct file_ra_state;
+
+#ifdef CONFIG_READAHEAD_TRACE
+extern int readahead_trace_enabled;
+extern void __readahead_trace(struct address_space *mapping,
+			      struct file_ra_state *ra, int pattern, int async,
+			      unsigned long offset, unsigned long req_size,
+			      int actual);
+
+static inline void readahead_trace(struct address_space *mapping,
+			struct file_ra_state *ra, int pattern, int async,
+			unsigned long offset, unsigned long req_size,
+			int actual)
+{
+	if (unlikely(readahead_trace_enabled))
+		__readahead_trace(mapping, ra, pattern, async, offset,
+				  req_size, actual);
+}
+#else
+static inline void readahead_trace(struct address_space *mapping,
+			struct file_ra_state *ra, int pattern, int async,
+			unsigned long offset, unsigned long req_size,
+			int actual)
+{
+}
+#endif /* CONFIG_READAHEAD_TRACE */
+#endif /* __KERNEL__ */
+
+#endif
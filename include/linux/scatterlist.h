@@ -20,4 +20,76 @@ static inline void sg_init_one(struct scatterlist *sg, void *buf,
 	sg_set_buf(sg, buf, buflen);
 }
 
+/*
+ * Chained scatterlists.  On architectures that define ARCH_HAS_SG_CHAIN
+ * the last entry of a table may, instead of a segment, hold a pointer
+ * to the table that continues the list, with bit 0 of ->page set.  Code
+ * that may be handed such a list walks it with sg_next() or
+ * for_each_sg() instead of indexing it.
+ */
+#ifdef ARCH_HAS_SG_CHAIN
+#define sg_is_chain(sg)		((unsigned long) (sg)->page & 0x01)
+#define sg_chain_ptr(sg)	\
+	((struct scatterlist *) ((unsigned long) (sg)->page & ~0x01))
+#else
+#define sg_is_chain(sg)		0
+#define sg_chain_ptr(sg)	NULL
+#endif
+
+/**
+ * sg_next - return the entry after @sg
+ * @sg: the current entry, which must not be the last of the list
+ */
+static inline struct scatterlist *sg_next(struct scatterlist *sg)
+{
+	sg++;
+	if (unlikely(sg_is_chain(sg)))
+		sg = sg_chain_ptr(sg);
+	return sg;
+}
+
+/*
+ * Loop over the @nr entries of a (possibly chained) list; the entry
+ * after the last one is never looked at.
+ */
+#define for_each_sg(sglist, sg, nr, __i)				\
+	for (__i = 0, sg = (sglist); __i < (nr);			\
+	     sg = ++__i < (nr) ? sg_next(sg) : NULL)
+
+/**
+ * sg_last - return the last entry of a list
+ * @sgl: the first entry
+ * @nents: the number of entries
+ */
+static inline struct scatterlist *sg_last(struct scatterlist *sgl,
+					  unsigned int nents)
+{
+#ifdef ARCH_HAS_SG_CHAIN
+	struct scatterlist *sg, *ret = NULL;
+	int i;
+
+	for_each_sg(sgl, sg, nents, i)
+		ret = sg;
+
+	return ret;
+#else
+	return &sgl[nents - 1];
+#endif
+}
+
+/**
+ * sg_chain - continue a table with another one
+ * @prv: the first table
+ * @prv_nents: its number of entries, the last of which becomes the link
+ * @sgl: the second table
+ */
+static inline void sg_chain(struct scatterlist *prv, unsigned int prv_nents,
+			    struct scatterlist *sgl)
+{
+#ifndef ARCH_HAS_SG_CHAIN
+	BUG();
+#endif
+	prv[prv_nents - 1].page = (struct page *) ((unsigned long) sgl | 0x01);
+}
+
 #endif /* _LINUX_SCATTERLIST_H */
@@ -191,6 +191,9 @@ extern void sched_init_smp(void);
 extern void init_idle(struct task_struct *idle, int cpu);
 
 extern cpumask_t nohz_cpu_mask;
+#ifdef CONFIG_NO_IDLE_HZ
+extern int sched_tick_needed(int cpu);
+#endif
 
 extern void show_state(void);
 extern void show_regs(struct pt_regs *);
@@ -246,6 +249,8 @@ struct namespace;
 extern int sysctl_max_map_count;
 
 #include <linux/aio.h>
+#include <linux/taskstats.h>
+#include <linux/task_io_accounting.h>
 
 extern unsigned long
 arch_get_unmapped_area(struct file *, unsigned long, unsigned long,
@@ -263,12 +268,45 @@ extern void arch_unmap_area_topdown(struct mm_struct *, unsigned long);
  * so must be incremented atomically.
  */
 #define set_mm_counter(mm, member, value) atomic_long_set(&(mm)->_##member, value)
-#define get_mm_counter(mm, member) ((unsigned long)atomic_long_read(&(mm)->_##member))
+#define get_mm_counter(mm, member) __get_mm_counter(&(mm)->_##member)
 #define add_mm_counter(mm, member, value) atomic_long_add(value, &(mm)->_##member)
 #define inc_mm_counter(mm, member) atomic_long_inc(&(mm)->_##member)
 #define dec_mm_counter(mm, member) atomic_long_dec(&(mm)->_##member)
 typedef atomic_long_t mm_counter_t;
 
+/*
+ * Faults count in the faulting task first, and the task folds its counts
+ * into the mm every TASK_RSS_EVENTS_THRESH faults and when it drops the
+ * mm, so that threads faulting in parallel don't bounce the counters.
+ * Until then the mm counter may lag behind, or even be below zero.
+ */
+#define SPLIT_RSS_COUNTING
+#define TASK_RSS_EVENTS_THRESH	64
+
+struct task_rss_stat {
+	int events;	/* faults since the last fold */
+	int file_rss;
+	int anon_rss;
+};
+
+#define add_mm_counter_fast(mm, member, value) do {		\
+	if (current->mm == (mm))				\
+		current->rss_stat.member += (value);		\
+	else							\
+		add_mm_counter(mm, member, value);		\
+} while (0)
+
+static inline unsigned long __get_mm_counter(atomic_long_t *counter)
+{
+	long val = atomic_long_read(counter);
+
+	return val < 0 ? 0 : val;
+}
+
+extern void sync_mm_rss(struct task_struct *task, struct mm_struct *mm);
+extern unsigned long get_mm_rss_exact(struct task_struct *task,
+				      struct mm_struct *mm);
+
 #else  /* NR_CPUS < CONFIG_SPLIT_PTLOCK_CPUS */
 /*
  * The mm counters are protected by its page_table_lock,
@@ -281,8 +319,19 @@ typedef atomic_long_t mm_counter_t;
 #define dec_mm_counter(mm, member) (mm)->_##member--
 typedef unsigned long mm_counter_t;
 
+#define add_mm_counter_fast(mm, member, value) add_mm_counter(mm, member, value)
+
+static inline void sync_mm_rss(struct task_struct *task, struct mm_struct *mm)
+{
+}
+
+#define get_mm_rss_exact(task, mm) get_mm_rss(mm)
+
 #endif /* NR_CPUS < CONFIG_SPLIT_PTLOCK_CPUS */
 
+#define inc_mm_counter_fast(mm, member) add_mm_counter_fast(mm, member, 1)
+#define dec_mm_counter_fast(mm, member) add_mm_counter_fast(mm, member, -1)
+
 #define get_mm_rss(mm)					\
 	(get_mm_counter(mm, file_rss) + get_mm_counter(mm, anon_rss))
 #define update_hiwater_rss(mm)	do {			\
@@ -353,12 +402,31 @@ struct mm_struct {
 	/* aio bits */
 	rwlock_t		ioctx_list_lock;
 	struct kioctx		*ioctx_list;
+
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+	/* page tables set aside to split huge pmds, under page_table_lock */
+	struct list_head	pmd_huge_pte;
+	/* on khugepaged's list of mms to scan, under khugepaged_lock */
+	struct list_head	khugepaged_link;
+#endif
+#ifdef CONFIG_KSM
+	/* ksmd's record of this mm, if it has mergeable areas */
+	struct mm_slot		*ksm_mm_slot;
+#endif
+#ifdef CONFIG_NUMA_BALANCING
+	/* on knumad's list of mms to sample, under knumad_lock */
+	struct list_head	numa_link;
+	/* where knumad's next pass resumes, and how many it has finished */
+	unsigned long		numa_scan_offset;
+	int			numa_scan_seq;
+#endif
 };
 
 struct sighand_struct {
 	atomic_t		count;
 	struct k_sigaction	action[_NSIG];
 	spinlock_t		siglock;
+	wait_queue_head_t	signalfd_wqh;	/* signalfd readers */
 };
 
 struct pacct_struct {
@@ -388,6 +456,10 @@ struct signal_struct {
 	/* shared signal handling: */
 	struct sigpending	shared_pending;
 
+	/* freed sigqueues kept for reuse, under siglock */
+	struct list_head	sigqueue_cache;
+	int			nr_sigqueue_cache;
+
 	/* thread group exit support */
 	int			group_exit_code;
 	/* overloaded:
@@ -558,6 +630,42 @@ struct sched_info {
 extern struct file_operations proc_schedstat_operations;
 #endif /* CONFIG_SCHEDSTATS */
 
+#ifdef CONFIG_SCHED_DEBUG
+extern struct file_operations proc_sched_debug_operations;
+#endif
+
+struct cfs_rq;
+
+struct load_weight {
+	unsigned long weight, inv_weight;
+};
+
+/*
+ * Per-task state of the fair scheduling policy (kernel/sched_fair.c).
+ * Runnable entities are sorted by vruntime, the nanoseconds they ran
+ * scaled by the inverse of their load weight.
+ */
+struct sched_entity {
+	struct load_weight	load;		/* nice level, or group shares */
+	struct rb_node		run_node;
+	unsigned int		on_rq;
+	struct cfs_rq		*cfs_rq;	/* queue we are (last were) on */
+	struct cfs_rq		*my_q;		/* queue a group owns, NULL for tasks */
+
+	u64			exec_start;
+	u64			sum_exec_runtime;
+	u64			prev_sum_exec_runtime;
+	u64			vruntime;
+
+#ifdef CONFIG_SCHED_DEBUG
+	u64			wait_start;
+	u64			wait_max;
+	u64			wait_sum;
+	u64			exec_max;
+	unsigned long		nr_wakeups;
+#endif
+};
+
 #ifdef CONFIG_TASK_DELAY_ACCT
 struct task_delay_info {
 	spinlock_t	lock;
@@ -585,6 +693,11 @@ struct task_delay_info {
 				/* io operations performed */
 	u32 swapin_count;	/* total count of the number of swapin block */
 				/* io operations performed */
+#ifdef CONFIG_TASK_DELAY_HIST
+	/* log2 histograms of the delays, see struct taskstats */
+	u32 blkio_hist[TASKSTATS_DELAY_HIST];
+	u32 swapin_hist[TASKSTATS_DELAY_HIST];
+#endif
 };
 #endif	/* CONFIG_TASK_DELAY_ACCT */
 
@@ -709,6 +822,7 @@ extern unsigned int max_cache_size;
 
 
 struct io_context;			/* See blkdev.h */
+struct blk_plug;			/* See blkdev.h */
 void exit_io_context(void);
 struct cpuset;
 
@@ -763,6 +877,8 @@ enum sleep_type {
 };
 
 struct prio_array;
+struct worker;
+struct perf_counter_context;
 
 struct task_struct {
 	volatile long state;	/* -1 unrunnable, 0 runnable, >0 stopped */
@@ -782,6 +898,7 @@ struct task_struct {
 	int prio, static_prio, normal_prio;
 	struct list_head run_list;
 	struct prio_array *array;
+	struct sched_entity se;
 
 	unsigned short ioprio;
 	unsigned int btrace_seq;
@@ -808,6 +925,9 @@ struct task_struct {
 	struct list_head ptrace_list;
 
 	struct mm_struct *mm, *active_mm;
+#ifdef SPLIT_RSS_COUNTING
+	struct task_rss_stat rss_stat;
+#endif
 
 /* task state */
 	struct linux_binfmt *binfmt;
@@ -909,6 +1029,19 @@ struct task_struct {
 	/* Protection of the PI data structures: */
 	spinlock_t pi_lock;
 
+#ifdef CONFIG_PREEMPT_RCU
+	int rcu_read_lock_nesting;
+	int rcu_read_unlock_special;
+	struct rcu_node *rcu_blocked_node;
+	struct list_head rcu_node_entry;
+#ifdef CONFIG_RCU_BOOST
+	int rcu_boosted;	/* protected by pi_lock */
+#endif
+#endif
+
+	/* the workqueue worker this task is, if PF_WQ_WORKER */
+	struct worker *wq_worker;
+
 #ifdef CONFIG_RT_MUTEXES
 	/* PI waiters blocked on a rt_mutex held by this task */
 	struct plist_head pi_waiters;
@@ -952,6 +1085,7 @@ struct task_struct {
 	struct backing_dev_info *backing_dev_info;
 
 	struct io_context *io_context;
+	struct blk_plug *plug;		/* requests batched by the task */
 
 	unsigned long ptrace_message;
 	siginfo_t *last_siginfo; /* For ptrace use.  */
@@ -964,6 +1098,7 @@ struct task_struct {
 	wait_queue_t *io_wait;
 /* i/o counters(bytes read/written, #syscalls */
 	u64 rchar, wchar, syscr, syscw;
+	struct task_io_accounting ioac;
 #if defined(CONFIG_BSD_PROCESS_ACCT)
 	u64 acct_rss_mem1;	/* accumulated rss usage */
 	u64 acct_vm_mem1;	/* accumulated virtual memory usage */
@@ -973,6 +1108,14 @@ struct task_struct {
   	struct mempolicy *mempolicy;
 	short il_next;
 #endif
+#ifdef CONFIG_NUMA_BALANCING
+	/* NUMA hinting faults taken, see mm/numa_balancing.c */
+	unsigned long numa_faults_local;
+	unsigned long numa_faults_remote;
+	unsigned long *numa_faults;	/* on shared pages, per node */
+	int numa_preferred_nid;
+	int numa_scan_seq;
+#endif
 #ifdef CONFIG_CPUSETS
 	struct cpuset *cpuset;
 	nodemask_t mems_allowed;
@@ -996,6 +1139,9 @@ struct task_struct {
 #ifdef	CONFIG_TASK_DELAY_ACCT
 	struct task_delay_info *delays;
 #endif
+#ifdef CONFIG_PERF_COUNTERS
+	struct perf_counter_context *perf_counter_ctxp;
+#endif
 };
 
 static inline pid_t process_group(struct task_struct *tsk)
@@ -1035,6 +1181,7 @@ static inline void put_task_struct(struct task_struct *t)
 #define PF_STARTING	0x00000002	/* being created */
 #define PF_EXITING	0x00000004	/* getting shut down */
 #define PF_DEAD		0x00000008	/* Dead */
+#define PF_WQ_WORKER	0x00000020	/* I'm a workqueue worker */
 #define PF_FORKNOEXEC	0x00000040	/* forked but didn't exec */
 #define PF_SUPERPRIV	0x00000100	/* used super-user privileges */
 #define PF_DUMPCORE	0x00000200	/* dumped core */
@@ -1104,6 +1251,12 @@ extern void sched_exec(void);
 #define sched_exec()   {}
 #endif
 
+#if defined(CONFIG_SMP) && defined(CONFIG_NUMA_BALANCING)
+extern void sched_move_to_node(int nid);
+#else
+static inline void sched_move_to_node(int nid) { }
+#endif
+
 #ifdef CONFIG_HOTPLUG_CPU
 extern void idle_task_exit(void);
 #else
@@ -1135,6 +1288,23 @@ extern struct task_struct *idle_task(int cpu);
 extern struct task_struct *curr_task(int cpu);
 extern void set_curr_task(int cpu, struct task_struct *p);
 
+#ifdef CONFIG_FAIR_GROUP_SCHED
+struct task_group;
+
+extern struct task_group root_task_group;
+
+extern struct task_group *sched_create_group(struct task_group *parent);
+extern void sched_destroy_group(struct task_group *tg);
+extern void sched_move_task(struct task_struct *tsk, struct task_group *tg);
+extern void sched_group_fork(struct task_struct *child, struct task_group *tg);
+extern int sched_group_set_shares(struct task_group *tg, unsigned long shares);
+extern unsigned long sched_group_shares(struct task_group *tg);
+extern int sched_group_set_bandwidth(struct task_group *tg,
+				     long quota_us, long period_us);
+extern long sched_group_quota(struct task_group *tg);
+extern long sched_group_period(struct task_group *tg);
+#endif
+
 void yield(void);
 
 /*
@@ -1200,6 +1370,8 @@ extern void proc_caches_init(void);
 extern void flush_signals(struct task_struct *);
 extern void flush_signal_handlers(struct task_struct *, int force_default);
 extern int dequeue_signal(struct task_struct *tsk, sigset_t *mask, siginfo_t *info);
+extern int next_signal(struct sigpending *pending, sigset_t *mask);
+extern void flush_sigqueue_cache(struct signal_struct *sig);
 
 static inline int dequeue_signal_lock(struct task_struct *tsk, sigset_t *mask, siginfo_t *info)
 {
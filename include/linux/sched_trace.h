@@ -0,0 +1,61 @@
+#ifndef _LINUX_SCHED_TRACE_H
+#define _LINUX_SCHED_TRACE_H
+
+#include <linux/types.h>
+
+/*
+ * Load balancing trace records, as read from the per cpu relay files
+ * in debugfs sched/trace<cpu> (CONFIG_SCHED_TRACE). Every record is one
+ * decision of load_balance, load_balance_newidle or active_load_balance
+ * and lands in the buffer of the cpu which made it.
+ */
+#define SCHED_TRACE_MAGIC	0x5c4ed1b0
+#define SCHED_TRACE_VERSION	0x01
+
+/*
+ * Balancing paths
+ */
+enum sched_trace_event {
+	SCHED_TRACE_LB = 1,		/* periodic load_balance */
+	SCHED_TRACE_LB_NEWIDLE,		/* load_balance_newidle */
+	SCHED_TRACE_LB_ACTIVE,		/* active_load_balance push */
+};
+
+/*
+ * Outcome of a balancing attempt
+ */
+enum sched_trace_result {
+	SCHED_TRACE_MOVED = 1,		/* tasks were moved */
+	SCHED_TRACE_NO_BUSY_GROUP,	/* balanced, no busiest group */
+	SCHED_TRACE_NO_BUSY_QUEUE,	/* balanced, no busiest queue */
+	SCHED_TRACE_ALL_PINNED,		/* all tasks pinned by affinity */
+	SCHED_TRACE_FAILED,		/* imbalance, nothing could move */
+	SCHED_TRACE_ACTIVE_KICK,	/* failed, migration thread kicked */
+	SCHED_TRACE_CURR_PINNED,	/* failed, busiest curr can't move */
+};
+
+/*
+ * The trace itself, 64 bytes
+ */
+struct sched_lb_trace {
+	__u32 magic;			/* MAGIC << 8 | version */
+	__u32 sequence;			/* event number of this cpu */
+	__u64 time;			/* sched_clock() of the decision */
+	__u64 imbalance;		/* weighted load asked for */
+	__u32 duration;			/* nsecs spent moving tasks */
+	__u32 nr_moved;			/* tasks moved */
+	__u32 sd_flags;			/* SD_* flags of the domain */
+	__u32 this_nr_running;		/* destination queue length */
+	__u32 busiest_nr_running;	/* source queue length */
+	__u32 nr_balance_failed;	/* of the domain, after the decision */
+	__u32 balance_interval;		/* of the domain, after the decision */
+	__u16 cpu;			/* destination cpu */
+	__s16 busiest_cpu;		/* source cpu, -1 if none was found */
+	__u16 sd_weight;		/* cpus spanned by the domain */
+	__u8 event;			/* enum sched_trace_event */
+	__u8 idle;			/* enum idle_type of the attempt */
+	__u8 result;			/* enum sched_trace_result */
+	__u8 pad[3];
+};
+
+#endif
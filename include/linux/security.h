@@ -1664,6 +1664,19 @@ static inline int security_inode_permission (struct inode *inode, int mask,
 	return security_ops->inode_permission (inode, mask, nd);
 }
 
+extern struct security_operations dummy_security_ops;
+
+/*
+ * May inode_permission be skipped for an inode no reference is held on,
+ * by the lockless path walk?  Only if the hook is the default one, which
+ * allows everything without looking at the inode.
+ */
+static inline int security_inode_permission_trivial (void)
+{
+	return security_ops->inode_permission ==
+		dummy_security_ops.inode_permission;
+}
+
 static inline int security_inode_setattr (struct dentry *dentry,
 					  struct iattr *attr)
 {
@@ -2367,6 +2380,11 @@ static inline int security_inode_permission (struct inode *inode, int mask,
 	return 0;
 }
 
+static inline int security_inode_permission_trivial (void)
+{
+	return 1;
+}
+
 static inline int security_inode_setattr (struct dentry *dentry,
 					  struct iattr *attr)
 {
@@ -0,0 +1,63 @@
+/*
+ *  include/linux/signalfd.h
+ *
+ *  Receiving signals through a file descriptor, see fs/signalfd.c.
+ */
+
+#ifndef _LINUX_SIGNALFD_H
+#define _LINUX_SIGNALFD_H
+
+#include <linux/types.h>
+
+/*
+ * struct signalfd_siginfo - read from a signalfd, one per signal.  The
+ * fields that do not apply to the kind of signal are zero.
+ */
+struct signalfd_siginfo {
+	__u32 ssi_signo;
+	__s32 ssi_errno;
+	__s32 ssi_code;
+	__u32 ssi_pid;
+	__u32 ssi_uid;
+	__s32 ssi_fd;
+	__u32 ssi_tid;
+	__u32 ssi_band;
+	__u32 ssi_overrun;
+	__u32 ssi_trapno;
+	__s32 ssi_status;
+	__s32 ssi_int;
+	__u64 ssi_ptr;
+	__u64 ssi_utime;
+	__u64 ssi_stime;
+	__u64 ssi_addr;
+
+	/* room to grow, keeping the structure at 128 bytes */
+	__u8 __pad[48];
+};
+
+#ifdef __KERNEL__
+
+#include <linux/sched.h>
+#include <linux/wait.h>
+
+#ifdef CONFIG_SIGNALFD
+
+/*
+ * Called with @tsk's siglock held once a signal is queued to it, as
+ * blocked signals do not wake the signalfd readers otherwise.
+ */
+static inline void signalfd_notify(struct task_struct *tsk, int sig)
+{
+	if (unlikely(waitqueue_active(&tsk->sighand->signalfd_wqh)))
+		wake_up(&tsk->sighand->signalfd_wqh);
+}
+
+#else
+
+static inline void signalfd_notify(struct task_struct *tsk, int sig) { }
+
+#endif /* CONFIG_SIGNALFD */
+
+#endif /* __KERNEL__ */
+
+#endif /* _LINUX_SIGNALFD_H */
@@ -44,6 +44,8 @@
 				  ~(SMP_CACHE_BYTES - 1))
 #define SKB_MAX_HEAD(X)		(SKB_MAX_ORDER((X), 0))
 #define SKB_MAX_ALLOC		(SKB_MAX_ORDER(0, 2))
+/* data room of a build_skb() buffer of X bytes */
+#define SKB_WITH_OVERHEAD(X)	((X) - SKB_DATA_ALIGN(sizeof(struct skb_shared_info)))
 
 /* A. Checksumming of received packets by device.
  *
@@ -141,6 +143,9 @@ struct skb_shared_info {
 	unsigned int    ip6_frag_id;
 	struct sk_buff	*frag_list;
 	skb_frag_t	frags[MAX_SKB_FRAGS];
+	/* Intermediate layers must ensure that destructor_arg
+	 * remains valid until skb destructor */
+	void *		destructor_arg;
 };
 
 /* We divide dataref into two halves.  The higher 16 bits hold references
@@ -209,6 +214,12 @@ enum {
  *	@priority: Packet queueing priority
  *	@users: User count - see {datagram,tcp}.c
  *	@protocol: Packet protocol from driver
+ *	@queue_mapping: Transmit queue of a multiqueue device
+ *	@xmit_more: More packets follow right behind, the driver may defer
+ *		telling the hardware about this one
+ *	@head_frag: skb->head is a page fragment, not kmalloc()ed
+ *	@queue_mapping_set: @queue_mapping was picked by a stacked device
+ *		(a bond) and is to be kept by the device underneath
  *	@truesize: Buffer size 
  *	@head: Head of buffer
  *	@data: Data head pointer
@@ -282,8 +293,12 @@ struct sk_buff {
 				nfctinfo:3;
 	__u8			pkt_type:3,
 				fclone:2,
-				ipvs_property:1;
+				ipvs_property:1,
+				xmit_more:1;
+	__u8			head_frag:1,
+				queue_mapping_set:1;
 	__be16			protocol;
+	__u16			queue_mapping;
 
 	void			(*destructor)(struct sk_buff *skb);
 #ifdef CONFIG_NETFILTER
@@ -346,6 +361,8 @@ static inline struct sk_buff *alloc_skb_fclone(unsigned int size,
 extern struct sk_buff *alloc_skb_from_cache(kmem_cache_t *cp,
 					    unsigned int size,
 					    gfp_t priority);
+extern struct sk_buff *build_skb(void *data, unsigned int frag_size);
+extern void *netdev_alloc_frag(unsigned int fragsz);
 extern void	       kfree_skbmem(struct sk_buff *skb);
 extern struct sk_buff *skb_clone(struct sk_buff *skb,
 				 gfp_t priority);
@@ -1098,13 +1115,13 @@ static inline void __skb_queue_purge(struct sk_buff_head *list)
  *
  *	%NULL is returned if there is no free memory.
  */
+extern struct sk_buff *__netdev_alloc_skb(struct net_device *dev,
+		unsigned int length, gfp_t gfp_mask);
+
 static inline struct sk_buff *__dev_alloc_skb(unsigned int length,
 					      gfp_t gfp_mask)
 {
-	struct sk_buff *skb = alloc_skb(length + NET_SKB_PAD, gfp_mask);
-	if (likely(skb))
-		skb_reserve(skb, NET_SKB_PAD);
-	return skb;
+	return __netdev_alloc_skb(NULL, length, gfp_mask);
 }
 
 /**
@@ -1124,9 +1141,6 @@ static inline struct sk_buff *dev_alloc_skb(unsigned int length)
 	return __dev_alloc_skb(length, GFP_ATOMIC);
 }
 
-extern struct sk_buff *__netdev_alloc_skb(struct net_device *dev,
-		unsigned int length, gfp_t gfp_mask);
-
 /**
  *	netdev_alloc_skb - allocate an skbuff for rx on a specific device
  *	@dev: network device to receive on
@@ -1146,6 +1160,29 @@ static inline struct sk_buff *netdev_alloc_skb(struct net_device *dev,
 	return __netdev_alloc_skb(dev, length, GFP_ATOMIC);
 }
 
+/*
+ *	Driver skb recycling: a driver hands the skbs its tx ring is done
+ *	with to skb_recycle() and refills its rx ring with
+ *	skb_recycle_alloc(), which gets them back, reset, on the same cpu
+ *	instead of through the slab.  Each cpu keeps at most @max of them.
+ */
+struct skb_recycle_pool;
+
+struct skb_recycle_stats {
+	unsigned long	recycled;	/* taken back by skb_recycle() */
+	unsigned long	reused;		/* handed out by skb_recycle_alloc() */
+	unsigned long	full;		/* refused, the cpu's cache was full */
+};
+
+extern struct skb_recycle_pool *skb_recycle_pool_create(unsigned int skb_size,
+							 unsigned int max);
+extern void skb_recycle_pool_destroy(struct skb_recycle_pool *pool);
+extern int skb_recycle(struct skb_recycle_pool *pool, struct sk_buff *skb);
+extern struct sk_buff *skb_recycle_alloc(struct skb_recycle_pool *pool,
+					 struct net_device *dev);
+extern void skb_recycle_pool_stats(struct skb_recycle_pool *pool,
+				   struct skb_recycle_stats *stats);
+
 /**
  *	skb_cow - copy header of skb when it is required
  *	@skb: buffer to cow
@@ -1340,6 +1377,9 @@ extern int	       skb_copy_bits(const struct sk_buff *skb, int offset,
 				     void *to, int len);
 extern int	       skb_store_bits(const struct sk_buff *skb, int offset,
 				      void *from, int len);
+struct pipe_inode_info;
+extern int	       skb_splice_bits(const struct sk_buff *skb, int offset,
+				       struct pipe_inode_info *pipe, int len);
 extern unsigned int    skb_copy_and_csum_bits(const struct sk_buff *skb,
 					      int offset, u8 *to, int len,
 					      unsigned int csum);
@@ -1348,6 +1388,7 @@ extern void	       skb_split(struct sk_buff *skb,
 				 struct sk_buff *skb1, const u32 len);
 
 extern struct sk_buff *skb_segment(struct sk_buff *skb, int features);
+extern int	       skb_gro_receive(struct sk_buff *p, struct sk_buff *skb);
 
 static inline void *skb_header_pointer(const struct sk_buff *skb, int offset,
 				       int len, void *buffer)
@@ -16,6 +16,7 @@
 #include <linux/slab.h>
 #include <asm/atomic.h>
 #include <linux/proc_fs.h>
+#include <linux/rcupdate.h>
 
 /*
  * Each cache requires:
@@ -38,6 +39,11 @@
  * in the hash table.
  * We only expire entries when refcount is zero.
  * Existance in the cache is counted  the refcount.
+ *
+ * sunrpc_cache_lookup() walks the hash chains under rcu_read_lock() only,
+ * and calls 'match' on entries which may be on their way out.  So the
+ * 'put' function must leave whatever 'match' looks at, and the item
+ * itself, to be freed after a grace period (see h.rcu_head).
  */
 
 /* Every cache item has a common header that is used
@@ -52,6 +58,7 @@ struct cache_head {
 					 */
 	struct kref	ref;
 	unsigned long	flags;
+	struct rcu_head	rcu_head;	/* for the owner to free the item by */
 };
 #define	CACHE_VALID	0	/* Entry contains valid data */
 #define	CACHE_NEGATIVE	1	/* Negative entry - there is no match for the key */
@@ -154,6 +161,14 @@ static inline struct cache_head  *cache_get(struct cache_head *h)
 	return h;
 }
 
+/* A reference to an entry found under rcu_read_lock(), unless it is dying */
+static inline struct cache_head *cache_get_rcu(struct cache_head *h)
+{
+	if (atomic_inc_not_zero(&h->ref.refcount))
+		return h;
+	return NULL;
+}
+
 
 static inline void cache_put(struct cache_head *h, struct cache_detail *cd)
 {
@@ -32,6 +32,9 @@ struct rpc_portmap {
 
 struct rpc_inode;
 
+/* connections one client may spread its calls over */
+#define RPC_MAX_XPRTS		16
+
 /*
  * The high-level client handle
  */
@@ -39,6 +42,9 @@ struct rpc_clnt {
 	atomic_t		cl_count;	/* Number of clones */
 	atomic_t		cl_users;	/* number of references */
 	struct rpc_xprt *	cl_xprt;	/* transport */
+	struct rpc_xprt *	cl_xprts[RPC_MAX_XPRTS]; /* cl_xprt first */
+	unsigned int		cl_nxprts;
+	atomic_t		cl_next_xprt;	/* for the next task */
 	struct rpc_procinfo *	cl_procinfo;	/* procedure info */
 	u32			cl_maxproc;	/* max procedure number */
 
@@ -120,6 +126,8 @@ struct rpc_clnt *rpc_new_client(struct rpc_xprt *xprt, char *servname,
 struct rpc_clnt	*rpc_bind_new_program(struct rpc_clnt *,
 				struct rpc_program *, int);
 struct rpc_clnt *rpc_clone_client(struct rpc_clnt *);
+int		rpc_clnt_add_xprt(struct rpc_clnt *, struct rpc_xprt *);
+struct rpc_xprt	*rpc_clnt_pick_xprt(struct rpc_clnt *);
 int		rpc_shutdown_client(struct rpc_clnt *);
 int		rpc_destroy_client(struct rpc_clnt *);
 void		rpc_release_client(struct rpc_clnt *);
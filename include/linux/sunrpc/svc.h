@@ -16,6 +16,26 @@
 #include <linux/sunrpc/svcauth.h>
 #include <linux/wait.h>
 #include <linux/mm.h>
+#include <linux/timer.h>
+#include <linux/cache.h>
+
+/*
+ * RPC service thread pool.
+ *
+ * Each pool has its own list of idle threads and of sockets waiting for
+ * a thread, and its own lock.  Most services have a single pool, but
+ * a service created with svc_create_pooled() gets one pool per CPU or
+ * per NUMA node, with its threads bound to the CPUs of their pool.
+ * A socket is queued on the pool of the CPU that saw its data arrive,
+ * so unrelated CPUs do not bounce a shared lock around.
+ */
+struct svc_pool {
+	unsigned int		sp_id;		/* pool id */
+	spinlock_t		sp_lock;	/* protects all fields */
+	struct list_head	sp_threads;	/* idle server threads */
+	struct list_head	sp_sockets;	/* pending sockets */
+	unsigned int		sp_nrthreads;	/* # of threads in pool */
+} ____cacheline_aligned_in_smp;
 
 /*
  * RPC service.
@@ -23,16 +43,14 @@
  * An RPC service is a ``daemon,'' possibly multithreaded, which
  * receives and processes incoming RPC messages.
  * It has one or more transport sockets associated with it, and maintains
- * a list of idle threads waiting for input.
+ * one or more pools of idle threads waiting for input.
  *
  * We currently do not support more than one RPC program per daemon.
  */
 struct svc_serv {
-	struct list_head	sv_threads;	/* idle server threads */
-	struct list_head	sv_sockets;	/* pending sockets */
 	struct svc_program *	sv_program;	/* RPC program */
 	struct svc_stat *	sv_stats;	/* RPC statistics */
-	spinlock_t		sv_lock;
+	spinlock_t		sv_lock;	/* protects the socket lists */
 	unsigned int		sv_nrthreads;	/* # of server threads */
 	unsigned int		sv_bufsz;	/* datagram buffer size */
 	unsigned int		sv_xdrsize;	/* XDR buffer size */
@@ -40,8 +58,12 @@ struct svc_serv {
 	struct list_head	sv_permsocks;	/* all permanent sockets */
 	struct list_head	sv_tempsocks;	/* all temporary sockets */
 	int			sv_tmpcnt;	/* count of temporary sockets */
+	struct timer_list	sv_temptimer;	/* ages idle temporary sockets */
 
 	char *			sv_name;	/* service name */
+
+	unsigned int		sv_nrpools;	/* number of thread pools */
+	struct svc_pool *	sv_pools;	/* array of thread pools */
 };
 
 /*
@@ -115,6 +137,7 @@ struct svc_rqst {
 	int			rq_addrlen;
 
 	struct svc_serv *	rq_server;	/* RPC service definition */
+	struct svc_pool *	rq_pool;	/* thread pool */
 	struct svc_procedure *	rq_procinfo;	/* procedure info */
 	struct auth_ops *	rq_authop;	/* authentication flavour */
 	struct svc_cred		rq_cred;	/* auth info */
@@ -312,6 +335,7 @@ typedef void		(*svc_thread_fn)(struct svc_rqst *);
  * Function prototypes.
  */
 struct svc_serv *  svc_create(struct svc_program *, unsigned int);
+struct svc_serv *  svc_create_pooled(struct svc_program *, unsigned int);
 int		   svc_create_thread(svc_thread_fn, struct svc_serv *);
 void		   svc_exit_thread(struct svc_rqst *);
 void		   svc_destroy(struct svc_serv *);
@@ -319,5 +343,6 @@ int		   svc_process(struct svc_serv *, struct svc_rqst *);
 int		   svc_register(struct svc_serv *, int, unsigned short);
 void		   svc_wake_up(struct svc_serv *);
 void		   svc_reserve(struct svc_rqst *rqstp, int space);
+struct svc_pool *  svc_pool_for_cpu(struct svc_serv *serv, int cpu);
 
 #endif /* SUNRPC_SVC_H */
@@ -114,6 +114,7 @@ struct swap_extent {
 enum {
 	SWP_USED	= (1 << 0),	/* is slot in swap_info[] used? */
 	SWP_WRITEOK	= (1 << 1),	/* ok to write to this swap?	*/
+	SWP_BLKDEV	= (1 << 2),	/* swapping straight to a bdev */
 	SWP_ACTIVE	= (SWP_USED | SWP_WRITEOK),
 					/* add others here before... */
 	SWP_SCANNING	= (1 << 8),	/* refcount in scan_swap_map */
@@ -124,6 +125,21 @@ enum {
 #define SWAP_MAP_MAX	0x7fff
 #define SWAP_MAP_BAD	0x8000
 
+/*
+ * Swap slots are handed out a cluster at a time: each cpu takes a wholly
+ * free cluster off the device's list and allocates from it in order, so
+ * that what one cpu writes out goes to disk sequentially, and finding
+ * room never needs a scan of the swap_map.
+ */
+struct swap_cluster_info {
+	struct list_head list;		/* on free_clusters while count is 0 */
+	unsigned int count;		/* slots in use */
+};
+
+struct percpu_cluster {
+	unsigned int next;		/* next offset to try, 0 for none */
+};
+
 /*
  * The in-memory structure used to track swap areas.
  */
@@ -140,6 +156,9 @@ struct swap_info_struct {
 	unsigned int highest_bit;
 	unsigned int cluster_next;
 	unsigned int cluster_nr;
+	struct swap_cluster_info *cluster_info;	/* one per cluster */
+	struct list_head free_clusters;
+	struct percpu_cluster *percpu_cluster;	/* each cpu's current cluster */
 	unsigned int pages;
 	unsigned int max;
 	unsigned int inuse_pages;
@@ -158,6 +177,7 @@ struct swap_list_t {
 extern void out_of_memory(struct zonelist *zonelist, gfp_t gfp_mask, int order);
 
 /* linux/mm/memory.c */
+extern int sysctl_swap_vma_readahead;
 extern void swapin_readahead(swp_entry_t, unsigned long, struct vm_area_struct *);
 
 /* linux/mm/page_alloc.c */
@@ -187,6 +207,15 @@ extern int vm_swappiness;
 extern int remove_mapping(struct address_space *mapping, struct page *page);
 extern long vm_total_pages;
 
+/* linux/mm/vmpressure.c */
+#ifdef CONFIG_PROC_FS
+extern void vmpressure(unsigned long scanned, unsigned long reclaimed);
+#else
+static inline void vmpressure(unsigned long scanned, unsigned long reclaimed)
+{
+}
+#endif
+
 #ifdef CONFIG_NUMA
 extern int zone_reclaim_mode;
 extern int sysctl_min_unmapped_ratio;
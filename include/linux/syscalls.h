@@ -25,8 +25,10 @@ struct linux_dirent64;
 struct list_head;
 struct msgbuf;
 struct msghdr;
+struct mmsghdr;
 struct msqid_ds;
 struct new_utsname;
+struct perf_counter_attr;
 struct nfsctl_arg;
 struct __old_kernel_stat;
 struct pollfd;
@@ -417,6 +419,11 @@ asmlinkage long sys_recv(int, void __user *, size_t, unsigned);
 asmlinkage long sys_recvfrom(int, void __user *, size_t, unsigned,
 				struct sockaddr __user *, int __user *);
 asmlinkage long sys_recvmsg(int fd, struct msghdr __user *msg, unsigned flags);
+asmlinkage long sys_recvmmsg(int fd, struct mmsghdr __user *msg,
+			     unsigned int vlen, unsigned flags,
+			     struct timespec __user *timeout);
+asmlinkage long sys_sendmmsg(int fd, struct mmsghdr __user *msg,
+			     unsigned int vlen, unsigned flags);
 asmlinkage long sys_socket(int, int, int);
 asmlinkage long sys_socketpair(int, int, int, int __user *);
 asmlinkage long sys_socketcall(int call, unsigned long __user *args);
@@ -526,6 +533,29 @@ asmlinkage long compat_sys_move_pages(pid_t pid, unsigned long nr_page,
 				const int __user *nodes,
 				int __user *status,
 				int flags);
+asmlinkage ssize_t sys_process_vm_readv(pid_t pid,
+				const struct iovec __user *lvec,
+				unsigned long liovcnt,
+				const struct iovec __user *rvec,
+				unsigned long riovcnt,
+				unsigned long flags);
+asmlinkage ssize_t sys_process_vm_writev(pid_t pid,
+				const struct iovec __user *lvec,
+				unsigned long liovcnt,
+				const struct iovec __user *rvec,
+				unsigned long riovcnt,
+				unsigned long flags);
+asmlinkage long sys_signalfd(int ufd, sigset_t __user *user_mask,
+				size_t sizemask);
+asmlinkage long sys_eventfd(unsigned int count);
+asmlinkage long sys_timerfd_create(int clockid, int flags);
+asmlinkage long sys_timerfd_settime(int ufd, int flags,
+				const struct itimerspec __user *utmr,
+				struct itimerspec __user *otmr);
+asmlinkage long sys_timerfd_gettime(int ufd, struct itimerspec __user *otmr);
+asmlinkage long sys_perf_counter_open(struct perf_counter_attr __user *attr_uptr,
+				pid_t pid, int cpu, int group_fd,
+				unsigned long flags);
 asmlinkage long sys_mbind(unsigned long start, unsigned long len,
 				unsigned long mode,
 				unsigned long __user *nmask,
@@ -150,6 +150,9 @@ enum
 	KERN_IA64_UNALIGNED=72, /* int: ia64 unaligned userland trap enable */
 	KERN_COMPAT_LOG=73,	/* int: print compat layer  messages */
 	KERN_MAX_LOCK_DEPTH=74,
+	KERN_PRINTK_DROPPED=75,	/* ulong: messages dropped by printk */
+	KERN_SOFTIRQ_BUDGET=76,	/* int: usecs __do_softirq may run for */
+	KERN_SHM_USE_HUGEPAGES=77, /* int: back SysV shm with huge pages */
 };
 
 
@@ -191,6 +194,12 @@ enum
 	VM_MIN_UNMAPPED=32,	/* Set min percent of unmapped pages */
 	VM_PANIC_ON_OOM=33,	/* panic at out-of-memory */
 	VM_VDSO_ENABLED=34,	/* map VDSO into new processes? */
+	VM_COMPACT_MEMORY=35,	/* compact all zones */
+	VM_FORK_SHARE_PAGE_TABLES=36, /* share anon page tables at fork */
+	VM_SWAP_VMA_READAHEAD=37, /* swap readahead by virtual address */
+	VM_NUMA_BALANCING=38,	/* automatic NUMA page/task placement */
+	VM_NUMA_BALANCING_SCAN_PERIOD_MS=39, /* knumad sampling interval */
+	VM_NUMA_BALANCING_SCAN_SIZE_MB=40, /* memory sampled per interval */
 };
 
 
@@ -269,6 +278,8 @@ enum
 	NET_CORE_BUDGET=19,
 	NET_CORE_AEVENT_ETIME=20,
 	NET_CORE_AEVENT_RSEQTH=21,
+	NET_CORE_BPF_JIT_ENABLE=22,
+	NET_CORE_BUSY_READ=23,
 };
 
 /* /proc/sys/net/ethernet */
@@ -433,6 +444,7 @@ enum {
 	NET_IPV4_ROUTE_MIN_ADVMSS=17,
 	NET_IPV4_ROUTE_SECRET_INTERVAL=18,
 	NET_IPV4_ROUTE_GC_MIN_INTERVAL_MS=19,
+	NET_IPV4_ROUTE_NOCACHE=20,
 };
 
 enum
@@ -794,6 +806,7 @@ enum
 	FS_AIO_NR=18,	/* current system-wide number of aio requests */
 	FS_AIO_MAX_NR=19,	/* system-wide maximum number of aio requests */
 	FS_INOTIFY=20,	/* inotify submenu */
+	FS_PIPE_MAX_SIZE=21,	/* int: maximum pipe size for users */
 };
 
 /* /proc/sys/fs/quota/ */
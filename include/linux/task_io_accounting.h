@@ -0,0 +1,23 @@
+/*
+ * task_io_accounting: what a single task did to storage.
+ *
+ * read_bytes is counted when reads are submitted, write_bytes when pages
+ * get dirtied (or direct writes are submitted), and cancelled_write_bytes
+ * when dirty pages are truncated before they were written back - so the
+ * writes a task really caused are write_bytes - cancelled_write_bytes.
+ */
+#ifndef _LINUX_TASK_IO_ACCOUNTING_H
+#define _LINUX_TASK_IO_ACCOUNTING_H
+
+#ifdef CONFIG_TASK_IO_ACCOUNTING
+struct task_io_accounting {
+	u64 read_bytes;
+	u64 write_bytes;
+	u64 cancelled_write_bytes;
+};
+#else
+struct task_io_accounting {
+};
+#endif
+
+#endif
@@ -29,7 +29,10 @@
  *	c) add new fields after version comment; maintain 64-bit alignment
  */
 
-#define TASKSTATS_VERSION	1
+#define TASKSTATS_VERSION	2
+
+/* Buckets of the delay histograms, see below */
+#define TASKSTATS_DELAY_HIST	16
 
 struct taskstats {
 
@@ -88,6 +91,41 @@ struct taskstats {
 	__u64	cpu_run_virtual_total;
 	/* Delay accounting fields end */
 	/* version 1 ends here */
+
+	/* Version 2 */
+
+	/* Bytes read and written by read and write syscalls, and the
+	 * number of those syscalls. Whatever was served by the page
+	 * cache counts here too.
+	 */
+	__u64	read_char;
+	__u64	write_char;
+	__u64	read_syscalls;
+	__u64	write_syscalls;
+
+	/* Storage I/O accounting fields start
+	 *
+	 * Only available if I/O accounting is enabled.
+	 *
+	 * read_bytes: reads submitted to block devices
+	 * write_bytes: pages dirtied in the page cache, and direct writes
+	 * cancelled_write_bytes: dirty pages truncated before writeback,
+	 *	so they never got written after all
+	 */
+	__u64	read_bytes;
+	__u64	write_bytes;
+	__u64	cancelled_write_bytes;
+	/* Storage I/O accounting fields end */
+
+	/* Delay histograms, only available if they are enabled along
+	 * with delay accounting.
+	 *
+	 * Bucket 0 counts the delays below 2^14 nsecs (16us), bucket n
+	 * those below 2^(14+n) nsecs, and the last bucket all longer ones.
+	 */
+	__u32	blkio_delay_hist[TASKSTATS_DELAY_HIST];
+	__u32	swapin_delay_hist[TASKSTATS_DELAY_HIST];
+	/* version 2 ends here */
 };
 
 
@@ -155,6 +155,8 @@ struct tcp_info
 	__u32	tcpi_rcv_space;
 
 	__u32	tcpi_total_retrans;
+
+	__u32	tcpi_snd_size_goal;	/* Bytes queued per TSO frame */
 };
 
 #ifdef __KERNEL__
@@ -310,6 +312,14 @@ struct tcp_sock {
 	int     retransmit_cnt_hint;
 	int     forward_cnt_hint;
 
+	/* SACK scoreboard index: the skb at which each block of the
+	 * previous slow-path SACK started, so that later walks can start
+	 * near the block instead of at the head of the retransmit queue.
+	 */
+	struct sk_buff *sack_skb_hint[4];
+	int	sack_cnt_hint[4];
+	u32	sack_scanned;	/* skbs walked by the last sacktag pass	*/
+
 	__u16	advmss;		/* Advertised MSS			*/
 	__u16	prior_ssthresh; /* ssthresh saved at recovery start	*/
 	__u32	lost_out;	/* Lost packets			*/
@@ -0,0 +1,13 @@
+/*
+ *  include/linux/timerfd.h
+ *
+ *  timerfd: hrtimers whose expirations are read from a file descriptor.
+ */
+
+#ifndef _LINUX_TIMERFD_H
+#define _LINUX_TIMERFD_H
+
+/* timerfd_settime() flags: it_value is an absolute time on the clock */
+#define TFD_TIMER_ABSTIME	(1 << 0)
+
+#endif /* _LINUX_TIMERFD_H */
@@ -0,0 +1,39 @@
+#ifndef _LINUX_TRACE_BUFFER_H
+#define _LINUX_TRACE_BUFFER_H
+
+/*
+ * Per cpu ring buffers for trace records.
+ *
+ * Records are written into the buffer of the cpu they happen on, with
+ * no lock taken: only that cpu writes there, with interrupts off, and
+ * the reader owns what lies between its tail and the writer's head.  A
+ * record that does not fit is dropped whole and counted, so that what
+ * is read stays a stream of whole records.
+ */
+
+#include <linux/types.h>
+#include <linux/threads.h>
+#include <linux/mutex.h>
+
+struct trace_cpu_buffer {
+	unsigned long head;		/* bytes written, by the writer */
+	unsigned long tail;		/* bytes read, by the reader */
+	unsigned long dropped;		/* records that did not fit */
+	struct mutex reader_mutex;
+	char *data;
+};
+
+struct trace_buffer {
+	unsigned long size;		/* of each cpu's, a power of 2 */
+	struct trace_cpu_buffer *buffers[NR_CPUS];
+};
+
+extern struct trace_buffer *trace_buffer_alloc(unsigned long size);
+extern void trace_buffer_free(struct trace_buffer *buffer);
+extern int trace_buffer_write(struct trace_buffer *buffer,
+			      const void *data, unsigned int len);
+extern ssize_t trace_buffer_read(struct trace_buffer *buffer, int cpu,
+				 char __user *ubuf, size_t cnt);
+extern unsigned long trace_buffer_dropped(struct trace_buffer *buffer);
+
+#endif /* _LINUX_TRACE_BUFFER_H */
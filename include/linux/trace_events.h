@@ -0,0 +1,123 @@
+#ifndef _LINUX_TRACE_EVENTS_H
+#define _LINUX_TRACE_EVENTS_H
+
+#include <linux/types.h>
+
+/*
+ * Event trace records, as read from the per cpu files of debugfs
+ * trace/cpu<N> (CONFIG_EVENT_TRACE).  Each file is a stream of the
+ * records written on that cpu, oldest first, every one starting with a
+ * struct trace_entry whose size gives where the next one starts.  A
+ * record that finds the buffer of its cpu full is dropped whole, and
+ * counted in trace/dropped.
+ *
+ * The events traced are chosen by writing a mask of (1 << type) to
+ * trace/enabled.
+ */
+
+enum trace_event_type {
+	TRACE_SCHED_SWITCH = 1,		/* struct trace_sched_switch */
+	TRACE_SCHED_WAKEUP,		/* struct trace_sched_wakeup */
+	TRACE_BLOCK_RQ_ISSUE,		/* struct trace_block_rq */
+	TRACE_BLOCK_RQ_COMPLETE,	/* struct trace_block_rq */
+	TRACE_NET_DEV_XMIT,		/* struct trace_net_dev */
+	TRACE_NET_DEV_RECEIVE,		/* struct trace_net_dev */
+	TRACE_MM_PAGE_ALLOC,		/* struct trace_mm_page */
+	TRACE_MM_PAGE_FREE,		/* struct trace_mm_page */
+
+	TRACE_NR_EVENTS
+};
+
+struct trace_entry {
+	__u16 type;			/* enum trace_event_type */
+	__u16 size;			/* of the record, this included */
+	__u32 pid;			/* current when it was written */
+	__u64 time;			/* sched_clock() */
+};
+
+struct trace_sched_switch {
+	struct trace_entry ent;
+	__u32 prev_pid;
+	__u32 next_pid;
+	__s32 prev_prio;
+	__s32 next_prio;
+	__s64 prev_state;		/* TASK_* of the task going out */
+};
+
+struct trace_sched_wakeup {
+	struct trace_entry ent;
+	__u32 pid;
+	__s32 prio;
+	__u32 cpu;			/* whose runqueue it is on */
+	__u32 success;			/* 0 if it was awake already */
+};
+
+struct trace_block_rq {
+	struct trace_entry ent;
+	__u64 sector;
+	__u32 dev;			/* new_encode_dev() of the disk */
+	__u32 nr_sectors;
+	__u32 flags;			/* REQ_* of the request */
+	__s32 errors;
+};
+
+struct trace_net_dev {
+	struct trace_entry ent;
+	__u32 ifindex;
+	__u32 len;			/* of the packet */
+	__u16 protocol;			/* ETH_P_*, network order */
+	__u16 pad[3];
+};
+
+struct trace_mm_page {
+	struct trace_entry ent;
+	__u64 pfn;			/* -1 for a failed allocation */
+	__u32 order;
+	__u32 gfp_flags;		/* 0 for a free */
+};
+
+#ifdef __KERNEL__
+
+#include <linux/tracepoint.h>
+
+struct task_struct;
+struct request_queue;
+struct request;
+struct sk_buff;
+struct page;
+
+DECLARE_TRACE(sched_switch,
+	TPPROTO(struct task_struct *prev, struct task_struct *next),
+	TPARGS(prev, next));
+
+DECLARE_TRACE(sched_wakeup,
+	TPPROTO(struct task_struct *p, int success),
+	TPARGS(p, success));
+
+DECLARE_TRACE(block_rq_issue,
+	TPPROTO(struct request_queue *q, struct request *rq),
+	TPARGS(q, rq));
+
+DECLARE_TRACE(block_rq_complete,
+	TPPROTO(struct request_queue *q, struct request *rq),
+	TPARGS(q, rq));
+
+DECLARE_TRACE(net_dev_xmit,
+	TPPROTO(struct sk_buff *skb),
+	TPARGS(skb));
+
+DECLARE_TRACE(net_dev_receive,
+	TPPROTO(struct sk_buff *skb),
+	TPARGS(skb));
+
+DECLARE_TRACE(mm_page_alloc,
+	TPPROTO(struct page *page, unsigned int order, gfp_t gfp_flags),
+	TPARGS(page, order, gfp_flags));
+
+DECLARE_TRACE(mm_page_free,
+	TPPROTO(struct page *page, unsigned int order),
+	TPARGS(page, order));
+
+#endif /* __KERNEL__ */
+
+#endif /* _LINUX_TRACE_EVENTS_H */
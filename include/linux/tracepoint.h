@@ -0,0 +1,101 @@
+#ifndef _LINUX_TRACEPOINT_H
+#define _LINUX_TRACEPOINT_H
+
+/*
+ * Static tracepoints (CONFIG_TRACEPOINTS).
+ *
+ * A tracepoint is declared with its prototype in a header:
+ *
+ *	DECLARE_TRACE(subsys_event,
+ *		TPPROTO(struct foo *foo, int bar),
+ *		TPARGS(foo, bar));
+ *
+ * defined once in the code it traces with DEFINE_TRACE(subsys_event),
+ * and called there as trace_subsys_event(foo, bar).  Probes are hooked
+ * on and off it with register_trace_subsys_event(probe) and
+ * unregister_trace_subsys_event(probe), and are called with preemption
+ * off, from whatever context the tracepoint is in.
+ *
+ * With no probe the call is a test of a flag that is not taken; without
+ * CONFIG_TRACEPOINTS it is nothing at all.
+ */
+
+#include <linux/types.h>
+#include <linux/compiler.h>
+#include <linux/errno.h>
+
+#define TPPROTO(args...)	args
+#define TPARGS(args...)		args
+
+#ifdef CONFIG_TRACEPOINTS
+
+#include <linux/preempt.h>
+#include <linux/rcupdate.h>
+#include <linux/module.h>
+
+struct tracepoint {
+	const char *name;
+	int state;		/* there are probes */
+	void **funcs;		/* NULL terminated, RCU-sched protected */
+};
+
+extern int tracepoint_probe_register(struct tracepoint *tp, void *probe);
+extern int tracepoint_probe_unregister(struct tracepoint *tp, void *probe);
+
+#define __DO_TRACE(tp, proto, args)					\
+	do {								\
+		void **it_func;						\
+									\
+		preempt_disable();					\
+		it_func = rcu_dereference((tp)->funcs);			\
+		if (it_func) {						\
+			do {						\
+				((void(*)(proto))(*it_func))(args);	\
+			} while (*(++it_func));				\
+		}							\
+		preempt_enable();					\
+	} while (0)
+
+#define DECLARE_TRACE(name, proto, args)				\
+	extern struct tracepoint __tracepoint_##name;			\
+	static inline void trace_##name(proto)				\
+	{								\
+		if (unlikely(__tracepoint_##name.state))		\
+			__DO_TRACE(&__tracepoint_##name,		\
+				TPPROTO(proto), TPARGS(args));		\
+	}								\
+	static inline int register_trace_##name(void (*probe)(proto))	\
+	{								\
+		return tracepoint_probe_register(&__tracepoint_##name,	\
+						 (void *)probe);	\
+	}								\
+	static inline int unregister_trace_##name(void (*probe)(proto))	\
+	{								\
+		return tracepoint_probe_unregister(&__tracepoint_##name,\
+						   (void *)probe);	\
+	}
+
+#define DEFINE_TRACE(name)						\
+	struct tracepoint __tracepoint_##name __read_mostly =		\
+		{ #name, 0, NULL };					\
+	EXPORT_SYMBOL_GPL(__tracepoint_##name)
+
+#else /* !CONFIG_TRACEPOINTS */
+
+#define DECLARE_TRACE(name, proto, args)				\
+	static inline void trace_##name(proto)				\
+	{ }								\
+	static inline int register_trace_##name(void (*probe)(proto))	\
+	{								\
+		return -ENOSYS;						\
+	}								\
+	static inline int unregister_trace_##name(void (*probe)(proto))	\
+	{								\
+		return -ENOSYS;						\
+	}
+
+#define DEFINE_TRACE(name)
+
+#endif /* CONFIG_TRACEPOINTS */
+
+#endif /* _LINUX_TRACEPOINT_H */
@@ -64,7 +64,7 @@ struct tty_bufhead {
 /*
  * The pty uses char_buf and flag_buf as a contiguous buffer
  */
-#define PTY_BUF_SIZE	4*TTY_FLIPBUF_SIZE
+#define PTY_BUF_SIZE	(16*TTY_FLIPBUF_SIZE)
 
 /*
  * When a break, frame error, or parity error happens, these codes are
@@ -225,6 +225,7 @@ struct tty_struct {
 	unsigned char *write_buf;
 	int write_cnt;
 	spinlock_t read_lock;
+	spinlock_t flip_write_lock;	/* pty: serializes writers into buf */
 	/* If the tty has a pending do_SAK, queue it here - akpm */
 	struct work_struct SAK_work;
 };
@@ -295,6 +296,7 @@ extern int tty_hung_up_p(struct file * filp);
 extern void do_SAK(struct tty_struct *tty);
 extern void disassociate_ctty(int priv);
 extern void tty_flip_buffer_push(struct tty_struct *tty);
+extern void tty_flush_to_ldisc(struct tty_struct *tty);
 extern int tty_get_baud_rate(struct tty_struct *tty);
 extern int tty_termios_baud_rate(struct termios *termios);
 
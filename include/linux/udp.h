@@ -37,6 +37,7 @@ struct udphdr {
 #ifdef __KERNEL__
 #include <linux/types.h>
 
+#include <linux/list_nulls.h>
 #include <net/inet_sock.h>
 
 struct udp_sock {
@@ -50,6 +51,9 @@ struct udp_sock {
 	 * when the socket is uncorked.
 	 */
 	__u16		 len;		/* total length of pending frames */
+	/* udp_hash2 chain of the local address and port */
+	unsigned int	 portaddr_hash;
+	struct hlist_nulls_node portaddr_node;
 };
 
 static inline struct udp_sock *udp_sk(const struct sock *sk)
@@ -29,7 +29,29 @@ enum vm_event_item { PGPGIN, PGPGOUT, PSWPIN, PSWPOUT,
 		FOR_ALL_ZONES(PGSCAN_KSWAPD),
 		FOR_ALL_ZONES(PGSCAN_DIRECT),
 		PGINODESTEAL, SLABS_SCANNED, KSWAPD_STEAL, KSWAPD_INODESTEAL,
-		PAGEOUTRUN, ALLOCSTALL, PGROTATED,
+		PAGEOUTRUN, ALLOCSTALL,
+		ALLOCSTALL_16US, ALLOCSTALL_64US, ALLOCSTALL_256US,
+		ALLOCSTALL_1MS, ALLOCSTALL_4MS, ALLOCSTALL_16MS,
+		ALLOCSTALL_64MS, ALLOCSTALL_256MS, ALLOCSTALL_1S,
+		ALLOCSTALL_LONGER,
+		PGROTATED,
+		PGLAZYFREE, PGLAZYFREED,
+#ifdef CONFIG_COMPACTION
+		COMPACTBLOCKS, COMPACTPAGES, COMPACTPAGEFAILED,
+		COMPACTSTALL, COMPACTFAIL, COMPACTSUCCESS,
+#endif
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+		THP_FAULT_ALLOC, THP_FAULT_FALLBACK,
+		THP_COLLAPSE_ALLOC, THP_COLLAPSE_ALLOC_FAILED,
+		THP_SPLIT,
+#endif
+#ifdef CONFIG_SPECULATIVE_PAGE_FAULT
+		SPECULATIVE_PGFAULT,
+#endif
+#ifdef CONFIG_NUMA_BALANCING
+		NUMA_PTE_UPDATES, NUMA_HINT_FAULTS, NUMA_HINT_FAULTS_LOCAL,
+		NUMA_PAGE_MIGRATE,
+#endif
 		NR_VM_EVENT_ITEMS
 };
 
@@ -54,14 +54,40 @@ struct execute_work {
 		init_timer(&(_work)->timer);			\
 	} while (0)
 
-extern struct workqueue_struct *__create_workqueue(const char *name,
-						    int singlethread);
-#define create_workqueue(name) __create_workqueue((name), 0)
-#define create_singlethread_workqueue(name) __create_workqueue((name), 1)
+/*
+ * the timer of a deferrable work does not wake up an idle cpu:
+ */
+#define INIT_WORK_DEFERRABLE(_work, _func, _data)		\
+	do {							\
+		INIT_WORK((_work), (_func), (_data));		\
+		init_timer_deferrable(&(_work)->timer);		\
+	} while (0)
+
+/*
+ * Workqueue flags and max_active, see alloc_workqueue().
+ */
+enum {
+	WQ_SINGLE_CPU		= 1 << 0, /* all works go to one cpu */
+	WQ_ORDERED		= 1 << 1, /* one at a time, in queueing order */
+	WQ_RESCUER		= 1 << 2, /* has a thread for memory reclaim */
+
+	WQ_MAX_ACTIVE		= 512,	  /* per cpu */
+	WQ_DFL_ACTIVE		= WQ_MAX_ACTIVE / 2,
+};
+
+extern struct workqueue_struct *alloc_workqueue(const char *name,
+						unsigned int flags,
+						int max_active);
+#define create_workqueue(name)					\
+	alloc_workqueue((name), WQ_RESCUER, 1)
+#define create_singlethread_workqueue(name)			\
+	alloc_workqueue((name), WQ_ORDERED | WQ_RESCUER, 1)
 
 extern void destroy_workqueue(struct workqueue_struct *wq);
 
 extern int FASTCALL(queue_work(struct workqueue_struct *wq, struct work_struct *work));
+extern int queue_work_on(int cpu, struct workqueue_struct *wq,
+	struct work_struct *work);
 extern int FASTCALL(queue_delayed_work(struct workqueue_struct *wq, struct work_struct *work, unsigned long delay));
 extern int queue_delayed_work_on(int cpu, struct workqueue_struct *wq,
 	struct work_struct *work, unsigned long delay);
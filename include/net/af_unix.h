@@ -8,6 +8,7 @@
 
 extern void unix_inflight(struct file *fp);
 extern void unix_notinflight(struct file *fp);
+extern void unix_gc_barrier(void);
 extern void unix_gc(void);
 
 #define UNIX_HASH_SIZE	256
@@ -81,8 +82,9 @@ struct unix_sock {
 	struct mutex		readlock;
         struct sock		*peer;
         struct sock		*other;
-        struct sock		*gc_tree;
         atomic_t                inflight;
+	struct list_head	link;		/* in flight, or gc candidate */
+	unsigned int		gc_candidate : 1;
         spinlock_t		lock;
         wait_queue_head_t       peer_wait;
 };
@@ -0,0 +1,41 @@
+/*
+ * Low latency receive by busy polling.
+ *
+ * A receiver that finds its socket queue empty polls the rx ring of the
+ * device the socket's last packet came in on, for up to sk_ll_usec
+ * microseconds, instead of going to sleep and waiting for the interrupt,
+ * the softirq and the wakeup.  Packets found that way go up the stack as
+ * usual, from the receiver's own context.
+ *
+ * Drivers opt in with dev->busy_poll; sockets with SO_BUSY_POLL, or for
+ * all sockets through net.core.busy_read.
+ */
+#ifndef _NET_BUSY_POLL_H
+#define _NET_BUSY_POLL_H
+
+#include <linux/netdevice.h>
+#include <linux/sched.h>
+#include <net/sock.h>
+
+extern int sysctl_net_busy_read;
+
+/* rx packets a busy poll takes at a time, NAPI weight is 64 */
+#define BUSY_POLL_BUDGET	8
+
+static inline int sk_can_busy_loop(const struct sock *sk)
+{
+	return sk->sk_ll_usec && sk->sk_rx_ifindex && !signal_pending(current);
+}
+
+/* Called as a packet is delivered to sk: remember where to poll. */
+static inline void sk_mark_rx_dev(struct sock *sk, const struct sk_buff *skb)
+{
+	int ifindex = skb->input_dev ? skb->input_dev->ifindex : 0;
+
+	if (unlikely(sk->sk_rx_ifindex != ifindex))
+		sk->sk_rx_ifindex = ifindex;
+}
+
+extern int sk_busy_loop(struct sock *sk, int nonblock);
+
+#endif /* _NET_BUSY_POLL_H */
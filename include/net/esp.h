@@ -5,49 +5,85 @@
 #include <asm/scatterlist.h>
 
 #define ESP_NUM_FAST_SG		4
+#define ESP_MAX_CTX		8
 
-struct esp_data
+/*
+ * The transforms keep the IV and the hash state of the packet being
+ * worked on, so one CPU at a time may use them.  Each SA has a set of
+ * them per online CPU, up to ESP_MAX_CTX, and the crypto runs under the
+ * context's lock instead of x->lock.  An asynchronous cipher does its
+ * own queueing and gets a single context.
+ */
+struct esp_ctx
 {
+	spinlock_t			lock;
 	struct scatterlist		sgbuf[ESP_NUM_FAST_SG];
+	struct crypto_tfm		*tfm;		/* cipher */
+	u8				*ivec;		/* ivec buffer */
+	struct crypto_tfm		*auth_tfm;
+	u8				*work_icv;
+};
 
+struct esp_data
+{
 	/* Confidentiality */
 	struct {
 		u8			*key;		/* Key */
-		int			key_len;	/* Key length */
-		u8			*ivec;		/* ivec buffer */
+		int			key_len;	/* Length of the key */
 		/* ivlen is offset from enc_data, where encrypted data start.
 		 * It is logically different of crypto_tfm_alg_ivsize(tfm).
 		 * We assume that it is either zero (no ivec), or
 		 * >= crypto_tfm_alg_ivsize(tfm). */
 		int			ivlen;
 		int			padlen;		/* 0..255 */
-		struct crypto_tfm	*tfm;		/* crypto handle */
+		struct crypto_tfm	*tfm;		/* ctx[0]'s, for sizes */
 	} conf;
 
 	/* Integrity. It is active when icv_full_len != 0 */
 	struct {
 		u8			*key;		/* Key */
 		int			key_len;	/* Length of the key */
-		u8			*work_icv;
 		int			icv_full_len;
 		int			icv_trunc_len;
 		void			(*icv)(struct esp_data*,
+					       struct esp_ctx *ctx,
 		                               struct sk_buff *skb,
 		                               int offset, int len, u8 *icv);
-		struct crypto_tfm	*tfm;
 	} auth;
+
+	int				nctx;
+	struct esp_ctx			ctx[0];
 };
 
 extern int skb_to_sgvec(struct sk_buff *skb, struct scatterlist *sg, int offset, int len);
 extern int skb_cow_data(struct sk_buff *skb, int tailbits, struct sk_buff **trailer);
 extern void *pskb_put(struct sk_buff *skb, struct sk_buff *tail, int len);
 
+extern struct esp_data *esp_alloc_data(struct xfrm_state *x, u32 cipher_flags);
+extern void esp_free_data(struct esp_data *esp);
+
+/* Pick this CPU's context and lock it, with BHs disabled */
+static inline struct esp_ctx *esp_get_ctx(struct esp_data *esp)
+{
+	struct esp_ctx *ctx;
+
+	local_bh_disable();
+	ctx = &esp->ctx[smp_processor_id() % esp->nctx];
+	spin_lock(&ctx->lock);
+	return ctx;
+}
+
+static inline void esp_put_ctx(struct esp_ctx *ctx)
+{
+	spin_unlock_bh(&ctx->lock);
+}
+
 static inline void
-esp_hmac_digest(struct esp_data *esp, struct sk_buff *skb, int offset,
-                int len, u8 *auth_data)
+esp_hmac_digest(struct esp_data *esp, struct esp_ctx *ctx,
+		struct sk_buff *skb, int offset, int len, u8 *auth_data)
 {
-	struct crypto_tfm *tfm = esp->auth.tfm;
-	char *icv = esp->auth.work_icv;
+	struct crypto_tfm *tfm = ctx->auth_tfm;
+	char *icv = ctx->work_icv;
 
 	memset(auth_data, 0, esp->auth.icv_trunc_len);
 	crypto_hmac_init(tfm, esp->auth.key, &esp->auth.key_len);
@@ -88,8 +88,20 @@ struct sock;
 typedef void (*flow_resolve_t)(struct flowi *key, u32 sk_sid, u16 family, u8 dir,
 			       void **objp, atomic_t **obj_refp);
 
+/*
+ * The owner of the cached objects: ->resolve() finds the object for a
+ * flow and holds a reference for the caller, ->check() says whether a
+ * cached object may still be handed out, ->put() drops a reference the
+ * cache took on it.
+ */
+struct flow_cache_ops {
+	flow_resolve_t	resolve;
+	int		(*check)(void *obj);
+	void		(*put)(void *obj);
+};
+
 extern void *flow_cache_lookup(struct flowi *key, u32 sk_sid, u16 family, u8 dir,
-	 		       flow_resolve_t resolver);
+	 		       struct flow_cache_ops *ops);
 extern void flow_cache_flush(void);
 extern atomic_t flow_cache_genid;
 
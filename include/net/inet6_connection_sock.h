@@ -13,6 +13,7 @@
 #ifndef _INET6_CONNECTION_SOCK_H
 #define _INET6_CONNECTION_SOCK_H
 
+#include <linux/spinlock.h>
 #include <linux/types.h>
 
 struct in6_addr;
@@ -32,6 +33,10 @@ extern struct request_sock *inet6_csk_search_req(const struct sock *sk,
 						 const struct in6_addr *laddr,
 						 const int iif);
 
+extern spinlock_t *inet6_csk_syn_lock(const struct sock *sk,
+				      const __u16 rport,
+				      const struct in6_addr *raddr);
+
 extern void inet6_csk_reqsk_queue_hash_add(struct sock *sk,
 					   struct request_sock *req,
 					   const unsigned long timeout);
@@ -63,6 +63,8 @@ extern struct sock *__inet6_lookup_established(struct inet_hashinfo *hashinfo,
 					   const int dif);
 
 extern struct sock *inet6_lookup_listener(struct inet_hashinfo *hashinfo,
+					  const struct in6_addr *saddr,
+					  const u16 sport,
 					  const struct in6_addr *daddr,
 					  const unsigned short hnum,
 					  const int dif);
@@ -79,7 +81,7 @@ static inline struct sock *__inet6_lookup(struct inet_hashinfo *hashinfo,
 	if (sk)
 		return sk;
 
-	return inet6_lookup_listener(hashinfo, daddr, hnum, dif);
+	return inet6_lookup_listener(hashinfo, saddr, sport, daddr, hnum, dif);
 }
 
 extern struct sock *inet6_lookup(struct inet_hashinfo *hashinfo,
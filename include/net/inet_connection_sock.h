@@ -240,6 +240,10 @@ extern struct request_sock *inet_csk_search_req(const struct sock *sk,
 						const __u16 rport,
 						const __u32 raddr,
 						const __u32 laddr);
+extern spinlock_t *inet_csk_syn_lock(const struct sock *sk,
+				     const __u16 rport, const __u32 raddr);
+extern int inet_csk_reuseport_ok(const struct sock *sk2, const int reuseport,
+				 const uid_t uid);
 extern int inet_csk_bind_conflict(const struct sock *sk,
 				  const struct inet_bind_bucket *tb);
 extern int inet_csk_get_port(struct inet_hashinfo *hashinfo,
@@ -261,11 +265,15 @@ extern void inet_csk_reqsk_queue_hash_add(struct sock *sk,
 					  struct request_sock *req,
 					  unsigned long timeout);
 
+/*
+ * The SYN-ACK timer is not stopped when the last request goes, it could
+ * race with a request added on another cpu: inet_csk_reqsk_queue_prune()
+ * lets it lapse once it finds the queue empty.
+ */
 static inline void inet_csk_reqsk_queue_removed(struct sock *sk,
 						struct request_sock *req)
 {
-	if (reqsk_queue_removed(&inet_csk(sk)->icsk_accept_queue, req) == 0)
-		inet_csk_delete_keepalive_timer(sk);
+	reqsk_queue_removed(&inet_csk(sk)->icsk_accept_queue, req);
 }
 
 static inline void inet_csk_reqsk_queue_added(struct sock *sk,
@@ -18,6 +18,7 @@
 #include <linux/interrupt.h>
 #include <linux/ipv6.h>
 #include <linux/list.h>
+#include <linux/rcupdate.h>
 #include <linux/slab.h>
 #include <linux/socket.h>
 #include <linux/spinlock.h>
@@ -88,9 +89,16 @@ struct inet_bind_hashbucket {
 	struct hlist_head	chain;
 };
 
-/* This is for listening sockets, thus all sockets which possess wildcards. */
+/* This is for listening sockets, thus all sockets which possess wildcards.
+ * Lookups walk a chain under RCU, the lock only serializes its writers.
+ */
 #define INET_LHTABLE_SIZE	32	/* Yes, really, this is all you need. */
 
+struct inet_listen_hashbucket {
+	spinlock_t		lock;
+	struct hlist_head	head;
+};
+
 struct inet_hashinfo {
 	/* This is for sockets with full identity only.  Sockets here will
 	 * always be without wildcards and will have the following invariant:
@@ -114,17 +122,8 @@ struct inet_hashinfo {
 	 * table where wildcard'd TCP sockets can exist.  Hash function here
 	 * is just local port number.
 	 */
-	struct hlist_head		listening_hash[INET_LHTABLE_SIZE];
+	struct inet_listen_hashbucket	listening_hash[INET_LHTABLE_SIZE];
 
-	/* All the above members are written once at bootup and
-	 * never written again _or_ are predominantly read-access.
-	 *
-	 * Now align to a new cache line as all the following members
-	 * are often dirty.
-	 */
-	rwlock_t			lhash_lock ____cacheline_aligned;
-	atomic_t			lhash_users;
-	wait_queue_head_t		lhash_wait;
 	kmem_cache_t			*bind_bucket_cachep;
 };
 
@@ -135,6 +134,8 @@ static inline struct inet_ehash_bucket *inet_ehash_bucket(
 	return &hashinfo->ehash[hash & (hashinfo->ehash_size - 1)];
 }
 
+extern void inet_hashinfo_init(struct inet_hashinfo *hashinfo);
+
 extern struct inet_bind_bucket *
 		    inet_bind_bucket_create(kmem_cache_t *cachep,
 					    struct inet_bind_hashbucket *head,
@@ -161,6 +162,13 @@ static inline int inet_sk_listen_hashfn(const struct sock *sk)
 	return inet_lhashfn(inet_sk(sk)->num);
 }
 
+static inline struct inet_listen_hashbucket *
+		inet_sk_listen_bucket(struct inet_hashinfo *hashinfo,
+				      const struct sock *sk)
+{
+	return &hashinfo->listening_hash[inet_sk_listen_hashfn(sk)];
+}
+
 /* Caller must disable local BH processing. */
 static inline void __inet_inherit_port(struct inet_hashinfo *table,
 				       struct sock *sk, struct sock *child)
@@ -186,51 +194,39 @@ static inline void inet_inherit_port(struct inet_hashinfo *table,
 
 extern void inet_put_port(struct inet_hashinfo *table, struct sock *sk);
 
-extern void inet_listen_wlock(struct inet_hashinfo *hashinfo);
-
 /*
- * - We may sleep inside this lock.
- * - If sleeping is not required (or called from BH),
- *   use plain read_(un)lock(&inet_hashinfo.lhash_lock).
+ * Listening sockets must have SOCK_RCU_FREE set before they are hashed.
+ * Caller must disable local BH processing.
  */
-static inline void inet_listen_lock(struct inet_hashinfo *hashinfo)
+static inline void __inet_hash_listen(struct inet_hashinfo *hashinfo,
+				      struct sock *sk)
 {
-	/* read_lock synchronizes to candidates to writers */
-	read_lock(&hashinfo->lhash_lock);
-	atomic_inc(&hashinfo->lhash_users);
-	read_unlock(&hashinfo->lhash_lock);
-}
+	struct inet_listen_hashbucket *ilb = inet_sk_listen_bucket(hashinfo, sk);
 
-static inline void inet_listen_unlock(struct inet_hashinfo *hashinfo)
-{
-	if (atomic_dec_and_test(&hashinfo->lhash_users))
-		wake_up(&hashinfo->lhash_wait);
+	BUG_TRAP(sock_flag(sk, SOCK_RCU_FREE));
+	spin_lock(&ilb->lock);
+	__sk_add_node_rcu(sk, &ilb->head);
+	sock_prot_inc_use(sk->sk_prot);
+	spin_unlock(&ilb->lock);
 }
 
 static inline void __inet_hash(struct inet_hashinfo *hashinfo,
 			       struct sock *sk, const int listen_possible)
 {
-	struct hlist_head *list;
-	rwlock_t *lock;
+	struct inet_ehash_bucket *head;
 
 	BUG_TRAP(sk_unhashed(sk));
 	if (listen_possible && sk->sk_state == TCP_LISTEN) {
-		list = &hashinfo->listening_hash[inet_sk_listen_hashfn(sk)];
-		lock = &hashinfo->lhash_lock;
-		inet_listen_wlock(hashinfo);
-	} else {
-		struct inet_ehash_bucket *head;
-		sk->sk_hash = inet_sk_ehashfn(sk);
-		head = inet_ehash_bucket(hashinfo, sk->sk_hash);
-		list = &head->chain;
-		lock = &head->lock;
-		write_lock(lock);
+		__inet_hash_listen(hashinfo, sk);
+		return;
 	}
-	__sk_add_node(sk, list);
+
+	sk->sk_hash = inet_sk_ehashfn(sk);
+	head = inet_ehash_bucket(hashinfo, sk->sk_hash);
+	write_lock(&head->lock);
+	__sk_add_node(sk, &head->chain);
 	sock_prot_inc_use(sk->sk_prot);
-	write_unlock(lock);
-	if (listen_possible && sk->sk_state == TCP_LISTEN)
-		wake_up(&hashinfo->lhash_wait);
+	write_unlock(&head->lock);
 }
 
 static inline void inet_hash(struct inet_hashinfo *hashinfo, struct sock *sk)
@@ -247,23 +243,25 @@ static inline void inet_unhash(struct inet_hashinfo *hashinfo, struct sock *sk)
 	rwlock_t *lock;
 
 	if (sk_unhashed(sk))
-		goto out;
+		return;
 
 	if (sk->sk_state == TCP_LISTEN) {
-		local_bh_disable();
-		inet_listen_wlock(hashinfo);
-		lock = &hashinfo->lhash_lock;
-	} else {
-		lock = &inet_ehash_bucket(hashinfo, sk->sk_hash)->lock;
-		write_lock_bh(lock);
+		struct inet_listen_hashbucket *ilb =
+			inet_sk_listen_bucket(hashinfo, sk);
+
+		/* Lookups may still walk through it, sk_free() waits */
+		spin_lock_bh(&ilb->lock);
+		if (__sk_del_node_init_rcu(sk))
+			sock_prot_dec_use(sk->sk_prot);
+		spin_unlock_bh(&ilb->lock);
+		return;
 	}
 
+	lock = &inet_ehash_bucket(hashinfo, sk->sk_hash)->lock;
+	write_lock_bh(lock);
 	if (__sk_del_node_init(sk))
 		sock_prot_dec_use(sk->sk_prot);
 	write_unlock_bh(lock);
-out:
-	if (sk->sk_state == TCP_LISTEN)
-		wake_up(&hashinfo->lhash_wait);
 }
 
 static inline int inet_iif(const struct sk_buff *skb)
@@ -272,36 +270,48 @@ static inline int inet_iif(const struct sk_buff *skb)
 }
 
 extern struct sock *__inet_lookup_listener(const struct hlist_head *head,
+					   const u32 saddr, const u16 sport,
 					   const u32 daddr,
 					   const unsigned short hnum,
 					   const int dif);
 
-/* Optimize the common listener case. */
+/*
+ * Optimize the common listener case.  The chain is walked under RCU, a
+ * listener going away meanwhile is not freed before rcu_read_unlock(),
+ * but its refcount may already have dropped to zero.
+ */
 static inline struct sock *
 		inet_lookup_listener(struct inet_hashinfo *hashinfo,
+				     const u32 saddr, const u16 sport,
 				     const u32 daddr,
 				     const unsigned short hnum, const int dif)
 {
 	struct sock *sk = NULL;
 	const struct hlist_head *head;
+	struct hlist_node *node;
 
-	read_lock(&hashinfo->lhash_lock);
-	head = &hashinfo->listening_hash[inet_lhashfn(hnum)];
-	if (!hlist_empty(head)) {
-		const struct inet_sock *inet = inet_sk((sk = __sk_head(head)));
+	rcu_read_lock();
+	head = &hashinfo->listening_hash[inet_lhashfn(hnum)].head;
+	node = rcu_dereference(head->first);
+	if (node) {
+		const struct inet_sock *inet;
 
+		sk = hlist_entry(node, struct sock, sk_node);
+		inet = inet_sk(sk);
 		if (inet->num == hnum && !sk->sk_node.next &&
 		    (!inet->rcv_saddr || inet->rcv_saddr == daddr) &&
 		    (sk->sk_family == PF_INET || !ipv6_only_sock(sk)) &&
 		    !sk->sk_bound_dev_if)
 			goto sherry_cache;
-		sk = __inet_lookup_listener(head, daddr, hnum, dif);
+		sk = __inet_lookup_listener(head, saddr, sport, daddr, hnum,
+					    dif);
 	}
 	if (sk) {
 sherry_cache:
-		sock_hold(sk);
+		if (unlikely(!atomic_inc_not_zero(&sk->sk_refcnt)))
+			sk = NULL;
 	}
-	read_unlock(&hashinfo->lhash_lock);
+	rcu_read_unlock();
 	return sk;
 }
 
@@ -398,7 +408,8 @@ static inline struct sock *__inet_lookup(struct inet_hashinfo *hashinfo,
 {
 	struct sock *sk = __inet_lookup_established(hashinfo, saddr, sport, daddr,
 						    hnum, dif);
-	return sk ? : inet_lookup_listener(hashinfo, daddr, hnum, dif);
+	return sk ? : inet_lookup_listener(hashinfo, saddr, sport, daddr, hnum,
+					   dif);
 }
 
 static inline struct sock *inet_lookup(struct inet_hashinfo *hashinfo,
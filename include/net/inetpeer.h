@@ -13,21 +13,24 @@
 #include <linux/init.h>
 #include <linux/jiffies.h>
 #include <linux/spinlock.h>
+#include <linux/list.h>
+#include <linux/rcupdate.h>
+#include <linux/rcuhash.h>
 #include <asm/atomic.h>
 
 struct inet_peer
 {
-	struct inet_peer	*avl_left, *avl_right;
-	struct inet_peer	*unused_next, **unused_prevp;
+	struct rcuhash_head	hash_node;	/* chain of the pool hash */
+	struct list_head	unused;		/* unused node list */
 	unsigned long		dtime;		/* the time of last use of not
 						 * referenced entries */
-	atomic_t		refcnt;
+	atomic_t		refcnt;		/* -1 once unlinked */
 	__u32			v4daddr;	/* peer's address */
-	__u16			avl_height;
-	__u16			ip_id_count;	/* IP ID for the next packet */
+	atomic_t		ip_id_count;	/* IP ID for the next packet */
 	atomic_t		rid;		/* Frag reception counter */
 	__u32			tcp_ts;
 	unsigned long		tcp_ts_stamp;
+	struct rcu_head		rcu;
 };
 
 void			inet_initpeers(void) __init;
@@ -35,33 +38,31 @@ void			inet_initpeers(void) __init;
 /* can be called with or without local BH being disabled */
 struct inet_peer	*inet_getpeer(__u32 daddr, int create);
 
-extern spinlock_t inet_peer_unused_lock;
-extern struct inet_peer **inet_peer_unused_tailp;
+struct inet_peer_unused_list {
+	struct list_head	list;
+	spinlock_t		lock;
+};
+extern struct inet_peer_unused_list inet_peer_unused;
+
 /* can be called from BH context or outside */
 static inline void	inet_putpeer(struct inet_peer *p)
 {
-	spin_lock_bh(&inet_peer_unused_lock);
+	/* Only the last reference going away takes the lock. */
+	if (atomic_add_unless(&p->refcnt, -1, 1))
+		return;
+	spin_lock_bh(&inet_peer_unused.lock);
 	if (atomic_dec_and_test(&p->refcnt)) {
-		p->unused_prevp = inet_peer_unused_tailp;
-		p->unused_next = NULL;
-		*inet_peer_unused_tailp = p;
-		inet_peer_unused_tailp = &p->unused_next;
+		list_add_tail(&p->unused, &inet_peer_unused.list);
 		p->dtime = jiffies;
 	}
-	spin_unlock_bh(&inet_peer_unused_lock);
+	spin_unlock_bh(&inet_peer_unused.lock);
 }
 
-extern spinlock_t inet_peer_idlock;
 /* can be called with or without local BH being disabled */
 static inline __u16	inet_getid(struct inet_peer *p, int more)
 {
-	__u16 id;
-
-	spin_lock_bh(&inet_peer_idlock);
-	id = p->ip_id_count;
-	p->ip_id_count += 1 + more;
-	spin_unlock_bh(&inet_peer_idlock);
-	return id;
+	more++;
+	return atomic_add_return(more, &p->ip_id_count) - more;
 }
 
 #endif /* _NET_INETPEER_H */
@@ -321,7 +321,7 @@ enum ip_defrag_users
 };
 
 struct sk_buff *ip_defrag(struct sk_buff *skb, u32 user);
-extern int ip_frag_nqueues;
+extern atomic_t ip_frag_nqueues;
 extern atomic_t ip_frag_mem;
 
 /*
@@ -40,6 +40,7 @@ struct kern_rta {
 };
 
 struct fib_info;
+struct rtable;
 
 struct fib_nh {
 	struct net_device	*nh_dev;
@@ -56,6 +57,9 @@ struct fib_nh {
 #endif
 	int			nh_oif;
 	u32			nh_gw;
+	struct rtable		**nh_pcpu_rth_input; /* forwarding routes,
+							per cpu, see
+							ip_rt_nocache */
 };
 
 /*
@@ -253,6 +253,7 @@ struct ip_vs_daemon_user {
 #include <asm/atomic.h>                 /* for struct atomic_t */
 #include <linux/compiler.h>
 #include <linux/timer.h>
+#include <linux/rcupdate.h>
 
 #include <net/checksum.h>
 
@@ -357,6 +358,7 @@ enum {
 	NET_IPV4_VS_SYNC_THRESHOLD=24,
 	NET_IPV4_VS_NAT_ICMP_SEND=25,
 	NET_IPV4_VS_EXPIRE_QUIESCENT_TEMPLATE=26,
+	NET_IPV4_VS_CONN_TAB_BITS=27,
 	NET_IPV4_VS_LAST
 };
 
@@ -407,6 +409,18 @@ struct ip_vs_seq {
 };
 
 
+/*
+ *	IPVS packet counters, kept per cpu and summed by the estimator
+ */
+struct ip_vs_cpu_stats
+{
+	__u32                   conns;          /* connections scheduled */
+	__u32                   inpkts;         /* incoming packets */
+	__u32                   outpkts;        /* outgoing packets */
+	__u64                   inbytes;        /* incoming bytes */
+	__u64                   outbytes;       /* outgoing bytes */
+};
+
 /*
  *	IPVS statistics object
  */
@@ -425,6 +439,9 @@ struct ip_vs_stats
 	__u32			outbps;		/* current out byte rate */
 
 	spinlock_t              lock;           /* spin lock */
+
+	struct ip_vs_cpu_stats	*cpustats;	/* alloc_percpu() */
+	struct ip_vs_cpu_stats	zerobase;	/* per cpu sums when zeroed */
 };
 
 struct dst_entry;
@@ -499,7 +516,7 @@ extern struct ip_vs_protocol * ip_vs_proto_get(unsigned short proto);
  *	IP_VS structure allocated for each dynamically scheduled connection
  */
 struct ip_vs_conn {
-	struct list_head        c_list;         /* hashed list heads */
+	struct hlist_node       c_list;         /* hashed list heads */
 
 	/* Protocol, addresses and port numbers */
 	__u32                   caddr;          /* client address */
@@ -540,6 +557,8 @@ struct ip_vs_conn {
 	void                    *app_data;      /* Application private data */
 	struct ip_vs_seq        in_seq;         /* incoming seq. struct */
 	struct ip_vs_seq        out_seq;        /* outgoing seq. struct */
+
+	struct rcu_head		rcu_head;	/* lookups run under RCU */
 };
 
 
@@ -714,11 +733,14 @@ extern void ip_vs_init_hash_table(struct list_head *table, int rows);
  */
 
 /*
- *     IPVS connection entry hash table
+ *     IPVS connection entry hash table, sized at load time by the
+ *     conn_tab_bits parameter and at run time by the conn_tab_bits sysctl
  */
 #ifndef CONFIG_IP_VS_TAB_BITS
 #define CONFIG_IP_VS_TAB_BITS   12
 #endif
+#define IP_VS_CONN_TAB_BITS_MIN	8
+#define IP_VS_CONN_TAB_BITS_MAX	24
 /* make sure that IP_VS_CONN_TAB_BITS is located in [8, 20] */
 #if CONFIG_IP_VS_TAB_BITS < 8
 #define IP_VS_CONN_TAB_BITS	8
@@ -729,8 +751,6 @@ extern void ip_vs_init_hash_table(struct list_head *table, int rows);
 #if 8 <= CONFIG_IP_VS_TAB_BITS && CONFIG_IP_VS_TAB_BITS <= 20
 #define IP_VS_CONN_TAB_BITS	CONFIG_IP_VS_TAB_BITS
 #endif
-#define IP_VS_CONN_TAB_SIZE     (1 << IP_VS_CONN_TAB_BITS)
-#define IP_VS_CONN_TAB_MASK     (IP_VS_CONN_TAB_SIZE - 1)
 
 enum {
 	IP_VS_DIR_INPUT = 0,
@@ -768,6 +788,8 @@ extern void ip_vs_secure_tcp_set(int on);
 extern void ip_vs_random_dropentry(void);
 extern int ip_vs_conn_init(void);
 extern void ip_vs_conn_cleanup(void);
+extern int ip_vs_conn_tab_bits;
+extern int ip_vs_conn_resize(int bits);
 
 static inline void ip_vs_control_del(struct ip_vs_conn *cp)
 {
@@ -922,6 +944,10 @@ extern void ip_vs_sync_conn(struct ip_vs_conn *cp);
 extern int ip_vs_new_estimator(struct ip_vs_stats *stats);
 extern void ip_vs_kill_estimator(struct ip_vs_stats *stats);
 extern void ip_vs_zero_estimator(struct ip_vs_stats *stats);
+extern int ip_vs_init_stats(struct ip_vs_stats *stats);
+extern void ip_vs_free_stats(struct ip_vs_stats *stats);
+extern void ip_vs_read_cpu_stats(struct ip_vs_stats *stats);
+extern void ip_vs_zero_cpu_stats(struct ip_vs_stats *stats);
 
 /*
  *	Various IPVS packet transmitters (from ip_vs_xmit.c)
@@ -214,6 +214,7 @@ extern int register_qdisc(struct Qdisc_ops *qops);
 extern int unregister_qdisc(struct Qdisc_ops *qops);
 extern struct Qdisc *qdisc_lookup(struct net_device *dev, u32 handle);
 extern struct Qdisc *qdisc_lookup_class(struct net_device *dev, u32 handle);
+extern void qdisc_tree_decrease_qlen(struct Qdisc *sch, unsigned int n);
 extern struct qdisc_rate_table *qdisc_get_rtab(struct tc_ratespec *r,
 		struct rtattr *tab);
 extern void qdisc_put_rtab(struct qdisc_rate_table *tab);
@@ -227,6 +228,16 @@ static inline void qdisc_run(struct net_device *dev)
 		__qdisc_run(dev);
 }
 
+extern void __qdisc_run_queue(struct netdev_queue *txq);
+
+/* Called under txq->lock with BH off, as qdisc_run() under queue_lock */
+static inline void qdisc_run_queue(struct netdev_queue *txq)
+{
+	if (!netif_tx_queue_stopped(txq) &&
+	    !test_and_set_bit(__QUEUE_STATE_QDISC_RUNNING, &txq->state))
+		__qdisc_run_queue(txq);
+}
+
 extern int tc_classify(struct sk_buff *skb, struct tcf_proto *tp,
 	struct tcf_result *res);
 
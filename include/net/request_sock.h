@@ -78,18 +78,30 @@ static inline void reqsk_free(struct request_sock *req)
 
 extern int sysctl_max_syn_backlog;
 
+/*
+ * Number of locks striping the SYN table of a listener.  Whoever walks or
+ * changes a chain of the table holds its lock, the lock of chain i being
+ * syn_lock[i % LISTEN_SYN_LOCKS].
+ */
+#define LISTEN_SYN_LOCKS	16
+
 /** struct listen_sock - listen state
  *
  * @max_qlen_log - log_2 of maximal queued SYNs/REQUESTs
+ * @syn_lock - serializers of the syn_table chains
+ *
+ * qlen and qlen_young are atomic, as the requests of one listener are
+ * added and removed on all the cpus at once, under different syn_locks.
  */
 struct listen_sock {
 	u8			max_qlen_log;
 	/* 3 bytes hole, try to use */
-	int			qlen;
-	int			qlen_young;
+	atomic_t		qlen;
+	atomic_t		qlen_young;
 	int			clock_hand;
 	u32			hash_rnd;
 	u32			nr_table_entries;
+	spinlock_t		syn_lock[LISTEN_SYN_LOCKS];
 	struct request_sock	*syn_table[0];
 };
 
@@ -98,21 +110,17 @@ struct listen_sock {
  * @rskq_accept_head - FIFO head of established children
  * @rskq_accept_tail - FIFO tail of established children
  * @rskq_defer_accept - User waits for some data after accept()
- * @syn_wait_lock - serializer
- *
- * %syn_wait_lock is necessary only to avoid proc interface having to grab the main
- * lock sock while browsing the listening hash (otherwise it's deadlock prone).
+ * @rskq_lock - serializer of the accept FIFO and of sk_ack_backlog
  *
- * This lock is acquired in read mode only from listening_get_next() seq_file
- * op and it's acquired in write mode _only_ from code that is actively
- * changing rskq_accept_head. All readers that are holding the master sock lock
- * don't need to grab this lock in read mode too as rskq_accept_head. writes
- * are always protected from the main sock lock.
+ * Connection requests are handled without the lock of the listening
+ * socket, so children are queued by softirqs on any cpu while accept()
+ * takes them off, hence %rskq_lock.  The SYN table itself is covered by
+ * the syn_locks of listen_opt, which stays until the listener is closed.
  */
 struct request_sock_queue {
 	struct request_sock	*rskq_accept_head;
 	struct request_sock	*rskq_accept_tail;
-	rwlock_t		syn_wait_lock;
+	spinlock_t		rskq_lock;
 	u8			rskq_defer_accept;
 	/* 3 bytes hole, try to pack */
 	struct listen_sock	*listen_opt;
@@ -123,13 +131,9 @@ extern int reqsk_queue_alloc(struct request_sock_queue *queue,
 
 static inline struct listen_sock *reqsk_queue_yank_listen_sk(struct request_sock_queue *queue)
 {
-	struct listen_sock *lopt;
+	struct listen_sock *lopt = queue->listen_opt;
 
-	write_lock_bh(&queue->syn_wait_lock);
-	lopt = queue->listen_opt;
 	queue->listen_opt = NULL;
-	write_unlock_bh(&queue->syn_wait_lock);
-
 	return lopt;
 }
 
@@ -143,9 +147,12 @@ extern void reqsk_queue_destroy(struct request_sock_queue *queue);
 static inline struct request_sock *
 	reqsk_queue_yank_acceptq(struct request_sock_queue *queue)
 {
-	struct request_sock *req = queue->rskq_accept_head;
+	struct request_sock *req;
 
+	spin_lock_bh(&queue->rskq_lock);
+	req = queue->rskq_accept_head;
 	queue->rskq_accept_head = NULL;
+	spin_unlock_bh(&queue->rskq_lock);
 	return req;
 }
 
@@ -154,13 +161,19 @@ static inline int reqsk_queue_empty(struct request_sock_queue *queue)
 	return queue->rskq_accept_head == NULL;
 }
 
+/* The lock of the SYN table chain @hash */
+static inline spinlock_t *reqsk_queue_syn_lock(struct request_sock_queue *queue,
+					       u32 hash)
+{
+	return &queue->listen_opt->syn_lock[hash % LISTEN_SYN_LOCKS];
+}
+
+/* Called with the syn_lock of the chain of req held */
 static inline void reqsk_queue_unlink(struct request_sock_queue *queue,
 				      struct request_sock *req,
 				      struct request_sock **prev_req)
 {
-	write_lock(&queue->syn_wait_lock);
 	*prev_req = req->dl_next;
-	write_unlock(&queue->syn_wait_lock);
 }
 
 static inline void reqsk_queue_add(struct request_sock_queue *queue,
@@ -169,6 +182,9 @@ static inline void reqsk_queue_add(struct request_sock_queue *queue,
 				   struct sock *child)
 {
 	req->sk = child;
+	req->dl_next = NULL;
+
+	spin_lock(&queue->rskq_lock);
 	sk_acceptq_added(parent);
 
 	if (queue->rskq_accept_head == NULL)
@@ -177,7 +193,7 @@ static inline void reqsk_queue_add(struct request_sock_queue *queue,
 		queue->rskq_accept_tail->dl_next = req;
 
 	queue->rskq_accept_tail = req;
-	req->dl_next = NULL;
+	spin_unlock(&queue->rskq_lock);
 }
 
 static inline struct request_sock *reqsk_queue_remove(struct request_sock_queue *queue)
@@ -196,12 +212,17 @@ static inline struct request_sock *reqsk_queue_remove(struct request_sock_queue
 static inline struct sock *reqsk_queue_get_child(struct request_sock_queue *queue,
 						 struct sock *parent)
 {
-	struct request_sock *req = reqsk_queue_remove(queue);
-	struct sock *child = req->sk;
+	struct request_sock *req;
+	struct sock *child;
 
+	spin_lock_bh(&queue->rskq_lock);
+	req = reqsk_queue_remove(queue);
+	sk_acceptq_removed(parent);
+	spin_unlock_bh(&queue->rskq_lock);
+
+	child = req->sk;
 	BUG_TRAP(child != NULL);
 
-	sk_acceptq_removed(parent);
 	__reqsk_free(req);
 	return child;
 }
@@ -212,36 +233,35 @@ static inline int reqsk_queue_removed(struct request_sock_queue *queue,
 	struct listen_sock *lopt = queue->listen_opt;
 
 	if (req->retrans == 0)
-		--lopt->qlen_young;
+		atomic_dec(&lopt->qlen_young);
 
-	return --lopt->qlen;
+	return atomic_dec_return(&lopt->qlen);
 }
 
 static inline int reqsk_queue_added(struct request_sock_queue *queue)
 {
 	struct listen_sock *lopt = queue->listen_opt;
-	const int prev_qlen = lopt->qlen;
 
-	lopt->qlen_young++;
-	lopt->qlen++;
-	return prev_qlen;
+	atomic_inc(&lopt->qlen_young);
+	return atomic_inc_return(&lopt->qlen) - 1;
 }
 
 static inline int reqsk_queue_len(const struct request_sock_queue *queue)
 {
-	return queue->listen_opt != NULL ? queue->listen_opt->qlen : 0;
+	return queue->listen_opt != NULL ? atomic_read(&queue->listen_opt->qlen) : 0;
 }
 
 static inline int reqsk_queue_len_young(const struct request_sock_queue *queue)
 {
-	return queue->listen_opt->qlen_young;
+	return atomic_read(&queue->listen_opt->qlen_young);
 }
 
 static inline int reqsk_queue_is_full(const struct request_sock_queue *queue)
 {
-	return queue->listen_opt->qlen >> queue->listen_opt->max_qlen_log;
+	return atomic_read(&queue->listen_opt->qlen) >> queue->listen_opt->max_qlen_log;
 }
 
+/* Called with the syn_lock of chain @hash held */
 static inline void reqsk_queue_hash_req(struct request_sock_queue *queue,
 					u32 hash, struct request_sock *req,
 					unsigned long timeout)
@@ -252,10 +272,7 @@ static inline void reqsk_queue_hash_req(struct request_sock_queue *queue,
 	req->retrans = 0;
 	req->sk = NULL;
 	req->dl_next = lopt->syn_table[hash];
-
-	write_lock(&queue->syn_wait_lock);
 	lopt->syn_table[hash] = req;
-	write_unlock(&queue->syn_wait_lock);
 }
 
 #endif /* _REQUEST_SOCK_H */
@@ -165,6 +165,7 @@ extern void qdisc_unlock_tree(struct net_device *dev);
 
 extern struct Qdisc noop_qdisc;
 extern struct Qdisc_ops noop_qdisc_ops;
+extern struct Qdisc mq_qdisc;
 
 extern void dev_init_scheduler(struct net_device *dev);
 extern void dev_shutdown(struct net_device *dev);
@@ -23,6 +23,8 @@
 #define _UDP_H
 
 #include <linux/list.h>
+#include <linux/list_nulls.h>
+#include <linux/jhash.h>
 #include <net/inet_sock.h>
 #include <net/sock.h>
 #include <net/snmp.h>
@@ -34,22 +36,36 @@
  *        and hashing code needs to work with different AF's yet
  *        the port space is shared.
  */
-extern struct hlist_head udp_hash[UDP_HTABLE_SIZE];
-extern rwlock_t udp_hash_lock;
+struct udp_hslot {
+	struct hlist_head	head;
+	int			count;	/* socks on the chain */
+	spinlock_t		lock;
+};
+
+/* a udp_hash2 chain ends in a nulls marker holding its own index */
+struct udp_hslot2 {
+	struct hlist_nulls_head	head;
+	int			count;
+	spinlock_t		lock;
+};
+
+/* by local port, and by local address and port */
+extern struct udp_hslot udp_hash[UDP_HTABLE_SIZE];
+extern struct udp_hslot2 udp_hash2[UDP_HTABLE_SIZE];
 
 extern int udp_port_rover;
 
-static inline int udp_lport_inuse(u16 num)
+static inline unsigned int udp_portaddr_hash(u32 addr, unsigned short port)
 {
-	struct sock *sk;
-	struct hlist_node *node;
-
-	sk_for_each(sk, node, &udp_hash[num & (UDP_HTABLE_SIZE - 1)])
-		if (inet_sk(sk)->num == num)
-			return 1;
-	return 0;
+	return (jhash_1word(addr, 0) ^ port) & (UDP_HTABLE_SIZE - 1);
 }
 
+extern int	udp_get_port(struct sock *sk, unsigned short snum,
+			     int (*saddr_comp)(const struct sock *sk1,
+					       const struct sock *sk2));
+extern void	udp_lib_unhash(struct sock *sk);
+extern void	udp_lib_rehash(struct sock *sk);
+
 /* Note: this must match 'valbool' in sock_setsockopt */
 #define UDP_CSUM_NOXMIT		1
 
@@ -71,6 +87,7 @@ extern int	udp_sendmsg(struct kiocb *iocb, struct sock *sk,
 extern int	udp_rcv(struct sk_buff *skb);
 extern int	udp_ioctl(struct sock *sk, int cmd, unsigned long arg);
 extern int	udp_disconnect(struct sock *sk, int flags);
+extern void	udp_init(void);
 extern unsigned int udp_poll(struct file *file, struct socket *sock,
 			     poll_table *wait);
 
@@ -154,6 +154,7 @@ struct iscsi_conn {
 	struct list_head	xmitqueue;	/* data-path cmd queue */
 	struct list_head	run_list;	/* list of cmds in progress */
 	struct work_struct	xmitwork;	/* per-conn. xmit workqueue */
+	int			xmit_cpu;	/* CPU xmitwork runs on */
 	/*
 	 * serializes connection xmit, access to kfifos:
 	 * xmitqueue, immqueue, mgmtqueue
@@ -225,6 +226,7 @@ struct iscsi_session {
 	struct iscsi_transport	*tt;
 	struct Scsi_Host	*host;
 	struct iscsi_conn	*leadconn;	/* leading connection */
+	struct iscsi_conn	*next_conn;	/* last conn given a cmd */
 	spinlock_t		lock;		/* protects session state, *
 						 * sequence numbers,       *
 						 * session resources:      *
@@ -281,6 +283,7 @@ extern void iscsi_conn_stop(struct iscsi_cls_conn *, int);
 extern int iscsi_conn_bind(struct iscsi_cls_session *, struct iscsi_cls_conn *,
 			   int);
 extern void iscsi_conn_failure(struct iscsi_conn *conn, enum iscsi_err err);
+extern void iscsi_conn_queue_work(struct iscsi_conn *conn);
 extern int iscsi_conn_get_param(struct iscsi_cls_conn *cls_conn,
 				enum iscsi_param param, char *buf);
 
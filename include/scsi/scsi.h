@@ -9,6 +9,7 @@
 #define _SCSI_SCSI_H
 
 #include <linux/types.h>
+#include <asm/scatterlist.h>
 
 /*
  *	The maximum sg list length SCSI can cope with
@@ -16,6 +17,19 @@
  */
 #define SCSI_MAX_PHYS_SEGMENTS	MAX_PHYS_SEGMENTS
 
+/*
+ *	The size of the largest sg table.  Hosts that set use_sg_chaining
+ *	may be given a chain of such tables, of up to
+ *	SCSI_MAX_SG_CHAIN_SEGMENTS entries in all.
+ */
+#define SCSI_MAX_SG_SEGMENTS	SCSI_MAX_PHYS_SEGMENTS
+
+#ifdef ARCH_HAS_SG_CHAIN
+#define SCSI_MAX_SG_CHAIN_SEGMENTS	2048
+#else
+#define SCSI_MAX_SG_CHAIN_SEGMENTS	SCSI_MAX_SG_SEGMENTS
+#endif
+
 
 /*
  *	SCSI command lengths
@@ -6,6 +6,7 @@
 #include <linux/types.h>
 #include <linux/workqueue.h>
 #include <linux/mutex.h>
+#include <asm/atomic.h>
 
 struct block_device;
 struct completion;
@@ -117,6 +118,9 @@ struct scsi_host_template {
 	 * I/O pressure in the system if there are no other outstanding
 	 * commands.
 	 *
+	 * queuecommand is called with the host_lock held and interrupts
+	 * off, unless the template sets lockless (see below).
+	 *
 	 * STATUS: REQUIRED
 	 */
 	int (* queuecommand)(struct scsi_cmnd *,
@@ -386,6 +390,20 @@ struct scsi_host_template {
 	 */
 	unsigned ordered_tag:1;
 
+	/*
+	 * True if queuecommand does its own locking: it is then called
+	 * without the host_lock, with interrupts enabled.
+	 */
+	unsigned lockless:1;
+
+	/*
+	 * True if the driver walks the sg lists of its commands with
+	 * sg_next()/for_each_sg(): it may then be given chained lists of
+	 * up to SCSI_MAX_SG_CHAIN_SEGMENTS entries, as far as sg_tablesize
+	 * allows.
+	 */
+	unsigned use_sg_chaining:1;
+
 	/*
 	 * Countdown for host blocking with no commands outstanding
 	 */
@@ -466,11 +484,12 @@ struct Scsi_Host {
 	struct scsi_transport_template *transportt;
 
 	/*
-	 * The following two fields are protected with host_lock;
-	 * however, eh routines can safely access during eh processing
-	 * without acquiring the lock.
+	 * host_busy is counted without the host_lock, so that issue and
+	 * completion of a command need not take it.  The following two
+	 * fields are protected with host_lock; however, eh routines can
+	 * safely access during eh processing without acquiring the lock.
 	 */
-	unsigned int host_busy;		   /* commands actually active on low-level */
+	atomic_t host_busy;		   /* commands actually active on low-level */
 	unsigned int host_failed;	   /* commands that failed. */
 	unsigned int host_eh_scheduled;    /* EH scheduled without command */
     
@@ -51,12 +51,15 @@
 #include <linux/buffer_head.h>
 #include <linux/debug_locks.h>
 #include <linux/lockdep.h>
+#include <linux/vmalloc.h>
+#include <linux/async.h>
 
 #include <asm/io.h>
 #include <asm/bugs.h>
 #include <asm/setup.h>
 #include <asm/sections.h>
 #include <asm/cacheflush.h>
+#include <asm/div64.h>
 
 #ifdef CONFIG_X86_LOCAL_APIC
 #include <asm/smp.h>
@@ -550,6 +553,7 @@ asmlinkage void __init start_kernel(void)
 	cpuset_init_early();
 	mem_init();
 	kmem_cache_init();
+	vmalloc_init();
 	setup_per_cpu_pageset();
 	numa_policy_init();
 	if (late_time_init)
@@ -589,7 +593,8 @@ asmlinkage void __init start_kernel(void)
 	rest_init();
 }
 
-static int __initdata initcall_debug;
+/* Read by kernel/async.c too, after the init sections are gone */
+int initcall_debug;
 
 static int __init initcall_debug_setup(char *str)
 {
@@ -610,17 +615,32 @@ static void __init do_initcalls(void)
 	for (call = __initcall_start; call < __initcall_end; call++) {
 		char *msg = NULL;
 		char msgbuf[40];
+		struct timespec t0, t1;
+		unsigned long long usecs;
 		int result;
 
 		if (initcall_debug) {
 			printk("Calling initcall 0x%p", *call);
 			print_fn_descriptor_symbol(": %s()",
 					(unsigned long) *call);
-			printk("\n");
+			printk(" @ %i\n", current->pid);
+			getnstimeofday(&t0);
 		}
 
 		result = (*call)();
 
+		if (initcall_debug) {
+			getnstimeofday(&t1);
+			t1 = timespec_sub(t1, t0);
+			usecs = timespec_to_ns(&t1);
+			do_div(usecs, 1000);
+			printk("initcall 0x%p", *call);
+			print_fn_descriptor_symbol(": %s()",
+					(unsigned long) *call);
+			printk(" returned %d after %lld usecs\n", result,
+			       (long long)usecs);
+		}
+
 		if (result && result != -ENODEV && initcall_debug) {
 			sprintf(msgbuf, "error code %d", result);
 			msg = msgbuf;
@@ -718,6 +738,13 @@ static int init(void * unused)
 
 	do_basic_setup();
 
+	/*
+	 * Drivers may have left their probing to run asynchronously: the
+	 * root device may be among what they find, and their code is
+	 * about to be freed.
+	 */
+	async_synchronize_full();
+
 	/*
 	 * check if there is an early userspace init.  If yes, let it do all
 	 * the work
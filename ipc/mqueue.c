@@ -29,6 +29,8 @@
 #include <linux/audit.h>
 #include <linux/signal.h>
 #include <linux/mutex.h>
+#include <linux/rbtree.h>
+#include <linux/highmem.h>
 
 #include <net/sock.h>
 #include "util.h"
@@ -43,6 +45,7 @@
 #define STATE_NONE	0
 #define STATE_PENDING	1
 #define STATE_READY	2
+#define STATE_CLAIMED	3	/* a sender is copying into the buffer */
 
 /* used by sysctl */
 #define FS_MQUEUE 	1
@@ -56,12 +59,28 @@
 #define HARD_MSGMAX 	(131072/sizeof(void*))
 #define DFLT_MSGSIZEMAX 8192	/* max message size */
 
+/* messages this large go straight into a waiting receiver's buffer */
+#define MQ_DIRECT_MIN	PAGE_SIZE
+#define MQ_DIRECT_BATCH	16	/* receiver pages pinned at a time */
 
 struct ext_wait_queue {		/* queue of sleeping tasks */
 	struct task_struct *task;
 	struct list_head list;
 	struct msg_msg *msg;	/* ptr of loaded message */
 	int state;		/* one of STATE_* values */
+
+	/* receivers only: where a sender may copy a message directly */
+	char __user *buf;
+	struct mm_struct *mm;
+	size_t msg_len;		/* the message copied there, if msg is NULL */
+	unsigned int msg_prio;
+};
+
+/* The queued messages of one priority, oldest first */
+struct mq_prio_bucket {
+	struct rb_node rb_node;
+	struct list_head msg_list;
+	long priority;
 };
 
 struct mqueue_inode_info {
@@ -69,7 +88,9 @@ struct mqueue_inode_info {
 	struct inode vfs_inode;
 	wait_queue_head_t wait_q;
 
-	struct msg_msg **messages;
+	struct rb_root msg_tree;	/* mq_prio_buckets by priority */
+	struct rb_node *msg_tree_rightmost; /* highest priority bucket */
+	struct mq_prio_bucket *node_cache; /* spare bucket for msg_insert */
 	struct mq_attr attr;
 
 	struct sigevent notify;
@@ -88,6 +109,7 @@ static struct inode_operations mqueue_dir_inode_operations;
 static struct file_operations mqueue_file_operations;
 static struct super_operations mqueue_super_ops;
 static void remove_notification(struct mqueue_inode_info *info);
+static struct msg_msg *msg_get(struct mqueue_inode_info *info);
 
 static spinlock_t mq_lock;
 static kmem_cache_t *mqueue_inode_cachep;
@@ -134,7 +156,9 @@ static struct inode *mqueue_get_inode(struct super_block *sb, int mode,
 			init_waitqueue_head(&info->wait_q);
 			INIT_LIST_HEAD(&info->e_wait_q[0].list);
 			INIT_LIST_HEAD(&info->e_wait_q[1].list);
-			info->messages = NULL;
+			info->msg_tree = RB_ROOT;
+			info->msg_tree_rightmost = NULL;
+			info->node_cache = NULL;
 			info->notify_owner = 0;
 			info->qsize = 0;
 			info->user = NULL;	/* set when all is ok */
@@ -145,7 +169,8 @@ static struct inode *mqueue_get_inode(struct super_block *sb, int mode,
 				info->attr.mq_maxmsg = attr->mq_maxmsg;
 				info->attr.mq_msgsize = attr->mq_msgsize;
 			}
-			mq_msg_tblsz = info->attr.mq_maxmsg * sizeof(struct msg_msg *);
+			mq_msg_tblsz = info->attr.mq_maxmsg *
+				sizeof(struct mq_prio_bucket);
 			mq_bytes = (mq_msg_tblsz +
 				(info->attr.mq_maxmsg * info->attr.mq_msgsize));
 
@@ -159,13 +184,6 @@ static struct inode *mqueue_get_inode(struct super_block *sb, int mode,
 			u->mq_bytes += mq_bytes;
 			spin_unlock(&mq_lock);
 
-			info->messages = kmalloc(mq_msg_tblsz, GFP_KERNEL);
-			if (!info->messages) {
-				spin_lock(&mq_lock);
-				u->mq_bytes -= mq_bytes;
-				spin_unlock(&mq_lock);
-				goto out_inode;
-			}
 			/* all is ok */
 			info->user = get_uid(u);
 		} else if (S_ISDIR(mode)) {
@@ -241,7 +259,6 @@ static void mqueue_delete_inode(struct inode *inode)
 	struct mqueue_inode_info *info;
 	struct user_struct *user;
 	unsigned long mq_bytes;
-	int i;
 
 	if (S_ISDIR(inode->i_mode)) {
 		clear_inode(inode);
@@ -249,14 +266,14 @@ static void mqueue_delete_inode(struct inode *inode)
 	}
 	info = MQUEUE_I(inode);
 	spin_lock(&info->lock);
-	for (i = 0; i < info->attr.mq_curmsgs; i++)
-		free_msg(info->messages[i]);
-	kfree(info->messages);
+	while (info->attr.mq_curmsgs)
+		free_msg(msg_get(info));
+	kfree(info->node_cache);
 	spin_unlock(&info->lock);
 
 	clear_inode(inode);
 
-	mq_bytes = (info->attr.mq_maxmsg * sizeof(struct msg_msg *) +
+	mq_bytes = (info->attr.mq_maxmsg * sizeof(struct mq_prio_bucket) +
 		   (info->attr.mq_maxmsg * info->attr.mq_msgsize));
 	user = info->user;
 	if (user) {
@@ -406,6 +423,25 @@ static void wq_add(struct mqueue_inode_info *info, int sr,
 	list_add_tail(&ewp->list, &info->e_wait_q[sr].list);
 }
 
+/*
+ * A sender copying straight into our buffer can sleep while doing so:
+ * wait for it to finish without spinning, signals or not, as the
+ * buffer must stay put until then.
+ */
+static void wq_wait_claimed(struct ext_wait_queue *ewp)
+{
+	for (;;) {
+		set_current_state(TASK_UNINTERRUPTIBLE);
+		if (ewp->state != STATE_CLAIMED)
+			break;
+		schedule();
+	}
+	__set_current_state(TASK_RUNNING);
+
+	while (ewp->state == STATE_PENDING)
+		cpu_relax();
+}
+
 /*
  * Puts current task to sleep. Caller must hold queue lock. After return
  * lock isn't held.
@@ -437,6 +473,17 @@ static int wq_sleep(struct mqueue_inode_info *info, int sr,
 			retval = 0;
 			goto out_unlock;
 		}
+		if (ewp->state == STATE_CLAIMED) {
+			spin_unlock(&info->lock);
+			wq_wait_claimed(ewp);
+			if (ewp->state == STATE_READY) {
+				retval = 0;
+				goto out;
+			}
+			/* the sender failed and put us back on the queue */
+			spin_lock(&info->lock);
+			continue;
+		}
 		if (signal_pending(current)) {
 			retval = -ERESTARTSYS;
 			break;
@@ -467,25 +514,81 @@ static struct ext_wait_queue *wq_get_first_waiter(
 	return list_entry(ptr, struct ext_wait_queue, list);
 }
 
-/* Auxiliary functions to manipulate messages' list */
-static void msg_insert(struct msg_msg *ptr, struct mqueue_inode_info *info)
+/*
+ * Auxiliary functions to manipulate messages' list.
+ * Messages are kept in one FIFO bucket per priority present, the buckets
+ * in an rbtree, so inserting depends on the number of priorities in use
+ * rather than of messages, and the usual case of a message as urgent as
+ * the most urgent queued takes no search at all.
+ */
+static int msg_insert(struct msg_msg *ptr, struct mqueue_inode_info *info)
 {
-	int k;
+	struct rb_node **p, *parent = NULL;
+	struct mq_prio_bucket *bucket;
+	int rightmost = 1;
+
+	if (info->msg_tree_rightmost) {
+		bucket = rb_entry(info->msg_tree_rightmost,
+				  struct mq_prio_bucket, rb_node);
+		if (bucket->priority == ptr->m_type)
+			goto insert_msg;
+	}
 
-	k = info->attr.mq_curmsgs - 1;
-	while (k >= 0 && info->messages[k]->m_type >= ptr->m_type) {
-		info->messages[k + 1] = info->messages[k];
-		k--;
+	p = &info->msg_tree.rb_node;
+	while (*p) {
+		parent = *p;
+		bucket = rb_entry(parent, struct mq_prio_bucket, rb_node);
+		if (bucket->priority == ptr->m_type)
+			goto insert_msg;
+		if (ptr->m_type < bucket->priority) {
+			p = &parent->rb_left;
+			rightmost = 0;
+		} else
+			p = &parent->rb_right;
+	}
+
+	if (info->node_cache) {
+		bucket = info->node_cache;
+		info->node_cache = NULL;
+	} else {
+		bucket = kmalloc(sizeof(*bucket), GFP_ATOMIC);
+		if (!bucket)
+			return -ENOMEM;
 	}
+	INIT_LIST_HEAD(&bucket->msg_list);
+	bucket->priority = ptr->m_type;
+	rb_link_node(&bucket->rb_node, parent, p);
+	rb_insert_color(&bucket->rb_node, &info->msg_tree);
+	if (rightmost)
+		info->msg_tree_rightmost = &bucket->rb_node;
+insert_msg:
+	list_add_tail(&ptr->m_list, &bucket->msg_list);
 	info->attr.mq_curmsgs++;
 	info->qsize += ptr->m_ts;
-	info->messages[k + 1] = ptr;
+	return 0;
 }
 
-static inline struct msg_msg *msg_get(struct mqueue_inode_info *info)
+/* Takes the oldest message of the highest priority; the queue is not empty */
+static struct msg_msg *msg_get(struct mqueue_inode_info *info)
 {
-	info->qsize -= info->messages[--info->attr.mq_curmsgs]->m_ts;
-	return info->messages[info->attr.mq_curmsgs];
+	struct mq_prio_bucket *bucket;
+	struct msg_msg *msg;
+
+	bucket = rb_entry(info->msg_tree_rightmost,
+			  struct mq_prio_bucket, rb_node);
+	msg = list_entry(bucket->msg_list.next, struct msg_msg, m_list);
+	list_del(&msg->m_list);
+	if (list_empty(&bucket->msg_list)) {
+		info->msg_tree_rightmost = rb_prev(&bucket->rb_node);
+		rb_erase(&bucket->rb_node, &info->msg_tree);
+		if (info->node_cache)
+			kfree(bucket);
+		else
+			info->node_cache = bucket;
+	}
+	info->attr.mq_curmsgs--;
+	info->qsize -= msg->m_ts;
+	return msg;
 }
 
 static inline void set_cookie(struct sk_buff *skb, char code)
@@ -591,7 +694,7 @@ static int mq_attr_ok(struct mq_attr *attr)
 	if (attr->mq_msgsize > ULONG_MAX/attr->mq_maxmsg)
 		return 0;
 	if ((unsigned long)(attr->mq_maxmsg * attr->mq_msgsize) +
-	    (attr->mq_maxmsg * sizeof (struct msg_msg *)) <
+	    (attr->mq_maxmsg * sizeof (struct mq_prio_bucket)) <
 	    (unsigned long)(attr->mq_maxmsg * attr->mq_msgsize))
 		return 0;
 	return 1;
@@ -800,7 +903,8 @@ static inline void pipelined_receive(struct mqueue_inode_info *info)
 		wake_up_interruptible(&info->wait_q);
 		return;
 	}
-	msg_insert(sender->msg, info);
+	if (msg_insert(sender->msg, info))
+		return;
 	list_del(&sender->list);
 	sender->state = STATE_PENDING;
 	wake_up_process(sender->task);
@@ -808,6 +912,109 @@ static inline void pipelined_receive(struct mqueue_inode_info *info)
 	sender->state = STATE_READY;
 }
 
+/*
+ * Copy len bytes from the sender's buffer at src into the buffer of a
+ * claimed receiver, a few of its pages at a time.  They are pinned with
+ * the receiver's mmap_sem taken only for that, so that faults on our
+ * own buffer never nest inside it.  Returns 0, -EFAULT if our buffer
+ * faulted, or 1 if the receiver's buffer could not be had.
+ */
+static int mq_copy_to_waiter(struct ext_wait_queue *receiver,
+			     const char __user *src, size_t len)
+{
+	struct mm_struct *mm = receiver->mm;
+	unsigned long addr = (unsigned long)receiver->buf;
+	struct page *pages[MQ_DIRECT_BATCH];
+	int i, nr, got, ret = 0;
+
+	while (len) {
+		unsigned long offset = addr & ~PAGE_MASK;
+
+		nr = (offset + len + PAGE_SIZE - 1) >> PAGE_SHIFT;
+		if (nr > MQ_DIRECT_BATCH)
+			nr = MQ_DIRECT_BATCH;
+		down_read(&mm->mmap_sem);
+		got = get_user_pages(receiver->task, mm, addr & PAGE_MASK, nr,
+				     1, 0, pages, NULL);
+		up_read(&mm->mmap_sem);
+		if (got < nr) {
+			for (i = 0; i < got; i++)
+				page_cache_release(pages[i]);
+			return 1;
+		}
+
+		for (i = 0; i < nr; i++) {
+			size_t n = min_t(size_t, PAGE_SIZE - offset, len);
+			char *kaddr;
+
+			if (!ret) {
+				kaddr = kmap(pages[i]);
+				if (copy_from_user(kaddr + offset, src, n))
+					ret = -EFAULT;
+				kunmap(pages[i]);
+				flush_dcache_page(pages[i]);
+				set_page_dirty_lock(pages[i]);
+			}
+			page_cache_release(pages[i]);
+			src += n;
+			addr += n;
+			len -= n;
+			offset = 0;
+		}
+		if (ret)
+			return ret;
+	}
+	return 0;
+}
+
+/* pipelined_send_direct() - send a large message to a receiver that
+ * sys_mq_timedsend() found waiting and took off the queue, copying it
+ * from the sender's buffer into the receiver's rather than through a
+ * kernel copy.  Should the receiver's buffer be unusable, the message
+ * is handed over as usual for the receiver to find that out.  Returns
+ * an error for the sender, after putting the receiver back to wait.
+ */
+static int pipelined_send_direct(struct mqueue_inode_info *info,
+				 struct ext_wait_queue *receiver,
+				 const char __user *u_msg_ptr, size_t msg_len,
+				 unsigned int msg_prio)
+{
+	struct msg_msg *msg_ptr = NULL;
+	int ret;
+
+	ret = mq_copy_to_waiter(receiver, u_msg_ptr, msg_len);
+	if (ret > 0) {
+		msg_ptr = load_msg(u_msg_ptr, msg_len);
+		if (IS_ERR(msg_ptr)) {
+			ret = PTR_ERR(msg_ptr);
+			goto requeue;
+		}
+		msg_ptr->m_ts = msg_len;
+		msg_ptr->m_type = msg_prio;
+		ret = 0;
+	}
+	if (ret)
+		goto requeue;
+
+	receiver->msg = msg_ptr;
+	receiver->msg_len = msg_len;
+	receiver->msg_prio = msg_prio;
+	receiver->state = STATE_PENDING;
+	wake_up_process(receiver->task);
+	smp_wmb();
+	receiver->state = STATE_READY;
+	return 0;
+
+requeue:
+	/* back where wq_get_first_waiter() found it */
+	spin_lock(&info->lock);
+	list_add_tail(&receiver->list, &info->e_wait_q[RECV].list);
+	receiver->state = STATE_NONE;
+	wake_up_process(receiver->task);
+	spin_unlock(&info->lock);
+	return ret;
+}
+
 asmlinkage long sys_mq_timedsend(mqd_t mqdes, const char __user *u_msg_ptr,
 	size_t msg_len, unsigned int msg_prio,
 	const struct timespec __user *u_abs_timeout)
@@ -818,6 +1025,7 @@ asmlinkage long sys_mq_timedsend(mqd_t mqdes, const char __user *u_msg_ptr,
 	struct ext_wait_queue *receiver;
 	struct msg_msg *msg_ptr;
 	struct mqueue_inode_info *info;
+	struct mq_prio_bucket *new_bucket = NULL;
 	long timeout;
 	int ret;
 
@@ -848,6 +1056,24 @@ asmlinkage long sys_mq_timedsend(mqd_t mqdes, const char __user *u_msg_ptr,
 		goto out_fput;
 	}
 
+	/* A large message for a receiver that is already waiting does not
+	 * need a copy in the kernel: put it straight into its buffer. */
+	if (msg_len >= MQ_DIRECT_MIN) {
+		spin_lock(&info->lock);
+		receiver = wq_get_first_waiter(info, RECV);
+		if (receiver) {
+			list_del(&receiver->list);
+			receiver->state = STATE_CLAIMED;
+			inode->i_atime = inode->i_mtime = inode->i_ctime =
+					CURRENT_TIME;
+			spin_unlock(&info->lock);
+			ret = pipelined_send_direct(info, receiver, u_msg_ptr,
+						    msg_len, msg_prio);
+			goto out_fput;
+		}
+		spin_unlock(&info->lock);
+	}
+
 	/* First try to allocate memory, before doing anything with
 	 * existing queues. */
 	msg_ptr = load_msg(u_msg_ptr, msg_len);
@@ -858,8 +1084,17 @@ asmlinkage long sys_mq_timedsend(mqd_t mqdes, const char __user *u_msg_ptr,
 	msg_ptr->m_ts = msg_len;
 	msg_ptr->m_type = msg_prio;
 
+	/* and the bucket a new priority may need */
+	if (!info->node_cache)
+		new_bucket = kmalloc(sizeof(*new_bucket), GFP_KERNEL);
+
 	spin_lock(&info->lock);
 
+	if (!info->node_cache && new_bucket) {
+		info->node_cache = new_bucket;
+		new_bucket = NULL;
+	}
+
 	if (info->attr.mq_curmsgs == info->attr.mq_maxmsg) {
 		if (filp->f_flags & O_NONBLOCK) {
 			spin_unlock(&info->lock);
@@ -877,18 +1112,23 @@ asmlinkage long sys_mq_timedsend(mqd_t mqdes, const char __user *u_msg_ptr,
 			free_msg(msg_ptr);
 	} else {
 		receiver = wq_get_first_waiter(info, RECV);
+		ret = 0;
 		if (receiver) {
 			pipelined_send(info, msg_ptr, receiver);
 		} else {
 			/* adds message to the queue */
-			msg_insert(msg_ptr, info);
-			__do_notify(info);
+			ret = msg_insert(msg_ptr, info);
+			if (!ret)
+				__do_notify(info);
 		}
-		inode->i_atime = inode->i_mtime = inode->i_ctime =
-				CURRENT_TIME;
+		if (!ret)
+			inode->i_atime = inode->i_mtime = inode->i_ctime =
+					CURRENT_TIME;
 		spin_unlock(&info->lock);
-		ret = 0;
+		if (ret)
+			free_msg(msg_ptr);
 	}
+	kfree(new_bucket);
 out_fput:
 	fput(filp);
 out:
@@ -945,8 +1185,18 @@ asmlinkage ssize_t sys_mq_timedreceive(mqd_t mqdes, char __user *u_msg_ptr,
 		} else {
 			wait.task = current;
 			wait.state = STATE_NONE;
+			wait.buf = u_msg_ptr;
+			wait.mm = current->mm;
 			ret = wq_sleep(info, RECV, timeout, &wait);
 			msg_ptr = wait.msg;
+			if (ret == 0 && !msg_ptr) {
+				/* the sender copied it straight to u_msg_ptr */
+				ret = wait.msg_len;
+				if (u_msg_prio &&
+				    put_user(wait.msg_prio, u_msg_prio))
+					ret = -EFAULT;
+				goto out_fput;
+			}
 		}
 	} else {
 		msg_ptr = msg_get(info);
@@ -85,7 +85,7 @@ static int sysvipc_msg_proc_show(struct seq_file *s, void *it);
 
 void __init msg_init(void)
 {
-	ipc_init_ids(&msg_ids, msg_ctlmni);
+	ipc_init_ids(&msg_ids);
 	ipc_init_proc_interface("sysvipc/msg",
 				"       key      msqid perms      cbytes       qnum lspid lrpid   uid   gid  cuid  cgid      stime      rtime      ctime\n",
 				&msg_ids,
@@ -395,7 +395,7 @@ asmlinkage long sys_msgctl(int msqid, int cmd, struct msqid_ds __user *buf)
 
 		if (!buf)
 			return -EFAULT;
-		if (cmd == MSG_STAT && msqid >= msg_ids.entries->size)
+		if (cmd == MSG_STAT && msqid > msg_ids.max_id)
 			return -EINVAL;
 
 		memset(&tbuf, 0, sizeof(tbuf));
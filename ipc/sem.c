@@ -83,7 +83,6 @@
 #include "util.h"
 
 
-#define sem_lock(id)	((struct sem_array*)ipc_lock(&sem_ids,id))
 #define sem_unlock(sma)	ipc_unlock(&(sma)->sem_perm)
 #define sem_rmid(id)	((struct sem_array*)ipc_rmid(&sem_ids,id))
 #define sem_checkid(sma, semid)	\
@@ -104,8 +103,10 @@ static int sysvipc_sem_proc_show(struct seq_file *s, void *it);
 /*
  * linked list protection:
  *	sem_undo.id_next,
- *	sem_array.sem_pending{,last},
+ *	sem_array.sem_pending,
  *	sem_array.sem_undo: sem_lock() for read/write
+ *	sem.sem_pending: sem_lock(), or sem.lock while the array has no
+ *		operations on several semaphores pending
  *	sem_undo.proc_next: only "current" is allowed to read/write that field.
  *	
  */
@@ -118,10 +119,88 @@ int sem_ctls[4] = {SEMMSL, SEMMNS, SEMOPM, SEMMNI};
 
 static int used_sems;
 
+/*
+ * Locking:
+ * A semop() on a single semaphore only takes that semaphore's lock, so
+ * that operations on different semaphores of one array do not contend.
+ * Everything else, including semop()s on several semaphores at once,
+ * takes the array lock in sem_perm and then waits for the holders of
+ * the per-semaphore locks to leave.  A single-semaphore locker that
+ * finds the array lock held, or operations on several semaphores
+ * pending (sma->complex_count), backs off to the array lock: those
+ * pending operations may have to be woken by it.
+ */
+static void sem_wait_array(struct sem_array *sma)
+{
+	int i;
+
+	/* order taking sem_perm.lock before looking at the others */
+	smp_mb();
+	for (i = 0; i < sma->sem_nsems; i++)
+		spin_unlock_wait(&sma->sem_base[i].lock);
+	smp_rmb();
+}
+
+static inline struct sem_array *sem_lock(int id)
+{
+	struct sem_array *sma;
+
+	sma = (struct sem_array *)ipc_lock(&sem_ids, id);
+	if (sma)
+		sem_wait_array(sma);
+	return sma;
+}
+
+static inline void sem_lock_by_ptr(struct sem_array *sma)
+{
+	ipc_lock_by_ptr(&sma->sem_perm);
+	sem_wait_array(sma);
+}
+
+/*
+ * Lock @sma for the operations @sops, with rcu_read_lock() held.
+ * Returns the number of the semaphore locked, or -1 for the array lock.
+ */
+static int sem_lock_sops(struct sem_array *sma, struct sembuf *sops, int nsops)
+{
+	struct sem *sem;
+
+again:
+	if (nsops == 1 && !sma->complex_count) {
+		sem = sma->sem_base + sops->sem_num;
+		spin_lock(&sem->lock);
+		/* order taking sem->lock before looking at the array lock */
+		smp_mb();
+		if (unlikely(sma->complex_count)) {
+			spin_unlock(&sem->lock);
+			goto lock_array;
+		}
+		if (unlikely(spin_is_locked(&sma->sem_perm.lock))) {
+			spin_unlock(&sem->lock);
+			spin_unlock_wait(&sma->sem_perm.lock);
+			goto again;
+		}
+		return sops->sem_num;
+	}
+lock_array:
+	spin_lock(&sma->sem_perm.lock);
+	sem_wait_array(sma);
+	return -1;
+}
+
+static inline void sem_unlock_sops(struct sem_array *sma, int locknum)
+{
+	if (locknum == -1)
+		spin_unlock(&sma->sem_perm.lock);
+	else
+		spin_unlock(&sma->sem_base[locknum].lock);
+	rcu_read_unlock();
+}
+
 void __init sem_init (void)
 {
 	used_sems = 0;
-	ipc_init_ids(&sem_ids,sc_semmni);
+	ipc_init_ids(&sem_ids);
 	ipc_init_proc_interface("sysvipc/sem",
 				"       key      semid perms      nsems   uid   gid  cuid  cgid      otime      ctime\n",
 				&sem_ids,
@@ -133,7 +212,7 @@ void __init sem_init (void)
  * Without the check/retry algorithm a lockless wakeup is possible:
  * - queue.status is initialized to -EINTR before blocking.
  * - wakeup is performed by
- *	* unlinking the queue entry from sma->sem_pending
+ *	* unlinking the queue entry from its pending queue
  *	* setting queue.status to IN_WAKEUP
  *	  This is the notification for the blocked thread that a
  *	  result value is imminent.
@@ -164,7 +243,7 @@ void __init sem_init (void)
 
 static int newary (key_t key, int nsems, int semflg)
 {
-	int id;
+	int id, i;
 	int retval;
 	struct sem_array *sma;
 	int size;
@@ -184,6 +263,17 @@ static int newary (key_t key, int nsems, int semflg)
 	sma->sem_perm.mode = (semflg & S_IRWXUGO);
 	sma->sem_perm.key = key;
 
+	/* sem_lock_sops() looks at these before any lock is taken */
+	sma->sem_base = (struct sem *) &sma[1];
+	for (i = 0; i < nsems; i++) {
+		spin_lock_init(&sma->sem_base[i].lock);
+		INIT_LIST_HEAD(&sma->sem_base[i].sem_pending);
+	}
+	INIT_LIST_HEAD(&sma->sem_pending);
+	/* sma->complex_count = 0; */
+	/* sma->undo = NULL; */
+	sma->sem_nsems = nsems;
+
 	sma->sem_perm.security = NULL;
 	retval = security_sem_alloc(sma);
 	if (retval) {
@@ -200,11 +290,6 @@ static int newary (key_t key, int nsems, int semflg)
 	used_sems += nsems;
 
 	sma->sem_id = sem_buildid(id, sma->sem_perm.seq);
-	sma->sem_base = (struct sem *) &sma[1];
-	/* sma->sem_pending = NULL; */
-	sma->sem_pending_last = &sma->sem_pending;
-	/* sma->undo = NULL; */
-	sma->sem_nsems = nsems;
 	sma->sem_ctime = get_seconds();
 	sem_unlock(sma);
 
@@ -249,36 +334,32 @@ asmlinkage long sys_semget (key_t key, int nsems, int semflg)
 	return err;
 }
 
-/* Manage the doubly linked list sma->sem_pending as a FIFO:
- * insert new queue elements at the tail sma->sem_pending_last.
+/* Queue q behind the operations already waiting on the same semaphores:
+ * single operations on their semaphore's sem_pending, the others on the
+ * array's.  Operations that do not alter the array go first.
  */
-static inline void append_to_queue (struct sem_array * sma,
-				    struct sem_queue * q)
+static void add_to_queue (struct sem_array * sma, struct sem_queue * q)
 {
-	*(q->prev = sma->sem_pending_last) = q;
-	*(sma->sem_pending_last = &q->next) = NULL;
-}
+	struct list_head *pending;
 
-static inline void prepend_to_queue (struct sem_array * sma,
-				     struct sem_queue * q)
-{
-	q->next = sma->sem_pending;
-	*(q->prev = &sma->sem_pending) = q;
-	if (q->next)
-		q->next->prev = &q->next;
-	else /* sma->sem_pending_last == &sma->sem_pending */
-		sma->sem_pending_last = &q->next;
+	if (q->nsops == 1)
+		pending = &sma->sem_base[q->sops->sem_num].sem_pending;
+	else {
+		pending = &sma->sem_pending;
+		sma->complex_count++;
+	}
+	if (q->alter)
+		list_add_tail(&q->list, pending);
+	else
+		list_add(&q->list, pending);
 }
 
 static inline void remove_from_queue (struct sem_array * sma,
 				      struct sem_queue * q)
 {
-	*(q->prev) = q->next;
-	if (q->next)
-		q->next->prev = q->prev;
-	else /* sma->sem_pending_last == &q->next */
-		sma->sem_pending_last = q->prev;
-	q->prev = NULL; /* mark as removed */
+	list_del_init(&q->list);
+	if (q->nsops > 1)
+		sma->complex_count--;
 }
 
 /*
@@ -348,49 +429,94 @@ undo:
 	return result;
 }
 
-/* Go through the pending queue for the indicated semaphore
- * looking for tasks that can be completed.
+/* Hand the result of its operation to a sleeping task */
+static void wake_up_sem_queue (struct sem_queue * q, int error)
+{
+	q->status = IN_WAKEUP;
+	wake_up_process(q->sleeper);
+	/* hands-off: q will disappear immediately after
+	 * writing q->status.
+	 */
+	smp_wmb();
+	q->status = error;
+}
+
+/* Go through the pending queue of semaphore semnum, or the array's
+ * queue if semnum is -1, looking for tasks that can be completed.
+ * Returns 1 if any were.
  */
-static void update_queue (struct sem_array * sma)
+static int update_queue (struct sem_array * sma, int semnum)
 {
-	int error;
+	int error, progress = 0;
+	struct list_head *pending, *walk;
 	struct sem_queue * q;
 
-	q = sma->sem_pending;
-	while(q) {
+	if (semnum == -1)
+		pending = &sma->sem_pending;
+	else
+		pending = &sma->sem_base[semnum].sem_pending;
+again:
+	walk = pending->next;
+	while (walk != pending) {
+		q = list_entry(walk, struct sem_queue, list);
+		walk = walk->next;
+
+		/*
+		 * A semaphore's own queue only holds decrements behind
+		 * the waits for zero: none of them can succeed at zero.
+		 */
+		if (semnum != -1 && q->alter &&
+		    sma->sem_base[semnum].semval == 0)
+			break;
+
 		error = try_atomic_semop(sma, q->sops, q->nsops,
 					 q->undo, q->pid);
 
 		/* Does q->sleeper still need to sleep? */
-		if (error <= 0) {
-			struct sem_queue *n;
-			remove_from_queue(sma,q);
-			q->status = IN_WAKEUP;
-			/*
-			 * Continue scanning. The next operation
-			 * that must be checked depends on the type of the
-			 * completed operation:
-			 * - if the operation modified the array, then
-			 *   restart from the head of the queue and
-			 *   check for threads that might be waiting
-			 *   for semaphore values to become 0.
-			 * - if the operation didn't modify the array,
-			 *   then just continue.
-			 */
-			if (q->alter)
-				n = sma->sem_pending;
-			else
-				n = q->next;
-			wake_up_process(q->sleeper);
-			/* hands-off: q will disappear immediately after
-			 * writing q->status.
-			 */
-			smp_wmb();
-			q->status = error;
-			q = n;
-		} else {
-			q = q->next;
+		if (error > 0)
+			continue;
+
+		remove_from_queue(sma, q);
+		progress = 1;
+		wake_up_sem_queue(q, error);
+		/*
+		 * If the operation modified the array, restart from the
+		 * head of the queue and check for threads that might be
+		 * waiting for semaphore values to become 0.
+		 */
+		if (q->alter && !error)
+			goto again;
+	}
+	return progress;
+}
+
+/* Wake up the tasks whose operations the change made by sops allows,
+ * or look at every semaphore if sops is NULL.  Only the queues of the
+ * semaphores that changed are scanned; operations on several
+ * semaphores are checked last, and if any of them completes every
+ * semaphore is looked at again.
+ */
+static void do_smart_update (struct sem_array * sma, struct sembuf * sops,
+			     int nsops)
+{
+	int i;
+
+again:
+	if (sops) {
+		for (i = 0; i < nsops; i++) {
+			int semnum = sops[i].sem_num;
+
+			if (sops[i].sem_op > 0 || (sops[i].sem_op < 0 &&
+			    sma->sem_base[semnum].semval == 0))
+				update_queue(sma, semnum);
 		}
+	} else {
+		for (i = 0; i < sma->sem_nsems; i++)
+			update_queue(sma, i);
+	}
+	if (sma->complex_count && update_queue(sma, -1)) {
+		sops = NULL;
+		goto again;
 	}
 }
 
@@ -403,41 +529,36 @@ static void update_queue (struct sem_array * sma)
  * The counts we return here are a rough approximation, but still
  * warrant that semncnt+semzcnt>0 if the task is on the pending queue.
  */
-static int count_semncnt (struct sem_array * sma, ushort semnum)
+static int count_sem_waiters (struct list_head * pending, ushort semnum,
+			      int zero)
 {
-	int semncnt;
+	int count;
 	struct sem_queue * q;
 
-	semncnt = 0;
-	for (q = sma->sem_pending; q; q = q->next) {
+	count = 0;
+	list_for_each_entry(q, pending, list) {
 		struct sembuf * sops = q->sops;
 		int nsops = q->nsops;
 		int i;
 		for (i = 0; i < nsops; i++)
 			if (sops[i].sem_num == semnum
-			    && (sops[i].sem_op < 0)
+			    && (zero ? sops[i].sem_op == 0 : sops[i].sem_op < 0)
 			    && !(sops[i].sem_flg & IPC_NOWAIT))
-				semncnt++;
+				count++;
 	}
-	return semncnt;
+	return count;
 }
-static int count_semzcnt (struct sem_array * sma, ushort semnum)
+
+static int count_semncnt (struct sem_array * sma, ushort semnum)
 {
-	int semzcnt;
-	struct sem_queue * q;
+	return count_sem_waiters(&sma->sem_base[semnum].sem_pending, semnum, 0) +
+	       count_sem_waiters(&sma->sem_pending, semnum, 0);
+}
 
-	semzcnt = 0;
-	for (q = sma->sem_pending; q; q = q->next) {
-		struct sembuf * sops = q->sops;
-		int nsops = q->nsops;
-		int i;
-		for (i = 0; i < nsops; i++)
-			if (sops[i].sem_num == semnum
-			    && (sops[i].sem_op == 0)
-			    && !(sops[i].sem_flg & IPC_NOWAIT))
-				semzcnt++;
-	}
-	return semzcnt;
+static int count_semzcnt (struct sem_array * sma, ushort semnum)
+{
+	return count_sem_waiters(&sma->sem_base[semnum].sem_pending, semnum, 1) +
+	       count_sem_waiters(&sma->sem_pending, semnum, 1);
 }
 
 /* Free a semaphore set. freeary() is called with sem_ids.mutex locked and
@@ -447,8 +568,8 @@ static int count_semzcnt (struct sem_array * sma, ushort semnum)
 static void freeary (struct sem_array *sma, int id)
 {
 	struct sem_undo *un;
-	struct sem_queue *q;
-	int size;
+	struct sem_queue *q, *n;
+	int size, i;
 
 	/* Invalidate the existing undo structures for this semaphore set.
 	 * (They will be freed without any further action in exit_sem()
@@ -458,17 +579,16 @@ static void freeary (struct sem_array *sma, int id)
 		un->semid = -1;
 
 	/* Wake up all pending processes and let them fail with EIDRM. */
-	q = sma->sem_pending;
-	while(q) {
-		struct sem_queue *n;
-		/* lazy remove_from_queue: we are killing the whole queue */
-		q->prev = NULL;
-		n = q->next;
-		q->status = IN_WAKEUP;
-		wake_up_process(q->sleeper); /* doesn't sleep */
-		smp_wmb();
-		q->status = -EIDRM;	/* hands-off q */
-		q = n;
+	list_for_each_entry_safe(q, n, &sma->sem_pending, list) {
+		remove_from_queue(sma, q);
+		wake_up_sem_queue(q, -EIDRM);
+	}
+	for (i = 0; i < sma->sem_nsems; i++) {
+		struct sem *sem = sma->sem_base + i;
+		list_for_each_entry_safe(q, n, &sem->sem_pending, list) {
+			remove_from_queue(sma, q);
+			wake_up_sem_queue(q, -EIDRM);
+		}
 	}
 
 	/* Remove the semaphore set from the ID array*/
@@ -547,7 +667,7 @@ static int semctl_nolock(int semid, int semnum, int cmd, int version, union semu
 		struct semid64_ds tbuf;
 		int id;
 
-		if(semid >= sem_ids.entries->size)
+		if(semid > sem_ids.max_id)
 			return -EINVAL;
 
 		memset(&tbuf,0,sizeof(tbuf));
@@ -624,13 +744,13 @@ static int semctl_main(int semid, int semnum, int cmd, int version, union semun
 
 			sem_io = ipc_alloc(sizeof(ushort)*nsems);
 			if(sem_io == NULL) {
-				ipc_lock_by_ptr(&sma->sem_perm);
+				sem_lock_by_ptr(sma);
 				ipc_rcu_putref(sma);
 				sem_unlock(sma);
 				return -ENOMEM;
 			}
 
-			ipc_lock_by_ptr(&sma->sem_perm);
+			sem_lock_by_ptr(sma);
 			ipc_rcu_putref(sma);
 			if (sma->sem_perm.deleted) {
 				sem_unlock(sma);
@@ -658,7 +778,7 @@ static int semctl_main(int semid, int semnum, int cmd, int version, union semun
 		if(nsems > SEMMSL_FAST) {
 			sem_io = ipc_alloc(sizeof(ushort)*nsems);
 			if(sem_io == NULL) {
-				ipc_lock_by_ptr(&sma->sem_perm);
+				sem_lock_by_ptr(sma);
 				ipc_rcu_putref(sma);
 				sem_unlock(sma);
 				return -ENOMEM;
@@ -666,7 +786,7 @@ static int semctl_main(int semid, int semnum, int cmd, int version, union semun
 		}
 
 		if (copy_from_user (sem_io, arg.array, nsems*sizeof(ushort))) {
-			ipc_lock_by_ptr(&sma->sem_perm);
+			sem_lock_by_ptr(sma);
 			ipc_rcu_putref(sma);
 			sem_unlock(sma);
 			err = -EFAULT;
@@ -675,14 +795,14 @@ static int semctl_main(int semid, int semnum, int cmd, int version, union semun
 
 		for (i = 0; i < nsems; i++) {
 			if (sem_io[i] > SEMVMX) {
-				ipc_lock_by_ptr(&sma->sem_perm);
+				sem_lock_by_ptr(sma);
 				ipc_rcu_putref(sma);
 				sem_unlock(sma);
 				err = -ERANGE;
 				goto out_free;
 			}
 		}
-		ipc_lock_by_ptr(&sma->sem_perm);
+		sem_lock_by_ptr(sma);
 		ipc_rcu_putref(sma);
 		if (sma->sem_perm.deleted) {
 			sem_unlock(sma);
@@ -697,7 +817,7 @@ static int semctl_main(int semid, int semnum, int cmd, int version, union semun
 				un->semadj[i] = 0;
 		sma->sem_ctime = get_seconds();
 		/* maybe some queued-up processes were waiting for this */
-		update_queue(sma);
+		do_smart_update(sma, NULL, 0);
 		err = 0;
 		goto out_unlock;
 	}
@@ -749,7 +869,7 @@ static int semctl_main(int semid, int semnum, int cmd, int version, union semun
 		curr->sempid = current->tgid;
 		sma->sem_ctime = get_seconds();
 		/* maybe some queued-up processes were waiting for this */
-		update_queue(sma);
+		do_smart_update(sma, NULL, 0);
 		err = 0;
 		goto out_unlock;
 	}
@@ -1020,7 +1140,7 @@ static struct sem_undo *find_undo(int semid)
 
 	new = (struct sem_undo *) kmalloc(sizeof(struct sem_undo) + sizeof(short)*nsems, GFP_KERNEL);
 	if (!new) {
-		ipc_lock_by_ptr(&sma->sem_perm);
+		sem_lock_by_ptr(sma);
 		ipc_rcu_putref(sma);
 		sem_unlock(sma);
 		return ERR_PTR(-ENOMEM);
@@ -1034,12 +1154,12 @@ static struct sem_undo *find_undo(int semid)
 	if (un) {
 		unlock_semundo();
 		kfree(new);
-		ipc_lock_by_ptr(&sma->sem_perm);
+		sem_lock_by_ptr(sma);
 		ipc_rcu_putref(sma);
 		sem_unlock(sma);
 		goto out;
 	}
-	ipc_lock_by_ptr(&sma->sem_perm);
+	sem_lock_by_ptr(sma);
 	ipc_rcu_putref(sma);
 	if (sma->sem_perm.deleted) {
 		sem_unlock(sma);
@@ -1070,6 +1190,7 @@ asmlinkage long sys_semtimedop(int semid, struct sembuf __user *tsops,
 	int undos = 0, alter = 0, max;
 	struct sem_queue queue;
 	unsigned long jiffies_left = 0;
+	int locknum;
 
 	if (nsops < 1 || semid < 0)
 		return -EINVAL;
@@ -1117,12 +1238,21 @@ retry_undos:
 	} else
 		un = NULL;
 
-	sma = sem_lock(semid);
-	error=-EINVAL;
-	if(sma==NULL)
-		goto out_free;
+	rcu_read_lock();
+	sma = (struct sem_array *)ipc_obtain_object(&sem_ids, semid);
+	error = -EINVAL;
+	if (sma == NULL)
+		goto out_rcu_free;
 	error = -EIDRM;
 	if (sem_checkid(sma,semid))
+		goto out_rcu_free;
+	error = -EFBIG;
+	if (max >= sma->sem_nsems)
+		goto out_rcu_free;
+
+	locknum = sem_lock_sops(sma, sops, nsops);
+	error = -EINVAL;
+	if (sma->sem_perm.deleted)
 		goto out_unlock_free;
 	/*
 	 * semid identifies are not unique - find_undo may have
@@ -1130,12 +1260,9 @@ retry_undos:
 	 * and now a new array with received the same id. Check and retry.
 	 */
 	if (un && un->semid == -1) {
-		sem_unlock(sma);
+		sem_unlock_sops(sma, locknum);
 		goto retry_undos;
 	}
-	error = -EFBIG;
-	if (max >= sma->sem_nsems)
-		goto out_unlock_free;
 
 	error = -EACCES;
 	if (ipcperms(&sma->sem_perm, alter ? S_IWUGO : S_IRUGO))
@@ -1148,7 +1275,7 @@ retry_undos:
 	error = try_atomic_semop (sma, sops, nsops, un, current->tgid);
 	if (error <= 0) {
 		if (alter && error == 0)
-			update_queue (sma);
+			do_smart_update(sma, sops, nsops);
 		goto out_unlock_free;
 	}
 
@@ -1163,15 +1290,12 @@ retry_undos:
 	queue.pid = current->tgid;
 	queue.id = semid;
 	queue.alter = alter;
-	if (alter)
-		append_to_queue(sma ,&queue);
-	else
-		prepend_to_queue(sma ,&queue);
+	add_to_queue(sma, &queue);
 
 	queue.status = -EINTR;
 	queue.sleeper = current;
 	current->state = TASK_INTERRUPTIBLE;
-	sem_unlock(sma);
+	sem_unlock_sops(sma, locknum);
 
 	if (timeout)
 		jiffies_left = schedule_timeout(jiffies_left);
@@ -1190,9 +1314,22 @@ retry_undos:
 		goto out_free;
 	}
 
-	sma = sem_lock(semid);
-	if(sma==NULL) {
-		BUG_ON(queue.prev != NULL);
+	/*
+	 * The array may have been removed, and its slot reused, while we
+	 * slept: look it up again.  freeary() has dequeued us if so.
+	 */
+	rcu_read_lock();
+	sma = (struct sem_array *)ipc_obtain_object(&sem_ids, semid);
+	if (sma == NULL || sem_checkid(sma,semid)) {
+		rcu_read_unlock();
+		BUG_ON(!list_empty(&queue.list));
+		error = -EIDRM;
+		goto out_free;
+	}
+	locknum = sem_lock_sops(sma, sops, nsops);
+	if (sma->sem_perm.deleted) {
+		sem_unlock_sops(sma, locknum);
+		BUG_ON(!list_empty(&queue.list));
 		error = -EIDRM;
 		goto out_free;
 	}
@@ -1214,7 +1351,10 @@ retry_undos:
 	goto out_unlock_free;
 
 out_unlock_free:
-	sem_unlock(sma);
+	sem_unlock_sops(sma, locknum);
+	goto out_free;
+out_rcu_free:
+	rcu_read_unlock();
 out_free:
 	if(sops != fast_sops)
 		kfree(sops);
@@ -1334,7 +1474,7 @@ found:
 		}
 		sma->sem_otime = get_seconds();
 		/* maybe some queued-up processes were waiting for this */
-		update_queue(sma);
+		do_smart_update(sma, NULL, 0);
 next_entry:
 		sem_unlock(sma);
 	}
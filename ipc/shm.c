@@ -58,12 +58,13 @@ static int sysvipc_shm_proc_show(struct seq_file *s, void *it);
 size_t	shm_ctlmax = SHMMAX;
 size_t 	shm_ctlall = SHMALL;
 int 	shm_ctlmni = SHMMNI;
+int	shm_use_hugepages;	/* back segments with huge pages when possible */
 
 static int shm_tot; /* total number of shared memory pages */
 
 void __init shm_init (void)
 {
-	ipc_init_ids(&shm_ids, 1);
+	ipc_init_ids(&shm_ids);
 	ipc_init_proc_interface("sysvipc/shm",
 				"       key      shmid perms       size  cpid  lpid nattch   uid   gid  cuid  cgid      atime      dtime      ctime\n",
 				&shm_ids,
@@ -218,10 +219,23 @@ static int newseg (key_t key, int shmflg, size_t size)
 		return error;
 	}
 
+	/*
+	 * With shm_use_hugepages set, segments that are a whole number of
+	 * huge pages get them when there are enough reserved and the user
+	 * may use them, as if SHM_HUGETLB had been asked for; all others
+	 * fall back to tmpfs.
+	 */
+	file = ERR_PTR(-ENOSYS);
+	if (!(shmflg & SHM_HUGETLB) && shm_use_hugepages &&
+	    !(size & ~HPAGE_MASK))
+		file = hugetlb_zero_setup(size);
+
 	if (shmflg & SHM_HUGETLB) {
 		/* hugetlb_zero_setup takes care of mlock user accounting */
 		file = hugetlb_zero_setup(size);
 		shp->mlock_user = current->user;
+	} else if (!IS_ERR(file)) {
+		shp->mlock_user = current->user;
 	} else {
 		int acctflag = VM_ACCOUNT;
 		/*
@@ -254,7 +268,7 @@ static int newseg (key_t key, int shmflg, size_t size)
 	file->f_dentry->d_inode->i_ino = shp->id;
 
 	/* Hugetlb ops would have already been assigned. */
-	if (!(shmflg & SHM_HUGETLB))
+	if (!is_file_hugepages(file))
 		file->f_op = &shm_file_operations;
 
 	shm_tot += numpages;
@@ -12,6 +12,8 @@
  *            Mingming Cao <cmm@us.ibm.com>
  * Mar 2006 - support for audit of ipc object properties
  *            Dustin Kirkland <dustin.kirkland@us.ibm.com>
+ * Ids are kept in an idr, looked up under RCU, rather than in an array
+ * that had to be copied to grow.
  */
 
 #include <linux/mm.h>
@@ -60,21 +62,15 @@ __initcall(ipc_init);
 /**
  *	ipc_init_ids		-	initialise IPC identifiers
  *	@ids: Identifier set
- *	@size: Number of identifiers
  *
- *	Given a size for the ipc identifier range (limited below IPCMNI)
- *	set up the sequence range to use then allocate and initialise the
- *	array itself. 
+ *	Set up the sequence range to use and the empty idr mapping
+ *	identifiers to objects.
  */
  
-void __init ipc_init_ids(struct ipc_ids* ids, int size)
+void __init ipc_init_ids(struct ipc_ids* ids)
 {
-	int i;
-
 	mutex_init(&ids->mutex);
 
-	if(size > IPCMNI)
-		size = IPCMNI;
 	ids->in_use = 0;
 	ids->max_id = -1;
 	ids->seq = 0;
@@ -86,17 +82,7 @@ void __init ipc_init_ids(struct ipc_ids* ids, int size)
 		 	ids->seq_max = seq_limit;
 	}
 
-	ids->entries = ipc_rcu_alloc(sizeof(struct kern_ipc_perm *)*size +
-				     sizeof(struct ipc_id_ary));
-
-	if(ids->entries == NULL) {
-		printk(KERN_ERR "ipc_init_ids() failed, ipc service disabled.\n");
-		size = 0;
-		ids->entries = &ids->nullentry;
-	}
-	ids->entries->size = size;
-	for(i=0;i<size;i++)
-		ids->entries->p[i] = NULL;
+	idr_init(&ids->ipcs_idr);
 }
 
 #ifdef CONFIG_PROC_FS
@@ -151,12 +137,8 @@ int ipc_findkey(struct ipc_ids* ids, key_t key)
 	struct kern_ipc_perm* p;
 	int max_id = ids->max_id;
 
-	/*
-	 * rcu_dereference() is not needed here
-	 * since ipc_ids.mutex is held
-	 */
 	for (id = 0; id <= max_id; id++) {
-		p = ids->entries->p[id];
+		p = idr_find(&ids->ipcs_idr, id);
 		if(p==NULL)
 			continue;
 		if (key == p->key)
@@ -165,88 +147,62 @@ int ipc_findkey(struct ipc_ids* ids, key_t key)
 	return -1;
 }
 
-/*
- * Requires ipc_ids.mutex locked
- */
-static int grow_ary(struct ipc_ids* ids, int newsize)
-{
-	struct ipc_id_ary* new;
-	struct ipc_id_ary* old;
-	int i;
-	int size = ids->entries->size;
-
-	if(newsize > IPCMNI)
-		newsize = IPCMNI;
-	if(newsize <= size)
-		return newsize;
-
-	new = ipc_rcu_alloc(sizeof(struct kern_ipc_perm *)*newsize +
-			    sizeof(struct ipc_id_ary));
-	if(new == NULL)
-		return size;
-	new->size = newsize;
-	memcpy(new->p, ids->entries->p, sizeof(struct kern_ipc_perm *)*size);
-	for(i=size;i<newsize;i++) {
-		new->p[i] = NULL;
-	}
-	old = ids->entries;
-
-	/*
-	 * Use rcu_assign_pointer() to make sure the memcpyed contents
-	 * of the new array are visible before the new array becomes visible.
-	 */
-	rcu_assign_pointer(ids->entries, new);
-
-	ipc_rcu_putref(old);
-	return newsize;
-}
-
 /**
  *	ipc_addid 	-	add an IPC identifier
  *	@ids: IPC identifier set
  *	@new: new IPC permission set
- *	@size: new size limit for the id array
+ *	@size: limit on the number of identifiers in use
  *
- *	Add an entry 'new' to the IPC arrays. The permissions object is
- *	initialised and the first free entry is set up and the id assigned
- *	is returned. The list is returned in a locked state on success.
- *	On failure the list is not locked and -1 is returned.
+ *	Add an entry 'new' to the IPC identifier set. The permissions object
+ *	is initialised and the lowest free id is assigned and returned. The
+ *	entry is returned in a locked state on success.
+ *	On failure the entry is not locked and -1 is returned.
  *
  *	Called with ipc_ids.mutex held.
  */
  
 int ipc_addid(struct ipc_ids* ids, struct kern_ipc_perm* new, int size)
 {
-	int id;
+	int id, err;
 
-	size = grow_ary(ids,size);
+	if (size > IPCMNI)
+		size = IPCMNI;
+	if (ids->in_use >= size)
+		return -1;
+
+	new->cuid = new->uid = current->euid;
+	new->gid = new->cgid = current->egid;
 
+	new->seq = ids->seq;
+	spin_lock_init(&new->lock);
+	new->deleted = 0;
 	/*
-	 * rcu_dereference()() is not needed here since
-	 * ipc_ids.mutex is held
+	 * The lowest free id is below in_use, hence below size.  idr
+	 * publishes new with rcu_assign_pointer(), which orders the
+	 * stores above, and those callers made to new, before it:
+	 * ipc_obtain_object() users look at new before taking its lock.
 	 */
-	for (id = 0; id < size; id++) {
-		if(ids->entries->p[id] == NULL)
-			goto found;
+again:
+	if (!idr_pre_get(&ids->ipcs_idr, GFP_KERNEL))
+		return -1;
+	rcu_read_lock();
+	spin_lock(&new->lock);
+	err = idr_get_new(&ids->ipcs_idr, new, &id);
+	if (err) {
+		spin_unlock(&new->lock);
+		rcu_read_unlock();
+		if (err == -EAGAIN)
+			goto again;
+		return -1;
 	}
-	return -1;
-found:
+
 	ids->in_use++;
 	if (id > ids->max_id)
 		ids->max_id = id;
 
-	new->cuid = new->uid = current->euid;
-	new->gid = new->cgid = current->egid;
-
-	new->seq = ids->seq++;
+	ids->seq++;
 	if(ids->seq > ids->seq_max)
 		ids->seq = 0;
-
-	spin_lock_init(&new->lock);
-	new->deleted = 0;
-	rcu_read_lock();
-	spin_lock(&new->lock);
-	ids->entries->p[id] = new;
 	return id;
 }
 
@@ -267,15 +223,10 @@ struct kern_ipc_perm* ipc_rmid(struct ipc_ids* ids, int id)
 {
 	struct kern_ipc_perm* p;
 	int lid = id % SEQ_MULTIPLIER;
-	BUG_ON(lid >= ids->entries->size);
 
-	/* 
-	 * do not need a rcu_dereference()() here to force ordering
-	 * on Alpha, since the ipc_ids.mutex is held.
-	 */	
-	p = ids->entries->p[lid];
-	ids->entries->p[lid] = NULL;
+	p = idr_find(&ids->ipcs_idr, lid);
 	BUG_ON(p==NULL);
+	idr_remove(&ids->ipcs_idr, lid);
 	ids->in_use--;
 
 	if (lid == ids->max_id) {
@@ -283,7 +234,7 @@ struct kern_ipc_perm* ipc_rmid(struct ipc_ids* ids, int id)
 			lid--;
 			if(lid == -1)
 				break;
-		} while (ids->entries->p[lid] == NULL);
+		} while (idr_find(&ids->ipcs_idr, lid) == NULL);
 		ids->max_id = lid;
 	}
 	p->deleted = 1;
@@ -531,39 +482,23 @@ void ipc64_perm_to_ipc_perm (struct ipc64_perm *in, struct ipc_perm *out)
 }
 
 /*
- * So far only shm_get_stat() calls ipc_get() via shm_get(), so ipc_get()
- * is called with shm_ids.mutex locked.  Since grow_ary() is also called with
- * shm_ids.mutex down(for Shared Memory), there is no need to add read
- * barriers here to gurantee the writes in grow_ary() are seen in order 
- * here (for Alpha).
- *
- * However ipc_get() itself does not necessary require ipc_ids.mutex down. So
- * if in the future ipc_get() is used by other places without ipc_ids.mutex
- * down, then ipc_get() needs read memery barriers as ipc_lock() does.
+ * So far only shm_get_stat() calls ipc_get() via shm_get(), with
+ * shm_ids.mutex locked, so the object cannot go away under it.
  */
 struct kern_ipc_perm* ipc_get(struct ipc_ids* ids, int id)
 {
-	struct kern_ipc_perm* out;
 	int lid = id % SEQ_MULTIPLIER;
-	if(lid >= ids->entries->size)
-		return NULL;
-	out = ids->entries->p[lid];
-	return out;
+
+	return idr_find(&ids->ipcs_idr, lid);
 }
 
 struct kern_ipc_perm* ipc_lock(struct ipc_ids* ids, int id)
 {
 	struct kern_ipc_perm* out;
 	int lid = id % SEQ_MULTIPLIER;
-	struct ipc_id_ary* entries;
 
 	rcu_read_lock();
-	entries = rcu_dereference(ids->entries);
-	if(lid >= entries->size) {
-		rcu_read_unlock();
-		return NULL;
-	}
-	out = entries->p[lid];
+	out = idr_find(&ids->ipcs_idr, lid);
 	if(out == NULL) {
 		rcu_read_unlock();
 		return NULL;
@@ -581,6 +516,22 @@ struct kern_ipc_perm* ipc_lock(struct ipc_ids* ids, int id)
 	return out;
 }
 
+/**
+ *	ipc_obtain_object	-	look up an IPC identifier
+ *	@ids: identifier set
+ *	@id: identifier to look up
+ *
+ *	Like ipc_lock(), but leaves taking a lock to the caller, which
+ *	must hold rcu_read_lock() and check ->deleted once it has locked
+ *	the object.  Returns NULL if the id is not in use.
+ */
+struct kern_ipc_perm *ipc_obtain_object(struct ipc_ids *ids, int id)
+{
+	int lid = id % SEQ_MULTIPLIER;
+
+	return idr_find(&ids->ipcs_idr, lid);
+}
+
 void ipc_lock_by_ptr(struct kern_ipc_perm *perm)
 {
 	rcu_read_lock();
@@ -0,0 +1,202 @@
+/*
+ * kernel/async.c
+ *
+ * Asynchronous function calls, for boot-time device probing.
+ *
+ * async_schedule() queues a function to be run by a worker of the
+ * "async" workqueue and returns at once.  Each call is given a cookie,
+ * handed out in increasing order, and async_synchronize_cookie() waits
+ * for every call with a lower cookie to finish.  A probe that waits on
+ * its hardware runs while the next driver's initcall goes on, and when
+ * the results must be published in a fixed order (the names of disks,
+ * say) the probe waits on its own cookie before doing so: the slow part
+ * overlaps, and what userspace sees does not change from one boot to
+ * the next.
+ *
+ * init waits for everything scheduled to finish before it looks for a
+ * root filesystem, and so before the init sections are freed.
+ */
+
+#include <linux/async.h>
+#include <linux/module.h>
+#include <linux/init.h>
+#include <linux/kallsyms.h>
+#include <linux/sched.h>
+#include <linux/slab.h>
+#include <linux/wait.h>
+#include <linux/workqueue.h>
+#include <asm/div64.h>
+
+struct async_entry {
+	struct list_head list;
+	struct work_struct work;
+	async_cookie_t cookie;
+	async_func_ptr *func;
+	void *data;
+};
+
+static async_cookie_t next_cookie = 1;
+
+/* The calls scheduled and not yet finished, in cookie order */
+static LIST_HEAD(async_running);
+static DEFINE_SPINLOCK(async_lock);
+static DECLARE_WAIT_QUEUE_HEAD(async_done);
+
+static struct workqueue_struct *async_wq;
+
+static unsigned long long async_now(void)
+{
+	struct timespec ts;
+
+	getnstimeofday(&ts);
+	return timespec_to_ns(&ts);
+}
+
+static unsigned long long async_usecs_since(unsigned long long t0)
+{
+	unsigned long long delta = async_now() - t0;
+
+	do_div(delta, 1000);
+	return delta;
+}
+
+static async_cookie_t lowest_in_progress(void)
+{
+	async_cookie_t ret;
+	unsigned long flags;
+
+	spin_lock_irqsave(&async_lock, flags);
+	if (list_empty(&async_running))
+		ret = next_cookie;
+	else
+		ret = list_entry(async_running.next,
+				 struct async_entry, list)->cookie;
+	spin_unlock_irqrestore(&async_lock, flags);
+	return ret;
+}
+
+static void async_run_entry(void *data)
+{
+	struct async_entry *entry = data;
+	unsigned long long t0 = 0;
+	unsigned long flags;
+
+	if (initcall_debug) {
+		printk("calling  %lli_", (long long)entry->cookie);
+		print_fn_descriptor_symbol("%s() @ ",
+				(unsigned long)entry->func);
+		printk("%i\n", current->pid);
+		t0 = async_now();
+	}
+
+	entry->func(entry->data, entry->cookie);
+
+	if (initcall_debug) {
+		printk("initcall %lli_", (long long)entry->cookie);
+		print_fn_descriptor_symbol("%s()",
+				(unsigned long)entry->func);
+		printk(" returned after %llu usecs\n",
+		       async_usecs_since(t0));
+	}
+
+	spin_lock_irqsave(&async_lock, flags);
+	list_del(&entry->list);
+	spin_unlock_irqrestore(&async_lock, flags);
+	kfree(entry);
+
+	wake_up_all(&async_done);
+}
+
+/**
+ * async_schedule - run a function asynchronously
+ * @ptr: the function
+ * @data: its argument
+ *
+ * Returns the cookie of the call, which is also passed to @ptr.  If
+ * the call cannot be queued, it is made before returning.
+ */
+async_cookie_t async_schedule(async_func_ptr *ptr, void *data)
+{
+	struct async_entry *entry = NULL;
+	async_cookie_t cookie;
+	unsigned long flags;
+
+	if (async_wq)
+		entry = kmalloc(sizeof(*entry), GFP_KERNEL);
+	if (!entry) {
+		spin_lock_irqsave(&async_lock, flags);
+		cookie = next_cookie++;
+		spin_unlock_irqrestore(&async_lock, flags);
+
+		ptr(data, cookie);
+		return cookie;
+	}
+
+	INIT_WORK(&entry->work, async_run_entry, entry);
+	entry->func = ptr;
+	entry->data = data;
+
+	spin_lock_irqsave(&async_lock, flags);
+	cookie = entry->cookie = next_cookie++;
+	list_add_tail(&entry->list, &async_running);
+	spin_unlock_irqrestore(&async_lock, flags);
+
+	queue_work(async_wq, &entry->work);
+	return cookie;
+}
+EXPORT_SYMBOL_GPL(async_schedule);
+
+/**
+ * async_synchronize_cookie - wait for the calls scheduled before one
+ * @cookie: the cookie of the first call not to wait for
+ *
+ * Typically called by an asynchronous function with its own cookie,
+ * to order what it does next after the calls scheduled before it.
+ */
+void async_synchronize_cookie(async_cookie_t cookie)
+{
+	unsigned long long t0 = 0;
+
+	if (initcall_debug) {
+		printk("async_waiting @ %i\n", current->pid);
+		t0 = async_now();
+	}
+
+	wait_event(async_done, lowest_in_progress() >= cookie);
+
+	if (initcall_debug)
+		printk("async_continuing @ %i after %llu usecs\n",
+		       current->pid, async_usecs_since(t0));
+}
+EXPORT_SYMBOL_GPL(async_synchronize_cookie);
+
+/**
+ * async_synchronize_full - wait for all the calls scheduled so far
+ *
+ * Not to be called from an asynchronous function, which would wait on
+ * itself.
+ */
+void async_synchronize_full(void)
+{
+	unsigned long flags;
+	async_cookie_t cookie;
+
+	spin_lock_irqsave(&async_lock, flags);
+	cookie = next_cookie;
+	spin_unlock_irqrestore(&async_lock, flags);
+
+	async_synchronize_cookie(cookie);
+}
+EXPORT_SYMBOL_GPL(async_synchronize_full);
+
+static int __init async_init(void)
+{
+	/*
+	 * Probes mostly sleep on their hardware, which lets the worker
+	 * pool start the next one; let them all be in flight at once.
+	 */
+	async_wq = alloc_workqueue("async", 0, WQ_MAX_ACTIVE);
+	BUG_ON(!async_wq);
+	return 0;
+}
+core_initcall(async_init);
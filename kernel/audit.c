@@ -48,6 +48,7 @@
 #include <linux/module.h>
 #include <linux/err.h>
 #include <linux/kthread.h>
+#include <linux/percpu.h>
 
 #include <linux/audit.h>
 
@@ -117,7 +118,11 @@ static DEFINE_SPINLOCK(audit_freelist_lock);
 static int	   audit_freelist_count;
 static LIST_HEAD(audit_freelist);
 
-static struct sk_buff_head audit_skb_queue;
+/* Records waiting for kauditd, queued on the cpu that wrote them so that
+ * audit_log_end() does not bounce a single queue lock between cpus;
+ * audit_backlog is their total, for the backlog limit. */
+static DEFINE_PER_CPU(struct sk_buff_head, audit_skb_queue);
+static atomic_t audit_backlog = ATOMIC_INIT(0);
 static struct task_struct *kauditd_task;
 static DECLARE_WAIT_QUEUE_HEAD(kauditd_wait);
 static DECLARE_WAIT_QUEUE_HEAD(audit_backlog_wait);
@@ -336,31 +341,50 @@ static int audit_set_failure(int state, uid_t loginuid, u32 sid)
 	return 0;
 }
 
+static void kauditd_send_skb(struct sk_buff *skb)
+{
+	if (audit_pid) {
+		int err = netlink_unicast(audit_sock, skb, audit_pid, 0);
+		if (err < 0) {
+			BUG_ON(err != -ECONNREFUSED); /* Shoudn't happen */
+			printk(KERN_ERR "audit: *NO* daemon at audit_pid=%d\n", audit_pid);
+			audit_pid = 0;
+		}
+	} else {
+		printk(KERN_NOTICE "%s\n", skb->data + NLMSG_SPACE(0));
+		kfree_skb(skb);
+	}
+}
+
 static int kauditd_thread(void *dummy)
 {
 	struct sk_buff *skb;
+	int cpu, sent;
 
 	while (1) {
-		skb = skb_dequeue(&audit_skb_queue);
-		wake_up(&audit_backlog_wait);
-		if (skb) {
-			if (audit_pid) {
-				int err = netlink_unicast(audit_sock, skb, audit_pid, 0);
-				if (err < 0) {
-					BUG_ON(err != -ECONNREFUSED); /* Shoudn't happen */
-					printk(KERN_ERR "audit: *NO* daemon at audit_pid=%d\n", audit_pid);
-					audit_pid = 0;
-				}
-			} else {
-				printk(KERN_NOTICE "%s\n", skb->data + NLMSG_SPACE(0));
-				kfree_skb(skb);
+		sent = 0;
+		for_each_possible_cpu(cpu) {
+			struct sk_buff_head *q = &per_cpu(audit_skb_queue, cpu);
+			int n = skb_queue_len(q);
+
+			/* Only what is queued now, so that one busy cpu
+			 * cannot hold up the records of the others. */
+			while (n-- > 0 && (skb = skb_dequeue(q))) {
+				atomic_dec(&audit_backlog);
+				wake_up(&audit_backlog_wait);
+				kauditd_send_skb(skb);
+				sent++;
 			}
-		} else {
+		}
+		if (!sent) {
 			DECLARE_WAITQUEUE(wait, current);
+
+			wake_up(&audit_backlog_wait);
 			set_current_state(TASK_INTERRUPTIBLE);
 			add_wait_queue(&kauditd_wait, &wait);
+			smp_mb();
 
-			if (!skb_queue_len(&audit_skb_queue)) {
+			if (!atomic_read(&audit_backlog)) {
 				try_to_freeze();
 				schedule();
 			}
@@ -517,7 +541,7 @@ static int audit_receive_msg(struct sk_buff *skb, struct nlmsghdr *nlh)
 		status_set.rate_limit	 = audit_rate_limit;
 		status_set.backlog_limit = audit_backlog_limit;
 		status_set.lost		 = atomic_read(&audit_lost);
-		status_set.backlog	 = skb_queue_len(&audit_skb_queue);
+		status_set.backlog	 = atomic_read(&audit_backlog);
 		audit_send_reply(NETLINK_CB(skb).pid, seq, AUDIT_GET, 0, 0,
 				 &status_set, sizeof(status_set));
 		break;
@@ -701,7 +725,8 @@ static int __init audit_init(void)
 	else
 		audit_sock->sk_sndtimeo = MAX_SCHEDULE_TIMEOUT;
 
-	skb_queue_head_init(&audit_skb_queue);
+	for_each_possible_cpu(i)
+		skb_queue_head_init(&per_cpu(audit_skb_queue, i));
 	audit_initialized = 1;
 	audit_enabled = audit_default;
 
@@ -886,7 +911,7 @@ struct audit_buffer *audit_log_start(struct audit_context *ctx, gfp_t gfp_mask,
 				entries over the normal backlog limit */
 
 	while (audit_backlog_limit
-	       && skb_queue_len(&audit_skb_queue) > audit_backlog_limit + reserve) {
+	       && atomic_read(&audit_backlog) > audit_backlog_limit + reserve) {
 		if (gfp_mask & __GFP_WAIT && audit_backlog_wait_time
 		    && time_before(jiffies, timeout_start + audit_backlog_wait_time)) {
 
@@ -896,7 +921,7 @@ struct audit_buffer *audit_log_start(struct audit_context *ctx, gfp_t gfp_mask,
 			add_wait_queue(&audit_backlog_wait, &wait);
 
 			if (audit_backlog_limit &&
-			    skb_queue_len(&audit_skb_queue) > audit_backlog_limit)
+			    atomic_read(&audit_backlog) > audit_backlog_limit)
 				schedule_timeout(timeout_start + audit_backlog_wait_time - jiffies);
 
 			__set_current_state(TASK_RUNNING);
@@ -907,7 +932,7 @@ struct audit_buffer *audit_log_start(struct audit_context *ctx, gfp_t gfp_mask,
 			printk(KERN_WARNING
 			       "audit: audit_backlog=%d > "
 			       "audit_backlog_limit=%d\n",
-			       skb_queue_len(&audit_skb_queue),
+			       atomic_read(&audit_backlog),
 			       audit_backlog_limit);
 		audit_log_lost("backlog limit exceeded");
 		audit_backlog_wait_time = audit_backlog_wait_overflow;
@@ -1156,9 +1181,8 @@ void audit_log_d_path(struct audit_buffer *ab, const char *prefix,
  * @ab: the audit_buffer
  *
  * The netlink_* functions cannot be called inside an irq context, so
- * the audit buffer is placed on a queue and a tasklet is scheduled to
- * remove them from the queue outside the irq context.  May be called in
- * any context.
+ * the audit buffer is placed on this cpu's queue and kauditd is woken
+ * to send it from outside the irq context.  May be called in any context.
  */
 void audit_log_end(struct audit_buffer *ab)
 {
@@ -1170,9 +1194,15 @@ void audit_log_end(struct audit_buffer *ab)
 		if (audit_pid) {
 			struct nlmsghdr *nlh = (struct nlmsghdr *)ab->skb->data;
 			nlh->nlmsg_len = ab->skb->len - NLMSG_SPACE(0);
-			skb_queue_tail(&audit_skb_queue, ab->skb);
+			skb_queue_tail(&get_cpu_var(audit_skb_queue), ab->skb);
+			put_cpu_var(audit_skb_queue);
 			ab->skb = NULL;
-			wake_up_interruptible(&kauditd_wait);
+			atomic_inc(&audit_backlog);
+			/* pairs with kauditd's add_wait_queue() before it
+			 * looks at audit_backlog */
+			smp_mb__after_atomic_inc();
+			if (waitqueue_active(&kauditd_wait))
+				wake_up_interruptible(&kauditd_wait);
 		} else {
 			printk(KERN_NOTICE "%s\n", ab->skb->data + NLMSG_SPACE(0));
 		}
@@ -131,6 +131,13 @@ extern void audit_handle_ievent(struct inotify_watch *, u32, u32, u32,
 extern int selinux_audit_rule_update(void);
 
 #ifdef CONFIG_AUDITSYSCALL
+extern u32 audit_syscall_mask[AUDIT_NR_FILTERS][AUDIT_BITMASK_SIZE];
+
+static inline int audit_syscall_may_match(int listnr, int major)
+{
+	return audit_syscall_mask[listnr][AUDIT_WORD(major)] & AUDIT_BIT(major);
+}
+
 extern void __audit_signal_info(int sig, struct task_struct *t);
 static inline void audit_signal_info(int sig, struct task_struct *t)
 {
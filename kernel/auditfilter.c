@@ -1154,6 +1154,43 @@ static int audit_add_watch(struct audit_krule *krule, struct nameidata *ndp,
 	return ret;
 }
 
+#ifdef CONFIG_AUDITSYSCALL
+/* Fold in a new rule's syscalls; the barrier in list_add_rcu() makes
+ * them visible before the rule is. */
+static void audit_index_add(struct audit_krule *krule)
+{
+	int i;
+
+	for (i = 0; i < AUDIT_BITMASK_SIZE; i++)
+		audit_syscall_mask[krule->listnr][i] |= krule->mask[i];
+}
+
+/* Recompute a list's syscall index after a rule has left it.  Rules
+ * dropped elsewhere, with their watches, only leave it a superset.
+ * Caller must hold audit_filter_mutex. */
+static void audit_index_rebuild(u32 listnr)
+{
+	u32 mask[AUDIT_BITMASK_SIZE];
+	struct audit_entry *e;
+	int h, i;
+
+	memset(mask, 0, sizeof(mask));
+	list_for_each_entry(e, &audit_filter_list[listnr], list)
+		for (i = 0; i < AUDIT_BITMASK_SIZE; i++)
+			mask[i] |= e->rule.mask[i];
+	for (h = 0; h < AUDIT_INODE_BUCKETS; h++)
+		list_for_each_entry(e, &audit_inode_hash[h], list)
+			if (e->rule.listnr == listnr)
+				for (i = 0; i < AUDIT_BITMASK_SIZE; i++)
+					mask[i] |= e->rule.mask[i];
+	for (i = 0; i < AUDIT_BITMASK_SIZE; i++)
+		audit_syscall_mask[listnr][i] = mask[i];
+}
+#else
+#define audit_index_add(krule)		do { } while (0)
+#define audit_index_rebuild(listnr)	do { } while (0)
+#endif
+
 /* Add rule to given filterlist if not a duplicate. */
 static inline int audit_add_rule(struct audit_entry *entry,
 				 struct list_head *list)
@@ -1161,7 +1198,7 @@ static inline int audit_add_rule(struct audit_entry *entry,
 	struct audit_entry *e;
 	struct audit_field *inode_f = entry->rule.inode_f;
 	struct audit_watch *watch = entry->rule.watch;
-	struct nameidata *ndp, *ndw;
+	struct nameidata *ndp = NULL, *ndw = NULL;
 	int h, err, putnd_needed = 0;
 #ifdef CONFIG_AUDITSYSCALL
 	int dont_count = 0;
@@ -1205,6 +1242,7 @@ static inline int audit_add_rule(struct audit_entry *entry,
 		list = &audit_inode_hash[h];
 	}
 
+	audit_index_add(&entry->rule);
 	if (entry->rule.flags & AUDIT_FILTER_PREPEND) {
 		list_add_rcu(&entry->list, list);
 		entry->rule.flags &= ~AUDIT_FILTER_PREPEND;
@@ -1282,6 +1320,7 @@ static inline int audit_del_rule(struct audit_entry *entry,
 	}
 
 	list_del_rcu(&e->list);
+	audit_index_rebuild(e->rule.listnr);
 	call_rcu(&e->rcu, audit_free_rule_rcu);
 
 #ifdef CONFIG_AUDITSYSCALL
@@ -88,6 +88,11 @@ extern int audit_enabled;
 /* number of audit rules */
 int audit_n_rules;
 
+/* Per filter list, the syscalls that some rule on it can match: the union
+ * of the rules' masks, kept by auditfilter.c.  The entry and exit filters
+ * look here first, so that syscalls no rule names cost one test. */
+u32 audit_syscall_mask[AUDIT_NR_FILTERS][AUDIT_BITMASK_SIZE];
+
 /* When fs/namei.c:getname() is called, we store the pointer in name and
  * we don't let putname() free it (instead we free all of the saved
  * pointers at syscall exit time).
@@ -489,14 +494,18 @@ static enum audit_state audit_filter_task(struct task_struct *tsk)
  */
 static enum audit_state audit_filter_syscall(struct task_struct *tsk,
 					     struct audit_context *ctx,
-					     struct list_head *list)
+					     int listnr)
 {
+	struct list_head *list = &audit_filter_list[listnr];
 	struct audit_entry *e;
 	enum audit_state state;
 
 	if (audit_pid && tsk->tgid == audit_pid)
 		return AUDIT_DISABLED;
 
+	if (!audit_syscall_may_match(listnr, ctx->major))
+		return AUDIT_BUILD_CONTEXT;
+
 	rcu_read_lock();
 	if (!list_empty(list)) {
 		int word = AUDIT_WORD(ctx->major);
@@ -530,6 +539,9 @@ enum audit_state audit_filter_inodes(struct task_struct *tsk,
 	if (audit_pid && tsk->tgid == audit_pid)
 		return AUDIT_DISABLED;
 
+	if (!audit_syscall_may_match(AUDIT_FILTER_EXIT, ctx->major))
+		return AUDIT_BUILD_CONTEXT;
+
 	rcu_read_lock();
 	for (i = 0; i < ctx->name_count; i++) {
 		int word = AUDIT_WORD(ctx->major);
@@ -572,7 +584,7 @@ static inline struct audit_context *audit_get_context(struct task_struct *tsk,
 	if (context->in_syscall && !context->dummy && !context->auditable) {
 		enum audit_state state;
 
-		state = audit_filter_syscall(tsk, context, &audit_filter_list[AUDIT_FILTER_EXIT]);
+		state = audit_filter_syscall(tsk, context, AUDIT_FILTER_EXIT);
 		if (state == AUDIT_RECORD_CONTEXT) {
 			context->auditable = 1;
 			goto get_context;
@@ -1122,9 +1134,14 @@ void audit_syscall_entry(int arch, int major,
 	context->argv[3]    = a4;
 
 	state = context->state;
-	context->dummy = !audit_n_rules;
+	/* If no rule can pick this syscall, don't collect names and
+	 * aux data for it, unless the task is audited regardless. */
+	context->dummy = !audit_n_rules ||
+		(state != AUDIT_RECORD_CONTEXT &&
+		 !audit_syscall_may_match(AUDIT_FILTER_ENTRY, major) &&
+		 !audit_syscall_may_match(AUDIT_FILTER_EXIT, major));
 	if (!context->dummy && (state == AUDIT_SETUP_CONTEXT || state == AUDIT_BUILD_CONTEXT))
-		state = audit_filter_syscall(tsk, context, &audit_filter_list[AUDIT_FILTER_ENTRY]);
+		state = audit_filter_syscall(tsk, context, AUDIT_FILTER_ENTRY);
 	if (likely(state == AUDIT_DISABLED))
 		return;
 
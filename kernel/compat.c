@@ -550,6 +550,48 @@ long compat_sys_timer_gettime(timer_t timer_id,
 	return err;
 } 
 
+#ifdef CONFIG_TIMERFD
+
+asmlinkage long compat_sys_timerfd_settime(int ufd, int flags,
+		const struct compat_itimerspec __user *utmr,
+		struct compat_itimerspec __user *otmr)
+{
+	long err;
+	mm_segment_t oldfs;
+	struct itimerspec newts, oldts;
+
+	if (get_compat_itimerspec(&newts,
+				  (struct compat_itimerspec __user *) utmr))
+		return -EFAULT;
+	oldfs = get_fs();
+	set_fs(KERNEL_DS);
+	err = sys_timerfd_settime(ufd, flags,
+				  (struct itimerspec __user *) &newts,
+				  (struct itimerspec __user *) &oldts);
+	set_fs(oldfs);
+	if (!err && otmr && put_compat_itimerspec(otmr, &oldts))
+		return -EFAULT;
+	return err;
+}
+
+asmlinkage long compat_sys_timerfd_gettime(int ufd,
+		struct compat_itimerspec __user *otmr)
+{
+	long err;
+	mm_segment_t oldfs;
+	struct itimerspec ts;
+
+	oldfs = get_fs();
+	set_fs(KERNEL_DS);
+	err = sys_timerfd_gettime(ufd, (struct itimerspec __user *) &ts);
+	set_fs(oldfs);
+	if (!err && put_compat_itimerspec(otmr, &ts))
+		return -EFAULT;
+	return err;
+}
+
+#endif /* CONFIG_TIMERFD */
+
 long compat_sys_clock_settime(clockid_t which_clock,
 		struct compat_timespec __user *tp)
 {
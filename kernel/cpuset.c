@@ -49,6 +49,7 @@
 #include <linux/time.h>
 #include <linux/backing-dev.h>
 #include <linux/sort.h>
+#include <linux/blk-iogroup.h>
 
 #include <asm/uaccess.h>
 #include <asm/atomic.h>
@@ -99,6 +100,13 @@ struct cpuset {
 	int mems_generation;
 
 	struct fmeter fmeter;		/* memory_pressure filter */
+
+#ifdef CONFIG_FAIR_GROUP_SCHED
+	struct task_group *tg;		/* cpu scheduling group */
+#endif
+#ifdef CONFIG_BLK_IO_GROUP
+	struct io_group *iog;		/* block I/O group */
+#endif
 };
 
 /* bits in struct cpuset flags field */
@@ -176,6 +184,12 @@ static struct cpuset top_cpuset = {
 	.count = ATOMIC_INIT(0),
 	.sibling = LIST_HEAD_INIT(top_cpuset.sibling),
 	.children = LIST_HEAD_INIT(top_cpuset.children),
+#ifdef CONFIG_FAIR_GROUP_SCHED
+	.tg = &root_task_group,
+#endif
+#ifdef CONFIG_BLK_IO_GROUP
+	.iog = &root_io_group,
+#endif
 };
 
 static struct vfsmount *cpuset_mount;
@@ -303,6 +317,12 @@ static void cpuset_diput(struct dentry *dentry, struct inode *inode)
 	if (S_ISDIR(inode->i_mode)) {
 		struct cpuset *cs = dentry->d_fsdata;
 		BUG_ON(!(is_removed(cs)));
+#ifdef CONFIG_FAIR_GROUP_SCHED
+		sched_destroy_group(cs->tg);
+#endif
+#ifdef CONFIG_BLK_IO_GROUP
+		io_group_put(cs->iog);
+#endif
 		kfree(cs);
 	}
 	iput(inode);
@@ -1230,6 +1250,9 @@ static int attach_task(struct cpuset *cs, char *pidbuf, char **ppathbuf)
 	}
 	atomic_inc(&cs->count);
 	rcu_assign_pointer(tsk->cpuset, cs);
+#ifdef CONFIG_FAIR_GROUP_SCHED
+	sched_move_task(tsk, cs->tg);
+#endif
 	task_unlock(tsk);
 
 	guarantee_online_cpus(cs, &cpus);
@@ -1271,8 +1294,91 @@ typedef enum {
 	FILE_SPREAD_PAGE,
 	FILE_SPREAD_SLAB,
 	FILE_TASKLIST,
+	FILE_CPU_SHARES,
+	FILE_CPU_QUOTA,
+	FILE_CPU_PERIOD,
+	FILE_IO_WEIGHT,
+	FILE_IO_BPS,
+	FILE_IO_IOPS,
+	FILE_IO_STAT,
 } cpuset_filetype_t;
 
+#ifdef CONFIG_FAIR_GROUP_SCHED
+/*
+ * update_cpu_sched - set the cpu shares, quota or period of a cpuset's
+ * scheduling group.  The quota is in usecs per period on each cpu,
+ * -1 meaning no limit.
+ *
+ * Call with manage_mutex held.
+ */
+
+static int update_cpu_sched(struct cpuset *cs, cpuset_filetype_t type,
+			    char *buf)
+{
+	struct task_group *tg = cs->tg;
+	long val = simple_strtol(buf, NULL, 10);
+
+	switch (type) {
+	case FILE_CPU_SHARES:
+		if (val <= 0)
+			return -EINVAL;
+		return sched_group_set_shares(tg, val);
+	case FILE_CPU_QUOTA:
+		return sched_group_set_bandwidth(tg, val,
+						 sched_group_period(tg));
+	case FILE_CPU_PERIOD:
+		return sched_group_set_bandwidth(tg, sched_group_quota(tg),
+						 val);
+	default:
+		return -EINVAL;
+	}
+}
+#endif
+
+#ifdef CONFIG_BLK_IO_GROUP
+/*
+ * update_io_group - set the weight or a limit of a cpuset's block I/O
+ * group.  The limits are in bytes and in I/Os per second, 0 meaning no
+ * limit.
+ *
+ * Call with manage_mutex held.
+ */
+
+static int update_io_group(struct cpuset *cs, cpuset_filetype_t type,
+			   char *buf)
+{
+	struct io_group *iog = cs->iog;
+	unsigned long long val = simple_strtoull(buf, NULL, 10);
+
+	switch (type) {
+	case FILE_IO_WEIGHT:
+		return io_group_set_weight(iog, val);
+	case FILE_IO_BPS:
+		return io_group_set_limit(iog, 0, val);
+	case FILE_IO_IOPS:
+		return io_group_set_limit(iog, 1, val);
+	default:
+		return -EINVAL;
+	}
+}
+
+/*
+ * The I/O group of the current task, for the block layer to account its
+ * I/O to.  Returns with a reference held on the group.
+ */
+struct io_group *cpuset_get_io_group(void)
+{
+	struct io_group *iog;
+
+	rcu_read_lock();
+	iog = rcu_dereference(current->cpuset)->iog;
+	io_group_get(iog);
+	rcu_read_unlock();
+	return iog;
+}
+EXPORT_SYMBOL_GPL(cpuset_get_io_group);
+#endif
+
 static ssize_t cpuset_common_file_write(struct file *file, const char __user *userbuf,
 					size_t nbytes, loff_t *unused_ppos)
 {
@@ -1340,6 +1446,23 @@ static ssize_t cpuset_common_file_write(struct file *file, const char __user *us
 	case FILE_TASKLIST:
 		retval = attach_task(cs, buffer, &pathbuf);
 		break;
+#ifdef CONFIG_FAIR_GROUP_SCHED
+	case FILE_CPU_SHARES:
+	case FILE_CPU_QUOTA:
+	case FILE_CPU_PERIOD:
+		retval = update_cpu_sched(cs, type, buffer);
+		break;
+#endif
+#ifdef CONFIG_BLK_IO_GROUP
+	case FILE_IO_WEIGHT:
+	case FILE_IO_BPS:
+	case FILE_IO_IOPS:
+		retval = update_io_group(cs, type, buffer);
+		break;
+	case FILE_IO_STAT:
+		retval = -EACCES;
+		break;
+#endif
 	default:
 		retval = -EINVAL;
 		goto out2;
@@ -1452,6 +1575,31 @@ static ssize_t cpuset_common_file_read(struct file *file, char __user *buf,
 	case FILE_SPREAD_SLAB:
 		*s++ = is_spread_slab(cs) ? '1' : '0';
 		break;
+#ifdef CONFIG_FAIR_GROUP_SCHED
+	case FILE_CPU_SHARES:
+		s += sprintf(s, "%lu", sched_group_shares(cs->tg));
+		break;
+	case FILE_CPU_QUOTA:
+		s += sprintf(s, "%ld", sched_group_quota(cs->tg));
+		break;
+	case FILE_CPU_PERIOD:
+		s += sprintf(s, "%ld", sched_group_period(cs->tg));
+		break;
+#endif
+#ifdef CONFIG_BLK_IO_GROUP
+	case FILE_IO_WEIGHT:
+		s += sprintf(s, "%u", cs->iog->weight);
+		break;
+	case FILE_IO_BPS:
+		s += sprintf(s, "%llu", (unsigned long long)cs->iog->bps.limit);
+		break;
+	case FILE_IO_IOPS:
+		s += sprintf(s, "%llu", (unsigned long long)cs->iog->iops.limit);
+		break;
+	case FILE_IO_STAT:
+		s += io_group_stat(cs->iog, s);
+		break;
+#endif
 	default:
 		retval = -EINVAL;
 		goto out;
@@ -1825,6 +1973,45 @@ static struct cftype cft_spread_slab = {
 	.private = FILE_SPREAD_SLAB,
 };
 
+#ifdef CONFIG_FAIR_GROUP_SCHED
+static struct cftype cft_cpu_shares = {
+	.name = "cpu_shares",
+	.private = FILE_CPU_SHARES,
+};
+
+static struct cftype cft_cpu_quota = {
+	.name = "cpu_quota_us",
+	.private = FILE_CPU_QUOTA,
+};
+
+static struct cftype cft_cpu_period = {
+	.name = "cpu_period_us",
+	.private = FILE_CPU_PERIOD,
+};
+#endif
+
+#ifdef CONFIG_BLK_IO_GROUP
+static struct cftype cft_io_weight = {
+	.name = "io_weight",
+	.private = FILE_IO_WEIGHT,
+};
+
+static struct cftype cft_io_bps = {
+	.name = "io_bps_limit",
+	.private = FILE_IO_BPS,
+};
+
+static struct cftype cft_io_iops = {
+	.name = "io_iops_limit",
+	.private = FILE_IO_IOPS,
+};
+
+static struct cftype cft_io_stat = {
+	.name = "io_stat",
+	.private = FILE_IO_STAT,
+};
+#endif
+
 static int cpuset_populate_dir(struct dentry *cs_dentry)
 {
 	int err;
@@ -1847,6 +2034,24 @@ static int cpuset_populate_dir(struct dentry *cs_dentry)
 		return err;
 	if ((err = cpuset_add_file(cs_dentry, &cft_spread_slab)) < 0)
 		return err;
+#ifdef CONFIG_FAIR_GROUP_SCHED
+	if ((err = cpuset_add_file(cs_dentry, &cft_cpu_shares)) < 0)
+		return err;
+	if ((err = cpuset_add_file(cs_dentry, &cft_cpu_quota)) < 0)
+		return err;
+	if ((err = cpuset_add_file(cs_dentry, &cft_cpu_period)) < 0)
+		return err;
+#endif
+#ifdef CONFIG_BLK_IO_GROUP
+	if ((err = cpuset_add_file(cs_dentry, &cft_io_weight)) < 0)
+		return err;
+	if ((err = cpuset_add_file(cs_dentry, &cft_io_bps)) < 0)
+		return err;
+	if ((err = cpuset_add_file(cs_dentry, &cft_io_iops)) < 0)
+		return err;
+	if ((err = cpuset_add_file(cs_dentry, &cft_io_stat)) < 0)
+		return err;
+#endif
 	if ((err = cpuset_add_file(cs_dentry, &cft_tasks)) < 0)
 		return err;
 	return 0;
@@ -1869,6 +2074,25 @@ static long cpuset_create(struct cpuset *parent, const char *name, int mode)
 	cs = kmalloc(sizeof(*cs), GFP_KERNEL);
 	if (!cs)
 		return -ENOMEM;
+#ifdef CONFIG_FAIR_GROUP_SCHED
+	cs->tg = sched_create_group(parent->tg);
+	if (IS_ERR(cs->tg)) {
+		err = PTR_ERR(cs->tg);
+		kfree(cs);
+		return err;
+	}
+#endif
+#ifdef CONFIG_BLK_IO_GROUP
+	cs->iog = io_group_create(parent->iog);
+	if (IS_ERR(cs->iog)) {
+		err = PTR_ERR(cs->iog);
+#ifdef CONFIG_FAIR_GROUP_SCHED
+		sched_destroy_group(cs->tg);
+#endif
+		kfree(cs);
+		return err;
+	}
+#endif
 
 	mutex_lock(&manage_mutex);
 	cpuset_update_task_memory_state();
@@ -1911,6 +2135,12 @@ static long cpuset_create(struct cpuset *parent, const char *name, int mode)
 err:
 	list_del(&cs->sibling);
 	mutex_unlock(&manage_mutex);
+#ifdef CONFIG_FAIR_GROUP_SCHED
+	sched_destroy_group(cs->tg);
+#endif
+#ifdef CONFIG_BLK_IO_GROUP
+	io_group_put(cs->iog);
+#endif
 	kfree(cs);
 	return err;
 }
@@ -2101,6 +2331,9 @@ void cpuset_fork(struct task_struct *child)
 	task_lock(current);
 	child->cpuset = current->cpuset;
 	atomic_inc(&child->cpuset->count);
+#ifdef CONFIG_FAIR_GROUP_SCHED
+	sched_group_fork(child, child->cpuset->tg);
+#endif
 	task_unlock(current);
 }
 
@@ -2169,6 +2402,10 @@ void cpuset_exit(struct task_struct *tsk)
 
 	cs = tsk->cpuset;
 	tsk->cpuset = &top_cpuset;	/* the_top_cpuset_hack - see above */
+#ifdef CONFIG_FAIR_GROUP_SCHED
+	if (cs != &top_cpuset)
+		sched_move_task(tsk, &root_task_group);
+#endif
 
 	if (notify_on_release(cs)) {
 		char *pathbuf = NULL;
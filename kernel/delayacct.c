@@ -56,13 +56,32 @@ static inline void delayacct_start(struct timespec *start)
 	do_posix_clock_monotonic_gettime(start);
 }
 
+#ifdef CONFIG_TASK_DELAY_HIST
+/*
+ * Histogram bucket of a delay: below 2^14 nsecs, then one per power
+ * of two, see struct taskstats
+ */
+static inline int delayacct_hist_bucket(s64 ns)
+{
+	int bucket = 0;
+
+	ns >>= 14;
+	while (ns && bucket < TASKSTATS_DELAY_HIST - 1) {
+		ns >>= 1;
+		bucket++;
+	}
+	return bucket;
+}
+#endif
+
 /*
  * Finish delay accounting for a statistic using
- * its timestamps (@start, @end), accumalator (@total) and @count
+ * its timestamps (@start, @end), accumalator (@total), @count
+ * and histogram (@hist)
  */
 
 static void delayacct_end(struct timespec *start, struct timespec *end,
-				u64 *total, u32 *count)
+				u64 *total, u32 *count, u32 *hist)
 {
 	struct timespec ts;
 	s64 ns;
@@ -76,9 +95,18 @@ static void delayacct_end(struct timespec *start, struct timespec *end,
 	spin_lock(&current->delays->lock);
 	*total += ns;
 	(*count)++;
+#ifdef CONFIG_TASK_DELAY_HIST
+	hist[delayacct_hist_bucket(ns)]++;
+#endif
 	spin_unlock(&current->delays->lock);
 }
 
+#ifdef CONFIG_TASK_DELAY_HIST
+#define DELAYACCT_HIST(hist)	(hist)
+#else
+#define DELAYACCT_HIST(hist)	NULL
+#endif
+
 void __delayacct_blkio_start(void)
 {
 	delayacct_start(&current->delays->blkio_start);
@@ -91,12 +119,14 @@ void __delayacct_blkio_end(void)
 		delayacct_end(&current->delays->blkio_start,
 			&current->delays->blkio_end,
 			&current->delays->swapin_delay,
-			&current->delays->swapin_count);
+			&current->delays->swapin_count,
+			DELAYACCT_HIST(current->delays->swapin_hist));
 	else	/* Other block I/O */
 		delayacct_end(&current->delays->blkio_start,
 			&current->delays->blkio_end,
 			&current->delays->blkio_delay,
-			&current->delays->blkio_count);
+			&current->delays->blkio_count,
+			DELAYACCT_HIST(current->delays->blkio_hist));
 }
 
 int __delayacct_add_tsk(struct taskstats *d, struct task_struct *tsk)
@@ -104,6 +134,9 @@ int __delayacct_add_tsk(struct taskstats *d, struct task_struct *tsk)
 	s64 tmp;
 	struct timespec ts;
 	unsigned long t1,t2,t3;
+#ifdef CONFIG_TASK_DELAY_HIST
+	int i;
+#endif
 
 	/* Though tsk->delays accessed later, early exit avoids
 	 * unnecessary returning of other data
@@ -143,6 +176,12 @@ int __delayacct_add_tsk(struct taskstats *d, struct task_struct *tsk)
 	d->swapin_delay_total = (tmp < d->swapin_delay_total) ? 0 : tmp;
 	d->blkio_count += tsk->delays->blkio_count;
 	d->swapin_count += tsk->delays->swapin_count;
+#ifdef CONFIG_TASK_DELAY_HIST
+	for (i = 0; i < TASKSTATS_DELAY_HIST; i++) {
+		d->blkio_delay_hist[i] += tsk->delays->blkio_hist[i];
+		d->swapin_delay_hist[i] += tsk->delays->swapin_hist[i];
+	}
+#endif
 	spin_unlock(&tsk->delays->lock);
 
 done:
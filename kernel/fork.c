@@ -41,10 +41,15 @@
 #include <linux/audit.h>
 #include <linux/profile.h>
 #include <linux/rmap.h>
+#include <linux/huge_mm.h>
+#include <linux/ksm.h>
+#include <linux/numa_balancing.h>
 #include <linux/acct.h>
 #include <linux/cn_proc.h>
 #include <linux/delayacct.h>
 #include <linux/taskstats_kern.h>
+#include <linux/task_io_accounting_ops.h>
+#include <linux/perf_counter.h>
 
 #include <asm/pgtable.h>
 #include <asm/pgalloc.h>
@@ -104,6 +109,8 @@ void free_task(struct task_struct *tsk)
 {
 	free_thread_info(tsk->thread_info);
 	rt_mutex_debug_task_free(tsk);
+	task_numa_free(tsk);
+	perf_counter_free_task(tsk);
 	free_task_struct(tsk);
 }
 EXPORT_SYMBOL(free_task);
@@ -180,6 +187,7 @@ static struct task_struct *dup_task_struct(struct task_struct *orig)
 	atomic_set(&tsk->fs_excl, 0);
 	tsk->btrace_seq = 0;
 	tsk->splice_pipe = NULL;
+	task_numa_init(tsk);
 	return tsk;
 }
 
@@ -276,6 +284,10 @@ static inline int dup_mmap(struct mm_struct *mm, struct mm_struct *oldmm)
 		if (retval)
 			goto out;
 	}
+	/* the child's huge pages were split: let khugepaged rebuild them */
+	khugepaged_fork(mm, oldmm);
+	ksm_fork(mm, oldmm);
+	numa_balancing_fork(mm, oldmm);
 	retval = 0;
 out:
 	up_write(&mm->mmap_sem);
@@ -330,6 +342,18 @@ static struct mm_struct * mm_init(struct mm_struct * mm)
 	mm->ioctx_list = NULL;
 	mm->free_area_cache = TASK_UNMAPPED_BASE;
 	mm->cached_hole_size = ~0UL;
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+	INIT_LIST_HEAD(&mm->pmd_huge_pte);
+	INIT_LIST_HEAD(&mm->khugepaged_link);
+#endif
+#ifdef CONFIG_KSM
+	mm->ksm_mm_slot = NULL;
+#endif
+#ifdef CONFIG_NUMA_BALANCING
+	INIT_LIST_HEAD(&mm->numa_link);
+	mm->numa_scan_offset = 0;
+	mm->numa_scan_seq = 0;
+#endif
 
 	if (likely(!mm_alloc_pgd(mm))) {
 		mm->def_flags = 0;
@@ -376,6 +400,7 @@ void mmput(struct mm_struct *mm)
 
 	if (atomic_dec_and_test(&mm->mm_users)) {
 		exit_aio(mm);
+		ksm_exit(mm);
 		exit_mmap(mm);
 		if (!list_empty(&mm->mmlist)) {
 			spin_lock(&mmlist_lock);
@@ -844,6 +869,8 @@ static inline int copy_signal(unsigned long clone_flags, struct task_struct * ts
 	sig->group_stop_count = 0;
 	sig->curr_target = NULL;
 	init_sigpending(&sig->shared_pending);
+	INIT_LIST_HEAD(&sig->sigqueue_cache);
+	sig->nr_sigqueue_cache = 0;
 	INIT_LIST_HEAD(&sig->posix_timers);
 
 	hrtimer_init(&sig->real_timer, CLOCK_MONOTONIC, HRTIMER_REL);
@@ -887,6 +914,7 @@ static inline int copy_signal(unsigned long clone_flags, struct task_struct * ts
 
 void __cleanup_signal(struct signal_struct *sig)
 {
+	flush_sigqueue_cache(sig);
 	exit_thread_group_keys(sig);
 	taskstats_tgid_free(sig);
 	kmem_cache_free(signal_cachep, sig);
@@ -906,7 +934,7 @@ static inline void copy_flags(unsigned long clone_flags, struct task_struct *p)
 {
 	unsigned long new_flags = p->flags;
 
-	new_flags &= ~(PF_SUPERPRIV | PF_NOFREEZE);
+	new_flags &= ~(PF_SUPERPRIV | PF_NOFREEZE | PF_WQ_WORKER);
 	new_flags |= PF_FORKNOEXEC;
 	if (!(clone_flags & CLONE_PTRACE))
 		p->ptrace = 0;
@@ -929,6 +957,19 @@ static inline void rt_mutex_init_task(struct task_struct *p)
 #endif
 }
 
+static inline void rcu_preempt_init_task(struct task_struct *p)
+{
+#ifdef CONFIG_PREEMPT_RCU
+	p->rcu_read_lock_nesting = 0;
+	p->rcu_read_unlock_special = 0;
+	p->rcu_blocked_node = NULL;
+	INIT_LIST_HEAD(&p->rcu_node_entry);
+#ifdef CONFIG_RCU_BOOST
+	p->rcu_boosted = 0;
+#endif
+#endif
+}
+
 /*
  * This creates a new process as a copy of the old one,
  * but does not actually start it yet.
@@ -974,6 +1015,7 @@ static struct task_struct *copy_process(unsigned long clone_flags,
 	p = dup_task_struct(current);
 	if (!p)
 		goto fork_out;
+	perf_counter_init_task(p);	/* before any path to free_task() */
 
 #ifdef CONFIG_TRACE_IRQFLAGS
 	DEBUG_LOCKS_WARN_ON(!p->hardirqs_enabled);
@@ -1029,7 +1071,11 @@ static struct task_struct *copy_process(unsigned long clone_flags,
 	p->wchar = 0;		/* I/O counter: bytes written */
 	p->syscr = 0;		/* I/O counter: read syscalls */
 	p->syscw = 0;		/* I/O counter: write syscalls */
+	task_io_accounting_init(p);
 	acct_clear_integrals(p);
+#ifdef SPLIT_RSS_COUNTING
+	memset(&p->rss_stat, 0, sizeof(p->rss_stat));
+#endif
 
  	p->it_virt_expires = cputime_zero;
 	p->it_prof_expires = cputime_zero;
@@ -1042,6 +1088,7 @@ static struct task_struct *copy_process(unsigned long clone_flags,
 	do_posix_clock_monotonic_gettime(&p->start_time);
 	p->security = NULL;
 	p->io_context = NULL;
+	p->plug = NULL;
 	p->io_wait = NULL;
 	p->audit_context = NULL;
 	cpuset_fork(p);
@@ -1076,6 +1123,7 @@ static struct task_struct *copy_process(unsigned long clone_flags,
 #endif
 
 	rt_mutex_init_task(p);
+	rcu_preempt_init_task(p);
 
 #ifdef CONFIG_DEBUG_MUTEXES
 	p->blocked_on = NULL; /* not blocked yet */
@@ -1410,8 +1458,10 @@ static void sighand_ctor(void *data, kmem_cache_t *cachep, unsigned long flags)
 	struct sighand_struct *sighand = data;
 
 	if ((flags & (SLAB_CTOR_VERIFY | SLAB_CTOR_CONSTRUCTOR)) ==
-					SLAB_CTOR_CONSTRUCTOR)
+					SLAB_CTOR_CONSTRUCTOR) {
 		spin_lock_init(&sighand->siglock);
+		init_waitqueue_head(&sighand->signalfd_wqh);
+	}
 }
 
 void __init proc_caches_init(void)
@@ -1431,6 +1481,10 @@ void __init proc_caches_init(void)
 			SLAB_HWCACHE_ALIGN|SLAB_PANIC, NULL, NULL);
 	vm_area_cachep = kmem_cache_create("vm_area_struct",
 			sizeof(struct vm_area_struct), 0,
+#ifdef CONFIG_SPECULATIVE_PAGE_FAULT
+			/* speculative faults walk vmas under RCU */
+			SLAB_DESTROY_BY_RCU|
+#endif
 			SLAB_PANIC, NULL, NULL);
 	mm_cachep = kmem_cache_create("mm_struct",
 			sizeof(struct mm_struct), ARCH_MIN_MMSTRUCT_ALIGN,
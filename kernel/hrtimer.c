@@ -37,6 +37,7 @@
 #include <linux/notifier.h>
 #include <linux/syscalls.h>
 #include <linux/interrupt.h>
+#include <linux/clockchips.h>
 
 #include <asm/uaccess.h>
 
@@ -45,7 +46,7 @@
  *
  * returns the time in ktime_t format
  */
-static ktime_t ktime_get(void)
+ktime_t ktime_get(void)
 {
 	struct timespec now;
 
@@ -53,6 +54,7 @@ static ktime_t ktime_get(void)
 
 	return timespec_to_ktime(now);
 }
+EXPORT_SYMBOL_GPL(ktime_get);
 
 /**
  * ktime_get_real - get the real (wall-) time in ktime_t format
@@ -80,8 +82,6 @@ EXPORT_SYMBOL_GPL(ktime_get_real);
  * rather than moving them into the range of valid clock id's.
  */
 
-#define MAX_HRTIMER_BASES 2
-
 static DEFINE_PER_CPU(struct hrtimer_base, hrtimer_bases[MAX_HRTIMER_BASES]) =
 {
 	{
@@ -96,6 +96,18 @@ static DEFINE_PER_CPU(struct hrtimer_base, hrtimer_bases[MAX_HRTIMER_BASES]) =
 	},
 };
 
+static DEFINE_PER_CPU(struct hrtimer_hres, hrtimer_hres);
+
+struct hrtimer_base *hrtimer_cpu_bases(int cpu)
+{
+	return per_cpu(hrtimer_bases, cpu);
+}
+
+struct hrtimer_hres *hrtimer_cpu_hres(int cpu)
+{
+	return &per_cpu(hrtimer_hres, cpu);
+}
+
 /**
  * ktime_get_ts - get the monotonic clock in timespec format
  * @ts:		pointer to timespec variable
@@ -406,6 +418,118 @@ remove_hrtimer(struct hrtimer *timer, struct hrtimer_base *base)
 	return 0;
 }
 
+#ifdef CONFIG_HIGH_RES_TIMERS
+/*
+ * High resolution mode:
+ *
+ * Once a cpu has a one-shot clock event device, its hrtimers are no
+ * longer expired from the timer softirq at jiffy granularity: the device
+ * is programmed for the first pending timer of the cpu, and the timers
+ * are expired right from its interrupt. The periodic tick is emulated
+ * with a per cpu hrtimer which calls the tick handler of the device.
+ */
+static int hrtimer_hres_enabled __read_mostly = 1;
+
+static int __init setup_hrtimer_hres(char *str)
+{
+	if (!strcmp(str, "off"))
+		hrtimer_hres_enabled = 0;
+	else if (!strcmp(str, "on"))
+		hrtimer_hres_enabled = 1;
+	else
+		return 0;
+	return 1;
+}
+__setup("highres=", setup_hrtimer_hres);
+
+int hrtimer_hres_active(void)
+{
+	return __get_cpu_var(hrtimer_hres).active;
+}
+
+/*
+ * The device is programmed in monotonic time, CLOCK_REALTIME expiry
+ * values are converted with the wall_to_monotonic offset:
+ */
+static ktime_t hrtimer_realtime_offset(void)
+{
+	struct timespec tomono;
+	unsigned long seq;
+
+	do {
+		seq = read_seqbegin(&xtime_lock);
+		tomono = wall_to_monotonic;
+	} while (read_seqretry(&xtime_lock, seq));
+
+	return timespec_to_ktime(tomono);
+}
+
+static inline ktime_t
+hrtimer_mono_expires(struct hrtimer *timer, ktime_t tomono)
+{
+	if (timer->base->index == CLOCK_REALTIME)
+		return ktime_add(timer->expires, tomono);
+	return timer->expires;
+}
+
+/*
+ * Program the device of the cpu for the first timer of all its bases.
+ * Called with interrupts disabled and no base lock held.
+ */
+static void hrtimer_force_reprogram(struct hrtimer_hres *hres)
+{
+	struct hrtimer_base *base = __get_cpu_var(hrtimer_bases);
+	ktime_t expires, tomono = hrtimer_realtime_offset();
+	int i;
+
+	hres->expires_next.tv64 = KTIME_MAX;
+
+	for (i = 0; i < MAX_HRTIMER_BASES; i++, base++) {
+		spin_lock(&base->lock);
+		if (base->first) {
+			expires = hrtimer_mono_expires(rb_entry(base->first,
+						struct hrtimer, node), tomono);
+			if (expires.tv64 < hres->expires_next.tv64)
+				hres->expires_next = expires;
+		}
+		spin_unlock(&base->lock);
+	}
+
+	if (hres->expires_next.tv64 != KTIME_MAX)
+		clockevents_program_event(hres->dev, hres->expires_next,
+					  ktime_get());
+}
+
+/*
+ * A timer was enqueued: reprogram the device when it became the first
+ * event of the local cpu. Timers which stay on a remote base (their
+ * callback is running there) are picked up by that cpu at its next
+ * event, the emulated tick at the latest.
+ *
+ * Called with the base lock held and interrupts disabled.
+ */
+static void hrtimer_check_reprogram(struct hrtimer *timer,
+				    struct hrtimer_base *base)
+{
+	struct hrtimer_hres *hres = &__get_cpu_var(hrtimer_hres);
+	ktime_t expires;
+
+	if (!hres->active || base->first != &timer->node ||
+	    base != &__get_cpu_var(hrtimer_bases)[base->index])
+		return;
+
+	expires = hrtimer_mono_expires(timer, hrtimer_realtime_offset());
+	if (expires.tv64 >= hres->expires_next.tv64)
+		return;
+
+	hres->expires_next = expires;
+	clockevents_program_event(hres->dev, expires, ktime_get());
+}
+
+#else
+# define hrtimer_check_reprogram(t, b)	do { } while (0)
+#endif /* CONFIG_HIGH_RES_TIMERS */
+
 /**
  * hrtimer_start - (re)start an relative timer on the current CPU
  * @timer:	the timer to be added
@@ -447,6 +571,7 @@ hrtimer_start(struct hrtimer *timer, ktime_t tim, const enum hrtimer_mode mode)
 	timer->expires = tim;
 
 	enqueue_hrtimer(timer, new_base);
+	hrtimer_check_reprogram(timer, new_base);
 
 	unlock_hrtimer_base(timer, &flags);
 
@@ -530,19 +655,25 @@ EXPORT_SYMBOL_GPL(hrtimer_get_remaining);
 ktime_t hrtimer_get_next_event(void)
 {
 	struct hrtimer_base *base = __get_cpu_var(hrtimer_bases);
+	struct hrtimer *tick = &__get_cpu_var(hrtimer_hres).sched_tick;
 	ktime_t delta, mindelta = { .tv64 = KTIME_MAX };
 	unsigned long flags;
 	int i;
 
 	for (i = 0; i < MAX_HRTIMER_BASES; i++, base++) {
+		struct rb_node *node;
 		struct hrtimer *timer;
 
 		spin_lock_irqsave(&base->lock, flags);
-		if (!base->first) {
+		/* The emulated tick is what is going to be stopped: */
+		node = base->first;
+		if (node == &tick->node)
+			node = rb_next(node);
+		if (!node) {
 			spin_unlock_irqrestore(&base->lock, flags);
 			continue;
 		}
-		timer = rb_entry(base->first, struct hrtimer, node);
+		timer = rb_entry(node, struct hrtimer, node);
 		delta.tv64 = timer->expires.tv64;
 		spin_unlock_irqrestore(&base->lock, flags);
 		delta = ktime_sub(delta, base->get_time());
@@ -598,11 +729,13 @@ int hrtimer_get_res(const clockid_t which_clock, struct timespec *tp)
 EXPORT_SYMBOL_GPL(hrtimer_get_res);
 
 /*
- * Expire the per base hrtimer-queue:
+ * Expire the per base hrtimer-queue. Called from the softirq, or from
+ * the event interrupt in high resolution mode:
  */
 static inline void run_hrtimer_queue(struct hrtimer_base *base)
 {
 	struct rb_node *node;
+	unsigned long flags;
 
 	if (!base->first)
 		return;
@@ -610,7 +743,7 @@ static inline void run_hrtimer_queue(struct hrtimer_base *base)
 	if (base->get_softirq_time)
 		base->softirq_time = base->get_softirq_time();
 
-	spin_lock_irq(&base->lock);
+	spin_lock_irqsave(&base->lock, flags);
 
 	while ((node = base->first)) {
 		struct hrtimer *timer;
@@ -624,11 +757,11 @@ static inline void run_hrtimer_queue(struct hrtimer_base *base)
 		fn = timer->function;
 		set_curr_timer(base, timer);
 		__remove_hrtimer(timer, base);
-		spin_unlock_irq(&base->lock);
+		spin_unlock_irqrestore(&base->lock, flags);
 
 		restart = fn(timer);
 
-		spin_lock_irq(&base->lock);
+		spin_lock_irqsave(&base->lock, flags);
 
 		if (restart != HRTIMER_NORESTART) {
 			BUG_ON(hrtimer_active(timer));
@@ -636,9 +769,173 @@ static inline void run_hrtimer_queue(struct hrtimer_base *base)
 		}
 	}
 	set_curr_timer(base, NULL);
-	spin_unlock_irq(&base->lock);
+	spin_unlock_irqrestore(&base->lock, flags);
+}
+
+#ifdef CONFIG_HIGH_RES_TIMERS
+/*
+ * High resolution timer interrupt, installed as the event handler of
+ * the one-shot clock event device of the cpu.
+ */
+void hrtimer_interrupt(struct clock_event_device *dev, struct pt_regs *regs)
+{
+	struct hrtimer_hres *hres = &__get_cpu_var(hrtimer_hres);
+	struct hrtimer_base *base = __get_cpu_var(hrtimer_bases);
+	ktime_t now, tomono;
+	int i;
+
+	hres->regs = regs;
+	hres->nr_events++;
+
+	now = ktime_get();
+	tomono = hrtimer_realtime_offset();
+
+	for (i = 0; i < MAX_HRTIMER_BASES; i++, base++) {
+		if (base->index == CLOCK_REALTIME)
+			base->softirq_time = ktime_sub(now, tomono);
+		else
+			base->softirq_time = now;
+		run_hrtimer_queue(base);
+	}
+
+	hres->regs = NULL;
+	hrtimer_force_reprogram(hres);
 }
 
+/*
+ * The emulated periodic tick:
+ */
+static int hrtimer_sched_tick(struct hrtimer *timer)
+{
+	struct hrtimer_hres *hres =
+		container_of(timer, struct hrtimer_hres, sched_tick);
+
+	hres->tick_handler(hres->dev, hres->regs);
+	hrtimer_forward(timer, timer->base->softirq_time,
+			ktime_set(0, TICK_NSEC));
+
+	return HRTIMER_RESTART;
+}
+
+/*
+ * Switch the current cpu to high resolution mode, when it has a one-shot
+ * clock event device. Called from the timer softirq.
+ */
+static int hrtimer_switch_to_hres(void)
+{
+	struct hrtimer_hres *hres = &__get_cpu_var(hrtimer_hres);
+	struct hrtimer_base *base = __get_cpu_var(hrtimer_bases);
+	int i, cpu = smp_processor_id();
+	struct clock_event_device *dev;
+	unsigned long flags;
+
+	dev = clockevents_get_oneshot_device(cpu);
+	if (!dev)
+		return 0;
+
+	local_irq_save(flags);
+
+	hres->dev = dev;
+	hres->tick_handler = dev->event_handler;
+	hres->expires_next.tv64 = KTIME_MAX;
+	dev->event_handler = hrtimer_interrupt;
+	clockevents_set_mode(dev, CLOCK_EVT_MODE_ONESHOT);
+
+	for (i = 0; i < MAX_HRTIMER_BASES; i++)
+		base[i].resolution = ktime_set(0, 1);
+	hres->active = 1;
+
+	hrtimer_init(&hres->sched_tick, CLOCK_MONOTONIC, HRTIMER_ABS);
+	hres->sched_tick.function = hrtimer_sched_tick;
+	hrtimer_start(&hres->sched_tick, ktime_add_ns(ktime_get(), TICK_NSEC),
+		      HRTIMER_ABS);
+
+	/* Timers which were queued before the switch: */
+	hrtimer_force_reprogram(hres);
+
+	local_irq_restore(flags);
+
+	printk(KERN_INFO "Switched to high resolution mode on CPU %d\n", cpu);
+
+	return 1;
+}
+
+/**
+ * hrtimer_switch_to_lowres - fall back to the periodic tick
+ *
+ * Called with interrupts disabled on a cpu whose clock event device can
+ * no longer do one-shot events (eg. the local APIC timer stops in deep
+ * C-states). The device must have dropped CLOCK_EVT_FEAT_ONESHOT, so
+ * that the cpu does not switch back.
+ */
+void hrtimer_switch_to_lowres(void)
+{
+	struct hrtimer_hres *hres = &__get_cpu_var(hrtimer_hres);
+	struct hrtimer_base *base = __get_cpu_var(hrtimer_bases);
+
+	if (!hres->active)
+		return;
+
+	hrtimer_try_to_cancel(&hres->sched_tick);
+	hres->active = 0;
+	hres->dev->event_handler = hres->tick_handler;
+	clockevents_set_mode(hres->dev, CLOCK_EVT_MODE_PERIODIC);
+	hres->dev = NULL;
+
+	base[CLOCK_REALTIME].resolution = KTIME_REALTIME_RES;
+	base[CLOCK_MONOTONIC].resolution = KTIME_MONOTONIC_RES;
+}
+
+#ifdef CONFIG_NO_IDLE_HZ
+/**
+ * hrtimer_stop_sched_tick - stop the emulated tick of an idle cpu
+ * @ticks:	number of jiffies to skip
+ *
+ * Called with interrupts disabled. Returns 1 when the cpu is in high
+ * resolution mode and the tick was deferred, 0 otherwise.
+ */
+int hrtimer_stop_sched_tick(unsigned long ticks)
+{
+	struct hrtimer_hres *hres = &__get_cpu_var(hrtimer_hres);
+	struct hrtimer *tick = &hres->sched_tick;
+
+	if (!hres->active)
+		return 0;
+
+	hrtimer_start(tick, ktime_add_ns(tick->expires,
+					 (u64)(ticks - 1) * TICK_NSEC),
+		      HRTIMER_ABS);
+	/* The device may still be programmed for the old tick: */
+	hrtimer_force_reprogram(hres);
+
+	return 1;
+}
+
+/**
+ * hrtimer_restart_sched_tick - restart the emulated tick
+ *
+ * Called with interrupts disabled when the cpu leaves idle. Returns 1
+ * when the cpu is in high resolution mode, 0 otherwise.
+ */
+int hrtimer_restart_sched_tick(void)
+{
+	struct hrtimer_hres *hres = &__get_cpu_var(hrtimer_hres);
+	struct hrtimer *tick = &hres->sched_tick;
+	ktime_t next;
+
+	if (!hres->active)
+		return 0;
+
+	next = ktime_add_ns(ktime_get(), TICK_NSEC);
+	if (tick->expires.tv64 > next.tv64)
+		hrtimer_start(tick, next, HRTIMER_ABS);
+
+	return 1;
+}
+#endif /* CONFIG_NO_IDLE_HZ */
+
+#endif /* CONFIG_HIGH_RES_TIMERS */
+
 /*
  * Called from timer softirq every jiffy, expire hrtimers:
  */
@@ -647,6 +944,14 @@ void hrtimer_run_queues(void)
 	struct hrtimer_base *base = __get_cpu_var(hrtimer_bases);
 	int i;
 
+#ifdef CONFIG_HIGH_RES_TIMERS
+	/* The timers are expired from the event interrupt: */
+	if (hrtimer_hres_active())
+		return;
+	if (hrtimer_hres_enabled && hrtimer_switch_to_hres())
+		return;
+#endif
+
 	hrtimer_get_softirq_time(base);
 
 	for (i = 0; i < MAX_HRTIMER_BASES; i++)
@@ -815,6 +1120,20 @@ static void migrate_hrtimers(int cpu)
 
 	local_irq_disable();
 
+#ifdef CONFIG_HIGH_RES_TIMERS
+	/* The emulated tick of the dead cpu dies with it: */
+	if (per_cpu(hrtimer_hres, cpu).active) {
+		struct hrtimer *tick = &per_cpu(hrtimer_hres, cpu).sched_tick;
+
+		spin_lock(&tick->base->lock);
+		remove_hrtimer(tick, tick->base);
+		spin_unlock(&tick->base->lock);
+		per_cpu(hrtimer_hres, cpu).active = 0;
+		old_base[CLOCK_REALTIME].resolution = KTIME_REALTIME_RES;
+		old_base[CLOCK_MONOTONIC].resolution = KTIME_MONOTONIC_RES;
+	}
+#endif
+
 	for (i = 0; i < MAX_HRTIMER_BASES; i++) {
 
 		spin_lock(&new_base->lock);
@@ -830,6 +1149,11 @@ static void migrate_hrtimers(int cpu)
 		new_base++;
 	}
 
+#ifdef CONFIG_HIGH_RES_TIMERS
+	if (__get_cpu_var(hrtimer_hres).active)
+		hrtimer_force_reprogram(&__get_cpu_var(hrtimer_hres));
+#endif
+
 	local_irq_enable();
 	put_cpu_var(hrtimer_bases);
 }
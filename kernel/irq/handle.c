@@ -141,8 +141,23 @@ irqreturn_t handle_IRQ_event(unsigned int irq, struct pt_regs *regs,
 
 	do {
 		ret = action->handler(irq, action->dev_id, regs);
-		if (ret == IRQ_HANDLED)
+		switch (ret) {
+		case IRQ_WAKE_THREAD:
+			/* The rest of the handling is left to the thread */
+			ret = IRQ_HANDLED;
+			if (unlikely(!action->thread)) {
+				printk(KERN_WARNING "IRQ %d device %s returned "
+				       "IRQ_WAKE_THREAD but has no thread\n",
+				       irq, action->name);
+				break;
+			}
+			set_bit(IRQTF_RUNTHREAD, &action->thread_flags);
+			wake_up_process(action->thread);
+			/* fall through */
+		case IRQ_HANDLED:
 			status |= action->flags;
+			break;
+		}
 		retval |= ret;
 		action = action->next;
 	} while (action);
@@ -4,6 +4,11 @@
 
 extern int noirqdebug;
 
+/* Bits in irqaction->thread_flags: */
+enum {
+	IRQTF_RUNTHREAD,		/* the handler thread has work */
+};
+
 /* Set default functions for irq_chip structures: */
 extern void irq_chip_set_defaults(struct irq_chip *chip);
 
@@ -11,20 +11,22 @@
 #include <linux/module.h>
 #include <linux/random.h>
 #include <linux/interrupt.h>
+#include <linux/kthread.h>
+#include <linux/sched.h>
 
 #include "internals.h"
 
-#ifdef CONFIG_SMP
-
 /**
  *	synchronize_irq - wait for pending IRQ handlers (on other CPUs)
  *	@irq: interrupt number to wait for
  *
  *	This function waits for any pending IRQ handlers for this interrupt
- *	to complete before returning. If you use this function while
- *	holding a resource the IRQ handler may need you will deadlock.
+ *	to complete before returning, threaded ones included. If you use
+ *	this function while holding a resource the IRQ handler may need
+ *	you will deadlock.
  *
- *	This function may be called - with care - from IRQ context.
+ *	This function may be called - with care - from IRQ context, but
+ *	not while a handler thread of the interrupt runs: it then sleeps.
  */
 void synchronize_irq(unsigned int irq)
 {
@@ -33,13 +35,17 @@ void synchronize_irq(unsigned int irq)
 	if (irq >= NR_IRQS)
 		return;
 
+#ifdef CONFIG_SMP
 	while (desc->status & IRQ_INPROGRESS)
 		cpu_relax();
+#endif
+
+	if (atomic_read(&desc->threads_active))
+		wait_event(desc->wait_for_threads,
+			   !atomic_read(&desc->threads_active));
 }
 EXPORT_SYMBOL(synchronize_irq);
 
-#endif
-
 /**
  *	disable_irq_nosync - disable an irq without waiting
  *	@irq: Interrupt to disable
@@ -208,6 +214,58 @@ void compat_irq_chip_set_default_handler(struct irq_desc *desc)
 		desc->handle_irq = NULL;
 }
 
+/*
+ * Wait for the primary handler to hand the thread an interrupt.
+ * Returns nonzero when the thread is to exit.
+ */
+static int irq_wait_for_interrupt(struct irqaction *action)
+{
+	set_current_state(TASK_INTERRUPTIBLE);
+	while (!kthread_should_stop()) {
+		if (test_and_clear_bit(IRQTF_RUNTHREAD,
+				       &action->thread_flags)) {
+			__set_current_state(TASK_RUNNING);
+			return 0;
+		}
+		schedule();
+		set_current_state(TASK_INTERRUPTIBLE);
+	}
+	__set_current_state(TASK_RUNNING);
+	return -1;
+}
+
+/*
+ * The handler thread of an irqaction.  An interrupt that arrives while
+ * the line is disabled is marked pending rather than handled, and is
+ * resent by enable_irq().
+ */
+static int irq_thread(void *data)
+{
+	struct sched_param param = { .sched_priority = MAX_USER_RT_PRIO / 2 };
+	struct irqaction *action = data;
+	struct irq_desc *desc = irq_desc + action->irq;
+
+	sched_setscheduler(current, SCHED_FIFO, &param);
+
+	while (!irq_wait_for_interrupt(action)) {
+		atomic_inc(&desc->threads_active);
+
+		spin_lock_irq(&desc->lock);
+		if (unlikely(desc->status & IRQ_DISABLED)) {
+			desc->status |= IRQ_PENDING;
+			spin_unlock_irq(&desc->lock);
+		} else {
+			spin_unlock_irq(&desc->lock);
+			action->thread_fn(action->irq, action->dev_id);
+		}
+
+		if (atomic_dec_and_test(&desc->threads_active) &&
+		    waitqueue_active(&desc->wait_for_threads))
+			wake_up(&desc->wait_for_threads);
+	}
+	return 0;
+}
+
 /*
  * Internal function to register an irqaction - typically used to
  * allocate special interrupts that are part of the architecture.
@@ -224,6 +282,22 @@ int setup_irq(unsigned int irq, struct irqaction *new)
 
 	if (desc->chip == &no_irq_chip)
 		return -ENOSYS;
+
+	/*
+	 * A threaded handler gets its thread before anything else, as
+	 * the primary handler may wake it as soon as it is installed.
+	 */
+	new->thread = NULL;
+	if (new->thread_fn) {
+		struct task_struct *t;
+
+		t = kthread_create(irq_thread, new, "irq/%d-%s", irq,
+				   new->name);
+		if (IS_ERR(t))
+			return PTR_ERR(t);
+		new->irq = irq;
+		new->thread = t;
+	}
 	/*
 	 * Some drivers like serial.c use request_irq() heavily,
 	 * so we have to be careful not to interfere with a
@@ -274,12 +348,15 @@ int setup_irq(unsigned int irq, struct irqaction *new)
 	}
 
 	*p = new;
+	if (new->thread)
+		wake_up_process(new->thread);
 #if defined(CONFIG_IRQ_PER_CPU)
 	if (new->flags & IRQF_PERCPU)
 		desc->status |= IRQ_PER_CPU;
 #endif
 	if (!shared) {
 		irq_chip_set_defaults(desc->chip);
+		init_waitqueue_head(&desc->wait_for_threads);
 
 		/* Setup the type (level, edge polarity) if configured: */
 		if (new->flags & IRQF_TRIGGER_MASK) {
@@ -327,6 +404,10 @@ mismatch:
 		printk(KERN_ERR "IRQ handler type mismatch for IRQ %d\n", irq);
 		dump_stack();
 	}
+	if (new->thread) {
+		kthread_stop(new->thread);
+		new->thread = NULL;
+	}
 	return -EBUSY;
 }
 
@@ -388,6 +469,9 @@ void free_irq(unsigned int irq, void *dev_id)
 
 			/* Make sure it's not being used on another CPU */
 			synchronize_irq(irq);
+			/* The thread finishes what it was given first */
+			if (action->thread)
+				kthread_stop(action->thread);
 			kfree(action);
 			return;
 		}
@@ -430,6 +514,37 @@ EXPORT_SYMBOL(free_irq);
 int request_irq(unsigned int irq,
 		irqreturn_t (*handler)(int, void *, struct pt_regs *),
 		unsigned long irqflags, const char *devname, void *dev_id)
+{
+	return request_threaded_irq(irq, handler, NULL, irqflags,
+				    devname, dev_id);
+}
+EXPORT_SYMBOL(request_irq);
+
+/**
+ *	request_threaded_irq - allocate an interrupt line with a handler thread
+ *	@irq: Interrupt line to allocate
+ *	@handler: Function to be called when the IRQ occurs
+ *	@thread_fn: Function to be called in the handler thread
+ *	@irqflags: Interrupt type flags
+ *	@devname: An ascii name for the claiming device
+ *	@dev_id: A cookie passed back to the handler functions
+ *
+ *	As request_irq(), but with @thread_fn the bulk of the handling
+ *	can be moved out of hard interrupt context into a kernel thread
+ *	of its own, named irq/<irq>-<devname>.  @handler only checks
+ *	whether the interrupt comes from its device and, if so, quiets
+ *	the device and returns IRQ_WAKE_THREAD, upon which the thread
+ *	runs @thread_fn.  The line is not masked meanwhile: a level
+ *	triggered device that is not quieted would keep interrupting.
+ *
+ *	The thread runs SCHED_FIFO at priority MAX_USER_RT_PRIO/2, which
+ *	can be changed like that of any other task, so that interrupts
+ *	are ordered with each other and with realtime user tasks.
+ */
+int request_threaded_irq(unsigned int irq,
+		irqreturn_t (*handler)(int, void *, struct pt_regs *),
+		irqreturn_t (*thread_fn)(int, void *),
+		unsigned long irqflags, const char *devname, void *dev_id)
 {
 	struct irqaction *action;
 	int retval;
@@ -460,6 +575,8 @@ int request_irq(unsigned int irq,
 		return -ENOMEM;
 
 	action->handler = handler;
+	action->thread_fn = thread_fn;
+	action->thread_flags = 0;
 	action->flags = irqflags;
 	cpus_clear(action->mask);
 	action->name = devname;
@@ -474,5 +591,5 @@ int request_irq(unsigned int irq,
 
 	return retval;
 }
-EXPORT_SYMBOL(request_irq);
+EXPORT_SYMBOL(request_threaded_irq);
 
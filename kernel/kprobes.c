@@ -65,44 +65,53 @@ static struct notifier_block kprobe_page_fault_nb = {
  * stepping on the instruction on a vmalloced/kmalloced/data page
  * is a recipe for disaster
  */
-#define INSNS_PER_PAGE	(PAGE_SIZE/(MAX_INSN_SIZE * sizeof(kprobe_opcode_t)))
-
 struct kprobe_insn_page {
 	struct hlist_node hlist;
 	kprobe_opcode_t *insns;		/* Page of instruction slots */
-	char slot_used[INSNS_PER_PAGE];
 	int nused;
+	char slot_used[0];
 };
 
-static struct hlist_head kprobe_insn_pages;
+/* Pages of executable slots of one size */
+struct kprobe_insn_cache {
+	struct hlist_head pages;
+	size_t insn_size;		/* of a slot, in kprobe_opcode_t */
+};
 
-/**
- * get_insn_slot() - Find a slot on an executable page for an instruction.
- * We allocate an executable page if there's no room on existing ones.
- */
-kprobe_opcode_t __kprobes *get_insn_slot(void)
+static int __kprobes slots_per_page(struct kprobe_insn_cache *c)
+{
+	return PAGE_SIZE / (c->insn_size * sizeof(kprobe_opcode_t));
+}
+
+static struct kprobe_insn_cache kprobe_insn_slots = {
+	.pages = HLIST_HEAD_INIT,
+	.insn_size = MAX_INSN_SIZE,
+};
+
+static kprobe_opcode_t __kprobes *__get_insn_slot(struct kprobe_insn_cache *c)
 {
 	struct kprobe_insn_page *kip;
 	struct hlist_node *pos;
 
-	hlist_for_each(pos, &kprobe_insn_pages) {
+	hlist_for_each(pos, &c->pages) {
 		kip = hlist_entry(pos, struct kprobe_insn_page, hlist);
-		if (kip->nused < INSNS_PER_PAGE) {
+		if (kip->nused < slots_per_page(c)) {
 			int i;
-			for (i = 0; i < INSNS_PER_PAGE; i++) {
+			for (i = 0; i < slots_per_page(c); i++) {
 				if (!kip->slot_used[i]) {
 					kip->slot_used[i] = 1;
 					kip->nused++;
-					return kip->insns + (i * MAX_INSN_SIZE);
+					return kip->insns + (i * c->insn_size);
 				}
 			}
 			/* Surprise!  No unused slots.  Fix kip->nused. */
-			kip->nused = INSNS_PER_PAGE;
+			kip->nused = slots_per_page(c);
 		}
 	}
 
 	/* All out of space.  Need to allocate a new page. Use slot 0.*/
-	kip = kmalloc(sizeof(struct kprobe_insn_page), GFP_KERNEL);
+	kip = kmalloc(sizeof(struct kprobe_insn_page) + slots_per_page(c),
+		      GFP_KERNEL);
 	if (!kip) {
 		return NULL;
 	}
@@ -118,23 +127,24 @@ kprobe_opcode_t __kprobes *get_insn_slot(void)
 		return NULL;
 	}
 	INIT_HLIST_NODE(&kip->hlist);
-	hlist_add_head(&kip->hlist, &kprobe_insn_pages);
-	memset(kip->slot_used, 0, INSNS_PER_PAGE);
+	hlist_add_head(&kip->hlist, &c->pages);
+	memset(kip->slot_used, 0, slots_per_page(c));
 	kip->slot_used[0] = 1;
 	kip->nused = 1;
 	return kip->insns;
 }
 
-void __kprobes free_insn_slot(kprobe_opcode_t *slot)
+static void __kprobes __free_insn_slot(struct kprobe_insn_cache *c,
+				       kprobe_opcode_t *slot)
 {
 	struct kprobe_insn_page *kip;
 	struct hlist_node *pos;
 
-	hlist_for_each(pos, &kprobe_insn_pages) {
+	hlist_for_each(pos, &c->pages) {
 		kip = hlist_entry(pos, struct kprobe_insn_page, hlist);
 		if (kip->insns <= slot &&
-		    slot < kip->insns + (INSNS_PER_PAGE * MAX_INSN_SIZE)) {
-			int i = (slot - kip->insns) / MAX_INSN_SIZE;
+		    slot < kip->insns + (slots_per_page(c) * c->insn_size)) {
+			int i = (slot - kip->insns) / c->insn_size;
 			kip->slot_used[i] = 0;
 			kip->nused--;
 			if (kip->nused == 0) {
@@ -145,10 +155,10 @@ void __kprobes free_insn_slot(kprobe_opcode_t *slot)
 				 * next time somebody inserts a probe.
 				 */
 				hlist_del(&kip->hlist);
-				if (hlist_empty(&kprobe_insn_pages)) {
+				if (hlist_empty(&c->pages)) {
 					INIT_HLIST_NODE(&kip->hlist);
 					hlist_add_head(&kip->hlist,
-						&kprobe_insn_pages);
+						&c->pages);
 				} else {
 					module_free(NULL, kip->insns);
 					kfree(kip);
@@ -158,6 +168,38 @@ void __kprobes free_insn_slot(kprobe_opcode_t *slot)
 		}
 	}
 }
+
+/**
+ * get_insn_slot() - Find a slot on an executable page for an instruction.
+ * We allocate an executable page if there's no room on existing ones.
+ */
+kprobe_opcode_t __kprobes *get_insn_slot(void)
+{
+	return __get_insn_slot(&kprobe_insn_slots);
+}
+
+void __kprobes free_insn_slot(kprobe_opcode_t *slot)
+{
+	__free_insn_slot(&kprobe_insn_slots, slot);
+}
+
+#ifdef CONFIG_OPTPROBES
+/* The detour buffers of jump-optimized probes, see arch_optimize_kprobe() */
+static struct kprobe_insn_cache kprobe_optinsn_slots = {
+	.pages = HLIST_HEAD_INIT,
+	.insn_size = MAX_OPTINSN_SIZE,
+};
+
+kprobe_opcode_t __kprobes *get_optinsn_slot(void)
+{
+	return __get_insn_slot(&kprobe_optinsn_slots);
+}
+
+void __kprobes free_optinsn_slot(kprobe_opcode_t *slot)
+{
+	__free_insn_slot(&kprobe_optinsn_slots, slot);
+}
+#endif
 #endif
 
 /* We have preemption disabled.. so it is safe to use __ versions */
@@ -432,6 +474,57 @@ static int __kprobes register_aggr_kprobe(struct kprobe *old_p,
 	return ret;
 }
 
+#ifdef CONFIG_OPTPROBES
+/*
+ * A probe can be reached by a jump instead of a breakpoint only if
+ * nothing at its address needs the instruction single-stepped: no
+ * post_handler, and no jprobe.  Whether the instructions around it allow
+ * it is up to arch_optimize_kprobe(); if not, the int3 stays.
+ * All of these are called under kprobe_mutex, on the probe in the hash.
+ */
+static void __kprobes optimize_kprobe(struct kprobe *p)
+{
+	if (!p->post_handler && !p->break_handler)
+		arch_optimize_kprobe(p);
+}
+
+static void __kprobes unoptimize_kprobe(struct kprobe *p)
+{
+	arch_unoptimize_kprobe(p);
+}
+
+/* Put back on int3 the probe whose displaced instructions cover addr */
+static void __kprobes unoptimize_kprobe_covering(void *addr)
+{
+	struct kprobe *p;
+	int i;
+
+	for (i = 1; i < MAX_OPTIMIZED_LENGTH; i++) {
+		p = get_kprobe((kprobe_opcode_t *)addr - i);
+		if (p && arch_within_optimized_kprobe(p, (unsigned long)addr))
+			unoptimize_kprobe(p);
+	}
+}
+
+/* A probe at addr is gone: those just before it may now be optimized */
+static void __kprobes optimize_kprobes_before(void *addr)
+{
+	struct kprobe *p;
+	int i;
+
+	for (i = 1; i < MAX_OPTIMIZED_LENGTH; i++) {
+		p = get_kprobe((kprobe_opcode_t *)addr - i);
+		if (p)
+			optimize_kprobe(p);
+	}
+}
+#else
+static inline void optimize_kprobe(struct kprobe *p) { }
+static inline void unoptimize_kprobe(struct kprobe *p) { }
+static inline void unoptimize_kprobe_covering(void *addr) { }
+static inline void optimize_kprobes_before(void *addr) { }
+#endif
+
 static int __kprobes in_kprobes_functions(unsigned long addr)
 {
 	if (addr >= (unsigned long)__kprobes_text_start
@@ -471,12 +564,17 @@ static int __kprobes __register_kprobe(struct kprobe *p,
 	mutex_lock(&kprobe_mutex);
 	old_p = get_kprobe(p->addr);
 	if (old_p) {
+		unoptimize_kprobe(old_p);
 		ret = register_aggr_kprobe(old_p, p);
 		if (!ret)
 			atomic_inc(&kprobe_count);
+		optimize_kprobe(get_kprobe(p->addr));
 		goto out;
 	}
 
+	/* Before the probed instruction is copied, it must be back in place */
+	unoptimize_kprobe_covering(p->addr);
+
 	if ((ret = arch_prepare_kprobe(p)) != 0)
 		goto out;
 
@@ -489,6 +587,7 @@ static int __kprobes __register_kprobe(struct kprobe *p,
 		register_page_fault_notifier(&kprobe_page_fault_nb);
 
   	arch_arm_kprobe(p);
+	optimize_kprobe(p);
 
 out:
 	mutex_unlock(&kprobe_mutex);
@@ -529,6 +628,7 @@ valid_p:
 		(p->list.next == &old_p->list) &&
 		(p->list.prev == &old_p->list))) {
 		/* Only probe on the hash list */
+		unoptimize_kprobe(old_p);
 		arch_disarm_kprobe(p);
 		hlist_del_rcu(&old_p->hlist);
 		cleanup_p = 1;
@@ -564,6 +664,7 @@ valid_p:
 			if (cleanup_p == 0)
 				old_p->post_handler = NULL;
 		}
+		optimize_kprobe(old_p);
 		mutex_unlock(&kprobe_mutex);
 	}
 
@@ -571,6 +672,8 @@ valid_p:
 	 * if no probes are active
 	 */
 	mutex_lock(&kprobe_mutex);
+	if (cleanup_p == 1)
+		optimize_kprobes_before(p->addr);
 	if (atomic_add_return(-1, &kprobe_count) == \
 				ARCH_INACTIVE_KPROBE_COUNT)
 		unregister_page_fault_notifier(&kprobe_page_fault_nb);
@@ -162,9 +162,11 @@ struct task_struct *kthread_create(int (*threadfn)(void *data),
 	init_completion(&create.done);
 
 	/*
-	 * The workqueue needs to start up first:
+	 * The workqueue needs to start up first, and a workqueue worker
+	 * must not wait on its pools for a thread: it may be the one
+	 * that would have been asked for another worker.
 	 */
-	if (!helper_wq)
+	if (!helper_wq || (current->flags & PF_WQ_WORKER))
 		work.func(work.data);
 	else {
 		queue_work(helper_wq, &work);
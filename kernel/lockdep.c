@@ -36,6 +36,7 @@
 #include <linux/stacktrace.h>
 #include <linux/debug_locks.h>
 #include <linux/irqflags.h>
+#include <linux/vmalloc.h>
 
 #include <asm/sections.h>
 
@@ -1941,6 +1942,172 @@ void lockdep_init_map(struct lockdep_map *lock, const char *name,
 
 EXPORT_SYMBOL_GPL(lockdep_init_map);
 
+#ifdef CONFIG_LOCK_STAT
+/*
+ * Lock statistics, per CPU and lock-class. They are far too big for
+ * the static per-cpu area, so they get vmalloc()-ed once that works -
+ * nothing is accounted before that:
+ */
+static struct lock_class_stats *cpu_lock_stats[NR_CPUS];
+
+static struct lock_class_stats *get_lock_stats(struct lock_class *class)
+{
+	struct lock_class_stats *stats;
+
+	stats = cpu_lock_stats[raw_smp_processor_id()];
+	if (!stats)
+		return NULL;
+
+	return stats + (class - lock_classes);
+}
+
+/*
+ * sched_clock() need not be synchronized between CPUs, and mutex
+ * holders can migrate - do not let that turn into huge times:
+ */
+static inline u64 lockstat_delta(u64 from, u64 to)
+{
+	return (s64)(to - from) > 0 ? to - from : 0;
+}
+
+static void lock_time_inc(struct lock_time *lt, u64 time)
+{
+	if (time > lt->max)
+		lt->max = time;
+	if (time < lt->min || !lt->nr)
+		lt->min = time;
+	lt->total += time;
+	lt->nr++;
+}
+
+static void lock_time_add(struct lock_time *src, struct lock_time *dst)
+{
+	if (!src->nr)
+		return;
+	if (src->max > dst->max)
+		dst->max = src->max;
+	if (src->min < dst->min || !dst->nr)
+		dst->min = src->min;
+	dst->total += src->total;
+	dst->nr += src->nr;
+}
+
+/*
+ * Sum up the statistics of a lock-class over all CPUs:
+ */
+struct lock_class_stats lock_stats(struct lock_class *class)
+{
+	struct lock_class_stats stats, *pcs;
+	int cpu, i;
+
+	memset(&stats, 0, sizeof(stats));
+	for_each_possible_cpu(cpu) {
+		if (!cpu_lock_stats[cpu])
+			continue;
+		pcs = cpu_lock_stats[cpu] + (class - lock_classes);
+
+		for (i = 0; i < LOCKSTAT_POINTS; i++)
+			stats.contention_point[i] += pcs->contention_point[i];
+		lock_time_add(&pcs->read_waittime, &stats.read_waittime);
+		lock_time_add(&pcs->write_waittime, &stats.write_waittime);
+		lock_time_add(&pcs->read_holdtime, &stats.read_holdtime);
+		lock_time_add(&pcs->write_holdtime, &stats.write_holdtime);
+		for (i = 0; i < LOCKSTAT_HIST; i++)
+			stats.wait_hist[i] += pcs->wait_hist[i];
+	}
+
+	return stats;
+}
+
+void clear_lock_stats(struct lock_class *class)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		if (cpu_lock_stats[cpu])
+			memset(cpu_lock_stats[cpu] + (class - lock_classes), 0,
+			       sizeof(struct lock_class_stats));
+	}
+	memset(class->contention_point, 0, sizeof(class->contention_point));
+}
+
+/*
+ * Find (or take) the slot of a contending call site. When all slots
+ * are taken by other sites, the contention is counted but not its
+ * site:
+ */
+static int lock_contention_point(struct lock_class *class, unsigned long ip)
+{
+	int i;
+
+	for (i = 0; i < LOCKSTAT_POINTS; i++) {
+		if (class->contention_point[i] == 0) {
+			class->contention_point[i] = ip;
+			break;
+		}
+		if (class->contention_point[i] == ip)
+			break;
+	}
+
+	return i;
+}
+
+static struct held_lock *
+find_held_lock(struct task_struct *curr, struct lockdep_map *lock)
+{
+	int i;
+
+	for (i = curr->lockdep_depth - 1; i >= 0; i--) {
+		if (curr->held_locks[i].instance == lock)
+			return curr->held_locks + i;
+	}
+
+	return NULL;
+}
+
+static void lock_release_holdtime(struct held_lock *hlock)
+{
+	struct lock_class_stats *stats;
+	u64 holdtime;
+
+	stats = get_lock_stats(hlock->class);
+	if (!stats)
+		return;
+
+	holdtime = lockstat_delta(hlock->holdtime_stamp, sched_clock());
+	if (hlock->read)
+		lock_time_inc(&stats->read_holdtime, holdtime);
+	else
+		lock_time_inc(&stats->write_holdtime, holdtime);
+}
+
+static int __init lock_stats_init(void)
+{
+	struct lock_class_stats *stats;
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		stats = vmalloc(MAX_LOCKDEP_KEYS * sizeof(*stats));
+		if (!stats) {
+			printk("lockdep: no memory for lock statistics of CPU %d\n",
+			       cpu);
+			continue;
+		}
+		memset(stats, 0, MAX_LOCKDEP_KEYS * sizeof(*stats));
+		smp_wmb();
+		cpu_lock_stats[cpu] = stats;
+	}
+
+	return 0;
+}
+
+core_initcall(lock_stats_init);
+#else
+static inline void lock_release_holdtime(struct held_lock *hlock)
+{
+}
+#endif
+
 /*
  * This gets called for every mutex_lock*()/spin_lock*() operation.
  * We maintain the dependency maps and validate the locking attempt:
@@ -2006,6 +2173,10 @@ static int __lock_acquire(struct lockdep_map *lock, unsigned int subclass,
 	hlock->read = read;
 	hlock->check = check;
 	hlock->hardirqs_off = hardirqs_off;
+#ifdef CONFIG_LOCK_STAT
+	hlock->waittime_stamp = 0;
+	hlock->holdtime_stamp = sched_clock();
+#endif
 
 	if (check != 2)
 		goto out_calc_hash;
@@ -2242,6 +2413,8 @@ lock_release_non_nested(struct task_struct *curr,
 	return print_unlock_inbalance_bug(curr, lock, ip);
 
 found_it:
+	lock_release_holdtime(hlock);
+
 	/*
 	 * We have the right lock to unlock, 'hlock' points to it.
 	 * Now we remove it from the stack, and add back the other
@@ -2257,6 +2430,11 @@ found_it:
 				hlock->read, hlock->check, hlock->hardirqs_off,
 				hlock->acquire_ip))
 			return 0;
+#ifdef CONFIG_LOCK_STAT
+		/* the lock is still held since back then: */
+		curr->held_locks[curr->lockdep_depth - 1].holdtime_stamp =
+			hlock->holdtime_stamp;
+#endif
 	}
 
 	if (DEBUG_LOCKS_WARN_ON(curr->lockdep_depth != depth - 1))
@@ -2289,6 +2467,8 @@ static int lock_release_nested(struct task_struct *curr,
 		return lock_release_non_nested(curr, lock, ip);
 	curr->lockdep_depth--;
 
+	lock_release_holdtime(hlock);
+
 	if (DEBUG_LOCKS_WARN_ON(!depth && (hlock->prev_chain_key != 0)))
 		return 0;
 
@@ -2400,6 +2580,96 @@ void lock_release(struct lockdep_map *lock, int nested, unsigned long ip)
 
 EXPORT_SYMBOL_GPL(lock_release);
 
+#ifdef CONFIG_LOCK_STAT
+static void __lock_contended(struct lockdep_map *lock, unsigned long ip)
+{
+	struct lock_class_stats *stats;
+	struct held_lock *hlock;
+	int point;
+
+	hlock = find_held_lock(current, lock);
+	if (!hlock)
+		return;
+
+	hlock->waittime_stamp = sched_clock();
+
+	point = lock_contention_point(hlock->class, ip);
+	stats = get_lock_stats(hlock->class);
+	if (stats && point < LOCKSTAT_POINTS)
+		stats->contention_point[point]++;
+}
+
+static void __lock_acquired(struct lockdep_map *lock)
+{
+	struct lock_class_stats *stats;
+	struct held_lock *hlock;
+	u64 now, waittime;
+	int bucket = 0;
+
+	hlock = find_held_lock(current, lock);
+	if (!hlock || !hlock->waittime_stamp)
+		return;
+
+	now = sched_clock();
+	waittime = lockstat_delta(hlock->waittime_stamp, now);
+	hlock->holdtime_stamp = now;
+
+	stats = get_lock_stats(hlock->class);
+	if (!stats)
+		return;
+
+	if (hlock->read)
+		lock_time_inc(&stats->read_waittime, waittime);
+	else
+		lock_time_inc(&stats->write_waittime, waittime);
+
+	while (bucket < LOCKSTAT_HIST - 1 && (waittime >> (9 + bucket)))
+		bucket++;
+	stats->wait_hist[bucket]++;
+}
+
+/*
+ * The lock, just acquired as far as lockdep is concerned, turned out
+ * to be held by someone else - we are about to wait for it:
+ */
+void lock_contended(struct lockdep_map *lock, unsigned long ip)
+{
+	unsigned long flags;
+
+	if (unlikely(current->lockdep_recursion))
+		return;
+
+	raw_local_irq_save(flags);
+	check_flags(flags);
+	current->lockdep_recursion = 1;
+	__lock_contended(lock, ip);
+	current->lockdep_recursion = 0;
+	raw_local_irq_restore(flags);
+}
+
+EXPORT_SYMBOL_GPL(lock_contended);
+
+/*
+ * ... and now we got it:
+ */
+void lock_acquired(struct lockdep_map *lock)
+{
+	unsigned long flags;
+
+	if (unlikely(current->lockdep_recursion))
+		return;
+
+	raw_local_irq_save(flags);
+	check_flags(flags);
+	current->lockdep_recursion = 1;
+	__lock_acquired(lock);
+	current->lockdep_recursion = 0;
+	raw_local_irq_restore(flags);
+}
+
+EXPORT_SYMBOL_GPL(lock_acquired);
+#endif
+
 /*
  * Used by the testsuite, sanitize the validator state
  * after a simulated failure:
@@ -2438,6 +2708,9 @@ static void zap_class(struct lock_class *class)
 	 */
 	list_del_rcu(&class->hash_entry);
 	list_del_rcu(&class->lock_entry);
+#ifdef CONFIG_LOCK_STAT
+	clear_lock_stats(class);
+#endif
 
 }
 
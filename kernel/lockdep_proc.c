@@ -7,7 +7,7 @@
  *
  *  Copyright (C) 2006 Red Hat, Inc., Ingo Molnar <mingo@redhat.com>
  *
- * Code for /proc/lockdep and /proc/lockdep_stats:
+ * Code for /proc/lockdep, /proc/lockdep_stats and /proc/lock_stat:
  *
  */
 #include <linux/sched.h>
@@ -16,6 +16,10 @@
 #include <linux/seq_file.h>
 #include <linux/kallsyms.h>
 #include <linux/debug_locks.h>
+#include <linux/vmalloc.h>
+#include <linux/sort.h>
+#include <asm/uaccess.h>
+#include <asm/div64.h>
 
 #include "lockdep_internals.h"
 
@@ -326,6 +330,281 @@ static struct file_operations proc_lockdep_stats_operations = {
 	.release	= seq_release,
 };
 
+#ifdef CONFIG_LOCK_STAT
+struct lock_stat_data {
+	struct lock_class	*class;
+	struct lock_class_stats	stats;
+};
+
+/*
+ * A snapshot of the statistics of all used classes, taken on open:
+ */
+struct lock_stat_seq {
+	struct lock_stat_data	*iter_end;
+	struct lock_stat_data	stats[MAX_LOCKDEP_KEYS];
+};
+
+static unsigned long lock_stat_contentions(struct lock_class_stats *stats)
+{
+	return stats->read_waittime.nr + stats->write_waittime.nr;
+}
+
+/*
+ * The most contended classes first, then the most used ones:
+ */
+static int lock_stat_cmp(const void *l, const void *r)
+{
+	struct lock_stat_data *dl = (struct lock_stat_data *)l;
+	struct lock_stat_data *dr = (struct lock_stat_data *)r;
+	unsigned long nl, nr;
+
+	nl = lock_stat_contentions(&dl->stats);
+	nr = lock_stat_contentions(&dr->stats);
+	if (nl == nr) {
+		nl = dl->stats.read_holdtime.nr + dl->stats.write_holdtime.nr;
+		nr = dr->stats.read_holdtime.nr + dr->stats.write_holdtime.nr;
+	}
+
+	return nl < nr ? 1 : nl > nr ? -1 : 0;
+}
+
+static void seq_line(struct seq_file *m, char c, int len)
+{
+	int i;
+
+	for (i = 0; i < len; i++)
+		seq_putc(m, c);
+	seq_puts(m, "\n");
+}
+
+/* times are kept in nsecs and shown in usecs: */
+static void seq_time(struct seq_file *m, u64 time)
+{
+	unsigned long rem;
+
+	rem = do_div(time, 1000);
+	seq_printf(m, " %11llu.%02lu", (unsigned long long)time, rem / 10);
+}
+
+static void seq_lock_time(struct seq_file *m, struct lock_time *lt)
+{
+	seq_printf(m, " %14lu", lt->nr);
+	seq_time(m, lt->min);
+	seq_time(m, lt->max);
+	seq_time(m, lt->total);
+}
+
+static void seq_stats(struct seq_file *m, struct lock_stat_data *data)
+{
+	struct lock_class *class = data->class;
+	struct lock_class_stats *stats = &data->stats;
+	char name[48], str[128];
+	const char *key;
+	char *modname;
+	unsigned long size, offset, count;
+	int i, j, order[LOCKSTAT_POINTS];
+
+	if (class->name) {
+		key = class->name;
+		i = snprintf(name, sizeof(name), "%s", key);
+		if (class->name_version > 1 && i < sizeof(name))
+			i += snprintf(name + i, sizeof(name) - i, "#%d",
+				      class->name_version);
+		if (class->subclass && i < sizeof(name))
+			snprintf(name + i, sizeof(name) - i, "/%d",
+				 class->subclass);
+	} else {
+		key = __get_key_name(class->key, str);
+		snprintf(name, sizeof(name), "%s", key);
+	}
+
+	if (stats->write_holdtime.nr) {
+		seq_printf(m, "%38s-W:", name);
+		seq_lock_time(m, &stats->write_waittime);
+		seq_lock_time(m, &stats->write_holdtime);
+		seq_puts(m, "\n");
+	}
+	if (stats->read_holdtime.nr) {
+		seq_printf(m, "%38s-R:", name);
+		seq_lock_time(m, &stats->read_waittime);
+		seq_lock_time(m, &stats->read_holdtime);
+		seq_puts(m, "\n");
+	}
+
+	if (!lock_stat_contentions(stats))
+		goto out;
+
+	seq_printf(m, "%41s", "wait-hist:");
+	for (i = 0; i < LOCKSTAT_HIST; i++)
+		seq_printf(m, " %lu", (unsigned long)stats->wait_hist[i]);
+	seq_puts(m, "\n");
+
+	/* the contention points, busiest first: */
+	for (i = 0; i < LOCKSTAT_POINTS; i++)
+		order[i] = i;
+	for (i = 1; i < LOCKSTAT_POINTS; i++)
+		for (j = i; j > 0 && stats->contention_point[order[j]] >
+				stats->contention_point[order[j - 1]]; j--) {
+			int tmp = order[j];
+
+			order[j] = order[j - 1];
+			order[j - 1] = tmp;
+		}
+
+	for (i = 0; i < LOCKSTAT_POINTS; i++) {
+		count = stats->contention_point[order[i]];
+		if (!class->contention_point[order[i]] || !count)
+			break;
+		key = kallsyms_lookup(class->contention_point[order[i]],
+				      &size, &offset, &modname, str);
+		seq_printf(m, "%40lu [<%p>]", count,
+			   (void *)class->contention_point[order[i]]);
+		if (key)
+			seq_printf(m, " %s+0x%lx/0x%lx", key, offset, size);
+		seq_puts(m, "\n");
+	}
+out:
+	seq_line(m, '.', 160);
+	seq_puts(m, "\n");
+}
+
+static void seq_header(struct seq_file *m)
+{
+	int i;
+
+	seq_printf(m, "lock_stat version 0.1\n");
+	seq_printf(m, "wait-hist buckets: <0.5us");
+	for (i = 1; i < LOCKSTAT_HIST - 1; i++)
+		seq_printf(m, " <%luus", 1UL << (i - 1));
+	seq_printf(m, " >=%luus\n", 1UL << (LOCKSTAT_HIST - 3));
+	seq_line(m, '-', 160);
+	seq_printf(m, "%41s %14s %14s %14s %14s %14s %14s %14s %14s\n",
+		   "class name", "contentions", "waittime-min",
+		   "waittime-max", "waittime-total", "acquisitions",
+		   "holdtime-min", "holdtime-max", "holdtime-total");
+	seq_line(m, '-', 160);
+	seq_puts(m, "\n");
+}
+
+static void *ls_start(struct seq_file *m, loff_t *pos)
+{
+	struct lock_stat_seq *data = m->private;
+
+	if (*pos == 0)
+		return SEQ_START_TOKEN;
+	if (data->stats + *pos - 1 < data->iter_end)
+		return data->stats + *pos - 1;
+
+	return NULL;
+}
+
+static void *ls_next(struct seq_file *m, void *v, loff_t *pos)
+{
+	(*pos)++;
+
+	return ls_start(m, pos);
+}
+
+static void ls_stop(struct seq_file *m, void *v)
+{
+}
+
+static int ls_show(struct seq_file *m, void *v)
+{
+	if (v == SEQ_START_TOKEN)
+		seq_header(m);
+	else
+		seq_stats(m, v);
+
+	return 0;
+}
+
+static struct seq_operations lockstat_ops = {
+	.start	= ls_start,
+	.next	= ls_next,
+	.stop	= ls_stop,
+	.show	= ls_show,
+};
+
+static int lock_stat_open(struct inode *inode, struct file *file)
+{
+	struct lock_stat_seq *data;
+	struct lock_stat_data *iter;
+	struct lock_class *class;
+	int res;
+
+	data = vmalloc(sizeof(*data));
+	if (!data)
+		return -ENOMEM;
+
+	res = seq_open(file, &lockstat_ops);
+	if (res) {
+		vfree(data);
+		return res;
+	}
+
+	/*
+	 * Only the classes that were used:
+	 */
+	iter = data->stats;
+	list_for_each_entry(class, &all_lock_classes, lock_entry) {
+		iter->class = class;
+		iter->stats = lock_stats(class);
+		if (iter->stats.read_holdtime.nr ||
+		    iter->stats.write_holdtime.nr)
+			iter++;
+	}
+	data->iter_end = iter;
+
+	sort(data->stats, data->iter_end - data->stats,
+	     sizeof(struct lock_stat_data), lock_stat_cmp, NULL);
+
+	((struct seq_file *)file->private_data)->private = data;
+
+	return 0;
+}
+
+/*
+ * Writing "0" clears the statistics of all classes:
+ */
+static ssize_t lock_stat_write(struct file *file, const char __user *buf,
+			       size_t count, loff_t *ppos)
+{
+	struct lock_class *class;
+	char c;
+
+	if (count) {
+		if (get_user(c, buf))
+			return -EFAULT;
+		if (c != '0')
+			return count;
+
+		list_for_each_entry(class, &all_lock_classes, lock_entry)
+			clear_lock_stats(class);
+	}
+
+	return count;
+}
+
+static int lock_stat_release(struct inode *inode, struct file *file)
+{
+	struct seq_file *seq = file->private_data;
+
+	vfree(seq->private);
+	seq->private = NULL;
+
+	return seq_release(inode, file);
+}
+
+static struct file_operations proc_lock_stat_operations = {
+	.open		= lock_stat_open,
+	.write		= lock_stat_write,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= lock_stat_release,
+};
+#endif /* CONFIG_LOCK_STAT */
+
 static int __init lockdep_proc_init(void)
 {
 	struct proc_dir_entry *entry;
@@ -338,6 +617,12 @@ static int __init lockdep_proc_init(void)
 	if (entry)
 		entry->proc_fops = &proc_lockdep_stats_operations;
 
+#ifdef CONFIG_LOCK_STAT
+	entry = create_proc_entry("lock_stat", S_IRUSR | S_IWUSR, NULL);
+	if (entry)
+		entry->proc_fops = &proc_lock_stat_operations;
+#endif
+
 	return 0;
 }
 
@@ -0,0 +1,1021 @@
+/*
+ * kernel/perf_counter.c
+ *
+ * Performance counters.
+ *
+ * perf_counter_open() gives a descriptor for a counter of hardware
+ * events (from the PMU driver of the architecture) or of software ones
+ * (page faults, context switches, migrations), on a task or on a cpu.
+ * read() returns the count so far.  A counter with a sample_period
+ * writes a sample record every sample_period events into a ring buffer
+ * that the reader mmap()s, and poll() says when there is more to read.
+ *
+ * The counters of a task are in its perf_counter_context, put on the
+ * cpu when the task is switched in and taken off when it is switched
+ * out; those of a cpu are in a per-cpu context and count whatever runs
+ * there.  Anyone may count and sample the tasks they could ptrace;
+ * counting a whole cpu takes CAP_SYS_ADMIN.
+ */
+
+#include <linux/perf_counter.h>
+#include <linux/module.h>
+#include <linux/sched.h>
+#include <linux/fs.h>
+#include <linux/file.h>
+#include <linux/poll.h>
+#include <linux/mm.h>
+#include <linux/slab.h>
+#include <linux/smp.h>
+#include <linux/ptrace.h>
+#include <linux/rcupdate.h>
+#include <linux/anon_inodes.h>
+#include <linux/syscalls.h>
+#include <linux/err.h>
+#include <asm/uaccess.h>
+#include <asm/ptrace.h>
+
+atomic_t perf_swcounter_enabled[PERF_SW_EVENTS_MAX];
+
+static DEFINE_PER_CPU(struct perf_counter_context, perf_cpu_context);
+
+/* One for samples taken in NMI context, one for the rest */
+static DEFINE_PER_CPU(struct perf_callchain_entry, perf_callchain_entry[2]);
+
+/*
+ * Architecture hooks, for those without a PMU driver
+ */
+
+const struct perf_counter_ops * __attribute__((weak))
+hw_perf_counter_init(struct perf_counter *counter)
+{
+	return ERR_PTR(-EOPNOTSUPP);
+}
+
+void __attribute__((weak))
+perf_callchain(struct pt_regs *regs, struct perf_callchain_entry *entry)
+{
+	if (!regs)
+		return;
+	entry->ip[entry->nr++] = user_mode(regs) ?
+		PERF_CONTEXT_USER : PERF_CONTEXT_KERNEL;
+	entry->ip[entry->nr++] = instruction_pointer(regs);
+}
+
+/*
+ * Run func on cpu, or here if cpu is -1, with interrupts off, and wait
+ * for it.  Used to get at the counters active there.
+ */
+struct perf_cpu_call {
+	int cpu;
+	void (*func)(void *info);
+	void *info;
+};
+
+static void perf_cpu_call_one(void *data)
+{
+	struct perf_cpu_call *call = data;
+
+	if (call->cpu == smp_processor_id())
+		call->func(call->info);
+}
+
+static void perf_call_on_cpu(int cpu, void (*func)(void *info), void *info)
+{
+	struct perf_cpu_call call = {
+		.cpu	= cpu,
+		.func	= func,
+		.info	= info,
+	};
+
+	preempt_disable();
+	if (cpu < 0 || cpu == smp_processor_id()) {
+		local_irq_disable();
+		func(info);
+		local_irq_enable();
+	} else
+		smp_call_function(perf_cpu_call_one, &call, 0, 1);
+	preempt_enable();
+}
+
+/*
+ * Putting counters on and off the cpu.  Called there with the context
+ * locked.
+ */
+
+static void counter_sched_in(struct perf_counter *counter, int cpu)
+{
+	if (counter->state != PERF_COUNTER_STATE_INACTIVE)
+		return;
+	/* no room on the PMU: it waits for the next switch-in */
+	if (counter->ops->enable(counter))
+		return;
+	counter->state = PERF_COUNTER_STATE_ACTIVE;
+	counter->oncpu = cpu;
+}
+
+static void counter_sched_out(struct perf_counter *counter)
+{
+	if (counter->state != PERF_COUNTER_STATE_ACTIVE)
+		return;
+	counter->ops->disable(counter);
+	counter->state = PERF_COUNTER_STATE_INACTIVE;
+	counter->oncpu = -1;
+}
+
+static void ctx_sched_in(struct perf_counter_context *ctx, int cpu)
+{
+	struct perf_counter *counter;
+
+	spin_lock(&ctx->lock);
+	if (!ctx->task_exited) {
+		list_for_each_entry(counter, &ctx->counter_list, list_entry)
+			counter_sched_in(counter, cpu);
+		ctx->is_active = 1;
+		ctx->cpu = cpu;
+	}
+	spin_unlock(&ctx->lock);
+}
+
+static void ctx_sched_out(struct perf_counter_context *ctx, int cpu)
+{
+	struct perf_counter *counter;
+
+	spin_lock(&ctx->lock);
+	list_for_each_entry(counter, &ctx->counter_list, list_entry)
+		counter_sched_out(counter);
+	ctx->is_active = 0;
+	ctx->cpu = -1;
+	ctx->last_cpu = cpu;
+	spin_unlock(&ctx->lock);
+}
+
+/*
+ * Called from the context switch, with interrupts off: the counters of
+ * the task going out are stopped, those of the task coming in started.
+ */
+void perf_counter_task_sched_out(struct task_struct *task, int cpu)
+{
+	struct perf_counter_context *ctx = task->perf_counter_ctxp;
+
+	if (ctx && ctx->is_active)
+		ctx_sched_out(ctx, cpu);
+}
+
+void perf_counter_task_sched_in(struct task_struct *task, int cpu)
+{
+	struct perf_counter_context *ctx = task->perf_counter_ctxp;
+	int migrated;
+
+	if (!ctx || !ctx->nr_counters)
+		return;
+	migrated = ctx->last_cpu != -1 && ctx->last_cpu != cpu;
+	ctx_sched_in(ctx, cpu);
+	if (migrated)
+		perf_swcounter_event(PERF_COUNT_CPU_MIGRATIONS, 1, NULL);
+}
+
+void perf_counter_init_task(struct task_struct *task)
+{
+	task->perf_counter_ctxp = NULL;
+}
+
+/*
+ * The task is exiting: stop its counters for good.  Their counts stay
+ * readable until the descriptors are closed.
+ */
+void perf_counter_exit_task(struct task_struct *task)
+{
+	struct perf_counter_context *ctx = task->perf_counter_ctxp;
+	unsigned long flags;
+
+	if (!ctx)
+		return;
+	local_irq_save(flags);
+	ctx_sched_out(ctx, smp_processor_id());
+	spin_lock(&ctx->lock);
+	ctx->task_exited = 1;
+	spin_unlock(&ctx->lock);
+	local_irq_restore(flags);
+}
+
+/* Every counter holds a reference on the task, so all are gone */
+void perf_counter_free_task(struct task_struct *task)
+{
+	kfree(task->perf_counter_ctxp);
+}
+
+/*
+ * Deferred wakeups
+ *
+ * Samples are written from NMI context, or under the runqueue lock for
+ * a context switch, where readers cannot be woken.  The counter is put
+ * on a list of this cpu instead, which the next tick empties.  The list
+ * is only changed on its own cpu, with cmpxchg() so that an NMI can
+ * push onto it in the middle of another push.
+ */
+
+static DEFINE_PER_CPU(struct perf_counter *, perf_pending_head);
+
+static void perf_counter_wakeup(struct perf_counter *counter)
+{
+	struct perf_counter **head, *prev;
+
+	if (cmpxchg(&counter->pending, 0, 1) != 0)
+		return;
+
+	head = &__get_cpu_var(perf_pending_head);
+	do {
+		prev = *head;
+		counter->pending_next = prev;
+	} while (cmpxchg(head, prev, counter) != prev);
+}
+
+static void __perf_counter_do_pending(void *unused)
+{
+	struct perf_counter *counter, *next;
+
+	counter = xchg(&__get_cpu_var(perf_pending_head), NULL);
+	while (counter) {
+		next = counter->pending_next;
+		atomic_set(&counter->poll, POLLIN);
+		wake_up_all(&counter->waitq);
+		smp_wmb();
+		counter->pending = 0;
+		counter = next;
+	}
+}
+
+/* From the timer tick */
+void perf_counter_do_pending(void)
+{
+	if (__get_cpu_var(perf_pending_head))
+		__perf_counter_do_pending(NULL);
+}
+
+/*
+ * Sample output
+ */
+
+struct perf_output_handle {
+	struct perf_mmap_data *data;
+	u64 head;
+};
+
+static int perf_output_begin(struct perf_output_handle *handle,
+			     struct perf_mmap_data *data, unsigned int size)
+{
+	u64 tail;
+
+	handle->data = data;
+	handle->head = data->head;
+	if (data->writable) {
+		tail = data->user_page->data_tail;
+		smp_mb();
+		if (handle->head + size - tail >
+		    ((u64)data->nr_pages << PAGE_SHIFT)) {
+			data->user_page->lost++;
+			return 0;
+		}
+	}
+	return 1;
+}
+
+static void perf_output_copy(struct perf_output_handle *handle,
+			     const void *buf, unsigned int len)
+{
+	struct perf_mmap_data *data = handle->data;
+	unsigned long mask = ((unsigned long)data->nr_pages << PAGE_SHIFT) - 1;
+	unsigned long offset, size;
+
+	while (len) {
+		offset = handle->head & mask;
+		size = min_t(unsigned long, len,
+			     PAGE_SIZE - (offset & ~PAGE_MASK));
+		memcpy(data->data_pages[offset >> PAGE_SHIFT] +
+		       (offset & ~PAGE_MASK), buf, size);
+		handle->head += size;
+		buf += size;
+		len -= size;
+	}
+}
+
+static void perf_output_end(struct perf_counter *counter,
+			    struct perf_output_handle *handle)
+{
+	struct perf_mmap_data *data = handle->data;
+	int wakeup;
+
+	/* the sample must be seen before the head that covers it */
+	smp_wmb();
+	data->user_page->data_head = handle->head;
+	data->head = handle->head;
+
+	if (counter->attr.wakeup_events)
+		wakeup = ++counter->wakeup_count >= counter->attr.wakeup_events;
+	else
+		wakeup = (handle->head ^ data->wakeup_head) >> PAGE_SHIFT;
+	if (wakeup) {
+		counter->wakeup_count = 0;
+		data->wakeup_head = handle->head;
+		perf_counter_wakeup(counter);
+	}
+}
+
+/**
+ * perf_counter_overflow - write a sample of a counter
+ * @counter: the counter whose period ran out
+ * @regs: where it did, if known
+ * @nmi: whether this is NMI context
+ *
+ * Called on the cpu the counter is active on, with interrupts off.
+ * Returns 0, or 1 if the sample had to be dropped.
+ */
+int perf_counter_overflow(struct perf_counter *counter,
+			  struct pt_regs *regs, int nmi)
+{
+	u64 sample_type = counter->attr.sample_type;
+	struct perf_callchain_entry *chain = NULL;
+	struct perf_output_handle handle;
+	struct perf_event_header header;
+	struct perf_mmap_data *data;
+	struct {
+		u32 pid, tid;
+	} tid_entry;
+	u64 ip = 0, time = 0;
+
+	data = rcu_dereference(counter->data);
+	if (!data)
+		return 1;
+
+	header.type = PERF_EVENT_SAMPLE;
+	header.misc = regs && user_mode(regs) ?
+		PERF_EVENT_MISC_USER : PERF_EVENT_MISC_KERNEL;
+	header.size = sizeof(header);
+
+	if (sample_type & PERF_SAMPLE_IP) {
+		if (regs)
+			ip = instruction_pointer(regs);
+		header.size += sizeof(ip);
+	}
+	if (sample_type & PERF_SAMPLE_TID) {
+		tid_entry.pid = current->tgid;
+		tid_entry.tid = current->pid;
+		header.size += sizeof(tid_entry);
+	}
+	if (sample_type & PERF_SAMPLE_TIME) {
+		time = sched_clock();
+		header.size += sizeof(time);
+	}
+	if (sample_type & PERF_SAMPLE_CALLCHAIN) {
+		chain = &__get_cpu_var(perf_callchain_entry)[!!nmi];
+		chain->nr = 0;
+		perf_callchain(regs, chain);
+		header.size += (1 + chain->nr) * sizeof(u64);
+	}
+
+	if (!perf_output_begin(&handle, data, header.size))
+		return 1;
+	perf_output_copy(&handle, &header, sizeof(header));
+	if (sample_type & PERF_SAMPLE_IP)
+		perf_output_copy(&handle, &ip, sizeof(ip));
+	if (sample_type & PERF_SAMPLE_TID)
+		perf_output_copy(&handle, &tid_entry, sizeof(tid_entry));
+	if (sample_type & PERF_SAMPLE_TIME)
+		perf_output_copy(&handle, &time, sizeof(time));
+	if (chain)
+		perf_output_copy(&handle, chain,
+				 (1 + chain->nr) * sizeof(u64));
+	perf_output_end(counter, &handle);
+	return 0;
+}
+
+/*
+ * Software counters
+ */
+
+static int perf_swcounter_enable(struct perf_counter *counter)
+{
+	return 0;
+}
+
+static void perf_swcounter_disable(struct perf_counter *counter)
+{
+}
+
+static void perf_swcounter_read(struct perf_counter *counter)
+{
+}
+
+static const struct perf_counter_ops perf_ops_software = {
+	.enable		= perf_swcounter_enable,
+	.disable	= perf_swcounter_disable,
+	.read		= perf_swcounter_read,
+};
+
+static int perf_swcounter_match(struct perf_counter *counter, u32 event,
+				struct pt_regs *regs)
+{
+	int user = regs && user_mode(regs);
+
+	if (counter->state != PERF_COUNTER_STATE_ACTIVE ||
+	    !is_software_counter(counter) || counter->attr.config != event)
+		return 0;
+	if (user && (counter->attr.flags & PERF_ATTR_EXCLUDE_USER))
+		return 0;
+	if (!user && (counter->attr.flags & PERF_ATTR_EXCLUDE_KERNEL))
+		return 0;
+	return 1;
+}
+
+static void perf_swcounter_ctx_event(struct perf_counter_context *ctx,
+				     u32 event, u64 nr, struct pt_regs *regs)
+{
+	struct perf_counter *counter;
+	u64 period;
+
+	spin_lock(&ctx->lock);
+	list_for_each_entry(counter, &ctx->counter_list, list_entry) {
+		if (!perf_swcounter_match(counter, event, regs))
+			continue;
+		counter->count += nr;
+		period = counter->attr.sample_period;
+		if (!period)
+			continue;
+		counter->period_left -= nr;
+		if (counter->period_left <= 0) {
+			counter->period_left += period;
+			if (counter->period_left <= 0)
+				counter->period_left = period;
+			perf_counter_overflow(counter, regs, 0);
+		}
+	}
+	spin_unlock(&ctx->lock);
+}
+
+void __perf_swcounter_event(u32 event, u64 nr, struct pt_regs *regs)
+{
+	struct perf_counter_context *ctx;
+	unsigned long flags;
+
+	local_irq_save(flags);
+	ctx = current->perf_counter_ctxp;
+	if (ctx && ctx->is_active)
+		perf_swcounter_ctx_event(ctx, event, nr, regs);
+	ctx = &__get_cpu_var(perf_cpu_context);
+	if (ctx->nr_counters)
+		perf_swcounter_ctx_event(ctx, event, nr, regs);
+	local_irq_restore(flags);
+}
+
+/*
+ * Changing a counter
+ *
+ * A counter may only be touched on the cpu its context is active on,
+ * or anywhere while the context is inactive.  The functions below run
+ * there with the context locked, and leave ->retry set if they find it
+ * has moved on in the meantime, its task having been switched.
+ */
+
+struct perf_counter_call {
+	struct perf_counter *counter;
+	int retry;
+};
+
+/* Whether the counter's context is active on this cpu, or nowhere */
+static int counter_ctx_here(struct perf_counter *counter)
+{
+	struct perf_counter_context *ctx = counter->ctx;
+
+	/* the counters of a cpu gone offline are not counting either */
+	if (!ctx->is_active || !cpu_online(ctx->cpu))
+		return 1;
+	return ctx->cpu == smp_processor_id();
+}
+
+static void __perf_counter_enable(void *info)
+{
+	struct perf_counter_call *call = info;
+	struct perf_counter *counter = call->counter;
+	struct perf_counter_context *ctx = counter->ctx;
+
+	spin_lock(&ctx->lock);
+	if (!counter_ctx_here(counter))
+		goto out;
+	if (counter->state == PERF_COUNTER_STATE_OFF) {
+		counter->state = PERF_COUNTER_STATE_INACTIVE;
+		if (ctx->is_active)
+			counter_sched_in(counter, smp_processor_id());
+	}
+	call->retry = 0;
+out:
+	spin_unlock(&ctx->lock);
+}
+
+static void __perf_counter_disable(void *info)
+{
+	struct perf_counter_call *call = info;
+	struct perf_counter *counter = call->counter;
+	struct perf_counter_context *ctx = counter->ctx;
+
+	spin_lock(&ctx->lock);
+	if (!counter_ctx_here(counter))
+		goto out;
+	counter_sched_out(counter);
+	counter->state = PERF_COUNTER_STATE_OFF;
+	call->retry = 0;
+out:
+	spin_unlock(&ctx->lock);
+}
+
+static void __perf_counter_read(void *info)
+{
+	struct perf_counter_call *call = info;
+	struct perf_counter *counter = call->counter;
+	struct perf_counter_context *ctx = counter->ctx;
+
+	spin_lock(&ctx->lock);
+	if (!counter_ctx_here(counter))
+		goto out;
+	if (counter->state == PERF_COUNTER_STATE_ACTIVE)
+		counter->ops->read(counter);
+	call->retry = 0;
+out:
+	spin_unlock(&ctx->lock);
+}
+
+static void __perf_counter_reset(void *info)
+{
+	struct perf_counter_call *call = info;
+	struct perf_counter *counter = call->counter;
+	struct perf_counter_context *ctx = counter->ctx;
+
+	spin_lock(&ctx->lock);
+	if (!counter_ctx_here(counter))
+		goto out;
+	if (counter->state == PERF_COUNTER_STATE_ACTIVE)
+		counter->ops->read(counter);
+	counter->count = 0;
+	counter->period_left = counter->attr.sample_period;
+	call->retry = 0;
+out:
+	spin_unlock(&ctx->lock);
+}
+
+/*
+ * A counter being installed in the caller's own context starts at
+ * once; in another task's, from the next time that is switched in if
+ * it is not running.
+ */
+static void __perf_install_in_context(void *info)
+{
+	struct perf_counter_call *call = info;
+	struct perf_counter *counter = call->counter;
+	struct perf_counter_context *ctx = counter->ctx;
+	int cpu = smp_processor_id();
+
+	spin_lock(&ctx->lock);
+	if (!counter_ctx_here(counter))
+		goto out;
+	list_add_tail(&counter->list_entry, &ctx->counter_list);
+	ctx->nr_counters++;
+	if (!ctx->is_active && ctx->task == current && !ctx->task_exited) {
+		ctx->is_active = 1;
+		ctx->cpu = cpu;
+	}
+	if (ctx->is_active)
+		counter_sched_in(counter, cpu);
+	call->retry = 0;
+out:
+	spin_unlock(&ctx->lock);
+}
+
+/* Run func where the counter's context is active, until it gets there */
+static void perf_counter_call(struct perf_counter *counter,
+			      void (*func)(void *info))
+{
+	struct perf_counter_context *ctx = counter->ctx;
+	struct perf_counter_call call = {
+		.counter	= counter,
+	};
+	int cpu;
+
+	do {
+		call.retry = 1;
+		spin_lock_irq(&ctx->lock);
+		cpu = ctx->is_active ? ctx->cpu : -1;
+		spin_unlock_irq(&ctx->lock);
+		perf_call_on_cpu(cpu, func, &call);
+	} while (call.retry);
+}
+
+static u64 perf_counter_read(struct perf_counter *counter)
+{
+	u64 count;
+
+	perf_counter_call(counter, __perf_counter_read);
+	spin_lock_irq(&counter->ctx->lock);
+	count = counter->count;
+	spin_unlock_irq(&counter->ctx->lock);
+	return count;
+}
+
+static void perf_remove_from_context(struct perf_counter *counter)
+{
+	struct perf_counter_context *ctx = counter->ctx;
+
+	perf_counter_call(counter, __perf_counter_disable);
+
+	spin_lock_irq(&ctx->lock);
+	list_del_init(&counter->list_entry);
+	ctx->nr_counters--;
+	spin_unlock_irq(&ctx->lock);
+}
+
+/*
+ * The context for pid and cpu: the task's, allocated here the first
+ * time, with a reference on the task taken; or the cpu's.
+ */
+static struct perf_counter_context *find_get_context(pid_t pid, int cpu)
+{
+	struct perf_counter_context *ctx, *new;
+	struct task_struct *task;
+
+	if (pid == -1 && cpu >= 0) {
+		if (!capable(CAP_SYS_ADMIN))
+			return ERR_PTR(-EACCES);
+		if (cpu >= NR_CPUS || !cpu_online(cpu))
+			return ERR_PTR(-ENODEV);
+		return &per_cpu(perf_cpu_context, cpu);
+	}
+	if (pid < 0 || cpu != -1)
+		return ERR_PTR(-EINVAL);
+
+	read_lock(&tasklist_lock);
+	task = pid ? find_task_by_pid(pid) : current;
+	if (task)
+		get_task_struct(task);
+	read_unlock(&tasklist_lock);
+	if (!task)
+		return ERR_PTR(-ESRCH);
+
+	ctx = ERR_PTR(-EACCES);
+	if (!ptrace_may_attach(task))
+		goto out_put;
+
+	ctx = task->perf_counter_ctxp;
+	if (ctx)
+		return ctx;
+
+	ctx = ERR_PTR(-ENOMEM);
+	new = kzalloc(sizeof(*new), GFP_KERNEL);
+	if (!new)
+		goto out_put;
+	spin_lock_init(&new->lock);
+	INIT_LIST_HEAD(&new->counter_list);
+	new->cpu = -1;
+	new->last_cpu = -1;
+	new->task = task;
+
+	task_lock(task);
+	if (!task->perf_counter_ctxp) {
+		smp_wmb();
+		task->perf_counter_ctxp = new;
+		new = NULL;
+	}
+	ctx = task->perf_counter_ctxp;
+	task_unlock(task);
+	kfree(new);
+	return ctx;
+
+out_put:
+	put_task_struct(task);
+	return ctx;
+}
+
+static void put_context(struct perf_counter_context *ctx)
+{
+	if (ctx->task)
+		put_task_struct(ctx->task);
+}
+
+static struct perf_counter *
+perf_counter_alloc(struct perf_counter_attr *attr,
+		   struct perf_counter_context *ctx)
+{
+	const struct perf_counter_ops *ops;
+	struct perf_counter *counter;
+
+	counter = kzalloc(sizeof(*counter), GFP_KERNEL);
+	if (!counter)
+		return ERR_PTR(-ENOMEM);
+
+	INIT_LIST_HEAD(&counter->list_entry);
+	counter->attr = *attr;
+	counter->ctx = ctx;
+	counter->oncpu = -1;
+	counter->state = attr->flags & PERF_ATTR_DISABLED ?
+		PERF_COUNTER_STATE_OFF : PERF_COUNTER_STATE_INACTIVE;
+	counter->period_left = attr->sample_period;
+	mutex_init(&counter->mmap_mutex);
+	init_waitqueue_head(&counter->waitq);
+
+	switch (attr->type) {
+	case PERF_TYPE_SOFTWARE:
+		ops = ERR_PTR(-EINVAL);
+		if (attr->config < PERF_SW_EVENTS_MAX) {
+			ops = &perf_ops_software;
+			atomic_inc(&perf_swcounter_enabled[attr->config]);
+		}
+		break;
+	case PERF_TYPE_HARDWARE:
+	case PERF_TYPE_RAW:
+		ops = hw_perf_counter_init(counter);
+		break;
+	default:
+		ops = ERR_PTR(-EINVAL);
+		break;
+	}
+	if (IS_ERR(ops)) {
+		kfree(counter);
+		return ERR_PTR(PTR_ERR(ops));
+	}
+	counter->ops = ops;
+	return counter;
+}
+
+static void free_counter(struct perf_counter *counter)
+{
+	if (is_software_counter(counter))
+		atomic_dec(&perf_swcounter_enabled[counter->attr.config]);
+	if (counter->destroy)
+		counter->destroy(counter);
+	put_context(counter->ctx);
+	kfree(counter);
+}
+
+static int perf_release(struct inode *inode, struct file *file)
+{
+	struct perf_counter *counter = file->private_data;
+
+	perf_remove_from_context(counter);
+	/* a wakeup may still be queued from its last sample */
+	if (counter->pending)
+		on_each_cpu(__perf_counter_do_pending, NULL, 0, 1);
+	free_counter(counter);
+	return 0;
+}
+
+static ssize_t perf_read(struct file *file, char __user *buf, size_t count,
+			 loff_t *ppos)
+{
+	struct perf_counter *counter = file->private_data;
+	u64 value;
+
+	if (count < sizeof(value))
+		return -EINVAL;
+	value = perf_counter_read(counter);
+	if (copy_to_user(buf, &value, sizeof(value)))
+		return -EFAULT;
+	return sizeof(value);
+}
+
+static unsigned int perf_poll(struct file *file, poll_table *wait)
+{
+	struct perf_counter *counter = file->private_data;
+
+	poll_wait(file, &counter->waitq, wait);
+	return atomic_xchg(&counter->poll, 0);
+}
+
+static long perf_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
+{
+	struct perf_counter *counter = file->private_data;
+
+	switch (cmd) {
+	case PERF_COUNTER_IOC_ENABLE:
+		perf_counter_call(counter, __perf_counter_enable);
+		return 0;
+	case PERF_COUNTER_IOC_DISABLE:
+		perf_counter_call(counter, __perf_counter_disable);
+		return 0;
+	case PERF_COUNTER_IOC_RESET:
+		perf_counter_call(counter, __perf_counter_reset);
+		return 0;
+	}
+	return -ENOTTY;
+}
+
+/*
+ * The sample buffer
+ */
+
+static struct perf_mmap_data *perf_mmap_data_alloc(int nr_pages)
+{
+	struct perf_mmap_data *data;
+	int i;
+
+	data = kzalloc(sizeof(*data) + nr_pages * sizeof(void *), GFP_KERNEL);
+	if (!data)
+		return NULL;
+	data->user_page = (void *)get_zeroed_page(GFP_KERNEL);
+	if (!data->user_page)
+		goto fail_user_page;
+	for (i = 0; i < nr_pages; i++) {
+		data->data_pages[i] = (void *)get_zeroed_page(GFP_KERNEL);
+		if (!data->data_pages[i])
+			goto fail_data_pages;
+	}
+	data->nr_pages = nr_pages;
+	return data;
+
+fail_data_pages:
+	while (--i >= 0)
+		free_page((unsigned long)data->data_pages[i]);
+	free_page((unsigned long)data->user_page);
+fail_user_page:
+	kfree(data);
+	return NULL;
+}
+
+static void perf_mmap_data_free(struct perf_mmap_data *data)
+{
+	int i;
+
+	free_page((unsigned long)data->user_page);
+	for (i = 0; i < data->nr_pages; i++)
+		free_page((unsigned long)data->data_pages[i]);
+	kfree(data);
+}
+
+static struct page *perf_mmap_nopage(struct vm_area_struct *vma,
+				     unsigned long address, int *type)
+{
+	struct perf_counter *counter = vma->vm_file->private_data;
+	struct perf_mmap_data *data = counter->data;
+	unsigned long pgoff;
+	struct page *page;
+
+	pgoff = (address - vma->vm_start) >> PAGE_SHIFT;
+	if (!data || pgoff > data->nr_pages)
+		return NOPAGE_SIGBUS;
+	if (pgoff == 0)
+		page = virt_to_page(data->user_page);
+	else
+		page = virt_to_page(data->data_pages[pgoff - 1]);
+	get_page(page);
+	if (type)
+		*type = VM_FAULT_MINOR;
+	return page;
+}
+
+static void perf_mmap_open(struct vm_area_struct *vma)
+{
+	struct perf_counter *counter = vma->vm_file->private_data;
+
+	atomic_inc(&counter->mmap_count);
+}
+
+/*
+ * The last unmap frees the buffer.  A sample being written from an NMI
+ * or with interrupts off is finished by the time synchronize_sched()
+ * returns.
+ */
+static void perf_mmap_close(struct vm_area_struct *vma)
+{
+	struct perf_counter *counter = vma->vm_file->private_data;
+	struct perf_mmap_data *data;
+
+	mutex_lock(&counter->mmap_mutex);
+	if (atomic_dec_and_test(&counter->mmap_count)) {
+		data = counter->data;
+		rcu_assign_pointer(counter->data, NULL);
+		synchronize_sched();
+		perf_mmap_data_free(data);
+	}
+	mutex_unlock(&counter->mmap_mutex);
+}
+
+static struct vm_operations_struct perf_mmap_vmops = {
+	.open		= perf_mmap_open,
+	.close		= perf_mmap_close,
+	.nopage		= perf_mmap_nopage,
+};
+
+static int perf_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	struct perf_counter *counter = file->private_data;
+	unsigned long nr_pages = (vma->vm_end - vma->vm_start) >> PAGE_SHIFT;
+	struct perf_mmap_data *data;
+	int ret = 0;
+
+	if (!(vma->vm_flags & VM_SHARED) || vma->vm_pgoff != 0)
+		return -EINVAL;
+	/* the header page and a power of two of data pages */
+	nr_pages--;
+	if (!nr_pages || (nr_pages & (nr_pages - 1)))
+		return -EINVAL;
+
+	mutex_lock(&counter->mmap_mutex);
+	data = counter->data;
+	if (data) {
+		if (data->nr_pages != nr_pages)
+			ret = -EINVAL;
+		goto unlock;
+	}
+	data = perf_mmap_data_alloc(nr_pages);
+	if (!data) {
+		ret = -ENOMEM;
+		goto unlock;
+	}
+	data->writable = !!(vma->vm_flags & VM_WRITE);
+	data->user_page->version = 1;
+	rcu_assign_pointer(counter->data, data);
+unlock:
+	if (!ret) {
+		atomic_inc(&counter->mmap_count);
+		vma->vm_flags |= VM_RESERVED | VM_DONTEXPAND;
+		vma->vm_ops = &perf_mmap_vmops;
+	}
+	mutex_unlock(&counter->mmap_mutex);
+	return ret;
+}
+
+static const struct file_operations perf_fops = {
+	.release		= perf_release,
+	.read			= perf_read,
+	.poll			= perf_poll,
+	.unlocked_ioctl		= perf_ioctl,
+	.compat_ioctl		= perf_ioctl,
+	.mmap			= perf_mmap,
+};
+
+#define PERF_ATTR_FLAGS	(PERF_ATTR_DISABLED | PERF_ATTR_EXCLUDE_USER | \
+			 PERF_ATTR_EXCLUDE_KERNEL)
+#define PERF_SAMPLE_TYPES (PERF_SAMPLE_IP | PERF_SAMPLE_TID | \
+			   PERF_SAMPLE_TIME | PERF_SAMPLE_CALLCHAIN)
+
+/**
+ * sys_perf_counter_open - open a performance counter
+ * @attr_uptr: what to count, and how
+ * @pid: the task to count, 0 for the caller, -1 for all on @cpu
+ * @cpu: the cpu to count on, -1 for wherever @pid runs
+ * @group_fd: must be -1, no counter groups yet
+ * @flags: must be 0
+ *
+ * Returns the counter's file descriptor.
+ */
+asmlinkage long sys_perf_counter_open(struct perf_counter_attr __user *attr_uptr,
+				      pid_t pid, int cpu, int group_fd,
+				      unsigned long flags)
+{
+	struct perf_counter_context *ctx;
+	struct perf_counter_attr attr;
+	struct perf_counter *counter;
+	int fd;
+
+	if (copy_from_user(&attr, attr_uptr, sizeof(attr)))
+		return -EFAULT;
+	if (attr.size != sizeof(attr) || flags || group_fd != -1)
+		return -EINVAL;
+	if ((attr.flags & ~PERF_ATTR_FLAGS) ||
+	    (attr.sample_type & ~PERF_SAMPLE_TYPES))
+		return -EINVAL;
+	if ((s64)attr.sample_period < 0)
+		return -EINVAL;
+
+	ctx = find_get_context(pid, cpu);
+	if (IS_ERR(ctx))
+		return PTR_ERR(ctx);
+
+	counter = perf_counter_alloc(&attr, ctx);
+	if (IS_ERR(counter)) {
+		put_context(ctx);
+		return PTR_ERR(counter);
+	}
+
+	perf_counter_call(counter, __perf_install_in_context);
+
+	fd = anon_inode_getfd(&perf_fops, counter, O_RDWR);
+	if (fd < 0) {
+		perf_remove_from_context(counter);
+		free_counter(counter);
+	}
+	return fd;
+}
+
+static int __init perf_counter_init(void)
+{
+	struct perf_counter_context *ctx;
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		ctx = &per_cpu(perf_cpu_context, cpu);
+		spin_lock_init(&ctx->lock);
+		INIT_LIST_HEAD(&ctx->counter_list);
+		ctx->is_active = 1;
+		ctx->cpu = cpu;
+		ctx->last_cpu = -1;
+	}
+	return 0;
+}
+core_initcall(perf_counter_init);
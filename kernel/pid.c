@@ -9,15 +9,19 @@
  * against. There is very little to them aside from hashing them and
  * parking tasks using given ID's on a list.
  *
- * The hash is always changed with the tasklist_lock write-acquired,
- * and the hash is only accessed with the tasklist_lock at least
- * read-acquired, so there's no additional SMP locking needed here.
+ * The hash is changed under pidmap_lock and looked up under RCU.  It
+ * starts out sized for the machine's memory and is doubled, by a work
+ * item, when it holds more than two pids per chain on average; lookups
+ * that miss while entries are being moved to the new table try again.
  *
  * We have a list of bitmap pages, which bitmaps represent the PID space.
  * Allocating and freeing PIDs is completely lockless. The worst-case
  * allocation scenario when all but one out of 1 million PIDs possible are
  * allocated already: the scanning of 32 list entries and at most PAGE_SIZE
  * bytes. The typical fastpath is a single successful setbit. Freeing is O(1).
+ * Each cpu takes its pids from the bitmap a batch at a time, so that
+ * forks on different cpus do not all write last_pid and the same bitmap
+ * words.
  */
 
 #include <linux/mm.h>
@@ -26,12 +30,32 @@
 #include <linux/init.h>
 #include <linux/bootmem.h>
 #include <linux/hash.h>
-
-#define pid_hashfn(nr) hash_long((unsigned long)nr, pidhash_shift)
-static struct hlist_head *pid_hash;
-static int pidhash_shift;
+#include <linux/percpu.h>
+#include <linux/cpu.h>
+#include <linux/notifier.h>
+#include <linux/seqlock.h>
+#include <linux/vmalloc.h>
+#include <linux/workqueue.h>
+
+struct pidhash {
+	int shift;
+	int boot;		/* from bootmem, never freed */
+	struct hlist_head heads[0];
+};
+
+#define pid_hashfn(ph, nr) hash_long((unsigned long)nr, (ph)->shift)
+static struct pidhash *pid_hash;
 static kmem_cache_t *pid_cachep;
 
+/* The number of pids in pid_hash, under pidmap_lock */
+static int nr_hashed_pids;
+
+/* Bumped around moving the pids to a new pid_hash */
+static seqcount_t pidhash_seq = SEQCNT_ZERO;
+
+/* 64K chains: more than enough for PID_MAX_LIMIT pids */
+#define PIDHASH_SHIFT_MAX	16
+
 int pid_max = PID_MAX_DEFAULT;
 int last_pid;
 
@@ -76,6 +100,19 @@ static pidmap_t pidmap_array[PIDMAP_ENTRIES] =
  */
 static  __cacheline_aligned_in_smp DEFINE_SPINLOCK(pidmap_lock);
 
+/*
+ * The pids a cpu took from the bitmap ahead of need.  They stay set in
+ * the bitmap, so nobody else gets them; the next is pids[nr - 1].
+ */
+#define PID_BATCH	16
+
+struct pid_cache {
+	int nr;
+	int pids[PID_BATCH];
+};
+
+static DEFINE_PER_CPU(struct pid_cache, pid_cache);
+
 static fastcall void free_pidmap(int pid)
 {
 	pidmap_t *map = pidmap_array + pid / BITS_PER_PAGE;
@@ -145,6 +182,87 @@ static int alloc_pidmap(void)
 	return -1;
 }
 
+/*
+ * Allocate a pid number, from this cpu's batch if it has one left, or
+ * else by taking a new batch from the bitmap.  Pids cached before
+ * pid_max was lowered below them are handed back.
+ */
+static int alloc_pid_nr(void)
+{
+	struct pid_cache *pc;
+	int batch[PID_BATCH];
+	int i, n, nr = -1;
+
+	pc = &get_cpu_var(pid_cache);
+	while (pc->nr) {
+		nr = pc->pids[--pc->nr];
+		if (likely(nr < pid_max))
+			break;
+		free_pidmap(nr);
+		nr = -1;
+	}
+	put_cpu_var(pid_cache);
+	if (nr >= 0)
+		return nr;
+
+	for (n = 0; n < PID_BATCH; n++) {
+		batch[n] = alloc_pidmap();
+		if (batch[n] < 0)
+			break;
+	}
+	if (!n)
+		return -1;
+
+	/*
+	 * Keep the rest of the batch, lowest last, in whichever cpu's
+	 * cache we are on now; whatever does not fit goes back.
+	 */
+	pc = &get_cpu_var(pid_cache);
+	for (i = n - 1; i > 0; i--) {
+		if (pc->nr < PID_BATCH)
+			pc->pids[pc->nr++] = batch[i];
+		else
+			free_pidmap(batch[i]);
+	}
+	put_cpu_var(pid_cache);
+	return batch[0];
+}
+
+#ifdef CONFIG_HOTPLUG_CPU
+static int pid_cpu_notify(struct notifier_block *self,
+			  unsigned long action, void *hcpu)
+{
+	struct pid_cache *pc = &per_cpu(pid_cache, (unsigned long)hcpu);
+
+	if (action == CPU_DEAD) {
+		while (pc->nr)
+			free_pidmap(pc->pids[--pc->nr]);
+	}
+	return NOTIFY_OK;
+}
+#endif /* CONFIG_HOTPLUG_CPU */
+
+/*
+ * Find the first set bit in the pid bitmap after last, or -1.
+ */
+static int next_pidmap(int last)
+{
+	int offset;
+	pidmap_t *map, *end;
+
+	offset = (last + 1) & BITS_PER_PAGE_MASK;
+	map = &pidmap_array[(last + 1)/BITS_PER_PAGE];
+	end = &pidmap_array[PIDMAP_ENTRIES];
+	for (; map < end; map++, offset = 0) {
+		if (unlikely(!map->page))
+			continue;
+		offset = find_next_bit((map)->page, BITS_PER_PAGE, offset);
+		if (offset < BITS_PER_PAGE)
+			return mk_pid(map, offset);
+	}
+	return -1;
+}
+
 fastcall void put_pid(struct pid *pid)
 {
 	if (!pid)
@@ -167,23 +285,80 @@ fastcall void free_pid(struct pid *pid)
 
 	spin_lock_irqsave(&pidmap_lock, flags);
 	hlist_del_rcu(&pid->pid_chain);
+	nr_hashed_pids--;
 	spin_unlock_irqrestore(&pidmap_lock, flags);
 
 	free_pidmap(pid->nr);
 	call_rcu(&pid->rcu, delayed_put_pid);
 }
 
+static struct pidhash *alloc_pidhash(int shift)
+{
+	struct pidhash *ph;
+	int i;
+
+	ph = vmalloc(sizeof(*ph) + (sizeof(struct hlist_head) << shift));
+	if (!ph)
+		return NULL;
+	ph->shift = shift;
+	ph->boot = 0;
+	for (i = 0; i < 1 << shift; i++)
+		INIT_HLIST_HEAD(&ph->heads[i]);
+	return ph;
+}
+
+/*
+ * Double pid_hash.  The pids are moved with pidmap_lock held and
+ * interrupts off, which happens once per doubling; the old table is
+ * freed once no lookup can be walking it any more.
+ */
+static void pidhash_grow(void *unused)
+{
+	struct pidhash *old, *new;
+	struct hlist_node *elem, *next;
+	struct pid *pid;
+	int i;
+
+	old = pid_hash;
+	if (old->shift >= PIDHASH_SHIFT_MAX ||
+	    nr_hashed_pids <= (2 << old->shift))
+		return;
+	new = alloc_pidhash(old->shift + 1);
+	if (!new)
+		return;
+
+	spin_lock_irq(&pidmap_lock);
+	write_seqcount_begin(&pidhash_seq);
+	for (i = 0; i < 1 << old->shift; i++) {
+		hlist_for_each_entry_safe(pid, elem, next, &old->heads[i],
+					  pid_chain) {
+			hlist_del_rcu(&pid->pid_chain);
+			hlist_add_head_rcu(&pid->pid_chain,
+				&new->heads[pid_hashfn(new, pid->nr)]);
+		}
+	}
+	rcu_assign_pointer(pid_hash, new);
+	write_seqcount_end(&pidhash_seq);
+	spin_unlock_irq(&pidmap_lock);
+
+	synchronize_rcu();
+	if (!old->boot)
+		vfree(old);
+}
+
+static DECLARE_WORK(pidhash_grow_work, pidhash_grow, NULL);
+
 struct pid *alloc_pid(void)
 {
 	struct pid *pid;
 	enum pid_type type;
-	int nr = -1;
+	int nr = -1, grow;
 
 	pid = kmem_cache_alloc(pid_cachep, GFP_KERNEL);
 	if (!pid)
 		goto out;
 
-	nr = alloc_pidmap();
+	nr = alloc_pid_nr();
 	if (nr < 0)
 		goto out_free;
 
@@ -193,9 +368,14 @@ struct pid *alloc_pid(void)
 		INIT_HLIST_HEAD(&pid->tasks[type]);
 
 	spin_lock_irq(&pidmap_lock);
-	hlist_add_head_rcu(&pid->pid_chain, &pid_hash[pid_hashfn(pid->nr)]);
+	hlist_add_head_rcu(&pid->pid_chain,
+			   &pid_hash->heads[pid_hashfn(pid_hash, pid->nr)]);
+	grow = ++nr_hashed_pids > (2 << pid_hash->shift) &&
+		pid_hash->shift < PIDHASH_SHIFT_MAX;
 	spin_unlock_irq(&pidmap_lock);
 
+	if (unlikely(grow))
+		schedule_work(&pidhash_grow_work);
 out:
 	return pid;
 
@@ -205,16 +385,26 @@ out_free:
 	goto out;
 }
 
+/*
+ * A pid that is found is the one; only a miss may be due to the entries
+ * moving to a new table, and is checked against pidhash_seq.
+ */
 struct pid * fastcall find_pid(int nr)
 {
+	struct pidhash *ph;
 	struct hlist_node *elem;
 	struct pid *pid;
-
-	hlist_for_each_entry_rcu(pid, elem,
-			&pid_hash[pid_hashfn(nr)], pid_chain) {
-		if (pid->nr == nr)
-			return pid;
-	}
+	unsigned seq;
+
+	do {
+		seq = read_seqcount_begin(&pidhash_seq);
+		ph = rcu_dereference(pid_hash);
+		hlist_for_each_entry_rcu(pid, elem,
+				&ph->heads[pid_hashfn(ph, nr)], pid_chain) {
+			if (pid->nr == nr)
+				return pid;
+		}
+	} while (read_seqcount_retry(&pidhash_seq, seq));
 	return NULL;
 }
 
@@ -297,13 +487,32 @@ struct pid *find_get_pid(pid_t nr)
 }
 
 /*
- * The pid hash table is scaled according to the amount of memory in the
- * machine.  From a minimum of 16 slots up to 4096 slots at one gigabyte or
- * more.
+ * Find the pid numbered nr, or else the next one above it, for walking
+ * the pids in order.  Must be called under rcu_read_lock() or with
+ * tasklist_lock read-held.
+ */
+struct pid *find_ge_pid(int nr)
+{
+	struct pid *pid;
+
+	do {
+		pid = find_pid(nr);
+		if (pid)
+			break;
+		nr = next_pidmap(nr);
+	} while (nr > 0);
+
+	return pid;
+}
+
+/*
+ * The pid hash table starts out scaled according to the amount of memory
+ * in the machine.  From a minimum of 16 slots up to 4096 slots at one
+ * gigabyte or more; from there it grows with the number of pids.
  */
 void __init pidhash_init(void)
 {
-	int i, pidhash_size;
+	int i, pidhash_shift, pidhash_size;
 	unsigned long megabytes = nr_kernel_pages >> (20 - PAGE_SHIFT);
 
 	pidhash_shift = max(4, fls(megabytes * 4));
@@ -314,11 +523,14 @@ void __init pidhash_init(void)
 		pidhash_size, pidhash_shift,
 		pidhash_size * sizeof(struct hlist_head));
 
-	pid_hash = alloc_bootmem(pidhash_size *	sizeof(*(pid_hash)));
+	pid_hash = alloc_bootmem(sizeof(*pid_hash) +
+				 pidhash_size * sizeof(struct hlist_head));
 	if (!pid_hash)
 		panic("Could not alloc pidhash!\n");
+	pid_hash->shift = pidhash_shift;
+	pid_hash->boot = 1;
 	for (i = 0; i < pidhash_size; i++)
-		INIT_HLIST_HEAD(&pid_hash[i]);
+		INIT_HLIST_HEAD(&pid_hash->heads[i]);
 }
 
 void __init pidmap_init(void)
@@ -331,4 +543,5 @@ void __init pidmap_init(void)
 	pid_cachep = kmem_cache_create("pid", sizeof(struct pid),
 					__alignof__(struct pid),
 					SLAB_PANIC, NULL, NULL);
+	hotcpu_notifier(pid_cpu_notify, 0);
 }
@@ -224,6 +224,46 @@ static int posix_ktime_get_ts(clockid_t which_clock, struct timespec *tp)
 	return 0;
 }
 
+/*
+ * The coarse clocks return the time as of the last tick: no clocksource
+ * read, tick resolution, and nothing to sleep or arm timers on.
+ */
+static int posix_get_coarse_res(const clockid_t which_clock,
+				struct timespec *tp)
+{
+	jiffies_to_timespec(1, tp);
+	return 0;
+}
+
+static int posix_get_realtime_coarse(clockid_t which_clock,
+				     struct timespec *tp)
+{
+	*tp = current_kernel_time();
+	return 0;
+}
+
+static int posix_get_monotonic_coarse(clockid_t which_clock,
+				      struct timespec *tp)
+{
+	struct timespec now, wtm;
+	unsigned long seq;
+
+	do {
+		seq = read_seqbegin(&xtime_lock);
+		now = xtime;
+		wtm = wall_to_monotonic;
+	} while (read_seqretry(&xtime_lock, seq));
+
+	set_normalized_timespec(tp, now.tv_sec + wtm.tv_sec,
+				now.tv_nsec + wtm.tv_nsec);
+	return 0;
+}
+
+static int no_timer_create(struct k_itimer *new_timer)
+{
+	return -EOPNOTSUPP;
+}
+
 /*
  * Initialize everything, well, just everything in Posix clocks/timers ;)
  */
@@ -237,9 +277,25 @@ static __init int init_posix_timers(void)
 		.clock_get = posix_ktime_get_ts,
 		.clock_set = do_posix_clock_nosettime,
 	};
+	struct k_clock clock_realtime_coarse = {
+		.clock_getres = posix_get_coarse_res,
+		.clock_get = posix_get_realtime_coarse,
+		.clock_set = do_posix_clock_nosettime,
+		.timer_create = no_timer_create,
+		.nsleep = do_posix_clock_nonanosleep,
+	};
+	struct k_clock clock_monotonic_coarse = {
+		.clock_getres = posix_get_coarse_res,
+		.clock_get = posix_get_monotonic_coarse,
+		.clock_set = do_posix_clock_nosettime,
+		.timer_create = no_timer_create,
+		.nsleep = do_posix_clock_nonanosleep,
+	};
 
 	register_posix_clock(CLOCK_REALTIME, &clock_realtime);
 	register_posix_clock(CLOCK_MONOTONIC, &clock_monotonic);
+	register_posix_clock(CLOCK_REALTIME_COARSE, &clock_realtime_coarse);
+	register_posix_clock(CLOCK_MONOTONIC_COARSE, &clock_monotonic_coarse);
 
 	posix_timers_cache = kmem_cache_create("posix_timers_cache",
 					sizeof (struct k_itimer), 0, 0, NULL, NULL);
@@ -410,6 +466,13 @@ static struct k_itimer * alloc_posix_timer(void)
 	return tmr;
 }
 
+static void k_itimer_rcu_free(struct rcu_head *head)
+{
+	struct k_itimer *tmr = container_of(head, struct k_itimer, rcu);
+
+	kmem_cache_free(posix_timers_cache, tmr);
+}
+
 #define IT_ID_SET	1
 #define IT_ID_NOT_SET	0
 static void release_posix_timer(struct k_itimer *tmr, int it_id_set)
@@ -424,7 +487,7 @@ static void release_posix_timer(struct k_itimer *tmr, int it_id_set)
 	if (unlikely(tmr->it_process) &&
 	    tmr->it_sigev_notify == (SIGEV_SIGNAL|SIGEV_THREAD_ID))
 		put_task_struct(tmr->it_process);
-	kmem_cache_free(posix_timers_cache, tmr);
+	call_rcu(&tmr->rcu, k_itimer_rcu_free);
 }
 
 /* Create a POSIX.1b interval timer. */
@@ -558,33 +621,28 @@ out:
 
 /*
  * Locking issues: We need to protect the result of the id look up until
- * we get the timer locked down so it is not deleted under us.  The
- * removal is done under the idr spinlock so we use that here to bridge
- * the find to the timer lock.  To avoid a dead lock, the timer id MUST
- * be release with out holding the timer lock.
+ * we get the timer locked down so it is not deleted under us.  Timers
+ * are freed only after an RCU grace period, so rcu_read_lock() bridges
+ * the find to the timer lock without taking idr_lock; a timer that is
+ * being deleted has had it_process cleared under its lock, and fails
+ * the checks below.  To avoid a dead lock, the timer id MUST be
+ * release with out holding the timer lock.
  */
 static struct k_itimer * lock_timer(timer_t timer_id, unsigned long *flags)
 {
 	struct k_itimer *timr;
-	/*
-	 * Watch out here.  We do a irqsave on the idr_lock and pass the
-	 * flags part over to the timer lock.  Must not let interrupts in
-	 * while we are moving the lock.
-	 */
 
-	spin_lock_irqsave(&idr_lock, *flags);
+	rcu_read_lock();
 	timr = (struct k_itimer *) idr_find(&posix_timers_id, (int) timer_id);
 	if (timr) {
-		spin_lock(&timr->it_lock);
-		spin_unlock(&idr_lock);
-
+		spin_lock_irqsave(&timr->it_lock, *flags);
 		if ((timr->it_id != timer_id) || !(timr->it_process) ||
 				timr->it_process->tgid != current->tgid) {
 			unlock_timer(timr, *flags);
 			timr = NULL;
 		}
-	} else
-		spin_unlock_irqrestore(&idr_lock, *flags);
+	}
+	rcu_read_unlock();
 
 	return timr;
 }
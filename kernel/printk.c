@@ -31,6 +31,9 @@
 #include <linux/security.h>
 #include <linux/bootmem.h>
 #include <linux/syscalls.h>
+#include <linux/kthread.h>
+#include <linux/percpu.h>
+#include <linux/slab.h>
 
 #include <asm/uaccess.h>
 
@@ -123,6 +126,9 @@ static char *log_buf = __log_buf;
 static int log_buf_len = __LOG_BUF_LEN;
 static unsigned long logged_chars; /* Number of chars produced since last read+clear operation */
 
+/* printk_drain_lock serializes readers of the per-cpu printk rings */
+static DEFINE_SPINLOCK(printk_drain_lock);
+
 static int __init log_buf_len_setup(char *str)
 {
 	unsigned long size = memparse(str, &str);
@@ -430,6 +436,7 @@ static void zap_locks(void)
 
 	/* If a crash is occurring, make sure we can't deadlock */
 	spin_lock_init(&logbuf_lock);
+	spin_lock_init(&printk_drain_lock);
 	/* And make sure that we print immediately */
 	init_MUTEX(&console_sem);
 }
@@ -468,6 +475,315 @@ static int have_callable_console(void)
 	return 0;
 }
 
+/*
+ * Copy a formatted message into log_buf, starting each line with a log
+ * level tag and, with printk_time, the time @t at which the message was
+ * printed.  Returns the number of characters this added to the message.
+ * logbuf_lock must be held.
+ */
+static int emit_log_text(const char *p, unsigned long long t)
+{
+	static int log_level_unknown = 1;
+	int printed_len = 0;
+
+	for ( ; *p; p++) {
+		if (log_level_unknown) {
+                        /* log_level_unknown signals the start of a new line */
+			if (printk_time) {
+				int loglev_char;
+				char tbuf[50], *tp;
+				unsigned tlen;
+				unsigned long nanosec_rem;
+
+				/*
+				 * force the log level token to be
+				 * before the time output.
+				 */
+				if (p[0] == '<' && p[1] >='0' &&
+				   p[1] <= '7' && p[2] == '>') {
+					loglev_char = p[1];
+					p += 3;
+					printed_len -= 3;
+				} else {
+					loglev_char = default_message_loglevel
+						+ '0';
+				}
+				nanosec_rem = do_div(t, 1000000000);
+				tlen = sprintf(tbuf,
+						"<%c>[%5lu.%06lu] ",
+						loglev_char,
+						(unsigned long)t,
+						nanosec_rem/1000);
+
+				for (tp = tbuf; tp < tbuf + tlen; tp++)
+					emit_log_char(*tp);
+				printed_len += tlen;
+			} else {
+				if (p[0] != '<' || p[1] < '0' ||
+				   p[1] > '7' || p[2] != '>') {
+					emit_log_char('<');
+					emit_log_char(default_message_loglevel
+						+ '0');
+					emit_log_char('>');
+					printed_len += 3;
+				}
+			}
+			log_level_unknown = 0;
+			if (!*p)
+				break;
+		}
+		emit_log_char(*p);
+		if (*p == '\n')
+			log_level_unknown = 1;
+	}
+	return printed_len;
+}
+
+/*
+ * Per-cpu printk rings
+ *
+ * Once kprintkd is up, printk() formats the message into a ring of the
+ * calling cpu along with the time, and returns.  Only that cpu adds to
+ * its ring, with interrupts off, and only the drain takes from it, so
+ * neither side needs a lock.  kprintkd moves the messages into log_buf,
+ * oldest first across all the rings, and feeds the consoles, so a storm
+ * of messages no longer has every cpu in the system waiting on
+ * logbuf_lock and a slow serial console.  A message that does not fit
+ * in its ring is dropped and counted in printk_dropped.
+ *
+ * printk() does not wake kprintkd itself: it may be called with the
+ * runqueue lock held.  It leaves that to the next timer tick of the cpu,
+ * printk_tick(), which keeps ticking while a wakeup is pending.
+ *
+ * Until kprintkd runs, and from then on for oopses, for KERN_CRIT and
+ * above and when the system is going down, printk() works as it always
+ * did, after draining whatever is waiting in the rings.
+ */
+#define PRINTK_RING_SIZE	(16 * 1024)
+
+struct printk_rec {
+	unsigned long long ts;
+	unsigned int len;	/* of the text, with the NUL; 0 to wrap */
+};
+
+#define PRINTK_REC_SIZE(len)	ALIGN(sizeof(struct printk_rec) + (len), 8)
+
+struct printk_ring {
+	unsigned long head;		/* advanced by the owning cpu */
+	unsigned long tail;		/* advanced by the drain */
+	unsigned long dropped;		/* by the owning cpu */
+	unsigned long dropped_seen;	/* by the drain */
+	int busy;			/* msg in use: printk() from NMI */
+	int wake;			/* kprintkd to be woken by the tick */
+	char msg[1024];
+	char buf[PRINTK_RING_SIZE];
+};
+
+static DEFINE_PER_CPU(struct printk_ring *, printk_ring);
+static struct task_struct *printkd_task;
+
+/* messages dropped since boot for want of room in a per-cpu ring */
+unsigned long printk_dropped;
+
+static inline int printk_may_defer(struct printk_ring *r, const char *fmt)
+{
+	if (!r || r->busy || !printkd_task || oops_in_progress)
+		return 0;
+	if (system_state != SYSTEM_RUNNING)
+		return 0;
+	/* KERN_EMERG, KERN_ALERT and KERN_CRIT go out at once */
+	if (fmt[0] == '<' && fmt[1] >= '0' && fmt[1] <= '2' && fmt[2] == '>')
+		return 0;
+	return 1;
+}
+
+/* Append r->msg, @len bytes with the NUL, to this cpu's ring */
+static void printk_ring_put(struct printk_ring *r, unsigned long long ts,
+			    int len)
+{
+	unsigned long head = r->head, tail = r->tail;
+	unsigned long off, pad = 0, need = PRINTK_REC_SIZE(len);
+	struct printk_rec *rec;
+
+	/* the drain is done with everything before tail */
+	smp_mb();
+	off = head & (PRINTK_RING_SIZE - 1);
+	if (off + need > PRINTK_RING_SIZE)
+		pad = PRINTK_RING_SIZE - off;
+	if (head + pad + need - tail > PRINTK_RING_SIZE) {
+		r->dropped++;
+		return;
+	}
+	if (pad) {
+		rec = (struct printk_rec *)(r->buf + off);
+		if (pad >= sizeof(*rec))
+			rec->len = 0;
+		off = 0;
+	}
+	rec = (struct printk_rec *)(r->buf + off);
+	rec->ts = ts;
+	rec->len = len;
+	memcpy(rec + 1, r->msg, len);
+	smp_wmb();
+	r->head = head + pad + need;
+}
+
+/* The oldest message in a ring, or NULL */
+static struct printk_rec *printk_ring_peek(struct printk_ring *r)
+{
+	unsigned long head = r->head, off;
+	struct printk_rec *rec;
+
+	smp_rmb();
+	while (r->tail != head) {
+		off = r->tail & (PRINTK_RING_SIZE - 1);
+		rec = (struct printk_rec *)(r->buf + off);
+		if (PRINTK_RING_SIZE - off >= sizeof(*rec) && rec->len)
+			return rec;
+		/* padding up to the end of the ring */
+		smp_mb();
+		r->tail += PRINTK_RING_SIZE - off;
+	}
+	return NULL;
+}
+
+static void printk_ring_advance(struct printk_ring *r, struct printk_rec *rec)
+{
+	unsigned long size = PRINTK_REC_SIZE(rec->len);
+
+	/* done reading the message before the cpu may reuse the space */
+	smp_mb();
+	r->tail += size;
+}
+
+/*
+ * Move up to @max messages from the rings into log_buf, oldest first by
+ * the time they were printed, noting any that were dropped.  Returns
+ * the number moved.  printk_drain_lock must be held.
+ */
+static int printk_drain(int max)
+{
+	struct printk_ring *r, *oldest;
+	struct printk_rec *rec, *orec;
+	unsigned long flags, dropped;
+	char tbuf[64];
+	int cpu, n;
+
+	for (n = 0; n < max; n++) {
+		oldest = NULL;
+		orec = NULL;
+		for_each_possible_cpu(cpu) {
+			r = per_cpu(printk_ring, cpu);
+			if (!r)
+				continue;
+			dropped = r->dropped;
+			if (dropped != r->dropped_seen) {
+				scnprintf(tbuf, sizeof(tbuf), KERN_WARNING
+					  "printk: %lu messages dropped on "
+					  "cpu %d\n", dropped - r->dropped_seen,
+					  cpu);
+				printk_dropped += dropped - r->dropped_seen;
+				r->dropped_seen = dropped;
+				spin_lock_irqsave(&logbuf_lock, flags);
+				emit_log_text(tbuf, printk_clock());
+				spin_unlock_irqrestore(&logbuf_lock, flags);
+			}
+			rec = printk_ring_peek(r);
+			if (rec && (!orec || rec->ts < orec->ts)) {
+				oldest = r;
+				orec = rec;
+			}
+		}
+		if (!oldest)
+			break;
+		spin_lock_irqsave(&logbuf_lock, flags);
+		emit_log_text((char *)(orec + 1), orec->ts);
+		spin_unlock_irqrestore(&logbuf_lock, flags);
+		printk_ring_advance(oldest, orec);
+	}
+	return n;
+}
+
+static int printk_rings_pending(void)
+{
+	struct printk_ring *r;
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		r = per_cpu(printk_ring, cpu);
+		if (r && (r->head != r->tail || r->dropped != r->dropped_seen))
+			return 1;
+	}
+	return 0;
+}
+
+static int printkd(void *unused)
+{
+	/* printk() has to keep working across suspend */
+	current->flags |= PF_NOFREEZE;
+
+	while (!kthread_should_stop()) {
+		set_current_state(TASK_INTERRUPTIBLE);
+		if (!printk_rings_pending()) {
+			schedule();
+			continue;
+		}
+		__set_current_state(TASK_RUNNING);
+
+		spin_lock(&printk_drain_lock);
+		printk_drain(64);
+		spin_unlock(&printk_drain_lock);
+
+		/*
+		 * As in vprintk(): if someone else holds console_sem, it
+		 * prints what we just logged before releasing it.
+		 */
+		if (!try_acquire_console_sem())
+			release_console_sem();
+		cond_resched();
+	}
+	return 0;
+}
+
+static int __init printkd_init(void)
+{
+	struct task_struct *task;
+	struct printk_ring *r;
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		r = kzalloc(sizeof(*r), GFP_KERNEL);
+		if (!r)
+			break;
+		per_cpu(printk_ring, cpu) = r;
+	}
+
+	task = kthread_run(printkd, NULL, "kprintkd");
+	if (IS_ERR(task))
+		return PTR_ERR(task);
+	printkd_task = task;
+	return 0;
+}
+module_init(printkd_init);
+
+/* Called from update_process_times() */
+void printk_tick(void)
+{
+	struct printk_ring *r = __get_cpu_var(printk_ring);
+
+	if (r && r->wake) {
+		r->wake = 0;
+		wake_up_process(printkd_task);
+	}
+}
+
+int printk_needs_cpu(int cpu)
+{
+	struct printk_ring *r = per_cpu(printk_ring, cpu);
+
+	return r && r->wake;
+}
+
 /**
  * printk - print a kernel message
  * @fmt: format string
@@ -480,6 +796,9 @@ static int have_callable_console(void)
  * notice the new output in release_console_sem() and will send it to the
  * consoles before releasing the semaphore.
  *
+ * Once kprintkd is running, most messages are instead left in a per-cpu
+ * ring for it to log and print; see above.
+ *
  * One effect of this deferred printing is that code which calls printk() and
  * then changes console_loglevel may break. This is because console_loglevel
  * is inspected when the actual printing occurs.
@@ -507,9 +826,8 @@ asmlinkage int vprintk(const char *fmt, va_list args)
 {
 	unsigned long flags;
 	int printed_len;
-	char *p;
+	struct printk_ring *r;
 	static char printk_buf[1024];
-	static int log_level_unknown = 1;
 
 	preempt_disable();
 	if (unlikely(oops_in_progress) && printk_cpu == smp_processor_id())
@@ -517,71 +835,36 @@ asmlinkage int vprintk(const char *fmt, va_list args)
 		 * make sure we can't deadlock */
 		zap_locks();
 
-	/* This stops the holder of console_sem just where we want him */
 	local_irq_save(flags);
 	lockdep_off();
+
+	r = __get_cpu_var(printk_ring);
+	if (printk_may_defer(r, fmt)) {
+		r->busy = 1;
+		printed_len = vscnprintf(r->msg, sizeof(r->msg), fmt, args);
+		printk_ring_put(r, printk_clock(), printed_len + 1);
+		r->busy = 0;
+		r->wake = 1;
+
+		lockdep_on();
+		local_irq_restore(flags);
+		preempt_enable();
+		return printed_len;
+	}
+
+	/* Whatever was deferred before this message goes out first */
+	if (spin_trylock(&printk_drain_lock)) {
+		printk_drain(INT_MAX);
+		spin_unlock(&printk_drain_lock);
+	}
+
+	/* This stops the holder of console_sem just where we want him */
 	spin_lock(&logbuf_lock);
 	printk_cpu = smp_processor_id();
 
 	/* Emit the output into the temporary buffer */
 	printed_len = vscnprintf(printk_buf, sizeof(printk_buf), fmt, args);
-
-	/*
-	 * Copy the output into log_buf.  If the caller didn't provide
-	 * appropriate log level tags, we insert them here
-	 */
-	for (p = printk_buf; *p; p++) {
-		if (log_level_unknown) {
-                        /* log_level_unknown signals the start of a new line */
-			if (printk_time) {
-				int loglev_char;
-				char tbuf[50], *tp;
-				unsigned tlen;
-				unsigned long long t;
-				unsigned long nanosec_rem;
-
-				/*
-				 * force the log level token to be
-				 * before the time output.
-				 */
-				if (p[0] == '<' && p[1] >='0' &&
-				   p[1] <= '7' && p[2] == '>') {
-					loglev_char = p[1];
-					p += 3;
-					printed_len -= 3;
-				} else {
-					loglev_char = default_message_loglevel
-						+ '0';
-				}
-				t = printk_clock();
-				nanosec_rem = do_div(t, 1000000000);
-				tlen = sprintf(tbuf,
-						"<%c>[%5lu.%06lu] ",
-						loglev_char,
-						(unsigned long)t,
-						nanosec_rem/1000);
-
-				for (tp = tbuf; tp < tbuf + tlen; tp++)
-					emit_log_char(*tp);
-				printed_len += tlen;
-			} else {
-				if (p[0] != '<' || p[1] < '0' ||
-				   p[1] > '7' || p[2] != '>') {
-					emit_log_char('<');
-					emit_log_char(default_message_loglevel
-						+ '0');
-					emit_log_char('>');
-					printed_len += 3;
-				}
-			}
-			log_level_unknown = 0;
-			if (!*p)
-				break;
-		}
-		emit_log_char(*p);
-		if (*p == '\n')
-			log_level_unknown = 1;
-	}
+	printed_len += emit_log_text(printk_buf, printk_clock());
 
 	if (!down_trylock(&console_sem)) {
 		/*
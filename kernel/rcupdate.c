@@ -48,21 +48,25 @@
 #include <linux/rcupdate.h>
 #include <linux/cpu.h>
 #include <linux/mutex.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
 
 /* Definition for rcupdate control block. */
 static struct rcu_ctrlblk rcu_ctrlblk = {
 	.cur = -300,
 	.completed = -300,
 	.lock = __SPIN_LOCK_UNLOCKED(&rcu_ctrlblk.lock),
-	.cpumask = CPU_MASK_NONE,
 };
 static struct rcu_ctrlblk rcu_bh_ctrlblk = {
 	.cur = -300,
 	.completed = -300,
 	.lock = __SPIN_LOCK_UNLOCKED(&rcu_bh_ctrlblk.lock),
-	.cpumask = CPU_MASK_NONE,
 };
 
+/* The leaves of the rcu_node tree: leaf i covers cpus i*RCU_FANOUT on */
+#define RCU_FIRST_LEAF	(RCU_NUM_NODES - RCU_LEAVES)
+#define rcu_leaf(rcp, i)	(&(rcp)->node[RCU_FIRST_LEAF + (i)])
+
 DEFINE_PER_CPU(struct rcu_data, rcu_data) = { 0L };
 DEFINE_PER_CPU(struct rcu_data, rcu_bh_data) = { 0L };
 
@@ -83,19 +87,27 @@ static struct completion rcu_barrier_completion;
 static void force_quiescent_state(struct rcu_data *rdp,
 			struct rcu_ctrlblk *rcp)
 {
-	int cpu;
-	cpumask_t cpumask;
+	unsigned long mask;
+	int i, bit, cpu;
+
 	set_need_resched();
 	if (unlikely(rdp->qlen - rdp->last_rs_qlen > rsinterval)) {
 		rdp->last_rs_qlen = rdp->qlen;
+		rdp->n_force_qs++;
 		/*
-		 * Don't send IPI to itself. With irqs disabled,
+		 * Kick the cpus the leaves are still waiting for; the masks
+		 * are read without their locks, as a stale bit only costs
+		 * an IPI.  Don't send IPI to itself. With irqs disabled,
 		 * rdp->cpu is the current cpu.
 		 */
-		cpumask = rcp->cpumask;
-		cpu_clear(rdp->cpu, cpumask);
-		for_each_cpu_mask(cpu, cpumask)
-			smp_send_reschedule(cpu);
+		for (i = 0; i < RCU_LEAVES; i++) {
+			mask = rcu_leaf(rcp, i)->qsmask;
+			for (bit = 0; mask; bit++, mask >>= 1) {
+				cpu = i * RCU_FANOUT + bit;
+				if ((mask & 1) && cpu != rdp->cpu)
+					smp_send_reschedule(cpu);
+			}
+		}
 	}
 }
 #else
@@ -129,6 +141,7 @@ void fastcall call_rcu(struct rcu_head *head,
 	rdp = &__get_cpu_var(rcu_data);
 	*rdp->nxttail = head;
 	rdp->nxttail = &head->next;
+	rdp->n_cbs_queued++;
 	if (unlikely(++rdp->qlen > qhimark)) {
 		rdp->blimit = INT_MAX;
 		force_quiescent_state(rdp, &rcu_ctrlblk);
@@ -164,6 +177,7 @@ void fastcall call_rcu_bh(struct rcu_head *head,
 	rdp = &__get_cpu_var(rcu_bh_data);
 	*rdp->nxttail = head;
 	rdp->nxttail = &head->next;
+	rdp->n_cbs_queued++;
 
 	if (unlikely(++rdp->qlen > qhimark)) {
 		rdp->blimit = INT_MAX;
@@ -248,6 +262,7 @@ static void rcu_do_batch(struct rcu_data *rdp)
 	local_irq_disable();
 	rdp->qlen -= count;
 	local_irq_enable();
+	rdp->n_cbs_invoked += count;
 	if (rdp->blimit == INT_MAX && rdp->qlen <= qlowmark)
 		rdp->blimit = blimit;
 
@@ -263,62 +278,354 @@ static void rcu_do_batch(struct rcu_data *rdp)
  * - A new grace period is started.
  *   This is done by rcu_start_batch. The start is not broadcasted to
  *   all cpus, they must pick this up by comparing rcp->cur with
- *   rdp->quiescbatch. All cpus are recorded  in the
- *   rcu_ctrlblk.cpumask bitmap.
+ *   rdp->quiescbatch. The cpus that must pass through a quiescent state
+ *   are recorded in the qsmask of the leaf rcu_node each belongs to,
+ *   and every leaf and inner node in the qsmask of the node above.
  * - All cpus must go through a quiescent state.
  *   Since the start of the grace period is not broadcasted, at least two
  *   calls to rcu_check_quiescent_state are required:
  *   The first call just notices that a new grace period is running. The
  *   following calls check if there was a quiescent state since the beginning
- *   of the grace period. If so, it updates rcu_ctrlblk.cpumask. If
- *   the bitmap is empty, then the grace period is completed.
- *   rcu_check_quiescent_state calls rcu_start_batch(0) to start the next grace
- *   period (if necessary).
+ *   of the grace period. If so, cpu_quiet clears the cpu from its leaf, and
+ *   the last cpu of a node to do so clears the node from its parent. The
+ *   one that empties the root completes the grace period, and calls
+ *   rcu_start_batch to start the next one (if necessary).
  */
+#ifdef CONFIG_PREEMPT_RCU
+/* Are there readers preempted before rnp's batch began, still inside? */
+static inline int rcu_preempted_readers(struct rcu_node *rnp)
+{
+	return !list_empty(&rnp->blocked_tasks[rnp->gpnum & 1]);
+}
+#else
+static inline int rcu_preempted_readers(struct rcu_node *rnp)
+{
+	return 0;
+}
+#endif
+
+/*
+ * Clear mask from rnp for batch gp, and if that leaves rnp with neither
+ * cpus nor preempted readers to wait for, clear rnp from its parent and
+ * so on up.  A mask of 0 just checks whether rnp is done.  Returns 1 if
+ * this emptied the root, -EAGAIN if rnp is not set up for gp yet, and
+ * 0 otherwise.
+ */
+static int rcu_node_quiet(struct rcu_node *rnp, unsigned long mask, long gp)
+{
+	struct rcu_node *parent;
+	unsigned long flags;
+
+	for (;;) {
+		spin_lock_irqsave(&rnp->lock, flags);
+		if (rnp->gpnum != gp) {
+			spin_unlock_irqrestore(&rnp->lock, flags);
+			return rcu_batch_before(rnp->gpnum, gp) ? -EAGAIN : 0;
+		}
+		if (mask && !(rnp->qsmask & mask)) {
+			/* already reported, or not waited for */
+			spin_unlock_irqrestore(&rnp->lock, flags);
+			return 0;
+		}
+		rnp->qsmask &= ~mask;
+		if (rnp->qsmask || rcu_preempted_readers(rnp)) {
+			spin_unlock_irqrestore(&rnp->lock, flags);
+			return 0;
+		}
+		mask = rnp->grpmask;
+		parent = rnp->parent;
+		spin_unlock_irqrestore(&rnp->lock, flags);
+		if (!parent)
+			return 1;
+		rnp = parent;
+	}
+}
+
 /*
  * Register a new batch of callbacks, and start it up if there is currently no
  * active batch and the batch to be registered has not already occurred.
- * Caller must hold rcu_ctrlblk.lock.
+ * Caller must hold rcu_ctrlblk.lock, with irqs disabled.
  */
 static void rcu_start_batch(struct rcu_ctrlblk *rcp)
 {
-	if (rcp->next_pending &&
-			rcp->completed == rcp->cur) {
-		rcp->next_pending = 0;
-		/*
-		 * next_pending == 0 must be visible in
-		 * __rcu_process_callbacks() before it can see new value of cur.
-		 */
-		smp_wmb();
-		rcp->cur++;
+	struct rcu_node *rnp;
+	int i, bit, cpu;
 
-		/*
-		 * Accessing nohz_cpu_mask before incrementing rcp->cur needs a
-		 * Barrier  Otherwise it can cause tickless idle CPUs to be
-		 * included in rcp->cpumask, which will extend graceperiods
-		 * unnecessarily.
-		 */
-		smp_mb();
-		cpus_andnot(rcp->cpumask, cpu_online_map, nohz_cpu_mask);
+	if (!rcp->next_pending || rcp->completed != rcp->cur)
+		return;
+
+	rcp->next_pending = 0;
+	/*
+	 * next_pending == 0 must be visible in
+	 * __rcu_process_callbacks() before it can see new value of cur.
+	 */
+	smp_wmb();
+	rcp->cur++;
+#ifdef CONFIG_RCU_BOOST
+	rcp->boost_time = jiffies + msecs_to_jiffies(CONFIG_RCU_BOOST_DELAY);
+#endif
 
+	/*
+	 * Accessing nohz_cpu_mask before incrementing rcp->cur needs a
+	 * Barrier  Otherwise it can cause tickless idle CPUs to be
+	 * included in the leaves, which will extend graceperiods
+	 * unnecessarily.
+	 */
+	smp_mb();
+
+	for (i = RCU_LEAVES - 1; i >= 0; i--) {
+		rnp = rcu_leaf(rcp, i);
+		rnp->qsmasknext = 0;
+		for (bit = 0; bit < RCU_FANOUT; bit++) {
+			cpu = i * RCU_FANOUT + bit;
+			if (cpu >= NR_CPUS)
+				break;
+			if (cpu_online(cpu) && !cpu_isset(cpu, nohz_cpu_mask))
+				rnp->qsmasknext |= 1UL << bit;
+		}
+	}
+
+	/*
+	 * Install the masks top down, so that a node is set up for the new
+	 * batch before any node below it can report to it.  A cpu that sees
+	 * the new rcp->cur before its leaf is set up tries again later.
+	 * Inner nodes wait for all their children, so the leaves that turn
+	 * out to have nothing to wait for, no cpus and no readers preempted
+	 * before now, then report themselves.
+	 */
+	for (i = 0; i < RCU_NUM_NODES; i++) {
+		unsigned long flags;
+
+		rnp = &rcp->node[i];
+		spin_lock_irqsave(&rnp->lock, flags);
+		rnp->qsmask = rnp->qsmasknext;
+		rnp->gpnum = rcp->cur;
+		spin_unlock_irqrestore(&rnp->lock, flags);
 	}
+	for (i = 0; i < RCU_LEAVES; i++)
+		if (rcu_node_quiet(rcu_leaf(rcp, i), 0, rcp->cur) == 1)
+			/* no cpu to wait for */
+			rcp->completed = rcp->cur;
 }
 
 /*
- * cpu went through a quiescent state since the beginning of the grace period.
- * Clear it from the cpu mask and complete the grace period if it was the last
- * cpu. Start another grace period if someone has further entries pending
+ * The root has emptied for batch gp: it is completed.  Start another
+ * grace period if someone has further entries pending.
  */
-static void cpu_quiet(int cpu, struct rcu_ctrlblk *rcp)
+static void rcu_batch_done(struct rcu_ctrlblk *rcp, long gp)
 {
-	cpu_clear(cpu, rcp->cpumask);
-	if (cpus_empty(rcp->cpumask)) {
-		/* batch completed ! */
-		rcp->completed = rcp->cur;
+	unsigned long flags;
+
+	spin_lock_irqsave(&rcp->lock, flags);
+	if (likely(rcp->cur == gp && rcp->completed != gp)) {
+		rcp->completed = gp;
 		rcu_start_batch(rcp);
 	}
+	spin_unlock_irqrestore(&rcp->lock, flags);
+}
+
+/*
+ * The cpus of mask in leaf rnp went through a quiescent state since the
+ * beginning of grace period gp.  Clear them from the leaf, and if it was
+ * the last, clear the leaf from its parent and so on up; whoever empties
+ * the root completes the grace period.  Returns -EAGAIN if the leaf is
+ * not set up for gp yet.
+ */
+static int cpu_quiet(struct rcu_node *rnp, unsigned long mask, long gp,
+		     struct rcu_ctrlblk *rcp)
+{
+	int ret;
+
+	ret = rcu_node_quiet(rnp, mask, gp);
+	if (ret == 1)
+		/* batch completed ! */
+		rcu_batch_done(rcp, gp);
+	return ret < 0 ? ret : 0;
+}
+
+#ifdef CONFIG_PREEMPT_RCU
+
+/*
+ * Preemptible read-side critical sections: rcu_read_lock() only counts
+ * the nesting in the task.  A task preempted inside is queued on the
+ * leaf of its cpu before the cpu reports a quiescent state, on the list
+ * of the leaf's current batch if the cpu has yet to report for it, and
+ * on the list of the next batch if not.  A leaf does not report to its
+ * parent while its current list is not empty, and the last reader to
+ * leave it reports instead.
+ */
+void __rcu_read_lock(void)
+{
+	current->rcu_read_lock_nesting++;
+	barrier();
+}
+EXPORT_SYMBOL(__rcu_read_lock);
+
+#ifdef CONFIG_RCU_BOOST
+static void rcu_unboost_reader(struct task_struct *t)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&t->pi_lock, flags);
+	if (t->rcu_boosted) {
+		t->rcu_boosted = 0;
+		rt_mutex_setprio(t, rt_mutex_getprio(t));
+	}
+	spin_unlock_irqrestore(&t->pi_lock, flags);
+}
+#else
+static inline void rcu_unboost_reader(struct task_struct *t)
+{
+}
+#endif
+
+/* The outermost rcu_read_unlock() of a task that was preempted inside */
+static void rcu_read_unlock_special(struct task_struct *t)
+{
+	struct rcu_node *rnp;
+	unsigned long flags;
+	long gp;
+
+	/* an interrupt's rcu_read_unlock() may have got here first */
+	local_irq_save(flags);
+	if (!(t->rcu_read_unlock_special & RCU_READ_UNLOCK_BLOCKED)) {
+		local_irq_restore(flags);
+		return;
+	}
+	rnp = t->rcu_blocked_node;
+	spin_lock(&rnp->lock);
+	list_del_init(&t->rcu_node_entry);
+	t->rcu_blocked_node = NULL;
+	t->rcu_read_unlock_special = 0;
+	gp = rnp->gpnum;
+	spin_unlock(&rnp->lock);
+
+	if (rcu_node_quiet(rnp, 0, gp) == 1)
+		rcu_batch_done(&rcu_ctrlblk, gp);
+	local_irq_restore(flags);
+
+	rcu_unboost_reader(t);
+}
+
+void __rcu_read_unlock(void)
+{
+	struct task_struct *t = current;
+
+	barrier();
+	if (--t->rcu_read_lock_nesting == 0 &&
+	    unlikely(t->rcu_read_unlock_special))
+		rcu_read_unlock_special(t);
+}
+EXPORT_SYMBOL(__rcu_read_unlock);
+
+/*
+ * Called by schedule() before the context switch that is a quiescent
+ * state for @cpu: queue @t if it is inside a read-side critical section.
+ */
+void rcu_preempt_note_context_switch(struct task_struct *t, int cpu)
+{
+	struct rcu_data *rdp;
+	struct rcu_node *rnp;
+	unsigned long flags;
+	int idx;
+
+	if (!t->rcu_read_lock_nesting ||
+	    (t->rcu_read_unlock_special & RCU_READ_UNLOCK_BLOCKED))
+		return;
+
+	rdp = &per_cpu(rcu_data, cpu);
+	rnp = rdp->mynode;
+	spin_lock_irqsave(&rnp->lock, flags);
+	idx = rnp->gpnum & 1;
+	if (!(rnp->qsmask & rdp->grpmask))
+		idx = !idx;
+	list_add(&t->rcu_node_entry, &rnp->blocked_tasks[idx]);
+	t->rcu_blocked_node = rnp;
+	t->rcu_read_unlock_special |= RCU_READ_UNLOCK_BLOCKED;
+	spin_unlock_irqrestore(&rnp->lock, flags);
+}
+
+#endif /* CONFIG_PREEMPT_RCU */
+
+#ifdef CONFIG_RCU_BOOST
+
+/* readers boosted per leaf and per RCU_BOOST_DELAY */
+#define RCU_BOOST_BATCH	16
+
+static int rcu_boost_pending(struct rcu_ctrlblk *rcp)
+{
+	return rcp->cur != rcp->completed &&
+		time_after(jiffies, rcp->boost_time);
+}
+
+/*
+ * The grace period has been held up for longer than RCU_BOOST_DELAY:
+ * raise the readers it waits for to realtime priority, so that they
+ * get to leave their critical sections.  The tasks are picked under
+ * the leaf lock, but boosted under their pi_lock alone, so that the
+ * leaf lock is never taken outside a runqueue lock.
+ */
+static void rcu_boost_readers(struct rcu_ctrlblk *rcp)
+{
+	struct task_struct *tasks[RCU_BOOST_BATCH];
+	struct task_struct *t;
+	struct rcu_node *rnp;
+	unsigned long flags;
+	int i, n, prio;
+
+	spin_lock_irqsave(&rcp->lock, flags);
+	if (!rcu_boost_pending(rcp)) {
+		spin_unlock_irqrestore(&rcp->lock, flags);
+		return;
+	}
+	rcp->boost_time = jiffies + msecs_to_jiffies(CONFIG_RCU_BOOST_DELAY);
+	spin_unlock_irqrestore(&rcp->lock, flags);
+
+	prio = MAX_RT_PRIO - 1 - CONFIG_RCU_BOOST_PRIO;
+	for (i = 0; i < RCU_LEAVES; i++) {
+		rnp = rcu_leaf(rcp, i);
+		n = 0;
+		spin_lock_irqsave(&rnp->lock, flags);
+		list_for_each_entry(t, &rnp->blocked_tasks[rnp->gpnum & 1],
+				    rcu_node_entry) {
+			if (t->rcu_boosted || t->prio <= prio)
+				continue;
+			get_task_struct(t);
+			tasks[n++] = t;
+			if (n == RCU_BOOST_BATCH)
+				break;
+		}
+		spin_unlock_irqrestore(&rnp->lock, flags);
+
+		while (n--) {
+			t = tasks[n];
+			spin_lock_irqsave(&t->pi_lock, flags);
+			/* not if it has left since, and unboosted itself */
+			if ((t->rcu_read_unlock_special &
+			     RCU_READ_UNLOCK_BLOCKED) &&
+			    !t->rcu_boosted && t->prio > prio) {
+				t->rcu_boosted = 1;
+				rt_mutex_setprio(t, prio);
+			}
+			spin_unlock_irqrestore(&t->pi_lock, flags);
+			put_task_struct(t);
+		}
+	}
 }
 
+#else /* !CONFIG_RCU_BOOST */
+
+static inline int rcu_boost_pending(struct rcu_ctrlblk *rcp)
+{
+	return 0;
+}
+
+static inline void rcu_boost_readers(struct rcu_ctrlblk *rcp)
+{
+}
+
+#endif /* CONFIG_RCU_BOOST */
+
 /*
  * Check if the cpu has gone through a quiescent state (say context
  * switch). If so and if it already hasn't done so in this RCU
@@ -336,7 +643,7 @@ static void rcu_check_quiescent_state(struct rcu_ctrlblk *rcp,
 	}
 
 	/* Grace period already completed for this cpu?
-	 * qs_pending is checked instead of the actual bitmap to avoid
+	 * qs_pending is checked instead of the leaf's mask to avoid
 	 * cacheline trashing.
 	 */
 	if (!rdp->qs_pending)
@@ -348,17 +655,15 @@ static void rcu_check_quiescent_state(struct rcu_ctrlblk *rcp,
 	 */
 	if (!rdp->passed_quiesc)
 		return;
-	rdp->qs_pending = 0;
 
-	spin_lock(&rcp->lock);
 	/*
-	 * rdp->quiescbatch/rcp->cur and the cpu bitmap can come out of sync
-	 * during cpu startup. Ignore the quiescent state.
+	 * A cpu that comes online during a grace period is not in its
+	 * leaf's mask, and its report is ignored.
 	 */
-	if (likely(rdp->quiescbatch == rcp->cur))
-		cpu_quiet(rdp->cpu, rcp);
-
-	spin_unlock(&rcp->lock);
+	if (cpu_quiet(rdp->mynode, rdp->grpmask, rdp->quiescbatch, rcp))
+		return;
+	rdp->qs_pending = 0;
+	rdp->n_qs_reported++;
 }
 
 
@@ -381,14 +686,19 @@ static void rcu_move_batch(struct rcu_data *this_rdp, struct rcu_head *list,
 static void __rcu_offline_cpu(struct rcu_data *this_rdp,
 				struct rcu_ctrlblk *rcp, struct rcu_data *rdp)
 {
+	long gp;
+
 	/* if the cpu going offline owns the grace period
 	 * we can block indefinitely waiting for it, so flush
 	 * it here
 	 */
-	spin_lock_bh(&rcp->lock);
-	if (rcp->cur != rcp->completed)
-		cpu_quiet(rdp->cpu, rcp);
-	spin_unlock_bh(&rcp->lock);
+	local_bh_disable();
+	gp = rcp->cur;
+	smp_rmb();
+	if (gp != rcp->completed)
+		while (cpu_quiet(rdp->mynode, rdp->grpmask, gp, rcp))
+			cpu_relax();
+	local_bh_enable();
 	rcu_move_batch(this_rdp, rdp->curlist, rdp->curtail);
 	rcu_move_batch(this_rdp, rdp->nxtlist, rdp->nxttail);
 	rcu_move_batch(this_rdp, rdp->donelist, rdp->donetail);
@@ -443,17 +753,20 @@ static void __rcu_process_callbacks(struct rcu_ctrlblk *rcp,
 
 		/* determine batch number */
 		rdp->batch = rcp->cur + 1;
+		rdp->n_batches++;
 		/* see the comment and corresponding wmb() in
 		 * the rcu_start_batch()
 		 */
 		smp_rmb();
 
 		if (!rcp->next_pending) {
+			unsigned long flags;
+
 			/* and start it/schedule start if it's a new batch */
-			spin_lock(&rcp->lock);
+			spin_lock_irqsave(&rcp->lock, flags);
 			rcp->next_pending = 1;
 			rcu_start_batch(rcp);
-			spin_unlock(&rcp->lock);
+			spin_unlock_irqrestore(&rcp->lock, flags);
 		}
 	}
 
@@ -464,6 +777,7 @@ static void __rcu_process_callbacks(struct rcu_ctrlblk *rcp,
 
 static void rcu_process_callbacks(unsigned long unused)
 {
+	rcu_boost_readers(&rcu_ctrlblk);
 	__rcu_process_callbacks(&rcu_ctrlblk, &__get_cpu_var(rcu_data));
 	__rcu_process_callbacks(&rcu_bh_ctrlblk, &__get_cpu_var(rcu_bh_data));
 }
@@ -500,7 +814,8 @@ static int __rcu_pending(struct rcu_ctrlblk *rcp, struct rcu_data *rdp)
 int rcu_pending(int cpu)
 {
 	return __rcu_pending(&rcu_ctrlblk, &per_cpu(rcu_data, cpu)) ||
-		__rcu_pending(&rcu_bh_ctrlblk, &per_cpu(rcu_bh_data, cpu));
+		__rcu_pending(&rcu_bh_ctrlblk, &per_cpu(rcu_bh_data, cpu)) ||
+		rcu_boost_pending(&rcu_ctrlblk);
 }
 
 /*
@@ -532,7 +847,21 @@ void rcu_check_callbacks(int cpu, int user)
 static void rcu_init_percpu_data(int cpu, struct rcu_ctrlblk *rcp,
 						struct rcu_data *rdp)
 {
+	unsigned long n_cbs_queued = rdp->n_cbs_queued;
+	unsigned long n_cbs_invoked = rdp->n_cbs_invoked;
+	unsigned long n_batches = rdp->n_batches;
+	unsigned long n_qs_reported = rdp->n_qs_reported;
+	unsigned long n_force_qs = rdp->n_force_qs;
+
+	/* the statistics carry over a cpu going offline and back */
 	memset(rdp, 0, sizeof(*rdp));
+	rdp->n_cbs_queued = n_cbs_queued;
+	rdp->n_cbs_invoked = n_cbs_invoked;
+	rdp->n_batches = n_batches;
+	rdp->n_qs_reported = n_qs_reported;
+	rdp->n_force_qs = n_force_qs;
+	rdp->mynode = rcu_leaf(rcp, cpu / RCU_FANOUT);
+	rdp->grpmask = 1UL << (cpu % RCU_FANOUT);
 	rdp->curtail = &rdp->curlist;
 	rdp->nxttail = &rdp->nxtlist;
 	rdp->donetail = &rdp->donelist;
@@ -573,6 +902,48 @@ static struct notifier_block __cpuinitdata rcu_nb = {
 	.notifier_call	= rcu_cpu_notify,
 };
 
+/*
+ * Link up the rcu_node tree: node i of a level hangs off node
+ * i / RCU_FANOUT of the level above, as bit i % RCU_FANOUT.  Inner
+ * nodes wait for all their children in every batch.
+ */
+static void __init rcu_init_tree(struct rcu_ctrlblk *rcp)
+{
+	struct rcu_node *rnp;
+	int i, first;
+
+	for (i = 0; i < RCU_NUM_NODES; i++) {
+		rnp = &rcp->node[i];
+		spin_lock_init(&rnp->lock);
+		rnp->gpnum = rcp->cur;
+		rnp->qsmask = 0;
+		rnp->qsmasknext = 0;
+		rnp->parent = NULL;
+		rnp->grpmask = 0;
+#ifdef CONFIG_PREEMPT_RCU
+		INIT_LIST_HEAD(&rnp->blocked_tasks[0]);
+		INIT_LIST_HEAD(&rnp->blocked_tasks[1]);
+#endif
+	}
+	if (RCU_LEVELS == 1)
+		return;
+
+	/* the leaves hang off the middle level, or the root if none */
+	first = RCU_LEVELS == 3 ? 1 : 0;
+	for (i = 0; i < RCU_LEAVES; i++) {
+		rnp = rcu_leaf(rcp, i);
+		rnp->parent = &rcp->node[first + i / RCU_FANOUT];
+		rnp->grpmask = 1UL << (i % RCU_FANOUT);
+		rnp->parent->qsmasknext |= rnp->grpmask;
+	}
+	for (i = 0; i < RCU_MIDS; i++) {
+		rnp = &rcp->node[1 + i];
+		rnp->parent = &rcp->node[0];
+		rnp->grpmask = 1UL << i;
+		rnp->parent->qsmasknext |= rnp->grpmask;
+	}
+}
+
 /*
  * Initializes rcu mechanism.  Assumed to be called early.
  * That is before local timer(SMP) or jiffie timer (uniproc) is setup.
@@ -581,6 +952,8 @@ static struct notifier_block __cpuinitdata rcu_nb = {
  */
 void __init rcu_init(void)
 {
+	rcu_init_tree(&rcu_ctrlblk);
+	rcu_init_tree(&rcu_bh_ctrlblk);
 	rcu_cpu_notify(&rcu_nb, CPU_UP_PREPARE,
 			(void *)(long)smp_processor_id());
 	/* Register notifier for non-boot CPUs */
@@ -625,6 +998,88 @@ void synchronize_rcu(void)
 	wait_for_completion(&rcu.completion);
 }
 
+#ifdef CONFIG_RCU_TRACE
+
+static void rcudata_show_one(struct seq_file *m, const char *name,
+			     struct rcu_data *rdp)
+{
+	seq_printf(m, "  %s qlen=%ld queued=%lu invoked=%lu batches=%lu "
+		   "qs=%lu force=%lu pending=%d\n", name, rdp->qlen,
+		   rdp->n_cbs_queued, rdp->n_cbs_invoked, rdp->n_batches,
+		   rdp->n_qs_reported, rdp->n_force_qs, rdp->qs_pending);
+}
+
+static int rcudata_show(struct seq_file *m, void *v)
+{
+	int cpu;
+
+	for_each_online_cpu(cpu) {
+		seq_printf(m, "cpu%d:\n", cpu);
+		rcudata_show_one(m, "rcu   ", &per_cpu(rcu_data, cpu));
+		rcudata_show_one(m, "rcu_bh", &per_cpu(rcu_bh_data, cpu));
+	}
+	return 0;
+}
+
+static void rcugp_show_one(struct seq_file *m, const char *name,
+			   struct rcu_ctrlblk *rcp)
+{
+	int i;
+
+	seq_printf(m, "%s: cur=%ld completed=%ld", name, rcp->cur,
+		   rcp->completed);
+	for (i = 0; i < RCU_NUM_NODES; i++)
+		seq_printf(m, "%s%lx", i ? " " : " qsmask=",
+			   rcp->node[i].qsmask);
+	seq_putc(m, '\n');
+}
+
+static int rcugp_show(struct seq_file *m, void *v)
+{
+	rcugp_show_one(m, "rcu", &rcu_ctrlblk);
+	rcugp_show_one(m, "rcu_bh", &rcu_bh_ctrlblk);
+	return 0;
+}
+
+static int rcudata_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, rcudata_show, NULL);
+}
+
+static int rcugp_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, rcugp_show, NULL);
+}
+
+static struct file_operations rcudata_fops = {
+	.open		= rcudata_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+static struct file_operations rcugp_fops = {
+	.open		= rcugp_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+static int __init rcu_trace_init(void)
+{
+	struct dentry *dir;
+
+	dir = debugfs_create_dir("rcu", NULL);
+	if (!dir)
+		return -ENOMEM;
+	debugfs_create_file("rcudata", 0444, dir, NULL, &rcudata_fops);
+	debugfs_create_file("rcugp", 0444, dir, NULL, &rcugp_fops);
+	return 0;
+}
+late_initcall(rcu_trace_init);
+
+#endif /* CONFIG_RCU_TRACE */
+
 module_param(blimit, int, 0);
 module_param(qhimark, int, 0);
 module_param(qlowmark, int, 0);
@@ -52,10 +52,18 @@
 #include <linux/acct.h>
 #include <linux/kprobes.h>
 #include <linux/delayacct.h>
+#include <linux/sched_trace.h>
+#include <linux/perf_counter.h>
+#include <linux/trace_events.h>
 #include <asm/tlb.h>
 
 #include <asm/unistd.h>
 
+#include "workqueue_sched.h"
+
+DEFINE_TRACE(sched_switch);
+DEFINE_TRACE(sched_wakeup);
+
 /*
  * Convert user-nice values [ -20 ... 0 ... 19 ]
  * to static priority [ MAX_RT_PRIO..MAX_PRIO-1 ],
@@ -157,8 +165,7 @@
 	(JIFFIES_TO_NS(MAX_SLEEP_AVG * \
 		(MAX_BONUS / 2 + DELTA((p)) + 1) / MAX_BONUS - 1))
 
-#define TASK_PREEMPTS_CURR(p, rq) \
-	((p)->prio < (rq)->curr->prio)
+#define TASK_PREEMPTS_CURR(p, rq)	task_preempts_curr(p, rq)
 
 /*
  * task_timeslice() scales user-nice values [ -20 ... 0 ... 19 ]
@@ -195,6 +202,52 @@ struct prio_array {
 	struct list_head queue[MAX_PRIO];
 };
 
+/*
+ * The tree of runnable fair tasks, sorted by vruntime:
+ */
+struct cfs_rq {
+	struct load_weight load;
+	unsigned long nr_running;
+
+	u64 exec_clock;
+	u64 min_vruntime;
+
+	struct rb_root tasks_timeline;
+	struct rb_node *rb_leftmost;
+
+	/* the running entity, which is not kept in the tree */
+	struct sched_entity *curr;
+
+	struct rq *rq;			/* cpu runqueue this queue belongs to */
+	struct task_group *tg;		/* group whose tasks are queued here */
+	struct sched_entity *my_se;	/* the group's entity in its parent */
+	struct list_head list;		/* on rq->cfs_rq_list */
+
+	/* hard cpu quota of the group, see account_cfs_rq_runtime() */
+	u64 runtime_used;
+	u64 period_end;
+	int throttled;
+	struct list_head throttled_list;	/* on rq->cfs_throttled */
+};
+
+#define RUNTIME_INF	(~0UL)
+
+/*
+ * A task group: the tasks of a cpuset, scheduled as one entity per cpu
+ * within the group's parent. The root group's queues are the cpus'
+ * rq->cfs, it has no entities.
+ */
+struct task_group {
+	struct sched_entity **se;
+	struct cfs_rq **cfs_rq;
+	struct task_group *parent;
+
+	unsigned long shares;
+	/* runtime allowed on each cpu per period, both in nsecs */
+	unsigned long quota;
+	unsigned long period;
+};
+
 /*
  * This is the main, per-CPU runqueue data structure.
  *
@@ -232,8 +285,15 @@ struct rq {
 	int best_expired_prio;
 	atomic_t nr_iowait;
 
+	/* fair scheduling policy, see kernel/sched_fair.c */
+	struct cfs_rq cfs;
+	u64 clock;
+	struct list_head cfs_rq_list;	/* all group queues of this cpu */
+	struct list_head cfs_throttled;	/* queues over their quota */
+
 #ifdef CONFIG_SMP
 	struct sched_domain *sd;
+	int cpu;		/* cpu of this runqueue */
 
 	/* For active balancing */
 	int active_balance;
@@ -657,11 +717,27 @@ sched_info_switch(struct task_struct *prev, struct task_struct *next)
 #define sched_info_switch(t, next)	do { } while (0)
 #endif /* CONFIG_SCHEDSTATS || CONFIG_TASK_DELAY_ACCT */
 
+#include "sched_fair.c"
+#include "sched_debug.c"
+#include "sched_trace.c"
+
+static inline int task_preempts_curr(struct task_struct *p, struct rq *rq)
+{
+	if (task_fair(p) && task_fair(rq->curr))
+		return wakeup_preempt_fair(rq, p);
+	return p->prio < rq->curr->prio;
+}
+
 /*
- * Adding/removing a task to/from a priority array:
+ * Adding/removing a task to/from a priority array. Fair tasks go into
+ * the runqueue's tree instead, ->array only marks them as queued:
  */
 static void dequeue_task(struct task_struct *p, struct prio_array *array)
 {
+	if (task_fair(p)) {
+		dequeue_task_fair(p);
+		return;
+	}
 	array->nr_active--;
 	list_del(&p->run_list);
 	if (list_empty(array->queue + p->prio))
@@ -671,6 +747,11 @@ static void dequeue_task(struct task_struct *p, struct prio_array *array)
 static void enqueue_task(struct task_struct *p, struct prio_array *array)
 {
 	sched_info_queued(p);
+	if (task_fair(p)) {
+		enqueue_task_fair(task_rq(p), p);
+		p->array = task_rq(p)->active;
+		return;
+	}
 	list_add_tail(&p->run_list, array->queue + p->prio);
 	__set_bit(p->prio, array->bitmap);
 	array->nr_active++;
@@ -762,6 +843,7 @@ static void set_load_weight(struct task_struct *p)
 			p->load_weight = RTPRIO_TO_LOAD_WEIGHT(p->rt_priority);
 	} else
 		p->load_weight = PRIO_TO_LOAD_WEIGHT(p->static_prio);
+	set_fair_load_weight(p);
 }
 
 static inline void
@@ -938,7 +1020,9 @@ static void activate_task(struct task_struct *p, struct rq *rq, int local)
 	}
 #endif
 
-	if (!rt_task(p))
+	if (task_fair(p))
+		place_task_fair(rq, p, 0);
+	else if (!rt_task(p))
 		p->prio = recalc_task_prio(p, now);
 
 	/*
@@ -1495,6 +1579,8 @@ out_activate:
 
 
 	activate_task(p, rq, cpu == this_cpu);
+	if (p->flags & PF_WQ_WORKER)
+		wq_worker_waking_up(p, cpu);
 	/*
 	 * Sync wakeups (i.e. those types of wakeups where the waker
 	 * has indicated that it will leave the CPU in short order)
@@ -1510,6 +1596,7 @@ out_activate:
 	success = 1;
 
 out_running:
+	trace_sched_wakeup(p, success);
 	p->state = TASK_RUNNING;
 out:
 	task_rq_unlock(rq, &flags);
@@ -1517,6 +1604,23 @@ out:
 	return success;
 }
 
+/*
+ * Wake up @p, asleep on @rq, which the caller has locked and which is
+ * this cpu's: schedule() uses it to hand a workqueue pool over to
+ * another of its workers without dropping the lock.
+ */
+static void try_to_wake_up_local(struct task_struct *p, struct rq *rq)
+{
+	if (task_rq(p) != rq || !(p->state & TASK_INTERRUPTIBLE))
+		return;
+
+	if (!p->array) {
+		activate_task(p, rq, 1);
+		wq_worker_waking_up(p, task_cpu(p));
+	}
+	p->state = TASK_RUNNING;
+}
+
 int fastcall wake_up_process(struct task_struct *p)
 {
 	return try_to_wake_up(p, TASK_STOPPED | TASK_TRACED |
@@ -1557,6 +1661,7 @@ void fastcall sched_fork(struct task_struct *p, int clone_flags)
 
 	INIT_LIST_HEAD(&p->run_list);
 	p->array = NULL;
+	sched_fork_fair(p);
 #if defined(CONFIG_SCHEDSTATS) || defined(CONFIG_TASK_DELAY_ACCT)
 	if (unlikely(sched_info_on()))
 		memset(&p->sched_info, 0, sizeof(p->sched_info));
@@ -1623,6 +1728,9 @@ void fastcall wake_up_new_task(struct task_struct *p, unsigned long clone_flags)
 		CHILD_PENALTY / 100 * MAX_SLEEP_AVG / MAX_BONUS);
 
 	p->prio = effective_prio(p);
+	if (task_fair(p))
+		task_new_fair(rq, p, cpu == this_cpu &&
+			      !(clone_flags & CLONE_VM));
 
 	if (likely(cpu == this_cpu)) {
 		if (!(clone_flags & CLONE_VM)) {
@@ -1631,7 +1739,7 @@ void fastcall wake_up_new_task(struct task_struct *p, unsigned long clone_flags)
 			 * do child-runs-first in anticipation of an exec. This
 			 * usually avoids a lot of COW overhead.
 			 */
-			if (unlikely(!current->array))
+			if (unlikely(!current->array) || task_fair(p))
 				__activate_task(p, rq);
 			else {
 				p->prio = current->prio;
@@ -1722,6 +1830,8 @@ void fastcall sched_exit(struct task_struct *p)
  */
 static inline void prepare_task_switch(struct rq *rq, struct task_struct *next)
 {
+	perf_swcounter_event(PERF_COUNT_CONTEXT_SWITCHES, 1, NULL);
+	perf_counter_task_sched_out(current, smp_processor_id());
 	prepare_lock_switch(rq, next);
 	prepare_arch_switch(next);
 }
@@ -1762,6 +1872,7 @@ static inline void finish_task_switch(struct rq *rq, struct task_struct *prev)
 	 */
 	prev_task_flags = prev->flags;
 	finish_arch_switch(prev);
+	perf_counter_task_sched_in(current, smp_processor_id());
 	finish_lock_switch(rq, prev);
 	if (mm)
 		mmdrop(mm);
@@ -1804,6 +1915,8 @@ context_switch(struct rq *rq, struct task_struct *prev,
 	struct mm_struct *mm = next->mm;
 	struct mm_struct *oldmm = prev->active_mm;
 
+	trace_sched_switch(prev, next);
+
 	if (unlikely(!mm)) {
 		next->active_mm = oldmm;
 		atomic_inc(&oldmm->mm_count);
@@ -2019,6 +2132,38 @@ void sched_exec(void)
 		sched_migrate_task(current, new_cpu);
 }
 
+#ifdef CONFIG_NUMA_BALANCING
+/*
+ * sched_move_to_node - move current to the least loaded cpu of node @nid
+ * it may run on, where most of the memory it faults on lives.  Nothing
+ * happens unless that cpu would be no busier than the one it is on.
+ */
+void sched_move_to_node(int nid)
+{
+	int this_cpu = get_cpu();
+	unsigned long load, min_load = ULONG_MAX;
+	int cpu, new_cpu = -1;
+	cpumask_t mask;
+
+	cpus_and(mask, node_to_cpumask(nid), current->cpus_allowed);
+	for_each_cpu_mask(cpu, mask) {
+		if (!cpu_online(cpu))
+			continue;
+		load = target_load(cpu, 0);
+		if (load < min_load) {
+			min_load = load;
+			new_cpu = cpu;
+		}
+	}
+	if (new_cpu >= 0 &&
+	    min_load + current->load_weight > source_load(this_cpu, 0))
+		new_cpu = -1;
+	put_cpu();
+	if (new_cpu >= 0 && new_cpu != this_cpu)
+		sched_migrate_task(current, new_cpu);
+}
+#endif
+
 /*
  * pull_task - move a task from a remote runqueue to the local runqueue.
  * Both runqueues must be locked.
@@ -2079,6 +2224,54 @@ int can_migrate_task(struct task_struct *p, struct rq *rq, int this_cpu,
 
 #define rq_best_prio(rq) min((rq)->curr->prio, (rq)->best_expired_prio)
 
+/*
+ * move_fair_tasks pulls fair tasks off busiest's group queues, starting
+ * with the ones which will run last in each. Tasks of throttled groups
+ * stay where they are. Returns the number of tasks moved.
+ */
+static unsigned long
+move_fair_tasks(struct rq *this_rq, int this_cpu, struct rq *busiest,
+		unsigned long max_nr_move, long *rem_load_move,
+		struct sched_domain *sd, enum idle_type idle, int *all_pinned)
+{
+	struct rb_node *node, *prev;
+	struct cfs_rq *cfs_rq;
+	unsigned long pulled = 0;
+
+	list_for_each_entry(cfs_rq, &busiest->cfs_rq_list, list) {
+		if (cfs_rq->throttled)
+			continue;
+
+		node = rb_last(&cfs_rq->tasks_timeline);
+		for (; node; node = prev) {
+			struct sched_entity *se;
+			struct task_struct *p;
+
+			prev = rb_prev(node);
+			se = rb_entry(node, struct sched_entity, run_node);
+			if (!entity_is_task(se))
+				continue;
+			p = task_of(se);
+
+			if (p->load_weight > *rem_load_move ||
+			    !can_migrate_task(p, busiest, this_cpu, sd, idle,
+					      all_pinned))
+				continue;
+
+#ifdef CONFIG_SCHEDSTATS
+			if (task_hot(p, busiest->timestamp_last_tick, sd))
+				schedstat_inc(sd, lb_hot_gained[idle]);
+#endif
+			pull_task(busiest, NULL, p, this_rq, NULL, this_cpu);
+			pulled++;
+			*rem_load_move -= p->load_weight;
+			if (pulled >= max_nr_move || *rem_load_move <= 0)
+				return pulled;
+		}
+	}
+	return pulled;
+}
+
 /*
  * move_tasks tries to move up to max_nr_move tasks and max_load_move weighted
  * load from busiest to this_rq, as part of a balancing operation within
@@ -2142,7 +2335,7 @@ skip_bitmap:
 			dst_array = this_rq->active;
 			goto new_array;
 		}
-		goto out;
+		goto fair;
 	}
 
 	head = array->queue + idx;
@@ -2191,11 +2384,16 @@ skip_queue:
 		idx++;
 		goto skip_bitmap;
 	}
+fair:
+	if (pulled < max_nr_move && rem_load_move > 0)
+		pulled += move_fair_tasks(this_rq, this_cpu, busiest,
+					  max_nr_move - pulled, &rem_load_move,
+					  sd, idle, &pinned);
 out:
 	/*
-	 * Right now, this is the only place pull_task() is called,
-	 * so we can safely collect pull_task() stats here rather than
-	 * inside pull_task().
+	 * Right now, this (and move_fair_tasks() called from here) is the
+	 * only place pull_task() is called, so we can safely collect
+	 * pull_task() stats here rather than inside pull_task().
 	 */
 	schedstat_add(sd, lb_gained[idle], pulled);
 
@@ -2507,10 +2705,12 @@ static inline unsigned long minus_1_or_zero(unsigned long n)
 static int load_balance(int this_cpu, struct rq *this_rq,
 			struct sched_domain *sd, enum idle_type idle)
 {
-	int nr_moved, all_pinned = 0, active_balance = 0, sd_idle = 0;
+	int nr_moved = 0, all_pinned = 0, active_balance = 0, sd_idle = 0;
 	struct sched_group *group;
 	unsigned long imbalance;
-	struct rq *busiest;
+	struct rq *busiest = NULL;
+	int result;
+	u64 start = 0;
 
 	if (idle != NOT_IDLE && sd->flags & SD_SHARE_CPUPOWER &&
 	    !sched_smt_power_savings)
@@ -2521,12 +2721,14 @@ static int load_balance(int this_cpu, struct rq *this_rq,
 	group = find_busiest_group(sd, this_cpu, &imbalance, idle, &sd_idle);
 	if (!group) {
 		schedstat_inc(sd, lb_nobusyg[idle]);
+		result = SCHED_TRACE_NO_BUSY_GROUP;
 		goto out_balanced;
 	}
 
 	busiest = find_busiest_queue(group, idle, imbalance);
 	if (!busiest) {
 		schedstat_inc(sd, lb_nobusyq[idle]);
+		result = SCHED_TRACE_NO_BUSY_QUEUE;
 		goto out_balanced;
 	}
 
@@ -2542,6 +2744,7 @@ static int load_balance(int this_cpu, struct rq *this_rq,
 		 * still unbalanced. nr_moved simply stays zero, so it is
 		 * correctly treated as an imbalance.
 		 */
+		start = sched_trace_clock();
 		double_rq_lock(this_rq, busiest);
 		nr_moved = move_tasks(this_rq, this_cpu, busiest,
 				      minus_1_or_zero(busiest->nr_running),
@@ -2549,8 +2752,10 @@ static int load_balance(int this_cpu, struct rq *this_rq,
 		double_rq_unlock(this_rq, busiest);
 
 		/* All tasks on this runqueue were pinned by CPU affinity */
-		if (unlikely(all_pinned))
+		if (unlikely(all_pinned)) {
+			result = SCHED_TRACE_ALL_PINNED;
 			goto out_balanced;
+		}
 	}
 
 	if (!nr_moved) {
@@ -2567,6 +2772,7 @@ static int load_balance(int this_cpu, struct rq *this_rq,
 			if (!cpu_isset(this_cpu, busiest->curr->cpus_allowed)) {
 				spin_unlock(&busiest->lock);
 				all_pinned = 1;
+				result = SCHED_TRACE_CURR_PINNED;
 				goto out_one_pinned;
 			}
 
@@ -2602,6 +2808,15 @@ static int load_balance(int this_cpu, struct rq *this_rq,
 			sd->balance_interval *= 2;
 	}
 
+	if (nr_moved)
+		result = SCHED_TRACE_MOVED;
+	else if (active_balance)
+		result = SCHED_TRACE_ACTIVE_KICK;
+	else
+		result = SCHED_TRACE_FAILED;
+	sched_trace_lb(sd, this_rq, busiest, SCHED_TRACE_LB, idle, result,
+		       imbalance, nr_moved, start);
+
 	if (!nr_moved && !sd_idle && sd->flags & SD_SHARE_CPUPOWER &&
 	    !sched_smt_power_savings)
 		return -1;
@@ -2618,6 +2833,9 @@ out_one_pinned:
 			(sd->balance_interval < sd->max_interval))
 		sd->balance_interval *= 2;
 
+	sched_trace_lb(sd, this_rq, busiest, SCHED_TRACE_LB, idle, result,
+		       imbalance, 0, start);
+
 	if (!sd_idle && sd->flags & SD_SHARE_CPUPOWER &&
 			!sched_smt_power_savings)
 		return -1;
@@ -2639,6 +2857,8 @@ load_balance_newidle(int this_cpu, struct rq *this_rq, struct sched_domain *sd)
 	unsigned long imbalance;
 	int nr_moved = 0;
 	int sd_idle = 0;
+	int result;
+	u64 start = 0;
 
 	if (sd->flags & SD_SHARE_CPUPOWER && !sched_smt_power_savings)
 		sd_idle = 1;
@@ -2647,12 +2867,14 @@ load_balance_newidle(int this_cpu, struct rq *this_rq, struct sched_domain *sd)
 	group = find_busiest_group(sd, this_cpu, &imbalance, NEWLY_IDLE, &sd_idle);
 	if (!group) {
 		schedstat_inc(sd, lb_nobusyg[NEWLY_IDLE]);
+		result = SCHED_TRACE_NO_BUSY_GROUP;
 		goto out_balanced;
 	}
 
 	busiest = find_busiest_queue(group, NEWLY_IDLE, imbalance);
 	if (!busiest) {
 		schedstat_inc(sd, lb_nobusyq[NEWLY_IDLE]);
+		result = SCHED_TRACE_NO_BUSY_QUEUE;
 		goto out_balanced;
 	}
 
@@ -2663,6 +2885,7 @@ load_balance_newidle(int this_cpu, struct rq *this_rq, struct sched_domain *sd)
 	nr_moved = 0;
 	if (busiest->nr_running > 1) {
 		/* Attempt to move tasks */
+		start = sched_trace_clock();
 		double_lock_balance(this_rq, busiest);
 		nr_moved = move_tasks(this_rq, this_cpu, busiest,
 					minus_1_or_zero(busiest->nr_running),
@@ -2672,15 +2895,24 @@ load_balance_newidle(int this_cpu, struct rq *this_rq, struct sched_domain *sd)
 
 	if (!nr_moved) {
 		schedstat_inc(sd, lb_failed[NEWLY_IDLE]);
+		sched_trace_lb(sd, this_rq, busiest, SCHED_TRACE_LB_NEWIDLE,
+			       NEWLY_IDLE, SCHED_TRACE_FAILED, imbalance, 0,
+			       start);
 		if (!sd_idle && sd->flags & SD_SHARE_CPUPOWER)
 			return -1;
-	} else
+	} else {
 		sd->nr_balance_failed = 0;
+		sched_trace_lb(sd, this_rq, busiest, SCHED_TRACE_LB_NEWIDLE,
+			       NEWLY_IDLE, SCHED_TRACE_MOVED, imbalance,
+			       nr_moved, start);
+	}
 
 	return nr_moved;
 
 out_balanced:
 	schedstat_inc(sd, lb_balanced[NEWLY_IDLE]);
+	sched_trace_lb(sd, this_rq, busiest, SCHED_TRACE_LB_NEWIDLE,
+		       NEWLY_IDLE, result, imbalance, 0, 0);
 	if (!sd_idle && sd->flags & SD_SHARE_CPUPOWER &&
 					!sched_smt_power_savings)
 		return -1;
@@ -2744,14 +2976,23 @@ static void active_load_balance(struct rq *busiest_rq, int busiest_cpu)
 	}
 
 	if (likely(sd)) {
+		u64 start = sched_trace_clock();
+		int nr_moved;
+
 		schedstat_inc(sd, alb_cnt);
 
-		if (move_tasks(target_rq, target_cpu, busiest_rq, 1,
-			       RTPRIO_TO_LOAD_WEIGHT(100), sd, SCHED_IDLE,
-			       NULL))
+		nr_moved = move_tasks(target_rq, target_cpu, busiest_rq, 1,
+				      RTPRIO_TO_LOAD_WEIGHT(100), sd,
+				      SCHED_IDLE, NULL);
+		if (nr_moved)
 			schedstat_inc(sd, alb_pushed);
 		else
 			schedstat_inc(sd, alb_failed);
+
+		sched_trace_lb(sd, target_rq, busiest_rq, SCHED_TRACE_LB_ACTIVE,
+			       SCHED_IDLE, nr_moved ? SCHED_TRACE_MOVED :
+			       SCHED_TRACE_FAILED, RTPRIO_TO_LOAD_WEIGHT(100),
+			       nr_moved, start);
 	}
 	spin_unlock(&target_rq->lock);
 }
@@ -2996,6 +3237,12 @@ void scheduler_tick(void)
 
 	rq->timestamp_last_tick = now;
 
+	if (unlikely(!list_empty(&rq->cfs_throttled))) {
+		spin_lock(&rq->lock);
+		unthrottle_expired_fair(rq);
+		spin_unlock(&rq->lock);
+	}
+
 	if (p == rq->idle) {
 		if (wake_priority_sleeper(rq))
 			goto out;
@@ -3003,6 +3250,12 @@ void scheduler_tick(void)
 		return;
 	}
 
+	if (task_fair(p)) {
+		spin_lock(&rq->lock);
+		task_tick_fair(rq, p);
+		goto out_unlock;
+	}
+
 	/* Task might have expired already, but not scheduled off yet */
 	if (p->array != rq->active) {
 		set_tsk_need_resched(p);
@@ -3278,12 +3531,21 @@ asmlinkage void __sched schedule(void)
 	}
 	profile_hit(SCHED_PROFILING, __builtin_return_address(0));
 
+	/*
+	 * A task going to sleep must not keep back the requests on its
+	 * plug, it may be about to wait for them.
+	 */
+	if (unlikely(current->plug) && current->state != TASK_RUNNING &&
+	    !(preempt_count() & PREEMPT_ACTIVE) && !in_atomic())
+		blk_flush_plug(current);
+
 need_resched:
 	preempt_disable();
 	prev = current;
 	release_kernel_lock(prev);
 need_resched_nonpreemptible:
 	rq = this_rq();
+	rcu_preempt_note_context_switch(prev, smp_processor_id());
 
 	/*
 	 * The idle thread is not allowed to schedule!
@@ -3324,8 +3586,22 @@ need_resched_nonpreemptible:
 			if (prev->state == TASK_UNINTERRUPTIBLE)
 				rq->nr_uninterruptible++;
 			deactivate_task(prev, rq);
+
+			/*
+			 * A workqueue worker that blocks may leave its
+			 * pool with works and no one running them.
+			 */
+			if (prev->flags & PF_WQ_WORKER) {
+				struct task_struct *to_wakeup;
+
+				to_wakeup = wq_worker_sleeping(prev,
+							task_cpu(prev));
+				if (to_wakeup)
+					try_to_wake_up_local(to_wakeup, rq);
+			}
 		}
 	}
+	put_prev_task_fair(rq);
 
 	cpu = smp_processor_id();
 	if (unlikely(!rq->nr_running)) {
@@ -3338,8 +3614,25 @@ need_resched_nonpreemptible:
 		}
 	}
 
+	/*
+	 * Fair tasks run whenever no real-time task is queued:
+	 */
+	if (rq->cfs.rb_leftmost &&
+	    sched_find_first_bit(rq->active->bitmap) >= MAX_RT_PRIO) {
+		next = pick_next_task_fair(rq);
+		goto picked;
+	}
+
 	array = rq->active;
 	if (unlikely(!array->nr_active)) {
+		/*
+		 * Only fair tasks of throttled groups are runnable: idle
+		 * until the tick gives them their next period.
+		 */
+		if (unlikely(!rq->expired->nr_active)) {
+			next = rq->idle;
+			goto switch_tasks;
+		}
 		/*
 		 * Switch the active and expired arrays.
 		 */
@@ -3372,9 +3665,12 @@ need_resched_nonpreemptible:
 			enqueue_task(next, array);
 		}
 	}
+picked:
 	next->sleep_type = SLEEP_NORMAL;
 	if (dependent_sleeper(cpu, rq, next))
 		next = rq->idle;
+	if (task_fair(next))
+		set_next_task_fair(rq, next);
 switch_tasks:
 	if (next == rq->idle)
 		schedstat_inc(rq, sched_goidle);
@@ -3837,6 +4133,8 @@ void rt_mutex_setprio(struct task_struct *p, int prio)
 	if (array)
 		dequeue_task(p, array);
 	p->prio = prio;
+	if (task_fair(p) && rt_prio(oldprio))
+		place_task_fair(rq, p, 0);
 
 	if (array) {
 		/*
@@ -4022,6 +4320,8 @@ static inline struct task_struct *find_process_by_pid(pid_t pid)
 /* Actually do priority change: must hold rq lock. */
 static void __setscheduler(struct task_struct *p, int policy, int prio)
 {
+	int was_fair = task_fair(p);
+
 	BUG_ON(p->array);
 
 	p->policy = policy;
@@ -4035,6 +4335,11 @@ static void __setscheduler(struct task_struct *p, int policy, int prio)
 	if (policy == SCHED_BATCH)
 		p->sleep_avg = 0;
 	set_load_weight(p);
+	/*
+	 * A task entering the fair policy is placed like a waking one:
+	 */
+	if (!was_fair && task_fair(p))
+		place_task_fair(task_rq(p), p, 0);
 }
 
 /**
@@ -4414,6 +4719,10 @@ asmlinkage long sys_sched_yield(void)
 	struct prio_array *array = current->array, *target = rq->expired;
 
 	schedstat_inc(rq, yld_cnt);
+	if (task_fair(current)) {
+		yield_task_fair(rq, current);
+		goto out;
+	}
 	/*
 	 * We implement yielding by moving the task into the expired
 	 * queue.
@@ -4439,7 +4748,7 @@ asmlinkage long sys_sched_yield(void)
 		 * requeue_task is cheaper so perform that if possible.
 		 */
 		requeue_task(current, array);
-
+out:
 	/*
 	 * Since we are going to call schedule() anyway, there's
 	 * no need to preempt or enable interrupts:
@@ -4812,6 +5121,24 @@ void __devinit init_idle(struct task_struct *idle, int cpu)
  */
 cpumask_t nohz_cpu_mask = CPU_MASK_NONE;
 
+#ifdef CONFIG_NO_IDLE_HZ
+/*
+ * An idle cpu without its tick no longer pulls tasks from busy cpus
+ * (see rebalance_tick()): it should only stop the tick as long as no
+ * runqueue has tasks waiting for a cpu.
+ */
+int sched_tick_needed(int cpu)
+{
+	int i;
+
+	for_each_online_cpu(i) {
+		if (i != cpu && cpu_rq(i)->nr_running > 1)
+			return 1;
+	}
+	return 0;
+}
+#endif
+
 #ifdef CONFIG_SMP
 /*
  * This is how migration works:
@@ -5134,6 +5461,7 @@ static void migrate_dead(unsigned int dead_cpu, struct task_struct *p)
 static void migrate_dead_tasks(unsigned int dead_cpu)
 {
 	struct rq *rq = cpu_rq(dead_cpu);
+	struct cfs_rq *cfs_rq, *next;
 	unsigned int arr, i;
 
 	for (arr = 0; arr < 2; arr++) {
@@ -5145,6 +5473,11 @@ static void migrate_dead_tasks(unsigned int dead_cpu)
 					     struct task_struct, run_list));
 		}
 	}
+	list_for_each_entry_safe(cfs_rq, next, &rq->cfs_throttled,
+				 throttled_list)
+		unthrottle_cfs_rq(cfs_rq);
+	while (rq->cfs.rb_leftmost)
+		migrate_dead(dead_cpu, pick_next_task_fair(rq));
 }
 #endif /* CONFIG_HOTPLUG_CPU */
 
@@ -6740,9 +7073,16 @@ void __init sched_init(void)
 		rq->active = rq->arrays;
 		rq->expired = rq->arrays + 1;
 		rq->best_expired_prio = MAX_PRIO;
+		init_cfs_rq(&rq->cfs, rq, &root_task_group, NULL);
+		root_task_group.cfs_rq[i] = &rq->cfs;
+		INIT_LIST_HEAD(&rq->cfs_rq_list);
+		list_add(&rq->cfs.list, &rq->cfs_rq_list);
+		INIT_LIST_HEAD(&rq->cfs_throttled);
+		rq->clock = 0;
 
 #ifdef CONFIG_SMP
 		rq->sd = NULL;
+		rq->cpu = i;
 		for (j = 1; j < 3; j++)
 			rq->cpu_load[j] = 0;
 		rq->active_balance = 0;
@@ -6882,3 +7222,237 @@ void set_curr_task(int cpu, struct task_struct *p)
 }
 
 #endif
+
+#ifdef CONFIG_FAIR_GROUP_SCHED
+
+/* the range of shares of a group, NICE_0_LOAD being the default */
+#define MIN_SHARES	2
+#define MAX_SHARES	(1UL << 18)
+
+static void free_sched_group(struct task_group *tg)
+{
+	int i;
+
+	for_each_possible_cpu(i) {
+		if (tg->cfs_rq)
+			kfree(tg->cfs_rq[i]);
+		if (tg->se)
+			kfree(tg->se[i]);
+	}
+	kfree(tg->cfs_rq);
+	kfree(tg->se);
+	kfree(tg);
+}
+
+/**
+ * sched_create_group - create a task group below @parent.
+ * @parent: the parent group, &root_task_group for a top level group.
+ *
+ * The new group has the default shares and no quota. Returns the group
+ * or an ERR_PTR().
+ */
+struct task_group *sched_create_group(struct task_group *parent)
+{
+	struct task_group *tg;
+	struct sched_entity *se;
+	struct cfs_rq *cfs_rq;
+	int i;
+
+	tg = kzalloc(sizeof(*tg), GFP_KERNEL);
+	if (!tg)
+		return ERR_PTR(-ENOMEM);
+	tg->cfs_rq = kzalloc(sizeof(cfs_rq) * NR_CPUS, GFP_KERNEL);
+	tg->se = kzalloc(sizeof(se) * NR_CPUS, GFP_KERNEL);
+	if (!tg->cfs_rq || !tg->se)
+		goto err;
+
+	tg->parent = parent;
+	tg->shares = NICE_0_LOAD;
+	tg->quota = RUNTIME_INF;
+	tg->period = DEF_SCHED_PERIOD;
+
+	for_each_possible_cpu(i) {
+		tg->cfs_rq[i] = kmalloc_node(sizeof(*cfs_rq), GFP_KERNEL,
+					     cpu_to_node(i));
+		tg->se[i] = kmalloc_node(sizeof(*se), GFP_KERNEL,
+					 cpu_to_node(i));
+		if (!tg->cfs_rq[i] || !tg->se[i])
+			goto err;
+	}
+
+	for_each_possible_cpu(i) {
+		struct rq *rq = cpu_rq(i);
+
+		cfs_rq = tg->cfs_rq[i];
+		se = tg->se[i];
+		memset(se, 0, sizeof(*se));
+		init_cfs_rq(cfs_rq, rq, tg, se);
+		se->my_q = cfs_rq;
+		se->load.weight = tg->shares;
+		RB_CLEAR_NODE(&se->run_node);
+
+		spin_lock_irq(&rq->lock);
+		se->cfs_rq = parent->cfs_rq[i];
+		se->vruntime = se->cfs_rq->min_vruntime;
+		list_add_tail(&cfs_rq->list, &rq->cfs_rq_list);
+		spin_unlock_irq(&rq->lock);
+	}
+	return tg;
+
+err:
+	free_sched_group(tg);
+	return ERR_PTR(-ENOMEM);
+}
+
+/**
+ * sched_destroy_group - free a task group.
+ * @tg: the group, which must neither have tasks nor child groups left.
+ */
+void sched_destroy_group(struct task_group *tg)
+{
+	int i;
+
+	for_each_possible_cpu(i) {
+		struct cfs_rq *cfs_rq = tg->cfs_rq[i];
+		struct rq *rq = cpu_rq(i);
+
+		spin_lock_irq(&rq->lock);
+		WARN_ON(cfs_rq->nr_running || tg->se[i]->on_rq);
+		list_del(&cfs_rq->list);
+		if (cfs_rq->throttled)
+			list_del(&cfs_rq->throttled_list);
+		spin_unlock_irq(&rq->lock);
+	}
+	free_sched_group(tg);
+}
+
+/**
+ * sched_move_task - move a task to another group.
+ * @tsk: the task, which may be running.
+ * @tg: the group it goes to.
+ */
+void sched_move_task(struct task_struct *tsk, struct task_group *tg)
+{
+	struct sched_entity *se = &tsk->se;
+	struct cfs_rq *cfs_rq;
+	int on_rq, running;
+	unsigned long flags;
+	struct rq *rq;
+
+	rq = task_rq_lock(tsk, &flags);
+
+	cfs_rq = tg->cfs_rq[task_cpu(tsk)];
+	if (se->cfs_rq == cfs_rq)
+		goto out;
+
+	update_rq_clock(rq);
+	running = se->cfs_rq && se->cfs_rq->curr == se;
+	on_rq = se->on_rq;
+	if (on_rq)
+		dequeue_task_fair(tsk);
+	if (running)
+		put_prev_task_fair(rq);
+
+	set_entity_cfs_rq(se, cfs_rq);
+
+	if (running)
+		set_next_task_fair(rq, tsk);
+	if (on_rq) {
+		enqueue_task_fair(rq, tsk);
+		resched_task(rq->curr);
+	}
+out:
+	task_rq_unlock(rq, &flags);
+}
+
+/**
+ * sched_group_fork - put a child that is being forked into a group.
+ * @child: the new task, not visible to the scheduler yet.
+ * @tg: the group.
+ */
+void sched_group_fork(struct task_struct *child, struct task_group *tg)
+{
+	/* not queued, whatever was copied from the parent */
+	child->se.on_rq = 0;
+	child->se.cfs_rq = tg->cfs_rq[task_cpu(child)];
+}
+
+/**
+ * sched_group_set_shares - set the cpu weight of a group.
+ * @tg: the group, not the root group.
+ * @shares: the weight, relative to NICE_0_LOAD for a nice 0 task.
+ */
+int sched_group_set_shares(struct task_group *tg, unsigned long shares)
+{
+	int i;
+
+	if (!tg->parent)
+		return -EINVAL;
+	if (shares < MIN_SHARES)
+		shares = MIN_SHARES;
+	else if (shares > MAX_SHARES)
+		shares = MAX_SHARES;
+
+	tg->shares = shares;
+	for_each_possible_cpu(i) {
+		struct sched_entity *se = tg->se[i];
+		struct rq *rq = cpu_rq(i);
+		unsigned long flags;
+		int on_rq;
+
+		spin_lock_irqsave(&rq->lock, flags);
+		update_rq_clock(rq);
+		/* the weight is accounted in the parent's queue */
+		on_rq = se->on_rq;
+		if (on_rq)
+			dequeue_entity(se->cfs_rq, se);
+		se->load.weight = shares;
+		se->load.inv_weight = 0;
+		if (on_rq)
+			enqueue_entity(se->cfs_rq, se);
+		spin_unlock_irqrestore(&rq->lock, flags);
+	}
+	return 0;
+}
+
+unsigned long sched_group_shares(struct task_group *tg)
+{
+	return tg->shares;
+}
+
+/**
+ * sched_group_set_bandwidth - limit the cpu time of a group.
+ * @tg: the group, not the root group.
+ * @quota_us: the runtime allowed on each cpu per period, -1 for no limit.
+ * @period_us: the period, from 1 msec to 1 sec.
+ *
+ * The new limit takes effect from the next period.
+ */
+int sched_group_set_bandwidth(struct task_group *tg, long quota_us,
+			      long period_us)
+{
+	if (!tg->parent)
+		return -EINVAL;
+	if (period_us < USEC_PER_MSEC || period_us > USEC_PER_SEC)
+		return -EINVAL;
+	if (quota_us != -1 && (quota_us < USEC_PER_MSEC || quota_us > period_us))
+		return -EINVAL;
+
+	tg->period = period_us * NSEC_PER_USEC;
+	tg->quota = quota_us == -1 ? RUNTIME_INF : quota_us * NSEC_PER_USEC;
+	return 0;
+}
+
+long sched_group_quota(struct task_group *tg)
+{
+	if (tg->quota == RUNTIME_INF)
+		return -1;
+	return tg->quota / NSEC_PER_USEC;
+}
+
+long sched_group_period(struct task_group *tg)
+{
+	return tg->period / NSEC_PER_USEC;
+}
+
+#endif /* CONFIG_FAIR_GROUP_SCHED */
@@ -0,0 +1,145 @@
+/*
+ * kernel/sched_debug.c
+ *
+ * Print the state of the runqueues into /proc/sched_debug: the O(1)
+ * priority arrays, the fair scheduling tree and the queued tasks, so
+ * that the behaviour of the two policies can be compared.
+ * Included from kernel/sched.c.
+ */
+#ifdef CONFIG_SCHED_DEBUG
+
+#include <linux/utsname.h>
+
+/*
+ * bump this up when changing the output format or the meaning of an existing
+ * format, so that tools can adapt (or abort)
+ */
+#define SCHED_DEBUG_VERSION 2
+
+#define P(x) \
+	seq_printf(m, "  .%-30s: %Ld\n", #x, (long long)(x))
+
+static void print_task(struct seq_file *m, struct rq *rq,
+		       struct task_struct *p)
+{
+	seq_printf(m, "%c%15s %5d %15Ld %9lu %5d %15Ld %15Ld %15Ld\n",
+		p == rq->curr ? 'R' : ' ', p->comm, p->pid,
+		task_fair(p) ? (long long)entity_key(p->se.cfs_rq, &p->se) : 0LL,
+		p->nvcsw + p->nivcsw, p->prio,
+		(long long)p->sched_time,
+		(long long)p->se.wait_sum, (long long)p->se.wait_max);
+}
+
+static void print_rq_tasks(struct seq_file *m, struct rq *rq, int cpu)
+{
+	struct task_struct *g, *p;
+
+	seq_printf(m, "\nrunnable tasks:\n"
+		   "            task   PID        tree-key  switches  prio"
+		   "    exec-runtime        wait-sum        wait-max\n"
+		   "-------------------------------------------------------"
+		   "------------------------------------------------\n");
+
+	read_lock_irq(&tasklist_lock);
+	do_each_thread(g, p) {
+		if (!p->array || task_cpu(p) != cpu)
+			continue;
+		print_task(m, rq, p);
+	} while_each_thread(g, p);
+	read_unlock_irq(&tasklist_lock);
+}
+
+static void print_cfs_rq(struct seq_file *m, struct cfs_rq *cfs_rq)
+{
+	struct sched_entity *first, *last;
+	u64 spread = 0;
+
+	first = __pick_next_entity(cfs_rq);
+	last = __pick_last_entity(cfs_rq);
+	if (first && last)
+		spread = last->vruntime - first->vruntime;
+
+	seq_printf(m, "\ncfs_rq %p (group %p)\n", cfs_rq, cfs_rq->tg);
+	P(cfs_rq->nr_running);
+	P(cfs_rq->load.weight);
+	P(cfs_rq->exec_clock);
+	P(cfs_rq->min_vruntime);
+	seq_printf(m, "  .%-30s: %Ld\n", "spread", (long long)spread);
+	if (!cfs_rq->my_se)
+		return;
+	P(cfs_rq->tg->shares);
+	P(cfs_rq->my_se->on_rq);
+	P(cfs_rq->my_se->vruntime);
+	P(cfs_rq->my_se->sum_exec_runtime);
+	if (cfs_rq->tg->quota == RUNTIME_INF)
+		return;
+	P(cfs_rq->tg->quota);
+	P(cfs_rq->tg->period);
+	P(cfs_rq->runtime_used);
+	P(cfs_rq->throttled);
+}
+
+static void print_cpu(struct seq_file *m, int cpu)
+{
+	struct rq *rq = cpu_rq(cpu);
+	struct cfs_rq *cfs_rq;
+	unsigned long flags;
+
+	seq_printf(m, "\ncpu#%d\n", cpu);
+
+	spin_lock_irqsave(&rq->lock, flags);
+	P(rq->nr_running);
+	P(rq->raw_weighted_load);
+	P(rq->nr_switches);
+	P(rq->nr_uninterruptible);
+	P(rq->clock);
+	P(rq->timestamp_last_tick);
+	P(rq->active->nr_active);
+	P(rq->expired->nr_active);
+	P(rq->expired_timestamp);
+	P(rq->best_expired_prio);
+#ifdef CONFIG_SMP
+	P(rq->cpu_load[0]);
+	P(rq->cpu_load[1]);
+	P(rq->cpu_load[2]);
+#endif
+	list_for_each_entry(cfs_rq, &rq->cfs_rq_list, list)
+		print_cfs_rq(m, cfs_rq);
+	spin_unlock_irqrestore(&rq->lock, flags);
+
+	print_rq_tasks(m, rq, cpu);
+}
+
+static int sched_debug_show(struct seq_file *m, void *v)
+{
+	int cpu;
+
+	seq_printf(m, "Sched Debug Version: v%d, %s\n",
+		   SCHED_DEBUG_VERSION, system_utsname.release);
+	seq_printf(m, "now at %Lu nsecs\n", (unsigned long long)sched_clock());
+	seq_printf(m, "policy: %s\n", sched_fair_enabled ? "fair" : "o1");
+	P(sched_latency);
+	P(sched_min_granularity);
+	P(sched_wakeup_granularity);
+	P(sched_child_runs_first);
+
+	for_each_online_cpu(cpu)
+		print_cpu(m, cpu);
+
+	seq_printf(m, "\n");
+	return 0;
+}
+
+static int sched_debug_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, sched_debug_show, NULL);
+}
+
+struct file_operations proc_sched_debug_operations = {
+	.open		= sched_debug_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+#endif /* CONFIG_SCHED_DEBUG */
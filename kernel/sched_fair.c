@@ -0,0 +1,887 @@
+/*
+ * Completely Fair Scheduling policy for SCHED_NORMAL and SCHED_BATCH
+ * tasks, used instead of the active/expired arrays when booted with
+ * "sched=fair". Included from kernel/sched.c.
+ *
+ * Every runnable task is kept in a per-runqueue rbtree, sorted by its
+ * virtual runtime: the nanoseconds it has spent on the cpu, scaled by
+ * the inverse of its nice-level weight. The leftmost task has received
+ * the least service and runs next. The running task is preempted once
+ * it has used up its share of the scheduling period, so every runnable
+ * task gets the cpu within sched_latency (or nr_running times
+ * sched_min_granularity on a loaded runqueue), without having to guess
+ * interactivity from sleep averages.
+ *
+ * Real-time tasks (and tasks boosted to an RT priority) are still kept
+ * in the priority arrays, and always run before the fair tasks.
+ */
+
+static int sched_fair_enabled __read_mostly;
+
+static int __init sched_select_setup(char *str)
+{
+	if (!strcmp(str, "fair"))
+		sched_fair_enabled = 1;
+	else if (!strcmp(str, "o1"))
+		sched_fair_enabled = 0;
+	else
+		printk(KERN_WARNING "sched: unknown policy \"%s\"\n", str);
+	return 1;
+}
+__setup("sched=", sched_select_setup);
+
+/*
+ * Targeted preemption latency for cpu-bound tasks, in nanoseconds:
+ * every runnable task runs at least once per period.
+ */
+static unsigned int sched_latency __read_mostly = 20000000;
+
+/*
+ * Minimal preemption granularity: when more tasks are runnable than
+ * fit into sched_latency with this granularity, the period is stretched
+ * instead of cutting the slices any shorter.
+ */
+static unsigned int sched_min_granularity __read_mostly = 4000000;
+
+/*
+ * A waking task needs to be this much (weighted) behind the running one
+ * to preempt it. Reduces over-scheduling of mixed workloads.
+ */
+static unsigned int sched_wakeup_granularity __read_mostly = 5000000;
+
+/*
+ * After fork the child runs before the parent, which usually saves the
+ * COW faults of the parent in anticipation of an exec.
+ */
+static unsigned int sched_child_runs_first __read_mostly = 1;
+
+/*
+ * The idle tasks sit at MAX_PRIO and never enter the fair tree.
+ */
+static inline int task_fair(const struct task_struct *p)
+{
+	return sched_fair_enabled && p->prio >= MAX_RT_PRIO &&
+		p->prio < MAX_PRIO;
+}
+
+/*
+ * Nice levels are multiplicative, with a gentle 10% change for every
+ * nice level changed. I.e. when a cpu-bound task goes from nice 0 to
+ * nice 1, it will get ~10% less cpu time than another cpu-bound task
+ * that remained on nice 0. The weight of two adjacent levels differs
+ * by a factor of ~1.25.
+ */
+#define NICE_0_LOAD		1024
+
+static const unsigned long prio_to_weight[40] = {
+	/* -20 */ 88761, 71755, 56483, 46273, 36291,
+	/* -15 */ 29154, 23254, 18705, 14949, 11916,
+	/* -10 */ 9548, 7620, 6100, 4904, 3906,
+	/*  -5 */ 3121, 2501, 1991, 1586, 1277,
+	/*   0 */ 1024, 820, 655, 526, 423,
+	/*   5 */ 335, 272, 215, 172, 137,
+	/*  10 */ 110, 87, 70, 56, 45,
+	/*  15 */ 36, 29, 23, 18, 15,
+};
+
+/*
+ * Inverse (2^32/x) values of the prio_to_weight[] array, precalculated
+ * so that the weighting of runtimes needs no division.
+ */
+static const unsigned long prio_to_wmult[40] = {
+	/* -20 */ 48388, 59856, 76040, 92818, 118348,
+	/* -15 */ 147320, 184698, 229616, 287308, 360437,
+	/* -10 */ 449829, 563644, 704093, 875809, 1099582,
+	/*  -5 */ 1376151, 1717300, 2157191, 2708050, 3363326,
+	/*   0 */ 4194304, 5237765, 6557202, 8165337, 10153587,
+	/*   5 */ 12820798, 15790321, 19976592, 24970740, 31350126,
+	/*  10 */ 39045157, 49367440, 61356676, 76695845, 95443718,
+	/*  15 */ 119304647, 148102321, 186737709, 238609294, 286331153,
+};
+
+static void set_fair_load_weight(struct task_struct *p)
+{
+	int idx = TASK_USER_PRIO(p);
+
+	p->se.load.weight = prio_to_weight[idx];
+	p->se.load.inv_weight = prio_to_wmult[idx];
+}
+
+#if BITS_PER_LONG == 32
+# define WMULT_CONST	(~0UL)
+#else
+# define WMULT_CONST	(1UL << 32)
+#endif
+
+#define WMULT_SHIFT	32
+
+/*
+ * Shift right and round:
+ */
+#define SRR(x, y) (((x) + (1UL << ((y) - 1))) >> (y))
+
+/*
+ * delta_exec * weight / lw->weight, using the cached inverse weight.
+ */
+static unsigned long
+calc_delta_mine(unsigned long delta_exec, unsigned long weight,
+		struct load_weight *lw)
+{
+	u64 tmp;
+
+	if (unlikely(!lw->inv_weight))
+		lw->inv_weight = (WMULT_CONST - lw->weight / 2) /
+					(lw->weight + 1);
+
+	tmp = (u64)delta_exec * weight;
+	/*
+	 * Check whether we'd overflow the 64-bit multiplication:
+	 */
+	if (unlikely(tmp > WMULT_CONST))
+		tmp = SRR(SRR(tmp, WMULT_SHIFT / 2) * lw->inv_weight,
+			  WMULT_SHIFT / 2);
+	else
+		tmp = SRR(tmp * lw->inv_weight, WMULT_SHIFT);
+
+	return (unsigned long)min(tmp, (u64)(unsigned long)LONG_MAX);
+}
+
+/*
+ * Convert real nanoseconds into the weighted (virtual) nanoseconds of
+ * an entity: a nice 0 task's vruntime advances at the speed of the
+ * wall clock, heavier tasks' slower and lighter tasks' faster.
+ */
+static inline unsigned long
+calc_delta_fair(unsigned long delta, struct sched_entity *se)
+{
+	if (likely(se->load.weight == NICE_0_LOAD))
+		return delta;
+	return calc_delta_mine(delta, NICE_0_LOAD, &se->load);
+}
+
+static inline void update_load_add(struct load_weight *lw, unsigned long inc)
+{
+	lw->weight += inc;
+	lw->inv_weight = 0;
+}
+
+static inline void update_load_sub(struct load_weight *lw, unsigned long dec)
+{
+	lw->weight -= dec;
+	lw->inv_weight = 0;
+}
+
+static inline struct rq *rq_of(struct cfs_rq *cfs_rq)
+{
+	return cfs_rq->rq;
+}
+
+static inline struct task_struct *task_of(struct sched_entity *se)
+{
+	return container_of(se, struct task_struct, se);
+}
+
+/*
+ * Group scheduling: the tasks of a group are queued on the group's
+ * cfs_rq of their cpu, which is represented in the queue of the parent
+ * group by the group's sched_entity, up to the cpu's rq->cfs.
+ */
+#define entity_is_task(se)	(!(se)->my_q)
+
+static inline struct cfs_rq *cfs_rq_of(struct sched_entity *se)
+{
+	return se->cfs_rq;
+}
+
+static inline struct sched_entity *parent_entity(struct sched_entity *se)
+{
+	return se->cfs_rq->my_se;
+}
+
+/* Walk up the hierarchy from an entity to the one queued on rq->cfs: */
+#define for_each_sched_entity(se) \
+		for (; se; se = parent_entity(se))
+
+#define DEF_SCHED_PERIOD	100000000UL	/* 100 msecs */
+
+static struct sched_entity *root_task_group_se[NR_CPUS];
+static struct cfs_rq *root_task_group_cfs_rq[NR_CPUS];
+
+struct task_group root_task_group = {
+	.se		= root_task_group_se,
+	.cfs_rq		= root_task_group_cfs_rq,
+	.shares		= NICE_0_LOAD,
+	.quota		= RUNTIME_INF,
+	.period		= DEF_SCHED_PERIOD,
+};
+
+/*
+ * rq->clock is the runqueue's own view of sched_clock(): compensated
+ * for drift when updated from another cpu, and never going backwards.
+ */
+static void update_rq_clock(struct rq *rq)
+{
+	u64 now = sched_clock();
+
+#ifdef CONFIG_SMP
+	if (rq != this_rq()) {
+		struct rq *this_rq = this_rq();
+
+		now = now - this_rq->timestamp_last_tick
+			+ rq->timestamp_last_tick;
+	}
+#endif
+	if ((s64)(now - rq->clock) > 0)
+		rq->clock = now;
+}
+
+/*
+ * vruntimes are compared relative to each other, so that they can
+ * wrap around.
+ */
+static inline u64 max_vruntime(u64 min_vruntime, u64 vruntime)
+{
+	if ((s64)(vruntime - min_vruntime) > 0)
+		min_vruntime = vruntime;
+	return min_vruntime;
+}
+
+static inline u64 min_vruntime(u64 min_vruntime, u64 vruntime)
+{
+	if ((s64)(vruntime - min_vruntime) < 0)
+		min_vruntime = vruntime;
+	return min_vruntime;
+}
+
+static inline s64 entity_key(struct cfs_rq *cfs_rq, struct sched_entity *se)
+{
+	return se->vruntime - cfs_rq->min_vruntime;
+}
+
+/*
+ * Enqueue an entity into the rb-tree. The running entity (cfs_rq->curr)
+ * is kept out of the tree.
+ */
+static void __enqueue_entity(struct cfs_rq *cfs_rq, struct sched_entity *se)
+{
+	struct rb_node **link = &cfs_rq->tasks_timeline.rb_node;
+	struct rb_node *parent = NULL;
+	struct sched_entity *entry;
+	s64 key = entity_key(cfs_rq, se);
+	int leftmost = 1;
+
+	while (*link) {
+		parent = *link;
+		entry = rb_entry(parent, struct sched_entity, run_node);
+		/*
+		 * We dont care about collisions. Nodes with
+		 * the same key stay together.
+		 */
+		if (key < entity_key(cfs_rq, entry)) {
+			link = &parent->rb_left;
+		} else {
+			link = &parent->rb_right;
+			leftmost = 0;
+		}
+	}
+
+	/*
+	 * Maintain a cache of leftmost tree entries (it is frequently
+	 * used):
+	 */
+	if (leftmost)
+		cfs_rq->rb_leftmost = &se->run_node;
+
+	rb_link_node(&se->run_node, parent, link);
+	rb_insert_color(&se->run_node, &cfs_rq->tasks_timeline);
+}
+
+static void __dequeue_entity(struct cfs_rq *cfs_rq, struct sched_entity *se)
+{
+	if (cfs_rq->rb_leftmost == &se->run_node)
+		cfs_rq->rb_leftmost = rb_next(&se->run_node);
+
+	rb_erase(&se->run_node, &cfs_rq->tasks_timeline);
+}
+
+static inline struct sched_entity *__pick_next_entity(struct cfs_rq *cfs_rq)
+{
+	struct rb_node *left = cfs_rq->rb_leftmost;
+
+	if (!left)
+		return NULL;
+	return rb_entry(left, struct sched_entity, run_node);
+}
+
+static inline struct sched_entity *__pick_last_entity(struct cfs_rq *cfs_rq)
+{
+	struct rb_node *last = rb_last(&cfs_rq->tasks_timeline);
+
+	if (!last)
+		return NULL;
+	return rb_entry(last, struct sched_entity, run_node);
+}
+
+/*
+ * The scheduling period: long enough for every runnable task to get
+ * a slice of at least sched_min_granularity.
+ */
+static u64 __sched_period(unsigned long nr_running)
+{
+	u64 period = sched_latency;
+	unsigned long nr_latency = sched_latency / sched_min_granularity;
+
+	if (unlikely(nr_running > nr_latency))
+		period = (u64)sched_min_granularity * nr_running;
+
+	return period;
+}
+
+/*
+ * The wall-time slice of the period an entity is entitled to, in
+ * proportion to its share of the runqueue's load. @add is non-zero
+ * when the entity is not queued yet.
+ */
+static u64 __sched_slice(struct cfs_rq *cfs_rq, struct sched_entity *se,
+			 int add)
+{
+	unsigned long nr_running = cfs_rq->nr_running + add;
+	unsigned long weight = cfs_rq->load.weight;
+	u64 slice = __sched_period(nr_running);
+
+	if (add)
+		weight += se->load.weight;
+	slice *= se->load.weight;
+	do_div(slice, weight);
+
+	return slice;
+}
+
+/*
+ * Hard quota: a group queue may run for tg->quota nsecs per tg->period.
+ * The period is restarted lazily, by the first update after it ended.
+ */
+static void account_cfs_rq_runtime(struct cfs_rq *cfs_rq, unsigned long delta)
+{
+	struct task_group *tg = cfs_rq->tg;
+	u64 now = rq_of(cfs_rq)->clock;
+
+	if (likely(tg->quota == RUNTIME_INF))
+		return;
+	if ((s64)(now - cfs_rq->period_end) >= 0) {
+		cfs_rq->period_end = now + tg->period;
+		cfs_rq->runtime_used = 0;
+	}
+	cfs_rq->runtime_used += delta;
+}
+
+static inline int cfs_rq_over_quota(struct cfs_rq *cfs_rq)
+{
+	struct task_group *tg = cfs_rq->tg;
+
+	if (likely(tg->quota == RUNTIME_INF))
+		return 0;
+	return cfs_rq->runtime_used >= tg->quota &&
+		(s64)(rq_of(cfs_rq)->clock - cfs_rq->period_end) < 0;
+}
+
+/*
+ * Charge the running entity for the time it ran since the last update
+ * and advance the runqueue's min_vruntime.
+ */
+static void update_curr(struct cfs_rq *cfs_rq)
+{
+	struct sched_entity *curr = cfs_rq->curr;
+	unsigned long delta_exec;
+	u64 vruntime;
+
+	if (unlikely(!curr))
+		return;
+
+	delta_exec = (unsigned long)(rq_of(cfs_rq)->clock - curr->exec_start);
+	curr->exec_start = rq_of(cfs_rq)->clock;
+	if (!delta_exec)
+		return;
+
+#ifdef CONFIG_SCHED_DEBUG
+	curr->exec_max = max((u64)delta_exec, curr->exec_max);
+#endif
+	curr->sum_exec_runtime += delta_exec;
+	cfs_rq->exec_clock += delta_exec;
+	curr->vruntime += calc_delta_fair(delta_exec, curr);
+	account_cfs_rq_runtime(cfs_rq, delta_exec);
+
+	/*
+	 * min_vruntime only ever moves forward: it tracks the smallest
+	 * vruntime of the running and the queued entities.
+	 */
+	vruntime = curr->vruntime;
+	if (cfs_rq->rb_leftmost)
+		vruntime = min_vruntime(vruntime,
+					__pick_next_entity(cfs_rq)->vruntime);
+	cfs_rq->min_vruntime = max_vruntime(cfs_rq->min_vruntime, vruntime);
+}
+
+static inline void
+update_stats_wait_start(struct cfs_rq *cfs_rq, struct sched_entity *se)
+{
+#ifdef CONFIG_SCHED_DEBUG
+	se->wait_start = rq_of(cfs_rq)->clock;
+#endif
+}
+
+static inline void
+update_stats_wait_end(struct cfs_rq *cfs_rq, struct sched_entity *se)
+{
+#ifdef CONFIG_SCHED_DEBUG
+	u64 wait = rq_of(cfs_rq)->clock - se->wait_start;
+
+	se->wait_max = max(se->wait_max, wait);
+	se->wait_sum += wait;
+#endif
+}
+
+/*
+ * Tasks keep their vruntime while they are off a runqueue. When they
+ * are queued on another cpu, rebase it onto that runqueue's
+ * min_vruntime so that they keep their relative position.
+ */
+static void set_entity_cfs_rq(struct sched_entity *se, struct cfs_rq *cfs_rq)
+{
+	if (se->cfs_rq == cfs_rq)
+		return;
+	if (se->cfs_rq)
+		se->vruntime += cfs_rq->min_vruntime - se->cfs_rq->min_vruntime;
+	se->cfs_rq = cfs_rq;
+}
+
+/*
+ * Place a new or waking entity relative to the runqueue's min_vruntime:
+ * new tasks start one slice behind everybody, so forking does not gain
+ * cpu time, and sleepers get a credit of at most half a latency period.
+ * Long sleeps therefore do not accumulate into a starvation of others.
+ */
+static void
+place_entity(struct cfs_rq *cfs_rq, struct sched_entity *se, int initial)
+{
+	u64 vruntime = cfs_rq->min_vruntime;
+
+	if (initial) {
+		vruntime += calc_delta_fair(__sched_slice(cfs_rq, se, 1), se);
+	} else {
+		if (!entity_is_task(se) || !batch_task(task_of(se)))
+			vruntime -= sched_latency / 2;
+		/* never gain time by being placed backwards */
+		vruntime = max_vruntime(se->vruntime, vruntime);
+	}
+	se->vruntime = vruntime;
+}
+
+static void enqueue_entity(struct cfs_rq *cfs_rq, struct sched_entity *se)
+{
+	update_curr(cfs_rq);
+	if (se != cfs_rq->curr) {
+		update_stats_wait_start(cfs_rq, se);
+		__enqueue_entity(cfs_rq, se);
+	}
+	update_load_add(&cfs_rq->load, se->load.weight);
+	cfs_rq->nr_running++;
+	se->on_rq = 1;
+}
+
+static void dequeue_entity(struct cfs_rq *cfs_rq, struct sched_entity *se)
+{
+	update_curr(cfs_rq);
+	if (se != cfs_rq->curr) {
+		update_stats_wait_end(cfs_rq, se);
+		__dequeue_entity(cfs_rq, se);
+	}
+	update_load_sub(&cfs_rq->load, se->load.weight);
+	cfs_rq->nr_running--;
+	se->on_rq = 0;
+}
+
+static void set_next_entity(struct cfs_rq *cfs_rq, struct sched_entity *se)
+{
+	if (se->on_rq) {
+		update_stats_wait_end(cfs_rq, se);
+		__dequeue_entity(cfs_rq, se);
+	}
+	se->exec_start = rq_of(cfs_rq)->clock;
+	se->prev_sum_exec_runtime = se->sum_exec_runtime;
+	cfs_rq->curr = se;
+}
+
+static void put_prev_entity(struct cfs_rq *cfs_rq, struct sched_entity *prev)
+{
+	update_curr(cfs_rq);
+	if (prev->on_rq) {
+		update_stats_wait_start(cfs_rq, prev);
+		__enqueue_entity(cfs_rq, prev);
+	}
+	cfs_rq->curr = NULL;
+}
+
+/*
+ * A group queue that used up its quota is taken off the hierarchy, its
+ * tasks stay queued on it until the next period. The entities above it
+ * are dequeued as far as they have become empty.
+ */
+static void throttle_cfs_rq(struct cfs_rq *cfs_rq)
+{
+	struct sched_entity *se = cfs_rq->my_se;
+
+	cfs_rq->throttled = 1;
+	list_add_tail(&cfs_rq->throttled_list, &rq_of(cfs_rq)->cfs_throttled);
+
+	for_each_sched_entity(se) {
+		struct cfs_rq *qcfs_rq = cfs_rq_of(se);
+
+		if (!se->on_rq)
+			break;
+		dequeue_entity(qcfs_rq, se);
+		if (qcfs_rq->throttled || qcfs_rq->load.weight)
+			break;
+	}
+}
+
+static void unthrottle_cfs_rq(struct cfs_rq *cfs_rq)
+{
+	struct sched_entity *se = cfs_rq->my_se;
+
+	cfs_rq->throttled = 0;
+	list_del(&cfs_rq->throttled_list);
+	if (!cfs_rq->load.weight)
+		return;
+
+	for_each_sched_entity(se) {
+		struct cfs_rq *qcfs_rq = cfs_rq_of(se);
+
+		if (se->on_rq)
+			break;
+		update_curr(qcfs_rq);
+		place_entity(qcfs_rq, se, 0);
+		enqueue_entity(qcfs_rq, se);
+		if (qcfs_rq->throttled)
+			break;
+	}
+}
+
+/*
+ * Called from the timer tick of the runqueue's cpu: give throttled queues whose period ended
+ * (or whose quota was lifted) back to the scheduler.
+ */
+static void unthrottle_expired_fair(struct rq *rq)
+{
+	struct cfs_rq *cfs_rq, *next;
+	int woken = 0;
+
+	update_rq_clock(rq);
+	list_for_each_entry_safe(cfs_rq, next, &rq->cfs_throttled,
+				 throttled_list) {
+		if (!cfs_rq_over_quota(cfs_rq)) {
+			unthrottle_cfs_rq(cfs_rq);
+			woken = 1;
+		}
+	}
+	if (woken)
+		set_tsk_need_resched(rq->curr);
+}
+
+/*
+ * Tasks keep their group queue when they are off a runqueue: find the
+ * one of their group on @cpu.
+ */
+static inline void set_task_cfs_rq(struct task_struct *p, unsigned int cpu)
+{
+	struct cfs_rq *cfs_rq = &cpu_rq(cpu)->cfs;
+
+	if (p->se.cfs_rq)
+		cfs_rq = p->se.cfs_rq->tg->cfs_rq[cpu];
+	set_entity_cfs_rq(&p->se, cfs_rq);
+}
+
+/*
+ * The task-level interface, called by kernel/sched.c with the
+ * runqueue lock held:
+ */
+
+static void enqueue_task_fair(struct rq *rq, struct task_struct *p)
+{
+	struct sched_entity *se = &p->se;
+
+	update_rq_clock(rq);
+	set_task_cfs_rq(p, task_cpu(p));
+
+	for_each_sched_entity(se) {
+		struct cfs_rq *cfs_rq = cfs_rq_of(se);
+
+		if (se->on_rq)
+			break;
+		if (!entity_is_task(se)) {
+			update_curr(cfs_rq);
+			place_entity(cfs_rq, se, 0);
+		}
+		enqueue_entity(cfs_rq, se);
+		if (cfs_rq->throttled)
+			break;
+	}
+}
+
+/*
+ * On migration the task may already be assigned to its new cpu, so
+ * dequeue it from the queue it was put on.
+ */
+static void dequeue_task_fair(struct task_struct *p)
+{
+	struct sched_entity *se = &p->se;
+
+	update_rq_clock(rq_of(se->cfs_rq));
+
+	for_each_sched_entity(se) {
+		struct cfs_rq *cfs_rq = cfs_rq_of(se);
+
+		dequeue_entity(cfs_rq, se);
+		/* the group entities stay queued while they have tasks */
+		if (cfs_rq->throttled || cfs_rq->load.weight)
+			break;
+	}
+}
+
+/*
+ * Position a task that is about to be queued: after a wakeup
+ * (@initial == 0), or when it is new to the fair policy.
+ */
+static void place_task_fair(struct rq *rq, struct task_struct *p, int initial)
+{
+	struct cfs_rq *cfs_rq;
+
+	update_rq_clock(rq);
+	set_task_cfs_rq(p, task_cpu(p));
+	cfs_rq = p->se.cfs_rq;
+	update_curr(cfs_rq);
+	place_entity(cfs_rq, &p->se, initial);
+#ifdef CONFIG_SCHED_DEBUG
+	if (!initial)
+		p->se.nr_wakeups++;
+#endif
+}
+
+/*
+ * Place a newly forked task. If @run_first, it is going to be queued
+ * right next to its parent, which it should run before.
+ */
+static void task_new_fair(struct rq *rq, struct task_struct *p, int run_first)
+{
+	struct sched_entity *curr, *se = &p->se;
+
+	place_task_fair(rq, p, 1);
+	curr = se->cfs_rq->curr;
+	if (run_first && sched_child_runs_first && curr == &current->se &&
+	    (s64)(curr->vruntime - se->vruntime) < 0) {
+		u64 vruntime = curr->vruntime;
+
+		curr->vruntime = se->vruntime;
+		se->vruntime = vruntime;
+	}
+}
+
+static void sched_fork_fair(struct task_struct *p)
+{
+	p->se.on_rq = 0;
+	p->se.my_q = NULL;
+	p->se.exec_start = 0;
+	p->se.sum_exec_runtime = 0;
+	p->se.prev_sum_exec_runtime = 0;
+#ifdef CONFIG_SCHED_DEBUG
+	p->se.wait_start = 0;
+	p->se.wait_max = 0;
+	p->se.wait_sum = 0;
+	p->se.exec_max = 0;
+	p->se.nr_wakeups = 0;
+#endif
+}
+
+/*
+ * Called from schedule() before the next task is picked: put the
+ * previous task, and the groups it runs in, back into the trees if
+ * they are still runnable. This is where groups over quota are
+ * throttled.
+ */
+static void put_prev_task_fair(struct rq *rq)
+{
+	struct cfs_rq *cfs_rq = &rq->cfs;
+	struct sched_entity *se;
+
+	if (!cfs_rq->curr)
+		return;
+
+	update_rq_clock(rq);
+	while ((se = cfs_rq->curr)) {
+		put_prev_entity(cfs_rq, se);
+		if (unlikely(cfs_rq_over_quota(cfs_rq)) && !cfs_rq->throttled)
+			throttle_cfs_rq(cfs_rq);
+		cfs_rq = se->my_q;
+		if (!cfs_rq)
+			break;
+	}
+}
+
+/*
+ * Pick the leftmost entity at each level of the hierarchy. A group
+ * entity is only queued while its own queue has entities queued, so
+ * this finds a task whenever rq->cfs is not empty.
+ */
+static struct task_struct *pick_next_task_fair(struct rq *rq)
+{
+	struct cfs_rq *cfs_rq = &rq->cfs;
+	struct sched_entity *se;
+
+	do {
+		se = __pick_next_entity(cfs_rq);
+		cfs_rq = se->my_q;
+	} while (cfs_rq);
+
+	return task_of(se);
+}
+
+static void set_next_task_fair(struct rq *rq, struct task_struct *p)
+{
+	struct sched_entity *se = &p->se;
+
+	update_rq_clock(rq);
+	for_each_sched_entity(se)
+		set_next_entity(cfs_rq_of(se), se);
+}
+
+/*
+ * Preempt the running task once it, or one of its groups, has used up
+ * its slice of the period or its group's quota.
+ */
+static void task_tick_fair(struct rq *rq, struct task_struct *p)
+{
+	struct sched_entity *se = &p->se;
+	u64 ideal_runtime, delta_exec;
+
+	update_rq_clock(rq);
+	for_each_sched_entity(se) {
+		struct cfs_rq *cfs_rq = cfs_rq_of(se);
+
+		/*
+		 * A task that just switched to the fair policy while running
+		 * is in the tree already: let schedule() sort it out.
+		 */
+		if (unlikely(cfs_rq->curr != se)) {
+			set_tsk_need_resched(p);
+			return;
+		}
+		update_curr(cfs_rq);
+		if (unlikely(cfs_rq_over_quota(cfs_rq))) {
+			set_tsk_need_resched(p);
+			continue;
+		}
+		if (cfs_rq->nr_running < 2)
+			continue;
+
+		ideal_runtime = __sched_slice(cfs_rq, se, 0);
+		delta_exec = se->sum_exec_runtime - se->prev_sum_exec_runtime;
+		if (delta_exec > ideal_runtime)
+			set_tsk_need_resched(p);
+	}
+}
+
+static inline int depth_se(struct sched_entity *se)
+{
+	int depth = 0;
+
+	for_each_sched_entity(se)
+		depth++;
+	return depth;
+}
+
+/*
+ * Walk @se and @pse up to the two entities that are queued on a common
+ * runqueue, so that their vruntimes can be compared.
+ */
+static void find_matching_se(struct sched_entity **se,
+			     struct sched_entity **pse)
+{
+	int se_depth = depth_se(*se), pse_depth = depth_se(*pse);
+
+	while (se_depth > pse_depth) {
+		se_depth--;
+		*se = parent_entity(*se);
+	}
+	while (pse_depth > se_depth) {
+		pse_depth--;
+		*pse = parent_entity(*pse);
+	}
+	while ((*se)->cfs_rq != (*pse)->cfs_rq) {
+		*se = parent_entity(*se);
+		*pse = parent_entity(*pse);
+	}
+}
+
+/*
+ * Should the woken task @p preempt the running fair task?
+ */
+static int wakeup_preempt_fair(struct rq *rq, struct task_struct *p)
+{
+	struct sched_entity *curr = &rq->curr->se, *se = &p->se;
+	unsigned long gran;
+
+	if (unlikely(!rq->cfs.curr || curr->cfs_rq->curr != curr))
+		return 1;
+	/*
+	 * Batch tasks do not preempt (their preemption is driven by
+	 * the tick), nor do tasks of a throttled group:
+	 */
+	if (batch_task(p) || se->cfs_rq->throttled)
+		return 0;
+
+	find_matching_se(&curr, &se);
+	update_rq_clock(rq);
+	update_curr(cfs_rq_of(curr));
+	gran = calc_delta_fair(sched_wakeup_granularity, se);
+
+	return (s64)(curr->vruntime - se->vruntime) > (s64)gran;
+}
+
+/*
+ * sched_yield() moves the task behind all the other runnable tasks of
+ * its group.
+ */
+static void yield_task_fair(struct rq *rq, struct task_struct *p)
+{
+	struct sched_entity *rightmost, *se = &p->se;
+	struct cfs_rq *cfs_rq = se->cfs_rq;
+
+	if (unlikely(!cfs_rq || cfs_rq->curr != se))
+		return;
+
+	update_rq_clock(rq);
+	update_curr(cfs_rq);
+	rightmost = __pick_last_entity(cfs_rq);
+	if (rightmost && (s64)(rightmost->vruntime - se->vruntime) > 0)
+		se->vruntime = rightmost->vruntime + 1;
+}
+
+static void init_cfs_rq(struct cfs_rq *cfs_rq, struct rq *rq,
+			struct task_group *tg, struct sched_entity *se)
+{
+	cfs_rq->tasks_timeline = RB_ROOT;
+	cfs_rq->rb_leftmost = NULL;
+	cfs_rq->curr = NULL;
+	cfs_rq->min_vruntime = 0;
+	cfs_rq->exec_clock = 0;
+	cfs_rq->nr_running = 0;
+	cfs_rq->load.weight = 0;
+	cfs_rq->load.inv_weight = 0;
+	cfs_rq->rq = rq;
+	cfs_rq->tg = tg;
+	cfs_rq->my_se = se;
+	cfs_rq->runtime_used = 0;
+	cfs_rq->period_end = 0;
+	cfs_rq->throttled = 0;
+	INIT_LIST_HEAD(&cfs_rq->throttled_list);
+}
@@ -0,0 +1,219 @@
+/*
+ * kernel/sched_trace.c
+ *
+ * Trace the load balancing decisions into per cpu relay buffers, in
+ * debugfs sched/trace<cpu>: which cpu pulled from which, the imbalance,
+ * the tasks moved, the time it took and why an attempt failed. Records
+ * only go to the buffer of the local cpu (with interrupts disabled), so
+ * tracing takes no lock shared between cpus. Writing 1 to sched/enabled
+ * allocates the buffers and starts tracing, writing 0 stops it.
+ * Included from kernel/sched.c.
+ */
+#ifdef CONFIG_SCHED_TRACE
+
+#include <linux/relay.h>
+#include <linux/debugfs.h>
+
+#define SCHED_TRACE_SUBBUF_SIZE		(64 * 1024)
+#define SCHED_TRACE_N_SUBBUFS		8
+
+static struct dentry *sched_trace_dir;
+static struct rchan *sched_trace_chan;
+static int sched_trace_enabled __read_mostly;
+static atomic_t sched_trace_dropped = ATOMIC_INIT(0);
+static DEFINE_MUTEX(sched_trace_mutex);
+static DEFINE_PER_CPU(u32, sched_trace_sequence);
+
+static inline u64 sched_trace_clock(void)
+{
+	return unlikely(sched_trace_enabled) ? sched_clock() : 0;
+}
+
+static void __sched_trace_lb(struct sched_domain *sd, struct rq *this_rq,
+			     struct rq *busiest, int event, enum idle_type idle,
+			     int result, unsigned long imbalance, int nr_moved,
+			     u64 start)
+{
+	struct sched_lb_trace t;
+	int cpu = this_rq->cpu;
+
+	t.magic = SCHED_TRACE_MAGIC | SCHED_TRACE_VERSION;
+	t.sequence = ++__get_cpu_var(sched_trace_sequence);
+	t.time = sched_clock();
+	t.imbalance = imbalance;
+	t.duration = start ? t.time - start : 0;
+	t.nr_moved = nr_moved > 0 ? nr_moved : 0;
+	t.sd_flags = sd->flags;
+	t.this_nr_running = this_rq->nr_running;
+	t.busiest_nr_running = busiest ? busiest->nr_running : 0;
+	t.nr_balance_failed = sd->nr_balance_failed;
+	t.balance_interval = sd->balance_interval;
+	t.cpu = cpu;
+	t.busiest_cpu = busiest ? busiest->cpu : -1;
+	t.sd_weight = cpus_weight(sd->span);
+	t.event = event;
+	t.idle = idle;
+	t.result = result;
+	memset(t.pad, 0, sizeof(t.pad));
+
+	/* pairs with the smp_wmb() in sched_trace_enabled_write() */
+	smp_rmb();
+	relay_write(sched_trace_chan, &t, sizeof(t));
+}
+
+/*
+ * Record one balancing decision of this_rq's cpu. busiest may be NULL
+ * when none was found, start is the sched_trace_clock() taken before
+ * the tasks were moved (0 if nothing was tried).
+ */
+static inline void
+sched_trace_lb(struct sched_domain *sd, struct rq *this_rq, struct rq *busiest,
+	       int event, enum idle_type idle, int result,
+	       unsigned long imbalance, int nr_moved, u64 start)
+{
+	if (unlikely(sched_trace_enabled))
+		__sched_trace_lb(sd, this_rq, busiest, event, idle, result,
+				 imbalance, nr_moved, start);
+}
+
+/*
+ * Count the records lost to full sub-buffers, for sched/dropped
+ */
+static int sched_trace_subbuf_start(struct rchan_buf *buf, void *subbuf,
+				    void *prev_subbuf, size_t prev_padding)
+{
+	if (!relay_buf_full(buf))
+		return 1;
+
+	atomic_inc(&sched_trace_dropped);
+	return 0;
+}
+
+static int sched_trace_remove_buf_file(struct dentry *dentry)
+{
+	debugfs_remove(dentry);
+	return 0;
+}
+
+static struct dentry *sched_trace_create_buf_file(const char *filename,
+						  struct dentry *parent,
+						  int mode,
+						  struct rchan_buf *buf,
+						  int *is_global)
+{
+	return debugfs_create_file(filename, mode, parent, buf,
+				   &relay_file_operations);
+}
+
+static struct rchan_callbacks sched_trace_relay_callbacks = {
+	.subbuf_start		= sched_trace_subbuf_start,
+	.create_buf_file	= sched_trace_create_buf_file,
+	.remove_buf_file	= sched_trace_remove_buf_file,
+};
+
+static ssize_t sched_trace_enabled_read(struct file *filp, char __user *ubuf,
+					size_t cnt, loff_t *ppos)
+{
+	char buf[4];
+
+	snprintf(buf, sizeof(buf), "%d\n", sched_trace_enabled);
+
+	return simple_read_from_buffer(ubuf, cnt, ppos, buf, strlen(buf));
+}
+
+static ssize_t sched_trace_enabled_write(struct file *filp,
+					 const char __user *ubuf,
+					 size_t cnt, loff_t *ppos)
+{
+	char buf[4];
+	int enable;
+
+	if (!cnt)
+		return 0;
+	if (copy_from_user(buf, ubuf, 1))
+		return -EFAULT;
+
+	switch (buf[0]) {
+	case '0':
+		enable = 0;
+		break;
+	case '1':
+		enable = 1;
+		break;
+	default:
+		return -EINVAL;
+	}
+
+	mutex_lock(&sched_trace_mutex);
+	if (enable && !sched_trace_chan) {
+		/*
+		 * The buffers of the cpus are only allocated the first
+		 * time tracing is turned on, and then stay around.
+		 */
+		sched_trace_chan = relay_open("trace", sched_trace_dir,
+					      SCHED_TRACE_SUBBUF_SIZE,
+					      SCHED_TRACE_N_SUBBUFS,
+					      &sched_trace_relay_callbacks);
+		if (!sched_trace_chan) {
+			mutex_unlock(&sched_trace_mutex);
+			return -ENOMEM;
+		}
+		/* the channel must be visible before the enable flag */
+		smp_wmb();
+	}
+	sched_trace_enabled = enable;
+	if (!enable && sched_trace_chan)
+		relay_flush(sched_trace_chan);
+	mutex_unlock(&sched_trace_mutex);
+
+	return cnt;
+}
+
+static struct file_operations sched_trace_enabled_fops = {
+	.read =		sched_trace_enabled_read,
+	.write =	sched_trace_enabled_write,
+};
+
+static ssize_t sched_trace_dropped_read(struct file *filp, char __user *ubuf,
+					size_t cnt, loff_t *ppos)
+{
+	char buf[16];
+
+	snprintf(buf, sizeof(buf), "%u\n", atomic_read(&sched_trace_dropped));
+
+	return simple_read_from_buffer(ubuf, cnt, ppos, buf, strlen(buf));
+}
+
+static struct file_operations sched_trace_dropped_fops = {
+	.read =		sched_trace_dropped_read,
+};
+
+static int __init sched_trace_init(void)
+{
+	sched_trace_dir = debugfs_create_dir("sched", NULL);
+	if (!sched_trace_dir)
+		return -ENOMEM;
+
+	debugfs_create_file("enabled", 0600, sched_trace_dir, NULL,
+			    &sched_trace_enabled_fops);
+	debugfs_create_file("dropped", 0444, sched_trace_dir, NULL,
+			    &sched_trace_dropped_fops);
+	return 0;
+}
+late_initcall(sched_trace_init);
+
+#else
+
+static inline u64 sched_trace_clock(void)
+{
+	return 0;
+}
+
+static inline void
+sched_trace_lb(struct sched_domain *sd, struct rq *this_rq, struct rq *busiest,
+	       int event, enum idle_type idle, int result,
+	       unsigned long imbalance, int nr_moved, u64 start)
+{
+}
+
+#endif /* CONFIG_SCHED_TRACE */
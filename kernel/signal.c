@@ -22,6 +22,7 @@
 #include <linux/syscalls.h>
 #include <linux/ptrace.h>
 #include <linux/signal.h>
+#include <linux/signalfd.h>
 #include <linux/capability.h>
 #include <asm/param.h>
 #include <asm/uaccess.h>
@@ -229,8 +230,7 @@ void recalc_sigpending(void)
 
 /* Given the mask, find the first available signal that should be serviced. */
 
-static int
-next_signal(struct sigpending *pending, sigset_t *mask)
+int next_signal(struct sigpending *pending, sigset_t *mask)
 {
 	unsigned long i, *s, *m, x;
 	int sig = 0;
@@ -263,16 +263,36 @@ next_signal(struct sigpending *pending, sigset_t *mask)
 	return sig;
 }
 
+/*
+ * Each thread group keeps up to SIGQUEUE_CACHE_MAX of the sigqueues freed
+ * on dequeue, under siglock, for the next signals queued to it, so that
+ * a steady stream of queued signals does not go through the slab for
+ * every one.  Cached sigqueues are not charged to any user.
+ */
+#define SIGQUEUE_CACHE_MAX	32
+
+/*
+ * @cached says that t's siglock is held, and so the sigqueue may come
+ * from t->signal's cache.
+ */
 static struct sigqueue *__sigqueue_alloc(struct task_struct *t, gfp_t flags,
-					 int override_rlimit)
+					 int override_rlimit, int cached)
 {
+	struct signal_struct *sig = t->signal;
 	struct sigqueue *q = NULL;
 
 	atomic_inc(&t->user->sigpending);
 	if (override_rlimit ||
 	    atomic_read(&t->user->sigpending) <=
-			t->signal->rlim[RLIMIT_SIGPENDING].rlim_cur)
-		q = kmem_cache_alloc(sigqueue_cachep, flags);
+			sig->rlim[RLIMIT_SIGPENDING].rlim_cur) {
+		if (cached && sig->nr_sigqueue_cache) {
+			q = list_entry(sig->sigqueue_cache.next,
+				       struct sigqueue, list);
+			list_del(&q->list);
+			sig->nr_sigqueue_cache--;
+		} else
+			q = kmem_cache_alloc(sigqueue_cachep, flags);
+	}
 	if (unlikely(q == NULL)) {
 		atomic_dec(&t->user->sigpending);
 	} else {
@@ -292,6 +312,35 @@ static void __sigqueue_free(struct sigqueue *q)
 	kmem_cache_free(sigqueue_cachep, q);
 }
 
+/* As __sigqueue_free(), keeping @q in @sig's cache if there is room */
+static void __sigqueue_free_cached(struct signal_struct *sig,
+				   struct sigqueue *q)
+{
+	if (q->flags & SIGQUEUE_PREALLOC)
+		return;
+	if (sig->nr_sigqueue_cache >= SIGQUEUE_CACHE_MAX) {
+		__sigqueue_free(q);
+		return;
+	}
+	atomic_dec(&q->user->sigpending);
+	free_uid(q->user);
+	list_add(&q->list, &sig->sigqueue_cache);
+	sig->nr_sigqueue_cache++;
+}
+
+/* Free the sigqueues cached by a thread group that is going away */
+void flush_sigqueue_cache(struct signal_struct *sig)
+{
+	struct sigqueue *q;
+
+	while (!list_empty(&sig->sigqueue_cache)) {
+		q = list_entry(sig->sigqueue_cache.next, struct sigqueue, list);
+		list_del(&q->list);
+		kmem_cache_free(sigqueue_cachep, q);
+	}
+	sig->nr_sigqueue_cache = 0;
+}
+
 void flush_sigqueue(struct sigpending *queue)
 {
 	struct sigqueue *q;
@@ -371,7 +420,8 @@ unblock_all_signals(void)
 	spin_unlock_irqrestore(&current->sighand->siglock, flags);
 }
 
-static int collect_signal(int sig, struct sigpending *list, siginfo_t *info)
+static int collect_signal(int sig, struct sigpending *list, siginfo_t *info,
+			  struct task_struct *tsk)
 {
 	struct sigqueue *q, *first = NULL;
 	int still_pending = 0;
@@ -395,7 +445,7 @@ static int collect_signal(int sig, struct sigpending *list, siginfo_t *info)
 	if (first) {
 		list_del_init(&first->list);
 		copy_siginfo(info, &first->info);
-		__sigqueue_free(first);
+		__sigqueue_free_cached(tsk->signal, first);
 		if (!still_pending)
 			sigdelset(&list->signal, sig);
 	} else {
@@ -414,8 +464,8 @@ static int collect_signal(int sig, struct sigpending *list, siginfo_t *info)
 	return 1;
 }
 
-static int __dequeue_signal(struct sigpending *pending, sigset_t *mask,
-			siginfo_t *info)
+static int __dequeue_signal(struct task_struct *tsk, struct sigpending *pending,
+			    sigset_t *mask, siginfo_t *info)
 {
 	int sig = 0;
 
@@ -430,7 +480,7 @@ static int __dequeue_signal(struct sigpending *pending, sigset_t *mask,
 			}
 		}
 
-		if (!collect_signal(sig, pending, info))
+		if (!collect_signal(sig, pending, info, tsk))
 			sig = 0;
 				
 	}
@@ -447,9 +497,9 @@ static int __dequeue_signal(struct sigpending *pending, sigset_t *mask,
  */
 int dequeue_signal(struct task_struct *tsk, sigset_t *mask, siginfo_t *info)
 {
-	int signr = __dequeue_signal(&tsk->pending, mask, info);
+	int signr = __dequeue_signal(tsk, &tsk->pending, mask, info);
 	if (!signr)
-		signr = __dequeue_signal(&tsk->signal->shared_pending,
+		signr = __dequeue_signal(tsk, &tsk->signal->shared_pending,
 					 mask, info);
  	if (signr && unlikely(sig_kernel_stop(signr))) {
  		/*
@@ -723,7 +773,7 @@ static int send_signal(int sig, struct siginfo *info, struct task_struct *t,
 
 	q = __sigqueue_alloc(t, GFP_ATOMIC, (sig < SIGRTMIN &&
 					     (is_si_special(info) ||
-					      info->si_code >= 0)));
+					      info->si_code >= 0)), 1);
 	if (q) {
 		list_add_tail(&q->list, &signals->list);
 		switch ((unsigned long) info) {
@@ -756,6 +806,7 @@ static int send_signal(int sig, struct siginfo *info, struct task_struct *t,
 
 out_set:
 	sigaddset(&signals->signal, sig);
+	signalfd_notify(t, sig);
 	return ret;
 }
 
@@ -1292,7 +1343,7 @@ struct sigqueue *sigqueue_alloc(void)
 {
 	struct sigqueue *q;
 
-	if ((q = __sigqueue_alloc(current, GFP_KERNEL, 0)))
+	if ((q = __sigqueue_alloc(current, GFP_KERNEL, 0, 0)))
 		q->flags |= SIGQUEUE_PREALLOC;
 	return(q);
 }
@@ -1357,6 +1408,7 @@ int send_sigqueue(int sig, struct sigqueue *q, struct task_struct *p)
 
 	list_add_tail(&q->list, &p->pending.list);
 	sigaddset(&p->pending.signal, sig);
+	signalfd_notify(p, sig);
 	if (!sigismember(&p->blocked, sig))
 		signal_wake_up(p, sig == SIGKILL);
 
@@ -1405,6 +1457,7 @@ send_group_sigqueue(int sig, struct sigqueue *q, struct task_struct *p)
 	 */
 	list_add_tail(&q->list, &p->signal->shared_pending.list);
 	sigaddset(&p->signal->shared_pending.signal, sig);
+	signalfd_notify(p, sig);
 
 	__group_complete_signal(sig, p);
 out:
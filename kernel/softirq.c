@@ -17,8 +17,10 @@
 #include <linux/kthread.h>
 #include <linux/rcupdate.h>
 #include <linux/smp.h>
+#include <linux/seq_file.h>
 
 #include <asm/irq.h>
+#include <asm/div64.h>
 /*
    - No shared variables, all the data are CPU local.
    - If a softirq needs serialization, let it serialize itself
@@ -46,6 +48,27 @@ static struct softirq_action softirq_vec[32] __cacheline_aligned_in_smp;
 
 static DEFINE_PER_CPU(struct task_struct *, ksoftirqd);
 
+static const char *softirq_names[NR_SOFTIRQS] = {
+	"HI", "TIMER", "NET_TX", "NET_RX", "BLOCK", "TASKLET"
+};
+
+/* How often, and for how long in ns, each vector ran on this cpu */
+struct softirq_stat {
+	unsigned long count[NR_SOFTIRQS];
+	unsigned long long time[NR_SOFTIRQS];
+};
+static DEFINE_PER_CPU(struct softirq_stat, softirq_stats);
+
+/*
+ * Vectors that overran the budget of an invocation of __do_softirq(),
+ * left to ksoftirqd until it has nothing more to do.  Only touched on
+ * the local cpu with interrupts disabled.
+ */
+static DEFINE_PER_CPU(__u32, softirq_deferred);
+
+/* Time __do_softirq() may take before handing over to ksoftirqd; 0 for none */
+int softirq_budget_us = 2000;
+
 /*
  * we cannot loop indefinitely here to avoid userspace starvation,
  * but we also don't want to introduce a worst case 1/HZ latency
@@ -193,22 +216,30 @@ void local_bh_enable_ip(unsigned long ip)
 EXPORT_SYMBOL(local_bh_enable_ip);
 
 /*
- * We restart softirq processing MAX_SOFTIRQ_RESTART times,
- * and we fall back to softirqd after that.
+ * We restart softirq processing MAX_SOFTIRQ_RESTART times, or for as
+ * long as softirq_budget_us allows, and we fall back to softirqd after
+ * that.
  *
  * This number has been established via experimentation.
  * The two things to balance is latency against fairness -
  * we want to handle softirqs as soon as possible, but they
  * should not be able to lock up the box.
+ *
+ * When we do fall back, the vector that took most of the time is left
+ * to softirqd alone until it catches up, so that one busy vector (say
+ * NET_RX under a flood) does not delay the timers and tasklets that
+ * run on interrupt exit behind it.
  */
 #define MAX_SOFTIRQ_RESTART 10
 
 asmlinkage void __do_softirq(void)
 {
+	struct softirq_stat *stat;
 	struct softirq_action *h;
-	__u32 pending;
+	unsigned long long start, now, budget, spent[NR_SOFTIRQS];
+	__u32 pending, deferred;
 	int max_restart = MAX_SOFTIRQ_RESTART;
-	int cpu;
+	int cpu, nr, hog;
 
 	pending = local_softirq_pending();
 	account_system_vtime(current);
@@ -217,31 +248,55 @@ asmlinkage void __do_softirq(void)
 	trace_softirq_enter();
 
 	cpu = smp_processor_id();
+	stat = &per_cpu(softirq_stats, cpu);
+	deferred = 0;
+	if (current != per_cpu(ksoftirqd, cpu))
+		deferred = per_cpu(softirq_deferred, cpu);
+	budget = (unsigned long long)softirq_budget_us * 1000;
+	memset(spent, 0, sizeof(spent));
+	start = sched_clock();
 restart:
 	/* Reset the pending bitmask before enabling irqs */
-	set_softirq_pending(0);
+	set_softirq_pending(pending & deferred);
+	pending &= ~deferred;
 
 	local_irq_enable();
 
 	h = softirq_vec;
+	nr = 0;
 
-	do {
+	while (pending) {
 		if (pending & 1) {
+			now = sched_clock();
 			h->action(h);
+			now = sched_clock() - now;
+			spent[nr] += now;
+			stat->time[nr] += now;
+			stat->count[nr]++;
 			rcu_bh_qsctr_inc(cpu);
 		}
 		h++;
+		nr++;
 		pending >>= 1;
-	} while (pending);
+	}
 
 	local_irq_disable();
 
 	pending = local_softirq_pending();
-	if (pending && --max_restart)
+	if (pending & ~deferred && --max_restart &&
+	    (!budget || sched_clock() - start < budget))
 		goto restart;
 
-	if (pending)
+	if (pending) {
+		if (pending & ~deferred && per_cpu(ksoftirqd, cpu)) {
+			hog = 0;
+			for (nr = 1; nr < NR_SOFTIRQS; nr++)
+				if (spent[nr] > spent[hog])
+					hog = nr;
+			per_cpu(softirq_deferred, cpu) |= 1 << hog;
+		}
 		wakeup_softirqd();
+	}
 
 	trace_softirq_exit();
 
@@ -495,6 +550,11 @@ static int ksoftirqd(void * __bind_cpu)
 			cond_resched();
 			preempt_disable();
 		}
+		/* Caught up: the deferred vectors may run on irq exit again */
+		local_irq_disable();
+		if (!local_softirq_pending())
+			__get_cpu_var(softirq_deferred) = 0;
+		local_irq_enable();
 		preempt_enable();
 		set_current_state(TASK_INTERRUPTIBLE);
 	}
@@ -599,6 +659,7 @@ static int __cpuinit cpu_callback(struct notifier_block *nfb,
 		per_cpu(ksoftirqd, hotcpu) = NULL;
 		kthread_stop(p);
 		takeover_tasklets(hotcpu);
+		per_cpu(softirq_deferred, hotcpu) = 0;
 		break;
 #endif /* CONFIG_HOTPLUG_CPU */
  	}
@@ -618,6 +679,50 @@ __init int spawn_ksoftirqd(void)
 	return 0;
 }
 
+#ifdef CONFIG_PROC_FS
+static void show_softirqs_header(struct seq_file *p, const char *title)
+{
+	char name[16];
+	int cpu;
+
+	seq_printf(p, "%-9s", title);
+	for_each_possible_cpu(cpu) {
+		sprintf(name, "CPU%d", cpu);
+		seq_printf(p, " %10s", name);
+	}
+	seq_putc(p, '\n');
+}
+
+/*
+ * /proc/softirqs: how many times each vector ran on each cpu, and then
+ * how long it took there in all, in microseconds.
+ */
+int show_softirqs(struct seq_file *p, void *v)
+{
+	unsigned long long t;
+	int i, cpu;
+
+	show_softirqs_header(p, "");
+	for (i = 0; i < NR_SOFTIRQS; i++) {
+		seq_printf(p, "%8s:", softirq_names[i]);
+		for_each_possible_cpu(cpu)
+			seq_printf(p, " %10lu", per_cpu(softirq_stats, cpu).count[i]);
+		seq_putc(p, '\n');
+	}
+	show_softirqs_header(p, "usecs");
+	for (i = 0; i < NR_SOFTIRQS; i++) {
+		seq_printf(p, "%8s:", softirq_names[i]);
+		for_each_possible_cpu(cpu) {
+			t = per_cpu(softirq_stats, cpu).time[i];
+			do_div(t, 1000);
+			seq_printf(p, " %10llu", t);
+		}
+		seq_putc(p, '\n');
+	}
+	return 0;
+}
+#endif
+
 #ifdef CONFIG_SMP
 /*
  * Call a function on all processors
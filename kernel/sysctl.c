@@ -34,6 +34,7 @@
 #include <linux/kobject.h>
 #include <linux/net.h>
 #include <linux/sysrq.h>
+#include <linux/interrupt.h>
 #include <linux/highuid.h>
 #include <linux/writeback.h>
 #include <linux/hugetlb.h>
@@ -45,6 +46,9 @@
 #include <linux/syscalls.h>
 #include <linux/nfs_fs.h>
 #include <linux/acpi.h>
+#include <linux/compaction.h>
+#include <linux/pipe_fs_i.h>
+#include <linux/numa_balancing.h>
 
 #include <asm/uaccess.h>
 #include <asm/processor.h>
@@ -69,6 +73,7 @@ extern int pid_max;
 extern int min_free_kbytes;
 extern int printk_ratelimit_jiffies;
 extern int printk_ratelimit_burst;
+extern unsigned long printk_dropped;
 extern int pid_max_min, pid_max_max;
 extern int sysctl_drop_caches;
 extern int percpu_pagelist_fraction;
@@ -97,6 +102,7 @@ extern int sg_big_buff;
 extern size_t shm_ctlmax;
 extern size_t shm_ctlall;
 extern int shm_ctlmni;
+extern int shm_use_hugepages;
 extern int msg_ctlmax;
 extern int msg_ctlmnb;
 extern int msg_ctlmni;
@@ -227,6 +233,12 @@ static ctl_table root_table[] = {
 	{ .ctl_name = 0 }
 };
 
+/* Constants for minimum and maximum testing in kern_table and vm_table.
+   We use these as one-element integer vectors. */
+static int zero;
+static int one = 1;
+static int one_hundred = 100;
+
 static ctl_table kern_table[] = {
 	{
 		.ctl_name	= KERN_OSTYPE,
@@ -452,6 +464,14 @@ static ctl_table kern_table[] = {
 		.mode		= 0644,
 		.proc_handler	= &proc_dointvec,
 	},
+	{
+		.ctl_name	= KERN_SHM_USE_HUGEPAGES,
+		.procname	= "shm_use_hugepages",
+		.data		= &shm_use_hugepages,
+		.maxlen		= sizeof (int),
+		.mode		= 0644,
+		.proc_handler	= &proc_dointvec,
+	},
 	{
 		.ctl_name	= KERN_MSGMAX,
 		.procname	= "msgmax",
@@ -557,6 +577,15 @@ static ctl_table kern_table[] = {
 		.mode		= 0644,
 		.proc_handler	= &proc_dointvec,
 	},
+#endif
+	{
+		.ctl_name	= KERN_S390_USER_DEBUG_LOGGING,
+		.procname	= "userprocess_debug",
+		.data		= &sysctl_userprocess_debug,
+		.maxlen		= sizeof(int),
+		.mode		= 0644,
+		.proc_handler	= &proc_dointvec,
+	},
 #endif
 #ifdef CONFIG_NO_IDLE_HZ
 	{
@@ -567,15 +596,6 @@ static ctl_table kern_table[] = {
 		.mode           = 0644,
 		.proc_handler   = &proc_dointvec,
 	},
-#endif
-	{
-		.ctl_name	= KERN_S390_USER_DEBUG_LOGGING,
-		.procname	= "userprocess_debug",
-		.data		= &sysctl_userprocess_debug,
-		.maxlen		= sizeof(int),
-		.mode		= 0644,
-		.proc_handler	= &proc_dointvec,
-	},
 #endif
 	{
 		.ctl_name	= KERN_PIDMAX,
@@ -613,6 +633,24 @@ static ctl_table kern_table[] = {
 		.mode		= 0644,
 		.proc_handler	= &proc_dointvec,
 	},
+	{
+		.ctl_name	= KERN_PRINTK_DROPPED,
+		.procname	= "printk_dropped",
+		.data		= &printk_dropped,
+		.maxlen		= sizeof(unsigned long),
+		.mode		= 0444,
+		.proc_handler	= &proc_doulongvec_minmax,
+	},
+	{
+		.ctl_name	= KERN_SOFTIRQ_BUDGET,
+		.procname	= "softirq_budget_us",
+		.data		= &softirq_budget_us,
+		.maxlen		= sizeof(int),
+		.mode		= 0644,
+		.proc_handler	= &proc_dointvec_minmax,
+		.strategy	= &sysctl_intvec,
+		.extra1		= &zero,
+	},
 	{
 		.ctl_name	= KERN_NGROUPS_MAX,
 		.procname	= "ngroups_max",
@@ -705,11 +743,6 @@ static ctl_table kern_table[] = {
 	{ .ctl_name = 0 }
 };
 
-/* Constants for minimum and maximum testing in vm_table.
-   We use these as one-element integer vectors. */
-static int zero;
-static int one_hundred = 100;
-
 
 static ctl_table vm_table[] = {
 	{
@@ -761,7 +794,7 @@ static ctl_table vm_table[] = {
 		.data		= &vm_dirty_ratio,
 		.maxlen		= sizeof(vm_dirty_ratio),
 		.mode		= 0644,
-		.proc_handler	= &proc_dointvec_minmax,
+		.proc_handler	= &dirty_ratio_handler,
 		.strategy	= &sysctl_intvec,
 		.extra1		= &zero,
 		.extra2		= &one_hundred,
@@ -955,6 +988,76 @@ static ctl_table vm_table[] = {
 		.strategy	= &sysctl_intvec,
 		.extra1		= &zero,
 	},
+#endif
+#ifdef CONFIG_COMPACTION
+	{
+		.ctl_name	= VM_COMPACT_MEMORY,
+		.procname	= "compact_memory",
+		.data		= &sysctl_compact_memory,
+		.maxlen		= sizeof(int),
+		.mode		= 0200,
+		.proc_handler	= &sysctl_compaction_handler,
+		.strategy	= &sysctl_intvec,
+	},
+#endif
+#ifdef CONFIG_SHARED_PAGE_TABLES
+	{
+		.ctl_name	= VM_FORK_SHARE_PAGE_TABLES,
+		.procname	= "fork_share_page_tables",
+		.data		= &sysctl_fork_share_page_tables,
+		.maxlen		= sizeof(sysctl_fork_share_page_tables),
+		.mode		= 0644,
+		.proc_handler	= &proc_dointvec_minmax,
+		.strategy	= &sysctl_intvec,
+		.extra1		= &zero,
+		.extra2		= &one,
+	},
+#endif
+#ifdef CONFIG_SWAP
+	{
+		.ctl_name	= VM_SWAP_VMA_READAHEAD,
+		.procname	= "swap_vma_readahead",
+		.data		= &sysctl_swap_vma_readahead,
+		.maxlen		= sizeof(sysctl_swap_vma_readahead),
+		.mode		= 0644,
+		.proc_handler	= &proc_dointvec_minmax,
+		.strategy	= &sysctl_intvec,
+		.extra1		= &zero,
+		.extra2		= &one,
+	},
+#endif
+#ifdef CONFIG_NUMA_BALANCING
+	{
+		.ctl_name	= VM_NUMA_BALANCING,
+		.procname	= "numa_balancing",
+		.data		= &sysctl_numa_balancing,
+		.maxlen		= sizeof(sysctl_numa_balancing),
+		.mode		= 0644,
+		.proc_handler	= &numa_balancing_sysctl_handler,
+		.strategy	= &sysctl_intvec,
+		.extra1		= &zero,
+		.extra2		= &one,
+	},
+	{
+		.ctl_name	= VM_NUMA_BALANCING_SCAN_PERIOD_MS,
+		.procname	= "numa_balancing_scan_period_ms",
+		.data		= &sysctl_numa_balancing_scan_period_ms,
+		.maxlen		= sizeof(sysctl_numa_balancing_scan_period_ms),
+		.mode		= 0644,
+		.proc_handler	= &numa_balancing_sysctl_handler,
+		.strategy	= &sysctl_intvec,
+		.extra1		= &one,
+	},
+	{
+		.ctl_name	= VM_NUMA_BALANCING_SCAN_SIZE_MB,
+		.procname	= "numa_balancing_scan_size_mb",
+		.data		= &sysctl_numa_balancing_scan_size_mb,
+		.maxlen		= sizeof(sysctl_numa_balancing_scan_size_mb),
+		.mode		= 0644,
+		.proc_handler	= &proc_dointvec_minmax,
+		.strategy	= &sysctl_intvec,
+		.extra1		= &one,
+	},
 #endif
 	{ .ctl_name = 0 }
 };
@@ -1074,6 +1177,16 @@ static ctl_table fs_table[] = {
 	},
 #endif	
 #endif
+	{
+		.ctl_name	= FS_PIPE_MAX_SIZE,
+		.procname	= "pipe-max-size",
+		.data		= &pipe_max_size,
+		.maxlen		= sizeof(int),
+		.mode		= 0644,
+		.proc_handler	= &pipe_proc_fn,
+		.strategy	= &sysctl_intvec,
+		.extra1		= &pipe_min_size,
+	},
 	{
 		.ctl_name	= KERN_SETUID_DUMPABLE,
 		.procname	= "suid_dumpable",
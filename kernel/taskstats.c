@@ -172,6 +172,23 @@ static void send_cpu_listeners(struct sk_buff *skb, unsigned int cpu)
 	up_write(&listeners->sem);
 }
 
+/*
+ * I/O done through read and write syscalls and, with I/O accounting,
+ * to storage:
+ */
+static void xacct_add_tsk(struct taskstats *stats, struct task_struct *tsk)
+{
+	stats->read_char += tsk->rchar;
+	stats->write_char += tsk->wchar;
+	stats->read_syscalls += tsk->syscr;
+	stats->write_syscalls += tsk->syscw;
+#ifdef CONFIG_TASK_IO_ACCOUNTING
+	stats->read_bytes += tsk->ioac.read_bytes;
+	stats->write_bytes += tsk->ioac.write_bytes;
+	stats->cancelled_write_bytes += tsk->ioac.cancelled_write_bytes;
+#endif
+}
+
 static int fill_pid(pid_t pid, struct task_struct *pidtsk,
 		struct taskstats *stats)
 {
@@ -198,6 +215,7 @@ static int fill_pid(pid_t pid, struct task_struct *pidtsk,
 	 */
 
 	delayacct_add_tsk(stats, tsk);
+	xacct_add_tsk(stats, tsk);
 	stats->version = TASKSTATS_VERSION;
 
 	/* Define err: label here if needed */
@@ -247,6 +265,7 @@ static int fill_tgid(pid_t tgid, struct task_struct *tgidtsk,
 		 *	per-task-foo(stats, tsk);
 		 */
 		delayacct_add_tsk(stats, tsk);
+		xacct_add_tsk(stats, tsk);
 
 	} while_each_thread(first, tsk);
 	read_unlock(&tasklist_lock);
@@ -276,6 +295,7 @@ static void fill_tgid_exit(struct task_struct *tsk)
 	 *	per-task-foo(tsk->signal->stats, tsk);
 	 */
 	delayacct_add_tsk(tsk->signal->stats, tsk);
+	xacct_add_tsk(tsk->signal->stats, tsk);
 ret:
 	spin_unlock_irqrestore(&tsk->signal->stats_lock, flags);
 	return;
@@ -0,0 +1,203 @@
+/*
+ * linux/kernel/time/clockevents.c
+ *
+ * This file contains the functions which manage clock event devices.
+ *
+ * Clock event devices are registered by the architecture code in their
+ * periodic tick mode. The hrtimer core picks the best one-shot capable
+ * device of a cpu when it switches that cpu to high resolution mode.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include <linux/clockchips.h>
+#include <linux/seq_file.h>
+#include <linux/kallsyms.h>
+#include <linux/module.h>
+#include <linux/spinlock.h>
+#include <linux/init.h>
+
+/*[Clock event internal variables]---------
+ * clockevent_devices:
+ *	linked list with the registered clock event devices
+ * clockevents_lock:
+ *	protects the clockevent_devices list
+ */
+static LIST_HEAD(clockevent_devices);
+static DEFINE_SPINLOCK(clockevents_lock);
+
+/**
+ * clockevent_delta2ns - Convert a latch value (device ticks) to nanoseconds
+ * @latch:	value to convert
+ * @evt:	pointer to clock event device descriptor
+ *
+ * Math helper, returns latch value converted to nanoseconds (bound checked)
+ */
+unsigned long clockevent_delta2ns(unsigned long latch,
+				  struct clock_event_device *evt)
+{
+	u64 clc = ((u64) latch << evt->shift);
+
+	do_div(clc, evt->mult);
+	if (clc < 1000)
+		clc = 1000;
+	if (clc > LONG_MAX)
+		clc = LONG_MAX;
+
+	return (unsigned long) clc;
+}
+
+/**
+ * clockevents_set_mode - set the operating mode of a clock event device
+ * @dev:	device to modify
+ * @mode:	new mode
+ *
+ * Must be called with interrupts disabled !
+ */
+void clockevents_set_mode(struct clock_event_device *dev,
+			  enum clock_event_mode mode)
+{
+	if (dev->mode != mode) {
+		dev->set_mode(mode, dev);
+		dev->mode = mode;
+	}
+	dev->next_event.tv64 = KTIME_MAX;
+}
+
+/**
+ * clockevents_program_event - Reprogram the clock event device.
+ * @dev:	device to program
+ * @expires:	absolute (monotonic) expiry time
+ * @now:	current monotonic time
+ *
+ * An event which is already due, or closer than the minimum delta of
+ * the device, is programmed min_delta_ns into the future, so the caller
+ * always gets its interrupt.
+ *
+ * Must be called with interrupts disabled !
+ */
+int clockevents_program_event(struct clock_event_device *dev, ktime_t expires,
+			      ktime_t now)
+{
+	unsigned long long clc;
+	int64_t delta;
+
+	delta = ktime_to_ns(ktime_sub(expires, now));
+
+	dev->next_event = expires;
+
+	if (dev->mode == CLOCK_EVT_MODE_SHUTDOWN)
+		return 0;
+
+	if (delta > (int64_t) dev->max_delta_ns)
+		delta = dev->max_delta_ns;
+	if (delta < (int64_t) dev->min_delta_ns)
+		delta = dev->min_delta_ns;
+
+	clc = delta * dev->mult;
+	clc >>= dev->shift;
+
+	return dev->set_next_event((unsigned long) clc, dev);
+}
+
+/**
+ * clockevents_register_device - register a clock event device
+ * @dev:	device to register
+ *
+ * The device must be set up in periodic mode, with the tick handler of
+ * the architecture installed as its event_handler.
+ */
+void clockevents_register_device(struct clock_event_device *dev)
+{
+	unsigned long flags;
+
+	BUG_ON(!dev->event_handler);
+
+	dev->next_event.tv64 = KTIME_MAX;
+
+	spin_lock_irqsave(&clockevents_lock, flags);
+	list_add(&dev->list, &clockevent_devices);
+	spin_unlock_irqrestore(&clockevents_lock, flags);
+}
+EXPORT_SYMBOL_GPL(clockevents_register_device);
+
+/**
+ * clockevents_get_oneshot_device - find the best one-shot device of a cpu
+ * @cpu:	cpu which is going to handle the events
+ *
+ * Returns the highest rated device which can do one-shot events and
+ * interrupts @cpu only, or NULL if there is none.
+ */
+struct clock_event_device *clockevents_get_oneshot_device(int cpu)
+{
+	struct clock_event_device *dev, *best = NULL;
+	cpumask_t mask = cpumask_of_cpu(cpu);
+	unsigned long flags;
+
+	spin_lock_irqsave(&clockevents_lock, flags);
+	list_for_each_entry(dev, &clockevent_devices, list) {
+		if (!(dev->features & CLOCK_EVT_FEAT_ONESHOT))
+			continue;
+		if (!cpus_equal(dev->cpumask, mask))
+			continue;
+		if (!best || dev->rating > best->rating)
+			best = dev;
+	}
+	spin_unlock_irqrestore(&clockevents_lock, flags);
+
+	return best;
+}
+
+#ifdef CONFIG_PROC_FS
+static const char *clockevent_modes[] = {
+	[CLOCK_EVT_MODE_UNUSED]		= "unused",
+	[CLOCK_EVT_MODE_SHUTDOWN]	= "shutdown",
+	[CLOCK_EVT_MODE_PERIODIC]	= "periodic",
+	[CLOCK_EVT_MODE_ONESHOT]	= "oneshot",
+};
+
+/*
+ * Print the registered devices, for /proc/timer_list
+ */
+void clockevents_print_devices(struct seq_file *m)
+{
+	struct clock_event_device *dev;
+	char symname[KSYM_NAME_LEN+1];
+	unsigned long flags;
+	int i = 0;
+
+	spin_lock_irqsave(&clockevents_lock, flags);
+	list_for_each_entry(dev, &clockevent_devices, list) {
+		char *modname;
+		const char *sym;
+		unsigned long size, offset;
+
+		seq_printf(m, "\nClock event device #%d: %s\n", i++, dev->name);
+		seq_printf(m, " cpumask:       %08lx\n", cpus_addr(dev->cpumask)[0]);
+		seq_printf(m, " features:      %s%s\n",
+			   dev->features & CLOCK_EVT_FEAT_PERIODIC ?
+			   "periodic " : "",
+			   dev->features & CLOCK_EVT_FEAT_ONESHOT ? "oneshot" : "");
+		seq_printf(m, " rating:        %d\n", dev->rating);
+		seq_printf(m, " max_delta_ns:  %lu\n", dev->max_delta_ns);
+		seq_printf(m, " min_delta_ns:  %lu\n", dev->min_delta_ns);
+		seq_printf(m, " mult:          %lu\n", dev->mult);
+		seq_printf(m, " shift:         %d\n", dev->shift);
+		seq_printf(m, " mode:          %s\n", clockevent_modes[dev->mode]);
+		seq_printf(m, " next_event:    %Ld nsecs\n",
+			   (long long) ktime_to_ns(dev->next_event));
+
+		sym = kallsyms_lookup((unsigned long)dev->event_handler, &size,
+				      &offset, &modname, symname);
+		if (sym)
+			seq_printf(m, " event_handler: %s\n", sym);
+		else
+			seq_printf(m, " event_handler: <%p>\n",
+				   dev->event_handler);
+	}
+	spin_unlock_irqrestore(&clockevents_lock, flags);
+}
+#endif
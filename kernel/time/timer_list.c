@@ -0,0 +1,149 @@
+/*
+ * kernel/time/timer_list.c
+ *
+ * List pending hrtimers and the clock event devices in /proc/timer_list
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <linux/proc_fs.h>
+#include <linux/module.h>
+#include <linux/spinlock.h>
+#include <linux/sched.h>
+#include <linux/seq_file.h>
+#include <linux/kallsyms.h>
+#include <linux/hrtimer.h>
+#include <linux/clockchips.h>
+
+/*
+ * bump this up when changing the output format or the meaning of an existing
+ * format, so that tools can adapt (or abort)
+ */
+#define TIMER_LIST_VERSION 1
+
+#define P(x) \
+	seq_printf(m, "  .%-15s: %Lu\n", #x, (unsigned long long)(x))
+
+#define P_ns(x) \
+	seq_printf(m, "  .%-15s: %Ld nsecs\n", #x, \
+		   (long long)ktime_to_ns(x))
+
+static void print_name_offset(struct seq_file *m, void *sym)
+{
+	unsigned long addr = (unsigned long)sym;
+	char namebuf[KSYM_NAME_LEN+1];
+	unsigned long size, offset;
+	const char *sym_name;
+	char *modname;
+
+	sym_name = kallsyms_lookup(addr, &size, &offset, &modname, namebuf);
+	if (sym_name)
+		seq_printf(m, "%s", sym_name);
+	else
+		seq_printf(m, "<%p>", sym);
+}
+
+static void print_timer(struct seq_file *m, struct hrtimer *timer, int idx,
+			ktime_t now)
+{
+	seq_printf(m, " #%d: <%p>, ", idx, timer);
+	print_name_offset(m, timer->function);
+	seq_printf(m, "\n # expires at %Ld nsecs [in %Ld nsecs]\n",
+		   (long long)ktime_to_ns(timer->expires),
+		   (long long)ktime_to_ns(ktime_sub(timer->expires, now)));
+}
+
+static void print_active_timers(struct seq_file *m, struct hrtimer_base *base,
+				ktime_t now)
+{
+	struct rb_node *node;
+	unsigned long flags;
+	int idx = 0;
+
+	seq_printf(m, "active timers:\n");
+
+	spin_lock_irqsave(&base->lock, flags);
+	for (node = rb_first(&base->active); node; node = rb_next(node))
+		print_timer(m, rb_entry(node, struct hrtimer, node), idx++,
+			    now);
+	spin_unlock_irqrestore(&base->lock, flags);
+}
+
+static void print_base(struct seq_file *m, struct hrtimer_base *base)
+{
+	seq_printf(m, "  .index:      %d\n", base->index);
+	seq_printf(m, "  .resolution: %Ld nsecs\n",
+		   (long long)ktime_to_ns(base->resolution));
+	seq_printf(m, "  .get_time:   ");
+	print_name_offset(m, base->get_time);
+	seq_printf(m, "\n");
+	print_active_timers(m, base, base->get_time());
+}
+
+static void print_cpu(struct seq_file *m, int cpu)
+{
+	struct hrtimer_base *base = hrtimer_cpu_bases(cpu);
+	struct hrtimer_hres *hres = hrtimer_cpu_hres(cpu);
+	struct clock_event_device *dev = hres->dev;
+	int i;
+
+	seq_printf(m, "\ncpu: %d\n", cpu);
+	for (i = 0; i < MAX_HRTIMER_BASES; i++) {
+		seq_printf(m, " clock %d:\n", i);
+		print_base(m, base + i);
+	}
+
+	P(hres->active);
+	if (!hres->active)
+		return;
+	P_ns(hres->expires_next);
+	P(hres->nr_events);
+	if (dev)
+		seq_printf(m, "  .%-15s: %s\n", "device", dev->name);
+}
+
+static int timer_list_show(struct seq_file *m, void *v)
+{
+	int cpu;
+
+	seq_printf(m, "Timer List Version: v%d\n", TIMER_LIST_VERSION);
+	seq_printf(m, "HRTIMER_MAX_CLOCK_BASES: %d\n", MAX_HRTIMER_BASES);
+
+	for_each_online_cpu(cpu)
+		print_cpu(m, cpu);
+
+#ifdef CONFIG_GENERIC_CLOCKEVENTS
+	clockevents_print_devices(m);
+#endif
+	seq_printf(m, "\n");
+
+	return 0;
+}
+
+static int timer_list_open(struct inode *inode, struct file *filp)
+{
+	return single_open(filp, timer_list_show, NULL);
+}
+
+static struct file_operations timer_list_fops = {
+	.open		= timer_list_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+static int __init init_timer_list_procfs(void)
+{
+	struct proc_dir_entry *pe;
+
+	pe = create_proc_entry("timer_list", 0444, NULL);
+	if (!pe)
+		return -ENOMEM;
+
+	pe->proc_fops = &timer_list_fops;
+
+	return 0;
+}
+module_init(init_timer_list_procfs);
@@ -34,6 +34,7 @@
 #include <linux/cpu.h>
 #include <linux/syscalls.h>
 #include <linux/delay.h>
+#include <linux/perf_counter.h>
 
 #include <asm/uaccess.h>
 #include <asm/unistd.h>
@@ -78,6 +79,8 @@ struct tvec_t_base_s {
 	tvec_t tv3;
 	tvec_t tv4;
 	tvec_t tv5;
+	tvec_root_t tv1_next;
+	struct list_head cascade[3];
 } ____cacheline_aligned_in_smp;
 
 typedef struct tvec_t_base_s tvec_base_t;
@@ -86,6 +89,36 @@ tvec_base_t boot_tvec_bases;
 EXPORT_SYMBOL(boot_tvec_bases);
 static DEFINE_PER_CPU(tvec_base_t *, tvec_bases) = &boot_tvec_bases;
 
+/*
+ * Note that all tvec_bases are cacheline aligned and the lower bit of
+ * base in timer_list is guaranteed to be zero. Use the LSB to flag a
+ * deferrable timer.
+ */
+#define TBASE_DEFERRABLE_FLAG		(0x1)
+
+static inline unsigned int tbase_get_deferrable(tvec_base_t *base)
+{
+	return (unsigned int)((unsigned long)base & TBASE_DEFERRABLE_FLAG);
+}
+
+static inline tvec_base_t *tbase_get_base(tvec_base_t *base)
+{
+	return (tvec_base_t *)((unsigned long)base & ~TBASE_DEFERRABLE_FLAG);
+}
+
+static inline void timer_set_deferrable(struct timer_list *timer)
+{
+	timer->base = (tvec_base_t *)((unsigned long)timer->base |
+				      TBASE_DEFERRABLE_FLAG);
+}
+
+static inline void
+timer_set_base(struct timer_list *timer, tvec_base_t *new_base)
+{
+	timer->base = (tvec_base_t *)((unsigned long)new_base |
+				      tbase_get_deferrable(timer->base));
+}
+
 static inline void set_running_timer(tvec_base_t *base,
 					struct timer_list *timer)
 {
@@ -100,7 +133,10 @@ static void internal_add_timer(tvec_base_t *base, struct timer_list *timer)
 	unsigned long idx = expires - base->timer_jiffies;
 	struct list_head *vec;
 
-	if (idx < TVR_SIZE) {
+	if ((expires >> TVR_BITS) == (base->timer_jiffies >> TVR_BITS) + 1) {
+		/* The next round of tv1, see cascade_ahead(): */
+		vec = base->tv1_next.vec + (expires & TVR_MASK);
+	} else if (idx < TVR_SIZE) {
 		int i = expires & TVR_MASK;
 		vec = base->tv1.vec + i;
 	} else if (idx < 1 << (TVR_BITS + TVN_BITS)) {
@@ -150,6 +186,22 @@ void fastcall init_timer(struct timer_list *timer)
 }
 EXPORT_SYMBOL(init_timer);
 
+/***
+ * init_timer_deferrable - initialize a deferrable timer.
+ * @timer: the timer to be initialized
+ *
+ * A deferrable timer works as a normal timer, except that an idle cpu
+ * is not woken up for it: it runs at the first tick after its expiry
+ * time, once the cpu is busy again. Meant for housekeeping work which
+ * can wait.
+ */
+void fastcall init_timer_deferrable(struct timer_list *timer)
+{
+	init_timer(timer);
+	timer_set_deferrable(timer);
+}
+EXPORT_SYMBOL(init_timer_deferrable);
+
 static inline void detach_timer(struct timer_list *timer,
 					int clear_pending)
 {
@@ -179,10 +231,11 @@ static tvec_base_t *lock_timer_base(struct timer_list *timer,
 	tvec_base_t *base;
 
 	for (;;) {
-		base = timer->base;
+		tvec_base_t *prelock_base = timer->base;
+		base = tbase_get_base(prelock_base);
 		if (likely(base != NULL)) {
 			spin_lock_irqsave(&base->lock, *flags);
-			if (likely(base == timer->base))
+			if (likely(prelock_base == timer->base))
 				return base;
 			/* The timer has migrated to another CPU */
 			spin_unlock_irqrestore(&base->lock, *flags);
@@ -218,11 +271,11 @@ int __mod_timer(struct timer_list *timer, unsigned long expires)
 		 */
 		if (likely(base->running_timer != timer)) {
 			/* See the comment in lock_timer_base() */
-			timer->base = NULL;
+			timer_set_base(timer, NULL);
 			spin_unlock(&base->lock);
 			base = new_base;
 			spin_lock(&base->lock);
-			timer->base = base;
+			timer_set_base(timer, base);
 		}
 	}
 
@@ -249,7 +302,7 @@ void add_timer_on(struct timer_list *timer, int cpu)
 
   	BUG_ON(timer_pending(timer) || !timer->function);
 	spin_lock_irqsave(&base->lock, flags);
-	timer->base = base;
+	timer_set_base(timer, base);
 	internal_add_timer(base, timer);
 	spin_unlock_irqrestore(&base->lock, flags);
 }
@@ -394,7 +447,7 @@ static int cascade(tvec_base_t *base, tvec_t *tv, int index)
 	 * don't have to detach them individually.
 	 */
 	list_for_each_entry_safe(timer, tmp, &tv_list, entry) {
-		BUG_ON(timer->base != base);
+		BUG_ON(tbase_get_base(timer->base) != base);
 		internal_add_timer(base, timer);
 	}
 
@@ -408,7 +461,91 @@ static int cascade(tvec_base_t *base, tvec_t *tv, int index)
  * This function cascades all vectors and executes all expired timer
  * vectors.
  */
-#define INDEX(N) ((base->timer_jiffies >> (TVR_BITS + (N) * TVN_BITS)) & TVN_MASK)
+#define LVL_SHIFT(N) (TVR_BITS + (N) * TVN_BITS)
+#define INDEX(N) ((base->timer_jiffies >> LVL_SHIFT(N)) & TVN_MASK)
+
+/*
+ * Cascading ahead of time:
+ *
+ * A tv2 bucket holds the timers of one round of tv1, and a tv3-tv5
+ * bucket those of one round of the level below. Re-hashing such a
+ * bucket in one go when its round starts costs a softirq spike with
+ * many timers pending, so the buckets are drained ahead of time,
+ * CASCADE_BATCH timers at each tick:
+ *
+ *  - the tv2 bucket of the next round goes into tv1_next, which is
+ *    spliced into tv1 when the round starts;
+ *  - a tv3-tv5 bucket is moved onto the cascade list of its level one
+ *    round of the level below before its boundary, and re-hashed from
+ *    there.
+ *
+ * Whatever is left is cascaded at the boundary as before, so a timer
+ * never runs late.
+ */
+#define CASCADE_BATCH 64
+
+static tvec_t *upper_tv(tvec_base_t *base, int n)
+{
+	tvec_t *tv[] = { &base->tv2, &base->tv3, &base->tv4, &base->tv5 };
+
+	return tv[n];
+}
+
+/*
+ * Re-hash up to @count timers of @head, all of them if @count is
+ * negative.
+ */
+static void cascade_list(tvec_base_t *base, struct list_head *head, int count)
+{
+	struct timer_list *timer;
+
+	while (count-- && !list_empty(head)) {
+		timer = list_entry(head->next, struct timer_list, entry);
+		BUG_ON(tbase_get_base(timer->base) != base);
+		detach_timer(timer, 0);
+		internal_add_timer(base, timer);
+	}
+}
+
+/* Called at every tick, with the base lock held. */
+static void cascade_ahead(tvec_base_t *base)
+{
+	int n;
+
+	cascade_list(base, base->tv2.vec + ((INDEX(0) + 1) & TVN_MASK),
+		     CASCADE_BATCH);
+	for (n = 0; n < 3; n++)
+		cascade_list(base, base->cascade + n, CASCADE_BATCH);
+}
+
+/* Called when a round of tv1 starts, with the base lock held. */
+static void cascade_round(tvec_base_t *base)
+{
+	int i, n;
+
+	for (i = 0; i < TVR_SIZE; i++)
+		list_splice_init(base->tv1_next.vec + i, base->tv1.vec + i);
+	cascade(base, &base->tv2, INDEX(0));
+
+	/* The boundaries of tv3-tv5: */
+	for (n = 0; n < 3 && !INDEX(n); n++) {
+		cascade_list(base, base->cascade + n, -1);
+		cascade(base, upper_tv(base, n + 1), INDEX(n + 1));
+	}
+
+	/* Stage the buckets whose boundary is one round ahead: */
+	for (n = 0; n < 3; n++) {
+		unsigned long round = base->timer_jiffies >> LVL_SHIFT(n);
+
+		if (base->timer_jiffies & ((1UL << LVL_SHIFT(n)) - 1))
+			break;
+		if ((round + 1) & TVN_MASK)
+			continue;
+		i = ((base->timer_jiffies >> LVL_SHIFT(n + 1)) + 1) & TVN_MASK;
+		list_splice_init(upper_tv(base, n + 1)->vec + i,
+				 base->cascade + n);
+	}
+}
 
 static inline void __run_timers(tvec_base_t *base)
 {
@@ -423,13 +560,10 @@ static inline void __run_timers(tvec_base_t *base)
 		/*
 		 * Cascade timers:
 		 */
-		if (!index &&
-			(!cascade(base, &base->tv2, INDEX(0))) &&
-				(!cascade(base, &base->tv3, INDEX(1))) &&
-					!cascade(base, &base->tv4, INDEX(2)))
-			cascade(base, &base->tv5, INDEX(3));
-		++base->timer_jiffies;
+		cascade_ahead(base);
 		list_replace_init(base->tv1.vec + index, &work_list);
+		if (!(++base->timer_jiffies & TVR_MASK))
+			cascade_round(base);
 		while (!list_empty(head)) {
 			void (*fn)(unsigned long);
 			unsigned long data;
@@ -461,6 +595,82 @@ static inline void __run_timers(tvec_base_t *base)
 }
 
 #ifdef CONFIG_NO_IDLE_HZ
+/*
+ * Find the expiry of the first timer of the base, ignoring deferrable
+ * timers. Called with the base lock held.
+ */
+static unsigned long __next_timer_interrupt(tvec_base_t *base)
+{
+	unsigned long timer_jiffies = base->timer_jiffies;
+	unsigned long expires = timer_jiffies + (LONG_MAX >> 1);
+	int index, slot, array, n, found = 0;
+	struct timer_list *nte;
+
+	/* Look for timer events in the rest of this round, in tv1. */
+	for (slot = timer_jiffies & TVR_MASK; slot < TVR_SIZE; slot++) {
+		list_for_each_entry(nte, base->tv1.vec + slot, entry) {
+			if (!tbase_get_deferrable(nte->base))
+				return nte->expires;
+		}
+	}
+
+	/* The next round is in tv1_next, and what is left in tv2. */
+	for (slot = 0; slot < TVR_SIZE && !found; slot++) {
+		list_for_each_entry(nte, base->tv1_next.vec + slot, entry) {
+			if (!tbase_get_deferrable(nte->base)) {
+				expires = nte->expires;
+				found = 1;
+				break;
+			}
+		}
+	}
+
+	/* Buckets staged for cascading expire from their boundary on. */
+	for (n = 0; n < 3; n++) {
+		unsigned long boundary;
+
+		if (list_empty(base->cascade + n))
+			continue;
+		boundary = ((timer_jiffies >> LVL_SHIFT(n + 1)) + 1) <<
+			LVL_SHIFT(n + 1);
+		if (time_before(boundary, expires))
+			expires = boundary;
+	}
+
+	/* Check tv2-tv5, starting at the bucket of the next round. */
+	timer_jiffies = (timer_jiffies >> TVR_BITS) + 1;
+	for (array = 0; array < 4; array++) {
+		tvec_t *varp = upper_tv(base, array);
+
+		index = slot = timer_jiffies & TVN_MASK;
+		do {
+			list_for_each_entry(nte, varp->vec + slot, entry) {
+				if (tbase_get_deferrable(nte->base))
+					continue;
+				found = 1;
+				if (time_before(nte->expires, expires))
+					expires = nte->expires;
+			}
+			/*
+			 * Do we still search for the first timer or are
+			 * we looking up the cascade buckets ?
+			 */
+			if (found) {
+				/* Look at the cascade bucket(s)? */
+				if (!index || slot < index)
+					break;
+				return expires;
+			}
+			slot = (slot + 1) & TVN_MASK;
+		} while (slot != index);
+
+		if (index)
+			timer_jiffies += TVN_SIZE - index;
+		timer_jiffies >>= TVN_BITS;
+	}
+	return expires;
+}
+
 /*
  * Find out when the next timer event is due to happen. This
  * is used on S/390 to stop all activity when a cpus is idle.
@@ -469,13 +679,9 @@ static inline void __run_timers(tvec_base_t *base)
 unsigned long next_timer_interrupt(void)
 {
 	tvec_base_t *base;
-	struct list_head *list;
-	struct timer_list *nte;
 	unsigned long expires;
 	unsigned long hr_expires = MAX_JIFFY_OFFSET;
 	ktime_t hr_delta;
-	tvec_t *varray[4];
-	int i, j;
 
 	hr_delta = hrtimer_get_next_event();
 	if (hr_delta.tv64 != KTIME_MAX) {
@@ -489,53 +695,7 @@ unsigned long next_timer_interrupt(void)
 
 	base = __get_cpu_var(tvec_bases);
 	spin_lock(&base->lock);
-	expires = base->timer_jiffies + (LONG_MAX >> 1);
-	list = NULL;
-
-	/* Look for timer events in tv1. */
-	j = base->timer_jiffies & TVR_MASK;
-	do {
-		list_for_each_entry(nte, base->tv1.vec + j, entry) {
-			expires = nte->expires;
-			if (j < (base->timer_jiffies & TVR_MASK))
-				list = base->tv2.vec + (INDEX(0));
-			goto found;
-		}
-		j = (j + 1) & TVR_MASK;
-	} while (j != (base->timer_jiffies & TVR_MASK));
-
-	/* Check tv2-tv5. */
-	varray[0] = &base->tv2;
-	varray[1] = &base->tv3;
-	varray[2] = &base->tv4;
-	varray[3] = &base->tv5;
-	for (i = 0; i < 4; i++) {
-		j = INDEX(i);
-		do {
-			if (list_empty(varray[i]->vec + j)) {
-				j = (j + 1) & TVN_MASK;
-				continue;
-			}
-			list_for_each_entry(nte, varray[i]->vec + j, entry)
-				if (time_before(nte->expires, expires))
-					expires = nte->expires;
-			if (j < (INDEX(i)) && i < 3)
-				list = varray[i + 1]->vec + (INDEX(i + 1));
-			goto found;
-		} while (j != (INDEX(i)));
-	}
-found:
-	if (list) {
-		/*
-		 * The search wrapped. We need to look at the next list
-		 * from next tv element that would cascade into tv element
-		 * where we found the timer element.
-		 */
-		list_for_each_entry(nte, list, entry) {
-			if (time_before(nte->expires, expires))
-				expires = nte->expires;
-		}
-	}
+	expires = __next_timer_interrupt(base);
 	spin_unlock(&base->lock);
 
 	/*
@@ -895,6 +1055,8 @@ int do_settimeofday(struct timespec *tv)
 	clock->error = 0;
 	ntp_clear();
 
+	update_vsyscall(&xtime, clock);
+
 	write_sequnlock_irqrestore(&xtime_lock, flags);
 
 	/* signal hrtimers about time change */
@@ -1165,6 +1327,8 @@ static void update_wall_time(void)
 		clock->xtime_nsec = 0;
 		clocksource_calculate_interval(clock, tick_nsec);
 	}
+
+	update_vsyscall(&xtime, clock);
 }
 
 /*
@@ -1185,7 +1349,9 @@ void update_process_times(int user_tick)
 	if (rcu_pending(cpu))
 		rcu_check_callbacks(cpu, user_tick);
 	scheduler_tick();
+	printk_tick();
  	run_posix_cpu_timers(p);
+	perf_counter_do_pending();
 }
 
 /*
@@ -1609,8 +1775,12 @@ static int __devinit init_timers_cpu(int cpu)
 		INIT_LIST_HEAD(base->tv3.vec + j);
 		INIT_LIST_HEAD(base->tv2.vec + j);
 	}
-	for (j = 0; j < TVR_SIZE; j++)
+	for (j = 0; j < TVR_SIZE; j++) {
 		INIT_LIST_HEAD(base->tv1.vec + j);
+		INIT_LIST_HEAD(base->tv1_next.vec + j);
+	}
+	for (j = 0; j < 3; j++)
+		INIT_LIST_HEAD(base->cascade + j);
 
 	base->timer_jiffies = jiffies;
 	return 0;
@@ -1624,7 +1794,7 @@ static void migrate_timer_list(tvec_base_t *new_base, struct list_head *head)
 	while (!list_empty(head)) {
 		timer = list_entry(head->next, struct timer_list, entry);
 		detach_timer(timer, 0);
-		timer->base = new_base;
+		timer_set_base(timer, new_base);
 		internal_add_timer(new_base, timer);
 	}
 }
@@ -1645,8 +1815,12 @@ static void __devinit migrate_timers(int cpu)
 
 	BUG_ON(old_base->running_timer);
 
-	for (i = 0; i < TVR_SIZE; i++)
+	for (i = 0; i < TVR_SIZE; i++) {
 		migrate_timer_list(new_base, old_base->tv1.vec + i);
+		migrate_timer_list(new_base, old_base->tv1_next.vec + i);
+	}
+	for (i = 0; i < 3; i++)
+		migrate_timer_list(new_base, old_base->cascade + i);
 	for (i = 0; i < TVN_SIZE; i++) {
 		migrate_timer_list(new_base, old_base->tv2.vec + i);
 		migrate_timer_list(new_base, old_base->tv3.vec + i);
@@ -0,0 +1,164 @@
+/*
+ * kernel/trace_buffer.c
+ *
+ * Per cpu lockless ring buffers for trace records, see
+ * <linux/trace_buffer.h>.
+ *
+ * head and tail only ever grow, and are taken modulo the size of the
+ * buffer to index it.  The writer reads tail before it overwrites the
+ * space the reader gave back, and publishes head after the record; the
+ * reader reads head before the records, and gives their space back by
+ * moving tail once it has copied them.
+ */
+
+#include <linux/trace_buffer.h>
+#include <linux/module.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/smp.h>
+#include <linux/cpumask.h>
+#include <asm/uaccess.h>
+
+/**
+ * trace_buffer_alloc - allocate per cpu trace buffers
+ * @size: bytes for each cpu, rounded up to a power of two
+ */
+struct trace_buffer *trace_buffer_alloc(unsigned long size)
+{
+	struct trace_cpu_buffer *cpu_buffer;
+	struct trace_buffer *buffer;
+	int cpu;
+
+	buffer = kzalloc(sizeof(*buffer), GFP_KERNEL);
+	if (!buffer)
+		return NULL;
+	buffer->size = roundup_pow_of_two(size);
+
+	for_each_possible_cpu(cpu) {
+		cpu_buffer = kzalloc(sizeof(*cpu_buffer), GFP_KERNEL);
+		if (!cpu_buffer)
+			goto fail;
+		buffer->buffers[cpu] = cpu_buffer;
+		mutex_init(&cpu_buffer->reader_mutex);
+		cpu_buffer->data = vmalloc(buffer->size);
+		if (!cpu_buffer->data)
+			goto fail;
+	}
+	return buffer;
+
+fail:
+	trace_buffer_free(buffer);
+	return NULL;
+}
+EXPORT_SYMBOL_GPL(trace_buffer_alloc);
+
+/* Nothing must be writing or reading any more */
+void trace_buffer_free(struct trace_buffer *buffer)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		if (!buffer->buffers[cpu])
+			continue;
+		vfree(buffer->buffers[cpu]->data);
+		kfree(buffer->buffers[cpu]);
+	}
+	kfree(buffer);
+}
+EXPORT_SYMBOL_GPL(trace_buffer_free);
+
+/**
+ * trace_buffer_write - write a record into the buffer of this cpu
+ * @buffer: the trace buffers
+ * @data: the record
+ * @len: its length
+ *
+ * Returns 0, or -ENOSPC if it was dropped.  May be called from any
+ * context but NMI.
+ */
+int trace_buffer_write(struct trace_buffer *buffer, const void *data,
+		       unsigned int len)
+{
+	struct trace_cpu_buffer *cpu_buffer;
+	unsigned long flags, head, tail, offset, part;
+	int ret = 0;
+
+	local_irq_save(flags);
+	cpu_buffer = buffer->buffers[smp_processor_id()];
+	head = cpu_buffer->head;
+	tail = cpu_buffer->tail;
+	/* what the reader gave back is only overwritten after tail is read */
+	smp_mb();
+	if (head + len - tail > buffer->size) {
+		cpu_buffer->dropped++;
+		ret = -ENOSPC;
+		goto out;
+	}
+
+	offset = head & (buffer->size - 1);
+	part = min_t(unsigned long, len, buffer->size - offset);
+	memcpy(cpu_buffer->data + offset, data, part);
+	memcpy(cpu_buffer->data, data + part, len - part);
+
+	/* the record must be seen before the head that covers it */
+	smp_wmb();
+	cpu_buffer->head = head + len;
+out:
+	local_irq_restore(flags);
+	return ret;
+}
+EXPORT_SYMBOL_GPL(trace_buffer_write);
+
+/**
+ * trace_buffer_read - consume what a cpu has written
+ * @buffer: the trace buffers
+ * @cpu: whose buffer
+ * @ubuf: where to
+ * @cnt: at most so many bytes
+ *
+ * Returns the bytes copied, 0 if there was nothing, or -EFAULT.  A
+ * record that does not fit in @cnt is continued by the next read.
+ */
+ssize_t trace_buffer_read(struct trace_buffer *buffer, int cpu,
+			  char __user *ubuf, size_t cnt)
+{
+	struct trace_cpu_buffer *cpu_buffer = buffer->buffers[cpu];
+	unsigned long head, tail, offset, part;
+	ssize_t ret;
+
+	mutex_lock(&cpu_buffer->reader_mutex);
+	head = cpu_buffer->head;
+	/* pairs with the smp_wmb() in trace_buffer_write() */
+	smp_rmb();
+	tail = cpu_buffer->tail;
+	if (cnt > head - tail)
+		cnt = head - tail;
+
+	offset = tail & (buffer->size - 1);
+	part = min_t(unsigned long, cnt, buffer->size - offset);
+	ret = -EFAULT;
+	if (copy_to_user(ubuf, cpu_buffer->data + offset, part) ||
+	    copy_to_user(ubuf + part, cpu_buffer->data, cnt - part))
+		goto out;
+
+	/* the records are copied before their space is given back */
+	smp_mb();
+	cpu_buffer->tail = tail + cnt;
+	ret = cnt;
+out:
+	mutex_unlock(&cpu_buffer->reader_mutex);
+	return ret;
+}
+EXPORT_SYMBOL_GPL(trace_buffer_read);
+
+/* The records dropped on all cpus */
+unsigned long trace_buffer_dropped(struct trace_buffer *buffer)
+{
+	unsigned long dropped = 0;
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		dropped += buffer->buffers[cpu]->dropped;
+	return dropped;
+}
+EXPORT_SYMBOL_GPL(trace_buffer_dropped);
@@ -0,0 +1,305 @@
+/*
+ * kernel/trace_events.c
+ *
+ * Trace the static tracepoints of the hot paths (context switches and
+ * wakeups, block requests issued and completed, packets sent and
+ * received, pages allocated and freed) into per cpu ring buffers, read
+ * from debugfs trace/cpu<N>.  Writing a mask of (1 << type) to
+ * trace/enabled hooks the probes of those events on and off; the
+ * buffers are allocated the first time any is.  The record format is
+ * in <linux/trace_events.h>.
+ */
+
+#include <linux/trace_events.h>
+#include <linux/trace_buffer.h>
+#include <linux/module.h>
+#include <linux/sched.h>
+#include <linux/fs.h>
+#include <linux/mm.h>
+#include <linux/kdev_t.h>
+#include <linux/blkdev.h>
+#include <linux/genhd.h>
+#include <linux/netdevice.h>
+#include <linux/skbuff.h>
+#include <linux/debugfs.h>
+#include <linux/mutex.h>
+#include <asm/uaccess.h>
+
+#define TRACE_BUFFER_SIZE	(128 * 1024)	/* per cpu */
+
+static struct trace_buffer *trace_event_buffer;
+static unsigned long trace_events_enabled;
+static DEFINE_MUTEX(trace_events_mutex);
+
+static inline void trace_entry_init(struct trace_entry *ent, int type,
+				    int size)
+{
+	ent->type = type;
+	ent->size = size;
+	ent->pid = current->pid;
+	ent->time = sched_clock();
+}
+
+static void probe_sched_switch(struct task_struct *prev,
+			       struct task_struct *next)
+{
+	struct trace_sched_switch t;
+
+	trace_entry_init(&t.ent, TRACE_SCHED_SWITCH, sizeof(t));
+	t.prev_pid = prev->pid;
+	t.next_pid = next->pid;
+	t.prev_prio = prev->prio;
+	t.next_prio = next->prio;
+	t.prev_state = prev->state;
+	trace_buffer_write(trace_event_buffer, &t, sizeof(t));
+}
+
+static void probe_sched_wakeup(struct task_struct *p, int success)
+{
+	struct trace_sched_wakeup t;
+
+	trace_entry_init(&t.ent, TRACE_SCHED_WAKEUP, sizeof(t));
+	t.pid = p->pid;
+	t.prio = p->prio;
+	t.cpu = task_cpu(p);
+	t.success = success;
+	trace_buffer_write(trace_event_buffer, &t, sizeof(t));
+}
+
+#ifdef CONFIG_BLOCK
+static void trace_block_rq(int type, struct request *rq)
+{
+	struct trace_block_rq t;
+	struct gendisk *disk = rq->rq_disk;
+
+	trace_entry_init(&t.ent, type, sizeof(t));
+	t.sector = rq->sector;
+	t.dev = disk ?
+		new_encode_dev(MKDEV(disk->major, disk->first_minor)) : 0;
+	t.nr_sectors = rq->nr_sectors;
+	t.flags = rq->flags;
+	t.errors = rq->errors;
+	trace_buffer_write(trace_event_buffer, &t, sizeof(t));
+}
+
+static void probe_block_rq_issue(struct request_queue *q, struct request *rq)
+{
+	trace_block_rq(TRACE_BLOCK_RQ_ISSUE, rq);
+}
+
+static void probe_block_rq_complete(struct request_queue *q,
+				    struct request *rq)
+{
+	trace_block_rq(TRACE_BLOCK_RQ_COMPLETE, rq);
+}
+#endif
+
+#ifdef CONFIG_NET
+static void trace_net_dev(int type, struct sk_buff *skb)
+{
+	struct trace_net_dev t;
+
+	trace_entry_init(&t.ent, type, sizeof(t));
+	t.ifindex = skb->dev ? skb->dev->ifindex : 0;
+	t.len = skb->len;
+	t.protocol = skb->protocol;
+	memset(t.pad, 0, sizeof(t.pad));
+	trace_buffer_write(trace_event_buffer, &t, sizeof(t));
+}
+
+static void probe_net_dev_xmit(struct sk_buff *skb)
+{
+	trace_net_dev(TRACE_NET_DEV_XMIT, skb);
+}
+
+static void probe_net_dev_receive(struct sk_buff *skb)
+{
+	trace_net_dev(TRACE_NET_DEV_RECEIVE, skb);
+}
+#endif
+
+static void trace_mm_page(int type, struct page *page, unsigned int order,
+			  gfp_t gfp_flags)
+{
+	struct trace_mm_page t;
+
+	trace_entry_init(&t.ent, type, sizeof(t));
+	t.pfn = page ? page_to_pfn(page) : (u64)-1;
+	t.order = order;
+	t.gfp_flags = (__force u32)gfp_flags;
+	trace_buffer_write(trace_event_buffer, &t, sizeof(t));
+}
+
+static void probe_mm_page_alloc(struct page *page, unsigned int order,
+				gfp_t gfp_flags)
+{
+	trace_mm_page(TRACE_MM_PAGE_ALLOC, page, order, gfp_flags);
+}
+
+static void probe_mm_page_free(struct page *page, unsigned int order)
+{
+	trace_mm_page(TRACE_MM_PAGE_FREE, page, order, 0);
+}
+
+/*
+ * Hooking the probes on and off, by event type
+ */
+
+#define TRACE_EVENT_PROBE(type, name)					\
+	[type] = {							\
+		.tp	= &__tracepoint_##name,				\
+		.probe	= probe_##name,					\
+	}
+
+static const struct trace_event_probe {
+	struct tracepoint *tp;
+	void *probe;
+} trace_event_probes[TRACE_NR_EVENTS] = {
+	TRACE_EVENT_PROBE(TRACE_SCHED_SWITCH, sched_switch),
+	TRACE_EVENT_PROBE(TRACE_SCHED_WAKEUP, sched_wakeup),
+#ifdef CONFIG_BLOCK
+	TRACE_EVENT_PROBE(TRACE_BLOCK_RQ_ISSUE, block_rq_issue),
+	TRACE_EVENT_PROBE(TRACE_BLOCK_RQ_COMPLETE, block_rq_complete),
+#endif
+#ifdef CONFIG_NET
+	TRACE_EVENT_PROBE(TRACE_NET_DEV_XMIT, net_dev_xmit),
+	TRACE_EVENT_PROBE(TRACE_NET_DEV_RECEIVE, net_dev_receive),
+#endif
+	TRACE_EVENT_PROBE(TRACE_MM_PAGE_ALLOC, mm_page_alloc),
+	TRACE_EVENT_PROBE(TRACE_MM_PAGE_FREE, mm_page_free),
+};
+
+/* Called with trace_events_mutex held */
+static int trace_events_set(unsigned long mask)
+{
+	const struct trace_event_probe *p;
+	int type, err;
+
+	if (mask && !trace_event_buffer) {
+		trace_event_buffer = trace_buffer_alloc(TRACE_BUFFER_SIZE);
+		if (!trace_event_buffer)
+			return -ENOMEM;
+	}
+
+	for (type = 1; type < TRACE_NR_EVENTS; type++) {
+		p = &trace_event_probes[type];
+		if (!p->probe || !(((mask ^ trace_events_enabled) >> type) & 1))
+			continue;
+		if (mask & (1UL << type)) {
+			/* the buffer is seen by the time the probe runs */
+			err = tracepoint_probe_register(p->tp, p->probe);
+			if (err)
+				return err;
+			trace_events_enabled |= 1UL << type;
+		} else {
+			tracepoint_probe_unregister(p->tp, p->probe);
+			trace_events_enabled &= ~(1UL << type);
+		}
+	}
+	return 0;
+}
+
+static ssize_t trace_enabled_read(struct file *filp, char __user *ubuf,
+				  size_t cnt, loff_t *ppos)
+{
+	char buf[32];
+
+	snprintf(buf, sizeof(buf), "%#lx\n", trace_events_enabled);
+
+	return simple_read_from_buffer(ubuf, cnt, ppos, buf, strlen(buf));
+}
+
+static ssize_t trace_enabled_write(struct file *filp, const char __user *ubuf,
+				   size_t cnt, loff_t *ppos)
+{
+	unsigned long mask;
+	char buf[32];
+	int err;
+
+	if (cnt >= sizeof(buf))
+		return -EINVAL;
+	if (copy_from_user(buf, ubuf, cnt))
+		return -EFAULT;
+	buf[cnt] = 0;
+	mask = simple_strtoul(buf, NULL, 0);
+	if (mask & ~((1UL << TRACE_NR_EVENTS) - 2))
+		return -EINVAL;
+
+	mutex_lock(&trace_events_mutex);
+	err = trace_events_set(mask);
+	mutex_unlock(&trace_events_mutex);
+
+	return err ? err : cnt;
+}
+
+static struct file_operations trace_enabled_fops = {
+	.read =		trace_enabled_read,
+	.write =	trace_enabled_write,
+};
+
+static ssize_t trace_dropped_read(struct file *filp, char __user *ubuf,
+				  size_t cnt, loff_t *ppos)
+{
+	unsigned long dropped = 0;
+	char buf[32];
+
+	mutex_lock(&trace_events_mutex);
+	if (trace_event_buffer)
+		dropped = trace_buffer_dropped(trace_event_buffer);
+	mutex_unlock(&trace_events_mutex);
+	snprintf(buf, sizeof(buf), "%lu\n", dropped);
+
+	return simple_read_from_buffer(ubuf, cnt, ppos, buf, strlen(buf));
+}
+
+static struct file_operations trace_dropped_fops = {
+	.read =		trace_dropped_read,
+};
+
+static int trace_cpu_open(struct inode *inode, struct file *filp)
+{
+	filp->private_data = inode->u.generic_ip;
+	return 0;
+}
+
+/* Consumes the records read; 0 when there are none left for now */
+static ssize_t trace_cpu_read(struct file *filp, char __user *ubuf,
+			      size_t cnt, loff_t *ppos)
+{
+	int cpu = (long)filp->private_data;
+	struct trace_buffer *buffer;
+
+	mutex_lock(&trace_events_mutex);
+	buffer = trace_event_buffer;
+	mutex_unlock(&trace_events_mutex);
+	if (!buffer)
+		return 0;
+
+	return trace_buffer_read(buffer, cpu, ubuf, cnt);
+}
+
+static struct file_operations trace_cpu_fops = {
+	.open =		trace_cpu_open,
+	.read =		trace_cpu_read,
+};
+
+static int __init trace_events_init(void)
+{
+	struct dentry *dir;
+	char name[16];
+	int cpu;
+
+	dir = debugfs_create_dir("trace", NULL);
+	if (!dir)
+		return -ENOMEM;
+
+	debugfs_create_file("enabled", 0600, dir, NULL, &trace_enabled_fops);
+	debugfs_create_file("dropped", 0444, dir, NULL, &trace_dropped_fops);
+	for_each_possible_cpu(cpu) {
+		snprintf(name, sizeof(name), "cpu%d", cpu);
+		debugfs_create_file(name, 0400, dir, (void *)(long)cpu,
+				    &trace_cpu_fops);
+	}
+	return 0;
+}
+late_initcall(trace_events_init);
@@ -0,0 +1,118 @@
+/*
+ * kernel/tracepoint.c
+ *
+ * Hooking probes on and off static tracepoints, see
+ * <linux/tracepoint.h>.
+ *
+ * The probes of a tracepoint are an array that is replaced as a whole
+ * when one is added or removed, and called with preemption off: the
+ * old array is only freed after synchronize_sched(), when no cpu can
+ * be calling through it any more.  That also means a probe is no
+ * longer running once unregistering it has returned.
+ */
+
+#include <linux/tracepoint.h>
+#include <linux/module.h>
+#include <linux/mutex.h>
+#include <linux/slab.h>
+#include <linux/errno.h>
+
+static DEFINE_MUTEX(tracepoints_mutex);
+
+static int tracepoint_nr_probes(void **funcs)
+{
+	int nr = 0;
+
+	if (funcs)
+		while (funcs[nr])
+			nr++;
+	return nr;
+}
+
+static void tracepoint_update(struct tracepoint *tp, void **new)
+{
+	void **old = tp->funcs;
+
+	rcu_assign_pointer(tp->funcs, new);
+	tp->state = new != NULL;
+	if (old) {
+		synchronize_sched();
+		kfree(old);
+	}
+}
+
+/**
+ * tracepoint_probe_register - hook a probe on a tracepoint
+ * @tp: the tracepoint
+ * @probe: a function of the prototype of the tracepoint
+ */
+int tracepoint_probe_register(struct tracepoint *tp, void *probe)
+{
+	void **old, **new;
+	int i, nr, ret = 0;
+
+	mutex_lock(&tracepoints_mutex);
+	old = tp->funcs;
+	nr = tracepoint_nr_probes(old);
+	for (i = 0; i < nr; i++)
+		if (old[i] == probe) {
+			ret = -EEXIST;
+			goto out;
+		}
+
+	new = kmalloc((nr + 2) * sizeof(void *), GFP_KERNEL);
+	if (!new) {
+		ret = -ENOMEM;
+		goto out;
+	}
+	if (nr)
+		memcpy(new, old, nr * sizeof(void *));
+	new[nr] = probe;
+	new[nr + 1] = NULL;
+	tracepoint_update(tp, new);
+out:
+	mutex_unlock(&tracepoints_mutex);
+	return ret;
+}
+EXPORT_SYMBOL_GPL(tracepoint_probe_register);
+
+/**
+ * tracepoint_probe_unregister - unhook a probe from a tracepoint
+ * @tp: the tracepoint
+ * @probe: the probe
+ *
+ * The probe is not running anywhere once this has returned.
+ */
+int tracepoint_probe_unregister(struct tracepoint *tp, void *probe)
+{
+	void **old, **new = NULL;
+	int i, j, nr, ret = 0;
+
+	mutex_lock(&tracepoints_mutex);
+	old = tp->funcs;
+	nr = tracepoint_nr_probes(old);
+	for (i = 0; i < nr; i++)
+		if (old[i] == probe)
+			break;
+	if (i == nr) {
+		ret = -ENOENT;
+		goto out;
+	}
+
+	if (nr > 1) {
+		new = kmalloc(nr * sizeof(void *), GFP_KERNEL);
+		if (!new) {
+			ret = -ENOMEM;
+			goto out;
+		}
+		for (i = 0, j = 0; i < nr; i++)
+			if (old[i] != probe)
+				new[j++] = old[i];
+		new[j] = NULL;
+	}
+	tracepoint_update(tp, new);
+out:
+	mutex_unlock(&tracepoints_mutex);
+	return ret;
+}
+EXPORT_SYMBOL_GPL(tracepoint_probe_unregister);
@@ -14,6 +14,15 @@
  *   Theodore Ts'o <tytso@mit.edu>
  *
  * Made to use alloc_percpu by Christoph Lameter <clameter@sgi.com>.
+ *
+ * Workqueues no longer have threads of their own.  Each cpu has one
+ * pool of workers which serves all of them, and which the scheduler
+ * tells when a worker blocks: works on a cpu run one after another in
+ * a single worker for as long as none of them sleeps, and another
+ * worker takes over the rest when one does.  Workers are created as
+ * they are needed and reaped after they have been idle for a while, so
+ * a system has a few of them per cpu rather than one for each
+ * workqueue and cpu.
  */
 
 #include <linux/module.h>
@@ -28,69 +37,336 @@
 #include <linux/notifier.h>
 #include <linux/kthread.h>
 #include <linux/hardirq.h>
+#include <linux/mutex.h>
+#include <asm/atomic.h>
+
+#include "workqueue_sched.h"
 
 /*
- * The per-CPU workqueue (if single thread, we always use the first
- * possible cpu).
- *
- * The sequence counters are for flush_scheduled_work().  It wants to wait
- * until until all currently-scheduled works are completed, but it doesn't
- * want to be livelocked by new, incoming ones.  So it waits until
- * remove_sequence is >= the insert_sequence which pertained when
- * flush_scheduled_work() was called.
+ * From being queued until it has run, a work is counted in its cwq's
+ * nr_in_flight[] under the flush color its workqueue had at the time,
+ * which is kept in the work's pending word next to the pending bit.
+ * flush_workqueue() flips the workqueue's color and waits for the old
+ * one to drain.
  */
-struct cpu_workqueue_struct {
+#define WORK_STRUCT_PENDING	0
+#define WORK_STRUCT_COLOR	1
+
+enum {
+	/* worker_pool flags */
+	POOL_MANAGING		= 1 << 0,	/* a worker manages the pool */
+	POOL_MANAGE_WORKERS	= 1 << 1,	/* idle workers to reap */
+	POOL_DISASSOCIATED	= 1 << 2,	/* the cpu is down */
+
+	/* worker flags */
+	WORKER_PREP		= 1 << 0,	/* between works */
+	WORKER_IDLE		= 1 << 1,	/* on the idle list */
+	WORKER_DIE		= 1 << 2,	/* to exit when woken */
+	WORKER_ROGUE		= 1 << 3,	/* its cpu went down */
+	WORKER_RESCUER		= 1 << 4,	/* a workqueue's rescuer */
+
+	/* not counted in the pool's nr_running */
+	WORKER_NOT_RUNNING	= WORKER_PREP | WORKER_IDLE | WORKER_ROGUE |
+				  WORKER_RESCUER,
+
+	NR_IDLE_WORKERS_KEEP	= 2,		/* idle workers never reaped */
+	IDLE_WORKER_RATIO	= 4,		/* 1 idle per 4 busy kept */
+
+	IDLE_WORKER_TIMEOUT	= 300 * HZ,	/* reap after 5 minutes idle */
+	MAYDAY_INITIAL_TIMEOUT	= HZ / 100 >= 2 ? HZ / 100 : 2,
+						/* call the rescuers after 10ms */
+	MAYDAY_INTERVAL		= HZ / 10,	/* and then every 100ms */
+	CREATE_COOLDOWN		= HZ,		/* after a failed creation */
+};
 
-	spinlock_t lock;
+/*
+ * The workers of one cpu.  nr_running counts those that are running
+ * works, as opposed to asleep in one or between them: the worker
+ * itself keeps it as it goes in and out of the WORKER_NOT_RUNNING
+ * states, and the scheduler hooks as it blocks and wakes up.  When it
+ * drops to zero with works left on the worklist, an idle worker is
+ * woken to carry on.  Everything else is protected by the lock.
+ */
+struct worker_pool {
+	spinlock_t		lock;
+	unsigned int		cpu;
+	unsigned int		flags;
 
-	long remove_sequence;	/* Least-recently added (next to run) */
-	long insert_sequence;	/* Next to add */
+	struct list_head	worklist;	/* works ready to run */
+	struct list_head	workers;	/* all but the rogue ones */
+	int			nr_workers;
+	int			nr_idle;
 
-	struct list_head worklist;
-	wait_queue_head_t more_work;
-	wait_queue_head_t work_done;
+	struct list_head	idle_list;	/* most recently idle first */
+	struct list_head	busy_list;	/* workers running a work */
+	struct timer_list	idle_timer;	/* reaps idle workers */
+	struct timer_list	mayday_timer;	/* calls the rescuers */
 
-	struct workqueue_struct *wq;
-	struct task_struct *thread;
+	int			next_id;	/* to name the workers */
+
+	/* hit by the scheduler hooks, so given a cacheline of its own */
+	atomic_t		nr_running ____cacheline_aligned_in_smp;
+} ____cacheline_aligned_in_smp;
+
+static DEFINE_PER_CPU(struct worker_pool, worker_pools);
+
+/*
+ * A worker thread.  Its flags are only changed under the pool lock.
+ */
+struct worker {
+	struct list_head	entry;		/* on idle_list or busy_list */
+	struct list_head	node;		/* on the pool's workers */
+	struct work_struct	*current_work;
+	struct cpu_workqueue_struct *current_cwq;
+	int			current_color;
+	int			nr_in_progress[2]; /* works running, by color */
+	struct list_head	scheduled;	/* works waiting on this one */
+	struct task_struct	*task;
+	struct worker_pool	*pool;		/* the one being served */
+	unsigned long		last_active;	/* when it went idle */
+	unsigned int		flags;
+	int			id;
+	int			run_depth;	/* of flushes from its works */
+};
 
-	int run_depth;		/* Detect run_workqueue() recursion depth */
-} ____cacheline_aligned;
+/*
+ * What a workqueue has on one cpu: the works queued there and not yet
+ * run are on the pool's worklist, except for those over max_active,
+ * which wait on delayed_works until one of the active ones is done.
+ * Protected by the pool lock.
+ */
+struct cpu_workqueue_struct {
+	struct worker_pool	*pool;
+	struct workqueue_struct	*wq;
+	int			nr_in_flight[2]; /* queued or running, by color */
+	int			nr_active;	/* on the worklist or running */
+	int			max_active;
+	struct list_head	delayed_works;
+};
 
 /*
  * The externally visible workqueue abstraction is an array of
  * per-CPU workqueues:
  */
 struct workqueue_struct {
+	unsigned int		flags;
 	struct cpu_workqueue_struct *cpu_wq;
-	const char *name;
-	struct list_head list; 	/* Empty if single thread */
+	struct list_head	list;		/* on workqueues */
+	struct mutex		flush_mutex;	/* serializes color flips */
+	int			work_color;	/* of works queued now */
+	wait_queue_head_t	flush_wait;
+	struct worker		*rescuer;	/* if WQ_RESCUER */
+	cpumask_t		mayday_mask;	/* cpus calling the rescuer */
+	const char		*name;
 };
 
-/* All the per-cpu workqueues on the system, for hotplug cpu to add/remove
-   threads to each one as cpus come/go. */
+/* All the workqueues on the system, and the cpu hotplug serialization. */
 static DEFINE_MUTEX(workqueue_mutex);
 static LIST_HEAD(workqueues);
 
+/* Where the works of WQ_SINGLE_CPU workqueues go */
 static int singlethread_cpu;
 
-/* If it's single threaded, it isn't in the list of workqueues. */
-static inline int is_single_threaded(struct workqueue_struct *wq)
+static struct workqueue_struct *keventd_wq;
+
+static inline struct worker_pool *get_pool(unsigned int cpu)
+{
+	return &per_cpu(worker_pools, cpu);
+}
+
+static inline struct cpu_workqueue_struct *get_cwq(unsigned int cpu,
+						   struct workqueue_struct *wq)
+{
+	return per_cpu_ptr(wq->cpu_wq, cpu);
+}
+
+static inline int get_work_color(struct work_struct *work)
+{
+	return test_bit(WORK_STRUCT_COLOR, &work->pending);
+}
+
+static inline void set_work_color(struct work_struct *work, int color)
+{
+	if (color)
+		set_bit(WORK_STRUCT_COLOR, &work->pending);
+	else
+		clear_bit(WORK_STRUCT_COLOR, &work->pending);
+}
+
+static inline struct worker *current_wq_worker(void)
+{
+	if (current->flags & PF_WQ_WORKER)
+		return current->wq_worker;
+	return NULL;
+}
+
+/*
+ * Concurrency management policy.  All called with the pool lock held.
+ */
+
+/* Are there works that no running worker will get to? */
+static inline int need_more_worker(struct worker_pool *pool)
+{
+	return !list_empty(&pool->worklist) && !atomic_read(&pool->nr_running);
+}
+
+/*
+ * A worker only starts on a work if another is idle to take over
+ * should the work block.
+ */
+static inline int may_start_working(struct worker_pool *pool)
 {
-	return list_empty(&wq->list);
+	return pool->nr_idle;
+}
+
+/* Should a worker that is done with a work go on to the next one? */
+static inline int keep_working(struct worker_pool *pool)
+{
+	return !list_empty(&pool->worklist) &&
+		atomic_read(&pool->nr_running) <= 1;
+}
+
+static inline int need_to_create_worker(struct worker_pool *pool)
+{
+	return need_more_worker(pool) && !may_start_working(pool);
+}
+
+static inline int need_to_manage_workers(struct worker_pool *pool)
+{
+	return need_to_create_worker(pool) ||
+		(pool->flags & POOL_MANAGE_WORKERS);
+}
+
+static inline int too_many_workers(struct worker_pool *pool)
+{
+	int nr_idle = pool->nr_idle;
+	int nr_busy = pool->nr_workers - nr_idle;
+
+	return nr_idle > NR_IDLE_WORKERS_KEEP &&
+		(nr_idle - NR_IDLE_WORKERS_KEEP) * IDLE_WORKER_RATIO >= nr_busy;
+}
+
+/*
+ * Wake the worker that went idle last, whose cache is the warmest.  The
+ * workers of a cpu that went down are left to themselves.
+ */
+static void wake_up_worker(struct worker_pool *pool)
+{
+	struct worker *worker;
+
+	if (unlikely(pool->flags & POOL_DISASSOCIATED) ||
+	    list_empty(&pool->idle_list))
+		return;
+	worker = list_entry(pool->idle_list.next, struct worker, entry);
+	wake_up_process(worker->task);
+}
+
+/*
+ * Called with the pool lock held, on the worker's own cpu unless it is
+ * rogue.  nr_running follows the worker in and out of the
+ * WORKER_NOT_RUNNING states.
+ */
+static inline void worker_set_flags(struct worker *worker, unsigned int flags)
+{
+	if ((flags & WORKER_NOT_RUNNING) &&
+	    !(worker->flags & WORKER_NOT_RUNNING))
+		atomic_dec(&worker->pool->nr_running);
+	worker->flags |= flags;
+}
+
+static inline void worker_clr_flags(struct worker *worker, unsigned int flags)
+{
+	unsigned int oflags = worker->flags;
+
+	worker->flags &= ~flags;
+	if ((oflags & WORKER_NOT_RUNNING) &&
+	    !(worker->flags & WORKER_NOT_RUNNING))
+		atomic_inc(&worker->pool->nr_running);
+}
+
+static void worker_enter_idle(struct worker *worker)
+{
+	struct worker_pool *pool = worker->pool;
+
+	worker_set_flags(worker, WORKER_IDLE);
+	pool->nr_idle++;
+	worker->last_active = jiffies;
+	list_add(&worker->entry, &pool->idle_list);
+
+	if (too_many_workers(pool) && !timer_pending(&pool->idle_timer))
+		mod_timer(&pool->idle_timer, jiffies + IDLE_WORKER_TIMEOUT);
+}
+
+static void worker_leave_idle(struct worker *worker)
+{
+	struct worker_pool *pool = worker->pool;
+
+	if (!(worker->flags & WORKER_IDLE))
+		return;
+	worker_clr_flags(worker, WORKER_IDLE);
+	pool->nr_idle--;
+	list_del_init(&worker->entry);
+}
+
+/*
+ * The worker running @work in @pool, if any.  A work may be queued
+ * again while it runs: it must then wait on that worker rather than
+ * run next to itself.
+ */
+static struct worker *find_worker_executing_work(struct worker_pool *pool,
+						 struct work_struct *work)
+{
+	struct worker *worker;
+
+	list_for_each_entry(worker, &pool->busy_list, entry)
+		if (worker->current_work == work)
+			return worker;
+	return NULL;
 }
 
-/* Preempt must be disabled. */
-static void __queue_work(struct cpu_workqueue_struct *cwq,
+static void __queue_work(unsigned int cpu, struct workqueue_struct *wq,
 			 struct work_struct *work)
 {
+	struct cpu_workqueue_struct *cwq;
+	struct worker_pool *pool;
 	unsigned long flags;
+	int color;
+
+	if (wq->flags & WQ_SINGLE_CPU)
+		cpu = singlethread_cpu;
+retry:
+	pool = get_pool(cpu);
+	spin_lock_irqsave(&pool->lock, flags);
+	if (unlikely(pool->flags & POOL_DISASSOCIATED)) {
+		/* The cpu went down: take the one we are on instead. */
+		spin_unlock_irqrestore(&pool->lock, flags);
+		if (wq->flags & WQ_SINGLE_CPU)
+			cpu = singlethread_cpu;
+		else
+			cpu = raw_smp_processor_id();
+		goto retry;
+	}
 
-	spin_lock_irqsave(&cwq->lock, flags);
+	cwq = get_cwq(cpu, wq);
 	work->wq_data = cwq;
-	list_add_tail(&work->entry, &cwq->worklist);
-	cwq->insert_sequence++;
-	wake_up(&cwq->more_work);
-	spin_unlock_irqrestore(&cwq->lock, flags);
+	color = wq->work_color;
+	set_work_color(work, color);
+	cwq->nr_in_flight[color]++;
+
+	if (likely(cwq->nr_active < cwq->max_active)) {
+		cwq->nr_active++;
+		list_add_tail(&work->entry, &pool->worklist);
+		/*
+		 * Pairs with the atomic_dec_and_test() in
+		 * wq_worker_sleeping(): either the worker going to sleep
+		 * sees the work, or we see it has stopped running.
+		 */
+		smp_mb();
+		if (!atomic_read(&pool->nr_running))
+			wake_up_worker(pool);
+	} else
+		list_add_tail(&work->entry, &cwq->delayed_works);
+	spin_unlock_irqrestore(&pool->lock, flags);
 }
 
 /**
@@ -100,35 +376,53 @@ static void __queue_work(struct cpu_workqueue_struct *cwq,
  *
  * Returns non-zero if it was successfully added.
  *
- * We queue the work to the CPU it was submitted, but there is no
- * guarantee that it will be processed by that CPU.
+ * We queue the work to the CPU it was submitted, but if the CPU dies
+ * it can be processed by another CPU.
  */
 int fastcall queue_work(struct workqueue_struct *wq, struct work_struct *work)
 {
-	int ret = 0, cpu = get_cpu();
+	int ret = 0;
 
-	if (!test_and_set_bit(0, &work->pending)) {
-		if (unlikely(is_single_threaded(wq)))
-			cpu = singlethread_cpu;
+	if (!test_and_set_bit(WORK_STRUCT_PENDING, &work->pending)) {
 		BUG_ON(!list_empty(&work->entry));
-		__queue_work(per_cpu_ptr(wq->cpu_wq, cpu), work);
+		__queue_work(get_cpu(), wq, work);
+		put_cpu();
 		ret = 1;
 	}
-	put_cpu();
 	return ret;
 }
 EXPORT_SYMBOL_GPL(queue_work);
 
+/**
+ * queue_work_on - queue work on a specific CPU
+ * @cpu: CPU number to execute work on
+ * @wq: workqueue to use
+ * @work: work to queue
+ *
+ * Returns non-zero if it was successfully added.
+ *
+ * If @cpu is offline the work runs on the CPU it was submitted from.
+ */
+int queue_work_on(int cpu, struct workqueue_struct *wq,
+		  struct work_struct *work)
+{
+	int ret = 0;
+
+	if (!test_and_set_bit(WORK_STRUCT_PENDING, &work->pending)) {
+		BUG_ON(!list_empty(&work->entry));
+		__queue_work(cpu, wq, work);
+		ret = 1;
+	}
+	return ret;
+}
+EXPORT_SYMBOL_GPL(queue_work_on);
+
 static void delayed_work_timer_fn(unsigned long __data)
 {
 	struct work_struct *work = (struct work_struct *)__data;
 	struct workqueue_struct *wq = work->wq_data;
-	int cpu = smp_processor_id();
 
-	if (unlikely(is_single_threaded(wq)))
-		cpu = singlethread_cpu;
-
-	__queue_work(per_cpu_ptr(wq->cpu_wq, cpu), work);
+	__queue_work(smp_processor_id(), wq, work);
 }
 
 /**
@@ -145,7 +439,7 @@ int fastcall queue_delayed_work(struct workqueue_struct *wq,
 	int ret = 0;
 	struct timer_list *timer = &work->timer;
 
-	if (!test_and_set_bit(0, &work->pending)) {
+	if (!test_and_set_bit(WORK_STRUCT_PENDING, &work->pending)) {
 		BUG_ON(timer_pending(timer));
 		BUG_ON(!list_empty(&work->entry));
 
@@ -176,7 +470,7 @@ int queue_delayed_work_on(int cpu, struct workqueue_struct *wq,
 	int ret = 0;
 	struct timer_list *timer = &work->timer;
 
-	if (!test_and_set_bit(0, &work->pending)) {
+	if (!test_and_set_bit(WORK_STRUCT_PENDING, &work->pending)) {
 		BUG_ON(timer_pending(timer));
 		BUG_ON(!list_empty(&work->entry));
 
@@ -192,47 +486,87 @@ int queue_delayed_work_on(int cpu, struct workqueue_struct *wq,
 }
 EXPORT_SYMBOL_GPL(queue_delayed_work_on);
 
-static void run_workqueue(struct cpu_workqueue_struct *cwq)
+/*
+ * A work of @cwq is done: let one of its delayed works in, and wake up
+ * the flushers if that was the last work of its color.
+ */
+static void cwq_dec_nr_in_flight(struct cpu_workqueue_struct *cwq, int color)
 {
-	unsigned long flags;
+	cwq->nr_active--;
+	if (!list_empty(&cwq->delayed_works) &&
+	    cwq->nr_active < cwq->max_active) {
+		struct work_struct *work = list_entry(cwq->delayed_works.next,
+						struct work_struct, entry);
 
-	/*
-	 * Keep taking off work from the queue until
-	 * done.
-	 */
-	spin_lock_irqsave(&cwq->lock, flags);
-	cwq->run_depth++;
-	if (cwq->run_depth > 3) {
-		/* morton gets to eat his hat */
-		printk("%s: recursion depth exceeded: %d\n",
-			__FUNCTION__, cwq->run_depth);
-		dump_stack();
+		list_move_tail(&work->entry, &cwq->pool->worklist);
+		cwq->nr_active++;
 	}
-	while (!list_empty(&cwq->worklist)) {
-		struct work_struct *work = list_entry(cwq->worklist.next,
-						struct work_struct, entry);
-		void (*f) (void *) = work->func;
-		void *data = work->data;
 
-		list_del_init(cwq->worklist.next);
-		spin_unlock_irqrestore(&cwq->lock, flags);
+	if (!--cwq->nr_in_flight[color] &&
+	    waitqueue_active(&cwq->wq->flush_wait))
+		wake_up(&cwq->wq->flush_wait);
+}
+
+/*
+ * Run @work, which is on the pool's worklist or on a worker's scheduled
+ * list.  Called with the pool lock held, which is dropped for the work
+ * function.  A work that flushes its own workqueue gets here again
+ * from inside the function, so what this worker is running is saved
+ * and restored around it.
+ */
+static void process_one_work(struct worker *worker, struct work_struct *work)
+{
+	struct cpu_workqueue_struct *cwq = work->wq_data;
+	struct worker_pool *pool = worker->pool;
+	struct work_struct *prev_work = worker->current_work;
+	struct cpu_workqueue_struct *prev_cwq = worker->current_cwq;
+	int prev_color = worker->current_color;
+	int color = get_work_color(work);
+	void (*f)(void *) = work->func;
+	void *data = work->data;
+	struct worker *collision;
+
+	collision = find_worker_executing_work(pool, work);
+	if (unlikely(collision && collision != worker)) {
+		list_move_tail(&work->entry, &collision->scheduled);
+		return;
+	}
 
-		BUG_ON(work->wq_data != cwq);
-		clear_bit(0, &work->pending);
-		f(data);
+	if (!prev_work)
+		list_add(&worker->entry, &pool->busy_list);
+	worker->current_work = work;
+	worker->current_cwq = cwq;
+	worker->current_color = color;
+	worker->nr_in_progress[color]++;
+	list_del_init(&work->entry);
+	spin_unlock_irq(&pool->lock);
+
+	BUG_ON(cwq->pool != pool);
+	clear_bit(WORK_STRUCT_PENDING, &work->pending);
+	f(data);
+
+	spin_lock_irq(&pool->lock);
+	worker->nr_in_progress[color]--;
+	worker->current_work = prev_work;
+	worker->current_cwq = prev_cwq;
+	worker->current_color = prev_color;
+	if (!prev_work)
+		list_del_init(&worker->entry);
+	cwq_dec_nr_in_flight(cwq, color);
+}
 
-		spin_lock_irqsave(&cwq->lock, flags);
-		cwq->remove_sequence++;
-		wake_up(&cwq->work_done);
+/* Called with the pool lock held */
+static void process_scheduled_works(struct worker *worker)
+{
+	while (!list_empty(&worker->scheduled)) {
+		struct work_struct *work = list_entry(worker->scheduled.next,
+						struct work_struct, entry);
+		process_one_work(worker, work);
 	}
-	cwq->run_depth--;
-	spin_unlock_irqrestore(&cwq->lock, flags);
 }
 
-static int worker_thread(void *__cwq)
+static void worker_setup(void)
 {
-	struct cpu_workqueue_struct *cwq = __cwq;
-	DECLARE_WAITQUEUE(wait, current);
 	struct k_sigaction sa;
 	sigset_t blocked;
 
@@ -250,49 +584,393 @@ static int worker_thread(void *__cwq)
 	sa.sa.sa_flags = 0;
 	siginitset(&sa.sa.sa_mask, sigmask(SIGCHLD));
 	do_sigaction(SIGCHLD, &sa, (struct k_sigaction *)0);
+}
 
-	set_current_state(TASK_INTERRUPTIBLE);
-	while (!kthread_should_stop()) {
-		add_wait_queue(&cwq->more_work, &wait);
-		if (list_empty(&cwq->worklist))
-			schedule();
-		else
-			__set_current_state(TASK_RUNNING);
-		remove_wait_queue(&cwq->more_work, &wait);
+static struct worker *alloc_worker(void)
+{
+	struct worker *worker;
 
-		if (!list_empty(&cwq->worklist))
-			run_workqueue(cwq);
-		set_current_state(TASK_INTERRUPTIBLE);
+	worker = kzalloc(sizeof(*worker), GFP_KERNEL);
+	if (worker) {
+		INIT_LIST_HEAD(&worker->entry);
+		INIT_LIST_HEAD(&worker->node);
+		INIT_LIST_HEAD(&worker->scheduled);
 	}
-	__set_current_state(TASK_RUNNING);
-	return 0;
+	return worker;
 }
 
-static void flush_cpu_workqueue(struct cpu_workqueue_struct *cwq)
+static int worker_thread(void *__worker);
+
+/*
+ * Create a worker for @pool, bound to its cpu.  It has yet to be
+ * started with start_worker() and woken up.
+ */
+static struct worker *create_worker(struct worker_pool *pool)
 {
-	if (cwq->thread == current) {
-		/*
-		 * Probably keventd trying to flush its own queue. So simply run
-		 * it by hand rather than deadlocking.
-		 */
-		run_workqueue(cwq);
-	} else {
-		DEFINE_WAIT(wait);
-		long sequence_needed;
-
-		spin_lock_irq(&cwq->lock);
-		sequence_needed = cwq->insert_sequence;
-
-		while (sequence_needed - cwq->remove_sequence > 0) {
-			prepare_to_wait(&cwq->work_done, &wait,
-					TASK_UNINTERRUPTIBLE);
-			spin_unlock_irq(&cwq->lock);
-			schedule();
-			spin_lock_irq(&cwq->lock);
+	struct worker *worker;
+
+	worker = alloc_worker();
+	if (!worker)
+		return NULL;
+	worker->pool = pool;
+	worker->flags = WORKER_PREP;
+
+	spin_lock_irq(&pool->lock);
+	worker->id = pool->next_id++;
+	spin_unlock_irq(&pool->lock);
+
+	worker->task = kthread_create(worker_thread, worker, "kworker/%u:%d",
+				      pool->cpu, worker->id);
+	if (IS_ERR(worker->task)) {
+		kfree(worker);
+		return NULL;
+	}
+	kthread_bind(worker->task, pool->cpu);
+	return worker;
+}
+
+/* Called with the pool lock held: account a new worker as idle */
+static void start_worker(struct worker *worker)
+{
+	struct worker_pool *pool = worker->pool;
+
+	pool->nr_workers++;
+	list_add_tail(&worker->node, &pool->workers);
+	worker_enter_idle(worker);
+}
+
+/* A worker that never ran: move it off its cpu, which may be gone, and stop it */
+static void kill_unstarted_worker(struct worker *worker)
+{
+	kthread_bind(worker->task, any_online_cpu(cpu_online_map));
+	kthread_stop(worker->task);
+	kfree(worker);
+}
+
+/* Called with the pool lock held: an idle worker is told to exit */
+static void destroy_worker(struct worker *worker)
+{
+	struct worker_pool *pool = worker->pool;
+
+	pool->nr_workers--;
+	pool->nr_idle--;
+	list_del_init(&worker->entry);
+	list_del_init(&worker->node);
+	worker->flags |= WORKER_DIE;
+	wake_up_process(worker->task);
+}
+
+static void idle_worker_timeout(unsigned long __pool)
+{
+	struct worker_pool *pool = (struct worker_pool *)__pool;
+
+	spin_lock_irq(&pool->lock);
+	if (too_many_workers(pool)) {
+		struct worker *worker;
+		unsigned long expires;
+
+		/* the longest idle is at the tail */
+		worker = list_entry(pool->idle_list.prev, struct worker, entry);
+		expires = worker->last_active + IDLE_WORKER_TIMEOUT;
+
+		if (time_before(jiffies, expires))
+			mod_timer(&pool->idle_timer, expires);
+		else {
+			pool->flags |= POOL_MANAGE_WORKERS;
+			wake_up_worker(pool);
 		}
-		finish_wait(&cwq->work_done, &wait);
-		spin_unlock_irq(&cwq->lock);
 	}
+	spin_unlock_irq(&pool->lock);
+}
+
+static void send_mayday(struct work_struct *work)
+{
+	struct cpu_workqueue_struct *cwq = work->wq_data;
+	struct workqueue_struct *wq = cwq->wq;
+
+	if (!wq->rescuer)
+		return;
+	if (!cpu_test_and_set(cwq->pool->cpu, wq->mayday_mask))
+		wake_up_process(wq->rescuer->task);
+}
+
+/*
+ * The pool has been unable to create a worker for a while: the works
+ * on its worklist may be what would free the memory for one.  Call on
+ * the rescuers of their workqueues.
+ */
+static void pool_mayday_timeout(unsigned long __pool)
+{
+	struct worker_pool *pool = (struct worker_pool *)__pool;
+	struct work_struct *work;
+
+	spin_lock_irq(&pool->lock);
+	if (need_to_create_worker(pool))
+		list_for_each_entry(work, &pool->worklist, entry)
+			send_mayday(work);
+	spin_unlock_irq(&pool->lock);
+
+	mod_timer(&pool->mayday_timer, jiffies + MAYDAY_INTERVAL);
+}
+
+/*
+ * Create a worker if none is idle to take over from the one about to
+ * start on a work.  Called with the pool lock held, which is dropped.
+ * Returns nonzero if it was, so that the caller rechecks the pool.
+ */
+static int maybe_create_worker(struct worker_pool *pool)
+{
+	struct worker *worker;
+
+	if (!need_to_create_worker(pool))
+		return 0;
+restart:
+	spin_unlock_irq(&pool->lock);
+
+	/* if it takes a while, the rescuers are called for */
+	mod_timer(&pool->mayday_timer, jiffies + MAYDAY_INITIAL_TIMEOUT);
+
+	while (1) {
+		worker = create_worker(pool);
+		if (worker) {
+			del_timer_sync(&pool->mayday_timer);
+			spin_lock_irq(&pool->lock);
+			if (unlikely(pool->flags & POOL_DISASSOCIATED)) {
+				spin_unlock_irq(&pool->lock);
+				kill_unstarted_worker(worker);
+				spin_lock_irq(&pool->lock);
+				return 1;
+			}
+			start_worker(worker);
+			wake_up_process(worker->task);
+			return 1;
+		}
+
+		if (!need_to_create_worker(pool))
+			break;
+		schedule_timeout_interruptible(CREATE_COOLDOWN);
+		if (!need_to_create_worker(pool))
+			break;
+	}
+
+	del_timer_sync(&pool->mayday_timer);
+	spin_lock_irq(&pool->lock);
+	if (need_to_create_worker(pool))
+		goto restart;
+	return 1;
+}
+
+/*
+ * Reap the workers that have been idle for longer than
+ * IDLE_WORKER_TIMEOUT, as long as there are too many.  Called with the
+ * pool lock held.
+ */
+static int maybe_destroy_workers(struct worker_pool *pool)
+{
+	int ret = 0;
+
+	while (too_many_workers(pool)) {
+		struct worker *worker;
+		unsigned long expires;
+
+		worker = list_entry(pool->idle_list.prev, struct worker, entry);
+		expires = worker->last_active + IDLE_WORKER_TIMEOUT;
+
+		if (time_before(jiffies, expires)) {
+			mod_timer(&pool->idle_timer, expires);
+			break;
+		}
+		destroy_worker(worker);
+		ret = 1;
+	}
+	return ret;
+}
+
+/*
+ * One worker at a time sizes the pool: it makes sure there is an idle
+ * worker before it starts on a work, and reaps the ones the idle timer
+ * found too many of.  Called with the pool lock held, which may be
+ * dropped.  Returns nonzero if the pool may have changed meanwhile.
+ */
+static int manage_workers(struct worker *worker)
+{
+	struct worker_pool *pool = worker->pool;
+	int ret = 0;
+
+	if (pool->flags & (POOL_MANAGING | POOL_DISASSOCIATED))
+		return 0;
+
+	pool->flags |= POOL_MANAGING;
+	pool->flags &= ~POOL_MANAGE_WORKERS;
+
+	ret |= maybe_destroy_workers(pool);
+	ret |= maybe_create_worker(pool);
+
+	pool->flags &= ~POOL_MANAGING;
+	return ret;
+}
+
+static void worker_exit(struct worker *worker)
+{
+	current->flags &= ~PF_WQ_WORKER;
+	kfree(worker);
+}
+
+/*
+ * A worker runs the works on its pool's worklist for as long as it is
+ * the only one running, and goes idle when there are none left or
+ * another worker is running too.  One that has gone rogue, its cpu
+ * having gone down, exits instead.
+ */
+static int worker_thread(void *__worker)
+{
+	struct worker *worker = __worker;
+	struct worker_pool *pool = worker->pool;
+
+	worker_setup();
+	current->wq_worker = worker;
+	current->flags |= PF_WQ_WORKER;
+woke_up:
+	spin_lock_irq(&pool->lock);
+	if (unlikely(worker->flags & WORKER_DIE)) {
+		spin_unlock_irq(&pool->lock);
+		worker_exit(worker);
+		return 0;
+	}
+	worker_leave_idle(worker);
+recheck:
+	if (!need_more_worker(pool))
+		goto sleep;
+	if (unlikely(!may_start_working(pool)) && manage_workers(worker))
+		goto recheck;
+
+	BUG_ON(!list_empty(&worker->scheduled));
+	worker_clr_flags(worker, WORKER_PREP);
+
+	do {
+		struct work_struct *work = list_entry(pool->worklist.next,
+						struct work_struct, entry);
+		process_one_work(worker, work);
+		process_scheduled_works(worker);
+	} while (keep_working(pool));
+
+	worker_set_flags(worker, WORKER_PREP);
+sleep:
+	if (unlikely(worker->flags & WORKER_ROGUE)) {
+		spin_unlock_irq(&pool->lock);
+		worker_exit(worker);
+		return 0;
+	}
+	if (unlikely(need_to_manage_workers(pool)) && manage_workers(worker))
+		goto recheck;
+
+	worker_enter_idle(worker);
+	__set_current_state(TASK_INTERRUPTIBLE);
+	spin_unlock_irq(&pool->lock);
+	schedule();
+	goto woke_up;
+}
+
+/*
+ * The rescuer of a workqueue that memory reclaim may wait on.  When a
+ * pool cannot get a new worker in time, its mayday timer calls the
+ * rescuers of the workqueues with works on its worklist: each runs the
+ * works of its own workqueue there, so that they make progress even if
+ * no thread can be had.
+ */
+static int rescuer_thread(void *__wq)
+{
+	struct workqueue_struct *wq = __wq;
+	struct worker *rescuer = wq->rescuer;
+	unsigned int cpu;
+
+	worker_setup();
+	current->wq_worker = rescuer;
+	current->flags |= PF_WQ_WORKER;
+repeat:
+	set_current_state(TASK_INTERRUPTIBLE);
+
+	if (kthread_should_stop()) {
+		__set_current_state(TASK_RUNNING);
+		current->flags &= ~PF_WQ_WORKER;
+		return 0;
+	}
+
+	for_each_cpu_mask(cpu, wq->mayday_mask) {
+		struct cpu_workqueue_struct *cwq = get_cwq(cpu, wq);
+		struct worker_pool *pool = cwq->pool;
+		struct work_struct *work, *n;
+
+		__set_current_state(TASK_RUNNING);
+		cpu_clear(cpu, wq->mayday_mask);
+
+		/* go where the works are, unless the cpu is gone */
+		set_cpus_allowed(current, cpumask_of_cpu(cpu));
+		rescuer->pool = pool;
+
+		spin_lock_irq(&pool->lock);
+		list_for_each_entry_safe(work, n, &pool->worklist, entry)
+			if (work->wq_data == cwq)
+				list_move_tail(&work->entry,
+					       &rescuer->scheduled);
+		process_scheduled_works(rescuer);
+		spin_unlock_irq(&pool->lock);
+	}
+
+	schedule();
+	goto repeat;
+}
+
+/*
+ * Is everything of @color that @wq has in flight done, but for the works
+ * that @self, flushing its own workqueue, is in the middle of?
+ */
+static int wq_drained(struct workqueue_struct *wq, int color,
+		      struct worker *self)
+{
+	int cpu, nr = 0;
+
+	for_each_possible_cpu(cpu)
+		nr += get_cwq(cpu, wq)->nr_in_flight[color];
+	if (self)
+		nr -= self->nr_in_progress[color];
+	return nr <= 0;
+}
+
+/*
+ * A work flushing its own workqueue would wait on itself, and on the
+ * works behind it on its cpu which may not get to run until it is done.
+ * Run those here instead, as the per-cpu threads used to.
+ */
+static void flush_own_cwq(struct worker *worker)
+{
+	struct cpu_workqueue_struct *cwq = worker->current_cwq;
+	struct worker_pool *pool = worker->pool;
+	struct work_struct *work;
+
+	spin_lock_irq(&pool->lock);
+	worker->run_depth++;
+	if (worker->run_depth > 3) {
+		/* morton gets to eat his hat */
+		printk("%s: recursion depth exceeded: %d\n",
+			__FUNCTION__, worker->run_depth);
+		dump_stack();
+	}
+	for (;;) {
+		list_for_each_entry(work, &pool->worklist, entry)
+			if (work->wq_data == cwq)
+				goto found;
+		if (list_empty(&cwq->delayed_works))
+			break;
+		work = list_entry(cwq->delayed_works.next,
+				  struct work_struct, entry);
+		list_move_tail(&work->entry, &pool->worklist);
+		cwq->nr_active++;
+found:
+		process_one_work(worker, work);
+	}
+	worker->run_depth--;
+	spin_unlock_irq(&pool->lock);
 }
 
 /**
@@ -302,121 +980,127 @@ static void flush_cpu_workqueue(struct cpu_workqueue_struct *cwq)
  * Forces execution of the workqueue and blocks until its completion.
  * This is typically used in driver shutdown handlers.
  *
- * This function will sample each workqueue's current insert_sequence number and
- * will sleep until the head sequence is greater than or equal to that.  This
- * means that we sleep until all works which were queued on entry have been
- * handled, but we are not livelocked by new incoming ones.
- *
- * This function used to run the workqueues itself.  Now we just wait for the
- * helper threads to do it.
+ * This function waits until all works which were queued on entry have
+ * been handled, but is not livelocked by new incoming ones: those are
+ * queued under the other flush color.  A flush still waiting on the
+ * works queued before it is let finish before the color is flipped
+ * again.
  */
 void fastcall flush_workqueue(struct workqueue_struct *wq)
 {
-	might_sleep();
+	struct worker *self = current_wq_worker();
+	int cpu, color;
 
-	if (is_single_threaded(wq)) {
-		/* Always use first cpu's area. */
-		flush_cpu_workqueue(per_cpu_ptr(wq->cpu_wq, singlethread_cpu));
-	} else {
-		int cpu;
+	might_sleep();
 
-		mutex_lock(&workqueue_mutex);
-		for_each_online_cpu(cpu)
-			flush_cpu_workqueue(per_cpu_ptr(wq->cpu_wq, cpu));
-		mutex_unlock(&workqueue_mutex);
+	if (self && self->current_cwq && self->current_cwq->wq == wq)
+		flush_own_cwq(self);
+	else
+		self = NULL;
+
+	for (;;) {
+		mutex_lock(&wq->flush_mutex);
+		color = wq->work_color;
+		if (wq_drained(wq, !color, self))
+			break;
+		mutex_unlock(&wq->flush_mutex);
+		wait_event(wq->flush_wait, wq->work_color != color ||
+			   wq_drained(wq, !color, self));
 	}
-}
-EXPORT_SYMBOL_GPL(flush_workqueue);
-
-static struct task_struct *create_workqueue_thread(struct workqueue_struct *wq,
-						   int cpu)
-{
-	struct cpu_workqueue_struct *cwq = per_cpu_ptr(wq->cpu_wq, cpu);
-	struct task_struct *p;
 
-	spin_lock_init(&cwq->lock);
-	cwq->wq = wq;
-	cwq->thread = NULL;
-	cwq->insert_sequence = 0;
-	cwq->remove_sequence = 0;
-	INIT_LIST_HEAD(&cwq->worklist);
-	init_waitqueue_head(&cwq->more_work);
-	init_waitqueue_head(&cwq->work_done);
+	/*
+	 * Works are queued with the color read under the pool lock: once
+	 * each lock has been taken after the flip, none is queued under
+	 * the old color any more.
+	 */
+	wq->work_color = !color;
+	for_each_possible_cpu(cpu) {
+		spin_lock_irq(&get_pool(cpu)->lock);
+		spin_unlock_irq(&get_pool(cpu)->lock);
+	}
+	mutex_unlock(&wq->flush_mutex);
+	wake_up(&wq->flush_wait);
 
-	if (is_single_threaded(wq))
-		p = kthread_create(worker_thread, cwq, "%s", wq->name);
-	else
-		p = kthread_create(worker_thread, cwq, "%s/%d", wq->name, cpu);
-	if (IS_ERR(p))
-		return NULL;
-	cwq->thread = p;
-	return p;
+	wait_event(wq->flush_wait, wq_drained(wq, color, self));
 }
+EXPORT_SYMBOL_GPL(flush_workqueue);
 
-struct workqueue_struct *__create_workqueue(const char *name,
-					    int singlethread)
+/**
+ * alloc_workqueue - create a workqueue
+ * @name: name of the workqueue, and of its rescuer
+ * @flags: WQ_* flags
+ * @max_active: the most works running at once per cpu, 0 for the default
+ *
+ * Works are run by the workers of the cpu they were queued on.  With
+ * WQ_SINGLE_CPU they all go to one cpu, and WQ_ORDERED, which also
+ * limits max_active to 1, runs them one at a time in queueing order.
+ * A workqueue that memory reclaim may wait on needs WQ_RESCUER, which
+ * gives it a thread that runs its works if no worker can be created.
+ */
+struct workqueue_struct *alloc_workqueue(const char *name,
+					 unsigned int flags, int max_active)
 {
-	int cpu, destroy = 0;
 	struct workqueue_struct *wq;
-	struct task_struct *p;
+	struct worker *rescuer;
+	int cpu;
+
+	if (flags & WQ_ORDERED) {
+		flags |= WQ_SINGLE_CPU;
+		max_active = 1;
+	}
+	if (max_active <= 0)
+		max_active = WQ_DFL_ACTIVE;
+	if (max_active > WQ_MAX_ACTIVE)
+		max_active = WQ_MAX_ACTIVE;
 
 	wq = kzalloc(sizeof(*wq), GFP_KERNEL);
 	if (!wq)
 		return NULL;
 
 	wq->cpu_wq = alloc_percpu(struct cpu_workqueue_struct);
-	if (!wq->cpu_wq) {
-		kfree(wq);
-		return NULL;
-	}
+	if (!wq->cpu_wq)
+		goto err;
 
+	wq->flags = flags;
 	wq->name = name;
-	mutex_lock(&workqueue_mutex);
-	if (singlethread) {
-		INIT_LIST_HEAD(&wq->list);
-		p = create_workqueue_thread(wq, singlethread_cpu);
-		if (!p)
-			destroy = 1;
-		else
-			wake_up_process(p);
-	} else {
-		list_add(&wq->list, &workqueues);
-		for_each_online_cpu(cpu) {
-			p = create_workqueue_thread(wq, cpu);
-			if (p) {
-				kthread_bind(p, cpu);
-				wake_up_process(p);
-			} else
-				destroy = 1;
-		}
-	}
-	mutex_unlock(&workqueue_mutex);
+	mutex_init(&wq->flush_mutex);
+	init_waitqueue_head(&wq->flush_wait);
+	cpus_clear(wq->mayday_mask);
 
-	/*
-	 * Was there any error during startup? If yes then clean up:
-	 */
-	if (destroy) {
-		destroy_workqueue(wq);
-		wq = NULL;
+	for_each_possible_cpu(cpu) {
+		struct cpu_workqueue_struct *cwq = get_cwq(cpu, wq);
+
+		cwq->pool = get_pool(cpu);
+		cwq->wq = wq;
+		cwq->max_active = max_active;
+		INIT_LIST_HEAD(&cwq->delayed_works);
 	}
-	return wq;
-}
-EXPORT_SYMBOL_GPL(__create_workqueue);
 
-static void cleanup_workqueue_thread(struct workqueue_struct *wq, int cpu)
-{
-	struct cpu_workqueue_struct *cwq;
-	unsigned long flags;
-	struct task_struct *p;
+	if (flags & WQ_RESCUER) {
+		rescuer = alloc_worker();
+		if (!rescuer)
+			goto err;
+		rescuer->flags = WORKER_RESCUER;
+		wq->rescuer = rescuer;
+
+		rescuer->task = kthread_create(rescuer_thread, wq, "%s", name);
+		if (IS_ERR(rescuer->task))
+			goto err;
+		wake_up_process(rescuer->task);
+	}
 
-	cwq = per_cpu_ptr(wq->cpu_wq, cpu);
-	spin_lock_irqsave(&cwq->lock, flags);
-	p = cwq->thread;
-	cwq->thread = NULL;
-	spin_unlock_irqrestore(&cwq->lock, flags);
-	if (p)
-		kthread_stop(p);
+	mutex_lock(&workqueue_mutex);
+	list_add(&wq->list, &workqueues);
+	mutex_unlock(&workqueue_mutex);
+	return wq;
+err:
+	if (wq->cpu_wq)
+		free_percpu(wq->cpu_wq);
+	kfree(wq->rescuer);
+	kfree(wq);
+	return NULL;
 }
+EXPORT_SYMBOL_GPL(alloc_workqueue);
 
 /**
  * destroy_workqueue - safely terminate a workqueue
@@ -426,27 +1110,21 @@ static void cleanup_workqueue_thread(struct workqueue_struct *wq, int cpu)
  */
 void destroy_workqueue(struct workqueue_struct *wq)
 {
-	int cpu;
-
 	flush_workqueue(wq);
 
-	/* We don't need the distraction of CPUs appearing and vanishing. */
 	mutex_lock(&workqueue_mutex);
-	if (is_single_threaded(wq))
-		cleanup_workqueue_thread(wq, singlethread_cpu);
-	else {
-		for_each_online_cpu(cpu)
-			cleanup_workqueue_thread(wq, cpu);
-		list_del(&wq->list);
-	}
+	list_del(&wq->list);
 	mutex_unlock(&workqueue_mutex);
+
+	if (wq->rescuer) {
+		kthread_stop(wq->rescuer->task);
+		kfree(wq->rescuer);
+	}
 	free_percpu(wq->cpu_wq);
 	kfree(wq);
 }
 EXPORT_SYMBOL_GPL(destroy_workqueue);
 
-static struct workqueue_struct *keventd_wq;
-
 /**
  * schedule_work - put work task in global workqueue
  * @work: job to be done
@@ -513,8 +1191,7 @@ int schedule_on_each_cpu(void (*func)(void *info), void *info)
 	mutex_lock(&workqueue_mutex);
 	for_each_online_cpu(cpu) {
 		INIT_WORK(per_cpu_ptr(works, cpu), func, info);
-		__queue_work(per_cpu_ptr(keventd_wq->cpu_wq, cpu),
-				per_cpu_ptr(works, cpu));
+		__queue_work(cpu, keventd_wq, per_cpu_ptr(works, cpu));
 	}
 	mutex_unlock(&workqueue_mutex);
 	flush_workqueue(keventd_wq);
@@ -586,40 +1263,82 @@ int keventd_up(void)
 	return keventd_wq != NULL;
 }
 
+/* Is current running a keventd work? */
 int current_is_keventd(void)
 {
-	struct cpu_workqueue_struct *cwq;
-	int cpu = smp_processor_id();	/* preempt-safe: keventd is per-cpu */
-	int ret = 0;
+	struct worker *worker = current_wq_worker();
 
 	BUG_ON(!keventd_wq);
 
-	cwq = per_cpu_ptr(keventd_wq->cpu_wq, cpu);
-	if (current == cwq->thread)
-		ret = 1;
+	return worker && worker->current_cwq &&
+		worker->current_cwq->wq == keventd_wq;
+}
 
-	return ret;
+/*
+ * Scheduler hooks, called with the runqueue of @cpu locked.
+ */
+
+/* A worker woke up, on @cpu */
+void wq_worker_waking_up(struct task_struct *task, unsigned int cpu)
+{
+	struct worker *worker = task->wq_worker;
+
+	if (!(worker->flags & WORKER_NOT_RUNNING))
+		atomic_inc(&worker->pool->nr_running);
+}
+
+/*
+ * A worker is going to sleep on @cpu.  If it was the last one running
+ * works on its pool and there are more, return an idle worker for
+ * schedule() to wake up in its place.  The idle list is only changed
+ * on this cpu, with interrupts off, so it is safe to look at here.
+ */
+struct task_struct *wq_worker_sleeping(struct task_struct *task,
+				       unsigned int cpu)
+{
+	struct worker *worker = task->wq_worker, *to_wakeup = NULL;
+	struct worker_pool *pool = worker->pool;
+
+	if (worker->flags & WORKER_NOT_RUNNING)
+		return NULL;
 
+	if (atomic_dec_and_test(&pool->nr_running) &&
+	    !list_empty(&pool->worklist) && !list_empty(&pool->idle_list))
+		to_wakeup = list_entry(pool->idle_list.next,
+				       struct worker, entry);
+	return to_wakeup ? to_wakeup->task : NULL;
 }
 
 #ifdef CONFIG_HOTPLUG_CPU
-/* Take the work from this (downed) CPU. */
-static void take_over_work(struct workqueue_struct *wq, unsigned int cpu)
+/*
+ * The pool's cpu is gone.  Works queued from now on go elsewhere; the
+ * workers, which the scheduler has moved off the dead cpu, finish what
+ * is on the worklist without concurrency management and then exit.
+ */
+static void disassociate_pool(struct worker_pool *pool)
 {
-	struct cpu_workqueue_struct *cwq = per_cpu_ptr(wq->cpu_wq, cpu);
-	struct list_head list;
-	struct work_struct *work;
+	struct worker *worker, *n;
 
-	spin_lock_irq(&cwq->lock);
-	list_replace_init(&cwq->worklist, &list);
+	if (singlethread_cpu == pool->cpu)
+		singlethread_cpu = any_online_cpu(cpu_online_map);
 
-	while (!list_empty(&list)) {
-		printk("Taking work for %s\n", wq->name);
-		work = list_entry(list.next,struct work_struct,entry);
-		list_del(&work->entry);
-		__queue_work(per_cpu_ptr(wq->cpu_wq, smp_processor_id()), work);
+	spin_lock_irq(&pool->lock);
+	pool->flags |= POOL_DISASSOCIATED;
+	list_for_each_entry_safe(worker, n, &pool->workers, node) {
+		worker->flags |= WORKER_ROGUE;
+		list_del_init(&worker->node);
 	}
-	spin_unlock_irq(&cwq->lock);
+	pool->nr_workers = 0;
+	atomic_set(&pool->nr_running, 0);
+
+	while (!list_empty(&pool->idle_list)) {
+		worker = list_entry(pool->idle_list.next, struct worker, entry);
+		worker_leave_idle(worker);
+		wake_up_process(worker->task);
+	}
+	spin_unlock_irq(&pool->lock);
+
+	del_timer_sync(&pool->idle_timer);
 }
 
 /* We're holding the cpucontrol mutex here */
@@ -628,41 +1347,47 @@ static int __devinit workqueue_cpu_callback(struct notifier_block *nfb,
 				  void *hcpu)
 {
 	unsigned int hotcpu = (unsigned long)hcpu;
-	struct workqueue_struct *wq;
+	struct worker_pool *pool = get_pool(hotcpu);
+	struct worker *worker;
 
 	switch (action) {
 	case CPU_UP_PREPARE:
 		mutex_lock(&workqueue_mutex);
-		/* Create a new workqueue thread for it. */
-		list_for_each_entry(wq, &workqueues, list) {
-			if (!create_workqueue_thread(wq, hotcpu)) {
-				printk("workqueue for %i failed\n", hotcpu);
-				return NOTIFY_BAD;
-			}
+		/* The pool starts out with one idle worker. */
+		worker = create_worker(pool);
+		if (!worker) {
+			printk("workqueue for %i failed\n", hotcpu);
+			return NOTIFY_BAD;
 		}
+		spin_lock_irq(&pool->lock);
+		start_worker(worker);
+		spin_unlock_irq(&pool->lock);
 		break;
 
 	case CPU_ONLINE:
-		/* Kick off worker threads. */
-		list_for_each_entry(wq, &workqueues, list) {
-			struct cpu_workqueue_struct *cwq;
-
-			cwq = per_cpu_ptr(wq->cpu_wq, hotcpu);
-			kthread_bind(cwq->thread, hotcpu);
-			wake_up_process(cwq->thread);
-		}
+		spin_lock_irq(&pool->lock);
+		pool->flags &= ~POOL_DISASSOCIATED;
+		/* any rogue workers left over are not counted */
+		atomic_set(&pool->nr_running, 0);
+		wake_up_worker(pool);
+		spin_unlock_irq(&pool->lock);
 		mutex_unlock(&workqueue_mutex);
 		break;
 
 	case CPU_UP_CANCELED:
-		list_for_each_entry(wq, &workqueues, list) {
-			if (!per_cpu_ptr(wq->cpu_wq, hotcpu)->thread)
-				continue;
-			/* Unbind so it can run. */
-			kthread_bind(per_cpu_ptr(wq->cpu_wq, hotcpu)->thread,
-				     any_online_cpu(cpu_online_map));
-			cleanup_workqueue_thread(wq, hotcpu);
+		worker = NULL;
+		spin_lock_irq(&pool->lock);
+		if (!list_empty(&pool->idle_list)) {
+			worker = list_entry(pool->idle_list.next,
+					    struct worker, entry);
+			pool->nr_workers--;
+			pool->nr_idle--;
+			list_del_init(&worker->entry);
+			list_del_init(&worker->node);
 		}
+		spin_unlock_irq(&pool->lock);
+		if (worker)
+			kill_unstarted_worker(worker);
 		mutex_unlock(&workqueue_mutex);
 		break;
 
@@ -675,10 +1400,7 @@ static int __devinit workqueue_cpu_callback(struct notifier_block *nfb,
 		break;
 
 	case CPU_DEAD:
-		list_for_each_entry(wq, &workqueues, list)
-			cleanup_workqueue_thread(wq, hotcpu);
-		list_for_each_entry(wq, &workqueues, list)
-			take_over_work(wq, hotcpu);
+		disassociate_pool(pool);
 		mutex_unlock(&workqueue_mutex);
 		break;
 	}
@@ -687,11 +1409,51 @@ static int __devinit workqueue_cpu_callback(struct notifier_block *nfb,
 }
 #endif
 
+static void init_worker_pool(struct worker_pool *pool, unsigned int cpu)
+{
+	spin_lock_init(&pool->lock);
+	pool->cpu = cpu;
+	pool->flags = POOL_DISASSOCIATED;
+	INIT_LIST_HEAD(&pool->worklist);
+	INIT_LIST_HEAD(&pool->workers);
+	INIT_LIST_HEAD(&pool->idle_list);
+	INIT_LIST_HEAD(&pool->busy_list);
+
+	init_timer_deferrable(&pool->idle_timer);
+	pool->idle_timer.function = idle_worker_timeout;
+	pool->idle_timer.data = (unsigned long)pool;
+
+	init_timer(&pool->mayday_timer);
+	pool->mayday_timer.function = pool_mayday_timeout;
+	pool->mayday_timer.data = (unsigned long)pool;
+
+	atomic_set(&pool->nr_running, 0);
+}
+
 void init_workqueues(void)
 {
-	singlethread_cpu = first_cpu(cpu_possible_map);
+	struct worker_pool *pool;
+	struct worker *worker;
+	int cpu;
+
+	singlethread_cpu = first_cpu(cpu_online_map);
+
+	for_each_possible_cpu(cpu)
+		init_worker_pool(get_pool(cpu), cpu);
+
+	for_each_online_cpu(cpu) {
+		pool = get_pool(cpu);
+		worker = create_worker(pool);
+		BUG_ON(!worker);
+
+		spin_lock_irq(&pool->lock);
+		pool->flags &= ~POOL_DISASSOCIATED;
+		start_worker(worker);
+		wake_up_process(worker->task);
+		spin_unlock_irq(&pool->lock);
+	}
+
 	hotcpu_notifier(workqueue_cpu_callback, 0);
-	keventd_wq = create_workqueue("events");
+	keventd_wq = alloc_workqueue("events", 0, 0);
 	BUG_ON(!keventd_wq);
 }
-
@@ -0,0 +1,55 @@
+/*
+ * ChaCha20 block function, after D. J. Bernstein's reference
+ * implementation, which is in the public domain.
+ */
+
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/cryptohash.h>
+#include <asm/byteorder.h>
+
+#define QUARTERROUND(a, b, c, d)				\
+	(a += b, d = rol32(d ^ a, 16),				\
+	 c += d, b = rol32(b ^ c, 12),				\
+	 a += b, d = rol32(d ^ a, 8),				\
+	 c += d, b = rol32(b ^ c, 7))
+
+/*
+ * chacha20_block: generate one block of ChaCha20 key stream
+ *
+ * @state:  16 words of state: constants, key, block counter and nonce
+ * @stream: 64 bytes of output, as little endian words
+ *
+ * The block counter in state[12] is advanced, carrying into state[13],
+ * so that consecutive calls return consecutive blocks of the stream.
+ * As with sha_transform(), clearing the output once it has been used
+ * is left to the caller.
+ */
+void chacha20_block(__u32 *state, __u32 *stream)
+{
+	__u32 x[16];
+	int i;
+
+	for (i = 0; i < 16; i++)
+		x[i] = state[i];
+
+	for (i = 0; i < 20; i += 2) {
+		QUARTERROUND(x[0], x[4], x[8],  x[12]);
+		QUARTERROUND(x[1], x[5], x[9],  x[13]);
+		QUARTERROUND(x[2], x[6], x[10], x[14]);
+		QUARTERROUND(x[3], x[7], x[11], x[15]);
+
+		QUARTERROUND(x[0], x[5], x[10], x[15]);
+		QUARTERROUND(x[1], x[6], x[11], x[12]);
+		QUARTERROUND(x[2], x[7], x[8],  x[13]);
+		QUARTERROUND(x[3], x[4], x[9],  x[14]);
+	}
+
+	for (i = 0; i < 16; i++)
+		stream[i] = cpu_to_le32(x[i] + state[i]);
+
+	if (!++state[12])
+		state[13]++;
+}
+
+EXPORT_SYMBOL(chacha20_block);
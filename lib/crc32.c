@@ -90,6 +90,26 @@ u32 __attribute_pure__ crc32_le(u32 crc, unsigned char const *p, size_t len)
 			b = (void *)p;
 		} while ((--len) && ((long)b)&3 );
 	}
+# ifdef __LITTLE_ENDIAN
+	if(likely(len >= 8)){
+		/*
+		 * Slicing by 8: fold in 64 bits at a time with eight
+		 * independent lookups; see gen_crc32table.c.
+		 */
+		const u32 (*t)[256] = crc32table_le_slice;
+		size_t save_len = len & 7;
+		len = len >> 3;
+		do {
+			u32 lo = crc ^ *b++;
+			u32 hi = *b++;
+			crc = t[6][lo & 255] ^ t[5][(lo >> 8) & 255] ^
+			      t[4][(lo >> 16) & 255] ^ t[3][lo >> 24] ^
+			      t[2][hi & 255] ^ t[1][(hi >> 8) & 255] ^
+			      t[0][(hi >> 16) & 255] ^ tab[hi >> 24];
+		} while (--len);
+		len = save_len;
+	}
+# endif
 	if(likely(len >= 4)){
 		/* load data 32 bits wide, xor data 32 bits wide. */
 		size_t save_len = len & 3;
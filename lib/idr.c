@@ -22,12 +22,24 @@
  * don't need to go to the memory "store" during an id allocate, just
  * so you don't need to be too concerned about locking and conflicts
  * with the slab allocator.
+ *
+ * idr_find() may run under rcu_read_lock() alone: layers are published
+ * with rcu_assign_pointer() and only freed after a grace period once
+ * they have been taken out of the tree.
+ *
+ * Layers freed after the grace period go to a small per-cpu cache, which
+ * idr_pre_get() takes from before it goes to the slab; an idr that
+ * allocates and releases ids at a steady rate so mostly reuses them
+ * without touching the slab.
  */
 
 #ifndef TEST                        // to test in user space...
 #include <linux/slab.h>
 #include <linux/init.h>
 #include <linux/module.h>
+#include <linux/percpu.h>
+#include <linux/cpu.h>
+#include <linux/notifier.h>
 #endif
 #include <linux/err.h>
 #include <linux/string.h>
@@ -35,6 +47,67 @@
 
 static kmem_cache_t *idr_layer_cache;
 
+/* Zeroed layers, chained through ary[0] */
+struct idr_layer_pcp {
+	struct idr_layer	*free;
+	int			 nr;
+};
+static DEFINE_PER_CPU(struct idr_layer_pcp, idr_layer_pcp);
+
+static struct idr_layer *idr_layer_get(gfp_t gfp_mask)
+{
+	struct idr_layer_pcp *pcp;
+	struct idr_layer *p;
+	unsigned long flags;
+
+	/* irqs off: the rcu callback refills the cache from softirq */
+	local_irq_save(flags);
+	pcp = &__get_cpu_var(idr_layer_pcp);
+	if ((p = pcp->free)) {
+		pcp->free = p->ary[0];
+		pcp->nr--;
+		p->ary[0] = NULL;
+	}
+	local_irq_restore(flags);
+	if (!p)
+		p = kmem_cache_alloc(idr_layer_cache, gfp_mask);
+	return p;
+}
+
+/* The layer must be zeroed, as the slab constructor leaves it */
+static void idr_layer_put(struct idr_layer *p)
+{
+	struct idr_layer_pcp *pcp;
+	unsigned long flags;
+
+	local_irq_save(flags);
+	pcp = &__get_cpu_var(idr_layer_pcp);
+	if (pcp->nr < IDR_FREE_MAX) {
+		p->ary[0] = pcp->free;
+		pcp->free = p;
+		pcp->nr++;
+		p = NULL;
+	}
+	local_irq_restore(flags);
+	if (p)
+		kmem_cache_free(idr_layer_cache, p);
+}
+
+static void idr_layer_rcu_free(struct rcu_head *head)
+{
+	struct idr_layer *p = container_of(head, struct idr_layer, rcu_head);
+
+	/* the cache hands out zeroed layers */
+	memset(p, 0, sizeof(*p));
+	idr_layer_put(p);
+}
+
+/* Free a layer that lookups may still be walking */
+static inline void free_layer_rcu(struct idr_layer *p)
+{
+	call_rcu(&p->rcu_head, idr_layer_rcu_free);
+}
+
 static struct idr_layer *alloc_layer(struct idr *idp)
 {
 	struct idr_layer *p;
@@ -58,18 +131,6 @@ static void __free_layer(struct idr *idp, struct idr_layer *p)
 	idp->id_free_cnt++;
 }
 
-static void free_layer(struct idr *idp, struct idr_layer *p)
-{
-	unsigned long flags;
-
-	/*
-	 * Depends on the return element being zeroed.
-	 */
-	spin_lock_irqsave(&idp->lock, flags);
-	__free_layer(idp, p);
-	spin_unlock_irqrestore(&idp->lock, flags);
-}
-
 /**
  * idr_pre_get - reserver resources for idr allocation
  * @idp:	idr handle
@@ -84,14 +145,31 @@ static void free_layer(struct idr *idp, struct idr_layer *p)
  */
 int idr_pre_get(struct idr *idp, gfp_t gfp_mask)
 {
-	while (idp->id_free_cnt < IDR_FREE_MAX) {
-		struct idr_layer *new;
-		new = kmem_cache_alloc(idr_layer_cache, gfp_mask);
-		if (new == NULL)
-			return (0);
-		free_layer(idp, new);
+	struct idr_layer *list = NULL, *new;
+	unsigned long flags;
+	int need, n;
+
+	/*
+	 * Gather what is missing first, then hand it over under one
+	 * lock.  Racing callers may overfill the free list a little,
+	 * which idr_remove() trims.
+	 */
+	need = IDR_FREE_MAX - idp->id_free_cnt;
+	for (n = 0; n < need; n++) {
+		if (!(new = idr_layer_get(gfp_mask)))
+			break;
+		new->ary[0] = list;
+		list = new;
+	}
+	if (list) {
+		spin_lock_irqsave(&idp->lock, flags);
+		while ((new = list)) {
+			list = new->ary[0];
+			__free_layer(idp, new);
+		}
+		spin_unlock_irqrestore(&idp->lock, flags);
 	}
-	return 1;
+	return n >= need;
 }
 EXPORT_SYMBOL(idr_pre_get);
 
@@ -138,7 +216,8 @@ static int sub_alloc(struct idr *idp, void *ptr, int *starting_id)
 		if (!p->ary[m]) {
 			if (!(new = alloc_layer(idp)))
 				return -1;
-			p->ary[m] = new;
+			new->layer = l - 1;
+			rcu_assign_pointer(p->ary[m], new);
 			p->count++;
 		}
 		pa[l--] = p;
@@ -148,7 +227,7 @@ static int sub_alloc(struct idr *idp, void *ptr, int *starting_id)
 	 * We have reached the leaf node, plant the
 	 * users pointer and return the raw id.
 	 */
-	p->ary[m] = (struct idr_layer *)ptr;
+	rcu_assign_pointer(p->ary[m], (struct idr_layer *)ptr);
 	__set_bit(m, &p->bitmap);
 	p->count++;
 	/*
@@ -180,6 +259,7 @@ build_up:
 	if (unlikely(!p)) {
 		if (!(p = alloc_layer(idp)))
 			return -1;
+		p->layer = 0;
 		layers = 1;
 	}
 	/*
@@ -188,8 +268,11 @@ build_up:
 	 */
 	while ((layers < (MAX_LEVEL - 1)) && (id >= (1 << (layers*IDR_BITS)))) {
 		layers++;
-		if (!p->count)
+		if (!p->count) {
+			/* an empty top can simply move up */
+			p->layer++;
 			continue;
+		}
 		if (!(new = alloc_layer(idp))) {
 			/*
 			 * The allocation failed.  If we built part of
@@ -207,11 +290,12 @@ build_up:
 		}
 		new->ary[0] = p;
 		new->count = 1;
+		new->layer = layers - 1;
 		if (p->bitmap == IDR_FULL)
 			__set_bit(0, &new->bitmap);
 		p = new;
 	}
-	idp->top = p;
+	rcu_assign_pointer(idp->top, p);
 	idp->layers = layers;
 	v = sub_alloc(idp, ptr, &id);
 	if (v == -2)
@@ -318,7 +402,7 @@ static void sub_remove(struct idr *idp, int shift, int id)
 		__clear_bit(n, &p->bitmap);
 		p->ary[n] = NULL;
 		while(*paa && ! --((**paa)->count)){
-			free_layer(idp, **paa);
+			free_layer_rcu(**paa);
 			**paa-- = NULL;
 		}
 		if (!*paa)
@@ -343,16 +427,16 @@ void idr_remove(struct idr *idp, int id)
 	if (idp->top && idp->top->count == 1 && (idp->layers > 1) &&
 	    idp->top->ary[0]) {  // We can drop a layer
 
-		p = idp->top->ary[0];
-		idp->top->bitmap = idp->top->count = 0;
-		free_layer(idp, idp->top);
-		idp->top = p;
+		struct idr_layer *old = idp->top;
+
+		p = old->ary[0];
+		rcu_assign_pointer(idp->top, p);
 		--idp->layers;
+		free_layer_rcu(old);
 	}
-	while (idp->id_free_cnt >= IDR_FREE_MAX) {
+	while (idp->id_free_cnt > IDR_FREE_MAX) {
 		p = alloc_layer(idp);
-		kmem_cache_free(idr_layer_cache, p);
-		return;
+		idr_layer_put(p);
 	}
 }
 EXPORT_SYMBOL(idr_remove);
@@ -365,7 +449,7 @@ void idr_destroy(struct idr *idp)
 {
 	while (idp->id_free_cnt) {
 		struct idr_layer *p = alloc_layer(idp);
-		kmem_cache_free(idr_layer_cache, p);
+		idr_layer_put(p);
 	}
 }
 EXPORT_SYMBOL(idr_destroy);
@@ -379,15 +463,20 @@ EXPORT_SYMBOL(idr_destroy);
  * return indicates that @id is not valid or you passed %NULL in
  * idr_get_new().
  *
- * The caller must serialize idr_find() vs idr_get_new() and idr_remove().
+ * The caller must either serialize idr_find() vs idr_get_new() and
+ * idr_remove(), or hold rcu_read_lock() and free what it registered
+ * only after a grace period.
  */
 void *idr_find(struct idr *idp, int id)
 {
 	int n;
 	struct idr_layer *p;
 
-	n = idp->layers * IDR_BITS;
-	p = idp->top;
+	/* The height comes from the top itself: idp->layers may be stale */
+	p = rcu_dereference(idp->top);
+	if (!p)
+		return NULL;
+	n = (p->layer + 1) * IDR_BITS;
 
 	/* Mask off upper bits we don't use for the search. */
 	id &= MAX_ID_MASK;
@@ -397,7 +486,7 @@ void *idr_find(struct idr *idp, int id)
 
 	while (n > 0 && p) {
 		n -= IDR_BITS;
-		p = p->ary[(id >> n) & IDR_MASK];
+		p = rcu_dereference(p->ary[(id >> n) & IDR_MASK]);
 	}
 	return((void *)p);
 }
@@ -439,7 +528,7 @@ void *idr_replace(struct idr *idp, void *ptr, int id)
 		return ERR_PTR(-ENOENT);
 
 	old_p = p->ary[n];
-	p->ary[n] = ptr;
+	rcu_assign_pointer(p->ary[n], ptr);
 
 	return old_p;
 }
@@ -451,6 +540,33 @@ static void idr_cache_ctor(void * idr_layer, kmem_cache_t *idr_layer_cache,
 	memset(idr_layer, 0, sizeof(struct idr_layer));
 }
 
+#ifdef CONFIG_HOTPLUG_CPU
+static int idr_layer_callback(struct notifier_block *nfb,
+			      unsigned long action, void *hcpu)
+{
+	struct idr_layer_pcp *pcp = &per_cpu(idr_layer_pcp, (long)hcpu);
+	struct idr_layer *p;
+
+	/* Free the dead cpu's cached layers */
+	if (action == CPU_DEAD) {
+		while ((p = pcp->free)) {
+			pcp->free = p->ary[0];
+			p->ary[0] = NULL;
+			kmem_cache_free(idr_layer_cache, p);
+		}
+		pcp->nr = 0;
+	}
+	return NOTIFY_OK;
+}
+
+static int __init idr_hotcpu_init(void)
+{
+	hotcpu_notifier(idr_layer_callback, 0);
+	return 0;
+}
+core_initcall(idr_hotcpu_init);
+#endif /* CONFIG_HOTPLUG_CPU */
+
 static  int init_id_cache(void)
 {
 	if (!idr_layer_cache)
@@ -0,0 +1,635 @@
+/*
+ * lib/microbench.c
+ *
+ * Microbenchmarks of core kernel primitives: slab and page allocation,
+ * radix tree, rbtree and prio_tree operations, spinlock, rwsem and mutex
+ * contention, RCU grace period latency and timer wheel insertion.
+ *
+ * Every test is a file in /sys/kernel/debug/microbench; reading it runs
+ * the test on 1, 2, 4, ... online CPUs at once, one kthread bound to each,
+ * and prints the average nanoseconds per operation of each of its phases
+ * for every CPU count, so that scaling regressions show as numbers.  The
+ * "iterations" file sets the operations per CPU, which the slower tests
+ * scale down.
+ *
+ * Times come from sched_clock() and include the loop around each batch
+ * of operations, but not the cond_resched() between batches.
+ */
+#include <linux/kernel.h>
+#include <linux/init.h>
+#include <linux/sched.h>
+#include <linux/kthread.h>
+#include <linux/completion.h>
+#include <linux/cpu.h>
+#include <linux/slab.h>
+#include <linux/gfp.h>
+#include <linux/vmalloc.h>
+#include <linux/radix-tree.h>
+#include <linux/rbtree.h>
+#include <linux/prio_tree.h>
+#include <linux/spinlock.h>
+#include <linux/rwsem.h>
+#include <linux/mutex.h>
+#include <linux/rcupdate.h>
+#include <linux/timer.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <asm/atomic.h>
+#include <asm/div64.h>
+
+#define MB_BATCH	64	/* operations timed at once */
+#define MB_PHASES	3
+
+struct mb_run;
+
+struct mb_test {
+	const char	*name;
+	const char	*phase[MB_PHASES];
+	int		(*run)(struct mb_run *run, u64 *ns);
+	unsigned long	param[8];
+	int		nparams;
+	int		iter_shift;	/* iterations >> iter_shift per CPU */
+};
+
+struct mb_run {
+	struct mb_test		*test;
+	unsigned long		param;
+	unsigned long		iters;
+	int			nr_cpus;
+	atomic_t		ready;
+	atomic_t		running;
+	struct completion	done;
+	spinlock_t		stat_lock;
+	u64			ns[MB_PHASES];
+	int			err;
+
+	/* shared by all CPUs in the contention tests */
+	spinlock_t		lock;
+	struct rw_semaphore	rwsem;
+	struct mutex		mutex;
+	unsigned long		counter;
+
+	struct task_struct	*task[0];
+};
+
+static u32 mb_iterations = 100000;
+static DEFINE_MUTEX(mb_mutex);
+
+static inline unsigned long mb_rand(unsigned long *seed)
+{
+	*seed = *seed * 1103515245 + 12345;
+	return *seed >> 8;
+}
+
+static int mb_kmalloc(struct mb_run *run, u64 *ns)
+{
+	void *obj[MB_BATCH];
+	unsigned long n;
+	u64 t0, t1, t2;
+	int i, err = 0;
+
+	for (n = 0; n < run->iters; n += MB_BATCH) {
+		t0 = sched_clock();
+		for (i = 0; i < MB_BATCH; i++)
+			obj[i] = kmalloc(run->param, GFP_KERNEL);
+		t1 = sched_clock();
+		for (i = 0; i < MB_BATCH; i++)
+			kfree(obj[i]);
+		t2 = sched_clock();
+		ns[0] += t1 - t0;
+		ns[1] += t2 - t1;
+		for (i = 0; i < MB_BATCH; i++)
+			if (!obj[i])
+				err = -ENOMEM;
+		cond_resched();
+	}
+	return err;
+}
+
+static int mb_pages(struct mb_run *run, u64 *ns)
+{
+	struct page *page[MB_BATCH];
+	unsigned long n;
+	u64 t0, t1, t2;
+	int i, err = 0;
+
+	for (n = 0; n < run->iters; n += MB_BATCH) {
+		t0 = sched_clock();
+		for (i = 0; i < MB_BATCH; i++)
+			page[i] = alloc_pages(GFP_KERNEL, run->param);
+		t1 = sched_clock();
+		for (i = 0; i < MB_BATCH; i++)
+			if (page[i])
+				__free_pages(page[i], run->param);
+		t2 = sched_clock();
+		ns[0] += t1 - t0;
+		ns[1] += t2 - t1;
+		for (i = 0; i < MB_BATCH; i++)
+			if (!page[i])
+				err = -ENOMEM;
+		cond_resched();
+	}
+	return err;
+}
+
+/*
+ * Items in a radix tree must not have the low bit set, so everything
+ * points to one int.
+ */
+static int mb_radix_item;
+
+/* param is the distance between indices: 1 is dense like the page cache */
+static int mb_radix_tree(struct mb_run *run, u64 *ns)
+{
+	struct radix_tree_root root;
+	unsigned long n, stride = run->param;
+	u64 t0;
+	int i, err = 0;
+
+	INIT_RADIX_TREE(&root, GFP_KERNEL);
+
+	for (n = 0; n < run->iters; n += MB_BATCH) {
+		t0 = sched_clock();
+		for (i = 0; i < MB_BATCH; i++)
+			if (radix_tree_insert(&root, (n + i) * stride,
+					      &mb_radix_item))
+				err = -ENOMEM;
+		ns[0] += sched_clock() - t0;
+		cond_resched();
+	}
+	for (n = 0; n < run->iters; n += MB_BATCH) {
+		t0 = sched_clock();
+		for (i = 0; i < MB_BATCH; i++)
+			if (!radix_tree_lookup(&root, (n + i) * stride))
+				err = -EINVAL;
+		ns[1] += sched_clock() - t0;
+		cond_resched();
+	}
+	for (n = 0; n < run->iters; n += MB_BATCH) {
+		t0 = sched_clock();
+		for (i = 0; i < MB_BATCH; i++)
+			radix_tree_delete(&root, (n + i) * stride);
+		ns[2] += sched_clock() - t0;
+		cond_resched();
+	}
+	return err;
+}
+
+struct mb_rb_node {
+	struct rb_node	node;
+	unsigned long	key;
+};
+
+static void mb_rb_insert(struct rb_root *root, struct mb_rb_node *new)
+{
+	struct rb_node **p = &root->rb_node;
+	struct rb_node *parent = NULL;
+
+	while (*p) {
+		parent = *p;
+		if (new->key < rb_entry(parent, struct mb_rb_node, node)->key)
+			p = &parent->rb_left;
+		else
+			p = &parent->rb_right;
+	}
+	rb_link_node(&new->node, parent, p);
+	rb_insert_color(&new->node, root);
+}
+
+static struct mb_rb_node *mb_rb_lookup(struct rb_root *root,
+				       unsigned long key)
+{
+	struct rb_node *p = root->rb_node;
+	struct mb_rb_node *entry;
+
+	while (p) {
+		entry = rb_entry(p, struct mb_rb_node, node);
+		if (key < entry->key)
+			p = p->rb_left;
+		else if (key > entry->key)
+			p = p->rb_right;
+		else
+			return entry;
+	}
+	return NULL;
+}
+
+static int mb_rbtree(struct mb_run *run, u64 *ns)
+{
+	struct rb_root root = RB_ROOT;
+	struct mb_rb_node *nodes;
+	unsigned long n, seed = smp_processor_id();
+	u64 t0;
+	int i, err = 0;
+
+	nodes = vmalloc(run->iters * sizeof(*nodes));
+	if (!nodes)
+		return -ENOMEM;
+	for (n = 0; n < run->iters; n++)
+		nodes[n].key = mb_rand(&seed);
+
+	for (n = 0; n < run->iters; n += MB_BATCH) {
+		t0 = sched_clock();
+		for (i = 0; i < MB_BATCH; i++)
+			mb_rb_insert(&root, &nodes[n + i]);
+		ns[0] += sched_clock() - t0;
+		cond_resched();
+	}
+	for (n = 0; n < run->iters; n += MB_BATCH) {
+		t0 = sched_clock();
+		for (i = 0; i < MB_BATCH; i++)
+			if (!mb_rb_lookup(&root, nodes[n + i].key))
+				err = -EINVAL;
+		ns[1] += sched_clock() - t0;
+		cond_resched();
+	}
+	for (n = 0; n < run->iters; n += MB_BATCH) {
+		t0 = sched_clock();
+		for (i = 0; i < MB_BATCH; i++)
+			rb_erase(&nodes[n + i].node, &root);
+		ns[2] += sched_clock() - t0;
+		cond_resched();
+	}
+	vfree(nodes);
+	return err;
+}
+
+/*
+ * Intervals of up to param pages at random offsets in a 1GB file, much
+ * like the vmas of a mapped library; queries are for a single page.
+ */
+#define MB_PRIO_RANGE	(1UL << 18)
+
+static int mb_prio_tree(struct mb_run *run, u64 *ns)
+{
+	struct prio_tree_root root;
+	struct prio_tree_node *nodes, *node;
+	struct prio_tree_iter iter;
+	unsigned long n, index, seed = smp_processor_id();
+	u64 t0;
+	int i;
+
+	nodes = vmalloc(run->iters * sizeof(*nodes));
+	if (!nodes)
+		return -ENOMEM;
+	INIT_PRIO_TREE_ROOT(&root);
+	for (n = 0; n < run->iters; n++) {
+		INIT_PRIO_TREE_NODE(&nodes[n]);
+		nodes[n].start = mb_rand(&seed) % MB_PRIO_RANGE;
+		nodes[n].last = nodes[n].start + mb_rand(&seed) % run->param;
+	}
+
+	/* an interval already in the tree is not inserted twice */
+	for (n = 0; n < run->iters; n += MB_BATCH) {
+		t0 = sched_clock();
+		for (i = 0; i < MB_BATCH; i++)
+			if (prio_tree_insert(&root, &nodes[n + i]) !=
+			    &nodes[n + i])
+				nodes[n + i].parent = NULL;
+		ns[0] += sched_clock() - t0;
+		cond_resched();
+	}
+	for (n = 0; n < run->iters; n += MB_BATCH) {
+		t0 = sched_clock();
+		for (i = 0; i < MB_BATCH; i++) {
+			index = mb_rand(&seed) % MB_PRIO_RANGE;
+			prio_tree_iter_init(&iter, &root, index, index);
+			do {
+				node = prio_tree_next(&iter);
+			} while (node);
+		}
+		ns[1] += sched_clock() - t0;
+		cond_resched();
+	}
+	for (n = 0; n < run->iters; n += MB_BATCH) {
+		t0 = sched_clock();
+		for (i = 0; i < MB_BATCH; i++)
+			if (nodes[n + i].parent)
+				prio_tree_remove(&root, &nodes[n + i]);
+		ns[2] += sched_clock() - t0;
+		cond_resched();
+	}
+	vfree(nodes);
+	return 0;
+}
+
+/*
+ * All CPUs take the same lock around an increment; param is the number
+ * of cpu_relax() spins outside of it between takes, to see how the lock
+ * does when it is not always contended.
+ */
+#define MB_LOCK_TEST(name, lock, unlock)				\
+static int name(struct mb_run *run, u64 *ns)				\
+{									\
+	unsigned long n, delay;						\
+	u64 t0;								\
+	int i;								\
+									\
+	for (n = 0; n < run->iters; n += MB_BATCH) {			\
+		t0 = sched_clock();					\
+		for (i = 0; i < MB_BATCH; i++) {			\
+			lock;						\
+			run->counter++;					\
+			unlock;						\
+			for (delay = 0; delay < run->param; delay++)	\
+				cpu_relax();				\
+		}							\
+		ns[0] += sched_clock() - t0;				\
+		cond_resched();						\
+	}								\
+	return 0;							\
+}
+
+MB_LOCK_TEST(mb_spinlock, spin_lock(&run->lock), spin_unlock(&run->lock))
+MB_LOCK_TEST(mb_rwsem_read, down_read(&run->rwsem), up_read(&run->rwsem))
+MB_LOCK_TEST(mb_rwsem_write, down_write(&run->rwsem), up_write(&run->rwsem))
+MB_LOCK_TEST(mb_mutex_lock, mutex_lock(&run->mutex), mutex_unlock(&run->mutex))
+
+static int mb_rcu(struct mb_run *run, u64 *ns)
+{
+	unsigned long n;
+	u64 t0;
+
+	/* not batched, each wait is milliseconds */
+	for (n = 0; n < run->iters; n++) {
+		t0 = sched_clock();
+		synchronize_rcu();
+		ns[0] += sched_clock() - t0;
+	}
+	return 0;
+}
+
+static void mb_timer_fn(unsigned long data)
+{
+}
+
+/* param is the expiry in jiffies, which picks the level of the wheel */
+static int mb_timer(struct mb_run *run, u64 *ns)
+{
+	struct timer_list timer[MB_BATCH];
+	unsigned long n, seed = smp_processor_id();
+	u64 t0, t1, t2;
+	int i;
+
+	for (i = 0; i < MB_BATCH; i++)
+		setup_timer(&timer[i], mb_timer_fn, 0);
+
+	for (n = 0; n < run->iters; n += MB_BATCH) {
+		t0 = sched_clock();
+		for (i = 0; i < MB_BATCH; i++)
+			mod_timer(&timer[i], jiffies + run->param +
+				  mb_rand(&seed) % 16);
+		t1 = sched_clock();
+		for (i = 0; i < MB_BATCH; i++)
+			del_timer(&timer[i]);
+		t2 = sched_clock();
+		ns[0] += t1 - t0;
+		ns[1] += t2 - t1;
+		cond_resched();
+	}
+	for (i = 0; i < MB_BATCH; i++)
+		del_timer_sync(&timer[i]);
+	return 0;
+}
+
+static struct mb_test mb_tests[] = {
+	{
+		.name		= "kmalloc",
+		.phase		= { "alloc", "free" },
+		.run		= mb_kmalloc,
+		.param		= { 32, 64, 128, 256, 512, 1024, 2048, 4096 },
+		.nparams	= 8,
+	},
+	{
+		.name		= "alloc_pages",
+		.phase		= { "alloc", "free" },
+		.run		= mb_pages,
+		.param		= { 0, 1, 2, 3 },
+		.nparams	= 4,
+		.iter_shift	= 2,
+	},
+	{
+		.name		= "radix_tree",
+		.phase		= { "insert", "lookup", "delete" },
+		.run		= mb_radix_tree,
+		.param		= { 1, 64 },
+		.nparams	= 2,
+		.iter_shift	= 1,
+	},
+	{
+		.name		= "rbtree",
+		.phase		= { "insert", "lookup", "erase" },
+		.run		= mb_rbtree,
+		.param		= { 0 },
+		.nparams	= 1,
+	},
+	{
+		.name		= "prio_tree",
+		.phase		= { "insert", "query", "remove" },
+		.run		= mb_prio_tree,
+		.param		= { 1, 16, 256 },
+		.nparams	= 3,
+		.iter_shift	= 1,
+	},
+	{
+		.name		= "spinlock",
+		.phase		= { "lock" },
+		.run		= mb_spinlock,
+		.param		= { 0, 100 },
+		.nparams	= 2,
+	},
+	{
+		.name		= "rwsem_read",
+		.phase		= { "lock" },
+		.run		= mb_rwsem_read,
+		.param		= { 0, 100 },
+		.nparams	= 2,
+	},
+	{
+		.name		= "rwsem_write",
+		.phase		= { "lock" },
+		.run		= mb_rwsem_write,
+		.param		= { 0, 100 },
+		.nparams	= 2,
+		.iter_shift	= 1,
+	},
+	{
+		.name		= "mutex",
+		.phase		= { "lock" },
+		.run		= mb_mutex_lock,
+		.param		= { 0, 100 },
+		.nparams	= 2,
+		.iter_shift	= 1,
+	},
+	{
+		.name		= "synchronize_rcu",
+		.phase		= { "wait" },
+		.run		= mb_rcu,
+		.param		= { 0 },
+		.nparams	= 1,
+		.iter_shift	= 11,
+	},
+	{
+		.name		= "timer",
+		.phase		= { "mod", "del" },
+		.run		= mb_timer,
+		.param		= { 1, 300, 20000 },
+		.nparams	= 3,
+	},
+};
+
+static int mb_thread(void *data)
+{
+	struct mb_run *run = data;
+	u64 ns[MB_PHASES] = { 0, };
+	int i, err;
+
+	/* start together, so the contention tests contend */
+	atomic_inc(&run->ready);
+	while (atomic_read(&run->ready) < run->nr_cpus)
+		cpu_relax();
+
+	err = run->test->run(run, ns);
+
+	spin_lock(&run->stat_lock);
+	for (i = 0; i < MB_PHASES; i++)
+		run->ns[i] += ns[i];
+	if (err && !run->err)
+		run->err = err;
+	spin_unlock(&run->stat_lock);
+
+	if (atomic_dec_and_test(&run->running))
+		complete(&run->done);
+	return 0;
+}
+
+/* Run @test on the first @nr_cpus online CPUs, ns/op of each phase in @ns */
+static int mb_run_test(struct mb_test *test, unsigned long param,
+		       int nr_cpus, u64 *ns)
+{
+	struct mb_run *run;
+	u64 ops;
+	int cpu, i = 0, err = 0;
+
+	run = kzalloc(sizeof(*run) + nr_cpus * sizeof(run->task[0]),
+		      GFP_KERNEL);
+	if (!run)
+		return -ENOMEM;
+	run->test = test;
+	run->param = param;
+	run->iters = ALIGN(max(mb_iterations >> test->iter_shift, 1U),
+			   MB_BATCH);
+	run->nr_cpus = nr_cpus;
+	atomic_set(&run->ready, 0);
+	atomic_set(&run->running, nr_cpus);
+	init_completion(&run->done);
+	spin_lock_init(&run->stat_lock);
+	spin_lock_init(&run->lock);
+	init_rwsem(&run->rwsem);
+	mutex_init(&run->mutex);
+
+	lock_cpu_hotplug();
+	for_each_online_cpu(cpu) {
+		if (i == nr_cpus)
+			break;
+		run->task[i] = kthread_create(mb_thread, run, "microbench/%d",
+					      cpu);
+		if (IS_ERR(run->task[i])) {
+			err = PTR_ERR(run->task[i]);
+			break;
+		}
+		kthread_bind(run->task[i], cpu);
+		i++;
+	}
+	if (err) {
+		while (i--)
+			kthread_stop(run->task[i]);
+		unlock_cpu_hotplug();
+		kfree(run);
+		return err;
+	}
+
+	/*
+	 * None of them may get to spin in mb_thread() on our CPU before
+	 * all are woken.
+	 */
+	preempt_disable();
+	for (i = 0; i < nr_cpus; i++)
+		wake_up_process(run->task[i]);
+	preempt_enable();
+	wait_for_completion(&run->done);
+	unlock_cpu_hotplug();
+
+	ops = (u64)run->iters * nr_cpus;
+	for (i = 0; i < MB_PHASES; i++) {
+		ns[i] = run->ns[i];
+		do_div(ns[i], ops);
+	}
+	err = run->err;
+	kfree(run);
+	return err;
+}
+
+static int mb_show(struct seq_file *m, void *v)
+{
+	struct mb_test *test = m->private;
+	u64 ns[MB_PHASES];
+	int p, i, nr, online, err = 0;
+
+	if (mutex_lock_interruptible(&mb_mutex))
+		return -EINTR;
+
+	seq_printf(m, "%-16s %8s %4s", test->name, "param", "cpus");
+	for (i = 0; i < MB_PHASES && test->phase[i]; i++)
+		seq_printf(m, " %10s", test->phase[i]);
+	seq_puts(m, "  (ns/op)\n");
+
+	online = num_online_cpus();
+	for (p = 0; p < test->nparams; p++) {
+		for (nr = 1; ; nr = min(nr * 2, online)) {
+			err = mb_run_test(test, test->param[p], nr, ns);
+			if (err)
+				goto out;
+			seq_printf(m, "%-16s %8lu %4d", test->name,
+				   test->param[p], nr);
+			for (i = 0; i < MB_PHASES && test->phase[i]; i++)
+				seq_printf(m, " %10llu",
+					   (unsigned long long)ns[i]);
+			seq_putc(m, '\n');
+			if (nr == online)
+				break;
+		}
+	}
+out:
+	mutex_unlock(&mb_mutex);
+	return err;
+}
+
+static int mb_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, mb_show, inode->u.generic_ip);
+}
+
+static struct file_operations mb_fops = {
+	.open		= mb_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+static int __init microbench_init(void)
+{
+	struct dentry *dir;
+	int i;
+
+	dir = debugfs_create_dir("microbench", NULL);
+	if (!dir)
+		return 0;
+	debugfs_create_u32("iterations", S_IRUGO | S_IWUSR, dir,
+			   &mb_iterations);
+	for (i = 0; i < ARRAY_SIZE(mb_tests); i++)
+		debugfs_create_file(mb_tests[i].name, S_IRUSR, dir,
+				    &mb_tests[i], &mb_fops);
+	return 0;
+}
+late_initcall(microbench_init);
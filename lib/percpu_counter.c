@@ -5,7 +5,11 @@
 #include <linux/percpu_counter.h>
 #include <linux/module.h>
 
-void percpu_counter_mod(struct percpu_counter *fbc, s32 amount)
+/*
+ * Adds amount to this cpu's count, and moves the count into the shared
+ * one once it reaches batch either way.
+ */
+void __percpu_counter_mod(struct percpu_counter *fbc, s32 amount, s32 batch)
 {
 	long count;
 	s32 *pcount;
@@ -13,7 +17,7 @@ void percpu_counter_mod(struct percpu_counter *fbc, s32 amount)
 
 	pcount = per_cpu_ptr(fbc->counters, cpu);
 	count = *pcount + amount;
-	if (count >= FBC_BATCH || count <= -FBC_BATCH) {
+	if (count >= batch || count <= -batch) {
 		spin_lock(&fbc->lock);
 		fbc->count += count;
 		*pcount = 0;
@@ -23,7 +27,7 @@ void percpu_counter_mod(struct percpu_counter *fbc, s32 amount)
 	}
 	put_cpu();
 }
-EXPORT_SYMBOL(percpu_counter_mod);
+EXPORT_SYMBOL(__percpu_counter_mod);
 
 /*
  * Add up all the per-cpu counts, return the result.  This is a more accurate
@@ -44,3 +48,29 @@ s64 percpu_counter_sum(struct percpu_counter *fbc)
 	return ret < 0 ? 0 : ret;
 }
 EXPORT_SYMBOL(percpu_counter_sum);
+
+/*
+ * Move the whole count, which may be negative, into *total, for users
+ * that fold the counter into some other total now and then.  The per-cpu
+ * counts are left alone, as their cpus may be changing them, and made up
+ * for in the shared count instead.  *total is updated before the count,
+ * so that a lockless reader of the count and then *total never sees less
+ * than their sum; the caller serialises writers of *total.
+ */
+void percpu_counter_drain(struct percpu_counter *fbc, s64 *total)
+{
+	s64 ret;
+	int cpu;
+
+	spin_lock(&fbc->lock);
+	ret = fbc->count;
+	for_each_possible_cpu(cpu) {
+		s32 *pcount = per_cpu_ptr(fbc->counters, cpu);
+		ret += *pcount;
+	}
+	*total += ret;
+	smp_wmb();
+	fbc->count -= ret;
+	spin_unlock(&fbc->lock);
+}
+EXPORT_SYMBOL(percpu_counter_drain);
@@ -0,0 +1,422 @@
+/*
+ * Resizable hash tables with RCU lookups.
+ *
+ * Distributed under the GNU GPL license version 2.
+ *
+ * Resizing.  The resize worker allocates a table of the new size, hangs
+ * it off the current one as its future table, then empties the current
+ * table bucket by bucket, each under its bucket lock, always moving the
+ * last object of the chain: the object is linked at the head of its new
+ * bucket before the chain is cut in front of it.  A lookup walking the
+ * old chain therefore either meets the object before it moves, or finds
+ * the chain ending short and then finds it in the future table; one
+ * sitting on the object as it moves follows its next pointer into the
+ * new chain, which only shows it more objects to compare against.  When
+ * the old table is empty the new one replaces it, and the old one is
+ * freed after a grace period.
+ *
+ * Locking.  The bucket locks are indexed by the low bits of the full
+ * hash, and there are never more locks than buckets, so an object has
+ * the same lock in the old and the new table and the worker needs only
+ * that one to move it.  Writers insert into the newest table, which they
+ * look up under the lock: the worker publishes the future table before
+ * it takes any bucket lock, so a writer that still saw no future table
+ * has finished before its bucket is moved.
+ *
+ * Lookups may use either rcu_read_lock() or rcu_read_lock_bh():
+ * synchronize_rcu() waits for every cpu to pass through a context
+ * switch, which covers softirq-disabled sections as well.
+ */
+
+#include <linux/module.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/mm.h>
+#include <linux/jhash.h>
+#include <linux/random.h>
+#include <linux/rcupdate.h>
+#include <linux/sched.h>
+#include <linux/rcuhash.h>
+
+#define RCUHASH_MIN_SIZE	16
+#define RCUHASH_MAX_SIZE	(1U << 20)
+#define RCUHASH_LOCKS_PER_CPU	32
+
+static inline void *rcuhash_obj(struct rcuhash *ht, struct rcuhash_head *he)
+{
+	return (char *)he - ht->p.head_offset;
+}
+
+static inline struct rcuhash_head *rcuhash_he(struct rcuhash *ht, void *obj)
+{
+	return (struct rcuhash_head *)((char *)obj + ht->p.head_offset);
+}
+
+static inline u32 rcuhash_hash(struct rcuhash *ht, const void *key)
+{
+	return ht->p.hashfn(key, ht->p.key_len, ht->seed);
+}
+
+static inline u32 rcuhash_obj_hash(struct rcuhash *ht, void *obj)
+{
+	return rcuhash_hash(ht, (char *)obj + ht->p.key_offset);
+}
+
+static inline spinlock_t *rcuhash_lock(struct rcuhash *ht, u32 hash)
+{
+	return &ht->locks[hash & ht->lock_mask];
+}
+
+static u32 rcuhash_jhash(const void *key, u32 len, u32 seed)
+{
+	return jhash(key, len, seed);
+}
+
+static struct rcuhash_table *rcuhash_alloc_table(unsigned int size)
+{
+	struct rcuhash_table *tbl;
+	size_t bytes = sizeof(*tbl) + size * sizeof(tbl->buckets[0]);
+
+	if (bytes <= PAGE_SIZE)
+		tbl = kmalloc(bytes, GFP_KERNEL);
+	else
+		tbl = vmalloc(bytes);
+	if (tbl) {
+		memset(tbl, 0, bytes);
+		tbl->size = size;
+	}
+	return tbl;
+}
+
+/* Process context only: vfree() may sleep */
+static void rcuhash_free_table(struct rcuhash_table *tbl)
+{
+	if (sizeof(*tbl) + tbl->size * sizeof(tbl->buckets[0]) <= PAGE_SIZE)
+		kfree(tbl);
+	else
+		vfree(tbl);
+}
+
+static inline int rcuhash_grow_above(struct rcuhash *ht,
+				     struct rcuhash_table *tbl)
+{
+	return atomic_read(&ht->nelems) > tbl->size / 4 * 3 &&
+	       tbl->size < ht->p.max_size;
+}
+
+static inline int rcuhash_shrink_below(struct rcuhash *ht,
+				       struct rcuhash_table *tbl)
+{
+	return atomic_read(&ht->nelems) < tbl->size / 10 * 3 &&
+	       tbl->size > ht->p.min_size;
+}
+
+/* Move bucket b of old into its future table, last object first */
+static void rcuhash_move_bucket(struct rcuhash *ht, struct rcuhash_table *old,
+				unsigned int b)
+{
+	struct rcuhash_table *new = old->future;
+	struct rcuhash_head *he, **pprev;
+	unsigned int nb;
+
+	spin_lock_bh(rcuhash_lock(ht, b));
+	while ((he = old->buckets[b]) != NULL) {
+		pprev = &old->buckets[b];
+		while (he->next) {
+			pprev = &he->next;
+			he = he->next;
+		}
+		nb = rcuhash_obj_hash(ht, rcuhash_obj(ht, he)) &
+			(new->size - 1);
+		rcu_assign_pointer(he->next, new->buckets[nb]);
+		rcu_assign_pointer(new->buckets[nb], he);
+		/* only now can a lookup in old miss it */
+		rcu_assign_pointer(*pprev, NULL);
+	}
+	spin_unlock_bh(rcuhash_lock(ht, b));
+}
+
+static void rcuhash_resize_work(void *data)
+{
+	struct rcuhash *ht = data;
+	struct rcuhash_table *old, *new;
+	unsigned int size, b;
+
+	mutex_lock(&ht->mutex);
+	if (ht->dying)
+		goto out;
+
+	old = ht->tbl;
+	size = old->size;
+	if (rcuhash_grow_above(ht, old)) {
+		while (size < ht->p.max_size &&
+		       atomic_read(&ht->nelems) > size / 4 * 3)
+			size <<= 1;
+	} else if (rcuhash_shrink_below(ht, old)) {
+		while (size > ht->p.min_size &&
+		       atomic_read(&ht->nelems) < size / 10 * 3)
+			size >>= 1;
+	} else
+		goto out;
+
+	new = rcuhash_alloc_table(size);
+	if (!new)
+		goto out;
+
+	rcu_assign_pointer(old->future, new);
+	for (b = 0; b < old->size; b++) {
+		rcuhash_move_bucket(ht, old, b);
+		cond_resched();
+	}
+	rcu_assign_pointer(ht->tbl, new);
+
+	synchronize_rcu();
+	rcuhash_free_table(old);
+out:
+	mutex_unlock(&ht->mutex);
+}
+
+/**
+ * rcuhash_init - set up a resizable hash table
+ * @ht: the table
+ * @params: key, head and sizing; copied
+ *
+ * Process context.  Returns 0 or -ENOMEM.
+ */
+int rcuhash_init(struct rcuhash *ht, const struct rcuhash_params *params)
+{
+	unsigned int size, nlocks, i;
+
+	memset(ht, 0, sizeof(*ht));
+	ht->p = *params;
+	if (!ht->p.hashfn)
+		ht->p.hashfn = rcuhash_jhash;
+	if (!ht->p.min_size)
+		ht->p.min_size = RCUHASH_MIN_SIZE;
+	ht->p.min_size = roundup_pow_of_two(ht->p.min_size);
+	if (!ht->p.max_size)
+		ht->p.max_size = RCUHASH_MAX_SIZE;
+	ht->p.max_size = max(ht->p.min_size,
+			     (unsigned int)roundup_pow_of_two(ht->p.max_size));
+
+	size = ht->p.min_size;
+	while (size < ht->p.max_size && ht->p.nelem_hint > size / 4 * 3)
+		size <<= 1;
+
+	/* no more locks than the smallest table has buckets */
+	nlocks = roundup_pow_of_two(num_possible_cpus()) *
+		RCUHASH_LOCKS_PER_CPU;
+	nlocks = min(nlocks, ht->p.min_size);
+	ht->locks = kmalloc(nlocks * sizeof(spinlock_t), GFP_KERNEL);
+	if (!ht->locks)
+		return -ENOMEM;
+	for (i = 0; i < nlocks; i++)
+		spin_lock_init(&ht->locks[i]);
+	ht->lock_mask = nlocks - 1;
+
+	ht->tbl = rcuhash_alloc_table(size);
+	if (!ht->tbl) {
+		kfree(ht->locks);
+		return -ENOMEM;
+	}
+	get_random_bytes(&ht->seed, sizeof(ht->seed));
+	atomic_set(&ht->nelems, 0);
+	mutex_init(&ht->mutex);
+	INIT_WORK(&ht->work, rcuhash_resize_work, ht);
+	return 0;
+}
+EXPORT_SYMBOL_GPL(rcuhash_init);
+
+/**
+ * rcuhash_destroy - free a table's buckets and locks
+ * @ht: the table, which must no longer be used
+ *
+ * The objects still in it are the caller's to free.
+ */
+void rcuhash_destroy(struct rcuhash *ht)
+{
+	mutex_lock(&ht->mutex);
+	ht->dying = 1;
+	mutex_unlock(&ht->mutex);
+	flush_scheduled_work();
+
+	rcuhash_free_table(ht->tbl);
+	kfree(ht->locks);
+}
+EXPORT_SYMBOL_GPL(rcuhash_destroy);
+
+/**
+ * rcuhash_lookup_compare - find an object by key
+ * @ht: the table
+ * @key: the key, which selects the bucket
+ * @cmp: called on the objects of the bucket until it returns nonzero
+ * @arg: passed to @cmp
+ *
+ * Under rcu_read_lock() or rcu_read_lock_bh().  @cmp may see objects
+ * of other keys, and the same object twice while the table is resized.
+ */
+void *rcuhash_lookup_compare(struct rcuhash *ht, const void *key,
+			     rcuhash_cmp_t cmp, void *arg)
+{
+	struct rcuhash_table *tbl = rcu_dereference(ht->tbl);
+	struct rcuhash_head *he;
+	u32 hash = rcuhash_hash(ht, key);
+
+	do {
+		he = rcu_dereference(tbl->buckets[hash & (tbl->size - 1)]);
+		for (; he; he = rcu_dereference(he->next)) {
+			void *obj = rcuhash_obj(ht, he);
+
+			if (cmp(obj, arg))
+				return obj;
+		}
+		/* see the future table if the chain was cut short */
+		smp_rmb();
+		tbl = rcu_dereference(tbl->future);
+	} while (tbl);
+	return NULL;
+}
+EXPORT_SYMBOL_GPL(rcuhash_lookup_compare);
+
+struct rcuhash_key {
+	struct rcuhash	*ht;
+	const void	*key;
+};
+
+static int rcuhash_key_cmp(void *obj, void *arg)
+{
+	struct rcuhash_key *k = arg;
+
+	return !memcmp((char *)obj + k->ht->p.key_offset, k->key,
+		       k->ht->p.key_len);
+}
+
+/**
+ * rcuhash_lookup - find an object by key
+ * @ht: the table
+ * @key: the key
+ *
+ * Under rcu_read_lock() or rcu_read_lock_bh().
+ */
+void *rcuhash_lookup(struct rcuhash *ht, const void *key)
+{
+	struct rcuhash_key k = { .ht = ht, .key = key };
+
+	return rcuhash_lookup_compare(ht, key, rcuhash_key_cmp, &k);
+}
+EXPORT_SYMBOL_GPL(rcuhash_lookup);
+
+static void *__rcuhash_insert(struct rcuhash *ht, void *obj,
+			      rcuhash_cmp_t cmp, void *arg)
+{
+	const void *key = (char *)obj + ht->p.key_offset;
+	struct rcuhash_head *he = rcuhash_he(ht, obj);
+	struct rcuhash_table *tbl;
+	void *found = NULL;
+	unsigned int b;
+	u32 hash = rcuhash_hash(ht, key);
+	int grow = 0;
+
+	rcu_read_lock();
+	spin_lock_bh(rcuhash_lock(ht, hash));
+	if (cmp) {
+		found = rcuhash_lookup_compare(ht, key, cmp, arg);
+		if (found)
+			goto out;
+	}
+	for (tbl = rcu_dereference(ht->tbl); tbl->future; tbl = tbl->future)
+		;
+	b = hash & (tbl->size - 1);
+	he->next = tbl->buckets[b];
+	rcu_assign_pointer(tbl->buckets[b], he);
+	atomic_inc(&ht->nelems);
+	grow = rcuhash_grow_above(ht, tbl);
+out:
+	spin_unlock_bh(rcuhash_lock(ht, hash));
+	rcu_read_unlock();
+
+	if (!found && grow)
+		schedule_work(&ht->work);
+	return found;
+}
+
+/**
+ * rcuhash_insert - add an object
+ * @ht: the table
+ * @obj: the object, with its key set
+ *
+ * Process or softirq context.
+ */
+void rcuhash_insert(struct rcuhash *ht, void *obj)
+{
+	__rcuhash_insert(ht, obj, NULL, NULL);
+}
+EXPORT_SYMBOL_GPL(rcuhash_insert);
+
+/**
+ * rcuhash_insert_unique - add an object unless its key is taken
+ * @ht: the table
+ * @obj: the object, with its key set
+ * @cmp: as for rcuhash_lookup_compare(), or %NULL to compare keys
+ * @arg: passed to @cmp
+ *
+ * Returns %NULL once @obj is in, or the object @cmp accepted, which
+ * stays in the table as long as the caller's own rules keep it there.
+ * Process or softirq context.
+ */
+void *rcuhash_insert_unique(struct rcuhash *ht, void *obj,
+			    rcuhash_cmp_t cmp, void *arg)
+{
+	struct rcuhash_key k = {
+		.ht = ht,
+		.key = (char *)obj + ht->p.key_offset,
+	};
+
+	if (!cmp) {
+		cmp = rcuhash_key_cmp;
+		arg = &k;
+	}
+	return __rcuhash_insert(ht, obj, cmp, arg);
+}
+EXPORT_SYMBOL_GPL(rcuhash_insert_unique);
+
+/**
+ * rcuhash_remove - take an object out
+ * @ht: the table
+ * @obj: the object
+ *
+ * Returns 0, or -ENOENT if @obj was not in the table.  Lookups may see
+ * @obj until a grace period has passed.  Process or softirq context.
+ */
+int rcuhash_remove(struct rcuhash *ht, void *obj)
+{
+	struct rcuhash_head *target = rcuhash_he(ht, obj);
+	struct rcuhash_head *he, **pprev;
+	struct rcuhash_table *tbl;
+	u32 hash = rcuhash_obj_hash(ht, obj);
+	int err = -ENOENT, shrink = 0;
+
+	rcu_read_lock();
+	spin_lock_bh(rcuhash_lock(ht, hash));
+	for (tbl = rcu_dereference(ht->tbl); tbl; tbl = tbl->future) {
+		pprev = &tbl->buckets[hash & (tbl->size - 1)];
+		for (he = *pprev; he; pprev = &he->next, he = *pprev) {
+			if (he == target) {
+				*pprev = he->next;
+				atomic_dec(&ht->nelems);
+				shrink = !tbl->future &&
+					 rcuhash_shrink_below(ht, tbl);
+				err = 0;
+				goto out;
+			}
+		}
+	}
+out:
+	spin_unlock_bh(rcuhash_lock(ht, hash));
+	rcu_read_unlock();
+
+	if (shrink)
+		schedule_work(&ht->work);
+	return err;
+}
+EXPORT_SYMBOL_GPL(rcuhash_remove);
@@ -0,0 +1,316 @@
+/*
+ * mm/backing-dev.c - flusher threads of the backing devices
+ *
+ * Dirty data is written back by a thread per backing device, so that a
+ * slow disk or a stuck server only holds up the writeback of its own
+ * pages, and each device sees the writes of one thread in large batches.
+ *
+ * The devices which can have a flusher are registered on bdi_list.  Their
+ * threads are started on demand by the flusher of default_backing_dev_info,
+ * the first time a device has dirty data, and run until it is unregistered.
+ * Writeback asked of a device which isn't registered is done by the default
+ * flusher, for all the devices at once, as pdflush used to do.
+ */
+
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/sched.h>
+#include <linux/fs.h>
+#include <linux/writeback.h>
+#include <linux/backing-dev.h>
+#include <linux/kthread.h>
+#include <linux/mutex.h>
+#include <linux/spinlock.h>
+#include <linux/init.h>
+
+/*
+ * The registered devices.  bdi_lock also protects the task and wb_nr_pages
+ * of each of them, and wb_global_pages.  bdi_mutex is held to start a
+ * flusher or to take a device off the list, so that the forker can drop
+ * bdi_lock while it starts the thread of a device.
+ */
+static LIST_HEAD(bdi_list);
+static DEFINE_SPINLOCK(bdi_lock);
+static DEFINE_MUTEX(bdi_mutex);
+
+/* Background writeout for the devices off the list, done by bdi-default */
+static long wb_global_pages;
+
+/* For the names of the flusher threads, under bdi_mutex */
+static int bdi_seq;
+
+/**
+ * bdi_register - let a backing device have its own flusher thread
+ * @bdi: the device's backing_dev_info structure
+ *
+ * May be called in any context, the thread is started later on.
+ */
+void bdi_register(struct backing_dev_info *bdi)
+{
+	spin_lock(&bdi_lock);
+	if (!test_and_set_bit(BDI_registered, &bdi->state))
+		list_add_tail(&bdi->bdi_list, &bdi_list);
+	spin_unlock(&bdi_lock);
+}
+EXPORT_SYMBOL(bdi_register);
+
+/**
+ * bdi_unregister - stop the flusher thread of a backing device
+ * @bdi: the device's backing_dev_info structure
+ *
+ * Must be called before the backing_dev_info goes away, from process
+ * context.  Does nothing for a device which was never registered.
+ */
+void bdi_unregister(struct backing_dev_info *bdi)
+{
+	struct task_struct *task;
+
+	if (!test_bit(BDI_registered, &bdi->state))
+		return;
+
+	mutex_lock(&bdi_mutex);
+	spin_lock(&bdi_lock);
+	list_del(&bdi->bdi_list);
+	clear_bit(BDI_registered, &bdi->state);
+	task = bdi->task;
+	bdi->task = NULL;
+	bdi->wb_nr_pages = 0;
+	spin_unlock(&bdi_lock);
+	mutex_unlock(&bdi_mutex);
+
+	if (task)
+		kthread_stop(task);
+}
+EXPORT_SYMBOL(bdi_unregister);
+
+/*
+ * Wake the flusher of a registered device, or the forker if it has none
+ * yet.  Called under bdi_lock.
+ */
+static void bdi_wakeup(struct backing_dev_info *bdi)
+{
+	struct task_struct *task = bdi->task;
+
+	if (!task)
+		task = default_backing_dev_info.task;
+	if (task)
+		wake_up_process(task);
+}
+
+/**
+ * bdi_start_writeback - start background writeout of a backing device
+ * @bdi: the device's backing_dev_info structure
+ * @nr_pages: the least number of pages to write
+ *
+ * The flusher of @bdi writes back at least @nr_pages, and on until the
+ * device is below its part of the background threshold.
+ */
+void bdi_start_writeback(struct backing_dev_info *bdi, long nr_pages)
+{
+	if (nr_pages < 1)
+		nr_pages = 1;
+
+	spin_lock(&bdi_lock);
+	if (test_bit(BDI_registered, &bdi->state)) {
+		if (bdi->wb_nr_pages < nr_pages)
+			bdi->wb_nr_pages = nr_pages;
+		bdi_wakeup(bdi);
+	} else {
+		if (wb_global_pages < nr_pages)
+			wb_global_pages = nr_pages;
+		bdi_wakeup(&default_backing_dev_info);
+	}
+	spin_unlock(&bdi_lock);
+}
+
+/**
+ * wakeup_flusher_threads - start writeback on all the backing devices
+ * @nr_pages: pages to write on each device, 0 for all of its dirty pages
+ */
+void wakeup_flusher_threads(long nr_pages)
+{
+	struct backing_dev_info *bdi;
+
+	spin_lock(&bdi_lock);
+	list_for_each_entry(bdi, &bdi_list, bdi_list) {
+		long nr = nr_pages;
+
+		if (!bdi_cap_writeback_dirty(bdi))
+			continue;
+		if (!nr)
+			nr = bdi_stat(bdi, BDI_RECLAIMABLE);
+		if (!nr)
+			continue;
+		if (bdi->wb_nr_pages < nr)
+			bdi->wb_nr_pages = nr;
+		bdi_wakeup(bdi);
+	}
+	spin_unlock(&bdi_lock);
+}
+
+/*
+ * Wake all the flusher threads, to have them look at the writeback
+ * interval again.
+ */
+void bdi_wakeup_all(void)
+{
+	struct backing_dev_info *bdi;
+
+	spin_lock(&bdi_lock);
+	list_for_each_entry(bdi, &bdi_list, bdi_list)
+		if (bdi->task)
+			wake_up_process(bdi->task);
+	spin_unlock(&bdi_lock);
+}
+
+/*
+ * Does the registered device still wait for its flusher to be started:
+ * has it got writeout asked of it, or dirty data on it?  Called under
+ * bdi_lock.
+ */
+static int bdi_needs_flusher(struct backing_dev_info *bdi)
+{
+	if (bdi->task || !bdi_cap_writeback_dirty(bdi))
+		return 0;
+	return bdi->wb_nr_pages || bdi_stat(bdi, BDI_RECLAIMABLE);
+}
+
+static int bdi_writeback_thread(void *data);
+
+/*
+ * Run by the flusher of default_backing_dev_info: start the flushers of
+ * the devices which need one.  If a thread can't be started, the work
+ * asked of the device is done for all the devices by bdi-default, and the
+ * next attempt is made the next time around.
+ */
+static void bdi_forker(void)
+{
+	struct backing_dev_info *bdi;
+	struct task_struct *task;
+
+	mutex_lock(&bdi_mutex);
+	for ( ; ; ) {
+		spin_lock(&bdi_lock);
+		list_for_each_entry(bdi, &bdi_list, bdi_list)
+			if (bdi_needs_flusher(bdi))
+				goto found;
+		spin_unlock(&bdi_lock);
+		break;
+found:
+		spin_unlock(&bdi_lock);
+
+		task = kthread_run(bdi_writeback_thread, bdi,
+				   "flush-%d", bdi_seq++);
+
+		spin_lock(&bdi_lock);
+		if (IS_ERR(task)) {
+			if (wb_global_pages < bdi->wb_nr_pages)
+				wb_global_pages = bdi->wb_nr_pages;
+			bdi->wb_nr_pages = 0;
+			spin_unlock(&bdi_lock);
+			break;
+		}
+		bdi->task = task;
+		spin_unlock(&bdi_lock);
+	}
+	mutex_unlock(&bdi_mutex);
+}
+
+/*
+ * Is there work for the flusher of @bdi?  Called under bdi_lock.
+ */
+static int bdi_work_pending(struct backing_dev_info *bdi)
+{
+	struct backing_dev_info *b;
+
+	if (bdi->wb_nr_pages)
+		return 1;
+	if (bdi != &default_backing_dev_info)
+		return 0;
+
+	if (wb_global_pages)
+		return 1;
+	list_for_each_entry(b, &bdi_list, bdi_list)
+		if (b->wb_nr_pages && !b->task)
+			return 1;
+	return 0;
+}
+
+/*
+ * The flusher thread of a device.  It does the background writeout asked
+ * of the device, and the periodic writeback of its old data.
+ */
+static int bdi_writeback_thread(void *data)
+{
+	struct backing_dev_info *bdi = data;
+	unsigned long next_kupdate = jiffies + dirty_writeback_interval;
+
+	current->flags |= PF_FLUSHER | PF_SWAPWRITE;
+
+	while (!kthread_should_stop()) {
+		long nr_pages;
+		long global_pages = 0;
+		int pending;
+
+		if (bdi == &default_backing_dev_info)
+			bdi_forker();
+
+		spin_lock(&bdi_lock);
+		nr_pages = bdi->wb_nr_pages;
+		bdi->wb_nr_pages = 0;
+		if (bdi == &default_backing_dev_info) {
+			global_pages = wb_global_pages;
+			wb_global_pages = 0;
+		}
+		spin_unlock(&bdi_lock);
+
+		if (nr_pages)
+			background_writeout(bdi, nr_pages);
+		if (global_pages)
+			background_writeout(NULL, global_pages);
+
+		if (dirty_writeback_interval &&
+		    time_after_eq(jiffies, next_kupdate))
+			next_kupdate = wb_kupdate(bdi);
+
+		set_current_state(TASK_INTERRUPTIBLE);
+		spin_lock(&bdi_lock);
+		pending = bdi_work_pending(bdi);
+		spin_unlock(&bdi_lock);
+		if (!pending && !kthread_should_stop()) {
+			long timeout = MAX_SCHEDULE_TIMEOUT;
+
+			if (dirty_writeback_interval) {
+				timeout = next_kupdate - jiffies;
+				if (timeout > dirty_writeback_interval)
+					timeout = dirty_writeback_interval;
+				if (timeout < 0)
+					timeout = 0;
+			}
+			schedule_timeout(timeout);
+		}
+		__set_current_state(TASK_RUNNING);
+		try_to_freeze();
+	}
+	return 0;
+}
+
+static int __init default_bdi_init(void)
+{
+	struct task_struct *task;
+
+	bdi_register(&default_backing_dev_info);
+
+	task = kthread_create(bdi_writeback_thread, &default_backing_dev_info,
+			      "bdi-default");
+	if (IS_ERR(task))
+		return PTR_ERR(task);
+
+	/* before it runs, or the forker would start another one */
+	spin_lock(&bdi_lock);
+	default_backing_dev_info.task = task;
+	spin_unlock(&bdi_lock);
+	wake_up_process(task);
+	return 0;
+}
+module_init(default_bdi_init);
@@ -133,12 +133,9 @@ void remove_from_page_cache(struct page *page)
 	write_unlock_irq(&mapping->tree_lock);
 }
 
-static int sync_page(void *word)
+static void unplug_page_io(struct page *page)
 {
 	struct address_space *mapping;
-	struct page *page;
-
-	page = container_of((unsigned long *)word, struct page, flags);
 
 	/*
 	 * page_mapping() is being called without PG_locked held.
@@ -165,6 +162,15 @@ static int sync_page(void *word)
 	mapping = page_mapping(page);
 	if (mapping && mapping->a_ops && mapping->a_ops->sync_page)
 		mapping->a_ops->sync_page(page);
+}
+
+static int sync_page(void *word)
+{
+	struct page *page;
+
+	page = container_of((unsigned long *)word, struct page, flags);
+
+	unplug_page_io(page);
 	io_schedule();
 	return 0;
 }
@@ -422,40 +428,48 @@ int filemap_write_and_wait_range(struct address_space *mapping,
 }
 
 /**
- * add_to_page_cache - add newly allocated pagecache pages
+ * add_to_page_cache_locked - add a locked page to the pagecache
  * @page:	page to add
  * @mapping:	the page's address_space
  * @offset:	page index
  * @gfp_mask:	page allocation mode
  *
- * This function is used to add newly allocated pagecache pages;
- * the page is new, so we can just run SetPageLocked() against it.
- * The other page state flags were set by rmqueue().
- *
+ * This function is used to add a page to the pagecache. It must be locked.
  * This function does not add the page to the LRU.  The caller must do that.
  */
-int add_to_page_cache(struct page *page, struct address_space *mapping,
+int add_to_page_cache_locked(struct page *page, struct address_space *mapping,
 		pgoff_t offset, gfp_t gfp_mask)
 {
-	int error = radix_tree_preload(gfp_mask & ~__GFP_HIGHMEM);
+	int error;
+
+	BUG_ON(!PageLocked(page));
 
+	error = radix_tree_preload(gfp_mask & ~__GFP_HIGHMEM);
 	if (error == 0) {
+		/*
+		 * Lockless lookups can find the page as soon as it is in the
+		 * tree, so it must be fully set up before it is inserted.
+		 */
+		page_cache_get(page);
+		page->mapping = mapping;
+		page->index = offset;
+
 		write_lock_irq(&mapping->tree_lock);
 		error = radix_tree_insert(&mapping->page_tree, offset, page);
 		if (!error) {
-			page_cache_get(page);
-			SetPageLocked(page);
-			page->mapping = mapping;
-			page->index = offset;
 			mapping->nrpages++;
 			__inc_zone_page_state(page, NR_FILE_PAGES);
 		}
 		write_unlock_irq(&mapping->tree_lock);
+		if (unlikely(error)) {
+			page->mapping = NULL;
+			page_cache_release(page);
+		}
 		radix_tree_preload_end();
 	}
 	return error;
 }
-EXPORT_SYMBOL(add_to_page_cache);
+EXPORT_SYMBOL(add_to_page_cache_locked);
 
 int add_to_page_cache_lru(struct page *page, struct address_space *mapping,
 				pgoff_t offset, gfp_t gfp_mask)
@@ -520,6 +534,73 @@ void fastcall wait_on_page_bit(struct page *page, int bit_nr)
 }
 EXPORT_SYMBOL(wait_on_page_bit);
 
+/*
+ * Queue the wait entry of an aio retry on the waitqueue of the page, for
+ * the wakeup to kick the retry once the bit is clear.  Returns -EIOCBRETRY
+ * when the kick is due, or 0 when the bit went clear meanwhile and nobody
+ * will kick: the entry is off the queue again and the caller goes on.
+ */
+static int __wait_on_page_bit_async(struct page *page, int bit_nr,
+				    wait_queue_t *wait)
+{
+	wait_queue_head_t *wq = page_waitqueue(page);
+	struct kiocb *iocb = io_wait_to_kiocb(wait);
+	unsigned long flags;
+	int ret = -EIOCBRETRY;
+
+	/* Queued for another page already: the retry must stop here */
+	if (kiocbIsWaiting(iocb))
+		return -EIOCBRETRY;
+
+	spin_lock_irqsave(&wq->lock, flags);
+	__add_wait_queue(wq, wait);
+	spin_unlock_irqrestore(&wq->lock, flags);
+
+	/* Pairs with the barrier between the clear_bit and the wakeup */
+	smp_mb();
+	if (!test_bit(bit_nr, &page->flags)) {
+		/*
+		 * Unless the wakeup took the entry off and kicked the iocb
+		 * already, it's up to us to go on.
+		 */
+		spin_lock_irqsave(&wq->lock, flags);
+		if (!list_empty(&wait->task_list)) {
+			list_del_init(&wait->task_list);
+			ret = 0;
+		}
+		spin_unlock_irqrestore(&wq->lock, flags);
+	}
+
+	if (ret) {
+		kiocbSetWaiting(iocb);
+		unplug_page_io(page);
+	}
+	return ret;
+}
+
+/**
+ * wait_on_page_bit_async - wait for a page bit to clear, from an aio retry
+ * @page: the page
+ * @bit_nr: the bit
+ * @wait: current->io_wait
+ *
+ * Returns 0 once the bit is clear.  In an aio retry, it does not sleep but
+ * returns -EIOCBRETRY, and the retry is kicked when the bit is cleared.
+ */
+int fastcall wait_on_page_bit_async(struct page *page, int bit_nr,
+				    wait_queue_t *wait)
+{
+	if (is_sync_wait(wait)) {
+		wait_on_page_bit(page, bit_nr);
+		return 0;
+	}
+
+	if (!test_bit(bit_nr, &page->flags))
+		return 0;
+	return __wait_on_page_bit_async(page, bit_nr, wait);
+}
+EXPORT_SYMBOL(wait_on_page_bit_async);
+
 /**
  * unlock_page - unlock a locked page
  * @page: the page
@@ -577,23 +658,70 @@ void fastcall __lock_page(struct page *page)
 }
 EXPORT_SYMBOL(__lock_page);
 
+/**
+ * __lock_page_async - get a lock on the page, or have an aio retry kicked
+ * @page: the page to lock
+ * @wait: current->io_wait
+ *
+ * See lock_page_async().
+ */
+int fastcall __lock_page_async(struct page *page, wait_queue_t *wait)
+{
+	int ret;
+
+	if (is_sync_wait(wait)) {
+		__lock_page(page);
+		return 0;
+	}
+
+	while (TestSetPageLocked(page)) {
+		ret = __wait_on_page_bit_async(page, PG_locked, wait);
+		if (ret)
+			return ret;
+	}
+	return 0;
+}
+EXPORT_SYMBOL(__lock_page_async);
+
 /**
  * find_get_page - find and get a page reference
  * @mapping: the address_space to search
  * @offset: the page index
  *
  * A rather lightweight function, finding and getting a reference to a
- * hashed page atomically.
+ * hashed page atomically.  The lookup does not take the tree_lock, it runs
+ * under rcu_read_lock() and takes a speculative reference on the page,
+ * see page_cache_get_speculative().
  */
 struct page * find_get_page(struct address_space *mapping, unsigned long offset)
 {
+	void **pagep;
 	struct page *page;
 
-	read_lock_irq(&mapping->tree_lock);
-	page = radix_tree_lookup(&mapping->page_tree, offset);
-	if (page)
-		page_cache_get(page);
-	read_unlock_irq(&mapping->tree_lock);
+	rcu_read_lock();
+repeat:
+	page = NULL;
+	pagep = radix_tree_lookup_slot(&mapping->page_tree, offset);
+	if (pagep) {
+		page = radix_tree_deref_slot(pagep);
+		if (unlikely(!page || page == RADIX_TREE_RETRY))
+			goto repeat;
+
+		if (!page_cache_get_speculative(page))
+			goto repeat;
+
+		/*
+		 * Has the page moved?
+		 * This is part of the lockless pagecache protocol. See
+		 * include/linux/pagemap.h for details.
+		 */
+		if (unlikely(page != *pagep)) {
+			page_cache_release(page);
+			goto repeat;
+		}
+	}
+	rcu_read_unlock();
+
 	return page;
 }
 EXPORT_SYMBOL(find_get_page);
@@ -633,26 +761,18 @@ struct page *find_lock_page(struct address_space *mapping,
 {
 	struct page *page;
 
-	read_lock_irq(&mapping->tree_lock);
 repeat:
-	page = radix_tree_lookup(&mapping->page_tree, offset);
+	page = find_get_page(mapping, offset);
 	if (page) {
-		page_cache_get(page);
-		if (TestSetPageLocked(page)) {
-			read_unlock_irq(&mapping->tree_lock);
-			__lock_page(page);
-			read_lock_irq(&mapping->tree_lock);
-
-			/* Has the page been truncated while we slept? */
-			if (unlikely(page->mapping != mapping ||
-				     page->index != offset)) {
-				unlock_page(page);
-				page_cache_release(page);
-				goto repeat;
-			}
+		lock_page(page);
+		/* Has the page been truncated before we locked it? */
+		if (unlikely(page->mapping != mapping ||
+			     page->index != offset)) {
+			unlock_page(page);
+			page_cache_release(page);
+			goto repeat;
 		}
 	}
-	read_unlock_irq(&mapping->tree_lock);
 	return page;
 }
 EXPORT_SYMBOL(find_lock_page);
@@ -722,13 +842,39 @@ unsigned find_get_pages(struct address_space *mapping, pgoff_t start,
 {
 	unsigned int i;
 	unsigned int ret;
+	unsigned int nr_found;
+
+	rcu_read_lock();
+restart:
+	nr_found = radix_tree_gang_lookup_slot(&mapping->page_tree,
+				(void ***)pages, start, nr_pages);
+	ret = 0;
+	for (i = 0; i < nr_found; i++) {
+		struct page *page;
+repeat:
+		page = radix_tree_deref_slot((void **)pages[i]);
+		if (unlikely(!page))
+			continue;
+		/*
+		 * this can only trigger if nr_found == 1, making livelock
+		 * a non issue.
+		 */
+		if (unlikely(page == RADIX_TREE_RETRY))
+			goto restart;
 
-	read_lock_irq(&mapping->tree_lock);
-	ret = radix_tree_gang_lookup(&mapping->page_tree,
-				(void **)pages, start, nr_pages);
-	for (i = 0; i < ret; i++)
-		page_cache_get(pages[i]);
-	read_unlock_irq(&mapping->tree_lock);
+		if (!page_cache_get_speculative(page))
+			goto repeat;
+
+		/* Has the page moved? */
+		if (unlikely(page != *((void **)pages[i]))) {
+			page_cache_release(page);
+			goto repeat;
+		}
+
+		pages[ret] = page;
+		ret++;
+	}
+	rcu_read_unlock();
 	return ret;
 }
 
@@ -749,19 +895,44 @@ unsigned find_get_pages_contig(struct address_space *mapping, pgoff_t index,
 {
 	unsigned int i;
 	unsigned int ret;
+	unsigned int nr_found;
+
+	rcu_read_lock();
+restart:
+	nr_found = radix_tree_gang_lookup_slot(&mapping->page_tree,
+				(void ***)pages, index, nr_pages);
+	ret = 0;
+	for (i = 0; i < nr_found; i++) {
+		struct page *page;
+repeat:
+		page = radix_tree_deref_slot((void **)pages[i]);
+		if (unlikely(!page))
+			continue;
+		/*
+		 * this can only trigger if nr_found == 1, making livelock
+		 * a non issue.
+		 */
+		if (unlikely(page == RADIX_TREE_RETRY))
+			goto restart;
 
-	read_lock_irq(&mapping->tree_lock);
-	ret = radix_tree_gang_lookup(&mapping->page_tree,
-				(void **)pages, index, nr_pages);
-	for (i = 0; i < ret; i++) {
-		if (pages[i]->mapping == NULL || pages[i]->index != index)
+		if (page->mapping == NULL || page->index != index)
 			break;
 
-		page_cache_get(pages[i]);
+		if (!page_cache_get_speculative(page))
+			goto repeat;
+
+		/* Has the page moved? */
+		if (unlikely(page != *((void **)pages[i]))) {
+			page_cache_release(page);
+			goto repeat;
+		}
+
+		pages[ret] = page;
+		ret++;
 		index++;
 	}
-	read_unlock_irq(&mapping->tree_lock);
-	return i;
+	rcu_read_unlock();
+	return ret;
 }
 
 /**
@@ -780,15 +951,43 @@ unsigned find_get_pages_tag(struct address_space *mapping, pgoff_t *index,
 {
 	unsigned int i;
 	unsigned int ret;
+	unsigned int nr_found;
+
+	rcu_read_lock();
+restart:
+	nr_found = radix_tree_gang_lookup_tag_slot(&mapping->page_tree,
+				(void ***)pages, *index, nr_pages, tag);
+	ret = 0;
+	for (i = 0; i < nr_found; i++) {
+		struct page *page;
+repeat:
+		page = radix_tree_deref_slot((void **)pages[i]);
+		if (unlikely(!page))
+			continue;
+		/*
+		 * this can only trigger if nr_found == 1, making livelock
+		 * a non issue.
+		 */
+		if (unlikely(page == RADIX_TREE_RETRY))
+			goto restart;
+
+		if (!page_cache_get_speculative(page))
+			goto repeat;
+
+		/* Has the page moved? */
+		if (unlikely(page != *((void **)pages[i]))) {
+			page_cache_release(page);
+			goto repeat;
+		}
+
+		pages[ret] = page;
+		ret++;
+	}
+	rcu_read_unlock();
 
-	read_lock_irq(&mapping->tree_lock);
-	ret = radix_tree_gang_lookup_tag(&mapping->page_tree,
-				(void **)pages, *index, nr_pages, tag);
-	for (i = 0; i < ret; i++)
-		page_cache_get(pages[i]);
 	if (ret)
 		*index = pages[ret - 1]->index + 1;
-	read_unlock_irq(&mapping->tree_lock);
+
 	return ret;
 }
 
@@ -881,7 +1080,6 @@ void do_generic_mapping_read(struct address_space *mapping,
 	unsigned long end_index;
 	unsigned long offset;
 	unsigned long last_index;
-	unsigned long next_index;
 	unsigned long prev_index;
 	loff_t isize;
 	struct page *cached_page;
@@ -890,7 +1088,6 @@ void do_generic_mapping_read(struct address_space *mapping,
 
 	cached_page = NULL;
 	index = *ppos >> PAGE_CACHE_SHIFT;
-	next_index = index;
 	prev_index = ra.prev_page;
 	last_index = (*ppos + desc->count + PAGE_CACHE_SIZE-1) >> PAGE_CACHE_SHIFT;
 	offset = *ppos & ~PAGE_CACHE_MASK;
@@ -917,15 +1114,18 @@ void do_generic_mapping_read(struct address_space *mapping,
 		nr = nr - offset;
 
 		cond_resched();
-		if (index == next_index)
-			next_index = page_cache_readahead(mapping, &ra, filp,
-					index, last_index - index);
-
 find_page:
 		page = find_get_page(mapping, index);
 		if (unlikely(page == NULL)) {
-			handle_ra_miss(mapping, &ra, index);
-			goto no_cached_page;
+			page_cache_sync_readahead(mapping, &ra, filp,
+					index, last_index - index);
+			page = find_get_page(mapping, index);
+			if (unlikely(page == NULL))
+				goto no_cached_page;
+		}
+		if (PageReadahead(page)) {
+			page_cache_async_readahead(mapping, &ra, filp, page,
+					index, last_index - index);
 		}
 		if (!PageUptodate(page))
 			goto page_not_up_to_date;
@@ -967,8 +1167,20 @@ page_ok:
 		goto out;
 
 page_not_up_to_date:
+		/*
+		 * An aio read waits for a page under read, readahead's say,
+		 * without its lock: the retry finds it up to date when kicked.
+		 */
+		if (!is_sync_wait(current->io_wait)) {
+			if (wait_on_page_locked_async(page, current->io_wait))
+				goto page_wait;
+			if (PageUptodate(page))
+				goto page_ok;
+		}
+
 		/* Get exclusive access to the page ... */
-		lock_page(page);
+		if (lock_page_async(page, current->io_wait))
+			goto page_wait;
 
 		/* Did it get unhashed before we got the lock? */
 		if (!page->mapping) {
@@ -983,6 +1195,18 @@ page_not_up_to_date:
 			goto page_ok;
 		}
 
+		/*
+		 * An aio read comes back here after waiting for the read of
+		 * the page: report its failure rather than read it again,
+		 * as the synchronous read below does.
+		 */
+		if (unlikely(PageError(page)) && !is_sync_wait(current->io_wait)) {
+			unlock_page(page);
+			error = -EIO;
+			shrink_readahead_size_eio(filp, &ra);
+			goto readpage_error;
+		}
+
 readpage:
 		/* Start the actual read. The read will unlock the page. */
 		error = mapping->a_ops->readpage(filp, page);
@@ -996,7 +1220,8 @@ readpage:
 		}
 
 		if (!PageUptodate(page)) {
-			lock_page(page);
+			if (lock_page_async(page, current->io_wait))
+				goto page_wait;
 			if (!PageUptodate(page)) {
 				if (page->mapping == NULL) {
 					/*
@@ -1047,6 +1272,12 @@ readpage_error:
 		page_cache_release(page);
 		goto out;
 
+page_wait:
+		/* An aio read goes on from here when the page is unlocked */
+		desc->error = -EIOCBRETRY;
+		page_cache_release(page);
+		goto out;
+
 no_cached_page:
 		/*
 		 * Ok, it wasn't cached, so we need to create a new
@@ -1073,6 +1304,7 @@ no_cached_page:
 	}
 
 out:
+	ra.prev_page = prev_index;
 	*_ra = ra;
 
 	*ppos = ((loff_t) index << PAGE_CACHE_SHIFT) + offset;
@@ -1377,27 +1609,31 @@ retry_all:
 	if (VM_RandomReadHint(area))
 		goto no_cached_page;
 
-	/*
-	 * The readahead code wants to be told about each and every page
-	 * so it can build and shrink its windows appropriately
-	 *
-	 * For sequential accesses, we use the generic readahead logic.
-	 */
-	if (VM_SequentialReadHint(area))
-		page_cache_readahead(mapping, ra, file, pgoff, 1);
-
 	/*
 	 * Do we have something in the page cache already?
 	 */
 retry_find:
 	page = find_get_page(mapping, pgoff);
+	/*
+	 * For sequential accesses, we use the generic readahead logic.
+	 */
+	if (VM_SequentialReadHint(area)) {
+		if (!page) {
+			page_cache_sync_readahead(mapping, ra, file, pgoff, 1);
+			page = find_get_page(mapping, pgoff);
+			if (!page)
+				goto no_cached_page;
+		}
+		if (PageReadahead(page)) {
+			page_cache_async_readahead(mapping, ra, file, page,
+						   pgoff, 1);
+		}
+		ra->prev_page = pgoff;
+	}
+
 	if (!page) {
 		unsigned long ra_pages;
 
-		if (VM_SequentialReadHint(area)) {
-			handle_ra_miss(mapping, ra, pgoff);
-			goto no_cached_page;
-		}
 		ra->mmap_miss++;
 
 		/*
@@ -1852,7 +2088,8 @@ EXPORT_SYMBOL(read_cache_page);
 /*
  * If the page was newly created, increment its refcount and add it to the
  * caller's lru-buffering pagevec.  This function is specifically for
- * generic_file_write().
+ * generic_file_write().  For an aio write, a locked page is not waited for:
+ * ERR_PTR(-EIOCBRETRY) is returned, and the write is kicked on the unlock.
  */
 static inline struct page *
 __grab_cache_page(struct address_space *mapping, unsigned long index,
@@ -1861,8 +2098,21 @@ __grab_cache_page(struct address_space *mapping, unsigned long index,
 	int err;
 	struct page *page;
 repeat:
-	page = find_lock_page(mapping, index);
-	if (!page) {
+	page = find_get_page(mapping, index);
+	if (page) {
+		err = lock_page_async(page, current->io_wait);
+		if (unlikely(err)) {
+			page_cache_release(page);
+			return ERR_PTR(err);
+		}
+		/* Has the page been truncated before we locked it? */
+		if (unlikely(page->mapping != mapping ||
+			     page->index != index)) {
+			unlock_page(page);
+			page_cache_release(page);
+			goto repeat;
+		}
+	} else {
 		if (!*cached_page) {
 			*cached_page = page_cache_alloc(mapping);
 			if (!*cached_page)
@@ -2121,6 +2371,10 @@ generic_file_buffered_write(struct kiocb *iocb, const struct iovec *iov,
 			status = -ENOMEM;
 			break;
 		}
+		if (IS_ERR(page)) {
+			status = PTR_ERR(page);
+			break;
+		}
 
 		if (unlikely(bytes == 0)) {
 			status = 0;
@@ -376,6 +376,7 @@ static void __blk_queue_bounce(request_queue_t *q, struct bio **bio_orig,
 	struct bio *bio = NULL;
 	int i, rw = bio_data_dir(*bio_orig);
 	struct bio_vec *to, *from;
+	unsigned int bounced = 0;
 
 	bio_for_each_segment(from, *bio_orig, i) {
 		page = from->bv_page;
@@ -398,6 +399,7 @@ static void __blk_queue_bounce(request_queue_t *q, struct bio **bio_orig,
 		to->bv_len = from->bv_len;
 		to->bv_offset = from->bv_offset;
 		inc_zone_page_state(to->bv_page, NR_BOUNCE);
+		bounced += to->bv_len;
 
 		if (rw == WRITE) {
 			char *vto, *vfrom;
@@ -416,6 +418,8 @@ static void __blk_queue_bounce(request_queue_t *q, struct bio **bio_orig,
 	if (!bio)
 		return;
 
+	atomic_long_add(bounced >> 9, &q->bounced_sectors);
+
 	/*
 	 * at least one page was bounced, fill in possible non-highmem
 	 * pages
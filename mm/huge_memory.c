@@ -0,0 +1,865 @@
+/*
+ * linux/mm/huge_memory.c
+ *
+ * Transparent huge pages: private anonymous memory backed by huge pages
+ * mapped with a single pmd, without the application having to know.
+ *
+ * A huge page is mapped by exactly one pmd of one mm, and is kept off the
+ * LRU lists.  Anything that needs the range at pte granularity (partial
+ * munmap or mprotect, mremap, fork, get_user_pages with FOLL_GET, page
+ * migration) first splits the pmd, which also turns the compound page into
+ * HPAGE_PMD_NR ordinary anonymous pages that go onto the LRU.  Reclaim gets
+ * at huge pages through a shrinker that splits them.  khugepaged goes the
+ * other way, copying runs of small pages into a new huge page.
+ *
+ * The page table needed to split a huge pmd is allocated with the huge
+ * page and kept on mm->pmd_huge_pte, so that splitting never fails.
+ */
+#include <linux/mm.h>
+#include <linux/module.h>
+#include <linux/sched.h>
+#include <linux/highmem.h>
+#include <linux/huge_mm.h>
+#include <linux/mman.h>
+#include <linux/rmap.h>
+#include <linux/swap.h>
+#include <linux/pagemap.h>
+#include <linux/kthread.h>
+#include <linux/kobject.h>
+#include <linux/sysfs.h>
+#include <linux/init.h>
+
+#include <asm/tlb.h>
+#include <asm/tlbflush.h>
+#include <asm/pgalloc.h>
+#include "internal.h"
+
+unsigned long transparent_hugepage_flags __read_mostly =
+	TRANSPARENT_HUGEPAGE_MADVISE;
+
+/*
+ * Every huge page mapped by a huge pmd, linked through the head page's
+ * lru, for the shrinker to split from the oldest.
+ */
+static LIST_HEAD(huge_page_list);
+static DEFINE_SPINLOCK(huge_page_lock);
+static unsigned long nr_huge_pages_mapped;
+
+/* khugepaged tunables and statistics */
+static unsigned int khugepaged_pages_to_scan __read_mostly = HPAGE_PMD_NR * 8;
+static unsigned int khugepaged_scan_sleep_millisecs __read_mostly = 10000;
+static unsigned int khugepaged_max_ptes_none __read_mostly = HPAGE_PMD_NR - 1;
+static unsigned long khugepaged_pages_collapsed;
+static unsigned long khugepaged_full_scans;
+
+/*
+ * The mms khugepaged scans, each holding an mm_count reference, and
+ * where the scan has got to.
+ */
+static LIST_HEAD(khugepaged_mms);
+static DEFINE_SPINLOCK(khugepaged_lock);
+static struct mm_struct *khugepaged_scan_mm;
+static unsigned long khugepaged_scan_address;
+static DECLARE_WAIT_QUEUE_HEAD(khugepaged_wait);
+
+static void huge_page_list_add(struct page *page)
+{
+	spin_lock(&huge_page_lock);
+	list_add(&page->lru, &huge_page_list);
+	nr_huge_pages_mapped++;
+	spin_unlock(&huge_page_lock);
+}
+
+static void huge_page_list_del(struct page *page)
+{
+	spin_lock(&huge_page_lock);
+	if (!list_empty(&page->lru)) {
+		list_del_init(&page->lru);
+		nr_huge_pages_mapped--;
+	}
+	spin_unlock(&huge_page_lock);
+}
+
+/* Set aside and take back the page table of a huge pmd, under page_table_lock */
+static void pgtable_deposit(struct mm_struct *mm, struct page *pgtable)
+{
+	list_add(&pgtable->lru, &mm->pmd_huge_pte);
+}
+
+static struct page *pgtable_withdraw(struct mm_struct *mm)
+{
+	struct page *pgtable;
+
+	BUG_ON(list_empty(&mm->pmd_huge_pte));
+	pgtable = list_entry(mm->pmd_huge_pte.next, struct page, lru);
+	list_del(&pgtable->lru);
+	return pgtable;
+}
+
+static struct page *alloc_hugepage_vma(struct vm_area_struct *vma,
+		unsigned long haddr)
+{
+	return alloc_pages_vma(GFP_HIGHUSER_MOVABLE | __GFP_COMP |
+			       __GFP_NOWARN | __GFP_NORETRY,
+			       HPAGE_PMD_ORDER, vma, haddr);
+}
+
+static void clear_huge_page(struct page *page, unsigned long haddr)
+{
+	int i;
+
+	for (i = 0; i < HPAGE_PMD_NR; i++) {
+		cond_resched();
+		clear_user_highpage(page + i, haddr + i * PAGE_SIZE);
+	}
+}
+
+static pmd_t mk_huge_pmd(struct page *page, struct vm_area_struct *vma)
+{
+	pte_t entry = mk_pte(page, vma->vm_page_prot);
+
+	/* the page is ours alone, so it can be writable from the start */
+	if (vma->vm_flags & VM_WRITE)
+		entry = pte_mkwrite(pte_mkdirty(entry));
+	return pte_huge_pmd(pte_mkyoung(entry));
+}
+
+/*
+ * Account a new huge page mapped at @pmd, with its page table set aside.
+ * Called with page_table_lock held.
+ */
+static void map_huge_page(struct mm_struct *mm, struct vm_area_struct *vma,
+		unsigned long haddr, pmd_t *pmd, struct page *page,
+		struct page *pgtable)
+{
+	page_add_new_anon_rmap(page, vma, haddr);
+	mod_zone_page_state(page_zone(page), NR_ANON_PAGES, HPAGE_PMD_NR - 1);
+	pgtable_deposit(mm, pgtable);
+	set_pmd(pmd, mk_huge_pmd(page, vma));
+	huge_page_list_add(page);
+}
+
+int do_huge_pmd_anonymous_page(struct mm_struct *mm, struct vm_area_struct *vma,
+		unsigned long address, pmd_t *pmd, int write_access)
+{
+	unsigned long haddr = address & HPAGE_PMD_MASK;
+	struct page *page, *pgtable;
+
+	if (haddr < vma->vm_start || haddr + HPAGE_PMD_SIZE > vma->vm_end)
+		return VM_FAULT_FALLBACK;
+	khugepaged_enter(mm);
+
+	if (unlikely(anon_vma_prepare(vma)))
+		return VM_FAULT_OOM;
+	page = alloc_hugepage_vma(vma, haddr);
+	if (!page) {
+		count_vm_event(THP_FAULT_FALLBACK);
+		return VM_FAULT_FALLBACK;
+	}
+	pgtable = pte_alloc_one(mm, haddr);
+	if (!pgtable) {
+		put_page(page);
+		return VM_FAULT_OOM;
+	}
+	pte_lock_init(pgtable);
+	clear_huge_page(page, haddr);
+
+	spin_lock(&mm->page_table_lock);
+	if (unlikely(!pmd_none(*pmd))) {
+		/* raced with another fault: let the caller look again */
+		spin_unlock(&mm->page_table_lock);
+		pte_lock_deinit(pgtable);
+		pte_free(pgtable);
+		put_page(page);
+		return VM_FAULT_FALLBACK;
+	}
+	mm->nr_ptes++;
+	inc_zone_page_state(pgtable, NR_PAGETABLE);
+	add_mm_counter(mm, anon_rss, HPAGE_PMD_NR);
+	map_huge_page(mm, vma, haddr, pmd, page, pgtable);
+	spin_unlock(&mm->page_table_lock);
+
+	count_vm_event(THP_FAULT_ALLOC);
+	return VM_FAULT_MINOR;
+}
+
+/*
+ * A fault on a present huge pmd: as huge pages are never shared, a write
+ * fault reuses the page, just as do_wp_page() does for an exclusive one.
+ */
+int do_huge_pmd_fault(struct mm_struct *mm, struct vm_area_struct *vma,
+		unsigned long address, pmd_t *pmd, int write_access)
+{
+	pte_t entry;
+
+	if (write_access && !(vma->vm_flags & VM_WRITE)) {
+		/* forced write by get_user_pages: COW it at pte level */
+		split_huge_page_pmd(mm, pmd);
+		return VM_FAULT_FALLBACK;
+	}
+
+	spin_lock(&mm->page_table_lock);
+	if (unlikely(!pmd_trans_huge(*pmd))) {
+		spin_unlock(&mm->page_table_lock);
+		return VM_FAULT_FALLBACK;
+	}
+	entry = huge_pmd_pte(*pmd);
+	if (write_access)
+		entry = pte_mkwrite(pte_mkdirty(entry));
+	entry = pte_mkyoung(entry);
+	set_pmd(pmd, pte_huge_pmd(entry));
+	spin_unlock(&mm->page_table_lock);
+
+	if (write_access)
+		flush_tlb_page(vma, address);
+	return VM_FAULT_MINOR;
+}
+
+/*
+ * follow_page() for a huge pmd, when no reference is wanted on the page.
+ */
+struct page *follow_trans_huge_pmd(struct mm_struct *mm, unsigned long address,
+		pmd_t *pmd, unsigned int flags)
+{
+	struct page *page = NULL;
+	pte_t entry;
+
+	spin_lock(&mm->page_table_lock);
+	if (unlikely(!pmd_trans_huge(*pmd)))
+		goto out;
+	entry = huge_pmd_pte(*pmd);
+	if ((flags & FOLL_WRITE) && !pte_write(entry))
+		goto out;
+	page = pte_page(entry) + ((address & ~HPAGE_PMD_MASK) >> PAGE_SHIFT);
+	if (flags & FOLL_TOUCH) {
+		entry = pte_mkyoung(entry);
+		if (flags & FOLL_WRITE)
+			entry = pte_mkdirty(entry);
+		set_pmd(pmd, pte_huge_pmd(entry));
+	}
+out:
+	spin_unlock(&mm->page_table_lock);
+	return page;
+}
+
+/*
+ * Unmap the whole huge page at @pmd.  Returns 0 if the pmd was split
+ * under us, for the caller to zap at pte level.
+ */
+int zap_huge_pmd(struct mmu_gather *tlb, struct vm_area_struct *vma,
+		pmd_t *pmd)
+{
+	struct mm_struct *mm = tlb->mm;
+	struct page *page, *pgtable;
+
+	spin_lock(&mm->page_table_lock);
+	if (unlikely(!pmd_trans_huge(*pmd))) {
+		spin_unlock(&mm->page_table_lock);
+		return 0;
+	}
+	page = pte_page(huge_pmd_pte(*pmd));
+	pmd_clear(pmd);
+	pgtable = pgtable_withdraw(mm);
+	mm->nr_ptes--;
+	huge_page_list_del(page);
+	page_remove_rmap(page);
+	mod_zone_page_state(page_zone(page), NR_ANON_PAGES,
+			    -(HPAGE_PMD_NR - 1));
+	add_mm_counter(mm, anon_rss, -HPAGE_PMD_NR);
+	spin_unlock(&mm->page_table_lock);
+
+	/* never linked into a pmd, so not in any TLB */
+	dec_zone_page_state(pgtable, NR_PAGETABLE);
+	pte_lock_deinit(pgtable);
+	pte_free(pgtable);
+	tlb_remove_page(tlb, page);
+	return 1;
+}
+
+/*
+ * Change the protection of a whole huge pmd in place; the caller flushes
+ * the TLB.  Returns 0 if the pmd was split under us.
+ */
+int change_huge_pmd(struct mm_struct *mm, pmd_t *pmd, pgprot_t newprot)
+{
+	pte_t entry;
+
+	spin_lock(&mm->page_table_lock);
+	if (unlikely(!pmd_trans_huge(*pmd))) {
+		spin_unlock(&mm->page_table_lock);
+		return 0;
+	}
+	entry = pte_modify(huge_pmd_pte(*pmd), newprot);
+	set_pmd(pmd, pte_huge_pmd(entry));
+	spin_unlock(&mm->page_table_lock);
+	return 1;
+}
+
+/*
+ * Replace the huge pmd by a page table mapping the same pages with the
+ * same protection, and make the compound page HPAGE_PMD_NR anonymous
+ * pages mapped once each.  Any extra references on the head page, which
+ * get_page() on a tail page would also have taken, stay on the head.
+ * Called with page_table_lock held.
+ */
+static void __split_huge_pmd_locked(struct mm_struct *mm, pmd_t *pmd)
+{
+	pte_t entry = huge_pmd_pte(*pmd);
+	struct page *page = pte_page(entry);
+	struct page *pgtable;
+	pmd_t _pmd;
+	pte_t *pte;
+	int i;
+
+	huge_page_list_del(page);
+
+	for (i = 0; i < HPAGE_PMD_NR; i++) {
+		struct page *p = page + i;
+
+		__ClearPageCompound(p);
+		set_page_private(p, 0);
+		if (i) {
+			set_page_refcounted(p);
+			p->mapping = page->mapping;
+			p->index = page->index + i;
+			atomic_set(&p->_mapcount, 0);
+			SetPageSwapBacked(p);
+		}
+	}
+
+	pgtable = pgtable_withdraw(mm);
+	pmd_populate(mm, &_pmd, pgtable);
+	pte = pte_offset_map(&_pmd, 0);
+	for (i = 0; i < HPAGE_PMD_NR; i++)
+		set_pte(pte + i, pfn_pte(pte_pfn(entry) + i, pte_pgprot(entry)));
+	pte_unmap(pte);
+
+	smp_wmb(); /* ptes are visible before the pmd pointing at them */
+	pmd_populate(mm, pmd, pgtable);
+	/* the huge TLB entry must go before the small ones can be used */
+	flush_tlb_mm(mm);
+
+	for (i = 0; i < HPAGE_PMD_NR; i++)
+		lru_cache_add_active(page + i);
+	count_vm_event(THP_SPLIT);
+}
+
+void __split_huge_page_pmd(struct mm_struct *mm, pmd_t *pmd)
+{
+	spin_lock(&mm->page_table_lock);
+	if (likely(pmd_trans_huge(*pmd)))
+		__split_huge_pmd_locked(mm, pmd);
+	spin_unlock(&mm->page_table_lock);
+}
+
+static pmd_t *mm_find_pmd(struct mm_struct *mm, unsigned long address)
+{
+	pgd_t *pgd;
+	pud_t *pud;
+	pmd_t *pmd;
+
+	pgd = pgd_offset(mm, address);
+	if (!pgd_present(*pgd))
+		return NULL;
+	pud = pud_offset(pgd, address);
+	if (!pud_present(*pud))
+		return NULL;
+	pmd = pmd_offset(pud, address);
+	if (!pmd_present(*pmd))
+		return NULL;
+	return pmd;
+}
+
+/*
+ * Split the huge pmd mapping @page at @address in @mm, if there is one.
+ * Called by split_huge_page() under the anon_vma lock.
+ */
+void split_huge_page_address(struct mm_struct *mm, unsigned long address,
+		struct page *page)
+{
+	pmd_t *pmd = mm_find_pmd(mm, address);
+
+	if (!pmd)
+		return;
+	spin_lock(&mm->page_table_lock);
+	if (pmd_trans_huge(*pmd) && pte_page(huge_pmd_pte(*pmd)) == page)
+		__split_huge_pmd_locked(mm, pmd);
+	spin_unlock(&mm->page_table_lock);
+}
+
+/*
+ * Huge pages are off the LRU, so reclaim can't see them: under memory
+ * pressure split the least recently mapped ones, one per HPAGE_PMD_NR
+ * pages reclaim asks us to scan, and leave the small pages to it.
+ */
+static int shrink_huge_pages(int nr_to_scan, gfp_t gfp_mask)
+{
+	struct page *page;
+
+	nr_to_scan = (nr_to_scan + HPAGE_PMD_NR - 1) / HPAGE_PMD_NR;
+	while (nr_to_scan-- > 0) {
+		spin_lock(&huge_page_lock);
+		if (list_empty(&huge_page_list)) {
+			spin_unlock(&huge_page_lock);
+			break;
+		}
+		page = list_entry(huge_page_list.prev, struct page, lru);
+		list_del_init(&page->lru);
+		nr_huge_pages_mapped--;
+		get_page(page);
+		spin_unlock(&huge_page_lock);
+
+		split_huge_page(page);
+		put_page(page);
+	}
+	return nr_huge_pages_mapped * HPAGE_PMD_NR;
+}
+
+int hugepage_madvise(unsigned long *vm_flags, int advice)
+{
+	switch (advice) {
+	case MADV_HUGEPAGE:
+		*vm_flags &= ~VM_NOHUGEPAGE;
+		*vm_flags |= VM_HUGEPAGE;
+		break;
+	case MADV_NOHUGEPAGE:
+		*vm_flags &= ~VM_HUGEPAGE;
+		*vm_flags |= VM_NOHUGEPAGE;
+		break;
+	}
+	return 0;
+}
+
+/*
+ * khugepaged
+ */
+
+void khugepaged_enter(struct mm_struct *mm)
+{
+	int wakeup = 0;
+
+	if (!list_empty(&mm->khugepaged_link))
+		return;
+	spin_lock(&khugepaged_lock);
+	if (list_empty(&mm->khugepaged_link)) {
+		wakeup = list_empty(&khugepaged_mms);
+		atomic_inc(&mm->mm_count);
+		list_add_tail(&mm->khugepaged_link, &khugepaged_mms);
+	}
+	spin_unlock(&khugepaged_lock);
+	if (wakeup)
+		wake_up_interruptible(&khugepaged_wait);
+}
+
+void khugepaged_fork(struct mm_struct *mm, struct mm_struct *oldmm)
+{
+	if (!list_empty(&oldmm->khugepaged_link))
+		khugepaged_enter(mm);
+}
+
+/*
+ * Can the small page mapped by @pteval be copied into a huge page and
+ * freed?  Only if the pte is all that holds it.
+ */
+static int collapse_pte_ok(struct vm_area_struct *vma, unsigned long address,
+		pte_t pteval)
+{
+	struct page *page;
+
+	if (!pte_present(pteval))
+		return 0;
+	page = vm_normal_page(vma, address, pteval);
+	if (!page || !PageAnon(page) || PageCompound(page) ||
+	    PageSwapCache(page) || PageLocked(page))
+		return 0;
+	return page_mapcount(page) == 1 && page_count(page) == 1;
+}
+
+/*
+ * Check the ptes of [@address, @address + HPAGE_PMD_SIZE) under @pte:
+ * returns the number present, or -1 if they can't be collapsed.
+ */
+static int collapse_scan_ptes(struct vm_area_struct *vma,
+		unsigned long address, pte_t *pte)
+{
+	int none = 0, present = 0;
+	int i;
+
+	for (i = 0; i < HPAGE_PMD_NR; i++, address += PAGE_SIZE) {
+		pte_t pteval = pte[i];
+
+		if (pte_none(pteval)) {
+			if (++none > khugepaged_max_ptes_none)
+				return -1;
+			continue;
+		}
+		if (!collapse_pte_ok(vma, address, pteval))
+			return -1;
+		present++;
+	}
+	return present ? present : -1;
+}
+
+/*
+ * Replace the page table at @address by a huge page holding a copy of its
+ * pages.  Called with mmap_sem held for reading, which is dropped: the
+ * collapse itself is done with it held for writing, which keeps faults,
+ * get_user_pages and swapoff away; the anon_vma lock keeps rmap away while
+ * the pmd is taken down.
+ */
+static void collapse_huge_page(struct mm_struct *mm, unsigned long address,
+		struct vm_area_struct *vma)
+{
+	struct page *new_page, *pgtable;
+	pmd_t *pmd, _pmd;
+	pte_t *pte;
+	spinlock_t *ptl;
+	int present, i;
+
+	new_page = alloc_hugepage_vma(vma, address);
+	up_read(&mm->mmap_sem);
+	if (!new_page) {
+		count_vm_event(THP_COLLAPSE_ALLOC_FAILED);
+		return;
+	}
+	count_vm_event(THP_COLLAPSE_ALLOC);
+
+	down_write(&mm->mmap_sem);
+	vma = find_vma(mm, address);
+	if (!vma || address < vma->vm_start ||
+	    address + HPAGE_PMD_SIZE > vma->vm_end ||
+	    !transparent_hugepage_enabled(vma) || !vma->anon_vma)
+		goto out;
+	pmd = mm_find_pmd(mm, address);
+	if (!pmd || pmd_trans_huge(*pmd) || pmd_ptes_shared(*pmd))
+		goto out;
+
+	/* keep speculative faults off the page table being taken down */
+	vma_write_begin(vma);
+	spin_lock(&vma->anon_vma->lock);
+	pte = pte_offset_map_lock(mm, pmd, address, &ptl);
+	present = collapse_scan_ptes(vma, address, pte);
+	pte_unmap_unlock(pte, ptl);
+	if (present < 0) {
+		spin_unlock(&vma->anon_vma->lock);
+		goto out_seq;
+	}
+	/* take the page table out of reach of the hardware and of rmap */
+	spin_lock(&mm->page_table_lock);
+	_pmd = *pmd;
+	pmd_clear(pmd);
+	spin_unlock(&mm->page_table_lock);
+	flush_tlb_range(vma, address, address + HPAGE_PMD_SIZE);
+	spin_unlock(&vma->anon_vma->lock);
+
+	/* nothing else can see or change the ptes now */
+	pgtable = pmd_page(_pmd);
+	pte = pte_offset_map(&_pmd, address);
+	for (i = 0; i < HPAGE_PMD_NR; i++) {
+		unsigned long addr = address + i * PAGE_SIZE;
+		pte_t pteval = pte[i];
+		struct page *src;
+
+		if (pte_none(pteval)) {
+			clear_user_highpage(new_page + i, addr);
+			continue;
+		}
+		src = vm_normal_page(vma, addr, pteval);
+		copy_user_highpage(new_page + i, src, addr);
+		pte_clear(mm, addr, pte + i);
+		page_remove_rmap(src);
+		page_cache_release(src);
+		cond_resched();
+	}
+	pte_unmap(pte);
+
+	spin_lock(&mm->page_table_lock);
+	add_mm_counter(mm, anon_rss, HPAGE_PMD_NR - present);
+	map_huge_page(mm, vma, address, pmd, new_page, pgtable);
+	spin_unlock(&mm->page_table_lock);
+	new_page = NULL;
+	khugepaged_pages_collapsed++;
+out_seq:
+	vma_write_end(vma);
+out:
+	up_write(&mm->mmap_sem);
+	if (new_page)
+		put_page(new_page);
+}
+
+/*
+ * Look at the page table covering @address in @vma.  Returns 1 if a
+ * collapse was tried, in which case mmap_sem has been dropped.
+ */
+static int khugepaged_scan_pmd(struct mm_struct *mm,
+		struct vm_area_struct *vma, unsigned long address)
+{
+	pmd_t *pmd;
+	pte_t *pte;
+	spinlock_t *ptl;
+	int present;
+
+	pmd = mm_find_pmd(mm, address);
+	if (!pmd || pmd_trans_huge(*pmd) || pmd_ptes_shared(*pmd))
+		return 0;
+	pte = pte_offset_map_lock(mm, pmd, address, &ptl);
+	present = collapse_scan_ptes(vma, address, pte);
+	pte_unmap_unlock(pte, ptl);
+	if (present < 0)
+		return 0;
+
+	collapse_huge_page(mm, address, vma);
+	return 1;
+}
+
+/* Take the scan on to the mm after @mm, dropping @mm if it has exited */
+static void khugepaged_next_mm(struct mm_struct *mm, int exited)
+{
+	spin_lock(&khugepaged_lock);
+	if (mm->khugepaged_link.next == &khugepaged_mms) {
+		khugepaged_scan_mm = NULL;
+		khugepaged_full_scans++;
+	} else
+		khugepaged_scan_mm = list_entry(mm->khugepaged_link.next,
+					struct mm_struct, khugepaged_link);
+	khugepaged_scan_address = 0;
+	if (exited)
+		list_del_init(&mm->khugepaged_link);
+	spin_unlock(&khugepaged_lock);
+	if (exited)
+		mmdrop(mm);
+}
+
+static unsigned int khugepaged_scan_mm_slot(unsigned int pages)
+{
+	struct vm_area_struct *vma;
+	struct mm_struct *mm;
+	unsigned long address;
+	unsigned int progress = 0;
+
+	spin_lock(&khugepaged_lock);
+	if (!khugepaged_scan_mm) {
+		if (list_empty(&khugepaged_mms)) {
+			spin_unlock(&khugepaged_lock);
+			return pages;
+		}
+		khugepaged_scan_mm = list_entry(khugepaged_mms.next,
+					struct mm_struct, khugepaged_link);
+		khugepaged_scan_address = 0;
+	}
+	mm = khugepaged_scan_mm;
+	address = khugepaged_scan_address;
+	spin_unlock(&khugepaged_lock);
+
+	if (!atomic_inc_not_zero(&mm->mm_users)) {
+		khugepaged_next_mm(mm, 1);
+		return 1;
+	}
+
+again:
+	down_read(&mm->mmap_sem);
+	for (vma = find_vma(mm, address); vma; vma = vma->vm_next) {
+		unsigned long hstart, hend;
+
+		hstart = (vma->vm_start + ~HPAGE_PMD_MASK) & HPAGE_PMD_MASK;
+		hend = vma->vm_end & HPAGE_PMD_MASK;
+		progress++;
+		if (!transparent_hugepage_enabled(vma) || hstart >= hend)
+			continue;
+		if (address < hstart)
+			address = hstart;
+		while (address < hend) {
+			int dropped;
+
+			if (kthread_should_stop() || progress >= pages)
+				goto breakout;
+			dropped = khugepaged_scan_pmd(mm, vma, address);
+			address += HPAGE_PMD_SIZE;
+			progress += HPAGE_PMD_NR;
+			if (dropped)
+				goto again;
+		}
+	}
+breakout:
+	up_read(&mm->mmap_sem);
+
+	if (vma) {
+		spin_lock(&khugepaged_lock);
+		khugepaged_scan_address = address;
+		spin_unlock(&khugepaged_lock);
+	} else
+		khugepaged_next_mm(mm, 0);
+	mmput(mm);
+	return progress;
+}
+
+static int khugepaged_has_work(void)
+{
+	return !list_empty(&khugepaged_mms) &&
+		(transparent_hugepage_flags & (TRANSPARENT_HUGEPAGE_ALWAYS |
+					       TRANSPARENT_HUGEPAGE_MADVISE));
+}
+
+static void khugepaged_do_scan(void)
+{
+	unsigned int progress = 0;
+	unsigned int pages = khugepaged_pages_to_scan;
+
+	while (progress < pages && khugepaged_has_work()) {
+		cond_resched();
+		if (kthread_should_stop())
+			break;
+		progress += khugepaged_scan_mm_slot(pages - progress);
+	}
+}
+
+static int khugepaged(void *none)
+{
+	set_user_nice(current, 19);
+	while (!kthread_should_stop()) {
+		khugepaged_do_scan();
+		if (khugepaged_has_work())
+			wait_event_interruptible_timeout(khugepaged_wait,
+				kthread_should_stop(),
+				msecs_to_jiffies(khugepaged_scan_sleep_millisecs));
+		else
+			wait_event_interruptible(khugepaged_wait,
+				kthread_should_stop() || khugepaged_has_work());
+		try_to_freeze();
+	}
+	return 0;
+}
+
+/*
+ * /sys/kernel/transparent_hugepage
+ */
+
+#define THP_ATTR_RO(_name) \
+static struct subsys_attribute _name##_attr = __ATTR_RO(_name)
+
+#define THP_ATTR_RW(_name) \
+static struct subsys_attribute _name##_attr = \
+	__ATTR(_name, 0644, _name##_show, _name##_store)
+
+static ssize_t enabled_show(struct subsystem *subsys, char *page)
+{
+	if (transparent_hugepage_flags & TRANSPARENT_HUGEPAGE_ALWAYS)
+		return sprintf(page, "[always] madvise never\n");
+	if (transparent_hugepage_flags & TRANSPARENT_HUGEPAGE_MADVISE)
+		return sprintf(page, "always [madvise] never\n");
+	return sprintf(page, "always madvise [never]\n");
+}
+
+static int parse_enabled(const char *buf, size_t count)
+{
+	if (count && buf[count - 1] == '\n')
+		count--;
+	if (count == 6 && !memcmp(buf, "always", 6))
+		transparent_hugepage_flags = TRANSPARENT_HUGEPAGE_ALWAYS;
+	else if (count == 7 && !memcmp(buf, "madvise", 7))
+		transparent_hugepage_flags = TRANSPARENT_HUGEPAGE_MADVISE;
+	else if (count == 5 && !memcmp(buf, "never", 5))
+		transparent_hugepage_flags = 0;
+	else
+		return -EINVAL;
+	return 0;
+}
+
+static ssize_t enabled_store(struct subsystem *subsys, const char *buf,
+		size_t count)
+{
+	int err = parse_enabled(buf, count);
+
+	if (err)
+		return err;
+	wake_up_interruptible(&khugepaged_wait);
+	return count;
+}
+THP_ATTR_RW(enabled);
+
+#define KHUGEPAGED_ATTR(_name, _min, _max)				\
+static ssize_t khugepaged_##_name##_show(struct subsystem *subsys,	\
+		char *page)						\
+{									\
+	return sprintf(page, "%u\n", khugepaged_##_name);		\
+}									\
+static ssize_t khugepaged_##_name##_store(struct subsystem *subsys,	\
+		const char *buf, size_t count)				\
+{									\
+	unsigned long val = simple_strtoul(buf, NULL, 10);		\
+									\
+	if (val < (_min) || val > (_max))				\
+		return -EINVAL;						\
+	khugepaged_##_name = val;					\
+	wake_up_interruptible(&khugepaged_wait);			\
+	return count;							\
+}									\
+THP_ATTR_RW(khugepaged_##_name)
+
+KHUGEPAGED_ATTR(pages_to_scan, 1, UINT_MAX);
+KHUGEPAGED_ATTR(scan_sleep_millisecs, 0, UINT_MAX);
+KHUGEPAGED_ATTR(max_ptes_none, 0, HPAGE_PMD_NR - 1);
+
+static ssize_t khugepaged_pages_collapsed_show(struct subsystem *subsys,
+		char *page)
+{
+	return sprintf(page, "%lu\n", khugepaged_pages_collapsed);
+}
+THP_ATTR_RO(khugepaged_pages_collapsed);
+
+static ssize_t khugepaged_full_scans_show(struct subsystem *subsys,
+		char *page)
+{
+	return sprintf(page, "%lu\n", khugepaged_full_scans);
+}
+THP_ATTR_RO(khugepaged_full_scans);
+
+static ssize_t nr_mapped_show(struct subsystem *subsys, char *page)
+{
+	return sprintf(page, "%lu\n", nr_huge_pages_mapped);
+}
+THP_ATTR_RO(nr_mapped);
+
+static struct attribute *hugepage_attrs[] = {
+	&enabled_attr.attr,
+	&nr_mapped_attr.attr,
+	&khugepaged_pages_to_scan_attr.attr,
+	&khugepaged_scan_sleep_millisecs_attr.attr,
+	&khugepaged_max_ptes_none_attr.attr,
+	&khugepaged_pages_collapsed_attr.attr,
+	&khugepaged_full_scans_attr.attr,
+	NULL
+};
+
+static struct attribute_group hugepage_attr_group = {
+	.name = "transparent_hugepage",
+	.attrs = hugepage_attrs,
+};
+
+static int __init setup_transparent_hugepage(char *str)
+{
+	if (parse_enabled(str, strlen(str)))
+		printk(KERN_WARNING
+		       "transparent_hugepage=: always, madvise or never\n");
+	return 1;
+}
+__setup("transparent_hugepage=", setup_transparent_hugepage);
+
+static int __init hugepage_init(void)
+{
+	struct task_struct *task;
+	int err;
+
+	err = sysfs_create_group(&kernel_subsys.kset.kobj,
+				 &hugepage_attr_group);
+	if (err)
+		printk(KERN_ERR "hugepage: sysfs group failed: %d\n", err);
+
+	set_shrinker(DEFAULT_SEEKS * 4, shrink_huge_pages);
+
+	task = kthread_run(khugepaged, NULL, "khugepaged");
+	if (IS_ERR(task))
+		return PTR_ERR(task);
+	return 0;
+}
+module_init(hugepage_init)
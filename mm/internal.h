@@ -37,4 +37,15 @@ static inline void __put_page(struct page *page)
 extern void fastcall __init __free_pages_bootmem(struct page *page,
 						unsigned int order);
 
+/*
+ * The order of a free page in the buddy lists, only meaningful while
+ * PageBuddy(page) is set and zone->lock is held.
+ */
+static inline unsigned long page_order(struct page *page)
+{
+	return page_private(page);
+}
+
+extern int split_free_page(struct page *page);
+
 #endif
@@ -0,0 +1,1201 @@
+/*
+ * linux/mm/ksm.c
+ *
+ * Kernel samepage merging.  The ksmd kernel thread scans the anonymous
+ * pages of areas registered with madvise(MADV_MERGEABLE), and maps each
+ * set of pages with identical content to a single write-protected page.
+ * do_wp_page() copies such a page for whoever next writes to it.
+ *
+ * Two red-black trees, sorted by page content, find the duplicates.
+ *
+ * The stable tree holds the merged pages, whose content cannot change
+ * while they are write-protected.  Each node is the rmap_item of one of
+ * their ptes, and lists the rmap_items of the others.
+ *
+ * The unstable tree holds pages not yet merged, which may be written to
+ * under us and leave the tree out of order.  It only serves to find a
+ * first partner for a page: it is rebuilt from scratch on every pass,
+ * and takes only pages whose checksum has not changed since the last
+ * pass, which keeps the pages being written out of it.
+ *
+ * A merged page has no anon_vma: its page->mapping holds only the
+ * PAGE_MAPPING_ANON and PAGE_MAPPING_KSM bits, so rmap cannot find its
+ * ptes.  Merged pages are therefore neither swapped nor migrated, and
+ * are freed when the last pte mapping them goes.
+ */
+#include <linux/mm.h>
+#include <linux/module.h>
+#include <linux/sched.h>
+#include <linux/highmem.h>
+#include <linux/mman.h>
+#include <linux/rmap.h>
+#include <linux/ksm.h>
+#include <linux/swap.h>
+#include <linux/pagemap.h>
+#include <linux/slab.h>
+#include <linux/rbtree.h>
+#include <linux/jhash.h>
+#include <linux/kthread.h>
+#include <linux/mutex.h>
+#include <linux/kobject.h>
+#include <linux/sysfs.h>
+#include <linux/init.h>
+
+#include <asm/tlbflush.h>
+
+/*
+ * A virtual address of a mergeable area, on its mm_slot's rmap_list in
+ * address order.  The low bits of address hold the flags below and, in
+ * the unstable tree, the sequence number of the pass that put it there.
+ */
+struct rmap_item {
+	struct list_head link;		/* on mm_slot->rmap_list */
+	struct mm_struct *mm;
+	unsigned long address;
+	union {
+		unsigned int oldchecksum;	/* when unstable */
+		struct rmap_item *next;		/* when stable */
+	};
+	union {
+		struct rb_node node;		/* when a tree node */
+		struct rmap_item *prev;		/* in a stable list */
+	};
+};
+
+#define SEQNR_MASK	0x0ff	/* low bits of unstable tree pass */
+#define NODE_FLAG	0x100	/* is a node of the stable or unstable tree */
+#define STABLE_FLAG	0x200	/* is in the stable tree */
+
+/*
+ * An mm with mergeable areas, on ksm_mm_head's list.  It holds an
+ * mm_count reference; ksmd frees it once the mm has exited.
+ */
+struct mm_slot {
+	struct list_head mm_list;
+	struct list_head rmap_list;
+	struct mm_struct *mm;
+};
+
+/* Where ksmd has got to */
+struct ksm_scan {
+	struct mm_slot *mm_slot;
+	unsigned long address;
+	struct list_head *rmap_item;	/* last visited, in mm_slot */
+	unsigned long seqnr;		/* of the unstable tree */
+};
+
+static struct rb_root root_stable_tree = RB_ROOT;
+static struct rb_root root_unstable_tree = RB_ROOT;
+
+static struct mm_slot ksm_mm_head = {
+	.mm_list = LIST_HEAD_INIT(ksm_mm_head.mm_list),
+};
+static struct ksm_scan ksm_scan = {
+	.mm_slot = &ksm_mm_head,
+};
+
+static kmem_cache_t *rmap_item_cache;
+static kmem_cache_t *mm_slot_cache;
+
+/* Merged pages, and the further ptes mapping them */
+static unsigned long ksm_pages_shared;
+static unsigned long ksm_pages_sharing;
+/* Pages waiting in the unstable tree for a partner */
+static unsigned long ksm_pages_unshared;
+static unsigned long ksm_rmap_items;
+static unsigned long ksm_pages_scanned;
+static unsigned long ksm_full_scans;
+
+static unsigned int ksm_thread_pages_to_scan __read_mostly = 100;
+static unsigned int ksm_thread_sleep_millisecs __read_mostly = 20;
+
+#define KSM_RUN_STOP	0
+#define KSM_RUN_MERGE	1
+#define KSM_RUN_UNMERGE	2
+static unsigned int ksm_run = KSM_RUN_STOP;
+
+static DECLARE_WAIT_QUEUE_HEAD(ksm_thread_wait);
+/* serialises ksmd with unmerging everything: both change the trees */
+static DEFINE_MUTEX(ksm_thread_mutex);
+/* protects the mm_slot list and ksm_scan.mm_slot */
+static DEFINE_SPINLOCK(ksm_mmlist_lock);
+
+static inline struct rmap_item *alloc_rmap_item(void)
+{
+	struct rmap_item *rmap_item;
+
+	rmap_item = kmem_cache_zalloc(rmap_item_cache, GFP_KERNEL);
+	if (rmap_item)
+		ksm_rmap_items++;
+	return rmap_item;
+}
+
+static inline void free_rmap_item(struct rmap_item *rmap_item)
+{
+	ksm_rmap_items--;
+	rmap_item->mm = NULL;	/* debug safety */
+	kmem_cache_free(rmap_item_cache, rmap_item);
+}
+
+static inline int in_stable_tree(struct rmap_item *rmap_item)
+{
+	return rmap_item->address & STABLE_FLAG;
+}
+
+/*
+ * The mm of an rmap_item may have exited: pin its address space, and
+ * take mmap_sem, only if it has not.
+ */
+static int ksm_get_mm(struct mm_struct *mm)
+{
+	if (!atomic_inc_not_zero(&mm->mm_users))
+		return 0;
+	down_read(&mm->mmap_sem);
+	return 1;
+}
+
+static void ksm_put_mm(struct mm_struct *mm)
+{
+	up_read(&mm->mmap_sem);
+	mmput(mm);
+}
+
+static struct vm_area_struct *find_mergeable_vma(struct mm_struct *mm,
+		unsigned long addr)
+{
+	struct vm_area_struct *vma;
+
+	vma = find_vma(mm, addr);
+	if (!vma || vma->vm_start > addr)
+		return NULL;
+	if (!(vma->vm_flags & VM_MERGEABLE) || !vma->anon_vma)
+		return NULL;
+	return vma;
+}
+
+/*
+ * Write-fault a merged page at @addr until it is replaced by a private
+ * copy.  Caller holds mmap_sem.
+ */
+static int break_ksm(struct vm_area_struct *vma, unsigned long addr)
+{
+	struct page *page;
+	int ret;
+
+	do {
+		cond_resched();
+		page = follow_page(vma, addr, FOLL_GET);
+		if (!page)
+			return 0;
+		if (PageKsm(page))
+			ret = __handle_mm_fault(vma->vm_mm, vma, addr, 1);
+		else
+			ret = VM_FAULT_WRITE;
+		put_page(page);
+	} while (ret == VM_FAULT_MINOR || ret == VM_FAULT_MAJOR);
+
+	return ret == VM_FAULT_OOM ? -ENOMEM : 0;
+}
+
+static void break_cow(struct mm_struct *mm, unsigned long addr)
+{
+	struct vm_area_struct *vma;
+
+	addr &= PAGE_MASK;
+	if (!ksm_get_mm(mm))
+		return;
+	vma = find_mergeable_vma(mm, addr);
+	if (vma)
+		break_ksm(vma, addr);
+	ksm_put_mm(mm);
+}
+
+/* The anonymous page an rmap_item maps, with a reference, or NULL */
+static struct page *get_mergeable_page(struct rmap_item *rmap_item)
+{
+	struct mm_struct *mm = rmap_item->mm;
+	unsigned long addr = rmap_item->address & PAGE_MASK;
+	struct vm_area_struct *vma;
+	struct page *page = NULL;
+
+	if (!ksm_get_mm(mm))
+		return NULL;
+	vma = find_mergeable_vma(mm, addr);
+	if (vma)
+		page = follow_page(vma, addr, FOLL_GET);
+	if (page) {
+		if (PageAnon(page)) {
+			flush_anon_page(page, addr);
+			flush_dcache_page(page);
+		} else {
+			put_page(page);
+			page = NULL;
+		}
+	}
+	ksm_put_mm(mm);
+	return page;
+}
+
+/*
+ * The merged page a stable tree rmap_item maps, or NULL if the pte has
+ * since been zapped or copied on write.
+ */
+static struct page *get_ksm_page(struct rmap_item *rmap_item)
+{
+	struct page *page;
+
+	page = get_mergeable_page(rmap_item);
+	if (page && !PageKsm(page)) {
+		put_page(page);
+		page = NULL;
+	}
+	return page;
+}
+
+/*
+ * Take an rmap_item out of whichever tree it is in.  ksmd, or whoever
+ * holds ksm_thread_mutex, is the only one to change the trees.
+ */
+static void remove_rmap_item_from_tree(struct rmap_item *rmap_item)
+{
+	if (in_stable_tree(rmap_item)) {
+		struct rmap_item *next_item = rmap_item->next;
+
+		if (rmap_item->address & NODE_FLAG) {
+			if (next_item) {
+				rb_replace_node(&rmap_item->node,
+						&next_item->node,
+						&root_stable_tree);
+				next_item->address |= NODE_FLAG;
+				ksm_pages_sharing--;
+			} else {
+				rb_erase(&rmap_item->node, &root_stable_tree);
+				ksm_pages_shared--;
+			}
+		} else {
+			struct rmap_item *prev_item = rmap_item->prev;
+
+			BUG_ON(prev_item->next != rmap_item);
+			prev_item->next = next_item;
+			if (next_item)
+				next_item->prev = prev_item;
+			ksm_pages_sharing--;
+		}
+		rmap_item->next = NULL;
+
+	} else if (rmap_item->address & NODE_FLAG) {
+		unsigned char age;
+
+		/*
+		 * root_unstable_tree is reset on each pass: only an item put
+		 * there on this pass is still linked into it.
+		 */
+		age = (unsigned char)(ksm_scan.seqnr - rmap_item->address);
+		if (!age)
+			rb_erase(&rmap_item->node, &root_unstable_tree);
+		ksm_pages_unshared--;
+	}
+
+	rmap_item->address &= PAGE_MASK;
+	cond_resched();
+}
+
+static void remove_trailing_rmap_items(struct mm_slot *mm_slot,
+		struct list_head *cur)
+{
+	struct rmap_item *rmap_item;
+
+	while (cur != &mm_slot->rmap_list) {
+		rmap_item = list_entry(cur, struct rmap_item, link);
+		cur = cur->next;
+		remove_rmap_item_from_tree(rmap_item);
+		list_del(&rmap_item->link);
+		free_rmap_item(rmap_item);
+	}
+}
+
+static u32 calc_checksum(struct page *page)
+{
+	u32 checksum;
+	void *addr = kmap_atomic(page, KM_USER0);
+
+	checksum = jhash2(addr, PAGE_SIZE / 4, 17);
+	kunmap_atomic(addr, KM_USER0);
+	return checksum;
+}
+
+static int memcmp_pages(struct page *page1, struct page *page2)
+{
+	char *addr1, *addr2;
+	int ret;
+
+	addr1 = kmap_atomic(page1, KM_USER0);
+	addr2 = kmap_atomic(page2, KM_USER1);
+	ret = memcmp(addr1, addr2, PAGE_SIZE);
+	kunmap_atomic(addr2, KM_USER1);
+	kunmap_atomic(addr1, KM_USER0);
+	return ret;
+}
+
+static inline int pages_identical(struct page *page1, struct page *page2)
+{
+	return !memcmp_pages(page1, page2);
+}
+
+/*
+ * Make the pte mapping @page in @vma read-only, if it is not already,
+ * and return it in @orig_pte.  Fails if anything but the pte, our
+ * references and the swap cache holds the page: somebody may be about
+ * to write to it through get_user_pages(), for direct I/O say.
+ */
+static int write_protect_page(struct vm_area_struct *vma, struct page *page,
+		pte_t *orig_pte)
+{
+	struct mm_struct *mm = vma->vm_mm;
+	unsigned long addr;
+	pte_t *ptep;
+	spinlock_t *ptl;
+	int err = -EFAULT;
+
+	addr = page_address_in_vma(page, vma);
+	if (addr == -EFAULT)
+		goto out;
+
+	ptep = page_check_address(page, mm, addr, &ptl);
+	if (!ptep)
+		goto out;
+
+	if (pte_write(*ptep)) {
+		int swapped = PageSwapCache(page);
+		pte_t entry;
+
+		flush_cache_page(vma, addr, page_to_pfn(page));
+		/*
+		 * Clear and flush the pte before checking the count, so that
+		 * nobody can start writing through it while we look.  The
+		 * one reference that is not a mapping is ksmd's own.
+		 */
+		entry = ptep_clear_flush(vma, addr, ptep);
+		if (page_mapcount(page) + 1 + swapped != page_count(page)) {
+			set_pte_at(mm, addr, ptep, entry);
+			goto out_unlock;
+		}
+		entry = pte_wrprotect(entry);
+		set_pte_at(mm, addr, ptep, entry);
+	}
+	*orig_pte = *ptep;
+	err = 0;
+
+out_unlock:
+	pte_unmap_unlock(ptep, ptl);
+out:
+	return err;
+}
+
+/*
+ * Point the pte that maps @oldpage in @vma, if it is still @orig_pte,
+ * at the merged @newpage instead.
+ */
+static int replace_page(struct vm_area_struct *vma, struct page *oldpage,
+		struct page *newpage, pte_t orig_pte)
+{
+	struct mm_struct *mm = vma->vm_mm;
+	unsigned long addr;
+	pte_t *ptep;
+	spinlock_t *ptl;
+
+	addr = page_address_in_vma(oldpage, vma);
+	if (addr == -EFAULT)
+		return -EFAULT;
+
+	ptep = page_check_address(oldpage, mm, addr, &ptl);
+	if (!ptep)
+		return -EFAULT;
+	if (!pte_same(*ptep, orig_pte)) {
+		pte_unmap_unlock(ptep, ptl);
+		return -EFAULT;
+	}
+
+	get_page(newpage);
+	page_add_ksm_rmap(newpage);
+
+	flush_cache_page(vma, addr, pte_pfn(*ptep));
+	ptep_clear_flush(vma, addr, ptep);
+	/* a private vma's vm_page_prot is never writable */
+	set_pte_at(mm, addr, ptep, mk_pte(newpage, vma->vm_page_prot));
+
+	page_remove_rmap(oldpage);
+	put_page(oldpage);
+
+	pte_unmap_unlock(ptep, ptl);
+	return 0;
+}
+
+/*
+ * Replace @oldpage, mapped in @vma, by the merged @newpage if they are
+ * still identical once @oldpage is write-protected.  Caller holds
+ * mmap_sem and references on both pages.
+ */
+static int try_to_merge_one_page(struct vm_area_struct *vma,
+		struct page *oldpage, struct page *newpage)
+{
+	pte_t orig_pte = __pte(0);
+	int err = -EFAULT;
+
+	if (!(vma->vm_flags & VM_MERGEABLE))
+		return err;
+	if (!PageAnon(oldpage) || PageKsm(oldpage))
+		return err;
+
+	/*
+	 * The page lock keeps PageSwapCache stable for write_protect_page.
+	 * Don't wait for it: we would rather go on merging other pages and
+	 * come back to this one on the next pass.
+	 */
+	if (TestSetPageLocked(oldpage))
+		return err;
+	err = write_protect_page(vma, oldpage, &orig_pte);
+	unlock_page(oldpage);
+	if (err)
+		return err;
+
+	err = -EFAULT;
+	if (pages_identical(oldpage, newpage))
+		err = replace_page(vma, oldpage, newpage, orig_pte);
+	return err;
+}
+
+/* Merge @page, mapped at @addr in @mm, into the merged page @kpage */
+static int try_to_merge_with_ksm_page(struct mm_struct *mm, unsigned long addr,
+		struct page *page, struct page *kpage)
+{
+	struct vm_area_struct *vma;
+	int err = -EFAULT;
+
+	addr &= PAGE_MASK;
+	if (!ksm_get_mm(mm))
+		return err;
+	vma = find_mergeable_vma(mm, addr);
+	if (vma)
+		err = try_to_merge_one_page(vma, page, kpage);
+	ksm_put_mm(mm);
+	return err;
+}
+
+/*
+ * Merge two identical anonymous pages into a new merged page, which
+ * then replaces both.
+ */
+static int try_to_merge_two_pages(struct mm_struct *mm1, unsigned long addr1,
+		struct page *page1, struct mm_struct *mm2, unsigned long addr2,
+		struct page *page2)
+{
+	struct vm_area_struct *vma;
+	struct page *kpage;
+	int err = -EFAULT;
+
+	addr1 &= PAGE_MASK;
+	kpage = alloc_page(GFP_HIGHUSER);
+	if (!kpage)
+		return -ENOMEM;
+
+	if (!ksm_get_mm(mm1))
+		goto out;
+	vma = find_mergeable_vma(mm1, addr1);
+	if (vma) {
+		copy_user_highpage(kpage, page1, addr1);
+		err = try_to_merge_one_page(vma, page1, kpage);
+	}
+	ksm_put_mm(mm1);
+
+	if (!err) {
+		SetPageSwapBacked(kpage);
+		lru_cache_add_active(kpage);
+		/*
+		 * If the second fails, the merged page is mapped only once:
+		 * break it again rather than leave it outside the tree.
+		 */
+		err = try_to_merge_with_ksm_page(mm2, addr2, page2, kpage);
+		if (err)
+			break_cow(mm1, addr1);
+	}
+out:
+	put_page(kpage);
+	return err;
+}
+
+/*
+ * Look for a merged page with the content of @page.  Returns its tree
+ * node, with a reference to the merged page in @page2[0].
+ */
+static struct rmap_item *stable_tree_search(struct page *page,
+		struct page **page2)
+{
+	struct rb_node *node = root_stable_tree.rb_node;
+
+	while (node) {
+		struct rmap_item *tree_rmap_item, *next_rmap_item;
+		int ret;
+
+		tree_rmap_item = rb_entry(node, struct rmap_item, node);
+		while (tree_rmap_item) {
+			page2[0] = get_ksm_page(tree_rmap_item);
+			if (page2[0])
+				break;
+			/* this pte is gone: try the next mapping the page */
+			next_rmap_item = tree_rmap_item->next;
+			remove_rmap_item_from_tree(tree_rmap_item);
+			tree_rmap_item = next_rmap_item;
+		}
+		if (!tree_rmap_item)
+			return NULL;
+
+		ret = memcmp_pages(page, page2[0]);
+		if (ret < 0) {
+			put_page(page2[0]);
+			node = node->rb_left;
+		} else if (ret > 0) {
+			put_page(page2[0]);
+			node = node->rb_right;
+		} else
+			return tree_rmap_item;
+	}
+	return NULL;
+}
+
+/*
+ * Insert @rmap_item, which now maps a merged page with the content of
+ * @page, as a new node of the stable tree.
+ */
+static struct rmap_item *stable_tree_insert(struct page *page,
+		struct rmap_item *rmap_item)
+{
+	struct rb_node **new = &root_stable_tree.rb_node;
+	struct rb_node *parent = NULL;
+	struct page *page2;
+
+	while (*new) {
+		struct rmap_item *tree_rmap_item, *next_rmap_item;
+		int ret;
+
+		tree_rmap_item = rb_entry(*new, struct rmap_item, node);
+		while (tree_rmap_item) {
+			page2 = get_ksm_page(tree_rmap_item);
+			if (page2)
+				break;
+			next_rmap_item = tree_rmap_item->next;
+			remove_rmap_item_from_tree(tree_rmap_item);
+			tree_rmap_item = next_rmap_item;
+		}
+		if (!tree_rmap_item)
+			return NULL;
+
+		ret = memcmp_pages(page, page2);
+		put_page(page2);
+
+		parent = *new;
+		if (ret < 0)
+			new = &parent->rb_left;
+		else if (ret > 0)
+			new = &parent->rb_right;
+		else {
+			/*
+			 * The content was written in between: it is no
+			 * longer identical to what we compared.
+			 */
+			return NULL;
+		}
+	}
+
+	rmap_item->address |= NODE_FLAG | STABLE_FLAG;
+	rmap_item->next = NULL;
+	rb_link_node(&rmap_item->node, parent, new);
+	rb_insert_color(&rmap_item->node, &root_stable_tree);
+
+	ksm_pages_shared++;
+	return rmap_item;
+}
+
+/* Add @rmap_item to the mappings of the merged page at @tree_rmap_item */
+static void stable_tree_append(struct rmap_item *rmap_item,
+		struct rmap_item *tree_rmap_item)
+{
+	rmap_item->next = tree_rmap_item->next;
+	rmap_item->prev = tree_rmap_item;
+	if (tree_rmap_item->next)
+		tree_rmap_item->next->prev = rmap_item;
+	tree_rmap_item->next = rmap_item;
+	rmap_item->address |= STABLE_FLAG;
+
+	ksm_pages_sharing++;
+}
+
+/*
+ * Look for a page identical to @page in the unstable tree: if there is
+ * one, return its rmap_item with a reference to it in @page2[0];
+ * otherwise insert @rmap_item.
+ */
+static struct rmap_item *unstable_tree_search_insert(struct page *page,
+		struct page **page2, struct rmap_item *rmap_item)
+{
+	struct rb_node **new = &root_unstable_tree.rb_node;
+	struct rb_node *parent = NULL;
+
+	while (*new) {
+		struct rmap_item *tree_rmap_item;
+		int ret;
+
+		cond_resched();
+		tree_rmap_item = rb_entry(*new, struct rmap_item, node);
+		page2[0] = get_mergeable_page(tree_rmap_item);
+		if (!page2[0])
+			return NULL;
+
+		/* the same page mapped twice, since fork */
+		if (page == page2[0]) {
+			put_page(page2[0]);
+			return NULL;
+		}
+
+		ret = memcmp_pages(page, page2[0]);
+
+		parent = *new;
+		if (ret < 0) {
+			put_page(page2[0]);
+			new = &parent->rb_left;
+		} else if (ret > 0) {
+			put_page(page2[0]);
+			new = &parent->rb_right;
+		} else
+			return tree_rmap_item;
+	}
+
+	rmap_item->address |= NODE_FLAG;
+	rmap_item->address |= (ksm_scan.seqnr & SEQNR_MASK);
+	rb_link_node(&rmap_item->node, parent, new);
+	rb_insert_color(&rmap_item->node, &root_unstable_tree);
+
+	ksm_pages_unshared++;
+	return NULL;
+}
+
+/*
+ * Merge @page, just scanned at @rmap_item, with an identical page if
+ * either tree has one; otherwise leave it in the unstable tree.
+ */
+static void cmp_and_merge_page(struct page *page, struct rmap_item *rmap_item)
+{
+	struct page *page2[1];
+	struct rmap_item *tree_rmap_item;
+	unsigned int checksum;
+	int err;
+
+	if (in_stable_tree(rmap_item))
+		remove_rmap_item_from_tree(rmap_item);
+
+	tree_rmap_item = stable_tree_search(page, page2);
+	if (tree_rmap_item) {
+		if (page == page2[0])		/* forked */
+			err = 0;
+		else
+			err = try_to_merge_with_ksm_page(rmap_item->mm,
+					rmap_item->address, page, page2[0]);
+		put_page(page2[0]);
+
+		if (!err)
+			stable_tree_append(rmap_item, tree_rmap_item);
+		return;
+	}
+
+	/*
+	 * A merged page that got here by fork, the other mappings of which
+	 * have left the stable tree: make it private again.
+	 */
+	if (PageKsm(page))
+		break_cow(rmap_item->mm, rmap_item->address);
+
+	/*
+	 * A page whose checksum changed since the last pass is being
+	 * written to: not worth putting in the unstable tree.
+	 */
+	checksum = calc_checksum(page);
+	if (rmap_item->oldchecksum != checksum) {
+		rmap_item->oldchecksum = checksum;
+		return;
+	}
+
+	tree_rmap_item = unstable_tree_search_insert(page, page2, rmap_item);
+	if (!tree_rmap_item)
+		return;
+
+	err = try_to_merge_two_pages(rmap_item->mm, rmap_item->address, page,
+			tree_rmap_item->mm, tree_rmap_item->address, page2[0]);
+	if (!err) {
+		/* the partner moves from the unstable to the stable tree */
+		rb_erase(&tree_rmap_item->node, &root_unstable_tree);
+		tree_rmap_item->address &= ~(NODE_FLAG | SEQNR_MASK);
+		ksm_pages_unshared--;
+
+		/*
+		 * page2[0] has the content of the new merged page.  If the
+		 * merged page can't go in the tree, both mappings of it
+		 * must be broken again.
+		 */
+		if (stable_tree_insert(page2[0], tree_rmap_item))
+			stable_tree_append(rmap_item, tree_rmap_item);
+		else {
+			break_cow(tree_rmap_item->mm, tree_rmap_item->address);
+			break_cow(rmap_item->mm, rmap_item->address);
+		}
+	}
+	put_page(page2[0]);
+}
+
+/*
+ * The rmap_item for @addr, freeing those of addresses before it that
+ * are no longer scanned.
+ */
+static struct rmap_item *get_next_rmap_item(struct mm_slot *mm_slot,
+		struct list_head *cur, unsigned long addr)
+{
+	struct rmap_item *rmap_item;
+
+	while (cur != &mm_slot->rmap_list) {
+		rmap_item = list_entry(cur, struct rmap_item, link);
+		if ((rmap_item->address & PAGE_MASK) == addr) {
+			if (!in_stable_tree(rmap_item))
+				remove_rmap_item_from_tree(rmap_item);
+			return rmap_item;
+		}
+		if (rmap_item->address > addr)
+			break;
+		cur = cur->next;
+		remove_rmap_item_from_tree(rmap_item);
+		list_del(&rmap_item->link);
+		free_rmap_item(rmap_item);
+	}
+
+	rmap_item = alloc_rmap_item();
+	if (rmap_item) {
+		rmap_item->mm = mm_slot->mm;
+		rmap_item->address = addr;
+		list_add_tail(&rmap_item->link, cur);
+	}
+	return rmap_item;
+}
+
+/*
+ * Find the next anonymous page to scan, and return it with a reference
+ * in @page.  Returns NULL at the end of a pass.
+ */
+static struct rmap_item *scan_get_next_rmap_item(struct page **page)
+{
+	struct mm_struct *mm;
+	struct mm_slot *slot;
+	struct vm_area_struct *vma;
+	struct rmap_item *rmap_item;
+	int exited;
+
+	if (list_empty(&ksm_mm_head.mm_list))
+		return NULL;
+
+	slot = ksm_scan.mm_slot;
+	if (slot == &ksm_mm_head) {
+		/* a new pass builds a new unstable tree */
+		root_unstable_tree = RB_ROOT;
+		ksm_scan.seqnr++;
+
+		spin_lock(&ksm_mmlist_lock);
+		slot = list_entry(slot->mm_list.next, struct mm_slot, mm_list);
+		ksm_scan.mm_slot = slot;
+		spin_unlock(&ksm_mmlist_lock);
+next_mm:
+		ksm_scan.address = 0;
+		ksm_scan.rmap_item = &slot->rmap_list;
+	}
+
+	mm = slot->mm;
+	exited = !ksm_get_mm(mm);
+	if (exited)
+		goto next;
+
+	for (vma = find_vma(mm, ksm_scan.address); vma; vma = vma->vm_next) {
+		if (!(vma->vm_flags & VM_MERGEABLE))
+			continue;
+		if (ksm_scan.address < vma->vm_start)
+			ksm_scan.address = vma->vm_start;
+		if (!vma->anon_vma)
+			ksm_scan.address = vma->vm_end;
+
+		while (ksm_scan.address < vma->vm_end) {
+			*page = follow_page(vma, ksm_scan.address, FOLL_GET);
+			if (*page && PageAnon(*page)) {
+				flush_anon_page(*page, ksm_scan.address);
+				flush_dcache_page(*page);
+				rmap_item = get_next_rmap_item(slot,
+						ksm_scan.rmap_item->next,
+						ksm_scan.address);
+				if (rmap_item) {
+					ksm_scan.rmap_item = &rmap_item->link;
+					ksm_scan.address += PAGE_SIZE;
+				} else
+					put_page(*page);
+				ksm_put_mm(mm);
+				return rmap_item;
+			}
+			if (*page)
+				put_page(*page);
+			ksm_scan.address += PAGE_SIZE;
+			cond_resched();
+		}
+	}
+	ksm_put_mm(mm);
+
+next:
+	/* drop the rmap_items of addresses no longer mergeable */
+	remove_trailing_rmap_items(slot, exited ? slot->rmap_list.next :
+				   ksm_scan.rmap_item->next);
+
+	spin_lock(&ksm_mmlist_lock);
+	ksm_scan.mm_slot = list_entry(slot->mm_list.next,
+				      struct mm_slot, mm_list);
+	if (exited) {
+		list_del(&slot->mm_list);
+		spin_unlock(&ksm_mmlist_lock);
+		kmem_cache_free(mm_slot_cache, slot);
+		mmdrop(mm);
+	} else
+		spin_unlock(&ksm_mmlist_lock);
+
+	slot = ksm_scan.mm_slot;
+	if (slot != &ksm_mm_head)
+		goto next_mm;
+
+	ksm_full_scans++;
+	return NULL;
+}
+
+static void ksm_do_scan(unsigned int scan_npages)
+{
+	struct rmap_item *rmap_item;
+	struct page *page;
+
+	while (scan_npages--) {
+		cond_resched();
+		rmap_item = scan_get_next_rmap_item(&page);
+		if (!rmap_item)
+			return;
+		if (!PageKsm(page) || !in_stable_tree(rmap_item))
+			cmp_and_merge_page(page, rmap_item);
+		else if (page_mapcount(page) == 1) {
+			/* the only mapping left: it may as well be private */
+			break_cow(rmap_item->mm, rmap_item->address);
+			remove_rmap_item_from_tree(rmap_item);
+			rmap_item->oldchecksum = calc_checksum(page);
+		}
+		put_page(page);
+		ksm_pages_scanned++;
+	}
+}
+
+static int unmerge_ksm_pages(struct vm_area_struct *vma,
+		unsigned long start, unsigned long end)
+{
+	unsigned long addr;
+	int err = 0;
+
+	for (addr = start; addr < end && !err; addr += PAGE_SIZE) {
+		if (signal_pending(current))
+			err = -ERESTARTSYS;
+		else
+			err = break_ksm(vma, addr);
+	}
+	return err;
+}
+
+/*
+ * Copy every merged page back to private pages and empty both trees,
+ * for run = 2.  Caller holds ksm_thread_mutex.
+ */
+static int unmerge_and_remove_all_rmap_items(void)
+{
+	struct mm_slot *slot;
+	struct mm_struct *mm;
+	struct vm_area_struct *vma;
+	int err = 0;
+
+	/* as ksmd's cursor, the slot being unmerged can't be freed by exit */
+	spin_lock(&ksm_mmlist_lock);
+	slot = list_entry(ksm_mm_head.mm_list.next, struct mm_slot, mm_list);
+	ksm_scan.mm_slot = slot;
+	spin_unlock(&ksm_mmlist_lock);
+
+	while (slot != &ksm_mm_head) {
+		mm = slot->mm;
+		if (ksm_get_mm(mm)) {
+			for (vma = mm->mmap; vma && !err; vma = vma->vm_next) {
+				if (!(vma->vm_flags & VM_MERGEABLE) ||
+				    !vma->anon_vma)
+					continue;
+				err = unmerge_ksm_pages(vma, vma->vm_start,
+							vma->vm_end);
+			}
+			ksm_put_mm(mm);
+			if (err)
+				break;
+		}
+		remove_trailing_rmap_items(slot, slot->rmap_list.next);
+
+		spin_lock(&ksm_mmlist_lock);
+		slot = list_entry(slot->mm_list.next, struct mm_slot, mm_list);
+		ksm_scan.mm_slot = slot;
+		spin_unlock(&ksm_mmlist_lock);
+	}
+
+	/* ksmd starts a new pass */
+	spin_lock(&ksm_mmlist_lock);
+	ksm_scan.mm_slot = &ksm_mm_head;
+	spin_unlock(&ksm_mmlist_lock);
+	return err;
+}
+
+static int ksmd_should_run(void)
+{
+	return (ksm_run & KSM_RUN_MERGE) && !list_empty(&ksm_mm_head.mm_list);
+}
+
+static int ksm_scan_thread(void *nothing)
+{
+	set_user_nice(current, 5);
+	while (!kthread_should_stop()) {
+		mutex_lock(&ksm_thread_mutex);
+		if (ksmd_should_run())
+			ksm_do_scan(ksm_thread_pages_to_scan);
+		mutex_unlock(&ksm_thread_mutex);
+
+		if (ksmd_should_run())
+			wait_event_interruptible_timeout(ksm_thread_wait,
+				kthread_should_stop(),
+				msecs_to_jiffies(ksm_thread_sleep_millisecs));
+		else
+			wait_event_interruptible(ksm_thread_wait,
+				kthread_should_stop() || ksmd_should_run());
+		try_to_freeze();
+	}
+	return 0;
+}
+
+static int ksm_enter(struct mm_struct *mm)
+{
+	struct mm_slot *slot;
+	int needs_wakeup;
+
+	slot = kmem_cache_zalloc(mm_slot_cache, GFP_KERNEL);
+	if (!slot)
+		return -ENOMEM;
+	INIT_LIST_HEAD(&slot->rmap_list);
+	slot->mm = mm;
+	atomic_inc(&mm->mm_count);
+
+	spin_lock(&ksm_mmlist_lock);
+	needs_wakeup = list_empty(&ksm_mm_head.mm_list);
+	/* just behind the cursor, to leave a new area time to settle */
+	list_add_tail(&slot->mm_list, &ksm_scan.mm_slot->mm_list);
+	mm->ksm_mm_slot = slot;
+	spin_unlock(&ksm_mmlist_lock);
+
+	if (needs_wakeup)
+		wake_up_interruptible(&ksm_thread_wait);
+	return 0;
+}
+
+/*
+ * madvise(MADV_MERGEABLE) and madvise(MADV_UNMERGEABLE), called with
+ * mmap_sem held for writing.
+ */
+int ksm_madvise(struct vm_area_struct *vma, unsigned long start,
+		unsigned long end, int advice, unsigned long *vm_flags)
+{
+	struct mm_struct *mm = vma->vm_mm;
+	int err;
+
+	switch (advice) {
+	case MADV_MERGEABLE:
+		/* anonymous pages only: ignore the advice for anything else */
+		if (*vm_flags & (VM_MERGEABLE | VM_SHARED | VM_MAYSHARE |
+				 VM_PFNMAP | VM_IO | VM_DONTEXPAND |
+				 VM_RESERVED | VM_HUGETLB | VM_INSERTPAGE |
+				 VM_NONLINEAR))
+			return 0;
+		if (!mm->ksm_mm_slot) {
+			err = ksm_enter(mm);
+			if (err)
+				return err;
+		}
+		*vm_flags |= VM_MERGEABLE;
+		break;
+
+	case MADV_UNMERGEABLE:
+		if (!(*vm_flags & VM_MERGEABLE))
+			return 0;
+		if (vma->anon_vma) {
+			err = unmerge_ksm_pages(vma, start, end);
+			if (err)
+				return err;
+		}
+		*vm_flags &= ~VM_MERGEABLE;
+		break;
+	}
+	return 0;
+}
+
+/* The child inherits the mergeable areas: scan it too */
+void ksm_fork(struct mm_struct *mm, struct mm_struct *oldmm)
+{
+	if (oldmm->ksm_mm_slot)
+		ksm_enter(mm);
+}
+
+/*
+ * Called by mmput() when the last user goes.  An mm_slot with no
+ * rmap_items, which ksmd is not looking at, can be freed at once; the
+ * others ksmd frees when it next comes to them.
+ */
+void __ksm_exit(struct mm_struct *mm)
+{
+	struct mm_slot *slot = mm->ksm_mm_slot;
+	int easy_to_free = 0;
+
+	spin_lock(&ksm_mmlist_lock);
+	if (ksm_scan.mm_slot != slot && list_empty(&slot->rmap_list)) {
+		list_del(&slot->mm_list);
+		mm->ksm_mm_slot = NULL;
+		easy_to_free = 1;
+	}
+	spin_unlock(&ksm_mmlist_lock);
+
+	if (easy_to_free) {
+		kmem_cache_free(mm_slot_cache, slot);
+		mmdrop(mm);
+	}
+}
+
+/*
+ * /sys/kernel/ksm
+ */
+
+#define KSM_ATTR_RO(_name) \
+static struct subsys_attribute _name##_attr = __ATTR_RO(_name)
+
+#define KSM_ATTR_RW(_name) \
+static struct subsys_attribute _name##_attr = \
+	__ATTR(_name, 0644, _name##_show, _name##_store)
+
+static ssize_t run_show(struct subsystem *subsys, char *page)
+{
+	return sprintf(page, "%u\n", ksm_run);
+}
+
+static ssize_t run_store(struct subsystem *subsys, const char *buf,
+		size_t count)
+{
+	unsigned long flags = simple_strtoul(buf, NULL, 10);
+	ssize_t ret = count;
+
+	if (flags > KSM_RUN_UNMERGE)
+		return -EINVAL;
+
+	mutex_lock(&ksm_thread_mutex);
+	if (ksm_run != flags) {
+		ksm_run = flags;
+		if (flags & KSM_RUN_UNMERGE) {
+			int err = unmerge_and_remove_all_rmap_items();
+
+			if (err) {
+				ksm_run = KSM_RUN_STOP;
+				ret = err;
+			}
+		}
+	}
+	mutex_unlock(&ksm_thread_mutex);
+
+	if (flags & KSM_RUN_MERGE)
+		wake_up_interruptible(&ksm_thread_wait);
+	return ret;
+}
+KSM_ATTR_RW(run);
+
+#define KSM_TUNABLE(_name, _min)					\
+static ssize_t _name##_show(struct subsystem *subsys, char *page)	\
+{									\
+	return sprintf(page, "%u\n", ksm_thread_##_name);		\
+}									\
+static ssize_t _name##_store(struct subsystem *subsys,			\
+		const char *buf, size_t count)				\
+{									\
+	unsigned long val = simple_strtoul(buf, NULL, 10);		\
+									\
+	if (val < (_min) || val > UINT_MAX)				\
+		return -EINVAL;						\
+	ksm_thread_##_name = val;					\
+	wake_up_interruptible(&ksm_thread_wait);			\
+	return count;							\
+}									\
+KSM_ATTR_RW(_name)
+
+KSM_TUNABLE(pages_to_scan, 1);
+KSM_TUNABLE(sleep_millisecs, 0);
+
+#define KSM_STAT(_name, _expr)						\
+static ssize_t _name##_show(struct subsystem *subsys, char *page)	\
+{									\
+	return sprintf(page, "%lu\n", (_expr));				\
+}									\
+KSM_ATTR_RO(_name)
+
+KSM_STAT(pages_shared, ksm_pages_shared);
+KSM_STAT(pages_sharing, ksm_pages_sharing);
+KSM_STAT(pages_unshared, ksm_pages_unshared);
+KSM_STAT(pages_volatile, ksm_rmap_items - ksm_pages_shared -
+	 ksm_pages_sharing - ksm_pages_unshared);
+KSM_STAT(pages_scanned, ksm_pages_scanned);
+KSM_STAT(full_scans, ksm_full_scans);
+
+static struct attribute *ksm_attrs[] = {
+	&run_attr.attr,
+	&pages_to_scan_attr.attr,
+	&sleep_millisecs_attr.attr,
+	&pages_shared_attr.attr,
+	&pages_sharing_attr.attr,
+	&pages_unshared_attr.attr,
+	&pages_volatile_attr.attr,
+	&pages_scanned_attr.attr,
+	&full_scans_attr.attr,
+	NULL
+};
+
+static struct attribute_group ksm_attr_group = {
+	.name = "ksm",
+	.attrs = ksm_attrs,
+};
+
+static int __init ksm_init(void)
+{
+	struct task_struct *task;
+	int err;
+
+	rmap_item_cache = kmem_cache_create("ksm_rmap_item",
+			sizeof(struct rmap_item), 0, SLAB_PANIC, NULL, NULL);
+	mm_slot_cache = kmem_cache_create("ksm_mm_slot",
+			sizeof(struct mm_slot), 0, SLAB_PANIC, NULL, NULL);
+
+	err = sysfs_create_group(&kernel_subsys.kset.kobj, &ksm_attr_group);
+	if (err)
+		printk(KERN_ERR "ksm: sysfs group failed: %d\n", err);
+
+	task = kthread_run(ksm_scan_thread, NULL, "ksmd");
+	if (IS_ERR(task))
+		return PTR_ERR(task);
+	return 0;
+}
+module_init(ksm_init)
@@ -10,6 +10,12 @@
 #include <linux/syscalls.h>
 #include <linux/mempolicy.h>
 #include <linux/hugetlb.h>
+#include <linux/huge_mm.h>
+#include <linux/ksm.h>
+#include <linux/swap.h>
+#include <linux/swapops.h>
+#include <linux/pagevec.h>
+#include <asm/tlbflush.h>
 
 /*
  * We can potentially split a vm area into separate
@@ -22,7 +28,7 @@ static long madvise_behavior(struct vm_area_struct * vma,
 	struct mm_struct * mm = vma->vm_mm;
 	int error = 0;
 	pgoff_t pgoff;
-	int new_flags = vma->vm_flags;
+	unsigned long new_flags = vma->vm_flags;
 
 	switch (behavior) {
 	case MADV_NORMAL:
@@ -40,6 +46,22 @@ static long madvise_behavior(struct vm_area_struct * vma,
 	case MADV_DOFORK:
 		new_flags &= ~VM_DONTCOPY;
 		break;
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+	case MADV_HUGEPAGE:
+	case MADV_NOHUGEPAGE:
+		error = hugepage_madvise(&new_flags, behavior);
+		if (error)
+			goto out;
+		break;
+#endif
+#ifdef CONFIG_KSM
+	case MADV_MERGEABLE:
+	case MADV_UNMERGEABLE:
+		error = ksm_madvise(vma, start, end, behavior, &new_flags);
+		if (error)
+			goto out;
+		break;
+#endif
 	}
 
 	if (new_flags == vma->vm_flags) {
@@ -135,6 +157,8 @@ static long madvise_dontneed(struct vm_area_struct * vma,
 	*prev = vma;
 	if (vma->vm_flags & (VM_LOCKED|VM_HUGETLB|VM_PFNMAP))
 		return -EINVAL;
+	if (unshare_page_range(vma, start, end))
+		return -EAGAIN;
 
 	if (unlikely(vma->vm_flags & VM_NONLINEAR)) {
 		struct zap_details details = {
@@ -147,6 +171,148 @@ static long madvise_dontneed(struct vm_area_struct * vma,
 	return 0;
 }
 
+/*
+ * Mark the pages mapped by [addr, end) clean and collect them for the
+ * file LRU.  Only pages this mm alone maps can be given up; swap held
+ * for the range is let go at once, as its contents are not wanted.
+ */
+static void madvise_free_pte_range(struct vm_area_struct *vma, pmd_t *pmd,
+		unsigned long addr, unsigned long end)
+{
+	struct mm_struct *mm = vma->vm_mm;
+	unsigned long start;
+	struct pagevec pvec;
+	pte_t *pte, ptent;
+	spinlock_t *ptl;
+	struct page *page;
+
+again:
+	pagevec_init(&pvec, 0);
+	start = addr;
+	pte = pte_offset_map_lock(mm, pmd, addr, &ptl);
+	do {
+		ptent = *pte;
+		if (pte_none(ptent))
+			continue;
+		if (!pte_present(ptent)) {
+			swp_entry_t entry = pte_to_swp_entry(ptent);
+
+			if (is_migration_entry(entry))
+				continue;
+			free_swap_and_cache(entry);
+			pte_clear(mm, addr, pte);
+			continue;
+		}
+		page = vm_normal_page(vma, addr, ptent);
+		if (!page || !PageAnon(page) || PageKsm(page) ||
+		    PageCompound(page) || page_mapcount(page) != 1)
+			continue;
+		if (PageSwapCache(page) || PageDirty(page)) {
+			if (TestSetPageLocked(page))
+				continue;
+			if (PageSwapCache(page))
+				remove_exclusive_swap_page(page);
+			if (PageSwapCache(page)) {
+				unlock_page(page);
+				continue;
+			}
+			ClearPageDirty(page);
+			unlock_page(page);
+		}
+		if (pte_dirty(ptent) || pte_young(ptent)) {
+			ptent = ptep_get_and_clear(mm, addr, pte);
+			ptent = pte_mkold(pte_mkclean(ptent));
+			set_pte_at(mm, addr, pte, ptent);
+		}
+		get_page(page);
+		pagevec_add(&pvec, page);
+	} while (pte++, addr += PAGE_SIZE,
+		 addr != end && pagevec_space(&pvec));
+	pte_unmap_unlock(pte - 1, ptl);
+
+	/*
+	 * A write through a stale TLB entry would not mark the pte dirty
+	 * again: flush before the pages become reclaimable without it.
+	 */
+	flush_tlb_range(vma, start, addr);
+	if (pagevec_count(&pvec))
+		__pagevec_lru_lazyfree(&pvec);
+	cond_resched();
+	if (addr != end)
+		goto again;
+}
+
+static void madvise_free_pmd_range(struct vm_area_struct *vma, pud_t *pud,
+		unsigned long addr, unsigned long end)
+{
+	unsigned long next;
+	pmd_t *pmd;
+
+	pmd = pmd_offset(pud, addr);
+	do {
+		next = pmd_addr_end(addr, end);
+		split_huge_page_pmd(vma->vm_mm, pmd);
+		if (pmd_none_or_clear_bad(pmd))
+			continue;
+		madvise_free_pte_range(vma, pmd, addr, next);
+	} while (pmd++, addr = next, addr != end);
+}
+
+static void madvise_free_pud_range(struct vm_area_struct *vma, pgd_t *pgd,
+		unsigned long addr, unsigned long end)
+{
+	unsigned long next;
+	pud_t *pud;
+
+	pud = pud_offset(pgd, addr);
+	do {
+		next = pud_addr_end(addr, end);
+		if (pud_none_or_clear_bad(pud))
+			continue;
+		madvise_free_pmd_range(vma, pud, addr, next);
+	} while (pud++, addr = next, addr != end);
+}
+
+/*
+ * Application is done with the contents of these pages, but may well
+ * use the memory again soon.  Rather than zap them as MADV_DONTNEED
+ * does, which costs a fault and a cleared page on the next touch, the
+ * pages are marked clean and moved to where reclaim finds them early.
+ * Under memory pressure reclaim drops them without writing them to
+ * swap; a page written to again before that is kept, contents and all,
+ * and the write takes no fault.  Reading a page before writing it
+ * returns either its old contents or zeroes.
+ */
+static long madvise_free(struct vm_area_struct *vma,
+			 struct vm_area_struct **prev,
+			 unsigned long start, unsigned long end)
+{
+	unsigned long next;
+	pgd_t *pgd;
+
+	*prev = vma;
+	if (vma->vm_flags & (VM_LOCKED|VM_HUGETLB|VM_PFNMAP))
+		return -EINVAL;
+	/* only private anonymous memory has nothing behind it to keep */
+	if (vma->vm_file || vma->vm_ops || (vma->vm_flags & VM_SHARED))
+		return -EINVAL;
+	if (!vma->anon_vma)
+		return 0;
+	if (unshare_page_range(vma, start, end))
+		return -EAGAIN;
+
+	/* pages just faulted in must be on the LRU to be moved */
+	lru_add_drain();
+	pgd = pgd_offset(vma->vm_mm, start);
+	do {
+		next = pgd_addr_end(start, end);
+		if (pgd_none_or_clear_bad(pgd))
+			continue;
+		madvise_free_pud_range(vma, pgd, start, next);
+	} while (pgd++, start = next, start != end);
+	return 0;
+}
+
 /*
  * Application wants to free up the pages and associated backing store.
  * This is effectively punching a hole into the middle of a file.
@@ -196,6 +362,14 @@ madvise_vma(struct vm_area_struct *vma, struct vm_area_struct **prev,
 	case MADV_NORMAL:
 	case MADV_SEQUENTIAL:
 	case MADV_RANDOM:
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+	case MADV_HUGEPAGE:
+	case MADV_NOHUGEPAGE:
+#endif
+#ifdef CONFIG_KSM
+	case MADV_MERGEABLE:
+	case MADV_UNMERGEABLE:
+#endif
 		error = madvise_behavior(vma, prev, start, end, behavior);
 		break;
 	case MADV_REMOVE:
@@ -210,6 +384,10 @@ madvise_vma(struct vm_area_struct *vma, struct vm_area_struct **prev,
 		error = madvise_dontneed(vma, prev, start, end);
 		break;
 
+	case MADV_FREE:
+		error = madvise_free(vma, prev, start, end);
+		break;
+
 	default:
 		error = -EINVAL;
 		break;
@@ -241,6 +419,16 @@ madvise_vma(struct vm_area_struct *vma, struct vm_area_struct **prev,
  *		so the kernel can free resources associated with it.
  *  MADV_REMOVE - the application wants to free up the given range of
  *		pages and associated backing store.
+ *  MADV_FREE - the application is done with the contents of the given
+ *		range: its pages may be freed under memory pressure,
+ *		unless they are written to again first.
+ *  MADV_HUGEPAGE - the range is worth backing with transparent huge
+ *		pages (when they are enabled only for madvised ranges).
+ *  MADV_NOHUGEPAGE - the range should never be backed by transparent
+ *		huge pages.
+ *  MADV_MERGEABLE - the range's anonymous pages may be merged with
+ *		identical pages by KSM.
+ *  MADV_UNMERGEABLE - undo MADV_MERGEABLE, unmerging any merged pages.
  *
  * return values:
  *  zero    - success
@@ -41,6 +41,7 @@
 #include <linux/kernel_stat.h>
 #include <linux/mm.h>
 #include <linux/hugetlb.h>
+#include <linux/huge_mm.h>
 #include <linux/mman.h>
 #include <linux/swap.h>
 #include <linux/highmem.h>
@@ -49,6 +50,9 @@
 #include <linux/module.h>
 #include <linux/delayacct.h>
 #include <linux/init.h>
+#include <linux/debugfs.h>
+#include <linux/rcupdate.h>
+#include <linux/numa_balancing.h>
 
 #include <asm/pgalloc.h>
 #include <asm/uaccess.h>
@@ -334,6 +338,59 @@ int __pte_alloc_kernel(pmd_t *pmd, unsigned long address)
 	return 0;
 }
 
+#ifdef SPLIT_RSS_COUNTING
+/*
+ * Fold the rss counts task has kept for mm into mm.  Called by the task
+ * itself, before it drops the mm.
+ */
+void sync_mm_rss(struct task_struct *task, struct mm_struct *mm)
+{
+	if (task->rss_stat.file_rss) {
+		add_mm_counter(mm, file_rss, task->rss_stat.file_rss);
+		task->rss_stat.file_rss = 0;
+	}
+	if (task->rss_stat.anon_rss) {
+		add_mm_counter(mm, anon_rss, task->rss_stat.anon_rss);
+		task->rss_stat.anon_rss = 0;
+	}
+	task->rss_stat.events = 0;
+}
+
+static inline void check_sync_rss_stat(struct task_struct *task)
+{
+	if (unlikely(++task->rss_stat.events > TASK_RSS_EVENTS_THRESH) &&
+	    task->mm)
+		sync_mm_rss(task, task->mm);
+}
+
+/*
+ * The rss of mm, with the counts the threads of task that use it have not
+ * folded in yet.  Their counts are read racily, which is good enough for
+ * a snapshot.
+ */
+unsigned long get_mm_rss_exact(struct task_struct *task, struct mm_struct *mm)
+{
+	struct task_struct *t;
+	long rss;
+
+	rss = atomic_long_read(&mm->_file_rss) + atomic_long_read(&mm->_anon_rss);
+	read_lock(&tasklist_lock);
+	if (pid_alive(task)) {
+		t = task;
+		do {
+			if (t->mm == mm)
+				rss += t->rss_stat.file_rss + t->rss_stat.anon_rss;
+		} while ((t = next_thread(t)) != task);
+	}
+	read_unlock(&tasklist_lock);
+	return rss < 0 ? 0 : rss;
+}
+#else
+static inline void check_sync_rss_stat(struct task_struct *task)
+{
+}
+#endif
+
 static inline void add_mm_rss(struct mm_struct *mm, int file_rss, int anon_rss)
 {
 	if (file_rss)
@@ -536,12 +593,223 @@ again:
 	return 0;
 }
 
+#ifdef CONFIG_SHARED_PAGE_TABLES
+/*
+ * fork() may give the child the parent's pte tables, instead of copying
+ * every pte, where a private anonymous vma covers a whole table.  Both
+ * mms then map the table through a pmd without write permission, so the
+ * first write through it faults, and any fault in it makes the faulting
+ * mm take a private copy with unshare_pte_table(), doing there and then
+ * what fork would have done for those ptes.  The table's page count says
+ * how many mms hold it, and only changes under its pte lock, which is
+ * shared with the table as it lives in its struct page.
+ *
+ * Nothing may change the ptes of a shared table: whoever would unshares
+ * it first, except that unmapping the whole of it just lets go of it,
+ * and rmap leaves its pages alone until it is unshared.  A table holding
+ * swap entries is copied as usual rather than shared, so none does.
+ */
+int sysctl_fork_share_page_tables __read_mostly;
+
+static inline int vma_shares_ptes(struct vm_area_struct *vma)
+{
+	/* the table's pte lock is what both mms agree on */
+	if (NR_CPUS < CONFIG_SPLIT_PTLOCK_CPUS)
+		return 0;
+	return sysctl_fork_share_page_tables && !vma->vm_file &&
+		!(vma->vm_flags & (VM_SHARED | VM_HUGETLB | VM_PFNMAP | VM_IO));
+}
+
+/* Count the pages mapped by a table, as rss[!!PageAnon]: -1 if it maps swap */
+static int count_pte_table(pte_t *pte, unsigned long addr, int *rss)
+{
+	unsigned long zero_pfn = page_to_pfn(ZERO_PAGE(addr));
+	int i;
+
+	rss[1] = rss[0] = 0;
+	for (i = 0; i < PTRS_PER_PTE; i++) {
+		if (pte_none(pte[i]))
+			continue;
+		if (!pte_present(pte[i]))
+			return -1;
+		rss[pte_pfn(pte[i]) != zero_pfn]++;
+	}
+	return 0;
+}
+
+static int share_pte_table(struct mm_struct *dst_mm, struct mm_struct *src_mm,
+		pmd_t *dst_pmd, pmd_t *src_pmd, unsigned long addr)
+{
+	struct page *table = pmd_page(*src_pmd);
+	spinlock_t *ptl;
+	pte_t *pte;
+	int rss[2];
+	int ret = 0;
+
+	pte = pte_offset_map_lock(src_mm, src_pmd, addr, &ptl);
+	if (!count_pte_table(pte, addr, rss)) {
+		get_page(table);
+		set_pmd(src_pmd, pmd_wrprotect(*src_pmd));
+		set_pmd(dst_pmd, *src_pmd);
+		dst_mm->nr_ptes++;
+		inc_zone_page_state(table, NR_PAGETABLE);
+		add_mm_rss(dst_mm, rss[0], rss[1]);
+		ret = 1;
+	}
+	pte_unmap_unlock(pte, ptl);
+	return ret;
+}
+
+/**
+ * unshare_pte_table - give an mm its own copy of a shared pte table
+ * @mm: the mm
+ * @vma: the vma covering the table
+ * @pmd: the pmd mapping the table in @mm
+ * @address: an address within the table
+ *
+ * Called with mmap_sem held, and may sleep.  Returns 0 or -ENOMEM.
+ */
+int unshare_pte_table(struct mm_struct *mm, struct vm_area_struct *vma,
+		pmd_t *pmd, unsigned long address)
+{
+	unsigned long start = address & PMD_MASK, addr;
+	struct page *new, *old;
+	spinlock_t *ptl;
+	pte_t *src_pte, *dst_pte;
+	pmd_t newpmd;
+	int rss[2];
+	int i;
+
+	new = pte_alloc_one(mm, start);
+	if (!new)
+		return -ENOMEM;
+	pte_lock_init(new);
+
+	/*
+	 * page_table_lock keeps the pmd, and so our hold on the old table,
+	 * from changing under us: other threads may be unsharing it too.
+	 */
+	spin_lock(&mm->page_table_lock);
+	if (!pmd_ptes_shared(*pmd))
+		goto out;
+	old = pmd_page(*pmd);
+	ptl = pte_lockptr(mm, pmd);
+	spin_lock(ptl);
+	if (page_count(old) == 1) {
+		/* the others have let go of it since: it is ours again */
+		set_pmd(pmd, pmd_mkwrite(*pmd));
+		spin_unlock(ptl);
+		goto out;
+	}
+
+	pmd_populate(mm, &newpmd, new);
+	src_pte = pte_offset_map(pmd, start);
+	dst_pte = pte_offset_map_nested(&newpmd, start);
+	for (i = 0, addr = start; i < PTRS_PER_PTE; i++, addr += PAGE_SIZE) {
+		if (!pte_none(src_pte[i]))
+			copy_one_pte(mm, mm, dst_pte + i, src_pte + i,
+				     vma, addr, rss);
+	}
+	pte_unmap_nested(dst_pte);
+	pte_unmap(src_pte);
+
+	/* rss already counts these pages, from when the table was shared */
+	set_pmd(pmd, newpmd);
+	put_page(old);
+	spin_unlock(ptl);
+	spin_unlock(&mm->page_table_lock);
+
+	/* nothing may be cached from the old table once it can change */
+	flush_tlb_range(vma, start, start + PMD_SIZE);
+	return 0;
+out:
+	spin_unlock(&mm->page_table_lock);
+	pte_lock_deinit(new);
+	pte_free(new);
+	return 0;
+}
+
+/**
+ * unshare_page_range - unshare the pte tables overlapping a range
+ * @vma: the vma
+ * @start: start of the range
+ * @end: end of the range
+ *
+ * For callers about to change ptes, or vma boundaries, in the range.
+ */
+int unshare_page_range(struct vm_area_struct *vma, unsigned long start,
+		unsigned long end)
+{
+	struct mm_struct *mm = vma->vm_mm;
+	unsigned long addr;
+	pgd_t *pgd;
+	pud_t *pud;
+	pmd_t *pmd;
+	int err;
+
+	for (addr = start & PMD_MASK; addr < end; addr += PMD_SIZE) {
+		pgd = pgd_offset(mm, addr);
+		if (!pgd_present(*pgd))
+			continue;
+		pud = pud_offset(pgd, addr);
+		if (!pud_present(*pud))
+			continue;
+		pmd = pmd_offset(pud, addr);
+		if (!pmd_ptes_shared(*pmd))
+			continue;
+		err = unshare_pte_table(mm, vma, pmd, addr);
+		if (err)
+			return err;
+	}
+	return 0;
+}
+
+/*
+ * Unmapping the whole of a shared table: just let go of it.  Returns 0
+ * if it is not shared after all, to be zapped as usual.
+ */
+static int zap_shared_pte_table(struct vm_area_struct *vma, pmd_t *pmd,
+		unsigned long addr)
+{
+	struct mm_struct *mm = vma->vm_mm;
+	struct page *table;
+	spinlock_t *ptl;
+	pte_t *pte;
+	int rss[2];
+	int ret = 0;
+
+	spin_lock(&mm->page_table_lock);
+	table = pmd_page(*pmd);
+	pte = pte_offset_map_lock(mm, pmd, addr, &ptl);
+	if (page_count(table) > 1) {
+		count_pte_table(pte, addr, rss);
+		add_mm_rss(mm, -rss[0], -rss[1]);
+		pmd_clear(pmd);
+		mm->nr_ptes--;
+		dec_zone_page_state(table, NR_PAGETABLE);
+		put_page(table);
+		ret = 1;
+	}
+	pte_unmap_unlock(pte, ptl);
+	spin_unlock(&mm->page_table_lock);
+
+	if (ret)
+		flush_tlb_range(vma, addr, addr + PMD_SIZE);
+	return ret;
+}
+#else
+#define vma_shares_ptes(vma)					0
+#define share_pte_table(dst_mm, src_mm, dst_pmd, src_pmd, addr)	0
+#define zap_shared_pte_table(vma, pmd, addr)			0
+#endif /* CONFIG_SHARED_PAGE_TABLES */
+
 static inline int copy_pmd_range(struct mm_struct *dst_mm, struct mm_struct *src_mm,
 		pud_t *dst_pud, pud_t *src_pud, struct vm_area_struct *vma,
 		unsigned long addr, unsigned long end)
 {
 	pmd_t *src_pmd, *dst_pmd;
 	unsigned long next;
+	int share = vma_shares_ptes(vma);
 
 	dst_pmd = pmd_alloc(dst_mm, dst_pud, addr);
 	if (!dst_pmd)
@@ -549,8 +817,13 @@ static inline int copy_pmd_range(struct mm_struct *dst_mm, struct mm_struct *src
 	src_pmd = pmd_offset(src_pud, addr);
 	do {
 		next = pmd_addr_end(addr, end);
+		/* huge pages are never shared: the child gets small ones */
+		split_huge_page_pmd(src_mm, src_pmd);
 		if (pmd_none_or_clear_bad(src_pmd))
 			continue;
+		if (share && next - addr == PMD_SIZE &&
+		    share_pte_table(dst_mm, src_mm, dst_pmd, src_pmd, addr))
+			continue;
 		if (copy_pte_range(dst_mm, src_mm, dst_pmd, src_pmd,
 						vma, addr, next))
 			return -ENOMEM;
@@ -709,10 +982,24 @@ static inline unsigned long zap_pmd_range(struct mmu_gather *tlb,
 	pmd = pmd_offset(pud, addr);
 	do {
 		next = pmd_addr_end(addr, end);
+		if (pmd_trans_huge(*pmd)) {
+			if (next - addr != HPAGE_PMD_SIZE)
+				split_huge_page_pmd(vma->vm_mm, pmd);
+			else if (zap_huge_pmd(tlb, vma, pmd)) {
+				(*zap_work) -= HPAGE_PMD_SIZE;
+				continue;
+			}
+		}
 		if (pmd_none_or_clear_bad(pmd)) {
 			(*zap_work)--;
 			continue;
 		}
+		/* callers unshare a table before unmapping part of it */
+		if (pmd_ptes_shared(*pmd) && next - addr == PMD_SIZE &&
+		    zap_shared_pte_table(vma, pmd, addr)) {
+			(*zap_work) -= PTRS_PER_PTE;
+			continue;
+		}
 		next = zap_pte_range(tlb, vma, pmd, addr, next,
 						zap_work, details);
 	} while (pmd++, addr = next, (addr != end && *zap_work > 0));
@@ -848,19 +1135,23 @@ unsigned long unmap_vmas(struct mmu_gather **tlbp,
 				break;
 			}
 
-			tlb_finish_mmu(*tlbp, tlb_start, start);
-
+			/*
+			 * Only finish the gather, and flush the tlbs of every
+			 * cpu the mm runs on, when we have to let go of the
+			 * cpu: otherwise keep gathering, the gather flushes
+			 * by itself once its page array is full.
+			 */
 			if (need_resched() ||
 				(i_mmap_lock && need_lockbreak(i_mmap_lock))) {
+				tlb_finish_mmu(*tlbp, tlb_start, start);
 				if (i_mmap_lock) {
 					*tlbp = NULL;
 					goto out;
 				}
 				cond_resched();
+				*tlbp = tlb_gather_mmu(vma->vm_mm, fullmm);
+				tlb_start_valid = 0;
 			}
-
-			*tlbp = tlb_gather_mmu(vma->vm_mm, fullmm);
-			tlb_start_valid = 0;
 			zap_work = ZAP_BLOCK_SIZE;
 		}
 	}
@@ -922,6 +1213,15 @@ struct page *follow_page(struct vm_area_struct *vma, unsigned long address,
 		goto no_page_table;
 	
 	pmd = pmd_offset(pud, address);
+	if (pmd_trans_huge(*pmd)) {
+		if (flags & FOLL_GET)
+			/* a reference must be on the page it is put on */
+			split_huge_page_pmd(mm, pmd);
+		else {
+			page = follow_trans_huge_pmd(mm, address, pmd, flags);
+			goto out;
+		}
+	}
 	if (pmd_none(*pmd) || unlikely(pmd_bad(*pmd)))
 		goto no_page_table;
 
@@ -931,6 +1231,10 @@ struct page *follow_page(struct vm_area_struct *vma, unsigned long address,
 		goto out;
 	}
 
+	/* leave it to handle_mm_fault() to unshare the table */
+	if ((flags & FOLL_WRITE) && pmd_ptes_shared(*pmd))
+		goto out;
+
 	ptep = pte_offset_map_lock(mm, pmd, address, &ptl);
 	if (!ptep)
 		goto out;
@@ -1496,7 +1800,8 @@ static int do_wp_page(struct mm_struct *mm, struct vm_area_struct *vma,
 		}
 
 		reuse = 1;
-	} else if (PageAnon(old_page) && !TestSetPageLocked(old_page)) {
+	} else if (PageAnon(old_page) && !PageKsm(old_page) &&
+		   !TestSetPageLocked(old_page)) {
 		reuse = can_share_swap_page(old_page);
 		unlock_page(old_page);
 	} else {
@@ -1528,7 +1833,7 @@ gotten:
 		if (!new_page)
 			goto oom;
 	} else {
-		new_page = alloc_page_vma(GFP_HIGHUSER, vma, address);
+		new_page = alloc_page_vma(GFP_HIGHUSER_MOVABLE, vma, address);
 		if (!new_page)
 			goto oom;
 		cow_user_page(new_page, old_page, address);
@@ -1542,19 +1847,19 @@ gotten:
 		if (old_page) {
 			page_remove_rmap(old_page);
 			if (!PageAnon(old_page)) {
-				dec_mm_counter(mm, file_rss);
-				inc_mm_counter(mm, anon_rss);
+				dec_mm_counter_fast(mm, file_rss);
+				inc_mm_counter_fast(mm, anon_rss);
 			}
 		} else
-			inc_mm_counter(mm, anon_rss);
+			inc_mm_counter_fast(mm, anon_rss);
 		flush_cache_page(vma, address, pte_pfn(orig_pte));
 		entry = mk_pte(new_page, vma->vm_page_prot);
 		entry = maybe_mkwrite(pte_mkdirty(entry), vma);
 		lazy_mmu_prot_update(entry);
 		ptep_establish(vma, address, page_table, entry);
 		update_mmu_cache(vma, address, entry);
-		lru_cache_add_active(new_page);
 		page_add_new_anon_rmap(new_page, vma, address);
+		lru_cache_add_active(new_page);
 
 		/* Free the old page.. */
 		new_page = old_page;
@@ -1856,6 +2161,85 @@ int vmtruncate_range(struct inode *inode, loff_t offset, loff_t end)
 }
 EXPORT_UNUSED_SYMBOL(vmtruncate_range);  /*  June 2006  */
 
+int sysctl_swap_vma_readahead __read_mostly = 1;
+
+/* most ptes swapin_readahead_vma() will look at */
+#define SWAP_RA_VMA_MAX		32
+
+/*
+ * Read ahead the swap entries of the ptes around the fault, within the
+ * vma and its page table, wherever they lie in swap: pages swapped out
+ * from the same neighbourhood of a process are the ones likely to be
+ * wanted back together, while the slots next to the faulting one may
+ * belong to anyone.  The ptes are looked at unlocked; a stale entry just
+ * reads a page that isn't needed.
+ *
+ * Caller must hold down_read on the vma->vm_mm.
+ */
+static void swapin_readahead_vma(swp_entry_t entry, unsigned long addr,
+				 struct vm_area_struct *vma)
+{
+	swp_entry_t entries[SWAP_RA_VMA_MAX];
+	unsigned long addrs[SWAP_RA_VMA_MAX];
+	unsigned long start, end, window;
+	pgd_t *pgd;
+	pud_t *pud;
+	pmd_t *pmd;
+	pte_t *pte, *orig_pte;
+	struct page *new_page;
+	int i, nr = 0;
+
+	window = 1UL << page_cluster;
+	if (window > SWAP_RA_VMA_MAX)
+		window = SWAP_RA_VMA_MAX;
+	window <<= PAGE_SHIFT;
+
+	start = addr & ~(window - 1);
+	end = start + window;
+	if (start < vma->vm_start)
+		start = vma->vm_start;
+	if (end > vma->vm_end || end < start)
+		end = vma->vm_end;
+	if (start < (addr & PMD_MASK))
+		start = addr & PMD_MASK;
+	end = pmd_addr_end(addr, end);
+
+	pgd = pgd_offset(vma->vm_mm, addr);
+	if (pgd_none(*pgd) || unlikely(pgd_bad(*pgd)))
+		goto read;
+	pud = pud_offset(pgd, addr);
+	if (pud_none(*pud) || unlikely(pud_bad(*pud)))
+		goto read;
+	pmd = pmd_offset(pud, addr);
+	if (pmd_none(*pmd) || pmd_trans_huge(*pmd) || unlikely(pmd_bad(*pmd)))
+		goto read;
+
+	orig_pte = pte = pte_offset_map(pmd, start);
+	for (; start < end; start += PAGE_SIZE, pte++) {
+		pte_t ptent = *pte;
+		swp_entry_t swp;
+
+		if (pte_none(ptent) || pte_present(ptent) || pte_file(ptent))
+			continue;
+		swp = pte_to_swp_entry(ptent);
+		if (is_migration_entry(swp))
+			continue;
+		entries[nr] = swp;
+		addrs[nr] = start;
+		nr++;
+	}
+	pte_unmap(orig_pte);
+
+read:
+	for (i = 0; i < nr; i++) {
+		new_page = read_swap_cache_async(entries[i], vma, addrs[i]);
+		if (!new_page)
+			break;
+		page_cache_release(new_page);
+	}
+	lru_add_drain();	/* Push any new pages onto the LRU now */
+}
+
 /* 
  * Primitive swap readahead code. We simply read an aligned block of
  * (1 << page_cluster) entries in the swap area. This method is chosen
@@ -1865,6 +2249,9 @@ EXPORT_UNUSED_SYMBOL(vmtruncate_range);  /*  June 2006  */
  * This has been extended to use the NUMA policies from the mm triggering
  * the readahead.
  *
+ * With a vma, and unless vm.swap_vma_readahead is cleared, the entries
+ * read are instead those of the ptes around the fault: see above.
+ *
  * Caller must hold down_read on the vma->vm_mm if vma is not NULL.
  */
 void swapin_readahead(swp_entry_t entry, unsigned long addr,struct vm_area_struct *vma)
@@ -1876,6 +2263,11 @@ void swapin_readahead(swp_entry_t entry, unsigned long addr,struct vm_area_struc
 	struct page *new_page;
 	unsigned long offset;
 
+	if (vma && sysctl_swap_vma_readahead) {
+		swapin_readahead_vma(entry, addr, vma);
+		return;
+	}
+
 	/*
 	 * Get the number of handles we should do readahead io to.
 	 */
@@ -1976,7 +2368,7 @@ static int do_swap_page(struct mm_struct *mm, struct vm_area_struct *vma,
 
 	/* The page isn't present yet, go ahead with the fault. */
 
-	inc_mm_counter(mm, anon_rss);
+	inc_mm_counter_fast(mm, anon_rss);
 	pte = mk_pte(page, vma->vm_page_prot);
 	if (write_access && can_share_swap_page(page)) {
 		pte = maybe_mkwrite(pte_mkdirty(pte), vma);
@@ -2042,9 +2434,10 @@ static int do_anonymous_page(struct mm_struct *mm, struct vm_area_struct *vma,
 		page_table = pte_offset_map_lock(mm, pmd, address, &ptl);
 		if (!pte_none(*page_table))
 			goto release;
-		inc_mm_counter(mm, anon_rss);
-		lru_cache_add_active(page);
+		inc_mm_counter_fast(mm, anon_rss);
 		page_add_new_anon_rmap(page, vma, address);
+		lru_cache_add_active(page);
+		numa_balancing_enter(mm);
 	} else {
 		/* Map the ZERO_PAGE - vm_page_prot is readonly */
 		page = ZERO_PAGE(address);
@@ -2055,7 +2448,7 @@ static int do_anonymous_page(struct mm_struct *mm, struct vm_area_struct *vma,
 		spin_lock(ptl);
 		if (!pte_none(*page_table))
 			goto release;
-		inc_mm_counter(mm, file_rss);
+		inc_mm_counter_fast(mm, file_rss);
 		page_add_file_rmap(page);
 	}
 
@@ -2074,6 +2467,168 @@ oom:
 	return VM_FAULT_OOM;
 }
 
+/*
+ * On a read fault in a page cache mapping, also map the neighbours of the
+ * faulting page that are already uptodate in the cache, within an aligned
+ * window of fault_around_bytes: a file mmapped and read through takes one
+ * fault per window instead of one per page.  PAGE_SIZE turns it off.
+ */
+static unsigned long fault_around_bytes __read_mostly = 65536;
+
+#define FAULT_AROUND_BATCH	16
+
+/*
+ * Map the pages of [start, end) that are uptodate in the page cache and
+ * not mapped yet.  Called with the pte lock held and page_table mapping
+ * address, in the same page table as the range.  Pages are only taken
+ * if they can be locked without waiting, so that truncation (which
+ * locks each page) cannot remove one under us; the reference from
+ * find_get_pages() becomes that of the new mapping.
+ */
+static void map_cached_pages(struct mm_struct *mm, struct vm_area_struct *vma,
+		unsigned long start, unsigned long end,
+		unsigned long address, pte_t *page_table,
+		struct address_space *mapping)
+{
+	pgoff_t start_index, index, end_index, size_index;
+	struct page *pages[FAULT_AROUND_BATCH];
+	unsigned int i, nr;
+
+	start_index = vma->vm_pgoff + ((start - vma->vm_start) >> PAGE_SHIFT);
+	end_index = start_index + ((end - start) >> PAGE_SHIFT);
+	size_index = (i_size_read(mapping->host) + PAGE_CACHE_SIZE - 1) >>
+							PAGE_CACHE_SHIFT;
+	if (end_index > size_index)
+		end_index = size_index;
+
+	index = start_index;
+	while (index < end_index) {
+		nr = find_get_pages(mapping, index,
+				min_t(pgoff_t, end_index - index,
+				      FAULT_AROUND_BATCH), pages);
+		if (!nr)
+			break;
+		for (i = 0; i < nr; i++) {
+			struct page *page = pages[i];
+			unsigned long addr;
+			pte_t *pte, entry;
+
+			index = page->index + 1;
+			if (page->index >= end_index || TestSetPageLocked(page))
+				goto skip;
+			if (page->mapping != mapping || !PageUptodate(page))
+				goto unlock;
+
+			addr = start + ((page->index - start_index) << PAGE_SHIFT);
+			pte = page_table + ((long)(addr - address) >> PAGE_SHIFT);
+			if (!pte_none(*pte))
+				goto unlock;
+
+			flush_icache_page(vma, page);
+			entry = mk_pte(page, vma->vm_page_prot);
+			set_pte_at(mm, addr, pte, entry);
+			inc_mm_counter_fast(mm, file_rss);
+			page_add_file_rmap(page);
+			update_mmu_cache(vma, addr, entry);
+			lazy_mmu_prot_update(entry);
+			unlock_page(page);
+			continue;
+unlock:
+			unlock_page(page);
+skip:
+			page_cache_release(page);
+		}
+	}
+}
+
+/* Called with the pte lock held and the faulting page already mapped */
+static void do_fault_around(struct mm_struct *mm, struct vm_area_struct *vma,
+		unsigned long address, pte_t *page_table,
+		struct address_space *mapping)
+{
+	unsigned long size = fault_around_bytes;
+	unsigned long start, end;
+
+	start = max(address & ~(size - 1), vma->vm_start);
+	end = min(start + size, vma->vm_end);
+	map_cached_pages(mm, vma, start, end, address, page_table, mapping);
+}
+
+/**
+ * populate_cached_range - map what is cached of part of a file mapping
+ * @vma: the mapping
+ * @start: start address
+ * @end: end address
+ *
+ * Maps the pages of [@start, @end) that are uptodate in the page cache
+ * as read faults would, without reading anything in: exec uses it to
+ * spare a new program the faults on the first pages of its segments.
+ * Called with mmap_sem held.
+ */
+void populate_cached_range(struct vm_area_struct *vma,
+		unsigned long start, unsigned long end)
+{
+	struct mm_struct *mm = vma->vm_mm;
+	unsigned long next;
+	spinlock_t *ptl;
+	pgd_t *pgd;
+	pud_t *pud;
+	pmd_t *pmd;
+	pte_t *pte;
+
+	if (!vma->vm_ops || vma->vm_ops->nopage != filemap_nopage ||
+	    (vma->vm_flags & VM_NONLINEAR))
+		return;
+	start = max(start & PAGE_MASK, vma->vm_start);
+	end = min(PAGE_ALIGN(end), vma->vm_end);
+
+	for (; start < end; start = next) {
+		next = pmd_addr_end(start, end);
+		pgd = pgd_offset(mm, start);
+		pud = pud_alloc(mm, pgd, start);
+		if (!pud)
+			return;
+		pmd = pmd_alloc(mm, pud, start);
+		if (!pmd)
+			return;
+		pte = pte_alloc_map_lock(mm, pmd, start, &ptl);
+		if (!pte)
+			return;
+		map_cached_pages(mm, vma, start, next, start, pte,
+				 vma->vm_file->f_mapping);
+		pte_unmap_unlock(pte, ptl);
+	}
+}
+
+#ifdef CONFIG_DEBUG_FS
+static u64 fault_around_bytes_get(void *data)
+{
+	return fault_around_bytes;
+}
+
+/* rounded down to a power of two, at most one page table's worth */
+static void fault_around_bytes_set(void *data, u64 val)
+{
+	if (val > PTRS_PER_PTE * PAGE_SIZE)
+		val = PTRS_PER_PTE * PAGE_SIZE;
+	while (val & (val - 1))
+		val &= val - 1;
+	if (val < PAGE_SIZE)
+		val = PAGE_SIZE;
+	fault_around_bytes = val;
+}
+DEFINE_SIMPLE_ATTRIBUTE(fault_around_bytes_fops, fault_around_bytes_get,
+			fault_around_bytes_set, "%llu\n");
+
+static int __init fault_around_debugfs(void)
+{
+	debugfs_create_file("fault_around_bytes", 0644, NULL, NULL,
+			    &fault_around_bytes_fops);
+	return 0;
+}
+late_initcall(fault_around_debugfs);
+#endif
+
 /*
  * do_no_page() tries to create a new page mapping. It aggressively
  * tries to share with existing pages, but makes a separate copy if
@@ -2132,7 +2687,7 @@ retry:
 
 			if (unlikely(anon_vma_prepare(vma)))
 				goto oom;
-			page = alloc_page_vma(GFP_HIGHUSER, vma, address);
+			page = alloc_page_vma(GFP_HIGHUSER_MOVABLE, vma, address);
 			if (!page)
 				goto oom;
 			copy_user_highpage(page, new_page, address);
@@ -2186,11 +2741,11 @@ retry:
 			entry = maybe_mkwrite(pte_mkdirty(entry), vma);
 		set_pte_at(mm, address, page_table, entry);
 		if (anon) {
-			inc_mm_counter(mm, anon_rss);
-			lru_cache_add_active(new_page);
+			inc_mm_counter_fast(mm, anon_rss);
 			page_add_new_anon_rmap(new_page, vma, address);
+			lru_cache_add_active(new_page);
 		} else {
-			inc_mm_counter(mm, file_rss);
+			inc_mm_counter_fast(mm, file_rss);
 			page_add_file_rmap(new_page);
 		}
 	} else {
@@ -2202,6 +2757,12 @@ retry:
 	/* no need to invalidate: a not-present page shouldn't be cached */
 	update_mmu_cache(vma, address, entry);
 	lazy_mmu_prot_update(entry);
+
+	if (!write_access && !anon && fault_around_bytes > PAGE_SIZE &&
+	    vma->vm_ops->nopage == filemap_nopage &&
+	    !(vma->vm_flags & VM_NONLINEAR))
+		do_fault_around(mm, vma, address & PAGE_MASK, page_table,
+				mapping);
 unlock:
 	pte_unmap_unlock(page_table, ptl);
 	return ret;
@@ -2248,6 +2809,62 @@ static int do_file_page(struct mm_struct *mm, struct vm_area_struct *vma,
 	return VM_FAULT_MAJOR;
 }
 
+#ifdef CONFIG_NUMA_BALANCING
+/*
+ * A hinting pte left by knumad has been touched.  Map the page back,
+ * tell task_numa_fault() which node it was used from, and move it to
+ * that node if nothing else can be using it.
+ */
+static int do_numa_page(struct mm_struct *mm, struct vm_area_struct *vma,
+		unsigned long address, pte_t *page_table, pmd_t *pmd,
+		pte_t orig_pte)
+{
+	struct page *page;
+	spinlock_t *ptl;
+	pte_t entry;
+	int private;
+
+	ptl = pte_lockptr(mm, pmd);
+	spin_lock(ptl);
+	if (unlikely(!pte_same(*page_table, orig_pte))) {
+		pte_unmap_unlock(page_table, ptl);
+		return VM_FAULT_MINOR;
+	}
+	entry = pte_mknonnuma(orig_pte);
+	set_pte_at(mm, address, page_table, entry);
+
+	/* No need to invalidate - it was non-present before */
+	update_mmu_cache(vma, address, entry);
+	lazy_mmu_prot_update(entry);
+
+	page = vm_normal_page(vma, address, entry);
+	if (!page || !PageAnon(page) || PageKsm(page)) {
+		pte_unmap_unlock(page_table, ptl);
+		return VM_FAULT_MINOR;
+	}
+	get_page(page);
+	/* another thread of the task may be using it from elsewhere */
+	private = page_mapcount(page) == 1 &&
+		  atomic_read(&current->signal->live) == 1;
+	pte_unmap_unlock(page_table, ptl);
+
+	if (task_numa_fault(page_to_nid(page), numa_node_id(), private) &&
+	    !(current->flags & PF_MEMPOLICY) && !vma_policy(vma))
+		migrate_misplaced_page(page, numa_node_id());
+	else
+		put_page(page);
+	return VM_FAULT_MINOR;
+}
+#else
+static inline int do_numa_page(struct mm_struct *mm,
+		struct vm_area_struct *vma, unsigned long address,
+		pte_t *page_table, pmd_t *pmd, pte_t orig_pte)
+{
+	BUG();
+	return VM_FAULT_SIGBUS;
+}
+#endif
+
 /*
  * These routines also need to handle stuff like marking pages dirty
  * and/or accessed for architectures that don't do it in hardware (most
@@ -2285,6 +2902,10 @@ static inline int handle_pte_fault(struct mm_struct *mm,
 					pte, pmd, write_access, entry);
 	}
 
+	/* PROT_NONE ptes look the same, but no access reaches them here */
+	if (pte_numa(entry) && (vma->vm_flags & (VM_READ | VM_WRITE | VM_EXEC)))
+		return do_numa_page(mm, vma, address, pte, pmd, entry);
+
 	ptl = pte_lockptr(mm, pmd);
 	spin_lock(ptl);
 	if (unlikely(!pte_same(*pte, entry)))
@@ -2329,6 +2950,7 @@ int __handle_mm_fault(struct mm_struct *mm, struct vm_area_struct *vma,
 	__set_current_state(TASK_RUNNING);
 
 	count_vm_event(PGFAULT);
+	check_sync_rss_stat(current);
 
 	if (unlikely(is_vm_hugetlb_page(vma)))
 		return hugetlb_fault(mm, vma, address, write_access);
@@ -2340,15 +2962,226 @@ int __handle_mm_fault(struct mm_struct *mm, struct vm_area_struct *vma,
 	pmd = pmd_alloc(mm, pud, address);
 	if (!pmd)
 		return VM_FAULT_OOM;
-	pte = pte_alloc_map(mm, pmd, address);
-	if (!pte)
+retry:
+	if (pmd_none(*pmd) && transparent_hugepage_enabled(vma)) {
+		int ret = do_huge_pmd_anonymous_page(mm, vma, address,
+						     pmd, write_access);
+		if (ret != VM_FAULT_FALLBACK)
+			return ret;
+	}
+	if (pmd_trans_huge(*pmd)) {
+		int ret = do_huge_pmd_fault(mm, vma, address,
+					    pmd, write_access);
+		if (ret != VM_FAULT_FALLBACK)
+			return ret;
+	}
+	if (unlikely(!pmd_present(*pmd)) && __pte_alloc(mm, pmd, address))
 		return VM_FAULT_OOM;
+	if (unlikely(pmd_ptes_shared(*pmd)) &&
+	    unshare_pte_table(mm, vma, pmd, address))
+		return VM_FAULT_OOM;
+	/* a huge page may have been faulted in by another thread */
+	if (unlikely(pmd_trans_huge(*pmd)))
+		goto retry;
+	pte = pte_offset_map(pmd, address);
 
 	return handle_pte_fault(mm, vma, address, pte, pmd, write_access);
 }
 
 EXPORT_SYMBOL_GPL(__handle_mm_fault);
 
+#ifdef CONFIG_SPECULATIVE_PAGE_FAULT
+/*
+ * Find the vma containing @addr without mmap_sem.  vm_area_cachep is
+ * SLAB_DESTROY_BY_RCU, so under rcu_read_lock() whatever the tree leads
+ * to is a vma, though perhaps no longer linked or not of this mm: the
+ * caller checks.  The tree may be rebalancing under us, so the walk is
+ * bounded and may miss.
+ */
+static struct vm_area_struct *find_vma_speculative(struct mm_struct *mm,
+		unsigned long addr)
+{
+	struct rb_node *rb_node = rcu_dereference(mm->mm_rb.rb_node);
+	int depth = 0;
+
+	while (rb_node && depth++ < 2 * BITS_PER_LONG) {
+		struct vm_area_struct *vma;
+
+		vma = rb_entry(rb_node, struct vm_area_struct, vm_rb);
+		if (vma->vm_end > addr) {
+			if (vma->vm_start <= addr)
+				return vma;
+			rb_node = rcu_dereference(rb_node->rb_left);
+		} else
+			rb_node = rcu_dereference(rb_node->rb_right);
+	}
+	return NULL;
+}
+
+/*
+ * Only private anonymous memory that already has its anon_vma and no
+ * policy of its own, and that may be accessed this way, is handled
+ * speculatively: that covers malloc arenas and GC heaps touching fresh
+ * memory, and keeps everything that could sleep or need mmap_sem out.
+ */
+static int vma_speculative_ok(struct vm_area_struct *vma,
+		struct mm_struct *mm, unsigned long address, int write_access)
+{
+	if (vma->vm_mm != mm ||
+	    address < vma->vm_start || address >= vma->vm_end)
+		return 0;
+	if (vma->vm_ops || vma->vm_file || !vma->anon_vma || vma_policy(vma))
+		return 0;
+	if (vma->vm_flags & (VM_SHARED | VM_GROWSDOWN | VM_GROWSUP |
+			     VM_HUGETLB | VM_PFNMAP | VM_IO))
+		return 0;
+	if (write_access)
+		return !!(vma->vm_flags & VM_WRITE);
+	return !!(vma->vm_flags & (VM_READ | VM_EXEC));
+}
+
+/* the vma still is what the snapshot says, whatever the sequence count */
+static int vma_speculative_same(struct vm_area_struct *vma,
+		struct vm_area_struct *snap)
+{
+	return vma->vm_mm == snap->vm_mm &&
+	       vma->vm_start == snap->vm_start &&
+	       vma->vm_end == snap->vm_end &&
+	       vma->vm_flags == snap->vm_flags &&
+	       vma->vm_pgoff == snap->vm_pgoff &&
+	       vma->anon_vma == snap->anon_vma &&
+	       pgprot_val(vma->vm_page_prot) == pgprot_val(snap->vm_page_prot);
+}
+
+/**
+ * handle_speculative_fault - handle a not-present fault without mmap_sem
+ * @mm: the faulting mm, current's
+ * @address: the faulting address
+ * @write_access: whether it is a write fault
+ *
+ * Maps a new anonymous page, or the zero page for a read, where there
+ * is no pte yet, exactly as do_anonymous_page() would.  Returns 1 if the
+ * fault was dealt with, 0 if the caller must take mmap_sem and go
+ * through handle_mm_fault() as usual.
+ *
+ * Interrupts are kept off from the page table walk until the pte lock
+ * is held and the vma has been revalidated: page tables are only freed
+ * after a TLB flush IPI, which this cpu cannot answer meanwhile.  Once
+ * the pte lock is held with the vma unchanged, anyone about to change
+ * the vma has bumped its sequence count after we looked, and must take
+ * the same lock before touching the ptes.
+ */
+int handle_speculative_fault(struct mm_struct *mm, unsigned long address,
+		int write_access)
+{
+	struct vm_area_struct *vma, snap;
+	struct page *page = NULL;
+	unsigned int seq;
+	pgd_t *pgd;
+	pud_t *pud;
+	pmd_t *pmd, pmdval;
+	pte_t *pte, entry;
+	spinlock_t *ptl;
+	int ret = 0;
+
+	address &= PAGE_MASK;
+	if (write_access) {
+		/* only allocate for a fault that can go this way */
+		rcu_read_lock();
+		vma = find_vma_speculative(mm, address);
+		ret = vma && vma_speculative_ok(vma, mm, address, 1);
+		rcu_read_unlock();
+		if (!ret)
+			return 0;
+		ret = 0;
+
+		/* the vma has no policy: the task's applies */
+		page = alloc_page_vma(GFP_HIGHUSER_MOVABLE, NULL, address);
+		if (!page)
+			return 0;
+		clear_user_highpage(page, address);
+	}
+
+	rcu_read_lock();
+	vma = find_vma_speculative(mm, address);
+	if (!vma)
+		goto out;
+	seq = read_seqcount_begin(&vma->vm_sequence);
+	snap = *vma;
+	if (read_seqcount_retry(&vma->vm_sequence, seq) ||
+	    !vma_speculative_ok(&snap, mm, address, write_access))
+		goto out;
+
+	local_irq_disable();
+	pgd = pgd_offset(mm, address);
+	if (!pgd_present(*pgd))
+		goto out_irq;
+	pud = pud_offset(pgd, address);
+	if (!pud_present(*pud))
+		goto out_irq;
+	pmd = pmd_offset(pud, address);
+	pmdval = *pmd;
+	if (!pmd_present(pmdval) || pmd_trans_huge(pmdval) ||
+	    pmd_ptes_shared(pmdval))
+		goto out_irq;
+
+	ptl = pte_lockptr(mm, &pmdval);
+	pte = pte_offset_map(&pmdval, address);
+	if (!spin_trylock(ptl))
+		goto out_unmap;
+	if (pmd_val(*pmd) != pmd_val(pmdval) ||
+	    read_seqcount_retry(&vma->vm_sequence, seq) ||
+	    !vma_speculative_same(vma, &snap)) {
+		spin_unlock(ptl);
+		goto out_unmap;
+	}
+	local_irq_enable();
+
+	if (!pte_none(*pte)) {
+		/* raced with another fault: retry the access if it mapped */
+		ret = pte_present(*pte) && !pte_numa(*pte);
+		goto unlock;
+	}
+	if (write_access) {
+		entry = mk_pte(page, snap.vm_page_prot);
+		entry = maybe_mkwrite(pte_mkdirty(entry), &snap);
+		inc_mm_counter_fast(mm, anon_rss);
+		page_add_new_anon_rmap(page, &snap, address);
+		lru_cache_add_active(page);
+		page = NULL;
+	} else {
+		/* Map the ZERO_PAGE - vm_page_prot is readonly */
+		struct page *zero = ZERO_PAGE(address);
+
+		page_cache_get(zero);
+		entry = mk_pte(zero, snap.vm_page_prot);
+		inc_mm_counter_fast(mm, file_rss);
+		page_add_file_rmap(zero);
+	}
+	set_pte_at(mm, address, pte, entry);
+
+	/* No need to invalidate - it was non-present before */
+	update_mmu_cache(&snap, address, entry);
+	lazy_mmu_prot_update(entry);
+	count_vm_event(SPECULATIVE_PGFAULT);
+	check_sync_rss_stat(current);
+	ret = 1;
+unlock:
+	pte_unmap_unlock(pte, ptl);
+	goto out;
+
+out_unmap:
+	pte_unmap(pte);
+out_irq:
+	local_irq_enable();
+out:
+	rcu_read_unlock();
+	if (page)
+		page_cache_release(page);
+	return ret;
+}
+#endif /* CONFIG_SPECULATIVE_PAGE_FAULT */
+
 #ifndef __PAGETABLE_PUD_FOLDED
 /*
  * Allocate page upper directory.
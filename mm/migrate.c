@@ -28,6 +28,7 @@
 #include <linux/mempolicy.h>
 #include <linux/vmalloc.h>
 #include <linux/security.h>
+#include <linux/numa_balancing.h>
 
 #include "internal.h"
 
@@ -53,10 +54,7 @@ int isolate_lru_page(struct page *page, struct list_head *pagelist)
 			ret = 0;
 			get_page(page);
 			ClearPageLRU(page);
-			if (PageActive(page))
-				del_page_from_active_list(zone, page);
-			else
-				del_page_from_inactive_list(zone, page);
+			del_page_from_lru_list(zone, page, page_lru(page));
 			list_add_tail(&page->lru, pagelist);
 		}
 		spin_unlock_irq(&zone->lru_lock);
@@ -221,7 +219,7 @@ static void remove_anon_migration_ptes(struct page *old, struct page *new)
 
 	mapping = (unsigned long)new->mapping;
 
-	if (!mapping || (mapping & PAGE_MAPPING_ANON) == 0)
+	if ((mapping & PAGE_MAPPING_FLAGS) != PAGE_MAPPING_ANON)
 		return;
 
 	/*
@@ -294,7 +292,8 @@ out:
 static int migrate_page_move_mapping(struct address_space *mapping,
 		struct page *newpage, struct page *page)
 {
-	struct page **radix_pointer;
+	int expected_count;
+	void **pslot;
 
 	if (!mapping) {
 		/* Anonymous page */
@@ -305,12 +304,21 @@ static int migrate_page_move_mapping(struct address_space *mapping,
 
 	write_lock_irq(&mapping->tree_lock);
 
-	radix_pointer = (struct page **)radix_tree_lookup_slot(
-						&mapping->page_tree,
-						page_index(page));
+	pslot = radix_tree_lookup_slot(&mapping->page_tree,
+					page_index(page));
 
-	if (page_count(page) != 2 + !!PagePrivate(page) ||
-			*radix_pointer != page) {
+	expected_count = 2 + !!PagePrivate(page);
+	if (page_count(page) != expected_count ||
+			radix_tree_deref_slot(pslot) != page) {
+		write_unlock_irq(&mapping->tree_lock);
+		return -EAGAIN;
+	}
+
+	/*
+	 * Keep lockless pagecache lookups from picking up new references
+	 * to the old page while its slot is being switched over.
+	 */
+	if (!page_freeze_refs(page, expected_count)) {
 		write_unlock_irq(&mapping->tree_lock);
 		return -EAGAIN;
 	}
@@ -326,8 +334,13 @@ static int migrate_page_move_mapping(struct address_space *mapping,
 	}
 #endif
 
-	*radix_pointer = newpage;
-	__put_page(page);
+	radix_tree_replace_slot(pslot, newpage);
+
+	/*
+	 * Drop the pagecache reference of the old page, the new page
+	 * took it over above.
+	 */
+	page_unfreeze_refs(page, expected_count - 1);
 	write_unlock_irq(&mapping->tree_lock);
 
 	return 0;
@@ -348,6 +361,8 @@ static void migrate_page_copy(struct page *newpage, struct page *page)
 		SetPageUptodate(newpage);
 	if (PageActive(page))
 		SetPageActive(newpage);
+	if (PageSwapBacked(page))
+		SetPageSwapBacked(newpage);
 	if (PageChecked(page))
 		SetPageChecked(newpage);
 	if (PageMappedToDisk(page))
@@ -591,6 +606,7 @@ static int unmap_and_move(new_page_t get_new_page, unsigned long private,
 {
 	int rc = 0;
 	int *result = NULL;
+	int rcu_locked = 0;
 	struct page *newpage = get_new_page(page, private, &result);
 
 	if (!newpage)
@@ -613,6 +629,30 @@ static int unmap_and_move(new_page_t get_new_page, unsigned long private,
 		wait_on_page_writeback(page);
 	}
 
+	/*
+	 * Pages found by a scan of physical memory (memory compaction) are
+	 * not pinned by the mm of whoever mapped them: an anonymous page
+	 * may be unmapped and its anon_vma freed while the migration ptes
+	 * are in place. anon_vma is SLAB_DESTROY_BY_RCU, so the RCU read
+	 * lock keeps it valid until the ptes are restored; nothing from here
+	 * to there sleeps for anonymous pages.
+	 */
+	if (PageAnon(page)) {
+		rcu_read_lock();
+		rcu_locked = 1;
+	}
+
+	/*
+	 * A page without rmap yet (swap cache being read in) or truncated
+	 * from under us can't be unmapped, leave it for a later pass.
+	 */
+	if (!page->mapping)
+		goto rcu_unlock;
+
+	/* nor can a KSM page: it has no anon_vma to find its ptes by */
+	if (PageKsm(page))
+		goto rcu_unlock;
+
 	/*
 	 * Establish migration ptes or remove ptes
 	 */
@@ -623,6 +663,9 @@ static int unmap_and_move(new_page_t get_new_page, unsigned long private,
 	if (rc)
 		remove_migration_ptes(page, page);
 
+rcu_unlock:
+	if (rcu_locked)
+		rcu_read_unlock();
 unlock:
 	unlock_page(page);
 
@@ -741,7 +784,7 @@ static struct page *new_page_node(struct page *p, unsigned long private,
 
 	*result = &pm->status;
 
-	return alloc_pages_node(pm->node, GFP_HIGHUSER, 0);
+	return alloc_pages_node(pm->node, GFP_HIGHUSER_MOVABLE, 0);
 }
 
 /*
@@ -994,3 +1037,52 @@ int migrate_vmas(struct mm_struct *mm, const nodemask_t *to,
  	}
  	return err;
 }
+
+#ifdef CONFIG_NUMA_BALANCING
+/*
+ * Only memory free on the node itself is worth taking: a page that
+ * would need reclaim, or that would land on yet another node, is left
+ * where it is.
+ */
+static struct page *alloc_misplaced_dst_page(struct page *page,
+		unsigned long private, int **result)
+{
+	int nid = (int)private;
+	struct page *newpage;
+
+	newpage = alloc_pages_node(nid, GFP_HIGHUSER_MOVABLE |
+				   __GFP_NOWARN | __GFP_NORETRY, 0);
+	if (newpage && page_to_nid(newpage) != nid) {
+		__free_page(newpage);
+		return NULL;
+	}
+	return newpage;
+}
+
+/**
+ * migrate_misplaced_page - move a page to the node that faulted on it
+ * @page: an anonymous page mapped only by current
+ * @nid: the node to move it to
+ *
+ * Called from a NUMA hinting fault, with mmap_sem held for read.  Takes
+ * over the caller's reference to @page.  Returns 0 if the page moved.
+ */
+int migrate_misplaced_page(struct page *page, int nid)
+{
+	LIST_HEAD(pagelist);
+	int err;
+
+	/* a page just faulted in may still be on its way to the LRU */
+	if (!PageLRU(page))
+		lru_add_drain();
+	err = isolate_lru_page(page, &pagelist);
+	put_page(page);
+	if (err)
+		return err;
+
+	if (migrate_pages(&pagelist, alloc_misplaced_dst_page, nid))
+		return -EAGAIN;
+	count_vm_event(NUMA_PAGE_MIGRATE);
+	return 0;
+}
+#endif /* CONFIG_NUMA_BALANCING */
@@ -488,6 +488,7 @@ void vma_adjust(struct vm_area_struct *vma, unsigned long start,
 	long adjust_next = 0;
 	int remove_next = 0;
 
+	vma_write_begin(vma);
 	if (next && !insert) {
 		if (end >= next->vm_end) {
 			/*
@@ -517,6 +518,9 @@ again:			remove_next = 1 + (end > next->vm_end);
 			importer = next;
 		}
 	}
+	/* a removed next is left odd: it is on its way out */
+	if (remove_next || adjust_next)
+		vma_write_begin(next);
 
 	if (file) {
 		mapping = file->f_mapping;
@@ -575,6 +579,7 @@ again:			remove_next = 1 + (end > next->vm_end);
 	if (adjust_next) {
 		next->vm_start += adjust_next << PAGE_SHIFT;
 		next->vm_pgoff += adjust_next;
+		vma_write_end(next);
 	}
 
 	if (root) {
@@ -624,6 +629,7 @@ again:			remove_next = 1 + (end > next->vm_end);
 			goto again;
 		}
 	}
+	vma_write_end(vma);
 
 	validate_mm(mm);
 }
@@ -1701,6 +1707,7 @@ detach_vmas_to_be_unmapped(struct mm_struct *mm, struct vm_area_struct *vma,
 
 	insertion_point = (prev ? &prev->vm_next : &mm->mmap);
 	do {
+		vma_write_begin(vma);	/* left odd, see vma_adjust() */
 		rb_erase(&vma->vm_rb, &mm->mm_rb);
 		mm->map_count--;
 		tail_vma = vma;
@@ -1732,6 +1739,10 @@ int split_vma(struct mm_struct * mm, struct vm_area_struct * vma,
 	if (mm->map_count >= sysctl_max_map_count)
 		return -ENOMEM;
 
+	/* a pte table shared since fork must lie within one vma */
+	if ((addr & ~PMD_MASK) && unshare_page_range(vma, addr, addr + 1))
+		return -ENOMEM;
+
 	new = kmem_cache_alloc(vm_area_cachep, SLAB_KERNEL);
 	if (!new)
 		return -ENOMEM;
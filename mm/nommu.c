@@ -58,6 +58,9 @@ EXPORT_SYMBOL(vmalloc_to_page);
 EXPORT_SYMBOL(vmalloc_32);
 EXPORT_SYMBOL(vmap);
 EXPORT_SYMBOL(vunmap);
+EXPORT_SYMBOL(vm_map_ram);
+EXPORT_SYMBOL(vm_unmap_ram);
+EXPORT_SYMBOL_GPL(vm_unmap_aliases);
 
 /*
  * Handle all mappings that got truncated by a "truncate()"
@@ -236,6 +239,21 @@ void vunmap(void *addr)
 	BUG();
 }
 
+void *vm_map_ram(struct page **pages, unsigned int count, int node, pgprot_t prot)
+{
+	BUG();
+	return NULL;
+}
+
+void vm_unmap_ram(const void *mem, unsigned int count)
+{
+	BUG();
+}
+
+void vm_unmap_aliases(void)
+{
+}
+
 /*
  *  sys_brk() for the most part doesn't need the global kernel
  *  lock, except when an application is doing something nasty
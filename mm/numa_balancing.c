@@ -0,0 +1,345 @@
+/*
+ *  mm/numa_balancing.c
+ *
+ *  Automatic NUMA balancing.
+ *
+ *  knumad walks the private anonymous memory of each registered mm a
+ *  slice at a time, turning present ptes into NUMA hinting ptes that
+ *  fault on the next access.  do_numa_page() maps the page back and
+ *  reports here which node the page is on and which node touched it.
+ *  A page that only one single-threaded task maps is moved to the node
+ *  that touched it; a task whose faults on pages it shares mostly land
+ *  on another node is moved there instead, as those pages cannot follow
+ *  every one of their users.
+ */
+
+#include <linux/mm.h>
+#include <linux/sched.h>
+#include <linux/huge_mm.h>
+#include <linux/mempolicy.h>
+#include <linux/numa_balancing.h>
+#include <linux/sysctl.h>
+#include <linux/kthread.h>
+#include <linux/init.h>
+#include <asm/cacheflush.h>
+#include <asm/tlbflush.h>
+
+int sysctl_numa_balancing __read_mostly;
+int sysctl_numa_balancing_scan_period_ms __read_mostly = 1000;
+int sysctl_numa_balancing_scan_size_mb __read_mostly = 256;
+
+/* The mms knumad samples, each holding an mm_count reference */
+static LIST_HEAD(knumad_mms);
+static DEFINE_SPINLOCK(knumad_lock);
+static DECLARE_WAIT_QUEUE_HEAD(knumad_wait);
+
+void __numa_balancing_enter(struct mm_struct *mm)
+{
+	int wakeup = 0;
+
+	spin_lock(&knumad_lock);
+	if (list_empty(&mm->numa_link)) {
+		wakeup = list_empty(&knumad_mms);
+		atomic_inc(&mm->mm_count);
+		list_add_tail(&mm->numa_link, &knumad_mms);
+	}
+	spin_unlock(&knumad_lock);
+	if (wakeup)
+		wake_up_interruptible(&knumad_wait);
+}
+
+/*
+ * Once per knumad pass over the task's mm, see where its faults on
+ * shared pages landed since the last look: if one node took most of
+ * them, that is where the task would rather run.  The counts are then
+ * halved so that the choice follows what the task does now.
+ */
+static void task_numa_placement(struct task_struct *p)
+{
+	unsigned long faults, total = 0, max_faults = 0;
+	int seq = p->mm->numa_scan_seq;
+	int nid, max_nid = -1;
+
+	if (p->numa_scan_seq == seq)
+		return;
+	p->numa_scan_seq = seq;
+
+	for_each_online_node(nid) {
+		faults = p->numa_faults[nid];
+		total += faults;
+		if (faults > max_faults) {
+			max_faults = faults;
+			max_nid = nid;
+		}
+		p->numa_faults[nid] = faults / 2;
+	}
+	p->numa_preferred_nid = max_faults * 2 > total ? max_nid : -1;
+
+	if (p->numa_preferred_nid >= 0 &&
+	    p->numa_preferred_nid != numa_node_id())
+		sched_move_to_node(p->numa_preferred_nid);
+}
+
+/**
+ * task_numa_fault - account a NUMA hinting fault to current
+ * @page_nid: the node the page is on
+ * @this_nid: the node of the faulting cpu
+ * @private: whether the page is used by current alone
+ *
+ * Returns 1 if the page should be moved to @this_nid.
+ */
+int task_numa_fault(int page_nid, int this_nid, int private)
+{
+	struct task_struct *p = current;
+
+	count_vm_event(NUMA_HINT_FAULTS);
+	if (page_nid == this_nid) {
+		count_vm_event(NUMA_HINT_FAULTS_LOCAL);
+		p->numa_faults_local++;
+	} else
+		p->numa_faults_remote++;
+
+	if (!p->mm)
+		return 0;
+	if (private)
+		return page_nid != this_nid;
+
+	if (!p->numa_faults) {
+		p->numa_faults = kzalloc(sizeof(*p->numa_faults) *
+					 MAX_NUMNODES, GFP_KERNEL);
+		if (!p->numa_faults)
+			return 0;
+	}
+	p->numa_faults[page_nid]++;
+	task_numa_placement(p);
+	return 0;
+}
+
+/*
+ * knumad
+ */
+
+/* Only pages knumad may unmap, and a fault may move, are sampled */
+static int vma_numa_ok(struct vm_area_struct *vma)
+{
+	if (vma->vm_file || vma->vm_ops || !vma->anon_vma || vma_policy(vma))
+		return 0;
+	if (vma->vm_flags & (VM_SHARED | VM_HUGETLB | VM_PFNMAP | VM_IO))
+		return 0;
+	return !!(vma->vm_flags & (VM_READ | VM_WRITE | VM_EXEC));
+}
+
+static unsigned long numa_mark_pte_range(struct vm_area_struct *vma,
+		pmd_t *pmd, unsigned long addr, unsigned long end)
+{
+	struct mm_struct *mm = vma->vm_mm;
+	unsigned long updated = 0;
+	pte_t *pte, ptent;
+	spinlock_t *ptl;
+	struct page *page;
+
+	pte = pte_offset_map_lock(mm, pmd, addr, &ptl);
+	do {
+		ptent = *pte;
+		if (!pte_present(ptent) || pte_numa(ptent))
+			continue;
+		page = vm_normal_page(vma, addr, ptent);
+		if (!page || !PageAnon(page) || PageKsm(page))
+			continue;
+		/*
+		 * As in change_pte_range(): wipe the pte before setting the
+		 * new one, so that no dirty bit set by hardware meanwhile
+		 * is lost.
+		 */
+		ptent = ptep_get_and_clear(mm, addr, pte);
+		set_pte_at(mm, addr, pte, pte_mknuma(ptent));
+		updated++;
+	} while (pte++, addr += PAGE_SIZE, addr != end);
+	pte_unmap_unlock(pte - 1, ptl);
+	return updated;
+}
+
+/* Huge pmds and page tables shared with another mm are left alone */
+static unsigned long numa_mark_pmd_range(struct vm_area_struct *vma,
+		pud_t *pud, unsigned long addr, unsigned long end)
+{
+	unsigned long next, updated = 0;
+	pmd_t *pmd;
+
+	pmd = pmd_offset(pud, addr);
+	do {
+		next = pmd_addr_end(addr, end);
+		if (pmd_trans_huge(*pmd) || pmd_ptes_shared(*pmd))
+			continue;
+		if (pmd_none_or_clear_bad(pmd))
+			continue;
+		updated += numa_mark_pte_range(vma, pmd, addr, next);
+	} while (pmd++, addr = next, addr != end);
+	return updated;
+}
+
+static unsigned long numa_mark_pud_range(struct vm_area_struct *vma,
+		pgd_t *pgd, unsigned long addr, unsigned long end)
+{
+	unsigned long next, updated = 0;
+	pud_t *pud;
+
+	pud = pud_offset(pgd, addr);
+	do {
+		next = pud_addr_end(addr, end);
+		if (pud_none_or_clear_bad(pud))
+			continue;
+		updated += numa_mark_pmd_range(vma, pud, addr, next);
+	} while (pud++, addr = next, addr != end);
+	return updated;
+}
+
+/* Turn the anonymous ptes of [addr, end) into hinting ptes */
+static unsigned long numa_mark_range(struct vm_area_struct *vma,
+		unsigned long addr, unsigned long end)
+{
+	unsigned long start = addr, next, updated = 0;
+	pgd_t *pgd;
+
+	pgd = pgd_offset(vma->vm_mm, addr);
+	flush_cache_range(vma, addr, end);
+	do {
+		next = pgd_addr_end(addr, end);
+		if (pgd_none_or_clear_bad(pgd))
+			continue;
+		updated += numa_mark_pud_range(vma, pgd, addr, next);
+	} while (pgd++, addr = next, addr != end);
+	if (updated)
+		flush_tlb_range(vma, start, end);
+	return updated;
+}
+
+/*
+ * Mark the next scan_size_mb of @mm, carrying on from where the last
+ * call stopped.  Reaching the end of the address space completes a
+ * pass, which lets the mm's tasks reconsider where they run.
+ */
+static void knumad_scan_mm(struct mm_struct *mm)
+{
+	unsigned long pages, start, end;
+	unsigned long updated = 0;
+	struct vm_area_struct *vma;
+
+	pages = (unsigned long)sysctl_numa_balancing_scan_size_mb <<
+		(20 - PAGE_SHIFT);
+
+	down_read(&mm->mmap_sem);
+	start = mm->numa_scan_offset;
+	vma = find_vma(mm, start);
+	if (!vma) {
+		mm->numa_scan_seq++;
+		start = 0;
+		vma = mm->mmap;
+	}
+	for (; vma && pages; vma = vma->vm_next) {
+		if (!vma_numa_ok(vma))
+			continue;
+		start = max(start, vma->vm_start);
+		end = vma->vm_end;
+		if ((end - start) >> PAGE_SHIFT > pages)
+			end = start + (pages << PAGE_SHIFT);
+		pages -= (end - start) >> PAGE_SHIFT;
+		updated += numa_mark_range(vma, start, end);
+		start = end;
+		cond_resched();
+	}
+	mm->numa_scan_offset = start;
+	up_read(&mm->mmap_sem);
+
+	count_vm_events(NUMA_PTE_UPDATES, updated);
+}
+
+static int knumad_has_work(void)
+{
+	return sysctl_numa_balancing && !list_empty(&knumad_mms);
+}
+
+/*
+ * Visit each registered mm once.  Only knumad takes mms off the list,
+ * so the one after the mm being scanned stays put while the lock is
+ * dropped.
+ */
+static void knumad_do_scan(void)
+{
+	struct mm_struct *mm, *next;
+	int exited;
+
+	spin_lock(&knumad_lock);
+	if (list_empty(&knumad_mms)) {
+		spin_unlock(&knumad_lock);
+		return;
+	}
+	next = list_entry(knumad_mms.next, struct mm_struct, numa_link);
+	while ((mm = next) != NULL) {
+		if (mm->numa_link.next == &knumad_mms)
+			next = NULL;
+		else
+			next = list_entry(mm->numa_link.next,
+					  struct mm_struct, numa_link);
+		exited = !atomic_inc_not_zero(&mm->mm_users);
+		if (exited)
+			list_del_init(&mm->numa_link);
+		spin_unlock(&knumad_lock);
+
+		if (exited)
+			mmdrop(mm);
+		else {
+			knumad_scan_mm(mm);
+			mmput(mm);
+		}
+		if (kthread_should_stop() || !sysctl_numa_balancing)
+			return;
+		cond_resched();
+		spin_lock(&knumad_lock);
+	}
+	spin_unlock(&knumad_lock);
+}
+
+static int knumad(void *none)
+{
+	set_user_nice(current, 19);
+	while (!kthread_should_stop()) {
+		knumad_do_scan();
+		if (knumad_has_work())
+			wait_event_interruptible_timeout(knumad_wait,
+				kthread_should_stop(),
+				msecs_to_jiffies(
+					sysctl_numa_balancing_scan_period_ms));
+		else
+			wait_event_interruptible(knumad_wait,
+				kthread_should_stop() || knumad_has_work());
+		try_to_freeze();
+	}
+	return 0;
+}
+
+int numa_balancing_sysctl_handler(struct ctl_table *table, int write,
+		struct file *file, void __user *buffer, size_t *length,
+		loff_t *ppos)
+{
+	int err;
+
+	err = proc_dointvec_minmax(table, write, file, buffer, length, ppos);
+	if (!err && write)
+		wake_up_interruptible(&knumad_wait);
+	return err;
+}
+
+static int __init numa_balancing_init(void)
+{
+	struct task_struct *task;
+
+	if (num_online_nodes() > 1)
+		sysctl_numa_balancing = 1;
+
+	task = kthread_run(knumad, NULL, "knumad");
+	if (IS_ERR(task))
+		return PTR_ERR(task);
+	return 0;
+}
+module_init(numa_balancing_init)
@@ -48,7 +48,7 @@ unsigned long badness(struct task_struct *p, unsigned long uptime)
 {
 	unsigned long points, cpu_time, run_time, s;
 	struct mm_struct *mm;
-	struct task_struct *child;
+	struct task_struct *t, *child;
 
 	task_lock(p);
 	mm = p->mm;
@@ -58,9 +58,11 @@ unsigned long badness(struct task_struct *p, unsigned long uptime)
 	}
 
 	/*
-	 * The memory size of the process is the basis for the badness.
+	 * The memory the process has resident is the basis for the badness.
+	 * The rss counters are kept up to date by the fault and unmap paths,
+	 * so this costs no page table walk.
 	 */
-	points = mm->total_vm;
+	points = get_mm_rss(mm);
 
 	/*
 	 * After this unlock we can no longer dereference local variable `mm'
@@ -74,13 +76,18 @@ unsigned long badness(struct task_struct *p, unsigned long uptime)
 	 * machine with an endless amount of children. In case a single
 	 * child is eating the vast majority of memory, adding only half
 	 * to the parents will make the child our kill candidate of choice.
+	 * The thread group leader stands for the whole group, so it counts
+	 * the children of all the threads.
 	 */
-	list_for_each_entry(child, &p->children, sibling) {
-		task_lock(child);
-		if (child->mm != mm && child->mm)
-			points += child->mm->total_vm/2 + 1;
-		task_unlock(child);
-	}
+	t = p;
+	do {
+		list_for_each_entry(child, &t->children, sibling) {
+			task_lock(child);
+			if (child->mm != mm && child->mm)
+				points += get_mm_rss(child->mm)/2 + 1;
+			task_unlock(child);
+		}
+	} while (thread_group_leader(p) && (t = next_thread(t)) != p);
 
 	/*
 	 * CPU time is in tens of seconds and run time is in thousands
@@ -176,6 +183,8 @@ static inline int constrained_alloc(struct zonelist *zonelist, gfp_t gfp_mask)
 /*
  * Simple selection loop. We chose the process with the highest
  * number of 'points'. We expect the caller will lock the tasklist.
+ * All threads of a process share its memory, so only the thread group
+ * leader is scored, unless it has already exited.
  *
  * (not docbooked, we don't want this one cluttering up the manual)
  */
@@ -211,6 +220,8 @@ static struct task_struct *select_bad_process(unsigned long *ppoints)
 		if (p->flags & PF_SWAPOFF)
 			return p;
 
+		if (p != g && g->mm)
+			continue;
 		points = badness(p, uptime.tv_sec);
 		if (points > *ppoints || !chosen) {
 			chosen = p;
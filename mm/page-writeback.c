@@ -29,6 +29,7 @@
 #include <linux/sysctl.h>
 #include <linux/cpu.h>
 #include <linux/syscalls.h>
+#include <linux/task_io_accounting_ops.h>
 
 /*
  * The maximum number of pages to writeout in a single bdflush/kupdate
@@ -46,7 +47,6 @@
 static long ratelimit_pages = 32;
 
 static long total_pages;	/* The total number of pages in the machine. */
-static int dirty_exceeded __cacheline_aligned_in_smp;	/* Dirty mem may be over limit */
 
 /*
  * When balance_dirty_pages decides that the caller needs to perform some
@@ -62,7 +62,7 @@ static inline long sync_writeback_pages(void)
 /* The following parameters are exported via /proc/sys/vm */
 
 /*
- * Start background writeback (via pdflush) at this percentage
+ * Start background writeback (via the flusher threads) at this percentage
  */
 int dirty_background_ratio = 10;
 
@@ -97,7 +97,102 @@ EXPORT_SYMBOL(laptop_mode);
 /* End of sysctl-exported parameters */
 
 
-static void background_writeout(unsigned long _min_pages);
+/*
+ * The dirty limit is shared among the backing devices by how fast they
+ * write back: each gets the part of it that its share of the recently
+ * completed writeouts is.  "Recently" is a period of writeout_period_shift
+ * completions in the whole machine, at the end of which all the counts are
+ * halved.  The global count is halved right away, the count of a device is
+ * caught up the next time it is looked at.
+ */
+static atomic_long_t writeout_total = ATOMIC_LONG_INIT(0);
+static unsigned long writeout_period;	/* Periods elapsed */
+static int writeout_period_shift;
+static DEFINE_SPINLOCK(writeout_lock);
+
+/*
+ * The period is about four times the dirty limit: long enough to average
+ * over, short enough for a device to get its share quickly.
+ */
+static void update_writeout_period(void)
+{
+	unsigned long dirty_total = (vm_dirty_ratio * total_pages) / 100;
+
+	writeout_period_shift = 1 + fls_long(dirty_total | 1);
+}
+
+/*
+ * Age the writeout count of the device by the periods it missed.
+ */
+static void bdi_writeout_age(struct backing_dev_info *bdi)
+{
+	unsigned long period = writeout_period;
+	unsigned long flags;
+
+	if (likely(bdi->writeout_period == period))
+		return;
+
+	spin_lock_irqsave(&writeout_lock, flags);
+	period = writeout_period;
+	if (bdi->writeout_period != period) {
+		unsigned long missed = period - bdi->writeout_period;
+		long count = atomic_long_read(&bdi->writeout);
+
+		if (missed < BITS_PER_LONG)
+			count -= count >> missed;
+		atomic_long_sub(count, &bdi->writeout);
+		bdi->writeout_period = period;
+	}
+	spin_unlock_irqrestore(&writeout_lock, flags);
+}
+
+/*
+ * A page of the device finished writeout.
+ */
+static void bdi_writeout_inc(struct backing_dev_info *bdi)
+{
+	unsigned long flags;
+	long total;
+
+	bdi_writeout_age(bdi);
+	atomic_long_inc(&bdi->writeout);
+	atomic_long_inc(&writeout_total);
+
+	if (likely(atomic_long_read(&writeout_total) <=
+					1L << writeout_period_shift))
+		return;
+
+	spin_lock_irqsave(&writeout_lock, flags);
+	total = atomic_long_read(&writeout_total);
+	if (total > 1L << writeout_period_shift) {
+		atomic_long_sub(total / 2, &writeout_total);
+		writeout_period++;
+	}
+	spin_unlock_irqrestore(&writeout_lock, flags);
+}
+
+/*
+ * The part of @dirty which belongs to @bdi.  Until writeouts have been
+ * seen at all, every device may use all of it.
+ */
+static long bdi_dirty_limit(struct backing_dev_info *bdi, long dirty)
+{
+	long numerator;
+	long denominator;
+
+	bdi_writeout_age(bdi);
+	numerator = atomic_long_read(&bdi->writeout);
+	denominator = atomic_long_read(&writeout_total);
+
+	if (denominator <= 0)
+		return dirty;
+	if (numerator > denominator)
+		numerator = denominator;
+	if (numerator < 0)
+		numerator = 0;
+
+	return (u64)dirty * numerator / denominator;
+}
 
 /*
  * Work out the current dirty-memory clamping and background writeout
@@ -115,9 +210,14 @@ static void background_writeout(unsigned long _min_pages);
  *
  * We make sure that the background writeout level is below the adjusted
  * clamping level.
+ *
+ * If pbdi_dirty is given, it is set to the part of the clamping level
+ * which belongs to the backing device of the mapping: see bdi_dirty_limit().
+ * It never leaves the device more than the dirty memory which is still
+ * available, so that all the devices together stay below the global level.
  */
 static void
-get_dirty_limits(long *pbackground, long *pdirty,
+get_dirty_limits(long *pbackground, long *pdirty, long *pbdi_dirty,
 					struct address_space *mapping)
 {
 	int background_ratio;		/* Percentages */
@@ -162,20 +262,42 @@ get_dirty_limits(long *pbackground, long *pdirty,
 	}
 	*pbackground = background;
 	*pdirty = dirty;
+
+	if (pbdi_dirty) {
+		struct backing_dev_info *bdi = mapping->backing_dev_info;
+		long bdi_dirty;
+		long avail_dirty;
+
+		bdi_dirty = bdi_dirty_limit(bdi, dirty);
+
+		avail_dirty = dirty -
+			(global_page_state(NR_FILE_DIRTY) +
+			 global_page_state(NR_WRITEBACK) +
+			 global_page_state(NR_UNSTABLE_NFS));
+		if (avail_dirty < 0)
+			avail_dirty = 0;
+		avail_dirty += bdi_stat(bdi, BDI_RECLAIMABLE) +
+			bdi_stat(bdi, BDI_WRITEBACK);
+
+		*pbdi_dirty = min(bdi_dirty, avail_dirty);
+	}
 }
 
 /*
  * balance_dirty_pages() must be called by processes which are generating dirty
- * data.  It looks at the number of dirty pages in the machine and will force
- * the caller to perform writeback if the system is over `vm_dirty_ratio'.
- * If we're over `background_thresh' then pdflush is woken to perform some
- * writeout.
+ * data.  It looks at the number of dirty pages of the backing device and will
+ * force the caller to perform writeback if the device is over its share of
+ * `vm_dirty_ratio'.  If the machine is over `background_thresh' then the
+ * flusher thread of the device is woken to perform some writeout.
  */
 static void balance_dirty_pages(struct address_space *mapping)
 {
 	long nr_reclaimable;
+	long bdi_nr_reclaimable;
+	long bdi_nr_writeback;
 	long background_thresh;
 	long dirty_thresh;
+	long bdi_thresh;
 	unsigned long pages_written = 0;
 	unsigned long write_chunk = sync_writeback_pages();
 
@@ -190,15 +312,17 @@ static void balance_dirty_pages(struct address_space *mapping)
 			.range_cyclic	= 1,
 		};
 
-		get_dirty_limits(&background_thresh, &dirty_thresh, mapping);
+		get_dirty_limits(&background_thresh, &dirty_thresh,
+				&bdi_thresh, mapping);
 		nr_reclaimable = global_page_state(NR_FILE_DIRTY) +
 					global_page_state(NR_UNSTABLE_NFS);
-		if (nr_reclaimable + global_page_state(NR_WRITEBACK) <=
-			dirty_thresh)
-				break;
+		bdi_nr_reclaimable = bdi_stat(bdi, BDI_RECLAIMABLE);
+		bdi_nr_writeback = bdi_stat(bdi, BDI_WRITEBACK);
+		if (bdi_nr_reclaimable + bdi_nr_writeback <= bdi_thresh)
+			break;
 
-		if (!dirty_exceeded)
-			dirty_exceeded = 1;
+		if (!bdi->dirty_exceeded)
+			bdi->dirty_exceeded = 1;
 
 		/* Note: nr_reclaimable denotes nr_dirty + nr_unstable.
 		 * Unstable writes are a feature of certain networked
@@ -206,29 +330,28 @@ static void balance_dirty_pages(struct address_space *mapping)
 		 * written to the server's write cache, but has not yet
 		 * been flushed to permanent storage.
 		 */
-		if (nr_reclaimable) {
+		if (bdi_nr_reclaimable) {
 			writeback_inodes(&wbc);
-			get_dirty_limits(&background_thresh,
-					 	&dirty_thresh, mapping);
-			nr_reclaimable = global_page_state(NR_FILE_DIRTY) +
-					global_page_state(NR_UNSTABLE_NFS);
-			if (nr_reclaimable +
-				global_page_state(NR_WRITEBACK)
-					<= dirty_thresh)
-						break;
 			pages_written += write_chunk - wbc.nr_to_write;
+			get_dirty_limits(&background_thresh, &dirty_thresh,
+				       &bdi_thresh, mapping);
+			bdi_nr_reclaimable = bdi_stat(bdi, BDI_RECLAIMABLE);
+			bdi_nr_writeback = bdi_stat(bdi, BDI_WRITEBACK);
+			if (bdi_nr_reclaimable + bdi_nr_writeback <=
+							bdi_thresh)
+				break;
 			if (pages_written >= write_chunk)
 				break;		/* We've done our duty */
 		}
 		blk_congestion_wait(WRITE, HZ/10);
 	}
 
-	if (nr_reclaimable + global_page_state(NR_WRITEBACK)
-		<= dirty_thresh && dirty_exceeded)
-			dirty_exceeded = 0;
+	if (bdi_nr_reclaimable + bdi_nr_writeback < bdi_thresh &&
+			bdi->dirty_exceeded)
+		bdi->dirty_exceeded = 0;
 
 	if (writeback_in_progress(bdi))
-		return;		/* pdflush is already working this queue */
+		return;		/* a flusher is already working this queue */
 
 	/*
 	 * In laptop mode, we wait until hitting the higher threshold before
@@ -240,7 +363,7 @@ static void balance_dirty_pages(struct address_space *mapping)
 	 */
 	if ((laptop_mode && pages_written) ||
 	     (!laptop_mode && (nr_reclaimable > background_thresh)))
-		pdflush_operation(background_writeout, 0);
+		bdi_start_writeback(bdi, 0);
 }
 
 /**
@@ -265,7 +388,7 @@ void balance_dirty_pages_ratelimited_nr(struct address_space *mapping,
 	unsigned long *p;
 
 	ratelimit = ratelimit_pages;
-	if (dirty_exceeded)
+	if (mapping->backing_dev_info->dirty_exceeded)
 		ratelimit = 8;
 
 	/*
@@ -291,7 +414,8 @@ void throttle_vm_writeout(void)
 	long dirty_thresh;
 
         for ( ; ; ) {
-		get_dirty_limits(&background_thresh, &dirty_thresh, NULL);
+		get_dirty_limits(&background_thresh, &dirty_thresh,
+				NULL, NULL);
 
                 /*
                  * Boost the allowable dirty threshold a bit for page
@@ -308,29 +432,45 @@ void throttle_vm_writeout(void)
 
 
 /*
- * writeback at least _min_pages, and keep writing until the amount of dirty
- * memory is less than the background threshold, or until we're all clean.
+ * Is there background writeout to do for @bdi: is the machine over the
+ * background threshold, and the device over its part of it?  A NULL @bdi
+ * stands for all of the devices.
  */
-static void background_writeout(unsigned long _min_pages)
+static int over_bground_thresh(struct backing_dev_info *bdi)
+{
+	long background_thresh;
+	long dirty_thresh;
+
+	get_dirty_limits(&background_thresh, &dirty_thresh, NULL, NULL);
+	if (global_page_state(NR_FILE_DIRTY) +
+		global_page_state(NR_UNSTABLE_NFS) < background_thresh)
+		return 0;
+	if (!bdi)
+		return 1;
+	return bdi_stat(bdi, BDI_RECLAIMABLE) >
+			bdi_dirty_limit(bdi, background_thresh);
+}
+
+/*
+ * writeback at least min_pages of @bdi, and keep writing until the amount of
+ * dirty memory is less than the background threshold, or until we're all
+ * clean.  This is run by the flusher thread of @bdi, which can wait on its
+ * own queue.  A NULL @bdi writes back any device, without waiting on a
+ * congested one.
+ */
+void background_writeout(struct backing_dev_info *bdi, long min_pages)
 {
-	long min_pages = _min_pages;
 	struct writeback_control wbc = {
-		.bdi		= NULL,
+		.bdi		= bdi,
 		.sync_mode	= WB_SYNC_NONE,
 		.older_than_this = NULL,
 		.nr_to_write	= 0,
-		.nonblocking	= 1,
+		.nonblocking	= !bdi,
 		.range_cyclic	= 1,
 	};
 
 	for ( ; ; ) {
-		long background_thresh;
-		long dirty_thresh;
-
-		get_dirty_limits(&background_thresh, &dirty_thresh, NULL);
-		if (global_page_state(NR_FILE_DIRTY) +
-			global_page_state(NR_UNSTABLE_NFS) < background_thresh
-				&& min_pages <= 0)
+		if (!over_bground_thresh(bdi) && min_pages <= 0)
 			break;
 		wbc.encountered_congestion = 0;
 		wbc.nr_to_write = MAX_WRITEBACK_PAGES;
@@ -346,23 +486,8 @@ static void background_writeout(unsigned long _min_pages)
 	}
 }
 
-/*
- * Start writeback of `nr_pages' pages.  If `nr_pages' is zero, write back
- * the whole world.  Returns 0 if a pdflush thread was dispatched.  Returns
- * -1 if all pdflush threads were busy.
- */
-int wakeup_pdflush(long nr_pages)
-{
-	if (nr_pages == 0)
-		nr_pages = global_page_state(NR_FILE_DIRTY) +
-				global_page_state(NR_UNSTABLE_NFS);
-	return pdflush_operation(background_writeout, nr_pages);
-}
-
-static void wb_timer_fn(unsigned long unused);
 static void laptop_timer_fn(unsigned long unused);
 
-static DEFINE_TIMER(wb_timer, wb_timer_fn, 0, 0);
 static DEFINE_TIMER(laptop_mode_wb_timer, laptop_timer_fn, 0, 0);
 
 /*
@@ -373,21 +498,23 @@ static DEFINE_TIMER(laptop_mode_wb_timer, laptop_timer_fn, 0, 0);
  * just walks the superblock inode list, writing back any inodes which are
  * older than a specific point in time.
  *
- * Try to run once per dirty_writeback_interval.  But if a writeback event
- * takes longer than a dirty_writeback_interval interval, then leave a
- * one-second gap.
+ * Every flusher thread runs this for its own device once per
+ * dirty_writeback_interval, the one of default_backing_dev_info also writes
+ * the superblocks.  But if a writeback event takes longer than a
+ * dirty_writeback_interval interval, then leave a one-second gap: the time
+ * of the next run is returned.
  *
  * older_than_this takes precedence over nr_to_write.  So we'll only write back
  * all dirty pages if they are all attached to "old" mappings.
  */
-static void wb_kupdate(unsigned long arg)
+unsigned long wb_kupdate(struct backing_dev_info *bdi)
 {
 	unsigned long oldest_jif;
 	unsigned long start_jif;
 	unsigned long next_jif;
 	long nr_to_write;
 	struct writeback_control wbc = {
-		.bdi		= NULL,
+		.bdi		= bdi,
 		.sync_mode	= WB_SYNC_NONE,
 		.older_than_this = &oldest_jif,
 		.nr_to_write	= 0,
@@ -396,13 +523,13 @@ static void wb_kupdate(unsigned long arg)
 		.range_cyclic	= 1,
 	};
 
-	sync_supers();
+	if (bdi == &default_backing_dev_info)
+		sync_supers();
 
 	oldest_jif = jiffies - dirty_expire_interval;
 	start_jif = jiffies;
 	next_jif = start_jif + dirty_writeback_interval;
-	nr_to_write = global_page_state(NR_FILE_DIRTY) +
-			global_page_state(NR_UNSTABLE_NFS) +
+	nr_to_write = bdi_stat(bdi, BDI_RECLAIMABLE) +
 			(inodes_stat.nr_inodes - inodes_stat.nr_unused);
 	while (nr_to_write > 0) {
 		wbc.encountered_congestion = 0;
@@ -418,8 +545,7 @@ static void wb_kupdate(unsigned long arg)
 	}
 	if (time_before(next_jif, jiffies + HZ))
 		next_jif = jiffies + HZ;
-	if (dirty_writeback_interval)
-		mod_timer(&wb_timer, next_jif);
+	return next_jif;
 }
 
 /*
@@ -429,19 +555,24 @@ int dirty_writeback_centisecs_handler(ctl_table *table, int write,
 		struct file *file, void __user *buffer, size_t *length, loff_t *ppos)
 {
 	proc_dointvec_userhz_jiffies(table, write, file, buffer, length, ppos);
-	if (dirty_writeback_interval) {
-		mod_timer(&wb_timer,
-			jiffies + dirty_writeback_interval);
-		} else {
-		del_timer(&wb_timer);
-	}
+	/* let the flusher threads pick up the new interval */
+	if (write)
+		bdi_wakeup_all();
 	return 0;
 }
 
-static void wb_timer_fn(unsigned long unused)
+/*
+ * sysctl handler for /proc/sys/vm/dirty_ratio
+ */
+int dirty_ratio_handler(ctl_table *table, int write,
+		struct file *file, void __user *buffer, size_t *length, loff_t *ppos)
 {
-	if (pdflush_operation(wb_kupdate, 0) < 0)
-		mod_timer(&wb_timer, jiffies + HZ); /* delay 1 second */
+	int ret;
+
+	ret = proc_dointvec_minmax(table, write, file, buffer, length, ppos);
+	if (ret == 0 && write)
+		update_writeout_period();
+	return ret;
 }
 
 static void laptop_flush(unsigned long unused)
@@ -537,22 +668,25 @@ void __init page_writeback_init(void)
 		if (vm_dirty_ratio <= 0)
 			vm_dirty_ratio = 1;
 	}
-	mod_timer(&wb_timer, jiffies + dirty_writeback_interval);
+	update_writeout_period();
 	set_ratelimit();
 	register_cpu_notifier(&ratelimit_nb);
 }
 
 int do_writepages(struct address_space *mapping, struct writeback_control *wbc)
 {
+	struct blk_plug plug;
 	int ret;
 
 	if (wbc->nr_to_write <= 0)
 		return 0;
 	wbc->for_writepages = 1;
+	blk_start_plug(&plug);
 	if (mapping->a_ops->writepages)
 		ret =  mapping->a_ops->writepages(mapping, wbc);
 	else
 		ret = generic_writepages(mapping, wbc);
+	blk_finish_plug(&plug);
 	wbc->for_writepages = 0;
 	return ret;
 }
@@ -623,9 +757,13 @@ int __set_page_dirty_nobuffers(struct page *page)
 			mapping2 = page_mapping(page);
 			if (mapping2) { /* Race with truncate? */
 				BUG_ON(mapping2 != mapping);
-				if (mapping_cap_account_dirty(mapping))
+				if (mapping_cap_account_dirty(mapping)) {
 					__inc_zone_page_state(page,
 								NR_FILE_DIRTY);
+					inc_bdi_stat(mapping->backing_dev_info,
+							BDI_RECLAIMABLE);
+					task_io_account_write(PAGE_CACHE_SIZE);
+				}
 				radix_tree_tag_set(&mapping->page_tree,
 					page_index(page), PAGECACHE_TAG_DIRTY);
 			}
@@ -712,8 +850,11 @@ int test_clear_page_dirty(struct page *page)
 			radix_tree_tag_clear(&mapping->page_tree,
 						page_index(page),
 						PAGECACHE_TAG_DIRTY);
-			if (mapping_cap_account_dirty(mapping))
+			if (mapping_cap_account_dirty(mapping)) {
 				__dec_zone_page_state(page, NR_FILE_DIRTY);
+				dec_bdi_stat(mapping->backing_dev_info,
+						BDI_RECLAIMABLE);
+			}
 			write_unlock_irqrestore(&mapping->tree_lock, flags);
 			return 1;
 		}
@@ -744,8 +885,11 @@ int clear_page_dirty_for_io(struct page *page)
 
 	if (mapping) {
 		if (TestClearPageDirty(page)) {
-			if (mapping_cap_account_dirty(mapping))
+			if (mapping_cap_account_dirty(mapping)) {
 				dec_zone_page_state(page, NR_FILE_DIRTY);
+				dec_bdi_stat(mapping->backing_dev_info,
+						BDI_RECLAIMABLE);
+			}
 			return 1;
 		}
 		return 0;
@@ -764,10 +908,18 @@ int test_clear_page_writeback(struct page *page)
 
 		write_lock_irqsave(&mapping->tree_lock, flags);
 		ret = TestClearPageWriteback(page);
-		if (ret)
+		if (ret) {
 			radix_tree_tag_clear(&mapping->page_tree,
 						page_index(page),
 						PAGECACHE_TAG_WRITEBACK);
+			if (mapping_cap_account_dirty(mapping)) {
+				struct backing_dev_info *bdi =
+					mapping->backing_dev_info;
+
+				dec_bdi_stat(bdi, BDI_WRITEBACK);
+				bdi_writeout_inc(bdi);
+			}
+		}
 		write_unlock_irqrestore(&mapping->tree_lock, flags);
 	} else {
 		ret = TestClearPageWriteback(page);
@@ -785,10 +937,14 @@ int test_set_page_writeback(struct page *page)
 
 		write_lock_irqsave(&mapping->tree_lock, flags);
 		ret = TestSetPageWriteback(page);
-		if (!ret)
+		if (!ret) {
 			radix_tree_tag_set(&mapping->page_tree,
 						page_index(page),
 						PAGECACHE_TAG_WRITEBACK);
+			if (mapping_cap_account_dirty(mapping))
+				inc_bdi_stat(mapping->backing_dev_info,
+						BDI_WRITEBACK);
+		}
 		if (!PageDirty(page))
 			radix_tree_tag_clear(&mapping->page_tree,
 						page_index(page),
@@ -808,12 +964,11 @@ EXPORT_SYMBOL(test_set_page_writeback);
  */
 int mapping_tagged(struct address_space *mapping, int tag)
 {
-	unsigned long flags;
 	int ret;
 
-	read_lock_irqsave(&mapping->tree_lock, flags);
+	rcu_read_lock();
 	ret = radix_tree_tagged(&mapping->page_tree, tag);
-	read_unlock_irqrestore(&mapping->tree_lock, flags);
+	rcu_read_unlock();
 	return ret;
 }
 EXPORT_SYMBOL(mapping_tagged);
@@ -37,6 +37,8 @@
 #include <linux/vmalloc.h>
 #include <linux/mempolicy.h>
 #include <linux/stop_machine.h>
+#include <linux/compaction.h>
+#include <linux/trace_events.h>
 
 #include <asm/tlbflush.h>
 #include <asm/div64.h>
@@ -55,9 +57,13 @@ unsigned long totalhigh_pages __read_mostly;
 unsigned long totalreserve_pages __read_mostly;
 long nr_swap_pages;
 int percpu_pagelist_fraction;
+int page_group_by_mobility_disabled __read_mostly;
 
 static void __free_pages_ok(struct page *page, unsigned int order);
 
+DEFINE_TRACE(mm_page_alloc);
+DEFINE_TRACE(mm_page_free);
+
 /*
  * results with 256, 32 in the lowmem_reserve sysctl:
  *	1G machine -> (16M dma, 800M-16M normal, 1G-800M high)
@@ -86,6 +92,53 @@ int min_free_kbytes = 1024;
 unsigned long __meminitdata nr_kernel_pages;
 unsigned long __meminitdata nr_all_pages;
 
+/*
+ * The pageblock map of a zone holds PB_MIGRATETYPE_BITS per pageblock.
+ * Returns the bit index of the block of pfn, or -1 when the block is
+ * not covered by the map: memory hot-added to a zone which already had
+ * some was not there when the map was sized, and just counts as
+ * unmovable.
+ */
+static inline long pfn_to_bitidx(struct zone *zone, unsigned long pfn)
+{
+	unsigned long block = (pfn - zone->pageblock_start_pfn) >> pageblock_order;
+
+	if (unlikely(pfn < zone->pageblock_start_pfn ||
+		     block >= zone->nr_pageblocks))
+		return -1;
+	return block * PB_MIGRATETYPE_BITS;
+}
+
+int get_pageblock_migratetype(struct page *page)
+{
+	struct zone *zone = page_zone(page);
+	long bitidx = pfn_to_bitidx(zone, page_to_pfn(page));
+
+	if (bitidx < 0)
+		return MIGRATE_UNMOVABLE;
+	return (zone->pageblock_flags[bitidx / BITS_PER_LONG] >>
+			(bitidx % BITS_PER_LONG)) &
+		((1UL << PB_MIGRATETYPE_BITS) - 1);
+}
+
+/*
+ * Changes are serialized by zone->lock (or happen while the zone is set
+ * up); readers outside of it may see the old type, which only costs a
+ * page on the wrong free list.
+ */
+static void set_pageblock_migratetype(struct page *page, int migratetype)
+{
+	struct zone *zone = page_zone(page);
+	long bitidx = pfn_to_bitidx(zone, page_to_pfn(page));
+	unsigned long *word;
+
+	if (bitidx < 0)
+		return;
+	word = &zone->pageblock_flags[bitidx / BITS_PER_LONG];
+	*word &= ~(((1UL << PB_MIGRATETYPE_BITS) - 1) << (bitidx % BITS_PER_LONG));
+	*word |= (unsigned long)migratetype << (bitidx % BITS_PER_LONG);
+}
+
 #ifdef CONFIG_DEBUG_VM
 static int page_outside_zone_boundaries(struct zone *zone, struct page *page)
 {
@@ -233,11 +286,6 @@ static inline void prep_zero_page(struct page *page, int order, gfp_t gfp_flags)
  * zone->lock is already acquired when we use these.
  * So, we don't need atomic page->flags operations here.
  */
-static inline unsigned long page_order(struct page *page)
-{
-	return page_private(page);
-}
-
 static inline void set_page_order(struct page *page, int order)
 {
 	set_page_private(page, order);
@@ -341,6 +389,7 @@ static inline void __free_one_page(struct page *page,
 {
 	unsigned long page_idx;
 	int order_size = 1 << order;
+	int migratetype = get_pageblock_migratetype(page);
 
 	if (unlikely(PageCompound(page)))
 		destroy_compound_page(page, order);
@@ -370,7 +419,7 @@ static inline void __free_one_page(struct page *page,
 		order++;
 	}
 	set_page_order(page, order);
-	list_add(&page->lru, &zone->free_area[order].free_list);
+	list_add(&page->lru, &zone->free_area[order].free_list[migratetype]);
 	zone->free_area[order].nr_free++;
 }
 
@@ -402,9 +451,9 @@ static inline int free_pages_check(struct page *page)
 }
 
 /*
- * Frees a list of pages. 
- * Assumes all pages on list are in same zone, and of same order.
- * count is the number of pages to free.
+ * Frees a number of pages from the per cpu lists of a zone.
+ * count is the number of pages to free, the oldest pages of the lists
+ * of the migrate types are taken in turn.
  *
  * If the zone was previously in an "all pages pinned" state then look to
  * see if this freeing clears that state.
@@ -412,29 +461,40 @@ static inline int free_pages_check(struct page *page)
  * And clear the zone's pages_scanned counter, to hold off the "all pages are
  * pinned" detection logic.
  */
-static void free_pages_bulk(struct zone *zone, int count,
-					struct list_head *list, int order)
+static void free_pcppages_bulk(struct zone *zone, int count,
+					struct per_cpu_pages *pcp)
 {
+	int migratetype = 0;
+
+	BUG_ON(count > pcp->count);
 	spin_lock(&zone->lock);
 	zone->all_unreclaimable = 0;
 	zone->pages_scanned = 0;
 	while (count--) {
+		struct list_head *list;
 		struct page *page;
 
-		BUG_ON(list_empty(list));
+		do {
+			if (++migratetype == MIGRATE_TYPES)
+				migratetype = 0;
+			list = &pcp->lists[migratetype];
+		} while (list_empty(list));
+
 		page = list_entry(list->prev, struct page, lru);
 		/* have to delete it as __free_one_page list manipulates */
 		list_del(&page->lru);
-		__free_one_page(page, zone, order);
+		__free_one_page(page, zone, 0);
 	}
 	spin_unlock(&zone->lock);
 }
 
 static void free_one_page(struct zone *zone, struct page *page, int order)
 {
-	LIST_HEAD(list);
-	list_add(&page->lru, &list);
-	free_pages_bulk(zone, 1, &list, order);
+	spin_lock(&zone->lock);
+	zone->all_unreclaimable = 0;
+	zone->pages_scanned = 0;
+	__free_one_page(page, zone, order);
+	spin_unlock(&zone->lock);
 }
 
 static void __free_pages_ok(struct page *page, unsigned int order)
@@ -443,11 +503,17 @@ static void __free_pages_ok(struct page *page, unsigned int order)
 	int i;
 	int reserved = 0;
 
+	trace_mm_page_free(page, order);
+
 	arch_free_page(page, order);
 	if (!PageHighMem(page))
 		debug_check_no_locks_freed(page_address(page),
 					   PAGE_SIZE<<order);
 
+	/* a transparent huge page freed unsplit is still anonymous */
+	if (PageAnon(page))
+		page->mapping = NULL;
+
 	for (i = 0 ; i < (1 << order) ; ++i)
 		reserved += free_pages_check(page + i);
 	if (reserved)
@@ -504,7 +570,7 @@ void fastcall __init __free_pages_bootmem(struct page *page, unsigned int order)
  * -- wli
  */
 static inline void expand(struct zone *zone, struct page *page,
- 	int low, int high, struct free_area *area)
+	int low, int high, struct free_area *area, int migratetype)
 {
 	unsigned long size = 1 << high;
 
@@ -513,7 +579,7 @@ static inline void expand(struct zone *zone, struct page *page,
 		high--;
 		size >>= 1;
 		BUG_ON(bad_range(zone, &page[size]));
-		list_add(&page[size].lru, &area->free_list);
+		list_add(&page[size].lru, &area->free_list[migratetype]);
 		area->nr_free++;
 		set_page_order(&page[size], high);
 	}
@@ -550,7 +616,8 @@ static int prep_new_page(struct page *page, int order, gfp_t gfp_flags)
 
 	page->flags &= ~(1 << PG_uptodate | 1 << PG_error |
 			1 << PG_referenced | 1 << PG_arch_1 |
-			1 << PG_checked | 1 << PG_mappedtodisk);
+			1 << PG_checked | 1 << PG_mappedtodisk |
+			1 << PG_swapbacked | 1 << PG_readahead);
 	set_page_private(page, 0);
 	set_page_refcounted(page);
 	kernel_map_pages(page, 1 << order, 1);
@@ -564,11 +631,12 @@ static int prep_new_page(struct page *page, int order, gfp_t gfp_flags)
 	return 0;
 }
 
-/* 
- * Do the hard work of removing an element from the buddy allocator.
- * Call me with the zone->lock already held.
+/*
+ * Go through the free lists of the given migratetype and remove
+ * the smallest available page from the freelists
  */
-static struct page *__rmqueue(struct zone *zone, unsigned int order)
+static struct page *__rmqueue_smallest(struct zone *zone, unsigned int order,
+						int migratetype)
 {
 	struct free_area * area;
 	unsigned int current_order;
@@ -576,34 +644,166 @@ static struct page *__rmqueue(struct zone *zone, unsigned int order)
 
 	for (current_order = order; current_order < MAX_ORDER; ++current_order) {
 		area = zone->free_area + current_order;
-		if (list_empty(&area->free_list))
+		if (list_empty(&area->free_list[migratetype]))
 			continue;
 
-		page = list_entry(area->free_list.next, struct page, lru);
+		page = list_entry(area->free_list[migratetype].next,
+							struct page, lru);
 		list_del(&page->lru);
 		rmv_page_order(page);
 		area->nr_free--;
 		zone->free_pages -= 1UL << order;
-		expand(zone, page, order, current_order, area);
+		expand(zone, page, order, current_order, area, migratetype);
 		return page;
 	}
 
 	return NULL;
 }
 
+/*
+ * This array describes the order lists are fallen back to when
+ * the free lists for the desirable migrate type are depleted
+ */
+static int fallbacks[MIGRATE_TYPES][MIGRATE_TYPES-1] = {
+	[MIGRATE_UNMOVABLE]   = { MIGRATE_RECLAIMABLE, MIGRATE_MOVABLE   },
+	[MIGRATE_RECLAIMABLE] = { MIGRATE_UNMOVABLE,   MIGRATE_MOVABLE   },
+	[MIGRATE_MOVABLE]     = { MIGRATE_RECLAIMABLE, MIGRATE_UNMOVABLE },
+};
+
+/*
+ * Move the free pages in a pageblock to the free lists of the requested
+ * type, clipped to the zone. Returns the number of pages moved.
+ */
+static int move_freepages_block(struct zone *zone, struct page *page,
+				int migratetype)
+{
+	unsigned long start_pfn, end_pfn, pfn;
+	int pages_moved = 0;
+
+	start_pfn = page_to_pfn(page) & ~(pageblock_nr_pages - 1);
+	end_pfn = start_pfn + pageblock_nr_pages;
+	if (start_pfn < zone->zone_start_pfn)
+		start_pfn = zone->zone_start_pfn;
+	if (end_pfn > zone->zone_start_pfn + zone->spanned_pages)
+		end_pfn = zone->zone_start_pfn + zone->spanned_pages;
+
+	for (pfn = start_pfn; pfn < end_pfn;) {
+		unsigned long order;
+
+		if (!pfn_valid_within(pfn)) {
+			pfn++;
+			continue;
+		}
+
+		page = pfn_to_page(pfn);
+		if (!PageBuddy(page)) {
+			pfn++;
+			continue;
+		}
+
+		order = page_order(page);
+		list_del(&page->lru);
+		list_add(&page->lru,
+			&zone->free_area[order].free_list[migratetype]);
+		pfn += 1 << order;
+		pages_moved += 1 << order;
+	}
+
+	return pages_moved;
+}
+
+/*
+ * Remove an element from the buddy allocator from the fallback list.
+ * The largest free block is taken, so that the steal hits as few
+ * pageblocks of the other types as possible; when it is big, the other
+ * free pages of its block come along and, if they make up half of the
+ * block, the block changes type.
+ */
+static struct page *__rmqueue_fallback(struct zone *zone, int order,
+						int start_migratetype)
+{
+	struct free_area * area;
+	int current_order;
+	struct page *page;
+	int migratetype, i;
+
+	for (current_order = MAX_ORDER-1; current_order >= order;
+						--current_order) {
+		for (i = 0; i < MIGRATE_TYPES - 1; i++) {
+			migratetype = fallbacks[start_migratetype][i];
+
+			area = &(zone->free_area[current_order]);
+			if (list_empty(&area->free_list[migratetype]))
+				continue;
+
+			page = list_entry(area->free_list[migratetype].next,
+					struct page, lru);
+			area->nr_free--;
+
+			/*
+			 * Reclaimable allocations are taken to be short lived
+			 * enough to be worth the whole block every time.
+			 */
+			if (unlikely(current_order >= pageblock_order / 2) ||
+			    start_migratetype == MIGRATE_RECLAIMABLE) {
+				int pages;
+
+				pages = move_freepages_block(zone, page,
+							start_migratetype);
+				if (pages >= (1 << (pageblock_order-1)))
+					set_pageblock_migratetype(page,
+							start_migratetype);
+				migratetype = start_migratetype;
+			}
+
+			/* Remove the page from the freelists */
+			list_del(&page->lru);
+			rmv_page_order(page);
+			zone->free_pages -= 1UL << order;
+
+			if (current_order == pageblock_order)
+				set_pageblock_migratetype(page,
+							start_migratetype);
+
+			expand(zone, page, order, current_order, area,
+							migratetype);
+			return page;
+		}
+	}
+
+	return NULL;
+}
+
+/* 
+ * Do the hard work of removing an element from the buddy allocator.
+ * Call me with the zone->lock already held.
+ */
+static struct page *__rmqueue(struct zone *zone, unsigned int order,
+						int migratetype)
+{
+	struct page *page;
+
+	page = __rmqueue_smallest(zone, order, migratetype);
+	if (unlikely(!page))
+		page = __rmqueue_fallback(zone, order, migratetype);
+
+	return page;
+}
+
 /* 
  * Obtain a specified number of elements from the buddy allocator, all under
  * a single hold of the lock, for efficiency.  Add them to the supplied list.
  * Returns the number of new pages which were placed at *list.
  */
 static int rmqueue_bulk(struct zone *zone, unsigned int order, 
-			unsigned long count, struct list_head *list)
+			unsigned long count, struct list_head *list,
+			int migratetype)
 {
 	int i;
 	
 	spin_lock(&zone->lock);
 	for (i = 0; i < count; ++i) {
-		struct page *page = __rmqueue(zone, order);
+		struct page *page = __rmqueue(zone, order, migratetype);
 		if (unlikely(page == NULL))
 			break;
 		list_add_tail(&page->lru, list);
@@ -635,7 +835,7 @@ void drain_node_pages(int nodeid)
 			pcp = &pset->pcp[i];
 			if (pcp->count) {
 				local_irq_save(flags);
-				free_pages_bulk(zone, pcp->count, &pcp->list, 0);
+				free_pcppages_bulk(zone, pcp->count, pcp);
 				pcp->count = 0;
 				local_irq_restore(flags);
 			}
@@ -660,7 +860,7 @@ static void __drain_pages(unsigned int cpu)
 
 			pcp = &pset->pcp[i];
 			local_irq_save(flags);
-			free_pages_bulk(zone, pcp->count, &pcp->list, 0);
+			free_pcppages_bulk(zone, pcp->count, pcp);
 			pcp->count = 0;
 			local_irq_restore(flags);
 		}
@@ -673,7 +873,7 @@ static void __drain_pages(unsigned int cpu)
 void mark_free_pages(struct zone *zone)
 {
 	unsigned long zone_pfn, flags;
-	int order;
+	int order, t;
 	struct list_head *curr;
 
 	if (!zone->spanned_pages)
@@ -683,8 +883,8 @@ void mark_free_pages(struct zone *zone)
 	for (zone_pfn = 0; zone_pfn < zone->spanned_pages; ++zone_pfn)
 		ClearPageNosaveFree(pfn_to_page(zone_pfn + zone->zone_start_pfn));
 
-	for (order = MAX_ORDER - 1; order >= 0; --order)
-		list_for_each(curr, &zone->free_area[order].free_list) {
+	for_each_migratetype_order(order, t)
+		list_for_each(curr, &zone->free_area[order].free_list[t]) {
 			unsigned long start_pfn, i;
 
 			start_pfn = page_to_pfn(list_entry(curr, struct page, lru));
@@ -716,7 +916,9 @@ static void fastcall free_hot_cold_page(struct page *page, int cold)
 	struct zone *zone = page_zone(page);
 	struct per_cpu_pages *pcp;
 	unsigned long flags;
+	int migratetype;
 
+	trace_mm_page_free(page, 0);
 	arch_free_page(page, 0);
 
 	if (PageAnon(page))
@@ -725,14 +927,15 @@ static void fastcall free_hot_cold_page(struct page *page, int cold)
 		return;
 
 	kernel_map_pages(page, 1, 0);
+	migratetype = get_pageblock_migratetype(page);
 
 	pcp = &zone_pcp(zone, get_cpu())->pcp[cold];
 	local_irq_save(flags);
 	__count_vm_event(PGFREE);
-	list_add(&page->lru, &pcp->list);
+	list_add(&page->lru, &pcp->lists[migratetype]);
 	pcp->count++;
 	if (pcp->count >= pcp->high) {
-		free_pages_bulk(zone, pcp->batch, &pcp->list, 0);
+		free_pcppages_bulk(zone, pcp->batch, pcp);
 		pcp->count -= pcp->batch;
 	}
 	local_irq_restore(flags);
@@ -749,6 +952,59 @@ void fastcall free_cold_page(struct page *page)
 	free_hot_cold_page(page, 1);
 }
 
+/*
+ * Drop a reference to each of the order-0 pages on list, and give those
+ * which become free back to the buddy lists, bypassing the per cpu lists:
+ * the lock of a zone is taken once for each run of pages from it. The
+ * list is empty afterwards.
+ */
+void free_pages_bulk(struct list_head *list)
+{
+	struct zone *locked_zone = NULL;
+	struct page *page, *next;
+	unsigned long flags;
+	int count = 0;
+	LIST_HEAD(pages);
+
+	list_for_each_entry_safe(page, next, list, lru) {
+		list_del(&page->lru);
+		if (!put_page_testzero(page))
+			continue;
+
+		arch_free_page(page, 0);
+		if (PageAnon(page))
+			page->mapping = NULL;
+		if (free_pages_check(page))
+			continue;
+		kernel_map_pages(page, 1, 0);
+		list_add_tail(&page->lru, &pages);
+	}
+	if (list_empty(&pages))
+		return;
+
+	local_irq_save(flags);
+	list_for_each_entry_safe(page, next, &pages, lru) {
+		struct zone *zone = page_zone(page);
+
+		if (zone != locked_zone) {
+			if (locked_zone)
+				spin_unlock(&locked_zone->lock);
+			locked_zone = zone;
+			spin_lock(&zone->lock);
+			zone->all_unreclaimable = 0;
+			zone->pages_scanned = 0;
+		}
+		list_del(&page->lru);
+		__free_one_page(page, zone, 0);
+		count++;
+	}
+	spin_unlock(&locked_zone->lock);
+	__count_vm_events(PGFREE, count);
+	local_irq_restore(flags);
+}
+
+EXPORT_SYMBOL(free_pages_bulk);
+
 /*
  * split_page takes a non-compound higher-order page, and splits it into
  * n (1<<order) sub-pages: page[0..n]
@@ -767,6 +1023,38 @@ void split_page(struct page *page, unsigned int order)
 		set_page_refcounted(page + i);
 }
 
+/*
+ * Similar to split_page except the page is already free, used by memory
+ * compaction to take the pages it migrates to. Must be called with zone->lock held, returns the number of pages split
+ * off or 0 if taking them would leave the zone below its low watermark.
+ */
+int split_free_page(struct page *page)
+{
+	unsigned int order;
+	struct zone *zone;
+
+	BUG_ON(!PageBuddy(page));
+
+	zone = page_zone(page);
+	order = page_order(page);
+
+	/* Obey watermarks as if the page was being allocated */
+	if (!zone_watermark_ok(zone, 0, zone->pages_low + (1 << order), 0, 0))
+		return 0;
+
+	/* Remove page from free list */
+	list_del(&page->lru);
+	zone->free_area[order].nr_free--;
+	rmv_page_order(page);
+	zone->free_pages -= 1UL << order;
+
+	/* Split into individual pages */
+	set_page_refcounted(page);
+	split_page(page, order);
+
+	return 1 << order;
+}
+
 /*
  * Really, prep_compound_page() should be called from __rmqueue_bulk().  But
  * we cheat by calling it from here, in the order > 0 path.  Saves a branch
@@ -778,27 +1066,30 @@ static struct page *buffered_rmqueue(struct zonelist *zonelist,
 	unsigned long flags;
 	struct page *page;
 	int cold = !!(gfp_flags & __GFP_COLD);
+	int migratetype = allocflags_to_migratetype(gfp_flags);
 	int cpu;
 
 again:
 	cpu  = get_cpu();
 	if (likely(order == 0)) {
 		struct per_cpu_pages *pcp;
+		struct list_head *list;
 
 		pcp = &zone_pcp(zone, cpu)->pcp[cold];
+		list = &pcp->lists[migratetype];
 		local_irq_save(flags);
-		if (!pcp->count) {
+		if (list_empty(list)) {
 			pcp->count += rmqueue_bulk(zone, 0,
-						pcp->batch, &pcp->list);
-			if (unlikely(!pcp->count))
+					pcp->batch, list, migratetype);
+			if (unlikely(list_empty(list)))
 				goto failed;
 		}
-		page = list_entry(pcp->list.next, struct page, lru);
+		page = list_entry(list->next, struct page, lru);
 		list_del(&page->lru);
 		pcp->count--;
 	} else {
 		spin_lock_irqsave(&zone->lock, flags);
-		page = __rmqueue(zone, order);
+		page = __rmqueue(zone, order, migratetype);
 		spin_unlock(&zone->lock);
 		if (!page)
 			goto failed;
@@ -903,6 +1194,72 @@ get_page_from_freelist(gfp_t gfp_mask, unsigned int order,
 	return page;
 }
 
+#ifdef CONFIG_COMPACTION
+/* Try memory compaction for high-order allocations before reclaim */
+static struct page *
+__alloc_pages_direct_compact(gfp_t gfp_mask, unsigned int order,
+			struct zonelist *zonelist, int alloc_flags)
+{
+	struct task_struct *p = current;
+	struct page *page;
+	unsigned long compact_result;
+
+	p->flags |= PF_MEMALLOC;
+	compact_result = try_to_compact_pages(zonelist, order, gfp_mask);
+	p->flags &= ~PF_MEMALLOC;
+
+	if (compact_result == COMPACT_SKIPPED)
+		return NULL;
+
+	page = get_page_from_freelist(gfp_mask, order, zonelist, alloc_flags);
+	if (page) {
+		count_vm_event(COMPACTSUCCESS);
+		return page;
+	}
+
+	/*
+	 * It's bad if compaction run occurs and fails.
+	 * The most likely reason is that pages exist,
+	 * but not enough to satisfy watermarks.
+	 */
+	count_vm_event(COMPACTFAIL);
+	cond_resched();
+
+	return NULL;
+}
+#else
+static inline struct page *
+__alloc_pages_direct_compact(gfp_t gfp_mask, unsigned int order,
+			struct zonelist *zonelist, int alloc_flags)
+{
+	return NULL;
+}
+#endif /* CONFIG_COMPACTION */
+
+#ifdef CONFIG_VM_EVENT_COUNTERS
+/*
+ * Account the time an allocation spent in direct reclaim, from its first
+ * pass to success or failure, in buckets of powers of four from 16us up.
+ */
+static void count_reclaim_stall(struct timespec *start)
+{
+	struct timespec now;
+	u64 ns;
+	int i;
+
+	do_posix_clock_monotonic_gettime(&now);
+	now = timespec_sub(now, *start);
+	ns = timespec_to_ns(&now) >> 14;	/* 16.4us units */
+	for (i = ALLOCSTALL_16US; i < ALLOCSTALL_LONGER && ns; i++)
+		ns >>= 2;
+	count_vm_event(i);
+}
+#else
+static inline void count_reclaim_stall(struct timespec *start)
+{
+}
+#endif
+
 /*
  * This is the 'heart' of the zoned buddy allocator.
  */
@@ -918,6 +1275,7 @@ __alloc_pages(gfp_t gfp_mask, unsigned int order,
 	int do_retry;
 	int alloc_flags;
 	int did_some_progress;
+	struct timespec stall_start = { .tv_sec = -1 };
 
 	might_sleep_if(wait);
 
@@ -991,7 +1349,20 @@ nofail_alloc:
 	if (!wait)
 		goto nopage;
 
+	/*
+	 * Try to assemble a free block of the order out of movable pages
+	 * before going into reclaim.
+	 */
+	if (order) {
+		page = __alloc_pages_direct_compact(gfp_mask, order,
+						zonelist, alloc_flags);
+		if (page)
+			goto got_pg;
+	}
+
 rebalance:
+	if (stall_start.tv_sec < 0)
+		do_posix_clock_monotonic_gettime(&stall_start);
 	cond_resched();
 
 	/* We now go into synchronous reclaim */
@@ -1056,11 +1427,81 @@ nopage:
 		show_mem();
 	}
 got_pg:
+	if (unlikely(stall_start.tv_sec >= 0))
+		count_reclaim_stall(&stall_start);
+	trace_mm_page_alloc(page, order, gfp_mask);
 	return page;
 }
 
 EXPORT_SYMBOL(__alloc_pages);
 
+/*
+ * Take up to nr_pages order-0 pages for list in one go. The pages come
+ * straight from the buddy lists of the first zone which stays above its
+ * low watermark once they are gone, under a single hold of its lock, so
+ * that callers refilling large rings of buffers don't take the lock for
+ * every batch of the per cpu lists. When no zone can spare them without
+ * trouble, this falls back to one page from __alloc_pages(), reclaim and
+ * all: the caller just gets a short count.
+ */
+unsigned int __alloc_pages_bulk(gfp_t gfp_mask, struct zonelist *zonelist,
+				unsigned int nr_pages, struct list_head *list)
+{
+	int migratetype = allocflags_to_migratetype(gfp_mask);
+	struct zone **z = zonelist->zones;
+	struct page *page, *next;
+	unsigned int allocated = 0;
+	unsigned long flags;
+	int classzone_idx;
+	LIST_HEAD(pages);
+
+	might_sleep_if(gfp_mask & __GFP_WAIT);
+
+	if (unlikely(!nr_pages || *z == NULL))
+		return 0;
+	classzone_idx = zone_idx(*z);
+
+	do {
+		struct zone *zone = *z;
+		int i, count;
+
+		if (!cpuset_zone_allowed(zone, gfp_mask | __GFP_HARDWALL))
+			continue;
+		if (!zone_watermark_ok(zone, 0, zone->pages_low + nr_pages,
+				       classzone_idx, 0))
+			continue;
+
+		local_irq_save(flags);
+		count = rmqueue_bulk(zone, 0, nr_pages, &pages, migratetype);
+		__count_zone_vm_events(PGALLOC, zone, count);
+		for (i = 0; i < count; i++)
+			zone_statistics(zonelist, zone);
+		local_irq_restore(flags);
+
+		if (count)
+			break;
+	} while (*(++z) != NULL);
+
+	list_for_each_entry_safe(page, next, &pages, lru) {
+		list_del(&page->lru);
+		/* a bad page is left alone, as in buffered_rmqueue() */
+		if (prep_new_page(page, 0, gfp_mask))
+			continue;
+		list_add_tail(&page->lru, list);
+		allocated++;
+	}
+	if (allocated)
+		return allocated;
+
+	page = __alloc_pages(gfp_mask, 0, zonelist);
+	if (!page)
+		return 0;
+	list_add_tail(&page->lru, list);
+	return 1;
+}
+
+EXPORT_SYMBOL(__alloc_pages_bulk);
+
 /*
  * Common helper functions.
  */
@@ -1307,8 +1748,10 @@ void show_free_areas(void)
 			" min:%lukB"
 			" low:%lukB"
 			" high:%lukB"
-			" active:%lukB"
-			" inactive:%lukB"
+			" active_anon:%lukB"
+			" inactive_anon:%lukB"
+			" active_file:%lukB"
+			" inactive_file:%lukB"
 			" present:%lukB"
 			" pages_scanned:%lu"
 			" all_unreclaimable? %s"
@@ -1318,8 +1761,10 @@ void show_free_areas(void)
 			K(zone->pages_min),
 			K(zone->pages_low),
 			K(zone->pages_high),
-			K(zone->nr_active),
-			K(zone->nr_inactive),
+			K(zone->lru[LRU_ACTIVE_ANON].nr_pages),
+			K(zone->lru[LRU_INACTIVE_ANON].nr_pages),
+			K(zone->lru[LRU_ACTIVE_FILE].nr_pages),
+			K(zone->lru[LRU_INACTIVE_FILE].nr_pages),
 			K(zone->present_pages),
 			zone->pages_scanned,
 			(zone->all_unreclaimable ? "yes" : "no")
@@ -1567,8 +2012,21 @@ void __meminit build_all_zonelists(void)
 		/* cpuset refresh routine should be here */
 	}
 	vm_total_pages = nr_free_pagecache_pages();
-	printk("Built %i zonelists.  Total pages: %ld\n",
-			num_online_nodes(), vm_total_pages);
+
+	/*
+	 * Disable grouping by mobility if the number of pages in the
+	 * system is too low to allow the mechanism to work. It would be
+	 * more accurate, but expensive to check per-zone.
+	 */
+	if (vm_total_pages < (pageblock_nr_pages * MIGRATE_TYPES))
+		page_group_by_mobility_disabled = 1;
+	else
+		page_group_by_mobility_disabled = 0;
+
+	printk("Built %i zonelists, mobility grouping %s.  Total pages: %ld\n",
+			num_online_nodes(),
+			page_group_by_mobility_disabled ? "off" : "on",
+			vm_total_pages);
 }
 
 /*
@@ -1678,6 +2136,14 @@ void __meminit memmap_init_zone(unsigned long size, int nid, unsigned long zone,
 		init_page_count(page);
 		reset_page_mapcount(page);
 		SetPageReserved(page);
+
+		/*
+		 * All blocks start out movable: a block only turns to another
+		 * type when such an allocation steals it.
+		 */
+		if ((pfn & (pageblock_nr_pages - 1)) == 0)
+			set_pageblock_migratetype(page, MIGRATE_MOVABLE);
+
 		INIT_LIST_HEAD(&page->lru);
 #ifdef WANT_PAGE_VIRTUAL
 		/* The shift won't overflow because ZONE_NORMAL is below 4G. */
@@ -1690,9 +2156,9 @@ void __meminit memmap_init_zone(unsigned long size, int nid, unsigned long zone,
 void zone_init_free_lists(struct pglist_data *pgdat, struct zone *zone,
 				unsigned long size)
 {
-	int order;
-	for (order = 0; order < MAX_ORDER ; order++) {
-		INIT_LIST_HEAD(&zone->free_area[order].free_list);
+	int order, t;
+	for_each_migratetype_order(order, t) {
+		INIT_LIST_HEAD(&zone->free_area[order].free_list[t]);
 		zone->free_area[order].nr_free = 0;
 	}
 }
@@ -1751,6 +2217,7 @@ static int __cpuinit zone_batchsize(struct zone *zone)
 inline void setup_pageset(struct per_cpu_pageset *p, unsigned long batch)
 {
 	struct per_cpu_pages *pcp;
+	int t;
 
 	memset(p, 0, sizeof(*p));
 
@@ -1758,13 +2225,15 @@ inline void setup_pageset(struct per_cpu_pageset *p, unsigned long batch)
 	pcp->count = 0;
 	pcp->high = 6 * batch;
 	pcp->batch = max(1UL, 1 * batch);
-	INIT_LIST_HEAD(&pcp->list);
+	for (t = 0; t < MIGRATE_TYPES; t++)
+		INIT_LIST_HEAD(&pcp->lists[t]);
 
 	pcp = &p->pcp[1];		/* cold*/
 	pcp->count = 0;
 	pcp->high = 2 * batch;
 	pcp->batch = max(1UL, batch/2);
-	INIT_LIST_HEAD(&pcp->list);
+	for (t = 0; t < MIGRATE_TYPES; t++)
+		INIT_LIST_HEAD(&pcp->lists[t]);
 }
 
 /*
@@ -1933,6 +2402,39 @@ int zone_wait_table_init(struct zone *zone, unsigned long zone_size_pages)
 	return 0;
 }
 
+/*
+ * Size and allocate the pageblock map of a zone, see pfn_to_bitidx()
+ */
+static __meminit int zone_pageblock_init(struct zone *zone,
+		unsigned long zone_start_pfn, unsigned long zone_size_pages)
+{
+	struct pglist_data *pgdat = zone->zone_pgdat;
+	unsigned long start_pfn, end_pfn;
+	size_t alloc_size;
+
+	start_pfn = zone_start_pfn & ~(pageblock_nr_pages - 1);
+	end_pfn = ALIGN(zone_start_pfn + zone_size_pages, pageblock_nr_pages);
+	zone->pageblock_start_pfn = start_pfn;
+	zone->nr_pageblocks = (end_pfn - start_pfn) >> pageblock_order;
+	alloc_size = BITS_TO_LONGS(zone->nr_pageblocks * PB_MIGRATETYPE_BITS)
+					* sizeof(unsigned long);
+
+	if (system_state == SYSTEM_BOOTING) {
+		zone->pageblock_flags = alloc_bootmem_node(pgdat, alloc_size);
+	} else {
+		/* memory hot-add, as for the wait table */
+		zone->pageblock_flags = vmalloc(alloc_size);
+		if (zone->pageblock_flags)
+			memset(zone->pageblock_flags, 0, alloc_size);
+	}
+	if (!zone->pageblock_flags) {
+		zone->nr_pageblocks = 0;
+		return -ENOMEM;
+	}
+
+	return 0;
+}
+
 static __meminit void zone_pcp_init(struct zone *zone)
 {
 	int cpu;
@@ -1959,6 +2461,9 @@ __meminit int init_currently_empty_zone(struct zone *zone,
 	struct pglist_data *pgdat = zone->zone_pgdat;
 	int ret;
 	ret = zone_wait_table_init(zone, size);
+	if (ret)
+		return ret;
+	ret = zone_pageblock_init(zone, zone_start_pfn, size);
 	if (ret)
 		return ret;
 	pgdat->nr_zones = zone_idx(zone) + 1;
@@ -1994,6 +2499,7 @@ static void __meminit free_area_init_core(struct pglist_data *pgdat,
 	for (j = 0; j < MAX_NR_ZONES; j++) {
 		struct zone *zone = pgdat->node_zones + j;
 		unsigned long size, realsize;
+		enum lru_list l;
 
 		realsize = size = zones_size[j];
 		if (zholes_size)
@@ -2019,12 +2525,15 @@ static void __meminit free_area_init_core(struct pglist_data *pgdat,
 		zone->temp_priority = zone->prev_priority = DEF_PRIORITY;
 
 		zone_pcp_init(zone);
-		INIT_LIST_HEAD(&zone->active_list);
-		INIT_LIST_HEAD(&zone->inactive_list);
-		zone->nr_scan_active = 0;
-		zone->nr_scan_inactive = 0;
-		zone->nr_active = 0;
-		zone->nr_inactive = 0;
+		for_each_lru(l) {
+			INIT_LIST_HEAD(&zone->lru[l].list);
+			zone->lru[l].nr_pages = 0;
+			zone->lru[l].nr_scan = 0;
+		}
+		zone->recent_rotated[0] = 0;
+		zone->recent_rotated[1] = 0;
+		zone->recent_scanned[0] = 0;
+		zone->recent_scanned[1] = 0;
 		zap_zone_vm_stats(zone);
 		atomic_set(&zone->reclaim_in_progress, 0);
 		if (!size)
@@ -33,12 +33,12 @@ static void start_one_pdflush_thread(void);
 
 
 /*
- * The pdflush threads are worker threads for writing back dirty data.
- * Ideally, we'd like one thread per active disk spindle.  But the disk
- * topology is very hard to divine at this level.   Instead, we take
- * care in various places to prevent more than one pdflush thread from
- * performing writeback against a single filesystem.  pdflush threads
- * have the PF_FLUSHER flag set in current->flags to aid in this.
+ * The pdflush threads are worker threads for whole-system writeback
+ * operations such as sync.  Background and periodic writeback of dirty
+ * data is done by the flusher thread of each backing device instead, see
+ * mm/backing-dev.c.  We take care in various places to prevent more than
+ * one thread from performing writeback against a single queue.  pdflush
+ * threads have the PF_FLUSHER flag set in current->flags to aid in this.
  */
 
 /*
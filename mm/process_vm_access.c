@@ -0,0 +1,365 @@
+/*
+ *  mm/process_vm_access.c
+ *
+ *  process_vm_readv() and process_vm_writev(): copy data directly
+ *  between the address space of the calling process and that of
+ *  another, given the same rights over it as ptrace needs.  The remote
+ *  pages are pinned with get_user_pages() and copied to or from the
+ *  local iovecs, so a transfer between two processes takes one copy
+ *  where going through shared memory takes two.
+ */
+
+#include <linux/mm.h>
+#include <linux/uio.h>
+#include <linux/sched.h>
+#include <linux/highmem.h>
+#include <linux/pagemap.h>
+#include <linux/ptrace.h>
+#include <linux/slab.h>
+#include <linux/syscalls.h>
+#include <linux/compat.h>
+#include <asm/uaccess.h>
+#include <asm/cacheflush.h>
+
+/* remote pages pinned at a time */
+#define PVM_MAX_PAGES	(PAGE_SIZE / sizeof(struct page *))
+
+/* Where the copy is at in the local iovecs */
+struct pvm_local {
+	const struct iovec *iov;
+	unsigned long nr_segs;
+	unsigned long seg;
+	size_t offset;
+};
+
+/*
+ * Copy len bytes at offset in pinned remote pages to or from the local
+ * iovecs.  Returns the number of bytes copied, which falls short of len
+ * if the local iovecs are used up or a local address faults.
+ */
+static size_t process_vm_rw_pages(struct page **pages, unsigned long offset,
+				  size_t len, struct pvm_local *local,
+				  int vm_write)
+{
+	size_t copied = 0;
+
+	while (len && local->seg < local->nr_segs) {
+		const struct iovec *iov = local->iov + local->seg;
+		char __user *ubuf = (char __user *)iov->iov_base + local->offset;
+		size_t n = iov->iov_len - local->offset;
+		size_t left;
+		char *kaddr;
+
+		if (n > len)
+			n = len;
+		if (n > PAGE_SIZE - offset)
+			n = PAGE_SIZE - offset;
+
+		kaddr = kmap(*pages);
+		if (vm_write) {
+			left = copy_from_user(kaddr + offset, ubuf, n);
+			flush_dcache_page(*pages);
+			set_page_dirty_lock(*pages);
+		} else
+			left = copy_to_user(ubuf, kaddr + offset, n);
+		kunmap(*pages);
+
+		n -= left;
+		copied += n;
+		len -= n;
+		local->offset += n;
+		if (left)
+			break;
+		if (local->offset == iov->iov_len) {
+			local->seg++;
+			local->offset = 0;
+		}
+		offset += n;
+		if (offset == PAGE_SIZE) {
+			pages++;
+			offset = 0;
+		}
+	}
+	return copied;
+}
+
+/*
+ * Copy between one remote range and the local iovecs, pinning the
+ * remote pages a batch at a time with mmap_sem taken only for that, so
+ * that faults on local addresses never nest inside it.
+ */
+static int process_vm_rw_single_vec(unsigned long addr, size_t len,
+				    struct pvm_local *local,
+				    struct page **pages,
+				    struct task_struct *task,
+				    struct mm_struct *mm, int vm_write,
+				    ssize_t *bytes_copied)
+{
+	unsigned long offset = addr & ~PAGE_MASK;
+	unsigned long start = addr & PAGE_MASK;
+	unsigned long nr_pages;
+	int i, got;
+	size_t want, copied;
+
+	if (!len)
+		return 0;
+	nr_pages = (addr + len - 1) / PAGE_SIZE - addr / PAGE_SIZE + 1;
+
+	while (nr_pages && local->seg < local->nr_segs) {
+		int batch = min_t(unsigned long, nr_pages, PVM_MAX_PAGES);
+
+		down_read(&mm->mmap_sem);
+		got = get_user_pages(task, mm, start, batch, vm_write, 0,
+				     pages, NULL);
+		up_read(&mm->mmap_sem);
+		if (got <= 0)
+			return -EFAULT;
+
+		want = min_t(size_t, len, got * PAGE_SIZE - offset);
+		copied = process_vm_rw_pages(pages, offset, want, local,
+					     vm_write);
+		for (i = 0; i < got; i++)
+			page_cache_release(pages[i]);
+
+		*bytes_copied += copied;
+		if (copied < want)
+			return local->seg < local->nr_segs ? -EFAULT : 0;
+		if (got < batch)
+			return -EFAULT;
+
+		len -= copied;
+		nr_pages -= got;
+		start += got * PAGE_SIZE;
+		offset = 0;
+	}
+	return 0;
+}
+
+/*
+ * The kernel copies of both iovec arrays are in hand: find the task, make
+ * sure we may get at its memory, and copy.  Returns the number of bytes
+ * copied, or an error if not even one could be.
+ */
+static ssize_t process_vm_rw_core(pid_t pid, const struct iovec *lvec,
+				  unsigned long liovcnt,
+				  const struct iovec *rvec,
+				  unsigned long riovcnt, int vm_write)
+{
+	struct pvm_local local = {
+		.iov = lvec,
+		.nr_segs = liovcnt,
+	};
+	struct task_struct *task;
+	struct mm_struct *mm;
+	struct page **pages;
+	ssize_t bytes_copied = 0;
+	unsigned long i;
+	int err = 0;
+
+	pages = (struct page **)__get_free_page(GFP_KERNEL);
+	if (!pages)
+		return -ENOMEM;
+
+	read_lock(&tasklist_lock);
+	task = find_task_by_pid(pid);
+	if (task)
+		get_task_struct(task);
+	read_unlock(&tasklist_lock);
+	if (!task) {
+		err = -ESRCH;
+		goto free_pages;
+	}
+
+	err = -EINVAL;
+	mm = get_task_mm(task);
+	if (!mm)
+		goto put_task;
+	/* checked against the mm we hold: not one exec'd since */
+	err = -EPERM;
+	if (!ptrace_may_attach(task) || task->mm != mm)
+		goto put_mm;
+
+	err = 0;
+	for (i = 0; i < riovcnt && local.seg < liovcnt && !err; i++)
+		err = process_vm_rw_single_vec(
+				(unsigned long)rvec[i].iov_base,
+				rvec[i].iov_len, &local, pages, task, mm,
+				vm_write, &bytes_copied);
+
+put_mm:
+	mmput(mm);
+put_task:
+	put_task_struct(task);
+free_pages:
+	free_page((unsigned long)pages);
+	return bytes_copied ? bytes_copied : err;
+}
+
+/* Check a kernel copy of an iovec array: the lengths must add up to a ssize_t */
+static int process_vm_check_iovec(const struct iovec *iov, unsigned long nr_segs)
+{
+	size_t total = 0;
+	unsigned long i;
+
+	for (i = 0; i < nr_segs; i++) {
+		if ((ssize_t)iov[i].iov_len < 0)
+			return -EINVAL;
+		total += iov[i].iov_len;
+		if ((ssize_t)total < 0)
+			return -EINVAL;
+	}
+	return 0;
+}
+
+static ssize_t process_vm_rw(pid_t pid, const struct iovec __user *lvec,
+			     unsigned long liovcnt,
+			     const struct iovec __user *rvec,
+			     unsigned long riovcnt, unsigned long flags,
+			     int vm_write)
+{
+	struct iovec iovstack_l[UIO_FASTIOV];
+	struct iovec iovstack_r[UIO_FASTIOV];
+	struct iovec *iov_l = iovstack_l;
+	struct iovec *iov_r = iovstack_r;
+	ssize_t rc;
+
+	if (flags != 0)
+		return -EINVAL;
+	if (liovcnt > UIO_MAXIOV || riovcnt > UIO_MAXIOV)
+		return -EINVAL;
+	if (liovcnt == 0 || riovcnt == 0)
+		return 0;
+
+	rc = -ENOMEM;
+	if (liovcnt > UIO_FASTIOV) {
+		iov_l = kmalloc(liovcnt * sizeof(struct iovec), GFP_KERNEL);
+		if (!iov_l)
+			goto out;
+	}
+	if (riovcnt > UIO_FASTIOV) {
+		iov_r = kmalloc(riovcnt * sizeof(struct iovec), GFP_KERNEL);
+		if (!iov_r)
+			goto out;
+	}
+
+	rc = -EFAULT;
+	if (copy_from_user(iov_l, lvec, liovcnt * sizeof(struct iovec)) ||
+	    copy_from_user(iov_r, rvec, riovcnt * sizeof(struct iovec)))
+		goto out;
+	rc = process_vm_check_iovec(iov_l, liovcnt);
+	if (!rc)
+		rc = process_vm_check_iovec(iov_r, riovcnt);
+	if (!rc)
+		rc = process_vm_rw_core(pid, iov_l, liovcnt, iov_r, riovcnt,
+					vm_write);
+out:
+	if (iov_r != iovstack_r)
+		kfree(iov_r);
+	if (iov_l != iovstack_l)
+		kfree(iov_l);
+	return rc;
+}
+
+asmlinkage ssize_t sys_process_vm_readv(pid_t pid,
+		const struct iovec __user *lvec, unsigned long liovcnt,
+		const struct iovec __user *rvec, unsigned long riovcnt,
+		unsigned long flags)
+{
+	return process_vm_rw(pid, lvec, liovcnt, rvec, riovcnt, flags, 0);
+}
+
+asmlinkage ssize_t sys_process_vm_writev(pid_t pid,
+		const struct iovec __user *lvec, unsigned long liovcnt,
+		const struct iovec __user *rvec, unsigned long riovcnt,
+		unsigned long flags)
+{
+	return process_vm_rw(pid, lvec, liovcnt, rvec, riovcnt, flags, 1);
+}
+
+#ifdef CONFIG_COMPAT
+
+/* Widen a compat iovec array; the result is checked like a native one */
+static int compat_process_vm_get_iovec(struct iovec *iov,
+		const struct compat_iovec __user *uvec, unsigned long nr_segs)
+{
+	compat_uptr_t base;
+	compat_ssize_t len;
+	unsigned long i;
+
+	if (!access_ok(VERIFY_READ, uvec, nr_segs * sizeof(*uvec)))
+		return -EFAULT;
+	for (i = 0; i < nr_segs; i++) {
+		if (__get_user(base, &uvec[i].iov_base) ||
+		    __get_user(len, &uvec[i].iov_len))
+			return -EFAULT;
+		if (len < 0)
+			return -EINVAL;
+		iov[i].iov_base = compat_ptr(base);
+		iov[i].iov_len = len;
+	}
+	return process_vm_check_iovec(iov, nr_segs);
+}
+
+static ssize_t compat_process_vm_rw(compat_pid_t pid,
+		const struct compat_iovec __user *lvec, unsigned long liovcnt,
+		const struct compat_iovec __user *rvec, unsigned long riovcnt,
+		unsigned long flags, int vm_write)
+{
+	struct iovec iovstack_l[UIO_FASTIOV];
+	struct iovec iovstack_r[UIO_FASTIOV];
+	struct iovec *iov_l = iovstack_l;
+	struct iovec *iov_r = iovstack_r;
+	ssize_t rc;
+
+	if (flags != 0)
+		return -EINVAL;
+	if (liovcnt > UIO_MAXIOV || riovcnt > UIO_MAXIOV)
+		return -EINVAL;
+	if (liovcnt == 0 || riovcnt == 0)
+		return 0;
+
+	rc = -ENOMEM;
+	if (liovcnt > UIO_FASTIOV) {
+		iov_l = kmalloc(liovcnt * sizeof(struct iovec), GFP_KERNEL);
+		if (!iov_l)
+			goto out;
+	}
+	if (riovcnt > UIO_FASTIOV) {
+		iov_r = kmalloc(riovcnt * sizeof(struct iovec), GFP_KERNEL);
+		if (!iov_r)
+			goto out;
+	}
+
+	rc = compat_process_vm_get_iovec(iov_l, lvec, liovcnt);
+	if (!rc)
+		rc = compat_process_vm_get_iovec(iov_r, rvec, riovcnt);
+	if (!rc)
+		rc = process_vm_rw_core(pid, iov_l, liovcnt, iov_r, riovcnt,
+					vm_write);
+out:
+	if (iov_r != iovstack_r)
+		kfree(iov_r);
+	if (iov_l != iovstack_l)
+		kfree(iov_l);
+	return rc;
+}
+
+asmlinkage ssize_t compat_sys_process_vm_readv(compat_pid_t pid,
+		const struct compat_iovec __user *lvec, compat_ulong_t liovcnt,
+		const struct compat_iovec __user *rvec, compat_ulong_t riovcnt,
+		compat_ulong_t flags)
+{
+	return compat_process_vm_rw(pid, lvec, liovcnt, rvec, riovcnt,
+				    flags, 0);
+}
+
+asmlinkage ssize_t compat_sys_process_vm_writev(compat_pid_t pid,
+		const struct compat_iovec __user *lvec, compat_ulong_t liovcnt,
+		const struct compat_iovec __user *rvec, compat_ulong_t riovcnt,
+		compat_ulong_t flags)
+{
+	return compat_process_vm_rw(pid, lvec, liovcnt, rvec, riovcnt,
+				    flags, 1);
+}
+
+#endif /* CONFIG_COMPAT */
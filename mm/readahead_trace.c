@@ -0,0 +1,196 @@
+/*
+ * mm/readahead_trace.c
+ *
+ * Trace the decisions of the on-demand readahead into per cpu relay
+ * buffers, in debugfs readahead/trace<cpu>: the file and offset read,
+ * the access pattern seen and the window submitted. Writing 1 to
+ * readahead/enabled allocates the buffers and starts tracing, writing 0
+ * stops it. The record format is in <linux/readahead_trace.h>.
+ */
+#include <linux/fs.h>
+#include <linux/mm.h>
+#include <linux/sched.h>
+#include <linux/relay.h>
+#include <linux/debugfs.h>
+#include <linux/mutex.h>
+#include <linux/percpu.h>
+#include <linux/readahead_trace.h>
+#include <asm/uaccess.h>
+
+#define READAHEAD_TRACE_SUBBUF_SIZE	(64 * 1024)
+#define READAHEAD_TRACE_N_SUBBUFS	8
+
+int readahead_trace_enabled __read_mostly;
+
+static struct dentry *readahead_trace_dir;
+static struct rchan *readahead_trace_chan;
+static atomic_t readahead_trace_dropped = ATOMIC_INIT(0);
+static DEFINE_MUTEX(readahead_trace_mutex);
+static DEFINE_PER_CPU(u32, readahead_trace_sequence);
+
+void __readahead_trace(struct address_space *mapping,
+		       struct file_ra_state *ra, int pattern, int async,
+		       unsigned long offset, unsigned long req_size,
+		       int actual)
+{
+	struct inode *inode = mapping->host;
+	struct readahead_trace t;
+	unsigned long flags;
+
+	t.magic = READAHEAD_TRACE_MAGIC | READAHEAD_TRACE_VERSION;
+	t.time = sched_clock();
+	t.ino = inode->i_ino;
+	t.offset = offset;
+	t.dev = inode->i_sb ? new_encode_dev(inode->i_sb->s_dev) : 0;
+	t.req_size = req_size;
+	if (pattern == RA_PATTERN_RANDOM) {
+		t.start = offset;
+		t.size = req_size;
+		t.async_size = 0;
+	} else {
+		t.start = ra->start;
+		t.size = ra->size;
+		t.async_size = ra->async_size;
+	}
+	t.actual = actual;
+	t.pattern = pattern;
+	t.async = async;
+	memset(t.pad, 0, sizeof(t.pad));
+
+	/* the sequence number and the buffer are those of this cpu */
+	local_irq_save(flags);
+	t.sequence = ++__get_cpu_var(readahead_trace_sequence);
+	/* pairs with the smp_wmb() in readahead_trace_enabled_write() */
+	smp_rmb();
+	relay_write(readahead_trace_chan, &t, sizeof(t));
+	local_irq_restore(flags);
+}
+
+/*
+ * Count the records lost to full sub-buffers, for readahead/dropped
+ */
+static int readahead_trace_subbuf_start(struct rchan_buf *buf, void *subbuf,
+					void *prev_subbuf, size_t prev_padding)
+{
+	if (!relay_buf_full(buf))
+		return 1;
+
+	atomic_inc(&readahead_trace_dropped);
+	return 0;
+}
+
+static int readahead_trace_remove_buf_file(struct dentry *dentry)
+{
+	debugfs_remove(dentry);
+	return 0;
+}
+
+static struct dentry *readahead_trace_create_buf_file(const char *filename,
+						      struct dentry *parent,
+						      int mode,
+						      struct rchan_buf *buf,
+						      int *is_global)
+{
+	return debugfs_create_file(filename, mode, parent, buf,
+				   &relay_file_operations);
+}
+
+static struct rchan_callbacks readahead_trace_relay_callbacks = {
+	.subbuf_start		= readahead_trace_subbuf_start,
+	.create_buf_file	= readahead_trace_create_buf_file,
+	.remove_buf_file	= readahead_trace_remove_buf_file,
+};
+
+static ssize_t readahead_trace_enabled_read(struct file *filp,
+					    char __user *ubuf,
+					    size_t cnt, loff_t *ppos)
+{
+	char buf[4];
+
+	snprintf(buf, sizeof(buf), "%d\n", readahead_trace_enabled);
+
+	return simple_read_from_buffer(ubuf, cnt, ppos, buf, strlen(buf));
+}
+
+static ssize_t readahead_trace_enabled_write(struct file *filp,
+					     const char __user *ubuf,
+					     size_t cnt, loff_t *ppos)
+{
+	char buf[4];
+	int enable;
+
+	if (!cnt)
+		return 0;
+	if (copy_from_user(buf, ubuf, 1))
+		return -EFAULT;
+
+	switch (buf[0]) {
+	case '0':
+		enable = 0;
+		break;
+	case '1':
+		enable = 1;
+		break;
+	default:
+		return -EINVAL;
+	}
+
+	mutex_lock(&readahead_trace_mutex);
+	if (enable && !readahead_trace_chan) {
+		/*
+		 * The buffers of the cpus are only allocated the first
+		 * time tracing is turned on, and then stay around.
+		 */
+		readahead_trace_chan = relay_open("trace", readahead_trace_dir,
+					READAHEAD_TRACE_SUBBUF_SIZE,
+					READAHEAD_TRACE_N_SUBBUFS,
+					&readahead_trace_relay_callbacks);
+		if (!readahead_trace_chan) {
+			mutex_unlock(&readahead_trace_mutex);
+			return -ENOMEM;
+		}
+		/* the channel must be visible before the enable flag */
+		smp_wmb();
+	}
+	readahead_trace_enabled = enable;
+	if (!enable && readahead_trace_chan)
+		relay_flush(readahead_trace_chan);
+	mutex_unlock(&readahead_trace_mutex);
+
+	return cnt;
+}
+
+static struct file_operations readahead_trace_enabled_fops = {
+	.read =		readahead_trace_enabled_read,
+	.write =	readahead_trace_enabled_write,
+};
+
+static ssize_t readahead_trace_dropped_read(struct file *filp,
+					    char __user *ubuf,
+					    size_t cnt, loff_t *ppos)
+{
+	char buf[16];
+
+	snprintf(buf, sizeof(buf), "%u\n",
+		 atomic_read(&readahead_trace_dropped));
+
+	return simple_read_from_buffer(ubuf, cnt, ppos, buf, strlen(buf));
+}
+
+static struct file_operations readahead_trace_dropped_fops = {
+	.read =		readahead_trace_dropped_read,
+};
+
+static int __init readahead_trace_init(void)
+{
+	readahead_trace_dir = debugfs_create_dir("readahead", NULL);
+	if (!readahead_trace_dir)
+		return -ENOMEM;
+
+	debugfs_create_file("enabled", 0600, readahead_trace_dir, NULL,
+			    &readahead_trace_enabled_fops);
+	debugfs_create_file("dropped", 0444, readahead_trace_dir, NULL,
+			    &readahead_trace_dropped_fops);
+	return 0;
+}
+late_initcall(readahead_trace_init);
@@ -51,6 +51,7 @@
 #include <linux/slab.h>
 #include <linux/init.h>
 #include <linux/rmap.h>
+#include <linux/huge_mm.h>
 #include <linux/rcupdate.h>
 #include <linux/module.h>
 
@@ -193,7 +194,7 @@ static struct anon_vma *page_lock_anon_vma(struct page *page)
 
 	rcu_read_lock();
 	anon_mapping = (unsigned long) page->mapping;
-	if (!(anon_mapping & PAGE_MAPPING_ANON))
+	if ((anon_mapping & PAGE_MAPPING_FLAGS) != PAGE_MAPPING_ANON)
 		goto out;
 	if (!page_mapped(page))
 		goto out;
@@ -252,7 +253,7 @@ pte_t *page_check_address(struct page *page, struct mm_struct *mm,
 {
 	pgd_t *pgd;
 	pud_t *pud;
-	pmd_t *pmd;
+	pmd_t *pmd, pmdval;
 	pte_t *pte;
 	spinlock_t *ptl;
 
@@ -265,19 +266,23 @@ pte_t *page_check_address(struct page *page, struct mm_struct *mm,
 		return NULL;
 
 	pmd = pmd_offset(pud, address);
-	if (!pmd_present(*pmd))
+	pmdval = *pmd;
+	/* a pte table shared since fork is left alone until unshared */
+	if (!pmd_present(pmdval) || pmd_trans_huge(pmdval) ||
+	    pmd_ptes_shared(pmdval))
 		return NULL;
 
-	pte = pte_offset_map(pmd, address);
+	pte = pte_offset_map(&pmdval, address);
 	/* Make a quick check before getting the lock */
 	if (!pte_present(*pte)) {
 		pte_unmap(pte);
 		return NULL;
 	}
 
-	ptl = pte_lockptr(mm, pmd);
+	ptl = pte_lockptr(mm, &pmdval);
 	spin_lock(ptl);
-	if (pte_present(*pte) && page_to_pfn(page) == pte_pfn(*pte)) {
+	if (pmd_val(*pmd) == pmd_val(pmdval) &&
+	    pte_present(*pte) && page_to_pfn(page) == pte_pfn(*pte)) {
 		*ptlp = ptl;
 		return pte;
 	}
@@ -481,15 +486,35 @@ void page_add_anon_rmap(struct page *page,
  * @address:	the user virtual address mapped
  *
  * Same as page_add_anon_rmap but must only be called on *new* pages.
- * This means the inc-and-test can be bypassed.
+ * This means the inc-and-test can be bypassed. The page goes onto the
+ * anon LRU lists, so this has to come before its lru_cache_add_active().
  */
 void page_add_new_anon_rmap(struct page *page,
 	struct vm_area_struct *vma, unsigned long address)
 {
+	SetPageSwapBacked(page);
 	atomic_set(&page->_mapcount, 0); /* elevate count by 1 (starts at -1) */
 	__page_set_anon_rmap(page, vma, address);
 }
 
+#ifdef CONFIG_KSM
+/**
+ * page_add_ksm_rmap - add pte mapping to a page merged by KSM
+ * @page: the page to add the mapping to
+ *
+ * A merged page has no anon_vma, and so no index either: its mapping
+ * only marks it anonymous and merged.  The caller needs to hold the
+ * pte lock.
+ */
+void page_add_ksm_rmap(struct page *page)
+{
+	if (atomic_inc_and_test(&page->_mapcount)) {
+		page->mapping = (void *)(PAGE_MAPPING_ANON | PAGE_MAPPING_KSM);
+		__inc_zone_page_state(page, NR_ANON_PAGES);
+	}
+}
+#endif
+
 /**
  * page_add_file_rmap - add pte mapping to a file page
  * @page: the page to add the mapping to
@@ -580,7 +605,23 @@ static int try_to_unmap_one(struct page *page, struct vm_area_struct *vma,
 	/* Update high watermark before we lower rss */
 	update_hiwater_rss(mm);
 
-	if (PageAnon(page)) {
+	if (PageAnon(page) && !PageSwapBacked(page) && !migration) {
+		/*
+		 * Freed with MADV_FREE: the contents can go, unless the page
+		 * was written since, or someone may yet write it through a
+		 * reference got from get_user_pages().  The caller holds
+		 * one reference of its own.
+		 */
+		smp_mb();
+		if (PageDirty(page) ||
+		    page_count(page) != 1 + page_mapcount(page)) {
+			set_pte_at(mm, address, pte, pteval);
+			SetPageSwapBacked(page);
+			ret = SWAP_FAIL;
+			goto out_unmap;
+		}
+		dec_mm_counter(mm, anon_rss);
+	} else if (PageAnon(page)) {
 		swp_entry_t entry = { .val = page_private(page) };
 
 		if (PageSwapCache(page)) {
@@ -862,3 +903,32 @@ int try_to_unmap(struct page *page, int migration)
 	return ret;
 }
 
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+/**
+ * split_huge_page - split the huge pmd mapping a transparent huge page
+ * @page: the head page, pinned by the caller
+ *
+ * For when the page is found without its mm, as by the huge page shrinker:
+ * the pmd is found through the anon_vma, like the ptes of a small page.
+ */
+void split_huge_page(struct page *page)
+{
+	struct anon_vma *anon_vma;
+	struct vm_area_struct *vma;
+
+	anon_vma = page_lock_anon_vma(page);
+	if (!anon_vma)
+		return;
+
+	list_for_each_entry(vma, &anon_vma->head, anon_vma_node) {
+		unsigned long address = vma_address(page, vma);
+
+		if (address == -EFAULT)
+			continue;
+		split_huge_page_address(vma->vm_mm, address, page);
+		if (!PageCompound(page))
+			break;
+	}
+	spin_unlock(&anon_vma->lock);
+}
+#endif
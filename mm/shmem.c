@@ -90,7 +90,8 @@ static inline struct page *shmem_dir_alloc(gfp_t gfp_mask)
 	 * BLOCKS_PER_PAGE on indirect pages, assume PAGE_CACHE_SIZE:
 	 * might be reconsidered if it ever diverges from PAGE_SIZE.
 	 */
-	return alloc_pages(gfp_mask, PAGE_CACHE_SHIFT-PAGE_SHIFT);
+	return alloc_pages(gfp_mask & ~GFP_MOVABLE_MASK,
+			   PAGE_CACHE_SHIFT-PAGE_SHIFT);
 }
 
 static inline void shmem_dir_free(struct page *page)
@@ -1019,7 +1020,21 @@ static int shmem_getpage(struct inode *inode, unsigned long idx,
 	 * But shmem_prepare_write passes in a locked filepage,
 	 * which may be found not uptodate by other callers too,
 	 * and may need to be copied from the swappage read in.
+	 *
+	 * The page is handed back unlocked, so when it is in
+	 * cache and uptodate there is no need to lock it at all:
+	 * that is most calls, and they stay off info->lock too.
 	 */
+	if (!filepage) {
+		filepage = find_get_page(mapping, idx);
+		if (filepage && PageUptodate(filepage)) {
+			*pagep = filepage;
+			return 0;
+		}
+		if (filepage)
+			page_cache_release(filepage);
+		filepage = NULL;
+	}
 repeat:
 	if (!filepage)
 		filepage = find_lock_page(mapping, idx);
@@ -1180,6 +1195,7 @@ repeat:
 				swap = *entry;
 				shmem_swp_unmap(entry);
 			}
+			SetPageSwapBacked(filepage);
 			if (error || swap.val || 0 != add_to_page_cache_lru(
 					filepage, mapping, idx, GFP_ATOMIC)) {
 				spin_unlock(&info->lock);
@@ -909,7 +909,7 @@ static void __devinit start_cpu_timer(int cpu)
 	 */
 	if (keventd_up() && reap_work->func == NULL) {
 		init_reap_node(cpu);
-		INIT_WORK(reap_work, cache_reap, NULL);
+		INIT_WORK_DEFERRABLE(reap_work, cache_reap, NULL);
 		schedule_delayed_work_on(cpu, reap_work, HZ + 3 * cpu);
 	}
 }
@@ -1543,6 +1543,11 @@ static void *kmem_getpages(struct kmem_cache *cachep, gfp_t flags, int nodeid)
 	 */
 	flags |= __GFP_COMP;
 #endif
+	/*
+	 * Slab pages are never movable, whatever the caller's mask says; the
+	 * reclaimable caches get grouped on reclaimable pageblocks instead.
+	 */
+	flags &= ~GFP_MOVABLE_MASK;
 	flags |= cachep->gfpflags;
 
 	page = alloc_pages_node(nodeid, flags, cachep->gfporder);
@@ -2198,6 +2203,8 @@ kmem_cache_create (const char *name, size_t size, size_t align,
 	cachep->gfpflags = 0;
 	if (flags & SLAB_CACHE_DMA)
 		cachep->gfpflags |= GFP_DMA;
+	if (flags & SLAB_RECLAIM_ACCOUNT)
+		cachep->gfpflags |= __GFP_RECLAIMABLE;
 	cachep->buffer_size = size;
 
 	if (flags & CFLGS_OFF_SLAB)
@@ -103,7 +103,7 @@ static void *slob_alloc(size_t size, gfp_t gfp, int align)
 			if (size == PAGE_SIZE) /* trying to shrink arena? */
 				return 0;
 
-			cur = (slob_t *)__get_free_page(gfp);
+			cur = (slob_t *)__get_free_page(gfp & ~GFP_MOVABLE_MASK);
 			if (!cur)
 				return 0;
 
@@ -173,7 +173,8 @@ void *kmalloc(size_t size, gfp_t gfp)
 		return 0;
 
 	bb->order = find_order(size);
-	bb->pages = (void *)__get_free_pages(gfp, bb->order);
+	bb->pages = (void *)__get_free_pages(gfp & ~GFP_MOVABLE_MASK,
+						 bb->order);
 
 	if (bb->pages) {
 		spin_lock_irqsave(&block_lock, flags);
@@ -284,7 +285,8 @@ void *kmem_cache_alloc(struct kmem_cache *c, gfp_t flags)
 	if (c->size < PAGE_SIZE)
 		b = slob_alloc(c->size, flags, c->align);
 	else
-		b = (void *)__get_free_pages(flags, find_order(c->size));
+		b = (void *)__get_free_pages(flags & ~GFP_MOVABLE_MASK,
+					     find_order(c->size));
 
 	if (c->ctor)
 		c->ctor(b, c, SLAB_CTOR_CONSTRUCTOR);
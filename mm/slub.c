@@ -0,0 +1,1587 @@
+/*
+ * SLUB: An unqueued slab allocator.
+ *
+ * How SLUB works:
+ *
+ * A slab is a naturally aligned block of 2^order pages cut into objects
+ * of one cache. The free objects of a slab are chained through a free
+ * pointer stored in the objects themselves, and everything else needed
+ * to manage the slab lives in the struct page of its first page:
+ *
+ *	page->slab		the cache (set in every page of the slab)
+ *	page->freelist		first free object, under the slab lock
+ *	page->inuse		objects not on page->freelist
+ *	page->lockless_freelist	free objects of the cpu owning the slab
+ *
+ * PG_locked of the first page is the slab lock, and PG_active marks a
+ * slab that is the current slab of a cpu ("frozen").
+ *
+ * Every cpu has one current slab per cache. Allocations take the first
+ * object off its lockless_freelist with interrupts disabled and without
+ * any lock; when that list runs empty the cpu takes over the whole
+ * page->freelist under the slab lock. Objects freed to the current slab
+ * of the local cpu go back to the lockless_freelist. All other frees,
+ * including those of objects from a remote node, take the slab lock of
+ * the slab the object came from and put it on its page->freelist. So
+ * there are no object queues, no alien caches between the nodes and
+ * nothing that needs to be reaped periodically.
+ *
+ * Slabs that are neither full nor the current slab of a cpu sit on the
+ * partial list of their node, from where the cpus pick up a new current
+ * slab. Full slabs are on no list at all. Empty slabs are given back to
+ * the page allocator, except for MIN_PARTIAL of them per node.
+ *
+ * Lock order:
+ *   1. slub_lock (list of caches, creation and destruction of caches)
+ *   2. slab_lock(page)
+ *   3. node->list_lock
+ *
+ * The partial lists are walked under the list_lock and only trylock the
+ * slabs on them, which makes taking the list_lock inside of the slab
+ * lock (when a slab is added to or removed from a partial list) safe.
+ */
+
+#include <linux/mm.h>
+#include <linux/module.h>
+#include <linux/bit_spinlock.h>
+#include <linux/interrupt.h>
+#include <linux/bitops.h>
+#include <linux/slab.h>
+#include <linux/seq_file.h>
+#include <linux/cpu.h>
+#include <linux/cpuset.h>
+#include <linux/mutex.h>
+#include <linux/rcupdate.h>
+#include <linux/swap.h>
+#include <linux/notifier.h>
+#include <linux/debug_locks.h>
+#include <asm/uaccess.h>
+
+#ifndef cache_line_size
+#define cache_line_size()	L1_CACHE_BYTES
+#endif
+
+#ifndef ARCH_KMALLOC_MINALIGN
+#define ARCH_KMALLOC_MINALIGN	0
+#endif
+
+#ifndef ARCH_SLAB_MINALIGN
+#define ARCH_SLAB_MINALIGN	0
+#endif
+
+#ifndef ARCH_KMALLOC_FLAGS
+#define ARCH_KMALLOC_FLAGS	SLAB_HWCACHE_ALIGN
+#endif
+
+/* Legal flag mask for kmem_cache_create(), as for SLAB without debugging */
+#define CREATE_MASK	(SLAB_HWCACHE_ALIGN | \
+			 SLAB_CACHE_DMA | SLAB_MUST_HWCACHE_ALIGN | \
+			 SLAB_RECLAIM_ACCOUNT | SLAB_PANIC | \
+			 SLAB_DESTROY_BY_RCU | SLAB_MEM_SPREAD)
+
+/* Same object size limits as SLAB */
+#if defined(CONFIG_LARGE_ALLOCS)
+#define MAX_OBJ_ORDER	13	/* up to 32Mb */
+#elif defined(CONFIG_MMU)
+#define MAX_OBJ_ORDER	5	/* 32 pages */
+#else
+#define MAX_OBJ_ORDER	8	/* up to 1Mb */
+#endif
+
+/*
+ * Empty slabs kept on the partial list of a node, so that a cache
+ * which hovers around a slab boundary does not keep going back to the
+ * page allocator.
+ */
+#define MIN_PARTIAL	2
+
+/*
+ * Slabs only go above slub_max_order if a single object does not fit,
+ * and below it try to hold at least slub_min_objects objects.
+ */
+#if PAGE_SHIFT <= 12
+#define DEFAULT_MAX_ORDER	2
+#define DEFAULT_MIN_OBJECTS	8
+#else
+#define DEFAULT_MAX_ORDER	1
+#define DEFAULT_MIN_OBJECTS	4
+#endif
+
+static int slub_min_order;
+static int slub_max_order = DEFAULT_MAX_ORDER;
+static int slub_min_objects = DEFAULT_MIN_OBJECTS;
+
+struct kmem_cache_node {
+	spinlock_t list_lock;	/* Protects partial and nr_partial */
+	unsigned long nr_partial;
+	atomic_long_t nr_slabs;
+	struct list_head partial;
+};
+
+struct kmem_cache {
+	unsigned long flags;
+	int size;		/* Object size including the free pointer */
+	int objsize;		/* Object size as passed to kmem_cache_create */
+	int offset;		/* Offset of the free pointer */
+	int order;		/* Page order of a slab */
+	int objects;		/* Objects per slab */
+	gfp_t allocflags;	/* Added to the gfp flags of the slab pages */
+	void (*ctor)(void *, struct kmem_cache *, unsigned long);
+	void (*dtor)(void *, struct kmem_cache *, unsigned long);
+	const char *name;
+	struct list_head list;	/* On slab_caches */
+#ifdef CONFIG_NUMA
+	struct kmem_cache_node *node[MAX_NUMNODES];
+#else
+	struct kmem_cache_node local_node;
+#endif
+	struct page *cpu_slab[NR_CPUS];
+};
+
+/*
+ * chicken and egg problem: the structures of the caches and of their
+ * nodes are allocated from slab caches themselves.
+ */
+static enum {
+	DOWN,		/* No slab functionality */
+	PARTIAL,	/* kmem_cache_node cache works */
+	UP		/* Everything works */
+} slab_state = DOWN;
+
+/* Guard access to the list of caches */
+static DEFINE_MUTEX(slub_lock);
+static LIST_HEAD(slab_caches);
+
+/*
+ * vm_enough_memory() looks at this to determine how many slab-allocated pages
+ * are possibly freeable under pressure
+ *
+ * SLAB_RECLAIM_ACCOUNT turns this on per-slab
+ */
+atomic_t slab_reclaim_pages;
+
+/*
+ * These are the default caches for kmalloc. Custom caches can have other sizes.
+ */
+struct cache_sizes malloc_sizes[] = {
+#define CACHE(x) { .cs_size = (x) },
+#include <linux/kmalloc_sizes.h>
+	CACHE(ULONG_MAX)
+#undef CACHE
+};
+EXPORT_SYMBOL(malloc_sizes);
+
+/* Must match cache_sizes above. Out of line to keep cache footprint low. */
+struct cache_names {
+	char *name;
+	char *name_dma;
+};
+
+static struct cache_names __initdata cache_names[] = {
+#define CACHE(x) { .name = "size-" #x, .name_dma = "size-" #x "(DMA)" },
+#include <linux/kmalloc_sizes.h>
+	{NULL,}
+#undef CACHE
+};
+
+/* The kmalloc caches and their DMA variants */
+static struct kmem_cache kmalloc_caches[2 * (ARRAY_SIZE(malloc_sizes) - 1)];
+
+#ifdef CONFIG_NUMA
+/* Cache of the struct kmem_cache_node of all caches, itself included */
+static struct kmem_cache kmem_node_cache;
+#endif
+
+/*
+ * used by boot code to determine if it can use slab based allocator
+ */
+int slab_is_available(void)
+{
+	return slab_state >= UP;
+}
+
+static inline struct kmem_cache_node *get_node(struct kmem_cache *s, int node)
+{
+#ifdef CONFIG_NUMA
+	return s->node[node];
+#else
+	return &s->local_node;
+#endif
+}
+
+static inline void *get_freepointer(struct kmem_cache *s, void *object)
+{
+	return *(void **)(object + s->offset);
+}
+
+static inline void set_freepointer(struct kmem_cache *s, void *object, void *fp)
+{
+	*(void **)(object + s->offset) = fp;
+}
+
+#define for_each_object(__p, __s, __addr) \
+	for (__p = (__addr); __p < (__addr) + (__s)->objects * (__s)->size;\
+			__p += (__s)->size)
+
+/*
+ * The first page of the slab holding x: the buddy allocator hands out
+ * naturally aligned blocks, so it is found from the page frame number.
+ */
+static inline struct page *virt_to_head_page(const void *x)
+{
+	struct page *page = virt_to_page(x);
+	int order;
+
+	BUG_ON(!PageSlab(page));
+	order = page->slab->order;
+	if (order)
+		page = pfn_to_page(page_to_pfn(page) & ~((1UL << order) - 1));
+	return page;
+}
+
+/*
+ * Per slab locking using the page lock bit. The flags of a slab page
+ * are only ever modified with the slab lock held.
+ */
+static __always_inline void slab_lock(struct page *page)
+{
+	bit_spin_lock(PG_locked, &page->flags);
+}
+
+static __always_inline void slab_unlock(struct page *page)
+{
+	bit_spin_unlock(PG_locked, &page->flags);
+}
+
+static __always_inline int slab_trylock(struct page *page)
+{
+	return bit_spin_trylock(PG_locked, &page->flags);
+}
+
+static inline int SlabFrozen(struct page *page)
+{
+	return test_bit(PG_active, &page->flags);
+}
+
+static inline void __SetSlabFrozen(struct page *page)
+{
+	__set_bit(PG_active, &page->flags);
+}
+
+static inline void __ClearSlabFrozen(struct page *page)
+{
+	__clear_bit(PG_active, &page->flags);
+}
+
+/*
+ * Slab allocation and freeing
+ */
+static struct page *allocate_slab(struct kmem_cache *s, gfp_t flags, int node)
+{
+	struct page *page;
+	int pages = 1 << s->order;
+
+	if (unlikely(s->order >= MAX_ORDER))
+		return NULL;
+
+	/* Slab pages never move, reclaimable caches set allocflags */
+	flags &= ~GFP_MOVABLE_MASK;
+	flags |= s->allocflags;
+	if (node == -1)
+		page = alloc_pages(flags, s->order);
+	else
+		page = alloc_pages_node(node, flags, s->order);
+	if (!page)
+		return NULL;
+
+	add_zone_page_state(page_zone(page), NR_SLAB, pages);
+	if (s->flags & SLAB_RECLAIM_ACCOUNT)
+		atomic_add(pages, &slab_reclaim_pages);
+	return page;
+}
+
+/*
+ * Allocate a new slab and chain all of its objects on page->freelist.
+ * Called with interrupts disabled, they are enabled for the page
+ * allocator if the allocation may sleep.
+ */
+static struct page *new_slab(struct kmem_cache *s, gfp_t flags, int node)
+{
+	struct kmem_cache_node *n;
+	struct page *page;
+	unsigned long ctor_flags = SLAB_CTOR_CONSTRUCTOR;
+	void *start, *last, *p;
+	int i;
+
+	if (flags & __GFP_WAIT)
+		local_irq_enable();
+	else
+		ctor_flags |= SLAB_CTOR_ATOMIC;
+
+#ifdef CONFIG_NUMA
+	if (node == -1 && (s->flags & SLAB_MEM_SPREAD) &&
+	    cpuset_do_slab_mem_spread())
+		node = cpuset_mem_spread_node();
+#endif
+	page = allocate_slab(s, flags & GFP_LEVEL_MASK, node);
+	if (!page)
+		goto out;
+
+	n = get_node(s, page_to_nid(page));
+	if (n)
+		atomic_long_inc(&n->nr_slabs);
+	for (i = 0; i < (1 << s->order); i++) {
+		__SetPageSlab(page + i);
+		page[i].slab = s;
+	}
+
+	start = page_address(page);
+	last = start;
+	for (i = 1; i < s->objects; i++) {
+		p = last + s->size;
+		if (s->ctor)
+			s->ctor(last, s, ctor_flags);
+		set_freepointer(s, last, p);
+		last = p;
+	}
+	if (s->ctor)
+		s->ctor(last, s, ctor_flags);
+	set_freepointer(s, last, NULL);
+
+	page->freelist = start;
+	page->lockless_freelist = NULL;
+	page->inuse = 0;
+out:
+	if (flags & __GFP_WAIT)
+		local_irq_disable();
+	return page;
+}
+
+static void __free_slab(struct kmem_cache *s, struct page *page)
+{
+	int pages = 1 << s->order;
+	int i;
+
+	if (unlikely(s->dtor)) {
+		void *start = page_address(page);
+		void *p;
+
+		for_each_object(p, s, start)
+			s->dtor(p, s, 0);
+	}
+
+	sub_zone_page_state(page_zone(page), NR_SLAB, pages);
+	for (i = 0; i < pages; i++) {
+		__ClearPageSlab(page + i);
+		page[i].mapping = NULL;
+	}
+	set_page_private(page, 0);
+	reset_page_mapcount(page);
+	if (current->reclaim_state)
+		current->reclaim_state->reclaimed_slab += pages;
+	__free_pages(page, s->order);
+	if (s->flags & SLAB_RECLAIM_ACCOUNT)
+		atomic_sub(pages, &slab_reclaim_pages);
+}
+
+static void rcu_free_slab(struct rcu_head *h)
+{
+	struct page *page;
+
+	page = container_of((struct list_head *)h, struct page, lru);
+	__free_slab(page->slab, page);
+}
+
+static void free_slab(struct kmem_cache *s, struct page *page)
+{
+	if (unlikely(s->flags & SLAB_DESTROY_BY_RCU)) {
+		/*
+		 * The rcu head overlays the lru list of the page, which
+		 * is unused once the slab is off the partial list.
+		 */
+		struct rcu_head *head = (void *)&page->lru;
+
+		call_rcu(head, rcu_free_slab);
+	} else
+		__free_slab(s, page);
+}
+
+static void discard_slab(struct kmem_cache *s, struct page *page)
+{
+	struct kmem_cache_node *n = get_node(s, page_to_nid(page));
+
+	atomic_long_dec(&n->nr_slabs);
+	free_slab(s, page);
+}
+
+/*
+ * Management of the partially allocated slabs
+ */
+static void add_partial(struct kmem_cache *s, struct page *page)
+{
+	struct kmem_cache_node *n = get_node(s, page_to_nid(page));
+
+	spin_lock(&n->list_lock);
+	n->nr_partial++;
+	list_add(&page->lru, &n->partial);
+	spin_unlock(&n->list_lock);
+}
+
+/* Empty slabs go to the tail, to be used after the partially used ones */
+static void add_partial_tail(struct kmem_cache *s, struct page *page)
+{
+	struct kmem_cache_node *n = get_node(s, page_to_nid(page));
+
+	spin_lock(&n->list_lock);
+	n->nr_partial++;
+	list_add_tail(&page->lru, &n->partial);
+	spin_unlock(&n->list_lock);
+}
+
+static void remove_partial(struct kmem_cache *s, struct page *page)
+{
+	struct kmem_cache_node *n = get_node(s, page_to_nid(page));
+
+	spin_lock(&n->list_lock);
+	list_del(&page->lru);
+	n->nr_partial--;
+	spin_unlock(&n->list_lock);
+}
+
+/*
+ * Lock a slab on the partial list and take it off the list.
+ * Must hold list_lock.
+ */
+static inline int lock_and_del_slab(struct kmem_cache_node *n,
+				    struct page *page)
+{
+	if (slab_trylock(page)) {
+		list_del(&page->lru);
+		n->nr_partial--;
+		return 1;
+	}
+	return 0;
+}
+
+/*
+ * Get a locked slab off the partial list of a node.
+ */
+static struct page *get_partial_node(struct kmem_cache_node *n)
+{
+	struct page *page;
+
+	/*
+	 * Racy check. If we mistakenly see no partial slabs then we
+	 * just allocate an empty slab.
+	 */
+	if (!n || !n->nr_partial)
+		return NULL;
+
+	spin_lock(&n->list_lock);
+	list_for_each_entry(page, &n->partial, lru)
+		if (lock_and_del_slab(n, page))
+			goto out;
+	page = NULL;
+out:
+	spin_unlock(&n->list_lock);
+	return page;
+}
+
+static struct page *get_partial(struct kmem_cache *s, int node)
+{
+	if (node == -1)
+		node = numa_node_id();
+	return get_partial_node(get_node(s, node));
+}
+
+/*
+ * Give up a slab that was the current slab of a cpu. It is put back
+ * on the partial list if it has free objects, or freed if it is empty
+ * and the node has enough partial slabs already.
+ *
+ * The slab must be locked, and is unlocked on return.
+ */
+static void unfreeze_slab(struct kmem_cache *s, struct page *page)
+{
+	__ClearSlabFrozen(page);
+	if (page->inuse) {
+		if (page->freelist)
+			add_partial(s, page);
+		slab_unlock(page);
+	} else if (get_node(s, page_to_nid(page))->nr_partial < MIN_PARTIAL) {
+		add_partial_tail(s, page);
+		slab_unlock(page);
+	} else {
+		slab_unlock(page);
+		discard_slab(s, page);
+	}
+}
+
+/*
+ * Remove the current slab of a cpu, merging the objects on the lockless
+ * free list back into the free list of the slab.
+ */
+static void deactivate_slab(struct kmem_cache *s, struct page *page, int cpu)
+{
+	while (unlikely(page->lockless_freelist)) {
+		void **object = page->lockless_freelist;
+
+		page->lockless_freelist = get_freepointer(s, object);
+		set_freepointer(s, object, page->freelist);
+		page->freelist = object;
+		page->inuse--;
+	}
+	s->cpu_slab[cpu] = NULL;
+	unfreeze_slab(s, page);
+}
+
+static inline void flush_slab(struct kmem_cache *s, struct page *page, int cpu)
+{
+	slab_lock(page);
+	deactivate_slab(s, page, cpu);
+}
+
+/*
+ * Flush the current slab of a cpu.
+ * Called with interrupts disabled, from the cpu or after it went away.
+ */
+static void __flush_cpu_slab(struct kmem_cache *s, int cpu)
+{
+	struct page *page = s->cpu_slab[cpu];
+
+	if (likely(page))
+		flush_slab(s, page, cpu);
+}
+
+static void flush_cpu_slab(void *d)
+{
+	struct kmem_cache *s = d;
+
+	__flush_cpu_slab(s, smp_processor_id());
+}
+
+static void flush_all(struct kmem_cache *s)
+{
+	on_each_cpu(flush_cpu_slab, s, 1, 1);
+}
+
+/*
+ * Slow path of the allocation: the lockless free list of the current
+ * slab is empty, or the object has to come from another node.
+ *
+ * Take over the free list of the current slab if other cpus freed
+ * objects to it, otherwise get a slab off the partial list or a new
+ * one. Called with interrupts disabled.
+ */
+static void *__slab_alloc(struct kmem_cache *s, gfp_t gfpflags, int node,
+			  struct page *page)
+{
+	void **object;
+	int cpu = smp_processor_id();
+
+	if (!page)
+		goto new_slab;
+
+	slab_lock(page);
+	if (unlikely(node != -1 && page_to_nid(page) != node))
+		goto another_slab;
+load_freelist:
+	object = page->freelist;
+	if (unlikely(!object))
+		goto another_slab;
+
+	page->lockless_freelist = get_freepointer(s, object);
+	page->inuse = s->objects;
+	page->freelist = NULL;
+	slab_unlock(page);
+	return object;
+
+another_slab:
+	deactivate_slab(s, page, cpu);
+
+new_slab:
+	page = get_partial(s, node);
+	if (page) {
+		__SetSlabFrozen(page);
+		s->cpu_slab[cpu] = page;
+		goto load_freelist;
+	}
+
+	if (unlikely(gfpflags & __GFP_NO_GROW))
+		return NULL;
+
+	page = new_slab(s, gfpflags, node);
+	if (!page)
+		return NULL;
+
+	/*
+	 * Interrupts may have been enabled for the page allocator: we
+	 * may be on another cpu now, and that cpu may have gotten a
+	 * current slab meanwhile.
+	 */
+	cpu = smp_processor_id();
+	if (s->cpu_slab[cpu])
+		flush_slab(s, s->cpu_slab[cpu], cpu);
+	slab_lock(page);
+	__SetSlabFrozen(page);
+	s->cpu_slab[cpu] = page;
+	goto load_freelist;
+}
+
+static __always_inline void *slab_alloc(struct kmem_cache *s,
+					gfp_t gfpflags, int node)
+{
+	struct page *page;
+	void **object;
+	unsigned long flags;
+
+	local_irq_save(flags);
+	page = s->cpu_slab[smp_processor_id()];
+	if (unlikely(!page || !page->lockless_freelist ||
+		     (node != -1 && page_to_nid(page) != node)))
+		object = __slab_alloc(s, gfpflags, node, page);
+	else {
+		object = page->lockless_freelist;
+		page->lockless_freelist = get_freepointer(s, object);
+	}
+	local_irq_restore(flags);
+	return object;
+}
+
+/*
+ * Slow path of the free: the object does not belong to the current slab
+ * of this cpu, so it goes to the free list of its slab under the slab
+ * lock. Called with interrupts disabled.
+ */
+static void __slab_free(struct kmem_cache *s, struct page *page, void *x)
+{
+	void *prior;
+	void **object = x;
+
+	slab_lock(page);
+	prior = page->freelist;
+	set_freepointer(s, object, prior);
+	page->freelist = object;
+	page->inuse--;
+
+	if (unlikely(SlabFrozen(page)))
+		goto out_unlock;
+
+	if (unlikely(!page->inuse))
+		goto slab_empty;
+
+	/*
+	 * The slab was full and on no list: now it has a free object
+	 * and goes on the partial list.
+	 */
+	if (unlikely(!prior))
+		add_partial(s, page);
+
+out_unlock:
+	slab_unlock(page);
+	return;
+
+slab_empty:
+	if (prior) {
+		if (get_node(s, page_to_nid(page))->nr_partial <= MIN_PARTIAL)
+			goto out_unlock;
+		remove_partial(s, page);
+	}
+	slab_unlock(page);
+	discard_slab(s, page);
+}
+
+static __always_inline void slab_free(struct kmem_cache *s,
+				      struct page *page, void *x)
+{
+	void **object = x;
+	unsigned long flags;
+
+	local_irq_save(flags);
+	if (likely(page == s->cpu_slab[smp_processor_id()])) {
+		set_freepointer(s, object, page->lockless_freelist);
+		page->lockless_freelist = object;
+	} else
+		__slab_free(s, page, x);
+	local_irq_restore(flags);
+}
+
+/**
+ * kmem_cache_alloc - Allocate an object
+ * @s: The cache to allocate from.
+ * @flags: See kmalloc().
+ *
+ * Allocate an object from this cache.  The flags are only relevant
+ * if the cache has no available objects.
+ */
+void *kmem_cache_alloc(struct kmem_cache *s, gfp_t flags)
+{
+	return slab_alloc(s, flags, -1);
+}
+EXPORT_SYMBOL(kmem_cache_alloc);
+
+/**
+ * kmem_cache_zalloc - Allocate an object. The memory is set to zero.
+ * @cache: The cache to allocate from.
+ * @flags: See kmalloc().
+ *
+ * Allocate an object from this cache and set the allocated memory to zero.
+ * The flags are only relevant if the cache has no available objects.
+ */
+void *kmem_cache_zalloc(struct kmem_cache *cache, gfp_t flags)
+{
+	void *ret = slab_alloc(cache, flags, -1);
+
+	if (ret)
+		memset(ret, 0, cache->objsize);
+	return ret;
+}
+EXPORT_SYMBOL(kmem_cache_zalloc);
+
+#ifdef CONFIG_NUMA
+/**
+ * kmem_cache_alloc_node - Allocate an object on the specified node
+ * @s: The cache to allocate from.
+ * @flags: See kmalloc().
+ * @node: node number of the target node.
+ *
+ * Identical to kmem_cache_alloc, except that the object comes from a
+ * slab on the given node.
+ */
+void *kmem_cache_alloc_node(struct kmem_cache *s, gfp_t flags, int node)
+{
+	return slab_alloc(s, flags, node);
+}
+EXPORT_SYMBOL(kmem_cache_alloc_node);
+#endif
+
+/**
+ * kmem_cache_free - Deallocate an object
+ * @s: The cache the allocation was from.
+ * @x: The previously allocated object.
+ *
+ * Free an object which was previously allocated from this
+ * cache.
+ */
+void kmem_cache_free(struct kmem_cache *s, void *x)
+{
+	struct page *page = virt_to_head_page(x);
+
+	BUG_ON(page->slab != s);
+	slab_free(s, page, x);
+}
+EXPORT_SYMBOL(kmem_cache_free);
+
+static inline struct kmem_cache *__find_general_cachep(size_t size,
+							gfp_t gfpflags)
+{
+	struct cache_sizes *csizep = malloc_sizes;
+
+	while (size > csizep->cs_size)
+		csizep++;
+
+	/*
+	 * The last entry with cs->cs_size==ULONG_MAX has
+	 * cs_{dma,}cachep==NULL, so large kmalloc calls fail
+	 * without a special case.
+	 */
+	if (unlikely(gfpflags & GFP_DMA))
+		return csizep->cs_dmacachep;
+	return csizep->cs_cachep;
+}
+
+struct kmem_cache *kmem_find_general_cachep(size_t size, gfp_t gfpflags)
+{
+	return __find_general_cachep(size, gfpflags);
+}
+EXPORT_SYMBOL(kmem_find_general_cachep);
+
+void *__kmalloc(size_t size, gfp_t flags)
+{
+	struct kmem_cache *s = __find_general_cachep(size, flags);
+
+	if (unlikely(s == NULL))
+		return NULL;
+	return slab_alloc(s, flags, -1);
+}
+EXPORT_SYMBOL(__kmalloc);
+
+#ifdef CONFIG_NUMA
+void *kmalloc_node(size_t size, gfp_t flags, int node)
+{
+	struct kmem_cache *s = __find_general_cachep(size, flags);
+
+	if (unlikely(s == NULL))
+		return NULL;
+	return slab_alloc(s, flags, node);
+}
+EXPORT_SYMBOL(kmalloc_node);
+#endif
+
+/**
+ * kfree - free previously allocated memory
+ * @x: pointer returned by kmalloc.
+ *
+ * If @x is NULL, no operation is performed.
+ *
+ * Don't free memory not originally allocated by kmalloc()
+ * or you will run into trouble.
+ */
+void kfree(const void *x)
+{
+	struct page *page;
+
+	if (unlikely(!x))
+		return;
+
+	page = virt_to_head_page(x);
+	debug_check_no_locks_freed(x, page->slab->objsize);
+	slab_free(page->slab, page, (void *)x);
+}
+EXPORT_SYMBOL(kfree);
+
+/**
+ * ksize - get the actual amount of memory allocated for a given object
+ * @x: Pointer to the object
+ *
+ * kmalloc may internally round up allocations and return more memory
+ * than requested. ksize() can be used to determine the actual amount of
+ * memory allocated. The caller may use this additional memory, even though
+ * a smaller amount of memory was initially specified with the kmalloc call.
+ * The caller must guarantee that x points to a valid object previously
+ * allocated with either kmalloc() or kmem_cache_alloc(). The object
+ * must not be freed during the duration of the call.
+ */
+unsigned int ksize(const void *x)
+{
+	if (unlikely(x == NULL))
+		return 0;
+
+	return virt_to_head_page(x)->slab->objsize;
+}
+
+/**
+ * kmem_ptr_validate - check if an untrusted pointer might
+ *	be a slab entry.
+ * @s: the cache we're checking against
+ * @ptr: pointer to validate
+ *
+ * This verifies that the untrusted pointer looks sane:
+ * it is _not_ a guarantee that the pointer is actually
+ * part of the slab cache in question, but it at least
+ * validates that the pointer can be dereferenced and
+ * looks half-way sane.
+ *
+ * Currently only used for dentry validation.
+ */
+int fastcall kmem_ptr_validate(struct kmem_cache *s, void *ptr)
+{
+	unsigned long addr = (unsigned long)ptr;
+	unsigned long size = s->size;
+	struct page *page;
+
+	if (unlikely(addr < PAGE_OFFSET))
+		return 0;
+	if (unlikely(addr > (unsigned long)high_memory - size))
+		return 0;
+	if (unlikely(addr & (sizeof(void *) - 1)))
+		return 0;
+	if (unlikely(!kern_addr_valid(addr)))
+		return 0;
+	if (unlikely(!kern_addr_valid(addr + size - 1)))
+		return 0;
+	page = virt_to_page(ptr);
+	if (unlikely(!PageSlab(page)))
+		return 0;
+	if (unlikely(page->slab != s))
+		return 0;
+	return 1;
+}
+
+unsigned int kmem_cache_size(struct kmem_cache *s)
+{
+	return s->objsize;
+}
+EXPORT_SYMBOL(kmem_cache_size);
+
+const char *kmem_cache_name(struct kmem_cache *s)
+{
+	return s->name;
+}
+EXPORT_SYMBOL_GPL(kmem_cache_name);
+
+/*
+ * Setup of the caches
+ */
+static void init_kmem_cache_node(struct kmem_cache_node *n)
+{
+	spin_lock_init(&n->list_lock);
+	n->nr_partial = 0;
+	atomic_long_set(&n->nr_slabs, 0);
+	INIT_LIST_HEAD(&n->partial);
+}
+
+#ifdef CONFIG_NUMA
+/*
+ * The node structures of kmem_node_cache come from kmem_node_cache:
+ * allocate its first slab on every node by hand and take the node
+ * structure for that node from it.
+ */
+static void __init early_kmem_cache_node_alloc(gfp_t gfpflags, int node)
+{
+	struct kmem_cache_node *n;
+	struct page *page;
+	unsigned long flags;
+
+	local_irq_save(flags);
+	page = new_slab(&kmem_node_cache, gfpflags, node);
+	local_irq_restore(flags);
+	if (!page)
+		panic("SLUB: Unable to allocate node structures for node %d\n",
+		      node);
+
+	n = page->freelist;
+	page->freelist = get_freepointer(&kmem_node_cache, n);
+	page->inuse++;
+	kmem_node_cache.node[node] = n;
+	init_kmem_cache_node(n);
+	atomic_long_inc(&n->nr_slabs);
+	n->nr_partial++;
+	list_add(&page->lru, &n->partial);
+}
+
+static void free_kmem_cache_nodes(struct kmem_cache *s)
+{
+	int node;
+
+	for_each_online_node(node) {
+		struct kmem_cache_node *n = s->node[node];
+
+		if (n)
+			kmem_cache_free(&kmem_node_cache, n);
+		s->node[node] = NULL;
+	}
+}
+
+static int init_kmem_cache_nodes(struct kmem_cache *s, gfp_t gfpflags)
+{
+	int node;
+
+	for_each_online_node(node) {
+		struct kmem_cache_node *n;
+
+		if (slab_state == DOWN) {
+			early_kmem_cache_node_alloc(gfpflags, node);
+			continue;
+		}
+		n = kmem_cache_alloc_node(&kmem_node_cache, gfpflags, node);
+		if (!n) {
+			free_kmem_cache_nodes(s);
+			return 0;
+		}
+		s->node[node] = n;
+		init_kmem_cache_node(n);
+	}
+	return 1;
+}
+#else
+static void free_kmem_cache_nodes(struct kmem_cache *s)
+{
+}
+
+static int init_kmem_cache_nodes(struct kmem_cache *s, gfp_t gfpflags)
+{
+	init_kmem_cache_node(&s->local_node);
+	return 1;
+}
+#endif
+
+/*
+ * The lowest order that holds slub_min_objects objects without wasting
+ * more than 1/8th of the slab, within slub_max_order unless a single
+ * object is bigger than that.
+ */
+static int calculate_order(int size)
+{
+	int order;
+	int rem;
+
+	for (order = max(slub_min_order, fls(size - 1) - PAGE_SHIFT);
+			order <= MAX_OBJ_ORDER; order++) {
+		unsigned long slab_size = PAGE_SIZE << order;
+
+		if (order < slub_max_order &&
+				slab_size < slub_min_objects * size)
+			continue;
+
+		if (slab_size < size)
+			continue;
+
+		if (order >= slub_max_order)
+			break;
+
+		rem = slab_size % size;
+		if (rem <= slab_size / 8)
+			break;
+	}
+	if (order > MAX_OBJ_ORDER)
+		return -E2BIG;
+
+	return order;
+}
+
+static unsigned long calculate_alignment(unsigned long flags,
+		unsigned long align, unsigned long size)
+{
+	unsigned long ralign = sizeof(void *);
+
+	if (flags & SLAB_MUST_HWCACHE_ALIGN)
+		ralign = cache_line_size();
+	else if (flags & SLAB_HWCACHE_ALIGN) {
+		/*
+		 * As SLAB: squeeze multiple small objects into one
+		 * cacheline.
+		 */
+		ralign = cache_line_size();
+		while (size <= ralign / 2)
+			ralign /= 2;
+	}
+	if (ralign < ARCH_SLAB_MINALIGN)
+		ralign = ARCH_SLAB_MINALIGN;
+	if (ralign < align)
+		ralign = align;
+
+	return ALIGN(ralign, sizeof(void *));
+}
+
+static int calculate_sizes(struct kmem_cache *s, unsigned long align)
+{
+	unsigned long size = ALIGN(s->objsize, sizeof(void *));
+
+	if ((s->flags & SLAB_DESTROY_BY_RCU) || s->ctor || s->dtor) {
+		/*
+		 * The free pointer goes behind the object if the object
+		 * has to keep its contents while it is free: constructed
+		 * objects, and objects that RCU readers may still look at.
+		 */
+		s->offset = size;
+		size += sizeof(void *);
+	} else
+		s->offset = 0;
+
+	size = ALIGN(size, calculate_alignment(s->flags, align, s->objsize));
+	s->size = size;
+
+	s->order = calculate_order(size);
+	if (s->order < 0)
+		return 0;
+
+	s->allocflags = 0;
+	if (s->flags & SLAB_CACHE_DMA)
+		s->allocflags |= GFP_DMA;
+	if (s->flags & SLAB_RECLAIM_ACCOUNT)
+		s->allocflags |= __GFP_RECLAIMABLE;
+
+	s->objects = (PAGE_SIZE << s->order) / size;
+	return s->objects != 0;
+}
+
+static int kmem_cache_open(struct kmem_cache *s, gfp_t gfpflags,
+		const char *name, size_t size, size_t align,
+		unsigned long flags,
+		void (*ctor)(void *, struct kmem_cache *, unsigned long),
+		void (*dtor)(void *, struct kmem_cache *, unsigned long))
+{
+	s->name = name;
+	s->ctor = ctor;
+	s->dtor = dtor;
+	s->objsize = size;
+	s->flags = flags;
+
+	if (calculate_sizes(s, align) && init_kmem_cache_nodes(s, gfpflags))
+		return 1;
+
+	if (flags & SLAB_PANIC)
+		panic("kmem_cache_create(): failed to create slab `%s'\n",
+		      name);
+	return 0;
+}
+
+/*
+ * Free the empty slabs on the partial lists, and return the number of
+ * slabs left in the cache.
+ */
+static unsigned long free_empty_slabs(struct kmem_cache *s)
+{
+	unsigned long slabs = 0;
+	int node;
+
+	for_each_online_node(node) {
+		struct kmem_cache_node *n = get_node(s, node);
+		struct page *page, *t;
+		unsigned long flags;
+
+		if (!n)
+			continue;
+
+		spin_lock_irqsave(&n->list_lock, flags);
+		list_for_each_entry_safe(page, t, &n->partial, lru) {
+			if (page->inuse || !slab_trylock(page))
+				continue;
+			list_del(&page->lru);
+			n->nr_partial--;
+			slab_unlock(page);
+			discard_slab(s, page);
+		}
+		spin_unlock_irqrestore(&n->list_lock, flags);
+		slabs += atomic_long_read(&n->nr_slabs);
+	}
+	return slabs;
+}
+
+/**
+ * kmem_cache_create - Create a cache.
+ * @name: A string which is used in /proc/slabinfo to identify this cache.
+ * @size: The size of objects to be created in this cache.
+ * @align: The required alignment for the objects.
+ * @flags: SLAB flags
+ * @ctor: A constructor for the objects.
+ * @dtor: A destructor for the objects.
+ *
+ * Returns a ptr to the cache on success, NULL on failure.
+ * Cannot be called within a int, but can be interrupted.
+ * The @ctor is run when new pages are allocated by the cache
+ * and the @dtor is run before the pages are handed back.
+ *
+ * @name must be valid until the cache is destroyed. This implies that
+ * the module calling this has to destroy the cache before getting unloaded.
+ *
+ * The flags are
+ *
+ * %SLAB_HWCACHE_ALIGN - Align the objects in this cache to a hardware
+ * cacheline.
+ *
+ * %SLAB_CACHE_DMA - Use GFP_DMA memory.
+ *
+ * %SLAB_PANIC - Panic if the cache cannot be created.
+ *
+ * %SLAB_DESTROY_BY_RCU - Free the pages of the cache after an RCU grace
+ * period.
+ *
+ * The debugging flags of SLAB are not supported.
+ */
+struct kmem_cache *
+kmem_cache_create(const char *name, size_t size, size_t align,
+	unsigned long flags,
+	void (*ctor)(void*, struct kmem_cache *, unsigned long),
+	void (*dtor)(void*, struct kmem_cache *, unsigned long))
+{
+	struct kmem_cache *s = NULL, *pc;
+
+	/*
+	 * Sanity checks... these are all serious usage bugs.
+	 */
+	if (!name || in_interrupt() || (size < sizeof(void *)) ||
+	    (size > (1 << MAX_OBJ_ORDER) * PAGE_SIZE) || (dtor && !ctor)) {
+		printk(KERN_ERR "%s: Early error in slab %s\n", __FUNCTION__,
+				name);
+		BUG();
+	}
+	if (flags & SLAB_DESTROY_BY_RCU)
+		BUG_ON(dtor);
+	BUG_ON(flags & ~CREATE_MASK);
+
+	mutex_lock(&slub_lock);
+
+	list_for_each_entry(pc, &slab_caches, list) {
+		mm_segment_t old_fs = get_fs();
+		char tmp;
+		int res;
+
+		/*
+		 * This happens when the module gets unloaded and doesn't
+		 * destroy its slab cache and no-one else reuses the vmalloc
+		 * area of the module.  Print a warning.
+		 */
+		set_fs(KERNEL_DS);
+		res = __get_user(tmp, pc->name);
+		set_fs(old_fs);
+		if (res) {
+			printk("SLUB: cache with size %d has lost its name\n",
+			       pc->objsize);
+			continue;
+		}
+
+		if (!strcmp(pc->name, name)) {
+			printk("kmem_cache_create: duplicate cache %s\n", name);
+			dump_stack();
+			goto oops;
+		}
+	}
+
+	s = kzalloc(sizeof(struct kmem_cache), GFP_KERNEL);
+	if (!s)
+		goto oops;
+
+	if (!kmem_cache_open(s, GFP_KERNEL, name, size, align, flags,
+			     ctor, dtor)) {
+		kfree(s);
+		s = NULL;
+		goto oops;
+	}
+
+	list_add(&s->list, &slab_caches);
+oops:
+	if (!s && (flags & SLAB_PANIC))
+		panic("kmem_cache_create(): failed to create slab `%s'\n",
+		      name);
+	mutex_unlock(&slub_lock);
+	return s;
+}
+EXPORT_SYMBOL(kmem_cache_create);
+
+/**
+ * kmem_cache_shrink - Shrink a cache.
+ * @s: The cache to shrink.
+ *
+ * Gives the current slabs of the cpus back and releases the empty
+ * slabs of the cache to the page allocator. Returns nonzero if slabs
+ * are left.
+ */
+int kmem_cache_shrink(struct kmem_cache *s)
+{
+	int ret;
+
+	BUG_ON(!s || in_interrupt());
+
+	lock_cpu_hotplug();
+	flush_all(s);
+	ret = free_empty_slabs(s) != 0;
+	unlock_cpu_hotplug();
+
+	return ret;
+}
+EXPORT_SYMBOL(kmem_cache_shrink);
+
+/**
+ * kmem_cache_destroy - delete a cache
+ * @s: the cache to destroy
+ *
+ * Remove a struct kmem_cache object from the slab cache.
+ * Returns 0 on success.
+ *
+ * It is expected this function will be called by a module when it is
+ * unloaded.  This will remove the cache completely, and avoid a duplicate
+ * cache being allocated each time a module is loaded and unloaded, if the
+ * module doesn't have persistent in-kernel storage across loads and unloads.
+ *
+ * The cache must be empty before calling this function.
+ *
+ * The caller must guarantee that noone will allocate memory from the cache
+ * during the kmem_cache_destroy().
+ */
+int kmem_cache_destroy(struct kmem_cache *s)
+{
+	BUG_ON(!s || in_interrupt());
+
+	/* Don't let CPUs to come and go */
+	lock_cpu_hotplug();
+
+	mutex_lock(&slub_lock);
+	list_del(&s->list);
+	mutex_unlock(&slub_lock);
+
+	flush_all(s);
+	if (free_empty_slabs(s)) {
+		printk(KERN_ERR "kmem_cache_destroy %s: Can't free all objects\n",
+		       s->name);
+		dump_stack();
+		mutex_lock(&slub_lock);
+		list_add(&s->list, &slab_caches);
+		mutex_unlock(&slub_lock);
+		unlock_cpu_hotplug();
+		return 1;
+	}
+
+	/* The slabs freed by RCU still look at the cache */
+	if (unlikely(s->flags & SLAB_DESTROY_BY_RCU))
+		rcu_barrier();
+
+	free_kmem_cache_nodes(s);
+	kfree(s);
+	unlock_cpu_hotplug();
+	return 0;
+}
+EXPORT_SYMBOL(kmem_cache_destroy);
+
+/*
+ * Give back the current slabs of a cpu that goes away.
+ */
+static int __cpuinit slab_cpuup_callback(struct notifier_block *nfb,
+				    unsigned long action, void *hcpu)
+{
+	long cpu = (long)hcpu;
+	struct kmem_cache *s;
+	unsigned long flags;
+
+	switch (action) {
+	case CPU_UP_CANCELED:
+	case CPU_DEAD:
+		mutex_lock(&slub_lock);
+		list_for_each_entry(s, &slab_caches, list) {
+			local_irq_save(flags);
+			__flush_cpu_slab(s, cpu);
+			local_irq_restore(flags);
+		}
+		mutex_unlock(&slub_lock);
+		break;
+	default:
+		break;
+	}
+	return NOTIFY_OK;
+}
+
+static struct notifier_block __cpuinitdata slab_notifier = {
+	&slab_cpuup_callback, NULL, 0
+};
+
+static int __init setup_slub_min_order(char *str)
+{
+	get_option(&str, &slub_min_order);
+	return 1;
+}
+__setup("slub_min_order=", setup_slub_min_order);
+
+static int __init setup_slub_max_order(char *str)
+{
+	get_option(&str, &slub_max_order);
+	return 1;
+}
+__setup("slub_max_order=", setup_slub_max_order);
+
+static int __init setup_slub_min_objects(char *str)
+{
+	get_option(&str, &slub_min_objects);
+	return 1;
+}
+__setup("slub_min_objects=", setup_slub_min_objects);
+
+/*
+ * Initialisation.  Called after the page allocator have been initialised and
+ * before smp_init().
+ */
+void __init kmem_cache_init(void)
+{
+	struct cache_sizes *sizes = malloc_sizes;
+	struct cache_names *names = cache_names;
+	struct kmem_cache *s = kmalloc_caches;
+
+#ifdef CONFIG_NUMA
+	kmem_cache_open(&kmem_node_cache, GFP_KERNEL, "kmem_cache_node",
+			sizeof(struct kmem_cache_node), 0, SLAB_PANIC,
+			NULL, NULL);
+	list_add(&kmem_node_cache.list, &slab_caches);
+#endif
+	slab_state = PARTIAL;
+
+	while (sizes->cs_size != ULONG_MAX) {
+		kmem_cache_open(s, GFP_KERNEL, names->name, sizes->cs_size,
+				ARCH_KMALLOC_MINALIGN, ARCH_KMALLOC_FLAGS | SLAB_PANIC,
+				NULL, NULL);
+		list_add(&s->list, &slab_caches);
+		sizes->cs_cachep = s++;
+
+		kmem_cache_open(s, GFP_KERNEL, names->name_dma, sizes->cs_size,
+				ARCH_KMALLOC_MINALIGN, ARCH_KMALLOC_FLAGS |
+				SLAB_CACHE_DMA | SLAB_PANIC, NULL, NULL);
+		list_add(&s->list, &slab_caches);
+		sizes->cs_dmacachep = s++;
+
+		sizes++;
+		names++;
+	}
+	slab_state = UP;
+
+	register_cpu_notifier(&slab_notifier);
+
+	printk(KERN_INFO "SLUB: Genslabs=%d, MinOrder=%d, MaxOrder=%d, "
+	       "MinObjects=%d, CPUs=%d, Nodes=%d\n",
+	       (int)(s - kmalloc_caches), slub_min_order, slub_max_order,
+	       slub_min_objects, num_possible_cpus(), num_online_nodes());
+}
+
+#ifdef CONFIG_SMP
+/**
+ * __alloc_percpu - allocate one copy of the object for every present
+ * cpu in the system, zeroing them.
+ * Objects should be dereferenced using the per_cpu_ptr macro only.
+ *
+ * @size: how many bytes of memory are required.
+ */
+void *__alloc_percpu(size_t size)
+{
+	int i;
+	struct percpu_data *pdata = kmalloc(sizeof(*pdata), GFP_KERNEL);
+
+	if (!pdata)
+		return NULL;
+
+	/*
+	 * Cannot use for_each_online_cpu since a cpu may come online
+	 * and we have no way of figuring out how to fix the array
+	 * that we have allocated then....
+	 */
+	for_each_possible_cpu(i) {
+		int node = cpu_to_node(i);
+
+		if (node_online(node))
+			pdata->ptrs[i] = kmalloc_node(size, GFP_KERNEL, node);
+		else
+			pdata->ptrs[i] = kmalloc(size, GFP_KERNEL);
+
+		if (!pdata->ptrs[i])
+			goto unwind_oom;
+		memset(pdata->ptrs[i], 0, size);
+	}
+
+	/* Catch derefs w/o wrappers */
+	return (void *)(~(unsigned long)pdata);
+
+unwind_oom:
+	while (--i >= 0) {
+		if (!cpu_possible(i))
+			continue;
+		kfree(pdata->ptrs[i]);
+	}
+	kfree(pdata);
+	return NULL;
+}
+EXPORT_SYMBOL(__alloc_percpu);
+
+/**
+ * free_percpu - free previously allocated percpu memory
+ * @objp: pointer returned by alloc_percpu.
+ *
+ * Don't free memory not originally allocated by alloc_percpu()
+ * The complemented objp is to check for that.
+ */
+void free_percpu(const void *objp)
+{
+	int i;
+	struct percpu_data *p = (struct percpu_data *)(~(unsigned long)objp);
+
+	/*
+	 * We allocate for all cpus so we cannot use for online cpu here.
+	 */
+	for_each_possible_cpu(i)
+	    kfree(p->ptrs[i]);
+	kfree(p);
+}
+EXPORT_SYMBOL(free_percpu);
+#endif
+
+#ifdef CONFIG_PROC_FS
+
+static void print_slabinfo_header(struct seq_file *m)
+{
+	/*
+	 * The format of SLAB, so that the existing tools keep working.
+	 * SLUB has no tunables and no shared caches.
+	 */
+	seq_puts(m, "slabinfo - version: 2.1\n");
+	seq_puts(m, "# name            <active_objs> <num_objs> <objsize> "
+		 "<objperslab> <pagesperslab>");
+	seq_puts(m, " : tunables <limit> <batchcount> <sharedfactor>");
+	seq_puts(m, " : slabdata <active_slabs> <num_slabs> <sharedavail>");
+	seq_putc(m, '\n');
+}
+
+static void *s_start(struct seq_file *m, loff_t *pos)
+{
+	loff_t n = *pos;
+	struct list_head *p;
+
+	mutex_lock(&slub_lock);
+	if (!n)
+		print_slabinfo_header(m);
+	p = slab_caches.next;
+	while (n--) {
+		p = p->next;
+		if (p == &slab_caches)
+			return NULL;
+	}
+	return list_entry(p, struct kmem_cache, list);
+}
+
+static void *s_next(struct seq_file *m, void *p, loff_t *pos)
+{
+	struct kmem_cache *s = p;
+	++*pos;
+	return s->list.next == &slab_caches ?
+		NULL : list_entry(s->list.next, struct kmem_cache, list);
+}
+
+static void s_stop(struct seq_file *m, void *p)
+{
+	mutex_unlock(&slub_lock);
+}
+
+/*
+ * The objects of the current slabs of the cpus are counted as in use.
+ */
+static int s_show(struct seq_file *m, void *p)
+{
+	struct kmem_cache *s = p;
+	unsigned long nr_slabs = 0, nr_partial = 0, partial_inuse = 0;
+	unsigned long nr_objs, nr_inuse;
+	int node;
+
+	for_each_online_node(node) {
+		struct kmem_cache_node *n = get_node(s, node);
+		struct page *page;
+		unsigned long flags;
+
+		if (!n)
+			continue;
+
+		spin_lock_irqsave(&n->list_lock, flags);
+		list_for_each_entry(page, &n->partial, lru) {
+			partial_inuse += page->inuse;
+			nr_partial++;
+		}
+		spin_unlock_irqrestore(&n->list_lock, flags);
+		nr_slabs += atomic_long_read(&n->nr_slabs);
+	}
+
+	nr_objs = nr_slabs * s->objects;
+	nr_inuse = (nr_slabs - nr_partial) * s->objects + partial_inuse;
+
+	seq_printf(m, "%-17s %6lu %6lu %6u %4u %4d", s->name, nr_inuse,
+		   nr_objs, s->size, s->objects, (1 << s->order));
+	seq_printf(m, " : tunables %4u %4u %4u", 0, 0, 0);
+	seq_printf(m, " : slabdata %6lu %6lu %6lu", nr_slabs, nr_slabs, 0UL);
+	seq_putc(m, '\n');
+	return 0;
+}
+
+/*
+ * slabinfo_op - iterator that generates /proc/slabinfo
+ *
+ * Output layout:
+ * cache-name
+ * num-active-objs
+ * total-objs
+ * object size
+ * objects per slab
+ * pages per slab
+ * : tunables (always 0)
+ * : slabdata active slabs, total slabs, shared objects (always 0)
+ */
+struct seq_operations slabinfo_op = {
+	.start = s_start,
+	.next = s_next,
+	.stop = s_stop,
+	.show = s_show,
+};
+
+#endif /* CONFIG_PROC_FS */
@@ -106,7 +106,8 @@ int rotate_reclaimable_page(struct page *page)
 	zone = page_zone(page);
 	spin_lock_irqsave(&zone->lru_lock, flags);
 	if (PageLRU(page) && !PageActive(page)) {
-		list_move_tail(&page->lru, &zone->inactive_list);
+		list_move_tail(&page->lru,
+			       &zone->lru[page_lru_base_type(page)].list);
 		__count_vm_event(PGROTATED);
 	}
 	if (!test_clear_page_writeback(page))
@@ -124,10 +125,16 @@ void fastcall activate_page(struct page *page)
 
 	spin_lock_irq(&zone->lru_lock);
 	if (PageLRU(page) && !PageActive(page)) {
-		del_page_from_inactive_list(zone, page);
+		int file = page_is_file_cache(page);
+		enum lru_list lru = page_lru_base_type(page);
+
+		del_page_from_lru_list(zone, page, lru);
 		SetPageActive(page);
-		add_page_to_active_list(zone, page);
+		add_page_to_lru_list(zone, page, lru + LRU_ACTIVE);
 		__count_vm_event(PGACTIVATE);
+
+		zone->recent_rotated[file]++;
+		zone->recent_scanned[file]++;
 	}
 	spin_unlock_irq(&zone->lru_lock);
 }
@@ -366,7 +373,8 @@ void __pagevec_lru_add(struct pagevec *pvec)
 		}
 		BUG_ON(PageLRU(page));
 		SetPageLRU(page);
-		add_page_to_inactive_list(zone, page);
+		add_page_to_lru_list(zone, page, page_lru_base_type(page));
+		zone->recent_scanned[page_is_file_cache(page)]++;
 	}
 	if (zone)
 		spin_unlock_irq(&zone->lru_lock);
@@ -395,7 +403,49 @@ void __pagevec_lru_add_active(struct pagevec *pvec)
 		SetPageLRU(page);
 		BUG_ON(PageActive(page));
 		SetPageActive(page);
-		add_page_to_active_list(zone, page);
+		add_page_to_lru_list(zone, page, page_lru(page));
+
+		/* new pages which start out active count as in use */
+		zone->recent_rotated[page_is_file_cache(page)]++;
+		zone->recent_scanned[page_is_file_cache(page)]++;
+	}
+	if (zone)
+		spin_unlock_irq(&zone->lru_lock);
+	release_pages(pvec->pages, pvec->nr, pvec->cold);
+	pagevec_reinit(pvec);
+}
+
+/*
+ * Move anonymous pages freed with MADV_FREE to the inactive file list,
+ * clearing PG_swapbacked: reclaim then drops them rather than swap them
+ * out, whether or not there is swap, unless they are written to again
+ * first.  Pages not on the LRU just now are left as they are.  Drops
+ * the caller's refcount on the pages.
+ */
+void __pagevec_lru_lazyfree(struct pagevec *pvec)
+{
+	int i;
+	struct zone *zone = NULL;
+
+	for (i = 0; i < pagevec_count(pvec); i++) {
+		struct page *page = pvec->pages[i];
+		struct zone *pagezone = page_zone(page);
+
+		if (pagezone != zone) {
+			if (zone)
+				spin_unlock_irq(&zone->lru_lock);
+			zone = pagezone;
+			spin_lock_irq(&zone->lru_lock);
+		}
+		if (PageLRU(page) && PageSwapBacked(page) &&
+		    !PageSwapCache(page)) {
+			del_page_from_lru_list(zone, page, page_lru(page));
+			ClearPageActive(page);
+			ClearPageReferenced(page);
+			ClearPageSwapBacked(page);
+			add_page_to_lru_list(zone, page, LRU_INACTIVE_FILE);
+			__count_vm_event(PGLAZYFREE);
+		}
 	}
 	if (zone)
 		spin_unlock_irq(&zone->lru_lock);
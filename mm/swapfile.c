@@ -7,6 +7,7 @@
 
 #include <linux/mm.h>
 #include <linux/hugetlb.h>
+#include <linux/huge_mm.h>
 #include <linux/mman.h>
 #include <linux/slab.h>
 #include <linux/kernel_stat.h>
@@ -84,6 +85,83 @@ void swap_unplug_io_fn(struct backing_dev_info *unused_bdi, struct page *page)
 #define SWAPFILE_CLUSTER	256
 #define LATENCY_LIMIT		256
 
+static inline struct swap_cluster_info *
+offset_to_cluster(struct swap_info_struct *si, unsigned long offset)
+{
+	return &si->cluster_info[offset / SWAPFILE_CLUSTER];
+}
+
+/*
+ * A slot is being allocated: its cluster is no longer free.
+ * Caller holds swap_lock.
+ */
+static void inc_cluster_info_page(struct swap_info_struct *si,
+				  unsigned long offset)
+{
+	struct swap_cluster_info *ci;
+
+	if (!si->cluster_info)
+		return;
+	ci = offset_to_cluster(si, offset);
+	if (!ci->count++)
+		list_del_init(&ci->list);
+}
+
+/*
+ * A slot has been freed: once nothing in its cluster is in use, the
+ * cluster goes to the back of the free list, so that it is reused last.
+ * Caller holds swap_lock.
+ */
+static void dec_cluster_info_page(struct swap_info_struct *si,
+				  unsigned long offset)
+{
+	struct swap_cluster_info *ci;
+
+	if (!si->cluster_info)
+		return;
+	ci = offset_to_cluster(si, offset);
+	BUG_ON(!ci->count);
+	if (!--ci->count)
+		list_add_tail(&ci->list, &si->free_clusters);
+}
+
+/*
+ * Find a slot in this cpu's current cluster, following on from its last
+ * allocation, or else in a fresh cluster off the free list.  Returns 0
+ * when there is no free cluster left.  Caller holds swap_lock.
+ */
+static unsigned long scan_swap_map_cluster(struct swap_info_struct *si)
+{
+	struct percpu_cluster *pc;
+	struct swap_cluster_info *ci;
+	unsigned long offset, end;
+
+	pc = per_cpu_ptr(si->percpu_cluster, smp_processor_id());
+	for (;;) {
+		if (!pc->next) {
+			if (list_empty(&si->free_clusters))
+				return 0;
+			ci = list_entry(si->free_clusters.next,
+					struct swap_cluster_info, list);
+			list_del_init(&ci->list);
+			/* cluster 0 holds the header, so is never free */
+			pc->next = (ci - si->cluster_info) * SWAPFILE_CLUSTER;
+		}
+
+		offset = pc->next;
+		end = (offset / SWAPFILE_CLUSTER + 1) * SWAPFILE_CLUSTER;
+		if (end > si->max)
+			end = si->max;
+		while (offset < end && si->swap_map[offset])
+			offset++;
+		if (offset < end) {
+			pc->next = offset + 1 < end ? offset + 1 : 0;
+			return offset;
+		}
+		pc->next = 0;
+	}
+}
+
 static inline unsigned long scan_swap_map(struct swap_info_struct *si)
 {
 	unsigned long offset, last_in_cluster;
@@ -100,6 +178,15 @@ static inline unsigned long scan_swap_map(struct swap_info_struct *si)
 	 */
 
 	si->flags += SWP_SCANNING;
+	if (si->cluster_info) {
+		if (!(si->flags & SWP_WRITEOK) || !si->highest_bit)
+			goto no_page;
+		offset = scan_swap_map_cluster(si);
+		if (offset)
+			goto checks;
+		/* No free cluster left: take the first free slot */
+		goto cluster;
+	}
 	if (unlikely(!si->cluster_nr)) {
 		si->cluster_nr = SWAPFILE_CLUSTER - 1;
 		if (si->pages - si->inuse_pages < SWAPFILE_CLUSTER)
@@ -147,6 +234,7 @@ checks:	if (!(si->flags & SWP_WRITEOK))
 			si->highest_bit = 0;
 		}
 		si->swap_map[offset] = 1;
+		inc_cluster_info_page(si, offset);
 		si->cluster_next = offset + 1;
 		si->flags -= SWP_SCANNING;
 		return offset;
@@ -276,6 +364,13 @@ static int swap_entry_free(struct swap_info_struct *p, unsigned long offset)
 		count--;
 		p->swap_map[offset] = count;
 		if (!count) {
+			dec_cluster_info_page(p, offset);
+			if (p->flags & SWP_BLKDEV) {
+				struct gendisk *disk = p->bdev->bd_disk;
+				if (disk->fops->swap_slot_free_notify)
+					disk->fops->swap_slot_free_notify(p->bdev,
+									  offset);
+			}
 			if (offset < p->lowest_bit)
 				p->lowest_bit = offset;
 			if (offset > p->highest_bit)
@@ -366,21 +461,24 @@ int remove_exclusive_swap_page(struct page *page)
 	/* Is the only swap cache user the cache itself? */
 	retval = 0;
 	if (p->swap_map[swp_offset(entry)] == 1) {
-		/* Recheck the page count with the swapcache lock held.. */
+		/*
+		 * Recheck the page count with the swapcache lock held,
+		 * freezing it so lockless lookups cannot take a new
+		 * reference meanwhile.
+		 */
 		write_lock_irq(&swapper_space.tree_lock);
-		if ((page_count(page) == 2) && !PageWriteback(page)) {
+		if (!PageWriteback(page) && page_freeze_refs(page, 2)) {
 			__delete_from_swap_cache(page);
 			SetPageDirty(page);
+			page_unfreeze_refs(page, 1);	/* swapcache ref */
 			retval = 1;
 		}
 		write_unlock_irq(&swapper_space.tree_lock);
 	}
 	spin_unlock(&swap_lock);
 
-	if (retval) {
+	if (retval)
 		swap_free(entry);
-		page_cache_release(page);
-	}
 
 	return retval;
 }
@@ -537,6 +635,8 @@ static inline int unuse_pmd_range(struct vm_area_struct *vma, pud_t *pud,
 	pmd = pmd_offset(pud, addr);
 	do {
 		next = pmd_addr_end(addr, end);
+		if (pmd_trans_huge(*pmd))
+			continue;	/* maps no swap entries */
 		if (pmd_none_or_clear_bad(pmd))
 			continue;
 		if (unuse_pte_range(vma, pmd, addr, next, entry, page))
@@ -1139,6 +1239,8 @@ asmlinkage long sys_swapoff(const char __user * specialfile)
 {
 	struct swap_info_struct * p = NULL;
 	unsigned short *swap_map;
+	struct swap_cluster_info *cluster_info;
+	struct percpu_cluster *percpu_cluster;
 	struct file *swap_file, *victim;
 	struct address_space *mapping;
 	struct inode *inode;
@@ -1241,10 +1343,17 @@ asmlinkage long sys_swapoff(const char __user * specialfile)
 	p->max = 0;
 	swap_map = p->swap_map;
 	p->swap_map = NULL;
+	cluster_info = p->cluster_info;
+	p->cluster_info = NULL;
+	percpu_cluster = p->percpu_cluster;
+	p->percpu_cluster = NULL;
 	p->flags = 0;
 	spin_unlock(&swap_lock);
 	mutex_unlock(&swapon_mutex);
 	vfree(swap_map);
+	vfree(cluster_info);
+	if (percpu_cluster)
+		free_percpu(percpu_cluster);
 	inode = mapping->host;
 	if (S_ISBLK(inode->i_mode)) {
 		struct block_device *bdev = I_BDEV(inode);
@@ -1356,6 +1465,45 @@ static int __init procswaps_init(void)
 __initcall(procswaps_init);
 #endif /* CONFIG_PROC_FS */
 
+/*
+ * Count the slots in use (the header and bad pages) per cluster, and put
+ * the clusters with none on the free list.
+ */
+static int setup_swap_clusters(struct swap_info_struct *p)
+{
+	unsigned long nr_clusters, i;
+	int cpu;
+
+	nr_clusters = (p->max + SWAPFILE_CLUSTER - 1) / SWAPFILE_CLUSTER;
+	p->cluster_info = vmalloc(nr_clusters * sizeof(struct swap_cluster_info));
+	if (!p->cluster_info)
+		return -ENOMEM;
+	p->percpu_cluster = alloc_percpu(struct percpu_cluster);
+	if (!p->percpu_cluster) {
+		vfree(p->cluster_info);
+		p->cluster_info = NULL;
+		return -ENOMEM;
+	}
+	for_each_possible_cpu(cpu)
+		per_cpu_ptr(p->percpu_cluster, cpu)->next = 0;
+
+	INIT_LIST_HEAD(&p->free_clusters);
+	for (i = 0; i < nr_clusters; i++) {
+		INIT_LIST_HEAD(&p->cluster_info[i].list);
+		p->cluster_info[i].count = 0;
+	}
+	for (i = 0; i < p->max; i++) {
+		if (p->swap_map[i])
+			p->cluster_info[i / SWAPFILE_CLUSTER].count++;
+	}
+	for (i = 0; i < nr_clusters; i++) {
+		if (!p->cluster_info[i].count)
+			list_add_tail(&p->cluster_info[i].list,
+				      &p->free_clusters);
+	}
+	return 0;
+}
+
 /*
  * Written 01/25/92 by Simmule Turner, heavily changed by Linus.
  *
@@ -1380,6 +1528,8 @@ asmlinkage long sys_swapon(const char __user * specialfile, int swap_flags)
 	unsigned long maxpages = 1;
 	int swapfilesize;
 	unsigned short *swap_map;
+	struct swap_cluster_info *cluster_info;
+	struct percpu_cluster *percpu_cluster;
 	struct page *page = NULL;
 	struct inode *inode = NULL;
 	int did_down = 0;
@@ -1406,6 +1556,8 @@ asmlinkage long sys_swapon(const char __user * specialfile, int swap_flags)
 	p->lowest_bit = 0;
 	p->highest_bit = 0;
 	p->cluster_nr = 0;
+	p->cluster_info = NULL;
+	p->percpu_cluster = NULL;
 	p->inuse_pages = 0;
 	p->next = -1;
 	if (swap_flags & SWAP_FLAG_PREFER) {
@@ -1583,6 +1735,10 @@ asmlinkage long sys_swapon(const char __user * specialfile, int swap_flags)
 			goto bad_swap;
 		}
 		nr_good_pages = p->pages;
+
+		error = setup_swap_clusters(p);
+		if (error)
+			goto bad_swap;
 	}
 	if (!nr_good_pages) {
 		printk(KERN_WARNING "Empty swap-file\n");
@@ -1593,6 +1749,8 @@ asmlinkage long sys_swapon(const char __user * specialfile, int swap_flags)
 	mutex_lock(&swapon_mutex);
 	spin_lock(&swap_lock);
 	p->flags = SWP_ACTIVE;
+	if (S_ISBLK(inode->i_mode))
+		p->flags |= SWP_BLKDEV;
 	nr_swap_pages += nr_good_pages;
 	total_swap_pages += nr_good_pages;
 
@@ -1628,13 +1786,20 @@ bad_swap:
 bad_swap_2:
 	spin_lock(&swap_lock);
 	swap_map = p->swap_map;
+	cluster_info = p->cluster_info;
+	percpu_cluster = p->percpu_cluster;
 	p->swap_file = NULL;
 	p->swap_map = NULL;
+	p->cluster_info = NULL;
+	p->percpu_cluster = NULL;
 	p->flags = 0;
 	if (!(swap_flags & SWAP_FLAG_PREFER))
 		++least_priority;
 	spin_unlock(&swap_lock);
 	vfree(swap_map);
+	vfree(cluster_info);
+	if (percpu_cluster)
+		free_percpu(percpu_cluster);
 	if (swap_file)
 		filp_close(swap_file, NULL);
 out:
@@ -12,8 +12,10 @@
 #include <linux/module.h>
 #include <linux/pagemap.h>
 #include <linux/pagevec.h>
+#include <linux/backing-dev.h>
 #include <linux/buffer_head.h>	/* grr. try_to_release_page,
 				   do_invalidatepage */
+#include <linux/task_io_accounting_ops.h>
 
 
 static inline void truncate_partial_page(struct page *page, unsigned partial)
@@ -42,6 +44,9 @@ truncate_complete_page(struct address_space *mapping, struct page *page)
 	if (PagePrivate(page))
 		do_invalidatepage(page, 0);
 
+	/* the write accounted when the page was dirtied will not happen */
+	if (PageDirty(page) && mapping_cap_account_dirty(mapping))
+		task_io_account_cancelled_write(PAGE_CACHE_SIZE);
 	clear_page_dirty(page);
 	ClearPageUptodate(page);
 	ClearPageMappedToDisk(page);
@@ -70,14 +75,15 @@ invalidate_complete_page(struct address_space *mapping, struct page *page)
 	write_lock_irq(&mapping->tree_lock);
 	if (PageDirty(page))
 		goto failed;
-	if (page_count(page) != 2)	/* caller's ref + pagecache ref */
+	/* caller's ref + pagecache ref, frozen against lockless lookups */
+	if (!page_freeze_refs(page, 2))
 		goto failed;
 
 	BUG_ON(PagePrivate(page));
 	__remove_from_page_cache(page);
 	write_unlock_irq(&mapping->tree_lock);
 	ClearPageUptodate(page);
-	page_cache_release(page);	/* pagecache ref */
+	page_unfreeze_refs(page, 1);	/* pagecache ref */
 	return 1;
 failed:
 	write_unlock_irq(&mapping->tree_lock);
@@ -14,6 +14,11 @@
 #include <linux/slab.h>
 #include <linux/spinlock.h>
 #include <linux/interrupt.h>
+#include <linux/rbtree.h>
+#include <linux/radix-tree.h>
+#include <linux/bitmap.h>
+#include <linux/percpu.h>
+#include <linux/err.h>
 
 #include <linux/vmalloc.h>
 
@@ -24,6 +29,8 @@
 DEFINE_RWLOCK(vmlist_lock);
 struct vm_struct *vmlist;
 
+/*** Page table manipulation functions ***/
+
 static void vunmap_pte_range(pmd_t *pmd, unsigned long addr, unsigned long end)
 {
 	pte_t *pte;
@@ -65,23 +72,33 @@ static inline void vunmap_pud_range(pgd_t *pgd, unsigned long addr,
 	} while (pud++, addr = next, addr != end);
 }
 
-void unmap_vm_area(struct vm_struct *area)
+/*
+ * Clear the kernel ptes of [addr, end).  The caller is responsible for
+ * the cache flush before and the TLB flush after.
+ */
+static void vunmap_page_range(unsigned long addr, unsigned long end)
 {
 	pgd_t *pgd;
 	unsigned long next;
-	unsigned long addr = (unsigned long) area->addr;
-	unsigned long end = addr + area->size;
 
 	BUG_ON(addr >= end);
 	pgd = pgd_offset_k(addr);
-	flush_cache_vunmap(addr, end);
 	do {
 		next = pgd_addr_end(addr, end);
 		if (pgd_none_or_clear_bad(pgd))
 			continue;
 		vunmap_pud_range(pgd, addr, next);
 	} while (pgd++, addr = next, addr != end);
-	flush_tlb_kernel_range((unsigned long) area->addr, end);
+}
+
+void unmap_vm_area(struct vm_struct *area)
+{
+	unsigned long addr = (unsigned long) area->addr;
+	unsigned long end = addr + area->size;
+
+	flush_cache_vunmap(addr, end);
+	vunmap_page_range(addr, end);
+	flush_tlb_kernel_range(addr, end);
 }
 
 static int vmap_pte_range(pmd_t *pmd, unsigned long addr,
@@ -137,13 +154,13 @@ static inline int vmap_pud_range(pgd_t *pgd, unsigned long addr,
 	return 0;
 }
 
-int map_vm_area(struct vm_struct *area, pgprot_t prot, struct page ***pages)
+static int vmap_page_range(unsigned long start, unsigned long end,
+			pgprot_t prot, struct page ***pages)
 {
 	pgd_t *pgd;
 	unsigned long next;
-	unsigned long addr = (unsigned long) area->addr;
-	unsigned long end = addr + area->size - PAGE_SIZE;
-	int err;
+	unsigned long addr = start;
+	int err = 0;
 
 	BUG_ON(addr >= end);
 	pgd = pgd_offset_k(addr);
@@ -153,16 +170,737 @@ int map_vm_area(struct vm_struct *area, pgprot_t prot, struct page ***pages)
 		if (err)
 			break;
 	} while (pgd++, addr = next, addr != end);
-	flush_cache_vmap((unsigned long) area->addr, end);
+	flush_cache_vmap(start, end);
 	return err;
 }
 
+int map_vm_area(struct vm_struct *area, pgprot_t prot, struct page ***pages)
+{
+	unsigned long addr = (unsigned long) area->addr;
+	unsigned long end = addr + area->size - PAGE_SIZE;
+
+	return vmap_page_range(addr, end, prot, pages);
+}
+
+/*** Global kva allocator ***/
+
+/*
+ * Every range of kernel virtual address handed out, whether it backs a
+ * vm_struct or a per-cpu vmap block, is a vmap_area.  They are indexed
+ * by address in an rbtree and also kept on an address sorted list, so
+ * that the search for a free range can start from the rbtree and step
+ * to the next area without walking everything below it.
+ *
+ * Freed areas are not given back straight away: their ptes are cleared,
+ * but the address range stays reserved on vmap_purge_list until enough
+ * has built up to be worth a single TLB flush of the lot.
+ */
+#define VM_VM_AREA	0x01	/* ->private is a vm_struct on vmlist */
+
+struct vmap_area {
+	unsigned long va_start;
+	unsigned long va_end;
+	unsigned long flags;
+	struct rb_node rb_node;		/* address sorted rbtree */
+	struct list_head list;		/* address sorted list */
+	struct list_head purge_list;	/* vmap_purge_list */
+	void *private;
+};
+
+static DEFINE_SPINLOCK(vmap_area_lock);
+static struct rb_root vmap_area_root = RB_ROOT;
+static LIST_HEAD(vmap_area_list);
+static LIST_HEAD(vmap_purge_list);
+static atomic_t vmap_lazy_nr = ATOMIC_INIT(0);
+
+/*
+ * Free area cache: the area just below the last allocation, and the
+ * largest hole skipped on the way to it.  An allocation no bigger than
+ * that hole, or with a different start or alignment, searches from the
+ * bottom again; otherwise it carries on from here.
+ */
+static struct rb_node *free_vmap_cache;
+static unsigned long cached_hole_size;
+static unsigned long cached_vstart;
+static unsigned long cached_align;
+
+static struct vmap_area *__find_vmap_area(unsigned long addr)
+{
+	struct rb_node *n = vmap_area_root.rb_node;
+
+	while (n) {
+		struct vmap_area *va;
+
+		va = rb_entry(n, struct vmap_area, rb_node);
+		if (addr < va->va_start)
+			n = n->rb_left;
+		else if (addr >= va->va_end)
+			n = n->rb_right;
+		else
+			return va;
+	}
+
+	return NULL;
+}
+
+static void __insert_vmap_area(struct vmap_area *va)
+{
+	struct rb_node **p = &vmap_area_root.rb_node;
+	struct rb_node *parent = NULL;
+	struct rb_node *tmp;
+
+	while (*p) {
+		struct vmap_area *tmp_va;
+
+		parent = *p;
+		tmp_va = rb_entry(parent, struct vmap_area, rb_node);
+		if (va->va_start < tmp_va->va_end)
+			p = &(*p)->rb_left;
+		else if (va->va_end > tmp_va->va_start)
+			p = &(*p)->rb_right;
+		else
+			BUG();
+	}
+
+	rb_link_node(&va->rb_node, parent, p);
+	rb_insert_color(&va->rb_node, &vmap_area_root);
+
+	/* keep the list address sorted, it is walked like the vmlist */
+	tmp = rb_prev(&va->rb_node);
+	if (tmp) {
+		struct vmap_area *prev;
+		prev = rb_entry(tmp, struct vmap_area, rb_node);
+		list_add(&va->list, &prev->list);
+	} else
+		list_add(&va->list, &vmap_area_list);
+}
+
+static void purge_vmap_area_lazy(void);
+
+/*
+ * Allocate a region of KVA of the specified size and alignment, within
+ * the vstart and vend.
+ */
+static struct vmap_area *alloc_vmap_area(unsigned long size,
+				unsigned long align,
+				unsigned long vstart, unsigned long vend,
+				int node, gfp_t gfp_mask)
+{
+	struct vmap_area *va;
+	struct rb_node *n;
+	unsigned long addr;
+	int purged = 0;
+	struct vmap_area *first;
+
+	BUG_ON(!size);
+	BUG_ON(size & ~PAGE_MASK);
+
+	va = kmalloc_node(sizeof(struct vmap_area),
+			gfp_mask & ~__GFP_HIGHMEM, node);
+	if (unlikely(!va))
+		return ERR_PTR(-ENOMEM);
+
+retry:
+	spin_lock(&vmap_area_lock);
+	if (!free_vmap_cache ||
+			size < cached_hole_size ||
+			vstart < cached_vstart ||
+			align < cached_align) {
+nocache:
+		cached_hole_size = 0;
+		free_vmap_cache = NULL;
+	}
+	cached_vstart = vstart;
+	cached_align = align;
+
+	if (free_vmap_cache) {
+		first = rb_entry(free_vmap_cache, struct vmap_area, rb_node);
+		addr = ALIGN(first->va_end, align);
+		if (addr < vstart)
+			goto nocache;
+		if (addr + size - 1 < addr)
+			goto overflow;
+	} else {
+		addr = ALIGN(vstart, align);
+		if (addr + size - 1 < addr)
+			goto overflow;
+
+		/* find the lowest area ending at or above addr */
+		n = vmap_area_root.rb_node;
+		first = NULL;
+		while (n) {
+			struct vmap_area *tmp;
+
+			tmp = rb_entry(n, struct vmap_area, rb_node);
+			if (tmp->va_end >= addr) {
+				first = tmp;
+				if (tmp->va_start <= addr)
+					break;
+				n = n->rb_left;
+			} else
+				n = n->rb_right;
+		}
+
+		if (!first)
+			goto found;
+	}
+
+	/* from there, step up the list until a hole is big enough */
+	while (addr + size > first->va_start && addr + size <= vend) {
+		if (addr + cached_hole_size < first->va_start)
+			cached_hole_size = first->va_start - addr;
+		addr = ALIGN(first->va_end, align);
+		if (addr + size - 1 < addr)
+			goto overflow;
+
+		if (first->list.next == &vmap_area_list)
+			goto found;
+		first = list_entry(first->list.next, struct vmap_area, list);
+	}
+
+found:
+	if (addr + size > vend)
+		goto overflow;
+
+	va->va_start = addr;
+	va->va_end = addr + size;
+	va->flags = 0;
+	va->private = NULL;
+	__insert_vmap_area(va);
+	free_vmap_cache = &va->rb_node;
+	spin_unlock(&vmap_area_lock);
+
+	return va;
+
+overflow:
+	spin_unlock(&vmap_area_lock);
+	if (!purged) {
+		/* lazily freed areas may be holding the space we need */
+		purge_vmap_area_lazy();
+		purged = 1;
+		goto retry;
+	}
+	if (printk_ratelimit())
+		printk(KERN_WARNING "allocation failed: out of vmalloc space - use vmalloc=<size> to increase size.\n");
+	kfree(va);
+	return ERR_PTR(-EBUSY);
+}
+
+static void __free_vmap_area(struct vmap_area *va)
+{
+	/*
+	 * A hole opening below the cached area has to be found by the
+	 * next search, so move the cache down to it.
+	 */
+	if (free_vmap_cache) {
+		if (va->va_end < cached_vstart) {
+			free_vmap_cache = NULL;
+		} else {
+			struct vmap_area *cache;
+			cache = rb_entry(free_vmap_cache, struct vmap_area, rb_node);
+			if (va->va_start <= cache->va_start)
+				free_vmap_cache = rb_prev(&va->rb_node);
+		}
+	}
+	rb_erase(&va->rb_node, &vmap_area_root);
+	list_del(&va->list);
+	kfree(va);
+}
+
+/*
+ * How much KVA may sit lazily freed before it is purged.  A purge costs
+ * one TLB flush IPI to every cpu, so allow more with more cpus.
+ */
+static unsigned long lazy_max_pages(void)
+{
+	unsigned int log;
+
+	log = fls(num_online_cpus());
+
+	return log * (32UL * 1024 * 1024 / PAGE_SIZE);
+}
+
+/*
+ * Purge the lazily freed areas: flush the TLB once over the span of
+ * them all (widened by [*start, *end) from the caller), and only then
+ * give their addresses back.
+ *
+ * If sync is 0, give up when someone else is already purging.  If
+ * force_flush is 1, flush [*start, *end) even with nothing on the list.
+ */
+static void __purge_vmap_area_lazy(unsigned long *start, unsigned long *end,
+					int sync, int force_flush)
+{
+	static DEFINE_SPINLOCK(purge_lock);
+	LIST_HEAD(valist);
+	struct vmap_area *va, *n;
+	int nr = 0;
+
+	/*
+	 * A sync caller must wait for a purge in progress, whose flush
+	 * may not have covered what it has to see gone yet.
+	 */
+	if (!sync && !force_flush) {
+		if (!spin_trylock(&purge_lock))
+			return;
+	} else
+		spin_lock(&purge_lock);
+
+	spin_lock(&vmap_area_lock);
+	list_splice_init(&vmap_purge_list, &valist);
+	spin_unlock(&vmap_area_lock);
+
+	list_for_each_entry(va, &valist, purge_list) {
+		if (va->va_start < *start)
+			*start = va->va_start;
+		if (va->va_end > *end)
+			*end = va->va_end;
+		nr += (va->va_end - va->va_start) >> PAGE_SHIFT;
+	}
+
+	if (nr)
+		atomic_sub(nr, &vmap_lazy_nr);
+
+	if (nr || force_flush)
+		flush_tlb_kernel_range(*start, *end);
+
+	if (nr) {
+		spin_lock(&vmap_area_lock);
+		list_for_each_entry_safe(va, n, &valist, purge_list)
+			__free_vmap_area(va);
+		spin_unlock(&vmap_area_lock);
+	}
+	spin_unlock(&purge_lock);
+}
+
+/*
+ * Kick off a purge of the outstanding lazy areas.  Don't bother if
+ * somebody is already purging.
+ */
+static void try_purge_vmap_area_lazy(void)
+{
+	unsigned long start = ULONG_MAX, end = 0;
+
+	__purge_vmap_area_lazy(&start, &end, 0, 0);
+}
+
+/*
+ * Kick off a purge of the outstanding lazy areas.
+ */
+static void purge_vmap_area_lazy(void)
+{
+	unsigned long start = ULONG_MAX, end = 0;
+
+	__purge_vmap_area_lazy(&start, &end, 1, 0);
+}
+
+/*
+ * Queue an area whose ptes have already been cleared for freeing at
+ * the next purge.
+ */
+static void free_vmap_area_noflush(struct vmap_area *va)
+{
+	spin_lock(&vmap_area_lock);
+	list_add_tail(&va->purge_list, &vmap_purge_list);
+	spin_unlock(&vmap_area_lock);
+
+	atomic_add((va->va_end - va->va_start) >> PAGE_SHIFT, &vmap_lazy_nr);
+	if (unlikely(atomic_read(&vmap_lazy_nr) > lazy_max_pages()))
+		try_purge_vmap_area_lazy();
+}
+
+/*
+ * Unmap an area and queue it for freeing.  Its TLB entries go at the
+ * next purge, until then the address range cannot be reused.
+ */
+static void free_unmap_vmap_area(struct vmap_area *va)
+{
+	flush_cache_vunmap(va->va_start, va->va_end);
+	vunmap_page_range(va->va_start, va->va_end);
+	free_vmap_area_noflush(va);
+}
+
+static struct vmap_area *find_vmap_area(unsigned long addr)
+{
+	struct vmap_area *va;
+
+	spin_lock(&vmap_area_lock);
+	va = __find_vmap_area(addr);
+	spin_unlock(&vmap_area_lock);
+
+	return va;
+}
+
+static void free_unmap_vmap_area_addr(unsigned long addr)
+{
+	struct vmap_area *va;
+
+	va = find_vmap_area(addr);
+	BUG_ON(!va || va->va_start != addr);
+	free_unmap_vmap_area(va);
+}
+
+/*** Per cpu kva allocator ***/
+
+/*
+ * vm_map_ram() mappings of up to VMAP_MAX_ALLOC pages are carved out of
+ * per-cpu vmap blocks, so that the global vmap_area_lock and rbtree are
+ * only taken once per block rather than once per mapping.  A block is
+ * never reused piecemeal: a freed range is unmapped and marked dirty,
+ * and the whole block goes back to the global allocator, lazily, once
+ * every range in it has been.
+ */
+#define VMAP_MAX_ALLOC		BITS_PER_LONG	/* 256K with 4K pages */
+
+#if BITS_PER_LONG == 64
+#define VMAP_BBMAP_BITS		1024	/* 4MB blocks with 4K pages */
+#else
+#define VMAP_BBMAP_BITS		128	/* the 32bit vmalloc space is small */
+#endif
+
+#define VMAP_BLOCK_SIZE		(VMAP_BBMAP_BITS * PAGE_SIZE)
+
+struct vmap_block_queue {
+	spinlock_t lock;
+	struct list_head free;		/* blocks with space left */
+};
+
+struct vmap_block {
+	spinlock_t lock;		/* protects the dirty state */
+	struct vmap_area *va;
+	struct vmap_block_queue *vbq;
+	unsigned long free;		/* pages never yet handed out */
+	unsigned long dirty;		/* pages handed out and unmapped */
+	unsigned long dirty_min;	/* unflushed dirty range, in pages */
+	unsigned long dirty_max;
+	DECLARE_BITMAP(used_map, VMAP_BBMAP_BITS);
+	struct list_head free_list;	/* on vbq->free */
+	struct list_head list;		/* on vmap_block_list */
+};
+
+/* Queue of free and dirty vmap blocks, for allocation and flushing purposes */
+static DEFINE_PER_CPU(struct vmap_block_queue, vmap_block_queue);
+
+/*
+ * Every vmap block, indexed by address for vb_free() and listed for
+ * vm_unmap_aliases(), under vmap_block_tree_lock.
+ */
+static DEFINE_SPINLOCK(vmap_block_tree_lock);
+static RADIX_TREE(vmap_block_tree, GFP_ATOMIC);
+static LIST_HEAD(vmap_block_list);
+
+static unsigned long addr_to_vb_idx(unsigned long addr)
+{
+	addr -= VMALLOC_START & ~(VMAP_BLOCK_SIZE-1);
+	addr /= VMAP_BLOCK_SIZE;
+	return addr;
+}
+
+static struct vmap_block *new_vmap_block(gfp_t gfp_mask)
+{
+	struct vmap_block_queue *vbq;
+	struct vmap_block *vb;
+	struct vmap_area *va;
+	unsigned long vb_idx;
+	int node, err;
+
+	node = numa_node_id();
+
+	vb = kmalloc_node(sizeof(struct vmap_block),
+			gfp_mask & ~__GFP_HIGHMEM, node);
+	if (unlikely(!vb))
+		return ERR_PTR(-ENOMEM);
+
+	va = alloc_vmap_area(VMAP_BLOCK_SIZE, VMAP_BLOCK_SIZE,
+					VMALLOC_START, VMALLOC_END,
+					node, gfp_mask);
+	if (IS_ERR(va)) {
+		kfree(vb);
+		return ERR_PTR(PTR_ERR(va));
+	}
+
+	err = radix_tree_preload(gfp_mask);
+	if (unlikely(err)) {
+		kfree(vb);
+		free_vmap_area_noflush(va);
+		return ERR_PTR(err);
+	}
+
+	spin_lock_init(&vb->lock);
+	vb->va = va;
+	vb->free = VMAP_BBMAP_BITS;
+	vb->dirty = 0;
+	vb->dirty_min = VMAP_BBMAP_BITS;
+	vb->dirty_max = 0;
+	bitmap_zero(vb->used_map, VMAP_BBMAP_BITS);
+	INIT_LIST_HEAD(&vb->free_list);
+
+	vb_idx = addr_to_vb_idx(va->va_start);
+	spin_lock(&vmap_block_tree_lock);
+	err = radix_tree_insert(&vmap_block_tree, vb_idx, vb);
+	BUG_ON(err);
+	list_add(&vb->list, &vmap_block_list);
+	spin_unlock(&vmap_block_tree_lock);
+	radix_tree_preload_end();
+
+	vbq = &get_cpu_var(vmap_block_queue);
+	vb->vbq = vbq;
+	spin_lock(&vbq->lock);
+	list_add(&vb->free_list, &vbq->free);
+	spin_unlock(&vbq->lock);
+	put_cpu_var(vmap_block_queue);
+
+	return vb;
+}
+
+static void free_vmap_block(struct vmap_block *vb)
+{
+	struct vmap_block *tmp;
+	unsigned long vb_idx;
+
+	vb_idx = addr_to_vb_idx(vb->va->va_start);
+	spin_lock(&vmap_block_tree_lock);
+	tmp = radix_tree_delete(&vmap_block_tree, vb_idx);
+	list_del(&vb->list);
+	spin_unlock(&vmap_block_tree_lock);
+	BUG_ON(tmp != vb);
+
+	/* the ranges were unmapped as they were freed */
+	free_vmap_area_noflush(vb->va);
+	kfree(vb);
+}
+
+static void *vb_alloc(unsigned long size, gfp_t gfp_mask)
+{
+	struct vmap_block_queue *vbq;
+	struct vmap_block *vb;
+	unsigned long addr = 0;
+	unsigned int order;
+
+	BUG_ON(size & ~PAGE_MASK);
+	BUG_ON(size > PAGE_SIZE*VMAP_MAX_ALLOC);
+	order = get_order(size);
+
+again:
+	vbq = &get_cpu_var(vmap_block_queue);
+	spin_lock(&vbq->lock);
+	list_for_each_entry(vb, &vbq->free, free_list) {
+		int i;
+
+		i = bitmap_find_free_region(vb->used_map,
+						VMAP_BBMAP_BITS, order);
+		if (i < 0)
+			continue;
+
+		addr = vb->va->va_start + (i << PAGE_SHIFT);
+		BUG_ON(addr_to_vb_idx(addr) !=
+				addr_to_vb_idx(vb->va->va_start));
+		vb->free -= 1UL << order;
+		if (vb->free == 0)
+			list_del_init(&vb->free_list);
+		break;
+	}
+	spin_unlock(&vbq->lock);
+	put_cpu_var(vmap_block_queue);
+
+	if (!addr) {
+		vb = new_vmap_block(gfp_mask);
+		if (IS_ERR(vb))
+			return vb;
+		goto again;
+	}
+
+	return (void *)addr;
+}
+
+static void vb_free(const void *addr, unsigned long size)
+{
+	unsigned long offset;
+	unsigned long vb_idx;
+	unsigned int order;
+	struct vmap_block *vb;
+
+	BUG_ON(size & ~PAGE_MASK);
+	BUG_ON(size > PAGE_SIZE*VMAP_MAX_ALLOC);
+	order = get_order(size);
+
+	offset = (unsigned long)addr & (VMAP_BLOCK_SIZE - 1);
+	offset >>= PAGE_SHIFT;
+
+	vb_idx = addr_to_vb_idx((unsigned long)addr);
+	spin_lock(&vmap_block_tree_lock);
+	vb = radix_tree_lookup(&vmap_block_tree, vb_idx);
+	spin_unlock(&vmap_block_tree_lock);
+	BUG_ON(!vb);
+
+	/*
+	 * The block can't go away under us: the range being freed is
+	 * still counted as not dirty.
+	 */
+	flush_cache_vunmap((unsigned long)addr, (unsigned long)addr + size);
+	vunmap_page_range((unsigned long)addr, (unsigned long)addr + size);
+
+	spin_lock(&vb->lock);
+	if (offset < vb->dirty_min)
+		vb->dirty_min = offset;
+	if (offset + (1UL << order) > vb->dirty_max)
+		vb->dirty_max = offset + (1UL << order);
+	vb->dirty += 1UL << order;
+	if (vb->dirty == VMAP_BBMAP_BITS) {
+		BUG_ON(vb->free);
+		spin_unlock(&vb->lock);
+		free_vmap_block(vb);
+	} else
+		spin_unlock(&vb->lock);
+}
+
+/**
+ *	vm_unmap_aliases - unmap outstanding lazy aliases in the vmap layer
+ *
+ *	The vmap/vmalloc layer lazily flushes kernel virtual mappings
+ *	primarily to amortize TLB flushing overheads.  What this means is
+ *	that any page you have now may, in a former life, have been mapped
+ *	into kernel virtual address by the vmap layer and so there might be
+ *	some CPUs with TLB entries still referencing that page (in addition
+ *	to the regular 1:1 kernel mapping).
+ *
+ *	vm_unmap_aliases flushes all such lazy mappings.  After it returns,
+ *	we can be sure that none of the pages we have control over will
+ *	have any aliases from the vmap layer.
+ */
+void vm_unmap_aliases(void)
+{
+	unsigned long start = ULONG_MAX, end = 0;
+	struct vmap_block *vb;
+	int flush = 0;
+
+	spin_lock(&vmap_block_tree_lock);
+	list_for_each_entry(vb, &vmap_block_list, list) {
+		spin_lock(&vb->lock);
+		if (vb->dirty_max) {
+			unsigned long s, e;
+
+			s = vb->va->va_start + (vb->dirty_min << PAGE_SHIFT);
+			e = vb->va->va_start + (vb->dirty_max << PAGE_SHIFT);
+			if (s < start)
+				start = s;
+			if (e > end)
+				end = e;
+			vb->dirty_min = VMAP_BBMAP_BITS;
+			vb->dirty_max = 0;
+			flush = 1;
+		}
+		spin_unlock(&vb->lock);
+	}
+	spin_unlock(&vmap_block_tree_lock);
+
+	__purge_vmap_area_lazy(&start, &end, 1, flush);
+}
+EXPORT_SYMBOL_GPL(vm_unmap_aliases);
+
+/**
+ *	vm_unmap_ram  -  unmap linear kernel address space set up by vm_map_ram
+ *
+ *	@mem:		the pointer returned by vm_map_ram
+ *	@count:		the count passed to that vm_map_ram call (cannot unmap partial)
+ *
+ *	Must not be called in interrupt context.
+ */
+void vm_unmap_ram(const void *mem, unsigned int count)
+{
+	unsigned long size = count << PAGE_SHIFT;
+	unsigned long addr = (unsigned long)mem;
+
+	BUG_ON(!addr);
+	BUG_ON(addr < VMALLOC_START);
+	BUG_ON(addr > VMALLOC_END);
+	BUG_ON(addr & (PAGE_SIZE-1));
+
+	debug_check_no_locks_freed(mem, size);
+
+	if (likely(count <= VMAP_MAX_ALLOC))
+		vb_free(mem, size);
+	else
+		free_unmap_vmap_area_addr(addr);
+}
+EXPORT_SYMBOL(vm_unmap_ram);
+
+/**
+ *	vm_map_ram  -  map pages linearly into kernel virtual address (vmalloc space)
+ *
+ *	@pages:		an array of pointers to the pages to be mapped
+ *	@count:		number of pages
+ *	@node:		prefer to allocate data structures on this node
+ *	@prot:		memory protection to use. PAGE_KERNEL for regular RAM
+ *
+ *	A cheaper vmap() for short lived mappings: no vm_struct is set up,
+ *	small mappings come from a per-cpu block, and the TLB flush on
+ *	vm_unmap_ram() is deferred and batched.  Returns the address of the
+ *	area or %NULL on failure.
+ */
+void *vm_map_ram(struct page **pages, unsigned int count, int node, pgprot_t prot)
+{
+	unsigned long size = count << PAGE_SHIFT;
+	unsigned long addr;
+	void *mem;
+
+	if (likely(count <= VMAP_MAX_ALLOC)) {
+		mem = vb_alloc(size, GFP_KERNEL);
+		if (IS_ERR(mem))
+			return NULL;
+		addr = (unsigned long)mem;
+	} else {
+		struct vmap_area *va;
+		va = alloc_vmap_area(size, PAGE_SIZE,
+				VMALLOC_START, VMALLOC_END, node, GFP_KERNEL);
+		if (IS_ERR(va))
+			return NULL;
+
+		addr = va->va_start;
+		mem = (void *)addr;
+	}
+	if (vmap_page_range(addr, addr + size, prot, &pages)) {
+		vm_unmap_ram(mem, count);
+		return NULL;
+	}
+	return mem;
+}
+EXPORT_SYMBOL(vm_map_ram);
+
+void __init vmalloc_init(void)
+{
+	struct vmap_area *va;
+	struct vm_struct *tmp;
+	int i;
+
+	for_each_possible_cpu(i) {
+		struct vmap_block_queue *vbq;
+
+		vbq = &per_cpu(vmap_block_queue, i);
+		spin_lock_init(&vbq->lock);
+		INIT_LIST_HEAD(&vbq->free);
+	}
+
+	/* Import areas an architecture registered before slab was up */
+	for (tmp = vmlist; tmp; tmp = tmp->next) {
+		va = kzalloc(sizeof(struct vmap_area), GFP_NOWAIT);
+		BUG_ON(!va);
+		va->flags = VM_VM_AREA;
+		va->va_start = (unsigned long)tmp->addr;
+		va->va_end = va->va_start + tmp->size;
+		va->private = tmp;
+		__insert_vmap_area(va);
+	}
+}
+
+/*** Old vmalloc interfaces ***/
+
 struct vm_struct *__get_vm_area_node(unsigned long size, unsigned long flags,
 				unsigned long start, unsigned long end, int node)
 {
 	struct vm_struct **p, *tmp, *area;
+	struct vmap_area *va;
 	unsigned long align = 1;
-	unsigned long addr;
 
 	if (flags & VM_IOREMAP) {
 		int bit = fls(size);
@@ -174,60 +912,51 @@ struct vm_struct *__get_vm_area_node(unsigned long size, unsigned long flags,
 
 		align = 1ul << bit;
 	}
-	addr = ALIGN(start, align);
 	size = PAGE_ALIGN(size);
+	if (unlikely(!size))
+		return NULL;
 
 	area = kmalloc_node(sizeof(*area), GFP_KERNEL, node);
 	if (unlikely(!area))
 		return NULL;
 
-	if (unlikely(!size)) {
-		kfree (area);
-		return NULL;
-	}
-
 	/*
 	 * We always allocate a guard page.
 	 */
 	size += PAGE_SIZE;
 
-	write_lock(&vmlist_lock);
-	for (p = &vmlist; (tmp = *p) != NULL ;p = &tmp->next) {
-		if ((unsigned long)tmp->addr < addr) {
-			if((unsigned long)tmp->addr + tmp->size >= addr)
-				addr = ALIGN(tmp->size + 
-					     (unsigned long)tmp->addr, align);
-			continue;
-		}
-		if ((size + addr) < addr)
-			goto out;
-		if (size + addr <= (unsigned long)tmp->addr)
-			goto found;
-		addr = ALIGN(tmp->size + (unsigned long)tmp->addr, align);
-		if (addr > end - size)
-			goto out;
+	va = alloc_vmap_area(size, align, start, end, node, GFP_KERNEL);
+	if (IS_ERR(va)) {
+		kfree(area);
+		return NULL;
 	}
 
-found:
-	area->next = *p;
-	*p = area;
-
 	area->flags = flags;
-	area->addr = (void *)addr;
+	area->addr = (void *)va->va_start;
 	area->size = size;
 	area->pages = NULL;
 	area->nr_pages = 0;
 	area->phys_addr = 0;
-	write_unlock(&vmlist_lock);
 
-	return area;
+	spin_lock(&vmap_area_lock);
+	va->private = area;
+	va->flags |= VM_VM_AREA;
+	spin_unlock(&vmap_area_lock);
 
-out:
+	/*
+	 * The vmlist is only kept for the code walking it to report on
+	 * vmalloc space; lookups by address go through the rbtree.
+	 */
+	write_lock(&vmlist_lock);
+	for (p = &vmlist; (tmp = *p) != NULL; p = &tmp->next) {
+		if (tmp->addr >= area->addr)
+			break;
+	}
+	area->next = *p;
+	*p = area;
 	write_unlock(&vmlist_lock);
-	kfree(area);
-	if (printk_ratelimit())
-		printk(KERN_WARNING "allocation failed: out of vmalloc space - use vmalloc=<size> to increase size.\n");
-	return NULL;
+
+	return area;
 }
 
 struct vm_struct *__get_vm_area(unsigned long size, unsigned long flags,
@@ -256,39 +985,73 @@ struct vm_struct *get_vm_area_node(unsigned long size, unsigned long flags, int
 	return __get_vm_area_node(size, flags, VMALLOC_START, VMALLOC_END, node);
 }
 
-/* Caller must hold vmlist_lock */
-static struct vm_struct *__find_vm_area(void *addr)
+/**
+ *	find_vm_area  -  find a continuous kernel virtual area
+ *
+ *	@addr:		base address
+ *
+ *	Search for the kernel VM area starting at @addr, and return it.
+ *	It is up to the caller to do all required locking to keep the
+ *	returned pointer valid.
+ */
+struct vm_struct *find_vm_area(void *addr)
 {
-	struct vm_struct *tmp;
+	struct vmap_area *va;
 
-	for (tmp = vmlist; tmp != NULL; tmp = tmp->next) {
-		 if (tmp->addr == addr)
-			break;
+	va = find_vmap_area((unsigned long)addr);
+	if (va && va->va_start == (unsigned long)addr &&
+			(va->flags & VM_VM_AREA))
+		return va->private;
+
+	return NULL;
+}
+
+/*
+ * Take the vm_struct at @addr off the rbtree and the vmlist, leaving its
+ * vmap_area in *vap for the caller to unmap and free.
+ * Caller must hold vmlist_lock for writing.
+ */
+static struct vm_struct *__unlink_vm_area(void *addr, struct vmap_area **vap)
+{
+	struct vm_struct **p, *tmp, *vm = NULL;
+	struct vmap_area *va;
+
+	spin_lock(&vmap_area_lock);
+	va = __find_vmap_area((unsigned long)addr);
+	if (va && va->va_start == (unsigned long)addr &&
+			(va->flags & VM_VM_AREA)) {
+		vm = va->private;
+		va->flags &= ~VM_VM_AREA;
 	}
+	spin_unlock(&vmap_area_lock);
+	if (!vm)
+		return NULL;
+
+	for (p = &vmlist; (tmp = *p) != vm; p = &tmp->next)
+		;
+	*p = tmp->next;
 
-	return tmp;
+	*vap = va;
+	return vm;
 }
 
-/* Caller must hold vmlist_lock */
+/* Caller must hold vmlist_lock for writing */
 struct vm_struct *__remove_vm_area(void *addr)
 {
-	struct vm_struct **p, *tmp;
+	struct vmap_area *va;
+	struct vm_struct *vm;
 
-	for (p = &vmlist ; (tmp = *p) != NULL ;p = &tmp->next) {
-		 if (tmp->addr == addr)
-			 goto found;
-	}
-	return NULL;
+	vm = __unlink_vm_area(addr, &va);
+	if (!vm)
+		return NULL;
 
-found:
-	unmap_vm_area(tmp);
-	*p = tmp->next;
+	free_unmap_vmap_area(va);
 
 	/*
 	 * Remove the guard page.
 	 */
-	tmp->size -= PAGE_SIZE;
-	return tmp;
+	vm->size -= PAGE_SIZE;
+	return vm;
 }
 
 /**
@@ -302,10 +1065,18 @@ found:
  */
 struct vm_struct *remove_vm_area(void *addr)
 {
+	struct vmap_area *va;
 	struct vm_struct *v;
+
 	write_lock(&vmlist_lock);
-	v = __remove_vm_area(addr);
+	v = __unlink_vm_area(addr, &va);
 	write_unlock(&vmlist_lock);
+	if (!v)
+		return NULL;
+
+	/* the unmap may purge, which is too slow to do under vmlist_lock */
+	free_unmap_vmap_area(va);
+	v->size -= PAGE_SIZE;
 	return v;
 }
 
@@ -531,10 +1302,10 @@ void *vmalloc_user(unsigned long size)
 	void *ret;
 
 	ret = __vmalloc(size, GFP_KERNEL | __GFP_HIGHMEM | __GFP_ZERO, PAGE_KERNEL);
-	write_lock(&vmlist_lock);
-	area = __find_vm_area(ret);
-	area->flags |= VM_USERMAP;
-	write_unlock(&vmlist_lock);
+	if (ret) {
+		area = find_vm_area(ret);
+		area->flags |= VM_USERMAP;
+	}
 
 	return ret;
 }
@@ -607,10 +1378,10 @@ void *vmalloc_32_user(unsigned long size)
 	void *ret;
 
 	ret = __vmalloc(size, GFP_KERNEL | __GFP_ZERO, PAGE_KERNEL);
-	write_lock(&vmlist_lock);
-	area = __find_vm_area(ret);
-	area->flags |= VM_USERMAP;
-	write_unlock(&vmlist_lock);
+	if (ret) {
+		area = find_vm_area(ret);
+		area->flags |= VM_USERMAP;
+	}
 
 	return ret;
 }
@@ -716,17 +1487,15 @@ int remap_vmalloc_range(struct vm_area_struct *vma, void *addr,
 	if ((PAGE_SIZE-1) & (unsigned long)addr)
 		return -EINVAL;
 
-	read_lock(&vmlist_lock);
-	area = __find_vm_area(addr);
+	area = find_vm_area(addr);
 	if (!area)
-		goto out_einval_locked;
+		return -EINVAL;
 
 	if (!(area->flags & VM_USERMAP))
-		goto out_einval_locked;
+		return -EINVAL;
 
 	if (usize + (pgoff << PAGE_SHIFT) > area->size - PAGE_SIZE)
-		goto out_einval_locked;
-	read_unlock(&vmlist_lock);
+		return -EINVAL;
 
 	addr += pgoff << PAGE_SHIFT;
 	do {
@@ -744,10 +1513,6 @@ int remap_vmalloc_range(struct vm_area_struct *vma, void *addr,
 	vma->vm_flags |= VM_RESERVED;
 
 	return ret;
-
-out_einval_locked:
-	read_unlock(&vmlist_lock);
-	return -EINVAL;
 }
 EXPORT_SYMBOL(remap_vmalloc_range);
 
@@ -0,0 +1,151 @@
+/*
+ * mm/vmpressure.c
+ *
+ * Memory pressure level for userspace, in /proc/vmpressure: how hard page
+ * reclaim has to work to free pages.  Every window of VMPRESSURE_WINDOW
+ * pages scanned, the share of them that could not be reclaimed gives the
+ * level - "low" while reclaim frees most of what it looks at, "medium"
+ * once it has to skip most pages, and "critical" when it frees almost
+ * nothing and the OOM killer is not far off.  Without reclaim for a
+ * second the level drops back to low.
+ *
+ * Reading the file returns the current level; poll() and epoll report it
+ * readable when the level has changed since the file was last read.
+ */
+#include <linux/mm.h>
+#include <linux/swap.h>
+#include <linux/fs.h>
+#include <linux/poll.h>
+#include <linux/proc_fs.h>
+#include <linux/spinlock.h>
+#include <linux/timer.h>
+#include <linux/init.h>
+
+#define VMPRESSURE_WINDOW		(SWAP_CLUSTER_MAX * 16)
+#define VMPRESSURE_MEDIUM_PERCENT	60	/* of the window not freed */
+#define VMPRESSURE_CRITICAL_PERCENT	95
+#define VMPRESSURE_RELAX		HZ
+
+enum {
+	VMPRESSURE_LOW,
+	VMPRESSURE_MEDIUM,
+	VMPRESSURE_CRITICAL,
+};
+
+static const char *vmpressure_names[] = {
+	"low", "medium", "critical",
+};
+
+static DEFINE_SPINLOCK(vmpressure_lock);
+static unsigned long vmpressure_scanned;
+static unsigned long vmpressure_reclaimed;
+static int vmpressure_level;
+static unsigned long vmpressure_event;	/* bumped on every level change */
+static DECLARE_WAIT_QUEUE_HEAD(vmpressure_wait);
+
+static void vmpressure_relax(unsigned long data);
+static DEFINE_TIMER(vmpressure_timer, vmpressure_relax, 0, 0);
+
+/* needs vmpressure_lock */
+static void vmpressure_set(int level)
+{
+	if (level == vmpressure_level)
+		return;
+	vmpressure_level = level;
+	vmpressure_event++;
+	wake_up_interruptible(&vmpressure_wait);
+}
+
+static void vmpressure_relax(unsigned long data)
+{
+	spin_lock(&vmpressure_lock);
+	vmpressure_scanned = 0;
+	vmpressure_reclaimed = 0;
+	vmpressure_set(VMPRESSURE_LOW);
+	spin_unlock(&vmpressure_lock);
+}
+
+/*
+ * Called by reclaim with the pages it scanned off the inactive lists and
+ * how many of them it freed.
+ */
+void vmpressure(unsigned long scanned, unsigned long reclaimed)
+{
+	unsigned long pressure;
+	int level;
+
+	if (!scanned)
+		return;
+
+	spin_lock_bh(&vmpressure_lock);
+	vmpressure_scanned += scanned;
+	vmpressure_reclaimed += reclaimed;
+	if (vmpressure_scanned < VMPRESSURE_WINDOW) {
+		spin_unlock_bh(&vmpressure_lock);
+		return;
+	}
+	scanned = vmpressure_scanned;
+	reclaimed = min(vmpressure_reclaimed, scanned);
+	vmpressure_scanned = 0;
+	vmpressure_reclaimed = 0;
+
+	pressure = (scanned - reclaimed) * 100 / scanned;
+	if (pressure >= VMPRESSURE_CRITICAL_PERCENT)
+		level = VMPRESSURE_CRITICAL;
+	else if (pressure >= VMPRESSURE_MEDIUM_PERCENT)
+		level = VMPRESSURE_MEDIUM;
+	else
+		level = VMPRESSURE_LOW;
+	vmpressure_set(level);
+	spin_unlock_bh(&vmpressure_lock);
+
+	if (level != VMPRESSURE_LOW)
+		mod_timer(&vmpressure_timer, jiffies + VMPRESSURE_RELAX);
+}
+
+/* The event last read through the file is kept in private_data */
+static int vmpressure_open(struct inode *inode, struct file *file)
+{
+	file->private_data = (void *)(vmpressure_event - 1);
+	return 0;
+}
+
+static ssize_t vmpressure_read(struct file *file, char __user *buf,
+			       size_t count, loff_t *ppos)
+{
+	char level[16];
+	int len;
+
+	spin_lock_bh(&vmpressure_lock);
+	len = sprintf(level, "%s\n", vmpressure_names[vmpressure_level]);
+	file->private_data = (void *)vmpressure_event;
+	spin_unlock_bh(&vmpressure_lock);
+
+	return simple_read_from_buffer(buf, count, ppos, level, len);
+}
+
+static unsigned int vmpressure_poll(struct file *file, poll_table *wait)
+{
+	poll_wait(file, &vmpressure_wait, wait);
+	if ((unsigned long)file->private_data != vmpressure_event)
+		return POLLIN | POLLRDNORM | POLLPRI;
+	return 0;
+}
+
+static struct file_operations vmpressure_fops = {
+	.open		= vmpressure_open,
+	.read		= vmpressure_read,
+	.poll		= vmpressure_poll,
+	.llseek		= generic_file_llseek,
+};
+
+static int __init vmpressure_init(void)
+{
+	struct proc_dir_entry *entry;
+
+	entry = create_proc_entry("vmpressure", S_IRUGO, NULL);
+	if (entry)
+		entry->proc_fops = &vmpressure_fops;
+	return 0;
+}
+module_init(vmpressure_init);
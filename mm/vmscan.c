@@ -35,6 +35,7 @@
 #include <linux/rwsem.h>
 #include <linux/delay.h>
 #include <linux/kthread.h>
+#include <linux/compaction.h>
 
 #include <asm/tlbflush.h>
 #include <asm/div64.h>
@@ -386,25 +387,31 @@ int remove_mapping(struct address_space *mapping, struct page *page)
 	 * The non-racy check for busy page.  It is critical to check
 	 * PageDirty _after_ making sure that the page is freeable and
 	 * not in use by anybody. 	(pagecache + us == 2)
+	 *
+	 * Lockless pagecache lookups do not take the tree_lock, so the
+	 * count is frozen to zero rather than just tested: that makes
+	 * page_cache_get_speculative() fail until the page is gone from
+	 * the radix tree.  The cmpxchg also orders the PageDirty test.
 	 */
-	if (unlikely(page_count(page) != 2))
+	if (!page_freeze_refs(page, 2))
 		goto cannot_free;
-	smp_rmb();
-	if (unlikely(PageDirty(page)))
+	if (unlikely(PageDirty(page))) {
+		page_unfreeze_refs(page, 2);
 		goto cannot_free;
+	}
 
 	if (PageSwapCache(page)) {
 		swp_entry_t swap = { .val = page_private(page) };
 		__delete_from_swap_cache(page);
 		write_unlock_irq(&mapping->tree_lock);
 		swap_free(swap);
-		__put_page(page);	/* The pagecache ref */
+		page_unfreeze_refs(page, 1);	/* drop the pagecache ref */
 		return 1;
 	}
 
 	__remove_from_page_cache(page);
 	write_unlock_irq(&mapping->tree_lock);
-	__put_page(page);
+	page_unfreeze_refs(page, 1);	/* drop the pagecache ref */
 	return 1;
 
 cannot_free:
@@ -431,6 +438,7 @@ static unsigned long shrink_page_list(struct list_head *page_list,
 		struct page *page;
 		int may_enter_fs;
 		int referenced;
+		int lazyfree;
 
 		cond_resched();
 
@@ -459,14 +467,21 @@ static unsigned long shrink_page_list(struct list_head *page_list,
 		if (referenced && page_mapping_inuse(page))
 			goto activate_locked;
 
+		/* freed with MADV_FREE: dropped if still clean, never swapped */
+		lazyfree = PageAnon(page) && !PageSwapBacked(page);
+
 #ifdef CONFIG_SWAP
 		/*
 		 * Anonymous process memory has backing store?
 		 * Try to allocate it some swap space here.
 		 */
-		if (PageAnon(page) && !PageSwapCache(page))
+		if (PageAnon(page) && !lazyfree && !PageSwapCache(page)) {
+			/* KSM pages have no anon_vma to unmap them through */
+			if (PageKsm(page))
+				goto activate_locked;
 			if (!add_to_swap(page, GFP_ATOMIC))
 				goto activate_locked;
+		}
 #endif /* CONFIG_SWAP */
 
 		mapping = page_mapping(page);
@@ -477,7 +492,7 @@ static unsigned long shrink_page_list(struct list_head *page_list,
 		 * The page is mapped into the page tables of one or more
 		 * processes. Try to unmap it here.
 		 */
-		if (page_mapped(page) && mapping) {
+		if (page_mapped(page) && (mapping || lazyfree)) {
 			switch (try_to_unmap(page, 0)) {
 			case SWAP_FAIL:
 				goto activate_locked;
@@ -547,7 +562,12 @@ static unsigned long shrink_page_list(struct list_head *page_list,
 				goto free_it;
 		}
 
-		if (!remove_mapping(mapping, page))
+		if (lazyfree) {
+			/* the ptes are gone: only ours should be left */
+			if (page_count(page) != 1 || PageDirty(page))
+				goto keep_locked;
+			count_vm_event(PGLAZYFREED);
+		} else if (!remove_mapping(mapping, page))
 			goto keep_locked;
 
 free_it:
@@ -630,12 +650,13 @@ static unsigned long isolate_lru_pages(unsigned long nr_to_scan,
  * of reclaimed pages
  */
 static unsigned long shrink_inactive_list(unsigned long max_scan,
-				struct zone *zone, struct scan_control *sc)
+			struct zone *zone, struct scan_control *sc, int file)
 {
 	LIST_HEAD(page_list);
 	struct pagevec pvec;
 	unsigned long nr_scanned = 0;
 	unsigned long nr_reclaimed = 0;
+	enum lru_list lru = LRU_BASE + file * LRU_FILE;
 
 	pagevec_init(&pvec, 1);
 
@@ -648,9 +669,10 @@ static unsigned long shrink_inactive_list(unsigned long max_scan,
 		unsigned long nr_freed;
 
 		nr_taken = isolate_lru_pages(sc->swap_cluster_max,
-					     &zone->inactive_list,
+					     &zone->lru[lru].list,
 					     &page_list, &nr_scan);
-		zone->nr_inactive -= nr_taken;
+		zone->lru[lru].nr_pages -= nr_taken;
+		zone->recent_scanned[file] += nr_taken;
 		zone->pages_scanned += nr_scan;
 		spin_unlock_irq(&zone->lru_lock);
 
@@ -677,10 +699,10 @@ static unsigned long shrink_inactive_list(unsigned long max_scan,
 			BUG_ON(PageLRU(page));
 			SetPageLRU(page);
 			list_del(&page->lru);
+			add_page_to_lru_list(zone, page, page_lru(page));
+			/* referenced while on the inactive list */
 			if (PageActive(page))
-				add_page_to_active_list(zone, page);
-			else
-				add_page_to_inactive_list(zone, page);
+				zone->recent_rotated[file]++;
 			if (!pagevec_add(&pvec, page)) {
 				spin_unlock_irq(&zone->lru_lock);
 				__pagevec_release(&pvec);
@@ -713,77 +735,46 @@ done:
  * But we had to alter page->flags anyway.
  */
 static void shrink_active_list(unsigned long nr_pages, struct zone *zone,
-				struct scan_control *sc)
+				struct scan_control *sc, int file)
 {
 	unsigned long pgmoved;
 	int pgdeactivate = 0;
 	unsigned long pgscanned;
+	unsigned long nr_rotated = 0;
 	LIST_HEAD(l_hold);	/* The pages which were snipped off */
 	LIST_HEAD(l_inactive);	/* Pages to go onto the inactive_list */
 	LIST_HEAD(l_active);	/* Pages to go onto the active_list */
 	struct page *page;
 	struct pagevec pvec;
-	int reclaim_mapped = 0;
-
-	if (sc->may_swap) {
-		long mapped_ratio;
-		long distress;
-		long swap_tendency;
-
-		/*
-		 * `distress' is a measure of how much trouble we're having
-		 * reclaiming pages.  0 -> no problems.  100 -> great trouble.
-		 */
-		distress = 100 >> zone->prev_priority;
-
-		/*
-		 * The point of this algorithm is to decide when to start
-		 * reclaiming mapped memory instead of just pagecache.  Work out
-		 * how much memory
-		 * is mapped.
-		 */
-		mapped_ratio = ((global_page_state(NR_FILE_MAPPED) +
-				global_page_state(NR_ANON_PAGES)) * 100) /
-					vm_total_pages;
-
-		/*
-		 * Now decide how much we really want to unmap some pages.  The
-		 * mapped ratio is downgraded - just because there's a lot of
-		 * mapped memory doesn't necessarily mean that page reclaim
-		 * isn't succeeding.
-		 *
-		 * The distress ratio is important - we don't want to start
-		 * going oom.
-		 *
-		 * A 100% value of vm_swappiness overrides this algorithm
-		 * altogether.
-		 */
-		swap_tendency = mapped_ratio / 2 + distress + sc->swappiness;
-
-		/*
-		 * Now use this metric to decide whether to start moving mapped
-		 * memory onto the inactive list.
-		 */
-		if (swap_tendency >= 100)
-			reclaim_mapped = 1;
-	}
+	enum lru_list lru = LRU_BASE + file * LRU_FILE;
 
 	lru_add_drain();
 	spin_lock_irq(&zone->lru_lock);
-	pgmoved = isolate_lru_pages(nr_pages, &zone->active_list,
+	pgmoved = isolate_lru_pages(nr_pages, &zone->lru[lru + LRU_ACTIVE].list,
 				    &l_hold, &pgscanned);
 	zone->pages_scanned += pgscanned;
-	zone->nr_active -= pgmoved;
+	zone->lru[lru + LRU_ACTIVE].nr_pages -= pgmoved;
+	zone->recent_scanned[file] += pgmoved;
 	spin_unlock_irq(&zone->lru_lock);
 
+	/*
+	 * How hard the anon and file pages are pressed is decided by the
+	 * caller, from get_scan_ratio(): all that is left here is to keep
+	 * the mapped pages which are still in use.
+	 */
 	while (!list_empty(&l_hold)) {
 		cond_resched();
 		page = lru_to_page(&l_hold);
 		list_del(&page->lru);
 		if (page_mapped(page)) {
-			if (!reclaim_mapped ||
-			    (total_swap_pages == 0 && PageAnon(page)) ||
-			    page_referenced(page, 0)) {
+			if (!sc->may_swap || (total_swap_pages == 0 &&
+					      PageAnon(page) &&
+					      PageSwapBacked(page))) {
+				list_add(&page->lru, &l_active);
+				continue;
+			}
+			if (page_referenced(page, 0)) {
+				nr_rotated++;
 				list_add(&page->lru, &l_active);
 				continue;
 			}
@@ -802,10 +793,10 @@ static void shrink_active_list(unsigned long nr_pages, struct zone *zone,
 		BUG_ON(!PageActive(page));
 		ClearPageActive(page);
 
-		list_move(&page->lru, &zone->inactive_list);
+		list_move(&page->lru, &zone->lru[lru].list);
 		pgmoved++;
 		if (!pagevec_add(&pvec, page)) {
-			zone->nr_inactive += pgmoved;
+			zone->lru[lru].nr_pages += pgmoved;
 			spin_unlock_irq(&zone->lru_lock);
 			pgdeactivate += pgmoved;
 			pgmoved = 0;
@@ -815,7 +806,7 @@ static void shrink_active_list(unsigned long nr_pages, struct zone *zone,
 			spin_lock_irq(&zone->lru_lock);
 		}
 	}
-	zone->nr_inactive += pgmoved;
+	zone->lru[lru].nr_pages += pgmoved;
 	pgdeactivate += pgmoved;
 	if (buffer_heads_over_limit) {
 		spin_unlock_irq(&zone->lru_lock);
@@ -823,6 +814,7 @@ static void shrink_active_list(unsigned long nr_pages, struct zone *zone,
 		spin_lock_irq(&zone->lru_lock);
 	}
 
+	lru += LRU_ACTIVE;
 	pgmoved = 0;
 	while (!list_empty(&l_active)) {
 		page = lru_to_page(&l_active);
@@ -830,17 +822,18 @@ static void shrink_active_list(unsigned long nr_pages, struct zone *zone,
 		BUG_ON(PageLRU(page));
 		SetPageLRU(page);
 		BUG_ON(!PageActive(page));
-		list_move(&page->lru, &zone->active_list);
+		list_move(&page->lru, &zone->lru[lru].list);
 		pgmoved++;
 		if (!pagevec_add(&pvec, page)) {
-			zone->nr_active += pgmoved;
+			zone->lru[lru].nr_pages += pgmoved;
 			pgmoved = 0;
 			spin_unlock_irq(&zone->lru_lock);
 			__pagevec_release(&pvec);
 			spin_lock_irq(&zone->lru_lock);
 		}
 	}
-	zone->nr_active += pgmoved;
+	zone->lru[lru].nr_pages += pgmoved;
+	zone->recent_rotated[file] += nr_rotated;
 
 	__count_zone_vm_events(PGREFILL, zone, pgscanned);
 	__count_vm_events(PGDEACTIVATE, pgdeactivate);
@@ -849,57 +842,174 @@ static void shrink_active_list(unsigned long nr_pages, struct zone *zone,
 	pagevec_release(&pvec);
 }
 
+static unsigned long shrink_list(enum lru_list l, unsigned long nr_to_scan,
+				struct zone *zone, struct scan_control *sc)
+{
+	int file = is_file_lru(l);
+
+	if (is_active_lru(l)) {
+		shrink_active_list(nr_to_scan, zone, sc, file);
+		return 0;
+	}
+	return shrink_inactive_list(nr_to_scan, zone, sc, file);
+}
+
+/*
+ * Determine how aggressively the anon and file LRU lists should be
+ * scanned.  The relative value of each set of LRU lists is determined
+ * by looking at the fraction of the pages scanned we did rotate back
+ * onto the active list instead of evict.
+ *
+ * percent[0] specifies how much pressure to put on ram/swap backed
+ * memory, while percent[1] determines pressure on the file LRUs.
+ */
+static void get_scan_ratio(struct zone *zone, struct scan_control *sc,
+					unsigned long *percent)
+{
+	unsigned long anon, file, free;
+	unsigned long anon_prio, file_prio;
+	unsigned long ap, fp;
+
+	/* If we have no swap space, do not bother scanning anon pages. */
+	if (!sc->may_swap || nr_swap_pages <= 0) {
+		percent[0] = 0;
+		percent[1] = 100;
+		return;
+	}
+
+	anon = zone->lru[LRU_ACTIVE_ANON].nr_pages +
+		zone->lru[LRU_INACTIVE_ANON].nr_pages;
+	file = zone->lru[LRU_ACTIVE_FILE].nr_pages +
+		zone->lru[LRU_INACTIVE_FILE].nr_pages;
+	free = zone->free_pages;
+
+	/* If we have very few page cache pages, force-scan anon pages. */
+	if (unlikely(file + free <= zone->pages_high)) {
+		percent[0] = 100;
+		percent[1] = 0;
+		return;
+	}
+
+	/*
+	 * OK, so we have swap space and a fair amount of page cache
+	 * pages.  We use the recently rotated / recently scanned
+	 * ratios to determine how valuable each cache is.
+	 *
+	 * Because workloads change over time (and to avoid overflow)
+	 * we keep these statistics as a floating average, which ends
+	 * up weighing recent references more than old ones.
+	 *
+	 * anon in [0], file in [1]
+	 */
+	if (unlikely(zone->recent_scanned[0] > anon / 4)) {
+		spin_lock_irq(&zone->lru_lock);
+		zone->recent_scanned[0] /= 2;
+		zone->recent_rotated[0] /= 2;
+		spin_unlock_irq(&zone->lru_lock);
+	}
+
+	if (unlikely(zone->recent_scanned[1] > file / 4)) {
+		spin_lock_irq(&zone->lru_lock);
+		zone->recent_scanned[1] /= 2;
+		zone->recent_rotated[1] /= 2;
+		spin_unlock_irq(&zone->lru_lock);
+	}
+
+	/*
+	 * With swappiness at 100, anonymous and file have the same priority.
+	 * This scanning priority is essentially the inverse of IO cost.
+	 */
+	anon_prio = sc->swappiness;
+	file_prio = 200 - sc->swappiness;
+
+	/*
+	 * The amount of pressure on anon vs file pages is inversely
+	 * proportional to the fraction of recently scanned pages on
+	 * each list that were recently referenced and in active use.
+	 */
+	ap = (anon_prio + 1) * (zone->recent_scanned[0] + 1);
+	ap /= zone->recent_rotated[0] + 1;
+
+	fp = (file_prio + 1) * (zone->recent_scanned[1] + 1);
+	fp /= zone->recent_rotated[1] + 1;
+
+	/* Normalize to percentages */
+	percent[0] = 100 * ap / (ap + fp + 1);
+	percent[1] = 100 - percent[0];
+}
+
+/*
+ * The pages reclaim could free: anonymous pages only count when there is
+ * swap space to put them in.
+ */
+static unsigned long zone_reclaimable_pages(struct zone *zone)
+{
+	unsigned long nr = zone->lru[LRU_ACTIVE_FILE].nr_pages +
+			zone->lru[LRU_INACTIVE_FILE].nr_pages;
+
+	if (nr_swap_pages > 0)
+		nr += zone->lru[LRU_ACTIVE_ANON].nr_pages +
+			zone->lru[LRU_INACTIVE_ANON].nr_pages;
+	return nr;
+}
+
 /*
  * This is a basic per-zone page freer.  Used by both kswapd and direct reclaim.
  */
 static unsigned long shrink_zone(int priority, struct zone *zone,
 				struct scan_control *sc)
 {
-	unsigned long nr_active;
-	unsigned long nr_inactive;
+	unsigned long nr[NR_LRU_LISTS];
 	unsigned long nr_to_scan;
 	unsigned long nr_reclaimed = 0;
+	unsigned long nr_scanned = sc->nr_scanned;
+	unsigned long percent[2];	/* anon @ 0; file @ 1 */
+	enum lru_list l;
 
 	atomic_inc(&zone->reclaim_in_progress);
 
-	/*
-	 * Add one to `nr_to_scan' just to make sure that the kernel will
-	 * slowly sift through the active list.
-	 */
-	zone->nr_scan_active += (zone->nr_active >> priority) + 1;
-	nr_active = zone->nr_scan_active;
-	if (nr_active >= sc->swap_cluster_max)
-		zone->nr_scan_active = 0;
-	else
-		nr_active = 0;
-
-	zone->nr_scan_inactive += (zone->nr_inactive >> priority) + 1;
-	nr_inactive = zone->nr_scan_inactive;
-	if (nr_inactive >= sc->swap_cluster_max)
-		zone->nr_scan_inactive = 0;
-	else
-		nr_inactive = 0;
-
-	while (nr_active || nr_inactive) {
-		if (nr_active) {
-			nr_to_scan = min(nr_active,
-					(unsigned long)sc->swap_cluster_max);
-			nr_active -= nr_to_scan;
-			shrink_active_list(nr_to_scan, zone, sc);
+	get_scan_ratio(zone, sc, percent);
+
+	for_each_lru(l) {
+		int file = is_file_lru(l);
+		unsigned long scan;
+
+		if (!percent[file]) {
+			nr[l] = 0;
+			continue;
 		}
 
-		if (nr_inactive) {
-			nr_to_scan = min(nr_inactive,
+		/*
+		 * Add one to `scan' just to make sure that the kernel will
+		 * slowly sift through the lists.
+		 */
+		scan = zone->lru[l].nr_pages >> priority;
+		scan = (scan * percent[file]) / 100 + 1;
+		zone->lru[l].nr_scan += scan;
+		nr[l] = zone->lru[l].nr_scan;
+		if (nr[l] >= sc->swap_cluster_max)
+			zone->lru[l].nr_scan = 0;
+		else
+			nr[l] = 0;
+	}
+
+	while (nr[LRU_ACTIVE_ANON] || nr[LRU_INACTIVE_ANON] ||
+	       nr[LRU_ACTIVE_FILE] || nr[LRU_INACTIVE_FILE]) {
+		for_each_lru(l) {
+			if (nr[l]) {
+				nr_to_scan = min(nr[l],
 					(unsigned long)sc->swap_cluster_max);
-			nr_inactive -= nr_to_scan;
-			nr_reclaimed += shrink_inactive_list(nr_to_scan, zone,
-								sc);
+				nr[l] -= nr_to_scan;
+				nr_reclaimed += shrink_list(l, nr_to_scan,
+							zone, sc);
+			}
 		}
 	}
 
 	throttle_vm_writeout();
 
 	atomic_dec(&zone->reclaim_in_progress);
+	vmpressure(sc->nr_scanned - nr_scanned, nr_reclaimed);
 	return nr_reclaimed;
 }
 
@@ -985,7 +1095,7 @@ unsigned long try_to_free_pages(struct zone **zones, gfp_t gfp_mask)
 			continue;
 
 		zone->temp_priority = DEF_PRIORITY;
-		lru_pages += zone->nr_active + zone->nr_inactive;
+		lru_pages += zone_lru_pages(zone);
 	}
 
 	for (priority = DEF_PRIORITY; priority >= 0; priority--) {
@@ -1013,7 +1123,7 @@ unsigned long try_to_free_pages(struct zone **zones, gfp_t gfp_mask)
 		 */
 		if (total_scanned > sc.swap_cluster_max +
 					sc.swap_cluster_max / 2) {
-			wakeup_pdflush(laptop_mode ? 0 : total_scanned);
+			wakeup_flusher_threads(laptop_mode ? 0 : total_scanned);
 			sc.may_writepage = 1;
 		}
 
@@ -1115,7 +1225,7 @@ scan:
 		for (i = 0; i <= end_zone; i++) {
 			struct zone *zone = pgdat->node_zones + i;
 
-			lru_pages += zone->nr_active + zone->nr_inactive;
+			lru_pages += zone_lru_pages(zone);
 		}
 
 		/*
@@ -1153,7 +1263,7 @@ scan:
 			if (zone->all_unreclaimable)
 				continue;
 			if (nr_slab == 0 && zone->pages_scanned >=
-				    (zone->nr_active + zone->nr_inactive) * 4)
+				    zone_reclaimable_pages(zone) * 4)
 				zone->all_unreclaimable = 1;
 			/*
 			 * If we've done a decent amount of scanning and
@@ -1261,6 +1371,13 @@ static int kswapd(void *p)
 		finish_wait(&pgdat->kswapd_wait, &wait);
 
 		balance_pgdat(pgdat, order);
+
+		/*
+		 * Reclaim frees pages without regard for their contiguity,
+		 * so assemble the higher order blocks it was woken for.
+		 */
+		if (order)
+			compact_pgdat(pgdat, order);
 	}
 	return 0;
 }
@@ -1302,6 +1419,7 @@ static unsigned long shrink_all_zones(unsigned long nr_pages, int pass,
 	unsigned long nr_to_scan, ret = 0;
 
 	for_each_zone(zone) {
+		enum lru_list l;
 
 		if (!populated_zone(zone))
 			continue;
@@ -1309,23 +1427,21 @@ static unsigned long shrink_all_zones(unsigned long nr_pages, int pass,
 		if (zone->all_unreclaimable && prio != DEF_PRIORITY)
 			continue;
 
-		/* For pass = 0 we don't shrink the active list */
-		if (pass > 0) {
-			zone->nr_scan_active += (zone->nr_active >> prio) + 1;
-			if (zone->nr_scan_active >= nr_pages || pass > 3) {
-				zone->nr_scan_active = 0;
-				nr_to_scan = min(nr_pages, zone->nr_active);
-				shrink_active_list(nr_to_scan, zone, sc);
-			}
-		}
+		for_each_lru(l) {
+			/* For pass = 0 we don't shrink the active list */
+			if (pass == 0 && is_active_lru(l))
+				continue;
 
-		zone->nr_scan_inactive += (zone->nr_inactive >> prio) + 1;
-		if (zone->nr_scan_inactive >= nr_pages || pass > 3) {
-			zone->nr_scan_inactive = 0;
-			nr_to_scan = min(nr_pages, zone->nr_inactive);
-			ret += shrink_inactive_list(nr_to_scan, zone, sc);
-			if (ret >= nr_pages)
-				return ret;
+			zone->lru[l].nr_scan +=
+				(zone->lru[l].nr_pages >> prio) + 1;
+			if (zone->lru[l].nr_scan >= nr_pages || pass > 3) {
+				zone->lru[l].nr_scan = 0;
+				nr_to_scan = min(nr_pages,
+						 zone->lru[l].nr_pages);
+				ret += shrink_list(l, nr_to_scan, zone, sc);
+				if (ret >= nr_pages)
+					return ret;
+			}
 		}
 	}
 
@@ -1359,7 +1475,7 @@ unsigned long shrink_all_memory(unsigned long nr_pages)
 
 	lru_pages = 0;
 	for_each_zone(zone)
-		lru_pages += zone->nr_active + zone->nr_inactive;
+		lru_pages += zone_lru_pages(zone);
 
 	nr_slab = global_page_state(NR_SLAB);
 	/* If slab caches are huge, it's better to hit them first */
@@ -1389,10 +1505,8 @@ unsigned long shrink_all_memory(unsigned long nr_pages)
 
 		/* Needed for shrinking slab caches later on */
 		if (!lru_pages)
-			for_each_zone(zone) {
-				lru_pages += zone->nr_active;
-				lru_pages += zone->nr_inactive;
-			}
+			for_each_zone(zone)
+				lru_pages += zone_lru_pages(zone);
 
 		/* Force reclaiming mapped pages in the passes #3 and #4 */
 		if (pass > 2) {
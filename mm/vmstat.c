@@ -13,6 +13,10 @@
 #include <linux/mm.h>
 #include <linux/module.h>
 #include <linux/cpu.h>
+#include <linux/vmalloc.h>
+#include <linux/fs.h>
+#include <linux/mutex.h>
+#include <linux/time.h>
 
 void __get_zone_counts(unsigned long *active, unsigned long *inactive,
 			unsigned long *free, struct pglist_data *pgdat)
@@ -24,8 +28,10 @@ void __get_zone_counts(unsigned long *active, unsigned long *inactive,
 	*inactive = 0;
 	*free = 0;
 	for (i = 0; i < MAX_NR_ZONES; i++) {
-		*active += zones[i].nr_active;
-		*inactive += zones[i].nr_inactive;
+		*active += zones[i].lru[LRU_ACTIVE_ANON].nr_pages +
+			zones[i].lru[LRU_ACTIVE_FILE].nr_pages;
+		*inactive += zones[i].lru[LRU_INACTIVE_ANON].nr_pages +
+			zones[i].lru[LRU_INACTIVE_FILE].nr_pages;
 		*free += zones[i].free_pages;
 	}
 }
@@ -159,7 +165,16 @@ static int calculate_threshold(struct zone *zone)
 	 */
 	threshold = min(125, threshold);
 
-	return threshold;
+	/*
+	 * All processors together may be off by threshold pages each. Keep
+	 * that below 1/32 of the zone, or a small zone on a big machine
+	 * (ZONE_DMA with 128 processors) could see its free count miss
+	 * the watermarks altogether.
+	 */
+	threshold = min_t(int, threshold,
+		zone->present_pages / 32 / num_online_cpus());
+
+	return max(1, threshold);
 }
 
 /*
@@ -435,6 +450,98 @@ struct seq_operations fragmentation_op = {
 	.show	= frag_show,
 };
 
+static char * const migratetype_names[MIGRATE_TYPES] = {
+	"Unmovable",
+	"Reclaimable",
+	"Movable",
+};
+
+/*
+ * The free lists of each zone split up by migrate type, and how many
+ * pageblocks of each type the zone has.
+ */
+static int pagetypeinfo_show(struct seq_file *m, void *arg)
+{
+	pg_data_t *pgdat = (pg_data_t *)arg;
+	struct zone *zone;
+	struct zone *node_zones = pgdat->node_zones;
+	unsigned long flags;
+	int order, mtype;
+
+	if (pgdat == first_online_pgdat()) {
+		seq_printf(m, "Page block order: %d\n", pageblock_order);
+		seq_printf(m, "Pages per block:  %lu\n\n", pageblock_nr_pages);
+		seq_printf(m, "%-43s ", "Free pages count per migrate type at order");
+		for (order = 0; order < MAX_ORDER; ++order)
+			seq_printf(m, "%6d ", order);
+		seq_putc(m, '\n');
+	}
+
+	for (zone = node_zones; zone - node_zones < MAX_NR_ZONES; ++zone) {
+		if (!populated_zone(zone))
+			continue;
+
+		spin_lock_irqsave(&zone->lock, flags);
+		for (mtype = 0; mtype < MIGRATE_TYPES; mtype++) {
+			seq_printf(m, "Node %4d, zone %8s, type %12s ",
+					pgdat->node_id, zone->name,
+					migratetype_names[mtype]);
+			for (order = 0; order < MAX_ORDER; ++order) {
+				unsigned long freecount = 0;
+				struct list_head *curr;
+
+				list_for_each(curr,
+					&zone->free_area[order].free_list[mtype])
+					freecount++;
+				seq_printf(m, "%6lu ", freecount);
+			}
+			seq_putc(m, '\n');
+		}
+		spin_unlock_irqrestore(&zone->lock, flags);
+	}
+
+	seq_printf(m, "\n%-23s", "Number of blocks type ");
+	for (mtype = 0; mtype < MIGRATE_TYPES; mtype++)
+		seq_printf(m, "%12s ", migratetype_names[mtype]);
+	seq_putc(m, '\n');
+
+	for (zone = node_zones; zone - node_zones < MAX_NR_ZONES; ++zone) {
+		unsigned long count[MIGRATE_TYPES] = { 0, };
+		unsigned long pfn, end_pfn;
+
+		if (!populated_zone(zone))
+			continue;
+
+		pfn = zone->zone_start_pfn;
+		end_pfn = pfn + zone->spanned_pages;
+		/* round up to the first block boundary in the zone */
+		pfn = ALIGN(pfn, pageblock_nr_pages);
+		for (; pfn < end_pfn; pfn += pageblock_nr_pages) {
+			struct page *page;
+
+			if (!pfn_valid(pfn))
+				continue;
+			page = pfn_to_page(pfn);
+			if (page_zone(page) != zone)
+				continue;
+			count[get_pageblock_migratetype(page)]++;
+		}
+
+		seq_printf(m, "Node %d, zone %8s ", pgdat->node_id, zone->name);
+		for (mtype = 0; mtype < MIGRATE_TYPES; mtype++)
+			seq_printf(m, "%12lu ", count[mtype]);
+		seq_putc(m, '\n');
+	}
+	return 0;
+}
+
+struct seq_operations pagetypeinfo_op = {
+	.start	= frag_start,
+	.next	= frag_next,
+	.stop	= frag_stop,
+	.show	= pagetypeinfo_show,
+};
+
 static char *vmstat_text[] = {
 	/* Zoned VM counters */
 	"nr_anon_pages",
@@ -500,8 +607,45 @@ static char *vmstat_text[] = {
 	"kswapd_inodesteal",
 	"pageoutrun",
 	"allocstall",
+	"allocstall_lt_16us",
+	"allocstall_lt_64us",
+	"allocstall_lt_256us",
+	"allocstall_lt_1ms",
+	"allocstall_lt_4ms",
+	"allocstall_lt_16ms",
+	"allocstall_lt_64ms",
+	"allocstall_lt_256ms",
+	"allocstall_lt_1s",
+	"allocstall_ge_1s",
 
 	"pgrotated",
+	"pglazyfree",
+	"pglazyfreed",
+
+#ifdef CONFIG_COMPACTION
+	"compact_blocks_moved",
+	"compact_pages_moved",
+	"compact_pagemigrate_failed",
+	"compact_stall",
+	"compact_fail",
+	"compact_success",
+#endif
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+	"thp_fault_alloc",
+	"thp_fault_fallback",
+	"thp_collapse_alloc",
+	"thp_collapse_alloc_failed",
+	"thp_split",
+#endif
+#ifdef CONFIG_SPECULATIVE_PAGE_FAULT
+	"speculative_pgfault",
+#endif
+#ifdef CONFIG_NUMA_BALANCING
+	"numa_pte_updates",
+	"numa_hint_faults",
+	"numa_hint_faults_local",
+	"numa_page_migrate",
+#endif
 #endif
 };
 
@@ -528,19 +672,29 @@ static int zoneinfo_show(struct seq_file *m, void *arg)
 			   "\n        min      %lu"
 			   "\n        low      %lu"
 			   "\n        high     %lu"
-			   "\n        active   %lu"
-			   "\n        inactive %lu"
-			   "\n        scanned  %lu (a: %lu i: %lu)"
+			   "\n        active_anon   %lu"
+			   "\n        inactive_anon %lu"
+			   "\n        active_file   %lu"
+			   "\n        inactive_file %lu"
+			   "\n        scanned  %lu (aa: %lu ia: %lu af: %lu if: %lu)"
+			   "\n        rotated  anon %lu/%lu file %lu/%lu"
 			   "\n        spanned  %lu"
 			   "\n        present  %lu",
 			   zone->free_pages,
 			   zone->pages_min,
 			   zone->pages_low,
 			   zone->pages_high,
-			   zone->nr_active,
-			   zone->nr_inactive,
+			   zone->lru[LRU_ACTIVE_ANON].nr_pages,
+			   zone->lru[LRU_INACTIVE_ANON].nr_pages,
+			   zone->lru[LRU_ACTIVE_FILE].nr_pages,
+			   zone->lru[LRU_INACTIVE_FILE].nr_pages,
 			   zone->pages_scanned,
-			   zone->nr_scan_active, zone->nr_scan_inactive,
+			   zone->lru[LRU_ACTIVE_ANON].nr_scan,
+			   zone->lru[LRU_INACTIVE_ANON].nr_scan,
+			   zone->lru[LRU_ACTIVE_FILE].nr_scan,
+			   zone->lru[LRU_INACTIVE_FILE].nr_scan,
+			   zone->recent_rotated[0], zone->recent_scanned[0],
+			   zone->recent_rotated[1], zone->recent_scanned[1],
 			   zone->spanned_pages,
 			   zone->present_pages);
 
@@ -668,6 +822,143 @@ struct seq_operations vmstat_op = {
 	.show	= vmstat_show,
 };
 
+/*
+ * /proc/vmstat_snapshot: the counters of /proc/vmstat, in the same order,
+ * followed by those of every populated zone, as one binary record for
+ * monitors that poll often and would rather not parse text. A read from
+ * offset 0 takes a new snapshot, so pread(fd, buf, size, 0) on a file
+ * kept open is all a poller needs. Layout, in native byte order:
+ *
+ *	struct vmstat_snapshot_header
+ *	u64 item[nr_items]
+ *	nr_zones times:
+ *		u32 node, zone index
+ *		u64 item[nr_zone_items]
+ */
+#define VMSTAT_SNAPSHOT_MAGIC	0x766d7374	/* "vmst" */
+#define VMSTAT_SNAPSHOT_VERSION	1
+
+struct vmstat_snapshot_header {
+	u32	magic;
+	u32	version;
+	u64	timestamp;	/* CLOCK_MONOTONIC, in ns */
+	u32	nr_items;
+	u32	nr_zone_items;
+	u32	nr_zones;
+	u32	pad;
+};
+
+struct vmstat_snapshot_zone {
+	u32	node;
+	u32	zone;
+	u64	item[NR_VM_ZONE_STAT_ITEMS];
+};
+
+struct vmstat_snapshot {
+	struct mutex lock;
+	int max_zones;
+	size_t len;
+#ifdef CONFIG_VM_EVENT_COUNTERS
+	struct vm_event_state events;
+#endif
+	u64 buf[0];
+};
+
+static void vmstat_snapshot_fill(struct vmstat_snapshot *s)
+{
+	struct vmstat_snapshot_header *h = (void *)s->buf;
+	struct vmstat_snapshot_zone *zs;
+	struct zone *zone;
+	struct timespec ts;
+	u64 *v = (u64 *)(h + 1);
+	int i, nr_zones = 0;
+
+	do_posix_clock_monotonic_gettime(&ts);
+
+	h->magic = VMSTAT_SNAPSHOT_MAGIC;
+	h->version = VMSTAT_SNAPSHOT_VERSION;
+	h->timestamp = timespec_to_ns(&ts);
+	h->nr_items = ARRAY_SIZE(vmstat_text);
+	h->nr_zone_items = NR_VM_ZONE_STAT_ITEMS;
+	h->pad = 0;
+
+	for (i = 0; i < NR_VM_ZONE_STAT_ITEMS; i++)
+		*v++ = global_page_state(i);
+#ifdef CONFIG_VM_EVENT_COUNTERS
+	all_vm_events(s->events.event);
+	s->events.event[PGPGIN] /= 2;		/* sectors -> kbytes */
+	s->events.event[PGPGOUT] /= 2;
+	for (i = 0; i < NR_VM_EVENT_ITEMS; i++)
+		*v++ = s->events.event[i];
+#endif
+
+	zs = (struct vmstat_snapshot_zone *)v;
+	for_each_zone(zone) {
+		if (!populated_zone(zone))
+			continue;
+		/* zones that came online after open() are left out */
+		if (nr_zones == s->max_zones)
+			break;
+		zs->node = zone->zone_pgdat->node_id;
+		zs->zone = zone_idx(zone);
+		for (i = 0; i < NR_VM_ZONE_STAT_ITEMS; i++)
+			zs->item[i] = zone_page_state(zone, i);
+		zs++;
+		nr_zones++;
+	}
+	h->nr_zones = nr_zones;
+	s->len = (char *)zs - (char *)s->buf;
+}
+
+static int vmstat_snapshot_open(struct inode *inode, struct file *file)
+{
+	struct vmstat_snapshot *s;
+	struct zone *zone;
+	int nr_zones = 0;
+
+	for_each_zone(zone)
+		if (populated_zone(zone))
+			nr_zones++;
+
+	s = vmalloc(sizeof(*s) + sizeof(struct vmstat_snapshot_header) +
+		    ARRAY_SIZE(vmstat_text) * sizeof(u64) +
+		    nr_zones * sizeof(struct vmstat_snapshot_zone));
+	if (!s)
+		return -ENOMEM;
+	mutex_init(&s->lock);
+	s->max_zones = nr_zones;
+	s->len = 0;
+	file->private_data = s;
+	return 0;
+}
+
+static ssize_t vmstat_snapshot_read(struct file *file, char __user *buf,
+				    size_t count, loff_t *ppos)
+{
+	struct vmstat_snapshot *s = file->private_data;
+	ssize_t ret;
+
+	mutex_lock(&s->lock);
+	if (*ppos == 0)
+		vmstat_snapshot_fill(s);
+	ret = simple_read_from_buffer(buf, count, ppos, s->buf, s->len);
+	mutex_unlock(&s->lock);
+	return ret;
+}
+
+static int vmstat_snapshot_release(struct inode *inode, struct file *file)
+{
+	vfree(file->private_data);
+	return 0;
+}
+
+struct file_operations proc_vmstat_snapshot_operations = {
+	.open		= vmstat_snapshot_open,
+	.read		= vmstat_snapshot_read,
+	.llseek		= generic_file_llseek,
+	.release	= vmstat_snapshot_release,
+};
+
 #endif /* CONFIG_PROC_FS */
 
 #ifdef CONFIG_SMP
@@ -117,6 +117,13 @@
 #include <linux/dmaengine.h>
 #include <linux/err.h>
 #include <linux/ctype.h>
+#include <net/ip.h>
+#include <linux/ipv6.h>
+#include <linux/in.h>
+#include <linux/jhash.h>
+#include <linux/random.h>
+#include <linux/trace_events.h>
+#include <net/busy_poll.h>
 
 /*
  *	The list of packet types we will receive (as opposed to discard)
@@ -209,6 +216,9 @@ static RAW_NOTIFIER_HEAD(netdev_chain);
  */
 DEFINE_PER_CPU(struct softnet_data, softnet_data) = { NULL };
 
+DEFINE_TRACE(net_dev_xmit);
+DEFINE_TRACE(net_dev_receive);
+
 #ifdef CONFIG_SYSFS
 extern int netdev_sysfs_init(void);
 extern int netdev_register_sysfs(struct net_device *);
@@ -1099,8 +1109,31 @@ static void dev_queue_xmit_nit(struct sk_buff *skb, struct net_device *dev)
 }
 
 
+static void __netif_schedule_txq(struct netdev_queue *txq)
+{
+	if (!test_and_set_bit(__QUEUE_STATE_SCHED, &txq->state)) {
+		unsigned long flags;
+		struct softnet_data *sd;
+
+		local_irq_save(flags);
+		sd = &__get_cpu_var(softnet_data);
+		txq->next_sched = sd->output_txq;
+		sd->output_txq = txq;
+		raise_softirq_irqoff(NET_TX_SOFTIRQ);
+		local_irq_restore(flags);
+	}
+}
+
 void __netif_schedule(struct net_device *dev)
 {
+	if (netif_is_multiqueue(dev) && dev->qdisc == &mq_qdisc) {
+		unsigned int i;
+
+		for (i = 0; i < dev->num_tx_queues; i++)
+			__netif_schedule_txq(&dev->tx_queues[i]);
+		return;
+	}
+
 	if (!test_and_set_bit(__LINK_STATE_SCHED, &dev->state)) {
 		unsigned long flags;
 		struct softnet_data *sd;
@@ -1115,6 +1148,61 @@ void __netif_schedule(struct net_device *dev)
 }
 EXPORT_SYMBOL(__netif_schedule);
 
+/*
+ * Have the qdisc which feeds the queue @txq of a multiqueue device run
+ * again: that of the queue itself, or the root qdisc of the device when
+ * one is set up with tc.
+ */
+void __netif_schedule_queue(struct netdev_queue *txq)
+{
+	if (txq->dev->qdisc != &mq_qdisc) {
+		__netif_schedule(txq->dev);
+		return;
+	}
+	__netif_schedule_txq(txq);
+}
+EXPORT_SYMBOL(__netif_schedule_queue);
+
+/*
+ * netif_tx_lock() of a multiqueue device, under dev->_xmit_lock: wait for
+ * the packet each queue may be handing to the driver, and keep the others
+ * back until netif_tx_thaw_queues().
+ */
+void netif_tx_freeze_queues(struct net_device *dev)
+{
+	unsigned int i;
+
+	for (i = 0; i < dev->num_tx_queues; i++) {
+		struct netdev_queue *txq = &dev->tx_queues[i];
+
+		netif_tx_queue_lock(txq);
+		set_bit(__QUEUE_STATE_FROZEN, &txq->state);
+		netif_tx_queue_unlock(txq);
+	}
+}
+EXPORT_SYMBOL(netif_tx_freeze_queues);
+
+void netif_tx_thaw_queues(struct net_device *dev)
+{
+	unsigned int i;
+
+	for (i = 0; i < dev->num_tx_queues; i++)
+		clear_bit(__QUEUE_STATE_FROZEN, &dev->tx_queues[i].state);
+	smp_mb__after_clear_bit();
+
+	/* Send on what was held back meanwhile */
+	for (i = 0; i < dev->num_tx_queues; i++) {
+		struct netdev_queue *txq = &dev->tx_queues[i];
+
+		if (!netif_tx_queue_stopped(txq) &&
+		    (txq->gso_skb || txq->qdisc->q.qlen))
+			__netif_schedule_queue(txq);
+	}
+	if (dev->gso_skb || dev->qdisc->q.qlen)
+		netif_schedule(dev);
+}
+EXPORT_SYMBOL(netif_tx_thaw_queues);
+
 void __netif_rx_schedule(struct net_device *dev)
 {
 	unsigned long flags;
@@ -1362,6 +1450,7 @@ gso:
 
 		skb->next = nskb->next;
 		nskb->next = NULL;
+		nskb->xmit_more = skb->next || skb->xmit_more;
 		rc = dev->hard_start_xmit(nskb, dev);
 		if (unlikely(rc)) {
 			nskb->next = skb->next;
@@ -1391,6 +1480,96 @@ out_kfree_skb:
 	}						\
 }
 
+static u32 skb_flow_hashrnd;
+static int skb_flow_hashrnd_initialized;
+
+/*
+ * The flow hash of a packet the network header of which is at @nh, from
+ * its addresses and, unless it is a fragment, its ports: it is the same
+ * for all the packets of a flow, so that they keep to one transmit queue
+ * or receiving cpu and remain in order.  Zero if the packet is not IP, or
+ * its header is not in the linear data.
+ */
+static u32 skb_flow_hash(const struct sk_buff *skb, const unsigned char *nh)
+{
+	u32 addr1, addr2, ports = 0;
+	u32 ihl;
+	u8 ip_proto = 0;
+
+	if (unlikely(!skb_flow_hashrnd_initialized)) {
+		get_random_bytes(&skb_flow_hashrnd, 4);
+		skb_flow_hashrnd_initialized = 1;
+	}
+
+	switch (skb->protocol) {
+	case __constant_htons(ETH_P_IP): {
+		const struct iphdr *iph = (const struct iphdr *) nh;
+
+		if (unlikely(nh < skb->data ||
+			     nh + sizeof(struct iphdr) > skb->tail))
+			return 0;
+		if (!(iph->frag_off & htons(IP_MF | IP_OFFSET)))
+			ip_proto = iph->protocol;
+		addr1 = iph->saddr;
+		addr2 = iph->daddr;
+		ihl = iph->ihl;
+		break;
+	}
+	case __constant_htons(ETH_P_IPV6): {
+		const struct ipv6hdr *ip6h = (const struct ipv6hdr *) nh;
+
+		if (unlikely(nh < skb->data ||
+			     nh + sizeof(struct ipv6hdr) > skb->tail))
+			return 0;
+		ip_proto = ip6h->nexthdr;
+		addr1 = ip6h->saddr.s6_addr32[3];
+		addr2 = ip6h->daddr.s6_addr32[3];
+		ihl = sizeof(struct ipv6hdr) >> 2;
+		break;
+	}
+	default:
+		return 0;
+	}
+
+	switch (ip_proto) {
+	case IPPROTO_TCP:
+	case IPPROTO_UDP:
+	case IPPROTO_DCCP:
+	case IPPROTO_ESP:
+	case IPPROTO_AH:
+	case IPPROTO_SCTP:
+		if (nh + ihl * 4 + 4 <= skb->tail)
+			memcpy(&ports, nh + ihl * 4, 4);
+		break;
+	}
+
+	return jhash_3words(addr1, addr2, ports, skb_flow_hashrnd);
+}
+
+static u16 simple_tx_hash(struct net_device *dev, struct sk_buff *skb)
+{
+	u32 hash = skb_flow_hash(skb, skb->nh.raw);
+
+	return (u16) (((u64) hash * dev->num_tx_queues) >> 32);
+}
+
+static u16 dev_pick_tx(struct net_device *dev, struct sk_buff *skb)
+{
+	u16 queue_index;
+
+	if (skb->queue_mapping_set)
+		return skb->queue_mapping % dev->num_tx_queues;
+
+	if (dev->select_queue)
+		queue_index = dev->select_queue(dev, skb);
+	else
+		queue_index = simple_tx_hash(dev, skb);
+
+	if (unlikely(queue_index >= dev->num_tx_queues))
+		queue_index = 0;
+	return queue_index;
+}
+
 /**
  *	dev_queue_xmit - transmit a buffer
  *	@skb: buffer to transmit
@@ -1423,6 +1602,8 @@ int dev_queue_xmit(struct sk_buff *skb)
 	struct Qdisc *q;
 	int rc = -ENOMEM;
 
+	trace_net_dev_xmit(skb);
+
 	/* GSO will handle the following emulations directly. */
 	if (netif_needs_gso(dev, skb))
 		goto gso;
@@ -1475,6 +1656,27 @@ gso:
 #ifdef CONFIG_NET_CLS_ACT
 	skb->tc_verd = SET_TC_AT(skb->tc_verd,AT_EGRESS);
 #endif
+	if (netif_is_multiqueue(dev))
+		skb->queue_mapping = dev_pick_tx(dev, skb);
+	skb->queue_mapping_set = 0;
+
+	if (q == &mq_qdisc) {
+		/* Each queue has its own qdisc, under its own lock */
+		struct netdev_queue *txq;
+
+		txq = netdev_get_tx_queue(dev, skb->queue_mapping);
+		spin_lock(&txq->lock);
+		q = txq->qdisc;
+
+		rc = q->enqueue(skb, q);
+
+		qdisc_run_queue(txq);
+
+		spin_unlock(&txq->lock);
+		rc = rc == NET_XMIT_BYPASS ? NET_XMIT_SUCCESS : rc;
+		goto out;
+	}
+
 	if (q->enqueue) {
 		/* Grab device queue */
 		spin_lock(&dev->queue_lock);
@@ -1550,6 +1752,123 @@ int weight_p = 64;            /* old backlog weight */
 DEFINE_PER_CPU(struct netif_rx_stats, netdev_rx_stat) = { 0, };
 
 
+/*
+ * The backlog of a cpu is only fed from that cpu, with interrupts off,
+ * unless packets are steered to it from other cpus.
+ */
+static inline void rps_lock(struct softnet_data *queue)
+{
+#ifdef CONFIG_RPS
+	spin_lock(&queue->input_pkt_queue.lock);
+#endif
+}
+
+static inline void rps_unlock(struct softnet_data *queue)
+{
+#ifdef CONFIG_RPS
+	spin_unlock(&queue->input_pkt_queue.lock);
+#endif
+}
+
+#ifdef CONFIG_RPS
+/*
+ * Receive packet steering.  The packets of a device with an rps_map are
+ * processed on the cpu the map gives for the hash of their flow, instead
+ * of on the cpu which took the interrupt.  They are queued to the backlog
+ * of that cpu, which is kicked with an IPI once the receive softirq of
+ * this cpu is over, so that a round of polling sends one IPI per cpu.
+ */
+
+/* The cpu to process @skb on, or -1 if the device does not steer it */
+static int get_rps_cpu(struct net_device *dev, struct sk_buff *skb)
+{
+	struct rps_map *map;
+	int cpu = -1;
+	u32 hash;
+
+	rcu_read_lock();
+	map = rcu_dereference(dev->rps_map);
+	if (map) {
+		hash = skb_flow_hash(skb, skb->data);
+		if (hash) {
+			cpu = map->cpus[((u64) hash * map->len) >> 32];
+			if (unlikely(!cpu_online(cpu)))
+				cpu = -1;
+		}
+	}
+	rcu_read_unlock();
+	return cpu;
+}
+
+/* Runs on a cpu packets were steered to, from the IPI */
+static void rps_trigger_softirq(void *data)
+{
+	struct softnet_data *queue = &__get_cpu_var(softnet_data);
+
+	__get_cpu_var(netdev_rx_stat).received_rps++;
+	netif_rx_schedule(&queue->backlog_dev);
+}
+
+/* Send the IPIs asked for by enqueue_to_backlog(), with interrupts on */
+static void net_rps_action(struct softnet_data *queue)
+{
+	cpumask_t mask;
+	int cpu;
+
+	if (cpus_empty(queue->rps_ipi_mask))
+		return;
+
+	local_irq_disable();
+	mask = queue->rps_ipi_mask;
+	cpus_clear(queue->rps_ipi_mask);
+	local_irq_enable();
+
+	for_each_cpu_mask(cpu, mask)
+		if (cpu_online(cpu))
+			smp_call_function_single(cpu, rps_trigger_softirq,
+						 NULL, 0, 0);
+}
+#endif
+
+/*
+ * Queue a packet to the backlog of @cpu, to be processed by the receive
+ * softirq there.  Called with interrupts off.  The caller frees the
+ * packet if it is dropped.
+ */
+static int enqueue_to_backlog(struct sk_buff *skb, int cpu)
+{
+	struct softnet_data *queue = &per_cpu(softnet_data, cpu);
+
+	__get_cpu_var(netdev_rx_stat).total++;
+
+	rps_lock(queue);
+	if (queue->input_pkt_queue.qlen <= netdev_max_backlog) {
+		if (queue->input_pkt_queue.qlen) {
+enqueue:
+			dev_hold(skb->dev);
+			__skb_queue_tail(&queue->input_pkt_queue, skb);
+			rps_unlock(queue);
+			return NET_RX_SUCCESS;
+		}
+
+#ifdef CONFIG_RPS
+		if (cpu != smp_processor_id()) {
+			struct softnet_data *sd = &__get_cpu_var(softnet_data);
+
+			cpu_set(cpu, sd->rps_ipi_mask);
+			__raise_softirq_irqoff(NET_RX_SOFTIRQ);
+			goto enqueue;
+		}
+#endif
+		netif_rx_schedule(&queue->backlog_dev);
+		goto enqueue;
+	}
+	rps_unlock(queue);
+
+	__get_cpu_var(netdev_rx_stat).dropped++;
+	return NET_RX_DROP;
+}
+
 /**
  *	netif_rx	-	post buffer to the network code
  *	@skb: buffer to post
@@ -1570,8 +1889,9 @@ DEFINE_PER_CPU(struct netif_rx_stats, netdev_rx_stat) = { 0, };
 
 int netif_rx(struct sk_buff *skb)
 {
-	struct softnet_data *queue;
 	unsigned long flags;
+	int cpu = -1;
+	int ret;
 
 	/* if netpoll wants it, pretend we never saw it */
 	if (netpoll_rx(skb))
@@ -1585,27 +1905,17 @@ int netif_rx(struct sk_buff *skb)
 	 * short when CPU is congested, but is still operating.
 	 */
 	local_irq_save(flags);
-	queue = &__get_cpu_var(softnet_data);
-
-	__get_cpu_var(netdev_rx_stat).total++;
-	if (queue->input_pkt_queue.qlen <= netdev_max_backlog) {
-		if (queue->input_pkt_queue.qlen) {
-enqueue:
-			dev_hold(skb->dev);
-			__skb_queue_tail(&queue->input_pkt_queue, skb);
-			local_irq_restore(flags);
-			return NET_RX_SUCCESS;
-		}
-
-		netif_rx_schedule(&queue->backlog_dev);
-		goto enqueue;
-	}
-
-	__get_cpu_var(netdev_rx_stat).dropped++;
+#ifdef CONFIG_RPS
+	cpu = get_rps_cpu(skb->dev, skb);
+#endif
+	if (cpu < 0)
+		cpu = smp_processor_id();
+	ret = enqueue_to_backlog(skb, cpu);
 	local_irq_restore(flags);
 
-	kfree_skb(skb);
-	return NET_RX_DROP;
+	if (ret == NET_RX_DROP)
+		kfree_skb(skb);
+	return ret;
 }
 
 int netif_rx_ni(struct sk_buff *skb)
@@ -1682,6 +1992,30 @@ static void net_tx_action(struct softirq_action *h)
 			}
 		}
 	}
+
+	if (sd->output_txq) {
+		struct netdev_queue *head;
+
+		local_irq_disable();
+		head = sd->output_txq;
+		sd->output_txq = NULL;
+		local_irq_enable();
+
+		while (head) {
+			struct netdev_queue *txq = head;
+			head = head->next_sched;
+
+			smp_mb__before_clear_bit();
+			clear_bit(__QUEUE_STATE_SCHED, &txq->state);
+
+			if (spin_trylock(&txq->lock)) {
+				qdisc_run_queue(txq);
+				spin_unlock(&txq->lock);
+			} else if (!netif_tx_queue_stopped(txq)) {
+				__netif_schedule_txq(txq);
+			}
+		}
+	}
 }
 
 static __inline__ int deliver_skb(struct sk_buff *skb,
@@ -1758,7 +2092,7 @@ static int ing_filter(struct sk_buff *skb)
 }
 #endif
 
-int netif_receive_skb(struct sk_buff *skb)
+static int __netif_receive_skb(struct sk_buff *skb)
 {
 	struct packet_type *ptype, *pt_prev;
 	struct net_device *orig_dev;
@@ -1853,6 +2187,237 @@ out:
 	return ret;
 }
 
+static int netif_steer_skb(struct sk_buff *skb)
+{
+#ifdef CONFIG_RPS
+	int cpu = get_rps_cpu(skb->dev, skb);
+
+	/* Steered to another cpu: processed from its backlog */
+	if (cpu >= 0 && cpu != raw_smp_processor_id()) {
+		unsigned long flags;
+		int ret;
+
+		if (!skb->tstamp.off_sec)
+			net_timestamp(skb);
+
+		local_irq_save(flags);
+		ret = enqueue_to_backlog(skb, cpu);
+		local_irq_restore(flags);
+
+		if (ret == NET_RX_DROP)
+			kfree_skb(skb);
+		return ret;
+	}
+#endif
+	return __netif_receive_skb(skb);
+}
+
+/*
+ * Generic receive offload.  While a device is polled, the segments of a
+ * flow it receives are held back on the cpu and merged into one packet,
+ * which is handed to the protocols when it can take no more and at the
+ * end of the poll.  The protocols match and merge the packets with the
+ * gro_receive and gro_complete of their packet_type, as they segment them
+ * with gso_segment; the result looks to them like a packet from GSO.
+ */
+static int dev_gro_complete(struct sk_buff *skb)
+{
+	struct list_head *head = &ptype_base[ntohs(skb->protocol) & 15];
+	struct packet_type *ptype;
+	int err = -ENOENT;
+
+	if (NAPI_GRO_CB(skb)->count == 1) {
+		skb_shinfo(skb)->gso_size = 0;
+		goto out;
+	}
+
+	rcu_read_lock();
+	list_for_each_entry_rcu(ptype, head, list) {
+		if (ptype->type != skb->protocol || ptype->dev ||
+		    !ptype->gro_complete)
+			continue;
+
+		err = ptype->gro_complete(skb);
+		break;
+	}
+	rcu_read_unlock();
+
+	if (unlikely(err)) {
+		WARN_ON(&ptype->list == head);
+		kfree_skb(skb);
+		return NET_RX_DROP;
+	}
+
+out:
+	return netif_steer_skb(skb);
+}
+
+static void dev_gro_flush(struct softnet_data *queue)
+{
+	struct sk_buff *skb, *next;
+
+	for (skb = queue->gro_list; skb; skb = next) {
+		next = skb->next;
+		skb->next = NULL;
+		dev_gro_complete(skb);
+	}
+	queue->gro_list = NULL;
+	queue->gro_count = 0;
+}
+
+static int dev_gro_receive(struct softnet_data *queue, struct sk_buff *skb)
+{
+	struct list_head *head = &ptype_base[ntohs(skb->protocol) & 15];
+	struct packet_type *ptype;
+	struct sk_buff **pp = NULL;
+	struct sk_buff *p;
+	unsigned int maclen;
+
+	/* Checksums of the merged segments are never looked at again */
+	if (skb->ip_summed != CHECKSUM_UNNECESSARY ||
+	    skb_shinfo(skb)->frag_list || skb_cloned(skb))
+		goto normal;
+
+	maclen = skb->data - skb->mac.raw;
+
+	rcu_read_lock();
+	list_for_each_entry_rcu(ptype, head, list) {
+		if (ptype->type != skb->protocol || ptype->dev ||
+		    !ptype->gro_receive)
+			continue;
+
+		for (p = queue->gro_list; p; p = p->next) {
+			NAPI_GRO_CB(p)->same_flow = p->dev == skb->dev &&
+				p->data - p->mac.raw == maclen &&
+				!memcmp(p->mac.raw, skb->mac.raw, maclen);
+			NAPI_GRO_CB(p)->flush = 0;
+		}
+
+		NAPI_GRO_CB(skb)->data_offset = 0;
+		NAPI_GRO_CB(skb)->same_flow = 0;
+		NAPI_GRO_CB(skb)->flush = 0;
+		NAPI_GRO_CB(skb)->count = 1;
+		NAPI_GRO_CB(skb)->last = NULL;
+
+		pp = ptype->gro_receive(&queue->gro_list, skb);
+		break;
+	}
+	rcu_read_unlock();
+
+	if (&ptype->list == head)
+		goto normal;
+
+	/* A held packet of the flow is done, it goes up ahead of skb */
+	if (pp) {
+		p = *pp;
+		*pp = p->next;
+		p->next = NULL;
+		queue->gro_count--;
+		dev_gro_complete(p);
+	}
+
+	if (NAPI_GRO_CB(skb)->same_flow)
+		return NET_RX_SUCCESS;
+
+	if (NAPI_GRO_CB(skb)->flush || queue->gro_count >= MAX_GRO_SKBS)
+		goto normal;
+
+	/* The first segment gives the size of those merged into it */
+	skb_shinfo(skb)->gso_size = skb->len - NAPI_GRO_CB(skb)->data_offset;
+	skb->next = queue->gro_list;
+	queue->gro_list = skb;
+	queue->gro_count++;
+	return NET_RX_SUCCESS;
+
+normal:
+	return netif_steer_skb(skb);
+}
+
+/**
+ *	netif_receive_skb - process receive buffer from network
+ *	@skb: buffer to process
+ *
+ *	The receive path of NAPI drivers, called from their poll.  A TCP
+ *	segment may be held back by receive offload (NETIF_F_GRO) until the
+ *	end of the poll, to go up merged with the next ones of its flow.
+ */
+int netif_receive_skb(struct sk_buff *skb)
+{
+	struct softnet_data *queue = &__get_cpu_var(softnet_data);
+
+	trace_net_dev_receive(skb);
+	if (queue->gro_dev == skb->dev && (skb->dev->features & NETIF_F_GRO))
+		return dev_gro_receive(queue, skb);
+	return netif_steer_skb(skb);
+}
+
+/*
+ * Poll a device from net_rx_action(), and push up what receive offload
+ * is holding of it at the end.
+ */
+static int dev_rx_poll(struct softnet_data *queue, struct net_device *dev,
+		       int *budget)
+{
+	int ret;
+
+	queue->gro_dev = dev;
+	ret = dev->poll(dev, budget);
+	queue->gro_dev = NULL;
+
+	if (queue->gro_list)
+		dev_gro_flush(queue);
+	return ret;
+}
+
+int sysctl_net_busy_read __read_mostly;
+
+/**
+ *	sk_busy_loop - poll the device for a socket instead of sleeping
+ *	@sk: socket whose receive queue is empty
+ *	@nonblock: poll once only
+ *
+ *	Runs the busy_poll routine of the device @sk last received from
+ *	until a packet lands in its receive queue, for at most
+ *	@sk->sk_ll_usec microseconds or until the task should give up the
+ *	CPU.  Packets found go up the stack from here, with bottom halves
+ *	disabled, and not through receive offload, which only merges
+ *	within a NAPI poll.  Returns non-zero if the queue is non-empty.
+ */
+int sk_busy_loop(struct sock *sk, int nonblock)
+{
+	struct net_device *dev;
+	s64 end;
+	int rc = 0;
+
+	dev = dev_get_by_index(sk->sk_rx_ifindex);
+	if (!dev)
+		return 0;
+	if (!dev->busy_poll)
+		goto out;
+
+	sk->sk_bp_stats.polls++;
+	end = ktime_to_ns(ktime_get()) + (s64)sk->sk_ll_usec * NSEC_PER_USEC;
+	for (;;) {
+		local_bh_disable();
+		if (netif_running(dev))
+			dev->busy_poll(dev, BUSY_POLL_BUDGET);
+		local_bh_enable();
+
+		rc = !skb_queue_empty(&sk->sk_receive_queue);
+		if (rc || nonblock || need_resched() ||
+		    signal_pending(current) ||
+		    ktime_to_ns(ktime_get()) >= end)
+			break;
+		cpu_relax();
+	}
+	if (rc)
+		sk->sk_bp_stats.hits++;
+out:
+	dev_put(dev);
+	return rc;
+}
+EXPORT_SYMBOL(sk_busy_loop);
+
 static int process_backlog(struct net_device *backlog_dev, int *budget)
 {
 	int work = 0;
@@ -1866,14 +2431,16 @@ static int process_backlog(struct net_device *backlog_dev, int *budget)
 		struct net_device *dev;
 
 		local_irq_disable();
+		rps_lock(queue);
 		skb = __skb_dequeue(&queue->input_pkt_queue);
 		if (!skb)
 			goto job_done;
+		rps_unlock(queue);
 		local_irq_enable();
 
 		dev = skb->dev;
 
-		netif_receive_skb(skb);
+		__netif_receive_skb(skb);
 
 		dev_put(dev);
 
@@ -1896,6 +2463,7 @@ job_done:
 	smp_mb__before_clear_bit();
 	netif_poll_enable(backlog_dev);
 
+	rps_unlock(queue);
 	local_irq_enable();
 	return 0;
 }
@@ -1921,7 +2489,7 @@ static void net_rx_action(struct softirq_action *h)
 				 struct net_device, poll_list);
 		have = netpoll_poll_lock(dev);
 
-		if (dev->quota <= 0 || dev->poll(dev, &budget)) {
+		if (dev->quota <= 0 || dev_rx_poll(queue, dev, &budget)) {
 			netpoll_poll_unlock(have);
 			local_irq_disable();
 			list_move_tail(&dev->poll_list, &queue->poll_list);
@@ -1950,6 +2518,9 @@ out:
 	}
 #endif
 	local_irq_enable();
+#ifdef CONFIG_RPS
+	net_rps_action(queue);
+#endif
 	return;
 
 softnet_break:
@@ -2180,10 +2751,10 @@ static int softnet_seq_show(struct seq_file *seq, void *v)
 {
 	struct netif_rx_stats *s = v;
 
-	seq_printf(seq, "%08x %08x %08x %08x %08x %08x %08x %08x %08x\n",
+	seq_printf(seq, "%08x %08x %08x %08x %08x %08x %08x %08x %08x %08x\n",
 		   s->total, s->dropped, s->time_squeeze, 0,
 		   0, 0, 0, 0, /* was fastroute */
-		   s->cpu_collision );
+		   s->cpu_collision, s->received_rps);
 	return 0;
 }
 
@@ -2960,6 +3531,10 @@ int register_netdevice(struct net_device *dev)
 		}
 	}
 
+	/* Receive offload is done in the poll loop, for NAPI devices. */
+	if (dev->poll)
+		dev->features |= NETIF_F_GRO;
+
 	/*
 	 *	nil rebuild_header routine,
 	 *	that should be never called and used as just bug trap.
@@ -3176,25 +3751,36 @@ out:
 }
 
 /**
- *	alloc_netdev - allocate network device
+ *	alloc_netdev_mq - allocate multiqueue network device
  *	@sizeof_priv:	size of private data to allocate space for
  *	@name:		device name format string
  *	@setup:		callback to initialize device
+ *	@queue_count:	the number of transmit queues of the device
  *
  *	Allocates a struct net_device with private data area for driver use
- *	and performs basic initialization.
+ *	and performs basic initialization.  A device with more than one
+ *	queue gets a struct netdev_queue for each, after the private area.
  */
-struct net_device *alloc_netdev(int sizeof_priv, const char *name,
-		void (*setup)(struct net_device *))
+struct net_device *alloc_netdev_mq(int sizeof_priv, const char *name,
+		void (*setup)(struct net_device *), unsigned int queue_count)
 {
 	void *p;
 	struct net_device *dev;
 	int alloc_size;
+	unsigned int i;
+
+	if (queue_count < 1)
+		queue_count = 1;
 
 	/* ensure 32-byte alignment of both the device and private area */
 	alloc_size = (sizeof(*dev) + NETDEV_ALIGN_CONST) & ~NETDEV_ALIGN_CONST;
 	alloc_size += sizeof_priv + NETDEV_ALIGN_CONST;
 
+	/* and cache line alignment of the queues */
+	if (queue_count > 1)
+		alloc_size += SMP_CACHE_BYTES - 1 +
+			queue_count * sizeof(struct netdev_queue);
+
 	p = kzalloc(alloc_size, GFP_KERNEL);
 	if (!p) {
 		printk(KERN_ERR "alloc_dev: Unable to allocate device.\n");
@@ -3208,10 +3794,43 @@ struct net_device *alloc_netdev(int sizeof_priv, const char *name,
 	if (sizeof_priv)
 		dev->priv = netdev_priv(dev);
 
+	dev->num_tx_queues = queue_count;
+	if (queue_count > 1) {
+		dev->tx_queues = (struct netdev_queue *)
+			ALIGN((unsigned long)netdev_priv(dev) + sizeof_priv,
+			      SMP_CACHE_BYTES);
+		for (i = 0; i < queue_count; i++) {
+			struct netdev_queue *txq = &dev->tx_queues[i];
+
+			spin_lock_init(&txq->lock);
+			spin_lock_init(&txq->_xmit_lock);
+			txq->xmit_lock_owner = -1;
+			txq->qdisc = &noop_qdisc;
+			txq->qdisc_sleeping = &noop_qdisc;
+			txq->dev = dev;
+		}
+	}
+
 	setup(dev);
 	strcpy(dev->name, name);
 	return dev;
 }
+EXPORT_SYMBOL(alloc_netdev_mq);
+
+/**
+ *	alloc_netdev - allocate network device
+ *	@sizeof_priv:	size of private data to allocate space for
+ *	@name:		device name format string
+ *	@setup:		callback to initialize device
+ *
+ *	Allocates a struct net_device with private data area for driver use
+ *	and performs basic initialization.
+ */
+struct net_device *alloc_netdev(int sizeof_priv, const char *name,
+		void (*setup)(struct net_device *))
+{
+	return alloc_netdev_mq(sizeof_priv, name, setup, 1);
+}
 EXPORT_SYMBOL(alloc_netdev);
 
 /**
@@ -3224,6 +3843,10 @@ EXPORT_SYMBOL(alloc_netdev);
  */
 void free_netdev(struct net_device *dev)
 {
+#ifdef CONFIG_RPS
+	kfree(dev->rps_map);
+	dev->rps_map = NULL;
+#endif
 #ifdef CONFIG_SYSFS
 	/*  Compatibility with error handling in drivers */
 	if (dev->reg_state == NETREG_UNINITIALIZED) {
@@ -3362,6 +3985,7 @@ static int dev_cpu_callback(struct notifier_block *nfb,
 {
 	struct sk_buff **list_skb;
 	struct net_device **list_net;
+	struct netdev_queue **list_txq;
 	struct sk_buff *skb;
 	unsigned int cpu, oldcpu = (unsigned long)ocpu;
 	struct softnet_data *sd, *oldsd;
@@ -3390,6 +4014,20 @@ static int dev_cpu_callback(struct notifier_block *nfb,
 	*list_net = oldsd->output_queue;
 	oldsd->output_queue = NULL;
 
+	/* The same for the queues of multiqueue devices */
+	list_txq = &sd->output_txq;
+	while (*list_txq)
+		list_txq = &(*list_txq)->next_sched;
+	*list_txq = oldsd->output_txq;
+	oldsd->output_txq = NULL;
+
+#ifdef CONFIG_RPS
+	/* Kick the cpus it steered packets to */
+	cpus_or(sd->rps_ipi_mask, sd->rps_ipi_mask, oldsd->rps_ipi_mask);
+	cpus_clear(oldsd->rps_ipi_mask);
+	raise_softirq_irqoff(NET_RX_SOFTIRQ);
+#endif
+
 	raise_softirq_irqoff(NET_TX_SOFTIRQ);
 	local_irq_enable();
 
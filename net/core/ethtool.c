@@ -637,6 +637,165 @@ static int ethtool_set_gso(struct net_device *dev, char __user *useraddr)
 	return 0;
 }
 
+static int ethtool_get_gro(struct net_device *dev, char __user *useraddr)
+{
+	struct ethtool_value edata = { ETHTOOL_GGRO };
+
+	edata.data = dev->features & NETIF_F_GRO;
+	if (copy_to_user(useraddr, &edata, sizeof(edata)))
+		 return -EFAULT;
+	return 0;
+}
+
+static int ethtool_set_gro(struct net_device *dev, char __user *useraddr)
+{
+	struct ethtool_value edata;
+
+	if (copy_from_user(&edata, useraddr, sizeof(edata)))
+		return -EFAULT;
+	if (edata.data) {
+		/* Packets are only merged in the NAPI poll loop. */
+		if (!dev->poll)
+			return -EINVAL;
+		dev->features |= NETIF_F_GRO;
+	} else
+		dev->features &= ~NETIF_F_GRO;
+	return 0;
+}
+
+static int ethtool_get_coalesce_profile(struct net_device *dev,
+					char __user *useraddr)
+{
+	struct ethtool_value edata = { ETHTOOL_GCOALPROFILE };
+
+	if (!dev->ethtool_ops->get_coalesce_profile)
+		return -EOPNOTSUPP;
+	edata.data = dev->ethtool_ops->get_coalesce_profile(dev);
+	if (copy_to_user(useraddr, &edata, sizeof(edata)))
+		return -EFAULT;
+	return 0;
+}
+
+static int ethtool_set_coalesce_profile(struct net_device *dev,
+					char __user *useraddr)
+{
+	struct ethtool_value edata;
+
+	if (!dev->ethtool_ops->set_coalesce_profile)
+		return -EOPNOTSUPP;
+	if (copy_from_user(&edata, useraddr, sizeof(edata)))
+		return -EFAULT;
+	return dev->ethtool_ops->set_coalesce_profile(dev, edata.data);
+}
+
+static int ethtool_get_rxfh(struct net_device *dev, char __user *useraddr)
+{
+	struct ethtool_ops *ops = dev->ethtool_ops;
+	struct ethtool_rxfh rxfh;
+	u32 indir_size = 0, key_size = 0;
+	u32 *indir;
+	u8 *data;
+	int ret;
+
+	if (!ops->get_rx_rings || !ops->get_rxfh)
+		return -EOPNOTSUPP;
+
+	if (copy_from_user(&rxfh, useraddr, sizeof(rxfh)))
+		return -EFAULT;
+
+	if (ops->get_rxfh_indir_size)
+		indir_size = ops->get_rxfh_indir_size(dev);
+	if (ops->get_rxfh_key_size)
+		key_size = ops->get_rxfh_key_size(dev);
+
+	/* both sizes 0: the caller only wants to know how big things are */
+	if (!rxfh.indir_size && !rxfh.key_size) {
+		rxfh.rx_rings = ops->get_rx_rings(dev);
+		rxfh.indir_size = indir_size;
+		rxfh.key_size = key_size;
+		if (copy_to_user(useraddr, &rxfh, sizeof(rxfh)))
+			return -EFAULT;
+		return 0;
+	}
+
+	if (rxfh.indir_size != indir_size || rxfh.key_size != key_size)
+		return -EINVAL;
+
+	data = kzalloc(indir_size * sizeof(u32) + key_size, GFP_USER);
+	if (!data)
+		return -ENOMEM;
+	indir = (u32 *)data;
+
+	ret = ops->get_rxfh(dev, indir_size ? indir : NULL,
+			    key_size ? data + indir_size * sizeof(u32) : NULL);
+	if (ret)
+		goto out;
+	rxfh.rx_rings = ops->get_rx_rings(dev);
+
+	ret = -EFAULT;
+	if (copy_to_user(useraddr, &rxfh, sizeof(rxfh)))
+		goto out;
+	useraddr += sizeof(rxfh);
+	if (copy_to_user(useraddr, data, indir_size * sizeof(u32) + key_size))
+		goto out;
+	ret = 0;
+
+ out:
+	kfree(data);
+	return ret;
+}
+
+static int ethtool_set_rxfh(struct net_device *dev, char __user *useraddr)
+{
+	struct ethtool_ops *ops = dev->ethtool_ops;
+	struct ethtool_rxfh rxfh;
+	u32 indir_size = 0, key_size = 0;
+	u32 rings, i, bytes;
+	u32 *indir;
+	u8 *data;
+	int ret;
+
+	if (!ops->get_rx_rings || !ops->set_rxfh)
+		return -EOPNOTSUPP;
+
+	if (copy_from_user(&rxfh, useraddr, sizeof(rxfh)))
+		return -EFAULT;
+
+	if (ops->get_rxfh_indir_size)
+		indir_size = ops->get_rxfh_indir_size(dev);
+	if (ops->get_rxfh_key_size)
+		key_size = ops->get_rxfh_key_size(dev);
+
+	if ((!rxfh.indir_size && !rxfh.key_size) ||
+	    (rxfh.indir_size && rxfh.indir_size != indir_size) ||
+	    (rxfh.key_size && rxfh.key_size != key_size))
+		return -EINVAL;
+
+	bytes = rxfh.indir_size * sizeof(u32) + rxfh.key_size;
+	data = kmalloc(bytes, GFP_USER);
+	if (!data)
+		return -ENOMEM;
+	indir = (u32 *)data;
+
+	ret = -EFAULT;
+	if (copy_from_user(data, useraddr + sizeof(rxfh), bytes))
+		goto out;
+
+	ret = -EINVAL;
+	rings = ops->get_rx_rings(dev);
+	for (i = 0; i < rxfh.indir_size; i++)
+		if (indir[i] >= rings)
+			goto out;
+
+	ret = ops->set_rxfh(dev, rxfh.indir_size ? indir : NULL,
+			    rxfh.key_size ?
+			    data + rxfh.indir_size * sizeof(u32) : NULL);
+
+ out:
+	kfree(data);
+	return ret;
+}
+
 static int ethtool_self_test(struct net_device *dev, char __user *useraddr)
 {
 	struct ethtool_test test;
@@ -934,6 +1093,24 @@ int dev_ethtool(struct ifreq *ifr)
 	case ETHTOOL_SGSO:
 		rc = ethtool_set_gso(dev, useraddr);
 		break;
+	case ETHTOOL_GGRO:
+		rc = ethtool_get_gro(dev, useraddr);
+		break;
+	case ETHTOOL_SGRO:
+		rc = ethtool_set_gro(dev, useraddr);
+		break;
+	case ETHTOOL_GCOALPROFILE:
+		rc = ethtool_get_coalesce_profile(dev, useraddr);
+		break;
+	case ETHTOOL_SCOALPROFILE:
+		rc = ethtool_set_coalesce_profile(dev, useraddr);
+		break;
+	case ETHTOOL_GRXFH:
+		rc = ethtool_get_rxfh(dev, useraddr);
+		break;
+	case ETHTOOL_SRXFH:
+		rc = ethtool_set_rxfh(dev, useraddr);
+		break;
 	default:
 		rc =  -EOPNOTSUPP;
 	}
@@ -277,6 +277,49 @@ load_b:
 	return 0;
 }
 
+/**
+ *	sk_filter_load_slow - out of line packet load for compiled filters
+ *	@skb: buffer the filter runs on
+ *	@k: offset of the load, possibly negative
+ *	@size: width of the load in bytes (1, 2 or 4)
+ *	@res: where to store the loaded value, in host byte order
+ *
+ * JIT compiled filters handle loads from the linear part of the skb
+ * inline and call here for everything else: paged data, the network
+ * and link layer offsets and ancillary data.  Mirrors sk_run_filter()
+ * exactly.  Returns 0 on success, or -EINVAL when the interpreter
+ * would have stopped and returned 0.
+ */
+int sk_filter_load_slow(struct sk_buff *skb, int k, unsigned int size, u32 *res)
+{
+	void *ptr;
+	u32 tmp;
+
+	ptr = load_pointer(skb, k, size, &tmp);
+	if (ptr != NULL) {
+		if (size == 4)
+			*res = ntohl(get_unaligned((u32 *)ptr));
+		else if (size == 2)
+			*res = ntohs(get_unaligned((u16 *)ptr));
+		else
+			*res = *(u8 *)ptr;
+		return 0;
+	}
+
+	switch (k-SKF_AD_OFF) {
+	case SKF_AD_PROTOCOL:
+		*res = htons(skb->protocol);
+		return 0;
+	case SKF_AD_PKTTYPE:
+		*res = skb->pkt_type;
+		return 0;
+	case SKF_AD_IFINDEX:
+		*res = skb->dev->ifindex;
+		return 0;
+	}
+	return -EINVAL;
+}
+
 /**
  *	sk_chk_filter - verify socket filter code
  *	@filter: filter to verify
@@ -417,11 +460,14 @@ int sk_attach_filter(struct sock_fprog *fprog, struct sock *sk)
 
 	atomic_set(&fp->refcnt, 1);
 	fp->len = fprog->len;
+	fp->bpf_func = sk_run_filter;
 
 	err = sk_chk_filter(fp->insns, fp->len);
 	if (!err) {
 		struct sk_filter *old_fp;
 
+		bpf_jit_compile(fp);
+
 		spin_lock_bh(&sk->sk_lock.slock);
 		old_fp = sk->sk_filter;
 		sk->sk_filter = fp;
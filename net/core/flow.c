@@ -35,24 +35,33 @@ struct flow_cache_entry {
 	u32			sk_sid;
 	void			*object;
 	atomic_t		*object_ref;
+	struct flow_cache_ops	*ops;
 };
 
 atomic_t flow_cache_genid = ATOMIC_INIT(0);
 
-static u32 flow_hash_shift;
-#define flow_hash_size	(1 << flow_hash_shift)
+/*
+ * Every cpu starts out with a table of 1 << FLOW_HASH_SHIFT_MIN chains
+ * and doubles it, up to flow_hash_shift_max, whenever it holds more than
+ * four entries per chain.  Only when it cannot grow any more are entries
+ * thrown away to make room.
+ */
+#define FLOW_HASH_SHIFT_MIN	10
+#define FLOW_HASH_SHIFT_MAX	16
+
+static int flow_hash_shift_max __read_mostly;
+
 static DEFINE_PER_CPU(struct flow_cache_entry **, flow_tables) = { NULL };
 
 #define flow_table(cpu) (per_cpu(flow_tables, cpu))
 
 static kmem_cache_t *flow_cachep __read_mostly;
 
-static int flow_lwm, flow_hwm;
-
 struct flow_percpu_info {
 	int hash_rnd_recalc;
 	u32 hash_rnd;
 	int count;
+	int hash_shift;
 } ____cacheline_aligned;
 static DEFINE_PER_CPU(struct flow_percpu_info, flow_hash_info) = { 0 };
 
@@ -62,6 +71,11 @@ static DEFINE_PER_CPU(struct flow_percpu_info, flow_hash_info) = { 0 };
 	(per_cpu(flow_hash_info, cpu).hash_rnd)
 #define flow_count(cpu) \
 	(per_cpu(flow_hash_info, cpu).count)
+#define flow_hash_shift(cpu) \
+	(per_cpu(flow_hash_info, cpu).hash_shift)
+#define flow_hash_size(cpu)	(1 << flow_hash_shift(cpu))
+#define flow_lwm(cpu)		(2 * flow_hash_size(cpu))
+#define flow_hwm(cpu)		(4 * flow_hash_size(cpu))
 
 static struct timer_list flow_hash_rnd_timer;
 
@@ -86,12 +100,31 @@ static void flow_cache_new_hashrnd(unsigned long arg)
 	add_timer(&flow_hash_rnd_timer);
 }
 
+/*
+ * A cached object stays good until a new object that might be the
+ * answer instead shows up, which bumps flow_cache_genid, or until its
+ * owner retires it, which the ->check() of the owner tells.
+ */
+static inline int flow_entry_valid(struct flow_cache_entry *fle)
+{
+	if (fle->genid != atomic_read(&flow_cache_genid))
+		return 0;
+	return !fle->object || fle->ops->check(fle->object);
+}
+
+static inline void flow_entry_put(struct flow_cache_entry *fle)
+{
+	if (fle->object)
+		fle->ops->put(fle->object);
+	fle->object = NULL;
+}
+
 static void __flow_cache_shrink(int cpu, int shrink_to)
 {
 	struct flow_cache_entry *fle, **flp;
 	int i;
 
-	for (i = 0; i < flow_hash_size; i++) {
+	for (i = 0; i < flow_hash_size(cpu); i++) {
 		int k = 0;
 
 		flp = &flow_table(cpu)[i];
@@ -101,8 +134,7 @@ static void __flow_cache_shrink(int cpu, int shrink_to)
 		}
 		while ((fle = *flp) != NULL) {
 			*flp = fle->next;
-			if (fle->object)
-				atomic_dec(fle->object_ref);
+			flow_entry_put(fle);
 			kmem_cache_free(flow_cachep, fle);
 			flow_count(cpu)--;
 		}
@@ -111,7 +143,7 @@ static void __flow_cache_shrink(int cpu, int shrink_to)
 
 static void flow_cache_shrink(int cpu)
 {
-	int shrink_to = flow_lwm / flow_hash_size;
+	int shrink_to = flow_lwm(cpu) / flow_hash_size(cpu);
 
 	__flow_cache_shrink(cpu, shrink_to);
 }
@@ -129,7 +161,59 @@ static u32 flow_hash_code(struct flowi *key, int cpu)
 	u32 *k = (u32 *) key;
 
 	return (jhash2(k, (sizeof(*key) / sizeof(u32)), flow_hash_rnd(cpu)) &
-		(flow_hash_size - 1));
+		(flow_hash_size(cpu) - 1));
+}
+
+static unsigned long flow_table_order(int shift)
+{
+	unsigned long order;
+
+	for (order = 0;
+	     (PAGE_SIZE << order) <
+		     (sizeof(struct flow_cache_entry *) << shift);
+	     order++)
+		/* NOTHING */;
+
+	return order;
+}
+
+/*
+ * Double the table of this cpu and rehash what it holds.  Runs with BHs
+ * off, so the allocation must not sleep; if it fails the caller shrinks
+ * the table instead.
+ */
+static int flow_cache_grow(int cpu)
+{
+	struct flow_cache_entry **old_table, **new_table, *fle;
+	int old_size, i;
+
+	if (flow_hash_shift(cpu) >= flow_hash_shift_max)
+		return 0;
+
+	new_table = (struct flow_cache_entry **)
+		__get_free_pages(GFP_ATOMIC|__GFP_NOWARN|__GFP_ZERO,
+				 flow_table_order(flow_hash_shift(cpu) + 1));
+	if (!new_table)
+		return 0;
+
+	old_table = flow_table(cpu);
+	old_size = flow_hash_size(cpu);
+	flow_table(cpu) = new_table;
+	flow_hash_shift(cpu)++;
+
+	for (i = 0; i < old_size; i++) {
+		while ((fle = old_table[i]) != NULL) {
+			unsigned int hash = flow_hash_code(&fle->key, cpu);
+
+			old_table[i] = fle->next;
+			fle->next = new_table[hash];
+			new_table[hash] = fle;
+		}
+	}
+
+	free_pages((unsigned long)old_table,
+		   flow_table_order(flow_hash_shift(cpu) - 1));
+	return 1;
 }
 
 #if (BITS_PER_LONG == 64)
@@ -166,7 +250,7 @@ static int flow_key_compare(struct flowi *key1, struct flowi *key2)
 }
 
 void *flow_cache_lookup(struct flowi *key, u32 sk_sid, u16 family, u8 dir,
-			flow_resolve_t resolver)
+			struct flow_cache_ops *ops)
 {
 	struct flow_cache_entry *fle, **head;
 	unsigned int hash;
@@ -191,7 +275,7 @@ void *flow_cache_lookup(struct flowi *key, u32 sk_sid, u16 family, u8 dir,
 		    fle->dir == dir &&
 		    fle->sk_sid == sk_sid &&
 		    flow_key_compare(key, &fle->key) == 0) {
-			if (fle->genid == atomic_read(&flow_cache_genid)) {
+			if (flow_entry_valid(fle)) {
 				void *ret = fle->object;
 
 				if (ret)
@@ -205,8 +289,12 @@ void *flow_cache_lookup(struct flowi *key, u32 sk_sid, u16 family, u8 dir,
 	}
 
 	if (!fle) {
-		if (flow_count(cpu) > flow_hwm)
-			flow_cache_shrink(cpu);
+		if (flow_count(cpu) > flow_hwm(cpu)) {
+			if (flow_cache_grow(cpu))
+				head = &flow_table(cpu)[flow_hash_code(key, cpu)];
+			else
+				flow_cache_shrink(cpu);
+		}
 
 		fle = kmem_cache_alloc(flow_cachep, SLAB_ATOMIC);
 		if (fle) {
@@ -226,16 +314,16 @@ nocache:
 		void *obj;
 		atomic_t *obj_ref;
 
-		resolver(key, sk_sid, family, dir, &obj, &obj_ref);
+		ops->resolve(key, sk_sid, family, dir, &obj, &obj_ref);
 
 		if (fle) {
 			fle->genid = atomic_read(&flow_cache_genid);
 
-			if (fle->object)
-				atomic_dec(fle->object_ref);
+			flow_entry_put(fle);
 
 			fle->object = obj;
 			fle->object_ref = obj_ref;
+			fle->ops = ops;
 			if (obj)
 				atomic_inc(fle->object_ref);
 		}
@@ -252,18 +340,15 @@ static void flow_cache_flush_tasklet(unsigned long data)
 	int cpu;
 
 	cpu = smp_processor_id();
-	for (i = 0; i < flow_hash_size; i++) {
+	for (i = 0; i < flow_hash_size(cpu); i++) {
 		struct flow_cache_entry *fle;
 
 		fle = flow_table(cpu)[i];
 		for (; fle; fle = fle->next) {
-			unsigned genid = atomic_read(&flow_cache_genid);
-
-			if (!fle->object || fle->genid == genid)
+			if (!fle->object || flow_entry_valid(fle))
 				continue;
 
-			fle->object = NULL;
-			atomic_dec(fle->object_ref);
+			flow_entry_put(fle);
 		}
 	}
 
@@ -309,19 +394,14 @@ void flow_cache_flush(void)
 static void __devinit flow_cache_cpu_prepare(int cpu)
 {
 	struct tasklet_struct *tasklet;
-	unsigned long order;
-
-	for (order = 0;
-	     (PAGE_SIZE << order) <
-		     (sizeof(struct flow_cache_entry *)*flow_hash_size);
-	     order++)
-		/* NOTHING */;
+	unsigned long order = flow_table_order(FLOW_HASH_SHIFT_MIN);
 
 	flow_table(cpu) = (struct flow_cache_entry **)
 		__get_free_pages(GFP_KERNEL|__GFP_ZERO, order);
 	if (!flow_table(cpu))
 		panic("NET: failed to allocate flow cache order %lu\n", order);
 
+	flow_hash_shift(cpu) = FLOW_HASH_SHIFT_MIN;
 	flow_hash_rnd_recalc(cpu) = 1;
 	flow_count(cpu) = 0;
 
@@ -342,6 +422,7 @@ static int flow_cache_cpu(struct notifier_block *nfb,
 
 static int __init flow_cache_init(void)
 {
+	unsigned long limit;
 	int i;
 
 	flow_cachep = kmem_cache_create("flow_cache",
@@ -352,9 +433,14 @@ static int __init flow_cache_init(void)
 	if (!flow_cachep)
 		panic("NET: failed to allocate flow cache slab\n");
 
-	flow_hash_shift = 10;
-	flow_lwm = 2 * flow_hash_size;
-	flow_hwm = 4 * flow_hash_size;
+	/* A full table on one cpu takes at most 1/512th of memory */
+	limit = (num_physpages >> 9) << PAGE_SHIFT;
+	limit /= 4 * sizeof(struct flow_cache_entry) +
+		 sizeof(struct flow_cache_entry *);
+	flow_hash_shift_max = FLOW_HASH_SHIFT_MIN;
+	while (flow_hash_shift_max < FLOW_HASH_SHIFT_MAX &&
+	       (2UL << flow_hash_shift_max) <= limit)
+		flow_hash_shift_max++;
 
 	init_timer(&flow_hash_rnd_timer);
 	flow_hash_rnd_timer.function = flow_cache_new_hashrnd;
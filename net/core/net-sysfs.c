@@ -221,6 +221,75 @@ static ssize_t store_weight(struct class_device *dev, const char *buf, size_t le
 	return netdev_store(dev, buf, len, change_weight);
 }
 
+#ifdef CONFIG_RPS
+static ssize_t show_rps_cpus(struct class_device *dev, char *buf)
+{
+	struct net_device *net = to_net_dev(dev);
+	struct rps_map *map;
+	cpumask_t mask;
+	int i, len;
+
+	cpus_clear(mask);
+	rcu_read_lock();
+	map = rcu_dereference(net->rps_map);
+	if (map)
+		for (i = 0; i < map->len; i++)
+			cpu_set(map->cpus[i], mask);
+	rcu_read_unlock();
+
+	len = cpulist_scnprintf(buf, PAGE_SIZE - 1, mask);
+	buf[len++] = '\n';
+	return len;
+}
+
+static void rps_map_release(struct rcu_head *rcu)
+{
+	kfree(container_of(rcu, struct rps_map, rcu));
+}
+
+/* An empty list of cpus turns steering off */
+static ssize_t store_rps_cpus(struct class_device *dev, const char *buf, size_t len)
+{
+	struct net_device *net = to_net_dev(dev);
+	struct rps_map *map, *old;
+	cpumask_t mask;
+	int cpu, i = 0;
+
+	if (!capable(CAP_NET_ADMIN))
+		return -EPERM;
+
+	cpus_clear(mask);
+	if (*buf != '\0' && *buf != '\n' && cpulist_parse(buf, mask))
+		return -EINVAL;
+	cpus_and(mask, mask, cpu_possible_map);
+
+	map = NULL;
+	if (!cpus_empty(mask)) {
+		map = kmalloc(sizeof(*map) + cpus_weight(mask) * sizeof(u16),
+			      GFP_KERNEL);
+		if (!map)
+			return -ENOMEM;
+		for_each_cpu_mask(cpu, mask)
+			map->cpus[i++] = cpu;
+		map->len = i;
+	}
+
+	rtnl_lock();
+	if (!dev_isalive(net)) {
+		rtnl_unlock();
+		kfree(map);
+		return -EINVAL;
+	}
+	old = net->rps_map;
+	rcu_assign_pointer(net->rps_map, map);
+	rtnl_unlock();
+
+	if (old)
+		call_rcu(&old->rcu, rps_map_release);
+	return len;
+}
+#endif
+
 static struct class_device_attribute net_class_attributes[] = {
 	__ATTR(addr_len, S_IRUGO, show_addr_len, NULL),
 	__ATTR(iflink, S_IRUGO, show_iflink, NULL),
@@ -238,6 +307,9 @@ static struct class_device_attribute net_class_attributes[] = {
 	__ATTR(tx_queue_len, S_IRUGO | S_IWUSR, show_tx_queue_len,
 	       store_tx_queue_len),
 	__ATTR(weight, S_IRUGO | S_IWUSR, show_weight, store_weight),
+#ifdef CONFIG_RPS
+	__ATTR(rps_cpus, S_IRUGO | S_IWUSR, show_rps_cpus, store_rps_cpus),
+#endif
 	{}
 };
 
@@ -0,0 +1,339 @@
+/*
+ * net/core/net_dim.c	Dynamic interrupt moderation for NAPI drivers.
+ *
+ *		This program is free software; you can redistribute it and/or
+ *		modify it under the terms of the GNU General Public License
+ *		as published by the Free Software Foundation; either version
+ *		2 of the License, or (at your option) any later version.
+ *
+ *	A hill climb over a small table of (usecs, frames) moderation
+ *	levels, driven by the traffic the driver sees between poll
+ *	completions; see include/linux/net_dim.h.
+ */
+
+#include <linux/module.h>
+#include <linux/types.h>
+#include <linux/kernel.h>
+#include <linux/time.h>
+#include <linux/net_dim.h>
+#include <asm/div64.h>
+
+enum {
+	NET_DIM_START_MEASURE,
+	NET_DIM_MEASURE_IN_PROGRESS,
+	NET_DIM_APPLY_NEW_PROFILE,
+};
+
+enum {
+	NET_DIM_PARKING_ON_TOP,
+	NET_DIM_PARKING_TIRED,
+	NET_DIM_GOING_RIGHT,
+	NET_DIM_GOING_LEFT,
+};
+
+enum {
+	NET_DIM_STATS_WORSE,
+	NET_DIM_STATS_SAME,
+	NET_DIM_STATS_BETTER,
+};
+
+enum {
+	NET_DIM_STEPPED,
+	NET_DIM_TOO_TIRED,
+	NET_DIM_ON_EDGE,
+};
+
+#define NET_DIM_PARKING_ON_TOP_TIRED	10	/* samples parked before retry */
+
+/*
+ * tg3 and friends take at most 255 frames, drivers clamp to their own
+ * limits in apply().
+ */
+static const struct net_dim_cq_moder
+net_dim_profiles[][NET_DIM_NUM_LEVELS] = {
+	[ETHTOOL_COAL_PROFILE_BALANCED] = {
+		{ 1, 1 }, { 8, 16 }, { 32, 32 }, { 64, 64 }, { 128, 128 },
+	},
+	[ETHTOOL_COAL_PROFILE_LATENCY] = {
+		{ 1, 1 }, { 2, 4 }, { 4, 8 }, { 8, 16 }, { 16, 32 },
+	},
+	[ETHTOOL_COAL_PROFILE_THROUGHPUT] = {
+		{ 16, 32 }, { 32, 64 }, { 64, 128 }, { 128, 255 }, { 256, 255 },
+	},
+};
+
+static const u8 net_dim_default_level[] = {
+	[ETHTOOL_COAL_PROFILE_BALANCED]		= 1,
+	[ETHTOOL_COAL_PROFILE_LATENCY]		= 0,
+	[ETHTOOL_COAL_PROFILE_THROUGHPUT]	= 2,
+};
+
+#define NET_DIM_NUM_PROFILES	ARRAY_SIZE(net_dim_profiles)
+
+struct net_dim_cq_moder net_dim_get_moderation(const struct net_dim *dim)
+{
+	return net_dim_profiles[dim->profile][dim->level];
+}
+EXPORT_SYMBOL(net_dim_get_moderation);
+
+static void net_dim_park_on_top(struct net_dim *dim)
+{
+	dim->steps_right = 0;
+	dim->steps_left = 0;
+	dim->tired = 0;
+	dim->tune_state = NET_DIM_PARKING_ON_TOP;
+}
+
+static void net_dim_park_tired(struct net_dim *dim)
+{
+	dim->steps_right = 0;
+	dim->steps_left = 0;
+	dim->tune_state = NET_DIM_PARKING_TIRED;
+}
+
+static int net_dim_step(struct net_dim *dim)
+{
+	if (dim->tired == NET_DIM_PARKING_ON_TOP_TIRED)
+		return NET_DIM_TOO_TIRED;
+
+	switch (dim->tune_state) {
+	case NET_DIM_PARKING_ON_TOP:
+	case NET_DIM_PARKING_TIRED:
+		break;
+	case NET_DIM_GOING_RIGHT:
+		if (dim->level == NET_DIM_NUM_LEVELS - 1)
+			return NET_DIM_ON_EDGE;
+		dim->level++;
+		dim->steps_right++;
+		break;
+	case NET_DIM_GOING_LEFT:
+		if (dim->level == 0)
+			return NET_DIM_ON_EDGE;
+		dim->level--;
+		dim->steps_left++;
+		break;
+	}
+
+	dim->tired++;
+	return NET_DIM_STEPPED;
+}
+
+static void net_dim_exit_parking(struct net_dim *dim)
+{
+	dim->tune_state = dim->level ? NET_DIM_GOING_LEFT :
+				       NET_DIM_GOING_RIGHT;
+	net_dim_step(dim);
+}
+
+/* more than a tenth apart */
+#define IS_SIGNIFICANT_DIFF(val, ref) \
+	(((100 * abs((val) - (ref))) / (ref)) > 10)
+
+static int net_dim_stats_compare(const struct net_dim_stats *curr,
+				 const struct net_dim_stats *prev)
+{
+	if (!prev->bpms)
+		return curr->bpms ? NET_DIM_STATS_BETTER : NET_DIM_STATS_SAME;
+
+	if (IS_SIGNIFICANT_DIFF(curr->bpms, prev->bpms))
+		return curr->bpms > prev->bpms ? NET_DIM_STATS_BETTER :
+						 NET_DIM_STATS_WORSE;
+
+	if (!prev->ppms)
+		return curr->ppms ? NET_DIM_STATS_BETTER : NET_DIM_STATS_SAME;
+
+	if (IS_SIGNIFICANT_DIFF(curr->ppms, prev->ppms))
+		return curr->ppms > prev->ppms ? NET_DIM_STATS_BETTER :
+						 NET_DIM_STATS_WORSE;
+
+	if (!prev->epms)
+		return NET_DIM_STATS_SAME;
+
+	/* same traffic for fewer interrupts is better */
+	if (IS_SIGNIFICANT_DIFF(curr->epms, prev->epms))
+		return curr->epms < prev->epms ? NET_DIM_STATS_BETTER :
+						 NET_DIM_STATS_WORSE;
+
+	return NET_DIM_STATS_SAME;
+}
+
+/* returns non-zero when the level changed */
+static int net_dim_decision(const struct net_dim_stats *curr,
+			    struct net_dim *dim)
+{
+	int prev_state = dim->tune_state;
+	int prev_level = dim->level;
+	int stats_res;
+	int step_res;
+
+	switch (dim->tune_state) {
+	case NET_DIM_PARKING_ON_TOP:
+		stats_res = net_dim_stats_compare(curr, &dim->prev_stats);
+		if (stats_res != NET_DIM_STATS_SAME)
+			net_dim_exit_parking(dim);
+		break;
+
+	case NET_DIM_PARKING_TIRED:
+		dim->tired--;
+		if (!dim->tired)
+			net_dim_exit_parking(dim);
+		break;
+
+	case NET_DIM_GOING_RIGHT:
+	case NET_DIM_GOING_LEFT:
+		stats_res = net_dim_stats_compare(curr, &dim->prev_stats);
+		if (stats_res != NET_DIM_STATS_BETTER) {
+			/* the last step made things worse: turn round */
+			if (dim->tune_state == NET_DIM_GOING_RIGHT)
+				dim->tune_state = NET_DIM_GOING_LEFT;
+			else
+				dim->tune_state = NET_DIM_GOING_RIGHT;
+
+			/* back and forth around one level: park there */
+			if (dim->steps_left > 1 && dim->steps_right == 1) {
+				net_dim_park_on_top(dim);
+				break;
+			}
+			if (dim->steps_right > 1 && dim->steps_left == 1) {
+				net_dim_park_on_top(dim);
+				break;
+			}
+		}
+
+		step_res = net_dim_step(dim);
+		switch (step_res) {
+		case NET_DIM_ON_EDGE:
+			net_dim_park_on_top(dim);
+			break;
+		case NET_DIM_TOO_TIRED:
+			net_dim_park_tired(dim);
+			break;
+		}
+		break;
+	}
+
+	if (prev_state != NET_DIM_PARKING_ON_TOP ||
+	    dim->tune_state != NET_DIM_PARKING_ON_TOP)
+		dim->prev_stats = *curr;
+
+	return dim->level != prev_level;
+}
+
+static void net_dim_sample(struct net_dim_sample *s, u16 event_ctr,
+			   u32 packets, u32 bytes)
+{
+	s->time = ktime_get();
+	s->pkt_ctr = packets;
+	s->byte_ctr = bytes;
+	s->event_ctr = event_ctr;
+}
+
+/* the counters are free running and wrap */
+static void net_dim_calc_stats(const struct net_dim_sample *start,
+			       const struct net_dim_sample *end,
+			       struct net_dim_stats *curr)
+{
+	u64 delta_us = ktime_to_ns(ktime_sub(end->time, start->time));
+	u32 npkts = end->pkt_ctr - start->pkt_ctr;
+	u32 nbytes = end->byte_ctr - start->byte_ctr;
+	u16 nevents = end->event_ctr - start->event_ctr;
+	u64 val;
+
+	do_div(delta_us, NSEC_PER_USEC);
+	if (!delta_us)
+		return;
+
+	val = (u64)npkts * USEC_PER_MSEC;
+	do_div(val, (u32)delta_us);
+	curr->ppms = val;
+
+	val = (u64)nbytes * USEC_PER_MSEC;
+	do_div(val, (u32)delta_us);
+	curr->bpms = val;
+
+	val = (u64)nevents * USEC_PER_MSEC;
+	do_div(val, (u32)delta_us);
+	curr->epms = val;
+}
+
+/**
+ * net_dim - feed one poll completion to the moderation algorithm
+ * @dim: the driver's moderation state
+ * @event_ctr: completions (interrupts) so far, counting this one
+ * @packets: packets received so far
+ * @bytes: bytes received so far
+ *
+ * All three are running totals kept by the driver.  Called from the
+ * driver's poll routine; a new moderation level is applied from process
+ * context, via @dim->apply, and sampling resumes once it has been.
+ */
+void net_dim(struct net_dim *dim, u16 event_ctr, u32 packets, u32 bytes)
+{
+	struct net_dim_sample end;
+	struct net_dim_stats curr;
+	u16 nevents;
+
+	switch (dim->state) {
+	case NET_DIM_MEASURE_IN_PROGRESS:
+		nevents = event_ctr - dim->start_sample.event_ctr;
+		if (nevents < NET_DIM_NEVENTS)
+			break;
+		net_dim_sample(&end, event_ctr, packets, bytes);
+		memset(&curr, 0, sizeof(curr));
+		net_dim_calc_stats(&dim->start_sample, &end, &curr);
+		if (net_dim_decision(&curr, dim)) {
+			dim->state = NET_DIM_APPLY_NEW_PROFILE;
+			schedule_work(&dim->work);
+			break;
+		}
+		/* fall through */
+	case NET_DIM_START_MEASURE:
+		net_dim_sample(&dim->start_sample, event_ctr, packets, bytes);
+		dim->state = NET_DIM_MEASURE_IN_PROGRESS;
+		break;
+	case NET_DIM_APPLY_NEW_PROFILE:
+		break;
+	}
+}
+EXPORT_SYMBOL(net_dim);
+
+static void net_dim_work(void *data)
+{
+	struct net_dim *dim = data;
+
+	dim->apply(dim, net_dim_get_moderation(dim));
+	dim->state = NET_DIM_START_MEASURE;
+}
+
+/**
+ * net_dim_set_profile - switch to another table of moderation levels
+ * @dim: the driver's moderation state
+ * @profile: one of ETHTOOL_COAL_PROFILE_*
+ *
+ * Starts over from the profile's default level, which the caller
+ * programs into the hardware itself.
+ */
+int net_dim_set_profile(struct net_dim *dim, int profile)
+{
+	if (profile < 0 || profile >= NET_DIM_NUM_PROFILES)
+		return -EINVAL;
+
+	dim->profile = profile;
+	dim->level = net_dim_default_level[profile];
+	memset(&dim->prev_stats, 0, sizeof(dim->prev_stats));
+	net_dim_park_on_top(dim);
+	dim->state = NET_DIM_START_MEASURE;
+	return 0;
+}
+EXPORT_SYMBOL(net_dim_set_profile);
+
+void net_dim_init(struct net_dim *dim, int profile,
+		  void (*apply)(struct net_dim *, struct net_dim_cq_moder))
+{
+	memset(dim, 0, sizeof(*dim));
+	INIT_WORK(&dim->work, net_dim_work, dim);
+	dim->apply = apply;
+	if (net_dim_set_profile(dim, profile))
+		net_dim_set_profile(dim, ETHTOOL_COAL_PROFILE_BALANCED);
+}
+EXPORT_SYMBOL(net_dim_init);
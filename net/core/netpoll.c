@@ -268,6 +268,22 @@ repeat:
 	return skb;
 }
 
+/* Is this cpu in the driver already, on the device or one of its queues? */
+static int netpoll_xmit_owner(struct net_device *dev)
+{
+	int cpu = smp_processor_id();
+	unsigned int i;
+
+	if (dev->xmit_lock_owner == cpu)
+		return 1;
+	if (!netif_is_multiqueue(dev))
+		return 0;
+	for (i = 0; i < dev->num_tx_queues; i++)
+		if (dev->tx_queues[i].xmit_lock_owner == cpu)
+			return 1;
+	return 0;
+}
+
 static void netpoll_send_skb(struct netpoll *np, struct sk_buff *skb)
 {
 	int status;
@@ -282,7 +298,7 @@ static void netpoll_send_skb(struct netpoll *np, struct sk_buff *skb)
 
 	/* avoid recursion */
 	if (npinfo->poll_owner == smp_processor_id() ||
-	    np->dev->xmit_lock_owner == smp_processor_id()) {
+	    netpoll_xmit_owner(np->dev)) {
 		if (np->drop)
 			np->drop(skb);
 		else
@@ -150,6 +150,7 @@
 #include <net/addrconf.h>
 #include <asm/byteorder.h>
 #include <linux/rcupdate.h>
+#include <linux/percpu.h>
 #include <asm/bitops.h>
 #include <asm/io.h>
 #include <asm/dma.h>
@@ -157,7 +158,7 @@
 #include <asm/div64.h>		/* do_div */
 #include <asm/timex.h>
 
-#define VERSION  "pktgen v2.67: Packet Generator for packet performance testing.\n"
+#define VERSION  "pktgen v2.68: Packet Generator for packet performance testing.\n"
 
 /* #define PG_DEBUG(a) a */
 #define PG_DEBUG(a)
@@ -194,9 +195,11 @@
 #define PKTGEN_MAGIC 0xbe9be955
 #define PG_PROC_DIR "pktgen"
 #define PGCTRL	    "pgctrl"
+#define PGRX	    "pgrx"
 static struct proc_dir_entry *pg_proc_dir = NULL;
 
 #define MAX_CFLOWS  65536
+#define MAX_SKB_RING 8192
 
 struct flow_state {
 	__u32 cur_daddr;
@@ -210,6 +213,8 @@ struct pktgen_dev {
 	 */
 
 	char ifname[IFNAMSIZ];
+	char odevname[32];	/* as added: ifname, or ifname@N for one more
+				 * thread sending on the same interface */
 	char result[512];
 
 	struct pktgen_thread *pg_thread;	/* the owner */
@@ -255,6 +260,16 @@ struct pktgen_dev {
 				 * For instance, if you want to send 1024 identical packets
 				 * before creating a new packet, set clone_skb to 1024.
 				 */
+	unsigned int burst;	/* Packets handed to the driver per tx lock, all
+				 * but the last with skb->xmit_more set.
+				 */
+	unsigned int skb_ring_size;	/* Build this many different packets
+					 * up front and send them round-robin,
+					 * instead of clone_skb.
+					 */
+	struct sk_buff **skb_ring;
+	unsigned int skb_ring_len;	/* entries built */
+	unsigned int skb_ring_next;
 
 	char dst_min[IP_NAME_SZ];	/* IP, ie 1.2.3.4 */
 	char dst_max[IP_NAME_SZ];	/* IP, ie 1.2.3.4 */
@@ -483,7 +498,7 @@ static char version[] __initdata = VERSION;
 static int pktgen_remove_device(struct pktgen_thread *t, struct pktgen_dev *i);
 static int pktgen_add_device(struct pktgen_thread *t, const char *ifname);
 static struct pktgen_dev *pktgen_find_dev(struct pktgen_thread *t,
-					  const char *ifname);
+					  const char *odevname);
 static int pktgen_device_event(struct notifier_block *, unsigned long, void *);
 static void pktgen_run_all_threads(void);
 static void pktgen_stop_all_threads_ifs(void);
@@ -586,6 +601,9 @@ static int pktgen_if_show(struct seq_file *seq, void *v)
 		   1000 * pkt_dev->delay_us + pkt_dev->delay_ns,
 		   pkt_dev->clone_skb, pkt_dev->ifname);
 
+	seq_printf(seq, "     burst: %u  skb_ring: %u\n", pkt_dev->burst,
+		   pkt_dev->skb_ring_size);
+
 	seq_printf(seq, "     flows: %u flowlen: %u\n", pkt_dev->cflows,
 		   pkt_dev->lflow);
 
@@ -1043,6 +1061,30 @@ static ssize_t pktgen_if_write(struct file *file,
 		sprintf(pg_result, "OK: clone_skb=%d", pkt_dev->clone_skb);
 		return count;
 	}
+	if (!strcmp(name, "burst")) {
+		len = num_arg(&user_buffer[i], 10, &value);
+		if (len < 0) {
+			return len;
+		}
+		i += len;
+		pkt_dev->burst = value < 1 ? 1 : value;
+
+		sprintf(pg_result, "OK: burst=%u", pkt_dev->burst);
+		return count;
+	}
+	if (!strcmp(name, "skb_ring")) {
+		len = num_arg(&user_buffer[i], 10, &value);
+		if (len < 0) {
+			return len;
+		}
+		i += len;
+		if (value > MAX_SKB_RING)
+			value = MAX_SKB_RING;
+		pkt_dev->skb_ring_size = value;
+
+		sprintf(pg_result, "OK: skb_ring=%u", pkt_dev->skb_ring_size);
+		return count;
+	}
 	if (!strcmp(name, "count")) {
 		len = num_arg(&user_buffer[i], 10, &value);
 		if (len < 0) {
@@ -1481,13 +1523,13 @@ static int pktgen_thread_show(struct seq_file *seq, void *v)
 	if_lock(t);
 	list_for_each_entry(pkt_dev, &t->if_list, list)
 		if (pkt_dev->running)
-			seq_printf(seq, "%s ", pkt_dev->ifname);
+			seq_printf(seq, "%s ", pkt_dev->odevname);
 
 	seq_printf(seq, "\nStopped: ");
 
 	list_for_each_entry(pkt_dev, &t->if_list, list)
 		if (!pkt_dev->running)
-			seq_printf(seq, "%s ", pkt_dev->ifname);
+			seq_printf(seq, "%s ", pkt_dev->odevname);
 
 	if (t->result[0])
 		seq_printf(seq, "\nResult: %s\n", t->result);
@@ -1609,23 +1651,269 @@ static struct file_operations pktgen_thread_fops = {
 	.release = single_release,
 };
 
+/*
+ * Receive side: count the pktgen packets coming in on one interface,
+ * and how long they took from the timestamp the sender put in them.
+ * The latency only means something when both ends read the same
+ * clock, as when sending out of one port and back in through another
+ * of the same machine, across the device under test.  The packets go
+ * on up the stack as well.  Counters are per CPU and updated without
+ * locks; reading them sums over the CPUs.
+ */
+struct pktgen_rx {
+	__u64 rx_packets;
+	__u64 rx_bytes;
+	__u64 lat_sum;		/* micro-seconds */
+	__u32 lat_min;
+	__u32 lat_max;
+	__u64 lat_buckets[LAT_BUCKETS_MAX];	/* by log2 of micro-seconds */
+};
+
+static DEFINE_PER_CPU(struct pktgen_rx, pktgen_rx_stats);
+static struct net_device *pg_rx_dev;	/* under pktgen_thread_lock */
+
+static int pktgen_rcv(struct sk_buff *skb, struct net_device *dev,
+		      struct packet_type *pt, struct net_device *orig_dev)
+{
+	struct pktgen_hdr _pgh, *pgh;
+	struct pktgen_rx *rx;
+	struct timeval now;
+	unsigned int off;
+	__s32 lat;
+	int bucket;
+
+	if (skb->protocol == htons(ETH_P_IP)) {
+		struct iphdr _iph, *iph;
+
+		iph = skb_header_pointer(skb, 0, sizeof(_iph), &_iph);
+		if (iph == NULL || iph->protocol != IPPROTO_UDP)
+			goto out;
+		off = iph->ihl * 4;
+	} else {
+		struct ipv6hdr _ip6h, *ip6h;
+
+		ip6h = skb_header_pointer(skb, 0, sizeof(_ip6h), &_ip6h);
+		if (ip6h == NULL || ip6h->nexthdr != IPPROTO_UDP)
+			goto out;
+		off = sizeof(struct ipv6hdr);
+	}
+	pgh = skb_header_pointer(skb, off + sizeof(struct udphdr),
+				 sizeof(_pgh), &_pgh);
+	if (pgh == NULL || pgh->pgh_magic != htonl(PKTGEN_MAGIC))
+		goto out;
+
+	/* stamped on the way in, as timestamps are enabled */
+	if (skb->tstamp.off_sec)
+		skb_get_timestamp(skb, &now);
+	else
+		do_gettimeofday(&now);
+	lat = (__s32)((__u32)now.tv_sec - ntohl(pgh->tv_sec)) * USEC_PER_SEC
+	    + (__s32)(now.tv_usec - ntohl(pgh->tv_usec));
+	if (lat < 0)
+		lat = 0;	/* clocks apart */
+
+	rx = &__get_cpu_var(pktgen_rx_stats);
+	rx->rx_packets++;
+	rx->rx_bytes += skb->len + ETH_HLEN;
+	rx->lat_sum += lat;
+	if (rx->rx_packets == 1 || lat < rx->lat_min)
+		rx->lat_min = lat;
+	if (lat > rx->lat_max)
+		rx->lat_max = lat;
+	bucket = fls(lat);
+	if (bucket >= LAT_BUCKETS_MAX)
+		bucket = LAT_BUCKETS_MAX - 1;
+	rx->lat_buckets[bucket]++;
+
+out:
+	kfree_skb(skb);
+	return NET_RX_SUCCESS;
+}
+
+static struct packet_type pktgen_rx_ip = {
+	.type = __constant_htons(ETH_P_IP),
+	.func = pktgen_rcv,
+};
+
+static struct packet_type pktgen_rx_ipv6 = {
+	.type = __constant_htons(ETH_P_IPV6),
+	.func = pktgen_rcv,
+};
+
+/* Called under pktgen_thread_lock */
+static void pktgen_rx_stop(void)
+{
+	if (!pg_rx_dev)
+		return;
+
+	dev_remove_pack(&pktgen_rx_ip);
+	dev_remove_pack(&pktgen_rx_ipv6);
+	net_disable_timestamp();
+	dev_put(pg_rx_dev);
+	pg_rx_dev = NULL;
+}
+
+/* Called under pktgen_thread_lock */
+static int pktgen_rx_start(const char *ifname)
+{
+	struct net_device *dev;
+
+	dev = dev_get_by_name(ifname);
+	if (!dev)
+		return -ENODEV;
+
+	pktgen_rx_stop();
+	pg_rx_dev = dev;
+	pktgen_rx_ip.dev = dev;
+	pktgen_rx_ipv6.dev = dev;
+	net_enable_timestamp();
+	dev_add_pack(&pktgen_rx_ip);
+	dev_add_pack(&pktgen_rx_ipv6);
+	return 0;
+}
+
+static void pktgen_rx_reset(void)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		memset(&per_cpu(pktgen_rx_stats, cpu), 0,
+		       sizeof(struct pktgen_rx));
+}
+
+static int pgrx_show(struct seq_file *seq, void *v)
+{
+	struct pktgen_rx sum, *rx;
+	__u64 avg = 0;
+	int cpu, i;
+
+	memset(&sum, 0, sizeof(sum));
+	sum.lat_min = ~0U;
+	for_each_possible_cpu(cpu) {
+		rx = &per_cpu(pktgen_rx_stats, cpu);
+		if (!rx->rx_packets)
+			continue;
+		sum.rx_packets += rx->rx_packets;
+		sum.rx_bytes += rx->rx_bytes;
+		sum.lat_sum += rx->lat_sum;
+		if (rx->lat_min < sum.lat_min)
+			sum.lat_min = rx->lat_min;
+		if (rx->lat_max > sum.lat_max)
+			sum.lat_max = rx->lat_max;
+		for (i = 0; i < LAT_BUCKETS_MAX; i++)
+			sum.lat_buckets[i] += rx->lat_buckets[i];
+	}
+	if (sum.rx_packets)
+		avg = pg_div64(sum.lat_sum, sum.rx_packets);
+	else
+		sum.lat_min = 0;
+
+	mutex_lock(&pktgen_thread_lock);
+	seq_printf(seq, "Receiving: %s\n", pg_rx_dev ? pg_rx_dev->name : "");
+	mutex_unlock(&pktgen_thread_lock);
+
+	seq_printf(seq, "     pkts: %llu  bytes: %llu\n",
+		   (unsigned long long)sum.rx_packets,
+		   (unsigned long long)sum.rx_bytes);
+	seq_printf(seq, "     latency: min %uus  avg %lluus  max %uus\n",
+		   sum.lat_min, (unsigned long long)avg, sum.lat_max);
+	for (i = 0; i < LAT_BUCKETS_MAX; i++)
+		if (sum.lat_buckets[i])
+			seq_printf(seq, "     <%luus: %llu\n", 1UL << i,
+				   (unsigned long long)sum.lat_buckets[i]);
+	return 0;
+}
+
+static ssize_t pgrx_write(struct file *file, const char __user * user_buffer,
+			  size_t count, loff_t * offset)
+{
+	int i = 0, len, ret;
+	char name[16], f[32];
+
+	if (!capable(CAP_NET_ADMIN))
+		return -EPERM;
+
+	len = count_trail_chars(&user_buffer[i], count - i);
+	if (len < 0)
+		return len;
+	i += len;
+
+	len = strn_len(&user_buffer[i], sizeof(name) - 1);
+	if (len < 0)
+		return len;
+	memset(name, 0, sizeof(name));
+	if (copy_from_user(name, &user_buffer[i], len))
+		return -EFAULT;
+	i += len;
+
+	len = count_trail_chars(&user_buffer[i], count - i);
+	if (len < 0)
+		return len;
+	i += len;
+
+	ret = count;
+	mutex_lock(&pktgen_thread_lock);
+	if (!strcmp(name, "rx")) {
+		len = strn_len(&user_buffer[i], sizeof(f) - 1);
+		memset(f, 0, sizeof(f));
+		if (len < 0)
+			ret = len;
+		else if (copy_from_user(f, &user_buffer[i], len))
+			ret = -EFAULT;
+		else if (pktgen_rx_start(f) < 0) {
+			printk("pktgen: no such netdevice: \"%s\"\n", f);
+			ret = -ENODEV;
+		}
+	} else if (!strcmp(name, "rx_stop"))
+		pktgen_rx_stop();
+	else if (!strcmp(name, "rx_reset"))
+		pktgen_rx_reset();
+	else
+		ret = -EINVAL;
+	mutex_unlock(&pktgen_thread_lock);
+
+	return ret;
+}
+
+static int pgrx_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, pgrx_show, PDE(inode)->data);
+}
+
+static struct file_operations pktgen_rx_fops = {
+	.owner   = THIS_MODULE,
+	.open    = pgrx_open,
+	.read    = seq_read,
+	.llseek  = seq_lseek,
+	.write   = pgrx_write,
+	.release = single_release,
+};
+
 /* Think find or remove for NN */
 static struct pktgen_dev *__pktgen_NN_threads(const char *ifname, int remove)
 {
 	struct pktgen_thread *t;
-	struct pktgen_dev *pkt_dev = NULL;
+	struct pktgen_dev *p, *pkt_dev = NULL;
+
+	if (remove == FIND) {
+		list_for_each_entry(t, &pktgen_threads, th_list) {
+			pkt_dev = pktgen_find_dev(t, ifname);
+			if (pkt_dev)
+				break;
+		}
+		return pkt_dev;
+	}
 
+	/* The interface goes away: mark all its ifname@N, on any thread */
 	list_for_each_entry(t, &pktgen_threads, th_list) {
-		pkt_dev = pktgen_find_dev(t, ifname);
-		if (pkt_dev) {
-			if (remove) {
-				if_lock(t);
-				pkt_dev->removal_mark = 1;
+		if_lock(t);
+		list_for_each_entry(p, &t->if_list, list)
+			if (strcmp(p->ifname, ifname) == 0) {
+				p->removal_mark = 1;
 				t->control |= T_REMDEV;
-				if_unlock(t);
+				pkt_dev = p;
 			}
-			break;
-		}
+		if_unlock(t);
 	}
 	return pkt_dev;
 }
@@ -1690,6 +1978,10 @@ static int pktgen_device_event(struct notifier_block *unused,
 
 	case NETDEV_UNREGISTER:
 		pktgen_mark_device(dev->name);
+		mutex_lock(&pktgen_thread_lock);
+		if (dev == pg_rx_dev)
+			pktgen_rx_stop();
+		mutex_unlock(&pktgen_thread_lock);
 		break;
 	};
 
@@ -2545,6 +2837,23 @@ static inline struct sk_buff *fill_packet(struct net_device *odev,
 		return fill_packet_ipv4(odev, pkt_dev);
 }
 
+static void pktgen_free_skbs(struct pktgen_dev *pkt_dev)
+{
+	int i;
+
+	if (pkt_dev->skb)
+		kfree_skb(pkt_dev->skb);
+	pkt_dev->skb = NULL;
+
+	if (pkt_dev->skb_ring) {
+		for (i = 0; i < pkt_dev->skb_ring_len; i++)
+			kfree_skb(pkt_dev->skb_ring[i]);
+		kfree(pkt_dev->skb_ring);
+		pkt_dev->skb_ring = NULL;
+	}
+	pkt_dev->skb_ring_len = 0;
+}
+
 static void pktgen_clear_counters(struct pktgen_dev *pkt_dev)
 {
 	pkt_dev->seq_num = 1;
@@ -2715,11 +3024,16 @@ static void show_results(struct pktgen_dev *pkt_dev, int nr_frags)
 
 static int pktgen_stop_device(struct pktgen_dev *pkt_dev)
 {
-	int nr_frags = pkt_dev->skb ? skb_shinfo(pkt_dev->skb)->nr_frags : -1;
+	int nr_frags = -1;
+
+	if (pkt_dev->skb)
+		nr_frags = skb_shinfo(pkt_dev->skb)->nr_frags;
+	else if (pkt_dev->skb_ring)
+		nr_frags = skb_shinfo(pkt_dev->skb_ring[0])->nr_frags;
 
 	if (!pkt_dev->running) {
 		printk("pktgen: interface: %s is already stopped\n",
-		       pkt_dev->ifname);
+		       pkt_dev->odevname);
 		return -EINVAL;
 	}
 
@@ -2759,10 +3073,7 @@ static void pktgen_stop(struct pktgen_thread *t)
 
 	list_for_each_entry(pkt_dev, &t->if_list, list) {
 		pktgen_stop_device(pkt_dev);
-		if (pkt_dev->skb)
-			kfree_skb(pkt_dev->skb);
-
-		pkt_dev->skb = NULL;
+		pktgen_free_skbs(pkt_dev);
 	}
 
 	if_unlock(t);
@@ -2787,13 +3098,9 @@ static void pktgen_rem_one_if(struct pktgen_thread *t)
 		if (!cur->removal_mark)
 			continue;
 
-		if (cur->skb)
-			kfree_skb(cur->skb);
-		cur->skb = NULL;
+		pktgen_free_skbs(cur);
 
 		pktgen_remove_device(t, cur);
-
-		break;
 	}
 
 	if_unlock(t);
@@ -2812,9 +3119,7 @@ static void pktgen_rem_all_ifs(struct pktgen_thread *t)
 	list_for_each_safe(q, n, &t->if_list) {
 		cur = list_entry(q, struct pktgen_dev, list);
 
-		if (cur->skb)
-			kfree_skb(cur->skb);
-		cur->skb = NULL;
+		pktgen_free_skbs(cur);
 
 		pktgen_remove_device(t, cur);
 	}
@@ -2835,6 +3140,92 @@ static void pktgen_rem_thread(struct pktgen_thread *t)
 	mutex_unlock(&pktgen_thread_lock);
 }
 
+/* Build the skb ring, each packet with the next flow, addresses etc. */
+static int pktgen_fill_ring(struct pktgen_dev *pkt_dev)
+{
+	struct sk_buff *skb;
+	int i;
+
+	pkt_dev->skb_ring = kcalloc(pkt_dev->skb_ring_size,
+				    sizeof(struct sk_buff *), GFP_KERNEL);
+	if (!pkt_dev->skb_ring)
+		return -ENOMEM;
+
+	for (i = 0; i < pkt_dev->skb_ring_size; i++) {
+		skb = fill_packet(pkt_dev->odev, pkt_dev);
+		if (skb == NULL) {
+			pktgen_free_skbs(pkt_dev);
+			return -ENOMEM;
+		}
+		pkt_dev->skb_ring[i] = skb;
+		pkt_dev->skb_ring_len++;
+		pkt_dev->allocated_skbs++;
+	}
+	pkt_dev->skb_ring_next = 0;
+	return 0;
+}
+
+/* New sequence number and timestamp for a packet sent again */
+static void pktgen_restamp(struct pktgen_dev *pkt_dev, struct sk_buff *skb)
+{
+	struct pktgen_hdr *pgh;
+	struct timeval timestamp;
+
+	pgh = (struct pktgen_hdr *)(skb->h.raw + sizeof(struct udphdr));
+	pgh->seq_num = htonl(pkt_dev->seq_num);
+	do_gettimeofday(&timestamp);
+	pgh->tv_sec = htonl(timestamp.tv_sec);
+	pgh->tv_usec = htonl(timestamp.tv_usec);
+}
+
+/*
+ * Send up to burst packets off the skb ring, in order.  A packet is
+ * only sent again once the driver is done with it, so that it can be
+ * restamped; a ring shorter than the device's tx queue waits for that
+ * as for a stopped queue.  Called with the tx lock held.
+ */
+static void pktgen_xmit_ring(struct pktgen_dev *pkt_dev,
+			     struct net_device *odev, unsigned int burst)
+{
+	struct sk_buff *skb, *next;
+	unsigned int idx;
+	int ret;
+
+	while (burst > 0 && !netif_queue_stopped(odev)) {
+		idx = pkt_dev->skb_ring_next;
+		skb = pkt_dev->skb_ring[idx];
+		if (atomic_read(&skb->users) != 1)
+			break;
+
+		pktgen_restamp(pkt_dev, skb);
+		atomic_inc(&skb->users);
+		if (++idx == pkt_dev->skb_ring_len)
+			idx = 0;
+		next = pkt_dev->skb_ring[idx];
+		skb->xmit_more = (burst > 1 && atomic_read(&next->users) == 1);
+	      retry_now:
+		ret = odev->hard_start_xmit(skb, odev);
+		if (ret == NETDEV_TX_LOCKED && (odev->features & NETIF_F_LLTX)) {
+			cpu_relax();
+			goto retry_now;
+		}
+		if (unlikely(ret != NETDEV_TX_OK)) {
+			atomic_dec(&skb->users);
+			if (debug && net_ratelimit())
+				printk(KERN_INFO "pktgen: Hard xmit error\n");
+			pkt_dev->errors++;
+			pkt_dev->last_ok = 0;
+			return;
+		}
+		pkt_dev->last_ok = 1;
+		pkt_dev->sofar++;
+		pkt_dev->seq_num++;
+		pkt_dev->tx_bytes += skb->len;
+		pkt_dev->skb_ring_next = idx;
+		burst--;
+	}
+}
+
 static __inline__ void pktgen_xmit(struct pktgen_dev *pkt_dev)
 {
 	struct net_device *odev = NULL;
@@ -2865,9 +3256,7 @@ static __inline__ void pktgen_xmit(struct pktgen_dev *pkt_dev)
 
 		if (!netif_running(odev)) {
 			pktgen_stop_device(pkt_dev);
-			if (pkt_dev->skb)
-				kfree_skb(pkt_dev->skb);
-			pkt_dev->skb = NULL;
+			pktgen_free_skbs(pkt_dev);
 			goto out;
 		}
 		if (need_resched())
@@ -2882,7 +3271,13 @@ static __inline__ void pktgen_xmit(struct pktgen_dev *pkt_dev)
 		}
 	}
 
-	if (pkt_dev->last_ok || !pkt_dev->skb) {
+	if (pkt_dev->skb_ring_size) {
+		if (!pkt_dev->skb_ring && pktgen_fill_ring(pkt_dev)) {
+			printk("pktgen: ERROR: couldn't allocate the skb ring.\n");
+			schedule();
+			goto out;
+		}
+	} else if (pkt_dev->last_ok || !pkt_dev->skb) {
 		if ((++pkt_dev->clone_count >= pkt_dev->clone_skb)
 		    || (!pkt_dev->skb)) {
 			/* build a new pkt */
@@ -2903,15 +3298,28 @@ static __inline__ void pktgen_xmit(struct pktgen_dev *pkt_dev)
 
 	netif_tx_lock_bh(odev);
 	if (!netif_queue_stopped(odev)) {
+		unsigned int burst = pkt_dev->burst;
 
-		atomic_inc(&(pkt_dev->skb->users));
+		/* the same skb goes out burst times in a row */
+		if (pkt_dev->count != 0 &&
+		    burst > pkt_dev->count - pkt_dev->sofar)
+			burst = pkt_dev->count - pkt_dev->sofar;
+		if (pkt_dev->skb_ring) {
+			pktgen_xmit_ring(pkt_dev, odev, burst);
+			goto next_tx;
+		}
+		atomic_add(burst, &(pkt_dev->skb->users));
 	      retry_now:
+		pkt_dev->skb->xmit_more = (burst > 1);
 		ret = odev->hard_start_xmit(pkt_dev->skb, odev);
 		if (likely(ret == NETDEV_TX_OK)) {
 			pkt_dev->last_ok = 1;
 			pkt_dev->sofar++;
 			pkt_dev->seq_num++;
 			pkt_dev->tx_bytes += pkt_dev->cur_pkt_size;
+			if (--burst > 0 && !netif_queue_stopped(odev))
+				goto retry_now;
+			atomic_sub(burst, &(pkt_dev->skb->users));
 
 		} else if (ret == NETDEV_TX_LOCKED
 			   && (odev->features & NETIF_F_LLTX)) {
@@ -2919,7 +3327,7 @@ static __inline__ void pktgen_xmit(struct pktgen_dev *pkt_dev)
 			goto retry_now;
 		} else {	/* Retry it next time */
 
-			atomic_dec(&(pkt_dev->skb->users));
+			atomic_sub(burst, &(pkt_dev->skb->users));
 
 			if (debug && net_ratelimit())
 				printk(KERN_INFO "pktgen: Hard xmit error\n");
@@ -2928,6 +3336,7 @@ static __inline__ void pktgen_xmit(struct pktgen_dev *pkt_dev)
 			pkt_dev->last_ok = 0;
 		}
 
+	      next_tx:
 		pkt_dev->next_tx_us = getCurUs();
 		pkt_dev->next_tx_ns = 0;
 
@@ -2950,7 +3359,7 @@ static __inline__ void pktgen_xmit(struct pktgen_dev *pkt_dev)
 
 	/* If pkt_dev->count is zero, then run forever */
 	if ((pkt_dev->count != 0) && (pkt_dev->sofar >= pkt_dev->count)) {
-		if (atomic_read(&(pkt_dev->skb->users)) != 1) {
+		if (pkt_dev->skb && atomic_read(&(pkt_dev->skb->users)) != 1) {
 			idle_start = getCurUs();
 			while (atomic_read(&(pkt_dev->skb->users)) != 1) {
 				if (signal_pending(current)) {
@@ -2963,9 +3372,7 @@ static __inline__ void pktgen_xmit(struct pktgen_dev *pkt_dev)
 
 		/* Done with this */
 		pktgen_stop_device(pkt_dev);
-		if (pkt_dev->skb)
-			kfree_skb(pkt_dev->skb);
-		pkt_dev->skb = NULL;
+		pktgen_free_skbs(pkt_dev);
 	}
 out:;
 }
@@ -3095,19 +3502,20 @@ static void pktgen_thread_worker(struct pktgen_thread *t)
 }
 
 static struct pktgen_dev *pktgen_find_dev(struct pktgen_thread *t,
-					  const char *ifname)
+					  const char *odevname)
 {
 	struct pktgen_dev *p, *pkt_dev = NULL;
 	if_lock(t);
 
 	list_for_each_entry(p, &t->if_list, list)
-		if (strncmp(p->ifname, ifname, IFNAMSIZ) == 0) {
+		if (strncmp(p->odevname, odevname, sizeof(p->odevname)) == 0) {
 			pkt_dev = p;
 			break;
 		}
 
 	if_unlock(t);
-	PG_DEBUG(printk("pktgen: find_dev(%s) returning %p\n", ifname, pkt_dev));
+	PG_DEBUG(printk("pktgen: find_dev(%s) returning %p\n", odevname,
+			pkt_dev));
 	return pkt_dev;
 }
 
@@ -3137,16 +3545,25 @@ out:
 	return rv;
 }
 
-/* Called under thread lock */
+/*
+ * Called under thread lock.  ifname@N adds one more pktgen_dev on the
+ * same interface, so that several threads can send on it at once.
+ */
 
-static int pktgen_add_device(struct pktgen_thread *t, const char *ifname)
+static int pktgen_add_device(struct pktgen_thread *t, const char *odevname)
 {
 	struct pktgen_dev *pkt_dev;
 	struct proc_dir_entry *pe;
+	int len = strcspn(odevname, "@");
 
-	/* We don't allow a device to be on several threads */
+	if (len >= IFNAMSIZ) {
+		printk("pktgen: ERROR: interface name too long.\n");
+		return -EINVAL;
+	}
 
-	pkt_dev = __pktgen_NN_threads(ifname, FIND);
+	/* We don't allow a pktgen_dev to be on several threads */
+
+	pkt_dev = __pktgen_NN_threads(odevname, FIND);
 	if (pkt_dev) {
 		printk("pktgen: ERROR: interface already used.\n");
 		return -EBUSY;
@@ -3168,6 +3585,7 @@ static int pktgen_add_device(struct pktgen_thread *t, const char *ifname)
 	pkt_dev->max_pkt_size = ETH_ZLEN;
 	pkt_dev->nfrags = 0;
 	pkt_dev->clone_skb = pg_clone_skb_d;
+	pkt_dev->burst = 1;
 	pkt_dev->delay_us = pg_delay_d / 1000;
 	pkt_dev->delay_ns = pg_delay_d % 1000;
 	pkt_dev->count = pg_count_d;
@@ -3177,7 +3595,8 @@ static int pktgen_add_device(struct pktgen_thread *t, const char *ifname)
 	pkt_dev->udp_dst_min = 9;
 	pkt_dev->udp_dst_max = 9;
 
-	strncpy(pkt_dev->ifname, ifname, IFNAMSIZ);
+	memcpy(pkt_dev->ifname, odevname, len);
+	strncpy(pkt_dev->odevname, odevname, sizeof(pkt_dev->odevname) - 1);
 
 	if (!pktgen_setup_dev(pkt_dev)) {
 		printk("pktgen: ERROR: pktgen_setup_dev failed.\n");
@@ -3187,10 +3606,10 @@ static int pktgen_add_device(struct pktgen_thread *t, const char *ifname)
 		return -ENODEV;
 	}
 
-	pe = create_proc_entry(ifname, 0600, pg_proc_dir);
+	pe = create_proc_entry(odevname, 0600, pg_proc_dir);
 	if (!pe) {
 		printk("pktgen: cannot create %s/%s procfs entry.\n",
-		       PG_PROC_DIR, ifname);
+		       PG_PROC_DIR, odevname);
 		if (pkt_dev->flows)
 			vfree(pkt_dev->flows);
 		kfree(pkt_dev);
@@ -3314,7 +3733,7 @@ static int pktgen_remove_device(struct pktgen_thread *t,
 
 	/* Clean up proc file system */
 
-	remove_proc_entry(pkt_dev->ifname, pg_proc_dir);
+	remove_proc_entry(pkt_dev->odevname, pg_proc_dir);
 
 	if (pkt_dev->flows)
 		vfree(pkt_dev->flows);
@@ -3345,6 +3764,16 @@ static int __init pg_init(void)
 	pe->proc_fops = &pktgen_fops;
 	pe->data = NULL;
 
+	pe = create_proc_entry(PGRX, 0600, pg_proc_dir);
+	if (pe == NULL) {
+		printk("pktgen: ERROR: cannot create %s procfs entry.\n",
+		       PGRX);
+		remove_proc_entry(PGCTRL, pg_proc_dir);
+		proc_net_remove(PG_PROC_DIR);
+		return -EINVAL;
+	}
+	pe->proc_fops = &pktgen_rx_fops;
+
 	/* Register us to receive netdevice events */
 	register_netdevice_notifier(&pktgen_notifier_block);
 
@@ -3362,6 +3791,7 @@ static int __init pg_init(void)
 	if (list_empty(&pktgen_threads)) {
 		printk("pktgen: ERROR: Initialization failed for all threads\n");
 		unregister_netdevice_notifier(&pktgen_notifier_block);
+		remove_proc_entry(PGRX, pg_proc_dir);
 		remove_proc_entry(PGCTRL, pg_proc_dir);
 		proc_net_remove(PG_PROC_DIR);
 		return -ENODEV;
@@ -3389,7 +3819,12 @@ static void __exit pg_cleanup(void)
 	/* Un-register us from receiving netdevice events */
 	unregister_netdevice_notifier(&pktgen_notifier_block);
 
+	mutex_lock(&pktgen_thread_lock);
+	pktgen_rx_stop();
+	mutex_unlock(&pktgen_thread_lock);
+
 	/* Clean up proc file system */
+	remove_proc_entry(PGRX, pg_proc_dir);
 	remove_proc_entry(PGCTRL, pg_proc_dir);
 	proc_net_remove(PG_PROC_DIR);
 }
@@ -39,6 +39,7 @@ int reqsk_queue_alloc(struct request_sock_queue *queue,
 	const int lopt_size = sizeof(struct listen_sock) +
 			      nr_table_entries * sizeof(struct request_sock *);
 	struct listen_sock *lopt = kzalloc(lopt_size, GFP_KERNEL);
+	int i;
 
 	if (lopt == NULL)
 		return -ENOMEM;
@@ -48,13 +49,14 @@ int reqsk_queue_alloc(struct request_sock_queue *queue,
 	     lopt->max_qlen_log++);
 
 	get_random_bytes(&lopt->hash_rnd, sizeof(lopt->hash_rnd));
-	rwlock_init(&queue->syn_wait_lock);
+	for (i = 0; i < LISTEN_SYN_LOCKS; i++)
+		spin_lock_init(&lopt->syn_lock[i]);
+	spin_lock_init(&queue->rskq_lock);
 	queue->rskq_accept_head = NULL;
 	lopt->nr_table_entries = nr_table_entries;
 
-	write_lock_bh(&queue->syn_wait_lock);
+	/* not hashed yet, nobody else can see the queue */
 	queue->listen_opt = lopt;
-	write_unlock_bh(&queue->syn_wait_lock);
 
 	return 0;
 }
@@ -66,7 +68,7 @@ void reqsk_queue_destroy(struct request_sock_queue *queue)
 	/* make all the listen_opt local to us */
 	struct listen_sock *lopt = reqsk_queue_yank_listen_sk(queue);
 
-	if (lopt->qlen != 0) {
+	if (atomic_read(&lopt->qlen) != 0) {
 		int i;
 
 		for (i = 0; i < lopt->nr_table_entries; i++) {
@@ -74,13 +76,13 @@ void reqsk_queue_destroy(struct request_sock_queue *queue)
 
 			while ((req = lopt->syn_table[i]) != NULL) {
 				lopt->syn_table[i] = req->dl_next;
-				lopt->qlen--;
+				atomic_dec(&lopt->qlen);
 				reqsk_free(req);
 			}
 		}
 	}
 
-	BUG_TRAP(lopt->qlen == 0);
+	BUG_TRAP(atomic_read(&lopt->qlen) == 0);
 	kfree(lopt);
 }
 
@@ -47,6 +47,7 @@
 #include <linux/in.h>
 #include <linux/inet.h>
 #include <linux/slab.h>
+#include <linux/percpu.h>
 #include <linux/netdevice.h>
 #ifdef CONFIG_NET_CLS_ACT
 #include <net/pkt_sched.h>
@@ -57,6 +58,7 @@
 #include <linux/rtnetlink.h>
 #include <linux/init.h>
 #include <linux/highmem.h>
+#include <linux/pipe_fs_i.h>
 
 #include <net/protocol.h>
 #include <net/dst.h>
@@ -170,7 +172,7 @@ struct sk_buff *__alloc_skb(unsigned int size, gfp_t gfp_mask,
 	/* make sure we initialize shinfo sequentially */
 	shinfo = skb_shinfo(skb);
 	atomic_set(&shinfo->dataref, 1);
-	shinfo->nr_frags  = 0;
+	shinfo->nr_frags = 0;
 	shinfo->gso_size = 0;
 	shinfo->gso_segs = 0;
 	shinfo->gso_type = 0;
@@ -249,6 +251,120 @@ nodata:
 	goto out;
 }
 
+/**
+ *	build_skb - build a network buffer around a page fragment
+ *	@data: data buffer, from netdev_alloc_frag()
+ *	@frag_size: size of @data, struct skb_shared_info included
+ *
+ *	Allocate only the &sk_buff, for data a device has already received
+ *	into, and make @data its head.  @frag_size is what the caller got
+ *	from netdev_alloc_frag(); SKB_WITH_OVERHEAD(@frag_size) bytes of it
+ *	are room for data.  The fragment reference is handed over to the
+ *	skb and dropped when it is freed.
+ *
+ *	%NULL is returned if there is no memory, @data is still the
+ *	caller's then.
+ */
+struct sk_buff *build_skb(void *data, unsigned int frag_size)
+{
+	struct skb_shared_info *shinfo;
+	struct sk_buff *skb;
+	unsigned int size = SKB_WITH_OVERHEAD(frag_size);
+
+	skb = kmem_cache_alloc(skbuff_head_cache, GFP_ATOMIC);
+	if (!skb)
+		return NULL;
+
+	memset(skb, 0, offsetof(struct sk_buff, truesize));
+	skb->truesize = frag_size + sizeof(struct sk_buff);
+	atomic_set(&skb->users, 1);
+	skb->head = data;
+	skb->data = data;
+	skb->tail = data;
+	skb->end  = data + size;
+	skb->head_frag = 1;
+
+	shinfo = skb_shinfo(skb);
+	atomic_set(&shinfo->dataref, 1);
+	shinfo->nr_frags = 0;
+	shinfo->gso_size = 0;
+	shinfo->gso_segs = 0;
+	shinfo->gso_type = 0;
+	shinfo->ip6_frag_id = 0;
+	shinfo->frag_list = NULL;
+
+	return skb;
+}
+
+/*
+ * Receive buffers are carved out of a per-cpu page, rather than being
+ * kmalloc()ed each: a 1500 byte frame plus struct skb_shared_info then
+ * costs about 2.4K, not the 4K slab object it rounds up to, and a
+ * 9K jumbo frame a third of a 32K page rather than a 16K slab object.
+ * Each fragment holds a reference on the page, which goes back to the
+ * page allocator once the last skb carved from it is freed.
+ */
+struct netdev_alloc_cache {
+	struct page	*page;
+	unsigned int	offset;
+	unsigned int	size;
+};
+static DEFINE_PER_CPU(struct netdev_alloc_cache, netdev_alloc_cache);
+
+#define NETDEV_FRAG_PAGE_MAX_SIZE	(32768 > PAGE_SIZE ? 32768 : PAGE_SIZE)
+
+static struct page *netdev_frag_page_alloc(unsigned int *size)
+{
+	struct page *page;
+	int order = get_order(NETDEV_FRAG_PAGE_MAX_SIZE);
+
+	/* a large page when one is to be had, else a single one */
+	if (order) {
+		page = alloc_pages(GFP_ATOMIC | __GFP_COMP | __GFP_NOWARN |
+				   __GFP_NORETRY, order);
+		if (page) {
+			*size = PAGE_SIZE << order;
+			return page;
+		}
+	}
+	page = alloc_page(GFP_ATOMIC | __GFP_NOWARN);
+	*size = PAGE_SIZE;
+	return page;
+}
+
+/**
+ *	netdev_alloc_frag - allocate a page fragment for a receive buffer
+ *	@fragsz: fragment size, a multiple of SMP_CACHE_BYTES
+ *
+ *	Returns the fragment's address, to be handed to build_skb() or
+ *	given back with put_page(virt_to_page()), or %NULL if no page
+ *	was to be had.  Callable from any context.
+ */
+void *netdev_alloc_frag(unsigned int fragsz)
+{
+	struct netdev_alloc_cache *nc;
+	unsigned long flags;
+	void *data = NULL;
+
+	local_irq_save(flags);
+	nc = &__get_cpu_var(netdev_alloc_cache);
+	if (unlikely(!nc->page || nc->offset + fragsz > nc->size)) {
+		if (nc->page)
+			put_page(nc->page);
+		nc->offset = 0;
+		nc->page = netdev_frag_page_alloc(&nc->size);
+		if (!nc->page || fragsz > nc->size)
+			goto out;
+	}
+	data = page_address(nc->page) + nc->offset;
+	nc->offset += fragsz;
+	get_page(nc->page);
+out:
+	local_irq_restore(flags);
+	return data;
+}
+EXPORT_SYMBOL(netdev_alloc_frag);
+
 /**
  *	__netdev_alloc_skb - allocate an skbuff for rx on a specific device
  *	@dev: network device to receive on
@@ -265,9 +381,23 @@ nodata:
 struct sk_buff *__netdev_alloc_skb(struct net_device *dev,
 		unsigned int length, gfp_t gfp_mask)
 {
-	struct sk_buff *skb;
-
-	skb = alloc_skb(length + NET_SKB_PAD, gfp_mask);
+	struct sk_buff *skb = NULL;
+	unsigned int fragsz = SKB_DATA_ALIGN(length + NET_SKB_PAD) +
+			      SKB_DATA_ALIGN(sizeof(struct skb_shared_info));
+
+	/* atomic, non-DMA requests come from the per-cpu page */
+	if (fragsz <= NETDEV_FRAG_PAGE_MAX_SIZE &&
+	    !(gfp_mask & (__GFP_WAIT | GFP_DMA))) {
+		void *data = netdev_alloc_frag(fragsz);
+
+		if (likely(data)) {
+			skb = build_skb(data, fragsz);
+			if (unlikely(!skb))
+				put_page(virt_to_page(data));
+		}
+	}
+	if (!skb)
+		skb = alloc_skb(length + NET_SKB_PAD, gfp_mask);
 	if (likely(skb)) {
 		skb_reserve(skb, NET_SKB_PAD);
 		skb->dev = dev;
@@ -315,7 +445,10 @@ static void skb_release_data(struct sk_buff *skb)
 		if (skb_shinfo(skb)->frag_list)
 			skb_drop_fraglist(skb);
 
-		kfree(skb->head);
+		if (skb->head_frag)
+			put_page(virt_to_page(skb->head));
+		else
+			kfree(skb->head);
 	}
 }
 
@@ -354,16 +487,8 @@ void kfree_skbmem(struct sk_buff *skb)
 	};
 }
 
-/**
- *	__kfree_skb - private function
- *	@skb: buffer
- *
- *	Free an sk_buff. Release anything attached to the buffer.
- *	Clean the state. This is an internal helper function. Users should
- *	always call kfree_skb
- */
-
-void __kfree_skb(struct sk_buff *skb)
+/* Release everything attached to the sk_buff itself, not its data. */
+static void skb_release_head_state(struct sk_buff *skb)
 {
 	dst_release(skb->dst);
 #ifdef CONFIG_XFRM
@@ -389,7 +514,20 @@ void __kfree_skb(struct sk_buff *skb)
 	skb->tc_verd = 0;
 #endif
 #endif
+}
+
+/**
+ *	__kfree_skb - private function
+ *	@skb: buffer
+ *
+ *	Free an sk_buff. Release anything attached to the buffer.
+ *	Clean the state. This is an internal helper function. Users should
+ *	always call kfree_skb
+ */
 
+void __kfree_skb(struct sk_buff *skb)
+{
+	skb_release_head_state(skb);
 	kfree_skbmem(skb);
 }
 
@@ -411,6 +549,190 @@ void kfree_skb(struct sk_buff *skb)
 	__kfree_skb(skb);
 }
 
+struct skb_recycle_cpu {
+	struct sk_buff_head		list;
+	struct skb_recycle_stats	stats;
+};
+
+struct skb_recycle_pool {
+	unsigned int			skb_size;
+	unsigned int			max;
+	struct skb_recycle_cpu		*cpu;	/* alloc_percpu() */
+};
+
+/*
+ * Turn an sk_buff the driver is done with back into a fresh one of at
+ * least @skb_size bytes, as __netdev_alloc_skb() would have returned it,
+ * if nobody else holds a reference to it or to its data.
+ */
+static int skb_recycle_check(struct sk_buff *skb, unsigned int skb_size)
+{
+	struct skb_shared_info *shinfo;
+	__u8 head_frag;
+
+	if (skb_is_nonlinear(skb) || skb_shinfo(skb)->frag_list)
+		return 0;
+	if (skb->fclone != SKB_FCLONE_UNAVAILABLE)
+		return 0;
+	if (skb_shared(skb) || skb_cloned(skb))
+		return 0;
+	if (skb->end - skb->head < SKB_DATA_ALIGN(skb_size + NET_SKB_PAD))
+		return 0;
+
+	skb_release_head_state(skb);
+
+	shinfo = skb_shinfo(skb);
+	atomic_set(&shinfo->dataref, 1);
+	shinfo->nr_frags = 0;
+	shinfo->gso_size = 0;
+	shinfo->gso_segs = 0;
+	shinfo->gso_type = 0;
+	shinfo->ip6_frag_id = 0;
+	shinfo->frag_list = NULL;
+
+	head_frag = skb->head_frag;
+	memset(skb, 0, offsetof(struct sk_buff, truesize));
+	skb->head_frag = head_frag;
+	skb->data = skb->head + NET_SKB_PAD;
+	skb->tail = skb->data;
+	return 1;
+}
+
+/**
+ *	skb_recycle_pool_create - set up a driver's skb recycling
+ *	@skb_size: buffer size the driver's rx ring takes, as passed to
+ *		netdev_alloc_skb()
+ *	@max: skbs each cpu holds on to at most
+ *
+ *	Returns %NULL if there is no memory for the per-cpu caches.
+ */
+struct skb_recycle_pool *skb_recycle_pool_create(unsigned int skb_size,
+						 unsigned int max)
+{
+	struct skb_recycle_pool *pool;
+	int cpu;
+
+	pool = kmalloc(sizeof(*pool), GFP_KERNEL);
+	if (!pool)
+		return NULL;
+
+	pool->cpu = alloc_percpu(struct skb_recycle_cpu);
+	if (!pool->cpu) {
+		kfree(pool);
+		return NULL;
+	}
+	pool->skb_size = skb_size;
+	pool->max = max;
+	for_each_possible_cpu(cpu)
+		skb_queue_head_init(&per_cpu_ptr(pool->cpu, cpu)->list);
+
+	return pool;
+}
+
+/**
+ *	skb_recycle_pool_destroy - free a pool and the skbs it holds
+ *	@pool: pool to free
+ *
+ *	The driver must have stopped calling skb_recycle() and
+ *	skb_recycle_alloc() on it.
+ */
+void skb_recycle_pool_destroy(struct skb_recycle_pool *pool)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		skb_queue_purge(&per_cpu_ptr(pool->cpu, cpu)->list);
+	free_percpu(pool->cpu);
+	kfree(pool);
+}
+
+/**
+ *	skb_recycle - offer a transmitted skb back to the rx pool
+ *	@pool: the device's pool
+ *	@skb: buffer the driver is done with
+ *
+ *	Returns 1 if the skb was taken, in which case the caller must not
+ *	touch it again; 0 if it is unsuitable or this cpu's cache is full,
+ *	in which case the caller frees it as usual.  Only recycles from
+ *	softirq or process context, as the destructor has to run.
+ */
+int skb_recycle(struct skb_recycle_pool *pool, struct sk_buff *skb)
+{
+	struct skb_recycle_cpu *rc;
+	unsigned long flags;
+	int ret = 0;
+
+	if (in_irq() || irqs_disabled())
+		return 0;
+
+	rc = per_cpu_ptr(pool->cpu, get_cpu());
+	if (skb_queue_len(&rc->list) >= pool->max) {
+		rc->stats.full++;
+		goto out;
+	}
+	if (!skb_recycle_check(skb, pool->skb_size))
+		goto out;
+
+	local_irq_save(flags);
+	__skb_queue_head(&rc->list, skb);
+	rc->stats.recycled++;
+	local_irq_restore(flags);
+	ret = 1;
+out:
+	put_cpu();
+	return ret;
+}
+
+/**
+ *	skb_recycle_alloc - allocate an rx skb, recycled if possible
+ *	@pool: the device's pool
+ *	@dev: network device to receive on
+ *
+ *	Like netdev_alloc_skb(dev, skb_size) for the size the pool was
+ *	created with, which it falls back to when this cpu has nothing
+ *	cached.
+ */
+struct sk_buff *skb_recycle_alloc(struct skb_recycle_pool *pool,
+				  struct net_device *dev)
+{
+	struct skb_recycle_cpu *rc;
+	struct sk_buff *skb;
+	unsigned long flags;
+
+	local_irq_save(flags);
+	rc = per_cpu_ptr(pool->cpu, smp_processor_id());
+	skb = __skb_dequeue(&rc->list);
+	if (skb)
+		rc->stats.reused++;
+	local_irq_restore(flags);
+
+	if (!skb)
+		return netdev_alloc_skb(dev, pool->skb_size);
+
+	skb->dev = dev;
+	return skb;
+}
+
+/**
+ *	skb_recycle_pool_stats - sum a pool's counters over all cpus
+ *	@pool: pool to read
+ *	@stats: filled in
+ */
+void skb_recycle_pool_stats(struct skb_recycle_pool *pool,
+			    struct skb_recycle_stats *stats)
+{
+	int cpu;
+
+	memset(stats, 0, sizeof(*stats));
+	for_each_possible_cpu(cpu) {
+		struct skb_recycle_cpu *rc = per_cpu_ptr(pool->cpu, cpu);
+
+		stats->recycled += rc->stats.recycled;
+		stats->reused += rc->stats.reused;
+		stats->full += rc->stats.full;
+	}
+}
+
 /**
  *	skb_clone	-	duplicate an sk_buff
  *	@skb: buffer to clone
@@ -464,6 +786,8 @@ struct sk_buff *skb_clone(struct sk_buff *skb, gfp_t gfp_mask)
 	C(local_df);
 	n->cloned = 1;
 	n->nohdr = 0;
+	n->xmit_more = 0;
+	n->queue_mapping_set = 0;
 	C(pkt_type);
 	C(ip_summed);
 	C(priority);
@@ -471,6 +795,7 @@ struct sk_buff *skb_clone(struct sk_buff *skb, gfp_t gfp_mask)
 	C(ipvs_property);
 #endif
 	C(protocol);
+	C(queue_mapping);
 	n->destructor = NULL;
 #ifdef CONFIG_NETFILTER
 	C(nfmark);
@@ -499,6 +824,7 @@ struct sk_buff *skb_clone(struct sk_buff *skb, gfp_t gfp_mask)
 	C(truesize);
 	atomic_set(&n->users, 1);
 	C(head);
+	C(head_frag);
 	C(data);
 	C(tail);
 	C(end);
@@ -520,6 +846,7 @@ static void copy_skb_header(struct sk_buff *new, const struct sk_buff *old)
 	new->dev	= old->dev;
 	new->priority	= old->priority;
 	new->protocol	= old->protocol;
+	new->queue_mapping = old->queue_mapping;
 	new->dst	= dst_clone(old->dst);
 #ifdef CONFIG_INET
 	new->sp		= secpath_get(old->sp);
@@ -718,6 +1045,7 @@ int pskb_expand_head(struct sk_buff *skb, int nhead, int ntail,
 	skb->nh.raw  += off;
 	skb->cloned   = 0;
 	skb->nohdr    = 0;
+	skb->head_frag = 0;
 	atomic_set(&skb_shinfo(skb)->dataref, 1);
 	return 0;
 
@@ -1236,6 +1564,191 @@ fault:
 
 EXPORT_SYMBOL(skb_store_bits);
 
+/*
+ * Pipe buffers of socket data.  The pages of skb fragments are passed by
+ * reference, and may be shared with other skbs: they can't be stolen.  The
+ * linear data is copied, packed into pages of the pipe's own which can be
+ * moved into the page cache whole, see pipe_to_file().
+ */
+static void sock_pipe_buf_release(struct pipe_inode_info *pipe,
+				  struct pipe_buffer *buf)
+{
+	put_page(buf->page);
+}
+
+static int sock_pipe_buf_steal(struct pipe_inode_info *pipe,
+			       struct pipe_buffer *buf)
+{
+	return 1;
+}
+
+static struct pipe_buf_operations sock_pipe_buf_ops = {
+	.can_merge = 0,
+	.map = generic_pipe_buf_map,
+	.unmap = generic_pipe_buf_unmap,
+	.pin = generic_pipe_buf_pin,
+	.release = sock_pipe_buf_release,
+	.steal = sock_pipe_buf_steal,
+	.get = generic_pipe_buf_get,
+};
+
+static struct pipe_buf_operations sock_copy_pipe_buf_ops = {
+	.can_merge = 0,
+	.map = generic_pipe_buf_map,
+	.unmap = generic_pipe_buf_unmap,
+	.pin = generic_pipe_buf_pin,
+	.release = sock_pipe_buf_release,
+	.steal = generic_pipe_buf_steal,
+	.get = generic_pipe_buf_get,
+};
+
+static struct pipe_buffer *skb_pipe_buf(struct pipe_inode_info *pipe,
+					struct page *page, unsigned int offset,
+					struct pipe_buf_operations *ops)
+{
+	struct pipe_buffer *buf;
+
+	buf = pipe->bufs + ((pipe->curbuf + pipe->nrbufs) & (pipe->buffers - 1));
+	buf->page = page;
+	buf->offset = offset;
+	buf->len = 0;
+	buf->ops = ops;
+	buf->flags = 0;
+	pipe->nrbufs++;
+	return buf;
+}
+
+/*
+ * Copy linear data into the pipe, appending to the last buffer while it
+ * is a copy with room left.  Returns the bytes copied.
+ */
+static int skb_splice_copy(struct pipe_inode_info *pipe, const u8 *from,
+			   int len)
+{
+	struct pipe_buffer *buf = NULL;
+	int copied = 0;
+
+	if (pipe->nrbufs) {
+		buf = pipe->bufs + ((pipe->curbuf + pipe->nrbufs - 1) &
+				    (pipe->buffers - 1));
+		if (buf->ops != &sock_copy_pipe_buf_ops ||
+		    buf->offset + buf->len == PAGE_SIZE)
+			buf = NULL;
+	}
+
+	while (copied < len) {
+		int copy;
+
+		if (!buf) {
+			struct page *page;
+
+			if (pipe->nrbufs >= pipe->buffers)
+				break;
+			page = alloc_page(GFP_KERNEL);
+			if (!page)
+				break;
+			buf = skb_pipe_buf(pipe, page, 0,
+					   &sock_copy_pipe_buf_ops);
+		}
+
+		copy = min_t(int, len - copied,
+			     PAGE_SIZE - (buf->offset + buf->len));
+		memcpy(page_address(buf->page) + buf->offset + buf->len,
+		       from + copied, copy);
+		buf->len += copy;
+		copied += copy;
+		buf = NULL;
+	}
+	return copied;
+}
+
+/**
+ *	skb_splice_bits - splice bits of an skb into a pipe
+ *	@skb: source skb
+ *	@offset: offset in the source
+ *	@pipe: the pipe, locked by the caller
+ *	@len: number of bytes to splice
+ *
+ *	Fill the pipe with the data of the skb, with references to the pages
+ *	of its fragments.  Stops when the pipe is full.  Returns the number
+ *	of bytes spliced, or -ENOMEM if none could be.
+ */
+int skb_splice_bits(const struct sk_buff *skb, int offset,
+		    struct pipe_inode_info *pipe, int len)
+{
+	int i, copy, done, total = 0;
+	int start = skb_headlen(skb);
+
+	/* Copy header. */
+	if ((copy = start - offset) > 0) {
+		if (copy > len)
+			copy = len;
+		done = skb_splice_copy(pipe, skb->data + offset, copy);
+		total += done;
+		if (done < copy || (len -= copy) == 0)
+			goto out;
+		offset += copy;
+	}
+
+	for (i = 0; i < skb_shinfo(skb)->nr_frags; i++) {
+		skb_frag_t *frag = &skb_shinfo(skb)->frags[i];
+		int end;
+
+		BUG_TRAP(start <= offset + len);
+
+		end = start + frag->size;
+		if ((copy = end - offset) > 0) {
+			struct pipe_buffer *buf;
+
+			if (pipe->nrbufs >= pipe->buffers)
+				goto out;
+			if (copy > len)
+				copy = len;
+
+			get_page(frag->page);
+			buf = skb_pipe_buf(pipe, frag->page,
+					   frag->page_offset + offset - start,
+					   &sock_pipe_buf_ops);
+			buf->len = copy;
+			total += copy;
+
+			if ((len -= copy) == 0)
+				goto out;
+			offset += copy;
+		}
+		start = end;
+	}
+
+	if (skb_shinfo(skb)->frag_list) {
+		struct sk_buff *list = skb_shinfo(skb)->frag_list;
+
+		for (; list; list = list->next) {
+			int end;
+
+			BUG_TRAP(start <= offset + len);
+
+			end = start + list->len;
+			if ((copy = end - offset) > 0) {
+				if (copy > len)
+					copy = len;
+				done = skb_splice_bits(list, offset - start,
+						       pipe, copy);
+				if (done > 0)
+					total += done;
+				if (done < copy || (len -= copy) == 0)
+					goto out;
+				offset += copy;
+			}
+			start = end;
+		}
+	}
+
+out:
+	if (!total && len && pipe->nrbufs < pipe->buffers)
+		return -ENOMEM;
+	return total;
+}
+
 /* Checksum skb data. */
 
 unsigned int skb_checksum(const struct sk_buff *skb, int offset,
@@ -1938,6 +2451,10 @@ struct sk_buff *skb_segment(struct sk_buff *skb, int features)
 	int i = 0;
 	int pos;
 
+	/* Only the copy handles the frag_list of a packet merged on receive */
+	if (skb_shinfo(skb)->frag_list)
+		sg = 0;
+
 	__skb_push(skb, doffset);
 	headroom = skb_headroom(skb);
 	pos = skb_headlen(skb);
@@ -1973,6 +2490,7 @@ struct sk_buff *skb_segment(struct sk_buff *skb, int features)
 		nskb->dev = skb->dev;
 		nskb->priority = skb->priority;
 		nskb->protocol = skb->protocol;
+		nskb->queue_mapping = skb->queue_mapping;
 		nskb->dst = dst_clone(skb->dst);
 		memcpy(nskb->cb, skb->cb, sizeof(skb->cb));
 		nskb->pkt_type = skb->pkt_type;
@@ -2041,6 +2559,43 @@ err:
 
 EXPORT_SYMBOL_GPL(skb_segment);
 
+/**
+ *	skb_gro_receive - merge a received packet into a held one
+ *	@p: packet held by receive offload
+ *	@skb: next segment of the same flow
+ *
+ *	The payload of @skb, past the headers the protocols looked at, is
+ *	chained to the frag_list of @p.  Returns -E2BIG if @p would get
+ *	larger than an IP packet can be, and @skb is left alone.
+ */
+int skb_gro_receive(struct sk_buff *p, struct sk_buff *skb)
+{
+	unsigned int offset = NAPI_GRO_CB(skb)->data_offset;
+	unsigned int len = skb->len - offset;
+
+	if (unlikely(p->len + len >= 65536))
+		return -E2BIG;
+
+	__skb_pull(skb, offset);
+
+	if (NAPI_GRO_CB(p)->last)
+		NAPI_GRO_CB(p)->last->next = skb;
+	else
+		skb_shinfo(p)->frag_list = skb;
+	NAPI_GRO_CB(p)->last = skb;
+	skb->next = NULL;
+
+	p->data_len += len;
+	p->truesize += skb->truesize;
+	p->len += len;
+
+	NAPI_GRO_CB(p)->count++;
+	NAPI_GRO_CB(skb)->same_flow = 1;
+	return 0;
+}
+
+EXPORT_SYMBOL_GPL(skb_gro_receive);
+
 void __init skb_init(void)
 {
 	skbuff_head_cache = kmem_cache_create("skbuff_head_cache",
@@ -2067,6 +2622,11 @@ EXPORT_SYMBOL(kfree_skb);
 EXPORT_SYMBOL(__pskb_pull_tail);
 EXPORT_SYMBOL(__alloc_skb);
 EXPORT_SYMBOL(__netdev_alloc_skb);
+EXPORT_SYMBOL(skb_recycle_pool_create);
+EXPORT_SYMBOL(skb_recycle_pool_destroy);
+EXPORT_SYMBOL(skb_recycle);
+EXPORT_SYMBOL(skb_recycle_alloc);
+EXPORT_SYMBOL(skb_recycle_pool_stats);
 EXPORT_SYMBOL(pskb_copy);
 EXPORT_SYMBOL(pskb_expand_head);
 EXPORT_SYMBOL(skb_checksum);
@@ -2076,6 +2636,7 @@ EXPORT_SYMBOL(skb_copy);
 EXPORT_SYMBOL(skb_copy_and_csum_bits);
 EXPORT_SYMBOL(skb_copy_and_csum_dev);
 EXPORT_SYMBOL(skb_copy_bits);
+EXPORT_SYMBOL(skb_splice_bits);
 EXPORT_SYMBOL(skb_copy_expand);
 EXPORT_SYMBOL(skb_over_panic);
 EXPORT_SYMBOL(skb_pad);
@@ -121,6 +121,7 @@
 #include <net/request_sock.h>
 #include <net/sock.h>
 #include <net/xfrm.h>
+#include <net/busy_poll.h>
 #include <linux/ipsec.h>
 
 #include <linux/filter.h>
@@ -386,6 +387,9 @@ int sock_setsockopt(struct socket *sock, int level, int optname,
 		case SO_REUSEADDR:
 			sk->sk_reuse = valbool;
 			break;
+		case SO_REUSEPORT:
+			sk->sk_reuseport = valbool;
+			break;
 		case SO_TYPE:
 		case SO_ERROR:
 			ret = -ENOPROTOOPT;
@@ -625,6 +629,16 @@ set_rcvbuf:
 				clear_bit(SOCK_PASSSEC, &sock->flags);
 			break;
 
+		case SO_BUSY_POLL:
+			/* spinning longer than now is privileged */
+			if (val > (int)sk->sk_ll_usec && !capable(CAP_NET_ADMIN))
+				ret = -EPERM;
+			else if (val < 0)
+				ret = -EINVAL;
+			else
+				sk->sk_ll_usec = val;
+			break;
+
 		/* We implement the SO_SNDLOWAT etc to
 		   not be settable (1003.1g 5.3) */
 		default:
@@ -646,6 +660,7 @@ int sock_getsockopt(struct socket *sock, int level, int optname,
   		int val;
   		struct linger ling;
 		struct timeval tm;
+		struct sock_busy_poll_stats bp;
 	} v;
 	
 	unsigned int lv = sizeof(int);
@@ -682,6 +697,10 @@ int sock_getsockopt(struct socket *sock, int level, int optname,
 			v.val = sk->sk_reuse;
 			break;
 
+		case SO_REUSEPORT:
+			v.val = sk->sk_reuseport;
+			break;
+
 		case SO_KEEPALIVE:
 			v.val = !!sock_flag(sk, SOCK_KEEPOPEN);
 			break;
@@ -790,6 +809,15 @@ int sock_getsockopt(struct socket *sock, int level, int optname,
 		case SO_PEERSEC:
 			return security_socket_getpeersec_stream(sock, optval, optlen, len);
 
+		case SO_BUSY_POLL:
+			v.val = sk->sk_ll_usec;
+			break;
+
+		case SO_BUSY_POLL_STATS:
+			lv = sizeof(struct sock_busy_poll_stats);
+			v.bp = sk->sk_bp_stats;
+			break;
+
 		default:
 			return(-ENOPROTOOPT);
 	}
@@ -876,7 +904,7 @@ out_free:
 	return NULL;
 }
 
-void sk_free(struct sock *sk)
+static void __sk_free(struct sock *sk)
 {
 	struct sk_filter *filter;
 	struct module *owner = sk->sk_prot_creator->owner;
@@ -904,6 +932,20 @@ void sk_free(struct sock *sk)
 	module_put(owner);
 }
 
+static void sk_free_rcu(struct rcu_head *head)
+{
+	__sk_free(container_of(head, struct sock, sk_rcu));
+}
+
+void sk_free(struct sock *sk)
+{
+	/* Lockless lookups may still be looking at a listener */
+	if (sock_flag(sk, SOCK_RCU_FREE))
+		call_rcu(&sk->sk_rcu, sk_free_rcu);
+	else
+		__sk_free(sk);
+}
+
 struct sock *sk_clone(const struct sock *sk, const gfp_t priority)
 {
 	struct sock *newsk = sk_alloc(sk->sk_family, priority, sk->sk_prot, 0);
@@ -957,6 +999,7 @@ struct sock *sk_clone(const struct sock *sk, const gfp_t priority)
 
 		newsk->sk_err	   = 0;
 		newsk->sk_priority = 0;
+		memset(&newsk->sk_bp_stats, 0, sizeof(newsk->sk_bp_stats));
 		atomic_set(&newsk->sk_refcnt, 2);
 
 		/*
@@ -1522,12 +1565,16 @@ void sock_init_data(struct socket *sock, struct sock *sk)
 	sk->sk_peercred.gid	=	-1;
 	sk->sk_write_pending	=	0;
 	sk->sk_rcvlowat		=	1;
+	sk->sk_pacing_rate	=	~0U;
 	sk->sk_rcvtimeo		=	MAX_SCHEDULE_TIMEOUT;
 	sk->sk_sndtimeo		=	MAX_SCHEDULE_TIMEOUT;
 
 	sk->sk_stamp.tv_sec     = -1L;
 	sk->sk_stamp.tv_usec    = -1L;
 
+	sk->sk_ll_usec		=	sysctl_net_busy_read;
+	sk->sk_rx_ifindex	=	0;
+
 	atomic_set(&sk->sk_refcnt, 1);
 }
 
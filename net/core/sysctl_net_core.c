@@ -10,6 +10,7 @@
 #include <linux/module.h>
 #include <linux/socket.h>
 #include <net/sock.h>
+#include <net/busy_poll.h>
 
 #ifdef CONFIG_SYSCTL
 
@@ -133,6 +134,16 @@ ctl_table core_table[] = {
 		.proc_handler	= &proc_dointvec
 	},
 #endif /* CONFIG_XFRM */
+#ifdef CONFIG_BPF_JIT
+	{
+		.ctl_name	= NET_CORE_BPF_JIT_ENABLE,
+		.procname	= "bpf_jit_enable",
+		.data		= &bpf_jit_enable,
+		.maxlen		= sizeof(int),
+		.mode		= 0644,
+		.proc_handler	= &proc_dointvec
+	},
+#endif /* CONFIG_BPF_JIT */
 #endif /* CONFIG_NET */
 	{
 		.ctl_name	= NET_CORE_SOMAXCONN,
@@ -150,6 +161,14 @@ ctl_table core_table[] = {
 		.mode		= 0644,
 		.proc_handler	= &proc_dointvec
 	},
+	{
+		.ctl_name	= NET_CORE_BUSY_READ,
+		.procname	= "busy_read",
+		.data		= &sysctl_net_busy_read,
+		.maxlen		= sizeof(int),
+		.mode		= 0644,
+		.proc_handler	= &proc_dointvec
+	},
 	{ .ctl_name = 0 }
 };
 
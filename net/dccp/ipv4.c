@@ -364,13 +364,16 @@ static void dccp_v4_err(struct sk_buff *skb, u32 info)
 
 	switch (sk->sk_state) {
 		struct request_sock *req , **prev;
+		spinlock_t *lock;
 	case DCCP_LISTEN:
 		if (sock_owned_by_user(sk))
 			goto out;
+		lock = inet_csk_syn_lock(sk, dh->dccph_dport, iph->daddr);
+		spin_lock(lock);
 		req = inet_csk_search_req(sk, &prev, dh->dccph_dport,
 					  iph->daddr, iph->saddr);
 		if (!req)
-			goto out;
+			goto out_unlock;
 
 		/*
 		 * ICMPs are not backlogged, hence we cannot get an established
@@ -380,7 +383,7 @@ static void dccp_v4_err(struct sk_buff *skb, u32 info)
 
 		if (seq != dccp_rsk(req)->dreq_iss) {
 			NET_INC_STATS_BH(LINUX_MIB_OUTOFWINDOWICMPS);
-			goto out;
+			goto out_unlock;
 		}
 		/*
 		 * Still in RESPOND, just remove it silently.
@@ -389,6 +392,8 @@ static void dccp_v4_err(struct sk_buff *skb, u32 info)
 		 * errors returned from accept().
 		 */
 		inet_csk_reqsk_queue_drop(sk, req, prev);
+out_unlock:
+		spin_unlock(lock);
 		goto out;
 
 	case DCCP_REQUESTING:
@@ -791,7 +796,17 @@ int dccp_v4_do_rcv(struct sock *sk, struct sk_buff *skb)
 	 *	 dccp_rcv_state_process
 	 */
 	if (sk->sk_state == DCCP_LISTEN) {
-		struct sock *nsk = dccp_v4_hnd_req(sk, skb);
+		/* the request table is walked by inet_diag too */
+		spinlock_t *lock = inet_csk_syn_lock(sk, dh->dccph_sport,
+						     skb->nh.iph->saddr);
+		struct sock *nsk;
+		int rc = 0;
+
+		spin_lock(lock);
+		nsk = dccp_v4_hnd_req(sk, skb);
+		if (nsk == sk)
+			rc = dccp_rcv_state_process(sk, skb, dh, skb->len);
+		spin_unlock(lock);
 
 		if (nsk == NULL)
 			goto discard;
@@ -801,6 +816,10 @@ int dccp_v4_do_rcv(struct sock *sk, struct sk_buff *skb)
 				goto reset;
 			return 0;
 		}
+
+		if (rc)
+			goto reset;
+		return 0;
 	}
 
 	if (dccp_rcv_state_process(sk, skb, dh, skb->len))
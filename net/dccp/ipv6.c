@@ -350,15 +350,18 @@ static void dccp_v6_err(struct sk_buff *skb, struct inet6_skb_parm *opt,
 	/* Might be for an request_sock */
 	switch (sk->sk_state) {
 		struct request_sock *req, **prev;
+		spinlock_t *lock;
 	case DCCP_LISTEN:
 		if (sock_owned_by_user(sk))
 			goto out;
 
+		lock = inet6_csk_syn_lock(sk, dh->dccph_dport, &hdr->daddr);
+		spin_lock(lock);
 		req = inet6_csk_search_req(sk, &prev, dh->dccph_dport,
 					   &hdr->daddr, &hdr->saddr,
 					   inet6_iif(skb));
 		if (req == NULL)
-			goto out;
+			goto out_unlock;
 
 		/*
 		 * ICMPs are not backlogged, hence we cannot get an established
@@ -368,10 +371,12 @@ static void dccp_v6_err(struct sk_buff *skb, struct inet6_skb_parm *opt,
 
 		if (seq != dccp_rsk(req)->dreq_iss) {
 			NET_INC_STATS_BH(LINUX_MIB_OUTOFWINDOWICMPS);
-			goto out;
+			goto out_unlock;
 		}
 
 		inet_csk_reqsk_queue_drop(sk, req, prev);
+out_unlock:
+		spin_unlock(lock);
 		goto out;
 
 	case DCCP_REQUESTING:
@@ -992,7 +997,18 @@ static int dccp_v6_do_rcv(struct sock *sk, struct sk_buff *skb)
 	}
 
 	if (sk->sk_state == DCCP_LISTEN) {
-		struct sock *nsk = dccp_v6_hnd_req(sk, skb);
+		/* the request table is walked by inet_diag too */
+		spinlock_t *lock = inet6_csk_syn_lock(sk, dccp_hdr(skb)->dccph_sport,
+						      &skb->nh.ipv6h->saddr);
+		struct sock *nsk;
+		int rc = 0;
+
+		spin_lock(lock);
+		nsk = dccp_v6_hnd_req(sk, skb);
+		if (nsk == sk)
+			rc = dccp_rcv_state_process(sk, skb, dccp_hdr(skb),
+						    skb->len);
+		spin_unlock(lock);
 
 		if (nsk == NULL)
 			goto discard;
@@ -1008,6 +1024,12 @@ static int dccp_v6_do_rcv(struct sock *sk, struct sk_buff *skb)
 				__kfree_skb(opt_skb);
 			return 0;
 		}
+
+		if (rc)
+			goto reset;
+		if (opt_skb != NULL)
+			__kfree_skb(opt_skb);
+		return 0;
 	}
 
 	if (dccp_rcv_state_process(sk, skb, dccp_hdr(skb), skb->len))
@@ -300,3 +300,18 @@ struct net_device *alloc_etherdev(int sizeof_priv)
 	return alloc_netdev(sizeof_priv, "eth%d", ether_setup);
 }
 EXPORT_SYMBOL(alloc_etherdev);
+
+/**
+ * alloc_etherdev_mq - Allocates and sets up a multiqueue ethernet device
+ * @sizeof_priv: Size of additional driver-private structure to be allocated
+ *	for this ethernet device
+ * @queue_count: The number of hardware transmit rings of the device
+ *
+ * As alloc_etherdev(), for a device which transmits on @queue_count
+ * rings at once.
+ */
+struct net_device *alloc_etherdev_mq(int sizeof_priv, unsigned int queue_count)
+{
+	return alloc_netdev_mq(sizeof_priv, "eth%d", ether_setup, queue_count);
+}
+EXPORT_SYMBOL(alloc_etherdev_mq);
@@ -11,6 +11,116 @@
 #include <net/protocol.h>
 #include <net/udp.h>
 
+/*
+ * An outbound packet being encrypted by an asynchronous cipher.  The
+ * cipher's request context, the scatterlist and the IV follow req.
+ */
+struct esp_req {
+	struct sk_buff *skb;
+	struct sk_buff *trailer;
+	int offset;			/* of the ESP header */
+	int len;			/* covered by the ICV */
+	struct cipher_request req;
+};
+
+/* Called with the context locked */
+static void esp_output_icv(struct esp_data *esp, struct esp_ctx *ctx,
+			   struct sk_buff *skb, int offset, int len,
+			   struct sk_buff *trailer)
+{
+	if (esp->auth.icv_full_len) {
+		esp->auth.icv(esp, ctx, skb, offset, len, trailer->tail);
+		pskb_put(skb, trailer, esp->auth.icv_trunc_len);
+	}
+
+	ip_send_check(skb->nh.iph);
+}
+
+static void esp_output_done(struct crypto_async_request *base, int err)
+{
+	struct esp_req *ereq = base->data;
+	struct sk_buff *skb = ereq->skb;
+	struct xfrm_state *x = skb->dst->xfrm;
+	struct esp_data *esp = x->data;
+	struct esp_ctx *ctx;
+
+	if (!err) {
+		ctx = esp_get_ctx(esp);
+		esp_output_icv(esp, ctx, skb, ereq->offset, ereq->len,
+			       ereq->trailer);
+		esp_put_ctx(ctx);
+	}
+	kfree(ereq);
+
+	xfrm4_output_resume(skb, err);
+}
+
+/*
+ * Hand the payload to an asynchronous cipher, the packet then goes on
+ * from esp_output_done().  Each packet gets a random IV of its own,
+ * instead of the last block of the previous one, since that is not
+ * known until the engine is done with it.  x->lock is held throughout,
+ * the engine does its own queueing, and there is only the one context.
+ */
+static int esp_output_async(struct xfrm_state *x, struct sk_buff *skb,
+			    struct ip_esp_hdr *esph, struct sk_buff *trailer,
+			    int nfrags, int clen)
+{
+	struct esp_data *esp = x->data;
+	struct crypto_tfm *tfm = esp->conf.tfm;
+	unsigned int ivsize = esp->conf.ivlen ? crypto_tfm_alg_ivsize(tfm) : 0;
+	u8 *ivec = esp->ctx[0].ivec;
+	unsigned int sgoff;
+	struct esp_ctx *ctx;
+	struct esp_req *ereq;
+	struct scatterlist *sg;
+	int err;
+
+	sgoff = ALIGN(offsetof(struct esp_req, req) + crypto_cipher_reqsize(tfm),
+		      __alignof__(struct scatterlist));
+	ereq = kmalloc(sgoff + sizeof(*sg) * nfrags + ivsize, GFP_ATOMIC);
+	if (!ereq)
+		return -ENOMEM;
+	sg = (struct scatterlist *)((u8 *)ereq + sgoff);
+
+	ereq->skb = skb;
+	ereq->trailer = trailer;
+	ereq->offset = (u8 *)esph - skb->data;
+	ereq->len = sizeof(struct ip_esp_hdr) + esp->conf.ivlen + clen;
+
+	crypto_request_init(&ereq->req.base, tfm, esp_output_done, ereq);
+	ereq->req.dst = sg;
+	ereq->req.src = sg;
+	ereq->req.nbytes = clen;
+	ereq->req.iv = NULL;
+	if (ivsize) {
+		ereq->req.iv = (u8 *)(sg + nfrags);
+		memcpy(ereq->req.iv, ivec, ivsize);
+		memcpy(esph->enc_data, ivec, ivsize);
+		get_random_bytes(ivec, ivsize);
+	}
+	skb_to_sgvec(skb, sg, esph->enc_data+esp->conf.ivlen-skb->data, clen);
+
+	err = crypto_cipher_encrypt_async(&ereq->req);
+	if (err == -EINPROGRESS)
+		return err;
+
+	/* done in software already */
+	kfree(ereq);
+	if (!err) {
+		ctx = esp_get_ctx(esp);
+		esp_output_icv(esp, ctx, skb, (u8 *)esph - skb->data,
+			       sizeof(struct ip_esp_hdr) + esp->conf.ivlen + clen,
+			       trailer);
+		esp_put_ctx(ctx);
+	}
+	return err;
+}
+
+/*
+ * Called with x->lock held, which is dropped around the crypto of a
+ * synchronous cipher once the sequence number is taken.
+ */
 static int esp_output(struct xfrm_state *x, struct sk_buff *skb)
 {
 	int err;
@@ -18,6 +128,7 @@ static int esp_output(struct xfrm_state *x, struct sk_buff *skb)
 	struct ip_esp_hdr *esph;
 	struct crypto_tfm *tfm;
 	struct esp_data *esp;
+	struct esp_ctx *ctx;
 	struct sk_buff *trailer;
 	int blksize;
 	int clen;
@@ -91,38 +202,43 @@ static int esp_output(struct xfrm_state *x, struct sk_buff *skb)
 	esph->seq_no = htonl(++x->replay.oseq);
 	xfrm_aevent_doreplay(x);
 
+	if (crypto_tfm_alg_async(tfm))
+		return esp_output_async(x, skb, esph, trailer, nfrags, clen);
+
+	spin_unlock(&x->lock);
+	ctx = esp_get_ctx(esp);
+	tfm = ctx->tfm;
+
 	if (esp->conf.ivlen)
-		crypto_cipher_set_iv(tfm, esp->conf.ivec, crypto_tfm_alg_ivsize(tfm));
+		crypto_cipher_set_iv(tfm, ctx->ivec, crypto_tfm_alg_ivsize(tfm));
 
 	do {
-		struct scatterlist *sg = &esp->sgbuf[0];
+		struct scatterlist *sg = &ctx->sgbuf[0];
 
 		if (unlikely(nfrags > ESP_NUM_FAST_SG)) {
 			sg = kmalloc(sizeof(struct scatterlist)*nfrags, GFP_ATOMIC);
 			if (!sg)
-				goto error;
+				goto unlock;
 		}
 		skb_to_sgvec(skb, sg, esph->enc_data+esp->conf.ivlen-skb->data, clen);
 		crypto_cipher_encrypt(tfm, sg, sg, clen);
-		if (unlikely(sg != &esp->sgbuf[0]))
+		if (unlikely(sg != &ctx->sgbuf[0]))
 			kfree(sg);
 	} while (0);
 
 	if (esp->conf.ivlen) {
-		memcpy(esph->enc_data, esp->conf.ivec, crypto_tfm_alg_ivsize(tfm));
-		crypto_cipher_get_iv(tfm, esp->conf.ivec, crypto_tfm_alg_ivsize(tfm));
-	}
-
-	if (esp->auth.icv_full_len) {
-		esp->auth.icv(esp, skb, (u8*)esph-skb->data,
-		              sizeof(struct ip_esp_hdr) + esp->conf.ivlen+clen, trailer->tail);
-		pskb_put(skb, trailer, alen);
+		memcpy(esph->enc_data, ctx->ivec, crypto_tfm_alg_ivsize(tfm));
+		crypto_cipher_get_iv(tfm, ctx->ivec, crypto_tfm_alg_ivsize(tfm));
 	}
 
-	ip_send_check(top_iph);
+	esp_output_icv(esp, ctx, skb, (u8*)esph-skb->data,
+		       sizeof(struct ip_esp_hdr) + esp->conf.ivlen+clen, trailer);
 
 	err = 0;
 
+unlock:
+	esp_put_ctx(ctx);
+	spin_lock(&x->lock);
 error:
 	return err;
 }
@@ -131,12 +247,16 @@ error:
  * Note: detecting truncated vs. non-truncated authentication data is very
  * expensive, so we only support truncated data, which is the recommended
  * and common case.
+ *
+ * Called with x->lock held, which is dropped around the crypto: the
+ * caller has to check the replay window again.
  */
 static int esp_input(struct xfrm_state *x, struct sk_buff *skb)
 {
 	struct iphdr *iph;
 	struct ip_esp_hdr *esph;
 	struct esp_data *esp = x->data;
+	struct esp_ctx *ctx;
 	struct sk_buff *trailer;
 	int blksize = ALIGN(crypto_tfm_alg_blocksize(esp->conf.tfm), 4);
 	int alen = esp->auth.icv_trunc_len;
@@ -146,6 +266,7 @@ static int esp_input(struct xfrm_state *x, struct sk_buff *skb)
 	u8 nexthdr[2];
 	struct scatterlist *sg;
 	int padlen;
+	int err = -EINVAL;
 
 	if (!pskb_may_pull(skb, sizeof(struct ip_esp_hdr)))
 		goto out;
@@ -153,24 +274,27 @@ static int esp_input(struct xfrm_state *x, struct sk_buff *skb)
 	if (elen <= 0 || (elen & (blksize-1)))
 		goto out;
 
+	spin_unlock(&x->lock);
+	ctx = esp_get_ctx(esp);
+
 	/* If integrity check is required, do this. */
 	if (esp->auth.icv_full_len) {
 		u8 sum[esp->auth.icv_full_len];
 		u8 sum1[alen];
 		
-		esp->auth.icv(esp, skb, 0, skb->len-alen, sum);
+		esp->auth.icv(esp, ctx, skb, 0, skb->len-alen, sum);
 
 		if (skb_copy_bits(skb, skb->len-alen, sum1, alen))
 			BUG();
 
 		if (unlikely(memcmp(sum, sum1, alen))) {
-			x->stats.integrity_failed++;
-			goto out;
+			err = -EBADMSG;
+			goto unlock;
 		}
 	}
 
 	if ((nfrags = skb_cow_data(skb, 0, &trailer)) < 0)
-		goto out;
+		goto unlock;
 
 	skb->ip_summed = CHECKSUM_NONE;
 
@@ -178,19 +302,29 @@ static int esp_input(struct xfrm_state *x, struct sk_buff *skb)
 
 	/* Get ivec. This can be wrong, check against another impls. */
 	if (esp->conf.ivlen)
-		crypto_cipher_set_iv(esp->conf.tfm, esph->enc_data, crypto_tfm_alg_ivsize(esp->conf.tfm));
+		crypto_cipher_set_iv(ctx->tfm, esph->enc_data, crypto_tfm_alg_ivsize(ctx->tfm));
 
-	sg = &esp->sgbuf[0];
+	sg = &ctx->sgbuf[0];
 
 	if (unlikely(nfrags > ESP_NUM_FAST_SG)) {
 		sg = kmalloc(sizeof(struct scatterlist)*nfrags, GFP_ATOMIC);
 		if (!sg)
-			goto out;
+			goto unlock;
 	}
 	skb_to_sgvec(skb, sg, sizeof(struct ip_esp_hdr) + esp->conf.ivlen, elen);
-	crypto_cipher_decrypt(esp->conf.tfm, sg, sg, elen);
-	if (unlikely(sg != &esp->sgbuf[0]))
+	crypto_cipher_decrypt(ctx->tfm, sg, sg, elen);
+	if (unlikely(sg != &ctx->sgbuf[0]))
 		kfree(sg);
+	err = 0;
+
+unlock:
+	esp_put_ctx(ctx);
+	spin_lock(&x->lock);
+	if (err) {
+		if (err == -EBADMSG)
+			x->stats.integrity_failed++;
+		goto out;
+	}
 
 	if (skb_copy_bits(skb, skb->len-alen-2, nexthdr, 2))
 		BUG();
@@ -293,20 +427,13 @@ static void esp_destroy(struct xfrm_state *x)
 	if (!esp)
 		return;
 
-	crypto_free_tfm(esp->conf.tfm);
-	esp->conf.tfm = NULL;
-	kfree(esp->conf.ivec);
-	esp->conf.ivec = NULL;
-	crypto_free_tfm(esp->auth.tfm);
-	esp->auth.tfm = NULL;
-	kfree(esp->auth.work_icv);
-	esp->auth.work_icv = NULL;
-	kfree(esp);
+	esp_free_data(esp);
 }
 
 static int esp_init_state(struct xfrm_state *x)
 {
 	struct esp_data *esp = NULL;
+	u32 cipher_flags;
 
 	/* null auth and encryption can have zero length keys */
 	if (x->aalg) {
@@ -316,57 +443,14 @@ static int esp_init_state(struct xfrm_state *x)
 	if (x->ealg == NULL)
 		goto error;
 
-	esp = kzalloc(sizeof(*esp), GFP_KERNEL);
-	if (esp == NULL)
-		return -ENOMEM;
-
-	if (x->aalg) {
-		struct xfrm_algo_desc *aalg_desc;
-
-		esp->auth.key = x->aalg->alg_key;
-		esp->auth.key_len = (x->aalg->alg_key_len+7)/8;
-		esp->auth.tfm = crypto_alloc_tfm(x->aalg->alg_name, 0);
-		if (esp->auth.tfm == NULL)
-			goto error;
-		esp->auth.icv = esp_hmac_digest;
-
-		aalg_desc = xfrm_aalg_get_byname(x->aalg->alg_name, 0);
-		BUG_ON(!aalg_desc);
-
-		if (aalg_desc->uinfo.auth.icv_fullbits/8 !=
-		    crypto_tfm_alg_digestsize(esp->auth.tfm)) {
-			NETDEBUG(KERN_INFO "ESP: %s digestsize %u != %hu\n",
-				 x->aalg->alg_name,
-				 crypto_tfm_alg_digestsize(esp->auth.tfm),
-				 aalg_desc->uinfo.auth.icv_fullbits/8);
-			goto error;
-		}
-
-		esp->auth.icv_full_len = aalg_desc->uinfo.auth.icv_fullbits/8;
-		esp->auth.icv_trunc_len = aalg_desc->uinfo.auth.icv_truncbits/8;
-
-		esp->auth.work_icv = kmalloc(esp->auth.icv_full_len, GFP_KERNEL);
-		if (!esp->auth.work_icv)
-			goto error;
-	}
-	esp->conf.key = x->ealg->alg_key;
-	esp->conf.key_len = (x->ealg->alg_key_len+7)/8;
 	if (x->props.ealgo == SADB_EALG_NULL)
-		esp->conf.tfm = crypto_alloc_tfm(x->ealg->alg_name, CRYPTO_TFM_MODE_ECB);
+		cipher_flags = CRYPTO_TFM_MODE_ECB;
 	else
-		esp->conf.tfm = crypto_alloc_tfm(x->ealg->alg_name, CRYPTO_TFM_MODE_CBC);
-	if (esp->conf.tfm == NULL)
-		goto error;
-	esp->conf.ivlen = crypto_tfm_alg_ivsize(esp->conf.tfm);
-	esp->conf.padlen = 0;
-	if (esp->conf.ivlen) {
-		esp->conf.ivec = kmalloc(esp->conf.ivlen, GFP_KERNEL);
-		if (unlikely(esp->conf.ivec == NULL))
-			goto error;
-		get_random_bytes(esp->conf.ivec, esp->conf.ivlen);
-	}
-	if (crypto_cipher_setkey(esp->conf.tfm, esp->conf.key, esp->conf.key_len))
-		goto error;
+		cipher_flags = CRYPTO_TFM_MODE_CBC | CRYPTO_TFM_REQ_ASYNC;
+	esp = esp_alloc_data(x, cipher_flags);
+	if (IS_ERR(esp))
+		return PTR_ERR(esp);
+
 	x->props.header_len = sizeof(struct ip_esp_hdr) + esp->conf.ivlen;
 	if (x->props.mode)
 		x->props.header_len += sizeof(struct iphdr);
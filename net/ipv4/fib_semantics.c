@@ -149,6 +149,10 @@ void free_fib_info(struct fib_info *fi)
 		return;
 	}
 	change_nexthops(fi) {
+		if (nh->nh_pcpu_rth_input) {
+			ip_rt_nh_flush(nh);
+			free_percpu(nh->nh_pcpu_rth_input);
+		}
 		if (nh->nh_dev)
 			dev_put(nh->nh_dev);
 		nh->nh_dev = NULL;
@@ -719,6 +723,9 @@ fib_create_info(const struct rtmsg *r, struct kern_rta *rta,
 	fi->fib_nhs = nhs;
 	change_nexthops(fi) {
 		nh->nh_parent = fi;
+		nh->nh_pcpu_rth_input = alloc_percpu(struct rtable *);
+		if (nh->nh_pcpu_rth_input == NULL)
+			goto failure;
 	} endfor_nexthops(fi)
 
 	fi->fib_flags = r->rtm_flags;
@@ -1201,6 +1208,8 @@ int fib_sync_down(u32 local, struct net_device *dev, int force)
 			prev_fi = fi;
 			dead = 0;
 			change_nexthops(fi) {
+				if (nh->nh_dev == dev)
+					ip_rt_nh_flush(nh);
 				if (nh->nh_flags&RTNH_F_DEAD)
 					dead++;
 				else if (nh->nh_dev == dev &&
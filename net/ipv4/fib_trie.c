@@ -111,20 +111,35 @@ struct node {
 	unsigned long parent;
 };
 
+struct leaf_info {
+	struct hlist_node hlist;
+	int plen;
+	struct list_head falh;
+	struct rcu_head rcu;
+};
+
+/*
+ * Most leaves hold a single prefix, so the first leaf_info of a leaf is
+ * allocated with it, and what a lookup reads of both (up to the falh of
+ * li) fits in one cache line on 64-bit.  Once li has been taken out of
+ * the list it is not used again, as lockless readers may still walk it;
+ * the few leaves with more prefixes get the others from kmalloc.
+ */
 struct leaf {
 	t_key key;
 	unsigned long parent;
 	struct hlist_head list;
+	struct leaf_info li;
+	int li_used;
 	struct rcu_head rcu;
 };
 
-struct leaf_info {
-	struct hlist_node hlist;
-	struct rcu_head rcu;
-	int plen;
-	struct list_head falh;
-};
-
+/*
+ * A lookup reads the header of each tnode on its way and one child, so
+ * the header is kept small for it and the first children to share the
+ * cache line it starts.  The rcu_head, only needed once the node is
+ * unlinked, goes after the children, see tnode_free_head().
+ */
 struct tnode {
 	t_key key;
 	unsigned long parent;
@@ -132,10 +147,14 @@ struct tnode {
 	unsigned short bits:5;		/* 2log(KEYLENGTH) bits needed */
 	unsigned short full_children;	/* KEYLENGTH bits needed */
 	unsigned short empty_children;	/* KEYLENGTH bits needed */
-	struct rcu_head rcu;
 	struct node *child[0];
 };
 
+struct tnode_free {
+	struct rcu_head rcu;
+	struct tnode *tn;
+};
+
 #ifdef CONFIG_IP_FIB_TRIE_STATS
 struct trie_use_stats {
 	unsigned int gets;
@@ -152,6 +171,9 @@ struct trie_stat {
 	unsigned int maxdepth;
 	unsigned int tnodes;
 	unsigned int leaves;
+	unsigned int prefixes;
+	unsigned int ext_prefixes;	/* leaf_info not in their leaf */
+	unsigned int aliases;
 	unsigned int nullpointers;
 	unsigned int nodesizes[MAX_STAT_DEPTH];
 };
@@ -173,6 +195,7 @@ static struct tnode *halve(struct trie *t, struct tnode *tn);
 static void tnode_free(struct tnode *tn);
 
 static kmem_cache_t *fn_alias_kmem __read_mostly;
+static kmem_cache_t *trie_leaf_kmem __read_mostly;
 static struct trie *trie_local = NULL, *trie_main = NULL;
 
 
@@ -310,7 +333,7 @@ static inline void alias_free_mem_rcu(struct fib_alias *fa)
 
 static void __leaf_free_rcu(struct rcu_head *head)
 {
-	kfree(container_of(head, struct leaf, rcu));
+	kmem_cache_free(trie_leaf_kmem, container_of(head, struct leaf, rcu));
 }
 
 static void __leaf_info_free_rcu(struct rcu_head *head)
@@ -318,9 +341,22 @@ static void __leaf_info_free_rcu(struct rcu_head *head)
 	kfree(container_of(head, struct leaf_info, rcu));
 }
 
-static inline void free_leaf_info(struct leaf_info *leaf)
+static inline void free_leaf_info(struct leaf *l, struct leaf_info *li)
+{
+	/* the embedded one goes with its leaf */
+	if (li != &l->li)
+		call_rcu(&li->rcu, __leaf_info_free_rcu);
+}
+
+static inline unsigned int tnode_size(int bits)
+{
+	return sizeof(struct tnode) + (1 << bits) * sizeof(struct node *) +
+	       sizeof(struct tnode_free);
+}
+
+static inline struct tnode_free *tnode_free_head(struct tnode *tn)
 {
-	call_rcu(&leaf->rcu, __leaf_info_free_rcu);
+	return (struct tnode_free *)&tn->child[1 << tn->bits];
 }
 
 static struct tnode *tnode_alloc(unsigned int size)
@@ -339,9 +375,8 @@ static struct tnode *tnode_alloc(unsigned int size)
 
 static void __tnode_free_rcu(struct rcu_head *head)
 {
-	struct tnode *tn = container_of(head, struct tnode, rcu);
-	unsigned int size = sizeof(struct tnode) +
-		(1 << tn->bits) * sizeof(struct node *);
+	struct tnode *tn = container_of(head, struct tnode_free, rcu)->tn;
+	unsigned int size = tnode_size(tn->bits);
 
 	if (size <= PAGE_SIZE)
 		kfree(tn);
@@ -353,25 +388,36 @@ static inline void tnode_free(struct tnode *tn)
 {
 	if(IS_LEAF(tn)) {
 		struct leaf *l = (struct leaf *) tn;
-		call_rcu_bh(&l->rcu, __leaf_free_rcu);
+		call_rcu(&l->rcu, __leaf_free_rcu);
+	}
+        else {
+		struct tnode_free *tf = tnode_free_head(tn);
+
+		tf->tn = tn;
+		call_rcu(&tf->rcu, __tnode_free_rcu);
 	}
-        else
-		call_rcu(&tn->rcu, __tnode_free_rcu);
 }
 
 static struct leaf *leaf_new(void)
 {
-	struct leaf *l = kmalloc(sizeof(struct leaf),  GFP_KERNEL);
+	struct leaf *l = kmem_cache_alloc(trie_leaf_kmem, GFP_KERNEL);
 	if (l) {
 		l->parent = T_LEAF;
 		INIT_HLIST_HEAD(&l->list);
+		l->li_used = 0;
 	}
 	return l;
 }
 
-static struct leaf_info *leaf_info_new(int plen)
+static struct leaf_info *leaf_info_new(struct leaf *l, int plen)
 {
-	struct leaf_info *li = kmalloc(sizeof(struct leaf_info),  GFP_KERNEL);
+	struct leaf_info *li;
+
+	if (!l->li_used) {
+		l->li_used = 1;
+		li = &l->li;
+	} else
+		li = kmalloc(sizeof(struct leaf_info), GFP_KERNEL);
 	if (li) {
 		li->plen = plen;
 		INIT_LIST_HEAD(&li->falh);
@@ -381,8 +427,7 @@ static struct leaf_info *leaf_info_new(int plen)
 
 static struct tnode* tnode_new(t_key key, int pos, int bits)
 {
-	int nchildren = 1<<bits;
-	int sz = sizeof(struct tnode) + nchildren * sizeof(struct node *);
+	int sz = tnode_size(bits);
 	struct tnode *tn = tnode_alloc(sz);
 
 	if (tn) {
@@ -1031,7 +1076,7 @@ fib_insert_node(struct trie *t, int *err, u32 key, int plen)
 	if (n != NULL && IS_LEAF(n) && tkey_equals(key, n->key)) {
 		struct leaf *l = (struct leaf *) n;
 
-		li = leaf_info_new(plen);
+		li = leaf_info_new(l, plen);
 
 		if (!li) {
 			*err = -ENOMEM;
@@ -1051,7 +1096,7 @@ fib_insert_node(struct trie *t, int *err, u32 key, int plen)
 	}
 
 	l->key = key;
-	li = leaf_info_new(plen);
+	li = leaf_info_new(l, plen);
 
 	if (!li) {
 		tnode_free((struct tnode *) l);
@@ -1090,7 +1135,7 @@ fib_insert_node(struct trie *t, int *err, u32 key, int plen)
 		}
 
 		if (!tn) {
-			free_leaf_info(li);
+			free_leaf_info(l, li);
 			tnode_free((struct tnode *) l);
 			*err = -ENOMEM;
 			goto err;
@@ -1623,7 +1668,7 @@ fn_trie_delete(struct fib_table *tb, struct rtmsg *r, struct kern_rta *rta,
 
 	if (list_empty(fa_head)) {
 		hlist_del_rcu(&li->hlist);
-		free_leaf_info(li);
+		free_leaf_info(l, li);
 	}
 
 	if (hlist_empty(&l->list))
@@ -1667,7 +1712,7 @@ static int trie_flush_leaf(struct trie *t, struct leaf *l)
 
 		if (list_empty(&li->falh)) {
 			hlist_del_rcu(&li->hlist);
-			free_leaf_info(li);
+			free_leaf_info(l, li);
 		}
 	}
 	return found;
@@ -1956,6 +2001,11 @@ struct fib_table * __init fib_hash_init(int id)
 						  sizeof(struct fib_alias),
 						  0, SLAB_HWCACHE_ALIGN,
 						  NULL, NULL);
+	if (trie_leaf_kmem == NULL)
+		trie_leaf_kmem = kmem_cache_create("ip_fib_trie",
+						   sizeof(struct leaf),
+						   0, SLAB_HWCACHE_ALIGN,
+						   NULL, NULL);
 
 	tb = kmalloc(sizeof(struct fib_table) + sizeof(struct trie),
 		     GFP_KERNEL);
@@ -2070,6 +2120,19 @@ static void trie_collect_stats(struct trie *t, struct trie_stat *s)
 	for (n = fib_trie_get_first(&iter, t); n;
 	     n = fib_trie_get_next(&iter)) {
 		if (IS_LEAF(n)) {
+			struct leaf *l = (struct leaf *) n;
+			struct leaf_info *li;
+			struct hlist_node *node;
+			struct fib_alias *fa;
+
+			hlist_for_each_entry_rcu(li, node, &l->list, hlist) {
+				s->prefixes++;
+				if (li != &l->li)
+					s->ext_prefixes++;
+				list_for_each_entry_rcu(fa, &li->falh, fa_list)
+					s->aliases++;
+			}
+
 			s->leaves++;
 			s->totdepth += iter.depth;
 			if (iter.depth > s->maxdepth)
@@ -2106,10 +2169,15 @@ static void trie_show_stats(struct seq_file *seq, struct trie_stat *stat)
 	seq_printf(seq, "\tMax depth:      %u\n", stat->maxdepth);
 
 	seq_printf(seq, "\tLeaves:         %u\n", stat->leaves);
+	seq_printf(seq, "\tPrefixes:       %u (%u outside their leaf)\n",
+		   stat->prefixes, stat->ext_prefixes);
+	seq_printf(seq, "\tAliases:        %u\n", stat->aliases);
 
-	bytes = sizeof(struct leaf) * stat->leaves;
+	bytes = L1_CACHE_ALIGN(sizeof(struct leaf)) * stat->leaves;
+	bytes += sizeof(struct leaf_info) * stat->ext_prefixes;
+	bytes += L1_CACHE_ALIGN(sizeof(struct fib_alias)) * stat->aliases;
 	seq_printf(seq, "\tInternal nodes: %d\n\t", stat->tnodes);
-	bytes += sizeof(struct tnode) * stat->tnodes;
+	bytes += (sizeof(struct tnode) + sizeof(struct tnode_free)) * stat->tnodes;
 
 	max = MAX_STAT_DEPTH;
 	while (max > 0 && stat->nodesizes[max-1] == 0)
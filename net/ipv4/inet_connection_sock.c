@@ -36,6 +36,23 @@ EXPORT_SYMBOL(inet_csk_timer_bug_msg);
  */
 int sysctl_local_port_range[2] = { 1024, 4999 };
 
+/*
+ * Sockets of the same user which all set SO_REUSEPORT may share a port,
+ * listening ones included; incoming connections are then spread over
+ * the listeners by inet_lookup_listener().
+ */
+int inet_csk_reuseport_ok(const struct sock *sk2, const int reuseport,
+			  const uid_t uid)
+{
+	if (!reuseport || !sk2->sk_reuseport)
+		return 0;
+	/* A TIME_WAIT sock has no owner left to compare with */
+	return sk2->sk_state == TCP_TIME_WAIT ||
+	       uid == sock_i_uid((struct sock *)sk2);
+}
+
+EXPORT_SYMBOL_GPL(inet_csk_reuseport_ok);
+
 int inet_csk_bind_conflict(const struct sock *sk,
 			   const struct inet_bind_bucket *tb)
 {
@@ -43,6 +60,8 @@ int inet_csk_bind_conflict(const struct sock *sk,
 	struct sock *sk2;
 	struct hlist_node *node;
 	int reuse = sk->sk_reuse;
+	int reuseport = sk->sk_reuseport;
+	uid_t uid = reuseport ? sock_i_uid((struct sock *)sk) : 0;
 
 	sk_for_each_bound(sk2, node, &tb->owners) {
 		if (sk != sk2 &&
@@ -50,8 +69,9 @@ int inet_csk_bind_conflict(const struct sock *sk,
 		    (!sk->sk_bound_dev_if ||
 		     !sk2->sk_bound_dev_if ||
 		     sk->sk_bound_dev_if == sk2->sk_bound_dev_if)) {
-			if (!reuse || !sk2->sk_reuse ||
-			    sk2->sk_state == TCP_LISTEN) {
+			if ((!reuse || !sk2->sk_reuse ||
+			     sk2->sk_state == TCP_LISTEN) &&
+			    !inet_csk_reuseport_ok(sk2, reuseport, uid)) {
 				const u32 sk2_rcv_saddr = inet_rcv_saddr(sk2);
 				if (!sk2_rcv_saddr || !sk_rcv_saddr ||
 				    sk2_rcv_saddr == sk_rcv_saddr)
@@ -353,6 +373,25 @@ static inline u32 inet_synq_hash(const u32 raddr, const u16 rport,
 #define AF_INET_FAMILY(fam) 1
 #endif
 
+/*
+ * The syn_lock of the chain where the requests from raddr/rport are.  It
+ * is held across inet_csk_search_req() and whatever is done with what it
+ * finds, up to inet_csk_reqsk_queue_hash_add() of a new request: SYNs are
+ * handled without the lock of the listening socket.
+ */
+spinlock_t *inet_csk_syn_lock(const struct sock *sk, const __u16 rport,
+			      const __u32 raddr)
+{
+	struct request_sock_queue *queue = &inet_csk(sk)->icsk_accept_queue;
+	struct listen_sock *lopt = queue->listen_opt;
+
+	return reqsk_queue_syn_lock(queue,
+				    inet_synq_hash(raddr, rport, lopt->hash_rnd,
+						   lopt->nr_table_entries));
+}
+
+EXPORT_SYMBOL_GPL(inet_csk_syn_lock);
+
 struct request_sock *inet_csk_search_req(const struct sock *sk,
 					 struct request_sock ***prevp,
 					 const __u16 rport, const __u32 raddr,
@@ -412,9 +451,9 @@ void inet_csk_reqsk_queue_prune(struct sock *parent,
 	int thresh = max_retries;
 	unsigned long now = jiffies;
 	struct request_sock **reqp, *req;
-	int i, budget;
+	int i, budget, qlen;
 
-	if (lopt == NULL || lopt->qlen == 0)
+	if (lopt == NULL || atomic_read(&lopt->qlen) == 0)
 		return;
 
 	/* Normally all the openreqs are young and become mature
@@ -434,11 +473,12 @@ void inet_csk_reqsk_queue_prune(struct sock *parent,
 	 * embrions; and abort old ones without pity, if old
 	 * ones are about to clog our table.
 	 */
-	if (lopt->qlen>>(lopt->max_qlen_log-1)) {
-		int young = (lopt->qlen_young<<1);
+	qlen = atomic_read(&lopt->qlen);
+	if (qlen>>(lopt->max_qlen_log-1)) {
+		int young = (atomic_read(&lopt->qlen_young)<<1);
 
 		while (thresh > 2) {
-			if (lopt->qlen < young)
+			if (qlen < young)
 				break;
 			thresh--;
 			young <<= 1;
@@ -452,6 +492,9 @@ void inet_csk_reqsk_queue_prune(struct sock *parent,
 	i = lopt->clock_hand;
 
 	do {
+		spinlock_t *lock = reqsk_queue_syn_lock(queue, i);
+
+		spin_lock(lock);
 		reqp=&lopt->syn_table[i];
 		while ((req = *reqp) != NULL) {
 			if (time_after_eq(now, req->expires)) {
@@ -461,7 +504,7 @@ void inet_csk_reqsk_queue_prune(struct sock *parent,
 					unsigned long timeo;
 
 					if (req->retrans++ == 0)
-						lopt->qlen_young--;
+						atomic_dec(&lopt->qlen_young);
 					timeo = min((timeout << req->retrans), max_rto);
 					req->expires = now + timeo;
 					reqp = &req->dl_next;
@@ -476,6 +519,7 @@ void inet_csk_reqsk_queue_prune(struct sock *parent,
 			}
 			reqp = &req->dl_next;
 		}
+		spin_unlock(lock);
 
 		i = (i + 1) & (lopt->nr_table_entries - 1);
 
@@ -483,7 +527,7 @@ void inet_csk_reqsk_queue_prune(struct sock *parent,
 
 	lopt->clock_hand = i;
 
-	if (lopt->qlen)
+	if (atomic_read(&lopt->qlen))
 		inet_csk_reset_keepalive_timer(parent, interval);
 }
 
@@ -499,6 +543,7 @@ struct sock *inet_csk_clone(struct sock *sk, const struct request_sock *req,
 
 		newsk->sk_state = TCP_SYN_RECV;
 		newicsk->icsk_bind_hash = NULL;
+		sock_reset_flag(newsk, SOCK_RCU_FREE);
 
 		inet_sk(newsk)->dport = inet_rsk(req)->rmt_port;
 		newsk->sk_write_space = sk_stream_write_space;
@@ -569,6 +614,8 @@ int inet_csk_listen_start(struct sock *sk, const int nr_table_entries)
 		inet->sport = htons(inet->num);
 
 		sk_dst_reset(sk);
+		/* the listening hash is walked without locks, see sk_free() */
+		sock_set_flag(sk, SOCK_RCU_FREE);
 		sk->sk_prot->hash(sk);
 
 		return 0;
@@ -591,6 +638,11 @@ void inet_csk_listen_stop(struct sock *sk)
 	struct request_sock *acc_req;
 	struct request_sock *req;
 
+	/* SYNs are handled without the socket lock, under rcu_read_lock(),
+	 * by whoever found us listening: let them finish with the queues.
+	 */
+	synchronize_rcu();
+
 	inet_csk_delete_keepalive_timer(sk);
 
 	/* make all the listen_opt local to us */
@@ -15,6 +15,7 @@
 
 #include <linux/module.h>
 #include <linux/random.h>
+#include <linux/jhash.h>
 #include <linux/sched.h>
 #include <linux/slab.h>
 #include <linux/wait.h>
@@ -23,6 +24,18 @@
 #include <net/inet_hashtables.h>
 #include <net/ip.h>
 
+void inet_hashinfo_init(struct inet_hashinfo *hashinfo)
+{
+	int i;
+
+	for (i = 0; i < INET_LHTABLE_SIZE; i++) {
+		spin_lock_init(&hashinfo->listening_hash[i].lock);
+		INIT_HLIST_HEAD(&hashinfo->listening_hash[i].head);
+	}
+}
+
+EXPORT_SYMBOL_GPL(inet_hashinfo_init);
+
 /*
  * Allocate and initialize a new local port bind bucket.
  * The bindhash mutex for snum's hash chain must be held here.
@@ -88,50 +101,29 @@ void inet_put_port(struct inet_hashinfo *hashinfo, struct sock *sk)
 
 EXPORT_SYMBOL(inet_put_port);
 
-/*
- * This lock without WQ_FLAG_EXCLUSIVE is good on UP and it can be very bad on SMP.
- * Look, when several writers sleep and reader wakes them up, all but one
- * immediately hit write lock and grab all the cpus. Exclusive sleep solves
- * this, _but_ remember, it adds useless work on UP machines (wake up each
- * exclusive lock release). It should be ifdefed really.
- */
-void inet_listen_wlock(struct inet_hashinfo *hashinfo)
-{
-	write_lock(&hashinfo->lhash_lock);
-
-	if (atomic_read(&hashinfo->lhash_users)) {
-		DEFINE_WAIT(wait);
-
-		for (;;) {
-			prepare_to_wait_exclusive(&hashinfo->lhash_wait,
-						  &wait, TASK_UNINTERRUPTIBLE);
-			if (!atomic_read(&hashinfo->lhash_users))
-				break;
-			write_unlock_bh(&hashinfo->lhash_lock);
-			schedule();
-			write_lock_bh(&hashinfo->lhash_lock);
-		}
-
-		finish_wait(&hashinfo->lhash_wait, &wait);
-	}
-}
-
-EXPORT_SYMBOL(inet_listen_wlock);
-
 /*
  * Don't inline this cruft. Here are some nice properties to exploit here. The
  * BSD API does not allow a listening sock to specify the remote port nor the
  * remote address for the connection. So always assume those are both
  * wildcarded during the search since they can never be otherwise.
+ *
+ * Of several SO_REUSEPORT listeners matching equally well, the one for a
+ * connection is picked by a hash of its addresses and ports, so that they
+ * all get their share and every packet of a handshake finds the same one.
+ * Must be called under rcu_read_lock().
  */
-struct sock *__inet_lookup_listener(const struct hlist_head *head, const u32 daddr,
-				    const unsigned short hnum, const int dif)
+struct sock *__inet_lookup_listener(const struct hlist_head *head,
+				    const u32 saddr, const u16 sport,
+				    const u32 daddr, const unsigned short hnum,
+				    const int dif)
 {
 	struct sock *result = NULL, *sk;
 	const struct hlist_node *node;
 	int hiscore = -1;
+	int matches = 0;
+	u32 phash = 0;
 
-	sk_for_each(sk, node, head) {
+	sk_for_each_rcu(sk, node, head) {
 		const struct inet_sock *inet = inet_sk(sk);
 
 		if (inet->num == hnum && !ipv6_only_sock(sk)) {
@@ -148,12 +140,24 @@ struct sock *__inet_lookup_listener(const struct hlist_head *head, const u32 dad
 					continue;
 				score += 2;
 			}
-			if (score == 5)
-				return sk;
 			if (score > hiscore) {
 				hiscore	= score;
 				result	= sk;
+				matches = 0;
+				if (sk->sk_reuseport) {
+					phash = jhash_3words(saddr, daddr,
+						((u32)sport << 16) | hnum, 0);
+					matches = 1;
+				}
+			} else if (score == hiscore && matches &&
+				   sk->sk_reuseport) {
+				matches++;
+				if ((((u64)phash * matches) >> 32) == 0)
+					result = sk;
+				phash = phash * 1664525 + 1013904223;
 			}
+			if (hiscore == 5 && !matches)
+				break;
 		}
 	}
 	return result;
@@ -34,6 +34,9 @@
 #include <linux/netdevice.h>
 #include <linux/jhash.h>
 #include <linux/random.h>
+#include <linux/init.h>
+#include <linux/bootmem.h>
+#include <linux/percpu.h>
 #include <net/sock.h>
 #include <net/ip.h>
 #include <net/icmp.h>
@@ -96,78 +99,136 @@ struct ipq {
 	int             iif;
 	unsigned int    rid;
 	struct inet_peer *peer;
+	unsigned int	hash;		/* ipq_hash bucket			*/
+	int		lru_cpu;	/* ipq_lru list				*/
 };
 
-/* Hash table. */
+/* Hash table.
+ *
+ * Sized from memory at boot, or with ipfrag_hash_entries=, every bucket
+ * with its own lock.  A queue remembers its bucket, which changes only
+ * when the secret is rebuilt, under the locks of both buckets.
+ */
 
-#define IPQ_HASHSZ	64
+struct ipq_bucket {
+	struct hlist_head	chain;
+	spinlock_t		lock;
+};
 
-/* Per-bucket lock is easy to add now. */
-static struct hlist_head ipq_hash[IPQ_HASHSZ];
-static DEFINE_RWLOCK(ipfrag_lock);
+static struct ipq_bucket *ipq_hash __read_mostly;
+static unsigned int ipq_hash_mask __read_mostly;
 static u32 ipfrag_hash_rnd;
-static LIST_HEAD(ipq_lru_list);
-int ip_frag_nqueues = 0;
+atomic_t ip_frag_nqueues = ATOMIC_INIT(0);
+
+/* Queues are evicted oldest first from a list per cpu, the one they were
+ * created on, the evicting cpu's own list first.
+ */
+struct ipq_lru {
+	spinlock_t		lock;
+	struct list_head	list;
+};
 
-static __inline__ void __ipq_unlink(struct ipq *qp)
+static DEFINE_PER_CPU(struct ipq_lru, ipq_lru);
+
+static inline struct ipq_bucket *ipq_lock_bucket(struct ipq *qp)
 {
-	hlist_del(&qp->list);
-	list_del(&qp->lru_list);
-	ip_frag_nqueues--;
+	struct ipq_bucket *b;
+
+	for (;;) {
+		b = &ipq_hash[qp->hash];
+		spin_lock(&b->lock);
+		if (likely(b == &ipq_hash[qp->hash]))
+			return b;
+		spin_unlock(&b->lock);
+	}
 }
 
 static __inline__ void ipq_unlink(struct ipq *ipq)
 {
-	write_lock(&ipfrag_lock);
-	__ipq_unlink(ipq);
-	write_unlock(&ipfrag_lock);
+	struct ipq_bucket *b = ipq_lock_bucket(ipq);
+	struct ipq_lru *lru = &per_cpu(ipq_lru, ipq->lru_cpu);
+
+	hlist_del(&ipq->list);
+	spin_unlock(&b->lock);
+
+	spin_lock(&lru->lock);
+	list_del(&ipq->lru_list);
+	spin_unlock(&lru->lock);
+
+	atomic_dec(&ip_frag_nqueues);
 }
 
 static unsigned int ipqhashfn(u16 id, u32 saddr, u32 daddr, u8 prot)
 {
 	return jhash_3words((u32)id << 16 | prot, saddr, daddr,
-			    ipfrag_hash_rnd) & (IPQ_HASHSZ - 1);
+			    ipfrag_hash_rnd) & ipq_hash_mask;
 }
 
 static struct timer_list ipfrag_secret_timer;
 int sysctl_ipfrag_secret_interval = 10 * 60 * HZ;
 
+/* A lookup racing with the rebuild may miss its queue and start another
+ * one, the older one then times out.
+ */
 static void ipfrag_secret_rebuild(unsigned long dummy)
 {
 	unsigned long now = jiffies;
-	int i;
+	unsigned int i;
 
-	write_lock(&ipfrag_lock);
 	get_random_bytes(&ipfrag_hash_rnd, sizeof(u32));
-	for (i = 0; i < IPQ_HASHSZ; i++) {
+	for (i = 0; i <= ipq_hash_mask; i++) {
+		struct ipq_bucket *b = &ipq_hash[i];
 		struct ipq *q;
 		struct hlist_node *p, *n;
 
-		hlist_for_each_entry_safe(q, p, n, &ipq_hash[i], list) {
+		spin_lock(&b->lock);
+		hlist_for_each_entry_safe(q, p, n, &b->chain, list) {
 			unsigned int hval = ipqhashfn(q->id, q->saddr,
 						      q->daddr, q->protocol);
 
 			if (hval != i) {
+				struct ipq_bucket *b2 = &ipq_hash[hval];
+
 				hlist_del(&q->list);
 
 				/* Relink to new hash chain. */
-				hlist_add_head(&q->list, &ipq_hash[hval]);
+				spin_lock_nested(&b2->lock, SINGLE_DEPTH_NESTING);
+				hlist_add_head(&q->list, &b2->chain);
+				q->hash = hval;
+				spin_unlock(&b2->lock);
 			}
 		}
+		spin_unlock(&b->lock);
 	}
-	write_unlock(&ipfrag_lock);
 
 	mod_timer(&ipfrag_secret_timer, now + sysctl_ipfrag_secret_interval);
 }
 
-atomic_t ip_frag_mem = ATOMIC_INIT(0);	/* Memory used for fragments */
+/* Memory used for fragments.  Each cpu keeps a delta of up to
+ * ipfrag_mem_batch bytes to itself, so the total is off by at most
+ * that much per cpu.  Everything runs in softirq context.
+ */
+atomic_t ip_frag_mem = ATOMIC_INIT(0);
+static DEFINE_PER_CPU(int, ip_frag_mem_delta);
+static int ipfrag_mem_batch __read_mostly = PAGE_SIZE;
+
+static __inline__ void ip_frag_mem_add(int amount)
+{
+	int *delta = &__get_cpu_var(ip_frag_mem_delta);
+
+	*delta += amount;
+	if (*delta >= ipfrag_mem_batch || *delta <= -ipfrag_mem_batch) {
+		atomic_add(*delta, &ip_frag_mem);
+		*delta = 0;
+	}
+}
 
 /* Memory Tracking Functions. */
 static __inline__ void frag_kfree_skb(struct sk_buff *skb, int *work)
 {
 	if (work)
 		*work -= skb->truesize;
-	atomic_sub(skb->truesize, &ip_frag_mem);
+	ip_frag_mem_add(-skb->truesize);
 	kfree_skb(skb);
 }
 
@@ -175,7 +236,7 @@ static __inline__ void frag_free_queue(struct ipq *qp, int *work)
 {
 	if (work)
 		*work -= sizeof(struct ipq);
-	atomic_sub(sizeof(struct ipq), &ip_frag_mem);
+	ip_frag_mem_add(-(int)sizeof(struct ipq));
 	kfree(qp);
 }
 
@@ -185,7 +246,7 @@ static __inline__ struct ipq *frag_alloc_queue(void)
 
 	if(!qp)
 		return NULL;
-	atomic_add(sizeof(struct ipq), &ip_frag_mem);
+	ip_frag_mem_add(sizeof(struct ipq));
 	return qp;
 }
 
@@ -243,23 +304,31 @@ static void ipq_kill(struct ipq *ipq)
 static void ip_evictor(void)
 {
 	struct ipq *qp;
-	struct list_head *tmp;
-	int work;
+	struct ipq_lru *lru;
+	int work, cpu, tries;
 
 	work = atomic_read(&ip_frag_mem) - sysctl_ipfrag_low_thresh;
 	if (work <= 0)
 		return;
 
+	cpu = smp_processor_id();
+	tries = 0;
 	while (work > 0) {
-		read_lock(&ipfrag_lock);
-		if (list_empty(&ipq_lru_list)) {
-			read_unlock(&ipfrag_lock);
-			return;
+		lru = &per_cpu(ipq_lru, cpu);
+		spin_lock(&lru->lock);
+		if (list_empty(&lru->list)) {
+			spin_unlock(&lru->lock);
+			/* on to the next cpu's list */
+			if (++tries >= num_possible_cpus())
+				return;
+			cpu = next_cpu(cpu, cpu_possible_map);
+			if (cpu >= NR_CPUS)
+				cpu = first_cpu(cpu_possible_map);
+			continue;
 		}
-		tmp = ipq_lru_list.next;
-		qp = list_entry(tmp, struct ipq, lru_list);
+		qp = list_entry(lru->list.next, struct ipq, lru_list);
 		atomic_inc(&qp->refcnt);
-		read_unlock(&ipfrag_lock);
+		spin_unlock(&lru->lock);
 
 		spin_lock(&qp->lock);
 		if (!(qp->last_in&COMPLETE))
@@ -306,27 +375,30 @@ out:
 static struct ipq *ip_frag_intern(struct ipq *qp_in)
 {
 	struct ipq *qp;
+	struct ipq_bucket *b;
+	struct ipq_lru *lru;
 #ifdef CONFIG_SMP
 	struct hlist_node *n;
 #endif
 	unsigned int hash;
 
-	write_lock(&ipfrag_lock);
 	hash = ipqhashfn(qp_in->id, qp_in->saddr, qp_in->daddr,
 			 qp_in->protocol);
+	b = &ipq_hash[hash];
+	spin_lock(&b->lock);
 #ifdef CONFIG_SMP
 	/* With SMP race we have to recheck hash table, because
 	 * such entry could be created on other cpu, while we
-	 * promoted read lock to write lock.
+	 * did not hold the bucket lock.
 	 */
-	hlist_for_each_entry(qp, n, &ipq_hash[hash], list) {
+	hlist_for_each_entry(qp, n, &b->chain, list) {
 		if(qp->id == qp_in->id		&&
 		   qp->saddr == qp_in->saddr	&&
 		   qp->daddr == qp_in->daddr	&&
 		   qp->protocol == qp_in->protocol &&
 		   qp->user == qp_in->user) {
 			atomic_inc(&qp->refcnt);
-			write_unlock(&ipfrag_lock);
+			spin_unlock(&b->lock);
 			qp_in->last_in |= COMPLETE;
 			ipq_put(qp_in, NULL);
 			return qp;
@@ -339,11 +411,15 @@ static struct ipq *ip_frag_intern(struct ipq *qp_in)
 		atomic_inc(&qp->refcnt);
 
 	atomic_inc(&qp->refcnt);
-	hlist_add_head(&qp->list, &ipq_hash[hash]);
-	INIT_LIST_HEAD(&qp->lru_list);
-	list_add_tail(&qp->lru_list, &ipq_lru_list);
-	ip_frag_nqueues++;
-	write_unlock(&ipfrag_lock);
+	qp->hash = hash;
+	qp->lru_cpu = smp_processor_id();
+	lru = &per_cpu(ipq_lru, qp->lru_cpu);
+	spin_lock(&lru->lock);
+	list_add_tail(&qp->lru_list, &lru->list);
+	spin_unlock(&lru->lock);
+	hlist_add_head(&qp->list, &b->chain);
+	atomic_inc(&ip_frag_nqueues);
+	spin_unlock(&b->lock);
 	return qp;
 }
 
@@ -391,23 +467,25 @@ static inline struct ipq *ip_find(struct iphdr *iph, u32 user)
 	__u32 daddr = iph->daddr;
 	__u8 protocol = iph->protocol;
 	unsigned int hash;
+	struct ipq_bucket *b;
 	struct ipq *qp;
 	struct hlist_node *n;
 
-	read_lock(&ipfrag_lock);
 	hash = ipqhashfn(id, saddr, daddr, protocol);
-	hlist_for_each_entry(qp, n, &ipq_hash[hash], list) {
+	b = &ipq_hash[hash];
+	spin_lock(&b->lock);
+	hlist_for_each_entry(qp, n, &b->chain, list) {
 		if(qp->id == id		&&
 		   qp->saddr == saddr	&&
 		   qp->daddr == daddr	&&
 		   qp->protocol == protocol &&
 		   qp->user == user) {
 			atomic_inc(&qp->refcnt);
-			read_unlock(&ipfrag_lock);
+			spin_unlock(&b->lock);
 			return qp;
 		}
 	}
-	read_unlock(&ipfrag_lock);
+	spin_unlock(&b->lock);
 
 	return ip_frag_create(iph, user);
 }
@@ -465,6 +543,7 @@ static int ip_frag_reinit(struct ipq *qp)
 /* Add new segment to existing queue. */
 static void ip_frag_queue(struct ipq *qp, struct sk_buff *skb)
 {
+	struct ipq_lru *lru;
 	struct sk_buff *prev, *next;
 	int flags, offset;
 	int ihl, end;
@@ -593,13 +672,14 @@ static void ip_frag_queue(struct ipq *qp, struct sk_buff *skb)
 	skb->dev = NULL;
 	skb_get_timestamp(skb, &qp->stamp);
 	qp->meat += skb->len;
-	atomic_add(skb->truesize, &ip_frag_mem);
+	ip_frag_mem_add(skb->truesize);
 	if (offset == 0)
 		qp->last_in |= FIRST_IN;
 
-	write_lock(&ipfrag_lock);
-	list_move_tail(&qp->lru_list, &ipq_lru_list);
-	write_unlock(&ipfrag_lock);
+	lru = &per_cpu(ipq_lru, qp->lru_cpu);
+	spin_lock(&lru->lock);
+	list_move_tail(&qp->lru_list, &lru->list);
+	spin_unlock(&lru->lock);
 
 	return;
 
@@ -608,12 +688,47 @@ err:
 }
 
 
+/* Moves the data of fp into the page frags of to, when it is all in
+ * pages: the linear part of a build_skb() skb is a page fragment too.
+ * The datagram then comes out as a single skb, not a long frag_list
+ * that has to be walked, or linearized, all the way up the stack.
+ */
+static int ip_frag_coalesce(struct sk_buff *to, struct sk_buff *fp)
+{
+	struct skb_shared_info *to_sh = skb_shinfo(to);
+	struct skb_shared_info *fp_sh = skb_shinfo(fp);
+	int hlen = skb_headlen(fp);
+	int i;
+
+	if (skb_cloned(to) || skb_cloned(fp) ||
+	    to_sh->frag_list || fp_sh->frag_list)
+		return 0;
+	if (hlen && !fp->head_frag)
+		return 0;
+	if (to_sh->nr_frags + (hlen ? 1 : 0) + fp_sh->nr_frags > MAX_SKB_FRAGS)
+		return 0;
+
+	if (hlen) {
+		struct page *page = virt_to_page(fp->data);
+
+		/* fp's own reference goes when it is freed */
+		get_page(page);
+		skb_fill_page_desc(to, to_sh->nr_frags, page,
+				   fp->data - (unsigned char *)page_address(page),
+				   hlen);
+	}
+	for (i = 0; i < fp_sh->nr_frags; i++)
+		to_sh->frags[to_sh->nr_frags++] = fp_sh->frags[i];
+	fp_sh->nr_frags = 0;
+	return 1;
+}
+
 /* Build a new IP datagram from all its fragments. */
 
 static struct sk_buff *ip_frag_reasm(struct ipq *qp, struct net_device *dev)
 {
 	struct iphdr *iph;
-	struct sk_buff *fp, *head = qp->fragments;
+	struct sk_buff *fp, *next, *to, *last, *head = qp->fragments;
 	int len;
 	int ihlen;
 
@@ -653,14 +768,22 @@ static struct sk_buff *ip_frag_reasm(struct ipq *qp, struct net_device *dev)
 		head->len -= clone->len;
 		clone->csum = 0;
 		clone->ip_summed = head->ip_summed;
-		atomic_add(clone->truesize, &ip_frag_mem);
+		ip_frag_mem_add(clone->truesize);
 	}
 
-	skb_shinfo(head)->frag_list = head->next;
 	skb_push(head, head->data - head->nh.raw);
-	atomic_sub(head->truesize, &ip_frag_mem);
+	ip_frag_mem_add(-head->truesize);
+
+	/* Fragments go into the page frags of the head, or of the last
+	 * skb on its frag_list, while they fit; onto the frag_list when
+	 * they do not.
+	 */
+	to = head;
+	last = NULL;
+	for (fp = head->next; fp; fp = next) {
+		next = fp->next;
+		fp->next = NULL;
 
-	for (fp=head->next; fp; fp = fp->next) {
 		head->data_len += fp->len;
 		head->len += fp->len;
 		if (head->ip_summed != fp->ip_summed)
@@ -668,7 +791,21 @@ static struct sk_buff *ip_frag_reasm(struct ipq *qp, struct net_device *dev)
 		else if (head->ip_summed == CHECKSUM_HW)
 			head->csum = csum_add(head->csum, fp->csum);
 		head->truesize += fp->truesize;
-		atomic_sub(fp->truesize, &ip_frag_mem);
+		ip_frag_mem_add(-fp->truesize);
+
+		if (ip_frag_coalesce(to, fp)) {
+			if (to != head) {
+				to->data_len += fp->len;
+				to->len += fp->len;
+			}
+			kfree_skb(fp);
+			continue;
+		}
+		if (last)
+			last->next = fp;
+		else
+			skb_shinfo(head)->frag_list = fp;
+		last = to = fp;
 	}
 
 	head->next = NULL;
@@ -733,8 +870,43 @@ struct sk_buff *ip_defrag(struct sk_buff *skb, u32 user)
 	return NULL;
 }
 
-void ipfrag_init(void)
+static __initdata unsigned long ipfrag_hash_entries;
+static int __init set_ipfrag_hash_entries(char *str)
+{
+	if (!str)
+		return 0;
+	ipfrag_hash_entries = simple_strtoul(str, &str, 0);
+	return 1;
+}
+__setup("ipfrag_hash_entries=", set_ipfrag_hash_entries);
+
+void __init ipfrag_init(void)
 {
+	unsigned int i;
+	int cpu;
+
+	ipq_hash = alloc_large_system_hash("IP fragment",
+					   sizeof(struct ipq_bucket),
+					   ipfrag_hash_entries,
+					   17,
+					   0,
+					   NULL,
+					   &ipq_hash_mask,
+					   4096);
+	for (i = 0; i <= ipq_hash_mask; i++) {
+		INIT_HLIST_HEAD(&ipq_hash[i].chain);
+		spin_lock_init(&ipq_hash[i].lock);
+	}
+
+	for_each_possible_cpu(cpu) {
+		spin_lock_init(&per_cpu(ipq_lru, cpu).lock);
+		INIT_LIST_HEAD(&per_cpu(ipq_lru, cpu).list);
+	}
+
+	/* no more than an eighth of the limit held back on all cpus */
+	ipfrag_mem_batch = max_t(int, sysctl_ipfrag_high_thresh /
+				      (8 * num_possible_cpus()), 1024);
+
 	ipfrag_hash_rnd = (u32) ((num_physpages ^ (num_physpages>>7)) ^
 				 (jiffies ^ (jiffies >> 6)));
 
@@ -30,6 +30,9 @@
 #include <linux/kernel.h>
 #include <linux/module.h>
 #include <linux/vmalloc.h>
+#include <linux/mutex.h>
+#include <linux/rcupdate.h>
+#include <linux/seqlock.h>
 #include <linux/proc_fs.h>		/* for proc_net_* */
 #include <linux/seq_file.h>
 #include <linux/jhash.h>
@@ -40,8 +43,30 @@
 
 /*
  *  Connection hash table: for input and output packets lookups of IPVS
+ *
+ *  Lookups walk it under RCU without locks.  Its size is set by the
+ *  conn_tab_bits module parameter and may be changed at run time through
+ *  /proc/sys/net/ipv4/vs/conn_tab_bits, see ip_vs_conn_resize().
  */
-static struct list_head *ip_vs_conn_tab;
+struct ip_vs_conn_tab {
+	unsigned int		size;
+	unsigned int		mask;
+	struct hlist_head	buckets[0];
+};
+
+static struct ip_vs_conn_tab *ip_vs_conn_tab;
+
+/* the table being emptied while a resize is in progress, else NULL */
+static struct ip_vs_conn_tab *ip_vs_conn_tab_old;
+
+/* odd while a resize is moving entries, lookups that miss then retry */
+static seqcount_t ip_vs_conn_tab_seq = SEQCNT_ZERO;
+
+static DEFINE_MUTEX(ip_vs_conn_resize_mutex);
+
+int ip_vs_conn_tab_bits = IP_VS_CONN_TAB_BITS;
+module_param_named(conn_tab_bits, ip_vs_conn_tab_bits, int, 0444);
+MODULE_PARM_DESC(conn_tab_bits, "Set connections' hash size");
 
 /*  SLAB cache for IPVS connections */
 static kmem_cache_t *ip_vs_conn_cachep __read_mostly;
@@ -56,69 +81,52 @@ static atomic_t ip_vs_conn_no_cport_cnt = ATOMIC_INIT(0);
 static unsigned int ip_vs_conn_rnd;
 
 /*
- *  Fine locking granularity for big connection hash table
+ *  Fine locking granularity for big connection hash table: the lock
+ *  of a bucket is picked by the low bits of its hash key, so that it
+ *  stays the same whatever the size of the table, which is never
+ *  smaller than the lock array.
  */
-#define CT_LOCKARRAY_BITS  4
+#define CT_LOCKARRAY_BITS  IP_VS_CONN_TAB_BITS_MIN
 #define CT_LOCKARRAY_SIZE  (1<<CT_LOCKARRAY_BITS)
 #define CT_LOCKARRAY_MASK  (CT_LOCKARRAY_SIZE-1)
 
 struct ip_vs_aligned_lock
 {
-	rwlock_t	l;
+	spinlock_t	l;
 } __attribute__((__aligned__(SMP_CACHE_BYTES)));
 
 /* lock array for conn table */
 static struct ip_vs_aligned_lock
 __ip_vs_conntbl_lock_array[CT_LOCKARRAY_SIZE] __cacheline_aligned;
 
-static inline void ct_read_lock(unsigned key)
-{
-	read_lock(&__ip_vs_conntbl_lock_array[key&CT_LOCKARRAY_MASK].l);
-}
-
-static inline void ct_read_unlock(unsigned key)
+static inline void ct_lock(unsigned key)
 {
-	read_unlock(&__ip_vs_conntbl_lock_array[key&CT_LOCKARRAY_MASK].l);
+	spin_lock(&__ip_vs_conntbl_lock_array[key&CT_LOCKARRAY_MASK].l);
 }
 
-static inline void ct_write_lock(unsigned key)
+static inline void ct_unlock(unsigned key)
 {
-	write_lock(&__ip_vs_conntbl_lock_array[key&CT_LOCKARRAY_MASK].l);
+	spin_unlock(&__ip_vs_conntbl_lock_array[key&CT_LOCKARRAY_MASK].l);
 }
 
-static inline void ct_write_unlock(unsigned key)
+static inline void ct_lock_bh(unsigned key)
 {
-	write_unlock(&__ip_vs_conntbl_lock_array[key&CT_LOCKARRAY_MASK].l);
+	spin_lock_bh(&__ip_vs_conntbl_lock_array[key&CT_LOCKARRAY_MASK].l);
 }
 
-static inline void ct_read_lock_bh(unsigned key)
+static inline void ct_unlock_bh(unsigned key)
 {
-	read_lock_bh(&__ip_vs_conntbl_lock_array[key&CT_LOCKARRAY_MASK].l);
-}
-
-static inline void ct_read_unlock_bh(unsigned key)
-{
-	read_unlock_bh(&__ip_vs_conntbl_lock_array[key&CT_LOCKARRAY_MASK].l);
-}
-
-static inline void ct_write_lock_bh(unsigned key)
-{
-	write_lock_bh(&__ip_vs_conntbl_lock_array[key&CT_LOCKARRAY_MASK].l);
-}
-
-static inline void ct_write_unlock_bh(unsigned key)
-{
-	write_unlock_bh(&__ip_vs_conntbl_lock_array[key&CT_LOCKARRAY_MASK].l);
+	spin_unlock_bh(&__ip_vs_conntbl_lock_array[key&CT_LOCKARRAY_MASK].l);
 }
 
 
 /*
- *	Returns hash value for IPVS connection entry
+ *	Returns hash key for IPVS connection entry, the bucket is picked
+ *	by masking it with the table's mask
  */
 static unsigned int ip_vs_conn_hashkey(unsigned proto, __u32 addr, __u16 port)
 {
-	return jhash_3words(addr, port, proto, ip_vs_conn_rnd)
-		& IP_VS_CONN_TAB_MASK;
+	return jhash_3words(addr, port, proto, ip_vs_conn_rnd);
 }
 
 
@@ -128,16 +136,19 @@ static unsigned int ip_vs_conn_hashkey(unsigned proto, __u32 addr, __u16 port)
  */
 static inline int ip_vs_conn_hash(struct ip_vs_conn *cp)
 {
+	struct ip_vs_conn_tab *tab;
 	unsigned hash;
 	int ret;
 
 	/* Hash by protocol, client address and port */
 	hash = ip_vs_conn_hashkey(cp->protocol, cp->caddr, cp->cport);
 
-	ct_write_lock(hash);
+	ct_lock(hash);
 
 	if (!(cp->flags & IP_VS_CONN_F_HASHED)) {
-		list_add(&cp->c_list, &ip_vs_conn_tab[hash]);
+		/* a resize moves the bucket under this same lock */
+		tab = ip_vs_conn_tab;
+		hlist_add_head_rcu(&cp->c_list, &tab->buckets[hash & tab->mask]);
 		cp->flags |= IP_VS_CONN_F_HASHED;
 		atomic_inc(&cp->refcnt);
 		ret = 1;
@@ -147,7 +158,7 @@ static inline int ip_vs_conn_hash(struct ip_vs_conn *cp)
 		ret = 0;
 	}
 
-	ct_write_unlock(hash);
+	ct_unlock(hash);
 
 	return ret;
 }
@@ -165,22 +176,131 @@ static inline int ip_vs_conn_unhash(struct ip_vs_conn *cp)
 	/* unhash it and decrease its reference counter */
 	hash = ip_vs_conn_hashkey(cp->protocol, cp->caddr, cp->cport);
 
-	ct_write_lock(hash);
+	ct_lock(hash);
 
 	if (cp->flags & IP_VS_CONN_F_HASHED) {
-		list_del(&cp->c_list);
+		hlist_del_rcu(&cp->c_list);
 		cp->flags &= ~IP_VS_CONN_F_HASHED;
 		atomic_dec(&cp->refcnt);
 		ret = 1;
 	} else
 		ret = 0;
 
-	ct_write_unlock(hash);
+	ct_unlock(hash);
 
 	return ret;
 }
 
 
+/*
+ *	How the lookups below compare an entry with the packet's
+ *	s_addr, s_port -> d_addr, d_port
+ */
+enum {
+	IP_VS_CONN_MATCH_IN,		/* from the client */
+	IP_VS_CONN_MATCH_TEMPLATE,	/* from the client, templates only */
+	IP_VS_CONN_MATCH_OUT,		/* from the real server */
+};
+
+static inline int
+ip_vs_conn_match(const struct ip_vs_conn *cp, int match, int protocol,
+		 __u32 s_addr, __u16 s_port, __u32 d_addr, __u16 d_port)
+{
+	switch (match) {
+	case IP_VS_CONN_MATCH_IN:
+		return s_addr==cp->caddr && s_port==cp->cport &&
+		       d_port==cp->vport && d_addr==cp->vaddr &&
+		       ((!s_port) ^ (!(cp->flags & IP_VS_CONN_F_NO_CPORT))) &&
+		       protocol==cp->protocol;
+	case IP_VS_CONN_MATCH_TEMPLATE:
+		return s_addr==cp->caddr && s_port==cp->cport &&
+		       d_port==cp->vport && d_addr==cp->vaddr &&
+		       cp->flags & IP_VS_CONN_F_TEMPLATE &&
+		       protocol==cp->protocol;
+	default:
+		return d_addr == cp->caddr && d_port == cp->cport &&
+		       s_port == cp->dport && s_addr == cp->daddr &&
+		       protocol == cp->protocol;
+	}
+}
+
+/*
+ *	Slow path of ip_vs_conn_find(): with the bucket's lock held no
+ *	resize can move its entries, they are all in the new table or
+ *	all still in the old one.
+ */
+static struct ip_vs_conn *
+ip_vs_conn_find_locked(unsigned hash, int match, int protocol,
+		       __u32 s_addr, __u16 s_port, __u32 d_addr, __u16 d_port)
+{
+	struct ip_vs_conn_tab *tab, *old;
+	struct ip_vs_conn *cp;
+	struct hlist_node *n;
+
+	ct_lock(hash);
+
+	tab = ip_vs_conn_tab;
+	smp_rmb();
+	old = ip_vs_conn_tab_old;
+
+	hlist_for_each_entry(cp, n, &tab->buckets[hash & tab->mask], c_list)
+		if (ip_vs_conn_match(cp, match, protocol,
+				     s_addr, s_port, d_addr, d_port) &&
+		    atomic_inc_not_zero(&cp->refcnt))
+			goto out;
+
+	if (old) {
+		hlist_for_each_entry(cp, n, &old->buckets[hash & old->mask],
+				     c_list)
+			if (ip_vs_conn_match(cp, match, protocol,
+					     s_addr, s_port, d_addr, d_port) &&
+			    atomic_inc_not_zero(&cp->refcnt))
+				goto out;
+	}
+	cp = NULL;
+
+  out:
+	ct_unlock(hash);
+	return cp;
+}
+
+/*
+ *	Look an entry up and take a reference to it.  Entries are freed
+ *	after an RCU grace period, the one whose last reference is being
+ *	dropped has a zero refcnt and is skipped.
+ */
+static inline struct ip_vs_conn *
+ip_vs_conn_find(unsigned hash, int match, int protocol,
+		__u32 s_addr, __u16 s_port, __u32 d_addr, __u16 d_port)
+{
+	struct ip_vs_conn_tab *tab;
+	struct ip_vs_conn *cp;
+	struct hlist_node *n;
+	unsigned seq;
+
+	rcu_read_lock();
+
+	seq = read_seqcount_begin(&ip_vs_conn_tab_seq);
+	tab = rcu_dereference(ip_vs_conn_tab);
+
+	hlist_for_each_entry_rcu(cp, n, &tab->buckets[hash & tab->mask], c_list)
+		if (ip_vs_conn_match(cp, match, protocol,
+				     s_addr, s_port, d_addr, d_port) &&
+		    atomic_inc_not_zero(&cp->refcnt))
+			goto out;
+	cp = NULL;
+
+	/* a resize may have moved the entry away from under us */
+	if (read_seqcount_retry(&ip_vs_conn_tab_seq, seq))
+		cp = ip_vs_conn_find_locked(hash, match, protocol,
+					    s_addr, s_port, d_addr, d_port);
+
+  out:
+	rcu_read_unlock();
+	return cp;
+}
+
+
 /*
  *  Gets ip_vs_conn associated with supplied parameters in the ip_vs_conn_tab.
  *  Called for pkts coming from OUTside-to-INside.
@@ -191,27 +311,11 @@ static inline struct ip_vs_conn *__ip_vs_conn_in_get
 (int protocol, __u32 s_addr, __u16 s_port, __u32 d_addr, __u16 d_port)
 {
 	unsigned hash;
-	struct ip_vs_conn *cp;
 
 	hash = ip_vs_conn_hashkey(protocol, s_addr, s_port);
 
-	ct_read_lock(hash);
-
-	list_for_each_entry(cp, &ip_vs_conn_tab[hash], c_list) {
-		if (s_addr==cp->caddr && s_port==cp->cport &&
-		    d_port==cp->vport && d_addr==cp->vaddr &&
-		    ((!s_port) ^ (!(cp->flags & IP_VS_CONN_F_NO_CPORT))) &&
-		    protocol==cp->protocol) {
-			/* HIT */
-			atomic_inc(&cp->refcnt);
-			ct_read_unlock(hash);
-			return cp;
-		}
-	}
-
-	ct_read_unlock(hash);
-
-	return NULL;
+	return ip_vs_conn_find(hash, IP_VS_CONN_MATCH_IN, protocol,
+			       s_addr, s_port, d_addr, d_port);
 }
 
 struct ip_vs_conn *ip_vs_conn_in_get
@@ -241,22 +345,8 @@ struct ip_vs_conn *ip_vs_ct_in_get
 
 	hash = ip_vs_conn_hashkey(protocol, s_addr, s_port);
 
-	ct_read_lock(hash);
-
-	list_for_each_entry(cp, &ip_vs_conn_tab[hash], c_list) {
-		if (s_addr==cp->caddr && s_port==cp->cport &&
-		    d_port==cp->vport && d_addr==cp->vaddr &&
-		    cp->flags & IP_VS_CONN_F_TEMPLATE &&
-		    protocol==cp->protocol) {
-			/* HIT */
-			atomic_inc(&cp->refcnt);
-			goto out;
-		}
-	}
-	cp = NULL;
-
-  out:
-	ct_read_unlock(hash);
+	cp = ip_vs_conn_find(hash, IP_VS_CONN_MATCH_TEMPLATE, protocol,
+			     s_addr, s_port, d_addr, d_port);
 
 	IP_VS_DBG(9, "template lookup/in %s %u.%u.%u.%u:%d->%u.%u.%u.%u:%d %s\n",
 		  ip_vs_proto_name(protocol),
@@ -277,27 +367,15 @@ struct ip_vs_conn *ip_vs_conn_out_get
 (int protocol, __u32 s_addr, __u16 s_port, __u32 d_addr, __u16 d_port)
 {
 	unsigned hash;
-	struct ip_vs_conn *cp, *ret=NULL;
+	struct ip_vs_conn *ret;
 
 	/*
 	 *	Check for "full" addressed entries
 	 */
 	hash = ip_vs_conn_hashkey(protocol, d_addr, d_port);
 
-	ct_read_lock(hash);
-
-	list_for_each_entry(cp, &ip_vs_conn_tab[hash], c_list) {
-		if (d_addr == cp->caddr && d_port == cp->cport &&
-		    s_port == cp->dport && s_addr == cp->daddr &&
-		    protocol == cp->protocol) {
-			/* HIT */
-			atomic_inc(&cp->refcnt);
-			ret = cp;
-			break;
-		}
-	}
-
-	ct_read_unlock(hash);
+	ret = ip_vs_conn_find(hash, IP_VS_CONN_MATCH_OUT, protocol,
+			      s_addr, s_port, d_addr, d_port);
 
 	IP_VS_DBG(9, "lookup/out %s %u.%u.%u.%u:%d->%u.%u.%u.%u:%d %s\n",
 		  ip_vs_proto_name(protocol),
@@ -527,6 +605,13 @@ int ip_vs_check_template(struct ip_vs_conn *ct)
 	return 1;
 }
 
+static void ip_vs_conn_rcu_free(struct rcu_head *head)
+{
+	struct ip_vs_conn *cp = container_of(head, struct ip_vs_conn, rcu_head);
+
+	kmem_cache_free(ip_vs_conn_cachep, cp);
+}
+
 static void ip_vs_conn_expire(unsigned long data)
 {
 	struct ip_vs_conn *cp = (struct ip_vs_conn *)data;
@@ -551,9 +636,10 @@ static void ip_vs_conn_expire(unsigned long data)
 		goto expire_later;
 
 	/*
-	 *	refcnt==1 implies I'm the only one referrer
+	 *	refcnt==1 implies I'm the only one referrer, a zero refcnt
+	 *	keeps lookups still walking the chain from taking a new one
 	 */
-	if (likely(atomic_read(&cp->refcnt) == 1)) {
+	if (likely(atomic_cmpxchg(&cp->refcnt, 1, 0) == 1)) {
 		/* delete the timer if it is activated by other users */
 		if (timer_pending(&cp->timer))
 			del_timer(&cp->timer);
@@ -569,7 +655,7 @@ static void ip_vs_conn_expire(unsigned long data)
 			atomic_dec(&ip_vs_conn_no_cport_cnt);
 		atomic_dec(&ip_vs_conn_count);
 
-		kmem_cache_free(ip_vs_conn_cachep, cp);
+		call_rcu(&cp->rcu_head, ip_vs_conn_rcu_free);
 		return;
 	}
 
@@ -610,7 +696,7 @@ ip_vs_conn_new(int proto, __u32 caddr, __u16 cport, __u32 vaddr, __u16 vport,
 	}
 
 	memset(cp, 0, sizeof(*cp));
-	INIT_LIST_HEAD(&cp->c_list);
+	INIT_HLIST_NODE(&cp->c_list);
 	init_timer(&cp->timer);
 	cp->timer.data     = (unsigned long)cp;
 	cp->timer.function = ip_vs_conn_expire;
@@ -663,20 +749,27 @@ ip_vs_conn_new(int proto, __u32 caddr, __u16 cport, __u32 vaddr, __u16 vport,
  */
 #ifdef CONFIG_PROC_FS
 
+/* walks the table under RCU; a concurrent resize may skip or repeat lines */
+struct ip_vs_conn_iter {
+	struct ip_vs_conn_tab	*tab;
+	unsigned int		bucket;
+};
+
 static void *ip_vs_conn_array(struct seq_file *seq, loff_t pos)
 {
-	int idx;
+	struct ip_vs_conn_iter *iter = seq->private;
+	struct ip_vs_conn_tab *tab = iter->tab;
 	struct ip_vs_conn *cp;
-	
-	for(idx = 0; idx < IP_VS_CONN_TAB_SIZE; idx++) {
-		ct_read_lock_bh(idx);
-		list_for_each_entry(cp, &ip_vs_conn_tab[idx], c_list) {
+	struct hlist_node *n;
+	unsigned int idx;
+
+	for (idx = 0; idx < tab->size; idx++) {
+		hlist_for_each_entry_rcu(cp, n, &tab->buckets[idx], c_list) {
 			if (pos-- == 0) {
-				seq->private = &ip_vs_conn_tab[idx];
+				iter->bucket = idx;
 				return cp;
 			}
 		}
-		ct_read_unlock_bh(idx);
 	}
 
 	return NULL;
@@ -684,45 +777,41 @@ static void *ip_vs_conn_array(struct seq_file *seq, loff_t pos)
 
 static void *ip_vs_conn_seq_start(struct seq_file *seq, loff_t *pos)
 {
-	seq->private = NULL;
+	struct ip_vs_conn_iter *iter = seq->private;
+
+	rcu_read_lock();
+	iter->tab = rcu_dereference(ip_vs_conn_tab);
 	return *pos ? ip_vs_conn_array(seq, *pos - 1) :SEQ_START_TOKEN;
 }
 
 static void *ip_vs_conn_seq_next(struct seq_file *seq, void *v, loff_t *pos)
 {
+	struct ip_vs_conn_iter *iter = seq->private;
+	struct ip_vs_conn_tab *tab = iter->tab;
 	struct ip_vs_conn *cp = v;
-	struct list_head *e, *l = seq->private;
-	int idx;
+	struct hlist_node *e;
+	unsigned int idx;
 
 	++*pos;
 	if (v == SEQ_START_TOKEN) 
 		return ip_vs_conn_array(seq, 0);
 
 	/* more on same hash chain? */
-	if ((e = cp->c_list.next) != l)
-		return list_entry(e, struct ip_vs_conn, c_list);
-
-	idx = l - ip_vs_conn_tab;
-	ct_read_unlock_bh(idx);
+	if ((e = rcu_dereference(cp->c_list.next)) != NULL)
+		return hlist_entry(e, struct ip_vs_conn, c_list);
 
-	while (++idx < IP_VS_CONN_TAB_SIZE) {
-		ct_read_lock_bh(idx);
-		list_for_each_entry(cp, &ip_vs_conn_tab[idx], c_list) {
-			seq->private = &ip_vs_conn_tab[idx];
+	for (idx = iter->bucket + 1; idx < tab->size; idx++) {
+		hlist_for_each_entry_rcu(cp, e, &tab->buckets[idx], c_list) {
+			iter->bucket = idx;
 			return cp;
 		}	
-		ct_read_unlock_bh(idx);
 	}
-	seq->private = NULL;
 	return NULL;
 }
 
 static void ip_vs_conn_seq_stop(struct seq_file *seq, void *v)
 {
-	struct list_head *l = seq->private;
-
-	if (l)
-		ct_read_unlock_bh(l - ip_vs_conn_tab);
+	rcu_read_unlock();
 }
 
 static int ip_vs_conn_seq_show(struct seq_file *seq, void *v)
@@ -755,7 +844,24 @@ static struct seq_operations ip_vs_conn_seq_ops = {
 
 static int ip_vs_conn_open(struct inode *inode, struct file *file)
 {
-	return seq_open(file, &ip_vs_conn_seq_ops);
+	struct seq_file *seq;
+	int rc = -ENOMEM;
+	struct ip_vs_conn_iter *iter = kzalloc(sizeof(*iter), GFP_KERNEL);
+
+	if (!iter)
+		goto out;
+
+	rc = seq_open(file, &ip_vs_conn_seq_ops);
+	if (rc)
+		goto out_kfree;
+
+	seq = file->private_data;
+	seq->private = iter;
+out:
+	return rc;
+out_kfree:
+	kfree(iter);
+	goto out;
 }
 
 static struct file_operations ip_vs_conn_fops = {
@@ -763,7 +869,7 @@ static struct file_operations ip_vs_conn_fops = {
 	.open    = ip_vs_conn_open,
 	.read    = seq_read,
 	.llseek  = seq_lseek,
-	.release = seq_release,
+	.release = seq_release_private,
 };
 #endif
 
@@ -802,21 +908,28 @@ static inline int todrop_entry(struct ip_vs_conn *cp)
 /* Called from keventd and must protect itself from softirqs */
 void ip_vs_random_dropentry(void)
 {
-	int idx;
+	struct ip_vs_conn_tab *tab;
+	unsigned int idx;
 	struct ip_vs_conn *cp;
+	struct hlist_node *n;
+
+	rcu_read_lock();
+	tab = rcu_dereference(ip_vs_conn_tab);
+	if (!tab)
+		goto out;
 
 	/*
 	 * Randomly scan 1/32 of the whole table every second
 	 */
-	for (idx = 0; idx < (IP_VS_CONN_TAB_SIZE>>5); idx++) {
-		unsigned hash = net_random() & IP_VS_CONN_TAB_MASK;
+	for (idx = 0; idx < (tab->size>>5); idx++) {
+		unsigned hash = net_random() & tab->mask;
 
 		/*
 		 *  Lock is actually needed in this loop.
 		 */
-		ct_write_lock_bh(hash);
+		ct_lock_bh(hash);
 
-		list_for_each_entry(cp, &ip_vs_conn_tab[hash], c_list) {
+		hlist_for_each_entry(cp, n, &tab->buckets[hash], c_list) {
 			if (cp->flags & IP_VS_CONN_F_TEMPLATE)
 				/* connection template */
 				continue;
@@ -847,8 +960,11 @@ void ip_vs_random_dropentry(void)
 				ip_vs_conn_expire_now(cp->control);
 			}
 		}
-		ct_write_unlock_bh(hash);
+		ct_unlock_bh(hash);
 	}
+
+  out:
+	rcu_read_unlock();
 }
 
 
@@ -857,17 +973,19 @@ void ip_vs_random_dropentry(void)
  */
 static void ip_vs_conn_flush(void)
 {
-	int idx;
+	struct ip_vs_conn_tab *tab = ip_vs_conn_tab;
+	unsigned int idx;
 	struct ip_vs_conn *cp;
+	struct hlist_node *n;
 
   flush_again:
-	for (idx=0; idx<IP_VS_CONN_TAB_SIZE; idx++) {
+	for (idx=0; idx<tab->size; idx++) {
 		/*
 		 *  Lock is actually needed in this loop.
 		 */
-		ct_write_lock_bh(idx);
+		ct_lock_bh(idx);
 
-		list_for_each_entry(cp, &ip_vs_conn_tab[idx], c_list) {
+		hlist_for_each_entry(cp, n, &tab->buckets[idx], c_list) {
 
 			IP_VS_DBG(4, "del connection\n");
 			ip_vs_conn_expire_now(cp);
@@ -876,7 +994,7 @@ static void ip_vs_conn_flush(void)
 				ip_vs_conn_expire_now(cp->control);
 			}
 		}
-		ct_write_unlock_bh(idx);
+		ct_unlock_bh(idx);
 	}
 
 	/* the counter may be not NULL, because maybe some conn entries
@@ -888,15 +1006,110 @@ static void ip_vs_conn_flush(void)
 }
 
 
+static struct ip_vs_conn_tab *ip_vs_conn_tab_alloc(int bits)
+{
+	struct ip_vs_conn_tab *tab;
+	unsigned int idx, size = 1 << bits;
+
+	tab = vmalloc(sizeof(*tab) + size*sizeof(struct hlist_head));
+	if (!tab)
+		return NULL;
+
+	tab->size = size;
+	tab->mask = size - 1;
+	for (idx = 0; idx < size; idx++)
+		INIT_HLIST_HEAD(&tab->buckets[idx]);
+
+	return tab;
+}
+
+/*
+ *	Move all entries to a table of 2^bits buckets.  Lookups go on
+ *	without locks meanwhile, the few that miss while it runs look
+ *	again under the bucket lock, in both tables.  Entries are moved
+ *	one lock's worth of buckets at a time.
+ */
+int ip_vs_conn_resize(int bits)
+{
+	struct ip_vs_conn_tab *new, *old;
+	struct ip_vs_conn *cp;
+	struct hlist_node *n, *next;
+	unsigned int lock, idx, hash;
+	int ret = 0;
+
+	if (bits < IP_VS_CONN_TAB_BITS_MIN || bits > IP_VS_CONN_TAB_BITS_MAX)
+		return -EINVAL;
+
+	mutex_lock(&ip_vs_conn_resize_mutex);
+
+	old = ip_vs_conn_tab;
+	if (!old) {
+		/* not loaded yet, ip_vs_conn_init() will use it */
+		ip_vs_conn_tab_bits = bits;
+		goto out;
+	}
+	if (old->size == 1 << bits)
+		goto out;
+
+	new = ip_vs_conn_tab_alloc(bits);
+	if (!new) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	write_seqcount_begin(&ip_vs_conn_tab_seq);
+	ip_vs_conn_tab_old = old;
+	smp_wmb();
+	rcu_assign_pointer(ip_vs_conn_tab, new);
+
+	for (lock = 0; lock < CT_LOCKARRAY_SIZE; lock++) {
+		ct_lock_bh(lock);
+		for (idx = lock; idx < old->size; idx += CT_LOCKARRAY_SIZE) {
+			hlist_for_each_entry_safe(cp, n, next, &old->buckets[idx],
+						  c_list) {
+				hash = ip_vs_conn_hashkey(cp->protocol,
+							  cp->caddr, cp->cport);
+				hlist_del_rcu(&cp->c_list);
+				hlist_add_head_rcu(&cp->c_list,
+					&new->buckets[hash & new->mask]);
+			}
+		}
+		ct_unlock_bh(lock);
+	}
+
+	ip_vs_conn_tab_old = NULL;
+	write_seqcount_end(&ip_vs_conn_tab_seq);
+
+	/* wait for the lookups still walking the old table */
+	synchronize_rcu();
+	vfree(old);
+
+	ip_vs_conn_tab_bits = bits;
+	IP_VS_INFO("Connection hash table resized "
+		   "(size=%d, memory=%ldKbytes)\n",
+		   new->size,
+		   (long)(new->size*sizeof(struct hlist_head))/1024);
+  out:
+	mutex_unlock(&ip_vs_conn_resize_mutex);
+	return ret;
+}
+
+
 int ip_vs_conn_init(void)
 {
+	struct ip_vs_conn_tab *tab;
 	int idx;
 
+	if (ip_vs_conn_tab_bits < IP_VS_CONN_TAB_BITS_MIN)
+		ip_vs_conn_tab_bits = IP_VS_CONN_TAB_BITS_MIN;
+	if (ip_vs_conn_tab_bits > IP_VS_CONN_TAB_BITS_MAX)
+		ip_vs_conn_tab_bits = IP_VS_CONN_TAB_BITS_MAX;
+
 	/*
 	 * Allocate the connection hash table and initialize its list heads
 	 */
-	ip_vs_conn_tab = vmalloc(IP_VS_CONN_TAB_SIZE*sizeof(struct list_head));
-	if (!ip_vs_conn_tab)
+	tab = ip_vs_conn_tab_alloc(ip_vs_conn_tab_bits);
+	if (!tab)
 		return -ENOMEM;
 
 	/* Allocate ip_vs_conn slab cache */
@@ -904,41 +1117,53 @@ int ip_vs_conn_init(void)
 					      sizeof(struct ip_vs_conn), 0,
 					      SLAB_HWCACHE_ALIGN, NULL, NULL);
 	if (!ip_vs_conn_cachep) {
-		vfree(ip_vs_conn_tab);
+		vfree(tab);
 		return -ENOMEM;
 	}
 
 	IP_VS_INFO("Connection hash table configured "
 		   "(size=%d, memory=%ldKbytes)\n",
-		   IP_VS_CONN_TAB_SIZE,
-		   (long)(IP_VS_CONN_TAB_SIZE*sizeof(struct list_head))/1024);
+		   tab->size,
+		   (long)(tab->size*sizeof(struct hlist_head))/1024);
 	IP_VS_DBG(0, "Each connection entry needs %Zd bytes at least\n",
 		  sizeof(struct ip_vs_conn));
 
-	for (idx = 0; idx < IP_VS_CONN_TAB_SIZE; idx++) {
-		INIT_LIST_HEAD(&ip_vs_conn_tab[idx]);
-	}
-
 	for (idx = 0; idx < CT_LOCKARRAY_SIZE; idx++)  {
-		rwlock_init(&__ip_vs_conntbl_lock_array[idx].l);
+		spin_lock_init(&__ip_vs_conntbl_lock_array[idx].l);
 	}
 
-	proc_net_fops_create("ip_vs_conn", 0, &ip_vs_conn_fops);
-
 	/* calculate the random value for connection hash */
 	get_random_bytes(&ip_vs_conn_rnd, sizeof(ip_vs_conn_rnd));
 
+	mutex_lock(&ip_vs_conn_resize_mutex);
+	rcu_assign_pointer(ip_vs_conn_tab, tab);
+	mutex_unlock(&ip_vs_conn_resize_mutex);
+
+	proc_net_fops_create("ip_vs_conn", 0, &ip_vs_conn_fops);
+
 	return 0;
 }
 
 
 void ip_vs_conn_cleanup(void)
 {
+	struct ip_vs_conn_tab *tab;
+
+	/* keep the table from being resized from under the flush */
+	mutex_lock(&ip_vs_conn_resize_mutex);
+
 	/* flush all the connection entries first */
 	ip_vs_conn_flush();
 
+	/* wait for the entries freed by RCU */
+	rcu_barrier();
+
 	/* Release the empty cache */
 	kmem_cache_destroy(ip_vs_conn_cachep);
 	proc_net_remove("ip_vs_conn");
-	vfree(ip_vs_conn_tab);
+
+	tab = ip_vs_conn_tab;
+	ip_vs_conn_tab = NULL;
+	mutex_unlock(&ip_vs_conn_resize_mutex);
+	vfree(tab);
 }
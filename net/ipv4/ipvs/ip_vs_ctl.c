@@ -472,8 +472,10 @@ __ip_vs_unbind_svc(struct ip_vs_dest *dest)
 	struct ip_vs_service *svc = dest->svc;
 
 	dest->svc = NULL;
-	if (atomic_dec_and_test(&svc->refcnt))
+	if (atomic_dec_and_test(&svc->refcnt)) {
+		ip_vs_free_stats(&svc->stats);
 		kfree(svc);
+	}
 }
 
 
@@ -626,6 +628,7 @@ ip_vs_trash_get_dest(struct ip_vs_service *svc, __u32 daddr, __u16 dport)
 			list_del(&dest->n_list);
 			ip_vs_dst_reset(dest);
 			__ip_vs_unbind_svc(dest);
+			ip_vs_free_stats(&dest->stats);
 			kfree(dest);
 		}
 	}
@@ -651,6 +654,7 @@ static void ip_vs_trash_cleanup(void)
 		list_del(&dest->n_list);
 		ip_vs_dst_reset(dest);
 		__ip_vs_unbind_svc(dest);
+		ip_vs_free_stats(&dest->stats);
 		kfree(dest);
 	}
 }
@@ -661,6 +665,7 @@ ip_vs_zero_stats(struct ip_vs_stats *stats)
 {
 	spin_lock_bh(&stats->lock);
 	memset(stats, 0, (char *)&stats->lock - (char *)stats);
+	ip_vs_zero_cpu_stats(stats);
 	spin_unlock_bh(&stats->lock);
 	ip_vs_zero_estimator(stats);
 }
@@ -740,6 +745,11 @@ ip_vs_new_dest(struct ip_vs_service *svc, struct ip_vs_dest_user *udest,
 		IP_VS_ERR("ip_vs_new_dest: kmalloc failed.\n");
 		return -ENOMEM;
 	}
+	if (ip_vs_init_stats(&dest->stats)) {
+		IP_VS_ERR("ip_vs_new_dest: alloc_percpu failed.\n");
+		kfree(dest);
+		return -ENOMEM;
+	}
 
 	dest->protocol = svc->protocol;
 	dest->vaddr = svc->addr;
@@ -755,7 +765,6 @@ ip_vs_new_dest(struct ip_vs_service *svc, struct ip_vs_dest_user *udest,
 
 	INIT_LIST_HEAD(&dest->d_list);
 	spin_lock_init(&dest->dst_lock);
-	spin_lock_init(&dest->stats.lock);
 	__ip_vs_update_dest(svc, dest, udest);
 	ip_vs_new_estimator(&dest->stats);
 
@@ -949,6 +958,7 @@ static void __ip_vs_del_dest(struct ip_vs_dest *dest)
 		   and only one user context can update virtual service at a
 		   time, so the operation here is OK */
 		atomic_dec(&dest->svc->refcnt);
+		ip_vs_free_stats(&dest->stats);
 		kfree(dest);
 	} else {
 		IP_VS_DBG(3, "Moving dest %u.%u.%u.%u:%u into trash, "
@@ -1070,7 +1080,9 @@ ip_vs_add_service(struct ip_vs_service_user *u, struct ip_vs_service **svc_p)
 
 	INIT_LIST_HEAD(&svc->destinations);
 	rwlock_init(&svc->sched_lock);
-	spin_lock_init(&svc->stats.lock);
+	ret = ip_vs_init_stats(&svc->stats);
+	if (ret)
+		goto out_err;
 
 	/* Bind the scheduler */
 	ret = ip_vs_bind_scheduler(svc, sched);
@@ -1104,6 +1116,7 @@ ip_vs_add_service(struct ip_vs_service_user *u, struct ip_vs_service **svc_p)
 			ip_vs_app_inc_put(svc->inc);
 			local_bh_enable();
 		}
+		ip_vs_free_stats(&svc->stats);
 		kfree(svc);
 	}
 	ip_vs_scheduler_put(sched);
@@ -1234,8 +1247,10 @@ static void __ip_vs_del_service(struct ip_vs_service *svc)
 	/*
 	 *    Free the service if nobody refers to it
 	 */
-	if (atomic_read(&svc->refcnt) == 0)
+	if (atomic_read(&svc->refcnt) == 0) {
+		ip_vs_free_stats(&svc->stats);
 		kfree(svc);
+	}
 
 	/* decrease the module use count */
 	ip_vs_use_count_dec();
@@ -1393,6 +1408,27 @@ proc_do_sync_threshold(ctl_table *table, int write, struct file *filp,
 }
 
 
+static int
+proc_do_conn_tab_bits(ctl_table *table, int write, struct file *filp,
+		      void __user *buffer, size_t *lenp, loff_t *ppos)
+{
+	int *valp = table->data;
+	int val = *valp;
+	int rc;
+
+	rc = proc_dointvec(table, write, filp, buffer, lenp, ppos);
+	if (write && (*valp != val)) {
+		int bits = *valp;
+
+		/* ip_vs_conn_resize() sets it once the table is resized */
+		*valp = val;
+		if (!rc)
+			rc = ip_vs_conn_resize(bits);
+	}
+	return rc;
+}
+
+
 /*
  *	IPVS sysctl table (under the /proc/sys/net/ipv4/vs/)
  */
@@ -1586,6 +1622,14 @@ static struct ctl_table vs_vars[] = {
 		.mode		= 0644,
 		.proc_handler	= &proc_dointvec,
 	},
+	{
+		.ctl_name	= NET_IPV4_VS_CONN_TAB_BITS,
+		.procname	= "conn_tab_bits",
+		.data		= &ip_vs_conn_tab_bits,
+		.maxlen		= sizeof(int),
+		.mode		= 0644,
+		.proc_handler	= &proc_do_conn_tab_bits,
+	},
 	{ .ctl_name = 0 }
 };
 
@@ -1743,7 +1787,7 @@ static int ip_vs_info_seq_show(struct seq_file *seq, void *v)
 	if (v == SEQ_START_TOKEN) {
 		seq_printf(seq,
 			"IP Virtual Server version %d.%d.%d (size=%d)\n",
-			NVERSION(IP_VS_VERSION_CODE), IP_VS_CONN_TAB_SIZE);
+			NVERSION(IP_VS_VERSION_CODE), 1 << ip_vs_conn_tab_bits);
 		seq_puts(seq,
 			 "Prot LocalAddress:Port Scheduler Flags\n");
 		seq_puts(seq,
@@ -1835,6 +1879,7 @@ static int ip_vs_stats_show(struct seq_file *seq, void *v)
 		   "   Conns  Packets  Packets            Bytes            Bytes\n");
 
 	spin_lock_bh(&ip_vs_stats.lock);
+	ip_vs_read_cpu_stats(&ip_vs_stats);
 	seq_printf(seq, "%8X %8X %8X %16LX %16LX\n\n", ip_vs_stats.conns,
 		   ip_vs_stats.inpkts, ip_vs_stats.outpkts,
 		   (unsigned long long) ip_vs_stats.inbytes,
@@ -2051,6 +2096,7 @@ static void
 ip_vs_copy_stats(struct ip_vs_stats_user *dst, struct ip_vs_stats *src)
 {
 	spin_lock_bh(&src->lock);
+	ip_vs_read_cpu_stats(src);
 	memcpy(dst, src, (char*)&src->lock - (char*)src);
 	spin_unlock_bh(&src->lock);
 }
@@ -2217,7 +2263,7 @@ do_ip_vs_get_ctl(struct sock *sk, int cmd, void __user *user, int *len)
 		char buf[64];
 
 		sprintf(buf, "IP Virtual Server version %d.%d.%d (size=%d)",
-			NVERSION(IP_VS_VERSION_CODE), IP_VS_CONN_TAB_SIZE);
+			NVERSION(IP_VS_VERSION_CODE), 1 << ip_vs_conn_tab_bits);
 		if (copy_to_user(user, buf, strlen(buf)+1) != 0) {
 			ret = -EFAULT;
 			goto out;
@@ -2230,7 +2276,7 @@ do_ip_vs_get_ctl(struct sock *sk, int cmd, void __user *user, int *len)
 	{
 		struct ip_vs_getinfo info;
 		info.version = IP_VS_VERSION_CODE;
-		info.size = IP_VS_CONN_TAB_SIZE;
+		info.size = 1 << ip_vs_conn_tab_bits;
 		info.num_services = ip_vs_num_services;
 		if (copy_to_user(user, &info, sizeof(info)) != 0)
 			ret = -EFAULT;
@@ -2350,9 +2396,17 @@ int ip_vs_control_init(void)
 
 	EnterFunction(2);
 
+	memset(&ip_vs_stats, 0, sizeof(ip_vs_stats));
+	ret = ip_vs_init_stats(&ip_vs_stats);
+	if (ret) {
+		IP_VS_ERR("cannot allocate stats.\n");
+		return ret;
+	}
+
 	ret = nf_register_sockopt(&ip_vs_sockopts);
 	if (ret) {
 		IP_VS_ERR("cannot register sockopt.\n");
+		ip_vs_free_stats(&ip_vs_stats);
 		return ret;
 	}
 
@@ -2370,8 +2424,6 @@ int ip_vs_control_init(void)
 		INIT_LIST_HEAD(&ip_vs_rtable[idx]);
 	}
 
-	memset(&ip_vs_stats, 0, sizeof(ip_vs_stats));
-	spin_lock_init(&ip_vs_stats.lock);
 	ip_vs_new_estimator(&ip_vs_stats);
 
 	/* Hook the defense timer */
@@ -2392,5 +2444,6 @@ void ip_vs_control_cleanup(void)
 	proc_net_remove("ip_vs_stats");
 	proc_net_remove("ip_vs");
 	nf_unregister_sockopt(&ip_vs_sockopts);
+	ip_vs_free_stats(&ip_vs_stats);
 	LeaveFunction(2);
 }
@@ -18,6 +18,7 @@
 #include <linux/slab.h>
 #include <linux/types.h>
 #include <linux/interrupt.h>
+#include <linux/percpu.h>
 
 #include <net/ip_vs.h>
 
@@ -42,6 +43,9 @@
     rate is ~2.15Gbits/s, average pps and cps are scaled by 2^10.
 
   * A lot code is taken from net/sched/estimator.c
+
+  * The packet paths count into per cpu counters without locking, the
+    totals are summed from them here and when the stats are read.
  */
 
 
@@ -64,6 +68,68 @@ struct ip_vs_estimator
 };
 
 
+/*
+ *	Set up the per cpu counters of a stats object, before any packet
+ *	can reach it
+ */
+int ip_vs_init_stats(struct ip_vs_stats *stats)
+{
+	spin_lock_init(&stats->lock);
+	stats->cpustats = alloc_percpu(struct ip_vs_cpu_stats);
+	if (stats->cpustats == NULL)
+		return -ENOMEM;
+	return 0;
+}
+
+void ip_vs_free_stats(struct ip_vs_stats *stats)
+{
+	if (stats->cpustats)
+		free_percpu(stats->cpustats);
+	stats->cpustats = NULL;
+}
+
+static void ip_vs_sum_cpu_stats(struct ip_vs_stats *stats,
+				struct ip_vs_cpu_stats *sum)
+{
+	int i;
+
+	memset(sum, 0, sizeof(*sum));
+	for_each_possible_cpu(i) {
+		struct ip_vs_cpu_stats *s = per_cpu_ptr(stats->cpustats, i);
+
+		sum->conns += s->conns;
+		sum->inpkts += s->inpkts;
+		sum->outpkts += s->outpkts;
+		sum->inbytes += s->inbytes;
+		sum->outbytes += s->outbytes;
+	}
+}
+
+/*
+ *	Bring the totals up to date, with stats->lock held
+ */
+void ip_vs_read_cpu_stats(struct ip_vs_stats *stats)
+{
+	struct ip_vs_cpu_stats sum;
+
+	ip_vs_sum_cpu_stats(stats, &sum);
+	stats->conns = sum.conns - stats->zerobase.conns;
+	stats->inpkts = sum.inpkts - stats->zerobase.inpkts;
+	stats->outpkts = sum.outpkts - stats->zerobase.outpkts;
+	stats->inbytes = sum.inbytes - stats->zerobase.inbytes;
+	stats->outbytes = sum.outbytes - stats->zerobase.outbytes;
+}
+
+/*
+ *	Count from zero again, with stats->lock held: the per cpu counters
+ *	keep running, the totals are taken relative to their sums now
+ */
+void ip_vs_zero_cpu_stats(struct ip_vs_stats *stats)
+{
+	ip_vs_sum_cpu_stats(stats, &stats->zerobase);
+}
+
+
 static struct ip_vs_estimator *est_list = NULL;
 static DEFINE_RWLOCK(est_lock);
 static struct timer_list est_timer;
@@ -82,6 +148,7 @@ static void estimation_timer(unsigned long arg)
 		s = e->stats;
 
 		spin_lock(&s->lock);
+		ip_vs_read_cpu_stats(s);
 		n_conns = s->conns;
 		n_inpkts = s->inpkts;
 		n_outpkts = s->outpkts;
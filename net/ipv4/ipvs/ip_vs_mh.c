@@ -0,0 +1,327 @@
+/*
+ * IPVS:        Maglev Hashing scheduling module
+ *
+ *              This program is free software; you can redistribute it and/or
+ *              modify it under the terms of the GNU General Public License
+ *              as published by the Free Software Foundation; either version
+ *              2 of the License, or (at your option) any later version.
+ *
+ * Changes:
+ *
+ */
+
+/*
+ * The mh algorithm selects the server by the hash of the source IP
+ * address, like sh, but through a lookup table filled by Maglev hashing
+ * ("Maglev: A Fast and Reliable Software Network Load Balancer", NSDI
+ * 2016) instead of round robin:
+ *
+ *       n <- servernode[hash(src_ip) % M];
+ *       if (n is dead) OR
+ *          (n is overloaded) or (n.weight <= 0) then
+ *                 return NULL;
+ *
+ *       return n;
+ *
+ * Every server has its own permutation of the M table entries, derived
+ * from a hash of its address and port only.  The servers take turns
+ * claiming the next free entry of their permutation until the table is
+ * full, a server taking as many turns per round as its weight (divided
+ * by the weights' gcd).  So the servers share the table in proportion
+ * to their weights, and adding or removing one server only moves about
+ * 1/N of the clients, where sh moves most of them.  Load balancers with
+ * the same servers build the same table, whatever the order the servers
+ * were added in, so that clients keep their server across a fail over.
+ *
+ * M is a prime, large compared with the number of servers.
+ */
+
+#include <linux/ip.h>
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/skbuff.h>
+#include <linux/jhash.h>
+
+#include <net/ip_vs.h>
+
+
+/*
+ *      IPVS MH bucket
+ */
+struct ip_vs_mh_bucket {
+	struct ip_vs_dest       *dest;          /* real server */
+};
+
+/*
+ *     for IPVS MH lookup table, the size must be a prime
+ */
+#ifndef CONFIG_IP_VS_MH_TAB_SIZE
+#define CONFIG_IP_VS_MH_TAB_SIZE        4093
+#endif
+#define IP_VS_MH_TAB_SIZE               CONFIG_IP_VS_MH_TAB_SIZE
+
+/* turns a server takes per round at most, weights are scaled down to it */
+#define IP_VS_MH_MAX_TURNS              256
+
+/*
+ *      Per server state while the table is being filled
+ */
+struct ip_vs_mh_perm {
+	struct ip_vs_dest       *dest;
+	unsigned int            offset;         /* first entry */
+	unsigned int            skip;           /* step between entries */
+	unsigned int            next;           /* entries tried so far */
+	unsigned int            turns;          /* entries per round */
+};
+
+
+/*
+ *	Returns the table entry for a source address; no random seed, so
+ *	that all load balancers agree
+ */
+static inline unsigned ip_vs_mh_hashkey(__u32 addr)
+{
+	return jhash_1word(addr, 0) % IP_VS_MH_TAB_SIZE;
+}
+
+
+/*
+ *      Get ip_vs_dest associated with supplied parameters.
+ */
+static inline struct ip_vs_dest *
+ip_vs_mh_get(struct ip_vs_mh_bucket *tbl, __u32 addr)
+{
+	return (tbl[ip_vs_mh_hashkey(addr)]).dest;
+}
+
+
+static unsigned int ip_vs_mh_gcd(unsigned int a, unsigned int b)
+{
+	unsigned int c;
+
+	while (b) {
+		c = a % b;
+		a = b;
+		b = c;
+	}
+	return a;
+}
+
+
+/*
+ *      Fill the lookup table with the servers of non-zero weight.
+ */
+static int
+ip_vs_mh_assign(struct ip_vs_mh_bucket *tbl, struct ip_vs_service *svc)
+{
+	struct ip_vs_mh_perm *perms, *p;
+	struct ip_vs_dest *dest;
+	unsigned int n = 0, filled = 0, gcd = 0, max = 0, shift = 0;
+	unsigned int i, t, c;
+	int weight;
+
+	memset(tbl, 0, sizeof(struct ip_vs_mh_bucket)*IP_VS_MH_TAB_SIZE);
+
+	list_for_each_entry(dest, &svc->destinations, n_list) {
+		weight = atomic_read(&dest->weight);
+		if (weight <= 0)
+			continue;
+		gcd = ip_vs_mh_gcd(weight, gcd);
+		if (weight > max)
+			max = weight;
+		n++;
+	}
+	if (!n)
+		return 0;
+
+	perms = kmalloc(n * sizeof(*perms), GFP_ATOMIC);
+	if (perms == NULL) {
+		IP_VS_ERR("ip_vs_mh_assign(): no memory\n");
+		return -ENOMEM;
+	}
+
+	while ((max / gcd) >> shift > IP_VS_MH_MAX_TURNS)
+		shift++;
+
+	p = perms;
+	list_for_each_entry(dest, &svc->destinations, n_list) {
+		weight = atomic_read(&dest->weight);
+		if (weight <= 0)
+			continue;
+		p->dest = dest;
+		p->offset = jhash_2words(dest->addr, dest->port, 0) %
+			    IP_VS_MH_TAB_SIZE;
+		p->skip = jhash_2words(dest->addr, dest->port, 1) %
+			  (IP_VS_MH_TAB_SIZE - 1) + 1;
+		p->next = 0;
+		p->turns = ((unsigned int)weight / gcd) >> shift;
+		if (!p->turns)
+			p->turns = 1;
+		p++;
+	}
+
+	for (;;) {
+		for (i = 0, p = perms; i < n; i++, p++) {
+			for (t = 0; t < p->turns; t++) {
+				/* the first free entry of its permutation */
+				do {
+					c = (p->offset + p->next * p->skip) %
+					    IP_VS_MH_TAB_SIZE;
+					p->next++;
+				} while (tbl[c].dest);
+
+				atomic_inc(&p->dest->refcnt);
+				tbl[c].dest = p->dest;
+				if (++filled == IP_VS_MH_TAB_SIZE)
+					goto out;
+			}
+		}
+	}
+
+  out:
+	kfree(perms);
+	return 0;
+}
+
+
+/*
+ *      Flush all the hash buckets of the specified table.
+ */
+static void ip_vs_mh_flush(struct ip_vs_mh_bucket *tbl)
+{
+	int i;
+	struct ip_vs_mh_bucket *b;
+
+	b = tbl;
+	for (i=0; i<IP_VS_MH_TAB_SIZE; i++) {
+		if (b->dest) {
+			atomic_dec(&b->dest->refcnt);
+			b->dest = NULL;
+		}
+		b++;
+	}
+}
+
+
+static int ip_vs_mh_init_svc(struct ip_vs_service *svc)
+{
+	struct ip_vs_mh_bucket *tbl;
+
+	/* allocate the MH table for this service */
+	tbl = kmalloc(sizeof(struct ip_vs_mh_bucket)*IP_VS_MH_TAB_SIZE,
+		      GFP_ATOMIC);
+	if (tbl == NULL) {
+		IP_VS_ERR("ip_vs_mh_init_svc(): no memory\n");
+		return -ENOMEM;
+	}
+	svc->sched_data = tbl;
+	IP_VS_DBG(6, "MH lookup table (memory=%Zdbytes) allocated for "
+		  "current service\n",
+		  sizeof(struct ip_vs_mh_bucket)*IP_VS_MH_TAB_SIZE);
+
+	/* fill the lookup table with the updated service, on failure
+	   it is left empty and released by ip_vs_mh_done_svc() */
+	return ip_vs_mh_assign(tbl, svc);
+}
+
+
+static int ip_vs_mh_done_svc(struct ip_vs_service *svc)
+{
+	struct ip_vs_mh_bucket *tbl = svc->sched_data;
+
+	/* got to clean up hash buckets here */
+	ip_vs_mh_flush(tbl);
+
+	/* release the table itself */
+	kfree(svc->sched_data);
+	IP_VS_DBG(6, "MH lookup table (memory=%Zdbytes) released\n",
+		  sizeof(struct ip_vs_mh_bucket)*IP_VS_MH_TAB_SIZE);
+
+	return 0;
+}
+
+
+static int ip_vs_mh_update_svc(struct ip_vs_service *svc)
+{
+	struct ip_vs_mh_bucket *tbl = svc->sched_data;
+
+	/* got to clean up hash buckets here */
+	ip_vs_mh_flush(tbl);
+
+	/* fill the lookup table with the updated service */
+	return ip_vs_mh_assign(tbl, svc);
+}
+
+
+/*
+ *      If the dest flags is set with IP_VS_DEST_F_OVERLOAD,
+ *      consider that the server is overloaded here.
+ */
+static inline int is_overloaded(struct ip_vs_dest *dest)
+{
+	return dest->flags & IP_VS_DEST_F_OVERLOAD;
+}
+
+
+/*
+ *      Maglev Hashing scheduling
+ */
+static struct ip_vs_dest *
+ip_vs_mh_schedule(struct ip_vs_service *svc, const struct sk_buff *skb)
+{
+	struct ip_vs_dest *dest;
+	struct ip_vs_mh_bucket *tbl;
+	struct iphdr *iph = skb->nh.iph;
+
+	IP_VS_DBG(6, "ip_vs_mh_schedule(): Scheduling...\n");
+
+	tbl = (struct ip_vs_mh_bucket *)svc->sched_data;
+	dest = ip_vs_mh_get(tbl, iph->saddr);
+	if (!dest
+	    || !(dest->flags & IP_VS_DEST_F_AVAILABLE)
+	    || atomic_read(&dest->weight) <= 0
+	    || is_overloaded(dest)) {
+		return NULL;
+	}
+
+	IP_VS_DBG(6, "MH: source IP address %u.%u.%u.%u "
+		  "--> server %u.%u.%u.%u:%d\n",
+		  NIPQUAD(iph->saddr),
+		  NIPQUAD(dest->addr),
+		  ntohs(dest->port));
+
+	return dest;
+}
+
+
+/*
+ *      IPVS MH Scheduler structure
+ */
+static struct ip_vs_scheduler ip_vs_mh_scheduler =
+{
+	.name =			"mh",
+	.refcnt =		ATOMIC_INIT(0),
+	.module =		THIS_MODULE,
+	.init_service =		ip_vs_mh_init_svc,
+	.done_service =		ip_vs_mh_done_svc,
+	.update_service =	ip_vs_mh_update_svc,
+	.schedule =		ip_vs_mh_schedule,
+};
+
+
+static int __init ip_vs_mh_init(void)
+{
+	INIT_LIST_HEAD(&ip_vs_mh_scheduler.n_list);
+	return register_ip_vs_scheduler(&ip_vs_mh_scheduler);
+}
+
+
+static void __exit ip_vs_mh_cleanup(void)
+{
+	unregister_ip_vs_scheduler(&ip_vs_mh_scheduler);
+}
+
+
+module_init(ip_vs_mh_init);
+module_exit(ip_vs_mh_cleanup);
+MODULE_LICENSE("GPL");
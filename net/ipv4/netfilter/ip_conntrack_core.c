@@ -37,9 +37,11 @@
 #include <linux/percpu.h>
 #include <linux/moduleparam.h>
 #include <linux/notifier.h>
+#include <linux/seqlock.h>
 
-/* ip_conntrack_lock protects the main hash table, protocol/helper/expected
-   registrations, conntrack timers*/
+/* ip_conntrack_lock protects protocol/helper/expected registrations.  The
+   main hash table is read under RCU; its chains are changed under the
+   stripe of ip_conntrack_locks they hash to, see ip_ct_double_lock(). */
 #define ASSERT_READ_LOCK(x)
 #define ASSERT_WRITE_LOCK(x)
 
@@ -59,8 +61,14 @@
 
 DEFINE_RWLOCK(ip_conntrack_lock);
 
-/* ip_conntrack_standalone needs this */
-atomic_t ip_conntrack_count = ATOMIC_INIT(0);
+/* The number of conntracks.  Each cpu counts in its own delta, which is
+ * folded into the global count only once it reaches IP_CT_COUNT_BATCH,
+ * so that creating and destroying connections on all cpus doesn't bounce
+ * one cache line between them.  The global count, as checked against
+ * ip_conntrack_max, is then off by less than the batch on each cpu. */
+#define IP_CT_COUNT_BATCH	32
+static atomic_t ip_conntrack_count_global = ATOMIC_INIT(0);
+static DEFINE_PER_CPU(int, ip_conntrack_count_delta);
 
 void (*ip_conntrack_destroyed)(struct ip_conntrack *conntrack) = NULL;
 LIST_HEAD(ip_conntrack_expect_list);
@@ -68,15 +76,31 @@ struct ip_conntrack_protocol *ip_ct_protos[MAX_IP_CT_PROTO];
 static LIST_HEAD(helpers);
 unsigned int ip_conntrack_htable_size = 0;
 int ip_conntrack_max;
-struct list_head *ip_conntrack_hash;
+struct hlist_head *ip_conntrack_hash;
 static kmem_cache_t *ip_conntrack_cachep __read_mostly;
 static kmem_cache_t *ip_conntrack_expect_cachep __read_mostly;
 struct ip_conntrack ip_conntrack_untracked;
 unsigned int ip_ct_log_invalid;
-static LIST_HEAD(unconfirmed);
 static int ip_conntrack_vmalloc;
 
-static unsigned int ip_conntrack_next_id;
+/* Bucket locks, striped.  Taking all of them, to resize the table, sets
+   ip_conntrack_locks_all under ip_conntrack_locks_all_lock. */
+#define IP_CT_LOCKS	256
+static spinlock_t ip_conntrack_locks[IP_CT_LOCKS];
+static DEFINE_SPINLOCK(ip_conntrack_locks_all_lock);
+static int ip_conntrack_locks_all;
+
+/* Bumped around a resize, for lookups to retry what they missed */
+static seqcount_t ip_conntrack_generation = SEQCNT_ZERO;
+
+/* Conntracks not in the hash yet, on the cpu which made them */
+struct ip_ct_unconfirmed {
+	spinlock_t lock;
+	struct hlist_head list;
+};
+static DEFINE_PER_CPU(struct ip_ct_unconfirmed, ip_ct_unconfirmed);
+
+static atomic_t ip_conntrack_next_id = ATOMIC_INIT(0);
 static unsigned int ip_conntrack_expect_next_id;
 #ifdef CONFIG_IP_NF_CONNTRACK_EVENTS
 ATOMIC_NOTIFIER_HEAD(ip_conntrack_chain);
@@ -163,6 +187,125 @@ hash_conntrack(const struct ip_conntrack_tuple *tuple)
 				ip_conntrack_hash_rnd);
 }
 
+/* The table and its size for a lockless reader.  set_hashsize() stores a
+ * larger table before its size, and a smaller one after it, so the lesser
+ * of the sizes read before and after the table never exceeds it.  A rnd
+ * not matching the table only makes the reader miss, and retry. */
+struct hlist_head *ip_conntrack_rcu_hash(unsigned int *size)
+{
+	struct hlist_head *hash;
+	unsigned int before, after;
+
+	before = ip_conntrack_htable_size;
+	smp_rmb();
+	hash = rcu_dereference(ip_conntrack_hash);
+	smp_rmb();
+	after = ip_conntrack_htable_size;
+
+	*size = min(before, after);
+	return hash;
+}
+
+static void ip_ct_lock(spinlock_t *lock)
+{
+	spin_lock(lock);
+	while (unlikely(ip_conntrack_locks_all)) {
+		spin_unlock(lock);
+		spin_unlock_wait(&ip_conntrack_locks_all_lock);
+		spin_lock(lock);
+	}
+}
+
+/* Lock the stripes of two buckets, softirqs disabled by the caller.
+ * Returns 1, with nothing locked, when the table was resized after the
+ * buckets were hashed in generation @seq. */
+static int ip_ct_double_lock(unsigned int h1, unsigned int h2,
+			     unsigned int seq)
+{
+	h1 %= IP_CT_LOCKS;
+	h2 %= IP_CT_LOCKS;
+	if (h1 > h2) {
+		unsigned int tmp = h1;
+		h1 = h2;
+		h2 = tmp;
+	}
+	ip_ct_lock(&ip_conntrack_locks[h1]);
+	if (h1 != h2)
+		spin_lock_nested(&ip_conntrack_locks[h2],
+				 SINGLE_DEPTH_NESTING);
+
+	if (read_seqcount_retry(&ip_conntrack_generation, seq)) {
+		spin_unlock(&ip_conntrack_locks[h1]);
+		if (h1 != h2)
+			spin_unlock(&ip_conntrack_locks[h2]);
+		return 1;
+	}
+	return 0;
+}
+
+static void ip_ct_double_unlock(unsigned int h1, unsigned int h2)
+{
+	h1 %= IP_CT_LOCKS;
+	h2 %= IP_CT_LOCKS;
+	spin_unlock(&ip_conntrack_locks[h1]);
+	if (h1 != h2)
+		spin_unlock(&ip_conntrack_locks[h2]);
+}
+
+/* Lock the buckets of both tuples of a conntrack; returns their hashes */
+static void ip_ct_lock_hashes(struct ip_conntrack *ct,
+			      unsigned int *hash, unsigned int *repl_hash)
+{
+	unsigned int seq;
+
+	do {
+		seq = read_seqcount_begin(&ip_conntrack_generation);
+		*hash = hash_conntrack(&ct->tuplehash[IP_CT_DIR_ORIGINAL].tuple);
+		*repl_hash = hash_conntrack(&ct->tuplehash[IP_CT_DIR_REPLY].tuple);
+	} while (ip_ct_double_lock(*hash, *repl_hash, seq));
+}
+
+/* Keep every chain still, for set_hashsize() */
+static void ip_ct_all_lock(void)
+{
+	int i;
+
+	spin_lock_bh(&ip_conntrack_locks_all_lock);
+	ip_conntrack_locks_all = 1;
+	for (i = 0; i < IP_CT_LOCKS; i++) {
+		spin_lock(&ip_conntrack_locks[i]);
+		spin_unlock(&ip_conntrack_locks[i]);
+	}
+}
+
+static void ip_ct_all_unlock(void)
+{
+	ip_conntrack_locks_all = 0;
+	spin_unlock_bh(&ip_conntrack_locks_all_lock);
+}
+
+static void ip_ct_unconfirmed_add(struct ip_conntrack *ct)
+{
+	struct ip_ct_unconfirmed *uc;
+
+	local_bh_disable();
+	ct->cpu = smp_processor_id();
+	uc = &per_cpu(ip_ct_unconfirmed, ct->cpu);
+	spin_lock(&uc->lock);
+	hlist_add_head(&ct->tuplehash[IP_CT_DIR_ORIGINAL].hnode, &uc->list);
+	spin_unlock(&uc->lock);
+	local_bh_enable();
+}
+
+static void ip_ct_unconfirmed_del(struct ip_conntrack *ct)
+{
+	struct ip_ct_unconfirmed *uc = &per_cpu(ip_ct_unconfirmed, ct->cpu);
+
+	spin_lock_bh(&uc->lock);
+	hlist_del(&ct->tuplehash[IP_CT_DIR_ORIGINAL].hnode);
+	spin_unlock_bh(&uc->lock);
+}
+
 int
 ip_ct_get_tuple(const struct iphdr *iph,
 		const struct sk_buff *skb,
@@ -291,21 +434,25 @@ void ip_ct_remove_expectations(struct ip_conntrack *ct)
 	}
 }
 
+/* Called with softirqs disabled */
 static void
 clean_from_lists(struct ip_conntrack *ct)
 {
 	unsigned int ho, hr;
 	
 	DEBUGP("clean_from_lists(%p)\n", ct);
-	ASSERT_WRITE_LOCK(&ip_conntrack_lock);
 
-	ho = hash_conntrack(&ct->tuplehash[IP_CT_DIR_ORIGINAL].tuple);
-	hr = hash_conntrack(&ct->tuplehash[IP_CT_DIR_REPLY].tuple);
-	LIST_DELETE(&ip_conntrack_hash[ho], &ct->tuplehash[IP_CT_DIR_ORIGINAL]);
-	LIST_DELETE(&ip_conntrack_hash[hr], &ct->tuplehash[IP_CT_DIR_REPLY]);
+	ip_ct_lock_hashes(ct, &ho, &hr);
+	hlist_del_rcu(&ct->tuplehash[IP_CT_DIR_ORIGINAL].hnode);
+	hlist_del_rcu(&ct->tuplehash[IP_CT_DIR_REPLY].hnode);
+	ip_ct_double_unlock(ho, hr);
 
 	/* Destroy all pending expectations */
-	ip_ct_remove_expectations(ct);
+	if (ct->expecting) {
+		write_lock(&ip_conntrack_lock);
+		ip_ct_remove_expectations(ct);
+		write_unlock(&ip_conntrack_lock);
+	}
 }
 
 static void
@@ -331,21 +478,25 @@ destroy_conntrack(struct nf_conntrack *nfct)
 	if (ip_conntrack_destroyed)
 		ip_conntrack_destroyed(ct);
 
-	write_lock_bh(&ip_conntrack_lock);
 	/* Expectations will have been removed in clean_from_lists,
 	 * except TFTP can create an expectation on the first packet,
 	 * before connection is in the list, so we need to clean here,
-	 * too. */
-	ip_ct_remove_expectations(ct);
+	 * too.  Nobody holds us any more to expect further ones. */
+	if (ct->expecting) {
+		write_lock_bh(&ip_conntrack_lock);
+		ip_ct_remove_expectations(ct);
+		write_unlock_bh(&ip_conntrack_lock);
+	}
 
 	/* We overload first tuple to link into unconfirmed list. */
 	if (!is_confirmed(ct)) {
-		BUG_ON(list_empty(&ct->tuplehash[IP_CT_DIR_ORIGINAL].list));
-		list_del(&ct->tuplehash[IP_CT_DIR_ORIGINAL].list);
+		BUG_ON(hlist_unhashed(&ct->tuplehash[IP_CT_DIR_ORIGINAL].hnode));
+		ip_ct_unconfirmed_del(ct);
 	}
 
+	local_bh_disable();
 	CONNTRACK_STAT_INC(delete);
-	write_unlock_bh(&ip_conntrack_lock);
+	local_bh_enable();
 
 	if (ct->master)
 		ip_conntrack_put(ct->master);
@@ -358,12 +509,12 @@ static void death_by_timeout(unsigned long ul_conntrack)
 {
 	struct ip_conntrack *ct = (void *)ul_conntrack;
 
-	write_lock_bh(&ip_conntrack_lock);
-	/* Inside lock so preempt is disabled on module removal path.
+	/* Softirqs off so preempt is disabled on module removal path.
 	 * Otherwise we can get spurious warnings. */
+	local_bh_disable();
 	CONNTRACK_STAT_INC(delete_list);
 	clean_from_lists(ct);
-	write_unlock_bh(&ip_conntrack_lock);
+	local_bh_enable();
 	ip_conntrack_put(ct);
 }
 
@@ -372,26 +523,33 @@ conntrack_tuple_cmp(const struct ip_conntrack_tuple_hash *i,
 		    const struct ip_conntrack_tuple *tuple,
 		    const struct ip_conntrack *ignored_conntrack)
 {
-	ASSERT_READ_LOCK(&ip_conntrack_lock);
 	return tuplehash_to_ctrack(i) != ignored_conntrack
 		&& ip_ct_tuple_equal(tuple, &i->tuple);
 }
 
+/* Under rcu_read_lock.  The conntrack found may be dying: take a reference
+ * with atomic_inc_not_zero() to keep it. */
 struct ip_conntrack_tuple_hash *
 __ip_conntrack_find(const struct ip_conntrack_tuple *tuple,
 		    const struct ip_conntrack *ignored_conntrack)
 {
 	struct ip_conntrack_tuple_hash *h;
-	unsigned int hash = hash_conntrack(tuple);
-
-	ASSERT_READ_LOCK(&ip_conntrack_lock);
-	list_for_each_entry(h, &ip_conntrack_hash[hash], list) {
-		if (conntrack_tuple_cmp(h, tuple, ignored_conntrack)) {
-			CONNTRACK_STAT_INC(found);
-			return h;
+	struct hlist_head *hash;
+	struct hlist_node *n;
+	unsigned int size, seq;
+
+	do {
+		seq = read_seqcount_begin(&ip_conntrack_generation);
+		hash = ip_conntrack_rcu_hash(&size);
+		hash += __hash_conntrack(tuple, size, ip_conntrack_hash_rnd);
+		hlist_for_each_entry_rcu(h, n, hash, hnode) {
+			if (conntrack_tuple_cmp(h, tuple, ignored_conntrack)) {
+				CONNTRACK_STAT_INC(found);
+				return h;
+			}
+			CONNTRACK_STAT_INC(searched);
 		}
-		CONNTRACK_STAT_INC(searched);
-	}
+	} while (read_seqcount_retry(&ip_conntrack_generation, seq));
 
 	return NULL;
 }
@@ -403,36 +561,49 @@ ip_conntrack_find_get(const struct ip_conntrack_tuple *tuple,
 {
 	struct ip_conntrack_tuple_hash *h;
 
-	read_lock_bh(&ip_conntrack_lock);
+	rcu_read_lock();
 	h = __ip_conntrack_find(tuple, ignored_conntrack);
-	if (h)
-		atomic_inc(&tuplehash_to_ctrack(h)->ct_general.use);
-	read_unlock_bh(&ip_conntrack_lock);
+	if (h && !atomic_inc_not_zero(&tuplehash_to_ctrack(h)->ct_general.use))
+		h = NULL;
+	rcu_read_unlock();
 
 	return h;
 }
 
+/* With both buckets locked */
 static void __ip_conntrack_hash_insert(struct ip_conntrack *ct,
 					unsigned int hash,
 					unsigned int repl_hash) 
 {
-	ct->id = ++ip_conntrack_next_id;
-	list_prepend(&ip_conntrack_hash[hash],
-		     &ct->tuplehash[IP_CT_DIR_ORIGINAL].list);
-	list_prepend(&ip_conntrack_hash[repl_hash],
-		     &ct->tuplehash[IP_CT_DIR_REPLY].list);
+	ct->id = atomic_inc_return(&ip_conntrack_next_id);
+	hlist_add_head_rcu(&ct->tuplehash[IP_CT_DIR_ORIGINAL].hnode,
+			   &ip_conntrack_hash[hash]);
+	hlist_add_head_rcu(&ct->tuplehash[IP_CT_DIR_REPLY].hnode,
+			   &ip_conntrack_hash[repl_hash]);
 }
 
 void ip_conntrack_hash_insert(struct ip_conntrack *ct)
 {
 	unsigned int hash, repl_hash;
 
-	hash = hash_conntrack(&ct->tuplehash[IP_CT_DIR_ORIGINAL].tuple);
-	repl_hash = hash_conntrack(&ct->tuplehash[IP_CT_DIR_REPLY].tuple);
-
-	write_lock_bh(&ip_conntrack_lock);
+	local_bh_disable();
+	ip_ct_lock_hashes(ct, &hash, &repl_hash);
 	__ip_conntrack_hash_insert(ct, hash, repl_hash);
-	write_unlock_bh(&ip_conntrack_lock);
+	ip_ct_double_unlock(hash, repl_hash);
+	local_bh_enable();
+}
+
+/* Is the tuple in the bucket, which is locked? */
+static int ip_ct_bucket_has(unsigned int hash,
+			    const struct ip_conntrack_tuple *tuple)
+{
+	struct ip_conntrack_tuple_hash *h;
+	struct hlist_node *n;
+
+	hlist_for_each_entry(h, n, &ip_conntrack_hash[hash], hnode)
+		if (ip_ct_tuple_equal(tuple, &h->tuple))
+			return 1;
+	return 0;
 }
 
 /* Confirm a connection given skb; places it in hash table */
@@ -452,9 +623,6 @@ __ip_conntrack_confirm(struct sk_buff **pskb)
 	if (CTINFO2DIR(ctinfo) != IP_CT_DIR_ORIGINAL)
 		return NF_ACCEPT;
 
-	hash = hash_conntrack(&ct->tuplehash[IP_CT_DIR_ORIGINAL].tuple);
-	repl_hash = hash_conntrack(&ct->tuplehash[IP_CT_DIR_REPLY].tuple);
-
 	/* We're not in hash table, and we refuse to set up related
 	   connections for unconfirmed conns.  But packet copies and
 	   REJECT will give spurious warnings here. */
@@ -465,23 +633,19 @@ __ip_conntrack_confirm(struct sk_buff **pskb)
 	IP_NF_ASSERT(!is_confirmed(ct));
 	DEBUGP("Confirming conntrack %p\n", ct);
 
-	write_lock_bh(&ip_conntrack_lock);
+	local_bh_disable();
+	ip_ct_lock_hashes(ct, &hash, &repl_hash);
 
 	/* See if there's one in the list already, including reverse:
            NAT could have grabbed it without realizing, since we're
            not in the hash.  If there is, we lost race. */
-	if (!LIST_FIND(&ip_conntrack_hash[hash],
-		       conntrack_tuple_cmp,
-		       struct ip_conntrack_tuple_hash *,
-		       &ct->tuplehash[IP_CT_DIR_ORIGINAL].tuple, NULL)
-	    && !LIST_FIND(&ip_conntrack_hash[repl_hash],
-			  conntrack_tuple_cmp,
-			  struct ip_conntrack_tuple_hash *,
-			  &ct->tuplehash[IP_CT_DIR_REPLY].tuple, NULL)) {
-		/* Remove from unconfirmed list */
-		list_del(&ct->tuplehash[IP_CT_DIR_ORIGINAL].list);
+	if (!ip_ct_bucket_has(hash, &ct->tuplehash[IP_CT_DIR_ORIGINAL].tuple)
+	    && !ip_ct_bucket_has(repl_hash,
+				 &ct->tuplehash[IP_CT_DIR_REPLY].tuple)) {
+		/* Remove from unconfirmed list; the walkers look there
+		   before the hash, and wait for our buckets. */
+		ip_ct_unconfirmed_del(ct);
 
-		__ip_conntrack_hash_insert(ct, hash, repl_hash);
 		/* Timer relative to confirmation time, not original
 		   setting time, otherwise we'd get timer wrap in
 		   weird delay cases. */
@@ -489,8 +653,11 @@ __ip_conntrack_confirm(struct sk_buff **pskb)
 		add_timer(&ct->timeout);
 		atomic_inc(&ct->ct_general.use);
 		set_bit(IPS_CONFIRMED_BIT, &ct->status);
+		/* Complete before lockless lookups can see it */
+		__ip_conntrack_hash_insert(ct, hash, repl_hash);
 		CONNTRACK_STAT_INC(insert);
-		write_unlock_bh(&ip_conntrack_lock);
+		ip_ct_double_unlock(hash, repl_hash);
+		local_bh_enable();
 		if (ct->helper)
 			ip_conntrack_event_cache(IPCT_HELPER, *pskb);
 #ifdef CONFIG_IP_NF_NAT_NEEDED
@@ -505,7 +672,8 @@ __ip_conntrack_confirm(struct sk_buff **pskb)
 	}
 
 	CONNTRACK_STAT_INC(insert_failed);
-	write_unlock_bh(&ip_conntrack_lock);
+	ip_ct_double_unlock(hash, repl_hash);
+	local_bh_enable();
 
 	return NF_DROP;
 }
@@ -518,9 +686,9 @@ ip_conntrack_tuple_taken(const struct ip_conntrack_tuple *tuple,
 {
 	struct ip_conntrack_tuple_hash *h;
 
-	read_lock_bh(&ip_conntrack_lock);
+	rcu_read_lock();
 	h = __ip_conntrack_find(tuple, ignored_conntrack);
-	read_unlock_bh(&ip_conntrack_lock);
+	rcu_read_unlock();
 
 	return h != NULL;
 }
@@ -532,20 +700,25 @@ static inline int unreplied(const struct ip_conntrack_tuple_hash *i)
 	return !(test_bit(IPS_ASSURED_BIT, &tuplehash_to_ctrack(i)->status));
 }
 
-static int early_drop(struct list_head *chain)
+static int early_drop(const struct ip_conntrack_tuple *tuple)
 {
-	/* Traverse backwards: gives us oldest, which is roughly LRU */
 	struct ip_conntrack_tuple_hash *h;
 	struct ip_conntrack *ct = NULL;
+	struct hlist_head *hash;
+	struct hlist_node *n;
+	unsigned int size;
 	int dropped = 0;
 
-	read_lock_bh(&ip_conntrack_lock);
-	h = LIST_FIND_B(chain, unreplied, struct ip_conntrack_tuple_hash *);
-	if (h) {
-		ct = tuplehash_to_ctrack(h);
-		atomic_inc(&ct->ct_general.use);
-	}
-	read_unlock_bh(&ip_conntrack_lock);
+	rcu_read_lock();
+	hash = ip_conntrack_rcu_hash(&size);
+	hash += __hash_conntrack(tuple, size, ip_conntrack_hash_rnd);
+	/* Newest first: the last one is the oldest, which is roughly LRU */
+	hlist_for_each_entry_rcu(h, n, hash, hnode)
+		if (unreplied(h))
+			ct = tuplehash_to_ctrack(h);
+	if (ct && !atomic_inc_not_zero(&ct->ct_general.use))
+		ct = NULL;
+	rcu_read_unlock();
 
 	if (!ct)
 		return dropped;
@@ -630,6 +803,33 @@ void ip_conntrack_proto_put(struct ip_conntrack_protocol *p)
 	module_put(p->me);
 }
 
+static void ip_conntrack_count_add(int n)
+{
+	unsigned long flags;
+	int *delta;
+
+	/* conntracks are put from any context */
+	local_irq_save(flags);
+	delta = &__get_cpu_var(ip_conntrack_count_delta);
+	*delta += n;
+	if (*delta >= IP_CT_COUNT_BATCH || *delta <= -IP_CT_COUNT_BATCH) {
+		atomic_add(*delta, &ip_conntrack_count_global);
+		*delta = 0;
+	}
+	local_irq_restore(flags);
+}
+
+/* The exact number of conntracks, for /proc and sysctl */
+unsigned int ip_conntrack_count(void)
+{
+	int count = atomic_read(&ip_conntrack_count_global);
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		count += per_cpu(ip_conntrack_count_delta, cpu);
+	return count < 0 ? 0 : count;
+}
+
 struct ip_conntrack *ip_conntrack_alloc(struct ip_conntrack_tuple *orig,
 					struct ip_conntrack_tuple *repl)
 {
@@ -641,10 +841,9 @@ struct ip_conntrack *ip_conntrack_alloc(struct ip_conntrack_tuple *orig,
 	}
 
 	if (ip_conntrack_max
-	    && atomic_read(&ip_conntrack_count) >= ip_conntrack_max) {
-		unsigned int hash = hash_conntrack(orig);
+	    && atomic_read(&ip_conntrack_count_global) >= ip_conntrack_max) {
 		/* Try dropping from this hash chain. */
-		if (!early_drop(&ip_conntrack_hash[hash])) {
+		if (!early_drop(orig)) {
 			if (net_ratelimit())
 				printk(KERN_WARNING
 				       "ip_conntrack: table full, dropping"
@@ -660,6 +859,7 @@ struct ip_conntrack *ip_conntrack_alloc(struct ip_conntrack_tuple *orig,
 	}
 
 	memset(conntrack, 0, sizeof(*conntrack));
+	spin_lock_init(&conntrack->lock);
 	atomic_set(&conntrack->ct_general.use, 1);
 	conntrack->ct_general.destroy = destroy_conntrack;
 	conntrack->tuplehash[IP_CT_DIR_ORIGINAL].tuple = *orig;
@@ -669,16 +869,23 @@ struct ip_conntrack *ip_conntrack_alloc(struct ip_conntrack_tuple *orig,
 	conntrack->timeout.data = (unsigned long)conntrack;
 	conntrack->timeout.function = death_by_timeout;
 
-	atomic_inc(&ip_conntrack_count);
+	ip_conntrack_count_add(1);
 
 	return conntrack;
 }
 
+static void ip_conntrack_free_rcu(struct rcu_head *head)
+{
+	struct ip_conntrack *ct = container_of(head, struct ip_conntrack, rcu);
+
+	kmem_cache_free(ip_conntrack_cachep, ct);
+}
+
 void
 ip_conntrack_free(struct ip_conntrack *conntrack)
 {
-	atomic_dec(&ip_conntrack_count);
-	kmem_cache_free(ip_conntrack_cachep, conntrack);
+	ip_conntrack_count_add(-1);
+	call_rcu(&conntrack->rcu, ip_conntrack_free_rcu);
 }
 
 /* Allocate a new conntrack: we return -ENOMEM if classification
@@ -691,6 +898,7 @@ init_conntrack(struct ip_conntrack_tuple *tuple,
 	struct ip_conntrack *conntrack;
 	struct ip_conntrack_tuple repl_tuple;
 	struct ip_conntrack_expect *exp;
+	int expecting;
 
 	if (!ip_ct_invert_tuple(&repl_tuple, tuple, protocol)) {
 		DEBUGP("Can't invert tuple.\n");
@@ -706,8 +914,16 @@ init_conntrack(struct ip_conntrack_tuple *tuple,
 		return NULL;
 	}
 
-	write_lock_bh(&ip_conntrack_lock);
-	exp = find_expectation(tuple);
+	/* Most connections are not expected: only take the lock for
+	 * writing when there are expectations to look through. */
+	expecting = !list_empty(&ip_conntrack_expect_list);
+	if (expecting) {
+		write_lock_bh(&ip_conntrack_lock);
+		exp = find_expectation(tuple);
+	} else {
+		read_lock_bh(&ip_conntrack_lock);
+		exp = NULL;
+	}
 
 	if (exp) {
 		DEBUGP("conntrack: expectation arrives ct=%p exp=%p\n",
@@ -734,10 +950,13 @@ init_conntrack(struct ip_conntrack_tuple *tuple,
 		CONNTRACK_STAT_INC(new);
 	}
 
-	/* Overload tuple linked list to put us in unconfirmed list. */
-	list_add(&conntrack->tuplehash[IP_CT_DIR_ORIGINAL].list, &unconfirmed);
+	if (expecting)
+		write_unlock_bh(&ip_conntrack_lock);
+	else
+		read_unlock_bh(&ip_conntrack_lock);
 
-	write_unlock_bh(&ip_conntrack_lock);
+	/* Overload tuple linked list to put us in unconfirmed list. */
+	ip_ct_unconfirmed_add(conntrack);
 
 	if (exp) {
 		if (exp->expectfn)
@@ -1045,7 +1264,8 @@ out:
 void ip_conntrack_alter_reply(struct ip_conntrack *conntrack,
 			      const struct ip_conntrack_tuple *newreply)
 {
-	write_lock_bh(&ip_conntrack_lock);
+	/* Only the helpers list needs the lock, the conntrack is ours */
+	read_lock_bh(&ip_conntrack_lock);
 	/* Should be unconfirmed, so not in hash table yet */
 	IP_NF_ASSERT(!is_confirmed(conntrack));
 
@@ -1055,7 +1275,7 @@ void ip_conntrack_alter_reply(struct ip_conntrack *conntrack,
 	conntrack->tuplehash[IP_CT_DIR_REPLY].tuple = *newreply;
 	if (!conntrack->master && conntrack->expecting == 0)
 		conntrack->helper = __ip_conntrack_helper_find(newreply);
-	write_unlock_bh(&ip_conntrack_lock);
+	read_unlock_bh(&ip_conntrack_lock);
 }
 
 int ip_conntrack_helper_register(struct ip_conntrack_helper *me)
@@ -1091,9 +1311,20 @@ static inline int unhelp(struct ip_conntrack_tuple_hash *i,
 	return 0;
 }
 
+static void unhelp_chain(struct hlist_head *chain,
+			 const struct ip_conntrack_helper *me)
+{
+	struct ip_conntrack_tuple_hash *h;
+	struct hlist_node *n;
+
+	hlist_for_each_entry(h, n, chain, hnode)
+		unhelp(h, me);
+}
+
 void ip_conntrack_helper_unregister(struct ip_conntrack_helper *me)
 {
 	unsigned int i;
+	int cpu;
 	struct ip_conntrack_expect *exp, *tmp;
 
 	/* Need write lock here, to delete helper. */
@@ -1107,11 +1338,19 @@ void ip_conntrack_helper_unregister(struct ip_conntrack_helper *me)
 			ip_conntrack_expect_put(exp);
 		}
 	}
-	/* Get rid of expecteds, set helpers to NULL. */
-	LIST_FIND_W(&unconfirmed, unhelp, struct ip_conntrack_tuple_hash*, me);
+	/* Get rid of expecteds, set helpers to NULL.  The unconfirmed
+	 * first: a conntrack leaves them only for the hash. */
+	for_each_possible_cpu(cpu) {
+		struct ip_ct_unconfirmed *uc = &per_cpu(ip_ct_unconfirmed, cpu);
+
+		spin_lock(&uc->lock);
+		unhelp_chain(&uc->list, me);
+		spin_unlock(&uc->lock);
+	}
+	ip_ct_all_lock();
 	for (i = 0; i < ip_conntrack_htable_size; i++)
-		LIST_FIND_W(&ip_conntrack_hash[i], unhelp,
-			    struct ip_conntrack_tuple_hash *, me);
+		unhelp_chain(&ip_conntrack_hash[i], me);
+	ip_ct_all_unlock();
 	write_unlock_bh(&ip_conntrack_lock);
 
 	/* Someone could be still looking at the helper in a bh. */
@@ -1130,22 +1369,26 @@ void __ip_ct_refresh_acct(struct ip_conntrack *ct,
 	IP_NF_ASSERT(ct->timeout.data == (unsigned long)ct);
 	IP_NF_ASSERT(skb);
 
-	write_lock_bh(&ip_conntrack_lock);
-
 	/* Only update if this is not a fixed timeout */
-	if (test_bit(IPS_FIXED_TIMEOUT_BIT, &ct->status)) {
-		write_unlock_bh(&ip_conntrack_lock);
+	if (test_bit(IPS_FIXED_TIMEOUT_BIT, &ct->status))
 		return;
-	}
+
+	spin_lock_bh(&ct->lock);
 
 	/* If not in hash table, timer will not be active yet */
 	if (!is_confirmed(ct)) {
 		ct->timeout.expires = extra_jiffies;
 		event = IPCT_REFRESH;
 	} else {
-		/* Need del_timer for race avoidance (may already be dying). */
-		if (del_timer(&ct->timeout)) {
-			ct->timeout.expires = jiffies + extra_jiffies;
+		unsigned long newtime = jiffies + extra_jiffies;
+
+		/* Only move the timer when the new timeout is at least HZ
+		   away from the old one: most packets of a busy connection
+		   then leave the timer alone.  Need del_timer for race
+		   avoidance (may already be dying). */
+		if (newtime - ct->timeout.expires >= HZ
+		    && del_timer(&ct->timeout)) {
+			ct->timeout.expires = newtime;
 			add_timer(&ct->timeout);
 			event = IPCT_REFRESH;
 		}
@@ -1162,7 +1405,7 @@ void __ip_ct_refresh_acct(struct ip_conntrack *ct,
 	}
 #endif
 
-	write_unlock_bh(&ip_conntrack_lock);
+	spin_unlock_bh(&ct->lock);
 
 	/* must be unlocked when calling event cache */
 	if (event)
@@ -1237,12 +1480,21 @@ static void ip_conntrack_attach(struct sk_buff *nskb, struct sk_buff *skb)
 	nf_conntrack_get(nskb->nfct);
 }
 
-static inline int
-do_iter(const struct ip_conntrack_tuple_hash *i,
-	int (*iter)(struct ip_conntrack *i, void *data),
-	void *data)
+/* The first conntrack of the chain @iter picks which we can hold */
+static struct ip_conntrack_tuple_hash *
+find_corpse(struct hlist_head *chain,
+	    int (*iter)(struct ip_conntrack *i, void *data), void *data)
 {
-	return iter(tuplehash_to_ctrack(i), data);
+	struct ip_conntrack_tuple_hash *h;
+	struct hlist_node *n;
+
+	hlist_for_each_entry(h, n, chain, hnode) {
+		struct ip_conntrack *ct = tuplehash_to_ctrack(h);
+
+		if (iter(ct, data) && atomic_inc_not_zero(&ct->ct_general.use))
+			return h;
+	}
+	return NULL;
 }
 
 /* Bring out ya dead! */
@@ -1251,21 +1503,32 @@ get_next_corpse(int (*iter)(struct ip_conntrack *i, void *data),
 		void *data, unsigned int *bucket)
 {
 	struct ip_conntrack_tuple_hash *h = NULL;
+	spinlock_t *lock;
+	int cpu;
 
-	write_lock_bh(&ip_conntrack_lock);
+	local_bh_disable();
 	for (; *bucket < ip_conntrack_htable_size; (*bucket)++) {
-		h = LIST_FIND_W(&ip_conntrack_hash[*bucket], do_iter,
-				struct ip_conntrack_tuple_hash *, iter, data);
+		lock = &ip_conntrack_locks[*bucket % IP_CT_LOCKS];
+		ip_ct_lock(lock);
+		/* the table may have shrunk before we got the lock */
+		if (*bucket < ip_conntrack_htable_size)
+			h = find_corpse(&ip_conntrack_hash[*bucket],
+					iter, data);
+		spin_unlock(lock);
 		if (h)
-			break;
+			goto out;
 	}
-	if (!h)
-		h = LIST_FIND_W(&unconfirmed, do_iter,
-				struct ip_conntrack_tuple_hash *, iter, data);
-	if (h)
-		atomic_inc(&tuplehash_to_ctrack(h)->ct_general.use);
-	write_unlock_bh(&ip_conntrack_lock);
+	for_each_possible_cpu(cpu) {
+		struct ip_ct_unconfirmed *uc = &per_cpu(ip_ct_unconfirmed, cpu);
 
+		spin_lock(&uc->lock);
+		h = find_corpse(&uc->list, iter, data);
+		spin_unlock(&uc->lock);
+		if (h)
+			break;
+	}
+out:
+	local_bh_enable();
 	return h;
 }
 
@@ -1359,13 +1622,13 @@ void ip_conntrack_flush(void)
 	ip_ct_iterate_cleanup(kill_all, NULL);
 }
 
-static void free_conntrack_hash(struct list_head *hash, int vmalloced,int size)
+static void free_conntrack_hash(struct hlist_head *hash, int vmalloced,int size)
 {
 	if (vmalloced)
 		vfree(hash);
 	else
 		free_pages((unsigned long)hash, 
-			   get_order(sizeof(struct list_head) * size));
+			   get_order(sizeof(struct hlist_head) * size));
 }
 
 /* Mishearing the voices in his head, our hero wonders how he's
@@ -1382,7 +1645,7 @@ void ip_conntrack_cleanup(void)
 	ip_ct_event_cache_flush();
  i_see_dead_people:
 	ip_conntrack_flush();
-	if (atomic_read(&ip_conntrack_count) != 0) {
+	if (ip_conntrack_count() != 0) {
 		schedule();
 		goto i_see_dead_people;
 	}
@@ -1390,6 +1653,9 @@ void ip_conntrack_cleanup(void)
 	while (atomic_read(&ip_conntrack_untracked.ct_general.use) > 1)
 		schedule();
 
+	/* and for the conntracks freed after a grace period */
+	rcu_barrier();
+
 	kmem_cache_destroy(ip_conntrack_cachep);
 	kmem_cache_destroy(ip_conntrack_expect_cachep);
 	free_conntrack_hash(ip_conntrack_hash, ip_conntrack_vmalloc,
@@ -1397,24 +1663,24 @@ void ip_conntrack_cleanup(void)
 	nf_unregister_sockopt(&so_getorigdst);
 }
 
-static struct list_head *alloc_hashtable(int size, int *vmalloced)
+static struct hlist_head *alloc_hashtable(int size, int *vmalloced)
 {
-	struct list_head *hash;
+	struct hlist_head *hash;
 	unsigned int i;
 
 	*vmalloced = 0; 
 	hash = (void*)__get_free_pages(GFP_KERNEL, 
-				       get_order(sizeof(struct list_head)
+				       get_order(sizeof(struct hlist_head)
 						 * size));
 	if (!hash) { 
 		*vmalloced = 1;
 		printk(KERN_WARNING"ip_conntrack: falling back to vmalloc.\n");
-		hash = vmalloc(sizeof(struct list_head) * size);
+		hash = vmalloc(sizeof(struct hlist_head) * size);
 	}
 
 	if (hash)
 		for (i = 0; i < size; i++)
-			INIT_LIST_HEAD(&hash[i]);
+			INIT_HLIST_HEAD(&hash[i]);
 
 	return hash;
 }
@@ -1424,7 +1690,7 @@ static int set_hashsize(const char *val, struct kernel_param *kp)
 	int i, bucket, hashsize, vmalloced;
 	int old_vmalloced, old_size;
 	int rnd;
-	struct list_head *hash, *old_hash;
+	struct hlist_head *hash, *old_hash;
 	struct ip_conntrack_tuple_hash *h;
 
 	/* On boot, we can set this without any fancy locking. */
@@ -1443,26 +1709,39 @@ static int set_hashsize(const char *val, struct kernel_param *kp)
 	 * use a new random seed */
 	get_random_bytes(&rnd, 4);
 
-	write_lock_bh(&ip_conntrack_lock);
+	/* Lookups walking a chain which moves end up in the new table,
+	 * miss, and retry once ip_conntrack_generation has settled. */
+	ip_ct_all_lock();
+	write_seqcount_begin(&ip_conntrack_generation);
 	for (i = 0; i < ip_conntrack_htable_size; i++) {
-		while (!list_empty(&ip_conntrack_hash[i])) {
-			h = list_entry(ip_conntrack_hash[i].next,
-				       struct ip_conntrack_tuple_hash, list);
-			list_del(&h->list);
+		while (!hlist_empty(&ip_conntrack_hash[i])) {
+			h = hlist_entry(ip_conntrack_hash[i].first,
+					struct ip_conntrack_tuple_hash, hnode);
+			hlist_del_rcu(&h->hnode);
 			bucket = __hash_conntrack(&h->tuple, hashsize, rnd);
-			list_add_tail(&h->list, &hash[bucket]);
+			hlist_add_head_rcu(&h->hnode, &hash[bucket]);
 		}
 	}
 	old_size = ip_conntrack_htable_size;
 	old_vmalloced = ip_conntrack_vmalloc;
 	old_hash = ip_conntrack_hash;
 
-	ip_conntrack_htable_size = hashsize;
+	/* See ip_conntrack_rcu_hash() */
+	if (hashsize > old_size) {
+		rcu_assign_pointer(ip_conntrack_hash, hash);
+		smp_wmb();
+		ip_conntrack_htable_size = hashsize;
+	} else {
+		ip_conntrack_htable_size = hashsize;
+		smp_wmb();
+		rcu_assign_pointer(ip_conntrack_hash, hash);
+	}
 	ip_conntrack_vmalloc = vmalloced;
-	ip_conntrack_hash = hash;
 	ip_conntrack_hash_rnd = rnd;
-	write_unlock_bh(&ip_conntrack_lock);
+	write_seqcount_end(&ip_conntrack_generation);
+	ip_ct_all_unlock();
 
+	synchronize_rcu();
 	free_conntrack_hash(old_hash, old_vmalloced, old_size);
 	return 0;
 }
@@ -1480,7 +1759,7 @@ int __init ip_conntrack_init(void)
  	if (!ip_conntrack_htable_size) {
 		ip_conntrack_htable_size
 			= (((num_physpages << PAGE_SHIFT) / 16384)
-			   / sizeof(struct list_head));
+			   / sizeof(struct hlist_head));
 		if (num_physpages > (1024 * 1024 * 1024 / PAGE_SIZE))
 			ip_conntrack_htable_size = 8192;
 		if (ip_conntrack_htable_size < 16)
@@ -1522,6 +1801,11 @@ int __init ip_conntrack_init(void)
 		goto err_free_conntrack_slab;
 	}
 
+	for (i = 0; i < IP_CT_LOCKS; i++)
+		spin_lock_init(&ip_conntrack_locks[i]);
+	for_each_possible_cpu(i)
+		spin_lock_init(&per_cpu(ip_ct_unconfirmed, i).lock);
+
 	/* Don't NEED lock here, but good form anyway. */
 	write_lock_bh(&ip_conntrack_lock);
 	for (i = 0; i < MAX_IP_CT_PROTO; i++)
@@ -1538,6 +1822,7 @@ int __init ip_conntrack_init(void)
 	/* Set up fake conntrack:
 	    - to never be deleted, not in any hashes */
 	atomic_set(&ip_conntrack_untracked.ct_general.use, 1);
+	spin_lock_init(&ip_conntrack_untracked.lock);
 	/*  - and look it like as a confirmed connection */
 	set_bit(IPS_CONFIRMED_BIT, &ip_conntrack_untracked.status);
 
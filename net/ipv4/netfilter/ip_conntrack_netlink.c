@@ -409,17 +409,19 @@ ctnetlink_dump_table(struct sk_buff *skb, struct netlink_callback *cb)
 {
 	struct ip_conntrack *ct, *last;
 	struct ip_conntrack_tuple_hash *h;
-	struct list_head *i;
+	struct hlist_head *hash;
+	struct hlist_node *i;
+	unsigned int size;
 
 	DEBUGP("entered %s, last bucket=%lu id=%u\n", __FUNCTION__, 
 			cb->args[0], *id);
 
-	read_lock_bh(&ip_conntrack_lock);
+	rcu_read_lock();
+	hash = ip_conntrack_rcu_hash(&size);
 	last = (struct ip_conntrack *)cb->args[1];
-	for (; cb->args[0] < ip_conntrack_htable_size; cb->args[0]++) {
+	for (; cb->args[0] < size; cb->args[0]++) {
 restart:
-		list_for_each_prev(i, &ip_conntrack_hash[cb->args[0]]) {
-			h = (struct ip_conntrack_tuple_hash *) i;
+		hlist_for_each_entry_rcu(h, i, &hash[cb->args[0]], hnode) {
 			if (DIRECTION(h) != IP_CT_DIR_ORIGINAL)
 				continue;
 			ct = tuplehash_to_ctrack(h);
@@ -432,8 +434,10 @@ restart:
 		                        	cb->nlh->nlmsg_seq,
 						IPCTNL_MSG_CT_NEW,
 						1, ct) < 0) {
-				nf_conntrack_get(&ct->ct_general);
-				cb->args[1] = (unsigned long)ct;
+				/* a dying one can't mark where to resume:
+				   the bucket is dumped again */
+				if (atomic_inc_not_zero(&ct->ct_general.use))
+					cb->args[1] = (unsigned long)ct;
 				goto out;
 			}
 		}
@@ -443,7 +447,7 @@ restart:
 		}
 	}
 out:
-	read_unlock_bh(&ip_conntrack_lock);
+	rcu_read_unlock();
 	if (last)
 		ip_conntrack_put(last);
 
@@ -457,16 +461,18 @@ ctnetlink_dump_table_w(struct sk_buff *skb, struct netlink_callback *cb)
 {
 	struct ip_conntrack *ct = NULL;
 	struct ip_conntrack_tuple_hash *h;
-	struct list_head *i;
+	struct hlist_head *hash;
+	struct hlist_node *i;
+	unsigned int size;
 	u_int32_t *id = (u_int32_t *) &cb->args[1];
 
 	DEBUGP("entered %s, last bucket=%u id=%u\n", __FUNCTION__, 
 			cb->args[0], *id);
 
-	write_lock_bh(&ip_conntrack_lock);
-	for (; cb->args[0] < ip_conntrack_htable_size; cb->args[0]++, *id = 0) {
-		list_for_each_prev(i, &ip_conntrack_hash[cb->args[0]]) {
-			h = (struct ip_conntrack_tuple_hash *) i;
+	rcu_read_lock();
+	hash = ip_conntrack_rcu_hash(&size);
+	for (; cb->args[0] < size; cb->args[0]++, *id = 0) {
+		hlist_for_each_entry_rcu(h, i, &hash[cb->args[0]], hnode) {
 			if (DIRECTION(h) != IP_CT_DIR_ORIGINAL)
 				continue;
 			ct = tuplehash_to_ctrack(h);
@@ -479,11 +485,13 @@ ctnetlink_dump_table_w(struct sk_buff *skb, struct netlink_callback *cb)
 				goto out;
 			*id = ct->id;
 
+			spin_lock_bh(&ct->lock);
 			memset(&ct->counters, 0, sizeof(ct->counters));
+			spin_unlock_bh(&ct->lock);
 		}
 	}
 out:	
-	write_unlock_bh(&ip_conntrack_lock);
+	rcu_read_unlock();
 
 	DEBUGP("leaving, last bucket=%lu id=%u\n", cb->args[0], *id);
 
@@ -1093,14 +1101,12 @@ ctnetlink_new_conntrack(struct sock *ctnl, struct sk_buff *skb,
 			return err;
 	}
 
-	write_lock_bh(&ip_conntrack_lock);
 	if (cda[CTA_TUPLE_ORIG-1])
-		h = __ip_conntrack_find(&otuple, NULL);
+		h = ip_conntrack_find_get(&otuple, NULL);
 	else if (cda[CTA_TUPLE_REPLY-1])
-		h = __ip_conntrack_find(&rtuple, NULL);
+		h = ip_conntrack_find_get(&rtuple, NULL);
 
 	if (h == NULL) {
-		write_unlock_bh(&ip_conntrack_lock);
 		DEBUGP("no such conntrack, create new\n");
 		err = -ENOENT;
 		if (nlh->nlmsg_flags & NLM_F_CREATE)
@@ -1112,18 +1118,21 @@ ctnetlink_new_conntrack(struct sock *ctnl, struct sk_buff *skb,
 	/* we only allow nat config for new conntracks */
 	if (cda[CTA_NAT_SRC-1] || cda[CTA_NAT_DST-1]) {
 		err = -EINVAL;
-		goto out_unlock;
+		goto out_put;
 	}
 
-	/* We manipulate the conntrack inside the global conntrack table lock,
-	 * so there's no need to increase the refcount */
+	/* The lookup is lockless: we hold a reference, and change it under
+	 * the conntrack lock for the helper and the expectations. */
 	DEBUGP("conntrack found\n");
 	err = -EEXIST;
-	if (!(nlh->nlmsg_flags & NLM_F_EXCL))
+	if (!(nlh->nlmsg_flags & NLM_F_EXCL)) {
+		write_lock_bh(&ip_conntrack_lock);
 		err = ctnetlink_change_conntrack(tuplehash_to_ctrack(h), cda);
+		write_unlock_bh(&ip_conntrack_lock);
+	}
 
-out_unlock:
-	write_unlock_bh(&ip_conntrack_lock);
+out_put:
+	ip_conntrack_put(tuplehash_to_ctrack(h));
 	return err;
 }
 
@@ -29,8 +29,13 @@
 #include <linux/proc_fs.h>
 #include <linux/err.h>
 #include <linux/cpumask.h>
+#include <linux/jhash.h>
+#include <linux/sort.h>
+#include <linux/tcp.h>
+#include <linux/udp.h>
 
 #include <linux/netfilter/x_tables.h>
+#include <linux/netfilter/xt_tcpudp.h>
 #include <linux/netfilter_ipv4/ip_tables.h>
 
 MODULE_LICENSE("GPL");
@@ -73,9 +78,11 @@ do {								\
 /*
    We keep a set of rules for each CPU, so we can avoid write-locking
    them in the softirq when updating the counters and therefore
-   only need to read-lock in the softirq; doing a write_lock_bh() in user
-   context stops packets coming through and allows user context to read
-   the counters or update the rules.
+   only need to read-lock in the softirq.  The lock taken is the
+   xt_info_locks of the CPU, not the table lock, so packets on different
+   CPUs share no cache line; user context write-locks each CPU in turn
+   to read the counters, which also waits for packets still walking a
+   table which has just been replaced.
 
    Hence the start of any table is given by get_table() below.  */
 
@@ -211,6 +218,558 @@ get_entry(void *base, unsigned int offset)
 	return (struct ipt_entry *)(base + offset);
 }
 
+#ifdef CONFIG_IP_NF_IPTABLES_CLASSIFY
+/*
+ * Rule-set classifier.
+ *
+ * Tables with many rules are indexed when they are loaded, so that
+ * ipt_do_table() can jump straight to the next rule which can possibly
+ * match a packet instead of testing every rule in turn.
+ *
+ * Each rule goes into one "tuple" according to how much of the source
+ * and destination address it looks at and whether it names a protocol,
+ * or even a single TCP/UDP destination port (only if the tcp or udp
+ * match comes first, so nothing with side effects is skipped).  Every
+ * tuple is a hash of the distinct keys its rules use, each key holding
+ * the ordered list of its rules.  A packet is looked up once in every
+ * tuple, and the next candidate at or after a given rule is the lowest
+ * one of all the lists found.  Rules the index cannot describe (eg.
+ * inverted addresses) simply end up in a wider tuple, so candidates are
+ * always a superset of the matching rules and they are still tested in
+ * full, which keeps the verdicts identical to the linear walk.
+ *
+ * Prefix lengths are rounded down to a few values to keep the number of
+ * tuples, and the per packet work, bounded.
+ */
+#define IPT_CLS_MIN_RULES	64
+#define IPT_CLS_MAX_TUPLES	8
+#define IPT_CLS_NONE		(~0U)
+
+enum ipt_cls_kind {
+	IPT_CLS_ANY,		/* any protocol */
+	IPT_CLS_PROTO,		/* a single protocol */
+	IPT_CLS_PORT,		/* a single TCP/UDP destination port */
+};
+
+struct ipt_cls_key {
+	u_int32_t src;
+	u_int32_t dst;
+	u_int32_t proto_port;
+};
+
+struct ipt_cls_bucket {
+	struct ipt_cls_key key;
+	unsigned int next;		/* on the hash chain */
+	unsigned int first;		/* rules, in ipt_cls.rules */
+	unsigned int count;
+};
+
+struct ipt_cls_tuple {
+	u_int32_t smsk, dmsk;
+	unsigned char slen, dlen, kind;
+	unsigned int hash_mask;
+	unsigned int *hash;		/* first bucket of each chain */
+	unsigned int all_first;		/* all rules, for PORT with no port */
+	unsigned int all_count;
+};
+
+struct ipt_cls {
+	unsigned int number;
+	unsigned int *offsets;		/* entry offset of each rule */
+	unsigned int num_tuples;
+	struct ipt_cls_tuple tuple[IPT_CLS_MAX_TUPLES];
+	struct ipt_cls_bucket *buckets;
+	unsigned int *heads;
+	unsigned int *rules;
+};
+
+/* Per packet state of ipt_do_table() */
+struct ipt_cls_cursor {
+	const unsigned int *rules;
+	unsigned int pos, count;
+};
+
+struct ipt_cls_state {
+	unsigned int ord;
+	struct ipt_cls_cursor cur[IPT_CLS_MAX_TUPLES];
+};
+
+static inline u_int32_t ipt_cls_mask(unsigned int len)
+{
+	return len ? htonl(~0U << (32 - len)) : 0;
+}
+
+static inline unsigned int
+ipt_cls_hash(const struct ipt_cls_key *key, const struct ipt_cls_tuple *t)
+{
+	return jhash_3words(key->src, key->dst, key->proto_port, 0)
+		& t->hash_mask;
+}
+
+static const struct ipt_cls_bucket *
+ipt_cls_find(const struct ipt_cls *cls, const struct ipt_cls_tuple *t,
+	     const struct ipt_cls_key *key)
+{
+	unsigned int b = t->hash[ipt_cls_hash(key, t)];
+
+	while (b != IPT_CLS_NONE) {
+		const struct ipt_cls_bucket *bucket = &cls->buckets[b];
+
+		if (bucket->key.src == key->src
+		    && bucket->key.dst == key->dst
+		    && bucket->key.proto_port == key->proto_port)
+			return bucket;
+		b = bucket->next;
+	}
+	return NULL;
+}
+
+/* Find the rule lists of every tuple for this packet. */
+static void
+ipt_cls_lookup(struct ipt_cls_state *st, const struct ipt_cls *cls,
+	       const struct sk_buff *skb, const struct iphdr *ip, int offset)
+{
+	unsigned int i, port = 0;
+	int port_known = 0;
+
+	/* Only when the tcp/udp match could test it without dropping */
+	if (!offset && ip->protocol == IPPROTO_TCP) {
+		struct tcphdr _tcph, *th;
+
+		th = skb_header_pointer(skb, ip->ihl*4, sizeof(_tcph), &_tcph);
+		if (th) {
+			port = ntohs(th->dest);
+			port_known = 1;
+		}
+	} else if (!offset && ip->protocol == IPPROTO_UDP) {
+		struct udphdr _udph, *uh;
+
+		uh = skb_header_pointer(skb, ip->ihl*4, sizeof(_udph), &_udph);
+		if (uh) {
+			port = ntohs(uh->dest);
+			port_known = 1;
+		}
+	}
+
+	st->ord = 0;
+	for (i = 0; i < cls->num_tuples; i++) {
+		const struct ipt_cls_tuple *t = &cls->tuple[i];
+		struct ipt_cls_cursor *cur = &st->cur[i];
+		const struct ipt_cls_bucket *bucket;
+		struct ipt_cls_key key;
+
+		key.src = ip->saddr & t->smsk;
+		key.dst = ip->daddr & t->dmsk;
+		switch (t->kind) {
+		case IPT_CLS_PROTO:
+			key.proto_port = ip->protocol << 16;
+			break;
+		case IPT_CLS_PORT:
+			if ((ip->protocol == IPPROTO_TCP
+			     || ip->protocol == IPPROTO_UDP) && !port_known) {
+				cur->rules = &cls->rules[t->all_first];
+				cur->count = t->all_count;
+				cur->pos = 0;
+				continue;
+			}
+			key.proto_port = (ip->protocol << 16) | port;
+			break;
+		default:
+			key.proto_port = 0;
+			break;
+		}
+
+		bucket = ipt_cls_find(cls, t, &key);
+		if (bucket) {
+			cur->rules = &cls->rules[bucket->first];
+			cur->count = bucket->count;
+		} else
+			cur->count = 0;
+		cur->pos = 0;
+	}
+}
+
+/* Returns the first candidate rule at or after e. */
+static struct ipt_entry *
+ipt_cls_next(struct ipt_cls_state *st, const struct ipt_cls *cls,
+	     void *table_base, struct ipt_entry *e)
+{
+	unsigned int off = (void *)e - table_base;
+	unsigned int ord = st->ord + 1, best = IPT_CLS_NONE;
+	unsigned int i;
+
+	/* Usually we just moved on to the next rule */
+	if (ord >= cls->number || cls->offsets[ord] != off) {
+		unsigned int lo = 0, hi = cls->number;
+
+		while (lo < hi) {
+			unsigned int mid = (lo + hi) / 2;
+
+			if (cls->offsets[mid] < off)
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+		ord = lo;
+		if (ord >= cls->number || cls->offsets[ord] != off)
+			return e;
+	}
+
+	for (i = 0; i < cls->num_tuples; i++) {
+		struct ipt_cls_cursor *cur = &st->cur[i];
+
+		if ((cur->pos < cur->count && cur->rules[cur->pos] < ord)
+		    || (cur->pos > 0 && cur->rules[cur->pos - 1] >= ord)) {
+			unsigned int lo = 0, hi = cur->count;
+
+			while (lo < hi) {
+				unsigned int mid = (lo + hi) / 2;
+
+				if (cur->rules[mid] < ord)
+					lo = mid + 1;
+				else
+					hi = mid;
+			}
+			cur->pos = lo;
+		}
+		if (cur->pos < cur->count && cur->rules[cur->pos] < best)
+			best = cur->rules[cur->pos];
+	}
+
+	if (best == IPT_CLS_NONE) {
+		st->ord = ord;
+		return e;
+	}
+	st->ord = best;
+	return get_entry(table_base, cls->offsets[best]);
+}
+
+/* How a rule can be indexed, filled in by ipt_cls_describe() */
+struct ipt_cls_rule {
+	unsigned int tuple;
+	struct ipt_cls_key key;
+	unsigned int ord;
+	unsigned char slen, dlen, kind;
+	u_int32_t src, dst, proto_port;
+};
+
+static unsigned int ipt_cls_prefix(u_int32_t mask)
+{
+	u_int32_t m = ntohl(mask);
+	unsigned int len = 0;
+
+	while (len < 32 && (m & (0x80000000U >> len)))
+		len++;
+	return len;
+}
+
+static void
+ipt_cls_describe(struct ipt_cls_rule *r, const struct ipt_entry *e)
+{
+	const struct ipt_ip *ipinfo = &e->ip;
+	const struct ipt_entry_match *m = (void *)e->elems;
+
+	if (ipinfo->invflags & IPT_INV_SRCIP)
+		r->slen = 0;
+	else
+		r->slen = ipt_cls_prefix(ipinfo->smsk.s_addr);
+	r->src = ipinfo->src.s_addr;
+
+	if (ipinfo->invflags & IPT_INV_DSTIP)
+		r->dlen = 0;
+	else
+		r->dlen = ipt_cls_prefix(ipinfo->dmsk.s_addr);
+	r->dst = ipinfo->dst.s_addr;
+
+	r->kind = IPT_CLS_ANY;
+	r->proto_port = 0;
+	if (!ipinfo->proto || (ipinfo->invflags & IPT_INV_PROTO))
+		return;
+
+	r->kind = IPT_CLS_PROTO;
+	r->proto_port = ipinfo->proto << 16;
+
+	/* The first match must be the one testing the port */
+	if (e->target_offset == sizeof(struct ipt_entry))
+		return;
+	if (ipinfo->proto == IPPROTO_TCP
+	    && strcmp(m->u.kernel.match->name, "tcp") == 0) {
+		const struct xt_tcp *tcpinfo = (void *)m->data;
+
+		if (tcpinfo->dpts[0] == tcpinfo->dpts[1]
+		    && !(tcpinfo->invflags & XT_TCP_INV_DSTPT)) {
+			r->kind = IPT_CLS_PORT;
+			r->proto_port |= tcpinfo->dpts[0];
+		}
+	} else if (ipinfo->proto == IPPROTO_UDP
+		   && strcmp(m->u.kernel.match->name, "udp") == 0) {
+		const struct xt_udp *udpinfo = (void *)m->data;
+
+		if (udpinfo->dpts[0] == udpinfo->dpts[1]
+		    && !(udpinfo->invflags & XT_UDP_INV_DSTPT)) {
+			r->kind = IPT_CLS_PORT;
+			r->proto_port |= udpinfo->dpts[0];
+		}
+	}
+}
+
+/* Prefix lengths the tuples use, from finest to coarsest */
+static const unsigned char ipt_cls_levels[][6] = {
+	{ 32, 24, 16, 8, 0 },
+	{ 32, 24, 16, 0 },
+	{ 32, 24, 0 },
+	{ 32, 0 },
+	{ 0 },
+};
+
+static unsigned char ipt_cls_round(unsigned int len, const unsigned char *lvl)
+{
+	while (*lvl > len)
+		lvl++;
+	return *lvl;
+}
+
+/*
+ * Put the rules into tuples at the given precision; returns the number
+ * of tuples, or 0 if there would be too many.
+ */
+static unsigned int
+ipt_cls_assign(struct ipt_cls *cls, struct ipt_cls_rule *rules,
+	       unsigned int n, const unsigned char *lvl, unsigned int max_kind)
+{
+	unsigned int i, j, num = 0;
+
+	for (i = 0; i < n; i++) {
+		struct ipt_cls_rule *r = &rules[i];
+		unsigned char slen = ipt_cls_round(r->slen, lvl);
+		unsigned char dlen = ipt_cls_round(r->dlen, lvl);
+		unsigned char kind = min_t(unsigned int, r->kind, max_kind);
+
+		for (j = 0; j < num; j++)
+			if (cls->tuple[j].slen == slen
+			    && cls->tuple[j].dlen == dlen
+			    && cls->tuple[j].kind == kind)
+				break;
+		if (j == num) {
+			if (num == IPT_CLS_MAX_TUPLES)
+				return 0;
+			cls->tuple[num].slen = slen;
+			cls->tuple[num].dlen = dlen;
+			cls->tuple[num].kind = kind;
+			cls->tuple[num].smsk = ipt_cls_mask(slen);
+			cls->tuple[num].dmsk = ipt_cls_mask(dlen);
+			num++;
+		}
+
+		r->tuple = j;
+		r->key.src = r->src & cls->tuple[j].smsk;
+		r->key.dst = r->dst & cls->tuple[j].dmsk;
+		if (kind == IPT_CLS_ANY)
+			r->key.proto_port = 0;
+		else if (kind == IPT_CLS_PROTO)
+			r->key.proto_port = r->proto_port & 0xffff0000;
+		else
+			r->key.proto_port = r->proto_port;
+	}
+	return num;
+}
+
+static int ipt_cls_rule_cmp(const void *a, const void *b)
+{
+	const struct ipt_cls_rule *x = a, *y = b;
+
+	if (x->tuple != y->tuple)
+		return x->tuple < y->tuple ? -1 : 1;
+	if (x->key.src != y->key.src)
+		return x->key.src < y->key.src ? -1 : 1;
+	if (x->key.dst != y->key.dst)
+		return x->key.dst < y->key.dst ? -1 : 1;
+	if (x->key.proto_port != y->key.proto_port)
+		return x->key.proto_port < y->key.proto_port ? -1 : 1;
+	if (x->ord != y->ord)
+		return x->ord < y->ord ? -1 : 1;
+	return 0;
+}
+
+static int ipt_cls_ord_cmp(const void *a, const void *b)
+{
+	const unsigned int *x = a, *y = b;
+
+	return *x < *y ? -1 : *x > *y;
+}
+
+static void ipt_cls_free(struct ipt_cls *cls)
+{
+	if (!cls)
+		return;
+	vfree(cls->offsets);
+	vfree(cls->buckets);
+	vfree(cls->heads);
+	vfree(cls->rules);
+	kfree(cls);
+}
+
+static int
+ipt_cls_fill(struct ipt_cls *cls, struct ipt_cls_rule *rules, unsigned int n)
+{
+	unsigned int keys[IPT_CLS_MAX_TUPLES] = { 0 };
+	unsigned int i, t, b, nb = 0, nr = 0, nheads = 0;
+
+	sort(rules, n, sizeof(*rules), ipt_cls_rule_cmp, NULL);
+
+	/* One bucket per distinct key, at most one per rule */
+	cls->buckets = vmalloc(n * sizeof(struct ipt_cls_bucket));
+	cls->rules = vmalloc(2 * n * sizeof(unsigned int));
+	if (!cls->buckets || !cls->rules)
+		return -ENOMEM;
+
+	/* The first n entries of cls->rules are in the order of rules[] */
+	for (i = 0; i < n; i++) {
+		if (i == 0 || rules[i - 1].tuple != rules[i].tuple
+		    || memcmp(&rules[i - 1].key, &rules[i].key,
+			      sizeof(struct ipt_cls_key)) != 0) {
+			cls->buckets[nb].key = rules[i].key;
+			cls->buckets[nb].first = nr;
+			cls->buckets[nb].count = 0;
+			keys[rules[i].tuple]++;
+			nb++;
+		}
+		cls->rules[nr++] = rules[i].ord;
+		cls->buckets[nb - 1].count++;
+	}
+
+	/* PORT tuples also keep all their rules, for packets with no port */
+	for (t = 0; t < cls->num_tuples; t++) {
+		struct ipt_cls_tuple *tuple = &cls->tuple[t];
+
+		tuple->all_first = nr;
+		tuple->all_count = 0;
+		if (tuple->kind != IPT_CLS_PORT)
+			continue;
+		for (i = 0; i < n; i++)
+			if (rules[i].tuple == t)
+				cls->rules[nr + tuple->all_count++] = rules[i].ord;
+		sort(&cls->rules[nr], tuple->all_count, sizeof(unsigned int),
+		     ipt_cls_ord_cmp, NULL);
+		nr += tuple->all_count;
+	}
+
+	/* Size every hash table to the number of keys in its tuple */
+	for (t = 0; t < cls->num_tuples; t++) {
+		cls->tuple[t].hash_mask = roundup_pow_of_two(keys[t] ? : 1) - 1;
+		nheads += cls->tuple[t].hash_mask + 1;
+	}
+
+	cls->heads = vmalloc(nheads * sizeof(unsigned int));
+	if (!cls->heads)
+		return -ENOMEM;
+	memset(cls->heads, 0xff, nheads * sizeof(unsigned int));
+
+	for (t = 0, i = 0; t < cls->num_tuples; t++) {
+		cls->tuple[t].hash = &cls->heads[i];
+		i += cls->tuple[t].hash_mask + 1;
+	}
+
+	for (b = 0; b < nb; b++) {
+		struct ipt_cls_bucket *bucket = &cls->buckets[b];
+		struct ipt_cls_tuple *tuple;
+		unsigned int h;
+
+		tuple = &cls->tuple[rules[bucket->first].tuple];
+		h = ipt_cls_hash(&bucket->key, tuple);
+		bucket->next = tuple->hash[h];
+		tuple->hash[h] = b;
+	}
+	return 0;
+}
+
+/* Build the classifier of a translated table, NULL if not worth it. */
+static struct ipt_cls *
+ipt_cls_build(const struct xt_table_info *info, void *entry0)
+{
+	struct ipt_cls_rule *rules;
+	struct ipt_cls *cls;
+	unsigned int i, off, lvl, kind, num = 0;
+
+	if (info->number < IPT_CLS_MIN_RULES)
+		return NULL;
+
+	cls = kzalloc(sizeof(*cls), GFP_KERNEL);
+	if (!cls)
+		return NULL;
+	cls->number = info->number;
+	cls->offsets = vmalloc(info->number * sizeof(unsigned int));
+	rules = vmalloc(info->number * sizeof(*rules));
+	if (!cls->offsets || !rules)
+		goto fail;
+
+	for (i = 0, off = 0; i < info->number; i++) {
+		struct ipt_entry *e = get_entry(entry0, off);
+
+		cls->offsets[i] = off;
+		rules[i].ord = i;
+		ipt_cls_describe(&rules[i], e);
+		off += e->next_offset;
+	}
+
+	/*
+	 * Give up address precision before ports, they select best.  The
+	 * last attempt puts everything into one tuple, so it always fits.
+	 */
+	for (kind = IPT_CLS_PORT; ; kind--) {
+		for (lvl = 0; lvl < ARRAY_SIZE(ipt_cls_levels) && !num; lvl++)
+			num = ipt_cls_assign(cls, rules, info->number,
+					     ipt_cls_levels[lvl], kind);
+		if (num || kind == IPT_CLS_ANY)
+			break;
+	}
+
+	/* A single wildcard tuple would be the linear walk again */
+	if (num <= 1)
+		goto fail;
+	cls->num_tuples = num;
+
+	if (ipt_cls_fill(cls, rules, info->number) != 0)
+		goto fail;
+
+	vfree(rules);
+	duprintf("ip_tables: classifier with %u tuples for %u rules\n",
+		 num, info->number);
+	return cls;
+
+fail:
+	vfree(rules);
+	ipt_cls_free(cls);
+	return NULL;
+}
+#else
+struct ipt_cls;
+struct ipt_cls_state { };
+
+static inline void
+ipt_cls_lookup(struct ipt_cls_state *st, const struct ipt_cls *cls,
+	       const struct sk_buff *skb, const struct iphdr *ip, int offset)
+{
+}
+
+static inline struct ipt_entry *
+ipt_cls_next(struct ipt_cls_state *st, const struct ipt_cls *cls,
+	     void *table_base, struct ipt_entry *e)
+{
+	return e;
+}
+
+static inline struct ipt_cls *
+ipt_cls_build(const struct xt_table_info *info, void *entry0)
+{
+	return NULL;
+}
+
+static inline void ipt_cls_free(struct ipt_cls *cls)
+{
+}
+#endif /* CONFIG_IP_NF_IPTABLES_CLASSIFY */
+
 /* Returns one of the generic firewall policies, like NF_ACCEPT. */
 unsigned int
 ipt_do_table(struct sk_buff **pskb,
@@ -231,6 +790,8 @@ ipt_do_table(struct sk_buff **pskb,
 	void *table_base;
 	struct ipt_entry *e, *back;
 	struct xt_table_info *private;
+	const struct ipt_cls *cls;
+	struct ipt_cls_state cls_state;
 
 	/* Initialization */
 	ip = (*pskb)->nh.iph;
@@ -245,7 +806,7 @@ ipt_do_table(struct sk_buff **pskb,
 	 * match it. */
 	offset = ntohs(ip->frag_off) & IP_OFFSET;
 
-	read_lock_bh(&table->lock);
+	xt_info_rdlock_bh();
 	IP_NF_ASSERT(table->valid_hooks & (1 << hook));
 	private = table->private;
 	table_base = (void *)private->entries[smp_processor_id()];
@@ -254,7 +815,14 @@ ipt_do_table(struct sk_buff **pskb,
 	/* For return from builtin chain */
 	back = get_entry(table_base, private->underflow[hook]);
 
+	cls = private->classifier;
+	if (cls)
+		ipt_cls_lookup(&cls_state, cls, *pskb, ip, offset);
+
 	do {
+		/* Skip the rules which cannot match */
+		if (cls)
+			e = ipt_cls_next(&cls_state, cls, table_base, e);
 		IP_NF_ASSERT(e);
 		IP_NF_ASSERT(back);
 		if (ip_packet_match(ip, indev, outdev, &e->ip, offset)) {
@@ -326,11 +894,15 @@ ipt_do_table(struct sk_buff **pskb,
 				ip = (*pskb)->nh.iph;
 				datalen = (*pskb)->len - ip->ihl * 4;
 
-				if (verdict == IPT_CONTINUE)
+				if (verdict == IPT_CONTINUE) {
 					e = (void *)e + e->next_offset;
-				else
+					if (cls)
+						ipt_cls_lookup(&cls_state, cls,
+							       *pskb, ip, offset);
+				} else {
 					/* Verdict */
 					break;
+				}
 			}
 		} else {
 
@@ -339,7 +911,7 @@ ipt_do_table(struct sk_buff **pskb,
 		}
 	} while (!hotdrop);
 
-	read_unlock_bh(&table->lock);
+	xt_info_rdunlock_bh();
 
 #ifdef DEBUG_ALLOW_ALL
 	return NF_ACCEPT;
@@ -740,9 +1312,16 @@ translate_table(const char *name,
 			memcpy(newinfo->entries[i], entry0, newinfo->size);
 	}
 
+	newinfo->classifier = ipt_cls_build(newinfo, entry0);
 	return ret;
 }
 
+static void ipt_free_table_info(struct xt_table_info *info)
+{
+	ipt_cls_free(info->classifier);
+	xt_free_table_info(info);
+}
+
 /* Gets counters. */
 static inline int
 add_entry_to_counter(const struct ipt_entry *e,
@@ -782,21 +1361,25 @@ get_counters(const struct xt_table_info *t,
 	curcpu = raw_smp_processor_id();
 
 	i = 0;
+	xt_info_wrlock_bh(curcpu);
 	IPT_ENTRY_ITERATE(t->entries[curcpu],
 			  t->size,
 			  set_entry_to_counter,
 			  counters,
 			  &i);
+	xt_info_wrunlock_bh(curcpu);
 
 	for_each_possible_cpu(cpu) {
 		if (cpu == curcpu)
 			continue;
 		i = 0;
+		xt_info_wrlock_bh(cpu);
 		IPT_ENTRY_ITERATE(t->entries[cpu],
 				  t->size,
 				  add_entry_to_counter,
 				  counters,
 				  &i);
+		xt_info_wrunlock_bh(cpu);
 	}
 }
 
@@ -806,8 +1389,8 @@ static inline struct xt_counters * alloc_counters(struct ipt_table *table)
 	struct xt_counters *counters;
 	struct xt_table_info *private = table->private;
 
-	/* We need atomic snapshot of counters: rest doesn't change
-	   (other than comefrom, which userspace doesn't care
+	/* We need a snapshot of the counters of each CPU: rest doesn't
+	   change (other than comefrom, which userspace doesn't care
 	   about). */
 	countersize = sizeof(struct xt_counters) * private->number;
 	counters = vmalloc_node(countersize, numa_node_id());
@@ -816,9 +1399,7 @@ static inline struct xt_counters * alloc_counters(struct ipt_table *table)
 		return ERR_PTR(-ENOMEM);
 
 	/* First, sum counters... */
-	write_lock_bh(&table->lock);
 	get_counters(private, counters);
-	write_unlock_bh(&table->lock);
 
 	return counters;
 }
@@ -1227,7 +1808,7 @@ __do_replace(const char *name, unsigned int valid_hooks,
 	/* Decrease module usage counts and free resource */
 	loc_cpu_old_entry = oldinfo->entries[raw_smp_processor_id()];
 	IPT_ENTRY_ITERATE(loc_cpu_old_entry, oldinfo->size, cleanup_entry,NULL);
-	xt_free_table_info(oldinfo);
+	ipt_free_table_info(oldinfo);
 	if (copy_to_user(counters_ptr, counters,
 			 sizeof(struct xt_counters) * num_counters) != 0)
 		ret = -EFAULT;
@@ -1296,7 +1877,7 @@ do_replace(void __user *user, unsigned int len)
  free_newinfo_untrans:
 	IPT_ENTRY_ITERATE(loc_cpu_entry, newinfo->size, cleanup_entry,NULL);
  free_newinfo:
-	xt_free_table_info(newinfo);
+	ipt_free_table_info(newinfo);
 	return ret;
 }
 
@@ -1336,6 +1917,7 @@ do_add_counters(void __user *user, unsigned int len, int compat)
 	struct xt_table_info *private;
 	int ret = 0;
 	void *loc_cpu_entry;
+	unsigned int curcpu;
 #ifdef CONFIG_COMPAT
 	struct compat_xt_counters_info compat_tmp;
 
@@ -1381,7 +1963,9 @@ do_add_counters(void __user *user, unsigned int len, int compat)
 		goto free;
 	}
 
-	write_lock_bh(&t->lock);
+	/* The table can't be replaced under us, we hold its mutex */
+	curcpu = raw_smp_processor_id();
+	xt_info_wrlock_bh(curcpu);
 	private = t->private;
 	if (private->number != num_counters) {
 		ret = -EINVAL;
@@ -1390,14 +1974,14 @@ do_add_counters(void __user *user, unsigned int len, int compat)
 
 	i = 0;
 	/* Choose the copy that is on our node */
-	loc_cpu_entry = private->entries[raw_smp_processor_id()];
+	loc_cpu_entry = private->entries[curcpu];
 	IPT_ENTRY_ITERATE(loc_cpu_entry,
 			  private->size,
 			  add_counter_to_entry,
 			  paddc,
 			  &i);
  unlock_up_free:
-	write_unlock_bh(&t->lock);
+	xt_info_wrunlock_bh(curcpu);
 	xt_table_unlock(t);
 	module_put(t->me);
  free:
@@ -1765,13 +2349,15 @@ translate_compat_table(const char *name,
 		if (newinfo->entries[i] && newinfo->entries[i] != entry1)
 			memcpy(newinfo->entries[i], entry1, newinfo->size);
 
+	newinfo->classifier = ipt_cls_build(newinfo, entry1);
+
 	*pinfo = newinfo;
 	*pentry0 = entry1;
-	xt_free_table_info(info);
+	ipt_free_table_info(info);
 	return 0;
 
 free_newinfo:
-	xt_free_table_info(newinfo);
+	ipt_free_table_info(newinfo);
 out:
 	return ret;
 out_unlock:
@@ -1831,7 +2417,7 @@ compat_do_replace(void __user *user, unsigned int len)
  free_newinfo_untrans:
 	IPT_ENTRY_ITERATE(loc_cpu_entry, newinfo->size, cleanup_entry,NULL);
  free_newinfo:
-	xt_free_table_info(newinfo);
+	ipt_free_table_info(newinfo);
 	return ret;
 }
 
@@ -2109,13 +2695,13 @@ int ipt_register_table(struct xt_table *table, const struct ipt_replace *repl)
 			      repl->hook_entry,
 			      repl->underflow);
 	if (ret != 0) {
-		xt_free_table_info(newinfo);
+		ipt_free_table_info(newinfo);
 		return ret;
 	}
 
 	ret = xt_register_table(table, &bootstrap, newinfo);
 	if (ret != 0) {
-		xt_free_table_info(newinfo);
+		ipt_free_table_info(newinfo);
 		return ret;
 	}
 
@@ -2132,7 +2718,7 @@ void ipt_unregister_table(struct ipt_table *table)
 	/* Decrease module usage counts and free resources */
 	loc_cpu_entry = private->entries[raw_smp_processor_id()];
 	IPT_ENTRY_ITERATE(loc_cpu_entry, private->size, cleanup_entry, NULL);
-	xt_free_table_info(private);
+	ipt_free_table_info(private);
 }
 
 /* Returns 1 if the type and code is matched by the range, 0 otherwise */
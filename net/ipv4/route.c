@@ -132,6 +132,7 @@ static int ip_rt_mtu_expires		= 10 * 60 * HZ;
 static int ip_rt_min_pmtu		= 512 + 20 + 20;
 static int ip_rt_min_advmss		= 256;
 static int ip_rt_secret_interval	= 10 * 60 * HZ;
+static int ip_rt_nocache;
 static unsigned long rt_deadline;
 
 #define RTprint(a...)	printk(KERN_DEBUG a)
@@ -247,6 +248,7 @@ static struct rt_hash_bucket 	*rt_hash_table;
 static unsigned			rt_hash_mask;
 static int			rt_hash_log;
 static unsigned int		rt_hash_rnd;
+static atomic_t			rt_genid;
 
 static DEFINE_PER_CPU(struct rt_cache_stat, rt_cache_stat);
 #define RT_CACHE_STAT_INC(field) \
@@ -689,6 +691,7 @@ static void rt_run_flush(unsigned long dummy)
 	rt_deadline = 0;
 
 	get_random_bytes(&rt_hash_rnd, 4);
+	atomic_inc(&rt_genid);
 
 	for (i = rt_hash_mask; i >= 0; i--) {
 		spin_lock_bh(rt_hash_lock_addr(i));
@@ -1809,6 +1812,104 @@ static inline int __mkroute_input(struct sk_buff *skb,
 	return err;
 }						
 
+/*
+ * Cacheless forwarding (route/nocache): the flows forwarded through a
+ * gateway do not get a cache entry each, they share one route per cpu
+ * kept by the next hop.  A flood of new flows then costs a FIB lookup per
+ * packet, but neither fills rt_hash_table nor pushes the garbage collector.
+ * Packets with options, flows which may get a redirect and directly
+ * connected destinations keep routes of their own.
+ */
+static inline int rt_nh_cacheable(struct sk_buff *skb, struct fib_result *res,
+				  struct in_device *in_dev)
+{
+	return res->fi && FIB_RES_GW(*res) &&
+	       FIB_RES_NH(*res).nh_scope == RT_SCOPE_LINK &&
+	       FIB_RES_DEV(*res) != in_dev->dev &&
+	       skb->protocol == htons(ETH_P_IP) &&
+	       skb->nh.iph->ihl == 5;
+}
+
+/*
+ * Attach the route of this cpu's next hop to skb, making it first if it
+ * is stale or was made for another interface, tos or source check.
+ * The slot holds no reference: like a route in the hash, the route is
+ * only freed, after a grace period, once it is taken out of its slot.
+ * Returns -EAGAIN when the flow needs a route of its own.
+ */
+static int ip_mkroute_input_nh(struct sk_buff *skb, struct fib_result *res,
+			       struct in_device *in_dev,
+			       u32 daddr, u32 saddr, u32 tos)
+{
+	struct rtable **slot, *rth, *old;
+	unsigned flags = 0;
+	u32 spec_dst, itag;
+	int err;
+
+	err = fib_validate_source(saddr, daddr, tos, FIB_RES_OIF(*res),
+				  in_dev->dev, &spec_dst, &itag);
+	if (err < 0)
+		return -EAGAIN;
+	if (err)
+		flags |= RTCF_DIRECTSRC;
+#ifdef CONFIG_NET_CLS_ROUTE
+	if (itag)
+		return -EAGAIN;
+#endif
+
+	rcu_read_lock_bh();
+	slot = per_cpu_ptr(FIB_RES_NH(*res).nh_pcpu_rth_input,
+			   smp_processor_id());
+	rth = rcu_dereference(*slot);
+	if (rth && rth->rt_genid == atomic_read(&rt_genid) &&
+	    rth->fl.iif == in_dev->dev->ifindex &&
+	    rth->fl.fl4_tos == tos &&
+	    rth->rt_spec_dst == spec_dst &&
+	    rth->rt_flags == flags) {
+		rth->u.dst.lastuse = jiffies;
+		dst_hold(&rth->u.dst);
+		rth->u.dst.__use++;
+		RT_CACHE_STAT_INC(in_hit);
+		rcu_read_unlock_bh();
+		skb->dst = (struct dst_entry *)rth;
+		return 0;
+	}
+
+	err = __mkroute_input(skb, res, in_dev, daddr, saddr, tos, &rth);
+	if (err) {
+		rcu_read_unlock_bh();
+		return err;
+	}
+	/* not known to the multipath algorithms */
+	rth->u.dst.flags &= ~DST_BALANCED;
+	rth->rt_genid = atomic_read(&rt_genid);
+
+	old = xchg(slot, rth);
+	if (old)
+		rt_free(old);
+	rcu_read_unlock_bh();
+
+	skb->dst = (struct dst_entry *)rth;
+	return 0;
+}
+
+/*
+ * Drop the routes a next hop keeps for cacheless forwarding, when its
+ * device goes down or its fib_info goes away.
+ */
+void ip_rt_nh_flush(struct fib_nh *nh)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		struct rtable *rt;
+
+		rt = xchg(per_cpu_ptr(nh->nh_pcpu_rth_input, cpu), NULL);
+		if (rt)
+			rt_free(rt);
+	}
+}
+
 static inline int ip_mkroute_input_def(struct sk_buff *skb, 
 				       struct fib_result* res, 
 				       const struct flowi *fl,
@@ -1824,6 +1925,12 @@ static inline int ip_mkroute_input_def(struct sk_buff *skb,
 		fib_select_multipath(fl, res);
 #endif
 
+	if (ip_rt_nocache && rt_nh_cacheable(skb, res, in_dev)) {
+		err = ip_mkroute_input_nh(skb, res, in_dev, daddr, saddr, tos);
+		if (err != -EAGAIN)
+			return err;
+	}
+
 	/* create a routing cache entry */
 	err = __mkroute_input(skb, res, in_dev, daddr, saddr, tos, &rth);
 	if (err)
@@ -1852,7 +1959,7 @@ static inline int ip_mkroute_input(struct sk_buff *skb,
 		hopcount = 1;
 
 	/* distinguish between multipath and singlepath */
-	if (hopcount < 2)
+	if (hopcount < 2 || ip_rt_nocache)
 		return ip_mkroute_input_def(skb, res, fl, in_dev, daddr,
 					    saddr, tos);
 	
@@ -2694,7 +2801,7 @@ static int rt_fill_info(struct sk_buff *skb, u32 pid, u32 seq, int event,
 	ci.rta_error	= rt->u.dst.error;
 	ci.rta_id	= ci.rta_ts = ci.rta_tsage = 0;
 	if (rt->peer) {
-		ci.rta_id = rt->peer->ip_id_count;
+		ci.rta_id = atomic_read(&rt->peer->ip_id_count) & 0xffff;
 		if (rt->peer->tcp_ts_stamp) {
 			ci.rta_ts = rt->peer->tcp_ts;
 			ci.rta_tsage = xtime.tv_sec - rt->peer->tcp_ts_stamp;
@@ -3057,6 +3164,14 @@ ctl_table ipv4_route_table[] = {
 		.proc_handler	= &proc_dointvec_jiffies,
 		.strategy	= &sysctl_jiffies,
 	},
+	{
+		.ctl_name	= NET_IPV4_ROUTE_NOCACHE,
+		.procname	= "nocache",
+		.data		= &ip_rt_nocache,
+		.maxlen		= sizeof(int),
+		.mode		= 0644,
+		.proc_handler	= &proc_dointvec,
+	},
 	{ .ctl_name = 0 }
 };
 #endif
@@ -258,12 +258,14 @@
 #include <linux/bootmem.h>
 #include <linux/cache.h>
 #include <linux/err.h>
+#include <linux/pipe_fs_i.h>
 
 #include <net/icmp.h>
 #include <net/tcp.h>
 #include <net/xfrm.h>
 #include <net/ip.h>
 #include <net/netdma.h>
+#include <net/busy_poll.h>
 
 #include <asm/uaccess.h>
 #include <asm/ioctls.h>
@@ -581,7 +583,8 @@ new_segment:
 		if (!(psize -= copy))
 			goto out;
 
-		if (skb->len < mss_now || (flags & MSG_OOB))
+		/* Fill the skb up to the TSO goal before pushing it out */
+		if (skb->len < size_goal || (flags & MSG_OOB))
 			continue;
 
 		if (forced_push(tp)) {
@@ -605,7 +608,15 @@ wait_for_memory:
 	}
 
 out:
-	if (copied)
+	/* With more pages to come (sendfile), an skb still short of the
+	 * goal is left to grow over the next call rather than be sent as
+	 * a small TSO frame: the ACKs of the data in flight push it out
+	 * anyway if the caller takes a while.
+	 */
+	if (copied &&
+	    !((flags & MSG_MORE) && tp->packets_out &&
+	      sk->sk_send_head == sk->sk_write_queue.prev &&
+	      sk->sk_send_head->len < size_goal))
 		tcp_push(sk, tp, flags, mss_now, tp->nonagle);
 	return copied;
 
@@ -1084,6 +1095,187 @@ int tcp_read_sock(struct sock *sk, read_descriptor_t *desc,
 	return copied;
 }
 
+static int tcp_splice_data_recv(read_descriptor_t *desc, struct sk_buff *skb,
+				unsigned int offset, size_t len)
+{
+	struct pipe_inode_info *pipe = desc->arg.data;
+	int ret;
+
+	if (len > desc->count)
+		len = desc->count;
+	ret = skb_splice_bits(skb, offset, pipe, len);
+	if (ret > 0)
+		desc->count -= ret;
+	else if (ret < 0)
+		desc->error = ret;
+	return ret;
+}
+
+/*
+ * Wait for data on the socket, without the pipe locked so that its reader
+ * can drain it meanwhile.  The pipe lock goes before the socket's, as for
+ * splice to a socket.
+ */
+static void tcp_splice_wait_data(struct sock *sk, struct pipe_inode_info *pipe,
+				 long *timeo)
+{
+	if (pipe->inode)
+		mutex_unlock(&pipe->inode->i_mutex);
+	sk_wait_data(sk, timeo);
+	release_sock(sk);
+	if (pipe->inode)
+		mutex_lock(&pipe->inode->i_mutex);
+	lock_sock(sk);
+}
+
+/**
+ * tcp_splice_read - splice data from a TCP socket to a pipe
+ * @sock:	socket to splice from
+ * @ppos:	position (not valid)
+ * @pipe:	pipe to splice to
+ * @len:	number of bytes to splice
+ * @flags:	splice modifier flags
+ *
+ * The data is consumed from the receive queue as it goes in the pipe, with
+ * references to the pages of the skbs; see skb_splice_bits().  Blocking on
+ * the socket follows O_NONBLOCK, on the pipe SPLICE_F_NONBLOCK.
+ */
+ssize_t tcp_splice_read(struct socket *sock, loff_t *ppos,
+			struct pipe_inode_info *pipe, size_t len,
+			unsigned int flags)
+{
+	struct sock *sk = sock->sk;
+	read_descriptor_t desc;
+	ssize_t spliced = 0;
+	long timeo;
+	int ret = 0;
+
+	if (pipe->inode)
+		mutex_lock(&pipe->inode->i_mutex);
+	lock_sock(sk);
+
+	timeo = sock_rcvtimeo(sk, sock->file->f_flags & O_NONBLOCK);
+	while (len) {
+		if (!pipe->readers) {
+			send_sig(SIGPIPE, current, 0);
+			ret = -EPIPE;
+			break;
+		}
+		if (pipe->nrbufs >= pipe->buffers) {
+			if (spliced)
+				break;
+			if (flags & SPLICE_F_NONBLOCK) {
+				ret = -EAGAIN;
+				break;
+			}
+			if (signal_pending(current)) {
+				ret = -ERESTARTSYS;
+				break;
+			}
+			release_sock(sk);
+			pipe->waiting_writers++;
+			pipe_wait(pipe);
+			pipe->waiting_writers--;
+			lock_sock(sk);
+			continue;
+		}
+
+		desc.arg.data = pipe;
+		desc.count = len;
+		desc.error = 0;
+		ret = tcp_read_sock(sk, &desc, tcp_splice_data_recv);
+		if (ret < 0)
+			break;
+		if (!ret) {
+			ret = desc.error;
+			if (ret || spliced)
+				break;
+			if (sock_flag(sk, SOCK_DONE))
+				break;
+			if (sk->sk_err) {
+				ret = sock_error(sk);
+				break;
+			}
+			if (sk->sk_shutdown & RCV_SHUTDOWN)
+				break;
+			if (sk->sk_state == TCP_CLOSE) {
+				/*
+				 * This occurs when user tries to read
+				 * from never connected socket.
+				 */
+				ret = -ENOTCONN;
+				break;
+			}
+			if (!timeo) {
+				ret = -EAGAIN;
+				break;
+			}
+			if (signal_pending(current)) {
+				ret = sock_intr_errno(timeo);
+				break;
+			}
+			tcp_splice_wait_data(sk, pipe, &timeo);
+			continue;
+		}
+
+		len -= ret;
+		spliced += ret;
+		ret = 0;
+	}
+
+	release_sock(sk);
+	if (pipe->inode)
+		mutex_unlock(&pipe->inode->i_mutex);
+
+	if (spliced) {
+		smp_mb();
+		if (waitqueue_active(&pipe->wait))
+			wake_up_interruptible(&pipe->wait);
+		kill_fasync(&pipe->fasync_readers, SIGIO, POLL_IN);
+		return spliced;
+	}
+
+	return ret;
+}
+
+#ifdef CONFIG_NET_DMA
+/*
+ * Free the skbs whose copies to user space the DMA engine has finished.
+ * With @wait, spin until all of them are done, as recvmsg must before
+ * it returns; without, just reap what is done by now and leave the rest
+ * in flight while we go on receiving.
+ */
+static void tcp_service_net_dma(struct sock *sk, int wait)
+{
+	struct tcp_sock *tp = tcp_sk(sk);
+	dma_cookie_t done, used;
+	dma_cookie_t last_issued;
+	struct sk_buff *skb;
+
+	if (!tp->ucopy.dma_chan)
+		return;
+
+	last_issued = tp->ucopy.dma_cookie;
+	dma_async_memcpy_issue_pending(tp->ucopy.dma_chan);
+
+	do {
+		if (dma_async_memcpy_complete(tp->ucopy.dma_chan, last_issued,
+					      &done, &used) != DMA_IN_PROGRESS) {
+			/* Safe to free early-copied skbs now */
+			__skb_queue_purge(&sk->sk_async_wait_queue);
+			break;
+		}
+
+		while ((skb = skb_peek(&sk->sk_async_wait_queue)) &&
+		       (dma_async_is_complete(skb->dma_cookie, done,
+					      used) == DMA_SUCCESS)) {
+			__skb_dequeue(&sk->sk_async_wait_queue);
+			kfree_skb(skb);
+		}
+	} while (wait);
+}
+#endif
+
 /*
  *	This routine copies from a sock struct into the user buffer.
  *
@@ -1106,6 +1298,11 @@ int tcp_recvmsg(struct kiocb *iocb, struct sock *sk, struct msghdr *msg,
 	struct task_struct *user_recv = NULL;
 	int copied_early = 0;
 
+	if (sk_can_busy_loop(sk) &&
+	    skb_queue_empty(&sk->sk_receive_queue) &&
+	    sk->sk_state == TCP_ESTABLISHED)
+		sk_busy_loop(sk, nonblock);
+
 	lock_sock(sk);
 
 	TCP_CHECK_TIMER(sk);
@@ -1281,6 +1478,7 @@ int tcp_recvmsg(struct kiocb *iocb, struct sock *sk, struct msghdr *msg,
 			sk_wait_data(sk, &timeo);
 
 #ifdef CONFIG_NET_DMA
+		tcp_service_net_dma(sk, 0);
 		tp->ucopy.wakeup = 0;
 #endif
 
@@ -1358,6 +1556,11 @@ do_prequeue:
 						copied = -EFAULT;
 					break;
 				}
+
+				/* Get the engine going on this one while
+				 * we look for the next. */
+				dma_async_memcpy_issue_pending(tp->ucopy.dma_chan);
+
 				if ((offset + used) == skb->len)
 					copied_early = 1;
 
@@ -1428,25 +1631,7 @@ skip_copy:
 
 #ifdef CONFIG_NET_DMA
 	if (tp->ucopy.dma_chan) {
-		struct sk_buff *skb;
-		dma_cookie_t done, used;
-
-		dma_async_memcpy_issue_pending(tp->ucopy.dma_chan);
-
-		while (dma_async_memcpy_complete(tp->ucopy.dma_chan,
-		                                 tp->ucopy.dma_cookie, &done,
-		                                 &used) == DMA_IN_PROGRESS) {
-			/* do partial cleanup of sk_async_wait_queue */
-			while ((skb = skb_peek(&sk->sk_async_wait_queue)) &&
-			       (dma_async_is_complete(skb->dma_cookie, done,
-			                              used) == DMA_SUCCESS)) {
-				__skb_dequeue(&sk->sk_async_wait_queue);
-				kfree_skb(skb);
-			}
-		}
-
-		/* Safe to free early-copied skbs now */
-		__skb_queue_purge(&sk->sk_async_wait_queue);
+		tcp_service_net_dma(sk, 1);
 		dma_chan_put(tp->ucopy.dma_chan);
 		tp->ucopy.dma_chan = NULL;
 	}
@@ -2027,6 +2212,8 @@ void tcp_get_info(struct sock *sk, struct tcp_info *info)
 	info->tcpi_rcv_space = tp->rcvq_space.space;
 
 	info->tcpi_total_retrans = tp->total_retrans;
+
+	info->tcpi_snd_size_goal = tp->xmit_size_goal;
 }
 
 EXPORT_SYMBOL_GPL(tcp_get_info);
@@ -2228,6 +2415,107 @@ out:
 }
 EXPORT_SYMBOL(tcp_tso_segment);
 
+/*
+ * Merge a segment into the held packet of its connection, if it is the
+ * next one in sequence and only differs from it in sequence number and
+ * PSH/FIN (see dev_gro_receive()).  Returns the held packet to push up
+ * first when the flow can't be merged further.
+ */
+struct sk_buff **tcp_gro_receive(struct sk_buff **head, struct sk_buff *skb)
+{
+	struct sk_buff **pp = NULL;
+	struct sk_buff *p;
+	struct tcphdr *th;
+	struct tcphdr *th2;
+	unsigned int off = NAPI_GRO_CB(skb)->data_offset;
+	unsigned int thlen;
+	unsigned int len;
+	unsigned int mss = 1;
+	__be32 flags;
+	int flush = 1;
+	int i;
+
+	if (unlikely(!pskb_may_pull(skb, off + sizeof(*th))))
+		goto out;
+
+	th = (struct tcphdr *)(skb->data + off);
+	thlen = th->doff * 4;
+	if (thlen < sizeof(*th))
+		goto out;
+
+	if (unlikely(!pskb_may_pull(skb, off + thlen)))
+		goto out;
+
+	th = (struct tcphdr *)(skb->data + off);
+	len = skb->len - off - thlen;
+	flags = tcp_flag_word(th);
+	NAPI_GRO_CB(skb)->data_offset = off + thlen;
+
+	for (; (p = *head); head = &p->next) {
+		if (!NAPI_GRO_CB(p)->same_flow)
+			continue;
+
+		th2 = (struct tcphdr *)(p->data + off);
+		if (*(u32 *)&th->source ^ *(u32 *)&th2->source) {
+			NAPI_GRO_CB(p)->same_flow = 0;
+			continue;
+		}
+
+		goto found;
+	}
+
+	goto out_check_final;
+
+found:
+	flush = NAPI_GRO_CB(p)->flush;
+	flush |= flags & TCP_FLAG_CWR;
+	flush |= (flags ^ tcp_flag_word(th2)) &
+		 ~(TCP_FLAG_CWR | TCP_FLAG_FIN | TCP_FLAG_PSH);
+	flush |= th->ack_seq ^ th2->ack_seq;
+	for (i = sizeof(*th); i < thlen; i += 4)
+		flush |= *(u32 *)((u8 *)th + i) ^ *(u32 *)((u8 *)th2 + i);
+
+	mss = skb_shinfo(p)->gso_size;
+
+	flush |= (len - 1) >= mss;
+	flush |= (ntohl(th2->seq) + p->len - off - thlen) ^ ntohl(th->seq);
+
+	if (flush || skb_gro_receive(p, skb))
+		goto out_check_final;
+
+	tcp_flag_word(th2) |= flags & (TCP_FLAG_FIN | TCP_FLAG_PSH);
+
+out_check_final:
+	/* A short segment or one with flags is the last of its batch */
+	flush = len < mss;
+	flush |= flags & (TCP_FLAG_URG | TCP_FLAG_PSH | TCP_FLAG_RST |
+			  TCP_FLAG_SYN | TCP_FLAG_FIN);
+
+	if (p && (!NAPI_GRO_CB(skb)->same_flow || flush))
+		pp = head;
+
+out:
+	NAPI_GRO_CB(skb)->flush |= flush;
+	return pp;
+}
+
+EXPORT_SYMBOL(tcp_gro_receive);
+
+int tcp_gro_complete(struct sk_buff *skb)
+{
+	struct tcphdr *th;
+
+	th = (struct tcphdr *)(skb->data + NAPI_GRO_CB(skb)->data_offset);
+
+	skb_shinfo(skb)->gso_segs = NAPI_GRO_CB(skb)->count;
+	skb_shinfo(skb)->gso_type = SKB_GSO_TCPV4;
+	if (th->cwr)
+		skb_shinfo(skb)->gso_type |= SKB_GSO_TCP_ECN;
+	return 0;
+}
+
+EXPORT_SYMBOL(tcp_gro_complete);
+
 extern void __skb_cb_too_small_for_tcp(int, int);
 extern struct tcp_congestion_ops tcp_reno;
 
@@ -2251,6 +2539,7 @@ void __init tcp_init(void)
 		__skb_cb_too_small_for_tcp(sizeof(struct tcp_skb_cb),
 					   sizeof(skb->cb));
 
+	inet_hashinfo_init(&tcp_hashinfo);
 	tcp_hashinfo.bind_bucket_cachep =
 		kmem_cache_create("tcp_bind_bucket",
 				  sizeof(struct inet_bind_bucket), 0,
@@ -2343,6 +2632,7 @@ EXPORT_SYMBOL(tcp_getsockopt);
 EXPORT_SYMBOL(tcp_ioctl);
 EXPORT_SYMBOL(tcp_poll);
 EXPORT_SYMBOL(tcp_read_sock);
+EXPORT_SYMBOL(tcp_splice_read);
 EXPORT_SYMBOL(tcp_recvmsg);
 EXPORT_SYMBOL(tcp_sendmsg);
 EXPORT_SYMBOL(tcp_sendpage);
@@ -70,6 +70,7 @@
 #include <net/inet_common.h>
 #include <linux/ipsec.h>
 #include <asm/unaligned.h>
+#include <asm/div64.h>
 #include <net/netdma.h>
 
 int sysctl_tcp_timestamps = 1;
@@ -125,9 +126,10 @@ static void tcp_measure_rcv_mss(struct sock *sk,
 	icsk->icsk_ack.last_seg_size = 0; 
 
 	/* skb->len may jitter because of SACKs, even if peer
-	 * sends good full-sized frames.
+	 * sends good full-sized frames.  A packet merged on receive
+	 * tells the size of the segments it was made of.
 	 */
-	len = skb->len;
+	len = skb_shinfo(skb)->gso_size ? : skb->len;
 	if (len >= icsk->icsk_ack.rcv_mss) {
 		icsk->icsk_ack.rcv_mss = len;
 	} else {
@@ -879,6 +881,32 @@ static void tcp_update_reordering(struct sock *sk, const int metric,
 	}
 }
 
+/* Find the best place to start walking the retransmit queue for a
+ * SACK block beginning at start_seq: the highest indexed skb which does
+ * not lie above the block.  Falls back to the queue head.
+ */
+static struct sk_buff *tcp_sacktag_lookup(struct sock *sk, u32 start_seq,
+					  int *fack_count)
+{
+	struct tcp_sock *tp = tcp_sk(sk);
+	struct sk_buff *skb = sk->sk_write_queue.next;
+	int i;
+
+	*fack_count = 0;
+	for (i = 0; i < ARRAY_SIZE(tp->sack_skb_hint); i++) {
+		struct sk_buff *hint = tp->sack_skb_hint[i];
+
+		if (hint == NULL ||
+		    after(TCP_SKB_CB(hint)->seq, start_seq))
+			continue;
+		if (*fack_count <= tp->sack_cnt_hint[i]) {
+			skb = hint;
+			*fack_count = tp->sack_cnt_hint[i];
+		}
+	}
+	return skb;
+}
+
 /* This procedure tags the retransmission queue when SACKs arrive.
  *
  * We have three tag bits: SACKED(S), RETRANS(R) and LOST(L).
@@ -940,11 +968,13 @@ tcp_sacktag_write_queue(struct sock *sk, struct sk_buff *ack_skb, u32 prior_snd_
 	u32 lost_retrans = 0;
 	int flag = 0;
 	int dup_sack = 0;
+	int slowpath;
 	int i;
 
 	if (!tp->sacked_out)
 		tp->fackets_out = 0;
 	prior_fackets = tp->fackets_out;
+	tp->sack_scanned = 0;
 
 	/* SACK fastpath:
 	 * if the only SACK change is the increase of the end_seq of
@@ -998,6 +1028,7 @@ tcp_sacktag_write_queue(struct sock *sk, struct sk_buff *ack_skb, u32 prior_snd_
 		}
 	}
 
+	slowpath = !flag;
 	if (flag)
 		num_sacks = 1;
 	else {
@@ -1028,10 +1059,15 @@ tcp_sacktag_write_queue(struct sock *sk, struct sk_buff *ack_skb, u32 prior_snd_
 		__u32 end_seq = ntohl(sp->end_seq);
 		int fack_count;
 
-		/* Use SACK fastpath hint if valid */
+		/* Use SACK fastpath hint if valid, otherwise start from the
+		 * nearest indexed skb below the block.  D-SACKs need the
+		 * whole queue to be looked at for undo accounting.
+		 */
 		if (tp->fastpath_skb_hint) {
 			skb = tp->fastpath_skb_hint;
 			fack_count = tp->fastpath_cnt_hint;
+		} else if (!dup_sack) {
+			skb = tcp_sacktag_lookup(sk, start_seq, &fack_count);
 		} else {
 			skb = sk->sk_write_queue.next;
 			fack_count = 0;
@@ -1047,6 +1083,7 @@ tcp_sacktag_write_queue(struct sock *sk, struct sk_buff *ack_skb, u32 prior_snd_
 
 			tp->fastpath_skb_hint = skb;
 			tp->fastpath_cnt_hint = fack_count;
+			tp->sack_scanned++;
 
 			/* The retransmission queue is always in order, so
 			 * we can short-circuit the walk early.
@@ -1054,6 +1091,14 @@ tcp_sacktag_write_queue(struct sock *sk, struct sk_buff *ack_skb, u32 prior_snd_
 			if (!before(TCP_SKB_CB(skb)->seq, end_seq))
 				break;
 
+			/* Remember where this block starts for later ACKs. */
+			if (slowpath && i < ARRAY_SIZE(tp->sack_skb_hint) &&
+			    !after(TCP_SKB_CB(skb)->seq, start_seq) &&
+			    after(TCP_SKB_CB(skb)->end_seq, start_seq)) {
+				tp->sack_skb_hint[i] = skb;
+				tp->sack_cnt_hint[i] = fack_count;
+			}
+
 			in_sack = !after(start_seq, TCP_SKB_CB(skb)->seq) &&
 				!before(end_seq, TCP_SKB_CB(skb)->end_seq);
 
@@ -1205,6 +1250,7 @@ tcp_sacktag_write_queue(struct sock *sk, struct sk_buff *ack_skb, u32 prior_snd_
 	}
 
 	tp->left_out = tp->sacked_out + tp->lost_out;
+	NET_ADD_STATS_BH(LINUX_MIB_TCPSACKSCANNED, tp->sack_scanned);
 
 	if ((reord < tp->fackets_out) && icsk->icsk_ca_state != TCP_CA_Loss)
 		tcp_update_reordering(sk, ((tp->fackets_out + 1) - reord), 0);
@@ -2484,6 +2530,26 @@ static void tcp_process_frto(struct sock *sk, u32 prior_snd_una)
 	tp->frto_counter = (tp->frto_counter + 1) % 3;
 }
 
+/* Let packet schedulers (sch_fq) pace the socket at twice cwnd per srtt,
+ * which smooths out bursts without holding back cwnd growth.  srtt has
+ * jiffy granularity, too coarse below a couple of jiffies to pace by.
+ */
+static void tcp_update_pacing_rate(struct sock *sk)
+{
+	const struct tcp_sock *tp = tcp_sk(sk);
+	u64 rate;
+
+	if (tp->srtt < (2 << 3)) {
+		sk->sk_pacing_rate = ~0U;
+		return;
+	}
+
+	rate = (u64)tp->mss_cache * 2 * (HZ << 3) *
+	       max(tp->snd_cwnd, tp->packets_out);
+	do_div(rate, tp->srtt);
+	sk->sk_pacing_rate = min_t(u64, rate, ~0U);
+}
+
 /* This routine deals with incoming acks, but not outgoing ones. */
 static int tcp_ack(struct sock *sk, struct sk_buff *skb, int flag)
 {
@@ -2572,6 +2638,7 @@ static int tcp_ack(struct sock *sk, struct sk_buff *skb, int flag)
 	if ((flag & FLAG_FORWARD_PROGRESS) || !(flag&FLAG_NOT_DUP))
 		dst_confirm(sk->sk_dst_cache);
 
+	tcp_update_pacing_rate(sk);
 	return 1;
 
 no_queue:
@@ -4377,7 +4444,9 @@ int tcp_rcv_state_process(struct sock *sk, struct sk_buff *skb,
 	struct inet_connection_sock *icsk = inet_csk(sk);
 	int queued = 0;
 
-	tp->rx_opt.saw_tstamp = 0;
+	/* listeners are run on all cpus at once, keep off their tcp_sock */
+	if (sk->sk_state != TCP_LISTEN)
+		tp->rx_opt.saw_tstamp = 0;
 
 	switch (sk->sk_state) {
 	case TCP_CLOSE:
@@ -71,6 +71,7 @@
 #include <net/timewait_sock.h>
 #include <net/xfrm.h>
 #include <net/netdma.h>
+#include <net/busy_poll.h>
 
 #include <linux/inet.h>
 #include <linux/ipv6.h>
@@ -89,11 +90,7 @@ static struct socket *tcp_socket;
 
 void tcp_v4_send_check(struct sock *sk, int len, struct sk_buff *skb);
 
-struct inet_hashinfo __cacheline_aligned tcp_hashinfo = {
-	.lhash_lock	= __RW_LOCK_UNLOCKED(tcp_hashinfo.lhash_lock),
-	.lhash_users	= ATOMIC_INIT(0),
-	.lhash_wait	= __WAIT_QUEUE_HEAD_INITIALIZER(tcp_hashinfo.lhash_wait),
-};
+struct inet_hashinfo __cacheline_aligned tcp_hashinfo;
 
 static int tcp_v4_get_port(struct sock *sk, unsigned short snum)
 {
@@ -405,14 +402,17 @@ void tcp_v4_err(struct sk_buff *skb, u32 info)
 
 	switch (sk->sk_state) {
 		struct request_sock *req, **prev;
+		spinlock_t *lock;
 	case TCP_LISTEN:
 		if (sock_owned_by_user(sk))
 			goto out;
 
+		lock = inet_csk_syn_lock(sk, th->dest, iph->daddr);
+		spin_lock(lock);
 		req = inet_csk_search_req(sk, &prev, th->dest,
 					  iph->daddr, iph->saddr);
 		if (!req)
-			goto out;
+			goto out_unlock;
 
 		/* ICMPs are not backlogged, hence we cannot get
 		   an established socket here.
@@ -421,7 +421,7 @@ void tcp_v4_err(struct sk_buff *skb, u32 info)
 
 		if (seq != tcp_rsk(req)->snt_isn) {
 			NET_INC_STATS_BH(LINUX_MIB_OUTOFWINDOWICMPS);
-			goto out;
+			goto out_unlock;
 		}
 
 		/*
@@ -431,6 +431,8 @@ void tcp_v4_err(struct sk_buff *skb, u32 info)
 		 * errors returned from accept().
 		 */
 		inet_csk_reqsk_queue_drop(sk, req, prev);
+out_unlock:
+		spin_unlock(lock);
 		goto out;
 
 	case TCP_SYN_SENT:
@@ -680,16 +682,19 @@ static void tcp_v4_reqsk_destructor(struct request_sock *req)
 }
 
 #ifdef CONFIG_SYN_COOKIES
-static void syn_flood_warning(struct sk_buff *skb)
+/*
+ * Once for each flood of a listener: it is the listener whose queue
+ * overflowed which falls back to cookies, until it has been quiet for a
+ * minute.
+ */
+static void syn_flood_warning(struct sock *sk, struct sk_buff *skb)
 {
-	static unsigned long warntime;
+	const unsigned long last = tcp_sk(sk)->last_synq_overflow;
 
-	if (time_after(jiffies, (warntime + HZ * 60))) {
-		warntime = jiffies;
+	if (!last || time_after(jiffies, last + HZ * 60))
 		printk(KERN_INFO
 		       "possible SYN flooding on port %d. Sending cookies.\n",
 		       ntohs(skb->h.th->dest));
-	}
 }
 #endif
 
@@ -807,7 +812,7 @@ int tcp_v4_conn_request(struct sock *sk, struct sk_buff *skb)
 
 	if (want_cookie) {
 #ifdef CONFIG_SYN_COOKIES
-		syn_flood_warning(skb);
+		syn_flood_warning(sk, skb);
 #endif
 		isn = cookie_v4_init_sequence(sk, skb, &req->mss);
 	} else if (!isn) {
@@ -988,8 +993,45 @@ static int tcp_v4_checksum_init(struct sk_buff *skb)
 }
 
 
+/*
+ * Segments for a listening socket are handled under the syn_lock of the
+ * chain of their flow only, which is all that request handling needs.
+ */
+static int tcp_v4_listen_rcv(struct sock *sk, struct sk_buff *skb)
+{
+	spinlock_t *lock = inet_csk_syn_lock(sk, skb->h.th->source,
+					     skb->nh.iph->saddr);
+	struct sock *nsk;
+	int rc = 0;
+
+	spin_lock(lock);
+	nsk = tcp_v4_hnd_req(sk, skb);
+	if (nsk == sk)
+		rc = tcp_rcv_state_process(sk, skb, skb->h.th, skb->len);
+	spin_unlock(lock);
+
+	if (!nsk)
+		goto discard;
+
+	if (nsk != sk) {
+		if (tcp_child_process(sk, nsk, skb))
+			goto reset;
+		return 0;
+	}
+
+	if (rc)
+		goto reset;
+	return 0;
+
+reset:
+	tcp_v4_send_reset(skb);
+discard:
+	kfree_skb(skb);
+	return 0;
+}
+
 /* The socket must have it's spinlock held when we get
- * here.
+ * here, unless it is listening.
  *
  * We have a potential double-lock case here, so even when
  * doing backlog processing we use the BH locking scheme.
@@ -1009,17 +1051,8 @@ int tcp_v4_do_rcv(struct sock *sk, struct sk_buff *skb)
 	if (skb->len < (skb->h.th->doff << 2) || tcp_checksum_complete(skb))
 		goto csum_err;
 
-	if (sk->sk_state == TCP_LISTEN) {
-		struct sock *nsk = tcp_v4_hnd_req(sk, skb);
-		if (!nsk)
-			goto discard;
-
-		if (nsk != sk) {
-			if (tcp_child_process(sk, nsk, skb))
-				goto reset;
-			return 0;
-		}
-	}
+	if (sk->sk_state == TCP_LISTEN)
+		return tcp_v4_listen_rcv(sk, skb);
 
 	TCP_CHECK_TIMER(sk);
 	if (tcp_rcv_state_process(sk, skb, skb->h.th, skb->len))
@@ -1106,6 +1139,21 @@ process:
 
 	skb->dev = NULL;
 
+	/* Listeners go without the socket lock.  inet_csk_listen_stop()
+	 * waits for an RCU grace period before tearing down the queues, so
+	 * a socket still found listening here keeps them until we are done.
+	 */
+	rcu_read_lock();
+	if (sk->sk_state == TCP_LISTEN) {
+		ret = tcp_v4_do_rcv(sk, skb);
+		rcu_read_unlock();
+		sock_put(sk);
+		return ret;
+	}
+	rcu_read_unlock();
+
+	sk_mark_rx_dev(sk, skb);
+
 	bh_lock_sock_nested(sk);
 	ret = 0;
 	if (!sock_owned_by_user(sk)) {
@@ -1164,6 +1212,8 @@ do_time_wait:
 					   skb, th)) {
 	case TCP_TW_SYN: {
 		struct sock *sk2 = inet_lookup_listener(&tcp_hashinfo,
+							skb->nh.iph->saddr,
+							th->source,
 							skb->nh.iph->daddr,
 							ntohs(th->dest),
 							inet_iif(skb));
@@ -1366,18 +1416,26 @@ static inline struct inet_timewait_sock *tw_next(struct inet_timewait_sock *tw)
 		hlist_entry(tw->tw_node.next, typeof(*tw), tw_node) : NULL;
 }
 
+/*
+ * Walks the listening hash with the lock of the current bucket held,
+ * which is dropped by tcp_seq_stop() if it stops in the middle.
+ */
 static void *listening_get_next(struct seq_file *seq, void *cur)
 {
 	struct inet_connection_sock *icsk;
 	struct hlist_node *node;
 	struct sock *sk = cur;
+	struct inet_listen_hashbucket *ilb;
 	struct tcp_iter_state* st = seq->private;
 
 	if (!sk) {
 		st->bucket = 0;
-		sk = sk_head(&tcp_hashinfo.listening_hash[0]);
+		ilb = &tcp_hashinfo.listening_hash[0];
+		spin_lock_bh(&ilb->lock);
+		sk = sk_head(&ilb->head);
 		goto get_sk;
 	}
+	ilb = &tcp_hashinfo.listening_hash[st->bucket];
 
 	++st->num;
 
@@ -1394,20 +1452,21 @@ static void *listening_get_next(struct seq_file *seq, void *cur)
 				}
 				req = req->dl_next;
 			}
+			spin_unlock(reqsk_queue_syn_lock(&icsk->icsk_accept_queue,
+							 st->sbucket));
 			if (++st->sbucket >= TCP_SYNQ_HSIZE)
 				break;
 get_req:
+			spin_lock(reqsk_queue_syn_lock(&icsk->icsk_accept_queue,
+						       st->sbucket));
 			req = icsk->icsk_accept_queue.listen_opt->syn_table[st->sbucket];
 		}
 		sk	  = sk_next(st->syn_wait_sk);
 		st->state = TCP_SEQ_STATE_LISTENING;
-		read_unlock_bh(&icsk->icsk_accept_queue.syn_wait_lock);
 	} else {
 	       	icsk = inet_csk(sk);
-		read_lock_bh(&icsk->icsk_accept_queue.syn_wait_lock);
 		if (reqsk_queue_len(&icsk->icsk_accept_queue))
 			goto start_req;
-		read_unlock_bh(&icsk->icsk_accept_queue.syn_wait_lock);
 		sk = sk_next(sk);
 	}
 get_sk:
@@ -1417,7 +1476,7 @@ get_sk:
 			goto out;
 		}
 	       	icsk = inet_csk(sk);
-		read_lock_bh(&icsk->icsk_accept_queue.syn_wait_lock);
+		/* listen_opt stays while the socket is in the listening hash */
 		if (reqsk_queue_len(&icsk->icsk_accept_queue)) {
 start_req:
 			st->uid		= sock_i_uid(sk);
@@ -1426,10 +1485,12 @@ start_req:
 			st->sbucket	= 0;
 			goto get_req;
 		}
-		read_unlock_bh(&icsk->icsk_accept_queue.syn_wait_lock);
 	}
+	spin_unlock_bh(&ilb->lock);
 	if (++st->bucket < INET_LHTABLE_SIZE) {
-		sk = sk_head(&tcp_hashinfo.listening_hash[st->bucket]);
+		ilb = &tcp_hashinfo.listening_hash[st->bucket];
+		spin_lock_bh(&ilb->lock);
+		sk = sk_head(&ilb->head);
 		goto get_sk;
 	}
 	cur = NULL;
@@ -1551,12 +1612,10 @@ static void *tcp_get_idx(struct seq_file *seq, loff_t pos)
 	void *rc;
 	struct tcp_iter_state* st = seq->private;
 
-	inet_listen_lock(&tcp_hashinfo);
 	st->state = TCP_SEQ_STATE_LISTENING;
 	rc	  = listening_get_idx(seq, &pos);
 
 	if (!rc) {
-		inet_listen_unlock(&tcp_hashinfo);
 		local_bh_disable();
 		st->state = TCP_SEQ_STATE_ESTABLISHED;
 		rc	  = established_get_idx(seq, pos);
@@ -1589,7 +1648,6 @@ static void *tcp_seq_next(struct seq_file *seq, void *v, loff_t *pos)
 	case TCP_SEQ_STATE_LISTENING:
 		rc = listening_get_next(seq, v);
 		if (!rc) {
-			inet_listen_unlock(&tcp_hashinfo);
 			local_bh_disable();
 			st->state = TCP_SEQ_STATE_ESTABLISHED;
 			rc	  = established_get_first(seq);
@@ -1613,11 +1671,12 @@ static void tcp_seq_stop(struct seq_file *seq, void *v)
 	case TCP_SEQ_STATE_OPENREQ:
 		if (v) {
 			struct inet_connection_sock *icsk = inet_csk(st->syn_wait_sk);
-			read_unlock_bh(&icsk->icsk_accept_queue.syn_wait_lock);
+			spin_unlock(reqsk_queue_syn_lock(&icsk->icsk_accept_queue,
+							 st->sbucket));
 		}
 	case TCP_SEQ_STATE_LISTENING:
 		if (v != SEQ_START_TOKEN)
-			inet_listen_unlock(&tcp_hashinfo);
+			spin_unlock_bh(&tcp_hashinfo.listening_hash[st->bucket].lock);
 		break;
 	case TCP_SEQ_STATE_TIME_WAIT:
 	case TCP_SEQ_STATE_ESTABLISHED:
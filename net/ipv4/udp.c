@@ -108,6 +108,8 @@
 #include <net/inet_common.h>
 #include <net/checksum.h>
 #include <net/xfrm.h>
+#include <net/busy_poll.h>
+#include <net/inet_connection_sock.h>
 
 /*
  *	Snmp MIB for the UDP layer
@@ -115,167 +117,362 @@
 
 DEFINE_SNMP_STAT(struct udp_mib, udp_statistics) __read_mostly;
 
-struct hlist_head udp_hash[UDP_HTABLE_SIZE];
-DEFINE_RWLOCK(udp_hash_lock);
+/*
+ * A UDP sock is hashed twice: by local port in udp_hash, which binding,
+ * multicast delivery and /proc walk, and by local address and port in
+ * udp_hash2.  When many socks share a port (a name server bound to each
+ * of hundreds of addresses, say), a unicast lookup walks the udp_hash2
+ * chains of the packet's destination address and of INADDR_ANY instead
+ * of the whole port chain.  Writers take the bucket locks, udp_hash's
+ * first; lookups only hold rcu_read_lock(), which is why UDP socks are
+ * freed after a grace period.
+ */
+struct udp_hslot udp_hash[UDP_HTABLE_SIZE];
+struct udp_hslot2 udp_hash2[UDP_HTABLE_SIZE];
 
 /* Shared by v4/v6 udp. */
 int udp_port_rover;
 
-static int udp_v4_get_port(struct sock *sk, unsigned short snum)
+/* port chains longer than this are looked up through udp_hash2 */
+#define UDP_HASH2_THRESHOLD	10
+
+static int udp_lport_inuse(struct udp_hslot *hslot, u16 num)
+{
+	struct sock *sk;
+	struct hlist_node *node;
+
+	sk_for_each(sk, node, &hslot->head)
+		if (inet_sk(sk)->num == num)
+			return 1;
+	return 0;
+}
+
+/**
+ * udp_get_port - bind a UDP sock to a local port
+ * @sk: the sock, its local address already set
+ * @snum: the port, or 0 for an ephemeral one
+ * @saddr_comp: whether the local addresses of two socks overlap
+ *
+ * Shared by v4 and v6, which only differ in how they compare addresses.
+ * Socks that set SO_REUSEPORT, all of the same user, may share a port
+ * and address; the lookup then spreads the flows over them.
+ */
+int udp_get_port(struct sock *sk, unsigned short snum,
+		 int (*saddr_comp)(const struct sock *sk1,
+				   const struct sock *sk2))
 {
+	struct udp_hslot *hslot;
 	struct hlist_node *node;
 	struct sock *sk2;
-	struct inet_sock *inet = inet_sk(sk);
+	int reuseport = sk->sk_reuseport;
+	uid_t uid = reuseport ? sock_i_uid(sk) : 0;
 
-	write_lock_bh(&udp_hash_lock);
 	if (snum == 0) {
 		int best_size_so_far, best, result, i;
 
 		if (udp_port_rover > sysctl_local_port_range[1] ||
 		    udp_port_rover < sysctl_local_port_range[0])
 			udp_port_rover = sysctl_local_port_range[0];
-		best_size_so_far = 32767;
+		best_size_so_far = INT_MAX;
 		best = result = udp_port_rover;
 		for (i = 0; i < UDP_HTABLE_SIZE; i++, result++) {
-			struct hlist_head *list;
 			int size;
 
-			list = &udp_hash[result & (UDP_HTABLE_SIZE - 1)];
-			if (hlist_empty(list)) {
-				if (result > sysctl_local_port_range[1])
-					result = sysctl_local_port_range[0] +
-						((result - sysctl_local_port_range[0]) &
-						 (UDP_HTABLE_SIZE - 1));
-				goto gotit;
+			/* the counts are only a hint, read unlocked */
+			size = udp_hash[result & (UDP_HTABLE_SIZE - 1)].count;
+			if (size < best_size_so_far) {
+				best_size_so_far = size;
+				best = result;
+				if (!size)
+					break;
 			}
-			size = 0;
-			sk_for_each(sk2, node, list)
-				if (++size >= best_size_so_far)
-					goto next;
-			best_size_so_far = size;
-			best = result;
-		next:;
 		}
+
+		/* all the candidates below share best's bucket */
 		result = best;
+		hslot = &udp_hash[result & (UDP_HTABLE_SIZE - 1)];
+		spin_lock_bh(&hslot->lock);
 		for(i = 0; i < (1 << 16) / UDP_HTABLE_SIZE; i++, result += UDP_HTABLE_SIZE) {
 			if (result > sysctl_local_port_range[1])
 				result = sysctl_local_port_range[0]
 					+ ((result - sysctl_local_port_range[0]) &
 					   (UDP_HTABLE_SIZE - 1));
-			if (!udp_lport_inuse(result))
+			if (!udp_lport_inuse(hslot, result))
 				break;
 		}
 		if (i >= (1 << 16) / UDP_HTABLE_SIZE)
 			goto fail;
-gotit:
 		udp_port_rover = snum = result;
 	} else {
-		sk_for_each(sk2, node,
-			    &udp_hash[snum & (UDP_HTABLE_SIZE - 1)]) {
-			struct inet_sock *inet2 = inet_sk(sk2);
-
-			if (inet2->num == snum &&
+		hslot = &udp_hash[snum & (UDP_HTABLE_SIZE - 1)];
+		spin_lock_bh(&hslot->lock);
+		sk_for_each(sk2, node, &hslot->head) {
+			if (inet_sk(sk2)->num == snum &&
 			    sk2 != sk &&
-			    !ipv6_only_sock(sk2) &&
 			    (!sk2->sk_bound_dev_if ||
 			     !sk->sk_bound_dev_if ||
 			     sk2->sk_bound_dev_if == sk->sk_bound_dev_if) &&
-			    (!inet2->rcv_saddr ||
-			     !inet->rcv_saddr ||
-			     inet2->rcv_saddr == inet->rcv_saddr) &&
-			    (!sk2->sk_reuse || !sk->sk_reuse))
+			    (!sk2->sk_reuse || !sk->sk_reuse) &&
+			    !inet_csk_reuseport_ok(sk2, reuseport, uid) &&
+			    saddr_comp(sk, sk2))
 				goto fail;
 		}
 	}
-	inet->num = snum;
+	inet_sk(sk)->num = snum;
 	if (sk_unhashed(sk)) {
-		struct hlist_head *h = &udp_hash[snum & (UDP_HTABLE_SIZE - 1)];
-
-		sk_add_node(sk, h);
+		struct udp_sock *up = udp_sk(sk);
+		struct udp_hslot2 *hslot2;
+
+		up->portaddr_hash = udp_portaddr_hash(inet_sk(sk)->rcv_saddr,
+						      snum);
+		hslot2 = &udp_hash2[up->portaddr_hash];
+
+		sock_set_flag(sk, SOCK_RCU_FREE);
+		__sk_add_node_rcu(sk, &hslot->head);
+		hslot->count++;
+		spin_lock(&hslot2->lock);
+		hlist_nulls_add_head_rcu(&up->portaddr_node, &hslot2->head);
+		hslot2->count++;
+		spin_unlock(&hslot2->lock);
 		sock_prot_inc_use(sk->sk_prot);
 	}
-	write_unlock_bh(&udp_hash_lock);
+	spin_unlock_bh(&hslot->lock);
 	return 0;
 
 fail:
-	write_unlock_bh(&udp_hash_lock);
+	spin_unlock_bh(&hslot->lock);
 	return 1;
 }
 
+static int ipv4_rcv_saddr_equal(const struct sock *sk1, const struct sock *sk2)
+{
+	const u32 sk1_rcv_saddr = inet_sk(sk1)->rcv_saddr;
+	const u32 sk2_rcv_saddr = inet_sk(sk2)->rcv_saddr;
+
+	return !ipv6_only_sock(sk2) &&
+	       (!sk1_rcv_saddr || !sk2_rcv_saddr ||
+		sk1_rcv_saddr == sk2_rcv_saddr);
+}
+
+static int udp_v4_get_port(struct sock *sk, unsigned short snum)
+{
+	return udp_get_port(sk, snum, ipv4_rcv_saddr_equal);
+}
+
 static void udp_v4_hash(struct sock *sk)
 {
 	BUG();
 }
 
-static void udp_v4_unhash(struct sock *sk)
+void udp_lib_unhash(struct sock *sk)
 {
-	write_lock_bh(&udp_hash_lock);
-	if (sk_del_node_init(sk)) {
-		inet_sk(sk)->num = 0;
+	struct inet_sock *inet = inet_sk(sk);
+	struct udp_hslot *hslot;
+
+	if (sk_unhashed(sk))
+		return;
+
+	hslot = &udp_hash[inet->num & (UDP_HTABLE_SIZE - 1)];
+	spin_lock_bh(&hslot->lock);
+	if (__sk_del_node_init_rcu(sk)) {
+		struct udp_sock *up = udp_sk(sk);
+		struct udp_hslot2 *hslot2 = &udp_hash2[up->portaddr_hash];
+
+		hslot->count--;
+		spin_lock(&hslot2->lock);
+		hlist_nulls_del_init_rcu(&up->portaddr_node);
+		hslot2->count--;
+		spin_unlock(&hslot2->lock);
+		inet->num = 0;
 		sock_prot_dec_use(sk->sk_prot);
 	}
-	write_unlock_bh(&udp_hash_lock);
+	spin_unlock_bh(&hslot->lock);
+}
+
+/*
+ * Moves a bound sock to the udp_hash2 chain of its new local address,
+ * after connect() or disconnect() changed it.  A lookup standing on the
+ * sock at that moment follows it onto the new chain, notices from the
+ * nulls marker it ends on and starts over; see udp_v4_lookup_chain2().
+ */
+void udp_lib_rehash(struct sock *sk)
+{
+	struct inet_sock *inet = inet_sk(sk);
+	struct udp_sock *up = udp_sk(sk);
+	struct udp_hslot *hslot;
+	struct udp_hslot2 *hslot2;
+	unsigned int hash2;
+
+	if (sk_unhashed(sk))
+		return;
+
+	hash2 = udp_portaddr_hash(inet->rcv_saddr, inet->num);
+	if (hash2 == up->portaddr_hash)
+		return;
+
+	hslot = &udp_hash[inet->num & (UDP_HTABLE_SIZE - 1)];
+	spin_lock_bh(&hslot->lock);
+	if (sk_hashed(sk)) {
+		hslot2 = &udp_hash2[up->portaddr_hash];
+		spin_lock(&hslot2->lock);
+		hlist_nulls_del_init_rcu(&up->portaddr_node);
+		hslot2->count--;
+		spin_unlock(&hslot2->lock);
+
+		hslot2 = &udp_hash2[hash2];
+		spin_lock(&hslot2->lock);
+		hlist_nulls_add_head_rcu(&up->portaddr_node, &hslot2->head);
+		hslot2->count++;
+		spin_unlock(&hslot2->lock);
+		up->portaddr_hash = hash2;
+	}
+	spin_unlock_bh(&hslot->lock);
 }
 
 /* UDP is nearly always wildcards out the wazoo, it makes no sense to try
  * harder than this. -DaveM
  */
-static struct sock *udp_v4_lookup_longway(u32 saddr, u16 sport,
-					  u32 daddr, u16 dport, int dif)
+static inline int udp_v4_score(struct sock *sk, u32 saddr, u16 sport,
+			       u32 daddr, unsigned short hnum, int dif)
 {
-	struct sock *sk, *result = NULL;
-	struct hlist_node *node;
-	unsigned short hnum = ntohs(dport);
-	int badness = -1;
+	struct inet_sock *inet = inet_sk(sk);
+	int score;
 
-	sk_for_each(sk, node, &udp_hash[hnum & (UDP_HTABLE_SIZE - 1)]) {
-		struct inet_sock *inet = inet_sk(sk);
+	if (inet->num != hnum || ipv6_only_sock(sk))
+		return -1;
 
-		if (inet->num == hnum && !ipv6_only_sock(sk)) {
-			int score = (sk->sk_family == PF_INET ? 1 : 0);
-			if (inet->rcv_saddr) {
-				if (inet->rcv_saddr != daddr)
-					continue;
-				score+=2;
-			}
-			if (inet->daddr) {
-				if (inet->daddr != saddr)
-					continue;
-				score+=2;
-			}
-			if (inet->dport) {
-				if (inet->dport != sport)
-					continue;
-				score+=2;
-			}
-			if (sk->sk_bound_dev_if) {
-				if (sk->sk_bound_dev_if != dif)
-					continue;
-				score+=2;
-			}
-			if(score == 9) {
-				result = sk;
-				break;
-			} else if(score > badness) {
-				result = sk;
-				badness = score;
-			}
+	score = (sk->sk_family == PF_INET ? 1 : 0);
+	if (inet->rcv_saddr) {
+		if (inet->rcv_saddr != daddr)
+			return -1;
+		score+=2;
+	}
+	if (inet->daddr) {
+		if (inet->daddr != saddr)
+			return -1;
+		score+=2;
+	}
+	if (inet->dport) {
+		if (inet->dport != sport)
+			return -1;
+		score+=2;
+	}
+	if (sk->sk_bound_dev_if) {
+		if (sk->sk_bound_dev_if != dif)
+			return -1;
+		score+=2;
+	}
+	return score;
+}
+
+/* The state of a walk along a chain for udp_v4_lookup() */
+struct udp_v4_match {
+	struct sock	*result;
+	int		hiscore;
+	int		matches;	/* SO_REUSEPORT socks scoring hiscore */
+	u32		phash;
+};
+
+/*
+ * Weighs sk against the best match so far.  Of several SO_REUSEPORT
+ * socks matching equally well, the one for a datagram is picked by a
+ * hash of its addresses and ports, as for TCP listeners, so that a flow
+ * always goes to the same sock.  Returns 1 once nothing can do better.
+ */
+static inline int udp_v4_match(struct udp_v4_match *m, struct sock *sk,
+			       u32 saddr, u16 sport, u32 daddr,
+			       unsigned short hnum, int dif)
+{
+	int score = udp_v4_score(sk, saddr, sport, daddr, hnum, dif);
+
+	if (score > m->hiscore) {
+		m->hiscore = score;
+		m->result = sk;
+		m->matches = 0;
+		if (sk->sk_reuseport) {
+			m->phash = jhash_3words(saddr, daddr,
+					((u32)sport << 16) | hnum, 0);
+			m->matches = 1;
 		}
+	} else if (score == m->hiscore && m->matches && sk->sk_reuseport) {
+		m->matches++;
+		if ((((u64)m->phash * m->matches) >> 32) == 0)
+			m->result = sk;
+		m->phash = m->phash * 1664525 + 1013904223;
 	}
-	return result;
+	return m->hiscore == 9 && !m->matches;
 }
 
-static __inline__ struct sock *udp_v4_lookup(u32 saddr, u16 sport,
-					     u32 daddr, u16 dport, int dif)
+/* Walks a udp_hash chain.  Must be called under rcu_read_lock(). */
+static void udp_v4_lookup_chain(struct udp_v4_match *m, struct hlist_head *head,
+				u32 saddr, u16 sport, u32 daddr,
+				unsigned short hnum, int dif)
 {
+	struct hlist_node *node;
 	struct sock *sk;
 
-	read_lock(&udp_hash_lock);
-	sk = udp_v4_lookup_longway(saddr, sport, daddr, dport, dif);
-	if (sk)
-		sock_hold(sk);
-	read_unlock(&udp_hash_lock);
-	return sk;
+	for (node = rcu_dereference(head->first); node;
+	     node = rcu_dereference(node->next)) {
+		sk = hlist_entry(node, struct sock, sk_node);
+		if (udp_v4_match(m, sk, saddr, sport, daddr, hnum, dif))
+			break;
+	}
+}
+
+/*
+ * Walks udp_hash2 chain slot2.  A sock moved to another chain by
+ * udp_lib_rehash() or udp_get_port() while the walk stood on it takes
+ * the walk along, and the rest of slot2 would go unseen: when the walk
+ * ends on the nulls marker of another chain, it starts over.  Must be
+ * called under rcu_read_lock().
+ */
+static void udp_v4_lookup_chain2(struct udp_v4_match *m, unsigned int slot2,
+				 u32 saddr, u16 sport, u32 daddr,
+				 unsigned short hnum, int dif)
+{
+	struct udp_v4_match start = *m;
+	struct hlist_nulls_node *node;
+	struct udp_sock *up;
+
+begin:
+	hlist_nulls_for_each_entry_rcu(up, node, &udp_hash2[slot2].head,
+				       portaddr_node) {
+		if (udp_v4_match(m, (struct sock *)up, saddr, sport, daddr,
+				 hnum, dif))
+			return;
+	}
+	if (get_nulls_value(node) != slot2) {
+		*m = start;
+		goto begin;
+	}
+}
+
+static struct sock *udp_v4_lookup(u32 saddr, u16 sport,
+				  u32 daddr, u16 dport, int dif)
+{
+	unsigned short hnum = ntohs(dport);
+	struct udp_hslot *hslot = &udp_hash[hnum & (UDP_HTABLE_SIZE - 1)];
+	struct udp_v4_match m = { .hiscore = -1 };
+	struct sock *result;
+
+	rcu_read_lock();
+	if (hslot->count > UDP_HASH2_THRESHOLD) {
+		unsigned int hash2 = udp_portaddr_hash(daddr, hnum);
+		unsigned int hash2_any = udp_portaddr_hash(INADDR_ANY, hnum);
+
+		/* socks bound to daddr all beat the wildcard ones */
+		udp_v4_lookup_chain2(&m, hash2, saddr, sport, daddr, hnum, dif);
+		if (m.hiscore < 9 && hash2_any != hash2)
+			udp_v4_lookup_chain2(&m, hash2_any, saddr, sport,
+					     daddr, hnum, dif);
+	} else
+		udp_v4_lookup_chain(&m, &hslot->head, saddr, sport,
+				    daddr, hnum, dif);
+	result = m.result;
+	if (result && unlikely(!atomic_inc_not_zero(&result->sk_refcnt)))
+		result = NULL;
+	rcu_read_unlock();
+	return result;
 }
 
 static inline struct sock *udp_v4_mcast_next(struct sock *sk,
@@ -793,6 +990,9 @@ static int udp_recvmsg(struct kiocb *iocb, struct sock *sk, struct msghdr *msg,
 		return ip_recv_error(sk, msg, len);
 
 try_again:
+	if (sk_can_busy_loop(sk) && skb_queue_empty(&sk->sk_receive_queue))
+		sk_busy_loop(sk, noblock);
+
 	skb = skb_recv_datagram(sk, flags, noblock, &err);
 	if (!skb)
 		goto out;
@@ -865,8 +1065,11 @@ int udp_disconnect(struct sock *sk, int flags)
 	inet->daddr = 0;
 	inet->dport = 0;
 	sk->sk_bound_dev_if = 0;
-	if (!(sk->sk_userlocks & SOCK_BINDADDR_LOCK))
+	if (!(sk->sk_userlocks & SOCK_BINDADDR_LOCK)) {
 		inet_reset_saddr(sk);
+		if (sk->sk_prot->rehash)
+			sk->sk_prot->rehash(sk);
+	}
 
 	if (!(sk->sk_userlocks & SOCK_BINDPORT_LOCK)) {
 		sk->sk_prot->unhash(sk);
@@ -1026,6 +1229,8 @@ static int udp_queue_rcv_skb(struct sock * sk, struct sk_buff *skb)
 		skb->ip_summed = CHECKSUM_UNNECESSARY;
 	}
 
+	sk_mark_rx_dev(sk, skb);
+
 	if (sock_queue_rcv_skb(sk,skb)<0) {
 		UDP_INC_STATS_BH(UDP_MIB_INERRORS);
 		kfree_skb(skb);
@@ -1038,17 +1243,19 @@ static int udp_queue_rcv_skb(struct sock * sk, struct sk_buff *skb)
 /*
  *	Multicasts and broadcasts go to each listener.
  *
- *	Note: called only from the BH handler context,
- *	so we don't need to lock the hashes.
+ *	Note: called only from the BH handler context, the bucket
+ *	lock keeps the socks on the chain while we deliver to them.
  */
 static int udp_v4_mcast_deliver(struct sk_buff *skb, struct udphdr *uh,
 				 u32 saddr, u32 daddr)
 {
+	struct udp_hslot *hslot;
 	struct sock *sk;
 	int dif;
 
-	read_lock(&udp_hash_lock);
-	sk = sk_head(&udp_hash[ntohs(uh->dest) & (UDP_HTABLE_SIZE - 1)]);
+	hslot = &udp_hash[ntohs(uh->dest) & (UDP_HTABLE_SIZE - 1)];
+	spin_lock(&hslot->lock);
+	sk = sk_head(&hslot->head);
 	dif = skb->dev->ifindex;
 	sk = udp_v4_mcast_next(sk, uh->dest, daddr, uh->source, saddr, dif);
 	if (sk) {
@@ -1073,7 +1280,7 @@ static int udp_v4_mcast_deliver(struct sk_buff *skb, struct udphdr *uh,
 		} while(sknext);
 	} else
 		kfree_skb(skb);
-	read_unlock(&udp_hash_lock);
+	spin_unlock(&hslot->lock);
 	return 0;
 }
 
@@ -1383,7 +1590,8 @@ struct proto udp_prot = {
 	.sendpage	   = udp_sendpage,
 	.backlog_rcv	   = udp_queue_rcv_skb,
 	.hash		   = udp_v4_hash,
-	.unhash		   = udp_v4_unhash,
+	.unhash		   = udp_lib_unhash,
+	.rehash		   = udp_lib_rehash,
 	.get_port	   = udp_v4_get_port,
 	.obj_size	   = sizeof(struct udp_sock),
 #ifdef CONFIG_COMPAT
@@ -1392,20 +1600,40 @@ struct proto udp_prot = {
 #endif
 };
 
+void __init udp_init(void)
+{
+	int i;
+
+	for (i = 0; i < UDP_HTABLE_SIZE; i++) {
+		INIT_HLIST_HEAD(&udp_hash[i].head);
+		spin_lock_init(&udp_hash[i].lock);
+		INIT_HLIST_NULLS_HEAD(&udp_hash2[i].head, i);
+		spin_lock_init(&udp_hash2[i].lock);
+	}
+}
+
 /* ------------------------------------------------------------------------ */
 #ifdef CONFIG_PROC_FS
 
-static struct sock *udp_get_first(struct seq_file *seq)
+/*
+ * The walk holds the lock of the bucket it is in, from one call to the
+ * next, and state->bucket is UDP_HTABLE_SIZE when it holds none.
+ */
+static struct sock *udp_get_first(struct seq_file *seq, int start)
 {
 	struct sock *sk;
 	struct udp_iter_state *state = seq->private;
 
-	for (state->bucket = 0; state->bucket < UDP_HTABLE_SIZE; ++state->bucket) {
+	for (state->bucket = start; state->bucket < UDP_HTABLE_SIZE; ++state->bucket) {
 		struct hlist_node *node;
-		sk_for_each(sk, node, &udp_hash[state->bucket]) {
+		struct udp_hslot *hslot = &udp_hash[state->bucket];
+
+		spin_lock_bh(&hslot->lock);
+		sk_for_each(sk, node, &hslot->head) {
 			if (sk->sk_family == state->family)
 				goto found;
 		}
+		spin_unlock_bh(&hslot->lock);
 	}
 	sk = NULL;
 found:
@@ -1418,20 +1646,18 @@ static struct sock *udp_get_next(struct seq_file *seq, struct sock *sk)
 
 	do {
 		sk = sk_next(sk);
-try_again:
-		;
 	} while (sk && sk->sk_family != state->family);
 
-	if (!sk && ++state->bucket < UDP_HTABLE_SIZE) {
-		sk = sk_head(&udp_hash[state->bucket]);
-		goto try_again;
+	if (!sk) {
+		spin_unlock_bh(&udp_hash[state->bucket].lock);
+		return udp_get_first(seq, state->bucket + 1);
 	}
 	return sk;
 }
 
 static struct sock *udp_get_idx(struct seq_file *seq, loff_t pos)
 {
-	struct sock *sk = udp_get_first(seq);
+	struct sock *sk = udp_get_first(seq, 0);
 
 	if (sk)
 		while(pos && (sk = udp_get_next(seq, sk)) != NULL)
@@ -1441,7 +1667,9 @@ static struct sock *udp_get_idx(struct seq_file *seq, loff_t pos)
 
 static void *udp_seq_start(struct seq_file *seq, loff_t *pos)
 {
-	read_lock(&udp_hash_lock);
+	struct udp_iter_state *state = seq->private;
+
+	state->bucket = UDP_HTABLE_SIZE;
 	return *pos ? udp_get_idx(seq, *pos-1) : (void *)1;
 }
 
@@ -1460,7 +1688,10 @@ static void *udp_seq_next(struct seq_file *seq, void *v, loff_t *pos)
 
 static void udp_seq_stop(struct seq_file *seq, void *v)
 {
-	read_unlock(&udp_hash_lock);
+	struct udp_iter_state *state = seq->private;
+
+	if (state->bucket < UDP_HTABLE_SIZE)
+		spin_unlock_bh(&udp_hash[state->bucket].lock);
 }
 
 static int udp_seq_open(struct inode *inode, struct file *file)
@@ -1578,8 +1809,10 @@ void udp4_proc_exit(void)
 #endif /* CONFIG_PROC_FS */
 
 EXPORT_SYMBOL(udp_disconnect);
+EXPORT_SYMBOL(udp_get_port);
 EXPORT_SYMBOL(udp_hash);
-EXPORT_SYMBOL(udp_hash_lock);
+EXPORT_SYMBOL(udp_lib_rehash);
+EXPORT_SYMBOL(udp_lib_unhash);
 EXPORT_SYMBOL(udp_ioctl);
 EXPORT_SYMBOL(udp_port_rover);
 EXPORT_SYMBOL(udp_prot);
@@ -93,8 +93,12 @@ int xfrm4_rcv_encap(struct sk_buff *skb, __u16 encap_type)
 		/* only the first xfrm gets the encap type */
 		encap_type = 0;
 
-		if (x->props.replay_window)
+		/* x->lock may have been dropped for the crypto */
+		if (x->props.replay_window) {
+			if (xfrm_replay_check(x, seq))
+				goto drop_unlock;
 			xfrm_replay_advance(x, seq);
+		}
 
 		x->curlft.bytes += skb->len;
 		x->curlft.packets++;
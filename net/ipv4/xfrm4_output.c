@@ -11,6 +11,7 @@
 #include <linux/compiler.h>
 #include <linux/if_ether.h>
 #include <linux/kernel.h>
+#include <linux/module.h>
 #include <linux/skbuff.h>
 #include <linux/spinlock.h>
 #include <linux/netfilter_ipv4.h>
@@ -42,11 +43,19 @@ out:
 	return ret;
 }
 
-static int xfrm4_output_one(struct sk_buff *skb)
+/*
+ * Apply the transforms up to the next tunnel.  err is 1 to start, or
+ * the result of a transform that completed asynchronously to go on
+ * from there: a transform returns -EINPROGRESS when it will call
+ * xfrm4_output_resume() itself.
+ */
+static int xfrm4_output_one(struct sk_buff *skb, int err)
 {
 	struct dst_entry *dst = skb->dst;
 	struct xfrm_state *x = dst->xfrm;
-	int err;
+
+	if (err <= 0)
+		goto resume;
 	
 	if (skb->ip_summed == CHECKSUM_HW) {
 		err = skb_checksum_help(skb, 0);
@@ -71,13 +80,19 @@ static int xfrm4_output_one(struct sk_buff *skb)
 			goto error;
 
 		err = x->type->output(x, skb);
-		if (err)
+		if (err && err != -EINPROGRESS)
 			goto error;
 
 		x->curlft.bytes += skb->len;
 		x->curlft.packets++;
 
 		spin_unlock_bh(&x->lock);
+
+		if (err == -EINPROGRESS)
+			goto out_exit;
+resume:
+		if (err)
+			goto error_nolock;
 	
 		if (!(skb->dst = dst_pop(dst))) {
 			err = -EHOSTUNREACH;
@@ -99,11 +114,11 @@ error_nolock:
 	goto out_exit;
 }
 
-static int xfrm4_output_finish2(struct sk_buff *skb)
-{
-	int err;
+static int xfrm4_output_finish2(struct sk_buff *skb);
 
-	while (likely((err = xfrm4_output_one(skb)) == 0)) {
+static int xfrm4_output_resume2(struct sk_buff *skb, int err)
+{
+	while (likely((err = xfrm4_output_one(skb, err)) == 0)) {
 		nf_reset(skb);
 
 		err = nf_hook(PF_INET, NF_IP_LOCAL_OUT, &skb, NULL,
@@ -120,9 +135,30 @@ static int xfrm4_output_finish2(struct sk_buff *skb)
 			break;
 	}
 
+	/* the packet is in the hands of an asynchronous transform */
+	if (err == -EINPROGRESS)
+		err = 0;
 	return err;
 }
 
+static int xfrm4_output_finish2(struct sk_buff *skb)
+{
+	return xfrm4_output_resume2(skb, 1);
+}
+
+/**
+ * xfrm4_output_resume - continue the output of a transformed packet
+ * @skb: the packet
+ * @err: the result of the transform, the packet is freed if nonzero
+ *
+ * For transforms that returned -EINPROGRESS from their output method.
+ */
+void xfrm4_output_resume(struct sk_buff *skb, int err)
+{
+	xfrm4_output_resume2(skb, err);
+}
+EXPORT_SYMBOL(xfrm4_output_resume);
+
 static int xfrm4_output_finish(struct sk_buff *skb)
 {
 	struct sk_buff *segs;
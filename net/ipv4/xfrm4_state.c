@@ -68,13 +68,14 @@ __xfrm4_state_lookup(xfrm_address_t *daddr, u32 spi, u8 proto)
 	unsigned h = __xfrm4_spi_hash(daddr, spi, proto);
 	struct xfrm_state *x;
 
-	list_for_each_entry(x, xfrm4_state_afinfo.state_byspi+h, byspi) {
+	list_for_each_entry_rcu(x, xfrm4_state_afinfo.state_byspi+h, byspi) {
 		if (x->props.family == AF_INET &&
 		    spi == x->id.spi &&
 		    daddr->a4 == x->id.daddr.a4 &&
 		    proto == x->id.proto) {
-			xfrm_state_hold(x);
-			return x;
+			/* may be on its way out, if not under the lock */
+			if (atomic_inc_not_zero(&x->refcnt))
+				return x;
 		}
 	}
 	return NULL;
@@ -38,6 +38,10 @@
 #include <net/protocol.h>
 #include <linux/icmpv6.h>
 
+/*
+ * Called with x->lock held, which is dropped around the crypto once the
+ * sequence number is taken.
+ */
 static int esp6_output(struct xfrm_state *x, struct sk_buff *skb)
 {
 	int err;
@@ -46,6 +50,7 @@ static int esp6_output(struct xfrm_state *x, struct sk_buff *skb)
 	struct ipv6_esp_hdr *esph;
 	struct crypto_tfm *tfm;
 	struct esp_data *esp;
+	struct esp_ctx *ctx;
 	struct sk_buff *trailer;
 	int blksize;
 	int clen;
@@ -95,45 +100,57 @@ static int esp6_output(struct xfrm_state *x, struct sk_buff *skb)
 	esph->seq_no = htonl(++x->replay.oseq);
 	xfrm_aevent_doreplay(x);
 
+	spin_unlock(&x->lock);
+	ctx = esp_get_ctx(esp);
+	tfm = ctx->tfm;
+
 	if (esp->conf.ivlen)
-		crypto_cipher_set_iv(tfm, esp->conf.ivec, crypto_tfm_alg_ivsize(tfm));
+		crypto_cipher_set_iv(tfm, ctx->ivec, crypto_tfm_alg_ivsize(tfm));
 
 	do {
-		struct scatterlist *sg = &esp->sgbuf[0];
+		struct scatterlist *sg = &ctx->sgbuf[0];
 
 		if (unlikely(nfrags > ESP_NUM_FAST_SG)) {
 			sg = kmalloc(sizeof(struct scatterlist)*nfrags, GFP_ATOMIC);
 			if (!sg)
-				goto error;
+				goto unlock;
 		}
 		skb_to_sgvec(skb, sg, esph->enc_data+esp->conf.ivlen-skb->data, clen);
 		crypto_cipher_encrypt(tfm, sg, sg, clen);
-		if (unlikely(sg != &esp->sgbuf[0]))
+		if (unlikely(sg != &ctx->sgbuf[0]))
 			kfree(sg);
 	} while (0);
 
 	if (esp->conf.ivlen) {
-		memcpy(esph->enc_data, esp->conf.ivec, crypto_tfm_alg_ivsize(tfm));
-		crypto_cipher_get_iv(tfm, esp->conf.ivec, crypto_tfm_alg_ivsize(tfm));
+		memcpy(esph->enc_data, ctx->ivec, crypto_tfm_alg_ivsize(tfm));
+		crypto_cipher_get_iv(tfm, ctx->ivec, crypto_tfm_alg_ivsize(tfm));
 	}
 
 	if (esp->auth.icv_full_len) {
-		esp->auth.icv(esp, skb, (u8*)esph-skb->data,
+		esp->auth.icv(esp, ctx, skb, (u8*)esph-skb->data,
 			sizeof(struct ipv6_esp_hdr) + esp->conf.ivlen+clen, trailer->tail);
 		pskb_put(skb, trailer, alen);
 	}
 
 	err = 0;
 
+unlock:
+	esp_put_ctx(ctx);
+	spin_lock(&x->lock);
 error:
 	return err;
 }
 
+/*
+ * Called with x->lock held, which is dropped around the crypto: the
+ * caller has to check the replay window again.
+ */
 static int esp6_input(struct xfrm_state *x, struct sk_buff *skb)
 {
 	struct ipv6hdr *iph;
 	struct ipv6_esp_hdr *esph;
 	struct esp_data *esp = x->data;
+	struct esp_ctx *ctx;
 	struct sk_buff *trailer;
 	int blksize = ALIGN(crypto_tfm_alg_blocksize(esp->conf.tfm), 4);
 	int alen = esp->auth.icv_trunc_len;
@@ -153,26 +170,28 @@ static int esp6_input(struct xfrm_state *x, struct sk_buff *skb)
 		goto out;
 	}
 
+	spin_unlock(&x->lock);
+	ctx = esp_get_ctx(esp);
+
 	/* If integrity check is required, do this. */
         if (esp->auth.icv_full_len) {
 		u8 sum[esp->auth.icv_full_len];
 		u8 sum1[alen];
 
-		esp->auth.icv(esp, skb, 0, skb->len-alen, sum);
+		esp->auth.icv(esp, ctx, skb, 0, skb->len-alen, sum);
 
 		if (skb_copy_bits(skb, skb->len-alen, sum1, alen))
 			BUG();
 
 		if (unlikely(memcmp(sum, sum1, alen))) {
-			x->stats.integrity_failed++;
-			ret = -EINVAL;
-			goto out;
+			ret = -EBADMSG;
+			goto unlock;
 		}
 	}
 
 	if ((nfrags = skb_cow_data(skb, 0, &trailer)) < 0) {
 		ret = -EINVAL;
-		goto out;
+		goto unlock;
 	}
 
 	skb->ip_summed = CHECKSUM_NONE;
@@ -182,25 +201,28 @@ static int esp6_input(struct xfrm_state *x, struct sk_buff *skb)
 
 	/* Get ivec. This can be wrong, check against another impls. */
 	if (esp->conf.ivlen)
-		crypto_cipher_set_iv(esp->conf.tfm, esph->enc_data, crypto_tfm_alg_ivsize(esp->conf.tfm));
+		crypto_cipher_set_iv(ctx->tfm, esph->enc_data, crypto_tfm_alg_ivsize(ctx->tfm));
 
         {
 		u8 nexthdr[2];
-		struct scatterlist *sg = &esp->sgbuf[0];
+		struct scatterlist *sg = &ctx->sgbuf[0];
 		u8 padlen;
 
 		if (unlikely(nfrags > ESP_NUM_FAST_SG)) {
 			sg = kmalloc(sizeof(struct scatterlist)*nfrags, GFP_ATOMIC);
 			if (!sg) {
 				ret = -ENOMEM;
-				goto out;
+				goto unlock;
 			}
 		}
 		skb_to_sgvec(skb, sg, sizeof(struct ipv6_esp_hdr) + esp->conf.ivlen, elen);
-		crypto_cipher_decrypt(esp->conf.tfm, sg, sg, elen);
-		if (unlikely(sg != &esp->sgbuf[0]))
+		crypto_cipher_decrypt(ctx->tfm, sg, sg, elen);
+		if (unlikely(sg != &ctx->sgbuf[0]))
 			kfree(sg);
 
+		esp_put_ctx(ctx);
+		spin_lock(&x->lock);
+
 		if (skb_copy_bits(skb, skb->len-alen-2, nexthdr, 2))
 			BUG();
 
@@ -220,6 +242,15 @@ static int esp6_input(struct xfrm_state *x, struct sk_buff *skb)
 
 out:
 	return ret;
+
+unlock:
+	esp_put_ctx(ctx);
+	spin_lock(&x->lock);
+	if (ret == -EBADMSG) {
+		x->stats.integrity_failed++;
+		ret = -EINVAL;
+	}
+	return ret;
 }
 
 static u32 esp6_get_max_size(struct xfrm_state *x, int mtu)
@@ -266,15 +297,7 @@ static void esp6_destroy(struct xfrm_state *x)
 	if (!esp)
 		return;
 
-	crypto_free_tfm(esp->conf.tfm);
-	esp->conf.tfm = NULL;
-	kfree(esp->conf.ivec);
-	esp->conf.ivec = NULL;
-	crypto_free_tfm(esp->auth.tfm);
-	esp->auth.tfm = NULL;
-	kfree(esp->auth.work_icv);
-	esp->auth.work_icv = NULL;
-	kfree(esp);
+	esp_free_data(esp);
 }
 
 static int esp6_init_state(struct xfrm_state *x)
@@ -292,57 +315,13 @@ static int esp6_init_state(struct xfrm_state *x)
 	if (x->encap)
 		goto error;
 
-	esp = kzalloc(sizeof(*esp), GFP_KERNEL);
-	if (esp == NULL)
-		return -ENOMEM;
-
-	if (x->aalg) {
-		struct xfrm_algo_desc *aalg_desc;
-
-		esp->auth.key = x->aalg->alg_key;
-		esp->auth.key_len = (x->aalg->alg_key_len+7)/8;
-		esp->auth.tfm = crypto_alloc_tfm(x->aalg->alg_name, 0);
-		if (esp->auth.tfm == NULL)
-			goto error;
-		esp->auth.icv = esp_hmac_digest;
- 
-		aalg_desc = xfrm_aalg_get_byname(x->aalg->alg_name, 0);
-		BUG_ON(!aalg_desc);
- 
-		if (aalg_desc->uinfo.auth.icv_fullbits/8 !=
-			crypto_tfm_alg_digestsize(esp->auth.tfm)) {
-				printk(KERN_INFO "ESP: %s digestsize %u != %hu\n",
-					x->aalg->alg_name,
-					crypto_tfm_alg_digestsize(esp->auth.tfm),
-					aalg_desc->uinfo.auth.icv_fullbits/8);
-				goto error;
-		}
- 
-		esp->auth.icv_full_len = aalg_desc->uinfo.auth.icv_fullbits/8;
-		esp->auth.icv_trunc_len = aalg_desc->uinfo.auth.icv_truncbits/8;
- 
-		esp->auth.work_icv = kmalloc(esp->auth.icv_full_len, GFP_KERNEL);
-		if (!esp->auth.work_icv)
-			goto error;
-	}
-	esp->conf.key = x->ealg->alg_key;
-	esp->conf.key_len = (x->ealg->alg_key_len+7)/8;
 	if (x->props.ealgo == SADB_EALG_NULL)
-		esp->conf.tfm = crypto_alloc_tfm(x->ealg->alg_name, CRYPTO_TFM_MODE_ECB);
+		esp = esp_alloc_data(x, CRYPTO_TFM_MODE_ECB);
 	else
-		esp->conf.tfm = crypto_alloc_tfm(x->ealg->alg_name, CRYPTO_TFM_MODE_CBC);
-	if (esp->conf.tfm == NULL)
-		goto error;
-	esp->conf.ivlen = crypto_tfm_alg_ivsize(esp->conf.tfm);
-	esp->conf.padlen = 0;
-	if (esp->conf.ivlen) {
-		esp->conf.ivec = kmalloc(esp->conf.ivlen, GFP_KERNEL);
-		if (unlikely(esp->conf.ivec == NULL))
-			goto error;
-		get_random_bytes(esp->conf.ivec, esp->conf.ivlen);
-	}
-	if (crypto_cipher_setkey(esp->conf.tfm, esp->conf.key, esp->conf.key_len))
-		goto error;
+		esp = esp_alloc_data(x, CRYPTO_TFM_MODE_CBC);
+	if (IS_ERR(esp))
+		return PTR_ERR(esp);
+
 	x->props.header_len = sizeof(struct ipv6_esp_hdr) + esp->conf.ivlen;
 	if (x->props.mode)
 		x->props.header_len += sizeof(struct ipv6hdr);
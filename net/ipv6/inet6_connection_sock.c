@@ -31,6 +31,8 @@ int inet6_csk_bind_conflict(const struct sock *sk,
 {
 	const struct sock *sk2;
 	const struct hlist_node *node;
+	int reuseport = sk->sk_reuseport;
+	uid_t uid = reuseport ? sock_i_uid((struct sock *)sk) : 0;
 
 	/* We must walk the whole port owner list in this case. -DaveM */
 	sk_for_each_bound(sk2, node, &tb->owners) {
@@ -40,6 +42,7 @@ int inet6_csk_bind_conflict(const struct sock *sk,
 		     sk->sk_bound_dev_if == sk2->sk_bound_dev_if) &&
 		    (!sk->sk_reuse || !sk2->sk_reuse ||
 		     sk2->sk_state == TCP_LISTEN) &&
+		    !inet_csk_reuseport_ok(sk2, reuseport, uid) &&
 		     ipv6_rcv_saddr_equal(sk, sk2))
 			break;
 	}
@@ -71,6 +74,24 @@ static u32 inet6_synq_hash(const struct in6_addr *raddr, const u16 rport,
 	return c & (synq_hsize - 1);
 }
 
+/*
+ * The syn_lock of the chain where the requests from raddr/rport are, held
+ * by the caller of inet6_csk_search_req() and of
+ * inet6_csk_reqsk_queue_hash_add().
+ */
+spinlock_t *inet6_csk_syn_lock(const struct sock *sk, const __u16 rport,
+			       const struct in6_addr *raddr)
+{
+	struct request_sock_queue *queue = &inet_csk(sk)->icsk_accept_queue;
+	struct listen_sock *lopt = queue->listen_opt;
+
+	return reqsk_queue_syn_lock(queue,
+				    inet6_synq_hash(raddr, rport, lopt->hash_rnd,
+						    lopt->nr_table_entries));
+}
+
+EXPORT_SYMBOL_GPL(inet6_csk_syn_lock);
+
 struct request_sock *inet6_csk_search_req(const struct sock *sk,
 					  struct request_sock ***prevp,
 					  const __u16 rport,
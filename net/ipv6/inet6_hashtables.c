@@ -16,6 +16,7 @@
 
 #include <linux/module.h>
 #include <linux/random.h>
+#include <linux/jhash.h>
 
 #include <net/inet_connection_sock.h>
 #include <net/inet_hashtables.h>
@@ -27,22 +28,20 @@ void __inet6_hash(struct inet_hashinfo *hashinfo,
 {
 	struct hlist_head *list;
 	rwlock_t *lock;
+	unsigned int hash;
 
 	BUG_TRAP(sk_unhashed(sk));
 
 	if (sk->sk_state == TCP_LISTEN) {
-		list = &hashinfo->listening_hash[inet_sk_listen_hashfn(sk)];
-		lock = &hashinfo->lhash_lock;
-		inet_listen_wlock(hashinfo);
-	} else {
-		unsigned int hash;
-		sk->sk_hash = hash = inet6_sk_ehashfn(sk);
-		hash &= (hashinfo->ehash_size - 1);
-		list = &hashinfo->ehash[hash].chain;
-		lock = &hashinfo->ehash[hash].lock;
-		write_lock(lock);
+		__inet_hash_listen(hashinfo, sk);
+		return;
 	}
 
+	sk->sk_hash = hash = inet6_sk_ehashfn(sk);
+	hash &= (hashinfo->ehash_size - 1);
+	list = &hashinfo->ehash[hash].chain;
+	lock = &hashinfo->ehash[hash].lock;
+	write_lock(lock);
 	__sk_add_node(sk, list);
 	sock_prot_inc_use(sk->sk_prot);
 	write_unlock(lock);
@@ -102,7 +101,12 @@ hit:
 }
 EXPORT_SYMBOL(__inet6_lookup_established);
 
+/*
+ * SO_REUSEPORT listeners are picked from as in __inet_lookup_listener().
+ */
 struct sock *inet6_lookup_listener(struct inet_hashinfo *hashinfo,
+				   const struct in6_addr *saddr,
+				   const u16 sport,
 				   const struct in6_addr *daddr,
 				   const unsigned short hnum, const int dif)
 {
@@ -110,9 +114,12 @@ struct sock *inet6_lookup_listener(struct inet_hashinfo *hashinfo,
 	const struct hlist_node *node;
 	struct sock *result = NULL;
 	int score, hiscore = 0;
+	int matches = 0;
+	u32 phash = 0;
 
-	read_lock(&hashinfo->lhash_lock);
-	sk_for_each(sk, node, &hashinfo->listening_hash[inet_lhashfn(hnum)]) {
+	rcu_read_lock();
+	sk_for_each_rcu(sk, node,
+			&hashinfo->listening_hash[inet_lhashfn(hnum)].head) {
 		if (inet_sk(sk)->num == hnum && sk->sk_family == PF_INET6) {
 			const struct ipv6_pinfo *np = inet6_sk(sk);
 			
@@ -127,19 +134,29 @@ struct sock *inet6_lookup_listener(struct inet_hashinfo *hashinfo,
 					continue;
 				score++;
 			}
-			if (score == 3) {
-				result = sk;
-				break;
-			}
 			if (score > hiscore) {
 				hiscore = score;
 				result = sk;
+				matches = 0;
+				if (sk->sk_reuseport) {
+					phash = jhash2((u32 *)saddr->s6_addr32, 4,
+						       ((u32)sport << 16) | hnum);
+					matches = 1;
+				}
+			} else if (score == hiscore && matches &&
+				   sk->sk_reuseport) {
+				matches++;
+				if ((((u64)phash * matches) >> 32) == 0)
+					result = sk;
+				phash = phash * 1664525 + 1013904223;
 			}
+			if (hiscore == 3 && !matches)
+				break;
 		}
 	}
-	if (result)
-		sock_hold(result);
-	read_unlock(&hashinfo->lhash_lock);
+	if (result && unlikely(!atomic_inc_not_zero(&result->sk_refcnt)))
+		result = NULL;
+	rcu_read_unlock();
 	return result;
 }
 
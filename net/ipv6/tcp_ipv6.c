@@ -401,14 +401,17 @@ static void tcp_v6_err(struct sk_buff *skb, struct inet6_skb_parm *opt,
 	/* Might be for an request_sock */
 	switch (sk->sk_state) {
 		struct request_sock *req, **prev;
+		spinlock_t *lock;
 	case TCP_LISTEN:
 		if (sock_owned_by_user(sk))
 			goto out;
 
+		lock = inet6_csk_syn_lock(sk, th->dest, &hdr->daddr);
+		spin_lock(lock);
 		req = inet6_csk_search_req(sk, &prev, th->dest, &hdr->daddr,
 					   &hdr->saddr, inet6_iif(skb));
 		if (!req)
-			goto out;
+			goto out_unlock;
 
 		/* ICMPs are not backlogged, hence we cannot get
 		 * an established socket here.
@@ -417,10 +420,12 @@ static void tcp_v6_err(struct sk_buff *skb, struct inet6_skb_parm *opt,
 
 		if (seq != tcp_rsk(req)->snt_isn) {
 			NET_INC_STATS_BH(LINUX_MIB_OUTOFWINDOWICMPS);
-			goto out;
+			goto out_unlock;
 		}
 
 		inet_csk_reqsk_queue_drop(sk, req, prev);
+out_unlock:
+		spin_unlock(lock);
 		goto out;
 
 	case TCP_SYN_SENT:
@@ -1104,7 +1109,20 @@ static int tcp_v6_do_rcv(struct sock *sk, struct sk_buff *skb)
 		goto csum_err;
 
 	if (sk->sk_state == TCP_LISTEN) { 
-		struct sock *nsk = tcp_v6_hnd_req(sk, skb);
+		/* The requests of v4 peers are handled without the socket
+		 * lock, the syn_lock of the chain is what keeps the table.
+		 */
+		spinlock_t *lock = inet6_csk_syn_lock(sk, skb->h.th->source,
+						      &skb->nh.ipv6h->saddr);
+		struct sock *nsk;
+		int rc = 0;
+
+		spin_lock(lock);
+		nsk = tcp_v6_hnd_req(sk, skb);
+		if (nsk == sk)
+			rc = tcp_rcv_state_process(sk, skb, skb->h.th, skb->len);
+		spin_unlock(lock);
+
 		if (!nsk)
 			goto discard;
 
@@ -1120,6 +1138,12 @@ static int tcp_v6_do_rcv(struct sock *sk, struct sk_buff *skb)
 				__kfree_skb(opt_skb);
 			return 0;
 		}
+
+		if (rc)
+			goto reset;
+		if (opt_skb)
+			__kfree_skb(opt_skb);
+		return 0;
 	}
 
 	TCP_CHECK_TIMER(sk);
@@ -1291,6 +1315,7 @@ do_time_wait:
 		struct sock *sk2;
 
 		sk2 = inet6_lookup_listener(&tcp_hashinfo,
+					    &skb->nh.ipv6h->saddr, th->source,
 					    &skb->nh.ipv6h->daddr,
 					    ntohs(th->dest), inet6_iif(skb));
 		if (sk2 != NULL) {
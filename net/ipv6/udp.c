@@ -66,76 +66,7 @@ DEFINE_SNMP_STAT(struct udp_mib, udp_stats_in6) __read_mostly;
  */
 static int udp_v6_get_port(struct sock *sk, unsigned short snum)
 {
-	struct sock *sk2;
-	struct hlist_node *node;
-
-	write_lock_bh(&udp_hash_lock);
-	if (snum == 0) {
-		int best_size_so_far, best, result, i;
-
-		if (udp_port_rover > sysctl_local_port_range[1] ||
-		    udp_port_rover < sysctl_local_port_range[0])
-			udp_port_rover = sysctl_local_port_range[0];
-		best_size_so_far = 32767;
-		best = result = udp_port_rover;
-		for (i = 0; i < UDP_HTABLE_SIZE; i++, result++) {
-			int size;
-			struct hlist_head *list;
-
-			list = &udp_hash[result & (UDP_HTABLE_SIZE - 1)];
-			if (hlist_empty(list)) {
-				if (result > sysctl_local_port_range[1])
-					result = sysctl_local_port_range[0] +
-						((result - sysctl_local_port_range[0]) &
-						 (UDP_HTABLE_SIZE - 1));
-				goto gotit;
-			}
-			size = 0;
-			sk_for_each(sk2, node, list)
-				if (++size >= best_size_so_far)
-					goto next;
-			best_size_so_far = size;
-			best = result;
-		next:;
-		}
-		result = best;
-		for(i = 0; i < (1 << 16) / UDP_HTABLE_SIZE; i++, result += UDP_HTABLE_SIZE) {
-			if (result > sysctl_local_port_range[1])
-				result = sysctl_local_port_range[0]
-					+ ((result - sysctl_local_port_range[0]) &
-					   (UDP_HTABLE_SIZE - 1));
-			if (!udp_lport_inuse(result))
-				break;
-		}
-		if (i >= (1 << 16) / UDP_HTABLE_SIZE)
-			goto fail;
-gotit:
-		udp_port_rover = snum = result;
-	} else {
-		sk_for_each(sk2, node,
-			    &udp_hash[snum & (UDP_HTABLE_SIZE - 1)]) {
-			if (inet_sk(sk2)->num == snum &&
-			    sk2 != sk &&
-			    (!sk2->sk_bound_dev_if ||
-			     !sk->sk_bound_dev_if ||
-			     sk2->sk_bound_dev_if == sk->sk_bound_dev_if) &&
-			    (!sk2->sk_reuse || !sk->sk_reuse) &&
-			    ipv6_rcv_saddr_equal(sk, sk2))
-				goto fail;
-		}
-	}
-
-	inet_sk(sk)->num = snum;
-	if (sk_unhashed(sk)) {
-		sk_add_node(sk, &udp_hash[snum & (UDP_HTABLE_SIZE - 1)]);
-		sock_prot_inc_use(sk->sk_prot);
-	}
-	write_unlock_bh(&udp_hash_lock);
-	return 0;
-
-fail:
-	write_unlock_bh(&udp_hash_lock);
-	return 1;
+	return udp_get_port(sk, snum, ipv6_rcv_saddr_equal);
 }
 
 static void udp_v6_hash(struct sock *sk)
@@ -143,16 +74,10 @@ static void udp_v6_hash(struct sock *sk)
 	BUG();
 }
 
-static void udp_v6_unhash(struct sock *sk)
-{
- 	write_lock_bh(&udp_hash_lock);
-	if (sk_del_node_init(sk)) {
-		inet_sk(sk)->num = 0;
-		sock_prot_dec_use(sk->sk_prot);
-	}
-	write_unlock_bh(&udp_hash_lock);
-}
-
+/*
+ * Lockless, as udp_v4_lookup(), but always on the port chain: udp_hash2
+ * is keyed by the IPv4 local address.
+ */
 static struct sock *udp_v6_lookup(struct in6_addr *saddr, u16 sport,
 				  struct in6_addr *daddr, u16 dport, int dif)
 {
@@ -160,9 +85,11 @@ static struct sock *udp_v6_lookup(struct in6_addr *saddr, u16 sport,
 	struct hlist_node *node;
 	unsigned short hnum = ntohs(dport);
 	int badness = -1;
+	int matches = 0;
+	u32 phash = 0;
 
- 	read_lock(&udp_hash_lock);
-	sk_for_each(sk, node, &udp_hash[hnum & (UDP_HTABLE_SIZE - 1)]) {
+	rcu_read_lock();
+	sk_for_each_rcu(sk, node, &udp_hash[hnum & (UDP_HTABLE_SIZE - 1)].head) {
 		struct inet_sock *inet = inet_sk(sk);
 
 		if (inet->num == hnum && sk->sk_family == PF_INET6) {
@@ -188,18 +115,30 @@ static struct sock *udp_v6_lookup(struct in6_addr *saddr, u16 sport,
 					continue;
 				score++;
 			}
-			if(score == 4) {
-				result = sk;
-				break;
-			} else if(score > badness) {
+			if (score > badness) {
 				result = sk;
 				badness = score;
+				matches = 0;
+				if (sk->sk_reuseport) {
+					phash = jhash_3words(saddr->s6_addr32[3],
+						daddr->s6_addr32[3],
+						((u32)sport << 16) | hnum, 0);
+					matches = 1;
+				}
+			} else if (score == badness && matches &&
+				   sk->sk_reuseport) {
+				matches++;
+				if ((((u64)phash * matches) >> 32) == 0)
+					result = sk;
+				phash = phash * 1664525 + 1013904223;
 			}
+			if (badness == 4 && !matches)
+				break;
 		}
 	}
-	if (result)
-		sock_hold(result);
- 	read_unlock(&udp_hash_lock);
+	if (result && unlikely(!atomic_inc_not_zero(&result->sk_refcnt)))
+		result = NULL;
+	rcu_read_unlock();
 	return result;
 }
 
@@ -403,18 +342,20 @@ static struct sock *udp_v6_mcast_next(struct sock *sk,
 }
 
 /*
- * Note: called only from the BH handler context,
- * so we don't need to lock the hashes.
+ * Note: called only from the BH handler context, the bucket
+ * lock keeps the socks on the chain while we deliver to them.
  */
 static void udpv6_mcast_deliver(struct udphdr *uh,
 				struct in6_addr *saddr, struct in6_addr *daddr,
 				struct sk_buff *skb)
 {
+	struct udp_hslot *hslot;
 	struct sock *sk, *sk2;
 	int dif;
 
-	read_lock(&udp_hash_lock);
-	sk = sk_head(&udp_hash[ntohs(uh->dest) & (UDP_HTABLE_SIZE - 1)]);
+	hslot = &udp_hash[ntohs(uh->dest) & (UDP_HTABLE_SIZE - 1)];
+	spin_lock(&hslot->lock);
+	sk = sk_head(&hslot->head);
 	dif = skb->dev->ifindex;
 	sk = udp_v6_mcast_next(sk, uh->dest, daddr, uh->source, saddr, dif);
 	if (!sk) {
@@ -431,7 +372,7 @@ static void udpv6_mcast_deliver(struct udphdr *uh,
 	}
 	udpv6_queue_rcv_skb(sk, skb);
 out:
-	read_unlock(&udp_hash_lock);
+	spin_unlock(&hslot->lock);
 }
 
 static int udpv6_rcv(struct sk_buff **pskb)
@@ -1081,7 +1022,8 @@ struct proto udpv6_prot = {
 	.recvmsg	   = udpv6_recvmsg,
 	.backlog_rcv	   = udpv6_queue_rcv_skb,
 	.hash		   = udp_v6_hash,
-	.unhash		   = udp_v6_unhash,
+	.unhash		   = udp_lib_unhash,
+	.rehash		   = udp_lib_rehash,
 	.get_port	   = udp_v6_get_port,
 	.obj_size	   = sizeof(struct udp6_sock),
 #ifdef CONFIG_COMPAT
@@ -59,8 +59,12 @@ int xfrm6_rcv_spi(struct sk_buff *skb, u32 spi)
 
 		skb->nh.raw[nhoff] = nexthdr;
 
-		if (x->props.replay_window)
+		/* x->lock may have been dropped for the crypto */
+		if (x->props.replay_window) {
+			if (xfrm_replay_check(x, seq))
+				goto drop_unlock;
 			xfrm_replay_advance(x, seq);
+		}
 
 		x->curlft.bytes += skb->len;
 		x->curlft.packets++;
@@ -69,13 +69,14 @@ __xfrm6_state_lookup(xfrm_address_t *daddr, u32 spi, u8 proto)
 	unsigned h = __xfrm6_spi_hash(daddr, spi, proto);
 	struct xfrm_state *x;
 
-	list_for_each_entry(x, xfrm6_state_afinfo.state_byspi+h, byspi) {
+	list_for_each_entry_rcu(x, xfrm6_state_afinfo.state_byspi+h, byspi) {
 		if (x->props.family == AF_INET6 &&
 		    spi == x->id.spi &&
 		    ipv6_addr_equal((struct in6_addr *)daddr, (struct in6_addr *)x->id.daddr.a6) &&
 		    proto == x->id.proto) {
-			xfrm_state_hold(x);
-			return x;
+			/* may be on its way out, if not under the lock */
+			if (atomic_inc_not_zero(&x->refcnt))
+				return x;
 		}
 	}
 	return NULL;
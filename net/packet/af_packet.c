@@ -77,6 +77,7 @@
 #include <linux/poll.h>
 #include <linux/module.h>
 #include <linux/init.h>
+#include <linux/mutex.h>
 
 #ifdef CONFIG_INET
 #include <net/inet_common.h>
@@ -180,7 +181,22 @@ struct packet_mreq_max
 };
 #endif
 #ifdef CONFIG_PACKET_MMAP
-static int packet_set_ring(struct sock *sk, struct tpacket_req *req, int closing);
+static int packet_set_ring(struct sock *sk, struct tpacket_req *req,
+			   int closing, int tx_ring);
+
+struct packet_ring_buffer {
+	char *			*pg_vec;
+	unsigned int		head;
+	unsigned int		frames_per_block;
+	unsigned int		frame_size;
+	unsigned int		frame_max;
+
+	unsigned int		pg_vec_order;
+	unsigned int		pg_vec_pages;
+	unsigned int		pg_vec_len;
+
+	atomic_t		pending;	/* tx frames in flight */
+};
 #endif
 
 static void packet_flush_mclist(struct sock *sk);
@@ -190,11 +206,8 @@ struct packet_sock {
 	struct sock		sk;
 	struct tpacket_stats	stats;
 #ifdef CONFIG_PACKET_MMAP
-	char *			*pg_vec;
-	unsigned int		head;
-	unsigned int            frames_per_block;
-	unsigned int		frame_size;
-	unsigned int		frame_max;
+	struct packet_ring_buffer	rx_ring;
+	struct packet_ring_buffer	tx_ring;
 	int			copy_thresh;
 #endif
 	struct packet_type	prot_hook;
@@ -207,26 +220,61 @@ struct packet_sock {
 #endif
 #ifdef CONFIG_PACKET_MMAP
 	atomic_t		mapped;
-	unsigned int            pg_vec_order;
-	unsigned int		pg_vec_pages;
-	unsigned int		pg_vec_len;
+	struct mutex		pg_vec_lock;
 #endif
 };
 
 #ifdef CONFIG_PACKET_MMAP
 
-static inline char *packet_lookup_frame(struct packet_sock *po, unsigned int position)
+static inline char *packet_lookup_frame(struct packet_ring_buffer *rb,
+					unsigned int position)
 {
 	unsigned int pg_vec_pos, frame_offset;
 	char *frame;
 
-	pg_vec_pos = position / po->frames_per_block;
-	frame_offset = position % po->frames_per_block;
+	pg_vec_pos = position / rb->frames_per_block;
+	frame_offset = position % rb->frames_per_block;
 
-	frame = po->pg_vec[pg_vec_pos] + (frame_offset * po->frame_size);
+	frame = rb->pg_vec[pg_vec_pos] + (frame_offset * rb->frame_size);
 	
 	return frame;
 }
+
+/*
+ * The frame status is shared with user space, which polls it through
+ * the mapping: make sure both sides see it after the frame contents.
+ */
+static void __packet_set_status(struct tpacket_hdr *h, unsigned long status)
+{
+	smp_wmb();
+	h->tp_status = status;
+	flush_dcache_page(virt_to_page(&h->tp_status));
+	smp_mb();
+}
+
+static unsigned long __packet_get_status(struct tpacket_hdr *h)
+{
+	smp_rmb();
+	flush_dcache_page(virt_to_page(&h->tp_status));
+	return h->tp_status;
+}
+
+/* Returns the frame at the head of the ring if it has this status. */
+static inline struct tpacket_hdr *
+packet_current_frame(struct packet_ring_buffer *rb, unsigned long status)
+{
+	struct tpacket_hdr *h;
+
+	h = (struct tpacket_hdr *)packet_lookup_frame(rb, rb->head);
+	if (__packet_get_status(h) != status)
+		return NULL;
+	return h;
+}
+
+static inline void packet_increment_head(struct packet_ring_buffer *rb)
+{
+	rb->head = rb->head != rb->frame_max ? rb->head+1 : 0;
+}
 #endif
 
 static inline struct packet_sock *pkt_sk(struct sock *sk)
@@ -438,7 +486,7 @@ static inline unsigned run_filter(struct sk_buff *skb, struct sock *sk, unsigned
 	 * verify that under bh_lock_sock() to be safe
 	 */
 	if (likely(filter != NULL))
-		res = sk_run_filter(skb, filter->insns, filter->len);
+		res = SK_RUN_FILTER(filter, skb);
 	bh_unlock_sock(sk);
 
 	return res;
@@ -609,7 +657,7 @@ static int tpacket_rcv(struct sk_buff *skb, struct net_device *dev, struct packe
 		macoff = netoff - maclen;
 	}
 
-	if (macoff + snaplen > po->frame_size) {
+	if (macoff + snaplen > po->rx_ring.frame_size) {
 		if (po->copy_thresh &&
 		    atomic_read(&sk->sk_rmem_alloc) + skb->truesize <
 		    (unsigned)sk->sk_rcvbuf) {
@@ -622,17 +670,18 @@ static int tpacket_rcv(struct sk_buff *skb, struct net_device *dev, struct packe
 			if (copy_skb)
 				skb_set_owner_r(copy_skb, sk);
 		}
-		snaplen = po->frame_size - macoff;
+		snaplen = po->rx_ring.frame_size - macoff;
 		if ((int)snaplen < 0)
 			snaplen = 0;
 	}
 
 	spin_lock(&sk->sk_receive_queue.lock);
-	h = (struct tpacket_hdr *)packet_lookup_frame(po, po->head);
+	h = (struct tpacket_hdr *)packet_lookup_frame(&po->rx_ring,
+						      po->rx_ring.head);
 	
 	if (h->tp_status)
 		goto ring_is_full;
-	po->head = po->head != po->frame_max ? po->head+1 : 0;
+	packet_increment_head(&po->rx_ring);
 	po->stats.tp_packets++;
 	if (copy_skb) {
 		status |= TP_STATUS_COPY;
@@ -703,9 +752,200 @@ ring_is_full:
 
 #endif
 
+#ifdef CONFIG_PACKET_MMAP
+/*
+ * Transmit ring: user space fills frames and sets them to
+ * TP_STATUS_SEND_REQUEST, then a single send() hands every requested
+ * frame to the device.  The skbs point at the ring pages instead of
+ * copying the data, so a frame only becomes TP_STATUS_AVAILABLE again
+ * once the device is done with it and the skb is freed.
+ */
+static void tpacket_destruct_skb(struct sk_buff *skb)
+{
+	struct packet_sock *po = pkt_sk(skb->sk);
+	struct tpacket_hdr *h = skb_shinfo(skb)->destructor_arg;
+
+	if (likely(po->tx_ring.pg_vec)) {
+		BUG_ON(__packet_get_status(h) != TP_STATUS_SENDING);
+		BUG_ON(atomic_read(&po->tx_ring.pending) == 0);
+		atomic_dec(&po->tx_ring.pending);
+		__packet_set_status(h, TP_STATUS_AVAILABLE);
+	}
 
-static int packet_sendmsg(struct kiocb *iocb, struct socket *sock,
-			  struct msghdr *msg, size_t len)
+	sock_wfree(skb);
+}
+
+static int tpacket_fill_skb(struct packet_sock *po, struct sk_buff *skb,
+			    struct tpacket_hdr *h, struct net_device *dev,
+			    int size_max, unsigned short proto,
+			    unsigned char *addr)
+{
+	struct socket *sock = po->sk.sk_socket;
+	struct page *page;
+	unsigned char *data;
+	int tp_len, to_write, offset, len, nr_frags;
+
+	skb->protocol = proto;
+	skb->dev = dev;
+	skb->priority = po->sk.sk_priority;
+	skb_shinfo(skb)->destructor_arg = h;
+
+	tp_len = h->tp_len;
+	if (unlikely(tp_len > size_max || tp_len <= 0))
+		return -EMSGSIZE;
+
+	skb_reserve(skb, LL_RESERVED_SPACE(dev));
+	skb->nh.raw = skb->data;
+
+	data = (unsigned char *)h + TPACKET_HDRLEN - sizeof(struct sockaddr_ll);
+	to_write = tp_len;
+
+	if (sock->type == SOCK_DGRAM) {
+		if (dev->hard_header &&
+		    dev->hard_header(skb, dev, ntohs(proto), addr, NULL,
+				     tp_len) < 0)
+			return -EINVAL;
+	} else if (dev->hard_header_len) {
+		/* devices want the link layer header in the linear part */
+		if (unlikely(tp_len <= dev->hard_header_len))
+			return -EINVAL;
+
+		skb_push(skb, dev->hard_header_len);
+		if (skb_store_bits(skb, 0, data, dev->hard_header_len))
+			return -EFAULT;
+		data += dev->hard_header_len;
+		to_write -= dev->hard_header_len;
+	}
+
+	/* The rest points straight at the ring */
+	skb->data_len = to_write;
+	skb->len += to_write;
+	skb->truesize += to_write;
+	atomic_add(to_write, &po->sk.sk_wmem_alloc);
+
+	page = virt_to_page(data);
+	offset = offset_in_page(data);
+	while (to_write) {
+		len = min_t(int, to_write, PAGE_SIZE - offset);
+		nr_frags = skb_shinfo(skb)->nr_frags;
+		if (unlikely(nr_frags >= MAX_SKB_FRAGS))
+			return -EMSGSIZE;
+
+		flush_dcache_page(page);
+		get_page(page);
+		skb_fill_page_desc(skb, nr_frags, page, offset, len);
+
+		to_write -= len;
+		offset = 0;
+		page++;
+	}
+
+	return tp_len;
+}
+
+static int tpacket_snd(struct packet_sock *po, struct msghdr *msg)
+{
+	struct sockaddr_ll *saddr = (struct sockaddr_ll *)msg->msg_name;
+	struct tpacket_hdr *h = NULL;
+	struct sk_buff *skb = NULL;
+	struct net_device *dev;
+	unsigned short proto;
+	unsigned char *addr;
+	unsigned long status = TP_STATUS_SEND_REQUEST;
+	int ifindex, err, size_max, tp_len;
+	int len_sum = 0;
+
+	mutex_lock(&po->pg_vec_lock);
+
+	if (saddr == NULL) {
+		ifindex	= po->ifindex;
+		proto	= po->num;
+		addr	= NULL;
+	} else {
+		err = -EINVAL;
+		if (msg->msg_namelen < sizeof(struct sockaddr_ll))
+			goto out;
+		if (msg->msg_namelen < (saddr->sll_halen + offsetof(struct sockaddr_ll, sll_addr)))
+			goto out;
+		ifindex	= saddr->sll_ifindex;
+		proto	= saddr->sll_protocol;
+		addr	= saddr->sll_addr;
+	}
+
+	err = -ENXIO;
+	dev = dev_get_by_index(ifindex);
+	if (unlikely(dev == NULL))
+		goto out;
+
+	err = -ENETDOWN;
+	if (unlikely(!(dev->flags & IFF_UP)))
+		goto out_put;
+
+	size_max = po->tx_ring.frame_size -
+		   (TPACKET_HDRLEN - sizeof(struct sockaddr_ll));
+	if (size_max > dev->mtu + dev->hard_header_len)
+		size_max = dev->mtu + dev->hard_header_len;
+
+	/*
+	 * Send every requested frame; unless MSG_DONTWAIT, also wait for
+	 * the frames still in flight before returning.
+	 */
+	do {
+		h = packet_current_frame(&po->tx_ring, TP_STATUS_SEND_REQUEST);
+		if (unlikely(h == NULL)) {
+			schedule();
+			continue;
+		}
+
+		status = TP_STATUS_SEND_REQUEST;
+		skb = sock_alloc_send_skb(&po->sk, LL_RESERVED_SPACE(dev),
+					  msg->msg_flags & MSG_DONTWAIT, &err);
+		if (unlikely(skb == NULL))
+			goto out_status;
+
+		tp_len = tpacket_fill_skb(po, skb, h, dev, size_max, proto,
+					  addr);
+		if (unlikely(tp_len < 0)) {
+			status = TP_STATUS_WRONG_FORMAT;
+			err = tp_len;
+			goto out_status;
+		}
+
+		skb->destructor = tpacket_destruct_skb;
+		__packet_set_status(h, TP_STATUS_SENDING);
+		atomic_inc(&po->tx_ring.pending);
+
+		err = dev_queue_xmit(skb);
+		if (unlikely(err > 0)) {
+			err = net_xmit_errno(err);
+			if (err && __packet_get_status(h) == TP_STATUS_AVAILABLE) {
+				/* dropped: queue the frame again for next time */
+				skb = NULL;
+				goto out_status;
+			}
+			err = 0;
+		}
+		packet_increment_head(&po->tx_ring);
+		len_sum += tp_len;
+	} while (likely(h != NULL ||
+			(!(msg->msg_flags & MSG_DONTWAIT) &&
+			 atomic_read(&po->tx_ring.pending))));
+
+	err = len_sum;
+	goto out_put;
+
+out_status:
+	__packet_set_status(h, status);
+	kfree_skb(skb);
+out_put:
+	dev_put(dev);
+out:
+	mutex_unlock(&po->pg_vec_lock);
+	return err;
+}
+#endif
+
+static int packet_snd(struct socket *sock, struct msghdr *msg, size_t len)
 {
 	struct sock *sk = sock->sk;
 	struct sockaddr_ll *saddr=(struct sockaddr_ll *)msg->msg_name;
@@ -801,6 +1041,18 @@ out:
 	return err;
 }
 
+static int packet_sendmsg(struct kiocb *iocb, struct socket *sock,
+			  struct msghdr *msg, size_t len)
+{
+#ifdef CONFIG_PACKET_MMAP
+	struct packet_sock *po = pkt_sk(sock->sk);
+
+	if (po->tx_ring.pg_vec)
+		return tpacket_snd(po, msg);
+#endif
+	return packet_snd(sock, msg, len);
+}
+
 /*
  *	Close a PACKET socket. This is fairly simple. We immediately go
  *	to 'closed' state and remove our protocol entry in the device list.
@@ -839,10 +1091,14 @@ static int packet_release(struct socket *sock)
 #endif
 
 #ifdef CONFIG_PACKET_MMAP
-	if (po->pg_vec) {
+	{
 		struct tpacket_req req;
+
 		memset(&req, 0, sizeof(req));
-		packet_set_ring(sk, &req, 1);
+		if (po->rx_ring.pg_vec)
+			packet_set_ring(sk, &req, 1, 0);
+		if (po->tx_ring.pg_vec)
+			packet_set_ring(sk, &req, 1, 1);
 	}
 #endif
 
@@ -1027,6 +1283,9 @@ static int packet_create(struct socket *sock, int protocol)
 	 */
 
 	spin_lock_init(&po->bind_lock);
+#ifdef CONFIG_PACKET_MMAP
+	mutex_init(&po->pg_vec_lock);
+#endif
 	po->prot_hook.func = packet_rcv;
 #ifdef CONFIG_SOCK_PACKET
 	if (sock->type == SOCK_PACKET)
@@ -1352,6 +1611,7 @@ packet_setsockopt(struct socket *sock, int level, int optname, char __user *optv
 #endif
 #ifdef CONFIG_PACKET_MMAP
 	case PACKET_RX_RING:
+	case PACKET_TX_RING:
 	{
 		struct tpacket_req req;
 
@@ -1359,7 +1619,7 @@ packet_setsockopt(struct socket *sock, int level, int optname, char __user *optv
 			return -EINVAL;
 		if (copy_from_user(&req,optval,sizeof(req)))
 			return -EFAULT;
-		return packet_set_ring(sk, &req, 0);
+		return packet_set_ring(sk, &req, 0, optname == PACKET_TX_RING);
 	}
 	case PACKET_COPY_THRESH:
 	{
@@ -1537,16 +1797,25 @@ static unsigned int packet_poll(struct file * file, struct socket *sock,
 	unsigned int mask = datagram_poll(file, sock, wait);
 
 	spin_lock_bh(&sk->sk_receive_queue.lock);
-	if (po->pg_vec) {
-		unsigned last = po->head ? po->head-1 : po->frame_max;
+	if (po->rx_ring.pg_vec) {
+		unsigned last = po->rx_ring.head ? po->rx_ring.head-1 :
+						   po->rx_ring.frame_max;
 		struct tpacket_hdr *h;
 
-		h = (struct tpacket_hdr *)packet_lookup_frame(po, last);
+		h = (struct tpacket_hdr *)packet_lookup_frame(&po->rx_ring,
+							      last);
 
 		if (h->tp_status)
 			mask |= POLLIN | POLLRDNORM;
 	}
 	spin_unlock_bh(&sk->sk_receive_queue.lock);
+
+	spin_lock_bh(&sk->sk_write_queue.lock);
+	if (po->tx_ring.pg_vec) {
+		if (packet_current_frame(&po->tx_ring, TP_STATUS_AVAILABLE))
+			mask |= POLLOUT | POLLWRNORM;
+	}
+	spin_unlock_bh(&sk->sk_write_queue.lock);
 	return mask;
 }
 
@@ -1627,19 +1896,25 @@ out_free_pgvec:
 	goto out;
 }
 
-static int packet_set_ring(struct sock *sk, struct tpacket_req *req, int closing)
+static int packet_set_ring(struct sock *sk, struct tpacket_req *req,
+			   int closing, int tx_ring)
 {
 	char **pg_vec = NULL;
 	struct packet_sock *po = pkt_sk(sk);
+	struct packet_ring_buffer *rb;
+	struct sk_buff_head *rb_queue;
 	int was_running, num, order = 0;
 	int err = 0;
+
+	rb = tx_ring ? &po->tx_ring : &po->rx_ring;
+	rb_queue = tx_ring ? &sk->sk_write_queue : &sk->sk_receive_queue;
 	
 	if (req->tp_block_nr) {
 		int i, l;
 
 		/* Sanity tests and some calculations */
 
-		if (unlikely(po->pg_vec))
+		if (unlikely(rb->pg_vec))
 			return -EBUSY;
 
 		if (unlikely((int)req->tp_block_size <= 0))
@@ -1651,10 +1926,10 @@ static int packet_set_ring(struct sock *sk, struct tpacket_req *req, int closing
 		if (unlikely(req->tp_frame_size & (TPACKET_ALIGNMENT - 1)))
 			return -EINVAL;
 
-		po->frames_per_block = req->tp_block_size/req->tp_frame_size;
-		if (unlikely(po->frames_per_block <= 0))
+		rb->frames_per_block = req->tp_block_size/req->tp_frame_size;
+		if (unlikely(rb->frames_per_block <= 0))
 			return -EINVAL;
-		if (unlikely((po->frames_per_block * req->tp_block_nr) !=
+		if (unlikely((rb->frames_per_block * req->tp_block_nr) !=
 			     req->tp_frame_nr))
 			return -EINVAL;
 
@@ -1670,7 +1945,7 @@ static int packet_set_ring(struct sock *sk, struct tpacket_req *req, int closing
 			struct tpacket_hdr *header;
 			int k;
 
-			for (k = 0; k < po->frames_per_block; k++) {
+			for (k = 0; k < rb->frames_per_block; k++) {
 				header = (struct tpacket_hdr *) ptr;
 				header->tp_status = TP_STATUS_KERNEL;
 				ptr += req->tp_frame_size;
@@ -1698,28 +1973,32 @@ static int packet_set_ring(struct sock *sk, struct tpacket_req *req, int closing
 		
 	synchronize_net();
 
+	/* Frames still being sent point into the old ring */
 	err = -EBUSY;
-	if (closing || atomic_read(&po->mapped) == 0) {
+	mutex_lock(&po->pg_vec_lock);
+	if (closing || (atomic_read(&po->mapped) == 0 &&
+			atomic_read(&rb->pending) == 0)) {
 		err = 0;
 #define XC(a, b) ({ __typeof__ ((a)) __t; __t = (a); (a) = (b); __t; })
 
-		spin_lock_bh(&sk->sk_receive_queue.lock);
-		pg_vec = XC(po->pg_vec, pg_vec);
-		po->frame_max = (req->tp_frame_nr - 1);
-		po->head = 0;
-		po->frame_size = req->tp_frame_size;
-		spin_unlock_bh(&sk->sk_receive_queue.lock);
+		spin_lock_bh(&rb_queue->lock);
+		pg_vec = XC(rb->pg_vec, pg_vec);
+		rb->frame_max = (req->tp_frame_nr - 1);
+		rb->head = 0;
+		rb->frame_size = req->tp_frame_size;
+		spin_unlock_bh(&rb_queue->lock);
 
-		order = XC(po->pg_vec_order, order);
-		req->tp_block_nr = XC(po->pg_vec_len, req->tp_block_nr);
+		order = XC(rb->pg_vec_order, order);
+		req->tp_block_nr = XC(rb->pg_vec_len, req->tp_block_nr);
 
-		po->pg_vec_pages = req->tp_block_size/PAGE_SIZE;
-		po->prot_hook.func = po->pg_vec ? tpacket_rcv : packet_rcv;
-		skb_queue_purge(&sk->sk_receive_queue);
+		rb->pg_vec_pages = req->tp_block_size/PAGE_SIZE;
+		po->prot_hook.func = po->rx_ring.pg_vec ? tpacket_rcv : packet_rcv;
+		skb_queue_purge(rb_queue);
 #undef XC
 		if (atomic_read(&po->mapped))
 			printk(KERN_DEBUG "packet_mmap: vma is busy: %d\n", atomic_read(&po->mapped));
 	}
+	mutex_unlock(&po->pg_vec_lock);
 
 	spin_lock(&po->bind_lock);
 	if (was_running && !po->running) {
@@ -1742,7 +2021,8 @@ static int packet_mmap(struct file *file, struct socket *sock, struct vm_area_st
 {
 	struct sock *sk = sock->sk;
 	struct packet_sock *po = pkt_sk(sk);
-	unsigned long size;
+	struct packet_ring_buffer *rb;
+	unsigned long size, expected_size;
 	unsigned long start;
 	int err = -EINVAL;
 	int i;
@@ -1752,22 +2032,34 @@ static int packet_mmap(struct file *file, struct socket *sock, struct vm_area_st
 
 	size = vma->vm_end - vma->vm_start;
 
+	/* The rx ring, if any, is mapped first and the tx ring after it */
 	lock_sock(sk);
-	if (po->pg_vec == NULL)
+	expected_size = 0;
+	for (rb = &po->rx_ring; rb <= &po->tx_ring; rb++)
+		if (rb->pg_vec)
+			expected_size += rb->pg_vec_len * rb->pg_vec_pages *
+					 PAGE_SIZE;
+	if (expected_size == 0)
 		goto out;
-	if (size != po->pg_vec_len*po->pg_vec_pages*PAGE_SIZE)
+	if (size != expected_size)
 		goto out;
 
 	start = vma->vm_start;
-	for (i = 0; i < po->pg_vec_len; i++) {
-		struct page *page = virt_to_page(po->pg_vec[i]);
-		int pg_num;
-
-		for (pg_num = 0; pg_num < po->pg_vec_pages; pg_num++, page++) {
-			err = vm_insert_page(vma, start, page);
-			if (unlikely(err))
-				goto out;
-			start += PAGE_SIZE;
+	for (rb = &po->rx_ring; rb <= &po->tx_ring; rb++) {
+		if (rb->pg_vec == NULL)
+			continue;
+
+		for (i = 0; i < rb->pg_vec_len; i++) {
+			struct page *page = virt_to_page(rb->pg_vec[i]);
+			int pg_num;
+
+			for (pg_num = 0; pg_num < rb->pg_vec_pages;
+			     pg_num++, page++) {
+				err = vm_insert_page(vma, start, page);
+				if (unlikely(err))
+					goto out;
+				start += PAGE_SIZE;
+			}
 		}
 	}
 	atomic_inc(&po->mapped);
@@ -206,6 +206,37 @@ struct Qdisc *qdisc_lookup(struct net_device *dev, u32 handle)
 	return NULL;
 }
 
+/* Account for n packets a qdisc dropped by itself, outside of its enqueue
+   and drop methods (codel drops at dequeue), in all qdiscs above it,
+   which counted them in when they were enqueued.  The caller holds
+   dev->queue_lock, which is taken together with qdisc_tree_lock around
+   any change of dev->qdisc_list, so the list is walked without the
+   latter.
+ */
+
+void qdisc_tree_decrease_qlen(struct Qdisc *sch, unsigned int n)
+{
+	struct net_device *dev = sch->dev;
+	u32 parentid;
+	struct Qdisc *q;
+
+	if (n == 0)
+		return;
+	while ((parentid = sch->parent) != 0) {
+		sch = NULL;
+		list_for_each_entry(q, &dev->qdisc_list, list) {
+			if (q->handle == TC_H_MAJ(parentid)) {
+				sch = q;
+				break;
+			}
+		}
+		if (sch == NULL)
+			break;
+		sch->q.qlen -= n;
+		sch->qstats.drops += n;
+	}
+}
+
 static struct Qdisc *qdisc_leaf(struct Qdisc *p, u32 classid)
 {
 	unsigned long cl;
@@ -1278,6 +1309,7 @@ static int __init pktsched_init(void)
 subsys_initcall(pktsched_init);
 
 EXPORT_SYMBOL(qdisc_lookup);
+EXPORT_SYMBOL(qdisc_tree_decrease_qlen);
 EXPORT_SYMBOL(qdisc_get_rtab);
 EXPORT_SYMBOL(qdisc_put_rtab);
 EXPORT_SYMBOL(register_qdisc);
@@ -0,0 +1,212 @@
+/*
+ * net/sched/sch_codel.c	Controlled Delay (CoDel) AQM
+ *
+ *		This program is free software; you can redistribute it and/or
+ *		modify it under the terms of the GNU General Public License
+ *		as published by the Free Software Foundation; either version
+ *		2 of the License, or (at your option) any later version.
+ *
+ *	A FIFO whose packets are dropped (or ECN marked) at dequeue when
+ *	they have spent too long in it; see include/net/codel.h.  The
+ *	packet limit only guards against memory exhaustion, the queue is
+ *	normally kept far below it.
+ */
+
+#include <linux/module.h>
+#include <linux/types.h>
+#include <linux/kernel.h>
+#include <linux/errno.h>
+#include <linux/init.h>
+#include <linux/skbuff.h>
+#include <net/pkt_sched.h>
+#include <net/codel.h>
+
+#define DEFAULT_CODEL_LIMIT 1000
+
+struct codel_sched_data {
+	struct codel_params	params;
+	struct codel_vars	vars;
+	struct codel_stats	stats;
+	u32			limit;
+	u32			drop_overlimit;
+};
+
+/* This is the specific function called from codel_dequeue()
+ * to dequeue a packet from queue. Note: backlog is handled in
+ * codel, we dont need to reduce it here.
+ */
+static struct sk_buff *dequeue(struct codel_vars *vars, struct Qdisc *sch)
+{
+	return __skb_dequeue(&sch->q);
+}
+
+static struct sk_buff *codel_qdisc_dequeue(struct Qdisc *sch)
+{
+	struct codel_sched_data *q = qdisc_priv(sch);
+	struct sk_buff *skb;
+
+	skb = codel_dequeue(sch, &q->params, &q->vars, &q->stats, dequeue);
+
+	/* the parents counted the packets dropped above in */
+	if (q->stats.drop_count) {
+		qdisc_tree_decrease_qlen(sch, q->stats.drop_count);
+		q->stats.drop_count = 0;
+	}
+	return skb;
+}
+
+static int codel_qdisc_enqueue(struct sk_buff *skb, struct Qdisc *sch)
+{
+	struct codel_sched_data *q = qdisc_priv(sch);
+
+	if (likely(skb_queue_len(&sch->q) < q->limit)) {
+		codel_set_enqueue_time(skb);
+		return qdisc_enqueue_tail(skb, sch);
+	}
+	q->drop_overlimit++;
+	return qdisc_drop(skb, sch);
+}
+
+static void codel_qdisc_reset(struct Qdisc *sch)
+{
+	struct codel_sched_data *q = qdisc_priv(sch);
+
+	qdisc_reset_queue(sch);
+	codel_vars_init(&q->vars);
+	q->stats.drop_count = 0;
+}
+
+static int codel_change(struct Qdisc *sch, struct rtattr *opt)
+{
+	struct codel_sched_data *q = qdisc_priv(sch);
+	struct rtattr *tb[TCA_CODEL_MAX];
+	unsigned int qlen;
+	int err = -EINVAL;
+
+	if (opt == NULL || rtattr_parse_nested(tb, TCA_CODEL_MAX, opt))
+		return -EINVAL;
+
+	sch_tree_lock(sch);
+
+	if (tb[TCA_CODEL_TARGET-1]) {
+		u32 target = RTA_GET_U32(tb[TCA_CODEL_TARGET-1]);
+
+		q->params.target = ((u64)target * NSEC_PER_USEC) >> CODEL_SHIFT;
+	}
+	if (tb[TCA_CODEL_INTERVAL-1]) {
+		u32 interval = RTA_GET_U32(tb[TCA_CODEL_INTERVAL-1]);
+
+		q->params.interval = ((u64)interval * NSEC_PER_USEC) >> CODEL_SHIFT;
+	}
+	if (tb[TCA_CODEL_LIMIT-1])
+		q->limit = RTA_GET_U32(tb[TCA_CODEL_LIMIT-1]);
+	if (tb[TCA_CODEL_ECN-1])
+		q->params.ecn = !!RTA_GET_U32(tb[TCA_CODEL_ECN-1]);
+
+	qlen = sch->q.qlen;
+	while (sch->q.qlen > q->limit) {
+		struct sk_buff *skb = __skb_dequeue(&sch->q);
+
+		sch->qstats.backlog -= skb->len;
+		qdisc_drop(skb, sch);
+	}
+	qdisc_tree_decrease_qlen(sch, qlen - sch->q.qlen);
+	err = 0;
+
+rtattr_failure:
+	sch_tree_unlock(sch);
+	return err;
+}
+
+static int codel_init(struct Qdisc *sch, struct rtattr *opt)
+{
+	struct codel_sched_data *q = qdisc_priv(sch);
+
+	q->limit = DEFAULT_CODEL_LIMIT;
+
+	codel_params_init(&q->params, sch->dev->mtu + sch->dev->hard_header_len);
+	codel_vars_init(&q->vars);
+	codel_stats_init(&q->stats);
+
+	if (opt) {
+		int err = codel_change(sch, opt);
+
+		if (err)
+			return err;
+	}
+	return 0;
+}
+
+static int codel_dump(struct Qdisc *sch, struct sk_buff *skb)
+{
+	struct codel_sched_data *q = qdisc_priv(sch);
+	struct rtattr *opts;
+
+	opts = RTA_NEST(skb, TCA_OPTIONS);
+
+	RTA_PUT_U32(skb, TCA_CODEL_TARGET, codel_time_to_us(q->params.target));
+	RTA_PUT_U32(skb, TCA_CODEL_LIMIT, q->limit);
+	RTA_PUT_U32(skb, TCA_CODEL_INTERVAL,
+		    codel_time_to_us(q->params.interval));
+	RTA_PUT_U32(skb, TCA_CODEL_ECN, q->params.ecn);
+
+	return RTA_NEST_END(skb, opts);
+
+rtattr_failure:
+	return RTA_NEST_CANCEL(skb, opts);
+}
+
+static int codel_dump_stats(struct Qdisc *sch, struct gnet_dump *d)
+{
+	const struct codel_sched_data *q = qdisc_priv(sch);
+	struct tc_codel_xstats st = {
+		.maxpacket	= q->stats.maxpacket,
+		.count		= q->vars.count,
+		.lastcount	= q->vars.lastcount,
+		.drop_overlimit	= q->drop_overlimit,
+		.ldelay		= codel_time_to_us(q->vars.ldelay),
+		.dropping	= q->vars.dropping,
+		.ecn_mark	= q->stats.ecn_mark,
+	};
+
+	if (q->vars.dropping) {
+		codel_tdiff_t delta = q->vars.drop_next - codel_get_time();
+
+		if (delta >= 0)
+			st.drop_next = codel_time_to_us(delta);
+		else
+			st.drop_next = -codel_time_to_us(-delta);
+	}
+
+	return gnet_stats_copy_app(d, &st, sizeof(st));
+}
+
+static struct Qdisc_ops codel_qdisc_ops = {
+	.id		=	"codel",
+	.priv_size	=	sizeof(struct codel_sched_data),
+	.enqueue	=	codel_qdisc_enqueue,
+	.dequeue	=	codel_qdisc_dequeue,
+	.requeue	=	qdisc_requeue,	/* keeps its enqueue time */
+	.drop		=	qdisc_queue_drop,
+	.init		=	codel_init,
+	.reset		=	codel_qdisc_reset,
+	.change		=	codel_change,
+	.dump		=	codel_dump,
+	.dump_stats	=	codel_dump_stats,
+	.owner		=	THIS_MODULE,
+};
+
+static int __init codel_module_init(void)
+{
+	return register_qdisc(&codel_qdisc_ops);
+}
+
+static void __exit codel_module_exit(void)
+{
+	unregister_qdisc(&codel_qdisc_ops);
+}
+
+module_init(codel_module_init)
+module_exit(codel_module_exit)
+MODULE_DESCRIPTION("Controlled Delay queue discipline");
+MODULE_LICENSE("GPL");
@@ -0,0 +1,849 @@
+/*
+ * net/sched/sch_fq.c	Fair Queue Packet Scheduler (per flow pacing)
+ *
+ *		This program is free software; you can redistribute it and/or
+ *		modify it under the terms of the GNU General Public License
+ *		as published by the Free Software Foundation; either version
+ *		2 of the License, or (at your option) any later version.
+ *
+ *	Flows are kept in rbtrees, one per hash bucket, keyed by the socket
+ *	that sent them, or for packets without one by a hash of their
+ *	addresses and ports; so, unlike SFQ, two flows never share a queue
+ *	and there is no perturbation to reorder them.
+ *
+ *	Flows with packets are served round robin, new ones first, each
+ *	with a credit of quantum bytes per round (initial_quantum for a
+ *	new flow).
+ *
+ *	With pacing enabled a flow can't send a packet before
+ *	time_next_packet, which the previous packet moved on by its length
+ *	over the flow's rate: sk->sk_pacing_rate, which TCP sets from cwnd
+ *	and srtt, capped by maxrate.  Flows that have to wait sit in an
+ *	rbtree ordered by that time, and an hrtimer wakes the device up
+ *	when the first of them is due.
+ *
+ *	Idle flows stay in their tree, and are garbage collected from
+ *	it once they have been idle a while and there are many.
+ */
+
+#include <linux/module.h>
+#include <linux/types.h>
+#include <linux/kernel.h>
+#include <linux/jiffies.h>
+#include <linux/string.h>
+#include <linux/errno.h>
+#include <linux/init.h>
+#include <linux/skbuff.h>
+#include <linux/slab.h>
+#include <linux/rbtree.h>
+#include <linux/hash.h>
+#include <linux/jhash.h>
+#include <linux/hrtimer.h>
+#include <linux/netdevice.h>
+#include <linux/ip.h>
+#include <linux/ipv6.h>
+#include <linux/in.h>
+#include <linux/if_ether.h>
+#include <net/ip.h>
+#include <net/sock.h>
+#include <net/pkt_sched.h>
+#include <asm/div64.h>
+
+/*
+ * Per flow structure, dynamically allocated
+ */
+struct fq_flow {
+	struct sk_buff	*head;		/* list of skbs for this flow : first skb */
+	struct sk_buff	*tail;		/* last skb in the list */
+	unsigned long	age;		/* jiffies when flow was emptied, for gc */
+	struct rb_node	fq_node;	/* anchor in fq_root[] trees */
+	unsigned long	sk;		/* flow key: socket, or hash with bit 0 set */
+	int		qlen;		/* number of packets in flow queue */
+	int		credit;
+	struct fq_flow	*next;		/* next pointer in RR lists, or &detached */
+	struct rb_node	rate_node;	/* anchor in q->delayed tree */
+	u64		time_next_packet;
+};
+
+struct fq_flow_head {
+	struct fq_flow *first;
+	struct fq_flow *last;
+};
+
+struct fq_sched_data {
+	struct fq_flow_head new_flows;
+	struct fq_flow_head old_flows;
+
+	struct rb_root	delayed;	/* for rate limited flows */
+	u64		time_next_delayed_flow;
+
+	struct fq_flow	internal;	/* for TC_PRIO_CONTROL and requeues */
+	u32		quantum;
+	u32		initial_quantum;
+	unsigned long	flow_refill_delay;	/* jiffies */
+	u32		flow_max_rate;	/* optional max rate per flow */
+	u32		flow_plimit;	/* max packets per flow */
+	u32		plimit;		/* max packets in the qdisc */
+	u32		rate_enable;
+	u32		perturbation;	/* seeds the hash of socketless flows */
+	struct rb_root	*fq_root;
+	u8		fq_trees_log;
+
+	u32		flows;
+	u32		inactive_flows;
+	u32		throttled_flows;
+
+	u64		stat_gc_flows;
+	u64		stat_internal_packets;
+	u64		stat_throttled;
+	u64		stat_flows_plimit;
+	u64		stat_pkts_too_long;
+	u64		stat_allocation_errors;
+
+	struct Qdisc	*sch;
+	struct hrtimer	timer;		/* wakes the device up for delayed flows */
+};
+
+#define FQ_TREES_LOG_MAX	16
+#define FQ_GC_MAX		8
+#define FQ_GC_AGE		(3*HZ)
+
+/* Longest a single packet can hold its flow back; rates change */
+#define FQ_MAX_DELAY		(125 * NSEC_PER_MSEC)
+
+/* special values to mark detached (not on old/new list) and throttled flows */
+static struct fq_flow detached, throttled;
+
+static kmem_cache_t *fq_flow_cachep;
+
+static void fq_flow_set_detached(struct fq_flow *f)
+{
+	f->next = &detached;
+	f->age = jiffies;
+}
+
+static int fq_flow_is_detached(const struct fq_flow *f)
+{
+	return f->next == &detached;
+}
+
+static void fq_flow_add_tail(struct fq_flow_head *head, struct fq_flow *flow)
+{
+	if (head->first)
+		head->last->next = flow;
+	else
+		head->first = flow;
+	head->last = flow;
+	flow->next = NULL;
+}
+
+static void fq_flow_unset_throttled(struct fq_sched_data *q, struct fq_flow *f)
+{
+	rb_erase(&f->rate_node, &q->delayed);
+	q->throttled_flows--;
+	fq_flow_add_tail(&q->old_flows, f);
+}
+
+static void fq_flow_set_throttled(struct fq_sched_data *q, struct fq_flow *f)
+{
+	struct rb_node **p = &q->delayed.rb_node, *parent = NULL;
+
+	while (*p) {
+		struct fq_flow *aux;
+
+		parent = *p;
+		aux = rb_entry(parent, struct fq_flow, rate_node);
+		if (f->time_next_packet >= aux->time_next_packet)
+			p = &parent->rb_right;
+		else
+			p = &parent->rb_left;
+	}
+	rb_link_node(&f->rate_node, parent, p);
+	rb_insert_color(&f->rate_node, &q->delayed);
+	q->throttled_flows++;
+	q->stat_throttled++;
+
+	f->next = &throttled;
+	if (q->time_next_delayed_flow > f->time_next_packet)
+		q->time_next_delayed_flow = f->time_next_packet;
+}
+
+/* The key of a packet without a socket, from the same fields as sfq_hash() */
+static u32 fq_flow_hash(const struct fq_sched_data *q, struct sk_buff *skb)
+{
+	u32 h, h2;
+
+	switch (skb->protocol) {
+	case __constant_htons(ETH_P_IP):
+	{
+		struct iphdr *iph = skb->nh.iph;
+		h = iph->daddr;
+		h2 = iph->saddr^iph->protocol;
+		if (!(iph->frag_off&htons(IP_MF|IP_OFFSET)) &&
+		    (iph->protocol == IPPROTO_TCP ||
+		     iph->protocol == IPPROTO_UDP ||
+		     iph->protocol == IPPROTO_SCTP ||
+		     iph->protocol == IPPROTO_DCCP ||
+		     iph->protocol == IPPROTO_ESP))
+			h2 ^= *(((u32*)iph) + iph->ihl);
+		break;
+	}
+	case __constant_htons(ETH_P_IPV6):
+	{
+		struct ipv6hdr *iph = skb->nh.ipv6h;
+		h = iph->daddr.s6_addr32[3];
+		h2 = iph->saddr.s6_addr32[3]^iph->nexthdr;
+		if (iph->nexthdr == IPPROTO_TCP ||
+		    iph->nexthdr == IPPROTO_UDP ||
+		    iph->nexthdr == IPPROTO_SCTP ||
+		    iph->nexthdr == IPPROTO_DCCP ||
+		    iph->nexthdr == IPPROTO_ESP)
+			h2 ^= *(u32*)&iph[1];
+		break;
+	}
+	default:
+		h = (u32)(unsigned long)skb->dst^skb->protocol;
+		h2 = 0;
+	}
+	return jhash_2words(h, h2, q->perturbation);
+}
+
+static int fq_gc_candidate(const struct fq_flow *f)
+{
+	return fq_flow_is_detached(f) &&
+	       time_after(jiffies, f->age + FQ_GC_AGE);
+}
+
+/* Free a few flows that have been idle a long time, on the way to key */
+static void fq_gc(struct fq_sched_data *q, struct rb_root *root,
+		  unsigned long key)
+{
+	struct fq_flow *f, *tofree[FQ_GC_MAX];
+	struct rb_node *p = root->rb_node;
+	int i, fcnt = 0;
+
+	while (p) {
+		f = rb_entry(p, struct fq_flow, fq_node);
+		if (f->sk == key)
+			break;
+
+		if (fq_gc_candidate(f)) {
+			tofree[fcnt++] = f;
+			if (fcnt == FQ_GC_MAX)
+				break;
+		}
+
+		if (f->sk > key)
+			p = p->rb_right;
+		else
+			p = p->rb_left;
+	}
+
+	for (i = 0; i < fcnt; i++) {
+		rb_erase(&tofree[i]->fq_node, root);
+		kmem_cache_free(fq_flow_cachep, tofree[i]);
+	}
+	q->flows -= fcnt;
+	q->inactive_flows -= fcnt;
+	q->stat_gc_flows += fcnt;
+}
+
+static struct fq_flow *fq_classify(struct sk_buff *skb, struct fq_sched_data *q)
+{
+	struct rb_node **p, *parent;
+	struct rb_root *root;
+	unsigned long key;
+	struct fq_flow *f;
+
+	if (unlikely(skb->priority == TC_PRIO_CONTROL))
+		return &q->internal;
+
+	/* socket pointers are aligned, hashes are made odd */
+	if (skb->sk)
+		key = (unsigned long)skb->sk;
+	else
+		key = ((unsigned long)fq_flow_hash(q, skb) << 1) | 1UL;
+
+	root = &q->fq_root[hash_long(key, q->fq_trees_log)];
+
+	if (q->flows >= (2U << q->fq_trees_log) &&
+	    q->inactive_flows > q->flows/2)
+		fq_gc(q, root, key);
+
+	p = &root->rb_node;
+	parent = NULL;
+	while (*p) {
+		parent = *p;
+
+		f = rb_entry(parent, struct fq_flow, fq_node);
+		if (f->sk == key)
+			return f;
+
+		if (f->sk > key)
+			p = &parent->rb_right;
+		else
+			p = &parent->rb_left;
+	}
+
+	f = kmem_cache_alloc(fq_flow_cachep, GFP_ATOMIC);
+	if (unlikely(!f)) {
+		q->stat_allocation_errors++;
+		return &q->internal;
+	}
+	memset(f, 0, sizeof(*f));
+	fq_flow_set_detached(f);
+	f->sk = key;
+	f->credit = q->initial_quantum;
+
+	rb_link_node(&f->fq_node, parent, p);
+	rb_insert_color(&f->fq_node, root);
+
+	q->flows++;
+	q->inactive_flows++;
+	return f;
+}
+
+/* remove one skb from head of flow queue */
+static struct sk_buff *fq_dequeue_head(struct Qdisc *sch, struct fq_flow *flow)
+{
+	struct sk_buff *skb = flow->head;
+
+	if (skb) {
+		flow->head = skb->next;
+		skb->next = NULL;
+		flow->qlen--;
+		sch->qstats.backlog -= skb->len;
+		sch->q.qlen--;
+	}
+	return skb;
+}
+
+static void flow_queue_add(struct fq_flow *flow, struct sk_buff *skb)
+{
+	skb->next = NULL;
+	if (!flow->head)
+		flow->head = skb;
+	else
+		flow->tail->next = skb;
+	flow->tail = skb;
+}
+
+static int fq_enqueue(struct sk_buff *skb, struct Qdisc *sch)
+{
+	struct fq_sched_data *q = qdisc_priv(sch);
+	struct fq_flow *f;
+
+	if (unlikely(sch->q.qlen >= q->plimit))
+		return qdisc_drop(skb, sch);
+
+	f = fq_classify(skb, q);
+	if (f == &q->internal) {
+		q->stat_internal_packets++;
+	} else {
+		if (unlikely(f->qlen >= q->flow_plimit)) {
+			q->stat_flows_plimit++;
+			return qdisc_drop(skb, sch);
+		}
+		if (fq_flow_is_detached(f)) {
+			fq_flow_add_tail(&q->new_flows, f);
+			if (time_after(jiffies, f->age + q->flow_refill_delay))
+				f->credit = max_t(u32, f->credit, q->quantum);
+			q->inactive_flows--;
+		}
+	}
+
+	f->qlen++;
+	flow_queue_add(f, skb);
+
+	sch->qstats.backlog += skb->len;
+	sch->bstats.bytes += skb->len;
+	sch->bstats.packets++;
+	sch->q.qlen++;
+	return NET_XMIT_SUCCESS;
+}
+
+/*
+ * The packet came out of fq_dequeue() last, so it goes back in front of
+ * everything else, its flow included.
+ */
+static int fq_requeue(struct sk_buff *skb, struct Qdisc *sch)
+{
+	struct fq_sched_data *q = qdisc_priv(sch);
+	struct fq_flow *f = &q->internal;
+
+	skb->next = f->head;
+	f->head = skb;
+	if (!skb->next)
+		f->tail = skb;
+	f->qlen++;
+
+	sch->qstats.backlog += skb->len;
+	sch->qstats.requeues++;
+	sch->q.qlen++;
+	return NET_XMIT_SUCCESS;
+}
+
+static void fq_check_throttled(struct fq_sched_data *q, u64 now)
+{
+	struct rb_node *p;
+
+	if (q->time_next_delayed_flow > now)
+		return;
+
+	q->time_next_delayed_flow = ~0ULL;
+	while ((p = rb_first(&q->delayed)) != NULL) {
+		struct fq_flow *f = rb_entry(p, struct fq_flow, rate_node);
+
+		if (f->time_next_packet > now) {
+			q->time_next_delayed_flow = f->time_next_packet;
+			break;
+		}
+		fq_flow_unset_throttled(q, f);
+	}
+}
+
+static int fq_watchdog(struct hrtimer *timer)
+{
+	struct fq_sched_data *q = container_of(timer, struct fq_sched_data,
+					       timer);
+	struct Qdisc *sch = q->sch;
+
+	sch->flags &= ~TCQ_F_THROTTLED;
+	netif_schedule(sch->dev);
+	return HRTIMER_NORESTART;
+}
+
+static void fq_watchdog_schedule(struct Qdisc *sch, u64 expires)
+{
+	struct fq_sched_data *q = qdisc_priv(sch);
+
+	sch->flags |= TCQ_F_THROTTLED;
+	sch->qstats.overlimits++;
+	hrtimer_start(&q->timer, ktime_add_ns(ktime_set(0, 0), expires),
+		      HRTIMER_ABS);
+}
+
+static struct sk_buff *fq_dequeue(struct Qdisc *sch)
+{
+	struct fq_sched_data *q = qdisc_priv(sch);
+	struct fq_flow_head *head;
+	struct sk_buff *skb;
+	struct fq_flow *f;
+	u64 now;
+	u32 rate;
+
+	skb = fq_dequeue_head(sch, &q->internal);
+	if (skb)
+		goto out;
+
+	now = ktime_to_ns(ktime_get());
+	fq_check_throttled(q, now);
+begin:
+	head = &q->new_flows;
+	if (!head->first) {
+		head = &q->old_flows;
+		if (!head->first) {
+			if (q->time_next_delayed_flow != ~0ULL)
+				fq_watchdog_schedule(sch,
+						     q->time_next_delayed_flow);
+			return NULL;
+		}
+	}
+	f = head->first;
+
+	if (f->credit <= 0) {
+		f->credit += q->quantum;
+		head->first = f->next;
+		fq_flow_add_tail(&q->old_flows, f);
+		goto begin;
+	}
+
+	if (unlikely(f->head && now < f->time_next_packet)) {
+		head->first = f->next;
+		fq_flow_set_throttled(q, f);
+		goto begin;
+	}
+
+	skb = fq_dequeue_head(sch, f);
+	if (!skb) {
+		head->first = f->next;
+		/* force a pass through old_flows to prevent starvation */
+		if ((head == &q->new_flows) && q->old_flows.first) {
+			fq_flow_add_tail(&q->old_flows, f);
+		} else {
+			fq_flow_set_detached(f);
+			q->inactive_flows++;
+		}
+		goto begin;
+	}
+	f->credit -= skb->len;
+
+	if (!q->rate_enable)
+		goto out;
+
+	rate = q->flow_max_rate;
+	if (skb->sk)
+		rate = min(skb->sk->sk_pacing_rate, rate);
+
+	if (rate != ~0U) {
+		u64 len = (u64)skb->len * NSEC_PER_SEC;
+
+		if (likely(rate))
+			do_div(len, rate);
+		/* A socket's rate can go up again: don't hold the flow too long */
+		if (unlikely(!rate || len > FQ_MAX_DELAY)) {
+			len = FQ_MAX_DELAY;
+			q->stat_pkts_too_long++;
+		}
+		f->time_next_packet = now + len;
+	}
+out:
+	sch->flags &= ~TCQ_F_THROTTLED;
+	return skb;
+}
+
+/* drop the first packet of the first flow with packets */
+static unsigned int fq_drop(struct Qdisc *sch)
+{
+	struct fq_sched_data *q = qdisc_priv(sch);
+	struct fq_flow *f;
+	struct sk_buff *skb = NULL;
+	unsigned int len;
+
+	for (f = q->old_flows.first; f && !skb; f = f->next)
+		skb = fq_dequeue_head(sch, f);
+	for (f = q->new_flows.first; f && !skb; f = f->next)
+		skb = fq_dequeue_head(sch, f);
+	if (!skb)
+		skb = fq_dequeue_head(sch, &q->internal);
+	if (!skb)
+		return 0;
+
+	len = skb->len;
+	kfree_skb(skb);
+	sch->qstats.drops++;
+	return len;
+}
+
+static void fq_flow_purge(struct fq_flow *flow)
+{
+	struct sk_buff *skb;
+
+	while ((skb = flow->head) != NULL) {
+		flow->head = skb->next;
+		kfree_skb(skb);
+	}
+	flow->tail = NULL;
+	flow->qlen = 0;
+}
+
+static void fq_reset(struct Qdisc *sch)
+{
+	struct fq_sched_data *q = qdisc_priv(sch);
+	struct rb_root *root;
+	struct rb_node *p;
+	struct fq_flow *f;
+	unsigned int idx;
+
+	sch->q.qlen = 0;
+	sch->qstats.backlog = 0;
+
+	fq_flow_purge(&q->internal);
+
+	if (!q->fq_root)
+		return;
+
+	for (idx = 0; idx < (1U << q->fq_trees_log); idx++) {
+		root = &q->fq_root[idx];
+		while ((p = rb_first(root)) != NULL) {
+			f = rb_entry(p, struct fq_flow, fq_node);
+			rb_erase(p, root);
+
+			fq_flow_purge(f);
+
+			kmem_cache_free(fq_flow_cachep, f);
+		}
+	}
+	q->new_flows.first	= NULL;
+	q->old_flows.first	= NULL;
+	q->delayed		= RB_ROOT;
+	q->flows		= 0;
+	q->inactive_flows	= 0;
+	q->throttled_flows	= 0;
+	q->time_next_delayed_flow = ~0ULL;
+
+	sch->flags &= ~TCQ_F_THROTTLED;
+	hrtimer_try_to_cancel(&q->timer);
+}
+
+static struct rb_root *fq_trees_alloc(unsigned int log)
+{
+	unsigned long sz = sizeof(struct rb_root) << log;
+	struct rb_root *array;
+	unsigned int idx;
+
+	if (sz <= PAGE_SIZE)
+		array = kmalloc(sz, GFP_KERNEL);
+	else
+		array = (struct rb_root *)__get_free_pages(GFP_KERNEL,
+							   get_order(sz));
+	if (array)
+		for (idx = 0; idx < (1U << log); idx++)
+			array[idx] = RB_ROOT;
+	return array;
+}
+
+static void fq_trees_free(struct rb_root *array, unsigned int log)
+{
+	unsigned long sz = sizeof(struct rb_root) << log;
+
+	if (sz <= PAGE_SIZE)
+		kfree(array);
+	else
+		free_pages((unsigned long)array, get_order(sz));
+}
+
+static void fq_rehash(struct fq_sched_data *q,
+		      struct rb_root *old_array, u32 old_log,
+		      struct rb_root *new_array, u32 new_log)
+{
+	struct rb_node *op, **np, *parent;
+	struct rb_root *oroot, *nroot;
+	struct fq_flow *of, *nf;
+	int fcnt = 0;
+	u32 idx;
+
+	for (idx = 0; idx < (1U << old_log); idx++) {
+		oroot = &old_array[idx];
+		while ((op = rb_first(oroot)) != NULL) {
+			rb_erase(op, oroot);
+			of = rb_entry(op, struct fq_flow, fq_node);
+			if (fq_gc_candidate(of)) {
+				fcnt++;
+				kmem_cache_free(fq_flow_cachep, of);
+				continue;
+			}
+			nroot = &new_array[hash_long(of->sk, new_log)];
+
+			np = &nroot->rb_node;
+			parent = NULL;
+			while (*np) {
+				parent = *np;
+
+				nf = rb_entry(parent, struct fq_flow, fq_node);
+				BUG_ON(nf->sk == of->sk);
+
+				if (nf->sk > of->sk)
+					np = &parent->rb_right;
+				else
+					np = &parent->rb_left;
+			}
+
+			rb_link_node(&of->fq_node, parent, np);
+			rb_insert_color(&of->fq_node, nroot);
+		}
+	}
+	q->flows -= fcnt;
+	q->inactive_flows -= fcnt;
+	q->stat_gc_flows += fcnt;
+}
+
+static int fq_change(struct Qdisc *sch, struct rtattr *opt)
+{
+	struct fq_sched_data *q = qdisc_priv(sch);
+	struct rtattr *tb[TCA_FQ_MAX];
+	struct rb_root *array = NULL, *old_array;
+	u32 fq_log, old_log;
+	int err = -EINVAL;
+
+	if (opt == NULL || rtattr_parse_nested(tb, TCA_FQ_MAX, opt))
+		return -EINVAL;
+
+	fq_log = q->fq_trees_log;
+	if (tb[TCA_FQ_BUCKETS_LOG-1]) {
+		u32 nval;
+
+		if (RTA_PAYLOAD(tb[TCA_FQ_BUCKETS_LOG-1]) < sizeof(u32))
+			return -EINVAL;
+		nval = *(u32 *)RTA_DATA(tb[TCA_FQ_BUCKETS_LOG-1]);
+		if (nval < 1 || nval > FQ_TREES_LOG_MAX)
+			return -EINVAL;
+		fq_log = nval;
+	}
+	if (!q->fq_root || fq_log != q->fq_trees_log) {
+		array = fq_trees_alloc(fq_log);
+		if (!array)
+			return -ENOMEM;
+	}
+
+	sch_tree_lock(sch);
+
+	if (tb[TCA_FQ_PLIMIT-1])
+		q->plimit = RTA_GET_U32(tb[TCA_FQ_PLIMIT-1]);
+	if (tb[TCA_FQ_FLOW_PLIMIT-1])
+		q->flow_plimit = RTA_GET_U32(tb[TCA_FQ_FLOW_PLIMIT-1]);
+	if (tb[TCA_FQ_QUANTUM-1])
+		q->quantum = RTA_GET_U32(tb[TCA_FQ_QUANTUM-1]);
+	if (tb[TCA_FQ_INITIAL_QUANTUM-1])
+		q->initial_quantum = RTA_GET_U32(tb[TCA_FQ_INITIAL_QUANTUM-1]);
+	if (tb[TCA_FQ_FLOW_MAX_RATE-1])
+		q->flow_max_rate = RTA_GET_U32(tb[TCA_FQ_FLOW_MAX_RATE-1]);
+	if (tb[TCA_FQ_RATE_ENABLE-1])
+		q->rate_enable = !!RTA_GET_U32(tb[TCA_FQ_RATE_ENABLE-1]);
+	if (tb[TCA_FQ_FLOW_REFILL_DELAY-1]) {
+		u32 usecs_delay = RTA_GET_U32(tb[TCA_FQ_FLOW_REFILL_DELAY-1]);
+
+		q->flow_refill_delay = usecs_to_jiffies(usecs_delay);
+	}
+
+	if (array) {
+		old_array = q->fq_root;
+		old_log = q->fq_trees_log;
+		if (old_array)
+			fq_rehash(q, old_array, old_log, array, fq_log);
+		q->fq_root = array;
+		q->fq_trees_log = fq_log;
+		array = old_array;
+		fq_log = old_log;
+	}
+
+	while (sch->q.qlen > q->plimit) {
+		if (!fq_drop(sch))
+			break;
+	}
+	err = 0;
+
+rtattr_failure:
+	sch_tree_unlock(sch);
+	if (array)
+		fq_trees_free(array, fq_log);
+	return err;
+}
+
+static int fq_init(struct Qdisc *sch, struct rtattr *opt)
+{
+	struct fq_sched_data *q = qdisc_priv(sch);
+	u32 mtu = sch->dev->mtu + sch->dev->hard_header_len;
+
+	q->plimit		= 10000;
+	q->flow_plimit		= 100;
+	q->quantum		= 2 * mtu;
+	q->initial_quantum	= 10 * mtu;
+	q->flow_refill_delay	= msecs_to_jiffies(40);
+	q->flow_max_rate	= ~0U;
+	q->rate_enable		= 1;
+	q->new_flows.first	= NULL;
+	q->old_flows.first	= NULL;
+	q->delayed		= RB_ROOT;
+	q->fq_root		= NULL;
+	q->fq_trees_log		= 10;
+	q->time_next_delayed_flow = ~0ULL;
+	q->perturbation		= net_random();
+	q->sch			= sch;
+	hrtimer_init(&q->timer, CLOCK_MONOTONIC, HRTIMER_ABS);
+	q->timer.function	= fq_watchdog;
+
+	if (opt)
+		return fq_change(sch, opt);
+
+	q->fq_root = fq_trees_alloc(q->fq_trees_log);
+	return q->fq_root ? 0 : -ENOMEM;
+}
+
+static void fq_destroy(struct Qdisc *sch)
+{
+	struct fq_sched_data *q = qdisc_priv(sch);
+
+	hrtimer_cancel(&q->timer);
+	fq_reset(sch);
+	if (q->fq_root)
+		fq_trees_free(q->fq_root, q->fq_trees_log);
+}
+
+static int fq_dump(struct Qdisc *sch, struct sk_buff *skb)
+{
+	struct fq_sched_data *q = qdisc_priv(sch);
+	struct rtattr *opts;
+
+	opts = RTA_NEST(skb, TCA_OPTIONS);
+
+	RTA_PUT_U32(skb, TCA_FQ_PLIMIT, q->plimit);
+	RTA_PUT_U32(skb, TCA_FQ_FLOW_PLIMIT, q->flow_plimit);
+	RTA_PUT_U32(skb, TCA_FQ_QUANTUM, q->quantum);
+	RTA_PUT_U32(skb, TCA_FQ_INITIAL_QUANTUM, q->initial_quantum);
+	RTA_PUT_U32(skb, TCA_FQ_RATE_ENABLE, q->rate_enable);
+	RTA_PUT_U32(skb, TCA_FQ_FLOW_MAX_RATE, q->flow_max_rate);
+	RTA_PUT_U32(skb, TCA_FQ_FLOW_REFILL_DELAY,
+		    jiffies_to_usecs(q->flow_refill_delay));
+	RTA_PUT_U32(skb, TCA_FQ_BUCKETS_LOG, q->fq_trees_log);
+
+	return RTA_NEST_END(skb, opts);
+
+rtattr_failure:
+	return RTA_NEST_CANCEL(skb, opts);
+}
+
+static int fq_dump_stats(struct Qdisc *sch, struct gnet_dump *d)
+{
+	struct fq_sched_data *q = qdisc_priv(sch);
+	u64 now = ktime_to_ns(ktime_get());
+	struct tc_fq_qd_stats st = {
+		.gc_flows		= q->stat_gc_flows,
+		.highprio_packets	= q->stat_internal_packets,
+		.too_long_pkts		= q->stat_pkts_too_long,
+		.allocation_errors	= q->stat_allocation_errors,
+		.flows			= q->flows,
+		.inactive_flows		= q->inactive_flows,
+		.throttled_flows	= q->throttled_flows,
+		.throttled		= q->stat_throttled,
+		.flows_plimit		= q->stat_flows_plimit,
+	};
+
+	if (q->time_next_delayed_flow != ~0ULL &&
+	    q->time_next_delayed_flow > now)
+		st.time_next_delayed_flow = q->time_next_delayed_flow - now;
+
+	return gnet_stats_copy_app(d, &st, sizeof(st));
+}
+
+static struct Qdisc_ops fq_qdisc_ops = {
+	.id		=	"fq",
+	.priv_size	=	sizeof(struct fq_sched_data),
+	.enqueue	=	fq_enqueue,
+	.dequeue	=	fq_dequeue,
+	.requeue	=	fq_requeue,
+	.drop		=	fq_drop,
+	.init		=	fq_init,
+	.reset		=	fq_reset,
+	.destroy	=	fq_destroy,
+	.change		=	fq_change,
+	.dump		=	fq_dump,
+	.dump_stats	=	fq_dump_stats,
+	.owner		=	THIS_MODULE,
+};
+
+static int __init fq_module_init(void)
+{
+	int ret;
+
+	fq_flow_cachep = kmem_cache_create("fq_flow_cache",
+					   sizeof(struct fq_flow),
+					   0, 0, NULL, NULL);
+	if (!fq_flow_cachep)
+		return -ENOMEM;
+
+	ret = register_qdisc(&fq_qdisc_ops);
+	if (ret)
+		kmem_cache_destroy(fq_flow_cachep);
+	return ret;
+}
+
+static void __exit fq_module_exit(void)
+{
+	unregister_qdisc(&fq_qdisc_ops);
+	kmem_cache_destroy(fq_flow_cachep);
+}
+
+module_init(fq_module_init)
+module_exit(fq_module_exit)
+MODULE_LICENSE("GPL");
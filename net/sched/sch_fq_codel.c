@@ -0,0 +1,538 @@
+/*
+ * net/sched/sch_fq_codel.c	Fair Queue CoDel discipline
+ *
+ *		This program is free software; you can redistribute it and/or
+ *		modify it under the terms of the GNU General Public License
+ *		as published by the Free Software Foundation; either version
+ *		2 of the License, or (at your option) any later version.
+ *
+ *	Packets are hashed, with a random perturbation as in SFQ, into a
+ *	fixed number of flow queues (1024 by default), each of which runs
+ *	its own CoDel (include/net/codel.h), so a bulk flow filling its
+ *	queue does not delay the packets of the others.
+ *
+ *	Flows are served deficit round robin, quantum bytes per round.
+ *	A flow that becomes active goes on the new_flows list, which is
+ *	served before old_flows: sparse flows (DNS, ACKs, interactive
+ *	traffic) get their packets through ahead of the bulk ones.  A new
+ *	flow that used its quantum, or ran empty, moves to old_flows.
+ *
+ *	When the packet limit is hit, a packet is dropped from the head of
+ *	the flow with the largest backlog in bytes.
+ */
+
+#include <linux/module.h>
+#include <linux/types.h>
+#include <linux/kernel.h>
+#include <linux/jiffies.h>
+#include <linux/string.h>
+#include <linux/errno.h>
+#include <linux/init.h>
+#include <linux/skbuff.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/jhash.h>
+#include <linux/netdevice.h>
+#include <linux/ip.h>
+#include <linux/ipv6.h>
+#include <linux/in.h>
+#include <linux/if_ether.h>
+#include <net/ip.h>
+#include <net/pkt_sched.h>
+#include <net/codel.h>
+
+#define FQ_CODEL_MAX_FLOWS	65536
+
+struct fq_codel_flow {
+	struct sk_buff	  *head;
+	struct sk_buff	  *tail;
+	struct list_head  flowchain;	/* in new_flows or old_flows */
+	int		  deficit;
+	u32		  dropped;	/* number of drops (or ECN marks) on this flow */
+	struct codel_vars cvars;
+}; /* please try to keep this structure <= 64 bytes */
+
+struct fq_codel_sched_data {
+	struct fq_codel_flow *flows;	/* Flows table [flows_cnt] */
+	u32		*backlogs;	/* backlog table [flows_cnt] */
+	u32		flows_cnt;	/* number of flows */
+	u32		perturbation;	/* hash perturbation */
+	u32		quantum;	/* DRR quantum, bytes */
+	struct codel_params cparams;
+	struct codel_stats cstats;
+	u32		limit;
+	u32		drop_overlimit;
+	u32		new_flow_count;
+
+	struct list_head new_flows;	/* list of new flows */
+	struct list_head old_flows;	/* list of old flows */
+};
+
+static unsigned int fq_codel_hash(const struct fq_codel_sched_data *q,
+				  const struct sk_buff *skb)
+{
+	u32 h, h2;
+
+	switch (skb->protocol) {
+	case __constant_htons(ETH_P_IP):
+	{
+		const struct iphdr *iph = skb->nh.iph;
+
+		h = iph->daddr;
+		h2 = iph->saddr ^ iph->protocol;
+		if (!(iph->frag_off & htons(IP_MF | IP_OFFSET)) &&
+		    (iph->protocol == IPPROTO_TCP ||
+		     iph->protocol == IPPROTO_UDP ||
+		     iph->protocol == IPPROTO_SCTP ||
+		     iph->protocol == IPPROTO_DCCP ||
+		     iph->protocol == IPPROTO_ESP))
+			h2 ^= *(((u32 *)iph) + iph->ihl);
+		break;
+	}
+	case __constant_htons(ETH_P_IPV6):
+	{
+		const struct ipv6hdr *iph = skb->nh.ipv6h;
+
+		h = iph->daddr.s6_addr32[3];
+		h2 = iph->saddr.s6_addr32[3] ^ iph->nexthdr;
+		if (iph->nexthdr == IPPROTO_TCP ||
+		    iph->nexthdr == IPPROTO_UDP ||
+		    iph->nexthdr == IPPROTO_SCTP ||
+		    iph->nexthdr == IPPROTO_DCCP ||
+		    iph->nexthdr == IPPROTO_ESP)
+			h2 ^= *(u32 *)&iph[1];
+		break;
+	}
+	default:
+		h = (u32)(unsigned long)skb->dst ^ skb->protocol;
+		h2 = (u32)(unsigned long)skb->sk;
+	}
+	return jhash_2words(h, h2, q->perturbation) % q->flows_cnt;
+}
+
+/* helper functions : might be changed when/if skb use a standard list_head */
+
+/* remove one skb from head of slot queue */
+static inline struct sk_buff *dequeue_head(struct fq_codel_flow *flow)
+{
+	struct sk_buff *skb = flow->head;
+
+	flow->head = skb->next;
+	skb->next = NULL;
+	return skb;
+}
+
+/* add skb to flow queue (tail add) */
+static inline void flow_queue_add(struct fq_codel_flow *flow,
+				  struct sk_buff *skb)
+{
+	if (flow->head == NULL)
+		flow->head = skb;
+	else
+		flow->tail->next = skb;
+	flow->tail = skb;
+	skb->next = NULL;
+}
+
+/* drops a packet from the head of the fattest flow and returns its index */
+static unsigned int fq_codel_drop_fat(struct Qdisc *sch, unsigned int *len)
+{
+	struct fq_codel_sched_data *q = qdisc_priv(sch);
+	struct sk_buff *skb;
+	unsigned int maxbacklog = 0, idx = 0, i;
+	struct fq_codel_flow *flow;
+
+	/* Queue is full! Find the fat flow and drop packet from it.
+	 * This might sound expensive, but with 1024 flows, we scan
+	 * 4KB of memory, and we dont need to handle a complex tree
+	 * in fast path (packet queue/enqueue) with many cache misses.
+	 */
+	for (i = 0; i < q->flows_cnt; i++) {
+		if (q->backlogs[i] > maxbacklog) {
+			maxbacklog = q->backlogs[i];
+			idx = i;
+		}
+	}
+	flow = &q->flows[idx];
+	*len = 0;
+	if (!flow->head)
+		return idx;
+	skb = dequeue_head(flow);
+	*len = skb->len;
+	q->backlogs[idx] -= *len;
+	kfree_skb(skb);
+	sch->q.qlen--;
+	sch->qstats.drops++;
+	sch->qstats.backlog -= *len;
+	flow->dropped++;
+	return idx;
+}
+
+static unsigned int fq_codel_drop(struct Qdisc *sch)
+{
+	unsigned int len;
+
+	fq_codel_drop_fat(sch, &len);
+	return len;
+}
+
+static int fq_codel_enqueue(struct sk_buff *skb, struct Qdisc *sch)
+{
+	struct fq_codel_sched_data *q = qdisc_priv(sch);
+	unsigned int idx, len;
+	struct fq_codel_flow *flow;
+
+	idx = fq_codel_hash(q, skb);
+	codel_set_enqueue_time(skb);
+	flow = &q->flows[idx];
+	flow_queue_add(flow, skb);
+	q->backlogs[idx] += skb->len;
+	sch->qstats.backlog += skb->len;
+	sch->bstats.bytes += skb->len;
+	sch->bstats.packets++;
+
+	if (list_empty(&flow->flowchain)) {
+		list_add_tail(&flow->flowchain, &q->new_flows);
+		q->new_flow_count++;
+		flow->deficit = q->quantum;
+		flow->dropped = 0;
+	}
+	if (++sch->q.qlen <= q->limit)
+		return NET_XMIT_SUCCESS;
+
+	q->drop_overlimit++;
+	/* Return Congestion Notification only if we dropped a packet
+	 * from this flow; otherwise this one is queued, and the parents
+	 * have to forget the one that was dropped.
+	 */
+	if (fq_codel_drop_fat(sch, &len) == idx)
+		return NET_XMIT_CN;
+
+	qdisc_tree_decrease_qlen(sch, 1);
+	return NET_XMIT_SUCCESS;
+}
+
+/* This is the specific function called from codel_dequeue()
+ * to dequeue a packet from queue. Note: backlog is handled in
+ * codel, we dont need to reduce it here.
+ */
+static struct sk_buff *dequeue(struct codel_vars *vars, struct Qdisc *sch)
+{
+	struct fq_codel_sched_data *q = qdisc_priv(sch);
+	struct fq_codel_flow *flow;
+	struct sk_buff *skb = NULL;
+
+	flow = container_of(vars, struct fq_codel_flow, cvars);
+	if (flow->head) {
+		skb = dequeue_head(flow);
+		q->backlogs[flow - q->flows] -= skb->len;
+		sch->q.qlen--;
+	}
+	return skb;
+}
+
+static struct sk_buff *fq_codel_dequeue(struct Qdisc *sch)
+{
+	struct fq_codel_sched_data *q = qdisc_priv(sch);
+	struct sk_buff *skb;
+	struct fq_codel_flow *flow;
+	struct list_head *head;
+	u32 prev_drop_count, prev_ecn_mark;
+
+begin:
+	head = &q->new_flows;
+	if (list_empty(head)) {
+		head = &q->old_flows;
+		if (list_empty(head)) {
+			skb = NULL;
+			goto out;
+		}
+	}
+	flow = list_entry(head->next, struct fq_codel_flow, flowchain);
+
+	if (flow->deficit <= 0) {
+		flow->deficit += q->quantum;
+		list_move_tail(&flow->flowchain, &q->old_flows);
+		goto begin;
+	}
+
+	prev_drop_count = q->cstats.drop_count;
+	prev_ecn_mark = q->cstats.ecn_mark;
+
+	skb = codel_dequeue(sch, &q->cparams, &flow->cvars, &q->cstats,
+			    dequeue);
+
+	flow->dropped += q->cstats.drop_count - prev_drop_count;
+	flow->dropped += q->cstats.ecn_mark - prev_ecn_mark;
+
+	if (!skb) {
+		/* force a pass through old_flows to prevent starvation */
+		if ((head == &q->new_flows) && !list_empty(&q->old_flows))
+			list_move_tail(&flow->flowchain, &q->old_flows);
+		else
+			list_del_init(&flow->flowchain);
+		goto begin;
+	}
+	flow->deficit -= skb->len;
+out:
+	/* the parents counted the packets codel dropped in */
+	if (q->cstats.drop_count) {
+		qdisc_tree_decrease_qlen(sch, q->cstats.drop_count);
+		q->cstats.drop_count = 0;
+	}
+	return skb;
+}
+
+/* The packet goes back to the head of its flow, with its enqueue time */
+static int fq_codel_requeue(struct sk_buff *skb, struct Qdisc *sch)
+{
+	struct fq_codel_sched_data *q = qdisc_priv(sch);
+	unsigned int idx = fq_codel_hash(q, skb);
+	struct fq_codel_flow *flow = &q->flows[idx];
+
+	skb->next = flow->head;
+	if (flow->head == NULL)
+		flow->tail = skb;
+	flow->head = skb;
+	q->backlogs[idx] += skb->len;
+	sch->qstats.backlog += skb->len;
+	sch->q.qlen++;
+	sch->qstats.requeues++;
+
+	if (list_empty(&flow->flowchain)) {
+		list_add(&flow->flowchain, &q->new_flows);
+		flow->deficit = q->quantum;
+	} else {
+		flow->deficit += skb->len;
+	}
+	return NET_XMIT_SUCCESS;
+}
+
+static void fq_codel_reset(struct Qdisc *sch)
+{
+	struct fq_codel_sched_data *q = qdisc_priv(sch);
+	struct sk_buff *skb;
+	unsigned int i;
+
+	INIT_LIST_HEAD(&q->new_flows);
+	INIT_LIST_HEAD(&q->old_flows);
+	for (i = 0; i < q->flows_cnt; i++) {
+		struct fq_codel_flow *flow = q->flows + i;
+
+		while (flow->head) {
+			skb = dequeue_head(flow);
+			kfree_skb(skb);
+		}
+		INIT_LIST_HEAD(&flow->flowchain);
+		codel_vars_init(&flow->cvars);
+		q->backlogs[i] = 0;
+	}
+	sch->q.qlen = 0;
+	sch->qstats.backlog = 0;
+	q->cstats.drop_count = 0;
+}
+
+static int fq_codel_change(struct Qdisc *sch, struct rtattr *opt)
+{
+	struct fq_codel_sched_data *q = qdisc_priv(sch);
+	struct rtattr *tb[TCA_FQ_CODEL_MAX];
+	unsigned int qlen, len;
+	int err = -EINVAL;
+
+	if (opt == NULL || rtattr_parse_nested(tb, TCA_FQ_CODEL_MAX, opt))
+		return -EINVAL;
+
+	if (tb[TCA_FQ_CODEL_FLOWS-1]) {
+		u32 flows;
+
+		/* the flow table is sized once, at creation */
+		if (q->flows ||
+		    RTA_PAYLOAD(tb[TCA_FQ_CODEL_FLOWS-1]) < sizeof(u32))
+			return -EINVAL;
+		flows = *(u32 *)RTA_DATA(tb[TCA_FQ_CODEL_FLOWS-1]);
+		if (!flows || flows > FQ_CODEL_MAX_FLOWS)
+			return -EINVAL;
+		q->flows_cnt = flows;
+	}
+
+	sch_tree_lock(sch);
+
+	if (tb[TCA_FQ_CODEL_TARGET-1]) {
+		u32 target = RTA_GET_U32(tb[TCA_FQ_CODEL_TARGET-1]);
+
+		q->cparams.target = ((u64)target * NSEC_PER_USEC) >> CODEL_SHIFT;
+	}
+	if (tb[TCA_FQ_CODEL_INTERVAL-1]) {
+		u32 interval = RTA_GET_U32(tb[TCA_FQ_CODEL_INTERVAL-1]);
+
+		q->cparams.interval = ((u64)interval * NSEC_PER_USEC) >> CODEL_SHIFT;
+	}
+	if (tb[TCA_FQ_CODEL_LIMIT-1])
+		q->limit = RTA_GET_U32(tb[TCA_FQ_CODEL_LIMIT-1]);
+	if (tb[TCA_FQ_CODEL_ECN-1])
+		q->cparams.ecn = !!RTA_GET_U32(tb[TCA_FQ_CODEL_ECN-1]);
+	if (tb[TCA_FQ_CODEL_QUANTUM-1]) {
+		u32 quantum = RTA_GET_U32(tb[TCA_FQ_CODEL_QUANTUM-1]);
+
+		q->quantum = max(256U, quantum);
+	}
+
+	qlen = sch->q.qlen;
+	while (sch->q.qlen > q->limit)
+		fq_codel_drop_fat(sch, &len);
+	qdisc_tree_decrease_qlen(sch, qlen - sch->q.qlen);
+	err = 0;
+
+rtattr_failure:
+	sch_tree_unlock(sch);
+	return err;
+}
+
+static void *fq_codel_zalloc(size_t sz)
+{
+	void *ptr;
+
+	if (sz <= PAGE_SIZE)
+		return kzalloc(sz, GFP_KERNEL);
+	ptr = vmalloc(sz);
+	if (ptr)
+		memset(ptr, 0, sz);
+	return ptr;
+}
+
+static void fq_codel_free(void *addr, size_t sz)
+{
+	if (sz <= PAGE_SIZE)
+		kfree(addr);
+	else
+		vfree(addr);
+}
+
+static void fq_codel_destroy(struct Qdisc *sch)
+{
+	struct fq_codel_sched_data *q = qdisc_priv(sch);
+
+	if (q->flows) {
+		fq_codel_reset(sch);
+		fq_codel_free(q->flows,
+			      q->flows_cnt * sizeof(struct fq_codel_flow));
+	}
+	if (q->backlogs)
+		fq_codel_free(q->backlogs, q->flows_cnt * sizeof(u32));
+}
+
+static int fq_codel_init(struct Qdisc *sch, struct rtattr *opt)
+{
+	struct fq_codel_sched_data *q = qdisc_priv(sch);
+	unsigned int i;
+
+	q->limit = 10*1024;
+	q->flows_cnt = 1024;
+	q->quantum = sch->dev->mtu + sch->dev->hard_header_len;
+	q->perturbation = net_random();
+	INIT_LIST_HEAD(&q->new_flows);
+	INIT_LIST_HEAD(&q->old_flows);
+	codel_params_init(&q->cparams, q->quantum);
+	codel_stats_init(&q->cstats);
+	q->cparams.ecn = 1;
+
+	if (opt) {
+		int err = fq_codel_change(sch, opt);
+
+		if (err)
+			return err;
+	}
+
+	q->flows = fq_codel_zalloc(q->flows_cnt *
+				   sizeof(struct fq_codel_flow));
+	q->backlogs = fq_codel_zalloc(q->flows_cnt * sizeof(u32));
+	if (!q->flows || !q->backlogs) {
+		if (q->flows)
+			fq_codel_free(q->flows, q->flows_cnt *
+				      sizeof(struct fq_codel_flow));
+		if (q->backlogs)
+			fq_codel_free(q->backlogs, q->flows_cnt * sizeof(u32));
+		q->flows = NULL;
+		q->backlogs = NULL;
+		return -ENOMEM;
+	}
+	for (i = 0; i < q->flows_cnt; i++) {
+		struct fq_codel_flow *flow = q->flows + i;
+
+		INIT_LIST_HEAD(&flow->flowchain);
+	}
+	return 0;
+}
+
+static int fq_codel_dump(struct Qdisc *sch, struct sk_buff *skb)
+{
+	struct fq_codel_sched_data *q = qdisc_priv(sch);
+	struct rtattr *opts;
+
+	opts = RTA_NEST(skb, TCA_OPTIONS);
+
+	RTA_PUT_U32(skb, TCA_FQ_CODEL_TARGET,
+		    codel_time_to_us(q->cparams.target));
+	RTA_PUT_U32(skb, TCA_FQ_CODEL_LIMIT, q->limit);
+	RTA_PUT_U32(skb, TCA_FQ_CODEL_INTERVAL,
+		    codel_time_to_us(q->cparams.interval));
+	RTA_PUT_U32(skb, TCA_FQ_CODEL_ECN, q->cparams.ecn);
+	RTA_PUT_U32(skb, TCA_FQ_CODEL_QUANTUM, q->quantum);
+	RTA_PUT_U32(skb, TCA_FQ_CODEL_FLOWS, q->flows_cnt);
+
+	return RTA_NEST_END(skb, opts);
+
+rtattr_failure:
+	return RTA_NEST_CANCEL(skb, opts);
+}
+
+static int fq_codel_dump_stats(struct Qdisc *sch, struct gnet_dump *d)
+{
+	struct fq_codel_sched_data *q = qdisc_priv(sch);
+	struct tc_fq_codel_xstats st = {
+		.maxpacket	= q->cstats.maxpacket,
+		.drop_overlimit	= q->drop_overlimit,
+		.ecn_mark	= q->cstats.ecn_mark,
+		.new_flow_count	= q->new_flow_count,
+	};
+	struct list_head *pos;
+
+	list_for_each(pos, &q->new_flows)
+		st.new_flows_len++;
+
+	list_for_each(pos, &q->old_flows)
+		st.old_flows_len++;
+
+	return gnet_stats_copy_app(d, &st, sizeof(st));
+}
+
+static struct Qdisc_ops fq_codel_qdisc_ops = {
+	.id		=	"fq_codel",
+	.priv_size	=	sizeof(struct fq_codel_sched_data),
+	.enqueue	=	fq_codel_enqueue,
+	.dequeue	=	fq_codel_dequeue,
+	.requeue	=	fq_codel_requeue,
+	.drop		=	fq_codel_drop,
+	.init		=	fq_codel_init,
+	.reset		=	fq_codel_reset,
+	.destroy	=	fq_codel_destroy,
+	.change		=	fq_codel_change,
+	.dump		=	fq_codel_dump,
+	.dump_stats	=	fq_codel_dump_stats,
+	.owner		=	THIS_MODULE,
+};
+
+static int __init fq_codel_module_init(void)
+{
+	return register_qdisc(&fq_codel_qdisc_ops);
+}
+
+static void __exit fq_codel_module_exit(void)
+{
+	unregister_qdisc(&fq_codel_qdisc_ops);
+}
+
+module_init(fq_codel_module_init)
+module_exit(fq_codel_module_exit)
+MODULE_DESCRIPTION("Fair Queue CoDel discipline");
+MODULE_LICENSE("GPL");
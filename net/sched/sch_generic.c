@@ -89,16 +89,132 @@ void qdisc_unlock_tree(struct net_device *dev)
    NOTE: Called under dev->queue_lock with locally disabled BH.
 */
 
+/* Requeue a packet that did not go out, for the next qdisc_restart */
+
+static inline void qdisc_requeue_skb(struct sk_buff *skb, struct Qdisc *q,
+				     struct sk_buff **gso_skb)
+{
+	if (skb->next)
+		*gso_skb = skb;
+	else
+		q->ops->requeue(skb, q);
+}
+
+/* qdisc_restart() of a multiqueue device.
+
+   The packets come from the qdisc of the queue @root, or from the root
+   qdisc of the device if @root is NULL, and each of them goes out under
+   the transmit lock of the queue it is mapped to only.  A packet to a
+   stopped queue waits in the qdisc until netif_wake_subqueue() or
+   netif_tx_unlock() schedules it again.
+
+   NOTE: Called under the lock of the qdisc with locally disabled BH.
+*/
+
+static int qdisc_restart_mq(struct net_device *dev, struct netdev_queue *root)
+{
+	spinlock_t *lock = root ? &root->lock : &dev->queue_lock;
+	struct sk_buff **gso_skb = root ? &root->gso_skb : &dev->gso_skb;
+	struct Qdisc *q = root ? root->qdisc : dev->qdisc;
+	unsigned nolock = (dev->features & NETIF_F_LLTX);
+	struct netdev_queue *txq;
+	struct sk_buff *skb;
+	int ret;
+
+	if (!(skb = *gso_skb) && !(skb = q->dequeue(q))) {
+		BUG_ON((int) q->q.qlen < 0);
+		return q->q.qlen;
+	}
+	*gso_skb = NULL;
+
+	txq = netdev_get_tx_queue(dev, skb->queue_mapping);
+	if (netif_tx_queue_stopped(txq))
+		goto stopped;
+
+	if (!nolock && !netif_tx_queue_trylock(txq)) {
+	collision:
+		if (txq->xmit_lock_owner == smp_processor_id()) {
+			kfree_skb(skb);
+			if (net_ratelimit())
+				printk(KERN_DEBUG "Dead loop on netdevice %s, fix it urgently!\n", dev->name);
+			return -1;
+		}
+		__get_cpu_var(netdev_rx_stat).cpu_collision++;
+		qdisc_requeue_skb(skb, q, gso_skb);
+		__netif_schedule_queue(txq);
+		return 1;
+	}
+
+	spin_unlock(lock);
+
+	ret = NETDEV_TX_BUSY;
+	if (!netif_tx_queue_stopped(txq))
+		ret = dev_hard_start_xmit(skb, dev);
+	if (!nolock)
+		netif_tx_queue_unlock(txq);
+
+	spin_lock(lock);
+	if (ret == NETDEV_TX_OK)
+		return -1;
+	q = root ? root->qdisc : dev->qdisc;
+	if (ret == NETDEV_TX_LOCKED && nolock)
+		goto collision;
+
+	/* NETDEV_TX_BUSY: the driver should have stopped its queue */
+	if (!netif_tx_queue_stopped(txq)) {
+		qdisc_requeue_skb(skb, q, gso_skb);
+		__netif_schedule_queue(txq);
+		return 1;
+	}
+
+stopped:
+	qdisc_requeue_skb(skb, q, gso_skb);
+
+	/* The queue may have been woken before the packet went back */
+	smp_mb();
+	if (!netif_tx_queue_stopped(txq))
+		__netif_schedule_queue(txq);
+	return 1;
+}
+
+/* Number of packets qdisc_restart() takes from the qdisc at a time and
+   hands to the driver under one transmit lock, all but the last with
+   skb->xmit_more set, so that the driver tells the hardware about them
+   once rather than once per packet.
+ */
+#define QDISC_XMIT_BATCH	8
+
+/* Put back the packets that did not go out, the last one first */
+
+static void qdisc_requeue_batch(struct net_device *dev, struct Qdisc *q,
+				struct sk_buff **batch, int from, int n)
+{
+	while (n-- > from)
+		qdisc_requeue_skb(batch[n], q, &dev->gso_skb);
+}
+
 static inline int qdisc_restart(struct net_device *dev)
 {
 	struct Qdisc *q = dev->qdisc;
+	struct sk_buff *batch[QDISC_XMIT_BATCH];
 	struct sk_buff *skb;
+	int n = 0, i = 0;
 
-	/* Dequeue packet */
-	if (((skb = dev->gso_skb)) || ((skb = q->dequeue(q)))) {
-		unsigned nolock = (dev->features & NETIF_F_LLTX);
+	if (netif_is_multiqueue(dev))
+		return qdisc_restart_mq(dev, NULL);
 
+	/* Dequeue packets */
+	if ((skb = dev->gso_skb)) {
 		dev->gso_skb = NULL;
+		batch[n++] = skb;
+	}
+	while (n < QDISC_XMIT_BATCH && (n == 0 || q->q.qlen) &&
+	       (skb = q->dequeue(q)))
+		batch[n++] = skb;
+
+	if (n) {
+		unsigned nolock = (dev->features & NETIF_F_LLTX);
+		int ret;
 
 		/*
 		 * When the driver has LLTX set it does its own locking
@@ -117,10 +233,11 @@ static inline int qdisc_restart(struct net_device *dev)
 				/* It may be transient configuration error,
 				   when hard_start_xmit() recurses. We detect
 				   it by checking xmit owner and drop the
-				   packet when deadloop is detected.
+				   packets when deadloop is detected.
 				*/
 				if (dev->xmit_lock_owner == smp_processor_id()) {
-					kfree_skb(skb);
+					for (; i < n; i++)
+						kfree_skb(batch[i]);
 					if (net_ratelimit())
 						printk(KERN_DEBUG "Dead loop on netdevice %s, fix it urgently!\n", dev->name);
 					return -1;
@@ -134,30 +251,27 @@ static inline int qdisc_restart(struct net_device *dev)
 			/* And release queue */
 			spin_unlock(&dev->queue_lock);
 
-			if (!netif_queue_stopped(dev)) {
-				int ret;
-
-				ret = dev_hard_start_xmit(skb, dev);
-				if (ret == NETDEV_TX_OK) { 
-					if (!nolock) {
-						netif_tx_unlock(dev);
-					}
-					spin_lock(&dev->queue_lock);
-					return -1;
-				}
-				if (ret == NETDEV_TX_LOCKED && nolock) {
-					spin_lock(&dev->queue_lock);
-					goto collision; 
-				}
+			for (i = 0; i < n; i++) {
+				ret = NETDEV_TX_BUSY;
+				if (netif_queue_stopped(dev))
+					break;
+				batch[i]->xmit_more = (i + 1 < n);
+				ret = dev_hard_start_xmit(batch[i], dev);
+				if (ret != NETDEV_TX_OK)
+					break;
 			}
 
-			/* NETDEV_TX_BUSY - we need to requeue */
 			/* Release the driver */
-			if (!nolock) { 
+			if (!nolock) {
 				netif_tx_unlock(dev);
-			} 
+			}
 			spin_lock(&dev->queue_lock);
+			if (i == n)
+				return -1;
 			q = dev->qdisc;
+			if (ret == NETDEV_TX_LOCKED && nolock)
+				goto collision;
+			/* NETDEV_TX_BUSY - we need to requeue */
 		}
 
 		/* Device kicked us out :(
@@ -171,10 +285,7 @@ static inline int qdisc_restart(struct net_device *dev)
 		 */
 
 requeue:
-		if (skb->next)
-			dev->gso_skb = skb;
-		else
-			q->ops->requeue(skb, q);
+		qdisc_requeue_batch(dev, q, batch, i, n);
 		netif_schedule(dev);
 		return 1;
 	}
@@ -194,6 +305,35 @@ out:
 	clear_bit(__LINK_STATE_QDISC_RUNNING, &dev->state);
 }
 
+void __qdisc_run_queue(struct netdev_queue *txq)
+{
+	if (unlikely(txq->qdisc == &noop_qdisc))
+		goto out;
+
+	while (qdisc_restart_mq(txq->dev, txq) < 0 &&
+	       !netif_tx_queue_stopped(txq))
+		/* NOTHING */;
+
+out:
+	clear_bit(__QUEUE_STATE_QDISC_RUNNING, &txq->state);
+}
+
+/* Is the device, or one of its rings, stopped? */
+
+static int dev_tx_stopped(struct net_device *dev)
+{
+	unsigned int i;
+
+	if (netif_queue_stopped(dev))
+		return 1;
+	if (!netif_is_multiqueue(dev))
+		return 0;
+	for (i = 0; i < dev->num_tx_queues; i++)
+		if (test_bit(__QUEUE_STATE_XOFF, &dev->tx_queues[i].state))
+			return 1;
+	return 0;
+}
+
 static void dev_watchdog(unsigned long arg)
 {
 	struct net_device *dev = (struct net_device *)arg;
@@ -203,7 +343,7 @@ static void dev_watchdog(unsigned long arg)
 		if (netif_device_present(dev) &&
 		    netif_running(dev) &&
 		    netif_carrier_ok(dev)) {
-			if (netif_queue_stopped(dev) &&
+			if (dev_tx_stopped(dev) &&
 			    time_after(jiffies, dev->trans_start + dev->watchdog_timeo)) {
 
 				printk(KERN_INFO "NETDEV WATCHDOG: %s: transmit timed out\n",
@@ -323,6 +463,27 @@ static struct Qdisc noqueue_qdisc = {
 };
 
 
+/* Root of a multiqueue device which has a qdisc on each of its queues:
+   dev_queue_xmit() goes straight to the qdisc of the queue of a packet.
+ */
+
+static struct Qdisc_ops mq_qdisc_ops = {
+	.id		=	"mq",
+	.priv_size	=	0,
+	.enqueue	=	noop_enqueue,
+	.dequeue	=	noop_dequeue,
+	.requeue	=	noop_requeue,
+	.owner		=	THIS_MODULE,
+};
+
+struct Qdisc mq_qdisc = {
+	.enqueue	=	noop_enqueue,
+	.dequeue	=	noop_dequeue,
+	.flags		=	TCQ_F_BUILTIN,
+	.ops		=	&mq_qdisc_ops,
+	.list		=	LIST_HEAD_INIT(mq_qdisc.list),
+};
+
 static const u8 prio2band[TC_PRIO_MAX+1] =
 	{ 1, 2, 2, 2, 1, 2, 0, 0 , 1, 1, 1, 1, 1, 1, 1, 1 };
 
@@ -533,6 +694,32 @@ void qdisc_destroy(struct Qdisc *qdisc)
 	call_rcu(&qdisc->q_rcu, __qdisc_destroy);
 }
 
+/* Give each queue of a multiqueue device a default qdisc of its own.
+   They are kept while a root qdisc is set up with tc, and used again
+   when it goes away.
+ */
+
+static int dev_create_queue_qdiscs(struct net_device *dev)
+{
+	unsigned int i;
+
+	for (i = 0; i < dev->num_tx_queues; i++) {
+		struct netdev_queue *txq = &dev->tx_queues[i];
+		struct Qdisc *qdisc;
+
+		if (txq->qdisc_sleeping != &noop_qdisc)
+			continue;
+		qdisc = qdisc_create_dflt(dev, &pfifo_fast_ops);
+		if (qdisc == NULL)
+			return -ENOBUFS;
+		qdisc->stats_lock = &txq->lock;
+		write_lock_bh(&qdisc_tree_lock);
+		txq->qdisc_sleeping = qdisc;
+		write_unlock_bh(&qdisc_tree_lock);
+	}
+	return 0;
+}
+
 void dev_activate(struct net_device *dev)
 {
 	/* No queueing discipline is attached to device;
@@ -543,7 +730,13 @@ void dev_activate(struct net_device *dev)
 
 	if (dev->qdisc_sleeping == &noop_qdisc) {
 		struct Qdisc *qdisc;
-		if (dev->tx_queue_len) {
+		if (dev->tx_queue_len && netif_is_multiqueue(dev)) {
+			if (dev_create_queue_qdiscs(dev)) {
+				printk(KERN_INFO "%s: activation failed\n", dev->name);
+				return;
+			}
+			qdisc = &mq_qdisc;
+		} else if (dev->tx_queue_len) {
 			qdisc = qdisc_create_dflt(dev, &pfifo_fast_ops);
 			if (qdisc == NULL) {
 				printk(KERN_INFO "%s: activation failed\n", dev->name);
@@ -564,6 +757,19 @@ void dev_activate(struct net_device *dev)
 		/* Delay activation until next carrier-on event */
 		return;
 
+	/* The queues first, they are fed as soon as mq_qdisc is seen */
+	if (dev->qdisc_sleeping == &mq_qdisc) {
+		unsigned int i;
+
+		for (i = 0; i < dev->num_tx_queues; i++) {
+			struct netdev_queue *txq = &dev->tx_queues[i];
+
+			spin_lock_bh(&txq->lock);
+			txq->qdisc = txq->qdisc_sleeping;
+			spin_unlock_bh(&txq->lock);
+		}
+	}
+
 	spin_lock_bh(&dev->queue_lock);
 	rcu_assign_pointer(dev->qdisc, dev->qdisc_sleeping);
 	if (dev->qdisc != &noqueue_qdisc) {
@@ -576,6 +782,7 @@ void dev_activate(struct net_device *dev)
 void dev_deactivate(struct net_device *dev)
 {
 	struct Qdisc *qdisc;
+	unsigned int i;
 
 	spin_lock_bh(&dev->queue_lock);
 	qdisc = dev->qdisc;
@@ -585,6 +792,16 @@ void dev_deactivate(struct net_device *dev)
 
 	spin_unlock_bh(&dev->queue_lock);
 
+	for (i = 0; i < dev->num_tx_queues && netif_is_multiqueue(dev); i++) {
+		struct netdev_queue *txq = &dev->tx_queues[i];
+
+		spin_lock_bh(&txq->lock);
+		qdisc = txq->qdisc;
+		txq->qdisc = &noop_qdisc;
+		qdisc_reset(qdisc);
+		spin_unlock_bh(&txq->lock);
+	}
+
 	dev_watchdog_down(dev);
 
 	/* Wait for outstanding dev_queue_xmit calls. */
@@ -598,14 +815,31 @@ void dev_deactivate(struct net_device *dev)
 		kfree_skb(dev->gso_skb);
 		dev->gso_skb = NULL;
 	}
+
+	for (i = 0; i < dev->num_tx_queues && netif_is_multiqueue(dev); i++) {
+		struct netdev_queue *txq = &dev->tx_queues[i];
+
+		while (test_bit(__QUEUE_STATE_QDISC_RUNNING, &txq->state))
+			yield();
+		if (txq->gso_skb) {
+			kfree_skb(txq->gso_skb);
+			txq->gso_skb = NULL;
+		}
+	}
 }
 
 void dev_init_scheduler(struct net_device *dev)
 {
+	unsigned int i;
+
 	qdisc_lock_tree(dev);
 	dev->qdisc = &noop_qdisc;
 	dev->qdisc_sleeping = &noop_qdisc;
 	INIT_LIST_HEAD(&dev->qdisc_list);
+	for (i = 0; i < dev->num_tx_queues && netif_is_multiqueue(dev); i++) {
+		dev->tx_queues[i].qdisc = &noop_qdisc;
+		dev->tx_queues[i].qdisc_sleeping = &noop_qdisc;
+	}
 	qdisc_unlock_tree(dev);
 
 	dev_watchdog_init(dev);
@@ -614,12 +848,21 @@ void dev_init_scheduler(struct net_device *dev)
 void dev_shutdown(struct net_device *dev)
 {
 	struct Qdisc *qdisc;
+	unsigned int i;
 
 	qdisc_lock_tree(dev);
 	qdisc = dev->qdisc_sleeping;
 	dev->qdisc = &noop_qdisc;
 	dev->qdisc_sleeping = &noop_qdisc;
 	qdisc_destroy(qdisc);
+	for (i = 0; i < dev->num_tx_queues && netif_is_multiqueue(dev); i++) {
+		struct netdev_queue *txq = &dev->tx_queues[i];
+
+		qdisc = txq->qdisc_sleeping;
+		txq->qdisc = &noop_qdisc;
+		txq->qdisc_sleeping = &noop_qdisc;
+		qdisc_destroy(qdisc);
+	}
 #if defined(CONFIG_NET_SCH_INGRESS) || defined(CONFIG_NET_SCH_INGRESS_MODULE)
         if ((qdisc = dev->qdisc_ingress) != NULL) {
 		dev->qdisc_ingress = NULL;
@@ -635,6 +878,7 @@ EXPORT_SYMBOL(netif_carrier_on);
 EXPORT_SYMBOL(netif_carrier_off);
 EXPORT_SYMBOL(noop_qdisc);
 EXPORT_SYMBOL(noop_qdisc_ops);
+EXPORT_SYMBOL(mq_qdisc);
 EXPORT_SYMBOL(qdisc_create_dflt);
 EXPORT_SYMBOL(qdisc_alloc);
 EXPORT_SYMBOL(qdisc_destroy);
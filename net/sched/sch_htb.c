@@ -68,7 +68,8 @@
     one less than their parent.
 */
 
-#define HTB_HSIZE 16	/* classid hash size */
+#define HTB_HSIZE 16	/* initial classid hash size, rate computer slots */
+#define HTB_HMAX 65536	/* classid hash limit (minor ids are 16 bit) */
 #define HTB_EWMAC 2	/* rate average over HTB_EWMAC*HTB_HSIZE sec */
 #undef HTB_DEBUG	/* compile debugging support (activated by tc tool) */
 #define HTB_RATECM 1    /* whether to use rate computer */
@@ -216,7 +217,10 @@ static __inline__ long L2T(struct htb_class *cl,struct qdisc_rate_table *rate,
 struct htb_sched
 {
     struct list_head root;			/* root classes list */
-    struct list_head hash[HTB_HSIZE];		/* hashed by classid */
+    struct list_head *hash;			/* hashed by classid */
+    unsigned int hmask;				/* hash size - 1 */
+    unsigned int hcount;			/* classes in hash */
+    struct list_head hash0[HTB_HSIZE];		/* until the hash grows */
     struct list_head drops[TC_HTB_NUMPRIO];	/* active leaves (for drops) */
     
     /* self list - roots of self generating tree */
@@ -249,7 +253,7 @@ struct htb_sched
     struct timer_list timer;	/* send delay timer */
 #ifdef HTB_RATECM
     struct timer_list rttim;	/* rate computer timer */
-    int recmp_bucket;		/* which hash bucket to recompute next */
+    int recmp_bucket;		/* which rate slot to recompute next */
 #endif
     
     /* non shaped skbs; let them go directly thru */
@@ -259,15 +263,15 @@ struct htb_sched
     long direct_pkts;
 };
 
-/* compute hash of size HTB_HSIZE for given handle */
-static __inline__ int htb_hash(u32 h) 
+/* 
+ * compute hash for given handle; bucket mod HTB_HSIZE doesn't depend on
+ * the hash size, so a class keeps its rate computer slot as the hash grows
+ */
+static __inline__ unsigned int htb_hash(struct htb_sched *q, u32 h) 
 {
-#if HTB_HSIZE != 16
- #error "Declare new hash for your HTB_HSIZE"
-#endif
     h ^= h>>8;	/* stolen from cbq_hash */
     h ^= h>>4;
-    return h & 0xf;
+    return h & q->hmask;
 }
 
 /* find class in global hash table using given handle */
@@ -278,7 +282,7 @@ static __inline__ struct htb_class *htb_find(u32 handle, struct Qdisc *sch)
 	if (TC_H_MAJ(handle) != sch->handle) 
 		return NULL;
 	
-	list_for_each (p,q->hash+htb_hash(handle)) {
+	list_for_each (p,q->hash+htb_hash(q,handle)) {
 		struct htb_class *cl = list_entry(p,struct htb_class,hlist);
 		if (cl->classid == handle)
 			return cl;
@@ -379,7 +383,7 @@ static void htb_debug_dump (struct htb_sched *q)
 		printk("\n");
 	}
 	/* classes */
-	for (i = 0; i < HTB_HSIZE; i++) {
+	for (i = 0; i <= q->hmask; i++) {
 		struct list_head *l;
 		list_for_each (l,q->hash+i) {
 			struct htb_class *cl = list_entry(l,struct htb_class,hlist);
@@ -790,6 +794,7 @@ static void htb_rate_timer(unsigned long arg)
 	struct Qdisc *sch = (struct Qdisc*)arg;
 	struct htb_sched *q = qdisc_priv(sch);
 	struct list_head *p;
+	unsigned int i;
 
 	/* lock queue so that we can muck with it */
 	HTB_QLOCK(sch);
@@ -798,15 +803,17 @@ static void htb_rate_timer(unsigned long arg)
 	q->rttim.expires = jiffies + HZ;
 	add_timer(&q->rttim);
 
-	/* scan and recompute one bucket at time */
+	/* scan and recompute one slot (every HTB_HSIZE-th bucket) at time */
 	if (++q->recmp_bucket >= HTB_HSIZE) 
 		q->recmp_bucket = 0;
-	list_for_each (p,q->hash+q->recmp_bucket) {
-		struct htb_class *cl = list_entry(p,struct htb_class,hlist);
-		HTB_DBG(10,2,"htb_rttmr_cl cl=%X sbyte=%lu spkt=%lu\n",
-				cl->classid,cl->sum_bytes,cl->sum_packets);
-		RT_GEN (cl->sum_bytes,cl->rate_bytes);
-		RT_GEN (cl->sum_packets,cl->rate_packets);
+	for (i = q->recmp_bucket; i <= q->hmask; i += HTB_HSIZE) {
+		list_for_each (p,q->hash+i) {
+			struct htb_class *cl = list_entry(p,struct htb_class,hlist);
+			HTB_DBG(10,2,"htb_rttmr_cl cl=%X sbyte=%lu spkt=%lu\n",
+					cl->classid,cl->sum_bytes,cl->sum_packets);
+			RT_GEN (cl->sum_bytes,cl->rate_bytes);
+			RT_GEN (cl->sum_packets,cl->rate_packets);
+		}
 	}
 	HTB_QUNLOCK(sch);
 }
@@ -1200,7 +1207,7 @@ static void htb_reset(struct Qdisc* sch)
 	int i;
 	HTB_DBG(0,1,"htb_reset sch=%p, handle=%X\n",sch,sch->handle);
 
-	for (i = 0; i < HTB_HSIZE; i++) {
+	for (i = 0; i <= q->hmask; i++) {
 		struct list_head *p;
 		list_for_each (p,q->hash+i) {
 			struct htb_class *cl = list_entry(p,struct htb_class,hlist);
@@ -1258,6 +1265,8 @@ static int htb_init(struct Qdisc *sch, struct rtattr *opt)
 	HTB_DBG(0,1,"htb_init sch=%p handle=%X r2q=%d\n",sch,sch->handle,gopt->rate2quantum);
 
 	INIT_LIST_HEAD(&q->root);
+	q->hash = q->hash0;
+	q->hmask = HTB_HSIZE - 1;
 	for (i = 0; i < HTB_HSIZE; i++)
 		INIT_LIST_HEAD(q->hash+i);
 	for (i = 0; i < TC_HTB_NUMPRIO; i++)
@@ -1430,6 +1439,61 @@ static void htb_destroy_filters(struct tcf_proto **fl)
 	}
 }
 
+static struct list_head *htb_hash_alloc(unsigned int size)
+{
+	unsigned long sz = size * sizeof(struct list_head);
+
+	if (sz <= PAGE_SIZE)
+		return kmalloc(sz, GFP_KERNEL);
+	return (struct list_head *)__get_free_pages(GFP_KERNEL, get_order(sz));
+}
+
+static void htb_hash_free(struct list_head *hash, unsigned int size)
+{
+	unsigned long sz = size * sizeof(struct list_head);
+
+	if (sz <= PAGE_SIZE)
+		kfree(hash);
+	else
+		free_pages((unsigned long)hash, get_order(sz));
+}
+
+/**
+ * htb_hash_grow - doubles the classid hash
+ *
+ * Called under RTNL once there are more classes than buckets, so that
+ * lookups for thousands of classes stay short. The new table is
+ * allocated outside of sch_tree_lock and swapped in under it; if it
+ * can't be had the old one is kept.
+ */
+static void htb_hash_grow(struct Qdisc *sch)
+{
+	struct htb_sched *q = qdisc_priv(sch);
+	unsigned int i, osize = q->hmask + 1, size = osize * 2;
+	struct list_head *nhash, *ohash;
+
+	if (size > HTB_HMAX || (nhash = htb_hash_alloc(size)) == NULL)
+		return;
+	for (i = 0; i < size; i++)
+		INIT_LIST_HEAD(nhash+i);
+
+	sch_tree_lock(sch);
+	ohash = q->hash;
+	q->hash = nhash;
+	q->hmask = size - 1;
+	for (i = 0; i < osize; i++)
+		while (!list_empty(ohash+i)) {
+			struct htb_class *cl = list_entry(ohash[i].next,
+					struct htb_class,hlist);
+			list_move_tail(&cl->hlist,
+					q->hash+htb_hash(q,cl->classid));
+		}
+	sch_tree_unlock(sch);
+
+	if (ohash != q->hash0)
+		htb_hash_free(ohash, osize);
+}
+
 static void htb_destroy_class(struct Qdisc* sch,struct htb_class *cl)
 {
 	struct htb_sched *q = qdisc_priv(sch);
@@ -1481,6 +1545,8 @@ static void htb_destroy(struct Qdisc* sch)
 		htb_destroy_class (sch,list_entry(q->root.next,
 					struct htb_class,sibling));
 
+	if (q->hash != q->hash0)
+		htb_hash_free(q->hash, q->hmask + 1);
 	__skb_queue_purge(&q->direct_queue);
 }
 
@@ -1500,6 +1566,7 @@ static int htb_delete(struct Qdisc *sch, unsigned long arg)
 	
 	/* delete from hash and active; remainder in destroy_class */
 	list_del_init(&cl->hlist);
+	q->hcount--;
 	if (cl->prio_activity)
 		htb_deactivate (q,cl);
 
@@ -1532,6 +1599,7 @@ static int htb_change_class(struct Qdisc *sch, u32 classid,
 	struct qdisc_rate_table *rtab = NULL, *ctab = NULL;
 	struct rtattr *tb[TCA_HTB_RTAB];
 	struct tc_htb_opt *hopt;
+	int grow = 0;
 
 	/* extract all subattrs from opt attr */
 	if (!opt || rtattr_parse_nested(tb, TCA_HTB_RTAB, opt) ||
@@ -1605,7 +1673,8 @@ static int htb_change_class(struct Qdisc *sch, u32 classid,
 		cl->cmode = HTB_CAN_SEND;
 
 		/* attach to the hash list and parent's family */
-		list_add_tail(&cl->hlist, q->hash+htb_hash(classid));
+		list_add_tail(&cl->hlist, q->hash+htb_hash(q,classid));
+		grow = ++q->hcount > q->hmask + 1;
 		list_add_tail(&cl->sibling, parent ? &parent->children : &q->root);
 #ifdef HTB_DEBUG
 		{ 
@@ -1640,6 +1709,9 @@ static int htb_change_class(struct Qdisc *sch, u32 classid,
 	if (cl->ceil) qdisc_put_rtab(cl->ceil); cl->ceil = ctab;
 	sch_tree_unlock(sch);
 
+	if (grow)
+		htb_hash_grow(sch);
+
 	*arg = (unsigned long)cl;
 	return 0;
 
@@ -1699,7 +1771,7 @@ static void htb_walk(struct Qdisc *sch, struct qdisc_walker *arg)
 	if (arg->stop)
 		return;
 
-	for (i = 0; i < HTB_HSIZE; i++) {
+	for (i = 0; i <= q->hmask; i++) {
 		struct list_head *p;
 		list_for_each (p,q->hash+i) {
 			struct htb_class *cl = list_entry(p,struct htb_class,hlist);
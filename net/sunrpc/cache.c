@@ -51,21 +51,25 @@ struct cache_head *sunrpc_cache_lookup(struct cache_detail *detail,
 				       struct cache_head *key, int hash)
 {
 	struct cache_head **head,  **hp;
-	struct cache_head *new = NULL;
+	struct cache_head *new = NULL, *tmp;
 
 	head = &detail->hash_table[hash];
 
-	read_lock(&detail->hash_lock);
-
-	for (hp=head; *hp != NULL ; hp = &(*hp)->next) {
-		struct cache_head *tmp = *hp;
-		if (detail->match(tmp, key)) {
-			cache_get(tmp);
-			read_unlock(&detail->hash_lock);
+	/*
+	 * Every RPC comes through here, for more than one cache, so the
+	 * chain is walked without the lock.  An entry whose last reference
+	 * is being dropped is passed over: it is unhashed by then, or about
+	 * to be, so the search under the lock below will not find it.
+	 */
+	rcu_read_lock();
+	for (tmp = rcu_dereference(*head); tmp != NULL;
+	     tmp = rcu_dereference(tmp->next)) {
+		if (detail->match(tmp, key) && cache_get_rcu(tmp)) {
+			rcu_read_unlock();
 			return tmp;
 		}
 	}
-	read_unlock(&detail->hash_lock);
+	rcu_read_unlock();
 	/* Didn't find anything, insert an empty entry */
 
 	new = detail->alloc();
@@ -82,7 +86,7 @@ struct cache_head *sunrpc_cache_lookup(struct cache_detail *detail,
 
 	/* check if entry appeared while we slept */
 	for (hp=head; *hp != NULL ; hp = &(*hp)->next) {
-		struct cache_head *tmp = *hp;
+		tmp = *hp;
 		if (detail->match(tmp, key)) {
 			cache_get(tmp);
 			write_unlock(&detail->hash_lock);
@@ -91,7 +95,7 @@ struct cache_head *sunrpc_cache_lookup(struct cache_detail *detail,
 		}
 	}
 	new->next = *head;
-	*head = new;
+	rcu_assign_pointer(*head, new);
 	detail->entries++;
 	cache_get(new);
 	write_unlock(&detail->hash_lock);
@@ -162,7 +166,7 @@ struct cache_head *sunrpc_cache_update(struct cache_detail *detail,
 	else
 		detail->update(tmp, new);
 	tmp->next = *head;
-	*head = tmp;
+	rcu_assign_pointer(*head, tmp);
 	detail->entries++;
 	cache_get(tmp);
 	is_new = cache_fresh_locked(tmp, new->expiry_time);
@@ -371,6 +375,8 @@ int cache_unregister(struct cache_detail *cd)
 		cancel_delayed_work(&cache_cleaner);
 		flush_scheduled_work();
 	}
+	/* the items are freed by the owner's rcu callbacks, see cache.h */
+	rcu_barrier();
 	return 0;
 }
 
@@ -436,12 +442,17 @@ static int cache_clean(void)
 			if (test_and_clear_bit(CACHE_PENDING, &ch->flags))
 				queue_loose(current_detail, ch);
 
-			if (atomic_read(&ch->ref.refcount) == 1)
+			/*
+			 * Only the hash holds it.  Dropping that reference
+			 * here, rather than after unhashing, keeps lockless
+			 * lookups from taking a new one meanwhile.
+			 */
+			if (atomic_cmpxchg(&ch->ref.refcount, 1, 0) == 1)
 				break;
 		}
 		if (ch) {
+			/* ch->next stays, for lookups still walking past ch */
 			*cp = ch->next;
-			ch->next = NULL;
 			current_detail->entries--;
 			rv = 1;
 		}
@@ -451,7 +462,7 @@ static int cache_clean(void)
 			current_index ++;
 		spin_unlock(&cache_list_lock);
 		if (ch)
-			cache_put(ch, d);
+			d->cache_put(&ch->ref);
 	} else
 		spin_unlock(&cache_list_lock);
 
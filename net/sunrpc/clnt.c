@@ -144,6 +144,8 @@ rpc_new_client(struct rpc_xprt *xprt, char *servname,
 	strlcpy(clnt->cl_server, servname, len);
 
 	clnt->cl_xprt     = xprt;
+	clnt->cl_xprts[0] = xprt;
+	clnt->cl_nxprts   = 1;
 	clnt->cl_procinfo = version->procs;
 	clnt->cl_maxproc  = version->nrprocs;
 	clnt->cl_protname = program->name;
@@ -226,6 +228,36 @@ struct rpc_clnt *rpc_create_client(struct rpc_xprt *xprt, char *servname,
 	return ERR_PTR(err);
 }
 
+/**
+ * rpc_clnt_add_xprt - spread the calls of a client over one more connection
+ * @clnt: the client, not yet cloned nor in use
+ * @xprt: a transport to the same server, by the same protocol
+ *
+ * The client owns @xprt from here on, whether this succeeds or not.
+ * Each new task is given the client's transports in turn.
+ */
+int rpc_clnt_add_xprt(struct rpc_clnt *clnt, struct rpc_xprt *xprt)
+{
+	if (clnt->cl_nxprts == RPC_MAX_XPRTS) {
+		xprt_destroy(xprt);
+		return -ENOSPC;
+	}
+	clnt->cl_xprts[clnt->cl_nxprts] = xprt;
+	smp_wmb();
+	clnt->cl_nxprts++;
+	return 0;
+}
+
+struct rpc_xprt *rpc_clnt_pick_xprt(struct rpc_clnt *clnt)
+{
+	unsigned int n = clnt->cl_nxprts;
+
+	if (n <= 1)
+		return clnt->cl_xprt;
+	smp_rmb();
+	return clnt->cl_xprts[(unsigned int)atomic_inc_return(&clnt->cl_next_xprt) % n];
+}
+
 /*
  * This function clones the RPC client structure. It allows us to share the
  * same transport while varying parameters such as the authentication
@@ -324,7 +356,10 @@ rpc_destroy_client(struct rpc_clnt *clnt)
 		rpc_put_mount();
 	}
 	if (clnt->cl_xprt) {
-		xprt_destroy(clnt->cl_xprt);
+		unsigned int i;
+
+		for (i = 0; i < clnt->cl_nxprts; i++)
+			xprt_destroy(clnt->cl_xprts[i]);
 		clnt->cl_xprt = NULL;
 	}
 	if (clnt->cl_server != clnt->cl_inline_name)
@@ -543,9 +578,14 @@ rpc_call_setup(struct rpc_task *task, struct rpc_message *msg, int flags)
 void
 rpc_setbufsize(struct rpc_clnt *clnt, unsigned int sndsize, unsigned int rcvsize)
 {
-	struct rpc_xprt *xprt = clnt->cl_xprt;
-	if (xprt->ops->set_buffer_size)
-		xprt->ops->set_buffer_size(xprt, sndsize, rcvsize);
+	unsigned int i;
+
+	for (i = 0; i < clnt->cl_nxprts; i++) {
+		struct rpc_xprt *xprt = clnt->cl_xprts[i];
+
+		if (xprt->ops->set_buffer_size)
+			xprt->ops->set_buffer_size(xprt, sndsize, rcvsize);
+	}
 }
 
 /*
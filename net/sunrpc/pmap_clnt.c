@@ -150,7 +150,13 @@ pmap_getport_done(struct rpc_task *task)
 		/* Program not registered */
 		rpc_exit(task, -EACCES);
 	} else {
-		xprt->ops->set_port(xprt, clnt->cl_port);
+		unsigned int i;
+
+		/* all the connections of the client go to the port found */
+		for (i = 0; i < clnt->cl_nxprts; i++) {
+			xprt = clnt->cl_xprts[i];
+			xprt->ops->set_port(xprt, clnt->cl_port);
+		}
 		clnt->cl_port = htons(clnt->cl_port);
 	}
 	spin_lock(&pmap_lock);
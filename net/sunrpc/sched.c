@@ -783,6 +783,8 @@ void rpc_init_task(struct rpc_task *task, struct rpc_clnt *clnt, int flags, cons
 	task->tk_timer.function = (void (*)(unsigned long)) rpc_run_timer;
 	atomic_set(&task->tk_count, 1);
 	task->tk_client = clnt;
+	if (clnt)
+		task->tk_xprt = rpc_clnt_pick_xprt(clnt);
 	task->tk_flags  = flags;
 	task->tk_ops = tk_ops;
 	if (tk_ops->rpc_call_prepare != NULL)
@@ -898,6 +900,7 @@ void rpc_release_task(struct rpc_task *task)
 	if (task->tk_client) {
 		rpc_release_client(task->tk_client);
 		task->tk_client = NULL;
+		task->tk_xprt = NULL;
 	}
 
 #ifdef RPC_DEBUG
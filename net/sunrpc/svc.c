@@ -12,6 +12,12 @@
 #include <linux/net.h>
 #include <linux/in.h>
 #include <linux/mm.h>
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/mutex.h>
+#include <linux/slab.h>
+#include <linux/cpumask.h>
+#include <linux/topology.h>
 
 #include <linux/sunrpc/types.h>
 #include <linux/sunrpc/xdr.h>
@@ -22,15 +28,235 @@
 #define RPCDBG_FACILITY	RPCDBG_SVCDSP
 #define RPC_PARANOIA 1
 
+/*
+ * Mapping between CPUs and the thread pools of pooled services.
+ * All pooled services share the one map; it is set up when the first
+ * of them is created and torn down again with the last one.
+ */
+enum {
+	SVC_POOL_GLOBAL,	/* no mapping, just a single global pool */
+	SVC_POOL_PERCPU,	/* one pool per cpu */
+	SVC_POOL_PERNODE	/* one pool per numa node */
+};
+
+static struct svc_pool_map {
+	int count;			/* # of pooled services using the map */
+	int mode;			/* one of the SVC_POOL_* above */
+	unsigned int npools;
+	unsigned int *pool_to;		/* maps pool id to cpu or node */
+	unsigned int *to_pool;		/* maps cpu or node to pool id */
+} svc_pool_map;
+
+static DEFINE_MUTEX(svc_pool_map_mutex);
+
+static char *pool_mode = "auto";
+module_param(pool_mode, charp, 0444);
+MODULE_PARM_DESC(pool_mode,
+		 "Thread pools of pooled services: auto, global, percpu or pernode");
+
+/*
+ * Without an explicit setting, split on NUMA nodes if there are
+ * several of them and on CPUs if there are enough of those.
+ */
+static int
+svc_pool_map_choose_mode(void)
+{
+	if (!strcmp(pool_mode, "global"))
+		return SVC_POOL_GLOBAL;
+	if (!strcmp(pool_mode, "percpu"))
+		return SVC_POOL_PERCPU;
+	if (!strcmp(pool_mode, "pernode"))
+		return SVC_POOL_PERNODE;
+	if (strcmp(pool_mode, "auto"))
+		printk(KERN_WARNING "sunrpc: unknown pool_mode \"%s\", "
+				"using auto\n", pool_mode);
+
+	if (num_online_nodes() > 1)
+		return SVC_POOL_PERNODE;
+	if (num_online_cpus() > 2)
+		return SVC_POOL_PERCPU;
+	return SVC_POOL_GLOBAL;
+}
+
+static int
+svc_pool_map_alloc_arrays(struct svc_pool_map *m, unsigned int maxpools)
+{
+	m->to_pool = kcalloc(maxpools, sizeof(unsigned int), GFP_KERNEL);
+	if (!m->to_pool)
+		goto fail;
+	m->pool_to = kcalloc(maxpools, sizeof(unsigned int), GFP_KERNEL);
+	if (!m->pool_to)
+		goto fail_free;
+	return 0;
+
+fail_free:
+	kfree(m->to_pool);
+	m->to_pool = NULL;
+fail:
+	return -ENOMEM;
+}
+
+static unsigned int
+svc_pool_map_init_percpu(struct svc_pool_map *m)
+{
+	unsigned int pidx = 0;
+	unsigned int cpu;
+
+	if (svc_pool_map_alloc_arrays(m, NR_CPUS))
+		return 0;
+
+	for_each_online_cpu(cpu) {
+		m->to_pool[cpu] = pidx;
+		m->pool_to[pidx] = cpu;
+		pidx++;
+	}
+	return pidx;
+}
+
+static unsigned int
+svc_pool_map_init_pernode(struct svc_pool_map *m)
+{
+	unsigned int pidx = 0;
+	unsigned int node;
+
+	if (svc_pool_map_alloc_arrays(m, MAX_NUMNODES))
+		return 0;
+
+	for_each_node_with_cpus(node) {
+		/* some architectures (e.g. SN2) have cpuless nodes */
+		m->to_pool[node] = pidx;
+		m->pool_to[pidx] = node;
+		pidx++;
+	}
+	return pidx;
+}
+
+/*
+ * Take a reference to the pool map, building it if this is the
+ * first pooled service.  Returns the number of pools to create.
+ */
+static unsigned int
+svc_pool_map_get(void)
+{
+	struct svc_pool_map *m = &svc_pool_map;
+	unsigned int npools = 0;
+
+	mutex_lock(&svc_pool_map_mutex);
+
+	if (m->count++) {
+		mutex_unlock(&svc_pool_map_mutex);
+		return m->npools;
+	}
+
+	m->mode = svc_pool_map_choose_mode();
+	switch (m->mode) {
+	case SVC_POOL_PERCPU:
+		npools = svc_pool_map_init_percpu(m);
+		break;
+	case SVC_POOL_PERNODE:
+		npools = svc_pool_map_init_pernode(m);
+		break;
+	}
+
+	if (npools <= 1) {
+		/* default, or memory allocation failure */
+		kfree(m->to_pool);
+		kfree(m->pool_to);
+		m->to_pool = m->pool_to = NULL;
+		npools = 1;
+		m->mode = SVC_POOL_GLOBAL;
+	}
+	m->npools = npools;
+
+	mutex_unlock(&svc_pool_map_mutex);
+	return npools;
+}
+
+static void
+svc_pool_map_put(void)
+{
+	struct svc_pool_map *m = &svc_pool_map;
+
+	mutex_lock(&svc_pool_map_mutex);
+	if (!--m->count) {
+		kfree(m->to_pool);
+		kfree(m->pool_to);
+		m->to_pool = m->pool_to = NULL;
+		m->npools = 0;
+	}
+	mutex_unlock(&svc_pool_map_mutex);
+}
+
+/*
+ * Restrict the current task to the CPUs of pool @pidx, so that a
+ * thread forked now inherits that binding.  Returns 1 and the old
+ * mask in @oldmask if the mask was changed.
+ */
+static int
+svc_pool_map_set_cpumask(unsigned int pidx, cpumask_t *oldmask)
+{
+	struct svc_pool_map *m = &svc_pool_map;
+	unsigned int n;
+
+	/*
+	 * The caller checked for sv_nrpools > 1, which
+	 * implies that the map is in use.
+	 */
+	BUG_ON(m->count == 0);
+
+	switch (m->mode) {
+	case SVC_POOL_PERCPU:
+		n = m->pool_to[pidx];
+		*oldmask = current->cpus_allowed;
+		set_cpus_allowed(current, cpumask_of_cpu(n));
+		return 1;
+	case SVC_POOL_PERNODE:
+		n = m->pool_to[pidx];
+		*oldmask = current->cpus_allowed;
+		set_cpus_allowed(current, node_to_cpumask(n));
+		return 1;
+	}
+	return 0;
+}
+
+/*
+ * Use the pool map to find the pool on which a socket that became
+ * ready on @cpu should be queued.
+ */
+struct svc_pool *
+svc_pool_for_cpu(struct svc_serv *serv, int cpu)
+{
+	struct svc_pool_map *m = &svc_pool_map;
+	unsigned int pidx = 0;
+
+	/*
+	 * An uninitialised map happens in a pure client when
+	 * lockd is brought up, so silently treat it the
+	 * same as SVC_POOL_GLOBAL.
+	 */
+	if (serv->sv_nrpools > 1) {
+		switch (m->mode) {
+		case SVC_POOL_PERCPU:
+			pidx = m->to_pool[cpu];
+			break;
+		case SVC_POOL_PERNODE:
+			pidx = m->to_pool[cpu_to_node(cpu)];
+			break;
+		}
+	}
+	return &serv->sv_pools[pidx % serv->sv_nrpools];
+}
+
 /*
  * Create an RPC service
  */
-struct svc_serv *
-svc_create(struct svc_program *prog, unsigned int bufsize)
+static struct svc_serv *
+__svc_create(struct svc_program *prog, unsigned int bufsize, int npools)
 {
 	struct svc_serv	*serv;
 	int vers;
 	unsigned int xdrsize;
+	unsigned int i;
 
 	if (!(serv = kzalloc(sizeof(*serv), GFP_KERNEL)))
 		return NULL;
@@ -53,18 +279,63 @@ svc_create(struct svc_program *prog, unsigned int bufsize)
 		prog = prog->pg_next;
 	}
 	serv->sv_xdrsize   = xdrsize;
-	INIT_LIST_HEAD(&serv->sv_threads);
-	INIT_LIST_HEAD(&serv->sv_sockets);
 	INIT_LIST_HEAD(&serv->sv_tempsocks);
 	INIT_LIST_HEAD(&serv->sv_permsocks);
+	setup_timer(&serv->sv_temptimer, svc_age_temp_sockets,
+		    (unsigned long)serv);
 	spin_lock_init(&serv->sv_lock);
 
+	serv->sv_nrpools = npools;
+	serv->sv_pools = kcalloc(npools, sizeof(struct svc_pool), GFP_KERNEL);
+	if (!serv->sv_pools) {
+		kfree(serv);
+		return NULL;
+	}
+
+	for (i = 0; i < serv->sv_nrpools; i++) {
+		struct svc_pool *pool = &serv->sv_pools[i];
+
+		dprintk("initialising pool %u for %s\n",
+				i, serv->sv_name);
+
+		pool->sp_id = i;
+		INIT_LIST_HEAD(&pool->sp_threads);
+		INIT_LIST_HEAD(&pool->sp_sockets);
+		spin_lock_init(&pool->sp_lock);
+	}
+
 	/* Remove any stale portmap registrations */
 	svc_register(serv, 0, 0);
 
 	return serv;
 }
 
+struct svc_serv *
+svc_create(struct svc_program *prog, unsigned int bufsize)
+{
+	return __svc_create(prog, bufsize, 1);
+}
+
+/*
+ * Create an RPC service with one thread pool per CPU or NUMA node,
+ * as given by the pool map.  Only useful for services that start
+ * enough threads to cover all the pools, such as nfsd.
+ */
+struct svc_serv *
+svc_create_pooled(struct svc_program *prog, unsigned int bufsize)
+{
+	struct svc_serv *serv;
+	unsigned int npools = svc_pool_map_get();
+
+	serv = __svc_create(prog, bufsize, npools);
+	if (serv == NULL)
+		svc_pool_map_put();
+	else if (npools == 1)
+		/* the map is not needed for a single pool */
+		svc_pool_map_put();
+	return serv;
+}
+
 /*
  * Destroy an RPC service
  */
@@ -85,6 +356,8 @@ svc_destroy(struct svc_serv *serv)
 	} else
 		printk("svc_destroy: no threads for serv=%p!\n", serv);
 
+	del_timer_sync(&serv->sv_temptimer);
+
 	while (!list_empty(&serv->sv_tempsocks)) {
 		svsk = list_entry(serv->sv_tempsocks.next,
 				  struct svc_sock,
@@ -102,6 +375,9 @@ svc_destroy(struct svc_serv *serv)
 
 	/* Unregister service with the portmapper */
 	svc_register(serv, 0, 0);
+	if (serv->sv_nrpools > 1)
+		svc_pool_map_put();
+	kfree(serv->sv_pools);
 	kfree(serv);
 }
 
@@ -149,6 +425,22 @@ svc_release_buffer(struct svc_rqst *rqstp)
 	rqstp->rq_argused = 0;
 }
 
+/*
+ * Choose the pool for a new thread: the one with the fewest threads,
+ * so that the threads are spread evenly.
+ */
+static struct svc_pool *
+svc_pool_for_thread(struct svc_serv *serv)
+{
+	struct svc_pool *pool = &serv->sv_pools[0];
+	unsigned int i;
+
+	for (i = 1; i < serv->sv_nrpools; i++)
+		if (serv->sv_pools[i].sp_nrthreads < pool->sp_nrthreads)
+			pool = &serv->sv_pools[i];
+	return pool;
+}
+
 /*
  * Create a server thread
  */
@@ -156,6 +448,9 @@ int
 svc_create_thread(svc_thread_fn func, struct svc_serv *serv)
 {
 	struct svc_rqst	*rqstp;
+	struct svc_pool	*pool;
+	cpumask_t	oldmask;
+	int		have_oldmask = 0;
 	int		error = -ENOMEM;
 
 	rqstp = kzalloc(sizeof(*rqstp), GFP_KERNEL);
@@ -169,9 +464,24 @@ svc_create_thread(svc_thread_fn func, struct svc_serv *serv)
 	 || !svc_init_buffer(rqstp, serv->sv_bufsz))
 		goto out_thread;
 
+	pool = svc_pool_for_thread(serv);
+	spin_lock_bh(&pool->sp_lock);
+	pool->sp_nrthreads++;
+	spin_unlock_bh(&pool->sp_lock);
+
 	serv->sv_nrthreads++;
 	rqstp->rq_server = serv;
+	rqstp->rq_pool = pool;
+
+	/* the new thread inherits our cpu mask, and so stays in its pool */
+	if (serv->sv_nrpools > 1)
+		have_oldmask = svc_pool_map_set_cpumask(pool->sp_id, &oldmask);
+
 	error = kernel_thread((int (*)(void *)) func, rqstp, 0);
+
+	if (have_oldmask)
+		set_cpus_allowed(current, oldmask);
+
 	if (error < 0)
 		goto out_thread;
 	svc_sock_update_bufs(serv);
@@ -191,6 +501,10 @@ void
 svc_exit_thread(struct svc_rqst *rqstp)
 {
 	struct svc_serv	*serv = rqstp->rq_server;
+	struct svc_pool	*pool = rqstp->rq_pool;
+
+	if (pool)
+		svc_pool_thread_exit(pool);
 
 	svc_release_buffer(rqstp);
 	kfree(rqstp->rq_resp);
@@ -84,6 +84,11 @@ struct ip_map {
 };
 static struct cache_head	*ip_table[IP_HASHMAX];
 
+static void ip_map_free_rcu(struct rcu_head *head)
+{
+	kfree(container_of(head, struct ip_map, h.rcu_head));
+}
+
 static void ip_map_put(struct kref *kref)
 {
 	struct cache_head *item = container_of(kref, struct cache_head, ref);
@@ -92,7 +97,7 @@ static void ip_map_put(struct kref *kref)
 	if (test_bit(CACHE_VALID, &item->flags) &&
 	    !test_bit(CACHE_NEGATIVE, &item->flags))
 		auth_domain_put(&im->m_client->h);
-	kfree(im);
+	call_rcu(&item->rcu_head, ip_map_free_rcu);
 }
 
 #if IP_HASHBITS == 8
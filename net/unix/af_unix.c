@@ -403,6 +403,11 @@ static int unix_release_sock (struct sock *sk, int embrion)
 
 	/* Try to flush out this socket. Throw out buffers at least */
 
+	/* Wait out a writer appending to the tail skb; see
+	 * unix_stream_coalesce(), later ones find us dead. */
+	mutex_lock(&u->readlock);
+	mutex_unlock(&u->readlock);
+
 	while ((skb = skb_dequeue(&sk->sk_receive_queue)) != NULL) {
 		if (state==TCP_LISTEN)
 			unix_release_sock(skb->sk, 1);
@@ -592,7 +597,8 @@ static struct sock * unix_create1(struct socket *sock)
 	u->dentry = NULL;
 	u->mnt	  = NULL;
 	spin_lock_init(&u->lock);
-	atomic_set(&u->inflight, sock ? 0 : -1);
+	atomic_set(&u->inflight, 0);
+	INIT_LIST_HEAD(&u->link);
 	mutex_init(&u->readlock); /* single task reading lock */
 	init_waitqueue_head(&u->peer_wait);
 	unix_insert_socket(unix_sockets_unbound, sk);
@@ -1101,9 +1107,6 @@ restart:
 	/* take ten and and send info to listening sock */
 	spin_lock(&other->sk_receive_queue.lock);
 	__skb_queue_tail(&other->sk_receive_queue, skb);
-	/* Undo artificially decreased inflight after embrion
-	 * is installed to listening socket. */
-	atomic_inc(&newu->inflight);
 	spin_unlock(&other->sk_receive_queue.lock);
 	unix_state_runlock(other);
 	other->sk_data_ready(other, 0);
@@ -1237,6 +1240,14 @@ static void unix_detach_fds(struct scm_cookie *scm, struct sk_buff *skb)
 		unix_notinflight(scm->fp->fp[i]);
 }
 
+static void unix_peek_fds(struct scm_cookie *scm, struct sk_buff *skb)
+{
+	scm->fp = scm_fp_dup(UNIXCB(skb).fp);
+
+	/* the new references must not slip past a running collection */
+	unix_gc_barrier();
+}
+
 static void unix_destruct_fds(struct sk_buff *skb)
 {
 	struct scm_cookie scm;
@@ -1414,6 +1425,66 @@ out:
 	return err;
 }
 
+/*
+ *	Stream writes up to UNIX_SKB_COALESCE bytes get an skb with room for
+ *	more behind them, and are appended to the last skb on the peer's
+ *	queue when that has room.
+ */
+#define UNIX_SKB_COALESCE	256
+#define UNIX_SKB_COALESCE_ALLOC	SKB_WITH_OVERHEAD(1024)
+
+/*
+ *	Append a small write to the last skb queued to other, if it is ours,
+ *	carries no descriptors and the same credentials (the reader never
+ *	glues writes of different writers), and has the room.  Holding the
+ *	peer's readlock keeps the reader, and the release of the peer, away
+ *	from that skb while we copy into it, without taking the peer's state
+ *	lock or allocating.  When the reader has the readlock it is likely
+ *	waiting for data, and a fresh skb wakes it as usual.
+ *
+ *	Returns the bytes appended, 0 when the write needs an skb of its
+ *	own, or an error.
+ */
+static int unix_stream_coalesce(struct sock *sk, struct sock *other,
+				struct msghdr *msg, int size,
+				struct scm_cookie *scm)
+{
+	struct unix_sock *u = unix_sk(other);
+	struct sk_buff *skb;
+	int err = 0;
+
+	if (!mutex_trylock(&u->readlock))
+		return 0;
+
+	/* let the usual path report these */
+	if (sock_flag(other, SOCK_DEAD) ||
+	    (other->sk_shutdown & RCV_SHUTDOWN))
+		goto out;
+
+	spin_lock(&other->sk_receive_queue.lock);
+	skb = skb_peek_tail(&other->sk_receive_queue);
+	spin_unlock(&other->sk_receive_queue.lock);
+
+	if (skb == NULL || skb->sk != sk || UNIXCB(skb).fp ||
+	    skb_tailroom(skb) < size ||
+	    memcmp(UNIXCREDS(skb), &scm->creds, sizeof(struct ucred)))
+		goto out;
+
+	/* Nobody looks past skb->len, so copy first and then publish */
+	err = memcpy_fromiovec(skb->tail, msg->msg_iov, size);
+	if (err)
+		goto out;
+
+	spin_lock(&other->sk_receive_queue.lock);
+	skb_put(skb, size);
+	spin_unlock(&other->sk_receive_queue.lock);
+	err = size;
+out:
+	mutex_unlock(&u->readlock);
+	if (err > 0)
+		other->sk_data_ready(other, size);
+	return err;
+}
 		
 static int unix_stream_sendmsg(struct kiocb *kiocb, struct socket *sock,
 			       struct msghdr *msg, size_t len)
@@ -1422,7 +1493,7 @@ static int unix_stream_sendmsg(struct kiocb *kiocb, struct socket *sock,
 	struct sock *sk = sock->sk;
 	struct sock *other = NULL;
 	struct sockaddr_un *sunaddr=msg->msg_name;
-	int err,size;
+	int err,size,alloc;
 	struct sk_buff *skb;
 	int sent=0;
 	struct scm_cookie tmp_scm;
@@ -1466,12 +1537,27 @@ static int unix_stream_sendmsg(struct kiocb *kiocb, struct socket *sock,
 
 		if (size > SKB_MAX_ALLOC)
 			size = SKB_MAX_ALLOC;
+
+		alloc = size;
+		if (size <= UNIX_SKB_COALESCE && !siocb->scm->fp) {
+			err = unix_stream_coalesce(sk, other, msg, size,
+						   siocb->scm);
+			if (err < 0)
+				goto out_err;
+			if (err) {
+				sent += err;
+				continue;
+			}
+			/* leave room for the writes that follow */
+			alloc = min_t(int, UNIX_SKB_COALESCE_ALLOC,
+				      (sk->sk_sndbuf >> 1) - 64);
+		}
 			
 		/*
 		 *	Grab a buffer
 		 */
 		 
-		skb=sock_alloc_send_skb(sk,size,msg->msg_flags&MSG_DONTWAIT, &err);
+		skb=sock_alloc_send_skb(sk,alloc,msg->msg_flags&MSG_DONTWAIT, &err);
 
 		if (skb==NULL)
 			goto out_err;
@@ -1619,7 +1705,7 @@ static int unix_dgram_recvmsg(struct kiocb *iocb, struct socket *sock,
 		   
 		*/
 		if (UNIXCB(skb).fp)
-			siocb->scm->fp = scm_fp_dup(UNIXCB(skb).fp);
+			unix_peek_fds(siocb->scm, skb);
 	}
 	err = size;
 
@@ -1794,7 +1880,7 @@ static int unix_stream_recvmsg(struct kiocb *iocb, struct socket *sock,
 			/* It is questionable, see note in unix_dgram_recvmsg.
 			 */
 			if (UNIXCB(skb).fp)
-				siocb->scm->fp = scm_fp_dup(UNIXCB(skb).fp);
+				unix_peek_fds(siocb->scm, skb);
 
 			/* put message back and return */
 			skb_queue_head(&sk->sk_receive_queue, skb);
@@ -62,6 +62,11 @@
  *	AV		1 Mar 1999
  *		Damn. Added missing check for ->dead in listen queues scanning.
  *
+ *	Only sockets in flight are looked at now, they are kept on a list
+ *	as they go in flight; see unix_gc() for the algorithm.  The
+ *	sockets which are not in flight, or are but have an open file as
+ *	well, are never touched, and the table lock is no longer taken.
+ *
  */
  
 #include <linux/kernel.h>
@@ -85,10 +90,9 @@
 
 /* Internal data structures and random procedures: */
 
-#define GC_HEAD		((struct sock *)(-1))
-#define GC_ORPHAN	((struct sock *)(-3))
-
-static struct sock *gc_current = GC_HEAD; /* stack of objects to mark */
+static LIST_HEAD(gc_inflight_list);
+static LIST_HEAD(gc_candidates);
+static DEFINE_SPINLOCK(unix_gc_lock);
 
 atomic_t unix_tot_inflight = ATOMIC_INIT(0);
 
@@ -116,15 +120,25 @@ static struct sock *unix_get_socket(struct file *filp)
 
 /*
  *	Keep the number of times in flight count for the file
- *	descriptor if it is for an AF_UNIX socket.
+ *	descriptor if it is for an AF_UNIX socket, and the socket
+ *	on the in flight list while it is non-zero.
  */
  
 void unix_inflight(struct file *fp)
 {
 	struct sock *s = unix_get_socket(fp);
 	if(s) {
-		atomic_inc(&unix_sk(s)->inflight);
+		struct unix_sock *u = unix_sk(s);
+
+		spin_lock(&unix_gc_lock);
+		if (atomic_inc_return(&u->inflight) == 1) {
+			BUG_ON(!list_empty(&u->link));
+			list_add_tail(&u->link, &gc_inflight_list);
+		} else {
+			BUG_ON(list_empty(&u->link));
+		}
 		atomic_inc(&unix_tot_inflight);
+		spin_unlock(&unix_gc_lock);
 	}
 }
 
@@ -132,182 +146,243 @@ void unix_notinflight(struct file *fp)
 {
 	struct sock *s = unix_get_socket(fp);
 	if(s) {
-		atomic_dec(&unix_sk(s)->inflight);
+		struct unix_sock *u = unix_sk(s);
+
+		spin_lock(&unix_gc_lock);
+		BUG_ON(list_empty(&u->link));
+		if (atomic_dec_and_test(&u->inflight))
+			list_del_init(&u->link);
 		atomic_dec(&unix_tot_inflight);
+		spin_unlock(&unix_gc_lock);
 	}
 }
 
+/*
+ *	MSG_PEEK hands out new references to the files of an skb which
+ *	stays queued.  A collection which has already counted the file
+ *	references of a candidate would miss that one; wait for it to be
+ *	over, a later one sees the reference.
+ */
+
+void unix_gc_barrier(void)
+{
+	spin_lock(&unix_gc_lock);
+	spin_unlock(&unix_gc_lock);
+}
+
 
 /*
  *	Garbage Collector Support Functions
  */
 
-static inline struct sock *pop_stack(void)
+#define receive_queue_for_each_skb(x, next, skb) \
+	for (skb = skb_peek(&(x)->sk_receive_queue), next = skb->next; \
+	     skb != (struct sk_buff *)&(x)->sk_receive_queue; \
+	     skb = next, next = skb->next)
+
+/*
+ *	Call func for each candidate passed on x's queue; with a hitlist,
+ *	also move the skbs which pass candidates to it.
+ */
+
+static void scan_inflight(struct sock *x, void (*func)(struct unix_sock *),
+			  struct sk_buff_head *hitlist)
 {
-	struct sock *p = gc_current;
-	gc_current = unix_sk(p)->gc_tree;
-	return p;
+	struct sk_buff *skb;
+	struct sk_buff *next;
+
+	spin_lock(&x->sk_receive_queue.lock);
+	receive_queue_for_each_skb(x, next, skb) {
+		/*
+		 *	Do we have file descriptors ?
+		 */
+		if (UNIXCB(skb).fp) {
+			int hit = 0;
+			/*
+			 *	Process the descriptors of this socket
+			 */
+			int nfd = UNIXCB(skb).fp->count;
+			struct file **fp = UNIXCB(skb).fp->fp;
+			while (nfd--) {
+				/*
+				 *	Get the socket the fd matches if
+				 *	it indeed does so
+				 */
+				struct sock *sk = unix_get_socket(*fp++);
+				if (sk) {
+					struct unix_sock *u = unix_sk(sk);
+
+					/*
+					 *	Skip the others, they may have
+					 *	been passed since we started
+					 */
+					if (u->gc_candidate) {
+						hit = 1;
+						func(u);
+					}
+				}
+			}
+			if (hit && hitlist != NULL) {
+				__skb_unlink(skb, &x->sk_receive_queue);
+				__skb_queue_tail(hitlist, skb);
+			}
+		}
+	}
+	spin_unlock(&x->sk_receive_queue.lock);
 }
 
-static inline int empty_stack(void)
+static void scan_children(struct sock *x, void (*func)(struct unix_sock *),
+			  struct sk_buff_head *hitlist)
 {
-	return gc_current == GC_HEAD;
+	struct sk_buff *skb;
+	struct sk_buff *next;
+	struct unix_sock *u;
+	LIST_HEAD(embryos);
+
+	if (x->sk_state != TCP_LISTEN) {
+		scan_inflight(x, func, hitlist);
+		return;
+	}
+
+	/*
+	 *	We have to scan not-yet-accepted ones too.  An embryo
+	 *	cannot be in flight, so its list link is free to use.
+	 */
+	spin_lock(&x->sk_receive_queue.lock);
+	receive_queue_for_each_skb(x, next, skb) {
+		u = unix_sk(skb->sk);
+		BUG_ON(!list_empty(&u->link));
+		list_add_tail(&u->link, &embryos);
+	}
+	spin_unlock(&x->sk_receive_queue.lock);
+
+	while (!list_empty(&embryos)) {
+		u = list_entry(embryos.next, struct unix_sock, link);
+		scan_inflight(&u->sk, func, hitlist);
+		list_del_init(&u->link);
+	}
 }
 
-static void maybe_unmark_and_push(struct sock *x)
+static void dec_inflight(struct unix_sock *u)
 {
-	struct unix_sock *u = unix_sk(x);
+	atomic_dec(&u->inflight);
+}
 
-	if (u->gc_tree != GC_ORPHAN)
-		return;
-	sock_hold(x);
-	u->gc_tree = gc_current;
-	gc_current = x;
+static void inc_inflight(struct unix_sock *u)
+{
+	atomic_inc(&u->inflight);
+}
+
+static void inc_inflight_move_tail(struct unix_sock *u)
+{
+	atomic_inc(&u->inflight);
+	/*
+	 *	A candidate found reachable only now has to be looked at
+	 *	again, even if it was passed over already.
+	 */
+	if (u->gc_candidate)
+		list_move_tail(&u->link, &gc_candidates);
 }
 
 
 /* The external entry point: unix_gc() */
 
+/*
+ *	Only sockets in flight can be garbage, and of those only the ones
+ *	whose every file reference is in flight: they are the candidates.
+ *	Taking away the references the candidates' queues hold on each
+ *	other, a candidate left with some is reachable from outside, and
+ *	so is everything it passes in turn.  What remains are cycles of
+ *	sockets that only reference each other: the skbs passing them are
+ *	thrown away, which releases them.
+ */
+
 void unix_gc(void)
 {
-	static DEFINE_MUTEX(unix_gc_sem);
-	int i;
-	struct sock *s;
+	static int gc_in_progress = 0;
+
+	struct unix_sock *u;
+	struct unix_sock *next;
 	struct sk_buff_head hitlist;
-	struct sk_buff *skb;
+	struct list_head cursor;
+
+	spin_lock(&unix_gc_lock);
 
 	/*
 	 *	Avoid a recursive GC.
 	 */
+	if (gc_in_progress)
+		goto out;
 
-	if (!mutex_trylock(&unix_gc_sem))
-		return;
-
-	spin_lock(&unix_table_lock);
+	gc_in_progress = 1;
 
-	forall_unix_sockets(i, s)
-	{
-		unix_sk(s)->gc_tree = GC_ORPHAN;
-	}
 	/*
-	 *	Everything is now marked 
-	 */
-
-	/* Invariant to be maintained:
-		- everything unmarked is either:
-		-- (a) on the stack, or
-		-- (b) has all of its children unmarked
-		- everything on the stack is always unmarked
-		- nothing is ever pushed onto the stack twice, because:
-		-- nothing previously unmarked is ever pushed on the stack
+	 *	Select the candidates
 	 */
+	list_for_each_entry_safe(u, next, &gc_inflight_list, link) {
+		int total_refs;
+		int inflight_refs;
+
+		total_refs = file_count(u->sk.sk_socket->file);
+		inflight_refs = atomic_read(&u->inflight);
+
+		BUG_ON(inflight_refs < 1);
+		BUG_ON(total_refs < inflight_refs);
+		if (total_refs == inflight_refs) {
+			list_move_tail(&u->link, &gc_candidates);
+			u->gc_candidate = 1;
+		}
+	}
 
 	/*
-	 *	Push root set
+	 *	Remove the references the candidates hold on each other
 	 */
-
-	forall_unix_sockets(i, s)
-	{
-		int open_count = 0;
-
-		/*
-		 *	If all instances of the descriptor are not
-		 *	in flight we are in use.
-		 *
-		 *	Special case: when socket s is embrion, it may be
-		 *	hashed but still not in queue of listening socket.
-		 *	In this case (see unix_create1()) we set artificial
-		 *	negative inflight counter to close race window.
-		 *	It is trick of course and dirty one.
-		 */
-		if (s->sk_socket && s->sk_socket->file)
-			open_count = file_count(s->sk_socket->file);
-		if (open_count > atomic_read(&unix_sk(s)->inflight))
-			maybe_unmark_and_push(s);
-	}
+	list_for_each_entry(u, &gc_candidates, link)
+		scan_children(&u->sk, dec_inflight, NULL);
 
 	/*
-	 *	Mark phase 
+	 *	Give them back to the children of the candidates that are
+	 *	still referenced from outside, which are then no candidates
+	 *	themselves.  The cursor keeps our place while the list
+	 *	changes under it.
 	 */
+	list_add(&cursor, &gc_candidates);
+	while (cursor.next != &gc_candidates) {
+		u = list_entry(cursor.next, struct unix_sock, link);
 
-	while (!empty_stack())
-	{
-		struct sock *x = pop_stack();
-		struct sock *sk;
+		/* Move cursor to after the current position. */
+		list_move(&cursor, &u->link);
 
-		spin_lock(&x->sk_receive_queue.lock);
-		skb = skb_peek(&x->sk_receive_queue);
-		
-		/*
-		 *	Loop through all but first born 
-		 */
-		
-		while (skb && skb != (struct sk_buff *)&x->sk_receive_queue) {
-			/*
-			 *	Do we have file descriptors ?
-			 */
-			if(UNIXCB(skb).fp)
-			{
-				/*
-				 *	Process the descriptors of this socket
-				 */
-				int nfd=UNIXCB(skb).fp->count;
-				struct file **fp = UNIXCB(skb).fp->fp;
-				while(nfd--)
-				{
-					/*
-					 *	Get the socket the fd matches if
-					 *	it indeed does so
-					 */
-					if((sk=unix_get_socket(*fp++))!=NULL)
-					{
-						maybe_unmark_and_push(sk);
-					}
-				}
-			}
-			/* We have to scan not-yet-accepted ones too */
-			if (x->sk_state == TCP_LISTEN)
-				maybe_unmark_and_push(skb->sk);
-			skb=skb->next;
+		if (atomic_read(&u->inflight) > 0) {
+			list_move_tail(&u->link, &gc_inflight_list);
+			u->gc_candidate = 0;
+			scan_children(&u->sk, inc_inflight_move_tail, NULL);
 		}
-		spin_unlock(&x->sk_receive_queue.lock);
-		sock_put(x);
 	}
+	list_del(&cursor);
 
+	/*
+	 *	The candidates left are garbage.  Restore their counts as
+	 *	well and collect the skbs making up the cycles.
+	 */
 	skb_queue_head_init(&hitlist);
+	list_for_each_entry(u, &gc_candidates, link)
+		scan_children(&u->sk, inc_inflight, &hitlist);
 
-	forall_unix_sockets(i, s)
-	{
-		struct unix_sock *u = unix_sk(s);
-
-		if (u->gc_tree == GC_ORPHAN) {
-			struct sk_buff *nextsk;
-
-			spin_lock(&s->sk_receive_queue.lock);
-			skb = skb_peek(&s->sk_receive_queue);
-			while (skb &&
-			       skb != (struct sk_buff *)&s->sk_receive_queue) {
-				nextsk = skb->next;
-				/*
-				 *	Do we have file descriptors ?
-				 */
-				if (UNIXCB(skb).fp) {
-					__skb_unlink(skb,
-						     &s->sk_receive_queue);
-					__skb_queue_tail(&hitlist, skb);
-				}
-				skb = nextsk;
-			}
-			spin_unlock(&s->sk_receive_queue.lock);
-		}
-		u->gc_tree = GC_ORPHAN;
-	}
-	spin_unlock(&unix_table_lock);
+	spin_unlock(&unix_gc_lock);
 
 	/*
 	 *	Here we are. Hitlist is filled. Die.
 	 */
 
 	__skb_queue_purge(&hitlist);
-	mutex_unlock(&unix_gc_sem);
+
+	spin_lock(&unix_gc_lock);
+
+	/* All candidates should have been detached by now. */
+	BUG_ON(!list_empty(&gc_candidates));
+	gc_in_progress = 0;
+
+ out:
+	spin_unlock(&unix_gc_lock);
 }
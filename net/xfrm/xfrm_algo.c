@@ -13,6 +13,7 @@
 #include <linux/kernel.h>
 #include <linux/pfkeyv2.h>
 #include <linux/crypto.h>
+#include <linux/random.h>
 #include <net/xfrm.h>
 #if defined(CONFIG_INET_AH) || defined(CONFIG_INET_AH_MODULE) || defined(CONFIG_INET6_AH) || defined(CONFIG_INET6_AH_MODULE)
 #include <net/ah.h>
@@ -723,4 +724,113 @@ void *pskb_put(struct sk_buff *skb, struct sk_buff *tail, int len)
 	return skb_put(tail, len);
 }
 EXPORT_SYMBOL_GPL(pskb_put);
+
+void esp_free_data(struct esp_data *esp)
+{
+	int i;
+
+	for (i = 0; i < esp->nctx; i++) {
+		struct esp_ctx *ctx = &esp->ctx[i];
+
+		crypto_free_tfm(ctx->tfm);
+		kfree(ctx->ivec);
+		crypto_free_tfm(ctx->auth_tfm);
+		kfree(ctx->work_icv);
+	}
+	kfree(esp);
+}
+EXPORT_SYMBOL_GPL(esp_free_data);
+
+static int esp_init_ctx(struct xfrm_state *x, struct esp_data *esp,
+			struct esp_ctx *ctx, u32 cipher_flags)
+{
+	spin_lock_init(&ctx->lock);
+
+	if (x->aalg) {
+		ctx->auth_tfm = crypto_alloc_tfm(x->aalg->alg_name, 0);
+		if (ctx->auth_tfm == NULL)
+			return -EINVAL;
+		if (esp->auth.icv_full_len !=
+		    crypto_tfm_alg_digestsize(ctx->auth_tfm)) {
+			NETDEBUG(KERN_INFO "ESP: %s digestsize %u != %hu\n",
+				 x->aalg->alg_name,
+				 crypto_tfm_alg_digestsize(ctx->auth_tfm),
+				 esp->auth.icv_full_len);
+			return -EINVAL;
+		}
+		ctx->work_icv = kmalloc(esp->auth.icv_full_len, GFP_KERNEL);
+		if (!ctx->work_icv)
+			return -ENOMEM;
+	}
+
+	ctx->tfm = crypto_alloc_tfm(x->ealg->alg_name, cipher_flags);
+	if (ctx->tfm == NULL)
+		return -EINVAL;
+	if (crypto_cipher_setkey(ctx->tfm, esp->conf.key, esp->conf.key_len))
+		return -EINVAL;
+	if (crypto_tfm_alg_ivsize(ctx->tfm)) {
+		ctx->ivec = kmalloc(crypto_tfm_alg_ivsize(ctx->tfm), GFP_KERNEL);
+		if (unlikely(ctx->ivec == NULL))
+			return -ENOMEM;
+		get_random_bytes(ctx->ivec, crypto_tfm_alg_ivsize(ctx->tfm));
+	}
+	return 0;
+}
+
+/**
+ * esp_alloc_data - set up the keys and crypto contexts of an ESP SA
+ * @x: the SA, with its algorithms
+ * @cipher_flags: crypto_alloc_tfm() flags for the cipher
+ *
+ * The first context is allocated with @cipher_flags, the others without
+ * CRYPTO_TFM_REQ_ASYNC, and there are no others if the first one is
+ * asynchronous.  Returns an ERR_PTR on failure.
+ */
+struct esp_data *esp_alloc_data(struct xfrm_state *x, u32 cipher_flags)
+{
+	int nctx = min_t(int, num_online_cpus(), ESP_MAX_CTX);
+	struct esp_data *esp;
+	int err, i;
+
+	esp = kzalloc(sizeof(*esp) + nctx * sizeof(struct esp_ctx),
+		      GFP_KERNEL);
+	if (esp == NULL)
+		return ERR_PTR(-ENOMEM);
+
+	if (x->aalg) {
+		struct xfrm_algo_desc *aalg_desc;
+
+		esp->auth.key = x->aalg->alg_key;
+		esp->auth.key_len = (x->aalg->alg_key_len+7)/8;
+		esp->auth.icv = esp_hmac_digest;
+
+		aalg_desc = xfrm_aalg_get_byname(x->aalg->alg_name, 0);
+		BUG_ON(!aalg_desc);
+
+		esp->auth.icv_full_len = aalg_desc->uinfo.auth.icv_fullbits/8;
+		esp->auth.icv_trunc_len = aalg_desc->uinfo.auth.icv_truncbits/8;
+	}
+	esp->conf.key = x->ealg->alg_key;
+	esp->conf.key_len = (x->ealg->alg_key_len+7)/8;
+
+	for (i = 0; i < nctx; i++) {
+		esp->nctx = i + 1;
+		err = esp_init_ctx(x, esp, &esp->ctx[i], cipher_flags);
+		if (err)
+			goto error;
+		if (crypto_tfm_alg_async(esp->ctx[i].tfm))
+			break;
+		cipher_flags &= ~CRYPTO_TFM_REQ_ASYNC;
+	}
+
+	esp->conf.tfm = esp->ctx[0].tfm;
+	esp->conf.ivlen = crypto_tfm_alg_ivsize(esp->conf.tfm);
+	esp->conf.padlen = 0;
+	return esp;
+
+error:
+	esp_free_data(esp);
+	return ERR_PTR(err);
+}
+EXPORT_SYMBOL_GPL(esp_alloc_data);
 #endif
@@ -348,9 +348,9 @@ static void xfrm_policy_gc_kill(struct xfrm_policy *policy)
 	if (del_timer(&policy->timer))
 		atomic_dec(&policy->refcnt);
 
-	if (atomic_read(&policy->refcnt) > 1)
-		flow_cache_flush();
-
+	/* Flow cache entries still holding the policy see it is dead on
+	 * their next lookup and drop it then, so it may well be one of them
+	 * that frees it. */
 	xfrm_pol_put(policy);
 }
 
@@ -451,7 +451,12 @@ int xfrm_policy_insert(int dir, struct xfrm_policy *policy, int excl)
 	xfrm_pol_hold(policy);
 	policy->next = *p;
 	*p = policy;
-	atomic_inc(&flow_cache_genid);
+	/* Cached lookups that found delpol find out it is dead by themselves.
+	 * Only a policy that goes ahead of what was there before may take
+	 * over flows that resolved to something else, and then all of the
+	 * cache has to be looked up again. */
+	if (!delpol || policy->priority < delpol->priority)
+		atomic_inc(&flow_cache_genid);
 	policy->index = delpol ? delpol->index : xfrm_gen_index(dir);
 	policy->curlft.add_time = (unsigned long)xtime.tv_sec;
 	policy->curlft.use_time = 0;
@@ -510,10 +515,8 @@ struct xfrm_policy *xfrm_policy_bysel_ctx(int dir, struct xfrm_selector *sel,
 	}
 	write_unlock_bh(&xfrm_policy_lock);
 
-	if (pol && delete) {
-		atomic_inc(&flow_cache_genid);
+	if (pol && delete)
 		xfrm_policy_kill(pol);
-	}
 	return pol;
 }
 EXPORT_SYMBOL(xfrm_policy_bysel_ctx);
@@ -533,10 +536,8 @@ struct xfrm_policy *xfrm_policy_byid(int dir, u32 id, int delete)
 	}
 	write_unlock_bh(&xfrm_policy_lock);
 
-	if (pol && delete) {
-		atomic_inc(&flow_cache_genid);
+	if (pol && delete)
 		xfrm_policy_kill(pol);
-	}
 	return pol;
 }
 EXPORT_SYMBOL(xfrm_policy_byid);
@@ -557,7 +558,6 @@ void xfrm_policy_flush(void)
 			write_lock_bh(&xfrm_policy_lock);
 		}
 	}
-	atomic_inc(&flow_cache_genid);
 	write_unlock_bh(&xfrm_policy_lock);
 }
 EXPORT_SYMBOL(xfrm_policy_flush);
@@ -624,6 +624,24 @@ static void xfrm_policy_lookup(struct flowi *fl, u32 sk_sid, u16 family, u8 dir,
 		*obj_refp = &pol->refcnt;
 }
 
+/* Policies are never changed in place, an update inserts a new one and
+ * kills the old, so a cached policy is good for as long as it lives. */
+static int xfrm_policy_cache_check(void *obj)
+{
+	return !((struct xfrm_policy *)obj)->dead;
+}
+
+static void xfrm_policy_cache_put(void *obj)
+{
+	xfrm_pol_put(obj);
+}
+
+static struct flow_cache_ops xfrm_policy_cache_ops = {
+	.resolve	= xfrm_policy_lookup,
+	.check		= xfrm_policy_cache_check,
+	.put		= xfrm_policy_cache_put,
+};
+
 static inline int policy_to_flow_dir(int dir)
 {
 	if (XFRM_POLICY_IN == FLOW_DIR_IN &&
@@ -691,8 +709,6 @@ int xfrm_policy_delete(struct xfrm_policy *pol, int dir)
 	pol = __xfrm_policy_unlink(pol, dir);
 	write_unlock_bh(&xfrm_policy_lock);
 	if (pol) {
-		if (dir < XFRM_POLICY_MAX)
-			atomic_inc(&flow_cache_genid);
 		xfrm_policy_kill(pol);
 		return 0;
 	}
@@ -875,7 +891,7 @@ restart:
 			return 0;
 
 		policy = flow_cache_lookup(fl, sk_sid, dst_orig->ops->family,
-					   dir, xfrm_policy_lookup);
+					   dir, &xfrm_policy_cache_ops);
 	}
 
 	if (!policy)
@@ -1083,7 +1099,7 @@ int __xfrm_policy_check(struct sock *sk, int dir, struct sk_buff *skb,
 
 	if (!pol)
 		pol = flow_cache_lookup(&fl, sk_sid, family, fl_dir,
-					xfrm_policy_lookup);
+					&xfrm_policy_cache_ops);
 
 	if (!pol)
 		return !skb->sp || !secpath_has_tunnel(skb->sp, 0);
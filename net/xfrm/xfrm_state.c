@@ -34,6 +34,10 @@ EXPORT_SYMBOL(sysctl_xfrm_aevent_rseqth);
    1. Hash table by (spi,daddr,ah/esp) to find SA by SPI. (input,ctl)
    2. Hash table by daddr to find what SAs exist for given
       destination/tunnel endpoint. (output)
+
+   Both are changed under xfrm_state_lock.  The SPI table is looked up
+   for every received packet, under rcu_read_lock() only: states are
+   freed an RCU grace period after they leave it.
  */
 
 static DEFINE_SPINLOCK(xfrm_state_lock);
@@ -102,6 +106,10 @@ static void xfrm_state_gc_task(void *data)
 	list_splice_init(&xfrm_state_gc_list, &gc_list);
 	spin_unlock_bh(&xfrm_state_gc_lock);
 
+	/* for lookups by SPI that may still be walking past them */
+	if (!list_empty(&gc_list))
+		synchronize_rcu();
+
 	list_for_each_safe(entry, tmp, &gc_list) {
 		x = list_entry(entry, struct xfrm_state, bydst);
 		xfrm_state_gc_destroy(x);
@@ -241,7 +249,7 @@ int __xfrm_state_delete(struct xfrm_state *x)
 		list_del(&x->bydst);
 		__xfrm_state_put(x);
 		if (x->id.spi) {
-			list_del(&x->byspi);
+			list_del_rcu(&x->byspi);
 			__xfrm_state_put(x);
 		}
 		spin_unlock(&xfrm_state_lock);
@@ -409,7 +417,7 @@ xfrm_state_find(xfrm_address_t *daddr, xfrm_address_t *saddr,
 			xfrm_state_hold(x);
 			if (x->id.spi) {
 				h = xfrm_spi_hash(&x->id.daddr, x->id.spi, x->id.proto, family);
-				list_add(&x->byspi, xfrm_state_byspi+h);
+				list_add_rcu(&x->byspi, xfrm_state_byspi+h);
 				xfrm_state_hold(x);
 			}
 			x->lft.hard_add_expires_seconds = XFRM_ACQ_EXPIRES;
@@ -442,7 +450,7 @@ static void __xfrm_state_insert(struct xfrm_state *x)
 
 	h = xfrm_spi_hash(&x->id.daddr, x->id.spi, x->id.proto, x->props.family);
 
-	list_add(&x->byspi, xfrm_state_byspi+h);
+	list_add_rcu(&x->byspi, xfrm_state_byspi+h);
 	xfrm_state_hold(x);
 
 	if (!mod_timer(&x->timer, jiffies + HZ))
@@ -644,9 +652,9 @@ xfrm_state_lookup(xfrm_address_t *daddr, u32 spi, u8 proto,
 	if (!afinfo)
 		return NULL;
 
-	spin_lock_bh(&xfrm_state_lock);
+	rcu_read_lock();
 	x = afinfo->state_lookup(daddr, spi, proto);
-	spin_unlock_bh(&xfrm_state_lock);
+	rcu_read_unlock();
 	xfrm_state_put_afinfo(afinfo);
 	return x;
 }
@@ -745,7 +753,7 @@ xfrm_alloc_spi(struct xfrm_state *x, u32 minspi, u32 maxspi)
 	if (x->id.spi) {
 		spin_lock_bh(&xfrm_state_lock);
 		h = xfrm_spi_hash(&x->id.daddr, x->id.spi, x->id.proto, x->props.family);
-		list_add(&x->byspi, xfrm_state_byspi+h);
+		list_add_rcu(&x->byspi, xfrm_state_byspi+h);
 		xfrm_state_hold(x);
 		spin_unlock_bh(&xfrm_state_lock);
 		wake_up(&km_waitq);
@@ -20,6 +20,8 @@
 #include <linux/fs.h>
 #include <linux/dcache.h>
 #include <linux/init.h>
+#include <linux/bootmem.h>
+#include <linux/mm.h>
 #include <linux/skbuff.h>
 #include <linux/percpu.h>
 #include <net/sock.h>
@@ -68,9 +70,11 @@ static const struct av_inherit
 #undef S_
 };
 
-#define AVC_CACHE_SLOTS			512
+#define AVC_CACHE_SLOTS			512	/* at least, see avc_init() */
+#define AVC_CACHE_SLOTS_MAX		16384
 #define AVC_DEF_CACHE_THRESHOLD		512
 #define AVC_CACHE_RECLAIM		16
+#define AVC_PCPU_SLOTS			32
 
 #ifdef CONFIG_SECURITY_SELINUX_AVC_STATS
 #define avc_cache_stats_incr(field) 				\
@@ -96,14 +100,44 @@ struct avc_node {
 	struct rcu_head         rhead;
 };
 
+struct avc_slot {
+	struct list_head	list;
+	spinlock_t		lock;		/* lock for writes */
+};
+
 struct avc_cache {
-	struct list_head	slots[AVC_CACHE_SLOTS];
-	spinlock_t		slots_lock[AVC_CACHE_SLOTS]; /* lock for writes */
+	struct avc_slot		*slots;
+	unsigned int		hash_mask;	/* number of slots - 1 */
 	atomic_t		lru_hint;	/* LRU hint for reclaim scan */
 	atomic_t		active_nodes;
+	atomic_t		gen;		/* bumped when a decision changes */
 	u32			latest_notif;	/* latest revocation notification */
 };
 
+/*
+ * A small per-cpu cache of recent decisions in front of avc_cache, so
+ * that a repeated check touches no memory shared with other cpus.  An
+ * entry is good while its gen matches avc_cache.gen, which is bumped
+ * whenever a cached decision is replaced or the cache is reset; nodes
+ * reclaimed for space do not bump it, their decisions still hold.
+ *
+ * Process and interrupt context may both use a cpu's cache: seq is odd
+ * while an entry is being written, and a lookup or fill that finds it
+ * so, or sees it change under a lookup, just misses.
+ */
+struct avc_pcpu_entry {
+	u32			ssid;
+	u32			tsid;
+	u16			tclass;
+	u32			gen;
+	struct av_decision	avd;
+};
+
+struct avc_pcpu_cache {
+	unsigned int		seq;
+	struct avc_pcpu_entry	entry[AVC_PCPU_SLOTS];
+};
+
 struct avc_callback_node {
 	int (*callback) (u32 event, u32 ssid, u32 tsid,
 	                 u16 tclass, u32 perms,
@@ -124,12 +158,28 @@ DEFINE_PER_CPU(struct avc_cache_stats, avc_cache_stats) = { 0 };
 #endif
 
 static struct avc_cache avc_cache;
+static DEFINE_PER_CPU(struct avc_pcpu_cache, avc_pcpu_cache);
 static struct avc_callback_node *avc_callbacks;
 static kmem_cache_t *avc_node_cachep;
 
+static __initdata unsigned long avc_hash_entries;
+static int __init set_avc_hash_entries(char *str)
+{
+	if (!str)
+		return 0;
+	avc_hash_entries = simple_strtoul(str, &str, 0);
+	return 1;
+}
+__setup("avc_hash_entries=", set_avc_hash_entries);
+
 static inline int avc_hash(u32 ssid, u32 tsid, u16 tclass)
 {
-	return (ssid ^ (tsid<<2) ^ (tclass<<4)) & (AVC_CACHE_SLOTS - 1);
+	return (ssid ^ (tsid<<2) ^ (tclass<<4)) & avc_cache.hash_mask;
+}
+
+static inline int avc_pcpu_hash(u32 ssid, u32 tsid, u16 tclass)
+{
+	return (ssid ^ (tsid<<2) ^ (tclass<<4)) & (AVC_PCPU_SLOTS - 1);
 }
 
 /**
@@ -228,14 +278,28 @@ static void avc_dump_query(struct audit_buffer *ab, u32 ssid, u32 tsid, u16 tcla
  */
 void __init avc_init(void)
 {
+	unsigned long entries;
 	int i;
 
-	for (i = 0; i < AVC_CACHE_SLOTS; i++) {
-		INIT_LIST_HEAD(&avc_cache.slots[i]);
-		spin_lock_init(&avc_cache.slots_lock[i]);
+	/* a slot per megabyte of memory, unless avc_hash_entries= says */
+	entries = avc_hash_entries;
+	if (!entries)
+		entries = max_t(unsigned long, AVC_CACHE_SLOTS,
+				num_physpages >> (20 - PAGE_SHIFT));
+	avc_cache.slots = alloc_large_system_hash("AVC",
+						  sizeof(struct avc_slot),
+						  entries, 0, 0, NULL,
+						  &avc_cache.hash_mask,
+						  AVC_CACHE_SLOTS_MAX);
+	for (i = 0; i <= avc_cache.hash_mask; i++) {
+		INIT_LIST_HEAD(&avc_cache.slots[i].list);
+		spin_lock_init(&avc_cache.slots[i].lock);
 	}
 	atomic_set(&avc_cache.active_nodes, 0);
 	atomic_set(&avc_cache.lru_hint, 0);
+	atomic_set(&avc_cache.gen, 1);		/* unused pcpu entries have 0 */
+	if (avc_cache_threshold < avc_cache.hash_mask + 1)
+		avc_cache_threshold = avc_cache.hash_mask + 1;
 
 	avc_node_cachep = kmem_cache_create("avc_node", sizeof(struct avc_node),
 					     0, SLAB_PANIC, NULL, NULL);
@@ -252,11 +316,11 @@ int avc_get_hash_stats(char *page)
 
 	slots_used = 0;
 	max_chain_len = 0;
-	for (i = 0; i < AVC_CACHE_SLOTS; i++) {
-		if (!list_empty(&avc_cache.slots[i])) {
+	for (i = 0; i <= avc_cache.hash_mask; i++) {
+		if (!list_empty(&avc_cache.slots[i].list)) {
 			slots_used++;
 			chain_len = 0;
-			list_for_each_entry_rcu(node, &avc_cache.slots[i], list)
+			list_for_each_entry_rcu(node, &avc_cache.slots[i].list, list)
 				chain_len++;
 			if (chain_len > max_chain_len)
 				max_chain_len = chain_len;
@@ -268,7 +332,7 @@ int avc_get_hash_stats(char *page)
 	return scnprintf(page, PAGE_SIZE, "entries: %d\nbuckets used: %d/%d\n"
 			 "longest chain: %d\n",
 			 atomic_read(&avc_cache.active_nodes),
-			 slots_used, AVC_CACHE_SLOTS, max_chain_len);
+			 slots_used, avc_cache.hash_mask + 1, max_chain_len);
 }
 
 static void avc_node_free(struct rcu_head *rhead)
@@ -292,11 +356,19 @@ static void avc_node_kill(struct avc_node *node)
 	atomic_dec(&avc_cache.active_nodes);
 }
 
+/* Called after a decision changes, to drop it from the per-cpu caches */
+static inline void avc_pcpu_invalidate(void)
+{
+	smp_wmb();
+	atomic_inc(&avc_cache.gen);
+}
+
 static void avc_node_replace(struct avc_node *new, struct avc_node *old)
 {
 	list_replace_rcu(&old->list, &new->list);
 	call_rcu(&old->rhead, avc_node_free);
 	atomic_dec(&avc_cache.active_nodes);
+	avc_pcpu_invalidate();
 }
 
 static inline int avc_reclaim_node(void)
@@ -305,25 +377,25 @@ static inline int avc_reclaim_node(void)
 	int hvalue, try, ecx;
 	unsigned long flags;
 
-	for (try = 0, ecx = 0; try < AVC_CACHE_SLOTS; try++ ) {
-		hvalue = atomic_inc_return(&avc_cache.lru_hint) & (AVC_CACHE_SLOTS - 1);
+	for (try = 0, ecx = 0; try <= avc_cache.hash_mask; try++ ) {
+		hvalue = atomic_inc_return(&avc_cache.lru_hint) & avc_cache.hash_mask;
 
-		if (!spin_trylock_irqsave(&avc_cache.slots_lock[hvalue], flags))
+		if (!spin_trylock_irqsave(&avc_cache.slots[hvalue].lock, flags))
 			continue;
 
-		list_for_each_entry(node, &avc_cache.slots[hvalue], list) {
+		list_for_each_entry(node, &avc_cache.slots[hvalue].list, list) {
 			if (atomic_dec_and_test(&node->ae.used)) {
 				/* Recently Unused */
 				avc_node_delete(node);
 				avc_cache_stats_incr(reclaims);
 				ecx++;
 				if (ecx >= AVC_CACHE_RECLAIM) {
-					spin_unlock_irqrestore(&avc_cache.slots_lock[hvalue], flags);
+					spin_unlock_irqrestore(&avc_cache.slots[hvalue].lock, flags);
 					goto out;
 				}
 			}
 		}
-		spin_unlock_irqrestore(&avc_cache.slots_lock[hvalue], flags);
+		spin_unlock_irqrestore(&avc_cache.slots[hvalue].lock, flags);
 	}
 out:
 	return ecx;
@@ -364,7 +436,7 @@ static inline struct avc_node *avc_search_node(u32 ssid, u32 tsid, u16 tclass)
 	int hvalue;
 
 	hvalue = avc_hash(ssid, tsid, tclass);
-	list_for_each_entry_rcu(node, &avc_cache.slots[hvalue], list) {
+	list_for_each_entry_rcu(node, &avc_cache.slots[hvalue].list, list) {
 		if (ssid == node->ae.ssid &&
 		    tclass == node->ae.tclass &&
 		    tsid == node->ae.tsid) {
@@ -417,6 +489,58 @@ out:
 	return node;
 }
 
+/*
+ * avc_pcpu_lookup - Look up a decision in this cpu's front cache.
+ * @gen: avc_cache.gen, read before this and any avc_lookup()
+ *
+ * Copies the decision to @avd and returns 1 if there is one for
+ * (@ssid, @tsid, @tclass) that covers @requested, else returns 0.
+ */
+static int avc_pcpu_lookup(u32 ssid, u32 tsid, u16 tclass, u32 requested,
+			   u32 gen, struct av_decision *avd)
+{
+	struct avc_pcpu_cache *pc = &get_cpu_var(avc_pcpu_cache);
+	struct avc_pcpu_entry *e;
+	unsigned int seq;
+	int hit = 0;
+
+	e = &pc->entry[avc_pcpu_hash(ssid, tsid, tclass)];
+	seq = pc->seq;
+	barrier();
+	if (!(seq & 1) && e->gen == gen && e->ssid == ssid &&
+	    e->tsid == tsid && e->tclass == tclass &&
+	    (e->avd.decided & requested) == requested) {
+		memcpy(avd, &e->avd, sizeof(*avd));
+		barrier();
+		hit = (pc->seq == seq);
+	}
+	put_cpu_var(avc_pcpu_cache);
+
+	return hit;
+}
+
+static void avc_pcpu_fill(u32 ssid, u32 tsid, u16 tclass, u32 gen,
+			  struct av_decision *avd)
+{
+	struct avc_pcpu_cache *pc = &get_cpu_var(avc_pcpu_cache);
+	struct avc_pcpu_entry *e;
+
+	/* not if we interrupted a fill on this cpu */
+	if (!(pc->seq & 1)) {
+		e = &pc->entry[avc_pcpu_hash(ssid, tsid, tclass)];
+		pc->seq++;
+		barrier();
+		e->ssid = ssid;
+		e->tsid = tsid;
+		e->tclass = tclass;
+		e->gen = gen;
+		memcpy(&e->avd, avd, sizeof(e->avd));
+		barrier();
+		pc->seq++;
+	}
+	put_cpu_var(avc_pcpu_cache);
+}
+
 static int avc_latest_notif_update(int seqno, int is_insert)
 {
 	int ret = 0;
@@ -470,8 +594,8 @@ static struct avc_node *avc_insert(u32 ssid, u32 tsid, u16 tclass, struct avc_en
 		hvalue = avc_hash(ssid, tsid, tclass);
 		avc_node_populate(node, ssid, tsid, tclass, ae);
 
-		spin_lock_irqsave(&avc_cache.slots_lock[hvalue], flag);
-		list_for_each_entry(pos, &avc_cache.slots[hvalue], list) {
+		spin_lock_irqsave(&avc_cache.slots[hvalue].lock, flag);
+		list_for_each_entry(pos, &avc_cache.slots[hvalue].list, list) {
 			if (pos->ae.ssid == ssid &&
 			    pos->ae.tsid == tsid &&
 			    pos->ae.tclass == tclass) {
@@ -479,9 +603,9 @@ static struct avc_node *avc_insert(u32 ssid, u32 tsid, u16 tclass, struct avc_en
 				goto found;
 			}
 		}
-		list_add_rcu(&node->list, &avc_cache.slots[hvalue]);
+		list_add_rcu(&node->list, &avc_cache.slots[hvalue].list);
 found:
-		spin_unlock_irqrestore(&avc_cache.slots_lock[hvalue], flag);
+		spin_unlock_irqrestore(&avc_cache.slots[hvalue].lock, flag);
 	}
 out:
 	return node;
@@ -742,9 +866,9 @@ static int avc_update_node(u32 event, u32 perms, u32 ssid, u32 tsid, u16 tclass)
 
 	/* Lock the target slot */
 	hvalue = avc_hash(ssid, tsid, tclass);
-	spin_lock_irqsave(&avc_cache.slots_lock[hvalue], flag);
+	spin_lock_irqsave(&avc_cache.slots[hvalue].lock, flag);
 
-	list_for_each_entry(pos, &avc_cache.slots[hvalue], list){
+	list_for_each_entry(pos, &avc_cache.slots[hvalue].list, list){
 		if ( ssid==pos->ae.ssid &&
 		     tsid==pos->ae.tsid &&
 		     tclass==pos->ae.tclass ){
@@ -788,7 +912,7 @@ static int avc_update_node(u32 event, u32 perms, u32 ssid, u32 tsid, u16 tclass)
 	}
 	avc_node_replace(node, orig);
 out_unlock:
-	spin_unlock_irqrestore(&avc_cache.slots_lock[hvalue], flag);
+	spin_unlock_irqrestore(&avc_cache.slots[hvalue].lock, flag);
 out:
 	return rc;
 }
@@ -804,12 +928,13 @@ int avc_ss_reset(u32 seqno)
 	unsigned long flag;
 	struct avc_node *node;
 
-	for (i = 0; i < AVC_CACHE_SLOTS; i++) {
-		spin_lock_irqsave(&avc_cache.slots_lock[i], flag);
-		list_for_each_entry(node, &avc_cache.slots[i], list)
+	for (i = 0; i <= avc_cache.hash_mask; i++) {
+		spin_lock_irqsave(&avc_cache.slots[i].lock, flag);
+		list_for_each_entry(node, &avc_cache.slots[i].list, list)
 			avc_node_delete(node);
-		spin_unlock_irqrestore(&avc_cache.slots_lock[i], flag);
+		spin_unlock_irqrestore(&avc_cache.slots[i].lock, flag);
 	}
+	avc_pcpu_invalidate();
 
 	for (c = avc_callbacks; c; c = c->next) {
 		if (c->events & AVC_CALLBACK_RESET) {
@@ -849,13 +974,23 @@ int avc_has_perm_noaudit(u32 ssid, u32 tsid,
                          u16 tclass, u32 requested,
                          struct av_decision *avd)
 {
-	struct avc_node *node;
+	struct avc_node *node = NULL;
 	struct avc_entry entry, *p_ae;
-	int rc = 0;
-	u32 denied;
+	int rc = 0, cached = 0;
+	u32 denied, gen;
 
 	rcu_read_lock();
 
+	gen = atomic_read(&avc_cache.gen);
+	smp_rmb();
+	if (avc_pcpu_lookup(ssid, tsid, tclass, requested, gen, &entry.avd)) {
+		avc_cache_stats_incr(lookups);
+		avc_cache_stats_incr(hits);
+		cached = 1;
+		p_ae = &entry;
+		goto decide;
+	}
+
 	node = avc_lookup(ssid, tsid, tclass, requested);
 	if (!node) {
 		rcu_read_unlock();
@@ -867,7 +1002,10 @@ int avc_has_perm_noaudit(u32 ssid, u32 tsid,
 	}
 
 	p_ae = node ? &node->ae : &entry;
+	if (node)
+		avc_pcpu_fill(ssid, tsid, tclass, gen, &node->ae.avd);
 
+decide:
 	if (avd)
 		memcpy(avd, &p_ae->avd, sizeof(*avd));
 
@@ -877,7 +1015,7 @@ int avc_has_perm_noaudit(u32 ssid, u32 tsid,
 		if (selinux_enforcing)
 			rc = -EACCES;
 		else
-			if (node)
+			if (node || cached)
 				avc_update_node(AVC_CALLBACK_GRANT,requested,
 						ssid,tsid,tclass);
 	}
@@ -18,15 +18,22 @@
 #include <linux/slab.h>
 #include <linux/vmalloc.h>
 #include <linux/errno.h>
+#include <linux/jhash.h>
+#include <linux/bitops.h>
 
 #include "avtab.h"
 #include "policydb.h"
 
-#define AVTAB_HASH(keyp) \
-((keyp->target_class + \
- (keyp->target_type << 2) + \
- (keyp->source_type << 9)) & \
- AVTAB_HASH_MASK)
+/*
+ * Types and classes are small dense integers, and rules tend to come in
+ * runs of neighbouring values; mix them all so that the runs spread
+ * over the whole table.
+ */
+static inline int avtab_hash(struct avtab_key *keyp, u32 mask)
+{
+	return jhash_3words(keyp->source_type, keyp->target_type,
+			    keyp->target_class, 0) & mask;
+}
 
 static kmem_cache_t *avtab_node_cachep;
 
@@ -60,10 +67,10 @@ static int avtab_insert(struct avtab *h, struct avtab_key *key, struct avtab_dat
 	struct avtab_node *prev, *cur, *newnode;
 	u16 specified = key->specified & ~(AVTAB_ENABLED|AVTAB_ENABLED_OLD);
 
-	if (!h)
+	if (!h || !h->htable)
 		return -EINVAL;
 
-	hvalue = AVTAB_HASH(key);
+	hvalue = avtab_hash(key, h->mask);
 	for (prev = NULL, cur = h->htable[hvalue];
 	     cur;
 	     prev = cur, cur = cur->next) {
@@ -101,9 +108,9 @@ avtab_insert_nonunique(struct avtab * h, struct avtab_key * key, struct avtab_da
 	struct avtab_node *prev, *cur, *newnode;
 	u16 specified = key->specified & ~(AVTAB_ENABLED|AVTAB_ENABLED_OLD);
 
-	if (!h)
+	if (!h || !h->htable)
 		return NULL;
-	hvalue = AVTAB_HASH(key);
+	hvalue = avtab_hash(key, h->mask);
 	for (prev = NULL, cur = h->htable[hvalue];
 	     cur;
 	     prev = cur, cur = cur->next) {
@@ -133,10 +140,10 @@ struct avtab_datum *avtab_search(struct avtab *h, struct avtab_key *key)
 	struct avtab_node *cur;
 	u16 specified = key->specified & ~(AVTAB_ENABLED|AVTAB_ENABLED_OLD);
 
-	if (!h)
+	if (!h || !h->htable)
 		return NULL;
 
-	hvalue = AVTAB_HASH(key);
+	hvalue = avtab_hash(key, h->mask);
 	for (cur = h->htable[hvalue]; cur; cur = cur->next) {
 		if (key->source_type == cur->key.source_type &&
 		    key->target_type == cur->key.target_type &&
@@ -168,10 +175,10 @@ avtab_search_node(struct avtab *h, struct avtab_key *key)
 	struct avtab_node *cur;
 	u16 specified = key->specified & ~(AVTAB_ENABLED|AVTAB_ENABLED_OLD);
 
-	if (!h)
+	if (!h || !h->htable)
 		return NULL;
 
-	hvalue = AVTAB_HASH(key);
+	hvalue = avtab_hash(key, h->mask);
 	for (cur = h->htable[hvalue]; cur; cur = cur->next) {
 		if (key->source_type == cur->key.source_type &&
 		    key->target_type == cur->key.target_type &&
@@ -229,7 +236,7 @@ void avtab_destroy(struct avtab *h)
 	if (!h || !h->htable)
 		return;
 
-	for (i = 0; i < AVTAB_SIZE; i++) {
+	for (i = 0; i < h->nslot; i++) {
 		cur = h->htable[i];
 		while (cur != NULL) {
 			temp = cur;
@@ -240,22 +247,66 @@ void avtab_destroy(struct avtab *h)
 	}
 	vfree(h->htable);
 	h->htable = NULL;
+	h->nslot = 0;
+	h->mask = 0;
 }
 
-
 int avtab_init(struct avtab *h)
 {
-	int i;
+	h->htable = NULL;
+	h->nel = 0;
+	h->nslot = 0;
+	h->mask = 0;
+	return 0;
+}
 
-	h->htable = vmalloc(sizeof(*(h->htable)) * AVTAB_SIZE);
+/*
+ * avtab_alloc - size the table for about @nrules rules, a bucket for
+ * every two, as a power of two from AVTAB_MIN_BUCKETS to
+ * AVTAB_MAX_BUCKETS.
+ */
+int avtab_alloc(struct avtab *h, u32 nrules)
+{
+	u32 nslot = AVTAB_MIN_BUCKETS;
+
+	while (nslot < nrules / 2 && nslot < AVTAB_MAX_BUCKETS)
+		nslot <<= 1;
+
+	h->htable = vmalloc(sizeof(*(h->htable)) * nslot);
 	if (!h->htable)
 		return -ENOMEM;
-	for (i = 0; i < AVTAB_SIZE; i++)
-		h->htable[i] = NULL;
+	memset(h->htable, 0, sizeof(*(h->htable)) * nslot);
 	h->nel = 0;
+	h->nslot = nslot;
+	h->mask = nslot - 1;
 	return 0;
 }
 
+/*
+ * avtab_mark_types - note in @src and @tgt, bitmaps indexed by type
+ * value - 1, every type or attribute that is the source or target of
+ * an access vector rule in @h.  Values beyond @nprim are ignored.
+ */
+void avtab_mark_types(struct avtab *h, u32 nprim,
+		      unsigned long *src, unsigned long *tgt)
+{
+	struct avtab_node *cur;
+	int i;
+
+	for (i = 0; i < h->nslot; i++) {
+		for (cur = h->htable[i]; cur; cur = cur->next) {
+			if (!(cur->key.specified & AVTAB_AV))
+				continue;
+			if (cur->key.source_type &&
+			    cur->key.source_type <= nprim)
+				__set_bit(cur->key.source_type - 1, src);
+			if (cur->key.target_type &&
+			    cur->key.target_type <= nprim)
+				__set_bit(cur->key.target_type - 1, tgt);
+		}
+	}
+}
+
 void avtab_hash_eval(struct avtab *h, char *tag)
 {
 	int i, chain_len, slots_used, max_chain_len;
@@ -263,7 +314,7 @@ void avtab_hash_eval(struct avtab *h, char *tag)
 
 	slots_used = 0;
 	max_chain_len = 0;
-	for (i = 0; i < AVTAB_SIZE; i++) {
+	for (i = 0; i < h->nslot; i++) {
 		cur = h->htable[i];
 		if (cur) {
 			slots_used++;
@@ -279,7 +330,7 @@ void avtab_hash_eval(struct avtab *h, char *tag)
 	}
 
 	printk(KERN_INFO "%s:  %d entries and %d/%d buckets used, longest "
-	       "chain length %d\n", tag, h->nel, slots_used, AVTAB_SIZE,
+	       "chain length %d\n", tag, h->nel, slots_used, h->nslot,
 	       max_chain_len);
 }
 
@@ -420,6 +471,11 @@ int avtab_read(struct avtab *a, void *fp, u32 vers)
 		rc = -EINVAL;
 		goto bad;
 	}
+
+	rc = avtab_alloc(a, nel);
+	if (rc)
+		goto bad;
+
 	for (i = 0; i < nel; i++) {
 		rc = avtab_read_item(fp,vers, a, avtab_insertf, NULL);
 		if (rc) {
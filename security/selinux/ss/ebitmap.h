@@ -67,6 +67,54 @@ static inline int ebitmap_node_get_bit(struct ebitmap_node * n,
 #define ebitmap_for_each_bit(e, n, bit) \
 	for (bit = ebitmap_start(e, &n); bit < ebitmap_length(e); bit = ebitmap_next(&n, bit)) \
 
+/* The lowest set bit of a non-zero map, a word at a time */
+static inline unsigned int ebitmap_map_ffs(MAPTYPE map)
+{
+	if ((u32)map)
+		return __ffs((u32)map);
+	return 32 + __ffs((u32)(map >> 32));
+}
+
+/* The first set bit at or after node *n, or ebitmap_length(e) */
+static inline unsigned int ebitmap_node_first(struct ebitmap *e,
+					      struct ebitmap_node **n)
+{
+	for (; *n; *n = (*n)->next)
+		if ((*n)->map)
+			return (*n)->startbit + ebitmap_map_ffs((*n)->map);
+	return ebitmap_length(e);
+}
+
+static inline unsigned int ebitmap_start_positive(struct ebitmap *e,
+						  struct ebitmap_node **n)
+{
+	*n = e->node;
+	return ebitmap_node_first(e, n);
+}
+
+static inline unsigned int ebitmap_next_positive(struct ebitmap *e,
+						 struct ebitmap_node **n,
+						 unsigned int bit)
+{
+	unsigned int ofs = bit - (*n)->startbit + 1;
+	MAPTYPE map = 0;
+
+	if (ofs < MAPSIZE)
+		map = (*n)->map & (~(MAPTYPE)0 << ofs);
+	if (map)
+		return (*n)->startbit + ebitmap_map_ffs(map);
+	*n = (*n)->next;
+	return ebitmap_node_first(e, n);
+}
+
+/*
+ * Visit only the set bits, skipping clear ones a word at a time rather
+ * than testing each with ebitmap_node_get_bit().
+ */
+#define ebitmap_for_each_positive_bit(e, n, bit) \
+	for (bit = ebitmap_start_positive(e, &n); bit < ebitmap_length(e); \
+	     bit = ebitmap_next_positive(e, &n, bit))
+
 int ebitmap_cmp(struct ebitmap *e1, struct ebitmap *e2);
 int ebitmap_cpy(struct ebitmap *dst, struct ebitmap *src);
 int ebitmap_contains(struct ebitmap *e1, struct ebitmap *e2);
@@ -662,6 +662,8 @@ void policydb_destroy(struct policydb *p)
 			ebitmap_destroy(&p->type_attr_map[i]);
 	}
 	kfree(p->type_attr_map);
+	kfree(p->type_av_source);
+	kfree(p->type_av_target);
 
 	return;
 }
@@ -1871,6 +1873,21 @@ int policydb_read(struct policydb *p, void *fp)
 				goto bad;
 	}
 
+	/*
+	 * Most attributes only ever appear on one side of the rules;
+	 * security_compute_av() skips the pairs that cannot match.
+	 */
+	p->type_av_source = kcalloc(BITS_TO_LONGS(p->p_types.nprim),
+				    sizeof(unsigned long), GFP_KERNEL);
+	p->type_av_target = kcalloc(BITS_TO_LONGS(p->p_types.nprim),
+				    sizeof(unsigned long), GFP_KERNEL);
+	if (!p->type_av_source || !p->type_av_target)
+		goto bad;
+	avtab_mark_types(&p->te_avtab, p->p_types.nprim,
+			 p->type_av_source, p->type_av_target);
+	avtab_mark_types(&p->te_cond_avtab, p->p_types.nprim,
+			 p->type_av_source, p->type_av_target);
+
 	rc = 0;
 out:
 	return rc;
@@ -240,6 +240,13 @@ struct policydb {
 	/* type -> attribute reverse mapping */
 	struct ebitmap *type_attr_map;
 
+	/*
+	 * types and attributes that are the source, or the target, of
+	 * some access vector rule; bitmaps indexed by value - 1
+	 */
+	unsigned long *type_av_source;
+	unsigned long *type_av_target;
+
 	unsigned int policyvers;
 };
 